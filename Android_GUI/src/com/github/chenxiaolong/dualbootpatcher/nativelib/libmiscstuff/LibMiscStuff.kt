@@ -20,8 +20,28 @@ package com.github.chenxiaolong.dualbootpatcher.nativelib.libmiscstuff
 import java.io.IOException
 
 object LibMiscStuff {
+    interface ExtractArchiveListener {
+        fun onProgressUpdated(bytes: Long, maxBytes: Long)
+
+        fun isCancelled(): Boolean
+    }
+
+    @Throws(IOException::class)
+    fun extractArchive(filename: String, target: String) {
+        extractArchive(filename, target, null)
+    }
+
+    /**
+     * Extract an archive into a directory
+     *
+     * Zip archives are extracted on multiple threads. The listener is called
+     * on the calling thread.
+     *
+     * @return False if the extraction was cancelled by the listener
+     */
     @Throws(IOException::class)
-    external fun extractArchive(filename: String, target: String)
+    external fun extractArchive(filename: String, target: String,
+                                listener: ExtractArchiveListener?): Boolean
 
     external fun mblogSetLogcat()
 
@@ -22,24 +22,28 @@ public final class FileOpenRequest extends Table {
   public ByteBuffer flagsAsByteBuffer() { return __vector_as_bytebuffer(6, 2); }
   public ByteBuffer flagsInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 6, 2); }
   public long perms() { int o = __offset(8); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public boolean passFd() { int o = __offset(10); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
 
   public static int createFileOpenRequest(FlatBufferBuilder builder,
       int pathOffset,
       int flagsOffset,
-      long perms) {
-    builder.startObject(3);
+      long perms,
+      boolean pass_fd) {
+    builder.startObject(4);
     FileOpenRequest.addPerms(builder, perms);
     FileOpenRequest.addFlags(builder, flagsOffset);
     FileOpenRequest.addPath(builder, pathOffset);
+    FileOpenRequest.addPassFd(builder, pass_fd);
     return FileOpenRequest.endFileOpenRequest(builder);
   }
 
-  public static void startFileOpenRequest(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void startFileOpenRequest(FlatBufferBuilder builder) { builder.startObject(4); }
   public static void addPath(FlatBufferBuilder builder, int pathOffset) { builder.addOffset(0, pathOffset, 0); }
   public static void addFlags(FlatBufferBuilder builder, int flagsOffset) { builder.addOffset(1, flagsOffset, 0); }
   public static int createFlagsVector(FlatBufferBuilder builder, short[] data) { builder.startVector(2, data.length, 2); for (int i = data.length - 1; i >= 0; i--) builder.addShort(data[i]); return builder.endVector(); }
   public static void startFlagsVector(FlatBufferBuilder builder, int numElems) { builder.startVector(2, numElems, 2); }
   public static void addPerms(FlatBufferBuilder builder, long perms) { builder.addInt(2, (int)perms, (int)0L); }
+  public static void addPassFd(FlatBufferBuilder builder, boolean passFd) { builder.addBoolean(3, passFd, false); }
   public static int endFileOpenRequest(FlatBufferBuilder builder) {
     int o = builder.endObject();
     return o;
@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobCancelResponse extends Table {
+  public static JobCancelResponse getRootAsJobCancelResponse(ByteBuffer _bb) { return getRootAsJobCancelResponse(_bb, new JobCancelResponse()); }
+  public static JobCancelResponse getRootAsJobCancelResponse(ByteBuffer _bb, JobCancelResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobCancelResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public boolean success() { int o = __offset(4); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createJobCancelResponse(FlatBufferBuilder builder,
+      boolean success) {
+    builder.startObject(1);
+    JobCancelResponse.addSuccess(builder, success);
+    return JobCancelResponse.endJobCancelResponse(builder);
+  }
+
+  public static void startJobCancelResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addSuccess(FlatBufferBuilder builder, boolean success) { builder.addBoolean(0, success, false); }
+  public static int endJobCancelResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
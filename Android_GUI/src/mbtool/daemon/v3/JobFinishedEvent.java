@@ -0,0 +1,46 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobFinishedEvent extends Table {
+  public static JobFinishedEvent getRootAsJobFinishedEvent(ByteBuffer _bb) { return getRootAsJobFinishedEvent(_bb, new JobFinishedEvent()); }
+  public static JobFinishedEvent getRootAsJobFinishedEvent(ByteBuffer _bb, JobFinishedEvent obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobFinishedEvent __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public boolean cancelled() { int o = __offset(6); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+  public int response(int j) { int o = __offset(8); return o != 0 ? bb.get(__vector(o) + j * 1) & 0xFF : 0; }
+  public int responseLength() { int o = __offset(8); return o != 0 ? __vector_len(o) : 0; }
+  public ByteBuffer responseAsByteBuffer() { return __vector_as_bytebuffer(8, 1); }
+  public ByteBuffer responseInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 8, 1); }
+
+  public static int createJobFinishedEvent(FlatBufferBuilder builder,
+      long job_id,
+      boolean cancelled,
+      int responseOffset) {
+    builder.startObject(3);
+    JobFinishedEvent.addResponse(builder, responseOffset);
+    JobFinishedEvent.addJobId(builder, job_id);
+    JobFinishedEvent.addCancelled(builder, cancelled);
+    return JobFinishedEvent.endJobFinishedEvent(builder);
+  }
+
+  public static void startJobFinishedEvent(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addInt(0, (int)jobId, (int)0L); }
+  public static void addCancelled(FlatBufferBuilder builder, boolean cancelled) { builder.addBoolean(1, cancelled, false); }
+  public static void addResponse(FlatBufferBuilder builder, int responseOffset) { builder.addOffset(2, responseOffset, 0); }
+  public static int createResponseVector(FlatBufferBuilder builder, byte[] data) { builder.startVector(1, data.length, 1); for (int i = data.length - 1; i >= 0; i--) builder.addByte(data[i]); return builder.endVector(); }
+  public static void startResponseVector(FlatBufferBuilder builder, int numElems) { builder.startVector(1, numElems, 1); }
+  public static int endJobFinishedEvent(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,53 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobProgressEvent extends Table {
+  public static JobProgressEvent getRootAsJobProgressEvent(ByteBuffer _bb) { return getRootAsJobProgressEvent(_bb, new JobProgressEvent()); }
+  public static JobProgressEvent getRootAsJobProgressEvent(ByteBuffer _bb, JobProgressEvent obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobProgressEvent __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public long elapsedMs() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesRead() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesWritten() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long readRate() { int o = __offset(12); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long writeRate() { int o = __offset(14); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createJobProgressEvent(FlatBufferBuilder builder,
+      long job_id,
+      long elapsed_ms,
+      long bytes_read,
+      long bytes_written,
+      long read_rate,
+      long write_rate) {
+    builder.startObject(6);
+    JobProgressEvent.addWriteRate(builder, write_rate);
+    JobProgressEvent.addReadRate(builder, read_rate);
+    JobProgressEvent.addBytesWritten(builder, bytes_written);
+    JobProgressEvent.addBytesRead(builder, bytes_read);
+    JobProgressEvent.addElapsedMs(builder, elapsed_ms);
+    JobProgressEvent.addJobId(builder, job_id);
+    return JobProgressEvent.endJobProgressEvent(builder);
+  }
+
+  public static void startJobProgressEvent(FlatBufferBuilder builder) { builder.startObject(6); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addInt(0, (int)jobId, (int)0L); }
+  public static void addElapsedMs(FlatBufferBuilder builder, long elapsedMs) { builder.addLong(1, elapsedMs, 0L); }
+  public static void addBytesRead(FlatBufferBuilder builder, long bytesRead) { builder.addLong(2, bytesRead, 0L); }
+  public static void addBytesWritten(FlatBufferBuilder builder, long bytesWritten) { builder.addLong(3, bytesWritten, 0L); }
+  public static void addReadRate(FlatBufferBuilder builder, long readRate) { builder.addLong(4, readRate, 0L); }
+  public static void addWriteRate(FlatBufferBuilder builder, long writeRate) { builder.addLong(5, writeRate, 0L); }
+  public static int endJobProgressEvent(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
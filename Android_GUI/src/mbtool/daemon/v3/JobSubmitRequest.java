@@ -0,0 +1,34 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobSubmitRequest extends Table {
+  public static JobSubmitRequest getRootAsJobSubmitRequest(ByteBuffer _bb) { return getRootAsJobSubmitRequest(_bb, new JobSubmitRequest()); }
+  public static JobSubmitRequest getRootAsJobSubmitRequest(ByteBuffer _bb, JobSubmitRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobSubmitRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public Request request() { return request(new Request()); }
+  public Request request(Request obj) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createJobSubmitRequest(FlatBufferBuilder builder,
+      int requestOffset) {
+    builder.startObject(1);
+    JobSubmitRequest.addRequest(builder, requestOffset);
+    return JobSubmitRequest.endJobSubmitRequest(builder);
+  }
+
+  public static void startJobSubmitRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addRequest(FlatBufferBuilder builder, int requestOffset) { builder.addOffset(0, requestOffset, 0); }
+  public static int endJobSubmitRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,39 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class JobSubmitResponse extends Table {
+  public static JobSubmitResponse getRootAsJobSubmitResponse(ByteBuffer _bb) { return getRootAsJobSubmitResponse(_bb, new JobSubmitResponse()); }
+  public static JobSubmitResponse getRootAsJobSubmitResponse(ByteBuffer _bb, JobSubmitResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public JobSubmitResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public long jobId() { int o = __offset(4); return o != 0 ? (long)bb.getInt(o + bb_pos) & 0xFFFFFFFFL : 0L; }
+  public String errorMsg() { int o = __offset(6); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer errorMsgAsByteBuffer() { return __vector_as_bytebuffer(6, 1); }
+  public ByteBuffer errorMsgInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 6, 1); }
+
+  public static int createJobSubmitResponse(FlatBufferBuilder builder,
+      long job_id,
+      int error_msgOffset) {
+    builder.startObject(2);
+    JobSubmitResponse.addErrorMsg(builder, error_msgOffset);
+    JobSubmitResponse.addJobId(builder, job_id);
+    return JobSubmitResponse.endJobSubmitResponse(builder);
+  }
+
+  public static void startJobSubmitResponse(FlatBufferBuilder builder) { builder.startObject(2); }
+  public static void addJobId(FlatBufferBuilder builder, long jobId) { builder.addInt(0, (int)jobId, (int)0L); }
+  public static void addErrorMsg(FlatBufferBuilder builder, int errorMsgOffset) { builder.addOffset(1, errorMsgOffset, 0); }
+  public static int endJobSubmitResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
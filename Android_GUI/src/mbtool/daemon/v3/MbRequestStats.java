@@ -0,0 +1,59 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbRequestStats extends Table {
+  public static MbRequestStats getRootAsMbRequestStats(ByteBuffer _bb) { return getRootAsMbRequestStats(_bb, new MbRequestStats()); }
+  public static MbRequestStats getRootAsMbRequestStats(ByteBuffer _bb, MbRequestStats obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbRequestStats __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public String name() { int o = __offset(4); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer nameAsByteBuffer() { return __vector_as_bytebuffer(4, 1); }
+  public ByteBuffer nameInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 4, 1); }
+  public long count() { int o = __offset(6); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long latencyP50Us() { int o = __offset(8); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long latencyP99Us() { int o = __offset(10); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long latencyMaxUs() { int o = __offset(12); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesIn() { int o = __offset(14); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+  public long bytesOut() { int o = __offset(16); return o != 0 ? bb.getLong(o + bb_pos) : 0L; }
+
+  public static int createMbRequestStats(FlatBufferBuilder builder,
+      int nameOffset,
+      long count,
+      long latency_p50_us,
+      long latency_p99_us,
+      long latency_max_us,
+      long bytes_in,
+      long bytes_out) {
+    builder.startObject(7);
+    MbRequestStats.addBytesOut(builder, bytes_out);
+    MbRequestStats.addBytesIn(builder, bytes_in);
+    MbRequestStats.addLatencyMaxUs(builder, latency_max_us);
+    MbRequestStats.addLatencyP99Us(builder, latency_p99_us);
+    MbRequestStats.addLatencyP50Us(builder, latency_p50_us);
+    MbRequestStats.addCount(builder, count);
+    MbRequestStats.addName(builder, nameOffset);
+    return MbRequestStats.endMbRequestStats(builder);
+  }
+
+  public static void startMbRequestStats(FlatBufferBuilder builder) { builder.startObject(7); }
+  public static void addName(FlatBufferBuilder builder, int nameOffset) { builder.addOffset(0, nameOffset, 0); }
+  public static void addCount(FlatBufferBuilder builder, long count) { builder.addLong(1, count, 0L); }
+  public static void addLatencyP50Us(FlatBufferBuilder builder, long latencyP50Us) { builder.addLong(2, latencyP50Us, 0L); }
+  public static void addLatencyP99Us(FlatBufferBuilder builder, long latencyP99Us) { builder.addLong(3, latencyP99Us, 0L); }
+  public static void addLatencyMaxUs(FlatBufferBuilder builder, long latencyMaxUs) { builder.addLong(4, latencyMaxUs, 0L); }
+  public static void addBytesIn(FlatBufferBuilder builder, long bytesIn) { builder.addLong(5, bytesIn, 0L); }
+  public static void addBytesOut(FlatBufferBuilder builder, long bytesOut) { builder.addLong(6, bytesOut, 0L); }
+  public static int endMbRequestStats(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
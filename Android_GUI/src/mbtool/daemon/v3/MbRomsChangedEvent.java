@@ -0,0 +1,24 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbRomsChangedEvent extends Table {
+  public static MbRomsChangedEvent getRootAsMbRomsChangedEvent(ByteBuffer _bb) { return getRootAsMbRomsChangedEvent(_bb, new MbRomsChangedEvent()); }
+  public static MbRomsChangedEvent getRootAsMbRomsChangedEvent(ByteBuffer _bb, MbRomsChangedEvent obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbRomsChangedEvent __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+
+  public static void startMbRomsChangedEvent(FlatBufferBuilder builder) { builder.startObject(0); }
+  public static int endMbRomsChangedEvent(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,33 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbWatchRomsRequest extends Table {
+  public static MbWatchRomsRequest getRootAsMbWatchRomsRequest(ByteBuffer _bb) { return getRootAsMbWatchRomsRequest(_bb, new MbWatchRomsRequest()); }
+  public static MbWatchRomsRequest getRootAsMbWatchRomsRequest(ByteBuffer _bb, MbWatchRomsRequest obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbWatchRomsRequest __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public boolean enable() { int o = __offset(4); return o != 0 ? 0!=bb.get(o + bb_pos) : false; }
+
+  public static int createMbWatchRomsRequest(FlatBufferBuilder builder,
+      boolean enable) {
+    builder.startObject(1);
+    MbWatchRomsRequest.addEnable(builder, enable);
+    return MbWatchRomsRequest.endMbWatchRomsRequest(builder);
+  }
+
+  public static void startMbWatchRomsRequest(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addEnable(FlatBufferBuilder builder, boolean enable) { builder.addBoolean(0, enable, false); }
+  public static int endMbWatchRomsRequest(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
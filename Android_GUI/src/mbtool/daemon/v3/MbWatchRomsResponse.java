@@ -0,0 +1,24 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class MbWatchRomsResponse extends Table {
+  public static MbWatchRomsResponse getRootAsMbWatchRomsResponse(ByteBuffer _bb) { return getRootAsMbWatchRomsResponse(_bb, new MbWatchRomsResponse()); }
+  public static MbWatchRomsResponse getRootAsMbWatchRomsResponse(ByteBuffer _bb, MbWatchRomsResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public MbWatchRomsResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+
+  public static void startMbWatchRomsResponse(FlatBufferBuilder builder) { builder.startObject(0); }
+  public static int endMbWatchRomsResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -0,0 +1,45 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyTreeError extends Table {
+  public static PathCopyTreeError getRootAsPathCopyTreeError(ByteBuffer _bb) { return getRootAsPathCopyTreeError(_bb, new PathCopyTreeError()); }
+  public static PathCopyTreeError getRootAsPathCopyTreeError(ByteBuffer _bb, PathCopyTreeError obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyTreeError __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public int errnoValue() { int o = __offset(4); return o != 0 ? bb.getInt(o + bb_pos) : 0; }
+  public String msg() { int o = __offset(6); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer msgAsByteBuffer() { return __vector_as_bytebuffer(6, 1); }
+  public ByteBuffer msgInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 6, 1); }
+  public String path() { int o = __offset(8); return o != 0 ? __string(o + bb_pos) : null; }
+  public ByteBuffer pathAsByteBuffer() { return __vector_as_bytebuffer(8, 1); }
+  public ByteBuffer pathInByteBuffer(ByteBuffer _bb) { return __vector_in_bytebuffer(_bb, 8, 1); }
+
+  public static int createPathCopyTreeError(FlatBufferBuilder builder,
+      int errno_value,
+      int msgOffset,
+      int pathOffset) {
+    builder.startObject(3);
+    PathCopyTreeError.addPath(builder, pathOffset);
+    PathCopyTreeError.addMsg(builder, msgOffset);
+    PathCopyTreeError.addErrnoValue(builder, errno_value);
+    return PathCopyTreeError.endPathCopyTreeError(builder);
+  }
+
+  public static void startPathCopyTreeError(FlatBufferBuilder builder) { builder.startObject(3); }
+  public static void addErrnoValue(FlatBufferBuilder builder, int errnoValue) { builder.addInt(0, errnoValue, 0); }
+  public static void addMsg(FlatBufferBuilder builder, int msgOffset) { builder.addOffset(1, msgOffset, 0); }
+  public static void addPath(FlatBufferBuilder builder, int pathOffset) { builder.addOffset(2, pathOffset, 0); }
+  public static int endPathCopyTreeError(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
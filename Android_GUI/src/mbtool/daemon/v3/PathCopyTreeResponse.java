@@ -0,0 +1,34 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+package mbtool.daemon.v3;
+
+import java.nio.*;
+import java.lang.*;
+import java.util.*;
+import com.google.flatbuffers.*;
+
+@SuppressWarnings("unused")
+public final class PathCopyTreeResponse extends Table {
+  public static PathCopyTreeResponse getRootAsPathCopyTreeResponse(ByteBuffer _bb) { return getRootAsPathCopyTreeResponse(_bb, new PathCopyTreeResponse()); }
+  public static PathCopyTreeResponse getRootAsPathCopyTreeResponse(ByteBuffer _bb, PathCopyTreeResponse obj) { _bb.order(ByteOrder.LITTLE_ENDIAN); return (obj.__assign(_bb.getInt(_bb.position()) + _bb.position(), _bb)); }
+  public void __init(int _i, ByteBuffer _bb) { bb_pos = _i; bb = _bb; }
+  public PathCopyTreeResponse __assign(int _i, ByteBuffer _bb) { __init(_i, _bb); return this; }
+
+  public PathCopyTreeError error() { return error(new PathCopyTreeError()); }
+  public PathCopyTreeError error(PathCopyTreeError obj) { int o = __offset(4); return o != 0 ? obj.__assign(__indirect(o + bb_pos), bb) : null; }
+
+  public static int createPathCopyTreeResponse(FlatBufferBuilder builder,
+      int errorOffset) {
+    builder.startObject(1);
+    PathCopyTreeResponse.addError(builder, errorOffset);
+    return PathCopyTreeResponse.endPathCopyTreeResponse(builder);
+  }
+
+  public static void startPathCopyTreeResponse(FlatBufferBuilder builder) { builder.startObject(1); }
+  public static void addError(FlatBufferBuilder builder, int errorOffset) { builder.addOffset(0, errorOffset, 0); }
+  public static int endPathCopyTreeResponse(FlatBufferBuilder builder) {
+    int o = builder.endObject();
+    return o;
+  }
+}
+
@@ -17,11 +17,20 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include <cassert>
 #include <climits>
@@ -141,7 +150,7 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "Pass -h/--help as a argument to a command to see its available options.\n"
 
 #define HELP_UNPACK_USAGE \
-    "Usage: bootimgtool unpack <input file> [<option>...]\n" \
+    "Usage: bootimgtool unpack <input file>... [<option>...]\n" \
     "\n" \
     "Options:\n" \
     "  -o, --output <output directory>\n" \
@@ -153,6 +162,10 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "  -t, --type <type>\n" \
     "                  Input type of the boot image (autodetect if unspecified)\n" \
     "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "  -j, --jobs <N>  Number of entries to extract concurrently (default: 1)\n" \
+    "  --batch         Unpack every <input file> given on the command line\n" \
+    "                  (cannot be used with -p/--prefix, -n/--noprefix, or\n" \
+    "                  --output-<item>)\n" \
     "  --output-<item> <item path>\n" \
     "                  Custom path for a particular item\n" \
     "\n" \
@@ -190,10 +203,14 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "2. Unpack a boot image to a different directory, but put the kernel in /tmp/\n" \
     "\n" \
     "        bootimgtool unpack boot.img -o extracted --output-kernel /tmp/kernel.img\n" \
+    "\n" \
+    "3. Unpack many boot images to a directory using 8 threads\n" \
+    "\n" \
+    "        bootimgtool unpack --batch -j 8 -o extracted *.img\n" \
     "\n"
 
 #define HELP_PACK_USAGE \
-    "Usage: bootimgtool pack <output file> [<option>...]\n" \
+    "Usage: bootimgtool pack <output file>... [<option>...]\n" \
     "\n" \
     "Options:\n" \
     "  -i, --input <input directory>\n" \
@@ -205,6 +222,10 @@ typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
     "  -t, --type <type>\n" \
     "                  Output type of the boot image (use header.json if unspecified)\n" \
     "                  (one of: android, bump, loki, mtk, sony_elf)\n" \
+    "  -j, --jobs <N>  Number of input files to load concurrently (default: 1)\n" \
+    "  --batch         Pack every <output file> given on the command line\n" \
+    "                  (cannot be used with -p/--prefix, -n/--noprefix, or\n" \
+    "                  --input-<item>)\n" \
     "  --input-<item> <item path>\n" \
     "                  Custom path for a particular item\n" \
     "\n" \
@@ -534,9 +555,13 @@ static bool write_header(const std::string &path, const Header &header)
     bool failed =
             !writer.StartObject()
             || (cmdline && !cmdline->empty()
-                    && !(writer.Key(FIELD_CMDLINE) && writer.String(*cmdline)))
+                    && !(writer.Key(FIELD_CMDLINE)
+                    && writer.String(cmdline->data(),
+                                     static_cast<rj::SizeType>(cmdline->size()))))
             || (board_name && !board_name->empty()
-                    && !(writer.Key(FIELD_BOARD) && writer.String(*board_name)))
+                    && !(writer.Key(FIELD_BOARD)
+                    && writer.String(board_name->data(),
+                                     static_cast<rj::SizeType>(board_name->size()))))
             || (base
                     && !(writer.Key(FIELD_BASE) && writer.Uint(*base)))
             || (kernel_offset
@@ -576,12 +601,126 @@ static bool write_header(const std::string &path, const Header &header)
     return true;
 }
 
-static bool write_data_file_to_entry(const std::string &path, Writer &writer)
+/*!
+ * \brief Simple pool of worker threads
+ *
+ * Tasks may submit more tasks. run() returns once every task has finished.
+ */
+class TaskPool
+{
+public:
+    explicit TaskPool(unsigned int jobs) : m_jobs(jobs), m_active(0)
+    {
+    }
+
+    void submit(std::function<void()> task)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+        m_cv.notify_one();
+    }
+
+    void run()
+    {
+        std::vector<std::thread> threads;
+
+        // The calling thread is one of the workers
+        for (unsigned int i = 1; i < m_jobs; ++i) {
+            threads.emplace_back(&TaskPool::worker, this);
+        }
+
+        worker();
+
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+private:
+    void worker()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (true) {
+            m_cv.wait(lock, [&] {
+                return !m_tasks.empty() || m_active == 0;
+            });
+
+            if (m_tasks.empty()) {
+                // Nothing is running, so nothing can be submitted anymore
+                m_cv.notify_all();
+                return;
+            }
+
+            auto task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+            ++m_active;
+
+            lock.unlock();
+            task();
+            lock.lock();
+
+            --m_active;
+            m_cv.notify_all();
+        }
+    }
+
+    unsigned int m_jobs;
+    unsigned int m_active;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+};
+
+static const std::string * entry_path(const Paths &paths, int type)
+{
+    switch (type) {
+    case ENTRY_TYPE_KERNEL:
+        return &paths.kernel;
+    case ENTRY_TYPE_RAMDISK:
+        return &paths.ramdisk;
+    case ENTRY_TYPE_SECONDBOOT:
+        return &paths.second;
+    case ENTRY_TYPE_DEVICE_TREE:
+        return &paths.dt;
+    case ENTRY_TYPE_ABOOT:
+        return &paths.aboot;
+    case ENTRY_TYPE_MTK_KERNEL_HEADER:
+        return &paths.kernel_mtkhdr;
+    case ENTRY_TYPE_MTK_RAMDISK_HEADER:
+        return &paths.ramdisk_mtkhdr;
+    case ENTRY_TYPE_SONY_IPL:
+        return &paths.ipl;
+    case ENTRY_TYPE_SONY_RPM:
+        return &paths.rpm;
+    case ENTRY_TYPE_SONY_APPSBL:
+        return &paths.appsbl;
+    default:
+        return nullptr;
+    }
+}
+
+static constexpr int ALL_ENTRY_TYPES[] = {
+    ENTRY_TYPE_KERNEL,
+    ENTRY_TYPE_RAMDISK,
+    ENTRY_TYPE_SECONDBOOT,
+    ENTRY_TYPE_DEVICE_TREE,
+    ENTRY_TYPE_ABOOT,
+    ENTRY_TYPE_MTK_KERNEL_HEADER,
+    ENTRY_TYPE_MTK_RAMDISK_HEADER,
+    ENTRY_TYPE_SONY_IPL,
+    ENTRY_TYPE_SONY_RPM,
+    ENTRY_TYPE_SONY_APPSBL,
+};
+
+static bool load_file(const std::string &path,
+                      std::optional<std::vector<unsigned char>> &data)
 {
     ScopedFILE fp(fopen(path.c_str(), "rb" CLOEXEC_FLAG), fclose);
     if (!fp) {
         // Entries are optional
         if (errno == ENOENT) {
+            data = std::nullopt;
             return true;
         } else {
             fprintf(stderr, "%s: Failed to open for reading: %s\n",
@@ -590,23 +729,20 @@ static bool write_data_file_to_entry(const std::string &path, Writer &writer)
         }
     }
 
+    data.emplace();
+
     char buf[10240];
     size_t n;
 
     while (true) {
         n = fread(buf, 1, sizeof(buf), fp.get());
-
-        auto bytes_written = writer.write_data(buf, n);
-        if (!bytes_written) {
-            fprintf(stderr, "Failed to write entry data: %s\n",
-                    bytes_written.error().message().c_str());
-            return false;
-        }
+        data->insert(data->end(), buf, buf + n);
 
         if (n < sizeof(buf)) {
             if (ferror(fp.get())) {
                 fprintf(stderr, "%s: Failed to read file: %s\n",
                         path.c_str(), strerror(errno));
+                return false;
             } else {
                 break;
             }
@@ -616,7 +752,8 @@ static bool write_data_file_to_entry(const std::string &path, Writer &writer)
     return true;
 }
 
-static bool write_data_entry_to_file(const std::string &path, Reader &reader)
+static bool write_entry_to_file(const std::string &path, Reader &reader,
+                                const EntryInfo &info)
 {
     ScopedFILE fp(fopen(path.c_str(), "wb" CLOEXEC_FLAG), fclose);
     if (!fp) {
@@ -625,23 +762,29 @@ static bool write_data_entry_to_file(const std::string &path, Reader &reader)
         return false;
     }
 
-    char buf[10240];
+    std::vector<unsigned char> buf(256 * 1024);
+    uint64_t offset = 0;
 
-    while (true) {
-        auto n = reader.read_data(buf, sizeof(buf));
+    while (offset < info.size) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(info.size - offset, buf.size()));
+
+        auto n = reader.read_entry_at(info.type, offset, buf.data(), to_read);
         if (!n) {
-            fprintf(stderr, "Failed to read entry data: %s\n",
-                    n.error().message().c_str());
+            fprintf(stderr, "%s: Failed to read entry data: %s\n",
+                    path.c_str(), n.error().message().c_str());
             return false;
         } else if (n.value() == 0) {
             break;
         }
 
-        if (fwrite(buf, 1, n.value(), fp.get()) != n.value()) {
+        if (fwrite(buf.data(), 1, n.value(), fp.get()) != n.value()) {
             fprintf(stderr, "%s: Failed to write data: %s\n",
                     path.c_str(), strerror(errno));
             return false;
         }
+
+        offset += n.value();
     }
 
     if (fclose(fp.release()) < 0) {
@@ -653,120 +796,254 @@ static bool write_data_entry_to_file(const std::string &path, Reader &reader)
     return true;
 }
 
-static bool write_file_to_entry(const Paths &paths, Writer &writer,
-                                const Entry &entry)
+/*!
+ * \brief Unpack a boot image
+ *
+ * The header is written immediately and a task is submitted to \p pool for
+ * each entry. The entries are read with positional reads, so they can be
+ * extracted concurrently through the same Reader.
+ */
+static void unpack_image(TaskPool &pool, std::atomic_bool &failed,
+                         const std::string &input_file, const Paths &paths,
+                         const char *type)
 {
-    std::string path;
+    auto reader = std::make_shared<Reader>();
+    Header header;
 
-    auto type = entry.type();
+    if (type) {
+        auto ret = reader->enable_format_by_name(type);
+        if (!ret) {
+            fprintf(stderr, "Failed to enable format '%s': %s\n",
+                    type, ret.error().message().c_str());
+            failed = true;
+            return;
+        }
+    } else {
+        auto ret = reader->enable_format_all();
+        if (!ret) {
+            fprintf(stderr, "Failed to enable all formats: %s\n",
+                    ret.error().message().c_str());
+            failed = true;
+            return;
+        }
+    }
 
-    if (!type) {
-        fprintf(stderr, "No entry type set!\n");
+    auto ret = reader->open_filename(input_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_file.c_str(), ret.error().message().c_str());
+        failed = true;
+        return;
+    }
+
+    ret = reader->read_header(header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                input_file.c_str(), ret.error().message().c_str());
+        failed = true;
+        return;
+    }
+
+    if (!write_header(paths.header, header)) {
+        failed = true;
+        return;
+    }
+
+    auto entries = reader->entries();
+    if (!entries) {
+        fprintf(stderr, "%s: Failed to read entries: %s\n",
+                input_file.c_str(), entries.error().message().c_str());
+        failed = true;
+        return;
+    }
+
+    for (auto const &info : entries.value()) {
+        auto path = entry_path(paths, info.type);
+        if (!path) {
+            fprintf(stderr, "%s: Unknown entry type: %d\n",
+                    input_file.c_str(), info.type);
+            failed = true;
+            return;
+        }
+
+        auto task = [&failed, reader, path = *path, info] {
+            if (!write_entry_to_file(path, *reader, info)) {
+                failed = true;
+            }
+        };
+
+#ifdef _WIN32
+        // Win32File emulates positional reads with seeks, which is not safe
+        // to do concurrently on the same handle
+        task();
+#else
+        pool.submit(std::move(task));
+#endif
+    }
+}
+
+struct PackJob
+{
+    std::string output_file;
+    Paths paths;
+    std::string type;
+    std::unordered_map<int, std::optional<std::vector<unsigned char>>> data;
+    std::atomic_size_t remaining;
+    std::atomic_bool failed;
+};
+
+static bool write_packed_image(PackJob &job)
+{
+    Writer writer;
+    Header header;
+    Entry entry;
+
+    if (!writer.set_format_by_name(job.type)) {
+        fprintf(stderr, "Invalid boot image type: %s\n", job.type.c_str());
         return false;
     }
 
-    switch (*type) {
-    case ENTRY_TYPE_KERNEL:
-        path = paths.kernel;
-        break;
-    case ENTRY_TYPE_RAMDISK:
-        path = paths.ramdisk;
-        break;
-    case ENTRY_TYPE_SECONDBOOT:
-        path = paths.second;
-        break;
-    case ENTRY_TYPE_DEVICE_TREE:
-        path = paths.dt;
-        break;
-    case ENTRY_TYPE_ABOOT:
-        path = paths.aboot;
-        break;
-    case ENTRY_TYPE_MTK_KERNEL_HEADER:
-        path = paths.kernel_mtkhdr;
-        break;
-    case ENTRY_TYPE_MTK_RAMDISK_HEADER:
-        path = paths.ramdisk_mtkhdr;
-        break;
-    case ENTRY_TYPE_SONY_IPL:
-        path = paths.ipl;
-        break;
-    case ENTRY_TYPE_SONY_RPM:
-        path = paths.rpm;
-        break;
-    case ENTRY_TYPE_SONY_APPSBL:
-        path = paths.appsbl;
-        break;
-    default:
-        fprintf(stderr, "Unknown entry type: %d\n", *type);
+    auto ret = writer.open_filename(job.output_file);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                job.output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    ret = writer.get_header(header);
+    if (!ret) {
+        fprintf(stderr, "Failed to get header instance: %s\n",
+                ret.error().message().c_str());
+        return false;
+    }
+
+    if (!read_header(job.paths.header, header)) {
         return false;
     }
 
-    auto ret = writer.write_entry(entry);
+    ret = writer.write_header(header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                job.output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    while (true) {
+        ret = writer.get_entry(entry);
+        if (!ret) {
+            if (ret.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "Failed to get next entry: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+
+        auto type = entry.type();
+        if (!type) {
+            fprintf(stderr, "No entry type set!\n");
+            return false;
+        }
+
+        auto it = job.data.find(*type);
+        if (it == job.data.end()) {
+            fprintf(stderr, "Unknown entry type: %d\n", *type);
+            return false;
+        }
+
+        ret = writer.write_entry(entry);
+        if (!ret) {
+            fprintf(stderr, "Failed to write entry: %s\n",
+                    ret.error().message().c_str());
+            return false;
+        }
+
+        if (auto const &data = it->second) {
+            auto n = writer.write_data(data->data(), data->size());
+            if (!n) {
+                fprintf(stderr, "Failed to write entry data: %s\n",
+                        n.error().message().c_str());
+                return false;
+            }
+        }
+    }
+
+    ret = writer.close();
     if (!ret) {
-        fprintf(stderr, "Failed to write entry: %s\n",
+        fprintf(stderr, "Failed to close boot image: %s\n",
                 ret.error().message().c_str());
         return false;
     }
 
-    return write_data_file_to_entry(path, writer);
+    return true;
 }
 
-static bool write_entry_to_file(const Paths &paths, Reader &reader,
-                                const Entry &entry)
+/*!
+ * \brief Pack a boot image
+ *
+ * A task is submitted to \p pool to load each input file. The task that loads
+ * the last file then writes the boot image.
+ */
+static void pack_image(TaskPool &pool, std::atomic_bool &failed,
+                       const std::string &output_file, const Paths &paths,
+                       const char *type)
 {
-    std::string path;
+    auto job = std::make_shared<PackJob>();
+    job->output_file = output_file;
+    job->paths = paths;
+    job->type = type;
+    job->remaining = std::size(ALL_ENTRY_TYPES);
+    job->failed = false;
+
+    // Create the slots up front so that the tasks never modify the map
+    for (int entry_type : ALL_ENTRY_TYPES) {
+        job->data[entry_type];
+    }
 
-    auto type = entry.type();
+    for (int entry_type : ALL_ENTRY_TYPES) {
+        pool.submit([&failed, job, entry_type] {
+            if (!load_file(*entry_path(job->paths, entry_type),
+                           job->data.at(entry_type))) {
+                job->failed = true;
+            }
 
-    if (!type) {
-        fprintf(stderr, "No entry type set!\n");
-        return false;
+            if (--job->remaining > 0) {
+                return;
+            }
+
+            if (job->failed || !write_packed_image(*job)) {
+                failed = true;
+            }
+        });
     }
+}
 
-    switch (*type) {
-    case ENTRY_TYPE_KERNEL:
-        path = paths.kernel;
-        break;
-    case ENTRY_TYPE_RAMDISK:
-        path = paths.ramdisk;
-        break;
-    case ENTRY_TYPE_SECONDBOOT:
-        path = paths.second;
-        break;
-    case ENTRY_TYPE_DEVICE_TREE:
-        path = paths.dt;
-        break;
-    case ENTRY_TYPE_ABOOT:
-        path = paths.aboot;
-        break;
-    case ENTRY_TYPE_MTK_KERNEL_HEADER:
-        path = paths.kernel_mtkhdr;
-        break;
-    case ENTRY_TYPE_MTK_RAMDISK_HEADER:
-        path = paths.ramdisk_mtkhdr;
-        break;
-    case ENTRY_TYPE_SONY_IPL:
-        path = paths.ipl;
-        break;
-    case ENTRY_TYPE_SONY_RPM:
-        path = paths.rpm;
-        break;
-    case ENTRY_TYPE_SONY_APPSBL:
-        path = paths.appsbl;
-        break;
-    default:
-        fprintf(stderr, "Unknown entry type: %d\n", *type);
+static bool parse_jobs(const char *str, unsigned int &jobs)
+{
+    if (!mb::str_to_num(str, 10, jobs) || jobs == 0) {
+        fprintf(stderr, "Invalid number of jobs: %s\n", str);
         return false;
     }
 
-    return write_data_entry_to_file(path, reader);
+    return true;
+}
+
+static bool has_custom_paths(const Paths &paths)
+{
+    return !paths.header.empty() || !paths.kernel.empty()
+            || !paths.ramdisk.empty() || !paths.second.empty()
+            || !paths.dt.empty() || !paths.aboot.empty()
+            || !paths.kernel_mtkhdr.empty() || !paths.ramdisk_mtkhdr.empty()
+            || !paths.ipl.empty() || !paths.rpm.empty()
+            || !paths.appsbl.empty();
 }
 
 static bool unpack_main(int argc, char *argv[])
 {
     int opt;
     bool no_prefix = false;
-    std::string input_file;
+    bool batch = false;
+    unsigned int jobs = 1;
     std::string output_dir;
     std::string prefix;
     const char *type = nullptr;
@@ -785,9 +1062,10 @@ static bool unpack_main(int argc, char *argv[])
         OPT_OUTPUT_IPL            = 10000 + 8,
         OPT_OUTPUT_RPM            = 10000 + 9,
         OPT_OUTPUT_APPSBL         = 10000 + 10,
+        OPT_BATCH                 = 10000 + 11,
     };
 
-    static const char short_options[] = "o:p:n" "h";
+    static const char short_options[] = "o:p:nt:j:" "h";
 
     static struct option long_options[] = {
         // Arguments with short versions
@@ -795,7 +1073,9 @@ static bool unpack_main(int argc, char *argv[])
         {"prefix",                required_argument, nullptr, 'p'},
         {"noprefix",              required_argument, nullptr, 'n'},
         {"type",                  required_argument, nullptr, 't'},
+        {"jobs",                  required_argument, nullptr, 'j'},
         // Arguments without short versions
+        {"batch",                 no_argument,       nullptr, OPT_BATCH},
         {"output-header",         required_argument, nullptr, OPT_OUTPUT_HEADER},
         {"output-kernel",         required_argument, nullptr, OPT_OUTPUT_KERNEL},
         {"output-ramdisk",        required_argument, nullptr, OPT_OUTPUT_RAMDISK},
@@ -820,6 +1100,7 @@ static bool unpack_main(int argc, char *argv[])
         case 'p':                       prefix = optarg;               break;
         case 'n':                       no_prefix = true;              break;
         case 't':                       type = optarg;                 break;
+        case OPT_BATCH:                 batch = true;                  break;
         case OPT_OUTPUT_HEADER:         paths.header = optarg;         break;
         case OPT_OUTPUT_KERNEL:         paths.kernel = optarg;         break;
         case OPT_OUTPUT_RAMDISK:        paths.ramdisk = optarg;        break;
@@ -831,6 +1112,12 @@ static bool unpack_main(int argc, char *argv[])
         case OPT_OUTPUT_RPM:            paths.rpm = optarg;            break;
         case OPT_OUTPUT_APPSBL:         paths.appsbl = optarg;         break;
 
+        case 'j':
+            if (!parse_jobs(optarg, jobs)) {
+                return false;
+            }
+            break;
+
         case 'h':
             fputs(HELP_UNPACK_USAGE, stdout);
             return true;
@@ -841,96 +1128,61 @@ static bool unpack_main(int argc, char *argv[])
         }
     }
 
-    // There should be one other arguments
-    if (argc - optind != 1) {
+    // There should be one other argument unless in batch mode
+    if (batch ? argc - optind < 1 : argc - optind != 1) {
         fputs(HELP_UNPACK_USAGE, stderr);
         return false;
     }
 
-    input_file = argv[optind];
-
-    if (no_prefix) {
-        prefix.clear();
-    } else if (prefix.empty()) {
-        prefix = mb::io::base_name(input_file);
-        prefix += "-";
+    if (batch && (no_prefix || !prefix.empty() || has_custom_paths(paths))) {
+        fprintf(stderr, "Prefixes and custom paths cannot be used with "
+                        "--batch\n");
+        return false;
     }
 
     if (output_dir.empty()) {
         output_dir = ".";
     }
 
-    prepend_if_empty(paths, output_dir, prefix);
-
     if (auto r = mb::io::create_directories(output_dir); !r) {
         fprintf(stderr, "%s: Failed to create directory: %s\n",
                 output_dir.c_str(), r.error().message().c_str());
         return false;
     }
 
-    // Load the boot image
-    Reader reader;
-    Header header;
-    Entry entry;
+    TaskPool pool(jobs);
+    std::atomic_bool failed{false};
 
-    if (type) {
-        auto ret = reader.enable_format_by_name(type);
-        if (!ret) {
-            fprintf(stderr, "Failed to enable format '%s': %s\n",
-                    type, ret.error().message().c_str());
-            return false;
-        }
-    } else {
-        auto ret = reader.enable_format_all();
-        if (!ret) {
-            fprintf(stderr, "Failed to enable all formats: %s\n",
-                    ret.error().message().c_str());
-            return false;
+    for (int i = optind; i < argc; ++i) {
+        std::string input_file = argv[i];
+        std::string image_prefix = prefix;
+        Paths image_paths = paths;
+
+        if (no_prefix) {
+            image_prefix.clear();
+        } else if (image_prefix.empty()) {
+            image_prefix = mb::io::base_name(input_file);
+            image_prefix += "-";
         }
-    }
 
-    auto ret = reader.open_filename(input_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open for reading: %s\n",
-                input_file.c_str(), ret.error().message().c_str());
-        return false;
-    }
+        prepend_if_empty(image_paths, output_dir, image_prefix);
 
-    ret = reader.read_header(header);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                input_file.c_str(), ret.error().message().c_str());
-        return false;
+        pool.submit([&, input_file, image_paths] {
+            unpack_image(pool, failed, input_file, image_paths, type);
+        });
     }
 
-    if (!write_header(paths.header, header)) {
-        return false;
-    }
-
-    while (true) {
-        ret = reader.read_entry(entry);
-        if (!ret) {
-            if (ret.error() == ReaderError::EndOfEntries) {
-                break;
-            }
-            fprintf(stderr, "Failed to read entry: %s\n",
-                    ret.error().message().c_str());
-            return false;
-        }
-
-        if (!write_entry_to_file(paths, reader, entry)) {
-            return false;
-        }
-    }
+    pool.run();
 
-    return true;
+    return !failed;
 }
 
 static bool pack_main(int argc, char *argv[])
 {
     int opt;
     bool no_prefix = false;
-    std::string output_file;
+    bool batch = false;
+    unsigned int jobs = 1;
     std::string input_dir;
     std::string prefix;
     const char *type = FORMAT_NAME_ANDROID;
@@ -951,9 +1203,10 @@ static bool pack_main(int argc, char *argv[])
         OPT_INPUT_IPL            = 10000 + 9,
         OPT_INPUT_RPM            = 10000 + 10,
         OPT_INPUT_APPSBL         = 10000 + 11,
+        OPT_BATCH                = 10000 + 12,
     };
 
-    static const char short_options[] = "i:p:nt:" "h";
+    static const char short_options[] = "i:p:nt:j:" "h";
 
     static struct option long_options[] = {
         // Arguments with short versions
@@ -961,7 +1214,9 @@ static bool pack_main(int argc, char *argv[])
         {"prefix",               required_argument, nullptr, 'p'},
         {"noprefix",             required_argument, nullptr, 'n'},
         {"type",                 required_argument, nullptr, 't'},
+        {"jobs",                 required_argument, nullptr, 'j'},
         // Arguments without short versions
+        {"batch",                no_argument,       nullptr, OPT_BATCH},
         {"input-header",         required_argument, nullptr, OPT_INPUT_HEADER},
         {"input-kernel",         required_argument, nullptr, OPT_INPUT_KERNEL},
         {"input-ramdisk",        required_argument, nullptr, OPT_INPUT_RAMDISK},
@@ -987,6 +1242,7 @@ static bool pack_main(int argc, char *argv[])
         case 'p':                      prefix = optarg;               break;
         case 'n':                      no_prefix = true;              break;
         case 't':                      type = optarg;                 break;
+        case OPT_BATCH:                batch = true;                  break;
         case OPT_INPUT_HEADER:         paths.header = optarg;         break;
         case OPT_INPUT_KERNEL:         paths.kernel = optarg;         break;
         case OPT_INPUT_RAMDISK:        paths.ramdisk = optarg;        break;
@@ -999,6 +1255,12 @@ static bool pack_main(int argc, char *argv[])
         case OPT_INPUT_RPM:            paths.rpm = optarg;            break;
         case OPT_INPUT_APPSBL:         paths.appsbl = optarg;         break;
 
+        case 'j':
+            if (!parse_jobs(optarg, jobs)) {
+                return false;
+            }
+            break;
+
         case 'h':
             fputs(HELP_PACK_USAGE, stdout);
             return true;
@@ -1009,86 +1271,45 @@ static bool pack_main(int argc, char *argv[])
         }
     }
 
-    // There should be one other argument
-    if (argc - optind != 1) {
+    // There should be one other argument unless in batch mode
+    if (batch ? argc - optind < 1 : argc - optind != 1) {
         fputs(HELP_PACK_USAGE, stderr);
         return false;
     }
 
-    output_file = argv[optind];
-
-    if (no_prefix) {
-        prefix.clear();
-    } else if (prefix.empty()) {
-        prefix = mb::io::base_name(output_file);
-        prefix += "-";
+    if (batch && (no_prefix || !prefix.empty() || has_custom_paths(paths))) {
+        fprintf(stderr, "Prefixes and custom paths cannot be used with "
+                        "--batch\n");
+        return false;
     }
 
     if (input_dir.empty()) {
         input_dir = ".";
     }
 
-    prepend_if_empty(paths, input_dir, prefix);
-
-    // Load the boot image
-    Writer writer;
-    Header header;
-    Entry entry;
-
-    if (!writer.set_format_by_name(type)) {
-        fprintf(stderr, "Invalid boot image type: %s\n", type);
-        return false;
-    }
-
-    auto ret = writer.open_filename(output_file);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to open for writing: %s\n",
-                output_file.c_str(), ret.error().message().c_str());
-        return false;
-    }
-
-    ret = writer.get_header(header);
-    if (!ret) {
-        fprintf(stderr, "Failed to get header instance: %s\n",
-                ret.error().message().c_str());
-        return false;
-    }
-
-    if (!read_header(paths.header, header)) {
-        return false;
-    }
+    TaskPool pool(jobs);
+    std::atomic_bool failed{false};
 
-    ret = writer.write_header(header);
-    if (!ret) {
-        fprintf(stderr, "%s: Failed to read header: %s\n",
-                output_file.c_str(), ret.error().message().c_str());
-        return false;
-    }
+    for (int i = optind; i < argc; ++i) {
+        std::string output_file = argv[i];
+        std::string image_prefix = prefix;
+        Paths image_paths = paths;
 
-    while (true) {
-        ret = writer.get_entry(entry);
-        if (!ret) {
-            if (ret.error() == WriterError::EndOfEntries) {
-                break;
-            }
-            fprintf(stderr, "Failed to get next entry: %s\n",
-                    ret.error().message().c_str());
-            return false;
+        if (no_prefix) {
+            image_prefix.clear();
+        } else if (image_prefix.empty()) {
+            image_prefix = mb::io::base_name(output_file);
+            image_prefix += "-";
         }
 
-        if (!write_file_to_entry(paths, writer, entry)) {
-            return false;
-        }
-    }
+        prepend_if_empty(image_paths, input_dir, image_prefix);
 
-    ret = writer.close();
-    if (!ret) {
-        fprintf(stderr, "Failed to close boot image: %s\n",
-                ret.error().message().c_str());
-        return false;
+        pack_image(pool, failed, output_file, image_paths, type);
     }
 
-    return true;
+    pool.run();
+
+    return !failed;
 }
 
 int main(int argc, char *argv[])
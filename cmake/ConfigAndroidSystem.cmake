@@ -1,3 +1,7 @@
 # Install paths
 set(BIN_INSTALL_DIR bin/${ANDROID_ABI})
 set(LIB_INSTALL_DIR lib/${ANDROID_ABI})
+
+# Trace markers for Android system tracing. They are only written while
+# tracing is on, so this is enabled by default.
+option(MBP_ENABLE_ATRACE "Emit ATRACE markers from mbtool and libmbutil" ON)
@@ -26,6 +26,7 @@ if(${MBP_BUILD_TARGET} STREQUAL desktop)
     include(cmake/dependencies/minizip.cmake)
     include(cmake/dependencies/qt5.cmake)
     include(cmake/dependencies/zlib.cmake)
+    include(cmake/dependencies/zstd.cmake)
 elseif(${MBP_BUILD_TARGET} STREQUAL android-app)
     include(cmake/dependencies/googletest.cmake)
     include(cmake/dependencies/libarchive.cmake)
@@ -33,6 +34,7 @@ elseif(${MBP_BUILD_TARGET} STREQUAL android-app)
     include(cmake/dependencies/lz4.cmake)
     include(cmake/dependencies/minizip.cmake)
     include(cmake/dependencies/zlib.cmake)
+    include(cmake/dependencies/zstd.cmake)
 elseif(${MBP_BUILD_TARGET} STREQUAL android-system)
     # Always use static libraries
     set(CMAKE_FIND_LIBRARY_SUFFIXES_OLD ${CMAKE_FIND_LIBRARY_SUFFIXES})
@@ -52,6 +54,7 @@ elseif(${MBP_BUILD_TARGET} STREQUAL android-system)
     include(cmake/dependencies/procps-ng.cmake)
     include(cmake/dependencies/safe-iop.cmake)
     include(cmake/dependencies/zlib.cmake)
+    include(cmake/dependencies/zstd.cmake)
 
     set(CMAKE_FIND_LIBRARY_SUFFIXES ${CMAKE_FIND_LIBRARY_SUFFIXES_OLD})
     unset(CMAKE_FIND_LIBRARY_SUFFIXES_OLD)
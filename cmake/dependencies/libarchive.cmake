@@ -7,5 +7,5 @@ set_target_properties(
     IMPORTED_LINK_INTERFACE_LANGUAGES "C"
     IMPORTED_LOCATION "${LibArchive_LIBRARIES}"
     INTERFACE_INCLUDE_DIRECTORIES "${LibArchive_INCLUDE_DIRS}"
-    INTERFACE_LINK_LIBRARIES "LibLZMA::LibLZMA;LZ4::LZ4;ZLIB::ZLIB"
+    INTERFACE_LINK_LIBRARIES "LibLZMA::LibLZMA;LZ4::LZ4;ZLIB::ZLIB;Zstd::Zstd"
 )
@@ -20,7 +20,9 @@
 #include "mbcommon/file_util.h"
 
 #include <limits>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
@@ -37,18 +39,25 @@
 
 static void usage(FILE *stream, const char *prog_name)
 {
-    fprintf(stream, "Usage: %s {-p <hex> | -t <text>} [option...] [<file>...]\n"
+    fprintf(stream, "Usage: %s {-p <hex> | -t <text>}... [option...] [<file>...]\n"
                     "\n"
                     "Options:\n"
                     "  -p, --hex <hex pattern>\n"
                     "                  Search file for hex pattern\n"
                     "  -t, --text <text pattern>\n"
                     "                  Search file for text pattern\n"
+                    "\n"
+                    "  Multiple patterns can be specified. They are searched for\n"
+                    "  in a single pass.\n"
+                    "\n"
                     "  -n, --num-matches\n"
                     "                  Maximum number of matches\n"
                     "  --start-offset  Starting boundary offset for search\n"
                     "  --end-offset    Ending boundary offset for search\n"
-                    "  --buffer-size   Buffer size\n",
+                    "  --buffer-size   Buffer size (chunk size with -j)\n"
+                    "  -j, --jobs <N>  Search a single pattern in N chunks in\n"
+                    "                  parallel. Multiple patterns and stdin are\n"
+                    "                  always searched serially.\n",
                     prog_name);
 }
 
@@ -65,59 +74,75 @@ static int ascii_to_hex(char c)
     }
 }
 
-static bool hex_to_binary(const char *hex, void **data, size_t *data_size)
+static bool hex_to_binary(const char *hex, std::string &data)
 {
     size_t size = strlen(hex);
-    unsigned char *buf;
 
     if (size & 1) {
         errno = EINVAL;
         return false;
     }
 
-    buf = static_cast<unsigned char *>(malloc(size / 2));
-    if (!buf) {
-        return false;
-    }
+    data.clear();
 
     for (size_t i = 0; i < size; i += 2) {
         int hi = ascii_to_hex(hex[i]);
         int lo = ascii_to_hex(hex[i + 1]);
 
         if (hi < 0 || lo < 0) {
-            free(buf);
             errno = EINVAL;
             return false;
         }
 
-        buf[i / 2] = static_cast<unsigned char>((hi << 4) | lo);
+        data.push_back(static_cast<char>((hi << 4) | lo));
     }
 
-    *data = buf;
-    *data_size = size / 2;
-
     return true;
 }
 
 static mb::oc::result<mb::FileSearchAction>
-search_result_cb(const char *name, mb::File &file, uint64_t offset)
+search_result_cb(const char *name, bool show_index, mb::File &file,
+                 size_t index, uint64_t offset)
 {
     (void) file;
-    printf("%s: 0x%016" PRIx64 "\n", name, offset);
+    if (show_index) {
+        printf("%s: 0x%016" PRIx64 " [%zu]\n", name, offset, index);
+    } else {
+        printf("%s: 0x%016" PRIx64 "\n", name, offset);
+    }
     return mb::FileSearchAction::Continue;
 }
 
 static bool search(const char *name, mb::File &file,
                    std::optional<uint64_t> start,
                    std::optional<uint64_t> end,
-                   size_t bsize, const void *pattern,
-                   size_t pattern_size, std::optional<uint64_t> max_matches)
+                   size_t bsize,
+                   const std::vector<mb::FileSearchPattern> &patterns,
+                   std::optional<uint64_t> max_matches,
+                   size_t jobs)
 {
     using namespace std::placeholders;
 
-    auto ret = mb::file_search(file, start, end, bsize, pattern, pattern_size,
-                               max_matches,
-                               std::bind(search_result_cb, name, _1, _2));
+    mb::oc::result<void> ret = mb::oc::success();
+
+    if (patterns.size() == 1 && jobs > 1) {
+        ret = mb::file_search_parallel(file, start, end, bsize,
+                                       patterns[0].data, patterns[0].size,
+                                       max_matches,
+                                       std::bind(search_result_cb, name,
+                                                 false, _1, 0, _2),
+                                       jobs);
+    } else if (patterns.size() == 1) {
+        ret = mb::file_search(file, start, end, bsize, patterns[0].data,
+                              patterns[0].size, max_matches,
+                              std::bind(search_result_cb, name, false, _1, 0,
+                                        _2));
+    } else {
+        ret = mb::file_search_multi(file, start, end, bsize, patterns.data(),
+                                    patterns.size(), max_matches,
+                                    std::bind(search_result_cb, name, true,
+                                              _1, _2, _3));
+    }
     if (!ret) {
         fprintf(stderr, "%s: Search failed: %s\n",
                 name, ret.error().message().c_str());
@@ -128,8 +153,8 @@ static bool search(const char *name, mb::File &file,
 
 static bool search_stdin(std::optional<uint64_t> start,
                          std::optional<uint64_t> end,
-                         size_t bsize, const void *pattern,
-                         size_t pattern_size,
+                         size_t bsize,
+                         const std::vector<mb::FileSearchPattern> &patterns,
                          std::optional<uint64_t> max_matches)
 {
     mb::PosixFile file;
@@ -141,16 +166,17 @@ static bool search_stdin(std::optional<uint64_t> start,
         return false;
     }
 
-    return search("stdin", file, start, end, bsize, pattern, pattern_size,
-                  max_matches);
+    // Parallel searches need random access
+    return search("stdin", file, start, end, bsize, patterns, max_matches, 1);
 }
 
 static bool search_file(const char *path,
                         std::optional<uint64_t> start,
                         std::optional<uint64_t> end,
-                        size_t bsize, const void *pattern,
-                        size_t pattern_size,
-                        std::optional<uint64_t> max_matches)
+                        size_t bsize,
+                        const std::vector<mb::FileSearchPattern> &patterns,
+                        std::optional<uint64_t> max_matches,
+                        size_t jobs)
 {
     mb::StandardFile file;
 
@@ -161,8 +187,8 @@ static bool search_file(const char *path,
         return false;
     }
 
-    return search(path, file, start, end, bsize, pattern, pattern_size,
-                  max_matches);
+    return search(path, file, start, end, bsize, patterns, max_matches,
+                  jobs);
 }
 
 int main(int argc, char *argv[])
@@ -171,12 +197,9 @@ int main(int argc, char *argv[])
     std::optional<uint64_t> end;
     size_t bsize = 0;
     std::optional<uint64_t> max_matches;
+    size_t jobs = 1;
 
-    const char *text_pattern = nullptr;
-    const char *hex_pattern = nullptr;
-    void *pattern = nullptr;
-    size_t pattern_size = 0;
-    bool pattern_needs_free = false;
+    std::vector<std::string> pattern_data;
 
     int opt;
 
@@ -188,11 +211,12 @@ int main(int argc, char *argv[])
         OPT_BUFFER_SIZE          = CHAR_MAX + 3,
     };
 
-    static const char short_options[] = "hn:p:t:";
+    static const char short_options[] = "hj:n:p:t:";
 
     static struct option long_options[] = {
         // Arguments with short versions
         {"help",         no_argument,       nullptr, 'h'},
+        {"jobs",         required_argument, nullptr, 'j'},
         {"num-matches",  required_argument, nullptr, 'n'},
         {"hex",          required_argument, nullptr, 'p'},
         {"text",         required_argument, nullptr, 't'},
@@ -208,6 +232,13 @@ int main(int argc, char *argv[])
     while ((opt = getopt_long(argc, argv, short_options,
                               long_options, &long_index)) != -1) {
         switch (opt) {
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid value for -j/--jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
         case 'n': {
             uint64_t value;
             if (!mb::str_to_num(optarg, 10, value)) {
@@ -219,12 +250,19 @@ int main(int argc, char *argv[])
             break;
         }
 
-        case 'p':
-            hex_pattern = optarg;
+        case 'p': {
+            std::string data;
+            if (!hex_to_binary(optarg, data)) {
+                fprintf(stderr, "Invalid hex pattern: %s: %s\n",
+                        optarg, strerror(errno));
+                return EXIT_FAILURE;
+            }
+            pattern_data.push_back(std::move(data));
             break;
+        }
 
         case 't':
-            text_pattern = optarg;
+            pattern_data.emplace_back(optarg);
             break;
 
         case OPT_START_OFFSET: {
@@ -267,38 +305,29 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (!hex_pattern && !text_pattern) {
+    if (pattern_data.empty()) {
         fprintf(stderr, "No pattern provided\n");
         return EXIT_FAILURE;
-    } else if (hex_pattern) {
-        if (!hex_to_binary(hex_pattern, &pattern, &pattern_size)) {
-            fprintf(stderr, "Invalid hex pattern: %s\n", strerror(errno));
-            return EXIT_FAILURE;
-        }
-        pattern_needs_free = true;
-    } else if (text_pattern) {
-        pattern = const_cast<char *>(text_pattern);
-        pattern_size = strlen(text_pattern);
+    }
+
+    std::vector<mb::FileSearchPattern> patterns;
+    for (auto const &data : pattern_data) {
+        patterns.push_back({ data.data(), data.size() });
     }
 
     bool ret = true;
 
     if (optind == argc) {
-        ret = search_stdin(start, end, bsize, pattern, pattern_size,
-                           max_matches);
+        ret = search_stdin(start, end, bsize, patterns, max_matches);
     } else {
         for (int i = optind; i < argc; ++i) {
-            bool ret2 = search_file(argv[i], start, end, bsize, pattern,
-                                    pattern_size, max_matches);
+            bool ret2 = search_file(argv[i], start, end, bsize, patterns,
+                                    max_matches, jobs);
             if (!ret2) {
                 ret = false;
             }
         }
     }
 
-    if (pattern_needs_free) {
-        free(pattern);
-    }
-
     return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }
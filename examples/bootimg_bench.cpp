@@ -0,0 +1,344 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures boot image probe latency, sequential read throughput, and full
+// unpack/repack round trips for each format using synthetic images held in
+// memory. Results are written to stdout as JSON.
+//
+// Loki is not included because the writer needs a real aboot image to patch.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/mtk_defs.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/repacker.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+static std::atomic<uint64_t> g_allocs{0};
+
+void * operator new(size_t size)
+{
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *ptr = malloc(size ? size : 1)) {
+        return ptr;
+    }
+
+    abort();
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+struct Format
+{
+    const char *name;
+    int code;
+};
+
+static constexpr Format FORMATS[] = {
+    { FORMAT_NAME_ANDROID, FORMAT_ANDROID },
+    { FORMAT_NAME_BUMP, FORMAT_BUMP },
+    { FORMAT_NAME_MTK, FORMAT_MTK },
+    { FORMAT_NAME_SONY_ELF, FORMAT_SONY_ELF },
+};
+
+static constexpr size_t IMAGE_SIZES_MIB[] = { 1, 16, 64 };
+
+struct Result
+{
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+[[noreturn]] static void die(const char *what)
+{
+    fprintf(stderr, "%s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+template<typename Fn>
+static Result measure(size_t iterations, Fn &&fn)
+{
+    double best = 0;
+    uint64_t allocs = 0;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        uint64_t allocs_before = g_allocs.load(std::memory_order_relaxed);
+        auto start = Clock::now();
+
+        fn();
+
+        auto end = Clock::now();
+        allocs += g_allocs.load(std::memory_order_relaxed) - allocs_before;
+
+        auto ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (i == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    return { best, static_cast<double>(allocs)
+            / static_cast<double>(iterations) };
+}
+
+static std::vector<unsigned char> mtk_header(size_t size)
+{
+    using namespace mtk;
+
+    std::vector<unsigned char> hdr(MTK_MAGIC_SIZE + sizeof(uint32_t)
+            + MTK_TYPE_SIZE + MTK_UNUSED_SIZE);
+    uint32_t le32_size = mb_htole32(static_cast<uint32_t>(size));
+
+    memcpy(hdr.data(), MTK_MAGIC, MTK_MAGIC_SIZE);
+    memcpy(hdr.data() + MTK_MAGIC_SIZE, &le32_size, sizeof(le32_size));
+    memset(hdr.data() + hdr.size() - MTK_UNUSED_SIZE, 0xff, MTK_UNUSED_SIZE);
+
+    return hdr;
+}
+
+static std::vector<unsigned char> create_image(int format, size_t size)
+{
+    // Pseudo-random data so that nothing benefits from repeated patterns
+    std::vector<unsigned char> data(size / 2);
+    uint32_t state = 0x12345678;
+    for (auto &c : data) {
+        state = state * 1103515245 + 12345;
+        c = static_cast<unsigned char>(state >> 24);
+    }
+
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    {
+        MemoryFile file(&buf, &buf_size);
+        Writer writer;
+
+        if (!file.is_open() || !writer.set_format_by_code(format)
+                || !writer.open(&file)) {
+            die("Failed to open writer");
+        }
+
+        Header header;
+        if (!writer.get_header(header)) {
+            die("Failed to get header");
+        }
+
+        (void) header.set_page_size(2048);
+        (void) header.set_kernel_cmdline({"console=null"});
+
+        if (!writer.write_header(header)) {
+            die("Failed to write header");
+        }
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            if (!writer.write_entry(entry)) {
+                die("Failed to write entry");
+            }
+
+            auto type = *entry.type();
+            if (type == ENTRY_TYPE_MTK_KERNEL_HEADER
+                    || type == ENTRY_TYPE_MTK_RAMDISK_HEADER) {
+                auto mtk_hdr = mtk_header(data.size());
+                if (!writer.write_data(mtk_hdr.data(), mtk_hdr.size())) {
+                    die("Failed to write MTK header");
+                }
+                continue;
+            } else if (type != ENTRY_TYPE_KERNEL && type != ENTRY_TYPE_RAMDISK) {
+                continue;
+            }
+
+            for (size_t pos = 0; pos < data.size(); pos += CHUNK_SIZE) {
+                auto n = std::min(CHUNK_SIZE, data.size() - pos);
+                if (!writer.write_data(data.data() + pos, n)) {
+                    die("Failed to write data");
+                }
+            }
+        }
+
+        if (!writer.close()) {
+            die("Failed to close writer");
+        }
+    }
+
+    std::vector<unsigned char> image(static_cast<unsigned char *>(buf),
+                                     static_cast<unsigned char *>(buf)
+                                             + buf_size);
+    free(buf);
+
+    return image;
+}
+
+static void open_reader(Reader &reader, MemoryFile &file,
+                        std::vector<unsigned char> &image)
+{
+    if (!file.open(image.data(), image.size())
+            || !reader.enable_format_all()
+            || !reader.open(&file)) {
+        die("Failed to open reader");
+    }
+}
+
+static Result bench_probe(std::vector<unsigned char> &image)
+{
+    return measure(200, [&] {
+        MemoryFile file;
+        Reader reader;
+        open_reader(reader, file, image);
+    });
+}
+
+static Result bench_read(std::vector<unsigned char> &image)
+{
+    std::vector<unsigned char> buf(CHUNK_SIZE);
+
+    return measure(5, [&] {
+        MemoryFile file;
+        Reader reader;
+        open_reader(reader, file, image);
+
+        Header header;
+        Entry entry;
+
+        if (!reader.read_header(header)) {
+            die("Failed to read header");
+        }
+
+        while (reader.read_entry(entry)) {
+            while (true) {
+                auto n = reader.read_data(buf.data(), buf.size());
+                if (!n) {
+                    die("Failed to read data");
+                } else if (n.value() == 0) {
+                    break;
+                }
+            }
+        }
+    });
+}
+
+static Result bench_round_trip(std::vector<unsigned char> &image)
+{
+    return measure(5, [&] {
+        MemoryFile file;
+        Reader reader;
+        open_reader(reader, file, image);
+
+        Header header;
+        if (!reader.read_header(header)) {
+            die("Failed to read header");
+        }
+
+        void *buf = nullptr;
+        size_t buf_size = 0;
+
+        {
+            MemoryFile out_file(&buf, &buf_size);
+            Writer writer;
+
+            if (!out_file.is_open()
+                    || !writer.set_format_by_code(reader.format_code())
+                    || !writer.open(&out_file)) {
+                die("Failed to open writer");
+            }
+
+            Repacker repacker(reader, writer);
+
+            if (!repacker.repack(header) || !writer.close()) {
+                die("Failed to repack image");
+            }
+        }
+
+        free(buf);
+    });
+}
+
+static void print_result(bool &first, const char *benchmark,
+                         const char *format, size_t size_mib,
+                         size_t image_size, const Result &result,
+                         bool throughput)
+{
+    printf("%s\n    {\"name\": \"%s/%s/%zuMiB\", \"format\": \"%s\", "
+           "\"image_size\": %zu, \"ns_per_op\": %.0f, "
+           "\"allocs_per_op\": %.1f",
+           first ? "" : ",", benchmark, format, size_mib, format, image_size,
+           result.ns_per_op, result.allocs_per_op);
+
+    if (throughput) {
+        printf(", \"mb_per_s\": %.1f", static_cast<double>(image_size)
+                / (1024.0 * 1024.0) / (result.ns_per_op / 1e9));
+    }
+
+    printf("}");
+
+    first = false;
+}
+
+int main()
+{
+    bool first = true;
+
+    printf("{\n  \"benchmarks\": [");
+
+    for (auto const &format : FORMATS) {
+        for (size_t size_mib : IMAGE_SIZES_MIB) {
+            auto image = create_image(format.code, size_mib * 1024 * 1024);
+
+            print_result(first, "probe", format.name, size_mib, image.size(),
+                         bench_probe(image), false);
+            print_result(first, "read", format.name, size_mib, image.size(),
+                         bench_read(image), true);
+            print_result(first, "round_trip", format.name, size_mib,
+                         image.size(), bench_round_trip(image), true);
+        }
+    }
+
+    printf("\n  ]\n}\n");
+
+    return EXIT_SUCCESS;
+}
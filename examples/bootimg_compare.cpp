@@ -17,63 +17,702 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 #include <getopt.h>
+#include <sys/stat.h>
+
+// rapidjson
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/filereadstream.h>
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/prettywriter.h>
+
+#include "mbcommon/executor.h"
+#include "mbcommon/file/hashing.h"
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/entry_file.h"
 #include "mbbootimg/header.h"
 #include "mbbootimg/reader.h"
 
+#define MANIFEST_VERSION                1
+
+#define FIELD_VERSION                   "version"
+#define FIELD_SOURCE                    "source"
+#define FIELD_HEADER                    "header"
+#define FIELD_SEGMENTS                  "segments"
+
+#define FIELD_DEVICE                    "device"
+#define FIELD_INODE                     "inode"
+#define FIELD_SIZE                      "size"
+#define FIELD_MTIME                     "mtime"
+#define FIELD_CTIME                     "ctime"
+
+#define FIELD_SUPPORTED_FIELDS          "supported_fields"
+#define FIELD_CMDLINE                   "cmdline"
+#define FIELD_BOARD                     "board"
+#define FIELD_KERNEL_ADDRESS            "kernel_address"
+#define FIELD_RAMDISK_ADDRESS           "ramdisk_address"
+#define FIELD_SECOND_ADDRESS            "second_address"
+#define FIELD_TAGS_ADDRESS              "tags_address"
+#define FIELD_IPL_ADDRESS               "ipl_address"
+#define FIELD_RPM_ADDRESS               "rpm_address"
+#define FIELD_APPSBL_ADDRESS            "appsbl_address"
+#define FIELD_ENTRYPOINT                "entrypoint"
+#define FIELD_PAGE_SIZE                 "page_size"
+
+#define FIELD_TYPE                      "type"
+#define FIELD_SHA256                    "sha256"
+
+#ifdef _WIN32
+#  define CLOEXEC_FLAG "N"
+#else
+#  define CLOEXEC_FLAG "e"
+#endif
+
+namespace rj = rapidjson;
+
+using namespace mb::bootimg;
+
+typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
+
+// Identity of the image file a cached manifest was computed from
+struct SourceIdentity
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;
+    int64_t ctime;
+
+    bool operator==(const SourceIdentity &other) const
+    {
+        return device == other.device
+                && inode == other.inode
+                && size == other.size
+                && mtime == other.mtime
+                && ctime == other.ctime;
+    }
+};
+
+struct SegmentDigest
+{
+    int type;
+    uint64_t size;
+    std::string sha256;
+
+    bool operator==(const SegmentDigest &other) const
+    {
+        return type == other.type
+                && size == other.size
+                && sha256 == other.sha256;
+    }
+};
+
+struct Manifest
+{
+    std::optional<SourceIdentity> source;
+    Header header;
+    // Sorted by type
+    std::vector<SegmentDigest> segments;
+
+    bool operator==(const Manifest &other) const
+    {
+        return header == other.header && segments == other.segments;
+    }
+};
+
 static void usage(FILE *stream, const char *prog_name)
 {
-    fprintf(stream, "Usage: %s <file1> <file2>\n"
+    fprintf(stream, "Usage: %s [option...] <file1> <file2>\n"
+                    "       %s -w <manifest> <file>\n"
+                    "\n"
+                    "Options:\n"
+                    "  -m, --manifest  Compare the header fields and segment\n"
+                    "                  digests of the images instead of their\n"
+                    "                  data. Either file may be a manifest\n"
+                    "                  (*.json) written by -w.\n"
+                    "  -w, --write-manifest <manifest>\n"
+                    "                  Write manifest of <file> and exit\n"
+                    "  -c, --cache <directory>\n"
+                    "                  Reuse manifests of unchanged image files\n"
+                    "                  from the directory (implies -m)\n"
                     "\n"
                     "Exits with:\n"
                     "  0 if boot images are equal\n"
                     "  1 if an error occurs\n"
                     "  2 if boot images are not equal\n",
-                    prog_name);
+                    prog_name, prog_name);
 }
 
-int main(int argc, char *argv[])
+static bool ends_with(const char *str, const char *suffix)
 {
-    int opt;
+    size_t str_len = strlen(str);
+    size_t suffix_len = strlen(suffix);
+    return str_len >= suffix_len
+            && strcmp(str + str_len - suffix_len, suffix) == 0;
+}
 
-    static const char short_options[] = "h";
+static int64_t timespec_to_ns(const struct timespec &ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
 
-    static struct option long_options[] = {
-        {"help", no_argument, nullptr, 'h'},
-        {nullptr, 0, nullptr, 0},
+// Get the identity of the file if its manifest can be cached. Only regular
+// files qualify because writing to a block device does not update its
+// timestamps. Files changed less than a second ago do not qualify either,
+// since the timestamp granularity may hide a write that follows this call.
+static std::optional<SourceIdentity> get_identity(const char *path)
+{
+    struct stat sb;
+    if (stat(path, &sb) < 0 || !S_ISREG(sb.st_mode)) {
+        return std::nullopt;
+    }
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) < 0
+            || timespec_to_ns(now) - timespec_to_ns(sb.st_ctim) < 1000000000) {
+        return std::nullopt;
+    }
+
+    return SourceIdentity{
+        static_cast<uint64_t>(sb.st_dev),
+        static_cast<uint64_t>(sb.st_ino),
+        static_cast<uint64_t>(sb.st_size),
+        timespec_to_ns(sb.st_mtim),
+        timespec_to_ns(sb.st_ctim),
     };
+}
 
-    int long_index = 0;
+static std::string to_hex(const std::vector<unsigned char> &data)
+{
+    static const char digits[] = "0123456789abcdef";
 
-    while ((opt = getopt_long(argc, argv, short_options,
-                              long_options, &long_index)) != -1) {
-        switch (opt) {
-        case 'h':
-            usage(stdout, argv[0]);
-            return EXIT_SUCCESS;
+    std::string result;
+    result.reserve(data.size() * 2);
 
-        default:
-            usage(stderr, argv[0]);
-            return EXIT_FAILURE;
+    for (unsigned char c : data) {
+        result += digits[(c >> 4) & 0xf];
+        result += digits[c & 0xf];
+    }
+
+    return result;
+}
+
+// Hash the entry of the given type. The reader must not be used by any other
+// thread.
+static mb::oc::result<std::string> hash_entry(Reader &reader, int type)
+{
+    EntryFile entry_file;
+    OUTCOME_TRYV(entry_file.open(&reader, type));
+
+    mb::HashingFile hasher;
+    OUTCOME_TRYV(hasher.open(&entry_file, mb::HashAlgorithm::Sha256));
+
+    std::vector<unsigned char> buf(1024 * 1024);
+
+    while (true) {
+        OUTCOME_TRY(n, hasher.read(buf.data(), buf.size()));
+        if (n == 0) {
+            break;
         }
     }
 
-    if (argc - optind != 2) {
-        usage(stderr, argv[0]);
-        return EXIT_FAILURE;
+    OUTCOME_TRY(digest, hasher.digest(mb::HashAlgorithm::Sha256));
+
+    return to_hex(digest);
+}
+
+// Compute the manifest of a boot image. The segments are hashed in parallel,
+// each with its own clone of the reader.
+static bool compute_manifest(const char *path, Manifest &manifest)
+{
+    Reader reader;
+    Entry entry;
+
+    auto ret = reader.enable_format_all();
+    if (!ret) {
+        fprintf(stderr, "Failed to enable all boot image formats: %s\n",
+                ret.error().message().c_str());
+        return false;
+    }
+
+    ret = reader.open_filename(path);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to open boot image for reading: %s\n",
+                path, ret.error().message().c_str());
+        return false;
+    }
+
+    ret = reader.read_header(manifest.header);
+    if (!ret) {
+        fprintf(stderr, "%s: Failed to read header: %s\n",
+                path, ret.error().message().c_str());
+        return false;
+    }
+
+    manifest.segments.clear();
+
+    while (true) {
+        ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            fprintf(stderr, "%s: Failed to read entry: %s\n",
+                    path, ret.error().message().c_str());
+            return false;
+        }
+
+        manifest.segments.push_back({*entry.type(), *entry.size(), {}});
+    }
+
+    std::sort(manifest.segments.begin(), manifest.segments.end(),
+              [](const SegmentDigest &a, const SegmentDigest &b) {
+        return a.type < b.type;
+    });
+
+    std::vector<std::unique_ptr<Reader>> clones;
+    clones.reserve(manifest.segments.size());
+
+    for (size_t i = 0; i < manifest.segments.size(); ++i) {
+        auto clone = reader.clone();
+        if (!clone) {
+            fprintf(stderr, "%s: Failed to clone reader: %s\n",
+                    path, clone.error().message().c_str());
+            return false;
+        }
+        clones.push_back(std::move(clone.value()));
+    }
+
+    std::vector<std::string> errors(manifest.segments.size());
+
+    mb::parallel_for(manifest.segments.size(), [&](size_t i) {
+        auto &segment = manifest.segments[i];
+
+        auto digest = hash_entry(*clones[i], segment.type);
+        if (digest) {
+            segment.sha256 = std::move(digest.value());
+        } else {
+            errors[i] = digest.error().message();
+        }
+    });
+
+    for (size_t i = 0; i < errors.size(); ++i) {
+        if (!errors[i].empty()) {
+            fprintf(stderr, "%s: Failed to hash entry %d: %s\n",
+                    path, manifest.segments[i].type, errors[i].c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static inline std::string get_string(const rj::Value &node)
+{
+    return {node.GetString(), node.GetStringLength()};
+}
+
+static bool parse_source(const rj::Value &node, SourceIdentity &source)
+{
+    bool has_fields[5] = {};
+
+    for (auto const &item : node.GetObject()) {
+        auto const &key = get_string(item.name);
+
+        if (key == FIELD_DEVICE && item.value.IsUint64()) {
+            source.device = item.value.GetUint64();
+            has_fields[0] = true;
+        } else if (key == FIELD_INODE && item.value.IsUint64()) {
+            source.inode = item.value.GetUint64();
+            has_fields[1] = true;
+        } else if (key == FIELD_SIZE && item.value.IsUint64()) {
+            source.size = item.value.GetUint64();
+            has_fields[2] = true;
+        } else if (key == FIELD_MTIME && item.value.IsInt64()) {
+            source.mtime = item.value.GetInt64();
+            has_fields[3] = true;
+        } else if (key == FIELD_CTIME && item.value.IsInt64()) {
+            source.ctime = item.value.GetInt64();
+            has_fields[4] = true;
+        } else {
+            return false;
+        }
+    }
+
+    return std::all_of(std::begin(has_fields), std::end(has_fields),
+                       [](bool b) { return b; });
+}
+
+static bool parse_header(const rj::Value &node, Header &header)
+{
+    header.clear();
+
+    // The supported fields must be set before any of the values
+    auto const &fields = node.FindMember(FIELD_SUPPORTED_FIELDS);
+    if (fields == node.MemberEnd() || !fields->value.IsUint64()) {
+        return false;
+    }
+
+    HeaderFields supported;
+    for (uint64_t bits = fields->value.GetUint64(); bits != 0;
+            bits &= bits - 1) {
+        supported |= static_cast<HeaderField>(bits & ~(bits - 1));
+    }
+    header.set_supported_fields(supported);
+
+    for (auto const &item : node.GetObject()) {
+        auto const &key = get_string(item.name);
+
+        bool ret;
+
+        if (key == FIELD_SUPPORTED_FIELDS) {
+            ret = true;
+        } else if (key == FIELD_CMDLINE && item.value.IsString()) {
+            ret = header.set_kernel_cmdline(get_string(item.value));
+        } else if (key == FIELD_BOARD && item.value.IsString()) {
+            ret = header.set_board_name(get_string(item.value));
+        } else if (key == FIELD_KERNEL_ADDRESS && item.value.IsUint()) {
+            ret = header.set_kernel_address(item.value.GetUint());
+        } else if (key == FIELD_RAMDISK_ADDRESS && item.value.IsUint()) {
+            ret = header.set_ramdisk_address(item.value.GetUint());
+        } else if (key == FIELD_SECOND_ADDRESS && item.value.IsUint()) {
+            ret = header.set_secondboot_address(item.value.GetUint());
+        } else if (key == FIELD_TAGS_ADDRESS && item.value.IsUint()) {
+            ret = header.set_kernel_tags_address(item.value.GetUint());
+        } else if (key == FIELD_IPL_ADDRESS && item.value.IsUint()) {
+            ret = header.set_sony_ipl_address(item.value.GetUint());
+        } else if (key == FIELD_RPM_ADDRESS && item.value.IsUint()) {
+            ret = header.set_sony_rpm_address(item.value.GetUint());
+        } else if (key == FIELD_APPSBL_ADDRESS && item.value.IsUint()) {
+            ret = header.set_sony_appsbl_address(item.value.GetUint());
+        } else if (key == FIELD_ENTRYPOINT && item.value.IsUint()) {
+            ret = header.set_entrypoint_address(item.value.GetUint());
+        } else if (key == FIELD_PAGE_SIZE && item.value.IsUint()) {
+            ret = header.set_page_size(item.value.GetUint());
+        } else {
+            ret = false;
+        }
+
+        if (!ret) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool parse_segments(const rj::Value &node,
+                           std::vector<SegmentDigest> &segments)
+{
+    segments.clear();
+
+    for (auto const &value : node.GetArray()) {
+        if (!value.IsObject()) {
+            return false;
+        }
+
+        SegmentDigest segment{};
+        bool has_fields[3] = {};
+
+        for (auto const &item : value.GetObject()) {
+            auto const &key = get_string(item.name);
+
+            if (key == FIELD_TYPE && item.value.IsInt()) {
+                segment.type = item.value.GetInt();
+                has_fields[0] = true;
+            } else if (key == FIELD_SIZE && item.value.IsUint64()) {
+                segment.size = item.value.GetUint64();
+                has_fields[1] = true;
+            } else if (key == FIELD_SHA256 && item.value.IsString()) {
+                segment.sha256 = get_string(item.value);
+                has_fields[2] = true;
+            } else {
+                return false;
+            }
+        }
+
+        if (!std::all_of(std::begin(has_fields), std::end(has_fields),
+                         [](bool b) { return b; })) {
+            return false;
+        }
+
+        segments.push_back(std::move(segment));
+    }
+
+    // Manifests may have been edited by hand
+    std::sort(segments.begin(), segments.end(),
+              [](const SegmentDigest &a, const SegmentDigest &b) {
+        return a.type < b.type;
+    });
+
+    return true;
+}
+
+// Load a manifest. If quiet is true, no error message is printed if the file
+// does not exist.
+static bool load_manifest(const char *path, Manifest &manifest, bool quiet)
+{
+    ScopedFILE fp(fopen(path, "rb" CLOEXEC_FLAG), fclose);
+    if (!fp) {
+        if (!quiet || errno != ENOENT) {
+            fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                    path, strerror(errno));
+        }
+        return false;
+    }
+
+    char read_buf[65536];
+    rj::Document document;
+    rj::FileReadStream is(fp.get(), read_buf, sizeof(read_buf));
+
+    if (document.ParseStream(is).HasParseError()) {
+        fprintf(stderr, "%s: JSON parse error at offset %zu: %s\n",
+                path, document.GetErrorOffset(),
+                rj::GetParseError_En(document.GetParseError()));
+        return false;
+    }
+
+    if (!document.IsObject()) {
+        fprintf(stderr, "%s: Root is not an object\n", path);
+        return false;
+    }
+
+    bool has_header = false;
+    bool has_segments = false;
+
+    manifest.source = std::nullopt;
+
+    for (auto const &item : document.GetObject()) {
+        auto const &key = get_string(item.name);
+
+        bool ret;
+
+        if (key == FIELD_VERSION && item.value.IsUint()) {
+            ret = item.value.GetUint() == MANIFEST_VERSION;
+        } else if (key == FIELD_SOURCE && item.value.IsObject()) {
+            ret = parse_source(item.value, manifest.source.emplace());
+        } else if (key == FIELD_HEADER && item.value.IsObject()) {
+            ret = parse_header(item.value, manifest.header);
+            has_header = true;
+        } else if (key == FIELD_SEGMENTS && item.value.IsArray()) {
+            ret = parse_segments(item.value, manifest.segments);
+            has_segments = true;
+        } else {
+            ret = false;
+        }
+
+        if (!ret) {
+            fprintf(stderr, "%s: Invalid value for key '%s'\n",
+                    path, key.c_str());
+            return false;
+        }
+    }
+
+    if (!has_header || !has_segments) {
+        fprintf(stderr, "%s: Missing header or segments\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+template<typename JsonWriter>
+static bool write_header(JsonWriter &writer, const Header &header)
+{
+    auto cmdline = header.kernel_cmdline();
+    auto board_name = header.board_name();
+    auto kernel_address = header.kernel_address();
+    auto ramdisk_address = header.ramdisk_address();
+    auto second_address = header.secondboot_address();
+    auto tags_address = header.kernel_tags_address();
+    auto sony_ipl_address = header.sony_ipl_address();
+    auto sony_rpm_address = header.sony_rpm_address();
+    auto sony_appsbl_address = header.sony_appsbl_address();
+    auto entrypoint_address = header.entrypoint_address();
+    auto page_size = header.page_size();
+
+    return writer.StartObject()
+            && writer.Key(FIELD_SUPPORTED_FIELDS)
+            && writer.Uint64(header.supported_fields())
+            && (!cmdline
+                    || (writer.Key(FIELD_CMDLINE)
+                    && writer.String(cmdline->data(),
+                                     static_cast<rj::SizeType>(cmdline->size()))))
+            && (!board_name
+                    || (writer.Key(FIELD_BOARD)
+                    && writer.String(board_name->data(),
+                                     static_cast<rj::SizeType>(board_name->size()))))
+            && (!kernel_address
+                    || (writer.Key(FIELD_KERNEL_ADDRESS) && writer.Uint(*kernel_address)))
+            && (!ramdisk_address
+                    || (writer.Key(FIELD_RAMDISK_ADDRESS) && writer.Uint(*ramdisk_address)))
+            && (!second_address
+                    || (writer.Key(FIELD_SECOND_ADDRESS) && writer.Uint(*second_address)))
+            && (!tags_address
+                    || (writer.Key(FIELD_TAGS_ADDRESS) && writer.Uint(*tags_address)))
+            && (!sony_ipl_address
+                    || (writer.Key(FIELD_IPL_ADDRESS) && writer.Uint(*sony_ipl_address)))
+            && (!sony_rpm_address
+                    || (writer.Key(FIELD_RPM_ADDRESS) && writer.Uint(*sony_rpm_address)))
+            && (!sony_appsbl_address
+                    || (writer.Key(FIELD_APPSBL_ADDRESS) && writer.Uint(*sony_appsbl_address)))
+            && (!entrypoint_address
+                    || (writer.Key(FIELD_ENTRYPOINT) && writer.Uint(*entrypoint_address)))
+            && (!page_size
+                    || (writer.Key(FIELD_PAGE_SIZE) && writer.Uint(*page_size)))
+            && writer.EndObject();
+}
+
+// Write a manifest. It is written to a temporary file first, so that readers
+// never see a partially written cache entry.
+static bool save_manifest(const std::string &path, const Manifest &manifest)
+{
+    std::string temp_path = path + ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "wb" CLOEXEC_FLAG), fclose);
+    if (!fp) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // NOTE: RapidJSON has no way of reporting write errors at the moment
+    char write_buf[65536];
+    rj::FileWriteStream os(fp.get(), write_buf, sizeof(write_buf));
+    rj::PrettyWriter<rj::FileWriteStream> writer(os);
+
+    auto const &source = manifest.source;
+
+    bool failed =
+            !writer.StartObject()
+            || !writer.Key(FIELD_VERSION)
+            || !writer.Uint(MANIFEST_VERSION)
+            || (source && !(writer.Key(FIELD_SOURCE)
+                    && writer.StartObject()
+                    && writer.Key(FIELD_DEVICE) && writer.Uint64(source->device)
+                    && writer.Key(FIELD_INODE) && writer.Uint64(source->inode)
+                    && writer.Key(FIELD_SIZE) && writer.Uint64(source->size)
+                    && writer.Key(FIELD_MTIME) && writer.Int64(source->mtime)
+                    && writer.Key(FIELD_CTIME) && writer.Int64(source->ctime)
+                    && writer.EndObject()))
+            || !writer.Key(FIELD_HEADER)
+            || !write_header(writer, manifest.header)
+            || !writer.Key(FIELD_SEGMENTS)
+            || !writer.StartArray();
+
+    for (auto it = manifest.segments.begin();
+            !failed && it != manifest.segments.end(); ++it) {
+        failed = !writer.StartObject()
+                || !writer.Key(FIELD_TYPE) || !writer.Int(it->type)
+                || !writer.Key(FIELD_SIZE) || !writer.Uint64(it->size)
+                || !writer.Key(FIELD_SHA256)
+                || !writer.String(it->sha256.data(),
+                                  static_cast<rj::SizeType>(it->sha256.size()))
+                || !writer.EndObject();
+    }
+
+    failed = failed || !writer.EndArray() || !writer.EndObject();
+
+    writer.Flush();
+
+    if (failed) {
+        fprintf(stderr, "%s: Failed to write file: %s\n",
+                temp_path.c_str(), strerror(errno));
+        remove(temp_path.c_str());
+        return false;
+    }
+
+    if (fclose(fp.release()) < 0) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                temp_path.c_str(), strerror(errno));
+        remove(temp_path.c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        fprintf(stderr, "%s: Failed to rename to %s: %s\n",
+                temp_path.c_str(), path.c_str(), strerror(errno));
+        remove(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Get the manifest for a boot image or manifest file. If cache_dir is not
+// null, the manifests of image files are looked up in and added to the cache.
+static bool get_manifest(const char *path, const char *cache_dir,
+                         Manifest &manifest)
+{
+    if (ends_with(path, ".json")) {
+        return load_manifest(path, manifest, false);
+    }
+
+    std::optional<SourceIdentity> id;
+    std::string cache_path;
+
+    if (cache_dir) {
+        id = get_identity(path);
+    }
+
+    if (id) {
+        char name[64];
+        snprintf(name, sizeof(name), "%016" PRIx64 "-%016" PRIx64 ".json",
+                 id->device, id->inode);
+        cache_path = cache_dir;
+        cache_path += '/';
+        cache_path += name;
+
+        if (load_manifest(cache_path.c_str(), manifest, true)
+                && manifest.source == id) {
+            return true;
+        }
+    }
+
+    if (!compute_manifest(path, manifest)) {
+        return false;
     }
 
-    using namespace mb::bootimg;
+    if (id) {
+        manifest.source = id;
+
+        // The comparison does not depend on the cache
+        (void) save_manifest(cache_path, manifest);
+    }
+
+    return true;
+}
+
+static int compare_manifests(const char *filename1, const char *filename2,
+                             const char *cache_dir)
+{
+    Manifest manifest1;
+    Manifest manifest2;
+
+    if (!get_manifest(filename1, cache_dir, manifest1)
+            || !get_manifest(filename2, cache_dir, manifest2)) {
+        return EXIT_FAILURE;
+    }
 
-    const char *filename1 = argv[optind];
-    const char *filename2 = argv[optind + 1];
+    return manifest1 == manifest2 ? EXIT_SUCCESS : 2;
+}
 
+static int compare_images(const char *filename1, const char *filename2)
+{
     Reader reader1;
     Reader reader2;
     Header header1;
@@ -209,3 +848,76 @@ int main(int argc, char *argv[])
 
     return EXIT_SUCCESS;
 }
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    bool use_manifest = false;
+    const char *manifest_path = nullptr;
+    const char *cache_dir = nullptr;
+
+    static const char short_options[] = "c:hmw:";
+
+    static struct option long_options[] = {
+        {"cache",          required_argument, nullptr, 'c'},
+        {"help",           no_argument,       nullptr, 'h'},
+        {"manifest",       no_argument,       nullptr, 'm'},
+        {"write-manifest", required_argument, nullptr, 'w'},
+        {nullptr,          0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'c':
+            cache_dir = optarg;
+            use_manifest = true;
+            break;
+
+        case 'm':
+            use_manifest = true;
+            break;
+
+        case 'w':
+            manifest_path = optarg;
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (manifest_path) {
+        if (argc - optind != 1) {
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        Manifest manifest;
+
+        if (!compute_manifest(argv[optind], manifest)
+                || !save_manifest(manifest_path, manifest)) {
+            return EXIT_FAILURE;
+        }
+
+        return EXIT_SUCCESS;
+    }
+
+    if (argc - optind != 2) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (use_manifest) {
+        return compare_manifests(argv[optind], argv[optind + 1], cache_dir);
+    } else {
+        return compare_images(argv[optind], argv[optind + 1]);
+    }
+}
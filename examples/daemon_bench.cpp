@@ -0,0 +1,836 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Load generator for the mbtool daemon. It opens -c concurrent connections
+// (one thread each) and sends -n requests over each of them, picked at random
+// from a weighted request mix (-m). The mix is a comma-separated list of
+// <type>[:<arg>][=<weight>] entries:
+//
+//   read:<size>     FileReadRequest of <size> bytes of the -f file, which is
+//                   opened once per connection
+//   dirsize[:<dir>] PathGetDirectorySizeRequest (default: /system/etc)
+//   roms            MbGetInstalledRomsRequest
+//   exec            SignedExecRequest of --exec-binary and --exec-signature
+//
+// With -b N, requests are sent in BatchRequests of up to N requests each
+// (except for exec, which is always sent by itself) and the latency is reported
+// per batch.
+// With -R N, each thread reconnects after every N requests, which measures the
+// cost of the daemon handing the connection to a new connection process.
+//
+// The daemon only accepts connections from root if it was started with
+// --allow-root-client. Results are written to stdout as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cerrno>
+#include <climits>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+
+#include "mbutil/socket.h"
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wsign-conversion"
+#ifdef __clang__
+#pragma GCC diagnostic ignored "-Wdocumentation"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+
+// flatbuffers
+#include "protocol/request_generated.h"
+#include "protocol/response_generated.h"
+
+#pragma GCC diagnostic pop
+
+using namespace mb;
+
+namespace v3 = mbtool::daemon::v3;
+namespace fb = flatbuffers;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr char SOCKET_ADDRESS[] = "mbtool.daemon";
+static constexpr int32_t PROTOCOL_VERSION = 3;
+
+// Same limit as the daemon's MAX_FILE_READ_SIZE
+static constexpr uint64_t MAX_READ_SIZE = 1024 * 1024;
+
+static constexpr char DEFAULT_MIX[] =
+        "read:4096=8,read:65536=4,read:1048576=1,dirsize=1,roms=2";
+static constexpr char DEFAULT_READ_FILE[] =
+        "/system/framework/framework-res.apk";
+static constexpr char DEFAULT_DIRSIZE_PATH[] = "/system/etc";
+
+enum class OpType
+{
+    Read,
+    DirSize,
+    Roms,
+    Exec,
+};
+
+struct Op
+{
+    std::string name;
+    OpType type;
+    uint64_t size;
+    std::string path;
+    unsigned int weight;
+};
+
+struct Options
+{
+    unsigned int connections = 8;
+    uint64_t requests = 1000;
+    uint64_t reconnect_every = 0;
+    size_t batch = 1;
+    std::string read_file = DEFAULT_READ_FILE;
+    std::string exec_binary;
+    std::string exec_signature;
+    std::vector<Op> mix;
+};
+
+// Latencies in nanoseconds
+struct Samples
+{
+    std::vector<uint64_t> latencies;
+    uint64_t bytes = 0;
+};
+
+struct Stats
+{
+    Samples connect;
+    std::map<std::string, Samples> requests;
+    uint64_t count = 0;
+};
+
+[[noreturn]] static void die(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+[[noreturn]] static void die(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t elapsed_ns(Clock::time_point start)
+{
+    return static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - start).count());
+}
+
+class Connection
+{
+public:
+    Connection() : m_fd(connect_fd()), m_socket(m_fd), m_next_id(1)
+    {
+    }
+
+    ~Connection()
+    {
+        close(m_fd);
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Connection)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Connection)
+
+    // Builds the sub-request table for an op and returns its type
+    v3::RequestType build(fb::FlatBufferBuilder &builder, const Op &op,
+                          const Options &options, int32_t file_id,
+                          fb::Offset<void> &request)
+    {
+        switch (op.type) {
+        case OpType::Read:
+            request = v3::CreateFileReadRequest(
+                    builder, file_id, op.size).Union();
+            return v3::RequestType_FileReadRequest;
+
+        case OpType::DirSize:
+            request = v3::CreatePathGetDirectorySizeRequest(
+                    builder, builder.CreateString(op.path)).Union();
+            return v3::RequestType_PathGetDirectorySizeRequest;
+
+        case OpType::Roms:
+            request = v3::CreateMbGetInstalledRomsRequest(builder).Union();
+            return v3::RequestType_MbGetInstalledRomsRequest;
+
+        case OpType::Exec: {
+            auto binary = builder.CreateString(options.exec_binary);
+            auto signature = builder.CreateString(options.exec_signature);
+            request = v3::CreateSignedExecRequest(
+                    builder, binary, signature).Union();
+            return v3::RequestType_SignedExecRequest;
+        }
+        }
+
+        die("Invalid op type");
+    }
+
+    // Sends a request and returns its response. SignedExecOutputResponses are
+    // skipped. The returned pointer is valid until the next call.
+    const v3::Response * send(fb::FlatBufferBuilder &builder,
+                              v3::RequestType type, fb::Offset<void> request)
+    {
+        uint32_t id = m_next_id++;
+
+        builder.Finish(v3::CreateRequest(builder, type, request, id));
+
+        if (auto r = m_socket.send(builder.GetBufferPointer(),
+                                   builder.GetSize()); !r) {
+            die("Failed to send request: %s", r.error().message().c_str());
+        }
+
+        while (true) {
+            auto frame = m_socket.receive();
+            if (!frame) {
+                die("Failed to receive response: %s",
+                    frame.error().message().c_str());
+            }
+
+            auto verifier = fb::Verifier(frame.value().data,
+                                         frame.value().size);
+            if (!v3::VerifyResponseBuffer(verifier)) {
+                die("Received invalid buffer");
+            }
+
+            auto response = v3::GetResponse(frame.value().data);
+            auto response_type = response->response_type();
+
+            if (response_type == v3::ResponseType_SignedExecOutputResponse) {
+                continue;
+            } else if (response_type == v3::ResponseType_Invalid) {
+                die("Daemon says request is invalid: %s",
+                    v3::EnumNameRequestType(type));
+            } else if (response_type == v3::ResponseType_Unsupported) {
+                die("Daemon does not support request type: %s",
+                    v3::EnumNameRequestType(type));
+            } else if (response->id() != id) {
+                // Asynchronous events and job notifications
+                continue;
+            }
+
+            return response;
+        }
+    }
+
+    int32_t open_file(const std::string &path, uint64_t &size)
+    {
+        fb::FlatBufferBuilder builder;
+        auto fb_path = builder.CreateString(path);
+        auto flags = builder.CreateVector(
+                std::vector<int16_t>{v3::FileOpenFlag_RDONLY});
+
+        auto response = send(builder, v3::RequestType_FileOpenRequest,
+                             v3::CreateFileOpenRequest(
+                                     builder, fb_path, flags).Union());
+        auto open = response->response_as_FileOpenResponse();
+        if (!open || open->error()) {
+            die("%s: Failed to open file: %s", path.c_str(),
+                open && open->error() && open->error()->msg()
+                        ? open->error()->msg()->c_str() : "unknown error");
+        }
+
+        int32_t id = open->id();
+        size = seek(id, 0, v3::FileSeekWhence_SEEK_END);
+        seek(id, 0, v3::FileSeekWhence_SEEK_SET);
+
+        return id;
+    }
+
+    uint64_t seek(int32_t id, int64_t offset, v3::FileSeekWhence whence)
+    {
+        fb::FlatBufferBuilder builder;
+
+        auto response = send(builder, v3::RequestType_FileSeekRequest,
+                             v3::CreateFileSeekRequest(
+                                     builder, id, offset, whence).Union());
+        auto seek = response->response_as_FileSeekResponse();
+        if (!seek || seek->error() || seek->offset() < 0) {
+            die("Failed to seek file");
+        }
+
+        return static_cast<uint64_t>(seek->offset());
+    }
+
+private:
+    static int connect_fd()
+    {
+        int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            die("Failed to create socket: %s", strerror(errno));
+        }
+
+        sockaddr_un addr = {};
+        addr.sun_family = AF_LOCAL;
+        // Abstract socket name
+        memcpy(addr.sun_path + 1, SOCKET_ADDRESS, sizeof(SOCKET_ADDRESS) - 1);
+
+        auto addr_len = static_cast<socklen_t>(
+                offsetof(sockaddr_un, sun_path) + sizeof(SOCKET_ADDRESS));
+
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), addr_len) < 0) {
+            die("Failed to connect to socket: %s", strerror(errno));
+        }
+
+        auto result = util::socket_read_string(fd);
+        if (!result) {
+            die("Failed to receive authorization result: %s",
+                result.error().message().c_str());
+        } else if (result.value() != "ALLOW") {
+            die("Daemon denied authorization: %s", result.value().c_str());
+        }
+
+        if (auto r = util::socket_write_int32(fd, PROTOCOL_VERSION); !r) {
+            die("Failed to send interface version: %s",
+                r.error().message().c_str());
+        }
+
+        result = util::socket_read_string(fd);
+        if (!result) {
+            die("Failed to receive interface request result: %s",
+                result.error().message().c_str());
+        } else if (result.value() != "OK") {
+            die("Daemon does not support interface version %d: %s",
+                PROTOCOL_VERSION, result.value().c_str());
+        }
+
+        return fd;
+    }
+
+    int m_fd;
+    util::FramedSocket m_socket;
+    uint32_t m_next_id;
+};
+
+static uint64_t response_bytes(const v3::Response *response)
+{
+    if (auto read = response->response_as_FileReadResponse()) {
+        return read->bytes_read();
+    }
+    return 0;
+}
+
+static void check_response(const v3::Response *response)
+{
+    if (auto r = response->response_as_FileReadResponse(); r && r->error()) {
+        die("Failed to read file: %s",
+            r->error()->msg() ? r->error()->msg()->c_str() : "unknown error");
+    } else if (auto r = response->response_as_PathGetDirectorySizeResponse();
+            r && r->error()) {
+        die("Failed to get directory size: %s",
+            r->error()->msg() ? r->error()->msg()->c_str() : "unknown error");
+    } else if (auto r = response->response_as_SignedExecResponse();
+            r && r->result() != v3::SignedExecResult_PROCESS_EXITED) {
+        die("Failed to run signed binary: %s",
+            r->error() && r->error()->msg()
+                    ? r->error()->msg()->c_str() : "unknown error");
+    }
+}
+
+class Worker
+{
+public:
+    Worker(const Options &options, unsigned int seed)
+        : m_options(options)
+        , m_rng(seed)
+    {
+        std::vector<unsigned int> weights;
+        for (auto const &op : options.mix) {
+            weights.push_back(op.weight);
+            m_needs_file |= op.type == OpType::Read;
+        }
+        m_dist = std::discrete_distribution<size_t>(weights.begin(),
+                                                    weights.end());
+    }
+
+    void run()
+    {
+        uint64_t sent = 0;
+
+        while (sent < m_options.requests) {
+            auto start = Clock::now();
+            Connection conn;
+            m_stats.connect.latencies.push_back(elapsed_ns(start));
+
+            m_file_id = -1;
+            m_offset = 0;
+
+            if (m_needs_file) {
+                m_file_id = conn.open_file(m_options.read_file, m_file_size);
+            }
+
+            uint64_t limit = m_options.requests - sent;
+            if (m_options.reconnect_every > 0) {
+                limit = std::min(limit, m_options.reconnect_every);
+            }
+
+            for (uint64_t i = 0; i < limit;) {
+                i += send_next(conn, static_cast<size_t>(std::min<uint64_t>(
+                        limit - i, m_options.batch)));
+            }
+
+            sent += limit;
+        }
+    }
+
+    const Stats & stats() const
+    {
+        return m_stats;
+    }
+
+private:
+    // Seeks back to the beginning if reading `count` more bytes would hit EOF
+    void rewind_if_needed(Connection &conn, uint64_t count)
+    {
+        if (m_offset + count > m_file_size) {
+            conn.seek(m_file_id, 0, v3::FileSeekWhence_SEEK_SET);
+            m_offset = 0;
+        }
+    }
+
+    // Sends up to `max` requests and returns the number sent
+    uint64_t send_next(Connection &conn, size_t max)
+    {
+        std::vector<const Op *> ops;
+        uint64_t read_bytes = 0;
+
+        while (ops.size() < max) {
+            auto const &op = m_options.mix[m_dist(m_rng)];
+            if (op.type == OpType::Exec && !ops.empty()) {
+                break;
+            }
+
+            ops.push_back(&op);
+            if (op.type == OpType::Read) {
+                read_bytes += op.size;
+            }
+
+            if (op.type == OpType::Exec) {
+                break;
+            }
+        }
+
+        if (read_bytes > 0) {
+            rewind_if_needed(conn, read_bytes);
+        }
+
+        fb::FlatBufferBuilder builder;
+
+        if (ops.size() == 1) {
+            fb::Offset<void> request;
+            auto type = conn.build(builder, *ops[0], m_options, m_file_id,
+                                   request);
+
+            auto start = Clock::now();
+            auto response = conn.send(builder, type, request);
+            auto ns = elapsed_ns(start);
+
+            check_response(response);
+
+            auto &samples = m_stats.requests[ops[0]->name];
+            samples.latencies.push_back(ns);
+            samples.bytes += response_bytes(response);
+            m_offset += response_bytes(response);
+        } else {
+            std::vector<fb::Offset<v3::Request>> requests;
+
+            for (auto const *op : ops) {
+                fb::Offset<void> request;
+                auto type = conn.build(builder, *op, m_options, m_file_id,
+                                       request);
+                requests.push_back(v3::CreateRequest(builder, type, request));
+            }
+
+            auto batch = v3::CreateBatchRequest(
+                    builder, builder.CreateVector(requests));
+
+            auto start = Clock::now();
+            auto response = conn.send(builder, v3::RequestType_BatchRequest,
+                                      batch.Union());
+            auto ns = elapsed_ns(start);
+
+            auto batch_response = response->response_as_BatchResponse();
+            if (!batch_response || !batch_response->responses()
+                    || batch_response->responses()->size() != ops.size()) {
+                die("Invalid batch response");
+            }
+
+            auto &samples = m_stats.requests[format("batch:%zu", ops.size())];
+            samples.latencies.push_back(ns);
+
+            for (auto const *entry : *batch_response->responses()) {
+                if (!entry->response()) {
+                    die("Invalid batch response entry");
+                }
+
+                auto verifier = fb::Verifier(entry->response()->data(),
+                                             entry->response()->size());
+                if (!v3::VerifyResponseBuffer(verifier)) {
+                    die("Received invalid buffer in batch");
+                }
+
+                auto sub = v3::GetResponse(entry->response()->data());
+                check_response(sub);
+
+                samples.bytes += response_bytes(sub);
+                m_offset += response_bytes(sub);
+            }
+        }
+
+        m_stats.count += ops.size();
+
+        return ops.size();
+    }
+
+    const Options &m_options;
+    std::mt19937 m_rng;
+    std::discrete_distribution<size_t> m_dist;
+    bool m_needs_file = false;
+    int32_t m_file_id = -1;
+    uint64_t m_file_size = 0;
+    uint64_t m_offset = 0;
+    Stats m_stats;
+};
+
+static double percentile_us(const std::vector<uint64_t> &sorted,
+                            unsigned int permille)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+
+    size_t rank = (sorted.size() * permille + 999) / 1000;
+    return static_cast<double>(sorted[std::max<size_t>(rank, 1) - 1]) / 1000.0;
+}
+
+static void print_samples(Samples &samples)
+{
+    auto &l = samples.latencies;
+    std::sort(l.begin(), l.end());
+
+    printf("\"count\": %zu, \"bytes\": %" PRIu64 ", \"p50_us\": %.1f, "
+           "\"p90_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, "
+           "\"max_us\": %.1f}",
+           l.size(), samples.bytes, percentile_us(l, 500),
+           percentile_us(l, 900), percentile_us(l, 990),
+           percentile_us(l, 999), percentile_us(l, 1000));
+}
+
+static bool parse_size(const char *str, uint64_t &size)
+{
+    std::string_view sv(str);
+    uint64_t multiplier = 1;
+
+    if (!sv.empty()) {
+        switch (sv.back()) {
+        case 'k': case 'K': multiplier = 1024; break;
+        case 'm': case 'M': multiplier = 1024 * 1024; break;
+        }
+        if (multiplier != 1) {
+            sv.remove_suffix(1);
+        }
+    }
+
+    if (!str_to_num(std::string(sv).c_str(), 10, size)
+            || size > UINT64_MAX / multiplier) {
+        return false;
+    }
+
+    size *= multiplier;
+    return true;
+}
+
+static bool parse_mix(const std::string &spec, std::vector<Op> &mix)
+{
+    for (auto const &entry : split(spec, ',')) {
+        Op op{};
+        std::string item = entry;
+        op.weight = 1;
+
+        if (auto pos = item.find('='); pos != std::string::npos) {
+            if (!str_to_num(item.c_str() + pos + 1, 10, op.weight)) {
+                fprintf(stderr, "Invalid weight: %s\n", entry.c_str());
+                return false;
+            }
+            item.resize(pos);
+        }
+
+        std::string arg;
+        std::string type = item;
+        if (auto pos = item.find(':'); pos != std::string::npos) {
+            arg = item.substr(pos + 1);
+            type = item.substr(0, pos);
+        }
+
+        op.name = item;
+
+        if (type == "read") {
+            op.type = OpType::Read;
+            if (!parse_size(arg.c_str(), op.size) || op.size == 0
+                    || op.size > MAX_READ_SIZE) {
+                fprintf(stderr, "Invalid read size (1 to %" PRIu64 "): %s\n",
+                        MAX_READ_SIZE, entry.c_str());
+                return false;
+            }
+        } else if (type == "dirsize") {
+            op.type = OpType::DirSize;
+            op.path = arg.empty() ? DEFAULT_DIRSIZE_PATH : arg;
+        } else if (type == "roms" && arg.empty()) {
+            op.type = OpType::Roms;
+        } else if (type == "exec" && arg.empty()) {
+            op.type = OpType::Exec;
+        } else {
+            fprintf(stderr, "Invalid request type: %s\n", entry.c_str());
+            return false;
+        }
+
+        if (op.weight > 0) {
+            mix.push_back(std::move(op));
+        }
+    }
+
+    if (mix.empty()) {
+        fprintf(stderr, "Request mix is empty\n");
+        return false;
+    }
+
+    return true;
+}
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [option...]\n"
+                    "\n"
+                    "Options:\n"
+                    "  -c, --connections <N>\n"
+                    "                  Number of concurrent connections\n"
+                    "                  (default: 8)\n"
+                    "  -n, --requests <N>\n"
+                    "                  Number of requests per connection\n"
+                    "                  thread (default: 1000)\n"
+                    "  -m, --mix <spec>\n"
+                    "                  Weighted request mix\n"
+                    "                  (default: %s)\n"
+                    "  -b, --batch <N> Send requests in batches of N\n"
+                    "  -R, --reconnect-every <N>\n"
+                    "                  Reconnect after every N requests\n"
+                    "  -f, --file <path>\n"
+                    "                  File for read requests\n"
+                    "                  (default: %s)\n"
+                    "  --exec-binary <path>\n"
+                    "                  Binary for exec requests\n"
+                    "  --exec-signature <path>\n"
+                    "                  Signature for exec requests\n",
+            prog_name, DEFAULT_MIX, DEFAULT_READ_FILE);
+}
+
+int main(int argc, char *argv[])
+{
+    enum : int
+    {
+        OPT_EXEC_BINARY    = CHAR_MAX + 1,
+        OPT_EXEC_SIGNATURE = CHAR_MAX + 2,
+    };
+
+    Options options;
+    std::string mix = DEFAULT_MIX;
+    int opt;
+
+    static const char short_options[] = "c:n:m:b:R:f:h";
+
+    static struct option long_options[] = {
+        // Arguments with short versions
+        {"connections",     required_argument, nullptr, 'c'},
+        {"requests",        required_argument, nullptr, 'n'},
+        {"mix",             required_argument, nullptr, 'm'},
+        {"batch",           required_argument, nullptr, 'b'},
+        {"reconnect-every", required_argument, nullptr, 'R'},
+        {"file",            required_argument, nullptr, 'f'},
+        {"help",            no_argument,       nullptr, 'h'},
+        // Arguments without short versions
+        {"exec-binary",     required_argument, nullptr, OPT_EXEC_BINARY},
+        {"exec-signature",  required_argument, nullptr, OPT_EXEC_SIGNATURE},
+        {nullptr,           0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'c':
+            if (!str_to_num(optarg, 10, options.connections)
+                    || options.connections == 0) {
+                fprintf(stderr, "Invalid value for -c/--connections: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'n':
+            if (!str_to_num(optarg, 10, options.requests)) {
+                fprintf(stderr, "Invalid value for -n/--requests: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'm':
+            mix = optarg;
+            break;
+
+        case 'b':
+            if (!str_to_num(optarg, 10, options.batch)
+                    || options.batch == 0) {
+                fprintf(stderr, "Invalid value for -b/--batch: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'R':
+            if (!str_to_num(optarg, 10, options.reconnect_every)) {
+                fprintf(stderr, "Invalid value for -R/--reconnect-every: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'f':
+            options.read_file = optarg;
+            break;
+
+        case OPT_EXEC_BINARY:
+            options.exec_binary = optarg;
+            break;
+
+        case OPT_EXEC_SIGNATURE:
+            options.exec_signature = optarg;
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!parse_mix(mix, options.mix)) {
+        return EXIT_FAILURE;
+    }
+
+    for (auto const &op : options.mix) {
+        if (op.type == OpType::Exec && (options.exec_binary.empty()
+                || options.exec_signature.empty())) {
+            fprintf(stderr, "exec requests require --exec-binary and "
+                            "--exec-signature\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Worker> workers;
+    workers.reserve(options.connections);
+    for (unsigned int i = 0; i < options.connections; ++i) {
+        workers.emplace_back(options, i + 1);
+    }
+
+    auto start = Clock::now();
+
+    {
+        std::vector<std::thread> threads;
+        for (auto &worker : workers) {
+            threads.emplace_back(&Worker::run, &worker);
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+    }
+
+    auto seconds = static_cast<double>(elapsed_ns(start)) / 1e9;
+
+    // Merge the per-thread statistics
+    Stats total;
+
+    for (auto const &worker : workers) {
+        auto const &stats = worker.stats();
+
+        total.count += stats.count;
+        total.connect.latencies.insert(total.connect.latencies.end(),
+                                       stats.connect.latencies.begin(),
+                                       stats.connect.latencies.end());
+
+        for (auto const &[name, samples] : stats.requests) {
+            auto &s = total.requests[name];
+            s.latencies.insert(s.latencies.end(), samples.latencies.begin(),
+                               samples.latencies.end());
+            s.bytes += samples.bytes;
+        }
+    }
+
+    uint64_t bytes = 0;
+    for (auto const &[name, samples] : total.requests) {
+        bytes += samples.bytes;
+    }
+
+    printf("{\n  \"connections\": %u,\n  \"batch\": %zu,\n",
+           options.connections, options.batch);
+    printf("  \"connect\": {");
+    print_samples(total.connect);
+    printf(",\n  \"requests\": [");
+
+    bool first = true;
+    for (auto &[name, samples] : total.requests) {
+        printf("%s\n    {\"name\": \"%s\", ", first ? "" : ",", name.c_str());
+        print_samples(samples);
+        first = false;
+    }
+
+    printf("\n  ],\n  \"total\": {\"requests\": %" PRIu64 ", "
+           "\"seconds\": %.3f, \"requests_per_s\": %.1f, \"mb_per_s\": %.1f}\n"
+           "}\n",
+           total.count, seconds, static_cast<double>(total.count) / seconds,
+           static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds);
+
+    return EXIT_SUCCESS;
+}
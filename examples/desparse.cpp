@@ -25,6 +25,7 @@
 
 #include "mbcommon/file/standard.h"
 #include "mbsparse/sparse.h"
+#include "mbsparse/sparse_util.h"
 
 int main(int argc, char *argv[])
 {
@@ -61,30 +62,14 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    char buf[10240];
-
-    while (true) {
-        auto n_read = sparse_file.read(buf, sizeof(buf));
-        if (!n_read) {
-            fprintf(stderr, "%s: Failed to read file: %s\n",
-                    input_path, n_read.error().message().c_str());
-            return EXIT_FAILURE;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        char *ptr = buf;
-
-        while (n_read.value() > 0) {
-            auto n_written = output_file.write(buf, n_read.value());
-            if (!n_written) {
-                fprintf(stderr, "%s: Failed to write file: %s\n",
-                        output_path, n_written.error().message().c_str());
-                return EXIT_FAILURE;
-            }
-            n_read.value() -= n_written.value();
-            ptr += n_written.value();
-        }
+    // The output file was just truncated, so zero chunks can be left as holes
+    auto copy_ret = mb::sparse::sparse_copy(
+            sparse_file, output_file,
+            mb::sparse::SparseCopyFlag::OutputIsZeroed);
+    if (!copy_ret) {
+        fprintf(stderr, "%s: Failed to copy sparse file: %s\n",
+                input_path, copy_ret.error().message().c_str());
+        return EXIT_FAILURE;
     }
 
     auto close_ret = output_file.close();
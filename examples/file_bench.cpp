@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the per-call overhead of reading small chunks through File& versus
+// FileRef<T>. MemoryFile is not final, so it serves as the baseline for the
+// forwarding path.
+
+#include <chrono>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/file/chunked_memory.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_ref.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+static constexpr size_t DATA_SIZE = 64 * 1024 * 1024;
+static constexpr size_t ROUNDS = 5;
+
+template<typename Fn>
+static double measure(File &file, size_t chunk_size, Fn &&fn)
+{
+    std::vector<unsigned char> buf(chunk_size);
+    double best = 0;
+
+    for (size_t round = 0; round < ROUNDS; ++round) {
+        if (!file.seek(0, SEEK_SET)) {
+            fprintf(stderr, "Failed to seek\n");
+            exit(EXIT_FAILURE);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (size_t pos = 0; pos < DATA_SIZE; pos += chunk_size) {
+            if (!fn(buf.data(), chunk_size)) {
+                fprintf(stderr, "Failed to read\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        auto ns = std::chrono::duration<double, std::nano>(end - start).count()
+                / static_cast<double>(DATA_SIZE / chunk_size);
+
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    return best;
+}
+
+template<typename T>
+static void run(const char *name, T &file)
+{
+    printf("%s\n", name);
+    printf("  %10s  %14s  %14s\n", "chunk size", "File& (ns)", "FileRef (ns)");
+
+    for (size_t chunk_size : {1, 4, 16, 64, 512, 4096}) {
+        double virt = measure(file, chunk_size, [&](void *buf, size_t size) {
+            return !!file_read_exact(static_cast<File &>(file), buf, size);
+        });
+        double direct = measure(file, chunk_size, [&](void *buf, size_t size) {
+            return !!file_read_exact(FileRef<T>(file), buf, size);
+        });
+
+        printf("  %10zu  %14.2f  %14.2f\n", chunk_size, virt, direct);
+    }
+}
+
+int main()
+{
+    std::vector<unsigned char> data(DATA_SIZE);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i);
+    }
+
+    MemoryFile memory_file(data.data(), data.size());
+    if (!memory_file.is_open()) {
+        fprintf(stderr, "Failed to open memory file\n");
+        return EXIT_FAILURE;
+    }
+
+    ChunkedMemoryFile chunked_file;
+    if (!chunked_file.open()
+            || !file_write_exact(chunked_file, data.data(), data.size())) {
+        fprintf(stderr, "Failed to create chunked memory file\n");
+        return EXIT_FAILURE;
+    }
+
+    run("MemoryFile", memory_file);
+    run("ChunkedMemoryFile", chunked_file);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,932 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Measures the libmbutil file, parsing, and archive operations that mbtool
+// runs during boot, ROM installation, and backups. The operations run on
+// synthetic trees in a scratch directory (-d, defaults to $TMPDIR or
+// /data/local/tmp):
+//
+//   small: 64 directories with 64 4 KiB files each, like /system/etc
+//   large: 4 32 MiB files, like APKs and system images
+//   deep:  64 nested directories with 4 1 KiB files each
+//
+// and on generated build.prop, fstab, and mountinfo inputs of realistic size.
+// With -m N, N tmpfs mounts are added in a private mount namespace (requires
+// root) so that the mount table is as large as on a device.
+//
+// Each benchmark reports the best of -r rounds. "ops" is the number of items
+// (files, lines, mounts, or calls) handled per round. syscalls_per_op is
+// counted with the raw_syscalls/sys_enter tracepoint in a separate round and is
+// null if perf events are not available (eg. perf_event_paranoid is too high).
+// Results are written to stdout as JSON.
+
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/integer.h"
+
+#include "mbutil/archive.h"
+#include "mbutil/blkid.h"
+#include "mbutil/copy.h"
+#include "mbutil/delete.h"
+#include "mbutil/fstab.h"
+#include "mbutil/hash.h"
+#include "mbutil/mount.h"
+#include "mbutil/properties.h"
+#include "mbutil/selinux.h"
+
+using namespace mb;
+using namespace mb::util;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t SMALL_DIRS = 64;
+static constexpr size_t SMALL_FILES_PER_DIR = 64;
+static constexpr size_t SMALL_FILE_SIZE = 4096;
+static constexpr size_t LARGE_FILES = 4;
+static constexpr size_t LARGE_FILE_SIZE = 32 * 1024 * 1024;
+static constexpr size_t DEEP_LEVELS = 64;
+static constexpr size_t DEEP_FILES_PER_LEVEL = 4;
+static constexpr size_t DEEP_FILE_SIZE = 1024;
+
+static constexpr size_t BUILD_PROP_LINES = 1000;
+static constexpr size_t FSTAB_LINES = 40;
+static constexpr size_t PARSE_ITERATIONS = 100;
+static constexpr size_t BLKID_ITERATIONS = 1000;
+
+static constexpr CopyFlags COPY_FLAGS = CopyFlag::CopyAttributes
+        | CopyFlag::CopyXattrs | CopyFlag::ExcludeTopLevel;
+
+struct Tree
+{
+    const char *name;
+    std::string path;
+    uint64_t files;
+    uint64_t bytes;
+};
+
+struct Options
+{
+    std::string work_dir;
+    size_t rounds = 5;
+    std::string filter;
+};
+
+[[noreturn]] static void die(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+[[noreturn]] static void die(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+static uint32_t next_random(uint32_t &state)
+{
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+// Counts the syscalls made by all threads of the process. A counter is opened
+// for each existing thread since the counts of inherited counters are only
+// added to the parent's once the child thread exits, which the executor's
+// workers never do.
+class SyscallCounter
+{
+public:
+    SyscallCounter()
+    {
+        m_id = read_tracepoint_id();
+    }
+
+    ~SyscallCounter()
+    {
+        close_all();
+    }
+
+    bool available() const
+    {
+        return m_id >= 0;
+    }
+
+    bool start()
+    {
+        close_all();
+
+        DIR *dp = opendir("/proc/self/task");
+        if (!dp) {
+            return false;
+        }
+
+        while (auto *ent = readdir(dp)) {
+            pid_t tid;
+            if (!str_to_num(ent->d_name, 10, tid)) {
+                continue;
+            }
+
+            perf_event_attr attr = {};
+            attr.type = PERF_TYPE_TRACEPOINT;
+            attr.size = sizeof(attr);
+            attr.config = static_cast<__u64>(m_id);
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_hv = 1;
+
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, tid,
+                                              -1, -1, PERF_FLAG_FD_CLOEXEC));
+            if (fd < 0) {
+                if (errno == ESRCH) {
+                    continue;
+                }
+                closedir(dp);
+                close_all();
+                return false;
+            }
+
+            m_fds.push_back(fd);
+        }
+
+        closedir(dp);
+
+        for (int fd : m_fds) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        return true;
+    }
+
+    std::optional<uint64_t> stop()
+    {
+        uint64_t total = 0;
+
+        for (int fd : m_fds) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+        for (int fd : m_fds) {
+            uint64_t count;
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                close_all();
+                return std::nullopt;
+            }
+            total += count;
+        }
+
+        close_all();
+        return total;
+    }
+
+private:
+    static int read_tracepoint_id()
+    {
+        for (auto path : {
+            "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+            "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+        }) {
+            FILE *fp = fopen(path, "re");
+            if (!fp) {
+                continue;
+            }
+
+            int id;
+            bool ok = fscanf(fp, "%d", &id) == 1;
+            fclose(fp);
+
+            if (ok) {
+                return id;
+            }
+        }
+
+        return -1;
+    }
+
+    void close_all()
+    {
+        for (int fd : m_fds) {
+            close(fd);
+        }
+        m_fds.clear();
+    }
+
+    int m_id;
+    std::vector<int> m_fds;
+};
+
+class Runner
+{
+public:
+    explicit Runner(const Options &options) : m_options(options)
+    {
+        printf("{\n  \"benchmarks\": [");
+    }
+
+    ~Runner()
+    {
+        printf("\n  ]\n}\n");
+    }
+
+    // Runs `setup` (untimed) and then `fn` (timed) each round
+    void run(const std::string &name, uint64_t ops, uint64_t bytes,
+             const std::function<void()> &setup,
+             const std::function<void()> &fn)
+    {
+        if (!m_options.filter.empty()
+                && name.find(m_options.filter) == std::string::npos) {
+            return;
+        }
+
+        double best = 0;
+
+        for (size_t i = 0; i < m_options.rounds; ++i) {
+            if (setup) {
+                setup();
+            }
+
+            auto start = Clock::now();
+
+            fn();
+
+            auto end = Clock::now();
+
+            auto ns = std::chrono::duration<double, std::nano>(
+                    end - start).count();
+            if (i == 0 || ns < best) {
+                best = ns;
+            }
+        }
+
+        // Count syscalls in a separate round so that the counters do not
+        // affect the timings
+        std::optional<uint64_t> syscalls;
+
+        if (m_syscalls.available()) {
+            if (setup) {
+                setup();
+            }
+            if (m_syscalls.start()) {
+                fn();
+                syscalls = m_syscalls.stop();
+            }
+        }
+
+        print_result(name, ops, bytes, best, syscalls);
+    }
+
+    void run(const std::string &name, uint64_t ops, uint64_t bytes,
+             const std::function<void()> &fn)
+    {
+        run(name, ops, bytes, nullptr, fn);
+    }
+
+private:
+    void print_result(const std::string &name, uint64_t ops, uint64_t bytes,
+                      double ns, std::optional<uint64_t> syscalls)
+    {
+        auto ops_d = static_cast<double>(ops);
+        auto secs = ns / 1e9;
+
+        printf("%s\n    {\"name\": \"%s\", \"ops\": %" PRIu64 ", "
+               "\"bytes\": %" PRIu64 ", \"ns_per_op\": %.0f, "
+               "\"ops_per_s\": %.1f, \"mb_per_s\": %.1f, ",
+               m_first ? "" : ",", name.c_str(), ops, bytes, ns / ops_d,
+               ops_d / secs,
+               static_cast<double>(bytes) / (1024.0 * 1024.0) / secs);
+
+        if (syscalls) {
+            printf("\"syscalls_per_op\": %.1f}",
+                   static_cast<double>(*syscalls) / ops_d);
+        } else {
+            printf("\"syscalls_per_op\": null}");
+        }
+
+        fflush(stdout);
+
+        m_first = false;
+    }
+
+    const Options &m_options;
+    SyscallCounter m_syscalls;
+    bool m_first = true;
+};
+
+static void make_dir(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+        die("%s: Failed to create directory: %s", path.c_str(),
+            strerror(errno));
+    }
+}
+
+static void write_file(const std::string &path, const void *data, size_t size)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        die("%s: Failed to open file: %s", path.c_str(), strerror(errno));
+    }
+
+    auto ptr = static_cast<const char *>(data);
+
+    while (size > 0) {
+        ssize_t n = write(fd, ptr, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            die("%s: Failed to write file: %s", path.c_str(), strerror(errno));
+        }
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    if (close(fd) < 0) {
+        die("%s: Failed to close file: %s", path.c_str(), strerror(errno));
+    }
+}
+
+static void write_random_file(const std::string &path, size_t size,
+                              uint32_t &state)
+{
+    std::vector<unsigned char> data(size);
+    for (auto &c : data) {
+        c = static_cast<unsigned char>(next_random(state));
+    }
+    write_file(path, data.data(), data.size());
+}
+
+static void write_string(const std::string &path, const std::string &data)
+{
+    write_file(path, data.data(), data.size());
+}
+
+static void remove_tree(const std::string &path)
+{
+    if (auto r = delete_recursive(path); !r) {
+        die("%s: Failed to delete: %s", r.error().path.c_str(),
+            r.error().ec.message().c_str());
+    }
+}
+
+static Tree create_small_tree(const std::string &dir)
+{
+    Tree tree{"small", dir + "/small", 0, 0};
+    uint32_t state = 0x12345678;
+    char name[32];
+
+    make_dir(tree.path);
+
+    for (size_t i = 0; i < SMALL_DIRS; ++i) {
+        snprintf(name, sizeof(name), "/dir%zu", i);
+        std::string subdir = tree.path + name;
+        make_dir(subdir);
+
+        for (size_t j = 0; j < SMALL_FILES_PER_DIR; ++j) {
+            snprintf(name, sizeof(name), "/file%zu.xml", j);
+            write_random_file(subdir + name, SMALL_FILE_SIZE, state);
+            ++tree.files;
+            tree.bytes += SMALL_FILE_SIZE;
+        }
+    }
+
+    return tree;
+}
+
+static Tree create_large_tree(const std::string &dir)
+{
+    Tree tree{"large", dir + "/large", 0, 0};
+    uint32_t state = 0x87654321;
+    char name[32];
+
+    make_dir(tree.path);
+
+    for (size_t i = 0; i < LARGE_FILES; ++i) {
+        snprintf(name, sizeof(name), "/file%zu.apk", i);
+        write_random_file(tree.path + name, LARGE_FILE_SIZE, state);
+        ++tree.files;
+        tree.bytes += LARGE_FILE_SIZE;
+    }
+
+    return tree;
+}
+
+static Tree create_deep_tree(const std::string &dir)
+{
+    Tree tree{"deep", dir + "/deep", 0, 0};
+    uint32_t state = 0x0badf00d;
+    char name[32];
+
+    std::string path = tree.path;
+    make_dir(path);
+
+    for (size_t i = 0; i < DEEP_LEVELS; ++i) {
+        for (size_t j = 0; j < DEEP_FILES_PER_LEVEL; ++j) {
+            snprintf(name, sizeof(name), "/file%zu", j);
+            write_random_file(path + name, DEEP_FILE_SIZE, state);
+            ++tree.files;
+            tree.bytes += DEEP_FILE_SIZE;
+        }
+
+        snprintf(name, sizeof(name), "/level%zu", i);
+        path += name;
+        make_dir(path);
+    }
+
+    return tree;
+}
+
+// Comments, blank lines, and mostly short values, like a device's
+// /system/build.prop plus its vendor and odm additions
+static std::string create_build_prop(uint32_t &state)
+{
+    static constexpr const char *prefixes[] = {
+        "ro.build", "ro.product", "ro.vendor", "persist.sys", "dalvik.vm",
+        "ro.config", "ro.hardware", "debug", "ro.boot", "vendor.audio",
+    };
+
+    std::string data;
+    char line[128];
+
+    for (size_t i = 0; i < BUILD_PROP_LINES; ++i) {
+        switch (next_random(state) % 16) {
+        case 0:
+            data += "\n";
+            break;
+        case 1:
+            data += "# Additional properties\n";
+            break;
+        default:
+            snprintf(line, sizeof(line), "%s.key%zu=value_%" PRIu32 "\n",
+                     prefixes[next_random(state) % std::size(prefixes)], i,
+                     next_random(state));
+            data += line;
+            break;
+        }
+    }
+
+    data += "ro.mbbench.last=1\n";
+
+    return data;
+}
+
+static std::string create_fstab()
+{
+    static constexpr const char *partitions[] = {
+        "system", "vendor", "cache", "userdata", "boot", "recovery", "persist",
+        "modem", "dsp", "efs", "misc", "odm", "product", "metadata",
+    };
+
+    std::string data = "# Android fstab file.\n"
+                       "#<src> <mnt_point> <type> <mnt_flags> <fs_mgr_flags>\n";
+    char line[256];
+
+    for (size_t i = 0; i < FSTAB_LINES; ++i) {
+        auto partition = partitions[i % std::size(partitions)];
+
+        snprintf(line, sizeof(line),
+                 "/dev/block/bootdevice/by-name/%s%zu /%s%zu ext4 "
+                 "nosuid,nodev,noatime,barrier=1,data=ordered "
+                 "wait,check,formattable,encryptable=footer\n",
+                 partition, i, partition, i);
+        data += line;
+    }
+
+    return data;
+}
+
+// Adds tmpfs mounts in a private mount namespace so that the mount table has a
+// realistic number of entries without affecting the rest of the system
+static bool add_mounts(const std::string &dir, size_t count)
+{
+    if (unshare(CLONE_NEWNS) < 0) {
+        fprintf(stderr, "Failed to unshare mount namespace: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    if (::mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) < 0) {
+        fprintf(stderr, "Failed to make mounts private: %s\n",
+                strerror(errno));
+        return false;
+    }
+
+    std::string base = dir + "/mnt";
+    make_dir(base);
+
+    for (size_t i = 0; i < count; ++i) {
+        std::string target = base + "/" + std::to_string(i);
+        make_dir(target);
+
+        if (::mount("tmpfs", target.c_str(), "tmpfs", MS_NOSUID | MS_NODEV,
+                    "size=4k") < 0) {
+            fprintf(stderr, "%s: Failed to mount tmpfs: %s\n",
+                    target.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void bench_trees(Runner &runner, const std::string &dir,
+                        const std::vector<Tree> &trees)
+{
+    std::string target = dir + "/target";
+
+    for (auto const &tree : trees) {
+        std::string prefix = std::string("copy_dir/") + tree.name;
+
+        for (auto parallel : { false, true }) {
+            auto flags = COPY_FLAGS;
+            if (parallel) {
+                flags |= CopyFlag::Parallel;
+            }
+
+            runner.run(prefix + (parallel ? "/parallel" : "/serial"),
+                       tree.files, tree.bytes, [&] {
+                remove_tree(target);
+                make_dir(target);
+            }, [&] {
+                if (auto r = copy_dir(tree.path, target, flags); !r) {
+                    die("%s: Failed to copy: %s", r.error().path.c_str(),
+                        r.error().ec.message().c_str());
+                }
+            });
+        }
+
+        for (auto parallel : { false, true }) {
+            DeleteFlags flags;
+            if (parallel) {
+                flags |= DeleteFlag::Parallel;
+            }
+
+            runner.run(std::string("delete_recursive/") + tree.name
+                       + (parallel ? "/parallel" : "/serial"),
+                       tree.files, tree.bytes, [&] {
+                remove_tree(target);
+                make_dir(target);
+                if (auto r = copy_dir(tree.path, target, COPY_FLAGS); !r) {
+                    die("%s: Failed to copy: %s", r.error().path.c_str(),
+                        r.error().ec.message().c_str());
+                }
+            }, [&] {
+                if (auto r = delete_recursive(target, flags); !r) {
+                    die("%s: Failed to delete: %s", r.error().path.c_str(),
+                        r.error().ec.message().c_str());
+                }
+            });
+        }
+    }
+
+    remove_tree(target);
+
+    // copy_file() and sha512_hash() on the large files
+    auto const &large = trees[1];
+    std::string source = large.path + "/file0.apk";
+    std::string copy = dir + "/file0.apk";
+
+    runner.run("copy_file/large", 1, LARGE_FILE_SIZE, [&] {
+        unlink(copy.c_str());
+    }, [&] {
+        if (auto r = copy_file(source, copy, COPY_FLAGS); !r) {
+            die("%s: Failed to copy: %s", r.error().path.c_str(),
+                r.error().ec.message().c_str());
+        }
+    });
+
+    unlink(copy.c_str());
+
+    runner.run("sha512_hash/large", 1, LARGE_FILE_SIZE, [&] {
+        if (auto r = sha512_hash(source); !r) {
+            die("%s: Failed to hash: %s", source.c_str(),
+                r.error().message().c_str());
+        }
+    });
+
+    auto const &small = trees[0];
+    std::string small_file = small.path + "/dir0/file0.xml";
+
+    runner.run("sha512_hash/small", PARSE_ITERATIONS,
+               PARSE_ITERATIONS * SMALL_FILE_SIZE, [&] {
+        for (size_t i = 0; i < PARSE_ITERATIONS; ++i) {
+            if (auto r = sha512_hash(small_file); !r) {
+                die("%s: Failed to hash: %s", small_file.c_str(),
+                    r.error().message().c_str());
+            }
+        }
+    });
+}
+
+static void bench_archive(Runner &runner, const std::string &dir,
+                          const std::vector<Tree> &trees)
+{
+    std::string archive = dir + "/archive.tar";
+    std::string target = dir + "/target";
+
+    for (auto const &tree : trees) {
+        std::string base = tree.path.substr(0, tree.path.rfind('/'));
+
+        runner.run(std::string("libarchive_tar_create/") + tree.name,
+                   tree.files, tree.bytes, [&] {
+            if (!libarchive_tar_create(archive, base, { tree.name },
+                                       CompressionType::None, 0)) {
+                die("%s: Failed to create archive", archive.c_str());
+            }
+        });
+
+        runner.run(std::string("libarchive_tar_extract/") + tree.name,
+                   tree.files, tree.bytes, [&] {
+            remove_tree(target);
+            make_dir(target);
+        }, [&] {
+            if (!libarchive_tar_extract(archive, target, {},
+                                        CompressionType::None, false)) {
+                die("%s: Failed to extract archive", archive.c_str());
+            }
+        });
+    }
+
+    remove_tree(target);
+    unlink(archive.c_str());
+    unlink((archive + ARCHIVE_INDEX_SUFFIX).c_str());
+}
+
+static void bench_selinux(Runner &runner, const std::vector<Tree> &trees)
+{
+    for (auto const &tree : trees) {
+        // Setting the current context again exercises the same syscalls as
+        // relabeling without changing anything
+        auto context = selinux_lget_context(tree.path);
+        if (!context) {
+            fprintf(stderr, "%s: Skipping selinux benchmarks: %s\n",
+                    tree.path.c_str(), context.error().message().c_str());
+            return;
+        }
+
+        runner.run(std::string("selinux_lset_context_recursive/") + tree.name,
+                   tree.files, 0, [&] {
+            if (auto r = selinux_lset_context_recursive(tree.path, *context);
+                    !r) {
+                die("%s: Failed to set context: %s", tree.path.c_str(),
+                    r.error().message().c_str());
+            }
+        });
+    }
+}
+
+static void bench_parsers(Runner &runner, const std::string &dir)
+{
+    uint32_t state = 0xcafebabe;
+
+    std::string build_prop = dir + "/build.prop";
+    std::string build_prop_data = create_build_prop(state);
+    write_string(build_prop, build_prop_data);
+
+    runner.run("property_file_iter/build.prop",
+               PARSE_ITERATIONS * BUILD_PROP_LINES,
+               PARSE_ITERATIONS * build_prop_data.size(), [&] {
+        for (size_t i = 0; i < PARSE_ITERATIONS; ++i) {
+            size_t count = 0;
+            if (!property_file_iter(build_prop, {},
+                                    [&](std::string_view, std::string_view) {
+                ++count;
+                return PropertyIterAction::Continue;
+            }) || count == 0) {
+                die("%s: Failed to iterate properties", build_prop.c_str());
+            }
+        }
+    });
+
+    // The key is on the last line, so the whole file is read
+    runner.run("property_file_get/build.prop", PARSE_ITERATIONS,
+               PARSE_ITERATIONS * build_prop_data.size(), [&] {
+        for (size_t i = 0; i < PARSE_ITERATIONS; ++i) {
+            if (!property_file_get(build_prop, "ro.mbbench.last")) {
+                die("%s: Failed to get property", build_prop.c_str());
+            }
+        }
+    });
+
+    std::string fstab = dir + "/fstab.qcom";
+    std::string fstab_data = create_fstab();
+    write_string(fstab, fstab_data);
+
+    runner.run("read_fstab/fstab", PARSE_ITERATIONS * FSTAB_LINES,
+               PARSE_ITERATIONS * fstab_data.size(), [&] {
+        for (size_t i = 0; i < PARSE_ITERATIONS; ++i) {
+            if (auto r = read_fstab(fstab); !r || r.value().empty()) {
+                die("%s: Failed to read fstab", fstab.c_str());
+            }
+        }
+    });
+
+    auto entries = get_mount_entries();
+    if (!entries) {
+        die("Failed to get mount entries: %s",
+            entries.error().message().c_str());
+    }
+    uint64_t mounts = entries.value().size();
+
+    runner.run("get_mount_entries", PARSE_ITERATIONS * mounts, 0, [&] {
+        for (size_t i = 0; i < PARSE_ITERATIONS; ++i) {
+            if (auto r = get_mount_entries(); !r) {
+                die("Failed to get mount entries: %s",
+                    r.error().message().c_str());
+            }
+        }
+    });
+
+    runner.run("mount_table_refresh", PARSE_ITERATIONS * mounts, 0, [&] {
+        MountTable table;
+
+        for (size_t i = 0; i < PARSE_ITERATIONS; ++i) {
+            table.invalidate();
+            if (auto r = table.refresh(); !r) {
+                die("Failed to refresh mount table: %s",
+                    r.error().message().c_str());
+            }
+        }
+    });
+
+    // 128 KiB covers every superblock location that blkid_get_fs_type()
+    // probes, so the unknown image shows the cost of a full miss
+    std::vector<unsigned char> image(128 * 1024);
+    std::string unknown_image = dir + "/unknown.img";
+    write_file(unknown_image, image.data(), image.size());
+
+    std::string ext4_image = dir + "/ext4.img";
+    image[0x438] = 0x53;
+    image[0x439] = 0xef;
+    write_file(ext4_image, image.data(), image.size());
+
+    for (auto const &[name, path] : {
+        std::pair{"blkid_get_fs_type/ext4", ext4_image},
+        std::pair{"blkid_get_fs_type/unknown", unknown_image},
+    }) {
+        runner.run(name, BLKID_ITERATIONS, 0, [&] {
+            for (size_t i = 0; i < BLKID_ITERATIONS; ++i) {
+                (void) blkid_get_fs_type(path);
+            }
+        });
+    }
+
+    unlink(build_prop.c_str());
+    unlink(fstab.c_str());
+    unlink(unknown_image.c_str());
+    unlink(ext4_image.c_str());
+}
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [option...]\n"
+                    "\n"
+                    "Options:\n"
+                    "  -d, --work-dir <dir>\n"
+                    "                  Directory for the synthetic trees\n"
+                    "                  (default: $TMPDIR or /data/local/tmp)\n"
+                    "  -r, --rounds <N>\n"
+                    "                  Number of rounds per benchmark\n"
+                    "                  (default: 5)\n"
+                    "  -f, --filter <text>\n"
+                    "                  Only run benchmarks whose names\n"
+                    "                  contain <text>\n"
+                    "  -m, --mounts <N>\n"
+                    "                  Add N tmpfs mounts in a private mount\n"
+                    "                  namespace (requires root)\n",
+            prog_name);
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    size_t extra_mounts = 0;
+    int opt;
+
+    static const char short_options[] = "d:r:f:m:h";
+
+    static struct option long_options[] = {
+        {"work-dir", required_argument, nullptr, 'd'},
+        {"rounds",   required_argument, nullptr, 'r'},
+        {"filter",   required_argument, nullptr, 'f'},
+        {"mounts",   required_argument, nullptr, 'm'},
+        {"help",     no_argument,       nullptr, 'h'},
+        {nullptr,    0,                 nullptr, 0},
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'd':
+            options.work_dir = optarg;
+            break;
+
+        case 'r':
+            if (!str_to_num(optarg, 10, options.rounds)
+                    || options.rounds == 0) {
+                fprintf(stderr, "Invalid value for -r/--rounds: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'f':
+            options.filter = optarg;
+            break;
+
+        case 'm':
+            if (!str_to_num(optarg, 10, extra_mounts)) {
+                fprintf(stderr, "Invalid value for -m/--mounts: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (options.work_dir.empty()) {
+        const char *tmpdir = getenv("TMPDIR");
+        options.work_dir = tmpdir && *tmpdir ? tmpdir : "/data/local/tmp";
+    }
+
+    std::string dir = options.work_dir + "/mbutil_bench.XXXXXX";
+    if (!mkdtemp(dir.data())) {
+        die("%s: Failed to create directory: %s", dir.c_str(),
+            strerror(errno));
+    }
+
+    if (extra_mounts > 0 && !add_mounts(dir, extra_mounts)) {
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Tree> trees;
+    trees.push_back(create_small_tree(dir));
+    trees.push_back(create_large_tree(dir));
+    trees.push_back(create_deep_tree(dir));
+
+    {
+        Runner runner(options);
+
+        bench_trees(runner, dir, trees);
+        bench_archive(runner, dir, trees);
+        bench_selinux(runner, trees);
+        bench_parsers(runner, dir);
+    }
+
+    // The tmpfs mounts disappear with the mount namespace, but their
+    // mountpoints must be unmounted before the directory can be deleted
+    if (extra_mounts > 0) {
+        (void) unmount_all(dir);
+    }
+
+    remove_tree(dir);
+
+    return EXIT_SUCCESS;
+}
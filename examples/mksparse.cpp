@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file/standard.h"
+#include "mbsparse/sparse_writer.h"
+
+int main(int argc, char *argv[])
+{
+    mb::sparse::SparseWriterFlags flags;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; ++argi) {
+        if (strcmp(argv[argi], "--dont-care") == 0) {
+            flags |= mb::sparse::SparseWriterFlag::DontCareZeroBlocks;
+        } else if (strcmp(argv[argi], "--crc32") == 0) {
+            flags |= mb::sparse::SparseWriterFlag::WriteCrc32;
+        } else {
+            break;
+        }
+    }
+
+    if (argc - argi != 2) {
+        std::fprintf(stderr, "Usage: %s [--dont-care] [--crc32]"
+                     " <input file> <output file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char *input_path = argv[argi];
+    const char *output_path = argv[argi + 1];
+
+    mb::StandardFile input_file;
+    mb::StandardFile output_file;
+    mb::sparse::SparseWriter sparse_file;
+
+    auto open_ret = input_file.open(input_path, mb::FileOpenMode::ReadOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for reading: %s\n",
+                input_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = output_file.open(output_path, mb::FileOpenMode::WriteOnly);
+    if (!open_ret) {
+        fprintf(stderr, "%s: Failed to open for writing: %s\n",
+                output_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    open_ret = sparse_file.open(&output_file, flags);
+    if (!open_ret) {
+        fprintf(stderr, "%s: %s\n",
+                output_path, open_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    static char buf[1024 * 1024];
+
+    while (true) {
+        auto n_read = input_file.read(buf, sizeof(buf));
+        if (!n_read) {
+            fprintf(stderr, "%s: Failed to read file: %s\n",
+                    input_path, n_read.error().message().c_str());
+            return EXIT_FAILURE;
+        } else if (n_read.value() == 0) {
+            break;
+        }
+
+        auto n_written = sparse_file.write(buf, n_read.value());
+        if (!n_written) {
+            fprintf(stderr, "%s: Failed to write file: %s\n",
+                    output_path, n_written.error().message().c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    auto close_ret = sparse_file.close();
+    if (!close_ret) {
+        fprintf(stderr, "%s: Failed to write sparse file: %s\n",
+                output_path, close_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    close_ret = output_file.close();
+    if (!close_ret) {
+        fprintf(stderr, "%s: Failed to close file: %s\n",
+                output_path, close_ret.error().message().c_str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,633 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Measures the speed of ZipPatcher, OdinPatcher, and RamdiskUpdater on
+// synthetic inputs. A ROM zip and an Odin tarball of configurable size and file
+// count, along with a fake data directory containing the mbtool binaries, are
+// generated in a work directory before running the patchers.
+//
+// Every run happens in a forked child process so that the peak RSS and I/O
+// counters only cover that run. The fastest of the iterations is reported.
+// temp_bytes_written is the number of bytes written to anything other than the
+// output file, which is mostly temporary files. The per-step timings are taken
+// from the patchers' "Timing:" debug log messages, so they are missing if
+// libmbpatcher was built with MB_LOG_MIN_LEVEL below MB_LOG_LEVEL_DEBUG.
+// Results are written to stdout as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <mbcommon/integer.h>
+#include <mblog/base_logger.h>
+#include <mblog/logging.h>
+#include <mbpatcher/patcherconfig.h>
+#include <mbpatcher/patcherinterface.h>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t CHUNK_SIZE = 1024 * 1024;
+static constexpr char ARCHITECTURE[] = "arm64-v8a";
+static constexpr size_t MAX_TIMINGS = 16;
+
+struct Options
+{
+    std::string work_dir;
+    uint64_t zip_size = 256;
+    uint64_t zip_files = 2000;
+    uint64_t odin_size = 512;
+    unsigned int iterations = 3;
+    unsigned int threads = 0;
+};
+
+// Passed from the child process to the parent through a pipe
+struct Result
+{
+    bool success;
+    double seconds;
+    uint64_t files;
+    uint64_t peak_rss_kib;
+    uint64_t bytes_written;
+    uint64_t output_bytes;
+    size_t timings;
+    char timing_names[MAX_TIMINGS][32];
+    double timing_ms[MAX_TIMINGS];
+};
+
+[[noreturn]] static void die(const char *what)
+{
+    fprintf(stderr, "%s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+// Collects the "Timing: <step>: <ms> ms" messages logged by the patchers
+class TimingLogger : public mb::log::BaseLogger
+{
+public:
+    explicit TimingLogger(Result &result) : m_result(result)
+    {
+    }
+
+    void log(const mb::log::LogRecord &rec) override
+    {
+        char name[32];
+        double ms;
+
+        if (m_result.timings < MAX_TIMINGS
+                && sscanf(rec.msg.c_str(), "Timing: %31[^:]: %lf ms",
+                          name, &ms) == 2) {
+            auto i = m_result.timings++;
+            strcpy(m_result.timing_names[i], name);
+            m_result.timing_ms[i] = ms;
+        } else if (rec.prio == mb::log::LogLevel::Error) {
+            fprintf(stderr, "%s\n", rec.fmt_msg.c_str());
+        }
+    }
+
+    bool formatted() override
+    {
+        return true;
+    }
+
+private:
+    Result &m_result;
+};
+
+static uint32_t next_random(uint32_t &state)
+{
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+// Alternating 4 KiB blocks of random and repetitive data, which compresses to
+// roughly half its size
+static void fill_data(std::vector<unsigned char> &buf, uint32_t &state)
+{
+    for (size_t i = 0; i < buf.size(); ++i) {
+        if ((i / 4096) % 2 == 0) {
+            buf[i] = static_cast<unsigned char>(next_random(state));
+        } else {
+            buf[i] = static_cast<unsigned char>("DualBootPatcher"[i % 15]);
+        }
+    }
+}
+
+static void write_file(const std::string &path, uint64_t size, uint32_t &state)
+{
+    FILE *fp = fopen(path.c_str(), "wbe");
+    if (!fp) {
+        die("Failed to create file");
+    }
+
+    std::vector<unsigned char> buf(CHUNK_SIZE);
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+        buf.resize(n);
+        fill_data(buf, state);
+
+        if (fwrite(buf.data(), 1, n, fp) != n) {
+            die("Failed to write file");
+        }
+        size -= n;
+    }
+
+    if (fclose(fp) != 0) {
+        die("Failed to close file");
+    }
+}
+
+static void make_dir(const std::string &path)
+{
+    if (mkdir(path.c_str(), 0755) < 0 && errno != EEXIST) {
+        die("Failed to create directory");
+    }
+}
+
+static void create_data_dir(const std::string &dir)
+{
+    std::string arch_dir = dir + "/binaries/android/" + ARCHITECTURE;
+    uint32_t state = 0x11111111;
+
+    make_dir(dir);
+    make_dir(dir + "/binaries");
+    make_dir(dir + "/binaries/android");
+    make_dir(arch_dir);
+    make_dir(dir + "/scripts");
+
+    for (auto const *name : {
+        "file-contexts-tool", "fsck-wrapper", "fuse-sparse", "mbtool",
+        "mbtool_recovery", "mount.exfat", "odinupdater",
+    }) {
+        write_file(arch_dir + "/" + name, 2 * 1024 * 1024, state);
+        write_file(arch_dir + "/" + name + ".sig", 512, state);
+    }
+
+    write_file(dir + "/scripts/bb-wrapper.sh", 4096, state);
+    write_file(dir + "/scripts/bb-wrapper.sh.sig", 512, state);
+}
+
+static void archive_add(archive *a, const std::string &name,
+                        const std::string &contents)
+{
+    archive_entry *entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_size(entry, static_cast<la_int64_t>(contents.size()));
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+
+    if (archive_write_header(a, entry) != ARCHIVE_OK
+            || archive_write_data(a, contents.data(), contents.size())
+                    != static_cast<la_ssize_t>(contents.size())) {
+        die(archive_error_string(a));
+    }
+
+    archive_entry_free(entry);
+}
+
+static void archive_add(archive *a, const std::string &name, uint64_t size,
+                        uint32_t &state)
+{
+    archive_entry *entry = archive_entry_new();
+    archive_entry_set_pathname(entry, name.c_str());
+    archive_entry_set_size(entry, static_cast<la_int64_t>(size));
+    archive_entry_set_filetype(entry, AE_IFREG);
+    archive_entry_set_perm(entry, 0644);
+
+    if (archive_write_header(a, entry) != ARCHIVE_OK) {
+        die(archive_error_string(a));
+    }
+
+    std::vector<unsigned char> buf(CHUNK_SIZE);
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+        buf.resize(n);
+        fill_data(buf, state);
+
+        if (archive_write_data(a, buf.data(), n)
+                != static_cast<la_ssize_t>(n)) {
+            die(archive_error_string(a));
+        }
+        size -= n;
+    }
+
+    archive_entry_free(entry);
+}
+
+// Updater script with the functions that StandardPatcher replaces
+static std::string create_updater_script(uint64_t files)
+{
+    std::string script;
+
+    script += "ui_print(\"Installing synthetic ROM\");\n";
+    script += "mount(\"ext4\", \"EMMC\", "
+              "\"/dev/block/bootdevice/by-name/system\", \"/system\");\n";
+    script += "format(\"ext4\", \"EMMC\", "
+              "\"/dev/block/bootdevice/by-name/system\", \"0\", "
+              "\"/system\");\n";
+
+    for (uint64_t i = 0; i < files; ++i) {
+        script += "set_metadata(\"/system/app/App" + std::to_string(i)
+                + "/App" + std::to_string(i) + ".apk\", \"uid\", 0, "
+                  "\"gid\", 0, \"mode\", 0644);\n";
+    }
+
+    script += "run_program(\"/sbin/busybox\", \"umount\", \"/system\");\n";
+    script += "unmount(\"/system\");\n";
+
+    return script;
+}
+
+static void create_rom_zip(const std::string &path, uint64_t size,
+                           uint64_t files)
+{
+    archive *a = archive_write_new();
+    uint32_t state = 0x22222222;
+
+    if (archive_write_set_format_zip(a) != ARCHIVE_OK
+            || archive_write_set_options(a, "zip:compression=deflate")
+                    != ARCHIVE_OK
+            || archive_write_open_filename(a, path.c_str()) != ARCHIVE_OK) {
+        die(archive_error_string(a));
+    }
+
+    archive_add(a, "META-INF/com/google/android/updater-script",
+                create_updater_script(files));
+    archive_add(a, "META-INF/com/google/android/update-binary", 512 * 1024,
+                state);
+
+    uint64_t file_size = size / std::max<uint64_t>(files, 1);
+
+    for (uint64_t i = 0; i < files; ++i) {
+        archive_add(a, "system/app/App" + std::to_string(i) + "/App"
+                    + std::to_string(i) + ".apk", file_size, state);
+    }
+
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        die(archive_error_string(a));
+    }
+    archive_write_free(a);
+}
+
+static void create_odin_tar(const std::string &path, uint64_t size)
+{
+    archive *a = archive_write_new();
+    uint32_t state = 0x33333333;
+
+    if (archive_write_set_format_ustar(a) != ARCHIVE_OK
+            || archive_write_open_filename(a, path.c_str()) != ARCHIVE_OK) {
+        die(archive_error_string(a));
+    }
+
+    archive_add(a, "boot.img", size / 32, state);
+    archive_add(a, "modem.bin", size / 32, state);
+    archive_add(a, "cache.img.ext4", size / 16, state);
+    archive_add(a, "system.img.ext4", size - size / 32 * 2 - size / 16, state);
+
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        die(archive_error_string(a));
+    }
+    archive_write_free(a);
+}
+
+static uint64_t file_size(const std::string &path)
+{
+    struct stat sb;
+    return stat(path.c_str(), &sb) == 0 ? static_cast<uint64_t>(sb.st_size)
+                                        : 0;
+}
+
+static uint64_t bytes_written()
+{
+    FILE *fp = fopen("/proc/self/io", "re");
+    if (!fp) {
+        return 0;
+    }
+
+    char line[128];
+    uint64_t value = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "wchar: %" SCNu64, &value) == 1) {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return value;
+}
+
+static mb::device::Device create_device()
+{
+    mb::device::Device device;
+    device.set_id("bench");
+    device.set_codenames({"bench"});
+    device.set_name("Benchmark device");
+    device.set_architecture(ARCHITECTURE);
+    device.set_block_dev_base_dirs({"/dev/block/bootdevice/by-name"});
+    device.set_system_block_devs({"/dev/block/bootdevice/by-name/system"});
+    device.set_cache_block_devs({"/dev/block/bootdevice/by-name/cache"});
+    device.set_data_block_devs({"/dev/block/bootdevice/by-name/userdata"});
+    device.set_boot_block_devs({"/dev/block/bootdevice/by-name/boot"});
+    return device;
+}
+
+// The logger keeps referencing the result, so this is only called in the child
+// process, which exits afterwards
+static void run_once(const Options &options, const char *patcher_id,
+                     const std::string &input_path, Result &result)
+{
+    mb::log::set_logger(std::make_shared<TimingLogger>(result));
+
+    std::string output_path = options.work_dir + "/output.zip";
+    unlink(output_path.c_str());
+
+    mb::patcher::PatcherConfig pc;
+    pc.set_data_directory(options.work_dir + "/data");
+    pc.set_temp_directory(options.work_dir + "/tmp");
+    pc.set_compression_threads(options.threads);
+
+    mb::patcher::FileInfo fi;
+    fi.set_device(create_device());
+    fi.set_input_path(input_path);
+    fi.set_output_path(output_path);
+    fi.set_rom_id("dual");
+
+    auto *patcher = pc.create_patcher(patcher_id);
+    if (!patcher) {
+        die("Invalid patcher ID");
+    }
+    patcher->set_file_info(&fi);
+
+    uint64_t written = bytes_written();
+    auto start = Clock::now();
+
+    result.success = patcher->patch_file(
+        nullptr,
+        [&](uint64_t, uint64_t max_files) {
+            result.files = max_files;
+        },
+        nullptr
+    );
+
+    result.seconds = std::chrono::duration<double>(Clock::now() - start)
+            .count();
+    result.bytes_written = bytes_written() - written;
+    result.output_bytes = file_size(output_path);
+
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        result.peak_rss_kib = static_cast<uint64_t>(usage.ru_maxrss);
+    }
+
+    if (!result.success) {
+        fprintf(stderr, "%s: Error: %d\n", patcher_id,
+                static_cast<int>(patcher->error()));
+    }
+}
+
+static Result run_in_child(const Options &options, const char *patcher_id,
+                           const std::string &input_path)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        die("Failed to create pipe");
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        die("Failed to fork");
+    } else if (pid == 0) {
+        close(fds[0]);
+
+        Result result{};
+        run_once(options, patcher_id, input_path, result);
+        bool ok = write(fds[1], &result, sizeof(result))
+                == static_cast<ssize_t>(sizeof(result));
+
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+
+    Result result{};
+    bool ok = read(fds[0], &result, sizeof(result))
+            == static_cast<ssize_t>(sizeof(result));
+    close(fds[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)
+            || WEXITSTATUS(status) != EXIT_SUCCESS || !ok) {
+        result.success = false;
+    }
+
+    return result;
+}
+
+static bool run(bool &first, const Options &options, const char *patcher_id,
+                const char *name, const std::string &input_path)
+{
+    Result best{};
+
+    for (unsigned int i = 0; i < options.iterations; ++i) {
+        Result result = run_in_child(options, patcher_id, input_path);
+        if (!result.success) {
+            return false;
+        }
+
+        if (i == 0 || result.seconds < best.seconds) {
+            best = result;
+        }
+    }
+
+    uint64_t bytes = input_path.empty() ? best.output_bytes
+                                        : file_size(input_path);
+    uint64_t temp_bytes = best.bytes_written > best.output_bytes
+            ? best.bytes_written - best.output_bytes : 0;
+
+    printf("%s\n    {\"name\": \"%s/%s\", \"bytes\": %" PRIu64 ", "
+           "\"files\": %" PRIu64 ", \"seconds\": %.3f, "
+           "\"mb_per_s\": %.1f, \"files_per_s\": %.1f, "
+           "\"peak_rss_kib\": %" PRIu64 ", \"output_bytes\": %" PRIu64 ", "
+           "\"temp_bytes_written\": %" PRIu64 ", \"timings_ms\": {",
+           first ? "" : ",", patcher_id, name, bytes, best.files,
+           best.seconds,
+           static_cast<double>(bytes) / (1024.0 * 1024.0) / best.seconds,
+           static_cast<double>(best.files) / best.seconds,
+           best.peak_rss_kib, best.output_bytes, temp_bytes);
+
+    for (size_t i = 0; i < best.timings; ++i) {
+        printf("%s\"%s\": %.3f", i == 0 ? "" : ", ", best.timing_names[i],
+               best.timing_ms[i]);
+    }
+
+    printf("}}");
+
+    first = false;
+    return true;
+}
+
+static void usage(FILE *stream, const char *prog_name)
+{
+    fprintf(stream, "Usage: %s [OPTION]...\n"
+                    "\n"
+                    "Options:\n"
+                    "  -d, --work-dir <dir>  Directory for generated files\n"
+                    "                        (default: new directory in /tmp)\n"
+                    "  --zip-size <MiB>      Size of the ROM zip (default: 256)\n"
+                    "  --zip-files <count>   Files in the ROM zip (default: 2000)\n"
+                    "  --odin-size <MiB>     Size of the Odin tarball (default: 512)\n"
+                    "  -n, --iterations <n>  Runs per patcher (default: 3)\n"
+                    "  -j, --threads <n>     Compression threads (default: all)\n"
+                    "  -h, --help            Display this help message\n",
+                    prog_name);
+}
+
+int main(int argc, char *argv[])
+{
+    enum : int
+    {
+        OPT_ZIP_SIZE = CHAR_MAX + 1,
+        OPT_ZIP_FILES,
+        OPT_ODIN_SIZE,
+    };
+
+    static const char short_options[] = "d:n:j:h";
+
+    static struct option long_options[] = {
+        {"work-dir",   required_argument, nullptr, 'd'},
+        {"zip-size",   required_argument, nullptr, OPT_ZIP_SIZE},
+        {"zip-files",  required_argument, nullptr, OPT_ZIP_FILES},
+        {"odin-size",  required_argument, nullptr, OPT_ODIN_SIZE},
+        {"iterations", required_argument, nullptr, 'n'},
+        {"threads",    required_argument, nullptr, 'j'},
+        {"help",       no_argument,       nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Options options;
+    int opt;
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        bool ok = true;
+
+        switch (opt) {
+        case 'd':
+            options.work_dir = optarg;
+            break;
+        case OPT_ZIP_SIZE:
+            ok = mb::str_to_num(optarg, 10, options.zip_size);
+            break;
+        case OPT_ZIP_FILES:
+            ok = mb::str_to_num(optarg, 10, options.zip_files);
+            break;
+        case OPT_ODIN_SIZE:
+            ok = mb::str_to_num(optarg, 10, options.odin_size);
+            break;
+        case 'n':
+            ok = mb::str_to_num(optarg, 10, options.iterations)
+                    && options.iterations > 0;
+            break;
+        case 'j':
+            ok = mb::str_to_num(optarg, 10, options.threads);
+            break;
+        case 'h':
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Invalid value: %s\n", optarg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (options.work_dir.empty()) {
+        char dir_template[] = "/tmp/patcher_bench-XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            die("Failed to create work directory");
+        }
+        options.work_dir = dir_template;
+    } else {
+        make_dir(options.work_dir);
+    }
+
+    make_dir(options.work_dir + "/tmp");
+
+    fprintf(stderr, "Generating inputs in %s\n", options.work_dir.c_str());
+
+    std::string zip_path = options.work_dir + "/rom.zip";
+    std::string odin_path = options.work_dir + "/firmware.tar";
+
+    create_data_dir(options.work_dir + "/data");
+    create_rom_zip(zip_path, options.zip_size * 1024 * 1024,
+                   options.zip_files);
+    create_odin_tar(odin_path, options.odin_size * 1024 * 1024);
+
+    char zip_name[64];
+    snprintf(zip_name, sizeof(zip_name), "%" PRIu64 "MiB_%" PRIu64 "files",
+             options.zip_size, options.zip_files);
+    char odin_name[64];
+    snprintf(odin_name, sizeof(odin_name), "%" PRIu64 "MiB",
+             options.odin_size);
+
+    bool first = true;
+    bool ret = true;
+
+    printf("{\n  \"benchmarks\": [");
+
+    ret = run(first, options, "ZipPatcher", zip_name, zip_path) && ret;
+    ret = run(first, options, "OdinPatcher", odin_name, odin_path) && ret;
+    ret = run(first, options, "RamdiskUpdater", "default", {}) && ret;
+
+    printf("\n  ]\n}\n");
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+// Measures SparseFile read throughput for sequential, strided, and random
+// access on synthetic images held in memory. Each access pattern is run with
+// an underlying file that can only be read, one that can also skip forward (eg.
+// a zip entry), and one that can seek randomly. Without random seeking,
+// SparseFile itself cannot seek, so strided reads discard the data in between
+// and random reads are not measured.
+//
+// The "tiny_chunks" images consist entirely of single-block chunks at
+// increasing chunk counts. ns_per_op should scale linearly with the image size;
+// anything worse points to superlinear behavior in the chunk handling.
+// Results are written to stdout as JSON.
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/callbacks.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr uint32_t BLOCK_SIZE = 4096;
+static constexpr size_t READ_SIZE = 64 * 1024;
+static constexpr size_t STRIDE_READ_SIZE = 4096;
+static constexpr size_t STRIDE = 64 * 1024;
+static constexpr size_t RANDOM_READS = 4096;
+
+enum class Mode
+{
+    CanRead,
+    CanSkip,
+    CanSeek,
+};
+
+struct ModeInfo
+{
+    const char *name;
+    Mode mode;
+};
+
+static constexpr ModeInfo MODES[] = {
+    { "can_read", Mode::CanRead },
+    { "can_skip", Mode::CanSkip },
+    { "can_seek", Mode::CanSeek },
+};
+
+[[noreturn]] static void die(const char *what)
+{
+    fprintf(stderr, "%s\n", what);
+    exit(EXIT_FAILURE);
+}
+
+template<typename Fn>
+static double measure(size_t iterations, Fn &&fn)
+{
+    double best = 0;
+
+    for (size_t i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+
+        fn();
+
+        auto end = Clock::now();
+
+        auto ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (i == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    return best;
+}
+
+static uint32_t next_random(uint32_t &state)
+{
+    state = state * 1103515245 + 12345;
+    return state >> 8;
+}
+
+class ImageBuilder
+{
+public:
+    ImageBuilder()
+    {
+        if (!m_file.open(&m_buf, &m_buf_size)
+                || !m_writer.open(&m_file, SparseWriterFlag::DontCareZeroBlocks
+                                  | SparseWriterFlag::WriteCrc32, BLOCK_SIZE)) {
+            die("Failed to open sparse writer");
+        }
+    }
+
+    ~ImageBuilder()
+    {
+        free(m_buf);
+    }
+
+    void add_raw(uint32_t blocks, uint32_t &state)
+    {
+        std::vector<unsigned char> data(BLOCK_SIZE);
+
+        for (uint32_t i = 0; i < blocks; ++i) {
+            for (auto &c : data) {
+                c = static_cast<unsigned char>(next_random(state));
+            }
+            write(data);
+        }
+    }
+
+    void add_fill(uint32_t blocks, unsigned char value)
+    {
+        std::vector<unsigned char> data(BLOCK_SIZE, value);
+
+        for (uint32_t i = 0; i < blocks; ++i) {
+            write(data);
+        }
+    }
+
+    std::vector<unsigned char> finish()
+    {
+        if (!m_writer.close()) {
+            die("Failed to close sparse writer");
+        }
+
+        return { static_cast<unsigned char *>(m_buf),
+                 static_cast<unsigned char *>(m_buf) + m_buf_size };
+    }
+
+private:
+    void write(const std::vector<unsigned char> &data)
+    {
+        if (!file_write_exact(m_writer, data.data(), data.size())) {
+            die("Failed to write sparse data");
+        }
+    }
+
+    void *m_buf = nullptr;
+    size_t m_buf_size = 0;
+    MemoryFile m_file;
+    SparseWriter m_writer;
+};
+
+// Mix of many small raw chunks, large fill and "don't care" runs, and a CRC32
+// chunk, similar to a partially filled ext4 image
+static std::vector<unsigned char> create_realistic_image(size_t size)
+{
+    ImageBuilder builder;
+    uint32_t state = 0x12345678;
+    auto total = static_cast<uint32_t>(size / BLOCK_SIZE);
+    uint32_t blocks = 0;
+
+    while (blocks < total) {
+        uint32_t remaining = total - blocks;
+        uint32_t n;
+
+        switch (next_random(state) % 4) {
+        case 0:
+        case 1:
+            n = std::min(remaining, 1 + next_random(state) % 16);
+            builder.add_raw(n, state);
+            break;
+        case 2:
+            n = std::min(remaining, 64 + next_random(state) % 1024);
+            builder.add_fill(n, 0);
+            break;
+        default:
+            n = std::min(remaining, 16 + next_random(state) % 256);
+            builder.add_fill(n, static_cast<unsigned char>(
+                    1 + next_random(state) % 255));
+            break;
+        }
+
+        blocks += n;
+    }
+
+    return builder.finish();
+}
+
+// Alternating single-block raw and fill chunks
+static std::vector<unsigned char> create_tiny_chunks_image(size_t chunks)
+{
+    ImageBuilder builder;
+    uint32_t state = 0x87654321;
+
+    for (size_t i = 0; i < chunks; ++i) {
+        if (i % 2 == 0) {
+            builder.add_raw(1, state);
+        } else {
+            builder.add_fill(1, static_cast<unsigned char>(i));
+        }
+    }
+
+    return builder.finish();
+}
+
+static void open_sparse(SparseFile &sparse_file, CallbackFile &cb_file,
+                        MemoryFile &file, std::vector<unsigned char> &image,
+                        Mode mode)
+{
+    auto read_cb = [&](File &, void *buf, size_t size) {
+        return file.read(buf, size);
+    };
+    auto seek_cb = [&, mode](File &, int64_t offset, int whence)
+            -> oc::result<uint64_t> {
+        if (mode == Mode::CanRead || (mode == Mode::CanSkip
+                && (whence != SEEK_CUR || offset < 0))) {
+            return FileError::UnsupportedSeek;
+        }
+        return file.seek(offset, whence);
+    };
+
+    if (!file.open(image.data(), image.size())
+            || !cb_file.open(nullptr, nullptr, read_cb, nullptr, seek_cb,
+                             nullptr)
+            || !sparse_file.open(&cb_file)) {
+        die("Failed to open sparse file");
+    }
+}
+
+static double bench_sequential(std::vector<unsigned char> &image, Mode mode)
+{
+    std::vector<unsigned char> buf(READ_SIZE);
+
+    return measure(5, [&] {
+        MemoryFile file;
+        CallbackFile cb_file;
+        SparseFile sparse_file;
+        open_sparse(sparse_file, cb_file, file, image, mode);
+
+        while (true) {
+            auto n = sparse_file.read(buf.data(), buf.size());
+            if (!n) {
+                die("Failed to read data");
+            } else if (n.value() == 0) {
+                break;
+            }
+        }
+    });
+}
+
+static double bench_strided(std::vector<unsigned char> &image, Mode mode)
+{
+    std::vector<unsigned char> buf(STRIDE_READ_SIZE);
+
+    return measure(5, [&] {
+        MemoryFile file;
+        CallbackFile cb_file;
+        SparseFile sparse_file;
+        open_sparse(sparse_file, cb_file, file, image, mode);
+
+        uint64_t size = sparse_file.size();
+
+        for (uint64_t pos = 0; pos + STRIDE <= size; pos += STRIDE) {
+            if (!file_read_exact(sparse_file, buf.data(), buf.size())) {
+                die("Failed to read data");
+            }
+
+            uint64_t skip = STRIDE - STRIDE_READ_SIZE;
+
+            if (mode == Mode::CanSeek) {
+                if (!sparse_file.seek(static_cast<int64_t>(skip), SEEK_CUR)) {
+                    die("Failed to seek");
+                }
+            } else {
+                auto n = file_read_discard(sparse_file, skip);
+                if (!n || n.value() != skip) {
+                    die("Failed to discard data");
+                }
+            }
+        }
+    });
+}
+
+static double bench_random(std::vector<unsigned char> &image)
+{
+    std::vector<unsigned char> buf(STRIDE_READ_SIZE);
+
+    return measure(5, [&] {
+        MemoryFile file;
+        CallbackFile cb_file;
+        SparseFile sparse_file;
+        open_sparse(sparse_file, cb_file, file, image, Mode::CanSeek);
+
+        uint64_t blocks = sparse_file.size() / STRIDE_READ_SIZE;
+        uint32_t state = 0xdeadbeef;
+
+        for (size_t i = 0; i < RANDOM_READS; ++i) {
+            uint64_t offset = (next_random(state) % blocks) * STRIDE_READ_SIZE;
+
+            if (!sparse_file.seek(static_cast<int64_t>(offset), SEEK_SET)
+                    || !file_read_exact(sparse_file, buf.data(), buf.size())) {
+                die("Failed to read data");
+            }
+        }
+    });
+}
+
+static void print_result(bool &first, const char *benchmark, const char *image,
+                         const char *mode, uint64_t bytes, double ns)
+{
+    printf("%s\n    {\"name\": \"%s/%s/%s\", \"bytes\": %" PRIu64 ", "
+           "\"ns_per_op\": %.0f, \"mb_per_s\": %.1f}",
+           first ? "" : ",", benchmark, image, mode, bytes, ns,
+           static_cast<double>(bytes) / (1024.0 * 1024.0) / (ns / 1e9));
+
+    first = false;
+}
+
+static void run(bool &first, const char *name, std::vector<unsigned char> image)
+{
+    uint64_t size;
+
+    {
+        MemoryFile file;
+        CallbackFile cb_file;
+        SparseFile sparse_file;
+        open_sparse(sparse_file, cb_file, file, image, Mode::CanSeek);
+        size = sparse_file.size();
+    }
+
+    for (auto const &mode : MODES) {
+        print_result(first, "sequential", name, mode.name, size,
+                     bench_sequential(image, mode.mode));
+        print_result(first, "strided", name, mode.name,
+                     size / STRIDE * STRIDE_READ_SIZE,
+                     bench_strided(image, mode.mode));
+    }
+
+    print_result(first, "random", name, "can_seek",
+                 RANDOM_READS * STRIDE_READ_SIZE, bench_random(image));
+}
+
+int main()
+{
+    bool first = true;
+
+    printf("{\n  \"benchmarks\": [");
+
+    run(first, "realistic_64MiB", create_realistic_image(64 * 1024 * 1024));
+
+    for (size_t chunks : { 4096u, 16384u, 65536u }) {
+        char name[32];
+        snprintf(name, sizeof(name), "tiny_chunks_%zu", chunks);
+        run(first, name, create_tiny_chunks_image(chunks));
+    }
+
+    printf("\n  ]\n}\n");
+
+    return EXIT_SUCCESS;
+}
@@ -22,6 +22,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 
 #include <cstdint>
 
@@ -58,16 +59,30 @@ public:
     std::optional<int> type() const;
     void set_type(std::optional<int> type);
 
-    std::optional<std::string> name() const;
-    void set_name(std::optional<std::string> name);
+    std::optional<std::string_view> name() const;
+    void set_name(std::optional<std::string_view> name);
 
     std::optional<uint64_t> size() const;
     void set_size(std::optional<uint64_t> size);
 
 private:
     std::optional<int> m_type;
-    std::optional<std::string> m_name;
+    // Not freed when unset so that reusing an entry does not reallocate
+    std::string m_name;
+    bool m_has_name;
     std::optional<uint64_t> m_size;
 };
 
+struct EntryInfo
+{
+    int type;
+    std::optional<std::string> name;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t alignment;
+
+    bool operator==(const EntryInfo &rhs) const;
+    bool operator!=(const EntryInfo &rhs) const;
+};
+
 }
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+namespace mb::bootimg
+{
+
+class Reader;
+
+class MB_EXPORT EntryFile : public File
+{
+public:
+    EntryFile();
+    EntryFile(Reader *reader, int entry_type);
+    virtual ~EntryFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(EntryFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(EntryFile)
+
+    oc::result<void> open(Reader *reader, int entry_type);
+
+    uint64_t size() const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    Reader *m_reader;
+    int m_type;
+    uint64_t m_size;
+    uint64_t m_pos;
+    /*! \endcond */
+};
+
+}
@@ -23,10 +23,9 @@
 
 #include <optional>
 
-#include <openssl/sha.h>
-
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
+#include "mbbootimg/sha1_hasher_p.h"
 #include "mbbootimg/writer.h"
 #include "mbbootimg/writer_p.h"
 
@@ -61,7 +60,7 @@ private:
     // Header values
     AndroidHeader m_hdr;
 
-    SHA_CTX m_sha_ctx;
+    detail::Sha1Hasher m_sha;
 
     std::optional<SegmentWriter> m_seg;
 };
@@ -24,10 +24,9 @@
 #include <optional>
 #include <vector>
 
-#include <openssl/sha.h>
-
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
+#include "mbbootimg/sha1_hasher_p.h"
 #include "mbbootimg/writer.h"
 #include "mbbootimg/writer_p.h"
 
@@ -62,7 +61,7 @@ private:
 
     std::vector<unsigned char> m_aboot;
 
-    SHA_CTX m_sha_ctx;
+    detail::Sha1Hasher m_sha;
 
     std::optional<SegmentWriter> m_seg;
 };
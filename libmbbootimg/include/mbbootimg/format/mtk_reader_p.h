@@ -45,12 +45,19 @@ public:
     int type() override;
     std::string name() override;
 
+    std::unique_ptr<detail::FormatReader> clone(Reader &reader) const override;
+
     oc::result<int> open(File &file, int best_bid) override;
     oc::result<void> close(File &file) override;
     oc::result<void> read_header(File &file, Header &header) override;
     oc::result<void> read_entry(File &file, Entry &entry) override;
     oc::result<void> go_to_entry(File &file, Entry &entry, int entry_type) override;
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size) override;
+    oc::result<FileView> read_data_view(File &file, size_t size) override;
+    oc::result<std::vector<EntryInfo>> entries() override;
+    oc::result<size_t> read_entry_at(File &file, int entry_type,
+                                     uint64_t offset, void *buf,
+                                     size_t size) override;
 
 private:
     // Header values
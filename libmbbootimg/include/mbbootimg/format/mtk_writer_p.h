@@ -26,6 +26,7 @@
 #include "mbbootimg/format/android_p.h"
 #include "mbbootimg/format/mtk_p.h"
 #include "mbbootimg/format/segment_writer_p.h"
+#include "mbbootimg/sha1_hasher_p.h"
 #include "mbbootimg/writer.h"
 #include "mbbootimg/writer_p.h"
 
@@ -59,6 +60,19 @@ private:
     android::AndroidHeader m_hdr;
 
     std::optional<SegmentWriter> m_seg;
+
+    // SHA1 of the data written so far
+    detail::Sha1Hasher m_sha;
+    bool m_sha_valid;
+    // SHA1 state and entry index before the last MTK header
+    detail::Sha1Hasher m_sha_resume;
+    size_t m_sha_resume_entry;
+
+    // Last MTK header written
+    MtkHeader m_mtk_hdr;
+    // Number of bytes written for the current entry
+    uint32_t m_entry_written;
+    bool m_entry_finished;
 };
 
 }
@@ -43,6 +43,7 @@ struct SegmentReaderEntry
     uint64_t offset;
     uint32_t size;
     bool can_truncate;
+    uint64_t alignment;
 };
 
 class SegmentReader
@@ -50,6 +51,11 @@ class SegmentReader
 public:
     SegmentReader();
 
+    SegmentReader(const SegmentReader &other);
+    SegmentReader & operator=(const SegmentReader &rhs);
+
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(SegmentReader)
+
     const std::vector<SegmentReaderEntry> & entries() const;
     oc::result<void> set_entries(std::vector<SegmentReaderEntry> entries);
 
@@ -62,6 +68,12 @@ public:
                                  Reader &reader);
     oc::result<size_t> read_data(File &file, void *buf, size_t buf_size,
                                  Reader &reader);
+    oc::result<FileView> read_data_view(File &file, size_t size,
+                                        Reader &reader);
+
+    std::vector<EntryInfo> entry_infos() const;
+    oc::result<size_t> read_at(File &file, int entry_type, uint64_t offset,
+                               void *buf, size_t size, Reader &reader);
 
 private:
     SegmentReaderState m_state;
@@ -49,6 +49,8 @@ struct SegmentWriterEntry
 struct SegmentWriter
 {
 public:
+    static constexpr size_t BUFFER_SIZE = 256 * 1024;
+
     SegmentWriter();
 
     const std::vector<SegmentWriterEntry> & entries() const;
@@ -65,7 +67,14 @@ public:
                                   Writer &writer);
     oc::result<void> finish_entry(File &file, Writer &writer);
 
+    oc::result<void> flush(File &file, Writer &writer);
+
 private:
+    oc::result<void> buffer_write(File &file, const void *buf, size_t size,
+                                  Writer &writer);
+    oc::result<void> buffer_pad(File &file, uint64_t size, Writer &writer);
+    void preallocate(File &file, uint64_t size);
+
     SegmentWriterState m_state;
 
     std::vector<SegmentWriterEntry> m_entries;
@@ -74,6 +83,10 @@ private:
     uint32_t m_entry_size;
 
     std::optional<uint64_t> m_pos;
+
+    // Data not yet written to the file. The file position is always at the
+    // start of the buffer.
+    std::vector<unsigned char> m_buf;
 };
 
 }
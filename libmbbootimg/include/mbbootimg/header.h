@@ -21,7 +21,7 @@
 
 #include <memory>
 #include <optional>
-#include <string>
+#include <string_view>
 
 #include <cstdint>
 
@@ -78,6 +78,11 @@ constexpr HeaderFields ALL_FIELDS =
 class MB_EXPORT Header
 {
 public:
+    // Largest values allowed by any format (Android's BOOT_NAME_SIZE and
+    // BOOT_ARGS_SIZE, without the NULL terminator)
+    static constexpr size_t MAX_BOARD_NAME_SIZE = 16;
+    static constexpr size_t MAX_KERNEL_CMDLINE_SIZE = 512;
+
     Header();
     ~Header();
 
@@ -92,11 +97,11 @@ public:
     HeaderFields supported_fields() const;
     void set_supported_fields(HeaderFields fields);
 
-    std::optional<std::string> board_name() const;
-    bool set_board_name(std::optional<std::string> name);
+    std::optional<std::string_view> board_name() const;
+    bool set_board_name(std::optional<std::string_view> name);
 
-    std::optional<std::string> kernel_cmdline() const;
-    bool set_kernel_cmdline(std::optional<std::string> cmdline);
+    std::optional<std::string_view> kernel_cmdline() const;
+    bool set_kernel_cmdline(std::optional<std::string_view> cmdline);
 
     std::optional<uint32_t> page_size() const;
     bool set_page_size(std::optional<uint32_t> page_size);
@@ -138,8 +143,8 @@ private:
     std::optional<uint32_t> m_rpm_addr;         // |         |      |      |     | X    |
     std::optional<uint32_t> m_appsbl_addr;      // |         |      |      |     | X    |
     std::optional<uint32_t> m_page_size;        // | X       | X    | X    | X   |      |
-    std::optional<std::string> m_board_name;    // | X       | X    | X    | X   |      |
-    std::optional<std::string> m_cmdline;       // | X       | X    | X    | X   |      |
+    std::optional<uint16_t> m_board_name_size;  // | X       | X    | X    | X   |      |
+    std::optional<uint16_t> m_cmdline_size;     // | X       | X    | X    | X   |      |
     // Raw header values                           |---------|------|------|-----|------|
 
     // TODO TODO TODO
@@ -151,6 +156,10 @@ private:
     std::optional<uint32_t> m_hdr_id[8];        // | X       | X    | X    | X   |      |
     std::optional<uint32_t> m_hdr_entrypoint;   // |         |      |      |     | X    |
     // TODO TODO TODO
+
+    // Inline storage so that copying and reusing a header never allocates
+    char m_board_name[MAX_BOARD_NAME_SIZE];
+    char m_cmdline[MAX_KERNEL_CMDLINE_SIZE];
 };
 
 }
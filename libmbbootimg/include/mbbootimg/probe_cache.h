@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+class File;
+
+namespace bootimg
+{
+
+struct ProbeCacheKey
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t formats;
+
+    bool operator==(const ProbeCacheKey &other) const;
+    bool operator!=(const ProbeCacheKey &other) const;
+
+    static oc::result<ProbeCacheKey> from_file(File &file);
+};
+
+class MB_EXPORT ProbeCache
+{
+public:
+    ProbeCache();
+    ~ProbeCache();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProbeCache)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProbeCache)
+
+    std::optional<int> lookup(const ProbeCacheKey &key) const;
+    void insert(const ProbeCacheKey &key, int format_code);
+    void remove(const ProbeCacheKey &key);
+    void clear();
+    size_t size() const;
+
+    oc::result<void> load(const std::string &path);
+    oc::result<void> save(const std::string &path) const;
+
+private:
+    /*! \cond INTERNAL */
+    struct KeyHash
+    {
+        size_t operator()(const ProbeCacheKey &key) const noexcept;
+    };
+
+    mutable std::mutex m_mutex;
+    std::unordered_map<ProbeCacheKey, int, KeyHash> m_entries;
+    /*! \endcond */
+};
+
+}
+}
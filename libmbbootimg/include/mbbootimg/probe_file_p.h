@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <optional>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+namespace mb::bootimg::detail
+{
+
+class ProbeFile : public File
+{
+public:
+    static constexpr size_t BLOCK_SIZE = 4096;
+    static constexpr size_t MAX_BLOCKS = 16;
+
+    ProbeFile();
+    explicit ProbeFile(File *file);
+    virtual ~ProbeFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProbeFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProbeFile)
+
+    oc::result<void> open(File *file);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    struct Block
+    {
+        uint64_t index;
+        std::vector<unsigned char> data;
+    };
+
+    void clear();
+
+    oc::result<size_t> read_underlying(uint64_t offset, void *buf,
+                                       size_t size);
+    oc::result<uint64_t> file_size();
+    oc::result<const Block *> get_block(uint64_t index);
+
+    File *m_file;
+    std::vector<Block> m_blocks;
+    std::optional<uint64_t> m_size;
+    uint64_t m_pos;
+};
+
+}
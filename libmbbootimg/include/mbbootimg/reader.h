@@ -24,6 +24,7 @@
 #include <vector>
 
 #include <cstddef>
+#include <cstdint>
 
 #include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
@@ -41,10 +42,18 @@ namespace bootimg
 
 class Entry;
 class Header;
+class ProbeCache;
+
+namespace detail
+{
+class StreamFile;
+}
 
 class MB_EXPORT Reader
 {
 public:
+    static constexpr size_t DEFAULT_LOOKAHEAD = 64 * 1024;
+
     Reader();
     ~Reader();
 
@@ -58,13 +67,26 @@ public:
     oc::result<void> open_filename_w(const std::wstring &filename);
     oc::result<void> open(std::unique_ptr<File> file);
     oc::result<void> open(File *file);
+    oc::result<void> open_stream(std::unique_ptr<File> file,
+                                 size_t lookahead = DEFAULT_LOOKAHEAD);
+    oc::result<void> open_stream(File *file,
+                                 size_t lookahead = DEFAULT_LOOKAHEAD);
     oc::result<void> close();
 
+    // Cloning
+    oc::result<std::unique_ptr<Reader>> clone();
+
     // Operations
     oc::result<void> read_header(Header &header);
     oc::result<void> read_entry(Entry &entry);
     oc::result<void> go_to_entry(Entry &entry, int entry_type);
     oc::result<size_t> read_data(void *buf, size_t size);
+    oc::result<FileView> entry_view(size_t size);
+
+    // Random access
+    oc::result<std::vector<EntryInfo>> entries();
+    oc::result<size_t> read_entry_at(int entry_type, uint64_t offset,
+                                     void *buf, size_t size);
 
     // Format operations
     int format_code();
@@ -82,6 +104,9 @@ public:
     oc::result<void> enable_format_mtk();
     oc::result<void> enable_format_sony_elf();
 
+    // Probe cache
+    void set_probe_cache(ProbeCache *cache);
+
     // Reader state
     bool is_open();
     bool is_fatal();
@@ -89,6 +114,8 @@ public:
 
 private:
     oc::result<void> register_format(std::unique_ptr<detail::FormatReader> format);
+    oc::result<detail::FormatReader *> bid_formats(File &file, File &probe,
+                                                   bool lenient);
 
     // Global state
     detail::ReaderState m_state;
@@ -97,9 +124,17 @@ private:
     std::unique_ptr<File> m_owned_file;
     File *m_file;
 
+    // Lookahead buffer for non-seekable files
+    std::unique_ptr<detail::StreamFile> m_stream;
+
     std::vector<std::unique_ptr<detail::FormatReader>> m_formats;
     detail::FormatReader *m_format;
     bool m_format_user_set;
+
+    ProbeCache *m_probe_cache;
+
+    // Fallback buffer for entry_view()
+    std::vector<unsigned char> m_view_buf;
 };
 
 }
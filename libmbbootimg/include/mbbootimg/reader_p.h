@@ -19,19 +19,20 @@
 
 #pragma once
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include <cstddef>
 
 #include "mbcommon/common.h"
+#include "mbcommon/file.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
 
 namespace mb
 {
-class File;
-
 namespace bootimg
 {
 class Reader;
@@ -51,6 +52,8 @@ public:
     virtual int type() = 0;
     virtual std::string name() = 0;
 
+    virtual std::unique_ptr<FormatReader> clone(Reader &reader) const = 0;
+
     virtual oc::result<void>
     set_option(const char *key, const char *value);
     virtual oc::result<int>
@@ -65,6 +68,13 @@ public:
     go_to_entry(File &file, Entry &entry, int entry_type);
     virtual oc::result<size_t>
     read_data(File &file, void *buf, size_t buf_size) = 0;
+    virtual oc::result<FileView>
+    read_data_view(File &file, size_t size);
+    virtual oc::result<std::vector<EntryInfo>>
+    entries();
+    virtual oc::result<size_t>
+    read_entry_at(File &file, int entry_type, uint64_t offset,
+                  void *buf, size_t size);
 
 protected:
     Reader &m_reader;
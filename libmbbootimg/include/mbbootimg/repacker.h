@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <unordered_map>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+class File;
+
+namespace bootimg
+{
+
+class Header;
+class Reader;
+class Writer;
+
+class MB_EXPORT Repacker
+{
+public:
+    Repacker(Reader &reader, Writer &writer);
+    ~Repacker();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Repacker)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Repacker)
+
+    void replace_entry(int entry_type, File &file);
+
+    oc::result<void> repack(const Header &header);
+
+private:
+    oc::result<void> copy_from_reader(int entry_type);
+    oc::result<void> copy_from_file(File &file);
+
+    Reader &m_reader;
+    Writer &m_writer;
+
+    std::unordered_map<int, File *> m_replacements;
+};
+
+}
+}
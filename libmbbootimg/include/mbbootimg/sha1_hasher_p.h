@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+
+#include <openssl/evp.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb::bootimg::detail
+{
+
+class Sha1Hasher
+{
+public:
+    static constexpr size_t DIGEST_SIZE = 20;
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    Sha1Hasher();
+    ~Sha1Hasher();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Sha1Hasher)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(Sha1Hasher)
+
+    oc::result<void> init();
+    oc::result<void> update(const void *data, size_t size);
+    oc::result<void> final(unsigned char digest[DIGEST_SIZE]);
+    oc::result<void> copy_from(const Sha1Hasher &other);
+    void reset();
+
+private:
+    oc::result<void> flush();
+
+    std::unique_ptr<EVP_MD_CTX, decltype(EVP_MD_CTX_free) *> m_ctx;
+    std::vector<unsigned char> m_buf;
+};
+
+}
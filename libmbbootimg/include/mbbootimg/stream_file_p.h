@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbbootimg/guard_p.h"
+
+#include <optional>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+
+namespace mb::bootimg::detail
+{
+
+class StreamFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_WINDOW_SIZE = 64 * 1024;
+
+    StreamFile();
+    StreamFile(File *file, size_t window_size);
+    virtual ~StreamFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(StreamFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(StreamFile)
+
+    oc::result<void> open(File *file, size_t window_size);
+
+    size_t window_size() const;
+
+    bool is_window_only() const;
+    void set_window_only(bool window_only);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    void clear();
+
+    oc::result<size_t> read_underlying(void *buf, size_t size);
+
+    File *m_file;
+    size_t m_window_size;
+    std::vector<unsigned char> m_window;
+    bool m_window_only;
+    // Offset of the underlying file's position
+    uint64_t m_stream_pos;
+    std::optional<uint64_t> m_size;
+    uint64_t m_pos;
+};
+
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/cursor_file_p.h"
+
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbbootimg/cursor_file_p.h
+ * \brief File handle with its own position over a shared file
+ */
+
+namespace mb::bootimg::detail
+{
+
+using namespace mb::detail;
+
+/*!
+ * \class CursorFile
+ *
+ * \brief Read-only File handle with an independent file position.
+ *
+ * All reads are done with File::read_at() on the underlying file and views are
+ * passed through to File::view_at(), so the underlying file position is never
+ * used after the CursorFile is opened. If the underlying file natively
+ * supports positional reads, several CursorFile handles on top of it can be
+ * used from different threads at the same time.
+ *
+ * The underlying File handle is not owned and must outlive this object.
+ */
+
+CursorFile::CursorFile()
+    : File()
+{
+    clear();
+}
+
+CursorFile::CursorFile(File *file)
+    : CursorFile()
+{
+    (void) open(file);
+}
+
+CursorFile::~CursorFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open File handle with its own position over another file.
+ *
+ * The initial position and the size are taken from the underlying file. Its
+ * position is restored before this function returns.
+ *
+ * \param file Underlying file. It must already be opened.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> CursorFile::open(File *file)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+    }
+
+    return File::open();
+}
+
+oc::result<void> CursorFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRY(pos, m_file->seek(0, SEEK_CUR));
+    OUTCOME_TRY(size, m_file->seek(0, SEEK_END));
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(pos), SEEK_SET));
+
+    m_size = size;
+    m_pos = pos;
+
+    return oc::success();
+}
+
+oc::result<void> CursorFile::on_close()
+{
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> CursorFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_read_at(m_pos, buf, size));
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> CursorFile::on_seek(int64_t offset, int whence)
+{
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        base = m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (offset < 0) {
+        // Negating INT64_MIN as a signed value would overflow
+        auto distance = 0 - static_cast<uint64_t>(offset);
+        if (distance > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base - distance;
+    } else {
+        if (static_cast<uint64_t>(offset) > INT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base + static_cast<uint64_t>(offset);
+    }
+}
+
+oc::result<size_t> CursorFile::on_read_at(uint64_t offset, void *buf,
+                                          size_t size)
+{
+    auto n = m_file->read_at(offset, buf, size);
+    if (!n && m_file->is_fatal()) {
+        set_fatal();
+    }
+
+    return n;
+}
+
+oc::result<FileView> CursorFile::on_view_at(uint64_t offset, size_t size)
+{
+    return m_file->view_at(offset, size);
+}
+
+/*! \cond INTERNAL */
+
+void CursorFile::clear()
+{
+    m_file = nullptr;
+    m_size = 0;
+    m_pos = 0;
+}
+
+/*! \endcond */
+
+}
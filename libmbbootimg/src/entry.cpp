@@ -27,14 +27,17 @@
 namespace mb::bootimg
 {
 
-Entry::Entry() = default;
+Entry::Entry()
+    : m_has_name(false)
+{
+}
 
 Entry::~Entry() = default;
 
 bool Entry::operator==(const Entry &rhs) const
 {
     return m_type == rhs.m_type
-            && m_name == rhs.m_name
+            && name() == rhs.name()
             && m_size == rhs.m_size;
 }
 
@@ -46,7 +49,7 @@ bool Entry::operator!=(const Entry &rhs) const
 void Entry::clear()
 {
     m_type = {};
-    m_name = {};
+    m_has_name = false;
     m_size = {};
 }
 
@@ -62,14 +65,34 @@ void Entry::set_type(std::optional<int> type)
     m_type = std::move(type);
 }
 
-std::optional<std::string> Entry::name() const
+/*!
+ * \brief Get entry name
+ *
+ * \return Entry name or nullopt if it is not set. The string is stored inside
+ *         the entry, so it is only valid until the entry is modified or
+ *         destroyed.
+ */
+std::optional<std::string_view> Entry::name() const
 {
+    if (!m_has_name) {
+        return std::nullopt;
+    }
     return m_name;
 }
 
-void Entry::set_name(std::optional<std::string> name)
+/*!
+ * \brief Set entry name
+ *
+ * The existing buffer is reused if it is large enough.
+ *
+ * \param name Entry name or nullopt to unset it
+ */
+void Entry::set_name(std::optional<std::string_view> name)
 {
-    m_name = std::move(name);
+    m_has_name = name.has_value();
+    if (name) {
+        m_name.assign(*name);
+    }
 }
 
 std::optional<uint64_t> Entry::size() const
@@ -83,4 +106,39 @@ void Entry::set_size(std::optional<uint64_t> size)
 
 }
 
+/*!
+ * \struct EntryInfo
+ *
+ * \brief Location of an entry within a boot image
+ *
+ * \var EntryInfo::type
+ * \brief Entry type
+ *
+ * \var EntryInfo::name
+ * \brief Entry name, if the format has one
+ *
+ * \var EntryInfo::offset
+ * \brief Offset of the entry data in the boot image
+ *
+ * \var EntryInfo::size
+ * \brief Size of the entry data
+ *
+ * \var EntryInfo::alignment
+ * \brief Boundary that the format aligns the entry data to
+ */
+
+bool EntryInfo::operator==(const EntryInfo &rhs) const
+{
+    return type == rhs.type
+            && name == rhs.name
+            && offset == rhs.offset
+            && size == rhs.size
+            && alignment == rhs.alignment;
+}
+
+bool EntryInfo::operator!=(const EntryInfo &rhs) const
+{
+    return !(*this == rhs);
+}
+
 }
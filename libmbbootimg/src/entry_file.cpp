@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/entry_file.h"
+
+#include <algorithm>
+
+#include <cstdio>
+
+#include "mbcommon/file_error.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/reader.h"
+
+/*!
+ * \file mbbootimg/entry_file.h
+ * \brief File handle for the data of a single boot image entry
+ */
+
+namespace mb::bootimg
+{
+
+using namespace mb::detail;
+
+/*!
+ * \class EntryFile
+ *
+ * \brief Read-only, seekable File handle for the data of one entry.
+ *
+ * EntryFile reads from the boot image with Reader::read_entry_at(), so it
+ * neither uses nor changes the Reader's current entry. This allows an entry to
+ * be passed directly to anything that consumes a File (eg. to decompress a
+ * ramdisk) without first copying it to a temporary file. Multiple EntryFiles
+ * may be opened for the same Reader.
+ *
+ * The Reader is not owned and must outlive this object.
+ */
+
+/*!
+ * \brief Construct unbound EntryFile.
+ *
+ * The File handle will not be bound to any entry. open() will need to be
+ * called to open an entry.
+ */
+EntryFile::EntryFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle for an entry.
+ *
+ * Construct the file handle and open the entry. Use is_open() to check if the
+ * entry was successfully opened.
+ *
+ * \sa open(Reader *, int)
+ *
+ * \param reader Reader for the boot image
+ * \param entry_type Entry type
+ */
+EntryFile::EntryFile(Reader *reader, int entry_type)
+    : EntryFile()
+{
+    (void) open(reader, entry_type);
+}
+
+EntryFile::~EntryFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open File handle for an entry.
+ *
+ * \param reader Reader for the boot image. Reader::read_header() must have
+ *               been called.
+ * \param entry_type Entry type
+ *
+ * \return Nothing if the entry is successfully opened. Otherwise, the error
+ *         code. \ref ReaderError::EndOfEntries is returned if the boot image
+ *         has no entry of type \p entry_type.
+ */
+oc::result<void> EntryFile::open(Reader *reader, int entry_type)
+{
+    if (state() == FileState::New) {
+        m_reader = reader;
+        m_type = entry_type;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get size of the entry.
+ *
+ * \return Size of the entry as recorded in the boot image header or 0 if the
+ *         file is not open. If the boot image is truncated, fewer bytes may be
+ *         readable.
+ */
+uint64_t EntryFile::size() const
+{
+    return m_size;
+}
+
+oc::result<void> EntryFile::on_open()
+{
+    if (!m_reader || !m_reader->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRY(entries, m_reader->entries());
+
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [&](const EntryInfo &info) {
+        return info.type == m_type;
+    });
+    if (it == entries.end()) {
+        return ReaderError::EndOfEntries;
+    }
+
+    m_size = it->size;
+    m_pos = 0;
+
+    return oc::success();
+}
+
+oc::result<void> EntryFile::on_close()
+{
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> EntryFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> EntryFile::on_seek(int64_t offset, int whence)
+{
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<uint64_t>(offset);
+    case SEEK_CUR:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos -= static_cast<uint64_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > UINT64_MAX - m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos += static_cast<uint64_t>(offset);
+        }
+    case SEEK_END:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size - static_cast<uint64_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > UINT64_MAX - m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size + static_cast<uint64_t>(offset);
+        }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+oc::result<size_t> EntryFile::on_read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+    if (offset >= m_size) {
+        return 0;
+    }
+
+    auto to_read = static_cast<size_t>(
+            std::min<uint64_t>(size, m_size - offset));
+
+    auto n = m_reader->read_entry_at(m_type, offset, buf, to_read);
+    if (!n && m_reader->is_fatal()) {
+        set_fatal();
+    }
+
+    return n;
+}
+
+/*! \cond INTERNAL */
+
+void EntryFile::clear()
+{
+    m_reader = nullptr;
+    m_type = 0;
+    m_size = 0;
+    m_pos = 0;
+}
+
+/*! \endcond */
+
+}
@@ -86,6 +86,17 @@ std::string AndroidFormatReader::name()
     }
 }
 
+std::unique_ptr<detail::FormatReader>
+AndroidFormatReader::clone(Reader &reader) const
+{
+    auto format = std::make_unique<AndroidFormatReader>(reader, m_is_bump);
+    format->m_hdr = m_hdr;
+    format->m_header_offset = m_header_offset;
+    format->m_allow_truncated_dt = m_allow_truncated_dt;
+    format->m_seg = m_seg;
+    return format;
+}
+
 oc::result<void> AndroidFormatReader::set_option(const char *key,
                                                  const char *value)
 {
@@ -170,20 +181,22 @@ oc::result<void> AndroidFormatReader::read_header(File &file, Header &header)
     std::vector<SegmentReaderEntry> entries;
 
     entries.push_back({
-        ENTRY_TYPE_KERNEL, kernel_offset, m_hdr.kernel_size, false
+        ENTRY_TYPE_KERNEL, kernel_offset, m_hdr.kernel_size, false, page_size
     });
     entries.push_back({
-        ENTRY_TYPE_RAMDISK, ramdisk_offset, m_hdr.ramdisk_size, false
+        ENTRY_TYPE_RAMDISK, ramdisk_offset, m_hdr.ramdisk_size, false,
+        page_size
     });
     if (m_hdr.second_size > 0) {
         entries.push_back({
-            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size, false
+            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size, false,
+            page_size
         });
     }
     if (m_hdr.dt_size > 0) {
         entries.push_back({
             ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size,
-            m_allow_truncated_dt
+            m_allow_truncated_dt, page_size
         });
     }
 
@@ -207,6 +220,23 @@ oc::result<size_t> AndroidFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileView> AndroidFormatReader::read_data_view(File &file, size_t size)
+{
+    return m_seg->read_data_view(file, size, m_reader);
+}
+
+oc::result<std::vector<EntryInfo>> AndroidFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
+oc::result<size_t> AndroidFormatReader::read_entry_at(File &file, int entry_type,
+                                                      uint64_t offset, void *buf,
+                                                      size_t size)
+{
+    return m_seg->read_at(file, entry_type, offset, buf, size, m_reader);
+}
+
 /*!
  * \brief Find and read Android boot image header
  *
@@ -423,6 +453,9 @@ AndroidFormatReader::find_bump_magic(Reader &reader, File &file,
 bool AndroidFormatReader::convert_header(const AndroidHeader &hdr,
                                          Header &header)
 {
+    static_assert(sizeof(hdr.name) <= Header::MAX_BOARD_NAME_SIZE);
+    static_assert(sizeof(hdr.cmdline) <= Header::MAX_KERNEL_CMDLINE_SIZE);
+
     auto *name_ptr = reinterpret_cast<const char *>(hdr.name);
     auto name_size = strnlen(name_ptr, sizeof(hdr.name));
 
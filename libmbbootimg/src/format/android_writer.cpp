@@ -26,8 +26,6 @@
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -51,7 +49,7 @@ AndroidFormatWriter::AndroidFormatWriter(Writer &writer, bool is_bump)
     : FormatWriter(writer)
     , m_is_bump(is_bump)
     , m_hdr()
-    , m_sha_ctx()
+    , m_sha()
 {
 }
 
@@ -79,9 +77,7 @@ oc::result<void> AndroidFormatWriter::open(File &file)
 {
     (void) file;
 
-    if (!SHA1_Init(&m_sha_ctx)) {
-        return AndroidError::Sha1InitError;
-    }
+    OUTCOME_TRYV(m_sha.init());
 
     m_seg = SegmentWriter();
 
@@ -92,7 +88,7 @@ oc::result<void> AndroidFormatWriter::close(File &file)
 {
     auto reset_state = finally([&] {
         m_hdr = {};
-        m_sha_ctx = {};
+        m_sha.reset();
         m_seg = {};
     });
 
@@ -115,12 +111,13 @@ oc::result<void> AndroidFormatWriter::close(File &file)
             }
 
             // Set ID
-            unsigned char digest[SHA_DIGEST_LENGTH];
-            if (!SHA1_Final(digest, &m_sha_ctx)) {
+            unsigned char digest[detail::Sha1Hasher::DIGEST_SIZE];
+            auto sha_ret = m_sha.final(digest);
+            if (!sha_ret) {
                 m_writer.set_fatal();
-                return AndroidError::Sha1UpdateError;
+                return sha_ret.as_failure();
             }
-            memcpy(m_hdr.id, digest, SHA_DIGEST_LENGTH);
+            memcpy(m_hdr.id, digest, sizeof(digest));
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -196,18 +193,14 @@ oc::result<void> AndroidFormatWriter::write_header(File &file,
             return AndroidError::BoardNameTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.name), board_name->c_str(),
-                sizeof(m_hdr.name) - 1);
-        m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
+        memcpy(m_hdr.name, board_name->data(), board_name->size());
     }
     if (auto cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return AndroidError::KernelCmdlineTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.cmdline), cmdline->c_str(),
-                sizeof(m_hdr.cmdline) - 1);
-        m_hdr.cmdline[sizeof(m_hdr.cmdline) - 1] = '\0';
+        memcpy(m_hdr.cmdline, cmdline->data(), cmdline->size());
     }
 
     // TODO: UNUSED
@@ -250,11 +243,12 @@ oc::result<size_t> AndroidFormatWriter::write_data(File &file, const void *buf,
 
     // We always include the image in the hash. The size is sometimes included
     // and is handled in finish_entry().
-    if (!SHA1_Update(&m_sha_ctx, buf, n)) {
+    auto sha_ret = m_sha.update(buf, n);
+    if (!sha_ret) {
         // This must be fatal as the write already happened and cannot be
         // reattempted
         m_writer.set_fatal();
-        return AndroidError::Sha1UpdateError;
+        return sha_ret.as_failure();
     }
 
     return n;
@@ -270,10 +264,12 @@ oc::result<void> AndroidFormatWriter::finish_entry(File &file)
     uint32_t le32_size = mb_htole32(*swentry->size);
 
     // Include size for everything except empty DT images
-    if ((swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0)
-            && !SHA1_Update(&m_sha_ctx, &le32_size, sizeof(le32_size))) {
-        m_writer.set_fatal();
-        return AndroidError::Sha1UpdateError;
+    if (swentry->type != ENTRY_TYPE_DEVICE_TREE || *swentry->size > 0) {
+        auto sha_ret = m_sha.update(&le32_size, sizeof(le32_size));
+        if (!sha_ret) {
+            m_writer.set_fatal();
+            return sha_ret.as_failure();
+        }
     }
 
     switch (swentry->type) {
@@ -66,6 +66,18 @@ std::string LokiFormatReader::name()
     return FORMAT_NAME_LOKI;
 }
 
+std::unique_ptr<detail::FormatReader>
+LokiFormatReader::clone(Reader &reader) const
+{
+    auto format = std::make_unique<LokiFormatReader>(reader);
+    format->m_hdr = m_hdr;
+    format->m_loki_hdr = m_loki_hdr;
+    format->m_header_offset = m_header_offset;
+    format->m_loki_offset = m_loki_offset;
+    format->m_seg = m_seg;
+    return format;
+}
+
 /*!
  * \brief Perform a bid
  *
@@ -158,14 +170,17 @@ oc::result<void> LokiFormatReader::read_header(File &file, Header &header)
     std::vector<SegmentReaderEntry> entries;
 
     entries.push_back({
-        ENTRY_TYPE_KERNEL, kernel_offset, kernel_size, false
+        ENTRY_TYPE_KERNEL, kernel_offset, kernel_size, false,
+        m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_RAMDISK, ramdisk_offset, ramdisk_size, false
+        ENTRY_TYPE_RAMDISK, ramdisk_offset, ramdisk_size, false,
+        m_hdr.page_size
     });
     if (m_hdr.dt_size > 0 && dt_offset != 0) {
         entries.push_back({
-            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size, false
+            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size, false,
+            m_hdr.page_size
         });
     }
 
@@ -189,6 +204,23 @@ oc::result<size_t> LokiFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileView> LokiFormatReader::read_data_view(File &file, size_t size)
+{
+    return m_seg->read_data_view(file, size, m_reader);
+}
+
+oc::result<std::vector<EntryInfo>> LokiFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
+oc::result<size_t> LokiFormatReader::read_entry_at(File &file, int entry_type,
+                                                   uint64_t offset, void *buf,
+                                                   size_t size)
+{
+    return m_seg->read_at(file, entry_type, offset, buf, size, m_reader);
+}
+
 /*!
  * \brief Find and read Loki boot image header
  *
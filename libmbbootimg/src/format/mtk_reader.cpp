@@ -71,14 +71,7 @@ read_mtk_header(Reader &reader, File &file,
 {
     MtkHeader mtkhdr;
 
-    auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
-    if (!seek_ret) {
-        //DEBUG("Failed to seek to MTK header at %" PRIu64, offset);
-        if (file.is_fatal()) { reader.set_fatal(); }
-        return seek_ret.as_failure();
-    }
-
-    auto ret = file_read_exact(file, &mtkhdr, sizeof(mtkhdr));
+    auto ret = file_read_exact_at(file, offset, &mtkhdr, sizeof(mtkhdr));
     if (!ret) {
         if (ret.error() == FileError::UnexpectedEof) {
             //DEBUG("MTK header not found at %" PRIu64, offset);
@@ -179,6 +172,20 @@ std::string MtkFormatReader::name()
     return FORMAT_NAME_MTK;
 }
 
+std::unique_ptr<detail::FormatReader>
+MtkFormatReader::clone(Reader &reader) const
+{
+    auto format = std::make_unique<MtkFormatReader>(reader);
+    format->m_hdr = m_hdr;
+    format->m_mtk_kernel_hdr = m_mtk_kernel_hdr;
+    format->m_mtk_ramdisk_hdr = m_mtk_ramdisk_hdr;
+    format->m_header_offset = m_header_offset;
+    format->m_mtk_kernel_offset = m_mtk_kernel_offset;
+    format->m_mtk_ramdisk_offset = m_mtk_ramdisk_offset;
+    format->m_seg = m_seg;
+    return format;
+}
+
 /*!
  * \brief Perform a bid
  *
@@ -309,25 +316,31 @@ oc::result<void> MtkFormatReader::read_header(File &file, Header &header)
     std::vector<SegmentReaderEntry> entries;
 
     entries.push_back({
-        ENTRY_TYPE_MTK_KERNEL_HEADER, kernel_offset, sizeof(MtkHeader), false
+        ENTRY_TYPE_MTK_KERNEL_HEADER, kernel_offset, sizeof(MtkHeader), false,
+        m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_KERNEL, *m_mtk_kernel_offset, m_mtk_kernel_hdr.size, false
+        ENTRY_TYPE_KERNEL, *m_mtk_kernel_offset, m_mtk_kernel_hdr.size, false,
+        sizeof(MtkHeader)
     });
     entries.push_back({
-        ENTRY_TYPE_MTK_RAMDISK_HEADER, ramdisk_offset, sizeof(MtkHeader), false
+        ENTRY_TYPE_MTK_RAMDISK_HEADER, ramdisk_offset, sizeof(MtkHeader), false,
+        m_hdr.page_size
     });
     entries.push_back({
-        ENTRY_TYPE_RAMDISK, *m_mtk_ramdisk_offset, m_mtk_ramdisk_hdr.size, false
+        ENTRY_TYPE_RAMDISK, *m_mtk_ramdisk_offset, m_mtk_ramdisk_hdr.size, false,
+        sizeof(MtkHeader)
     });
     if (m_hdr.second_size > 0) {
         entries.push_back({
-            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size, false
+            ENTRY_TYPE_SECONDBOOT, second_offset, m_hdr.second_size, false,
+            m_hdr.page_size
         });
     }
     if (m_hdr.dt_size > 0) {
         entries.push_back({
-            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size, false
+            ENTRY_TYPE_DEVICE_TREE, dt_offset, m_hdr.dt_size, false,
+            m_hdr.page_size
         });
     }
 
@@ -351,6 +364,23 @@ oc::result<size_t> MtkFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileView> MtkFormatReader::read_data_view(File &file, size_t size)
+{
+    return m_seg->read_data_view(file, size, m_reader);
+}
+
+oc::result<std::vector<EntryInfo>> MtkFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
+oc::result<size_t> MtkFormatReader::read_entry_at(File &file, int entry_type,
+                                                  uint64_t offset, void *buf,
+                                                  size_t size)
+{
+    return m_seg->read_at(file, entry_type, offset, buf, size, m_reader);
+}
+
 }
 
 /*!
@@ -23,11 +23,10 @@
 
 #include <cerrno>
 #include <cinttypes>
+#include <cstddef>
 #include <cstdio>
 #include <cstring>
 
-#include <openssl/sha.h>
-
 #include "mbcommon/endian.h"
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
@@ -74,20 +73,41 @@ _mtk_header_update_size(Writer &writer, File &file,
 }
 
 static oc::result<void>
-_mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
-                  File &file, unsigned char digest[SHA_DIGEST_LENGTH])
+_mtk_update_sha1_size(detail::Sha1Hasher &sha, int type, uint32_t size)
 {
-    SHA_CTX sha_ctx;
-    char buf[10240];
+    uint32_t le32_size;
 
-    uint32_t kernel_mtkhdr_size = 0;
-    uint32_t ramdisk_mtkhdr_size = 0;
-
-    if (!SHA1_Init(&sha_ctx)) {
-        return android::AndroidError::Sha1InitError;
+    // Update checksum with size
+    switch (type) {
+    case ENTRY_TYPE_KERNEL:
+    case ENTRY_TYPE_RAMDISK:
+        le32_size = mb_htole32(size + static_cast<uint32_t>(sizeof(MtkHeader)));
+        break;
+    case ENTRY_TYPE_SECONDBOOT:
+        le32_size = mb_htole32(size);
+        break;
+    case ENTRY_TYPE_DEVICE_TREE:
+        if (size == 0) {
+            return oc::success();
+        }
+        le32_size = mb_htole32(size);
+        break;
+    default:
+        return oc::success();
     }
 
-    for (auto const &entry : seg.entries()) {
+    return sha.update(&le32_size, sizeof(le32_size));
+}
+
+static oc::result<void>
+_mtk_compute_sha1(Writer &writer, SegmentWriter &seg, File &file,
+                  detail::Sha1Hasher &sha, size_t first_entry)
+{
+    char buf[10240];
+
+    for (auto it = seg.entries().begin() + static_cast<ptrdiff_t>(first_entry);
+            it != seg.entries().end(); ++it) {
+        auto const &entry = *it;
         uint64_t remain = *entry.size;
 
         auto seek_ret = file.seek(static_cast<int64_t>(entry.offset),
@@ -107,49 +127,12 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
                 return ret.as_failure();
             }
 
-            if (!SHA1_Update(&sha_ctx, buf, static_cast<size_t>(to_read))) {
-                return android::AndroidError::Sha1UpdateError;
-            }
+            OUTCOME_TRYV(sha.update(buf, static_cast<size_t>(to_read)));
 
             remain -= to_read;
         }
 
-        uint32_t le32_size;
-
-        // Update checksum with size
-        switch (entry.type) {
-        case ENTRY_TYPE_MTK_KERNEL_HEADER:
-            kernel_mtkhdr_size = *entry.size;
-            continue;
-        case ENTRY_TYPE_MTK_RAMDISK_HEADER:
-            ramdisk_mtkhdr_size = *entry.size;
-            continue;
-        case ENTRY_TYPE_KERNEL:
-            le32_size = mb_htole32(*entry.size + kernel_mtkhdr_size);
-            break;
-        case ENTRY_TYPE_RAMDISK:
-            le32_size = mb_htole32(*entry.size + ramdisk_mtkhdr_size);
-            break;
-        case ENTRY_TYPE_SECONDBOOT:
-            le32_size = mb_htole32(*entry.size);
-            break;
-        case ENTRY_TYPE_DEVICE_TREE:
-            if (*entry.size == 0) {
-                continue;
-            }
-            le32_size = mb_htole32(*entry.size);
-            break;
-        default:
-            continue;
-        }
-
-        if (!SHA1_Update(&sha_ctx, &le32_size, sizeof(le32_size))) {
-            return android::AndroidError::Sha1UpdateError;
-        }
-    }
-
-    if (!SHA1_Final(digest, &sha_ctx)) {
-        return android::AndroidError::Sha1UpdateError;
+        OUTCOME_TRYV(_mtk_update_sha1_size(sha, entry.type, *entry.size));
     }
 
     return oc::success();
@@ -158,6 +141,11 @@ _mtk_compute_sha1(Writer &writer, SegmentWriter &seg,
 MtkFormatWriter::MtkFormatWriter(Writer &writer)
     : FormatWriter(writer)
     , m_hdr()
+    , m_sha_valid(false)
+    , m_sha_resume_entry()
+    , m_mtk_hdr()
+    , m_entry_written()
+    , m_entry_finished(false)
 {
 }
 
@@ -187,6 +175,9 @@ oc::result<void> MtkFormatWriter::close(File &file)
     auto reset_state = finally([&] {
         m_hdr = {};
         m_seg = {};
+        m_sha.reset();
+        m_sha_valid = false;
+        m_sha_resume.reset();
     });
 
     if (m_writer.is_open()) {
@@ -222,13 +213,19 @@ oc::result<void> MtkFormatWriter::close(File &file)
                 }
             }
 
-            // We need to take the performance hit and compute the SHA1 here.
-            // We can't fill in the sizes in the MTK headers when we're writing
-            // them. Thus, if we calculated the SHA1sum during write, it would
-            // be incorrect.
-            OUTCOME_TRYV(_mtk_compute_sha1(
-                    m_writer, *m_seg, file,
-                    reinterpret_cast<unsigned char *>(m_hdr.id)));
+            // The SHA1 is computed as the data is written, but it covers the
+            // MTK headers, which are written before the sizes are known. If a
+            // header had to be patched above, the data is re-read starting
+            // from that header.
+            if (!m_sha_valid) {
+                OUTCOME_TRYV(m_sha.copy_from(m_sha_resume));
+                OUTCOME_TRYV(_mtk_compute_sha1(m_writer, *m_seg, file,
+                                               m_sha, m_sha_resume_entry));
+            }
+
+            unsigned char digest[detail::Sha1Hasher::DIGEST_SIZE];
+            OUTCOME_TRYV(m_sha.final(digest));
+            memcpy(m_hdr.id, digest, sizeof(digest));
 
             // Convert fields back to little-endian
             android_fix_header_byte_order(m_hdr);
@@ -303,18 +300,14 @@ oc::result<void> MtkFormatWriter::write_header(File &file, const Header &header)
             return android::AndroidError::BoardNameTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.name), board_name->c_str(),
-                sizeof(m_hdr.name) - 1);
-        m_hdr.name[sizeof(m_hdr.name) - 1] = '\0';
+        memcpy(m_hdr.name, board_name->data(), board_name->size());
     }
     if (auto cmdline = header.kernel_cmdline()) {
         if (cmdline->size() >= sizeof(m_hdr.cmdline)) {
             return android::AndroidError::KernelCmdlineTooLong;
         }
 
-        strncpy(reinterpret_cast<char *>(m_hdr.cmdline), cmdline->c_str(),
-                sizeof(m_hdr.cmdline) - 1);
-        m_hdr.cmdline[sizeof(m_hdr.cmdline) - 1] = '\0';
+        memcpy(m_hdr.cmdline, cmdline->data(), cmdline->size());
     }
 
     // TODO: UNUSED
@@ -331,6 +324,12 @@ oc::result<void> MtkFormatWriter::write_header(File &file, const Header &header)
 
     OUTCOME_TRYV(m_seg->set_entries(std::move(entries)));
 
+    OUTCOME_TRYV(m_sha.init());
+    OUTCOME_TRYV(m_sha_resume.copy_from(m_sha));
+
+    m_sha_valid = true;
+    m_sha_resume_entry = 0;
+
     // Start writing after first page
     auto seek_ret = file.seek(m_hdr.page_size, SEEK_SET);
     if (!seek_ret) {
@@ -343,7 +342,26 @@ oc::result<void> MtkFormatWriter::write_header(File &file, const Header &header)
 
 oc::result<void> MtkFormatWriter::get_entry(File &file, Entry &entry)
 {
-    return m_seg->get_entry(file, entry, m_writer);
+    // Entries that are skipped without being written are not hashed
+    if (m_seg->entry() != m_seg->entries().end() && !m_entry_finished) {
+        m_sha_valid = false;
+    }
+
+    OUTCOME_TRYV(m_seg->get_entry(file, entry, m_writer));
+
+    auto swentry = m_seg->entry();
+
+    m_entry_written = 0;
+    m_entry_finished = false;
+
+    if (m_sha_valid && (swentry->type == ENTRY_TYPE_MTK_KERNEL_HEADER
+            || swentry->type == ENTRY_TYPE_MTK_RAMDISK_HEADER)) {
+        OUTCOME_TRYV(m_sha_resume.copy_from(m_sha));
+        m_sha_resume_entry = static_cast<size_t>(
+                swentry - m_seg->entries().begin());
+    }
+
+    return oc::success();
 }
 
 oc::result<void> MtkFormatWriter::write_entry(File &file, const Entry &entry)
@@ -354,7 +372,29 @@ oc::result<void> MtkFormatWriter::write_entry(File &file, const Entry &entry)
 oc::result<size_t> MtkFormatWriter::write_data(File &file, const void *buf,
                                                size_t buf_size)
 {
-    return m_seg->write_data(file, buf, buf_size, m_writer);
+    OUTCOME_TRY(n, m_seg->write_data(file, buf, buf_size, m_writer));
+
+    auto swentry = m_seg->entry();
+
+    // Keep a copy of the MTK header to check its size field later
+    if ((swentry->type == ENTRY_TYPE_MTK_KERNEL_HEADER
+            || swentry->type == ENTRY_TYPE_MTK_RAMDISK_HEADER)
+            && m_entry_written < sizeof(m_mtk_hdr)) {
+        memcpy(reinterpret_cast<char *>(&m_mtk_hdr) + m_entry_written, buf,
+               std::min(n, sizeof(m_mtk_hdr) - m_entry_written));
+    }
+
+    if (m_sha_valid) {
+        auto sha_ret = m_sha.update(buf, n);
+        if (!sha_ret) {
+            m_writer.set_fatal();
+            return sha_ret.as_failure();
+        }
+    }
+
+    m_entry_written += static_cast<uint32_t>(n);
+
+    return n;
 }
 
 oc::result<void> MtkFormatWriter::finish_entry(File &file)
@@ -392,6 +432,27 @@ oc::result<void> MtkFormatWriter::finish_entry(File &file)
         break;
     }
 
+    m_entry_finished = true;
+
+    if (m_sha_valid) {
+        // The digest covers the entry size, not the number of bytes written
+        if (*swentry->size != m_entry_written) {
+            m_sha_valid = false;
+        }
+
+        // The MTK header will be patched during close() if its size is wrong
+        if ((swentry->type == ENTRY_TYPE_KERNEL
+                || swentry->type == ENTRY_TYPE_RAMDISK)
+                && mb_le32toh(m_mtk_hdr.size) != *swentry->size) {
+            m_sha_valid = false;
+        }
+    }
+
+    if (m_sha_valid) {
+        OUTCOME_TRYV(_mtk_update_sha1_size(m_sha, swentry->type,
+                                           *swentry->size));
+    }
+
     return oc::success();
 }
 
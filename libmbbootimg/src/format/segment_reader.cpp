@@ -45,6 +45,33 @@ SegmentReader::SegmentReader()
 {
 }
 
+// The current entry iterator must point into the copied vector
+SegmentReader::SegmentReader(const SegmentReader &other)
+    : m_state(other.m_state)
+    , m_entries(other.m_entries)
+    , m_entry(m_entries.begin() + (other.m_entry - other.m_entries.begin()))
+    , m_read_start_offset(other.m_read_start_offset)
+    , m_read_end_offset(other.m_read_end_offset)
+    , m_read_cur_offset(other.m_read_cur_offset)
+{
+}
+
+SegmentReader & SegmentReader::operator=(const SegmentReader &rhs)
+{
+    if (this != &rhs) {
+        auto index = rhs.m_entry - rhs.m_entries.begin();
+
+        m_state = rhs.m_state;
+        m_entries = rhs.m_entries;
+        m_entry = m_entries.begin() + index;
+        m_read_start_offset = rhs.m_read_start_offset;
+        m_read_end_offset = rhs.m_read_end_offset;
+        m_read_cur_offset = rhs.m_read_cur_offset;
+    }
+
+    return *this;
+}
+
 const std::vector<SegmentReaderEntry> & SegmentReader::entries() const
 {
     return m_entries;
@@ -174,4 +201,105 @@ oc::result<size_t> SegmentReader::read_data(File &file, void *buf,
     return n.value();
 }
 
+oc::result<FileView> SegmentReader::read_data_view(File &file, size_t size,
+                                                   Reader &reader)
+{
+    auto to_view = static_cast<size_t>(std::min<uint64_t>(
+            size, m_read_end_offset - m_read_cur_offset));
+    if (to_view == 0) {
+        return FileView{nullptr, 0};
+    }
+
+    auto view = file.view_at(m_read_cur_offset, to_view);
+    if (!view) {
+        if (file.is_fatal()) { reader.set_fatal(); }
+        return view.as_failure();
+    }
+
+    if (view.value().size == 0) {
+        // Reached EOF early
+        if (!m_entry->can_truncate) {
+            reader.set_fatal();
+            return FileError::UnexpectedEof;
+        }
+        return view;
+    }
+
+    m_read_cur_offset += view.value().size;
+
+    // Keep the file position in sync for read_data()
+    auto seek_ret = file.seek(static_cast<int64_t>(m_read_cur_offset),
+                              SEEK_SET);
+    if (!seek_ret) {
+        if (file.is_fatal()) { reader.set_fatal(); }
+        return seek_ret.as_failure();
+    }
+
+    return view;
+}
+
+std::vector<EntryInfo> SegmentReader::entry_infos() const
+{
+    std::vector<EntryInfo> infos;
+    infos.reserve(m_entries.size());
+
+    for (auto const &srentry : m_entries) {
+        infos.push_back({
+            srentry.type, {}, srentry.offset, srentry.size, srentry.alignment
+        });
+    }
+
+    return infos;
+}
+
+oc::result<size_t> SegmentReader::read_at(File &file, int entry_type,
+                                          uint64_t offset, void *buf,
+                                          size_t size, Reader &reader)
+{
+    auto srentry = std::find_if(
+        m_entries.begin(),
+        m_entries.end(),
+        [&](const SegmentReaderEntry &sre) {
+            return sre.type == entry_type;
+        }
+    );
+
+    if (srentry == m_entries.end()) {
+        return ReaderError::EndOfEntries;
+    } else if (offset >= srentry->size) {
+        return 0;
+    } else if (srentry->offset > UINT64_MAX - srentry->size) {
+        return SegmentError::EntryWouldOverflowOffset;
+    }
+
+    auto to_copy = static_cast<size_t>(std::min<uint64_t>(
+            size, srentry->size - offset));
+    uint64_t file_offset = srentry->offset + offset;
+    size_t total = 0;
+
+    // Does not affect the file position, so sequential reads are unaffected
+    while (total < to_copy) {
+        auto n = file.read_at(file_offset + total,
+                              static_cast<char *>(buf) + total,
+                              to_copy - total);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            if (file.is_fatal()) { reader.set_fatal(); }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        total += n.value();
+    }
+
+    if (total < to_copy && !srentry->can_truncate) {
+        return FileError::UnexpectedEof;
+    }
+
+    return total;
+}
+
 }
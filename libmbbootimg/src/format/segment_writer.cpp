@@ -25,6 +25,10 @@
 #include <cstdio>
 #include <cstring>
 
+#ifdef __linux__
+#  include <fcntl.h>
+#endif
+
 #include "mbcommon/file.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
@@ -42,6 +46,7 @@ SegmentWriter::SegmentWriter()
     , m_entry()
     , m_entry_size()
     , m_pos()
+    , m_buf()
 {
 }
 
@@ -98,6 +103,9 @@ oc::result<void> SegmentWriter::get_entry(File &file, Entry &entry,
     }
 
     if (swentry == m_entries.end()) {
+        // Everything must be on disk before the format finishes the image
+        OUTCOME_TRYV(flush(file, writer));
+
         m_state = SegmentWriterState::End;
         m_entry = swentry;
         return WriterError::EndOfEntries;
@@ -119,7 +127,6 @@ oc::result<void> SegmentWriter::get_entry(File &file, Entry &entry,
 oc::result<void> SegmentWriter::write_entry(File &file, const Entry &entry,
                                             Writer &writer)
 {
-    (void) file;
     (void) writer;
 
     // Use entry size if specified
@@ -131,6 +138,8 @@ oc::result<void> SegmentWriter::write_entry(File &file, const Entry &entry,
         }
 
         update_size_if_unset(static_cast<uint32_t>(*size));
+
+        preallocate(file, *size);
     }
 
     return oc::success();
@@ -145,13 +154,7 @@ oc::result<size_t> SegmentWriter::write_data(File &file, const void *buf,
         return SegmentError::WriteWouldOverflowInteger;
     }
 
-    auto ret = file_write_exact(file, buf, buf_size);
-    if (!ret) {
-        // This is a fatal error. We must guarantee that buf_size bytes will be
-        // written.
-        writer.set_fatal();
-        return ret.as_failure();
-    }
+    OUTCOME_TRYV(buffer_write(file, buf, buf_size, writer));
 
     m_entry_size += static_cast<uint32_t>(buf_size);
     *m_pos += buf_size;
@@ -168,16 +171,140 @@ oc::result<void> SegmentWriter::finish_entry(File &file, Writer &writer)
     if (m_entry->align > 0) {
         auto skip = align_page_size<uint64_t>(*m_pos, m_entry->align);
 
-        auto new_pos = file.seek(static_cast<int64_t>(skip), SEEK_CUR);
-        if (!new_pos) {
-            if (file.is_fatal()) { writer.set_fatal(); }
-            return new_pos.as_failure();
+        OUTCOME_TRYV(buffer_pad(file, skip, writer));
+
+        *m_pos += skip;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write buffered data to the file
+ *
+ * This is done automatically once get_entry() reaches the end of the entries.
+ */
+oc::result<void> SegmentWriter::flush(File &file, Writer &writer)
+{
+    if (!m_buf.empty()) {
+        auto ret = file_write_exact(file, m_buf.data(), m_buf.size());
+        if (!ret) {
+            // This is a fatal error. The caller was already told that the
+            // data was written.
+            writer.set_fatal();
+            return ret.as_failure();
+        }
+
+        m_buf.clear();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Coalesce writes into blocks of \ref BUFFER_SIZE bytes
+ *
+ * Since the first entry starts on a page boundary, the blocks are page-aligned
+ * for every supported page size. Data that fills whole blocks is written
+ * directly when nothing is buffered.
+ */
+oc::result<void> SegmentWriter::buffer_write(File &file, const void *buf,
+                                             size_t size, Writer &writer)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        if (m_buf.empty() && size >= BUFFER_SIZE) {
+            size_t n = size - size % BUFFER_SIZE;
+
+            auto ret = file_write_exact(file, ptr, n);
+            if (!ret) {
+                // This is a fatal error. We must guarantee that size bytes
+                // will be written.
+                writer.set_fatal();
+                return ret.as_failure();
+            }
+
+            ptr += n;
+            size -= n;
+            continue;
+        }
+
+        if (m_buf.capacity() < BUFFER_SIZE) {
+            m_buf.reserve(BUFFER_SIZE);
+        }
+
+        size_t n = std::min(size, BUFFER_SIZE - m_buf.size());
+        m_buf.insert(m_buf.end(), ptr, ptr + n);
+
+        ptr += n;
+        size -= n;
+
+        if (m_buf.size() == BUFFER_SIZE) {
+            OUTCOME_TRYV(flush(file, writer));
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add zero padding to the buffer
+ */
+oc::result<void> SegmentWriter::buffer_pad(File &file, uint64_t size,
+                                           Writer &writer)
+{
+    while (size > 0) {
+        if (m_buf.capacity() < BUFFER_SIZE) {
+            m_buf.reserve(BUFFER_SIZE);
         }
 
-        m_pos = new_pos.value();
+        auto n = static_cast<size_t>(std::min<uint64_t>(
+                size, BUFFER_SIZE - m_buf.size()));
+        m_buf.resize(m_buf.size() + n);
+
+        size -= n;
+
+        if (m_buf.size() == BUFFER_SIZE) {
+            OUTCOME_TRYV(flush(file, writer));
+        }
     }
 
     return oc::success();
 }
 
+/*!
+ * \brief Reserve disk space for the current entry
+ *
+ * This is only a hint to the filesystem to allocate the entry and its padding
+ * contiguously. The file size is not changed and errors are ignored.
+ */
+void SegmentWriter::preallocate(File &file, uint64_t size)
+{
+#if defined(__linux__) && (!defined(__ANDROID__) || __ANDROID_API__ >= 21)
+    auto fd = file.native_fd();
+    if (!fd || size == 0) {
+        return;
+    }
+
+    uint64_t offset = *m_pos;
+    uint64_t length = size;
+
+    if (m_entry->align > 0) {
+        length += align_page_size<uint64_t>(offset + size, m_entry->align);
+    }
+
+    if (offset > INT64_MAX || length > INT64_MAX - offset) {
+        return;
+    }
+
+    (void) fallocate64(fd.value(), FALLOC_FL_KEEP_SIZE,
+                       static_cast<off64_t>(offset),
+                       static_cast<off64_t>(length));
+#else
+    (void) file;
+    (void) size;
+#endif
+}
+
 }
@@ -63,6 +63,15 @@ std::string SonyElfFormatReader::name()
     return FORMAT_NAME_SONY_ELF;
 }
 
+std::unique_ptr<detail::FormatReader>
+SonyElfFormatReader::clone(Reader &reader) const
+{
+    auto format = std::make_unique<SonyElfFormatReader>(reader);
+    format->m_hdr = m_hdr;
+    format->m_seg = m_seg;
+    return format;
+}
+
 /*!
  * \brief Perform a bid
  *
@@ -123,29 +132,22 @@ oc::result<void> SonyElfFormatReader::read_header(File &file, Header &header)
     // Header
     pos += sizeof(Sony_Elf32_Ehdr);
 
-    std::vector<SegmentReaderEntry> entries;
-
-    // Read program segment headers
-    for (Elf32_Half i = 0; i < m_hdr.e_phnum; ++i) {
-        Sony_Elf32_Phdr phdr;
-
-        auto seek_ret = file.seek(static_cast<int64_t>(pos), SEEK_SET);
-        if (!seek_ret) {
-            //DEBUG("Failed to seek to segment %" PRIu16 " at %" PRIu64, i, pos);
-            if (file.is_fatal()) { m_reader.set_fatal(); }
-            return seek_ret.as_failure();
-        }
+    // Read the whole program header table at once. This avoids a round trip
+    // per segment on files where each operation is expensive.
+    std::vector<Sony_Elf32_Phdr> phdrs(m_hdr.e_phnum);
 
-        auto ret = file_read_exact(file, &phdr, sizeof(phdr));
-        if (!ret) {
-            //DEBUG("Failed to read segment %" PRIu16, i);
-            if (file.is_fatal()) { m_reader.set_fatal(); }
-            return ret.as_failure();
-        }
+    auto ret = file_read_exact_at(file, pos, phdrs.data(),
+                                  phdrs.size() * sizeof(Sony_Elf32_Phdr));
+    if (!ret) {
+        //DEBUG("Failed to read program headers at %" PRIu64, pos);
+        if (file.is_fatal()) { m_reader.set_fatal(); }
+        return ret.as_failure();
+    }
 
-        // Account for program header
-        pos += sizeof(phdr);
+    std::vector<SegmentReaderEntry> entries;
+    entries.reserve(phdrs.size());
 
+    for (auto &phdr : phdrs) {
         // Fix byte order
         sony_elf_fix_phdr_byte_order(phdr);
 
@@ -157,14 +159,8 @@ oc::result<void> SonyElfFormatReader::read_header(File &file, Header &header)
                 return SonyElfError::KernelCmdlineTooLong;
             }
 
-            seek_ret = file.seek(phdr.p_offset, SEEK_SET);
-            if (!seek_ret) {
-                //DEBUG("Failed to seek to cmdline");
-                if (file.is_fatal()) { m_reader.set_fatal(); }
-                return seek_ret.as_failure();
-            }
-
-            ret = file_read_exact(file, cmdline, phdr.p_memsz);
+            ret = file_read_exact_at(file, phdr.p_offset, cmdline,
+                                     phdr.p_memsz);
             if (!ret) {
                 //DEBUG("Failed to read cmdline");
                 if (file.is_fatal()) { m_reader.set_fatal(); };
@@ -177,35 +173,35 @@ oc::result<void> SonyElfFormatReader::read_header(File &file, Header &header)
         } else if (phdr.p_type == SONY_E_TYPE_KERNEL
                 && phdr.p_flags == SONY_E_FLAGS_KERNEL) {
             entries.push_back({
-                ENTRY_TYPE_KERNEL, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_KERNEL, phdr.p_offset, phdr.p_memsz, false, 1
             });
 
             header.set_kernel_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_RAMDISK
                 && phdr.p_flags == SONY_E_FLAGS_RAMDISK) {
             entries.push_back({
-                ENTRY_TYPE_RAMDISK, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_RAMDISK, phdr.p_offset, phdr.p_memsz, false, 1
             });
 
             header.set_ramdisk_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_IPL
                 && phdr.p_flags == SONY_E_FLAGS_IPL) {
             entries.push_back({
-                ENTRY_TYPE_SONY_IPL, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_SONY_IPL, phdr.p_offset, phdr.p_memsz, false, 1
             });
 
             header.set_sony_ipl_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_RPM
                 && phdr.p_flags == SONY_E_FLAGS_RPM) {
             entries.push_back({
-                ENTRY_TYPE_SONY_RPM, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_SONY_RPM, phdr.p_offset, phdr.p_memsz, false, 1
             });
 
             header.set_sony_rpm_address(phdr.p_vaddr);
         } else if (phdr.p_type == SONY_E_TYPE_APPSBL
                 && phdr.p_flags == SONY_E_FLAGS_APPSBL) {
             entries.push_back({
-                ENTRY_TYPE_SONY_APPSBL, phdr.p_offset, phdr.p_memsz, false
+                ENTRY_TYPE_SONY_APPSBL, phdr.p_offset, phdr.p_memsz, false, 1
             });
 
             header.set_sony_appsbl_address(phdr.p_vaddr);
@@ -216,8 +212,8 @@ oc::result<void> SonyElfFormatReader::read_header(File &file, Header &header)
             continue;
         } else {
             //DEBUG("Invalid type (0x%08" PRIx32 ") or flags"
-            //      " (0x%08" PRIx32 ") field in segment %" PRIu32,
-            //      phdr.p_type, phdr.p_flags, i);
+            //      " (0x%08" PRIx32 ") field in segment",
+            //      phdr.p_type, phdr.p_flags);
             return SonyElfError::InvalidTypeOrFlagsField;
         }
     }
@@ -242,6 +238,23 @@ oc::result<size_t> SonyElfFormatReader::read_data(File &file, void *buf,
     return m_seg->read_data(file, buf, buf_size, m_reader);
 }
 
+oc::result<FileView> SonyElfFormatReader::read_data_view(File &file, size_t size)
+{
+    return m_seg->read_data_view(file, size, m_reader);
+}
+
+oc::result<std::vector<EntryInfo>> SonyElfFormatReader::entries()
+{
+    return m_seg->entry_infos();
+}
+
+oc::result<size_t> SonyElfFormatReader::read_entry_at(File &file, int entry_type,
+                                                      uint64_t offset, void *buf,
+                                                      size_t size)
+{
+    return m_seg->read_at(file, entry_type, offset, buf, size, m_reader);
+}
+
 /*!
  * \brief Find and read Sony ELF boot image header
  *
@@ -268,13 +281,7 @@ SonyElfFormatReader::find_sony_elf_header(Reader &reader, File &file,
 {
     Sony_Elf32_Ehdr header;
 
-    auto seek_ret = file.seek(0, SEEK_SET);
-    if (!seek_ret) {
-        if (file.is_fatal()) { reader.set_fatal(); }
-        return seek_ret.as_failure();
-    }
-
-    auto ret = file_read_exact(file, &header, sizeof(header));
+    auto ret = file_read_exact_at(file, 0, &header, sizeof(header));
     if (!ret) {
         if (ret.error() == FileError::UnexpectedEof) {
             return SonyElfError::SonyElfHeaderTooSmall;
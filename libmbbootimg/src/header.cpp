@@ -37,8 +37,26 @@
 namespace mb::bootimg
 {
 
+static bool set_string(std::optional<std::string_view> value, char *buf,
+                       size_t buf_size, std::optional<uint16_t> &size)
+{
+    if (!value) {
+        size = {};
+    } else if (value->size() > buf_size) {
+        return false;
+    } else {
+        // The value may point into the buffer. Only the first `size` bytes are
+        // ever read, so the rest of the buffer does not need to be cleared.
+        memmove(buf, value->data(), value->size());
+        size = static_cast<uint16_t>(value->size());
+    }
+    return true;
+}
+
 Header::Header()
     : m_fields_supported(ALL_FIELDS)
+    , m_board_name()
+    , m_cmdline()
 {
 }
 
@@ -54,8 +72,8 @@ bool Header::operator==(const Header &rhs) const
             && m_rpm_addr == rhs.m_rpm_addr
             && m_appsbl_addr == rhs.m_appsbl_addr
             && m_page_size == rhs.m_page_size
-            && m_board_name == rhs.m_board_name
-            && m_cmdline == rhs.m_cmdline
+            && board_name() == rhs.board_name()
+            && kernel_cmdline() == rhs.kernel_cmdline()
             && m_hdr_kernel_size == rhs.m_hdr_kernel_size
             && m_hdr_ramdisk_size == rhs.m_hdr_ramdisk_size
             && m_hdr_second_size == rhs.m_hdr_second_size
@@ -89,8 +107,8 @@ void Header::clear()
     m_rpm_addr = {};
     m_appsbl_addr = {};
     m_page_size = {};
-    m_board_name = {};
-    m_cmdline = {};
+    m_board_name_size = {};
+    m_cmdline_size = {};
 
     m_hdr_kernel_size = {};
     m_hdr_ramdisk_size = {};
@@ -119,28 +137,63 @@ void Header::set_supported_fields(HeaderFields fields)
 
 // Fields
 
-std::optional<std::string> Header::board_name() const
+/*!
+ * \brief Get board name
+ *
+ * \return Board name or nullopt if it is not set. The string is stored inside
+ *         the header, so it is only valid until the header is modified or
+ *         destroyed.
+ */
+std::optional<std::string_view> Header::board_name() const
 {
-    return m_board_name;
+    if (!m_board_name_size) {
+        return std::nullopt;
+    }
+    return {{m_board_name, *m_board_name_size}};
 }
 
-bool Header::set_board_name(std::optional<std::string> name)
+/*!
+ * \brief Set board name
+ *
+ * \param name Board name or nullopt to unset it
+ *
+ * \return Whether the field is supported and the name is no longer than
+ *         #MAX_BOARD_NAME_SIZE bytes
+ */
+bool Header::set_board_name(std::optional<std::string_view> name)
 {
     ENSURE_SUPPORTED(HeaderField::BoardName);
-    m_board_name = std::move(name);
-    return true;
+    return set_string(name, m_board_name, sizeof(m_board_name),
+                      m_board_name_size);
 }
 
-std::optional<std::string> Header::kernel_cmdline() const
+/*!
+ * \brief Get kernel command line
+ *
+ * \return Kernel command line or nullopt if it is not set. The string is
+ *         stored inside the header, so it is only valid until the header is
+ *         modified or destroyed.
+ */
+std::optional<std::string_view> Header::kernel_cmdline() const
 {
-    return m_cmdline;
+    if (!m_cmdline_size) {
+        return std::nullopt;
+    }
+    return {{m_cmdline, *m_cmdline_size}};
 }
 
-bool Header::set_kernel_cmdline(std::optional<std::string> cmdline)
+/*!
+ * \brief Set kernel command line
+ *
+ * \param cmdline Kernel command line or nullopt to unset it
+ *
+ * \return Whether the field is supported and the command line is no longer
+ *         than #MAX_KERNEL_CMDLINE_SIZE bytes
+ */
+bool Header::set_kernel_cmdline(std::optional<std::string_view> cmdline)
 {
     ENSURE_SUPPORTED(HeaderField::KernelCmdline);
-    m_cmdline = std::move(cmdline);
-    return true;
+    return set_string(cmdline, m_cmdline, sizeof(m_cmdline), m_cmdline_size);
 }
 
 std::optional<uint32_t> Header::page_size() const
@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_cache.h"
+
+#include <functional>
+
+#include <cinttypes>
+#include <cstdio>
+
+#include <sys/stat.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbbootimg/probe_cache.h
+ * \brief Cache of probed boot image formats
+ */
+
+// First line of the persisted cache
+#define CACHE_FILE_HEADER "# mbbootimg probe cache v1"
+
+namespace mb::bootimg
+{
+
+/*!
+ * \struct ProbeCacheKey
+ *
+ * \brief Identity of a file on disk
+ *
+ * A file's key changes whenever the file is replaced or modified through the
+ * normal filesystem APIs. \ref formats holds one bit per format that took part
+ * in the bid (`1 << (code >> 16)` for each base format code) since the winner
+ * depends on which formats are enabled.
+ */
+
+bool ProbeCacheKey::operator==(const ProbeCacheKey &other) const
+{
+    return dev == other.dev
+            && ino == other.ino
+            && size == other.size
+            && mtime_ns == other.mtime_ns
+            && formats == other.formats;
+}
+
+bool ProbeCacheKey::operator!=(const ProbeCacheKey &other) const
+{
+    return !(*this == other);
+}
+
+/*!
+ * \brief Get key for an opened file
+ *
+ * \param file File handle backed by a file descriptor
+ *
+ * \return The key with no formats set if the file can be identified.
+ *         Otherwise, the error code.
+ *         \ref FileError::UnsupportedNativeFd is returned if the file has no
+ *         file descriptor (eg. a MemoryFile).
+ */
+oc::result<ProbeCacheKey> ProbeCacheKey::from_file(File &file)
+{
+    OUTCOME_TRY(fd, file.native_fd());
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    ProbeCacheKey key{};
+    key.dev = static_cast<uint64_t>(sb.st_dev);
+    key.ino = static_cast<uint64_t>(sb.st_ino);
+    key.size = static_cast<uint64_t>(sb.st_size);
+#if defined(__APPLE__)
+    key.mtime_ns = static_cast<int64_t>(sb.st_mtimespec.tv_sec) * 1000000000
+            + sb.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+    key.mtime_ns = static_cast<int64_t>(sb.st_mtime) * 1000000000;
+#else
+    key.mtime_ns = static_cast<int64_t>(sb.st_mtim.tv_sec) * 1000000000
+            + sb.st_mtim.tv_nsec;
+#endif
+
+    return key;
+}
+
+/*!
+ * \class ProbeCache
+ *
+ * \brief Remember which format each boot image was detected as
+ *
+ * When a ProbeCache is attached to a Reader with Reader::set_probe_cache(),
+ * Reader::open() looks up the file before bidding. If the file is known, only
+ * the cached format is tried and the other formats are never probed. The format
+ * reader still parses the header as usual, so a stale entry can never produce
+ * wrong results. If the cached format no longer accepts the file, all formats
+ * are bid on again and the entry is updated.
+ *
+ * Files are identified by their device, inode, size, and modification time, so
+ * only files backed by a file descriptor can be cached.
+ *
+ * All functions are thread safe, so one cache can be shared by multiple
+ * Readers.
+ */
+
+ProbeCache::ProbeCache() = default;
+
+ProbeCache::~ProbeCache() = default;
+
+/*!
+ * \brief Look up the format of a file
+ *
+ * \return The format code if the file is in the cache. Otherwise, nothing.
+ */
+std::optional<int> ProbeCache::lookup(const ProbeCacheKey &key) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (auto it = m_entries.find(key); it != m_entries.end()) {
+        return it->second;
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Add or replace the format of a file
+ */
+void ProbeCache::insert(const ProbeCacheKey &key, int format_code)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_entries[key] = format_code;
+}
+
+/*!
+ * \brief Remove a file from the cache
+ */
+void ProbeCache::remove(const ProbeCacheKey &key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_entries.erase(key);
+}
+
+/*!
+ * \brief Remove all files from the cache
+ */
+void ProbeCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_entries.clear();
+}
+
+/*!
+ * \brief Get number of cached files
+ */
+size_t ProbeCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_entries.size();
+}
+
+/*!
+ * \brief Add entries from a file written by save()
+ *
+ * Existing entries are kept unless they are also in the file. Malformed lines
+ * are ignored since the entries are only hints.
+ *
+ * \param path Path to cache file
+ *
+ * \return Nothing if the file is successfully read. Otherwise, the error code.
+ */
+oc::result<void> ProbeCache::load(const std::string &path)
+{
+    StandardFile file;
+    OUTCOME_TRYV(file.open(path, FileOpenMode::ReadOnly));
+
+    std::string data;
+    char buf[10240];
+
+    while (true) {
+        OUTCOME_TRY(n, file_read_retry(file, buf, sizeof(buf)));
+        if (n == 0) {
+            break;
+        }
+        data.append(buf, n);
+    }
+
+    auto lines = split_sv(data, '\n');
+
+    if (lines.empty() || lines[0] != CACHE_FILE_HEADER) {
+        return oc::success();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto it = lines.begin() + 1; it != lines.end(); ++it) {
+        std::string line(*it);
+        ProbeCacheKey key;
+        int format_code;
+
+        if (sscanf(line.c_str(), "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNd64
+                   " %" SCNu32 " %d", &key.dev, &key.ino, &key.size,
+                   &key.mtime_ns, &key.formats, &format_code) == 6) {
+            m_entries[key] = format_code;
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write all entries to a file
+ *
+ * \param path Path to cache file. It will be overwritten if it exists.
+ *
+ * \return Nothing if the file is successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<void> ProbeCache::save(const std::string &path) const
+{
+    std::string data = CACHE_FILE_HEADER "\n";
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto const &[key, format_code] : m_entries) {
+            data += format("%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRId64
+                           " %" PRIu32 " %d\n", key.dev, key.ino, key.size,
+                           key.mtime_ns, key.formats, format_code);
+        }
+    }
+
+    StandardFile file;
+    OUTCOME_TRYV(file.open(path, FileOpenMode::WriteOnly));
+    OUTCOME_TRYV(file_write_exact(file, data.data(), data.size()));
+    OUTCOME_TRYV(file.close());
+
+    return oc::success();
+}
+
+/*! \cond INTERNAL */
+
+size_t ProbeCache::KeyHash::operator()(const ProbeCacheKey &key) const noexcept
+{
+    std::hash<uint64_t> h;
+    size_t seed = h(key.dev);
+
+    for (uint64_t v : {key.ino, key.size, static_cast<uint64_t>(key.mtime_ns),
+                       static_cast<uint64_t>(key.formats)}) {
+        seed ^= h(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+    return seed;
+}
+
+/*! \endcond */
+
+}
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/probe_file_p.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbbootimg/probe_file_p.h
+ * \brief Cached File handle for format bidding
+ */
+
+namespace mb::bootimg::detail
+{
+
+using namespace mb::detail;
+
+/*!
+ * \class ProbeFile
+ *
+ * \brief Read-only File handle that caches the regions read while bidding.
+ *
+ * Every format reader inspects the same few regions of a boot image when
+ * placing a bid. For example, the Android, Bump, Loki, and MTK readers all
+ * search for the Android header at the beginning of the file and the Android
+ * and Bump readers both check for a magic string after the last segment.
+ * ProbeFile reads the underlying file in aligned blocks of #BLOCK_SIZE bytes
+ * and keeps up to #MAX_BLOCKS of them so that each region is only read once
+ * no matter how many formats are registered.
+ *
+ * Reads of at least #BLOCK_SIZE bytes from uncached blocks are passed through
+ * without being cached. The underlying file is read with File::read_at(), so
+ * its file position is unspecified while the ProbeFile is in use.
+ *
+ * The underlying File handle is not owned and must outlive this object.
+ */
+
+ProbeFile::ProbeFile()
+    : File()
+{
+    clear();
+}
+
+ProbeFile::ProbeFile(File *file)
+    : ProbeFile()
+{
+    (void) open(file);
+}
+
+ProbeFile::~ProbeFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open File handle that caches reads from another file.
+ *
+ * \param file Underlying file. It must already be opened.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> ProbeFile::open(File *file)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+    }
+
+    return File::open();
+}
+
+oc::result<void> ProbeFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ProbeFile::on_close()
+{
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> ProbeFile::on_read(void *buf, size_t size)
+{
+    uint64_t index = m_pos / BLOCK_SIZE;
+    auto block_offset = static_cast<size_t>(m_pos % BLOCK_SIZE);
+
+    auto it = std::find_if(m_blocks.begin(), m_blocks.end(),
+                           [&](const Block &b) { return b.index == index; });
+    const Block *block;
+
+    if (it != m_blocks.end()) {
+        block = &*it;
+    } else if (size >= BLOCK_SIZE || m_blocks.size() == MAX_BLOCKS) {
+        // Not worth caching
+        OUTCOME_TRY(n, read_underlying(m_pos, buf, size));
+        m_pos += n;
+        return n;
+    } else {
+        OUTCOME_TRY(b, get_block(index));
+        block = b;
+    }
+
+    if (block_offset >= block->data.size()) {
+        // Short blocks only occur at EOF
+        return 0;
+    }
+
+    size_t n = std::min(size, block->data.size() - block_offset);
+    memcpy(buf, block->data.data() + block_offset, n);
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> ProbeFile::on_seek(int64_t offset, int whence)
+{
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END: {
+        OUTCOME_TRY(size, file_size());
+        base = size;
+        break;
+    }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > INT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = base + static_cast<uint64_t>(offset);
+    }
+}
+
+/*! \cond INTERNAL */
+
+void ProbeFile::clear()
+{
+    m_file = nullptr;
+    m_blocks.clear();
+    m_size = {};
+    m_pos = 0;
+}
+
+/*!
+ * \brief Read from the underlying file until \p size bytes are read or EOF is
+ *        reached
+ */
+oc::result<size_t> ProbeFile::read_underlying(uint64_t offset, void *buf,
+                                              size_t size)
+{
+    size_t total = 0;
+
+    while (total < size) {
+        auto n = m_file->read_at(offset + total,
+                                 static_cast<unsigned char *>(buf) + total,
+                                 size - total);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            if (m_file->is_fatal()) {
+                set_fatal();
+            }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        total += n.value();
+    }
+
+    return total;
+}
+
+/*!
+ * \brief Get the size of the underlying file
+ */
+oc::result<uint64_t> ProbeFile::file_size()
+{
+    if (!m_size) {
+        auto size = m_file->seek(0, SEEK_END);
+        if (!size) {
+            if (m_file->is_fatal()) {
+                set_fatal();
+            }
+            return size.as_failure();
+        }
+        m_size = size.value();
+    }
+
+    return *m_size;
+}
+
+/*!
+ * \brief Read and cache a block from the underlying file
+ */
+oc::result<const ProbeFile::Block *> ProbeFile::get_block(uint64_t index)
+{
+    // Knowing the size avoids an extra read to find EOF in the last block
+    OUTCOME_TRY(size, file_size());
+
+    Block block;
+    block.index = index;
+    block.data.resize(static_cast<size_t>(std::min<uint64_t>(
+            BLOCK_SIZE, size - std::min(size, index * BLOCK_SIZE))));
+
+    OUTCOME_TRY(n, read_underlying(index * BLOCK_SIZE, block.data.data(),
+                                   block.data.size()));
+    block.data.resize(n);
+
+    m_blocks.push_back(std::move(block));
+
+    return &m_blocks.back();
+}
+
+/*! \endcond */
+
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/ramdisk.h"
+
+#include <cstring>
+
+#include "mbcommon/file.h"
+
+/*!
+ * \file mbbootimg/ramdisk.h
+ * \brief Ramdisk utility functions
+ */
+
+namespace mb::bootimg
+{
+
+/*!
+ * \enum RamdiskCompression
+ *
+ * \brief Compression format of a ramdisk
+ */
+
+/*!
+ * \var RamdiskCompression::Unknown
+ *
+ * \brief Data is not a recognized ramdisk
+ */
+
+/*!
+ * \var RamdiskCompression::None
+ *
+ * \brief Uncompressed cpio archive
+ */
+
+struct Magic
+{
+    const char *data;
+    size_t size;
+    RamdiskCompression compression;
+};
+
+static constexpr Magic MAGICS[] = {
+    { "\x1f\x8b", 2, RamdiskCompression::Gzip },
+    // Legacy format used by the kernel
+    { "\x02\x21\x4c\x18", 4, RamdiskCompression::Lz4 },
+    { "\x04\x22\x4d\x18", 4, RamdiskCompression::Lz4 },
+    { "\xfd\x37\x7a\x58\x5a\x00", 6, RamdiskCompression::Xz },
+    // Properties byte for the default lc=3, lp=0, pb=2
+    { "\x5d\x00\x00", 3, RamdiskCompression::Lzma },
+    { "070701", 6, RamdiskCompression::None },
+    { "070702", 6, RamdiskCompression::None },
+    { "070707", 6, RamdiskCompression::None },
+};
+
+static constexpr size_t MAX_MAGIC_SIZE = 6;
+
+/*!
+ * \brief Detect the compression format of a ramdisk
+ *
+ * Only the first few bytes of the file are inspected, so this is cheap enough
+ * to do before choosing a decompressor. The file is read with File::read_at(),
+ * so the file position is not changed.
+ *
+ * \param file File containing the ramdisk (eg. an EntryFile)
+ *
+ * \return The compression format or \ref RamdiskCompression::Unknown if the
+ *         data is not a recognized ramdisk. If the file cannot be read,
+ *         returns the error code.
+ */
+oc::result<RamdiskCompression> detect_ramdisk_compression(File &file)
+{
+    unsigned char buf[MAX_MAGIC_SIZE];
+    size_t size = 0;
+
+    while (size < sizeof(buf)) {
+        auto n = file.read_at(size, buf + size, sizeof(buf) - size);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            return n.as_failure();
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        size += n.value();
+    }
+
+    for (auto const &magic : MAGICS) {
+        if (size >= magic.size && memcmp(buf, magic.data, magic.size) == 0) {
+            return magic.compression;
+        }
+    }
+
+    return RamdiskCompression::Unknown;
+}
+
+}
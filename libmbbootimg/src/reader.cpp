@@ -19,6 +19,8 @@
 
 #include "mbbootimg/reader.h"
 
+#include <algorithm>
+
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
@@ -27,11 +29,19 @@
 #include <cstring>
 
 #include "mbcommon/file.h"
+#include "mbcommon/file_error.h"
 #include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
 
+#include "mbbootimg/cursor_file_p.h"
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_cache.h"
+#include "mbbootimg/probe_file_p.h"
+#include "mbbootimg/stream_file_p.h"
+
+// Buffer size for entry_view() when the data cannot be accessed directly
+#define VIEW_BUFFER_SIZE                (1024 * 1024)
 
 #define ENSURE_STATE_OR_RETURN(STATES, RETVAL) \
     do { \
@@ -81,6 +91,10 @@
  * file position is set to the beginning of the file before this function is
  * called and also after.
  *
+ * During bidding, \p file is a read-only view of the boot image that is shared
+ * by all format readers and caches the regions they read. It must not be used
+ * after this function returns.
+ *
  * If this function returns an error code or if the bid is lost, close() will be
  * called in Reader::open() to clean up any state. Otherwise, close() will be
  * called in Reader::close() when the user closes the Reader.
@@ -175,6 +189,62 @@
  *   * Return a specific error code if an error occurs
  */
 
+/*!
+ * \fn FormatReader::read_data_view
+ *
+ * \brief Format reader callback to get a view of entry data
+ *
+ * The view is obtained with File::view_at() and consumes the data from the
+ * entry as if it were read with read_data(). It may be shorter than \p size.
+ * If the default implementation is not overridden, FileError::UnsupportedView
+ * is returned and Reader::entry_view() falls back to read_data().
+ *
+ * \param[in] file Reference to file handle
+ * \param[in] size Maximum size of the view
+ *
+ * \return
+ *   * Return view of the data if the entry data is directly accessible. The
+ *     view is empty if the end of the entry is reached.
+ *   * Return FileError::UnsupportedView if the data is not directly accessible
+ *   * Return a specific error code if an error occurs
+ */
+
+/*!
+ * \fn FormatReader::entries
+ *
+ * \brief Format reader callback to get the table of entries
+ *
+ * This is called after read_header() succeeds. If the default implementation
+ * is not overridden, ReaderError::UnsupportedRandomAccess is returned.
+ *
+ * \return
+ *   * Return the location of every entry in the boot image, in the order that
+ *     read_entry() returns them
+ *   * Return a specific error code if an error occurs
+ */
+
+/*!
+ * \fn FormatReader::read_entry_at
+ *
+ * \brief Format reader callback to read entry data at an offset
+ *
+ * \note This function must not change the state of read_entry(), go_to_entry(),
+ *       or read_data(). If the default implementation is not overridden,
+ *       ReaderError::UnsupportedRandomAccess is returned.
+ *
+ * \param[in] file Reference to file handle
+ * \param[in] entry_type Type of entry to read from
+ * \param[in] offset Offset within the entry data
+ * \param[out] buf Output buffer to write data
+ * \param[in] size Size of output buffer
+ *
+ * \return
+ *   * Return number of bytes read. This is less than \p size only if the end
+ *     of the entry is reached.
+ *   * Return ReaderError::EndOfEntries if the entry cannot be found
+ *   * Return a specific error code if an error occurs
+ */
+
 ///
 
 namespace mb::bootimg
@@ -240,6 +310,30 @@ oc::result<void> FormatReader::go_to_entry(File &file, Entry &entry,
     return ReaderError::UnsupportedGoTo;
 }
 
+oc::result<FileView> FormatReader::read_data_view(File &file, size_t size)
+{
+    (void) file;
+    (void) size;
+    return FileError::UnsupportedView;
+}
+
+oc::result<std::vector<EntryInfo>> FormatReader::entries()
+{
+    return ReaderError::UnsupportedRandomAccess;
+}
+
+oc::result<size_t> FormatReader::read_entry_at(File &file, int entry_type,
+                                               uint64_t offset, void *buf,
+                                               size_t size)
+{
+    (void) file;
+    (void) entry_type;
+    (void) offset;
+    (void) buf;
+    (void) size;
+    return ReaderError::UnsupportedRandomAccess;
+}
+
 /*!
  * \brief Construct new Reader.
  */
@@ -247,8 +341,10 @@ Reader::Reader()
     : m_state(ReaderState::New)
     , m_owned_file()
     , m_file()
+    , m_stream()
     , m_format()
     , m_format_user_set(false)
+    , m_probe_cache()
 {
 }
 
@@ -268,9 +364,12 @@ Reader::Reader(Reader &&other) noexcept
     : m_state(other.m_state)
     , m_owned_file(std::move(other.m_owned_file))
     , m_file(other.m_file)
+    , m_stream(std::move(other.m_stream))
     , m_formats(std::move(other.m_formats))
     , m_format(other.m_format)
     , m_format_user_set(other.m_format_user_set)
+    , m_probe_cache(other.m_probe_cache)
+    , m_view_buf(std::move(other.m_view_buf))
 {
     other.m_state = ReaderState::Moved;
 }
@@ -282,9 +381,12 @@ Reader & Reader::operator=(Reader &&rhs) noexcept
     m_state = rhs.m_state;
     m_owned_file.swap(rhs.m_owned_file);
     m_file = rhs.m_file;
+    m_stream.swap(rhs.m_stream);
     m_formats.swap(rhs.m_formats);
     m_format = rhs.m_format;
     m_format_user_set = rhs.m_format_user_set;
+    m_probe_cache = rhs.m_probe_cache;
+    m_view_buf.swap(rhs.m_view_buf);
 
     rhs.m_state = ReaderState::Moved;
 
@@ -368,7 +470,6 @@ oc::result<void> Reader::open(File *file)
         return ReaderError::NoFormatsRegistered;
     }
 
-    int best_bid = 0;
     FormatReader *format = nullptr;
 
     auto close_format = finally([&] {
@@ -379,39 +480,74 @@ oc::result<void> Reader::open(File *file)
 
     // Perform bid if a format wasn't explicitly chosen
     if (!m_format) {
-        for (auto &f : m_formats) {
-            // Seek to beginning
-            auto seek_ret = file->seek(0, SEEK_SET);
-            if (!seek_ret) {
-                if (file->is_fatal()) { set_fatal(); }
-                return seek_ret.as_failure();
+        // The formats inspect mostly the same regions of the file, so let them
+        // share a cache instead of each reading from the file
+        ProbeFile probe;
+        OUTCOME_TRYV(probe.open(file));
+
+        std::optional<ProbeCacheKey> key;
+        std::optional<int> cached_code;
+
+        if (m_probe_cache) {
+            if (auto r = ProbeCacheKey::from_file(*file)) {
+                key = r.value();
+
+                // The winner depends on which formats compete
+                for (auto const &f : m_formats) {
+                    key->formats |= 1u << ((f->type() & FORMAT_BASE_MASK)
+                            >> 16);
+                }
+
+                cached_code = m_probe_cache->lookup(*key);
             }
+        }
 
-            auto close_f = finally([&] {
-                (void) f->close(*file);
+        // The cached format won the bid for this exact file with the same
+        // set of formats, so there's no need to ask the others
+        if (cached_code) {
+            auto it = std::find_if(m_formats.begin(), m_formats.end(),
+                                   [&](auto const &f) {
+                return f->type() == *cached_code;
             });
 
-            // Call bidder
-            OUTCOME_TRY(bid, f->open(*file, best_bid));
-
-            if (bid > best_bid) {
-                // Close previous best format
-                if (format) {
-                    (void) format->close(*file);
+            if (it != m_formats.end()) {
+                auto seek_ret = probe.seek(0, SEEK_SET);
+                if (!seek_ret) {
+                    if (probe.is_fatal()) { set_fatal(); }
+                    return seek_ret.as_failure();
                 }
 
-                // Don't close this format
-                close_f.dismiss();
+                auto close_f = finally([&] {
+                    (void) (*it)->close(*file);
+                });
 
-                best_bid = bid;
-                format = f.get();
+                OUTCOME_TRY(bid, (*it)->open(probe, 0));
+
+                if (bid > 0) {
+                    close_f.dismiss();
+
+                    format = it->get();
+                }
             }
         }
 
+        // Otherwise, bid on all formats
         if (!format) {
+            OUTCOME_TRY(f, bid_formats(*file, probe, false));
+            format = f;
+        }
+
+        if (!format) {
+            if (key) {
+                m_probe_cache->remove(*key);
+            }
             return ReaderError::UnknownFileFormat;
         }
 
+        if (key && cached_code != format->type()) {
+            m_probe_cache->insert(*key, format->type());
+        }
+
         // We've found a matching format, so don't close it
         close_format.dismiss();
 
@@ -424,6 +560,94 @@ oc::result<void> Reader::open(File *file)
     return oc::success();
 }
 
+/*!
+ * \brief Open boot image from non-seekable File handle.
+ *
+ * This function will take ownership of the file handle. When the Reader is
+ * closed, the file handle will also be closed.
+ *
+ * \sa open_stream(File *, size_t)
+ *
+ * \param file File handle
+ * \param lookahead Number of bytes to buffer for format detection
+ *
+ * \return Nothing if the boot image is successfully opened. Otherwise, a
+ *         specific error code.
+ */
+oc::result<void> Reader::open_stream(std::unique_ptr<File> file,
+                                     size_t lookahead)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
+
+    OUTCOME_TRYV(open_stream(file.get(), lookahead));
+
+    // Underlying pointer is not invalidated during a move
+    m_owned_file = std::move(file);
+    return oc::success();
+}
+
+/*!
+ * \brief Open boot image from non-seekable File handle.
+ *
+ * This function will not take ownership of the file handle. When the Reader is
+ * closed, the file handle will remain open.
+ *
+ * The file is only ever read forward, starting from its current position, so
+ * it can be a pipe or socket. The first \p lookahead bytes are buffered in
+ * memory. Only that window is visible to the formats while bidding, so a
+ * format whose detection needs data past the window (eg. the Samsung or Bump
+ * magic after the last segment) will not be detected. The probe cache is not
+ * used.
+ *
+ * After the format is determined, the header and entries are read in file
+ * order and the data between them is read and discarded. Operations that need
+ * to go back to a position past the window, such as Reader::go_to_entry() for
+ * an earlier entry or Reader::read_entry_at(), fail with
+ * FileError::UnsupportedSeek.
+ *
+ * \param file File handle
+ * \param lookahead Number of bytes to buffer for format detection
+ *
+ * \return Nothing if the boot image is successfully opened. Otherwise, a
+ *         specific error code.
+ */
+oc::result<void> Reader::open_stream(File *file, size_t lookahead)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
+
+    if (m_formats.empty()) {
+        return ReaderError::NoFormatsRegistered;
+    }
+
+    auto stream = std::make_unique<StreamFile>();
+    auto open_ret = stream->open(file, lookahead);
+    if (!open_ret) {
+        if (stream->is_fatal()) { set_fatal(); }
+        return open_ret.as_failure();
+    }
+
+    // Perform bid if a format wasn't explicitly chosen
+    if (!m_format) {
+        // Bidders must not consume the stream
+        stream->set_window_only(true);
+
+        OUTCOME_TRY(format, bid_formats(*stream, *stream, true));
+        if (!format) {
+            return ReaderError::UnknownFileFormat;
+        }
+
+        stream->set_window_only(false);
+
+        m_format = format;
+    }
+
+    m_state = ReaderState::Header;
+    m_file = stream.get();
+    m_stream = std::move(stream);
+
+    return oc::success();
+}
+
 /*!
  * \brief Close a Reader.
  *
@@ -442,6 +666,7 @@ oc::result<void> Reader::close()
 
         m_owned_file.reset();
         m_file = nullptr;
+        m_stream.reset();
 
         // Reset auto-detected format
         if (!m_format_user_set) {
@@ -465,6 +690,54 @@ oc::result<void> Reader::close()
     return ret;
 }
 
+/*!
+ * \brief Create a reader that shares this reader's parsed state.
+ *
+ * The clone uses the same format and entry table, so the boot image is not
+ * probed or parsed again. It starts in the same state and at the same file
+ * position as this reader, but has its own position, which it reads from with
+ * File::read_at(). This makes it possible to read different entries in
+ * parallel with one clone per thread. This reader and its clones may be used
+ * concurrently from different threads if the File handle natively supports
+ * positional reads (eg. FdFile, MemoryFile, and MmapFile).
+ *
+ * This function itself must not be called while the File handle is in use
+ * elsewhere because it seeks to find the file size. The clones must be
+ * destroyed before this reader is closed and before the File handle is
+ * closed. Readers opened with open_stream() cannot be cloned.
+ *
+ * \return A new reader if this reader is successfully cloned. Otherwise, a
+ *         specific error code.
+ */
+oc::result<std::unique_ptr<Reader>> Reader::clone()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Header | ReaderState::Entry
+            | ReaderState::Data);
+
+    if (m_stream) {
+        return ReaderError::UnsupportedRandomAccess;
+    }
+
+    auto file = std::make_unique<CursorFile>();
+    auto open_ret = file->open(m_file);
+    if (!open_ret) {
+        if (m_file->is_fatal()) { set_fatal(); }
+        return open_ret.as_failure();
+    }
+
+    // Readers are not moved after this, so the format can keep a reference
+    auto reader = std::make_unique<Reader>();
+    reader->m_formats.push_back(m_format->clone(*reader));
+    reader->m_format = reader->m_formats.back().get();
+    reader->m_format_user_set = m_format_user_set;
+    reader->m_probe_cache = m_probe_cache;
+    reader->m_state = m_state;
+    reader->m_file = file.get();
+    reader->m_owned_file = std::move(file);
+
+    return std::move(reader);
+}
+
 /*!
  * \brief Read boot image header.
  *
@@ -564,6 +837,85 @@ oc::result<size_t> Reader::read_data(void *buf, size_t size)
     return m_format->read_data(*m_file, buf, size);
 }
 
+/*!
+ * \brief Get a view of the current boot image entry data.
+ *
+ * If the underlying File handle supports File::view_at() (eg. MemoryFile or
+ * MmapFile), the returned view points directly into the file's storage and no
+ * data is copied. Otherwise, the data is read into a buffer owned by the Reader
+ * and the view points to that buffer.
+ *
+ * Like read_data(), this consumes the data. The view may be shorter than
+ * \p size, but it is only empty once the end of the entry is reached. The view
+ * is valid until the next operation on the Reader.
+ *
+ * \param size Maximum size of the view
+ *
+ * \return View of the entry data. If an error occurs, a specific error code
+ *         will be returned.
+ */
+oc::result<FileView> Reader::entry_view(size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Data);
+
+    auto view = m_format->read_data_view(*m_file, size);
+    if (view || view.error() != FileError::UnsupportedView) {
+        return view;
+    }
+
+    // Fall back to copying
+    m_view_buf.resize(std::min<size_t>(size, VIEW_BUFFER_SIZE));
+
+    OUTCOME_TRY(n, m_format->read_data(*m_file, m_view_buf.data(),
+                                       m_view_buf.size()));
+
+    return FileView{m_view_buf.data(), n};
+}
+
+/*!
+ * \brief Get locations of all boot image entries.
+ *
+ * The table is available once the header has been read with read_header(). It
+ * lists the entries in the order that read_entry() returns them.
+ *
+ * \return Table of entries. If the format does not support random access,
+ *         ReaderError::UnsupportedRandomAccess is returned. If any other error
+ *         occurs, a specific error code will be returned.
+ */
+oc::result<std::vector<EntryInfo>> Reader::entries()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    return m_format->entries();
+}
+
+/*!
+ * \brief Read boot image entry data at an offset.
+ *
+ * Read data from the specified entry without going to it first. This uses
+ * File::read_at(), so it does not affect the current entry or the position of
+ * read_data(). Entries that come before the requested entry are not read.
+ *
+ * \param[in] entry_type Type of entry to read from
+ * \param[in] offset Offset within the entry data
+ * \param[out] buf Output buffer
+ * \param[in] size Size of output buffer
+ *
+ * \return Number of bytes read. If the end of the entry is reached, the return
+ *         value will be less than \p size. Otherwise, it's guaranteed to equal
+ *         \p size. If the boot image entry is not found, this function returns
+ *         ReaderError::EndOfEntries. If any other error occurs, a specific
+ *         error code will be returned.
+ */
+oc::result<size_t> Reader::read_entry_at(int entry_type, uint64_t offset,
+                                         void *buf, size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(ReaderState::Entry | ReaderState::Data);
+
+    // Do not alter state
+    return m_format->read_entry_at(*m_file, entry_type, offset, buf, size);
+}
+
 /*!
  * \brief Get detected or forced boot image format code.
  *
@@ -747,6 +1099,22 @@ oc::result<void> Reader::enable_format_by_name(const std::string &name)
     return ReaderError::InvalidFormatName;
 }
 
+/*!
+ * \brief Use a cache of previously probed files
+ *
+ * If a cache is set, open() skips bidding for files with a known format and
+ * adds the result of the bid for new files. Only files backed by a file
+ * descriptor are cached. This has no effect if a format was explicitly chosen
+ * with set_format_by_code() or set_format_by_name().
+ *
+ * \param cache Probe cache or nullptr to disable caching. The cache is not
+ *              owned and must outlive the Reader.
+ */
+void Reader::set_probe_cache(ProbeCache *cache)
+{
+    m_probe_cache = cache;
+}
+
 /*!
  * \brief Check whether reader is opened
  *
@@ -785,6 +1153,68 @@ void Reader::set_fatal()
     }
 }
 
+/*!
+ * \brief Ask each format to bid on a file.
+ *
+ * \param file File handle to pass to FormatReader::close()
+ * \param probe File handle for the bidders to read from
+ * \param lenient Whether to treat non-fatal errors from a bidder as a bid of 0
+ *
+ * \return The format with the highest bid, which is left open, or nullptr if
+ *         no format bid. Otherwise, a specific error code.
+ */
+oc::result<FormatReader *> Reader::bid_formats(File &file, File &probe,
+                                               bool lenient)
+{
+    int best_bid = 0;
+    FormatReader *format = nullptr;
+
+    auto close_format = finally([&] {
+        if (format) {
+            (void) format->close(file);
+        }
+    });
+
+    for (auto &f : m_formats) {
+        // Seek to beginning
+        auto seek_ret = probe.seek(0, SEEK_SET);
+        if (!seek_ret) {
+            if (probe.is_fatal()) { set_fatal(); }
+            return seek_ret.as_failure();
+        }
+
+        auto close_f = finally([&] {
+            (void) f->close(file);
+        });
+
+        // Call bidder
+        auto bid = f->open(probe, best_bid);
+        if (!bid) {
+            if (lenient && !probe.is_fatal()) {
+                continue;
+            }
+            return bid.as_failure();
+        }
+
+        if (bid.value() > best_bid) {
+            // Close previous best format
+            if (format) {
+                (void) format->close(file);
+            }
+
+            // Don't close this format
+            close_f.dismiss();
+
+            best_bid = bid.value();
+            format = f.get();
+        }
+    }
+
+    close_format.dismiss();
+
+    return format;
+}
+
 oc::result<void> Reader::register_format(std::unique_ptr<FormatReader> format)
 {
     ENSURE_STATE_OR_RETURN_ERROR(ReaderState::New);
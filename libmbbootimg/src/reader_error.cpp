@@ -70,6 +70,8 @@ std::string ReaderErrorCategory::message(int ev) const
         return "end of entries";
     case ReaderError::UnsupportedGoTo:
         return "go to entry not supported";
+    case ReaderError::UnsupportedRandomAccess:
+        return "random access to entries not supported";
     default:
         return "(unknown reader error)";
     }
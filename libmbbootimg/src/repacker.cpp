@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/repacker.h"
+
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+/*!
+ * \file mbbootimg/repacker.h
+ * \brief Rewrite a boot image with some entries replaced
+ */
+
+// Buffer size for copying replacement entries
+#define COPY_BUFFER_SIZE (256 * 1024)
+
+namespace mb::bootimg
+{
+
+/*!
+ * \class Repacker
+ *
+ * \brief Rewrite a boot image with some entries replaced
+ *
+ * Repacker copies a boot image from a Reader to a Writer. Entries that have a
+ * replacement are written from the replacement file and all other entries are
+ * copied from the Reader without being decoded. If the Reader's file supports
+ * File::view_at() (eg. MmapFile), unchanged entries are written straight from
+ * the view without being copied into an intermediate buffer. The header fields
+ * and digests are recomputed by the Writer as usual.
+ *
+ * The data is still passed through the Writer because every format except
+ * Sony ELF stores a digest of all entries in the header.
+ */
+
+/*!
+ * \brief Construct a Repacker
+ *
+ * \param reader Reader for the input boot image. Reader::read_header() must
+ *               have been called. The Reader may have already been used to
+ *               read entries.
+ * \param writer Writer for the output boot image. It must be opened, but the
+ *               header must not be written yet.
+ */
+Repacker::Repacker(Reader &reader, Writer &writer)
+    : m_reader(reader)
+    , m_writer(writer)
+{
+}
+
+Repacker::~Repacker() = default;
+
+/*!
+ * \brief Replace the data of an entry
+ *
+ * The entry data is read from the current position of \p file until EOF when
+ * the entry is written. If the output format has no entry of type
+ * \p entry_type, the replacement is ignored. The replacement is used even if
+ * the input boot image does not contain the entry.
+ *
+ * \param entry_type Entry type to replace
+ * \param file File to read the entry data from. It must remain valid until
+ *             repack() returns.
+ */
+void Repacker::replace_entry(int entry_type, File &file)
+{
+    m_replacements[entry_type] = &file;
+}
+
+/*!
+ * \brief Write the output boot image
+ *
+ * Write \p header and every entry requested by the Writer. Entries that are not
+ * replaced and do not exist in the input boot image are left empty.
+ *
+ * \note Writer::close() must still be called afterwards to finalize the boot
+ *       image.
+ *
+ * \param header Header to write. This is usually the header read from the
+ *               input boot image, optionally with some fields modified.
+ *
+ * \return Nothing if all entries are successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> Repacker::repack(const Header &header)
+{
+    OUTCOME_TRYV(m_writer.write_header(header));
+
+    Entry entry;
+
+    while (true) {
+        auto ret = m_writer.get_entry(entry);
+        if (!ret) {
+            if (ret.error() == WriterError::EndOfEntries) {
+                break;
+            }
+            return ret.as_failure();
+        }
+
+        OUTCOME_TRYV(m_writer.write_entry(entry));
+
+        auto type = *entry.type();
+
+        if (auto it = m_replacements.find(type); it != m_replacements.end()) {
+            OUTCOME_TRYV(copy_from_file(*it->second));
+        } else {
+            OUTCOME_TRYV(copy_from_reader(type));
+        }
+    }
+
+    return oc::success();
+}
+
+oc::result<void> Repacker::copy_from_reader(int entry_type)
+{
+    Entry entry;
+
+    auto ret = m_reader.go_to_entry(entry, entry_type);
+    if (!ret) {
+        if (ret.error() == ReaderError::EndOfEntries) {
+            return oc::success();
+        }
+        return ret.as_failure();
+    }
+
+    while (true) {
+        OUTCOME_TRY(view, m_reader.entry_view(SIZE_MAX));
+        if (view.size == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(m_writer.write_data(view.data, view.size));
+    }
+
+    return oc::success();
+}
+
+oc::result<void> Repacker::copy_from_file(File &file)
+{
+    std::vector<unsigned char> buf(COPY_BUFFER_SIZE);
+
+    while (true) {
+        OUTCOME_TRY(n, file_read_retry(file, buf.data(), buf.size()));
+        if (n == 0) {
+            break;
+        }
+
+        OUTCOME_TRYV(m_writer.write_data(buf.data(), n));
+    }
+
+    return oc::success();
+}
+
+}
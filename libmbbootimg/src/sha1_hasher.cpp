@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/sha1_hasher_p.h"
+
+#include "mbbootimg/format/android_error.h"
+
+namespace mb::bootimg::detail
+{
+
+/*!
+ * \class Sha1Hasher
+ *
+ * \brief SHA1 digest shared by the boot image writers
+ *
+ * This uses the EVP interface so that OpenSSL can pick the fastest
+ * implementation for the CPU, such as the ARMv8 cryptography extensions or the
+ * x86 SHA extensions. Small updates, like the entry sizes and data written in
+ * small chunks, are coalesced into a buffer of \ref BUFFER_SIZE bytes before
+ * being hashed. Updates at least as large as the buffer are hashed directly.
+ *
+ * Errors are reported as android::AndroidError::Sha1InitError and
+ * android::AndroidError::Sha1UpdateError.
+ */
+
+Sha1Hasher::Sha1Hasher()
+    : m_ctx(nullptr, EVP_MD_CTX_free)
+{
+}
+
+Sha1Hasher::~Sha1Hasher() = default;
+
+/*!
+ * \brief Start a new digest
+ *
+ * Any data previously hashed is discarded.
+ */
+oc::result<void> Sha1Hasher::init()
+{
+    if (!m_ctx) {
+        m_ctx.reset(EVP_MD_CTX_new());
+        if (!m_ctx) {
+            return android::AndroidError::Sha1InitError;
+        }
+    }
+
+    if (!EVP_DigestInit_ex(m_ctx.get(), EVP_sha1(), nullptr)) {
+        return android::AndroidError::Sha1InitError;
+    }
+
+    m_buf.clear();
+    m_buf.reserve(BUFFER_SIZE);
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add data to the digest
+ */
+oc::result<void> Sha1Hasher::update(const void *data, size_t size)
+{
+    if (!m_ctx) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    if (size > BUFFER_SIZE - m_buf.size()) {
+        OUTCOME_TRYV(flush());
+    }
+
+    if (size >= BUFFER_SIZE) {
+        if (!EVP_DigestUpdate(m_ctx.get(), data, size)) {
+            return android::AndroidError::Sha1UpdateError;
+        }
+    } else {
+        auto ptr = static_cast<const unsigned char *>(data);
+        m_buf.insert(m_buf.end(), ptr, ptr + size);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Finish the digest
+ *
+ * init() must be called before the instance is used again.
+ *
+ * \param[out] digest Output buffer for the digest
+ */
+oc::result<void> Sha1Hasher::final(unsigned char digest[DIGEST_SIZE])
+{
+    if (!m_ctx) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    OUTCOME_TRYV(flush());
+
+    unsigned int size;
+
+    if (!EVP_DigestFinal_ex(m_ctx.get(), digest, &size)
+            || size != DIGEST_SIZE) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Copy the digest state from another instance
+ *
+ * Data that \p other has not yet hashed is copied as well.
+ */
+oc::result<void> Sha1Hasher::copy_from(const Sha1Hasher &other)
+{
+    if (!other.m_ctx) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    if (!m_ctx) {
+        m_ctx.reset(EVP_MD_CTX_new());
+        if (!m_ctx) {
+            return android::AndroidError::Sha1InitError;
+        }
+    }
+
+    if (!EVP_MD_CTX_copy_ex(m_ctx.get(), other.m_ctx.get())) {
+        return android::AndroidError::Sha1UpdateError;
+    }
+
+    m_buf.reserve(BUFFER_SIZE);
+    m_buf = other.m_buf;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Discard the digest state
+ */
+void Sha1Hasher::reset()
+{
+    m_ctx.reset();
+    m_buf.clear();
+}
+
+oc::result<void> Sha1Hasher::flush()
+{
+    if (!m_buf.empty()) {
+        if (!EVP_DigestUpdate(m_ctx.get(), m_buf.data(), m_buf.size())) {
+            return android::AndroidError::Sha1UpdateError;
+        }
+
+        m_buf.clear();
+    }
+
+    return oc::success();
+}
+
+}
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbbootimg/stream_file_p.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+/*!
+ * \file mbbootimg/stream_file_p.h
+ * \brief Forward-only File handle for reading from non-seekable sources
+ */
+
+namespace mb::bootimg::detail
+{
+
+using namespace mb::detail;
+
+/*!
+ * \class StreamFile
+ *
+ * \brief Read-only File handle for sources that can only be read forward.
+ *
+ * When the StreamFile is opened, up to window_size() bytes are read from the
+ * current position of the underlying file into memory. The window can be read
+ * and seeked within freely, so the format readers can bid on it and read the
+ * header without the underlying file ever being seeked.
+ *
+ * Past the window, reads come directly from the underlying file. Seeking
+ * forward from the underlying file's position is allowed and the skipped data
+ * is read and discarded once the next read happens. Seeking backwards to a
+ * position past the window fails with FileError::UnsupportedSeek. Seeking
+ * relative to the end of the file only works once the underlying file has
+ * reached EOF.
+ *
+ * In window-only mode, the data after the window is treated as if the file
+ * ended there. This is used while bidding so that probes which look further
+ * into the file fail instead of consuming the stream.
+ *
+ * The underlying File handle is not owned and must outlive this object.
+ */
+
+StreamFile::StreamFile()
+    : File()
+{
+    clear();
+}
+
+StreamFile::StreamFile(File *file, size_t window_size)
+    : StreamFile()
+{
+    (void) open(file, window_size);
+}
+
+StreamFile::~StreamFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open forward-only File handle on top of another file.
+ *
+ * \param file Underlying file. It must already be opened. It is read starting
+ *             from its current position, which becomes offset 0.
+ * \param window_size Number of bytes to buffer in memory
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> StreamFile::open(File *file, size_t window_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_window_size = window_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Maximum number of bytes kept in memory
+ */
+size_t StreamFile::window_size() const
+{
+    return m_window_size;
+}
+
+/*!
+ * \brief Whether the data past the window is hidden
+ */
+bool StreamFile::is_window_only() const
+{
+    return m_window_only;
+}
+
+/*!
+ * \brief Set whether the data past the window is hidden
+ *
+ * \param window_only Whether to report EOF at the end of the window
+ */
+void StreamFile::set_window_only(bool window_only)
+{
+    m_window_only = window_only;
+}
+
+oc::result<void> StreamFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    m_window.resize(m_window_size);
+
+    OUTCOME_TRY(n, read_underlying(m_window.data(), m_window.size()));
+    m_window.resize(n);
+    m_window.shrink_to_fit();
+
+    return oc::success();
+}
+
+oc::result<void> StreamFile::on_close()
+{
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> StreamFile::on_read(void *buf, size_t size)
+{
+    if (m_pos < m_window.size()) {
+        size_t n = std::min(size, static_cast<size_t>(m_window.size() - m_pos));
+        memcpy(buf, m_window.data() + m_pos, n);
+        m_pos += n;
+        return n;
+    } else if (m_window_only) {
+        return 0;
+    }
+
+    if (m_pos > m_stream_pos) {
+        auto n = file_read_discard(*m_file, m_pos - m_stream_pos);
+        if (!n) {
+            if (m_file->is_fatal()) {
+                set_fatal();
+            }
+            return n.as_failure();
+        }
+
+        m_stream_pos += n.value();
+
+        if (m_stream_pos < m_pos) {
+            m_size = m_stream_pos;
+            return 0;
+        }
+    }
+
+    OUTCOME_TRY(n, read_underlying(buf, size));
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> StreamFile::on_seek(int64_t offset, int whence)
+{
+    uint64_t base;
+
+    switch (whence) {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = m_pos;
+        break;
+    case SEEK_END:
+        if (!m_size) {
+            return FileError::UnsupportedSeek;
+        }
+        base = *m_size;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+
+    uint64_t pos;
+
+    if (offset < 0) {
+        if (static_cast<uint64_t>(-offset) > base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        pos = base - static_cast<uint64_t>(-offset);
+    } else {
+        if (static_cast<uint64_t>(offset) > INT64_MAX - base) {
+            return FileError::ArgumentOutOfRange;
+        }
+        pos = base + static_cast<uint64_t>(offset);
+    }
+
+    // The data between the window and the underlying file's position is gone
+    if (pos >= m_window.size() && pos < m_stream_pos) {
+        return FileError::UnsupportedSeek;
+    }
+
+    return m_pos = pos;
+}
+
+/*! \cond INTERNAL */
+
+void StreamFile::clear()
+{
+    m_file = nullptr;
+    m_window_size = DEFAULT_WINDOW_SIZE;
+    m_window.clear();
+    m_window.shrink_to_fit();
+    m_window_only = false;
+    m_stream_pos = 0;
+    m_size = {};
+    m_pos = 0;
+}
+
+/*!
+ * \brief Read from the underlying file until \p size bytes are read or EOF is
+ *        reached
+ */
+oc::result<size_t> StreamFile::read_underlying(void *buf, size_t size)
+{
+    auto n = file_read_retry(*m_file, buf, size);
+    if (!n) {
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+        return n.as_failure();
+    }
+
+    m_stream_pos += n.value();
+
+    if (n.value() < size) {
+        m_size = m_stream_pos;
+    }
+
+    return n;
+}
+
+/*! \endcond */
+
+}
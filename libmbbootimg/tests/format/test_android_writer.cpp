@@ -157,3 +157,63 @@ TEST_F(AndroidWriterSHA1Test, HandlesKernelRamdiskSecondbootDT)
     TestChecksum(expected, ENTRY_TYPE_KERNEL | ENTRY_TYPE_RAMDISK
             | ENTRY_TYPE_SECONDBOOT | ENTRY_TYPE_DEVICE_TREE);
 }
+
+TEST(AndroidWriterTest, SmallWritesAreCoalesced)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    file.set_stats_enabled(true);
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_android());
+    ASSERT_TRUE(writer.open(&file));
+
+    Header header;
+    Entry entry;
+
+    ASSERT_TRUE(writer.get_header(header));
+    ASSERT_TRUE(header.set_page_size(2048));
+    ASSERT_TRUE(writer.write_header(header));
+
+    // Write the kernel one byte at a time
+    ASSERT_TRUE(writer.get_entry(entry));
+    ASSERT_EQ(entry.type(), ENTRY_TYPE_KERNEL);
+    ASSERT_TRUE(writer.write_entry(entry));
+
+    for (size_t i = 0; i < 3000; ++i) {
+        auto c = static_cast<unsigned char>(i);
+        ASSERT_TRUE(writer.write_data(&c, 1));
+    }
+
+    while (true) {
+        auto ret = writer.get_entry(entry);
+        if (!ret) {
+            ASSERT_EQ(ret.error(), WriterError::EndOfEntries);
+            break;
+        }
+
+        ASSERT_TRUE(writer.write_entry(entry));
+    }
+
+    ASSERT_TRUE(writer.close());
+
+    // One write for the buffered data plus the header writes
+    ASSERT_LT(file.stats()->n_write, 5u);
+
+    // Kernel starts at the second page and is padded to the fourth page. The
+    // SEAndroid magic follows.
+    ASSERT_EQ(buf_size, 4096u + 2048u + 16u);
+
+    auto data = static_cast<unsigned char *>(buf);
+    for (size_t i = 0; i < 3000; ++i) {
+        ASSERT_EQ(data[2048 + i], static_cast<unsigned char>(i));
+    }
+    for (size_t i = 2048 + 3000; i < 4096 + 2048; ++i) {
+        ASSERT_EQ(data[i], 0);
+    }
+
+    free(buf);
+}
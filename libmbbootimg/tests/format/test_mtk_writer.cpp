@@ -18,3 +18,153 @@
  */
 
 #include <gtest/gtest.h>
+
+#include <memory>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/android_p.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::android;
+using namespace mb::bootimg::mtk;
+
+static constexpr char KERNEL[] = "kernel";
+static constexpr char RAMDISK[] = "ramdisk";
+
+struct MtkWriterSha1Test : testing::Test
+{
+    void *_buf = nullptr;
+    size_t _buf_size = 0;
+    uint64_t _n_read = 0;
+
+    void TearDown() override
+    {
+        free(_buf);
+    }
+
+    void write_image(uint32_t kernel_hdr_size, uint32_t ramdisk_hdr_size)
+    {
+        MemoryFile file(&_buf, &_buf_size);
+        ASSERT_TRUE(file.is_open());
+        file.set_stats_enabled(true);
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_mtk());
+        ASSERT_TRUE(writer.open(&file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            ASSERT_TRUE(writer.write_entry(entry));
+
+            MtkHeader mtk_hdr = {};
+            memcpy(mtk_hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+
+            switch (*entry.type()) {
+            case ENTRY_TYPE_MTK_KERNEL_HEADER:
+                mtk_hdr.size = mb_htole32(kernel_hdr_size);
+                ASSERT_TRUE(writer.write_data(&mtk_hdr, sizeof(mtk_hdr)));
+                break;
+            case ENTRY_TYPE_MTK_RAMDISK_HEADER:
+                mtk_hdr.size = mb_htole32(ramdisk_hdr_size);
+                ASSERT_TRUE(writer.write_data(&mtk_hdr, sizeof(mtk_hdr)));
+                break;
+            case ENTRY_TYPE_KERNEL:
+                // Split the write to test incremental hashing
+                ASSERT_TRUE(writer.write_data(KERNEL, 2));
+                ASSERT_TRUE(writer.write_data(KERNEL + 2, sizeof(KERNEL) - 2));
+                break;
+            case ENTRY_TYPE_RAMDISK:
+                ASSERT_TRUE(writer.write_data(RAMDISK, sizeof(RAMDISK)));
+                break;
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+
+        _n_read = file.stats()->n_read;
+    }
+
+    void expected_sha1(unsigned char digest[SHA_DIGEST_LENGTH])
+    {
+        MtkHeader kernel_hdr = {};
+        memcpy(kernel_hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+        kernel_hdr.size = mb_htole32(sizeof(KERNEL));
+
+        MtkHeader ramdisk_hdr = {};
+        memcpy(ramdisk_hdr.magic, MTK_MAGIC, MTK_MAGIC_SIZE);
+        ramdisk_hdr.size = mb_htole32(sizeof(RAMDISK));
+
+        uint32_t kernel_size = mb_htole32(
+                sizeof(KERNEL) + sizeof(MtkHeader));
+        uint32_t ramdisk_size = mb_htole32(
+                sizeof(RAMDISK) + sizeof(MtkHeader));
+        uint32_t second_size = 0;
+
+        std::unique_ptr<EVP_MD_CTX, decltype(EVP_MD_CTX_free) *> ctx(
+                EVP_MD_CTX_new(), EVP_MD_CTX_free);
+        ASSERT_TRUE(ctx);
+
+        auto c = ctx.get();
+        ASSERT_TRUE(EVP_DigestInit_ex(c, EVP_sha1(), nullptr));
+        ASSERT_TRUE(EVP_DigestUpdate(c, &kernel_hdr, sizeof(kernel_hdr)));
+        ASSERT_TRUE(EVP_DigestUpdate(c, KERNEL, sizeof(KERNEL)));
+        ASSERT_TRUE(EVP_DigestUpdate(c, &kernel_size, sizeof(kernel_size)));
+        ASSERT_TRUE(EVP_DigestUpdate(c, &ramdisk_hdr, sizeof(ramdisk_hdr)));
+        ASSERT_TRUE(EVP_DigestUpdate(c, RAMDISK, sizeof(RAMDISK)));
+        ASSERT_TRUE(EVP_DigestUpdate(c, &ramdisk_size, sizeof(ramdisk_size)));
+        ASSERT_TRUE(EVP_DigestUpdate(c, &second_size, sizeof(second_size)));
+
+        unsigned int size;
+        ASSERT_TRUE(EVP_DigestFinal_ex(c, digest, &size));
+        ASSERT_EQ(size, SHA_DIGEST_LENGTH);
+    }
+
+    void check_sha1()
+    {
+        unsigned char digest[SHA_DIGEST_LENGTH];
+        ASSERT_NO_FATAL_FAILURE(expected_sha1(digest));
+
+        ASSERT_GE(_buf_size, sizeof(AndroidHeader));
+        auto hdr = static_cast<const AndroidHeader *>(_buf);
+        ASSERT_EQ(memcmp(hdr->id, digest, sizeof(digest)), 0);
+    }
+};
+
+TEST_F(MtkWriterSha1Test, CorrectHeaderSizesAreNotReread)
+{
+    ASSERT_NO_FATAL_FAILURE(write_image(sizeof(KERNEL), sizeof(RAMDISK)));
+    ASSERT_NO_FATAL_FAILURE(check_sha1());
+    ASSERT_EQ(_n_read, 0u);
+}
+
+TEST_F(MtkWriterSha1Test, PatchedRamdiskHeaderIsReread)
+{
+    ASSERT_NO_FATAL_FAILURE(write_image(sizeof(KERNEL), 0));
+    ASSERT_NO_FATAL_FAILURE(check_sha1());
+    ASSERT_GT(_n_read, 0u);
+}
+
+TEST_F(MtkWriterSha1Test, PatchedKernelHeaderIsReread)
+{
+    ASSERT_NO_FATAL_FAILURE(write_image(0, sizeof(RAMDISK)));
+    ASSERT_NO_FATAL_FAILURE(check_sha1());
+    ASSERT_GT(_n_read, 0u);
+}
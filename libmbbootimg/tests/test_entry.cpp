@@ -183,3 +183,22 @@ TEST(BootImgEntryTest, CheckClear)
     ASSERT_FALSE(entry.name());
     ASSERT_FALSE(entry.size());
 }
+
+TEST(BootImgEntryTest, CheckReuseAfterClear)
+{
+    Entry entry;
+
+    entry.set_name({"test"});
+    entry.clear();
+    ASSERT_FALSE(entry.name());
+
+    entry.set_name({""});
+    auto name = entry.name();
+    ASSERT_TRUE(name);
+    ASSERT_TRUE(name->empty());
+
+    Entry entry2;
+    entry2.set_name({"other"});
+    entry2.clear();
+    ASSERT_EQ(entry2, Entry());
+}
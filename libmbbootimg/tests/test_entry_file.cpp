@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/entry_file.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct EntryFileTest : testing::Test
+{
+    void *_buf = nullptr;
+    size_t _buf_size = 0;
+    MemoryFile _file;
+    Reader _reader;
+
+    void SetUp() override
+    {
+        {
+            MemoryFile file(&_buf, &_buf_size);
+            ASSERT_TRUE(file.is_open());
+
+            Writer writer;
+            ASSERT_TRUE(writer.set_format_android());
+            ASSERT_TRUE(writer.open(&file));
+
+            Header header;
+            ASSERT_TRUE(writer.get_header(header));
+            ASSERT_TRUE(header.set_page_size(2048));
+            ASSERT_TRUE(writer.write_header(header));
+
+            Entry entry;
+            while (writer.get_entry(entry)) {
+                ASSERT_TRUE(writer.write_entry(entry));
+
+                if (*entry.type() == ENTRY_TYPE_KERNEL) {
+                    ASSERT_TRUE(writer.write_data("kernel", 6));
+                } else if (*entry.type() == ENTRY_TYPE_RAMDISK) {
+                    ASSERT_TRUE(writer.write_data("ramdisk", 7));
+                }
+            }
+
+            ASSERT_TRUE(writer.close());
+        }
+
+        ASSERT_TRUE(_file.open(_buf, _buf_size));
+        ASSERT_TRUE(_reader.enable_format_android());
+        ASSERT_TRUE(_reader.open(&_file));
+
+        Header header;
+        ASSERT_TRUE(_reader.read_header(header));
+    }
+
+    void TearDown() override
+    {
+        (void) _reader.close();
+        free(_buf);
+    }
+};
+
+TEST_F(EntryFileTest, ReadEntries)
+{
+    EntryFile kernel(&_reader, ENTRY_TYPE_KERNEL);
+    ASSERT_TRUE(kernel.is_open());
+    EntryFile ramdisk(&_reader, ENTRY_TYPE_RAMDISK);
+    ASSERT_TRUE(ramdisk.is_open());
+
+    ASSERT_EQ(kernel.size(), 6u);
+    ASSERT_EQ(ramdisk.size(), 7u);
+
+    // Interleaved reads do not affect each other
+    char buf[10];
+    ASSERT_TRUE(file_read_exact(kernel, buf, 3));
+    ASSERT_TRUE(file_read_exact(ramdisk, buf + 3, 4));
+    ASSERT_EQ(std::string(buf, 7), "kerramd");
+
+    auto n = file_read_retry(kernel, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "nel");
+
+    auto pos = ramdisk.seek(-2, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 5u);
+
+    n = file_read_retry(ramdisk, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "sk");
+}
+
+TEST_F(EntryFileTest, ReaderPositionIsUnchanged)
+{
+    Entry entry;
+    ASSERT_TRUE(_reader.read_entry(entry));
+    ASSERT_EQ(entry.type(), ENTRY_TYPE_KERNEL);
+
+    EntryFile ramdisk(&_reader, ENTRY_TYPE_RAMDISK);
+    ASSERT_TRUE(ramdisk.is_open());
+
+    char buf[7];
+    ASSERT_TRUE(file_read_exact(ramdisk, buf, sizeof(buf)));
+
+    ASSERT_EQ(std::string(buf, sizeof(buf)), "ramdisk");
+
+    auto n = _reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "kernel");
+}
+
+TEST_F(EntryFileTest, MissingEntryFails)
+{
+    EntryFile file;
+
+    auto ret = file.open(&_reader, ENTRY_TYPE_SECONDBOOT);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), ReaderError::EndOfEntries);
+}
@@ -20,6 +20,7 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
 
 #include "mbbootimg/header.h"
 
@@ -537,3 +538,32 @@ TEST(BootImgHeaderTest, CheckClear)
     ASSERT_FALSE(header.sony_appsbl_address());
     ASSERT_FALSE(header.entrypoint_address());
 }
+
+TEST(BootImgHeaderTest, CheckStringLimits)
+{
+    Header header;
+
+    std::string name(Header::MAX_BOARD_NAME_SIZE, 'a');
+    ASSERT_TRUE(header.set_board_name(name));
+    ASSERT_EQ(*header.board_name(), name);
+
+    // Values that don't fit are rejected and the old value is kept
+    ASSERT_FALSE(header.set_board_name(name + "a"));
+    ASSERT_EQ(*header.board_name(), name);
+
+    std::string cmdline(Header::MAX_KERNEL_CMDLINE_SIZE, 'b');
+    ASSERT_TRUE(header.set_kernel_cmdline(cmdline));
+    ASSERT_EQ(*header.kernel_cmdline(), cmdline);
+
+    ASSERT_FALSE(header.set_kernel_cmdline(cmdline + "b"));
+    ASSERT_EQ(*header.kernel_cmdline(), cmdline);
+
+    // Setting a value from the header's own storage
+    ASSERT_TRUE(header.set_kernel_cmdline(header.kernel_cmdline()->substr(1)));
+    ASSERT_EQ(*header.kernel_cmdline(), cmdline.substr(1));
+
+    // Empty values are distinct from unset values
+    ASSERT_TRUE(header.set_board_name({""}));
+    ASSERT_TRUE(header.board_name());
+    ASSERT_TRUE(header.board_name()->empty());
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/probe_cache.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+#ifdef __linux__
+#  include <unistd.h>
+
+#  include "mbcommon/file/fd.h"
+#endif
+
+using namespace mb;
+using namespace mb::bootimg;
+
+TEST(ProbeCacheTest, KeyRequiresFileDescriptor)
+{
+    char buf[1];
+    MemoryFile file(buf, sizeof(buf));
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_FALSE(ProbeCacheKey::from_file(file));
+}
+
+TEST(ProbeCacheTest, InsertAndRemoveEntries)
+{
+    ProbeCache cache;
+    ProbeCacheKey key{1, 2, 3, 4, 5};
+
+    ASSERT_FALSE(cache.lookup(key));
+
+    cache.insert(key, FORMAT_ANDROID);
+    ASSERT_EQ(cache.lookup(key), FORMAT_ANDROID);
+
+    // Every field is part of the key
+    ASSERT_FALSE(cache.lookup({1, 2, 3, 4, 6}));
+    ASSERT_FALSE(cache.lookup({0, 2, 3, 4, 5}));
+
+    cache.insert(key, FORMAT_LOKI);
+    ASSERT_EQ(cache.lookup(key), FORMAT_LOKI);
+    ASSERT_EQ(cache.size(), 1u);
+
+    cache.remove(key);
+    ASSERT_FALSE(cache.lookup(key));
+    ASSERT_EQ(cache.size(), 0u);
+}
+
+#ifdef __linux__
+struct ProbeCacheFileTest : testing::Test
+{
+    std::unique_ptr<FILE, decltype(fclose) *> _fp{tmpfile(), &fclose};
+    FdFile _file;
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_fp);
+        ASSERT_TRUE(_file.open(fileno(_fp.get()), false));
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_android());
+        ASSERT_TRUE(writer.open(&_file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            ASSERT_TRUE(writer.write_entry(entry));
+
+            if (*entry.type() == ENTRY_TYPE_KERNEL) {
+                ASSERT_TRUE(writer.write_data("kernel", 6));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    ProbeCacheKey key()
+    {
+        auto key = ProbeCacheKey::from_file(_file);
+        EXPECT_TRUE(key);
+        if (!key) {
+            return {};
+        }
+
+        // Only Android is enabled
+        key.value().formats = 1u << (FORMAT_ANDROID >> 16);
+
+        return key.value();
+    }
+
+    void open_reader(ProbeCache &cache)
+    {
+        ASSERT_TRUE(_file.seek(0, SEEK_SET));
+
+        Reader reader;
+        ASSERT_TRUE(reader.enable_format_android());
+        reader.set_probe_cache(&cache);
+        ASSERT_TRUE(reader.open(&_file));
+        ASSERT_EQ(reader.format_code(), FORMAT_ANDROID);
+
+        Header header;
+        ASSERT_TRUE(reader.read_header(header));
+        ASSERT_EQ(header.page_size(), 2048u);
+    }
+};
+
+TEST_F(ProbeCacheFileTest, OpenAddsResult)
+{
+    ProbeCache cache;
+
+    ASSERT_NO_FATAL_FAILURE(open_reader(cache));
+    ASSERT_EQ(cache.size(), 1u);
+    ASSERT_EQ(cache.lookup(key()), FORMAT_ANDROID);
+
+    // Cache hit
+    ASSERT_NO_FATAL_FAILURE(open_reader(cache));
+    ASSERT_EQ(cache.size(), 1u);
+}
+
+TEST_F(ProbeCacheFileTest, StaleEntryIsReplaced)
+{
+    ProbeCache cache;
+    cache.insert(key(), FORMAT_LOKI);
+
+    ASSERT_NO_FATAL_FAILURE(open_reader(cache));
+    ASSERT_EQ(cache.lookup(key()), FORMAT_ANDROID);
+}
+
+TEST_F(ProbeCacheFileTest, DifferentFormatSetsAreSeparate)
+{
+    ProbeCache cache;
+
+    ASSERT_NO_FATAL_FAILURE(open_reader(cache));
+
+    auto all_formats = key();
+    all_formats.formats = ~0u;
+    ASSERT_FALSE(cache.lookup(all_formats));
+}
+
+TEST_F(ProbeCacheFileTest, SaveAndLoad)
+{
+    char path[] = "/tmp/mbbootimg_probe_cache_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    ProbeCache cache;
+    ASSERT_NO_FATAL_FAILURE(open_reader(cache));
+    ASSERT_TRUE(cache.save(path));
+
+    ProbeCache loaded;
+    ASSERT_TRUE(loaded.load(path));
+    ASSERT_EQ(loaded.size(), 1u);
+    ASSERT_EQ(loaded.lookup(key()), FORMAT_ANDROID);
+
+    unlink(path);
+}
+#endif
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/format/mtk_p.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/probe_file_p.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+using namespace mb::bootimg::detail;
+
+struct ProbeFileTest : testing::Test
+{
+    std::vector<unsigned char> _data;
+    MemoryFile _file;
+
+    void SetUp() override
+    {
+        _data.resize(ProbeFile::BLOCK_SIZE * 3 + 100);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i * 7 + i / 251);
+        }
+
+        ASSERT_TRUE(_file.open(_data.data(), _data.size()));
+        _file.set_stats_enabled(true);
+    }
+};
+
+TEST_F(ProbeFileTest, RepeatedReadsUseCache)
+{
+    ProbeFile probe(&_file);
+    ASSERT_TRUE(probe.is_open());
+
+    for (int i = 0; i < 3; ++i) {
+        unsigned char buf[100];
+        ASSERT_TRUE(probe.seek(ProbeFile::BLOCK_SIZE - 50, SEEK_SET));
+        ASSERT_TRUE(file_read_exact(probe, buf, sizeof(buf)));
+        ASSERT_EQ(memcmp(buf, _data.data() + ProbeFile::BLOCK_SIZE - 50,
+                         sizeof(buf)), 0);
+    }
+
+    // One read for each of the two blocks
+    ASSERT_EQ(_file.stats()->n_read, 2u);
+}
+
+TEST_F(ProbeFileTest, ReadsStopAtEof)
+{
+    ProbeFile probe(&_file);
+    ASSERT_TRUE(probe.is_open());
+
+    auto pos = probe.seek(-10, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), _data.size() - 10);
+
+    unsigned char buf[100];
+    auto n = file_read_retry(probe, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 10u);
+    ASSERT_EQ(memcmp(buf, _data.data() + _data.size() - 10, 10), 0);
+
+    ASSERT_TRUE(probe.seek(100, SEEK_END));
+    n = probe.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(ProbeFileTest, LargeReadsAreNotCached)
+{
+    ProbeFile probe(&_file);
+    ASSERT_TRUE(probe.is_open());
+
+    std::vector<unsigned char> buf(_data.size());
+
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(probe.seek(0, SEEK_SET));
+        ASSERT_TRUE(file_read_exact(probe, buf.data(), buf.size()));
+        ASSERT_EQ(buf, _data);
+    }
+
+    ASSERT_EQ(_file.stats()->n_read, 2u);
+}
+
+TEST_F(ProbeFileTest, WritesAreUnsupported)
+{
+    ProbeFile probe(&_file);
+    ASSERT_TRUE(probe.is_open());
+
+    auto n = probe.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedWrite);
+}
+
+static void write_image(int format, void **buf, size_t *buf_size)
+{
+    MemoryFile file(buf, buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_by_code(format));
+    ASSERT_TRUE(writer.open(&file));
+
+    Header header;
+    ASSERT_TRUE(writer.get_header(header));
+    ASSERT_TRUE(header.set_page_size(2048));
+    ASSERT_TRUE(writer.write_header(header));
+
+    Entry entry;
+    while (writer.get_entry(entry)) {
+        ASSERT_TRUE(writer.write_entry(entry));
+
+        if (*entry.type() == ENTRY_TYPE_MTK_KERNEL_HEADER
+                || *entry.type() == ENTRY_TYPE_MTK_RAMDISK_HEADER) {
+            mtk::MtkHeader mtk_hdr = {};
+            memcpy(mtk_hdr.magic, mtk::MTK_MAGIC, mtk::MTK_MAGIC_SIZE);
+            ASSERT_TRUE(writer.write_data(&mtk_hdr, sizeof(mtk_hdr)));
+        } else {
+            ASSERT_TRUE(writer.write_data("hello", 5));
+        }
+    }
+
+    ASSERT_TRUE(writer.close());
+}
+
+TEST(ReaderProbeTest, BiddingReadsEachRegionOnce)
+{
+    // The Android bid can only be beaten by the MTK reader, so for an MTK
+    // image, every format except Sony ELF probes the file. The first block
+    // contains the Android and Loki headers and the MTK kernel header. The
+    // other two blocks contain the MTK ramdisk header and the offset of the
+    // SEAndroid/Bump magic.
+    void *buf = nullptr;
+    size_t buf_size = 0;
+
+    ASSERT_NO_FATAL_FAILURE(write_image(FORMAT_MTK, &buf, &buf_size));
+
+    MemoryFile file(buf, buf_size);
+    ASSERT_TRUE(file.is_open());
+    file.set_stats_enabled(true);
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_all());
+    ASSERT_TRUE(reader.open(&file));
+    ASSERT_EQ(reader.format_code(), FORMAT_MTK);
+
+    ASSERT_EQ(file.stats()->n_read, 3u);
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+    ASSERT_EQ(header.page_size(), 2048u);
+
+    ASSERT_TRUE(reader.close());
+
+    free(buf);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/ramdisk.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+static RamdiskCompression detect(const char *data, size_t size)
+{
+    MemoryFile file(const_cast<char *>(data), size);
+    EXPECT_TRUE(file.is_open());
+
+    auto ret = detect_ramdisk_compression(file);
+    EXPECT_TRUE(ret);
+
+    // File position is not changed
+    auto pos = file.seek(0, SEEK_CUR);
+    EXPECT_TRUE(pos);
+    EXPECT_EQ(pos.value(), 0u);
+
+    return ret ? ret.value() : RamdiskCompression::Unknown;
+}
+
+TEST(RamdiskTest, DetectCompression)
+{
+    ASSERT_EQ(detect("\x1f\x8b\x08\x00", 4), RamdiskCompression::Gzip);
+    ASSERT_EQ(detect("\x02\x21\x4c\x18\x00", 5), RamdiskCompression::Lz4);
+    ASSERT_EQ(detect("\x04\x22\x4d\x18\x64", 5), RamdiskCompression::Lz4);
+    ASSERT_EQ(detect("\xfd\x37\x7a\x58\x5a\x00\x00", 7),
+              RamdiskCompression::Xz);
+    ASSERT_EQ(detect("\x5d\x00\x00\x80\x00", 5), RamdiskCompression::Lzma);
+    ASSERT_EQ(detect("07070100000001", 14), RamdiskCompression::None);
+    ASSERT_EQ(detect("070707", 6), RamdiskCompression::None);
+}
+
+TEST(RamdiskTest, DetectUnknownData)
+{
+    ASSERT_EQ(detect("", 0), RamdiskCompression::Unknown);
+    ASSERT_EQ(detect("\x1f", 1), RamdiskCompression::Unknown);
+    ASSERT_EQ(detect("ANDROID!", 8), RamdiskCompression::Unknown);
+}
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/reader_error.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+// Forwards reads and seeks, but does not expose the data directly
+class UnviewableFile : public File
+{
+public:
+    UnviewableFile(File &file) : m_file(file)
+    {
+        (void) open();
+    }
+
+    virtual ~UnviewableFile()
+    {
+        (void) close();
+    }
+
+protected:
+    oc::result<size_t> on_read(void *buf, size_t size) override
+    {
+        return m_file.read(buf, size);
+    }
+
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override
+    {
+        return m_file.seek(offset, whence);
+    }
+
+private:
+    File &m_file;
+};
+
+// Forwards reads, but cannot seek
+class PipeFile : public File
+{
+public:
+    PipeFile(File &file) : m_file(file)
+    {
+        (void) open();
+    }
+
+    virtual ~PipeFile()
+    {
+        (void) close();
+    }
+
+protected:
+    oc::result<size_t> on_read(void *buf, size_t size) override
+    {
+        return m_file.read(buf, size);
+    }
+
+private:
+    File &m_file;
+};
+
+struct ReaderTest : testing::Test
+{
+    void *_buf = nullptr;
+    size_t _buf_size = 0;
+
+    void SetUp() override
+    {
+        MemoryFile file(&_buf, &_buf_size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_android());
+        ASSERT_TRUE(writer.open(&file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            ASSERT_TRUE(writer.write_entry(entry));
+            if (*entry.type() == ENTRY_TYPE_KERNEL) {
+                ASSERT_TRUE(writer.write_data("kernel", 6));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+
+    void TearDown() override
+    {
+        free(_buf);
+    }
+
+    void read_kernel(File &file, std::string &data, bool &zero_copy)
+    {
+        Reader reader;
+        ASSERT_TRUE(reader.enable_format_android());
+        ASSERT_TRUE(reader.open(&file));
+
+        Header header;
+        ASSERT_TRUE(reader.read_header(header));
+
+        Entry entry;
+        ASSERT_TRUE(reader.go_to_entry(entry, ENTRY_TYPE_KERNEL));
+
+        auto begin = static_cast<const char *>(_buf);
+        auto end = begin + _buf_size;
+        zero_copy = true;
+
+        while (true) {
+            // Small size to test multiple views
+            auto view = reader.entry_view(4);
+            ASSERT_TRUE(view);
+            if (view.value().size == 0) {
+                break;
+            }
+
+            auto ptr = static_cast<const char *>(view.value().data);
+            if (ptr < begin || ptr >= end) {
+                zero_copy = false;
+            }
+
+            data.append(ptr, view.value().size);
+        }
+
+        // The file position must be kept in sync for read_data()
+        ASSERT_TRUE(reader.read_entry(entry));
+        ASSERT_EQ(*entry.type(), ENTRY_TYPE_RAMDISK);
+
+        char buf[1];
+        auto n = reader.read_data(buf, sizeof(buf));
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), 0u);
+    }
+};
+
+TEST_F(ReaderTest, MemoryFileIsNotCopied)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    std::string data;
+    bool zero_copy;
+    ASSERT_NO_FATAL_FAILURE(read_kernel(file, data, zero_copy));
+
+    ASSERT_EQ(data, "kernel");
+    ASSERT_TRUE(zero_copy);
+}
+
+TEST_F(ReaderTest, UnviewableFileIsCopied)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+    UnviewableFile wrapper(file);
+    ASSERT_TRUE(wrapper.is_open());
+
+    auto view = wrapper.view_at(0, 1);
+    ASSERT_FALSE(view);
+    ASSERT_EQ(view.error(), FileError::UnsupportedView);
+
+    std::string data;
+    bool zero_copy;
+    ASSERT_NO_FATAL_FAILURE(read_kernel(wrapper, data, zero_copy));
+
+    ASSERT_EQ(data, "kernel");
+    ASSERT_FALSE(zero_copy);
+}
+
+TEST_F(ReaderTest, RandomAccessToEntries)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_android());
+    ASSERT_TRUE(reader.open(&file));
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+
+    auto entries = reader.entries();
+    ASSERT_TRUE(entries);
+    ASSERT_EQ(entries.value(), (std::vector<EntryInfo>{
+        {ENTRY_TYPE_KERNEL, {}, 2048, 6, 2048},
+        {ENTRY_TYPE_RAMDISK, {}, 4096, 0, 2048},
+    }));
+
+    Entry entry;
+    ASSERT_TRUE(reader.go_to_entry(entry, ENTRY_TYPE_KERNEL));
+
+    char buf[10];
+    auto n = reader.read_entry_at(ENTRY_TYPE_KERNEL, 2, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "rnel");
+
+    n = reader.read_entry_at(ENTRY_TYPE_KERNEL, 6, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    n = reader.read_entry_at(ENTRY_TYPE_DEVICE_TREE, 0, buf, sizeof(buf));
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), ReaderError::EndOfEntries);
+
+    // Sequential reads should be unaffected
+    n = reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "kernel");
+}
+
+TEST_F(ReaderTest, StreamReadsEntriesInOrder)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+    PipeFile pipe(file);
+    ASSERT_TRUE(pipe.is_open());
+
+    // The entries are all past the window
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_all());
+    ASSERT_TRUE(reader.open_stream(&pipe, 2048));
+    ASSERT_EQ(reader.format_code(), FORMAT_ANDROID);
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+    ASSERT_EQ(*header.page_size(), 2048u);
+
+    Entry entry;
+    ASSERT_TRUE(reader.read_entry(entry));
+    ASSERT_EQ(*entry.type(), ENTRY_TYPE_KERNEL);
+
+    char buf[10];
+    auto n = reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "kernel");
+
+    ASSERT_TRUE(reader.read_entry(entry));
+    ASSERT_EQ(*entry.type(), ENTRY_TYPE_RAMDISK);
+
+    auto ret = reader.read_entry(entry);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), ReaderError::EndOfEntries);
+
+    ASSERT_TRUE(reader.close());
+}
+
+TEST_F(ReaderTest, StreamCannotGoBackPastWindow)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+    PipeFile pipe(file);
+    ASSERT_TRUE(pipe.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_all());
+    ASSERT_TRUE(reader.open_stream(&pipe, 2048));
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+
+    Entry entry;
+    ASSERT_TRUE(reader.go_to_entry(entry, ENTRY_TYPE_KERNEL));
+
+    char buf[10];
+    ASSERT_TRUE(reader.read_data(buf, sizeof(buf)));
+
+    // The kernel was already consumed
+    auto ret = reader.go_to_entry(entry, ENTRY_TYPE_KERNEL);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+}
+
+TEST_F(ReaderTest, StreamNeedsHeaderInWindow)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+    PipeFile pipe(file);
+    ASSERT_TRUE(pipe.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_all());
+
+    auto ret = reader.open_stream(&pipe, 100);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), ReaderError::UnknownFileFormat);
+}
+
+TEST_F(ReaderTest, CloneHasIndependentPosition)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_android());
+
+    auto clone = reader.clone();
+    ASSERT_FALSE(clone);
+    ASSERT_EQ(clone.error(), ReaderError::InvalidState);
+
+    ASSERT_TRUE(reader.open(&file));
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+
+    Entry entry;
+    ASSERT_TRUE(reader.go_to_entry(entry, ENTRY_TYPE_KERNEL));
+
+    char buf[10];
+    auto n = reader.read_data(buf, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "ke");
+
+    // The clone continues from the same point
+    clone = reader.clone();
+    ASSERT_TRUE(clone);
+    auto &reader2 = *clone.value();
+    ASSERT_EQ(reader2.format_code(), FORMAT_ANDROID);
+
+    n = reader2.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "rnel");
+
+    Entry entry2;
+    ASSERT_TRUE(reader2.go_to_entry(entry2, ENTRY_TYPE_KERNEL));
+    n = reader2.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "kernel");
+
+    ASSERT_TRUE(reader2.read_entry(entry2));
+    ASSERT_EQ(*entry2.type(), ENTRY_TYPE_RAMDISK);
+
+    // The original reader is unaffected
+    n = reader.read_data(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(std::string(buf, n.value()), "rnel");
+
+    ASSERT_TRUE(reader2.close());
+}
+
+TEST_F(ReaderTest, ClonesReadInParallel)
+{
+    MemoryFile file(_buf, _buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_all());
+    ASSERT_TRUE(reader.open(&file));
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+
+    std::vector<std::unique_ptr<Reader>> clones;
+    for (int i = 0; i < 4; ++i) {
+        auto clone = reader.clone();
+        ASSERT_TRUE(clone);
+        clones.push_back(std::move(clone.value()));
+    }
+
+    std::vector<std::string> results(clones.size());
+    std::vector<std::thread> threads;
+
+    for (size_t i = 0; i < clones.size(); ++i) {
+        threads.emplace_back([&, i] {
+            for (int j = 0; j < 100; ++j) {
+                Entry entry;
+                if (!clones[i]->go_to_entry(entry, ENTRY_TYPE_KERNEL)) {
+                    return;
+                }
+
+                char buf[10];
+                auto n = clones[i]->read_data(buf, sizeof(buf));
+                if (!n) {
+                    return;
+                }
+
+                results[i].assign(buf, n.value());
+            }
+        });
+    }
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    for (auto const &result : results) {
+        ASSERT_EQ(result, "kernel");
+    }
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbbootimg/entry.h"
+#include "mbbootimg/header.h"
+#include "mbbootimg/reader.h"
+#include "mbbootimg/repacker.h"
+#include "mbbootimg/writer.h"
+
+using namespace mb;
+using namespace mb::bootimg;
+
+struct RepackerTest : testing::Test
+{
+    void *_in_buf = nullptr;
+    size_t _in_size = 0;
+    void *_out_buf = nullptr;
+    size_t _out_size = 0;
+    void *_expected_buf = nullptr;
+    size_t _expected_size = 0;
+
+    void TearDown() override
+    {
+        free(_in_buf);
+        free(_out_buf);
+        free(_expected_buf);
+    }
+
+    static void write_image(void **buf, size_t *size,
+                            const std::map<int, std::string> &data)
+    {
+        MemoryFile file(buf, size);
+        ASSERT_TRUE(file.is_open());
+
+        Writer writer;
+        ASSERT_TRUE(writer.set_format_android());
+        ASSERT_TRUE(writer.open(&file));
+
+        Header header;
+        ASSERT_TRUE(writer.get_header(header));
+        ASSERT_TRUE(header.set_page_size(2048));
+        ASSERT_TRUE(header.set_kernel_cmdline({"cmdline"}));
+        ASSERT_TRUE(writer.write_header(header));
+
+        Entry entry;
+        while (writer.get_entry(entry)) {
+            ASSERT_TRUE(writer.write_entry(entry));
+
+            if (auto it = data.find(*entry.type()); it != data.end()) {
+                ASSERT_TRUE(writer.write_data(it->second.data(),
+                                              it->second.size()));
+            }
+        }
+
+        ASSERT_TRUE(writer.close());
+    }
+};
+
+TEST_F(RepackerTest, ReplaceRamdisk)
+{
+    ASSERT_NO_FATAL_FAILURE(write_image(&_in_buf, &_in_size, {
+        {ENTRY_TYPE_KERNEL, "kernel"},
+        {ENTRY_TYPE_RAMDISK, "ramdisk"},
+        {ENTRY_TYPE_DEVICE_TREE, "dt"},
+    }));
+    ASSERT_NO_FATAL_FAILURE(write_image(&_expected_buf, &_expected_size, {
+        {ENTRY_TYPE_KERNEL, "kernel"},
+        {ENTRY_TYPE_RAMDISK, "patched ramdisk"},
+        {ENTRY_TYPE_DEVICE_TREE, "dt"},
+    }));
+
+    MemoryFile in_file(_in_buf, _in_size);
+    ASSERT_TRUE(in_file.is_open());
+    MemoryFile out_file(&_out_buf, &_out_size);
+    ASSERT_TRUE(out_file.is_open());
+    MemoryFile ramdisk_file(const_cast<char *>("patched ramdisk"), 15);
+    ASSERT_TRUE(ramdisk_file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_android());
+    ASSERT_TRUE(reader.open(&in_file));
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_by_code(reader.format_code()));
+    ASSERT_TRUE(writer.open(&out_file));
+
+    Repacker repacker(reader, writer);
+    repacker.replace_entry(ENTRY_TYPE_RAMDISK, ramdisk_file);
+    // Not requested by the Android writer
+    repacker.replace_entry(ENTRY_TYPE_ABOOT, ramdisk_file);
+
+    ASSERT_TRUE(repacker.repack(header));
+    ASSERT_TRUE(writer.close());
+
+    // Header fields and digest should be recomputed
+    ASSERT_EQ(_out_size, _expected_size);
+    ASSERT_EQ(memcmp(_out_buf, _expected_buf, _out_size), 0);
+}
+
+TEST_F(RepackerTest, MissingEntriesAreLeftEmpty)
+{
+    ASSERT_NO_FATAL_FAILURE(write_image(&_in_buf, &_in_size, {
+        {ENTRY_TYPE_KERNEL, "kernel"},
+        {ENTRY_TYPE_RAMDISK, "ramdisk"},
+    }));
+
+    MemoryFile in_file(_in_buf, _in_size);
+    ASSERT_TRUE(in_file.is_open());
+    MemoryFile out_file(&_out_buf, &_out_size);
+    ASSERT_TRUE(out_file.is_open());
+
+    Reader reader;
+    ASSERT_TRUE(reader.enable_format_android());
+    ASSERT_TRUE(reader.open(&in_file));
+
+    Header header;
+    ASSERT_TRUE(reader.read_header(header));
+
+    Writer writer;
+    ASSERT_TRUE(writer.set_format_android());
+    ASSERT_TRUE(writer.open(&out_file));
+
+    Repacker repacker(reader, writer);
+    ASSERT_TRUE(repacker.repack(header));
+    ASSERT_TRUE(writer.close());
+
+    ASSERT_EQ(_out_size, _in_size);
+    ASSERT_EQ(memcmp(_out_buf, _in_buf, _out_size), 0);
+}
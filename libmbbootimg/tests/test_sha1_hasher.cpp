@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include <openssl/sha.h>
+
+#include "mbbootimg/sha1_hasher_p.h"
+
+using namespace mb::bootimg::detail;
+
+static std::vector<unsigned char> make_data(size_t size)
+{
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<unsigned char>(i * 7);
+    }
+    return data;
+}
+
+TEST(Sha1HasherTest, MixedUpdateSizesMatchOneShot)
+{
+    auto data = make_data(4 * Sha1Hasher::BUFFER_SIZE + 123);
+
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(data.data(), data.size(), expected);
+
+    Sha1Hasher sha;
+    ASSERT_TRUE(sha.init());
+
+    // Small updates are buffered, large ones are hashed directly
+    size_t pos = 0;
+    for (size_t size : {size_t(1), size_t(4), size_t(1000),
+                        Sha1Hasher::BUFFER_SIZE - 1,
+                        2 * Sha1Hasher::BUFFER_SIZE}) {
+        ASSERT_TRUE(sha.update(data.data() + pos, size));
+        pos += size;
+    }
+    ASSERT_TRUE(sha.update(data.data() + pos, data.size() - pos));
+
+    unsigned char digest[Sha1Hasher::DIGEST_SIZE];
+    ASSERT_TRUE(sha.final(digest));
+    ASSERT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+}
+
+TEST(Sha1HasherTest, CopyIncludesBufferedData)
+{
+    auto data = make_data(100);
+
+    unsigned char expected[SHA_DIGEST_LENGTH];
+    SHA1(data.data(), data.size(), expected);
+
+    Sha1Hasher sha;
+    ASSERT_TRUE(sha.init());
+    ASSERT_TRUE(sha.update(data.data(), 50));
+
+    Sha1Hasher copy;
+    ASSERT_TRUE(copy.copy_from(sha));
+
+    // Diverge the original
+    ASSERT_TRUE(sha.update("x", 1));
+
+    ASSERT_TRUE(copy.update(data.data() + 50, 50));
+
+    unsigned char digest[Sha1Hasher::DIGEST_SIZE];
+    ASSERT_TRUE(copy.final(digest));
+    ASSERT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+}
+
+TEST(Sha1HasherTest, UninitializedFails)
+{
+    Sha1Hasher sha;
+    ASSERT_FALSE(sha.update("x", 1));
+
+    unsigned char digest[Sha1Hasher::DIGEST_SIZE];
+    ASSERT_FALSE(sha.final(digest));
+}
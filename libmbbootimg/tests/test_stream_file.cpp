@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mbbootimg/stream_file_p.h"
+
+using namespace mb;
+using namespace mb::bootimg::detail;
+
+// Forwards reads, but cannot seek
+class PipeFile : public File
+{
+public:
+    PipeFile(File &file) : m_file(file)
+    {
+        (void) open();
+    }
+
+    virtual ~PipeFile()
+    {
+        (void) close();
+    }
+
+protected:
+    oc::result<size_t> on_read(void *buf, size_t size) override
+    {
+        return m_file.read(buf, size);
+    }
+
+private:
+    File &m_file;
+};
+
+struct StreamFileTest : testing::Test
+{
+    static constexpr size_t WINDOW_SIZE = 1000;
+
+    std::vector<unsigned char> _data;
+    MemoryFile _file;
+
+    void SetUp() override
+    {
+        _data.resize(WINDOW_SIZE * 20 + 10);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i * 7 + i / 251);
+        }
+
+        ASSERT_TRUE(_file.open(_data.data(), _data.size()));
+    }
+
+    void check_read(File &file, uint64_t offset, size_t size)
+    {
+        std::vector<unsigned char> buf(size);
+        ASSERT_TRUE(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+        ASSERT_TRUE(file_read_exact(file, buf.data(), buf.size()));
+        ASSERT_EQ(memcmp(buf.data(), _data.data() + offset, size), 0);
+    }
+};
+
+TEST_F(StreamFileTest, WindowIsRandomAccess)
+{
+    PipeFile pipe(_file);
+    StreamFile stream(&pipe, WINDOW_SIZE);
+    ASSERT_TRUE(stream.is_open());
+
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 500, 100));
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 0, 10));
+
+    // Reads may cross the end of the window
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 990, 20));
+
+    // The window is still available after reading past it
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 100, 900));
+}
+
+TEST_F(StreamFileTest, ForwardSeeksDiscardData)
+{
+    PipeFile pipe(_file);
+    StreamFile stream(&pipe, WINDOW_SIZE);
+    ASSERT_TRUE(stream.is_open());
+
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 5000, 100));
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 5100, 100));
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 12000, 100));
+
+    // Data between the window and the current position is gone
+    auto seek_ret = stream.seek(5000, SEEK_SET);
+    ASSERT_FALSE(seek_ret);
+    ASSERT_EQ(seek_ret.error(), FileError::UnsupportedSeek);
+
+    // The size is unknown until EOF is reached
+    seek_ret = stream.seek(0, SEEK_END);
+    ASSERT_FALSE(seek_ret);
+    ASSERT_EQ(seek_ret.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(stream.seek(static_cast<int64_t>(_data.size()) + 10,
+                            SEEK_SET));
+    unsigned char c;
+    auto n = stream.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    seek_ret = stream.seek(0, SEEK_END);
+    ASSERT_TRUE(seek_ret);
+    ASSERT_EQ(seek_ret.value(), _data.size());
+}
+
+TEST_F(StreamFileTest, WindowOnlyHidesRestOfFile)
+{
+    PipeFile pipe(_file);
+    StreamFile stream(&pipe, WINDOW_SIZE);
+    ASSERT_TRUE(stream.is_open());
+    stream.set_window_only(true);
+
+    unsigned char buf[100];
+    ASSERT_TRUE(stream.seek(WINDOW_SIZE - 10, SEEK_SET));
+    auto n = file_read_retry(stream, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 10u);
+
+    ASSERT_TRUE(stream.seek(WINDOW_SIZE * 5, SEEK_SET));
+    n = stream.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    auto seek_ret = stream.seek(0, SEEK_END);
+    ASSERT_FALSE(seek_ret);
+    ASSERT_EQ(seek_ret.error(), FileError::UnsupportedSeek);
+
+    // Nothing past the window was consumed
+    stream.set_window_only(false);
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, WINDOW_SIZE, 100));
+}
+
+TEST_F(StreamFileTest, SmallFileFitsInWindow)
+{
+    PipeFile pipe(_file);
+    StreamFile stream(&pipe, _data.size() * 2);
+    ASSERT_TRUE(stream.is_open());
+    stream.set_window_only(true);
+
+    auto seek_ret = stream.seek(-10, SEEK_END);
+    ASSERT_TRUE(seek_ret);
+    ASSERT_EQ(seek_ret.value(), _data.size() - 10);
+
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, _data.size() - 10, 10));
+    ASSERT_NO_FATAL_FAILURE(check_read(stream, 0, _data.size()));
+}
+
+TEST_F(StreamFileTest, StartsAtCurrentPosition)
+{
+    ASSERT_TRUE(_file.seek(100, SEEK_SET));
+
+    PipeFile pipe(_file);
+    StreamFile stream(&pipe, WINDOW_SIZE);
+    ASSERT_TRUE(stream.is_open());
+
+    unsigned char buf[10];
+    ASSERT_TRUE(file_read_exact(stream, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, _data.data() + 100, sizeof(buf)), 0);
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+class TaskGroup;
+
+class MB_EXPORT Executor
+{
+public:
+    explicit Executor(unsigned int max_threads);
+    ~Executor();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Executor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Executor)
+
+    static Executor & global();
+
+    unsigned int max_threads() const;
+
+    unsigned int concurrency() const;
+    void set_concurrency(unsigned int concurrency);
+
+    void set_thread_setup(std::function<void()> fn);
+
+private:
+    /*! \cond INTERNAL */
+    struct Task
+    {
+        std::function<void()> fn;
+        TaskGroup *group;
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void push(Task task);
+    bool pop(size_t index, Task &task);
+    bool steal(size_t index, Task &task);
+    bool take(size_t index, const TaskGroup &group, Task &task);
+    bool run_one(TaskGroup &group);
+    void run(Task &task);
+    void start_workers(unsigned int count);
+    void worker_func(size_t index);
+
+    bool current_worker(size_t &index) const;
+
+    const unsigned int m_max_threads;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::atomic_uint m_concurrency;
+    std::atomic_size_t m_queued;
+    std::atomic_size_t m_next_push;
+
+    // Protects thread startup and sleeping
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    unsigned int m_started;
+    unsigned int m_sleepers;
+    bool m_stop;
+    std::function<void()> m_thread_setup;
+    std::atomic_uint m_setup_generation;
+
+    friend class TaskGroup;
+    /*! \endcond */
+};
+
+class MB_EXPORT TaskGroup
+{
+public:
+    explicit TaskGroup(Executor &executor = Executor::global());
+    ~TaskGroup();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TaskGroup)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TaskGroup)
+
+    Executor & executor() const;
+
+    void run(std::function<void()> fn);
+    void wait();
+
+    void cancel();
+    bool is_cancelled() const;
+
+private:
+    /*! \cond INTERNAL */
+    void task_done();
+
+    Executor &m_executor;
+    std::atomic_size_t m_pending;
+    // Tasks of this group that are queued and not yet running
+    std::atomic_size_t m_queued;
+    std::atomic_bool m_cancelled;
+
+    friend class Executor;
+    /*! \endcond */
+};
+
+MB_EXPORT void parallel_for(size_t count,
+                            const std::function<void(size_t)> &fn,
+                            size_t max_tasks = 0,
+                            Executor &executor = Executor::global());
+
+MB_EXPORT bool parallel_for_until(size_t count,
+                                  const std::function<bool(size_t)> &fn,
+                                  size_t max_tasks = 0,
+                                  Executor &executor = Executor::global());
+
+/*!
+ * \brief Call \p fn for each index in [0, count) in parallel until one fails.
+ *
+ * This is parallel_for_until() for functions returning an `oc::result<void>`.
+ * Once a call fails, no further indexes are started.
+ *
+ * \return Nothing if every call succeeded. Otherwise, the error of the first
+ *         call that failed.
+ */
+template<typename Fn>
+auto try_parallel_for(size_t count, Fn &&fn, size_t max_tasks = 0,
+                      Executor &executor = Executor::global())
+    -> decltype(fn(size_t{}))
+{
+    using Result = decltype(fn(size_t{}));
+
+    std::mutex mutex;
+    std::optional<typename Result::error_type> error;
+
+    parallel_for_until(count, [&](size_t i) {
+        auto r = fn(i);
+        if (!r) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::move(r.error());
+            }
+            return false;
+        }
+        return true;
+    }, max_tasks, executor);
+
+    if (error) {
+        return std::move(*error);
+    }
+
+    return oc::success();
+}
+
+}
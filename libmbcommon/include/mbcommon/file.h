@@ -21,8 +21,10 @@
 
 #include "mbcommon/common.h"
 
+#include <chrono>
 #include <memory>
 #include <string>
+#include <system_error>
 
 #include <cstddef>
 #include <cstdint>
@@ -34,6 +36,62 @@
 namespace mb
 {
 
+struct FileIoVec
+{
+    void *data;
+    size_t size;
+};
+
+struct FileView
+{
+    const void *data;
+    size_t size;
+};
+
+enum class FileOp
+{
+    Read,
+    Write,
+    Seek,
+    Truncate,
+    ReadAt,
+    WriteAt,
+    Readv,
+    Writev,
+};
+
+struct FileStats
+{
+    uint64_t n_read = 0;
+    uint64_t n_write = 0;
+    uint64_t n_seek = 0;
+    uint64_t n_truncate = 0;
+    uint64_t n_error = 0;
+
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+
+    std::chrono::nanoseconds time_read{0};
+    std::chrono::nanoseconds time_write{0};
+    std::chrono::nanoseconds time_seek{0};
+    std::chrono::nanoseconds time_truncate{0};
+};
+
+struct FileOpInfo
+{
+    FileOp op;
+    uint64_t bytes;
+    std::chrono::nanoseconds duration;
+    std::error_code error;
+};
+
+class File;
+
+using FileTraceHook = void (*)(File &file, const FileOpInfo &info);
+
+template<typename T>
+class FileRef;
+
 class MB_EXPORT File
 {
 public:
@@ -51,11 +109,31 @@ public:
     oc::result<uint64_t> seek(int64_t offset, int whence);
     oc::result<void> truncate(uint64_t size);
 
+    // Positional and vectored file operations
+    oc::result<size_t> read_at(uint64_t offset, void *buf, size_t size);
+    oc::result<size_t> write_at(uint64_t offset, const void *buf, size_t size);
+    oc::result<size_t> readv(const FileIoVec *iov, size_t count);
+    oc::result<size_t> writev(const FileIoVec *iov, size_t count);
+
+    // Underlying file descriptor
+    oc::result<int> native_fd();
+
+    // Direct access to file contents
+    oc::result<FileView> view_at(uint64_t offset, size_t size);
+
     // File state
     bool is_open();
     bool is_fatal();
     void set_fatal();
 
+    // Instrumentation
+    void set_stats_enabled(bool enabled);
+    const FileStats * stats() const;
+    void reset_stats();
+
+    static void set_trace_hook(FileTraceHook hook);
+    static FileTraceHook trace_hook();
+
 protected:
     File(File &&other) noexcept;
     File & operator=(File &&rhs) noexcept;
@@ -72,10 +150,25 @@ protected:
     virtual oc::result<size_t> on_write(const void *buf, size_t size);
     virtual oc::result<uint64_t> on_seek(int64_t offset, int whence);
     virtual oc::result<void> on_truncate(uint64_t size);
+    virtual oc::result<size_t> on_read_at(uint64_t offset,
+                                          void *buf, size_t size);
+    virtual oc::result<size_t> on_write_at(uint64_t offset,
+                                           const void *buf, size_t size);
+    virtual oc::result<size_t> on_readv(const FileIoVec *iov, size_t count);
+    virtual oc::result<size_t> on_writev(const FileIoVec *iov, size_t count);
+    virtual oc::result<int> on_native_fd();
+    virtual oc::result<FileView> on_view_at(uint64_t offset, size_t size);
 
 private:
     /*! \cond INTERNAL */
+    template<typename T>
+    friend class FileRef;
+
+    template<typename T, typename Fn>
+    oc::result<T> instrument(FileOp op, Fn &&fn);
+
     detail::FileState m_state;
+    std::unique_ptr<FileStats> m_stats;
     /*! \endcond */
 };
 
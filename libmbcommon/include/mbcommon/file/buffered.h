@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT BufferedFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 256 * 1024;
+
+    BufferedFile();
+    BufferedFile(File *file, size_t buf_size = DEFAULT_BUFFER_SIZE);
+    virtual ~BufferedFile();
+
+    BufferedFile(BufferedFile &&other) noexcept;
+    BufferedFile & operator=(BufferedFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferedFile)
+
+    oc::result<void> open(File *file, size_t buf_size = DEFAULT_BUFFER_SIZE);
+
+    oc::result<void> flush();
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> flush_write_buffer();
+    oc::result<void> discard_read_buffer();
+    oc::result<void> sync_underlying();
+
+    File *m_file;
+    size_t m_buf_size;
+    std::vector<unsigned char> m_buf;
+
+    // Whether the underlying file reported its position when opened
+    bool m_can_seek;
+    // Position of the underlying file
+    uint64_t m_pos;
+
+    // Unconsumed read-ahead data is m_buf[m_rpos, m_rlen)
+    size_t m_rpos;
+    size_t m_rlen;
+    // Pending write-behind data is m_buf[0, m_wlen)
+    size_t m_wlen;
+    /*! \endcond */
+};
+
+}
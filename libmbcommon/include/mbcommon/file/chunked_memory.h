@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT ChunkedMemoryFile final : public File
+{
+public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+    ChunkedMemoryFile();
+    explicit ChunkedMemoryFile(size_t chunk_size);
+    virtual ~ChunkedMemoryFile();
+
+    ChunkedMemoryFile(ChunkedMemoryFile &&other) noexcept;
+    ChunkedMemoryFile & operator=(ChunkedMemoryFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ChunkedMemoryFile)
+
+    oc::result<void> open(size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+    size_t size() const;
+    std::vector<FileIoVec> chunks() const;
+    std::vector<unsigned char> flatten() const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<FileView> on_view_at(uint64_t offset, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    template<typename T>
+    friend class FileRef;
+
+    void clear();
+
+    oc::result<void> resize(size_t size);
+    void copy_out(size_t offset, void *buf, size_t size) const;
+    void copy_in(size_t offset, const void *buf, size_t size);
+
+    std::vector<std::unique_ptr<unsigned char[]>> m_chunks;
+    size_t m_chunk_size;
+    size_t m_size;
+    size_t m_pos;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT CompareWriteFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 1024 * 1024;
+
+    CompareWriteFile();
+    CompareWriteFile(File *file, size_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~CompareWriteFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(CompareWriteFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(CompareWriteFile)
+
+    oc::result<void> open(File *file, size_t block_size = DEFAULT_BLOCK_SIZE);
+
+    uint64_t blocks_compared() const;
+    uint64_t blocks_written() const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> flush_block();
+
+    File *m_file;
+    size_t m_block_size;
+
+    // Pending data for the block containing m_pos, starting at m_block_start
+    std::vector<unsigned char> m_buf;
+    size_t m_buf_used;
+    uint64_t m_block_start;
+    // Existing contents of the target, read for comparison
+    std::vector<unsigned char> m_existing;
+
+    // Position of the next byte to be written
+    uint64_t m_pos;
+
+    uint64_t m_blocks_compared;
+    uint64_t m_blocks_written;
+    /*! \endcond */
+};
+
+}
@@ -62,6 +62,13 @@ protected:
     oc::result<size_t> on_write(const void *buf, size_t size) override;
     oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
     oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<size_t> on_readv(const FileIoVec *iov, size_t count) override;
+    oc::result<size_t> on_writev(const FileIoVec *iov, size_t count) override;
+    oc::result<int> on_native_fd() override;
 
 private:
     /*! \cond INTERNAL */
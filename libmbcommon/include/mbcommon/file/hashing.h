@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "mbcommon/file.h"
+#include "mbcommon/flags.h"
+
+namespace mb
+{
+
+enum class HashAlgorithm : uint8_t
+{
+    Sha1    = 1 << 0,
+    Sha256  = 1 << 1,
+    Sha512  = 1 << 2,
+};
+MB_DECLARE_FLAGS(HashAlgorithms, HashAlgorithm)
+MB_DECLARE_OPERATORS_FOR_FLAGS(HashAlgorithms)
+
+class MB_EXPORT HashingFile : public File
+{
+public:
+    HashingFile();
+    HashingFile(File *file, HashAlgorithms algorithms);
+    virtual ~HashingFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(HashingFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(HashingFile)
+
+    oc::result<void> open(File *file, HashAlgorithms algorithms);
+
+    oc::result<std::vector<unsigned char>> digest(HashAlgorithm algorithm);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    struct Context;
+
+    static constexpr size_t MAX_ALGORITHMS = 3;
+
+    void clear();
+
+    oc::result<void> update(const void *buf, size_t size);
+
+    File *m_file;
+    HashAlgorithms m_algorithms;
+    std::unique_ptr<Context> m_ctxs[MAX_ALGORITHMS];
+
+    // Position of the underlying file
+    uint64_t m_pos;
+    // Offset where the hashed stream ends. Data is only hashed when it is
+    // read or written at this offset.
+    uint64_t m_hashed_end;
+    // Whether the digests still cover a contiguous stream of data
+    bool m_sequential;
+    /*! \endcond */
+};
+
+}
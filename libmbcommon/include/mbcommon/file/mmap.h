@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mbcommon/file.h"
+
+#include "mbcommon/file/mmap_p.h"
+
+namespace mb
+{
+
+class MB_EXPORT MmapFile : public File
+{
+public:
+    MmapFile();
+    MmapFile(int fd, bool owned);
+    MmapFile(const std::string &filename);
+    MmapFile(const std::wstring &filename);
+    virtual ~MmapFile();
+
+    MmapFile(MmapFile &&other) noexcept;
+    MmapFile & operator=(MmapFile &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MmapFile)
+
+    oc::result<void> open(int fd, bool owned);
+    oc::result<void> open(const std::string &filename);
+    oc::result<void> open(const std::wstring &filename);
+
+    // Direct access to mapping
+    const unsigned char * data() const;
+    size_t size() const;
+
+protected:
+    /*! \cond INTERNAL */
+    MmapFile(detail::MmapFileFuncs *funcs);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             int fd, bool owned);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             const std::string &filename);
+    MmapFile(detail::MmapFileFuncs *funcs,
+             const std::wstring &filename);
+    /*! \endcond */
+
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<FileView> on_view_at(uint64_t offset, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    detail::MmapFileFuncs *m_funcs;
+
+    int m_fd;
+    bool m_owned;
+    std::string m_filename;
+
+    void *m_data;
+    size_t m_size;
+    size_t m_pos;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/file.h"
+
+namespace mb
+{
+
+class MB_EXPORT PrefetchFile : public File
+{
+public:
+    static constexpr size_t DEFAULT_BUFFER_COUNT = 4;
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+    PrefetchFile();
+    PrefetchFile(File *file, size_t buf_count = DEFAULT_BUFFER_COUNT,
+                 size_t buf_size = DEFAULT_BUFFER_SIZE);
+    virtual ~PrefetchFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PrefetchFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PrefetchFile)
+
+    oc::result<void> open(File *file, size_t buf_count = DEFAULT_BUFFER_COUNT,
+                          size_t buf_size = DEFAULT_BUFFER_SIZE);
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+
+private:
+    /*! \cond INTERNAL */
+    struct Slot
+    {
+        std::vector<unsigned char> data;
+        size_t size;
+        size_t pos;
+        std::error_code error;
+    };
+
+    void clear();
+
+    void start_worker();
+    void stop_worker();
+    void worker_func();
+
+    File *m_file;
+    size_t m_buf_count;
+    size_t m_buf_size;
+
+    bool m_can_seek;
+    // Position of the next byte returned by on_read()
+    uint64_t m_pos;
+
+    std::thread m_thread;
+    bool m_running;
+
+    // Everything below is protected by m_mutex while the worker is running
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::vector<Slot> m_slots;
+    // Next slot to be consumed
+    size_t m_head;
+    // Next slot to be filled
+    size_t m_tail;
+    // Number of filled slots
+    size_t m_filled;
+    // Whether the worker has reached EOF or an error
+    bool m_done;
+    // Whether the worker should exit
+    bool m_stop;
+    /*! \endcond */
+};
+
+}
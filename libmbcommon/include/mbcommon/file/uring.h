@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <sys/uio.h>
+
+#include "mbcommon/file/fd.h"
+
+namespace mb
+{
+
+class MB_EXPORT UringFile : public FdFile
+{
+public:
+    static constexpr size_t QUEUE_DEPTH = 8;
+    static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+    static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    UringFile();
+    UringFile(int fd, bool owned);
+    UringFile(const std::string &filename, FileOpenMode mode);
+    UringFile(const std::wstring &filename, FileOpenMode mode);
+    virtual ~UringFile();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(UringFile)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(UringFile)
+
+    bool uses_uring() const;
+
+    bool enable_direct_io();
+    bool uses_direct_io() const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_read(void *buf, size_t size) override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+    oc::result<uint64_t> on_seek(int64_t offset, int whence) override;
+    oc::result<void> on_truncate(uint64_t size) override;
+    oc::result<size_t> on_read_at(uint64_t offset,
+                                  void *buf, size_t size) override;
+    oc::result<size_t> on_write_at(uint64_t offset,
+                                   const void *buf, size_t size) override;
+    oc::result<size_t> on_readv(const FileIoVec *iov, size_t count) override;
+    oc::result<size_t> on_writev(const FileIoVec *iov, size_t count) override;
+    oc::result<int> on_native_fd() override;
+
+private:
+    /*! \cond INTERNAL */
+    struct Ring;
+
+    enum class Mode
+    {
+        Idle,
+        Reading,
+        Writing,
+    };
+
+    enum class SlotState
+    {
+        Free,
+        Filling,
+        InFlight,
+        Done,
+    };
+
+    struct Slot
+    {
+        SlotState state;
+        uint64_t offset;
+        size_t size;
+        size_t pos;
+        int result;
+        // Whether the request was submitted with O_DIRECT
+        bool direct;
+        // Buffer of non-fixed requests. Kernels without
+        // IORING_FEAT_SUBMIT_STABLE may read it after submission, so it must
+        // live until the request completes.
+        struct iovec iov;
+    };
+
+    void clear();
+
+    void setup_ring();
+    void teardown_ring();
+
+    void disable_direct_io();
+
+    unsigned char * slot_data(size_t index);
+
+    oc::result<void> submit(size_t index, bool write);
+    oc::result<void> reap(bool wait);
+    oc::result<void> retire_write(size_t index);
+    oc::result<size_t> acquire_write_slot();
+    oc::result<void> fill_read_ahead();
+    oc::result<void> drain();
+
+    std::unique_ptr<Ring> m_ring;
+
+    unsigned char *m_buf;
+    std::vector<Slot> m_slots;
+    bool m_fixed;
+
+    // Whether queued requests currently bypass the page cache
+    bool m_direct;
+    // Whether any request bypassed the page cache, meaning that the device's
+    // write cache needs to be flushed when the file is closed
+    bool m_direct_used;
+
+    Mode m_mode;
+    // Logical file position. The descriptor's offset is only updated when the
+    // queue is drained.
+    uint64_t m_pos;
+
+    // Slot currently being filled by on_write()
+    size_t m_fill;
+
+    // Slots with outstanding reads, in file order
+    std::deque<size_t> m_read_queue;
+    uint64_t m_read_offset;
+    bool m_read_eof;
+    /*! \endcond */
+};
+
+}
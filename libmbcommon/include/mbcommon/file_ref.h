@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <type_traits>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbcommon/file_ref.h
+ * \brief Statically typed File handle references for hot loops
+ */
+
+namespace mb
+{
+
+/*!
+ * \brief Reference to a File handle with a known concrete type
+ *
+ * File::read() and File::write() check the file state, check whether
+ * instrumentation is enabled, and then call the virtual on_read() or
+ * on_write(). In loops that make many small calls, this overhead can be
+ * significant.
+ *
+ * If \p T is a `final` class that declares FileRef as a friend, FileRef skips
+ * File::read()/File::write() and calls `T::on_read()`/`T::on_write()` directly
+ * whenever the file is open and no instrumentation is enabled. The result is
+ * the same as calling the File methods. For any other type, FileRef simply
+ * forwards to File::read() and File::write().
+ *
+ * \tparam T Concrete File type
+ */
+template<typename T>
+class FileRef
+{
+    static_assert(std::is_base_of_v<File, T>, "T must be a File");
+
+public:
+    explicit FileRef(T &file) : m_file(file)
+    {
+    }
+
+    T & file()
+    {
+        return m_file;
+    }
+
+    oc::result<size_t> read(void *buf, size_t size)
+    {
+        if constexpr (std::is_final_v<T>) {
+            if (is_direct()) {
+                return m_file.T::on_read(buf, size);
+            }
+        }
+
+        return m_file.read(buf, size);
+    }
+
+    oc::result<size_t> write(const void *buf, size_t size)
+    {
+        if constexpr (std::is_final_v<T>) {
+            if (is_direct()) {
+                return m_file.T::on_write(buf, size);
+            }
+        }
+
+        return m_file.write(buf, size);
+    }
+
+private:
+    /*! \cond INTERNAL */
+    bool is_direct() const
+    {
+        const File &base = m_file;
+        return base.m_state == detail::FileState::Opened && !base.m_stats
+                && !File::trace_hook();
+    }
+
+    T &m_file;
+    /*! \endcond */
+};
+
+/*!
+ * \brief Read from a File handle.
+ *
+ * Like file_read_retry(File &, void *, size_t), but avoids virtual dispatch
+ * where possible.
+ */
+template<typename T>
+oc::result<size_t> file_read_retry(FileRef<T> file, void *buf, size_t size)
+{
+    size_t bytes_read = 0;
+
+    while (bytes_read < size) {
+        auto n = file.read(static_cast<char *>(buf) + bytes_read,
+                           size - bytes_read);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        bytes_read += n.value();
+    }
+
+    return bytes_read;
+}
+
+/*!
+ * \brief Read from a File handle.
+ *
+ * Like file_read_exact(File &, void *, size_t), but avoids virtual dispatch
+ * where possible.
+ */
+template<typename T>
+oc::result<void> file_read_exact(FileRef<T> file, void *buf, size_t size)
+{
+    OUTCOME_TRY(n, file_read_retry(file, buf, size));
+
+    if (n != size) {
+        return FileError::UnexpectedEof;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Read from a File handle and discard the data.
+ *
+ * Like file_read_discard(File &, uint64_t), but avoids virtual dispatch where
+ * possible.
+ */
+template<typename T>
+oc::result<uint64_t> file_read_discard(FileRef<T> file, uint64_t size)
+{
+    char buf[10240];
+
+    uint64_t bytes_discarded = 0;
+
+    while (bytes_discarded < size) {
+        auto to_read = std::min<uint64_t>(size - bytes_discarded, sizeof(buf));
+
+        OUTCOME_TRY(n, file_read_retry(file, buf,
+                                       static_cast<size_t>(to_read)));
+        bytes_discarded += n;
+
+        if (n < to_read) {
+            break;
+        }
+    }
+
+    return bytes_discarded;
+}
+
+}
@@ -23,6 +23,7 @@
 #include <optional>
 
 #include "mbcommon/file.h"
+#include "mbcommon/flags.h"
 
 namespace mb
 {
@@ -33,9 +34,26 @@ enum class FileSearchAction
     Stop,
 };
 
+enum class FileMoveFlag : uint8_t
+{
+    ShiftTail = 1 << 0,
+};
+MB_DECLARE_FLAGS(FileMoveFlags, FileMoveFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(FileMoveFlags)
+
 using FileSearchResultCallback = std::function<oc::result<FileSearchAction>
         (File &file, uint64_t offset)>;
 
+struct FileSearchPattern
+{
+    const void *data;
+    size_t size;
+};
+
+using FileSearchMultiResultCallback = std::function<
+        oc::result<FileSearchAction>
+        (File &file, size_t index, uint64_t offset)>;
+
 MB_EXPORT oc::result<size_t> file_read_retry(File &file,
                                              void *buf, size_t size);
 MB_EXPORT oc::result<size_t> file_write_retry(File &file,
@@ -43,6 +61,8 @@ MB_EXPORT oc::result<size_t> file_write_retry(File &file,
 
 MB_EXPORT oc::result<void> file_read_exact(File &file,
                                            void *buf, size_t size);
+MB_EXPORT oc::result<void> file_read_exact_at(File &file, uint64_t offset,
+                                              void *buf, size_t size);
 MB_EXPORT oc::result<void> file_write_exact(File &file,
                                             const void *buf, size_t size);
 
@@ -56,7 +76,34 @@ MB_EXPORT oc::result<void> file_search(File &file,
                                        std::optional<uint64_t> max_matches,
                                        const FileSearchResultCallback &result_cb);
 
+MB_EXPORT oc::result<void>
+file_search_parallel(File &file,
+                     std::optional<uint64_t> start,
+                     std::optional<uint64_t> end,
+                     size_t chunk_size, const void *pattern,
+                     size_t pattern_size,
+                     std::optional<uint64_t> max_matches,
+                     const FileSearchResultCallback &result_cb,
+                     size_t max_tasks = 0);
+
+MB_EXPORT std::optional<size_t> memory_search(const void *data, size_t size,
+                                             const void *pattern,
+                                             size_t pattern_size);
+
+MB_EXPORT oc::result<void>
+file_search_multi(File &file,
+                  std::optional<uint64_t> start,
+                  std::optional<uint64_t> end,
+                  size_t bsize,
+                  const FileSearchPattern *patterns, size_t count,
+                  std::optional<uint64_t> max_matches,
+                  const FileSearchMultiResultCallback &result_cb);
+
 MB_EXPORT oc::result<uint64_t> file_move(File &file, uint64_t src,
-                                         uint64_t dest, uint64_t size);
+                                         uint64_t dest, uint64_t size,
+                                         FileMoveFlags flags = {});
+
+MB_EXPORT oc::result<uint64_t> file_copy(File &in, File &out,
+                                         std::optional<uint64_t> size);
 
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+
+class MB_EXPORT ResourceBudget
+{
+public:
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ResourceBudget)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ResourceBudget)
+
+    static ResourceBudget & global();
+
+    uint64_t memory_size() const;
+
+    bool low_memory() const;
+    void set_low_memory(bool low_memory);
+
+    size_t max_buffer_size() const;
+    void set_max_buffer_size(size_t size);
+
+    unsigned int max_workers() const;
+    void set_max_workers(unsigned int workers);
+
+    size_t buffer_count(size_t buffer_size, size_t preferred,
+                        size_t minimum = 1) const;
+
+private:
+    /*! \cond INTERNAL */
+    ResourceBudget();
+
+    void apply_defaults();
+    void apply_env();
+
+    size_t reserve(size_t preferred, size_t minimum);
+    void release(size_t size);
+
+    uint64_t m_memory_size;
+    std::atomic_bool m_low_memory;
+    std::atomic_size_t m_max_buffer_size;
+    std::atomic_uint m_max_workers;
+    std::atomic_size_t m_reserved;
+
+    friend class BufferLease;
+    /*! \endcond */
+};
+
+class MB_EXPORT BufferLease
+{
+public:
+    BufferLease() noexcept;
+    BufferLease(size_t preferred, size_t minimum);
+    ~BufferLease();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(BufferLease)
+
+    BufferLease(BufferLease &&other) noexcept;
+    BufferLease & operator=(BufferLease &&rhs) noexcept;
+
+    size_t size() const;
+
+private:
+    /*! \cond INTERNAL */
+    size_t m_size;
+    /*! \endcond */
+};
+
+}
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/executor.h"
+
+#include <algorithm>
+
+#include "mbcommon/resource_budget.h"
+
+/*!
+ * \file mbcommon/executor.h
+ * \brief Process-wide work-stealing thread pool
+ */
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+// Executor and worker index of the current thread if it is a worker thread
+static thread_local const Executor *tl_executor = nullptr;
+static thread_local size_t tl_index = 0;
+/*! \endcond */
+
+/*!
+ * \class Executor
+ *
+ * \brief Work-stealing thread pool.
+ *
+ * Each worker thread has its own deque of tasks. Tasks submitted from a worker
+ * thread are pushed to and popped from the back of that worker's deque, so
+ * nested work stays on the same thread. Tasks submitted from other threads are
+ * spread across the deques. Idle workers steal from the front of the other
+ * deques.
+ *
+ * Worker threads are only started when tasks are submitted and there is no
+ * idle worker, up to the concurrency limit. Workers with an index at or above
+ * the limit stop taking tasks until the limit is raised again.
+ *
+ * Tasks are submitted through a TaskGroup. A thread that waits for a group
+ * runs the group's pending tasks in the meantime, so waiting from within a
+ * task does not deadlock the pool. Tasks of other groups are never run by a
+ * waiting thread. Otherwise, a thread waiting for a short task could end up
+ * running an unrelated long one, or one that needs a lock the thread holds.
+ *
+ * \note Tasks must not throw exceptions.
+ */
+
+/*!
+ * \brief Construct executor with up to \p max_threads worker threads.
+ *
+ * The concurrency limit is set to \p max_threads. No threads are started until
+ * tasks are submitted.
+ *
+ * \param max_threads Maximum number of worker threads (at least 1)
+ */
+Executor::Executor(unsigned int max_threads)
+    : m_max_threads(std::max(max_threads, 1u))
+    , m_concurrency(m_max_threads)
+    , m_queued(0)
+    , m_next_push(0)
+    , m_started(0)
+    , m_sleepers(0)
+    , m_stop(false)
+    , m_setup_generation(0)
+{
+    m_workers.reserve(m_max_threads);
+    for (unsigned int i = 0; i < m_max_threads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+/*!
+ * \brief Stop and join the worker threads.
+ *
+ * All task groups using the executor must have been waited for.
+ */
+Executor::~Executor()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+
+    for (unsigned int i = 0; i < m_started; ++i) {
+        m_workers[i]->thread.join();
+    }
+}
+
+/*!
+ * \brief Get the process-wide executor.
+ *
+ * It has one worker thread per CPU. All of the libraries use this executor for
+ * their parallel operations, so its concurrency limit applies to them all. The
+ * initial limit is ResourceBudget::max_workers().
+ *
+ * The executor is never destroyed, so it can be used during static
+ * destruction.
+ */
+Executor & Executor::global()
+{
+    static Executor *executor = [] {
+        auto e = new Executor(std::max(std::thread::hardware_concurrency(), 1u));
+        e->set_concurrency(ResourceBudget::global().max_workers());
+        return e;
+    }();
+    return *executor;
+}
+
+/*!
+ * \brief Maximum number of worker threads
+ */
+unsigned int Executor::max_threads() const
+{
+    return m_max_threads;
+}
+
+/*!
+ * \brief Maximum number of tasks that run at the same time
+ */
+unsigned int Executor::concurrency() const
+{
+    return m_concurrency;
+}
+
+/*!
+ * \brief Set maximum number of tasks that run at the same time
+ *
+ * Tasks that are already running are not interrupted when the limit is
+ * lowered.
+ *
+ * \param concurrency New limit. It is clamped to [1, max_threads()].
+ */
+void Executor::set_concurrency(unsigned int concurrency)
+{
+    m_concurrency = std::clamp(concurrency, 1u, m_max_threads);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_cv.notify_all();
+}
+
+/*!
+ * \brief Set function to run on each worker thread before it runs tasks
+ *
+ * This can be used to set platform-specific scheduling parameters, such as the
+ * CPU affinity or priority, that are not inherited from the submitting thread.
+ * Workers that are already running call \p fn before they run their next
+ * task.
+ *
+ * \param fn Setup function or nullptr to stop setting up new workers
+ */
+void Executor::set_thread_setup(std::function<void()> fn)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_thread_setup = std::move(fn);
+    ++m_setup_generation;
+}
+
+void Executor::push(Task task)
+{
+    size_t index;
+    if (!current_worker(index)) {
+        index = m_next_push++ % m_concurrency;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    {
+        auto &worker = *m_workers[index];
+        std::lock_guard<std::mutex> worker_lock(worker.mutex);
+        ++task.group->m_queued;
+        worker.tasks.push_back(std::move(task));
+    }
+
+    ++m_queued;
+
+    if (m_sleepers == 0 && m_started < m_concurrency) {
+        start_workers(1);
+    }
+
+    m_cv.notify_all();
+}
+
+bool Executor::pop(size_t index, Task &task)
+{
+    auto &worker = *m_workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+
+    if (worker.tasks.empty()) {
+        return false;
+    }
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    --m_queued;
+    --task.group->m_queued;
+
+    return true;
+}
+
+bool Executor::steal(size_t index, Task &task)
+{
+    for (size_t i = 0; i < m_max_threads; ++i) {
+        auto &worker = *m_workers[(index + i) % m_max_threads];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+
+        if (!worker.tasks.empty()) {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            --m_queued;
+            --task.group->m_queued;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Take a queued task of a specific group, starting with the newest task of
+// the worker at the specified index
+bool Executor::take(size_t index, const TaskGroup &group, Task &task)
+{
+    for (size_t i = 0; i < m_max_threads && group.m_queued > 0; ++i) {
+        auto &worker = *m_workers[(index + i) % m_max_threads];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+
+        auto it = std::find_if(
+                worker.tasks.rbegin(), worker.tasks.rend(), [&](auto &t) {
+            return t.group == &group;
+        });
+
+        if (it != worker.tasks.rend()) {
+            task = std::move(*it);
+            worker.tasks.erase(std::next(it).base());
+            --m_queued;
+            --task.group->m_queued;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Run a pending task of a group on the calling thread
+bool Executor::run_one(TaskGroup &group)
+{
+    Task task;
+    size_t index;
+
+    if (!current_worker(index)) {
+        index = m_next_push % m_max_threads;
+    }
+
+    if (!take(index, group, task)) {
+        return false;
+    }
+
+    run(task);
+    return true;
+}
+
+void Executor::run(Task &task)
+{
+    TaskGroup *group = task.group;
+
+    if (!group->is_cancelled()) {
+        task.fn();
+    }
+
+    // Release the captures before the group can be destroyed
+    task.fn = nullptr;
+
+    group->task_done();
+}
+
+// Must be called with m_mutex locked
+void Executor::start_workers(unsigned int count)
+{
+    for (; count > 0 && m_started < m_max_threads; --count) {
+        size_t index = m_started++;
+        m_workers[index]->thread = std::thread(&Executor::worker_func, this,
+                                               index);
+    }
+}
+
+void Executor::worker_func(size_t index)
+{
+    tl_executor = this;
+    tl_index = index;
+
+    unsigned int setup_generation = 0;
+
+    while (true) {
+        if (unsigned int generation = m_setup_generation;
+                generation != setup_generation) {
+            std::function<void()> setup;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                setup = m_thread_setup;
+                setup_generation = m_setup_generation;
+            }
+            if (setup) {
+                setup();
+            }
+            continue;
+        }
+
+        bool enabled = index < m_concurrency;
+        Task task;
+
+        if (enabled && (pop(index, task) || steal(index, task))) {
+            run(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        if (m_stop) {
+            break;
+        } else if (index < m_concurrency && m_queued > 0) {
+            continue;
+        }
+
+        ++m_sleepers;
+        m_cv.wait(lock);
+        --m_sleepers;
+    }
+}
+
+bool Executor::current_worker(size_t &index) const
+{
+    if (tl_executor != this) {
+        return false;
+    }
+
+    index = tl_index;
+    return true;
+}
+
+/*!
+ * \class TaskGroup
+ *
+ * \brief Set of tasks that can be waited for or cancelled together.
+ *
+ * The destructor waits for all of the tasks in the group, so the tasks may
+ * safely refer to variables that outlive the group.
+ */
+
+/*!
+ * \brief Construct task group for an executor.
+ *
+ * \param executor Executor to run the tasks on
+ */
+TaskGroup::TaskGroup(Executor &executor)
+    : m_executor(executor)
+    , m_pending(0)
+    , m_queued(0)
+    , m_cancelled(false)
+{
+}
+
+/*!
+ * \brief Wait for all tasks in the group.
+ */
+TaskGroup::~TaskGroup()
+{
+    wait();
+}
+
+/*!
+ * \brief Executor that the tasks run on
+ */
+Executor & TaskGroup::executor() const
+{
+    return m_executor;
+}
+
+/*!
+ * \brief Submit a task.
+ *
+ * If the group is cancelled before the task starts, the task will not be run.
+ *
+ * \param fn Task function
+ */
+void TaskGroup::run(std::function<void()> fn)
+{
+    ++m_pending;
+    m_executor.push({std::move(fn), this});
+}
+
+/*!
+ * \brief Wait for all tasks in the group to finish.
+ *
+ * While waiting, the calling thread runs the group's tasks that have not
+ * been started by a worker thread yet.
+ */
+void TaskGroup::wait()
+{
+    auto &executor = m_executor;
+
+    while (m_pending > 0) {
+        if (executor.run_one(*this)) {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(executor.m_mutex);
+
+        if (m_pending == 0) {
+            break;
+        } else if (m_queued > 0) {
+            continue;
+        }
+
+        executor.m_cv.wait(lock);
+    }
+}
+
+/*!
+ * \brief Cancel the tasks in the group that have not started yet.
+ *
+ * Running tasks can check is_cancelled() to stop early. The group stays
+ * cancelled.
+ */
+void TaskGroup::cancel()
+{
+    m_cancelled = true;
+}
+
+/*!
+ * \brief Check whether the group was cancelled.
+ */
+bool TaskGroup::is_cancelled() const
+{
+    return m_cancelled;
+}
+
+void TaskGroup::task_done()
+{
+    // The group may be destroyed as soon as m_pending reaches 0
+    auto &executor = m_executor;
+
+    if (--m_pending == 0) {
+        std::lock_guard<std::mutex> lock(executor.m_mutex);
+        executor.m_cv.notify_all();
+    }
+}
+
+/*!
+ * \brief Call \p fn for each index in [0, count) in parallel.
+ *
+ * The indexes are claimed one at a time by up to \p max_tasks tasks, including
+ * the calling thread, so uneven amounts of work per index are balanced out.
+ * The function returns once all calls have returned.
+ *
+ * \param count Number of indexes
+ * \param fn Function to call with each index
+ * \param max_tasks Maximum number of tasks. If 0, the executor's concurrency is
+ *                  used. It is never higher than the executor's concurrency.
+ * \param executor Executor to run the tasks on
+ */
+void parallel_for(size_t count, const std::function<void(size_t)> &fn,
+                  size_t max_tasks, Executor &executor)
+{
+    parallel_for_until(count, [&](size_t i) {
+        fn(i);
+        return true;
+    }, max_tasks, executor);
+}
+
+/*!
+ * \brief Call \p fn for each index in [0, count) in parallel until one fails.
+ *
+ * This behaves like parallel_for(), except that once a call returns false, no
+ * further indexes are claimed. Calls that are already running are not
+ * interrupted.
+ *
+ * \param count Number of indexes
+ * \param fn Function to call with each index
+ * \param max_tasks Maximum number of tasks. If 0, the executor's concurrency is
+ *                  used. It is never higher than the executor's concurrency.
+ * \param executor Executor to run the tasks on
+ *
+ * \return Whether every call returned true
+ */
+bool parallel_for_until(size_t count, const std::function<bool(size_t)> &fn,
+                        size_t max_tasks, Executor &executor)
+{
+    size_t tasks = executor.concurrency();
+    if (max_tasks != 0) {
+        tasks = std::min(tasks, max_tasks);
+    }
+    tasks = std::min(tasks, count);
+
+    if (tasks <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            if (!fn(i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::atomic_size_t next{0};
+    std::atomic_bool failed{false};
+
+    auto task = [&] {
+        for (size_t i; !failed && (i = next++) < count;) {
+            if (!fn(i)) {
+                failed = true;
+            }
+        }
+    };
+
+    TaskGroup group(executor);
+
+    for (size_t i = 1; i < tasks; ++i) {
+        group.run(task);
+    }
+    task();
+
+    group.wait();
+
+    return !failed;
+}
+
+}
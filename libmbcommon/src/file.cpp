@@ -19,6 +19,9 @@
 
 #include "mbcommon/file.h"
 
+#include <atomic>
+#include <type_traits>
+
 #include <cassert>
 #include <cerrno>
 #include <cinttypes>
@@ -37,6 +40,11 @@
 #define ENSURE_STATE_OR_RETURN_ERROR(STATES) \
     ENSURE_STATE_OR_RETURN(STATES, FileError::InvalidState)
 
+// Only pay for instrumentation if it is enabled for this file or globally
+#define INSTRUMENTED(OP, TYPE, EXPR) \
+    ((!m_stats && !g_trace_hook.load(std::memory_order_relaxed)) \
+            ? (EXPR) : instrument<TYPE>((OP), [&] { return (EXPR); }))
+
 // File documentation
 
 /*!
@@ -49,12 +57,99 @@ namespace mb
 
 using namespace detail;
 
+static std::atomic<FileTraceHook> g_trace_hook{nullptr};
+
 /*!
  * \class File
  *
  * \brief Utility class for reading and writing files.
  */
 
+/*!
+ * \struct FileIoVec
+ *
+ * \brief Buffer descriptor for File::readv() and File::writev()
+ */
+
+/*!
+ * \var FileIoVec::data
+ *
+ * \brief Pointer to buffer
+ */
+
+/*!
+ * \var FileIoVec::size
+ *
+ * \brief Size of buffer
+ */
+
+/*!
+ * \struct FileView
+ *
+ * \brief Read-only view of data stored by a File handle
+ */
+
+/*!
+ * \var FileView::data
+ *
+ * \brief Pointer to data
+ */
+
+/*!
+ * \var FileView::size
+ *
+ * \brief Size of data
+ */
+
+/*!
+ * \enum FileOp
+ *
+ * \brief File operation reported to a #FileTraceHook
+ */
+
+/*!
+ * \struct FileStats
+ *
+ * \brief Per-File I/O counters
+ *
+ * File::read_at() and File::readv() count as reads and File::write_at() and
+ * File::writev() count as writes. Times are the wall clock time spent in the
+ * corresponding `on_*()` callbacks.
+ *
+ * \sa File::set_stats_enabled()
+ */
+
+/*!
+ * \struct FileOpInfo
+ *
+ * \brief Information about a completed file operation
+ *
+ * \sa FileTraceHook
+ */
+
+/*!
+ * \var FileOpInfo::bytes
+ *
+ * \brief Number of bytes read or written or 0 if not applicable
+ */
+
+/*!
+ * \var FileOpInfo::error
+ *
+ * \brief Error code if the operation failed
+ */
+
+/*!
+ * \typedef FileTraceHook
+ *
+ * \brief Global hook that is invoked after every file operation
+ *
+ * The hook may be called from multiple threads simultaneously if File handles
+ * are used from multiple threads. It must not perform operations on \p file.
+ *
+ * \sa File::set_trace_hook()
+ */
+
 /*!
  * \var File::m_state
  *
@@ -99,7 +194,9 @@ File::~File()
  * file2 = mb::StandardFile("baz.txt", mb::FileOpenMode::ReadOnly);
  * \endcode
  */
-File::File(File &&other) noexcept : m_state(other.m_state)
+File::File(File &&other) noexcept
+    : m_state(other.m_state)
+    , m_stats(std::move(other.m_stats))
 {
     other.m_state = FileState::Moved;
 }
@@ -125,6 +222,7 @@ File & File::operator=(File &&rhs) noexcept
     (void) close();
 
     m_state = rhs.m_state;
+    m_stats = std::move(rhs.m_stats);
     rhs.m_state = FileState::Moved;
 
     return *this;
@@ -221,7 +319,7 @@ oc::result<size_t> File::read(void *buf, size_t size)
 {
     ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
 
-    return on_read(buf, size);
+    return INSTRUMENTED(FileOp::Read, size_t, on_read(buf, size));
 }
 
 /*!
@@ -248,7 +346,7 @@ oc::result<size_t> File::write(const void *buf, size_t size)
 {
     ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
 
-    return on_write(buf, size);
+    return INSTRUMENTED(FileOp::Write, size_t, on_write(buf, size));
 }
 
 /*!
@@ -264,7 +362,7 @@ oc::result<uint64_t> File::seek(int64_t offset, int whence)
 {
     ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
 
-    return on_seek(offset, whence);
+    return INSTRUMENTED(FileOp::Seek, uint64_t, on_seek(offset, whence));
 }
 
 /*!
@@ -283,7 +381,141 @@ oc::result<void> File::truncate(uint64_t size)
 {
     ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
 
-    return on_truncate(size);
+    return INSTRUMENTED(FileOp::Truncate, void, on_truncate(size));
+}
+
+/*!
+ * \brief Read from a File handle at an offset.
+ *
+ * Reads up to \p size bytes starting at \p offset. Unlike File::read(), the
+ * file position is neither used nor changed by this function.
+ *
+ * \note If the File implementation does not natively support positional reads,
+ *       the operation is emulated with seeks and the file position is restored
+ *       afterwards. The emulated operation is not safe to use concurrently with
+ *       other operations on the same handle.
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return Number of bytes read if some were successfully read or EOF is
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::read_at(uint64_t offset, void *buf, size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return INSTRUMENTED(FileOp::ReadAt, size_t, on_read_at(offset, buf, size));
+}
+
+/*!
+ * \brief Write to a File handle at an offset.
+ *
+ * Writes up to \p size bytes starting at \p offset. Unlike File::write(), the
+ * file position is neither used nor changed by this function.
+ *
+ * \note If the File implementation does not natively support positional
+ *       writes, the operation is emulated with seeks and the file position is
+ *       restored afterwards. The emulated operation is not safe to use
+ *       concurrently with other operations on the same handle.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return Number of bytes written if some were successfully written or EOF is
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::write_at(uint64_t offset, const void *buf,
+                                  size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return INSTRUMENTED(FileOp::WriteAt, size_t, on_write_at(offset, buf, size));
+}
+
+/*!
+ * \brief Read from a File handle into multiple buffers.
+ *
+ * Reads from the current file position into the buffers described by \p iov.
+ * Each buffer is filled completely before moving on to the next one. Like
+ * File::read(), fewer bytes than requested may be read.
+ *
+ * \param iov Array of buffer descriptors
+ * \param count Number of elements in \p iov
+ *
+ * \return Total number of bytes read if some were successfully read or EOF is
+ *         reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::readv(const FileIoVec *iov, size_t count)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return INSTRUMENTED(FileOp::Readv, size_t, on_readv(iov, count));
+}
+
+/*!
+ * \brief Write to a File handle from multiple buffers.
+ *
+ * Writes the buffers described by \p iov, in order, to the current file
+ * position. Like File::write(), fewer bytes than requested may be written.
+ *
+ * \param iov Array of buffer descriptors
+ * \param count Number of elements in \p iov
+ *
+ * \return Total number of bytes written if some were successfully written or
+ *         EOF is reached. Otherwise, the error code.
+ */
+oc::result<size_t> File::writev(const FileIoVec *iov, size_t count)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return INSTRUMENTED(FileOp::Writev, size_t, on_writev(iov, count));
+}
+
+/*!
+ * \brief Get the file descriptor backing a File handle.
+ *
+ * If a file descriptor is returned, its file offset is the same as the File
+ * handle's position, and reading or writing the file descriptor directly
+ * advances the File handle's position accordingly. This allows utility
+ * functions, like file_copy(), to use fd-based kernel interfaces. The file
+ * descriptor remains owned by the File handle and must not be closed.
+ *
+ * \return File descriptor if the File handle is backed by one. Otherwise,
+ *         FileError::UnsupportedNativeFd or some other error code.
+ */
+oc::result<int> File::native_fd()
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_native_fd();
+}
+
+/*!
+ * \brief Get direct access to the contents of a File handle.
+ *
+ * If the file contents are resident in memory, this returns a pointer to up to
+ * \p size bytes starting at \p offset without copying them. The view may be
+ * shorter than \p size if the data is not stored contiguously. An empty view
+ * is returned if \p offset is at or beyond EOF. The file position is neither
+ * used nor changed by this function.
+ *
+ * The view remains valid until the File handle is written to, truncated, or
+ * closed.
+ *
+ * \param offset Offset to start the view at
+ * \param size Maximum size of the view
+ *
+ * \return The view if the File handle supports direct access. Otherwise,
+ *         FileError::UnsupportedView or some other error code.
+ */
+oc::result<FileView> File::view_at(uint64_t offset, size_t size)
+{
+    ENSURE_STATE_OR_RETURN_ERROR(FileState::Opened);
+
+    return on_view_at(offset, size);
 }
 
 /*!
@@ -324,6 +556,69 @@ void File::set_fatal()
     }
 }
 
+/*!
+ * \brief Enable or disable I/O counters for this File handle
+ *
+ * When enabled, the number of calls, bytes transferred, and time spent in each
+ * type of operation are recorded and can be queried with stats(). Enabling
+ * stats when they are already enabled does not reset the counters.
+ *
+ * When both the counters and the global trace hook are disabled, the only
+ * overhead is a pointer check per operation.
+ *
+ * \param enabled Whether the counters should be enabled
+ */
+void File::set_stats_enabled(bool enabled)
+{
+    if (!enabled) {
+        m_stats.reset();
+    } else if (!m_stats) {
+        m_stats = std::make_unique<FileStats>();
+    }
+}
+
+/*!
+ * \brief Get I/O counters for this File handle
+ *
+ * \return Pointer to counters if they are enabled. Otherwise, nullptr.
+ */
+const FileStats * File::stats() const
+{
+    return m_stats.get();
+}
+
+/*!
+ * \brief Reset I/O counters for this File handle
+ *
+ * This does nothing if the counters are not enabled.
+ */
+void File::reset_stats()
+{
+    if (m_stats) {
+        *m_stats = {};
+    }
+}
+
+/*!
+ * \brief Set global hook that is invoked after every file operation
+ *
+ * \param hook Function to invoke or nullptr to disable tracing
+ */
+void File::set_trace_hook(FileTraceHook hook)
+{
+    g_trace_hook.store(hook, std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Get global trace hook
+ *
+ * \return Current hook or nullptr if tracing is disabled
+ */
+FileTraceHook File::trace_hook()
+{
+    return g_trace_hook.load(std::memory_order_relaxed);
+}
+
 /*!
  * \brief Get current state of the File handle
  *
@@ -347,6 +642,81 @@ void File::set_state(FileState state)
     m_state = state;
 }
 
+/*! \cond INTERNAL */
+
+template<typename T, typename Fn>
+oc::result<T> File::instrument(FileOp op, Fn &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    oc::result<T> ret = fn();
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start);
+
+    // Only the data transfer operations return a byte count. The result of
+    // seek() is an offset, and uint64_t may be the same type as size_t.
+    uint64_t bytes = 0;
+    if constexpr (std::is_convertible_v<T, uint64_t>) {
+        switch (op) {
+        case FileOp::Read:
+        case FileOp::ReadAt:
+        case FileOp::Readv:
+        case FileOp::Write:
+        case FileOp::WriteAt:
+        case FileOp::Writev:
+            if (ret) {
+                bytes = static_cast<uint64_t>(ret.value());
+            }
+            break;
+        case FileOp::Seek:
+        case FileOp::Truncate:
+            break;
+        }
+    }
+
+    if (m_stats) {
+        switch (op) {
+        case FileOp::Read:
+        case FileOp::ReadAt:
+        case FileOp::Readv:
+            ++m_stats->n_read;
+            m_stats->bytes_read += bytes;
+            m_stats->time_read += duration;
+            break;
+        case FileOp::Write:
+        case FileOp::WriteAt:
+        case FileOp::Writev:
+            ++m_stats->n_write;
+            m_stats->bytes_written += bytes;
+            m_stats->time_write += duration;
+            break;
+        case FileOp::Seek:
+            ++m_stats->n_seek;
+            m_stats->time_seek += duration;
+            break;
+        case FileOp::Truncate:
+            ++m_stats->n_truncate;
+            m_stats->time_truncate += duration;
+            break;
+        }
+
+        if (!ret) {
+            ++m_stats->n_error;
+        }
+    }
+
+    if (auto hook = g_trace_hook.load(std::memory_order_relaxed)) {
+        FileOpInfo info{op, bytes, duration, {}};
+        if (!ret) {
+            info.error = ret.error();
+        }
+        hook(*this, info);
+    }
+
+    return ret;
+}
+
+/*! \endcond */
+
 /*!
  * \brief File open callback
  *
@@ -517,4 +887,191 @@ oc::result<void> File::on_truncate(uint64_t size)
     return FileError::UnsupportedTruncate;
 }
 
+/*!
+ * \brief File positional read callback
+ *
+ * Subclasses should override this method if the file supports reading from an
+ * offset without changing the file position.
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * If this method is not overridden, it will save the file position with
+ * on_seek(), seek to \p offset, call on_read(), and then restore the file
+ * position.
+ *
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return Number of bytes read or the error code. If the file position cannot
+ *         be restored, the error is returned even if the read succeeded.
+ */
+oc::result<size_t> File::on_read_at(uint64_t offset, void *buf, size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, on_seek(0, SEEK_CUR));
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = on_read(buf, size);
+
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    return n;
+}
+
+/*!
+ * \brief File positional write callback
+ *
+ * Subclasses should override this method if the file supports writing to an
+ * offset without changing the file position.
+ *
+ * \note This callback must *not* change the file position.
+ *
+ * If this method is not overridden, it will save the file position with
+ * on_seek(), seek to \p offset, call on_write(), and then restore the file
+ * position.
+ *
+ * \param offset File offset to write to
+ * \param buf Buffer to write from
+ * \param size Buffer size
+ *
+ * \return Number of bytes written or the error code. If the file position
+ *         cannot be restored, the error is returned even if the write
+ *         succeeded.
+ */
+oc::result<size_t> File::on_write_at(uint64_t offset, const void *buf,
+                                     size_t size)
+{
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(orig_pos, on_seek(0, SEEK_CUR));
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(offset), SEEK_SET));
+
+    auto n = on_write(buf, size);
+
+    OUTCOME_TRYV(on_seek(static_cast<int64_t>(orig_pos), SEEK_SET));
+
+    return n;
+}
+
+/*!
+ * \brief File vectored read callback
+ *
+ * Subclasses should override this method if the file supports scatter reads
+ * natively.
+ *
+ * If this method is not overridden, it will call on_read() for each buffer in
+ * order and stop after the first short read. If an error occurs after some
+ * data has already been read, the number of bytes read so far is returned
+ * instead of the error.
+ *
+ * \param iov Array of buffer descriptors
+ * \param count Number of elements in \p iov
+ *
+ * \return Total number of bytes read or the error code
+ */
+oc::result<size_t> File::on_readv(const FileIoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = on_read(iov[i].data, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief File vectored write callback
+ *
+ * Subclasses should override this method if the file supports gather writes
+ * natively.
+ *
+ * If this method is not overridden, it will call on_write() for each buffer in
+ * order and stop after the first short write. If an error occurs after some
+ * data has already been written, the number of bytes written so far is
+ * returned instead of the error.
+ *
+ * \param iov Array of buffer descriptors
+ * \param count Number of elements in \p iov
+ *
+ * \return Total number of bytes written or the error code
+ */
+oc::result<size_t> File::on_writev(const FileIoVec *iov, size_t count)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto n = on_write(iov[i].data, iov[i].size);
+        if (!n) {
+            if (total > 0) {
+                break;
+            }
+            return n.as_failure();
+        }
+
+        total += n.value();
+
+        if (n.value() < iov[i].size) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*!
+ * \brief File native fd callback
+ *
+ * Subclasses should override this method if the file is backed by a file
+ * descriptor whose file offset always matches the File handle's position.
+ *
+ * If this method is not overridden, FileError::UnsupportedNativeFd will be
+ * returned.
+ *
+ * \return File descriptor or the error code
+ */
+oc::result<int> File::on_native_fd()
+{
+    return FileError::UnsupportedNativeFd;
+}
+
+/*!
+ * \brief File view callback
+ *
+ * Subclasses should override this method if the file contents are resident in
+ * memory.
+ *
+ * If this method is not overridden, FileError::UnsupportedView will be
+ * returned.
+ *
+ * \param offset Offset to start the view at
+ * \param size Maximum size of the view
+ *
+ * \return View of the file contents or the error code
+ */
+oc::result<FileView> File::on_view_at(uint64_t offset, size_t size)
+{
+    (void) offset;
+    (void) size;
+    return FileError::UnsupportedView;
+}
+
 }
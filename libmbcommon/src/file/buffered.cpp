@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/buffered.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+/*!
+ * \file mbcommon/file/buffered.h
+ * \brief Buffered wrapper around another File handle
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*!
+ * \class BufferedFile
+ *
+ * \brief Add read-ahead and write-behind buffering to another File handle.
+ *
+ * Small sequential reads are served from a buffer that is refilled with a
+ * single large read of the underlying file. Small writes are coalesced in the
+ * same buffer and written out when the buffer fills, when the file is seeked,
+ * truncated, or read, when flush() is called, or when the file is closed.
+ * Requests that are at least as large as the buffer bypass it entirely.
+ *
+ * Only one of the read-ahead and write-behind buffers is active at any given
+ * time. Switching from reading to writing requires the underlying file to
+ * support seeking so that the unconsumed read-ahead data can be given back.
+ *
+ * \note Errors that occur while writing out buffered data are reported by the
+ *       operation that triggered the write, which may be a later seek, read,
+ *       flush(), or close(). Callers writing data they care about should check
+ *       the result of flush() or close().
+ */
+
+/*!
+ * \var BufferedFile::DEFAULT_BUFFER_SIZE
+ *
+ * \brief Default buffer size
+ *
+ * This is large enough to amortize the per-call overhead of the common
+ * backends (syscalls for FdFile and Win32File, locking for PosixFile) while
+ * staying small enough for memory-constrained environments, such as recovery.
+ */
+
+/*!
+ * \brief Construct unbound BufferedFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+BufferedFile::BufferedFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open buffered file from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t)
+ *
+ * \param file File to wrap
+ * \param buf_size Size of read-ahead/write-behind buffer
+ */
+BufferedFile::BufferedFile(File *file, size_t buf_size)
+    : BufferedFile()
+{
+    (void) open(file, buf_size);
+}
+
+BufferedFile::~BufferedFile()
+{
+    (void) close();
+}
+
+BufferedFile::BufferedFile(BufferedFile &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_buf_size(other.m_buf_size)
+    , m_buf(std::move(other.m_buf))
+    , m_can_seek(other.m_can_seek)
+    , m_pos(other.m_pos)
+    , m_rpos(other.m_rpos)
+    , m_rlen(other.m_rlen)
+    , m_wlen(other.m_wlen)
+{
+    other.clear();
+}
+
+BufferedFile & BufferedFile::operator=(BufferedFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_buf_size = rhs.m_buf_size;
+    m_buf.swap(rhs.m_buf);
+    m_can_seek = rhs.m_can_seek;
+    m_pos = rhs.m_pos;
+    m_rpos = rhs.m_rpos;
+    m_rlen = rhs.m_rlen;
+    m_wlen = rhs.m_wlen;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open buffered file from File handle.
+ *
+ * \note The BufferedFile will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed. \p file must not be accessed directly while the BufferedFile is
+ *       open.
+ *
+ * \param file File to wrap
+ * \param buf_size Size of read-ahead/write-behind buffer. Must be non-zero.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::open(File *file, size_t buf_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_buf_size = buf_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Write out buffered data
+ *
+ * Write any pending write-behind data to the underlying file. This does not
+ * call any sync function on the underlying file.
+ *
+ * \return Nothing if the buffered data is successfully written. Otherwise, the
+ *         error code.
+ */
+oc::result<void> BufferedFile::flush()
+{
+    if (state() != FileState::Opened) {
+        return FileError::InvalidState;
+    }
+
+    return flush_write_buffer();
+}
+
+/*!
+ * \brief Open buffered file
+ *
+ * The underlying file must already be open. If it supports querying the
+ * current position with `seek(0, SEEK_CUR)`, then seeking the BufferedFile
+ * within the read-ahead buffer will not require seeking the underlying file.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> BufferedFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    } else if (m_buf_size == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    auto pos = m_file->seek(0, SEEK_CUR);
+    m_can_seek = !!pos;
+    m_pos = pos ? pos.value() : 0;
+
+    m_buf.resize(m_buf_size);
+
+    return oc::success();
+}
+
+oc::result<void> BufferedFile::on_close()
+{
+    // The underlying file is not owned, so only write out pending data
+    auto ret = flush_write_buffer();
+
+    // Reset to allow opening another file
+    clear();
+
+    return ret;
+}
+
+oc::result<size_t> BufferedFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRYV(flush_write_buffer());
+
+    if (m_rpos == m_rlen) {
+        m_rpos = m_rlen = 0;
+
+        // Large reads go directly to the caller's buffer
+        if (size >= m_buf.size()) {
+            OUTCOME_TRY(n, m_file->read(buf, size));
+            m_pos += n;
+            return n;
+        }
+
+        OUTCOME_TRY(n, m_file->read(m_buf.data(), m_buf.size()));
+        m_pos += n;
+        m_rlen = n;
+    }
+
+    size_t n = std::min(size, m_rlen - m_rpos);
+    memcpy(buf, m_buf.data() + m_rpos, n);
+    m_rpos += n;
+
+    return n;
+}
+
+oc::result<size_t> BufferedFile::on_write(const void *buf, size_t size)
+{
+    OUTCOME_TRYV(discard_read_buffer());
+
+    if (size > m_buf.size() - m_wlen) {
+        OUTCOME_TRYV(flush_write_buffer());
+    }
+
+    // Large writes go directly to the underlying file
+    if (size >= m_buf.size()) {
+        OUTCOME_TRY(n, m_file->write(buf, size));
+        m_pos += n;
+        return n;
+    }
+
+    memcpy(m_buf.data() + m_wlen, buf, size);
+    m_wlen += size;
+
+    return size;
+}
+
+oc::result<uint64_t> BufferedFile::on_seek(int64_t offset, int whence)
+{
+    if (!m_can_seek) {
+        OUTCOME_TRYV(flush_write_buffer());
+        return m_file->seek(offset, whence);
+    }
+
+    uint64_t cur_pos = m_pos - (m_rlen - m_rpos) + m_wlen;
+
+    if (whence == SEEK_CUR && offset == 0) {
+        return cur_pos;
+    }
+
+    OUTCOME_TRYV(flush_write_buffer());
+
+    if (whence == SEEK_SET || whence == SEEK_CUR) {
+        uint64_t target;
+
+        if (whence == SEEK_SET) {
+            if (offset < 0) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = static_cast<uint64_t>(offset);
+        } else if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > cur_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = cur_pos - static_cast<uint64_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > INT64_MAX - cur_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            target = cur_pos + static_cast<uint64_t>(offset);
+        }
+
+        // Seeking within the read-ahead buffer does not need to touch the
+        // underlying file
+        uint64_t buf_begin = m_pos - m_rlen;
+        if (m_rlen > 0 && target >= buf_begin && target <= m_pos) {
+            m_rpos = static_cast<size_t>(target - buf_begin);
+            return target;
+        }
+
+        // Convert to an absolute seek since the underlying file's position
+        // does not match ours if there is read-ahead data
+        offset = static_cast<int64_t>(target);
+        whence = SEEK_SET;
+    }
+
+    OUTCOME_TRY(pos, m_file->seek(offset, whence));
+
+    m_pos = pos;
+    m_rpos = m_rlen = 0;
+
+    return pos;
+}
+
+oc::result<void> BufferedFile::on_truncate(uint64_t size)
+{
+    OUTCOME_TRYV(sync_underlying());
+
+    return m_file->truncate(size);
+}
+
+oc::result<size_t> BufferedFile::on_read_at(uint64_t offset,
+                                            void *buf, size_t size)
+{
+    // Make pending writes visible to the underlying file
+    OUTCOME_TRYV(flush_write_buffer());
+
+    return m_file->read_at(offset, buf, size);
+}
+
+oc::result<size_t> BufferedFile::on_write_at(uint64_t offset,
+                                             const void *buf, size_t size)
+{
+    // The read-ahead data may overlap the written region
+    OUTCOME_TRYV(sync_underlying());
+
+    return m_file->write_at(offset, buf, size);
+}
+
+void BufferedFile::clear()
+{
+    m_file = nullptr;
+    m_buf_size = 0;
+    m_buf.clear();
+    m_buf.shrink_to_fit();
+    m_can_seek = false;
+    m_pos = 0;
+    m_rpos = 0;
+    m_rlen = 0;
+    m_wlen = 0;
+}
+
+/*!
+ * \brief Write out pending write-behind data
+ *
+ * If the write fails, the buffered data is dropped and the file is put in the
+ * fatal state since it is unknown how much of it made it to the underlying
+ * file.
+ */
+oc::result<void> BufferedFile::flush_write_buffer()
+{
+    if (m_wlen == 0) {
+        return oc::success();
+    }
+
+    auto ret = file_write_exact(*m_file, m_buf.data(), m_wlen);
+    if (!ret) {
+        m_wlen = 0;
+        set_fatal();
+        return ret.as_failure();
+    }
+
+    m_pos += m_wlen;
+    m_wlen = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Drop read-ahead data and move the underlying file back to the logical
+ *        position
+ */
+oc::result<void> BufferedFile::discard_read_buffer()
+{
+    size_t unconsumed = m_rlen - m_rpos;
+
+    if (unconsumed > 0) {
+        if (!m_can_seek) {
+            return FileError::UnsupportedSeek;
+        }
+
+        auto ret = m_file->seek(-static_cast<int64_t>(unconsumed), SEEK_CUR);
+        if (!ret) {
+            return ret.as_failure();
+        }
+
+        m_pos = ret.value();
+    }
+
+    m_rpos = m_rlen = 0;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Make the underlying file's contents and position match ours
+ */
+oc::result<void> BufferedFile::sync_underlying()
+{
+    OUTCOME_TRYV(flush_write_buffer());
+    return discard_read_buffer();
+}
+
+}
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/chunked_memory.h"
+
+#include <algorithm>
+#include <new>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/error_code.h"
+
+/*!
+ * \file mbcommon/file/chunked_memory.h
+ * \brief Open growable file backed by fixed-size memory chunks
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*!
+ * \class ChunkedMemoryFile
+ *
+ * \brief Open growable in-memory file that stores data in fixed-size chunks.
+ *
+ * Unlike MemoryFile opened with a dynamically sized buffer, growing the file
+ * only allocates new chunks and never moves existing data. This avoids
+ * repeatedly copying the whole buffer and keeps peak memory usage close to the
+ * size of the data when writing large files, such as boot images, to memory.
+ *
+ * The file owns its data. The data is retained after the file is closed and is
+ * only discarded when the file is opened again or destroyed, so it can be
+ * retrieved with chunks() or flatten() at any point.
+ */
+
+/*!
+ * \brief Construct unbound ChunkedMemoryFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+ChunkedMemoryFile::ChunkedMemoryFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open empty ChunkedMemoryFile.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(size_t)
+ *
+ * \param chunk_size Size of each chunk
+ */
+ChunkedMemoryFile::ChunkedMemoryFile(size_t chunk_size)
+    : ChunkedMemoryFile()
+{
+    (void) open(chunk_size);
+}
+
+ChunkedMemoryFile::~ChunkedMemoryFile()
+{
+    (void) close();
+}
+
+ChunkedMemoryFile::ChunkedMemoryFile(ChunkedMemoryFile &&other) noexcept
+    : File(std::move(other))
+    , m_chunks(std::move(other.m_chunks))
+    , m_chunk_size(other.m_chunk_size)
+    , m_size(other.m_size)
+    , m_pos(other.m_pos)
+{
+    other.clear();
+}
+
+ChunkedMemoryFile &
+ChunkedMemoryFile::operator=(ChunkedMemoryFile &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_chunks.swap(rhs.m_chunks);
+    m_chunk_size = rhs.m_chunk_size;
+    m_size = rhs.m_size;
+    m_pos = rhs.m_pos;
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open empty file.
+ *
+ * Any data from a previously opened file is discarded.
+ *
+ * \param chunk_size Size of each chunk
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> ChunkedMemoryFile::open(size_t chunk_size)
+{
+    if (state() == FileState::New) {
+        clear();
+        m_chunk_size = chunk_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get size of the file
+ *
+ * \return Size of the data
+ */
+size_t ChunkedMemoryFile::size() const
+{
+    return m_size;
+}
+
+/*!
+ * \brief Get the chunks holding the file's data
+ *
+ * The returned buffers are in file order and cover exactly size() bytes. They
+ * remain valid until the file is written to, truncated, reopened, or
+ * destroyed.
+ *
+ * \return List of buffers
+ */
+std::vector<FileIoVec> ChunkedMemoryFile::chunks() const
+{
+    std::vector<FileIoVec> result;
+    result.reserve(m_chunks.size());
+
+    for (size_t offset = 0; offset < m_size; offset += m_chunk_size) {
+        result.push_back({m_chunks[offset / m_chunk_size].get(),
+                          std::min(m_chunk_size, m_size - offset)});
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Copy the file's data into a contiguous buffer
+ *
+ * \return Copy of the data
+ */
+std::vector<unsigned char> ChunkedMemoryFile::flatten() const
+{
+    std::vector<unsigned char> result(m_size);
+
+    copy_out(0, result.data(), m_size);
+
+    return result;
+}
+
+oc::result<void> ChunkedMemoryFile::on_open()
+{
+    if (m_chunk_size == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return oc::success();
+}
+
+oc::result<void> ChunkedMemoryFile::on_close()
+{
+    // The data is kept until the file is reopened
+    m_pos = 0;
+
+    return oc::success();
+}
+
+oc::result<size_t> ChunkedMemoryFile::on_read(void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_read_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> ChunkedMemoryFile::on_write(const void *buf, size_t size)
+{
+    OUTCOME_TRY(n, on_write_at(m_pos, buf, size));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<uint64_t> ChunkedMemoryFile::on_seek(int64_t offset, int whence)
+{
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0 || static_cast<uint64_t>(offset) > SIZE_MAX) {
+            return FileError::ArgumentOutOfRange;
+        }
+        return m_pos = static_cast<size_t>(offset);
+    case SEEK_CUR:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos -= static_cast<size_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > SIZE_MAX - m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos += static_cast<size_t>(offset);
+        }
+    case SEEK_END:
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size - static_cast<size_t>(-offset);
+        } else {
+            if (static_cast<uint64_t>(offset) > SIZE_MAX - m_size) {
+                return FileError::ArgumentOutOfRange;
+            }
+            return m_pos = m_size + static_cast<size_t>(offset);
+        }
+    default:
+        MB_UNREACHABLE("Invalid whence argument: %d", whence);
+    }
+}
+
+oc::result<void> ChunkedMemoryFile::on_truncate(uint64_t size)
+{
+    if (size > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return resize(static_cast<size_t>(size));
+}
+
+oc::result<size_t> ChunkedMemoryFile::on_read_at(uint64_t offset, void *buf,
+                                                 size_t size)
+{
+    if (offset > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    size_t pos = static_cast<size_t>(offset);
+    size_t to_read = 0;
+    if (pos < m_size) {
+        to_read = std::min(m_size - pos, size);
+    }
+
+    copy_out(pos, buf, to_read);
+
+    return to_read;
+}
+
+oc::result<FileView> ChunkedMemoryFile::on_view_at(uint64_t offset,
+                                                  size_t size)
+{
+    if (offset >= m_size) {
+        return FileView{nullptr, 0};
+    }
+
+    // Views cannot span chunks
+    size_t pos = static_cast<size_t>(offset);
+    size_t chunk_offset = pos % m_chunk_size;
+
+    return FileView{m_chunks[pos / m_chunk_size].get() + chunk_offset,
+                    std::min({size, m_size - pos,
+                              m_chunk_size - chunk_offset})};
+}
+
+oc::result<size_t> ChunkedMemoryFile::on_write_at(uint64_t offset,
+                                                  const void *buf, size_t size)
+{
+    if (offset > SIZE_MAX || static_cast<size_t>(offset) > SIZE_MAX - size) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    size_t pos = static_cast<size_t>(offset);
+
+    if (pos + size > m_size) {
+        OUTCOME_TRYV(resize(pos + size));
+    }
+
+    copy_in(pos, buf, size);
+
+    return size;
+}
+
+/*! \cond INTERNAL */
+
+void ChunkedMemoryFile::clear()
+{
+    m_chunks.clear();
+    m_chunk_size = 0;
+    m_size = 0;
+    m_pos = 0;
+}
+
+/*!
+ * \brief Grow or shrink the file
+ *
+ * New space is zero-initialized. Bytes past the end of the file in the last
+ * chunk are always kept zeroed so that growing the file does not expose stale
+ * data.
+ */
+oc::result<void> ChunkedMemoryFile::resize(size_t size)
+{
+    size_t n_chunks = size / m_chunk_size + (size % m_chunk_size != 0);
+
+    if (size < m_size) {
+        m_chunks.resize(n_chunks);
+
+        size_t tail = size % m_chunk_size;
+        if (tail != 0) {
+            memset(m_chunks.back().get() + tail, 0, m_chunk_size - tail);
+        }
+    } else {
+        m_chunks.reserve(n_chunks);
+
+        while (m_chunks.size() < n_chunks) {
+            std::unique_ptr<unsigned char[]> chunk(
+                    new (std::nothrow) unsigned char[m_chunk_size]());
+            if (!chunk) {
+                return std::make_error_code(std::errc::not_enough_memory);
+            }
+
+            m_chunks.push_back(std::move(chunk));
+        }
+    }
+
+    m_size = size;
+
+    return oc::success();
+}
+
+void ChunkedMemoryFile::copy_out(size_t offset, void *buf, size_t size) const
+{
+    auto out = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        size_t index = offset / m_chunk_size;
+        size_t chunk_offset = offset % m_chunk_size;
+        size_t n = std::min(size, m_chunk_size - chunk_offset);
+
+        memcpy(out, m_chunks[index].get() + chunk_offset, n);
+
+        out += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+void ChunkedMemoryFile::copy_in(size_t offset, const void *buf, size_t size)
+{
+    auto in = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        size_t index = offset / m_chunk_size;
+        size_t chunk_offset = offset % m_chunk_size;
+        size_t n = std::min(size, m_chunk_size - chunk_offset);
+
+        memcpy(m_chunks[index].get() + chunk_offset, in, n);
+
+        in += n;
+        offset += n;
+        size -= n;
+    }
+}
+
+/*! \endcond */
+
+}
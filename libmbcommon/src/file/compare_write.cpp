@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/compare_write.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/compare_write.h
+ * \brief Write-only wrapper that skips writing unchanged blocks
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*!
+ * \class CompareWriteFile
+ *
+ * \brief Only write the blocks of another File handle that actually change.
+ *
+ * Writes are collected into blocks that are aligned to the block size in the
+ * underlying file. Before a block is written, the existing data at that
+ * location is read back and compared. The block is only written if it differs
+ * or if it could not be read (eg. because it is past the end of the file).
+ * Rewriting a block device with data it already contains therefore only costs
+ * reads, which is cheaper and avoids wearing out flash storage.
+ *
+ * The underlying file is accessed with positional reads and writes, so it
+ * must have been opened for both reading and writing and must *not* have been
+ * truncated when opened. The file is never shrunk when closed. If the
+ * underlying file supports native file descriptors, it is synced to disk when
+ * the CompareWriteFile is closed.
+ *
+ * \note Like BufferedFile, errors that occur while writing out a partially
+ *       filled block are reported by the seek, truncate, or close that
+ *       triggered the write.
+ */
+
+/*!
+ * \brief Construct unbound CompareWriteFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+CompareWriteFile::CompareWriteFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open compare-write file from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t)
+ *
+ * \param file File to wrap
+ * \param block_size Size of the blocks that are compared
+ */
+CompareWriteFile::CompareWriteFile(File *file, size_t block_size)
+    : CompareWriteFile()
+{
+    (void) open(file, block_size);
+}
+
+CompareWriteFile::~CompareWriteFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open compare-write file from File handle.
+ *
+ * \note The CompareWriteFile will *not* take ownership of \p file. The caller
+ *       must ensure that it is properly closed and destroyed when it is no
+ *       longer needed.
+ *
+ * \param file File to wrap
+ * \param block_size Size of the blocks that are compared. Must be non-zero.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> CompareWriteFile::open(File *file, size_t block_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_block_size = block_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get the number of blocks that were compared
+ */
+uint64_t CompareWriteFile::blocks_compared() const
+{
+    return m_blocks_compared;
+}
+
+/*!
+ * \brief Get the number of blocks that differed and were written
+ */
+uint64_t CompareWriteFile::blocks_written() const
+{
+    return m_blocks_written;
+}
+
+oc::result<void> CompareWriteFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    } else if (m_block_size == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Writing starts at the underlying file's position
+    auto pos = m_file->seek(0, SEEK_CUR);
+    m_pos = pos ? pos.value() : 0;
+
+    m_buf.resize(m_block_size);
+    m_existing.resize(m_block_size);
+    m_buf_used = 0;
+    m_blocks_compared = 0;
+    m_blocks_written = 0;
+
+    return oc::success();
+}
+
+oc::result<void> CompareWriteFile::on_close()
+{
+    // Keep the file usable for the statistics, but allow opening another file
+    auto reset = finally([&] {
+        m_file = nullptr;
+        m_buf.clear();
+        m_existing.clear();
+    });
+
+    OUTCOME_TRYV(flush_block());
+
+#ifndef _WIN32
+    if (auto fd = m_file->native_fd(); fd && fsync(fd.value()) < 0) {
+        return ec_from_errno();
+    }
+#endif
+
+    return oc::success();
+}
+
+oc::result<size_t> CompareWriteFile::on_write(const void *buf, size_t size)
+{
+    if (m_buf_used == 0) {
+        m_block_start = m_pos;
+    }
+
+    // The first block may be partial if writing did not start at an aligned
+    // offset
+    uint64_t block_end = (m_block_start / m_block_size + 1) * m_block_size;
+    auto capacity = static_cast<size_t>(block_end - m_block_start);
+    size_t n = std::min(size, capacity - m_buf_used);
+
+    memcpy(m_buf.data() + m_buf_used, buf, n);
+    m_buf_used += n;
+    m_pos += n;
+
+    if (m_buf_used == capacity) {
+        OUTCOME_TRYV(flush_block());
+    }
+
+    return n;
+}
+
+oc::result<uint64_t> CompareWriteFile::on_seek(int64_t offset, int whence)
+{
+    if (whence == SEEK_CUR && offset == 0) {
+        return m_pos;
+    }
+
+    OUTCOME_TRYV(flush_block());
+
+    switch (whence) {
+    case SEEK_SET:
+        if (offset < 0) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos = static_cast<uint64_t>(offset);
+        break;
+
+    case SEEK_CUR:
+        if (offset < 0 && static_cast<uint64_t>(-offset) > m_pos) {
+            return FileError::ArgumentOutOfRange;
+        } else if (offset > 0
+                && static_cast<uint64_t>(offset) > UINT64_MAX - m_pos) {
+            return FileError::ArgumentOutOfRange;
+        }
+        m_pos += static_cast<uint64_t>(offset);
+        break;
+
+    case SEEK_END: {
+        OUTCOME_TRY(pos, m_file->seek(offset, SEEK_END));
+        m_pos = pos;
+        break;
+    }
+
+    default:
+        return FileError::ArgumentOutOfRange;
+    }
+
+    return m_pos;
+}
+
+oc::result<void> CompareWriteFile::on_truncate(uint64_t size)
+{
+    OUTCOME_TRYV(flush_block());
+
+    return m_file->truncate(size);
+}
+
+/*! \cond INTERNAL */
+
+void CompareWriteFile::clear()
+{
+    m_file = nullptr;
+    m_block_size = 0;
+    m_buf.clear();
+    m_buf_used = 0;
+    m_block_start = 0;
+    m_existing.clear();
+    m_pos = 0;
+    m_blocks_compared = 0;
+    m_blocks_written = 0;
+}
+
+/*!
+ * \brief Compare the pending block with the file and write it if it differs
+ */
+oc::result<void> CompareWriteFile::flush_block()
+{
+    if (m_buf_used == 0) {
+        return oc::success();
+    }
+
+    size_t size = m_buf_used;
+    m_buf_used = 0;
+
+    ++m_blocks_compared;
+
+    // A block that can't be read (eg. past EOF) is simply written
+    if (file_read_exact_at(*m_file, m_block_start, m_existing.data(), size)
+            && memcmp(m_existing.data(), m_buf.data(), size) == 0) {
+        return oc::success();
+    }
+
+    for (size_t n = 0; n < size;) {
+        OUTCOME_TRY(written, m_file->write_at(m_block_start + n,
+                                              m_buf.data() + n, size - n));
+        if (written == 0) {
+            return FileError::UnexpectedEof;
+        }
+        n += written;
+    }
+
+    ++m_blocks_written;
+
+    return oc::success();
+}
+
+/*! \endcond */
+
+}
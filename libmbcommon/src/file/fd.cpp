@@ -26,6 +26,9 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#ifndef _WIN32
+#  include <sys/uio.h>
+#endif
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
@@ -45,6 +48,11 @@ using namespace detail;
 static constexpr mode_t DEFAULT_MODE =
         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
 
+#ifndef _WIN32
+//! Maximum number of buffers passed to a single readv()/writev() call
+static constexpr size_t MAX_IOVECS = 64;
+#endif
+
 /*! \cond INTERNAL */
 struct RealFdFileFuncs : public FdFileFuncs
 {
@@ -89,6 +97,30 @@ struct RealFdFileFuncs : public FdFileFuncs
     {
         return write(fd, buf, count);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_readv(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return ::readv(fd, iov, iovcnt);
+    }
+
+    ssize_t fn_writev(int fd, const struct iovec *iov, int iovcnt) override
+    {
+        return ::writev(fd, iov, iovcnt);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -135,6 +167,41 @@ static int convert_mode(FileOpenMode mode)
     return ret;
 }
 
+#ifndef _WIN32
+/*!
+ * \brief Convert FileIoVec array to iovec array
+ *
+ * At most \p out_count buffers are converted and the total size is capped at
+ * `SSIZE_MAX` so that the result can be passed to `readv()` or `writev()`.
+ *
+ * \return Number of iovec elements populated
+ */
+static int to_iovecs(const FileIoVec *iov, size_t count,
+                     struct iovec *out, size_t out_count)
+{
+    size_t total = 0;
+    size_t i = 0;
+
+    for (; i < count && i < out_count; ++i) {
+        size_t size = iov[i].size;
+        if (size > SSIZE_MAX - total) {
+            size = SSIZE_MAX - total;
+        }
+
+        out[i].iov_base = iov[i].data;
+        out[i].iov_len = size;
+        total += size;
+
+        if (total == SSIZE_MAX) {
+            ++i;
+            break;
+        }
+    }
+
+    return static_cast<int>(i);
+}
+#endif
+
 /*! \endcond */
 
 /*!
@@ -462,6 +529,92 @@ oc::result<void> FdFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+oc::result<size_t> FdFile::on_read_at(uint64_t offset, void *buf, size_t size)
+{
+#ifdef _WIN32
+    return File::on_read_at(offset, buf, size);
+#else
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pread64(m_fd, buf, size,
+                                    static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+oc::result<size_t> FdFile::on_write_at(uint64_t offset, const void *buf,
+                                       size_t size)
+{
+#ifdef _WIN32
+    return File::on_write_at(offset, buf, size);
+#else
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    if (size > SSIZE_MAX) {
+        size = SSIZE_MAX;
+    }
+
+    ssize_t n = m_funcs->fn_pwrite64(m_fd, buf, size,
+                                     static_cast<off64_t>(offset));
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+oc::result<size_t> FdFile::on_readv(const FileIoVec *iov, size_t count)
+{
+#ifdef _WIN32
+    return File::on_readv(iov, count);
+#else
+    struct iovec vecs[MAX_IOVECS];
+    int n_vecs = to_iovecs(iov, count, vecs, MAX_IOVECS);
+
+    ssize_t n = m_funcs->fn_readv(m_fd, vecs, n_vecs);
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+oc::result<size_t> FdFile::on_writev(const FileIoVec *iov, size_t count)
+{
+#ifdef _WIN32
+    return File::on_writev(iov, count);
+#else
+    struct iovec vecs[MAX_IOVECS];
+    int n_vecs = to_iovecs(iov, count, vecs, MAX_IOVECS);
+
+    ssize_t n = m_funcs->fn_writev(m_fd, vecs, n_vecs);
+    if (n < 0) {
+        return ec_from_errno();
+    }
+
+    return static_cast<size_t>(n);
+#endif
+}
+
+oc::result<int> FdFile::on_native_fd()
+{
+    return m_fd;
+}
+
 void FdFile::clear()
 {
     m_fd = -1;
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/hashing.h"
+
+#include <cstdio>
+
+#include <openssl/evp.h>
+
+#include "mbcommon/file_error.h"
+
+/*!
+ * \file mbcommon/file/hashing.h
+ * \brief Compute digests of data passing through a File handle
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*! \cond INTERNAL */
+
+struct HashingFile::Context
+{
+    EVP_MD_CTX *ctx;
+
+    Context() : ctx(EVP_MD_CTX_new())
+    {
+    }
+
+    ~Context()
+    {
+        EVP_MD_CTX_free(ctx);
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(Context)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(Context)
+};
+
+static constexpr HashAlgorithm ALGORITHMS[] = {
+    HashAlgorithm::Sha1,
+    HashAlgorithm::Sha256,
+    HashAlgorithm::Sha512,
+};
+
+static const EVP_MD * evp_md(HashAlgorithm algorithm)
+{
+    switch (algorithm) {
+    case HashAlgorithm::Sha1:
+        return EVP_sha1();
+    case HashAlgorithm::Sha256:
+        return EVP_sha256();
+    case HashAlgorithm::Sha512:
+        return EVP_sha512();
+    default:
+        MB_UNREACHABLE("Invalid algorithm: %d", static_cast<int>(algorithm));
+    }
+}
+
+/*! \endcond */
+
+/*!
+ * \class HashingFile
+ *
+ * \brief Compute digests of the data read from or written to another File.
+ *
+ * HashingFile passes all operations through to the underlying File handle and
+ * updates the selected digests with every byte that is sequentially read or
+ * written. This allows a single pass over the data to both copy it and compute
+ * its checksums.
+ *
+ * Seeking is allowed, but data is only hashed when it continues the stream
+ * from where the last hashed byte ended. If a read or write happens anywhere
+ * else, or if the file is truncated before that point or modified with
+ * write_at(), the digests no longer describe the data and digest() will fail.
+ * read_at() does not affect the digests.
+ *
+ * The underlying File handle is not owned and must outlive this object.
+ */
+
+/*!
+ * \brief Construct unbound HashingFile.
+ *
+ * The File handle will not be bound to any file. open() will need to be called
+ * to open a file.
+ */
+HashingFile::HashingFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle that hashes data passing through another file.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, HashAlgorithms)
+ *
+ * \param file Underlying file
+ * \param algorithms Digests to compute
+ */
+HashingFile::HashingFile(File *file, HashAlgorithms algorithms)
+    : HashingFile()
+{
+    (void) open(file, algorithms);
+}
+
+HashingFile::~HashingFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open File handle that hashes data passing through another file.
+ *
+ * \param file Underlying file. It must already be opened. The hashed stream
+ *             starts at the file's current position.
+ * \param algorithms Digests to compute
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> HashingFile::open(File *file, HashAlgorithms algorithms)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_algorithms = algorithms;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get digest of the data hashed so far.
+ *
+ * This can be called at any time. Hashing continues with subsequent reads and
+ * writes.
+ *
+ * \param algorithm Digest to get. It must have been selected when the file was
+ *                  opened.
+ *
+ * \return The digest if it is available. Otherwise, the error code.
+ *         \ref FileError::ArgumentOutOfRange if \p algorithm was not selected.
+ *         \ref FileError::InvalidState if the file is not open or if data was
+ *         read or written non-sequentially.
+ */
+oc::result<std::vector<unsigned char>>
+HashingFile::digest(HashAlgorithm algorithm)
+{
+    if (!is_open() || !m_sequential) {
+        return FileError::InvalidState;
+    } else if (!(m_algorithms & algorithm)) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    for (size_t i = 0; i < MAX_ALGORITHMS; ++i) {
+        if (ALGORITHMS[i] != algorithm) {
+            continue;
+        }
+
+        // Finalize a copy so that hashing can continue
+        Context copy;
+        std::vector<unsigned char> result(EVP_MAX_MD_SIZE);
+        unsigned int size;
+
+        if (!copy.ctx || !EVP_MD_CTX_copy_ex(copy.ctx, m_ctxs[i]->ctx)
+                || !EVP_DigestFinal_ex(copy.ctx, result.data(), &size)) {
+            return std::make_error_code(std::errc::io_error);
+        }
+
+        result.resize(size);
+
+        return std::move(result);
+    }
+
+    MB_UNREACHABLE("Invalid algorithm: %d", static_cast<int>(algorithm));
+}
+
+oc::result<void> HashingFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    }
+
+    for (size_t i = 0; i < MAX_ALGORITHMS; ++i) {
+        if (!(m_algorithms & ALGORITHMS[i])) {
+            continue;
+        }
+
+        m_ctxs[i] = std::make_unique<Context>();
+
+        if (!m_ctxs[i]->ctx || !EVP_DigestInit_ex(
+                m_ctxs[i]->ctx, evp_md(ALGORITHMS[i]), nullptr)) {
+            return std::make_error_code(std::errc::io_error);
+        }
+    }
+
+    // Unseekable files start at offset 0
+    auto pos = m_file->seek(0, SEEK_CUR);
+    m_pos = pos ? pos.value() : 0;
+    m_hashed_end = m_pos;
+    m_sequential = true;
+
+    return oc::success();
+}
+
+oc::result<void> HashingFile::on_close()
+{
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> HashingFile::on_read(void *buf, size_t size)
+{
+    auto n = m_file->read(buf, size);
+    if (!n) {
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+        return n.as_failure();
+    }
+
+    OUTCOME_TRYV(update(buf, n.value()));
+
+    return n;
+}
+
+oc::result<size_t> HashingFile::on_write(const void *buf, size_t size)
+{
+    auto n = m_file->write(buf, size);
+    if (!n) {
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+        return n.as_failure();
+    }
+
+    OUTCOME_TRYV(update(buf, n.value()));
+
+    return n;
+}
+
+oc::result<uint64_t> HashingFile::on_seek(int64_t offset, int whence)
+{
+    auto pos = m_file->seek(offset, whence);
+    if (!pos) {
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+        return pos.as_failure();
+    }
+
+    m_pos = pos.value();
+
+    return pos;
+}
+
+oc::result<void> HashingFile::on_truncate(uint64_t size)
+{
+    auto ret = m_file->truncate(size);
+    if (!ret) {
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+        return ret.as_failure();
+    }
+
+    if (size < m_hashed_end) {
+        m_sequential = false;
+    }
+
+    return oc::success();
+}
+
+oc::result<size_t> HashingFile::on_read_at(uint64_t offset, void *buf,
+                                           size_t size)
+{
+    auto n = m_file->read_at(offset, buf, size);
+    if (!n && m_file->is_fatal()) {
+        set_fatal();
+    }
+
+    return n;
+}
+
+oc::result<size_t> HashingFile::on_write_at(uint64_t offset, const void *buf,
+                                            size_t size)
+{
+    auto n = m_file->write_at(offset, buf, size);
+    if (!n) {
+        if (m_file->is_fatal()) {
+            set_fatal();
+        }
+        return n.as_failure();
+    }
+
+    if (n.value() > 0) {
+        m_sequential = false;
+    }
+
+    return n;
+}
+
+/*! \cond INTERNAL */
+
+void HashingFile::clear()
+{
+    m_file = nullptr;
+    m_algorithms = {};
+    for (auto &ctx : m_ctxs) {
+        ctx.reset();
+    }
+    m_pos = 0;
+    m_hashed_end = 0;
+    m_sequential = false;
+}
+
+/*!
+ * \brief Update digests with data at the current position
+ */
+oc::result<void> HashingFile::update(const void *buf, size_t size)
+{
+    if (m_pos != m_hashed_end) {
+        m_sequential = false;
+    }
+
+    m_pos += size;
+
+    if (!m_sequential) {
+        return oc::success();
+    }
+
+    for (auto &ctx : m_ctxs) {
+        if (ctx && !EVP_DigestUpdate(ctx->ctx, buf, size)) {
+            set_fatal();
+            return std::make_error_code(std::errc::io_error);
+        }
+    }
+
+    m_hashed_end = m_pos;
+
+    return oc::success();
+}
+
+/*! \endcond */
+
+}
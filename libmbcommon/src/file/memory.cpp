@@ -299,6 +299,59 @@ oc::result<void> MemoryFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+oc::result<size_t> MemoryFile::on_read_at(uint64_t offset, void *buf,
+                                          size_t size)
+{
+    if (offset > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    size_t pos = static_cast<size_t>(offset);
+    size_t to_read = 0;
+    if (pos < m_size) {
+        to_read = std::min(m_size - pos, size);
+    }
+
+    // m_data may be null for an empty file
+    if (to_read == 0) {
+        return 0;
+    }
+
+    memcpy(buf, static_cast<char *>(m_data) + pos, to_read);
+
+    return to_read;
+}
+
+oc::result<FileView> MemoryFile::on_view_at(uint64_t offset, size_t size)
+{
+    if (offset >= m_size) {
+        return FileView{nullptr, 0};
+    }
+
+    size_t pos = static_cast<size_t>(offset);
+
+    return FileView{static_cast<char *>(m_data) + pos,
+                    std::min(m_size - pos, size)};
+}
+
+oc::result<size_t> MemoryFile::on_write_at(uint64_t offset, const void *buf,
+                                           size_t size)
+{
+    if (offset > SIZE_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Reuse the buffer resizing logic in on_write()
+    size_t orig_pos = m_pos;
+    m_pos = static_cast<size_t>(offset);
+
+    auto n = on_write(buf, size);
+
+    m_pos = orig_pos;
+
+    return n;
+}
+
 void MemoryFile::clear()
 {
     m_data = nullptr;
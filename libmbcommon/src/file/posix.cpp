@@ -20,6 +20,7 @@
 #include "mbcommon/file/posix.h"
 
 #include <cerrno>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -63,6 +64,11 @@ struct RealPosixFileFuncs : public PosixFileFuncs
         return ferror(stream);
     }
 
+    int fn_fflush(FILE *stream) override
+    {
+        return fflush(stream);
+    }
+
     int fn_fileno(FILE *stream) override
     {
         return fileno(stream);
@@ -105,6 +111,20 @@ struct RealPosixFileFuncs : public PosixFileFuncs
     {
         return ftruncate64(fd, length);
     }
+
+#ifndef _WIN32
+    ssize_t fn_pread64(int fd, void *buf, size_t count,
+                       off64_t offset) override
+    {
+        return pread64(fd, buf, count, offset);
+    }
+
+    ssize_t fn_pwrite64(int fd, const void *buf, size_t count,
+                        off64_t offset) override
+    {
+        return pwrite64(fd, buf, count, offset);
+    }
+#endif
 };
 /*! \endcond */
 
@@ -525,6 +545,71 @@ oc::result<void> PosixFile::on_truncate(uint64_t size)
     return oc::success();
 }
 
+oc::result<size_t> PosixFile::on_read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+#ifndef _WIN32
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (m_can_seek && fd >= 0) {
+        // Make sure buffered writes are visible to the file descriptor
+        if (m_funcs->fn_fflush(m_fp) != 0) {
+            return ec_from_errno();
+        }
+
+        if (size > SSIZE_MAX) {
+            size = SSIZE_MAX;
+        }
+
+        ssize_t n = m_funcs->fn_pread64(fd, buf, size,
+                                        static_cast<off64_t>(offset));
+        if (n < 0) {
+            return ec_from_errno();
+        }
+
+        return static_cast<size_t>(n);
+    }
+#endif
+
+    return File::on_read_at(offset, buf, size);
+}
+
+oc::result<size_t> PosixFile::on_write_at(uint64_t offset, const void *buf,
+                                          size_t size)
+{
+#ifndef _WIN32
+    if (offset > INT64_MAX) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    int fd = m_funcs->fn_fileno(m_fp);
+    if (m_can_seek && fd >= 0) {
+        // Write out pending data and discard the read buffer so that the
+        // stream does not return stale data afterwards
+        if (m_funcs->fn_fflush(m_fp) != 0) {
+            return ec_from_errno();
+        }
+
+        if (size > SSIZE_MAX) {
+            size = SSIZE_MAX;
+        }
+
+        ssize_t n = m_funcs->fn_pwrite64(fd, buf, size,
+                                         static_cast<off64_t>(offset));
+        if (n < 0) {
+            return ec_from_errno();
+        }
+
+        return static_cast<size_t>(n);
+    }
+#endif
+
+    return File::on_write_at(offset, buf, size);
+}
+
 void PosixFile::clear()
 {
     m_fp = nullptr;
@@ -0,0 +1,327 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/prefetch.h"
+
+#include <algorithm>
+
+#include <cstdio>
+#include <cstring>
+
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/resource_budget.h"
+
+/*!
+ * \file mbcommon/file/prefetch.h
+ * \brief Read-only wrapper that reads ahead on a background thread
+ */
+
+namespace mb
+{
+
+using namespace detail;
+
+/*!
+ * \class PrefetchFile
+ *
+ * \brief Read another File handle ahead of the consumer on a worker thread.
+ *
+ * The worker thread sequentially fills a ring of fixed-size buffers from the
+ * underlying file. on_read() hands out data from the filled buffers and
+ * returns them to the worker once they are fully consumed. If all buffers are
+ * full, the worker waits for the consumer (backpressure). If all buffers are
+ * empty, the consumer waits for the worker. This allows slow consumers, like
+ * decompression or hashing, to overlap with disk reads.
+ *
+ * Seeking stops the worker, discards all prefetched data, and seeks the
+ * underlying file. The worker is restarted on the next read. Since a read in
+ * progress cannot be interrupted, seeking and closing wait for the worker's
+ * current read to complete.
+ *
+ * PrefetchFile is read-only. If a read from the underlying file fails, the
+ * error is returned when the consumer reaches that point in the stream and
+ * the PrefetchFile is put in the fatal state.
+ *
+ * \note The underlying file is accessed from the worker thread. It must not be
+ *       used directly by anything else while the PrefetchFile is open.
+ */
+
+/*!
+ * \brief Construct unbound PrefetchFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+PrefetchFile::PrefetchFile()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open prefetching file from File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, size_t, size_t)
+ *
+ * \param file File to wrap
+ * \param buf_count Number of buffers in the read-ahead ring
+ * \param buf_size Size of each buffer
+ */
+PrefetchFile::PrefetchFile(File *file, size_t buf_count, size_t buf_size)
+    : PrefetchFile()
+{
+    (void) open(file, buf_count, buf_size);
+}
+
+PrefetchFile::~PrefetchFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Open prefetching file from File handle.
+ *
+ * \note The PrefetchFile will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * \param file File to wrap
+ * \param buf_count Number of buffers in the read-ahead ring. Must be non-zero.
+ *                  Fewer buffers are used if they do not fit in the
+ *                  ResourceBudget.
+ * \param buf_size Size of each buffer. Must be non-zero.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> PrefetchFile::open(File *file, size_t buf_count,
+                                    size_t buf_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_buf_count = buf_count;
+        m_buf_size = buf_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Open prefetching file
+ *
+ * The underlying file must already be open. The worker thread is not started
+ * until the first read.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> PrefetchFile::on_open()
+{
+    if (!m_file || !m_file->is_open()) {
+        return FileError::InvalidState;
+    } else if (m_buf_count == 0 || m_buf_size == 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    auto pos = m_file->seek(0, SEEK_CUR);
+    m_can_seek = !!pos;
+    m_pos = pos ? pos.value() : 0;
+
+    m_buf_count = ResourceBudget::global().buffer_count(m_buf_size, m_buf_count);
+
+    m_slots.resize(m_buf_count);
+    for (auto &slot : m_slots) {
+        slot.data.resize(m_buf_size);
+    }
+
+    return oc::success();
+}
+
+oc::result<void> PrefetchFile::on_close()
+{
+    stop_worker();
+
+    // Reset to allow opening another file
+    clear();
+
+    return oc::success();
+}
+
+oc::result<size_t> PrefetchFile::on_read(void *buf, size_t size)
+{
+    start_worker();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_cond.wait(lock, [&] { return m_filled > 0 || m_done; });
+    if (m_filled == 0) {
+        return 0;
+    }
+
+    // The worker never touches filled slots, so the data can be copied
+    // without holding the lock
+    Slot &slot = m_slots[m_head];
+    lock.unlock();
+
+    if (slot.error) {
+        set_fatal();
+        return slot.error;
+    }
+
+    size_t n = std::min(size, slot.size - slot.pos);
+    memcpy(buf, slot.data.data() + slot.pos, n);
+    slot.pos += n;
+    m_pos += n;
+
+    if (slot.pos == slot.size) {
+        lock.lock();
+        m_head = (m_head + 1) % m_slots.size();
+        --m_filled;
+        lock.unlock();
+
+        m_cond.notify_all();
+    }
+
+    return n;
+}
+
+oc::result<uint64_t> PrefetchFile::on_seek(int64_t offset, int whence)
+{
+    if (whence == SEEK_CUR && offset == 0 && m_can_seek) {
+        return m_pos;
+    }
+
+    stop_worker();
+
+    if (!m_can_seek) {
+        return m_file->seek(offset, whence);
+    }
+
+    // The underlying file's position is ahead of ours by the amount of
+    // prefetched data, so relative seeks must be made absolute
+    if (whence == SEEK_CUR) {
+        if (offset < 0) {
+            if (static_cast<uint64_t>(-offset) > m_pos) {
+                return FileError::ArgumentOutOfRange;
+            }
+        } else if (static_cast<uint64_t>(offset) > INT64_MAX - m_pos) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        offset = static_cast<int64_t>(m_pos) + offset;
+        whence = SEEK_SET;
+    }
+
+    OUTCOME_TRY(pos, m_file->seek(offset, whence));
+
+    // Discard prefetched data
+    m_head = m_tail = m_filled = 0;
+    m_done = false;
+    m_pos = pos;
+
+    return pos;
+}
+
+void PrefetchFile::clear()
+{
+    m_file = nullptr;
+    m_buf_count = 0;
+    m_buf_size = 0;
+    m_can_seek = false;
+    m_pos = 0;
+    m_running = false;
+    m_slots.clear();
+    m_head = 0;
+    m_tail = 0;
+    m_filled = 0;
+    m_done = false;
+    m_stop = false;
+}
+
+void PrefetchFile::start_worker()
+{
+    if (!m_running && !m_done) {
+        m_stop = false;
+        m_thread = std::thread(&PrefetchFile::worker_func, this);
+        m_running = true;
+    }
+}
+
+void PrefetchFile::stop_worker()
+{
+    if (m_running) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+
+        m_thread.join();
+        m_running = false;
+    }
+}
+
+void PrefetchFile::worker_func()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        m_cond.wait(lock, [&] { return m_stop || m_filled < m_slots.size(); });
+        if (m_stop) {
+            break;
+        }
+
+        Slot &slot = m_slots[m_tail];
+        lock.unlock();
+
+        auto n = file_read_retry(*m_file, slot.data.data(), slot.data.size());
+
+        lock.lock();
+
+        if (n) {
+            slot.size = n.value();
+            slot.error = {};
+        } else {
+            slot.size = 0;
+            slot.error = n.error();
+        }
+        slot.pos = 0;
+
+        m_tail = (m_tail + 1) % m_slots.size();
+        ++m_filled;
+
+        // file_read_retry() only returns a short read at EOF
+        bool done = !n || n.value() < slot.data.size();
+        if (done) {
+            m_done = true;
+        }
+
+        m_cond.notify_all();
+
+        if (done) {
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,1039 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/file/uring.h"
+
+#include <algorithm>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/finally.h"
+
+/*!
+ * \file mbcommon/file/uring.h
+ * \brief Open file with the Linux io_uring API
+ */
+
+// The syscall numbers are shared by all architectures
+#ifndef __NR_io_uring_setup
+#  define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#  define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#  define __NR_io_uring_register 427
+#endif
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+
+// Subset of <linux/io_uring.h>. The NDK headers predate io_uring, so the
+// structures are declared here instead.
+namespace
+{
+
+struct IoUringSqe
+{
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off;
+    uint64_t addr;
+    uint32_t len;
+    uint32_t rw_flags;
+    uint64_t user_data;
+    uint16_t buf_index;
+    uint16_t personality;
+    int32_t splice_fd_in;
+    uint64_t pad[2];
+};
+
+struct IoUringCqe
+{
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+struct IoSqringOffsets
+{
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+struct IoCqringOffsets
+{
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+struct IoUringParams
+{
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    IoSqringOffsets sq_off;
+    IoCqringOffsets cq_off;
+};
+
+static_assert(sizeof(IoUringSqe) == 64, "Invalid io_uring_sqe size");
+static_assert(sizeof(IoUringCqe) == 16, "Invalid io_uring_cqe size");
+static_assert(sizeof(IoUringParams) == 120, "Invalid io_uring_params size");
+
+constexpr uint8_t IORING_OP_READV = 1;
+constexpr uint8_t IORING_OP_WRITEV = 2;
+constexpr uint8_t IORING_OP_READ_FIXED = 4;
+constexpr uint8_t IORING_OP_WRITE_FIXED = 5;
+
+constexpr uint32_t IORING_FEAT_SINGLE_MMAP = 1u << 0;
+
+constexpr unsigned int IORING_ENTER_GETEVENTS = 1u << 0;
+
+constexpr unsigned int IORING_REGISTER_BUFFERS = 0;
+
+constexpr off_t IORING_OFF_SQ_RING = 0;
+constexpr off_t IORING_OFF_CQ_RING = 0x8000000;
+constexpr off_t IORING_OFF_SQES = 0x10000000;
+
+}
+
+static int sys_io_uring_setup(unsigned int entries, IoUringParams *p)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, nullptr, _NSIG / 8));
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, const void *arg,
+                                 unsigned int nr_args)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg,
+                                    nr_args));
+}
+
+template<typename T>
+static T * ring_ptr(void *base, uint32_t offset)
+{
+    return reinterpret_cast<T *>(static_cast<unsigned char *>(base) + offset);
+}
+
+struct UringFile::Ring
+{
+    int fd = -1;
+
+    void *sq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    void *cq_ptr = MAP_FAILED;
+    size_t cq_size = 0;
+    IoUringSqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t sq_mask;
+    uint32_t *sq_array;
+
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t cq_mask;
+    IoUringCqe *cqes;
+
+    static std::unique_ptr<Ring> create(unsigned int entries);
+
+    ~Ring()
+    {
+        if (sqes) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) {
+            munmap(cq_ptr, cq_size);
+        }
+        if (sq_ptr != MAP_FAILED) {
+            munmap(sq_ptr, sq_size);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+};
+
+std::unique_ptr<UringFile::Ring> UringFile::Ring::create(unsigned int entries)
+{
+    IoUringParams p = {};
+
+    int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    auto ring = std::make_unique<Ring>();
+    ring->fd = fd;
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(IoUringCqe);
+
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+    }
+
+    ring->sq_ptr = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        return nullptr;
+    }
+
+    if (single_mmap) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            return nullptr;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(IoUringSqe);
+    void *sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return nullptr;
+    }
+    ring->sqes = static_cast<IoUringSqe *>(sqes);
+
+    ring->sq_head = ring_ptr<uint32_t>(ring->sq_ptr, p.sq_off.head);
+    ring->sq_tail = ring_ptr<uint32_t>(ring->sq_ptr, p.sq_off.tail);
+    ring->sq_mask = *ring_ptr<uint32_t>(ring->sq_ptr, p.sq_off.ring_mask);
+    ring->sq_array = ring_ptr<uint32_t>(ring->sq_ptr, p.sq_off.array);
+
+    ring->cq_head = ring_ptr<uint32_t>(ring->cq_ptr, p.cq_off.head);
+    ring->cq_tail = ring_ptr<uint32_t>(ring->cq_ptr, p.cq_off.tail);
+    ring->cq_mask = *ring_ptr<uint32_t>(ring->cq_ptr, p.cq_off.ring_mask);
+    ring->cqes = ring_ptr<IoUringCqe>(ring->cq_ptr, p.cq_off.cqes);
+
+    return ring;
+}
+
+/*! \endcond */
+
+/*!
+ * \class UringFile
+ *
+ * \brief Open file using io_uring on Linux.
+ *
+ * This class behaves like FdFile, except that sequential reads and writes are
+ * queued to an io_uring instance so that up to \ref QUEUE_DEPTH requests of
+ * \ref BUFFER_SIZE bytes are in flight at once. Writes are copied into the
+ * queue and return immediately, while reads are served from a read-ahead
+ * window. This keeps block devices busy instead of idling between syscalls.
+ *
+ * The queue is drained before any other operation (seeking, truncating,
+ * positional and vectored I/O) and when the file is closed. Because of this,
+ * errors from queued writes may be reported by a later call. Such errors are
+ * fatal since the data can no longer be written.
+ *
+ * If the kernel does not support io_uring or the file is not a regular file or
+ * block device opened without `O_APPEND`, all operations are passed through to
+ * FdFile. uses_uring() can be used to check which mode is active.
+ *
+ * enable_direct_io() makes the queued requests bypass the page cache, which is
+ * useful for writing large images to block devices.
+ *
+ * \note native_fd() is not supported while io_uring is in use because writing
+ *       to the file descriptor directly would bypass the queue.
+ */
+
+/*!
+ * \brief Construct unbound UringFile.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+UringFile::UringFile()
+    : FdFile()
+{
+    clear();
+}
+
+/*!
+ * \brief Open File handle from file descriptor.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa FdFile::open(int, bool)
+ *
+ * \param fd File descriptor
+ * \param owned Whether the file descriptor should be owned by the File handle
+ */
+UringFile::UringFile(int fd, bool owned)
+    : UringFile()
+{
+    (void) open(fd, owned);
+}
+
+/*!
+ * \brief Open File handle from a multi-byte filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa FdFile::open(const std::string &, FileOpenMode)
+ *
+ * \param filename MBS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ */
+UringFile::UringFile(const std::string &filename, FileOpenMode mode)
+    : UringFile()
+{
+    (void) open(filename, mode);
+}
+
+/*!
+ * \brief Open File handle from a wide-character filename.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa FdFile::open(const std::wstring &, FileOpenMode)
+ *
+ * \param filename WCS filename
+ * \param mode Open mode (\ref FileOpenMode)
+ */
+UringFile::UringFile(const std::wstring &filename, FileOpenMode mode)
+    : UringFile()
+{
+    (void) open(filename, mode);
+}
+
+UringFile::~UringFile()
+{
+    (void) close();
+}
+
+/*!
+ * \brief Check whether I/O is being queued to io_uring
+ *
+ * \return Whether the file is open and io_uring is in use. If false, all
+ *         operations are passed through to FdFile.
+ */
+bool UringFile::uses_uring() const
+{
+    return !!m_ring;
+}
+
+/*!
+ * \brief Bypass the page cache for queued writes
+ *
+ * The file descriptor is switched to `O_DIRECT`. The queue's buffers are
+ * page-aligned and \ref BUFFER_SIZE bytes long, so full buffers at offsets
+ * that are multiples of \ref DIRECT_IO_ALIGNMENT can be written directly.
+ * This avoids the extra copy into the page cache and the long stall when the
+ * page cache is flushed on close.
+ *
+ * Reads, writes that are not aligned (such as the final partial buffer), and
+ * all operations that are passed through to FdFile switch the file back to the
+ * page cache for the rest of the time it is open. So do direct requests that
+ * the device rejects with `EINVAL`, which are then retried through the page
+ * cache. After direct I/O was used, closing the file flushes the device's
+ * write cache with `fdatasync()`, which is one flush for the whole file
+ * instead of one per write, as with `O_DSYNC`.
+ *
+ * \return Whether direct I/O is in use. It is not used if io_uring is not in
+ *         use or if the file system does not support `O_DIRECT`.
+ */
+bool UringFile::enable_direct_io()
+{
+    if (!m_ring || m_direct) {
+        return m_direct;
+    }
+
+    int fd = FdFile::on_native_fd().value();
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_DIRECT) < 0) {
+        return false;
+    }
+
+    m_direct = true;
+
+    return true;
+}
+
+/*!
+ * \brief Check whether queued writes bypass the page cache
+ */
+bool UringFile::uses_direct_io() const
+{
+    return m_direct;
+}
+
+oc::result<void> UringFile::on_open()
+{
+    OUTCOME_TRYV(FdFile::on_open());
+
+    setup_ring();
+
+    return oc::success();
+}
+
+oc::result<void> UringFile::on_close()
+{
+    auto reset = finally([&] {
+        clear();
+    });
+
+    oc::result<void> ret = oc::success();
+
+    if (m_ring) {
+        ret = drain();
+    }
+
+    teardown_ring();
+
+    if (ret && m_direct_used
+            && fdatasync(FdFile::on_native_fd().value()) < 0) {
+        ret = ec_from_errno();
+    }
+
+    auto close_ret = FdFile::on_close();
+    if (ret && !close_ret) {
+        ret = std::move(close_ret);
+    }
+
+    return ret;
+}
+
+oc::result<size_t> UringFile::on_read(void *buf, size_t size)
+{
+    if (!m_ring) {
+        return FdFile::on_read(buf, size);
+    }
+
+    if (m_mode != Mode::Reading) {
+        OUTCOME_TRYV(drain());
+        disable_direct_io();
+        m_mode = Mode::Reading;
+        m_read_offset = m_pos;
+        m_read_eof = false;
+    }
+
+    while (true) {
+        OUTCOME_TRYV(fill_read_ahead());
+
+        if (m_read_queue.empty()) {
+            // Reached EOF and every queued read has been consumed
+            return 0;
+        }
+
+        size_t index = m_read_queue.front();
+        Slot &slot = m_slots[index];
+
+        while (slot.state == SlotState::InFlight) {
+            OUTCOME_TRYV(reap(true));
+        }
+
+        if (slot.result < 0) {
+            auto ec = std::error_code(-slot.result, std::generic_category());
+            // Throw away the read-ahead window so the next read retries
+            (void) drain();
+            return ec;
+        }
+
+        size_t valid = static_cast<size_t>(slot.result);
+
+        if (slot.pos < valid) {
+            size_t n = std::min(size, valid - slot.pos);
+            memcpy(buf, slot_data(index) + slot.pos, n);
+            slot.pos += n;
+            m_pos += n;
+            return n;
+        }
+
+        // Slot fully consumed. A short read means the end of the file was
+        // reached, so no further reads are queued.
+        if (valid < slot.size) {
+            m_read_eof = true;
+        }
+
+        slot.state = SlotState::Free;
+        m_read_queue.pop_front();
+
+        if (m_read_eof) {
+            // Slots queued after the end of the file hold no data
+            while (!m_read_queue.empty()) {
+                size_t i = m_read_queue.front();
+                while (m_slots[i].state == SlotState::InFlight) {
+                    OUTCOME_TRYV(reap(true));
+                }
+                m_slots[i].state = SlotState::Free;
+                m_read_queue.pop_front();
+            }
+            return 0;
+        }
+    }
+}
+
+oc::result<size_t> UringFile::on_write(const void *buf, size_t size)
+{
+    if (!m_ring) {
+        return FdFile::on_write(buf, size);
+    }
+
+    if (m_mode != Mode::Writing) {
+        OUTCOME_TRYV(drain());
+        m_mode = Mode::Writing;
+    }
+
+    auto ptr = static_cast<const unsigned char *>(buf);
+    size_t total = 0;
+
+    while (total < size) {
+        if (m_fill == m_slots.size()) {
+            auto index = acquire_write_slot();
+            if (!index) {
+                set_fatal();
+                return index.as_failure();
+            }
+
+            m_fill = index.value();
+            m_slots[m_fill].state = SlotState::Filling;
+            m_slots[m_fill].offset = m_pos;
+            m_slots[m_fill].size = 0;
+        }
+
+        Slot &slot = m_slots[m_fill];
+        size_t n = std::min(size - total, BUFFER_SIZE - slot.size);
+
+        memcpy(slot_data(m_fill) + slot.size, ptr + total, n);
+        slot.size += n;
+        total += n;
+        m_pos += n;
+
+        if (slot.size == BUFFER_SIZE) {
+            auto ret = submit(m_fill, true);
+            if (!ret) {
+                set_fatal();
+                return ret.as_failure();
+            }
+
+            m_fill = m_slots.size();
+        }
+    }
+
+    return total;
+}
+
+oc::result<uint64_t> UringFile::on_seek(int64_t offset, int whence)
+{
+    if (!m_ring) {
+        return FdFile::on_seek(offset, whence);
+    }
+
+    // Querying the position does not require draining the queue
+    if (offset == 0 && whence == SEEK_CUR) {
+        return m_pos;
+    }
+
+    OUTCOME_TRYV(drain());
+    OUTCOME_TRY(pos, FdFile::on_seek(offset, whence));
+
+    m_pos = pos;
+
+    return pos;
+}
+
+oc::result<void> UringFile::on_truncate(uint64_t size)
+{
+    if (m_ring) {
+        OUTCOME_TRYV(drain());
+    }
+
+    return FdFile::on_truncate(size);
+}
+
+oc::result<size_t> UringFile::on_read_at(uint64_t offset, void *buf,
+                                         size_t size)
+{
+    if (m_ring) {
+        OUTCOME_TRYV(drain());
+        disable_direct_io();
+    }
+
+    return FdFile::on_read_at(offset, buf, size);
+}
+
+oc::result<size_t> UringFile::on_write_at(uint64_t offset, const void *buf,
+                                          size_t size)
+{
+    if (m_ring) {
+        OUTCOME_TRYV(drain());
+        disable_direct_io();
+    }
+
+    return FdFile::on_write_at(offset, buf, size);
+}
+
+oc::result<size_t> UringFile::on_readv(const FileIoVec *iov, size_t count)
+{
+    if (!m_ring) {
+        return FdFile::on_readv(iov, count);
+    }
+
+    OUTCOME_TRYV(drain());
+    disable_direct_io();
+    OUTCOME_TRY(n, FdFile::on_readv(iov, count));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<size_t> UringFile::on_writev(const FileIoVec *iov, size_t count)
+{
+    if (!m_ring) {
+        return FdFile::on_writev(iov, count);
+    }
+
+    OUTCOME_TRYV(drain());
+    disable_direct_io();
+    OUTCOME_TRY(n, FdFile::on_writev(iov, count));
+
+    m_pos += n;
+
+    return n;
+}
+
+oc::result<int> UringFile::on_native_fd()
+{
+    if (m_ring) {
+        return FileError::UnsupportedNativeFd;
+    }
+
+    return FdFile::on_native_fd();
+}
+
+/*! \cond INTERNAL */
+
+void UringFile::clear()
+{
+    m_ring.reset();
+    m_buf = nullptr;
+    m_slots.clear();
+    m_fixed = false;
+    m_direct = false;
+    m_direct_used = false;
+    m_mode = Mode::Idle;
+    m_pos = 0;
+    m_fill = 0;
+    m_read_queue.clear();
+    m_read_offset = 0;
+    m_read_eof = false;
+}
+
+/*!
+ * \brief Set up the io_uring instance and buffers
+ *
+ * If anything fails, the file silently falls back to plain FdFile behavior.
+ */
+void UringFile::setup_ring()
+{
+    int fd = FdFile::on_native_fd().value();
+
+    // Queued requests use explicit offsets, which does not work with pipes,
+    // sockets, character devices, or append mode
+    struct stat sb;
+    if (fstat(fd, &sb) < 0 || !(S_ISREG(sb.st_mode) || S_ISBLK(sb.st_mode))) {
+        return;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || (flags & O_APPEND)) {
+        return;
+    }
+
+    off64_t pos = lseek64(fd, 0, SEEK_CUR);
+    if (pos < 0) {
+        return;
+    }
+
+    auto ring = Ring::create(static_cast<unsigned int>(QUEUE_DEPTH));
+    if (!ring) {
+        return;
+    }
+
+    // Page-aligned so that the buffers also work with O_DIRECT
+    size_t buf_size = QUEUE_DEPTH * BUFFER_SIZE;
+    void *buf = mmap(nullptr, buf_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        return;
+    }
+
+    m_ring = std::move(ring);
+    m_buf = static_cast<unsigned char *>(buf);
+    m_slots.resize(QUEUE_DEPTH);
+    for (auto &slot : m_slots) {
+        slot = {};
+    }
+    m_mode = Mode::Idle;
+    m_pos = static_cast<uint64_t>(pos);
+    m_fill = m_slots.size();
+
+    // Registering the buffers avoids mapping them for every request. This can
+    // fail if RLIMIT_MEMLOCK is too low, in which case plain readv/writev
+    // requests are used instead.
+    struct iovec iovs[QUEUE_DEPTH];
+    for (size_t i = 0; i < QUEUE_DEPTH; ++i) {
+        iovs[i].iov_base = slot_data(i);
+        iovs[i].iov_len = BUFFER_SIZE;
+    }
+
+    m_fixed = sys_io_uring_register(m_ring->fd, IORING_REGISTER_BUFFERS,
+                                    iovs,
+                                    static_cast<unsigned int>(QUEUE_DEPTH)) == 0;
+}
+
+void UringFile::teardown_ring()
+{
+    // Closing the ring also unregisters the buffers
+    m_ring.reset();
+
+    if (m_buf) {
+        munmap(m_buf, QUEUE_DEPTH * BUFFER_SIZE);
+        m_buf = nullptr;
+    }
+}
+
+/*!
+ * \brief Switch the file descriptor back to the page cache
+ *
+ * Requests that are already in flight are not affected.
+ */
+void UringFile::disable_direct_io()
+{
+    if (!m_direct) {
+        return;
+    }
+
+    int fd = FdFile::on_native_fd().value();
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) {
+        (void) fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+    }
+
+    m_direct = false;
+}
+
+unsigned char * UringFile::slot_data(size_t index)
+{
+    return m_buf + index * BUFFER_SIZE;
+}
+
+/*!
+ * \brief Queue a read or write of a slot's buffer
+ *
+ * Never more than \ref QUEUE_DEPTH requests are in flight, so the submission
+ * queue cannot overflow. Failures are fatal.
+ */
+oc::result<void> UringFile::submit(size_t index, bool write)
+{
+    Slot &slot = m_slots[index];
+    Ring &ring = *m_ring;
+
+    if (m_direct && (slot.offset % DIRECT_IO_ALIGNMENT != 0
+            || slot.size % DIRECT_IO_ALIGNMENT != 0)) {
+        disable_direct_io();
+    }
+
+    slot.direct = m_direct;
+    m_direct_used |= m_direct;
+
+    uint32_t tail = *ring.sq_tail;
+    uint32_t sq_index = tail & ring.sq_mask;
+    IoUringSqe *sqe = &ring.sqes[sq_index];
+
+    slot.iov.iov_base = slot_data(index);
+    slot.iov.iov_len = slot.size;
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = FdFile::on_native_fd().value();
+    sqe->off = slot.offset;
+    sqe->user_data = index;
+
+    if (m_fixed) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = reinterpret_cast<uintptr_t>(slot.iov.iov_base);
+        sqe->len = static_cast<uint32_t>(slot.size);
+        sqe->buf_index = static_cast<uint16_t>(index);
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = reinterpret_cast<uintptr_t>(&slot.iov);
+        sqe->len = 1;
+    }
+
+    ring.sq_array[sq_index] = sq_index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    slot.state = SlotState::InFlight;
+    slot.pos = 0;
+
+    while (true) {
+        int ret = sys_io_uring_enter(ring.fd, 1, 0, 0);
+        if (ret >= 0) {
+            break;
+        } else if (errno != EINTR) {
+            // The entry is still in the submission queue and would be
+            // submitted by a later call, so the ring can no longer be used
+            slot.state = SlotState::Free;
+            set_fatal();
+            return ec_from_errno();
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Process completed requests
+ *
+ * \param wait Whether to block until at least one request completes
+ */
+oc::result<void> UringFile::reap(bool wait)
+{
+    Ring &ring = *m_ring;
+
+    while (true) {
+        uint32_t head = *ring.cq_head;
+        uint32_t tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head != tail) {
+            for (; head != tail; ++head) {
+                IoUringCqe *cqe = &ring.cqes[head & ring.cq_mask];
+                Slot &slot = m_slots[static_cast<size_t>(cqe->user_data)];
+
+                slot.result = cqe->res;
+                slot.state = SlotState::Done;
+            }
+
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+            return oc::success();
+        } else if (!wait) {
+            return oc::success();
+        }
+
+        if (sys_io_uring_enter(ring.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+                && errno != EINTR) {
+            return ec_from_errno();
+        }
+    }
+}
+
+/*!
+ * \brief Check the result of a completed write and release its slot
+ *
+ * Short writes are completed synchronously.
+ */
+oc::result<void> UringFile::retire_write(size_t index)
+{
+    Slot &slot = m_slots[index];
+    slot.state = SlotState::Free;
+
+    size_t done = 0;
+
+    if (slot.result == -EINVAL && slot.direct) {
+        // The device does not accept direct requests after all
+        disable_direct_io();
+    } else if (slot.result < 0) {
+        return std::error_code(-slot.result, std::generic_category());
+    } else {
+        done = static_cast<size_t>(slot.result);
+    }
+
+    if (done < slot.size) {
+        // Unaligned offsets cannot be written with O_DIRECT
+        disable_direct_io();
+    }
+
+    while (done < slot.size) {
+        OUTCOME_TRY(n, FdFile::on_write_at(slot.offset + done,
+                                           slot_data(index) + done,
+                                           slot.size - done));
+        if (n == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        done += n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Get a free slot for writing, waiting for a write to complete if
+ *        necessary
+ */
+oc::result<size_t> UringFile::acquire_write_slot()
+{
+    while (true) {
+        for (size_t i = 0; i < m_slots.size(); ++i) {
+            if (m_slots[i].state == SlotState::Done) {
+                OUTCOME_TRYV(retire_write(i));
+            }
+            if (m_slots[i].state == SlotState::Free) {
+                return i;
+            }
+        }
+
+        OUTCOME_TRYV(reap(true));
+    }
+}
+
+/*!
+ * \brief Queue reads for every free slot, unless EOF has been reached
+ */
+oc::result<void> UringFile::fill_read_ahead()
+{
+    if (m_read_eof) {
+        return oc::success();
+    }
+
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        Slot &slot = m_slots[i];
+        if (slot.state != SlotState::Free) {
+            continue;
+        }
+
+        slot.offset = m_read_offset;
+        slot.size = BUFFER_SIZE;
+
+        OUTCOME_TRYV(submit(i, false));
+
+        m_read_queue.push_back(i);
+        m_read_offset += BUFFER_SIZE;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Wait for all queued requests and sync the descriptor's offset
+ *
+ * Pending writes are flushed and unread read-ahead data is discarded. Write
+ * errors are fatal.
+ */
+oc::result<void> UringFile::drain()
+{
+    if (m_mode == Mode::Idle) {
+        return oc::success();
+    }
+
+    oc::result<void> ret = oc::success();
+
+    if (m_mode == Mode::Writing && m_fill != m_slots.size()) {
+        if (m_slots[m_fill].size > 0) {
+            ret = submit(m_fill, true);
+        } else {
+            m_slots[m_fill].state = SlotState::Free;
+        }
+        m_fill = m_slots.size();
+    }
+
+    for (size_t i = 0; i < m_slots.size(); ++i) {
+        while (m_slots[i].state == SlotState::InFlight) {
+            auto reap_ret = reap(true);
+            if (!reap_ret) {
+                // The kernel still owns the buffers, so there is no way to
+                // recover
+                teardown_ring();
+                set_fatal();
+                return reap_ret.as_failure();
+            }
+        }
+
+        if (m_slots[i].state == SlotState::Done && m_mode == Mode::Writing) {
+            auto retire_ret = retire_write(i);
+            if (ret && !retire_ret) {
+                ret = std::move(retire_ret);
+            }
+        }
+
+        m_slots[i].state = SlotState::Free;
+    }
+
+    m_read_queue.clear();
+    m_read_eof = false;
+
+    bool writing = m_mode == Mode::Writing;
+    m_mode = Mode::Idle;
+
+    if (!ret) {
+        if (writing) {
+            set_fatal();
+        }
+        return ret.as_failure();
+    }
+
+    OUTCOME_TRYV(FdFile::on_seek(static_cast<int64_t>(m_pos), SEEK_SET));
+
+    return oc::success();
+}
+
+/*! \endcond */
+
+}
@@ -64,6 +64,10 @@ std::string FileErrorCategory::message(int ev) const
         return "seek not supported";
     case FileError::UnsupportedTruncate:
         return "truncate not supported";
+    case FileError::UnsupportedNativeFd:
+        return "file is not backed by a file descriptor";
+    case FileError::UnsupportedView:
+        return "file contents are not resident in memory";
     case FileError::UnexpectedEof:
         return "unexpected end of file";
     case FileError::IntegerOverflow:
@@ -86,6 +90,8 @@ FileErrorCategory::default_error_condition(int code) const noexcept
     case FileError::UnsupportedWrite:
     case FileError::UnsupportedSeek:
     case FileError::UnsupportedTruncate:
+    case FileError::UnsupportedNativeFd:
+    case FileError::UnsupportedView:
         return FileErrorC::Unsupported;
     default:
         return FileErrorC::InternalError;
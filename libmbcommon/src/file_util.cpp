@@ -31,9 +31,47 @@
 #include <cstdio>
 #include <cstring>
 
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <linux/falloc.h>
+#  include <sys/sendfile.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/resource_budget.h"
 
 #define DEFAULT_BUFFER_SIZE             (8 * 1024 * 1024)
+#define COPY_BUFFER_SIZE                (1024 * 1024)
+// Smallest buffer used when the buffer budget is exhausted
+#define MIN_BUFFER_SIZE                 (64 * 1024)
+
+// Kernel copy interfaces transfer at most this many bytes per call
+#define MAX_KERNEL_COPY_SIZE            0x7ffff000
+
+// Userspace file_move() copies are aligned to this on the destination
+#define MOVE_ALIGNMENT                  4096
+
+// Added in Linux 3.15 and 4.1
+#ifndef FALLOC_FL_COLLAPSE_RANGE
+#  define FALLOC_FL_COLLAPSE_RANGE      0x08
+#endif
+#ifndef FALLOC_FL_INSERT_RANGE
+#  define FALLOC_FL_INSERT_RANGE        0x20
+#endif
+
+// Patterns longer than this are searched with Boyer-Moore
+#define MAX_SHORT_PATTERN_SIZE          32
 
 /*!
  * \file mbcommon/file_util.h
@@ -163,6 +201,51 @@ oc::result<void> file_read_exact(File &file, void *buf, size_t size)
     return oc::success();
 }
 
+/*!
+ * \brief Read from a File handle at an offset.
+ *
+ * This function behaves like file_read_exact(), except that the data is read
+ * with File::read_at(). The file position is not changed.
+ *
+ * If this function fails, the contents of \p buf are unspecified.
+ *
+ * \param[in] file File handle
+ * \param[in] offset File offset to read from
+ * \param[out] buf Buffer to read into
+ * \param[in] size Buffer size
+ *
+ * \return Nothing if the specified number of bytes were successfully read.
+ *         Otherwise, the error code.
+ */
+oc::result<void> file_read_exact_at(File &file, uint64_t offset,
+                                    void *buf, size_t size)
+{
+    size_t bytes_read = 0;
+
+    while (bytes_read < size) {
+        if (offset > UINT64_MAX - bytes_read) {
+            return FileError::ArgumentOutOfRange;
+        }
+
+        auto n = file.read_at(offset + bytes_read,
+                              static_cast<char *>(buf) + bytes_read,
+                              size - bytes_read);
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            } else {
+                return n.as_failure();
+            }
+        } else if (n.value() == 0) {
+            return FileError::UnexpectedEof;
+        }
+
+        bytes_read += n.value();
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Write to a File handle.
  *
@@ -227,6 +310,196 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
     return bytes_discarded;
 }
 
+/*! \cond INTERNAL */
+
+/*!
+ * \brief Rough estimate of how common a byte is in binary files
+ *
+ * Lower values are rarer. Zero padding and erased flash (0xff) are by far the
+ * most common, followed by printable text.
+ */
+static int byte_frequency_rank(unsigned char c)
+{
+    if (c == 0x00) {
+        return 3;
+    } else if (c == 0xff) {
+        return 2;
+    } else if ((c >= 0x20 && c <= 0x7e) || c == '\n' || c == '\t') {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/*!
+ * \brief Pattern searcher that avoids Boyer-Moore table setup for short
+ *        patterns
+ *
+ * Short patterns are searched by scanning for two of the pattern's rarest
+ * bytes at their respective offsets (with SSE2 or NEON if available, otherwise
+ * with memchr()) and then verifying the candidates. Longer patterns use
+ * Boyer-Moore.
+ */
+class PatternSearcher
+{
+public:
+    PatternSearcher(const unsigned char *pattern, size_t size)
+        : m_pattern(pattern)
+        , m_size(size)
+        , m_rare1(0)
+        , m_rare2(0)
+    {
+        if (size > MAX_SHORT_PATTERN_SIZE) {
+            m_bm.emplace(pattern, pattern + size);
+            return;
+        }
+
+        for (size_t i = 1; i < size; ++i) {
+            if (byte_frequency_rank(pattern[i])
+                    < byte_frequency_rank(pattern[m_rare1])) {
+                m_rare1 = i;
+            }
+        }
+
+        if (size == 1) {
+            return;
+        }
+
+        // Prefer a different byte value for the second filter byte
+        auto score = [&](size_t i) {
+            return byte_frequency_rank(pattern[i])
+                    + (pattern[i] == pattern[m_rare1] ? 4 : 0);
+        };
+
+        m_rare2 = m_rare1 == 0 ? 1 : 0;
+        for (size_t i = 0; i < size; ++i) {
+            if (i != m_rare1 && score(i) < score(m_rare2)) {
+                m_rare2 = i;
+            }
+        }
+    }
+
+    /*!
+     * \brief Find first occurrence of pattern
+     *
+     * \return Offset of first match or \p size if there is no match
+     */
+    size_t find(const unsigned char *data, size_t size) const
+    {
+        if (size < m_size) {
+            return size;
+        } else if (m_bm) {
+            auto it = std2::search(data, data + size, *m_bm);
+            return static_cast<size_t>(it - data);
+        } else if (m_size == 1) {
+            auto ptr = static_cast<const unsigned char *>(
+                    memchr(data, m_pattern[0], size));
+            return ptr ? static_cast<size_t>(ptr - data) : size;
+        }
+
+        // Last possible starting offset
+        const size_t last = size - m_size;
+        size_t i = 0;
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#  if defined(__SSE2__)
+        const __m128i v1 = _mm_set1_epi8(static_cast<char>(m_pattern[m_rare1]));
+        const __m128i v2 = _mm_set1_epi8(static_cast<char>(m_pattern[m_rare2]));
+#  else
+        const uint8x16_t v1 = vdupq_n_u8(m_pattern[m_rare1]);
+        const uint8x16_t v2 = vdupq_n_u8(m_pattern[m_rare2]);
+#  endif
+
+        // Check 16 starting offsets at a time
+        for (; last >= 15 && i <= last - 15; i += 16) {
+#  if defined(__SSE2__)
+            auto b1 = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(data + i + m_rare1));
+            auto b2 = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i *>(data + i + m_rare2));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+                    _mm_and_si128(_mm_cmpeq_epi8(b1, v1),
+                                  _mm_cmpeq_epi8(b2, v2))));
+            constexpr int bits_per_offset = 1;
+#  else
+            auto b1 = vld1q_u8(data + i + m_rare1);
+            auto b2 = vld1q_u8(data + i + m_rare2);
+            auto eq = vandq_u8(vceqq_u8(b1, v1), vceqq_u8(b2, v2));
+            // Narrow each byte to a nibble to get a 64-bit mask
+            auto mask = vget_lane_u64(vreinterpret_u64_u8(
+                    vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            constexpr int bits_per_offset = 4;
+#  endif
+
+            while (mask != 0) {
+                auto offset = i + static_cast<size_t>(
+                        __builtin_ctzll(mask) / bits_per_offset);
+                if (memcmp(data + offset, m_pattern, m_size) == 0) {
+                    return offset;
+                }
+
+                // Clear lowest matching offset
+                decltype(mask) bits = (decltype(mask)(1) << bits_per_offset) - 1;
+                mask &= ~(bits << ((offset - i) * bits_per_offset));
+            }
+        }
+#endif
+
+        while (i <= last) {
+            auto ptr = static_cast<const unsigned char *>(memchr(
+                    data + i + m_rare1, m_pattern[m_rare1], last - i + 1));
+            if (!ptr) {
+                break;
+            }
+
+            i = static_cast<size_t>(ptr - data) - m_rare1;
+            if (data[i + m_rare2] == m_pattern[m_rare2]
+                    && memcmp(data + i, m_pattern, m_size) == 0) {
+                return i;
+            }
+            ++i;
+        }
+
+        return size;
+    }
+
+private:
+    const unsigned char *m_pattern;
+    size_t m_size;
+    // Offsets of the rarest bytes in the pattern
+    size_t m_rare1;
+    size_t m_rare2;
+    std::optional<std2::boyer_moore_searcher<const unsigned char *>> m_bm;
+};
+
+/*!
+ * \brief Move to the starting offset of a search
+ *
+ * If the file does not support seeking, data before \p offset is read and
+ * discarded instead.
+ */
+static oc::result<void> file_search_seek_start(File &file, uint64_t offset)
+{
+    auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
+    if (!seek_ret) {
+        if (seek_ret.error() == FileErrorC::Unsupported) {
+            OUTCOME_TRY(discarded, file_read_discard(file, offset));
+
+            if (discarded != offset) {
+                // Reached EOF before starting offset
+                file.set_fatal();
+                return FileError::ArgumentOutOfRange;
+            }
+        } else {
+            return seek_ret.as_failure();
+        }
+    }
+
+    return oc::success();
+}
+
+/*! \endcond */
+
 /*!
  * \typedef FileSearchResultCallback
  *
@@ -255,14 +528,18 @@ oc::result<uint64_t> file_read_discard(File &file, uint64_t size)
  * If \p buf_size is non-zero, a buffer of size \p buf_size will be allocated.
  * If it is less than or equal to \p pattern_size, then the function will return
  * FileError::ArgumentOutOfRange. If \p buf_size is zero, then the larger of
- * 8 MiB and 2 * \p pattern_size will be used. In the rare case that
- * 2 * \p pattern_size would exceed the maximum value of a `size_t`, `SIZE_MAX`
- * will be used.
+ * 8 MiB (or less, down to 64 KiB, if the ResourceBudget is exhausted) and
+ * 2 * \p pattern_size will be used. In the rare case that 2 * \p pattern_size
+ * would exceed the maximum value of a `size_t`, `SIZE_MAX` will be used.
  *
  * If \p file does not support seeking, then the file position must be set to
  * the beginning of the file before calling this function. Instead of seeking,
  * the function will read and discard any data before \p start.
  *
+ * Patterns of up to 32 bytes are found by scanning for two of the pattern's
+ * rarest bytes (using SSE2 or NEON when available) and verifying candidates.
+ * Longer patterns are searched for with Boyer-Moore.
+ *
  * \note We do not do overlapping searches. For example, if a file's contents
  *       is "ababababab" and the search pattern is "abab", the resulting offsets
  *       will be (0 and 4), *not* (0, 2, 4, 6). In other words, the next search
@@ -306,11 +583,14 @@ oc::result<void> file_search(File &file,
         return oc::success();
     }
 
+    BufferLease lease;
+
     // Compute buffer size
     if (bsize != 0) {
         buf_size = bsize;
     } else {
-        buf_size = DEFAULT_BUFFER_SIZE;
+        lease = BufferLease(DEFAULT_BUFFER_SIZE, MIN_BUFFER_SIZE);
+        buf_size = lease.size();
 
         if (pattern_size > SIZE_MAX / 2) {
             buf_size = SIZE_MAX;
@@ -334,29 +614,14 @@ oc::result<void> file_search(File &file,
     }
 
     // Seek to starting point
-    auto seek_ret = file.seek(static_cast<int64_t>(offset), SEEK_SET);
-    if (!seek_ret) {
-        if (seek_ret.error() == FileErrorC::Unsupported) {
-            OUTCOME_TRY(discarded, file_read_discard(file, offset));
-
-            if (discarded != offset) {
-                // Reached EOF before starting offset
-                file.set_fatal();
-                return FileError::ArgumentOutOfRange;
-            }
-        } else {
-            return seek_ret.as_failure();
-        }
-    }
+    OUTCOME_TRYV(file_search_seek_start(file, offset));
 
     // Initially read to beginning of buffer
     unsigned char *ptr = buf.data();
     size_t ptr_remain = buf.size();
 
-    // Boyer-Moore searcher for pattern
-    auto pattern_searcher = std2::boyer_moore_searcher<const unsigned char *>(
-            static_cast<const unsigned char *>(pattern),
-            static_cast<const unsigned char *>(pattern) + pattern_size);
+    PatternSearcher searcher(static_cast<const unsigned char *>(pattern),
+                             pattern_size);
 
     while (true) {
         OUTCOME_TRY(n, file_read_retry(file, ptr, ptr_remain));
@@ -384,12 +649,11 @@ oc::result<void> file_search(File &file,
         size_t match_remain = n;
 
         while (true) {
-            auto it = std2::search(match, match + match_remain,
-                                   pattern_searcher);
-            if (it == match + match_remain) {
+            auto pos = searcher.find(match, match_remain);
+            if (pos == match_remain) {
                 break;
             }
-            match = it;
+            match += pos;
 
             // Stop if match falls outside of ending boundary
             if (end && offset + static_cast<size_t>(match - buf.data())
@@ -434,110 +698,1088 @@ oc::result<void> file_search(File &file,
     }
 }
 
+/*! \cond INTERNAL */
+
 /*!
- * \brief Move data in file
+ * \brief Get a pointer to a range of a file
  *
- * This function is equivalent to `memmove()`, except it operates on a File
- * handle. The source and destination regions can overlap. In the degenerate
- * case where \p src == \p dest or \p size == 0, no operation will be performed,
- * but the function will return \p size accordingly.
+ * The range is accessed directly if the file supports views. Otherwise, it is
+ * read into \p buf with positional reads.
+ */
+static oc::result<const unsigned char *>
+file_search_load(File &file, uint64_t offset, size_t size,
+                 std::vector<unsigned char> &buf)
+{
+    auto view = file.view_at(offset, size);
+    if (view && view.value().size == size) {
+        return static_cast<const unsigned char *>(view.value().data);
+    } else if (!view && view.error() != FileError::UnsupportedView) {
+        return view.as_failure();
+    }
+
+    buf.resize(size);
+    OUTCOME_TRYV(file_read_exact_at(file, offset, buf.data(), size));
+
+    return buf.data();
+}
+
+/*!
+ * \brief Matches found in one chunk of a parallel search
+ */
+struct FileSearchChunk
+{
+    // Offset of the chunk's data
+    uint64_t offset;
+    // Size of the chunk's data, including the overlap with the next chunk
+    size_t size;
+    // Non-overlapping matches when searching from the start of the chunk
+    std::vector<uint64_t> matches;
+    oc::result<void> ret = oc::success();
+};
+
+/*! \endcond */
+
+/*!
+ * \brief Search file for binary sequence using multiple threads
  *
- * \note This function is very seek-heavy and may be slow if the handle cannot
- *       seek efficiently. It will perform two seeks per loop interation. Each
- *       iteration moves up to 10240 bytes.
+ * This finds the same matches as file_search(), including its non-overlapping
+ * semantics, and invokes \p result_cb in the same order, but splits the range
+ * into chunks of \p chunk_size bytes that are searched in parallel on the
+ * global Executor. Adjacent chunks overlap by \p pattern_size - 1 bytes so
+ * that matches across chunk boundaries are found. \p result_cb is only invoked
+ * from the calling thread.
  *
- * \note If the return value, \p r, is less than \p size, then the *first* \p r
- *       bytes have been copied from offset \p src to offset \p dest. This is
- *       true even if \p src \< \p dest, resulting in a backwards copy.
+ * Each chunk is searched from its beginning. When a match from the previous
+ * chunk extends into a chunk and overlaps the chunk's first match, that chunk
+ * is searched again starting at the end of the previous match until the
+ * results agree. With self-overlapping patterns in repetitive data (eg.
+ * "aaaa" in a run of 'a's), this may happen for every chunk, which degrades
+ * the search to about the speed of file_search().
+ *
+ * The file is accessed with File::view_at() if it is supported and with
+ * File::read_at() otherwise, so it must support concurrent positional reads
+ * (eg. FdFile, MemoryFile, MmapFile, or PosixFile). Its size is determined by
+ * seeking to the end, so non-seekable files are not supported.
+ *
+ * \note The file position after this function returns is undefined.
  *
  * \param file File handle
- * \param src Source offset
- * \param dest Destination offset
- * \param size Size of data to move
+ * \param start Start offset or nothing for beginning of file
+ * \param end End offset or nothing for end of file
+ * \param chunk_size Chunk size or 0 to automatically choose a size. Each task
+ *                   uses a buffer of this size if the file does not support
+ *                   views.
+ * \param pattern Pattern to search
+ * \param pattern_size Size of pattern
+ * \param max_matches Maximum number of matches or nothing to find all matches
+ * \param result_cb Callback to invoke upon finding a match
+ * \param max_tasks Maximum number of parallel tasks or 0 to use the executor's
+ *                  concurrency
  *
- * \return Size of data that is moved if data is successfully moved. Otherwise,
- *         the error code.
+ * \return Nothing if the search completes successfully. Otherwise, the error
+ *         code.
  */
-oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
-                               uint64_t size)
+oc::result<void> file_search_parallel(File &file,
+                                      std::optional<uint64_t> start,
+                                      std::optional<uint64_t> end,
+                                      size_t chunk_size, const void *pattern,
+                                      size_t pattern_size,
+                                      std::optional<uint64_t> max_matches,
+                                      const FileSearchResultCallback &result_cb,
+                                      size_t max_tasks)
 {
-    char buf[10240];
+    // Check boundaries
+    if (start && end && *end < *start) {
+        // End offset < start offset
+        return FileError::ArgumentOutOfRange;
+    }
 
-    // Check if we need to do anything
-    if (src == dest || size == 0) {
-        return size;
+    // Trivial case
+    if ((max_matches && *max_matches == 0) || pattern_size == 0) {
+        return oc::success();
     }
 
-    if (src > UINT64_MAX - size || dest > UINT64_MAX - size) {
-        // Offset + size overflows integer
+    if (chunk_size == 0) {
+        BufferLease lease(DEFAULT_BUFFER_SIZE, MIN_BUFFER_SIZE);
+        chunk_size = std::max(lease.size(), pattern_size);
+    } else if (chunk_size < pattern_size) {
+        // Chunk size cannot be less than pattern size
         return FileError::ArgumentOutOfRange;
     }
 
-    uint64_t size_moved = 0;
+    // Matches may start anywhere in [offset, last_start]
+    OUTCOME_TRY(file_size, file.seek(0, SEEK_END));
 
-    if (dest < src) {
-        // Copy forwards
-        while (size_moved < size) {
-            auto to_read = std::min<uint64_t>(
-                    sizeof(buf), size - size_moved);
+    uint64_t offset = start ? *start : 0;
+    uint64_t limit = end ? std::min(*end, file_size) : file_size;
 
-            // Seek to source offset
-            OUTCOME_TRYV(file.seek(static_cast<int64_t>(src + size_moved),
-                                   SEEK_SET));
+    if (limit < pattern_size || offset > limit - pattern_size) {
+        return oc::success();
+    }
 
-            // Read data from source
-            OUTCOME_TRY(n_read, file_read_retry(
-                    file, buf, static_cast<size_t>(to_read)));
-            if (n_read == 0) {
-                break;
-            }
+    const uint64_t last_start = limit - pattern_size;
+    const size_t overlap = pattern_size - 1;
 
-            // Seek to destination offset
-            OUTCOME_TRYV(file.seek(static_cast<int64_t>(dest + size_moved),
-                                   SEEK_SET));
+    PatternSearcher searcher(static_cast<const unsigned char *>(pattern),
+                             pattern_size);
 
-            // Write data to destination
-            OUTCOME_TRY(n_written, file_write_retry(file, buf, n_read));
+    auto &executor = Executor::global();
+    size_t tasks = executor.concurrency();
+    if (max_tasks != 0) {
+        tasks = std::min(tasks, max_tasks);
+    }
 
-            size_moved += n_written;
+    // Search a few chunks ahead of the results being reported
+    const size_t batch_size = tasks * 2;
+    std::vector<FileSearchChunk> chunks;
+    std::vector<unsigned char> buf;
 
-            if (n_written < n_read) {
-                break;
-            }
+    // The next match must start at or after this offset
+    uint64_t next_offset = offset;
+
+    // Returns false if the search should stop
+    auto report = [&](uint64_t match) -> oc::result<bool> {
+        OUTCOME_TRY(action, result_cb(file, match));
+        if (action == FileSearchAction::Stop) {
+            return false;
         }
-    } else {
-        // Copy backwards
-        while (size_moved < size) {
-            auto to_read = std::min<uint64_t>(sizeof(buf), size - size_moved);
 
-            // Seek to source offset
-            OUTCOME_TRYV(file.seek(static_cast<int64_t>(
-                    src + size - size_moved - to_read), SEEK_SET));
+        if (max_matches && --*max_matches == 0) {
+            return false;
+        }
 
-            // Read data form source
-            OUTCOME_TRY(n_read, file_read_retry(
-                    file, buf, static_cast<size_t>(to_read)));
-            if (n_read == 0) {
-                break;
+        next_offset = match + pattern_size;
+        return true;
+    };
+
+    while (offset <= last_start) {
+        chunks.clear();
+
+        for (size_t i = 0; i < batch_size && offset <= last_start; ++i) {
+            uint64_t starts = std::min<uint64_t>(chunk_size,
+                                                 last_start - offset + 1);
+
+            FileSearchChunk &chunk = chunks.emplace_back();
+            chunk.offset = offset;
+            chunk.size = static_cast<size_t>(starts) + overlap;
+
+            offset += starts;
+        }
+
+        // A chunk needs at most this many matches as long as it agrees with
+        // the previous chunk
+        std::optional<uint64_t> chunk_max_matches;
+        if (max_matches) {
+            chunk_max_matches = *max_matches + 1;
+        }
+
+        parallel_for(chunks.size(), [&](size_t i) {
+            auto &chunk = chunks[i];
+            std::vector<unsigned char> chunk_buf;
+
+            auto data = file_search_load(file, chunk.offset, chunk.size,
+                                         chunk_buf);
+            if (!data) {
+                chunk.ret = data.as_failure();
+                return;
             }
 
-            // Seek to destination offset
-            OUTCOME_TRYV(file.seek(static_cast<int64_t>(
-                    dest + size - size_moved - n_read), SEEK_SET));
+            for (size_t pos = 0; pos + pattern_size <= chunk.size;) {
+                auto n = searcher.find(data.value() + pos, chunk.size - pos);
+                if (n == chunk.size - pos) {
+                    break;
+                }
 
-            // Write data to destination
-            OUTCOME_TRY(n_written, file_write_retry(file, buf, n_read));
+                chunk.matches.push_back(chunk.offset + pos + n);
+                if (chunk_max_matches
+                        && chunk.matches.size() == *chunk_max_matches) {
+                    break;
+                }
 
-            size_moved += n_written;
+                pos += n + pattern_size;
+            }
+        }, tasks, executor);
 
-            if (n_written < n_read) {
-                // Hit EOF. Subtract bytes beyond EOF that we can't copy
-                size -= n_read - n_written;
+        for (auto &chunk : chunks) {
+            OUTCOME_TRYV(chunk.ret);
+
+            auto it = chunk.matches.begin();
+
+            // The previous match overlaps this chunk's first match, so find
+            // the real matches until they line up with the chunk's matches
+            if (it != chunk.matches.end() && *it < next_offset) {
+                uint64_t base = next_offset;
+                auto size = static_cast<size_t>(
+                        chunk.offset + chunk.size - base);
+
+                OUTCOME_TRY(data, file_search_load(file, base, size, buf));
+
+                it = chunk.matches.end();
+
+                for (size_t pos = 0; pos + pattern_size <= size;) {
+                    auto n = searcher.find(data + pos, size - pos);
+                    if (n == size - pos) {
+                        break;
+                    }
+
+                    uint64_t match = base + pos + n;
+
+                    auto found = std::lower_bound(chunk.matches.begin(),
+                                                  chunk.matches.end(), match);
+                    if (found != chunk.matches.end() && *found == match) {
+                        it = found;
+                        break;
+                    }
+
+                    OUTCOME_TRY(cont, report(match));
+                    if (!cont) {
+                        return oc::success();
+                    }
+
+                    pos += n + pattern_size;
+                }
+            }
+
+            for (; it != chunk.matches.end(); ++it) {
+                OUTCOME_TRY(cont, report(*it));
+                if (!cont) {
+                    return oc::success();
+                }
             }
         }
     }
 
-    return size_moved;
+    return oc::success();
+}
+
+/*!
+ * \brief Search memory buffer for binary sequence
+ *
+ * This uses the same search algorithm as file_search(), but searches data that
+ * is already in memory (eg. a kernel image read from a boot image) without
+ * copying it through a read buffer.
+ *
+ * \param data Buffer to search
+ * \param size Size of buffer
+ * \param pattern Pattern to search
+ * \param pattern_size Size of pattern
+ *
+ * \return Offset of the first match or nothing if there is no match or
+ *         \p pattern_size is 0
+ */
+std::optional<size_t> memory_search(const void *data, size_t size,
+                                    const void *pattern, size_t pattern_size)
+{
+    if (pattern_size == 0) {
+        return std::nullopt;
+    }
+
+    PatternSearcher searcher(static_cast<const unsigned char *>(pattern),
+                             pattern_size);
+
+    auto pos = searcher.find(static_cast<const unsigned char *>(data), size);
+    if (pos == size) {
+        return std::nullopt;
+    }
+
+    return pos;
+}
+
+/*! \cond INTERNAL */
+
+/*!
+ * \brief Aho-Corasick automaton for searching multiple patterns in one pass
+ *
+ * The automaton is stored as a full DFA (256 transitions per state) so that
+ * each input byte costs a single table lookup.
+ */
+class MultiPatternMatcher
+{
+public:
+    MultiPatternMatcher(const FileSearchPattern *patterns, size_t count)
+        : m_next(256, 0)
+        , m_outputs(1)
+    {
+        // Build trie
+        for (size_t i = 0; i < count; ++i) {
+            auto data = static_cast<const unsigned char *>(patterns[i].data);
+
+            if (patterns[i].size == 0) {
+                continue;
+            }
+
+            uint32_t state = 0;
+
+            for (size_t j = 0; j < patterns[i].size; ++j) {
+                uint32_t &next = m_next[state * 256 + data[j]];
+                if (next == 0) {
+                    next = static_cast<uint32_t>(m_outputs.size());
+                    m_next.resize(m_next.size() + 256, 0);
+                    m_outputs.emplace_back();
+                }
+                state = m_next[state * 256 + data[j]];
+            }
+
+            m_outputs[state].push_back(i);
+        }
+
+        // Compute failure links breadth-first and turn them into DFA
+        // transitions
+        std::vector<uint32_t> fail(m_outputs.size(), 0);
+        std::vector<uint32_t> queue;
+
+        for (size_t c = 0; c < 256; ++c) {
+            if (m_next[c] != 0) {
+                queue.push_back(m_next[c]);
+            }
+        }
+
+        for (size_t i = 0; i < queue.size(); ++i) {
+            uint32_t state = queue[i];
+
+            // Inherit matches that end at the failure state
+            auto &outputs = m_outputs[state];
+            auto &fail_outputs = m_outputs[fail[state]];
+            outputs.insert(outputs.end(), fail_outputs.begin(),
+                           fail_outputs.end());
+            std::sort(outputs.begin(), outputs.end());
+
+            for (size_t c = 0; c < 256; ++c) {
+                uint32_t &next = m_next[state * 256 + c];
+                uint32_t fail_next = m_next[fail[state] * 256 + c];
+
+                if (next != 0) {
+                    fail[next] = fail_next;
+                    queue.push_back(next);
+                } else {
+                    next = fail_next;
+                }
+            }
+        }
+    }
+
+    uint32_t next(uint32_t state, unsigned char c) const
+    {
+        return m_next[state * 256 + c];
+    }
+
+    const std::vector<size_t> & outputs(uint32_t state) const
+    {
+        return m_outputs[state];
+    }
+
+private:
+    std::vector<uint32_t> m_next;
+    std::vector<std::vector<size_t>> m_outputs;
+};
+
+/*! \endcond */
+
+/*!
+ * \struct FileSearchPattern
+ *
+ * \brief Pattern descriptor for file_search_multi()
+ */
+
+/*!
+ * \typedef FileSearchMultiResultCallback
+ *
+ * \brief Search result callback for file_search_multi()
+ *
+ * This is the same as #FileSearchResultCallback, except that the index of the
+ * matching pattern is also passed.
+ *
+ * \sa file_search_multi()
+ *
+ * \param file File handle
+ * \param index Index of matching pattern
+ * \param offset File offset of search result
+ */
+
+/*!
+ * \brief Search file for multiple binary sequences in a single pass
+ *
+ * This function is similar to file_search(), except that all patterns are
+ * searched for at the same time using the Aho-Corasick algorithm. The file is
+ * only read once regardless of the number of patterns.
+ *
+ * For each pattern, the matches are the same as what file_search() would
+ * report (ie. non-overlapping). Results are reported in order of the end
+ * offset of the match. If multiple patterns match at the same end offset, they
+ * are reported in order of their index. Patterns of size 0 never match.
+ *
+ * If \p bsize is zero, an 8 MiB buffer (or less, down to 64 KiB, if the
+ * ResourceBudget is exhausted) will be used. Since the automaton keeps its
+ * state across reads, the buffer size does not need to be larger than the
+ * patterns.
+ *
+ * If \p file does not support seeking, then the file position must be set to
+ * the beginning of the file before calling this function. Instead of seeking,
+ * the function will read and discard any data before \p start.
+ *
+ * \note The file position after this function returns is undefined. Be sure to
+ *       seek to a known location before attempting further read or write
+ *       operations.
+ *
+ * \param file File handle
+ * \param start Start offset or nothing for beginning of file
+ * \param end End offset or nothing for end of file
+ * \param bsize Buffer size or 0 to automatically choose a size
+ * \param patterns Array of patterns to search
+ * \param count Number of elements in \p patterns
+ * \param max_matches Maximum total number of matches or nothing to find all
+ *                    matches
+ * \param result_cb Callback to invoke upon finding a match
+ *
+ * \return Nothing if the search completes successfully. Otherwise, the error
+ *         code.
+ */
+oc::result<void> file_search_multi(File &file,
+                                   std::optional<uint64_t> start,
+                                   std::optional<uint64_t> end,
+                                   size_t bsize,
+                                   const FileSearchPattern *patterns,
+                                   size_t count,
+                                   std::optional<uint64_t> max_matches,
+                                   const FileSearchMultiResultCallback &result_cb)
+{
+    // Check boundaries
+    if (start && end && *end < *start) {
+        // End offset < start offset
+        return FileError::ArgumentOutOfRange;
+    }
+
+    // Trivial case
+    if ((max_matches && *max_matches == 0) || count == 0) {
+        return oc::success();
+    }
+
+    MultiPatternMatcher matcher(patterns, count);
+
+    BufferLease lease;
+    if (bsize == 0) {
+        lease = BufferLease(DEFAULT_BUFFER_SIZE, MIN_BUFFER_SIZE);
+    }
+
+    std::vector<unsigned char> buf(bsize != 0 ? bsize : lease.size());
+
+    uint64_t offset = start ? *start : 0;
+
+    // Seek to starting point
+    OUTCOME_TRYV(file_search_seek_start(file, offset));
+
+    // Offset where the next non-overlapping match of each pattern may begin
+    std::vector<uint64_t> next_allowed(count, offset);
+    uint32_t state = 0;
+
+    while (!end || offset < *end) {
+        OUTCOME_TRY(n, file_read_retry(file, buf.data(), buf.size()));
+        if (n == 0) {
+            // Reached EOF
+            return oc::success();
+        }
+
+        if (n > UINT64_MAX - offset) {
+            // Read overflows offset value
+            return FileError::IntegerOverflow;
+        }
+
+        // Don't go past the ending boundary
+        if (end && n > *end - offset) {
+            n = static_cast<size_t>(*end - offset);
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            state = matcher.next(state, buf[i]);
+
+            for (size_t index : matcher.outputs(state)) {
+                // Offset of the byte following the match
+                uint64_t match_end = offset + i + 1;
+                uint64_t match_offset = match_end - patterns[index].size;
+
+                if (match_offset < next_allowed[index]) {
+                    continue;
+                }
+                next_allowed[index] = match_end;
+
+                // Invoke callback
+                OUTCOME_TRY(action, result_cb(file, index, match_offset));
+                if (action == FileSearchAction::Stop) {
+                    // Stop searching early
+                    return oc::success();
+                }
+
+                if (max_matches) {
+                    --*max_matches;
+                    if (*max_matches == 0) {
+                        return oc::success();
+                    }
+                }
+            }
+        }
+
+        offset += n;
+    }
+
+    // Artificial EOF
+    return oc::success();
+}
+
+#ifdef __linux__
+
+/*! \cond INTERNAL */
+
+enum class KernelCopyMethod
+{
+    CopyFileRange,
+    Sendfile,
+    Splice,
+};
+
+static bool is_kernel_copy_unsupported(int error)
+{
+    return error == ENOSYS || error == EINVAL || error == EXDEV
+            || error == EOPNOTSUPP || error == ESPIPE || error == EBADF;
+}
+
+static ssize_t kernel_copy_file_range(int fd_in, loff_t *off_in,
+                                      int fd_out, loff_t *off_out, size_t size)
+{
+    // copy_file_range() is not in the seccomp whitelist for Android apps prior
+    // to Android 9, so only use it for the system builds
+#if defined(__NR_copy_file_range) \
+        && (!defined(__ANDROID__) || __ANDROID_API__ >= 28)
+    return static_cast<ssize_t>(syscall(__NR_copy_file_range, fd_in, off_in,
+                                        fd_out, off_out, size, 0u));
+#else
+    (void) fd_in;
+    (void) off_in;
+    (void) fd_out;
+    (void) off_out;
+    (void) size;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static ssize_t kernel_sendfile(int fd_in, int fd_out, size_t size)
+{
+    return sendfile(fd_out, fd_in, nullptr, size);
+}
+
+/*!
+ * \brief Copy data through a pipe with splice()
+ *
+ * \param[out] consumed Set to true if an error occurs after data has already
+ *                      been removed from \p fd_in
+ */
+static ssize_t kernel_splice(int fd_in, int fd_out, const int pipe_fds[2],
+                             size_t size, bool &consumed)
+{
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+    ssize_t n = splice(fd_in, nullptr, pipe_fds[1], nullptr, size,
+                       SPLICE_F_MOVE);
+    if (n <= 0) {
+        return n;
+    }
+
+    for (size_t remain = static_cast<size_t>(n); remain > 0;) {
+        ssize_t m = splice(pipe_fds[0], nullptr, fd_out, nullptr, remain,
+                           SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR) {
+            continue;
+        } else if (m <= 0) {
+            consumed = true;
+            if (m == 0) {
+                errno = EIO;
+            }
+            return -1;
+        }
+
+        remain -= static_cast<size_t>(m);
+    }
+
+    return n;
+#else
+    (void) fd_in;
+    (void) fd_out;
+    (void) pipe_fds;
+    (void) size;
+    (void) consumed;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/*!
+ * \brief Copy data between file descriptors in the kernel
+ *
+ * The methods are tried in order: copy_file_range(), sendfile(), and splice().
+ * A method is skipped if it fails with an error indicating that it does not
+ * support the file types. Since all methods use and advance the file
+ * descriptors' file offsets, switching methods after some data has been copied
+ * is safe.
+ *
+ * \param[in,out] copied Incremented by the number of bytes copied
+ *
+ * \return Whether the copy was completed if no error occurs. Otherwise, the
+ *         error code. If false is returned, the caller should copy the
+ *         remaining data in userspace.
+ */
+static oc::result<bool> file_copy_kernel(int fd_in, int fd_out,
+                                         std::optional<uint64_t> size,
+                                         uint64_t &copied)
+{
+    int pipe_fds[2] = { -1, -1 };
+
+    auto close_pipe = finally([&] {
+        if (pipe_fds[0] >= 0) {
+            close(pipe_fds[0]);
+            close(pipe_fds[1]);
+        }
+    });
+
+    for (auto method : { KernelCopyMethod::CopyFileRange,
+                         KernelCopyMethod::Sendfile,
+                         KernelCopyMethod::Splice }) {
+        if (method == KernelCopyMethod::Splice
+                && pipe2(pipe_fds, O_CLOEXEC) < 0) {
+            pipe_fds[0] = pipe_fds[1] = -1;
+            break;
+        }
+
+        bool first = true;
+
+        while (!size || copied < *size) {
+            auto to_copy = static_cast<size_t>(std::min<uint64_t>(
+                    size ? *size - copied : UINT64_MAX, MAX_KERNEL_COPY_SIZE));
+            bool consumed = false;
+            ssize_t n;
+
+            switch (method) {
+            case KernelCopyMethod::CopyFileRange:
+                n = kernel_copy_file_range(fd_in, nullptr, fd_out,
+                                           nullptr, to_copy);
+                break;
+            case KernelCopyMethod::Sendfile:
+                n = kernel_sendfile(fd_in, fd_out, to_copy);
+                break;
+            case KernelCopyMethod::Splice:
+                n = kernel_splice(fd_in, fd_out, pipe_fds, to_copy, consumed);
+                break;
+            default:
+                MB_UNREACHABLE("Invalid kernel copy method");
+            }
+
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (!consumed && is_kernel_copy_unsupported(errno)) {
+                    break;
+                }
+                return ec_from_errno();
+            } else if (n == 0) {
+                // Some special files (eg. in procfs) report EOF immediately
+                // with copy_file_range(), so let another method confirm it
+                if (first && method == KernelCopyMethod::CopyFileRange) {
+                    break;
+                }
+                return true;
+            }
+
+            copied += static_cast<uint64_t>(n);
+            first = false;
+        }
+
+        if (size && copied == *size) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * \brief Move the tail of a file by inserting or removing filesystem blocks
+ *
+ * \return Whether the data was moved if no error occurs. Otherwise, the error
+ *         code. If false is returned, the filesystem does not support the
+ *         operation or the offsets are not block-aligned.
+ */
+static oc::result<bool> file_move_shift_tail(int fd, uint64_t src,
+                                             uint64_t dest, uint64_t block_size)
+{
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+    int mode;
+    uint64_t offset;
+    uint64_t length;
+
+    if (dest > src) {
+        mode = FALLOC_FL_INSERT_RANGE;
+        offset = src;
+        length = dest - src;
+    } else {
+        mode = FALLOC_FL_COLLAPSE_RANGE;
+        offset = dest;
+        length = src - dest;
+    }
+
+    if (block_size == 0 || offset % block_size != 0
+            || length % block_size != 0 || offset > INT64_MAX
+            || length > INT64_MAX) {
+        return false;
+    }
+
+    while (fallocate64(fd, mode, static_cast<off64_t>(offset),
+                       static_cast<off64_t>(length)) < 0) {
+        if (errno == EINTR) {
+            continue;
+        } else if (is_kernel_copy_unsupported(errno)) {
+            return false;
+        }
+        return ec_from_errno();
+    }
+
+    return true;
+#else
+    (void) fd;
+    (void) src;
+    (void) dest;
+    (void) block_size;
+    return false;
+#endif
+}
+
+/*!
+ * \brief Copy between non-overlapping regions of a file in the kernel
+ *
+ * \return Whether the data was copied if no error occurs. Otherwise, the error
+ *         code. If false is returned, the caller should copy the data in
+ *         userspace. Since the regions do not overlap, it is safe to start over
+ *         even if some data was already copied.
+ */
+static oc::result<bool> file_move_copy_range(int fd, uint64_t src,
+                                             uint64_t dest, uint64_t size)
+{
+    if (src > INT64_MAX - size || dest > INT64_MAX - size) {
+        return false;
+    }
+
+    auto off_in = static_cast<loff_t>(src);
+    auto off_out = static_cast<loff_t>(dest);
+
+    for (uint64_t copied = 0; copied < size;) {
+        auto to_copy = static_cast<size_t>(std::min<uint64_t>(
+                size - copied, MAX_KERNEL_COPY_SIZE));
+
+        ssize_t n = kernel_copy_file_range(fd, &off_in, fd, &off_out, to_copy);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (is_kernel_copy_unsupported(errno)) {
+                return false;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            // The file was truncated in the meantime. Let the userspace copy
+            // handle the EOF.
+            return false;
+        }
+
+        copied += static_cast<uint64_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Move data within a file descriptor without passing it through
+ *        userspace
+ *
+ * This is only attempted when the whole source region lies within the file.
+ * Otherwise, the partial copy semantics of file_move() are left to the
+ * userspace copy.
+ *
+ * \return Whether all of the data was moved if no error occurs. Otherwise, the
+ *         error code.
+ */
+static oc::result<bool> file_move_kernel(int fd, uint64_t src, uint64_t dest,
+                                         uint64_t size, FileMoveFlags flags)
+{
+    struct stat64 sb;
+
+    if (fstat64(fd, &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (!S_ISREG(sb.st_mode) || src + size > static_cast<uint64_t>(sb.st_size)) {
+        return false;
+    }
+
+    bool shift_tail = (flags & FileMoveFlag::ShiftTail)
+            && src + size == static_cast<uint64_t>(sb.st_size);
+
+    if (shift_tail) {
+        OUTCOME_TRY(shifted, file_move_shift_tail(
+                fd, src, dest, static_cast<uint64_t>(sb.st_blksize)));
+        if (shifted) {
+            return true;
+        }
+    }
+
+    if (src + size > dest && dest + size > src) {
+        // copy_file_range() does not allow overlapping regions
+        return false;
+    }
+
+    OUTCOME_TRY(copied, file_move_copy_range(fd, src, dest, size));
+    if (!copied) {
+        return false;
+    }
+
+    if (shift_tail && dest < src) {
+        if (ftruncate64(fd, static_cast<off64_t>(dest + size)) < 0) {
+            return ec_from_errno();
+        }
+    }
+
+    return true;
+}
+
+/*! \endcond */
+
+#endif
+
+/*!
+ * \enum FileMoveFlag
+ *
+ * \brief Flags for file_move()
+ */
+
+/*!
+ * \var FileMoveFlag::ShiftTail
+ *
+ * \brief Source region is the tail of the file
+ *
+ * The file is resized to end at the destination region. The contents between
+ * the old and new locations of the region are unspecified. This allows the
+ * data to be moved by adding or removing filesystem blocks instead of copying
+ * it.
+ */
+
+/*!
+ * \brief Move data in file
+ *
+ * This function is equivalent to `memmove()`, except it operates on a File
+ * handle. The source and destination regions can overlap. In the degenerate
+ * case where \p src == \p dest or \p size == 0, no operation will be performed,
+ * but the function will return \p size accordingly.
+ *
+ * If the handle is backed by a regular file (see File::native_fd()) and the
+ * source region lies entirely within the file, the data is moved in the kernel
+ * where possible:
+ *
+ * - If \ref FileMoveFlag::ShiftTail is set and the filesystem supports it, the
+ *   tail of the file is shifted with `fallocate(FALLOC_FL_INSERT_RANGE)` or
+ *   `fallocate(FALLOC_FL_COLLAPSE_RANGE)`. This only changes the extent
+ *   mappings and requires \p src and \p dest to be multiples of the filesystem
+ *   block size.
+ * - If the regions do not overlap, the data is copied with
+ *   `copy_file_range()`.
+ *
+ * Otherwise, the data is copied through a buffer of up to 1 MiB, depending on
+ * the ResourceBudget. Except for the first and last chunks, the writes are
+ * aligned to 4 KiB.
+ *
+ * \note The userspace copy is very seek-heavy and may be slow if the handle
+ *       cannot seek efficiently. It will perform two seeks per loop interation.
+ *
+ * \note If the return value, \p r, is less than \p size, then the *first* \p r
+ *       bytes have been copied from offset \p src to offset \p dest. This is
+ *       true even if \p src \< \p dest, resulting in a backwards copy.
+ *
+ * \note The file position after this function returns is unspecified.
+ *
+ * \param file File handle
+ * \param src Source offset
+ * \param dest Destination offset
+ * \param size Size of data to move
+ * \param flags Move flags
+ *
+ * \return Size of data that is moved if data is successfully moved. Otherwise,
+ *         the error code.
+ */
+oc::result<uint64_t> file_move(File &file, uint64_t src, uint64_t dest,
+                               uint64_t size, FileMoveFlags flags)
+{
+    // Check if we need to do anything
+    if (src == dest || size == 0) {
+        return size;
+    }
+
+    if (src > UINT64_MAX - size || dest > UINT64_MAX - size) {
+        // Offset + size overflows integer
+        return FileError::ArgumentOutOfRange;
+    }
+
+#ifdef __linux__
+    if (auto fd = file.native_fd()) {
+        OUTCOME_TRY(moved, file_move_kernel(fd.value(), src, dest, size,
+                                            flags));
+        if (moved) {
+            return size;
+        }
+    }
+#endif
+
+    BufferLease lease(COPY_BUFFER_SIZE, MIN_BUFFER_SIZE);
+    std::vector<unsigned char> buf(static_cast<size_t>(
+            std::min<uint64_t>(size, lease.size())));
+
+    // Only align chunks when the buffer holds more than one alignment unit.
+    // Otherwise, aligning could produce empty chunks.
+    uint64_t alignment = buf.size() > MOVE_ALIGNMENT ? MOVE_ALIGNMENT : 1;
+
+    uint64_t size_moved = 0;
+
+    if (dest < src) {
+        // Copy forwards
+        while (size_moved < size) {
+            // End the chunk on an aligned destination offset
+            auto to_read = std::min<uint64_t>(
+                    buf.size() - (dest + size_moved) % alignment,
+                    size - size_moved);
+
+            // Seek to source offset
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(src + size_moved),
+                                   SEEK_SET));
+
+            // Read data from source
+            OUTCOME_TRY(n_read, file_read_retry(
+                    file, buf.data(), static_cast<size_t>(to_read)));
+            if (n_read == 0) {
+                break;
+            }
+
+            // Seek to destination offset
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(dest + size_moved),
+                                   SEEK_SET));
+
+            // Write data to destination
+            OUTCOME_TRY(n_written, file_write_retry(file, buf.data(), n_read));
+
+            size_moved += n_written;
+
+            if (n_written < n_read) {
+                break;
+            }
+        }
+
+        if (flags & FileMoveFlag::ShiftTail) {
+            OUTCOME_TRYV(file.truncate(dest + size_moved));
+        }
+    } else {
+        // Copy backwards
+        while (size_moved < size) {
+            // Start the chunk on an aligned destination offset
+            auto dest_end = dest + size - size_moved;
+            auto to_read = std::min<uint64_t>(
+                    buf.size() - (alignment - dest_end % alignment) % alignment,
+                    size - size_moved);
+
+            // Seek to source offset
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(
+                    src + size - size_moved - to_read), SEEK_SET));
+
+            // Read data form source
+            OUTCOME_TRY(n_read, file_read_retry(
+                    file, buf.data(), static_cast<size_t>(to_read)));
+            if (n_read == 0) {
+                break;
+            }
+
+            // Seek to destination offset
+            OUTCOME_TRYV(file.seek(static_cast<int64_t>(
+                    dest + size - size_moved - n_read), SEEK_SET));
+
+            // Write data to destination
+            OUTCOME_TRY(n_written, file_write_retry(file, buf.data(), n_read));
+
+            size_moved += n_written;
+
+            if (n_written < n_read) {
+                // Hit EOF. Subtract bytes beyond EOF that we can't copy
+                size -= n_read - n_written;
+            }
+        }
+    }
+
+    return size_moved;
+}
+
+/*!
+ * \brief Copy data between File handles
+ *
+ * Copies up to \p size bytes (or until EOF if \p size is std::nullopt) from
+ * the current position of \p in to the current position of \p out. Both
+ * positions are advanced by the number of bytes copied.
+ *
+ * If both handles are backed by file descriptors (see File::native_fd()), the
+ * data is copied in the kernel with `copy_file_range()`, `sendfile()`, or
+ * `splice()`, in that order of preference, without passing through userspace.
+ * Otherwise, or if none of those are supported for the file types, the data is
+ * copied with a read/write loop using a buffer of up to 1 MiB, depending on the
+ * ResourceBudget.
+ *
+ * \note If the return value, \p r, is less than \p size, then EOF was reached
+ *       on \p in or \p out could not accept more data.
+ *
+ * \param in Source file handle
+ * \param out Destination file handle
+ * \param size Maximum number of bytes to copy or std::nullopt to copy until EOF
+ *
+ * \return Number of bytes copied if the copy is successful. Otherwise, the
+ *         error code.
+ */
+oc::result<uint64_t> file_copy(File &in, File &out,
+                               std::optional<uint64_t> size)
+{
+    uint64_t copied = 0;
+
+#ifdef __linux__
+    if (auto fd_in = in.native_fd(), fd_out = out.native_fd();
+            fd_in && fd_out) {
+        OUTCOME_TRY(done, file_copy_kernel(fd_in.value(), fd_out.value(),
+                                           size, copied));
+        if (done) {
+            return copied;
+        }
+    }
+#endif
+
+    BufferLease lease(COPY_BUFFER_SIZE, MIN_BUFFER_SIZE);
+    std::vector<unsigned char> buf(static_cast<size_t>(std::min<uint64_t>(
+            size ? *size - copied : UINT64_MAX, lease.size())));
+
+    while (!size || copied < *size) {
+        auto to_read = static_cast<size_t>(std::min<uint64_t>(
+                size ? *size - copied : UINT64_MAX, buf.size()));
+
+        OUTCOME_TRY(n_read, file_read_retry(in, buf.data(), to_read));
+        if (n_read == 0) {
+            break;
+        }
+
+        OUTCOME_TRY(n_written, file_write_retry(out, buf.data(), n_read));
+
+        copied += n_written;
+
+        if (n_written < n_read) {
+            break;
+        }
+    }
+
+    return copied;
 }
 
 }
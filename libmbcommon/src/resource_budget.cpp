@@ -0,0 +1,374 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbcommon/resource_budget.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "mbcommon/executor.h"
+#include "mbcommon/integer.h"
+
+/*!
+ * \file mbcommon/resource_budget.h
+ * \brief Process-wide memory and thread budget
+ */
+
+namespace mb
+{
+
+/*! \cond INTERNAL */
+// Devices with this much RAM or less run in low-memory mode
+static constexpr uint64_t LOW_MEMORY_THRESHOLD = 1024ull * 1024 * 1024;
+
+// Fraction of the RAM that may be used for I/O buffers
+static constexpr uint64_t BUFFER_DIVISOR = 16;
+static constexpr uint64_t LOW_MEMORY_BUFFER_DIVISOR = 32;
+
+// The buffer budget is never lower than this, so that streaming still makes
+// reasonable progress
+static constexpr size_t MIN_BUFFER_BUDGET = 4 * 1024 * 1024;
+
+// RAM per worker thread in low-memory mode
+static constexpr uint64_t LOW_MEMORY_BYTES_PER_WORKER = 256 * 1024 * 1024;
+
+// Environment variables that override the detected budget
+static constexpr char ENV_LOW_MEMORY[] = "MB_LOW_MEMORY";
+static constexpr char ENV_MAX_BUFFER_SIZE[] = "MB_MAX_BUFFER_SIZE";
+static constexpr char ENV_MAX_WORKERS[] = "MB_MAX_WORKERS";
+/*! \endcond */
+
+static uint64_t detect_memory_size()
+{
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+
+    if (GlobalMemoryStatusEx(&status)) {
+        return status.ullTotalPhys;
+    }
+#else
+    FILE *fp = fopen("/proc/meminfo", "rb");
+    if (!fp) {
+        return 0;
+    }
+
+    char line[256];
+    uint64_t kib = 0;
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "MemTotal: %" SCNu64 " kB", &kib) == 1) {
+            break;
+        }
+    }
+
+    fclose(fp);
+
+    if (kib != 0 && kib <= UINT64_MAX / 1024) {
+        return kib * 1024;
+    }
+#endif
+
+    return 0;
+}
+
+/*!
+ * \class ResourceBudget
+ *
+ * \brief Limits for memory-hungry and parallel operations.
+ *
+ * The budget is detected from the amount of RAM when it is first used. On
+ * devices with 1 GiB of RAM or less, such as older devices in recovery, it is
+ * in low-memory mode and allows fewer worker threads and smaller buffers.
+ *
+ * The following environment variables override the detected values:
+ *
+ * * `MB_LOW_MEMORY`: `1` or `0` to enable or disable low-memory mode
+ * * `MB_MAX_BUFFER_SIZE`: Maximum total size of the I/O buffers in bytes
+ * * `MB_MAX_WORKERS`: Maximum number of worker threads
+ *
+ * The buffer budget is not a hard limit. Code that sizes its buffers
+ * heuristically obtains them through BufferLease and falls back to smaller
+ * buffers when the budget is exhausted, so that large operations are streamed
+ * in smaller pieces instead of getting the process killed.
+ */
+
+ResourceBudget::ResourceBudget()
+    : m_memory_size(detect_memory_size())
+    , m_low_memory(m_memory_size != 0 && m_memory_size <= LOW_MEMORY_THRESHOLD)
+    , m_max_buffer_size(0)
+    , m_max_workers(0)
+    , m_reserved(0)
+{
+    apply_env();
+}
+
+/*!
+ * \brief Get the process-wide budget
+ *
+ * The budget is never destroyed, so it can be used during static destruction.
+ */
+ResourceBudget & ResourceBudget::global()
+{
+    static ResourceBudget *budget = new ResourceBudget();
+    return *budget;
+}
+
+/*!
+ * \brief Amount of RAM in bytes or 0 if it could not be determined
+ */
+uint64_t ResourceBudget::memory_size() const
+{
+    return m_memory_size;
+}
+
+/*!
+ * \brief Whether the budget is in low-memory mode
+ */
+bool ResourceBudget::low_memory() const
+{
+    return m_low_memory;
+}
+
+/*!
+ * \brief Enable or disable low-memory mode
+ *
+ * This resets the buffer and worker limits to the defaults for the mode and
+ * updates the concurrency of the global Executor.
+ *
+ * \param low_memory Whether to use low-memory mode
+ */
+void ResourceBudget::set_low_memory(bool low_memory)
+{
+    m_low_memory = low_memory;
+    apply_defaults();
+
+    Executor::global().set_concurrency(m_max_workers);
+}
+
+/*!
+ * \brief Maximum total size of the heuristically sized I/O buffers
+ */
+size_t ResourceBudget::max_buffer_size() const
+{
+    return m_max_buffer_size;
+}
+
+/*!
+ * \brief Set maximum total size of the heuristically sized I/O buffers
+ *
+ * Existing leases are not affected.
+ *
+ * \param size Maximum size in bytes
+ */
+void ResourceBudget::set_max_buffer_size(size_t size)
+{
+    m_max_buffer_size = size;
+}
+
+/*!
+ * \brief Maximum number of worker threads
+ */
+unsigned int ResourceBudget::max_workers() const
+{
+    return m_max_workers;
+}
+
+/*!
+ * \brief Set maximum number of worker threads
+ *
+ * This also sets the concurrency of the global Executor.
+ *
+ * \param workers Maximum number of worker threads (at least 1)
+ */
+void ResourceBudget::set_max_workers(unsigned int workers)
+{
+    m_max_workers = std::max(workers, 1u);
+
+    Executor::global().set_concurrency(m_max_workers);
+}
+
+/*!
+ * \brief Get number of buffers of a certain size that fit in the budget
+ *
+ * This is meant for pipelines that keep several buffers in flight. Unlike
+ * BufferLease, it only considers the total budget and not the buffers that
+ * are currently leased.
+ *
+ * \param buffer_size Size of each buffer
+ * \param preferred Number of buffers that the caller would like to use
+ * \param minimum Number of buffers that the caller needs
+ *
+ * \return Number of buffers in [min(\p minimum, \p preferred), \p preferred]
+ */
+size_t ResourceBudget::buffer_count(size_t buffer_size, size_t preferred,
+                                    size_t minimum) const
+{
+    if (buffer_size == 0) {
+        return preferred;
+    }
+
+    return std::clamp<size_t>(m_max_buffer_size / buffer_size,
+                              std::min(minimum, preferred), preferred);
+}
+
+void ResourceBudget::apply_defaults()
+{
+    size_t max_buffer_size = std::numeric_limits<size_t>::max();
+    unsigned int max_workers = std::numeric_limits<unsigned int>::max();
+
+    if (m_memory_size != 0) {
+        uint64_t buffer_size = m_memory_size
+                / (m_low_memory ? LOW_MEMORY_BUFFER_DIVISOR : BUFFER_DIVISOR);
+
+        max_buffer_size = static_cast<size_t>(std::clamp<uint64_t>(
+                buffer_size, MIN_BUFFER_BUDGET,
+                std::numeric_limits<size_t>::max()));
+
+        if (m_low_memory) {
+            max_workers = static_cast<unsigned int>(std::max<uint64_t>(
+                    m_memory_size / LOW_MEMORY_BYTES_PER_WORKER, 1));
+        }
+    } else if (m_low_memory) {
+        max_buffer_size = MIN_BUFFER_BUDGET;
+        max_workers = 1;
+    }
+
+    m_max_buffer_size = max_buffer_size;
+    m_max_workers = max_workers;
+}
+
+void ResourceBudget::apply_env()
+{
+    if (const char *value = getenv(ENV_LOW_MEMORY)) {
+        m_low_memory = strcmp(value, "1") == 0;
+    }
+
+    apply_defaults();
+
+    size_t max_buffer_size;
+    unsigned int max_workers;
+
+    if (const char *value = getenv(ENV_MAX_BUFFER_SIZE);
+            value && str_to_num(value, 10, max_buffer_size)) {
+        m_max_buffer_size = max_buffer_size;
+    }
+
+    if (const char *value = getenv(ENV_MAX_WORKERS);
+            value && str_to_num(value, 10, max_workers) && max_workers > 0) {
+        m_max_workers = max_workers;
+    }
+}
+
+size_t ResourceBudget::reserve(size_t preferred, size_t minimum)
+{
+    size_t reserved = m_reserved;
+    size_t max_size = m_max_buffer_size;
+    size_t available = reserved < max_size ? max_size - reserved : 0;
+
+    size_t size = std::max(std::min(preferred, available),
+                           std::min(minimum, preferred));
+
+    m_reserved += size;
+
+    return size;
+}
+
+void ResourceBudget::release(size_t size)
+{
+    m_reserved -= size;
+}
+
+/*!
+ * \class BufferLease
+ *
+ * \brief Reservation of part of the global buffer budget.
+ *
+ * The lease is for the preferred size if it fits in the remaining budget and
+ * for a smaller size, down to the minimum, otherwise. The minimum is always
+ * granted. The reservation is returned when the lease is destroyed.
+ *
+ * \note The lease itself does not allocate memory. The caller should size its
+ *       buffer with size().
+ */
+
+/*!
+ * \brief Construct empty lease
+ */
+BufferLease::BufferLease() noexcept
+    : m_size(0)
+{
+}
+
+/*!
+ * \brief Lease up to \p preferred bytes of the buffer budget
+ *
+ * \param preferred Size that the caller would like to use
+ * \param minimum Size that the caller needs. This is capped at \p preferred.
+ */
+BufferLease::BufferLease(size_t preferred, size_t minimum)
+    : m_size(ResourceBudget::global().reserve(preferred, minimum))
+{
+}
+
+BufferLease::~BufferLease()
+{
+    if (m_size > 0) {
+        ResourceBudget::global().release(m_size);
+    }
+}
+
+BufferLease::BufferLease(BufferLease &&other) noexcept
+    : m_size(other.m_size)
+{
+    other.m_size = 0;
+}
+
+BufferLease & BufferLease::operator=(BufferLease &&rhs) noexcept
+{
+    if (this != &rhs) {
+        if (m_size > 0) {
+            ResourceBudget::global().release(m_size);
+        }
+
+        m_size = rhs.m_size;
+        rhs.m_size = 0;
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Leased size in bytes
+ */
+size_t BufferLease::size() const
+{
+    return m_size;
+}
+
+}
@@ -161,44 +161,165 @@ std::string format(const char *fmt, ...)
  * \return Resulting formatted string or error.
  */
 oc::result<std::string> format_v_safe(const char *fmt, va_list ap)
+{
+    std::string buf;
+
+    OUTCOME_TRYV(format_v_to_safe(buf, fmt, ap));
+
+    return std::move(buf);
+}
+
+/*!
+ * \brief Format a string using a `va_list`
+ *
+ * \note This uses the `*printf()` family of functions in the system's C
+ *       library. The format string may not be understood the same way by every
+ *       platform.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are preserved if
+ *       this function does not fail.
+ *
+ * \param fmt Format string
+ * \param ap Format arguments as `va_list`
+ *
+ * \return Resulting formatted string.
+ * \throws std::exception If an error occurs while formatting the string.
+ */
+std::string format_v(const char *fmt, va_list ap)
+{
+    auto result = format_v_safe(fmt, ap);
+    if (!result) {
+        // TODO: This should use exceptions to report errors, but we currently
+        // don't support them due to the substantial size increase of the
+        // compiled binaries.
+        std::terminate();
+    }
+    return std::move(result.value());
+}
+
+/*!
+ * \brief Append a formatted string to an existing string
+ *
+ * \note This uses the `*printf()` family of functions in the system's C
+ *       library. The format string may not be understood the same way by every
+ *       platform.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are always
+ *       preserved.
+ *
+ * \param[out] out String to append to. It is left unmodified if an error
+ *                 occurs.
+ * \param fmt Format string
+ * \param ... Format arguments
+ *
+ * \return Nothing if successful. Otherwise, the error.
+ */
+oc::result<void> format_to_safe(std::string &out, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    auto result = format_v_to_safe(out, fmt, ap);
+    va_end(ap);
+
+    return result;
+}
+
+/*!
+ * \brief Append a formatted string to an existing string
+ *
+ * \note This uses the `*printf()` family of functions in the system's C
+ *       library. The format string may not be understood the same way by every
+ *       platform.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are preserved if
+ *       this function does not fail.
+ *
+ * \param[out] out String to append to
+ * \param fmt Format string
+ * \param ... Format arguments
+ *
+ * \throws std::exception If an error occurs while formatting the string.
+ */
+void format_to(std::string &out, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    format_v_to(out, fmt, ap);
+    va_end(ap);
+}
+
+/*!
+ * \brief Append a formatted string to an existing string using a `va_list`
+ *
+ * Short results are formatted into a stack buffer with a single `vsnprintf()`
+ * call. The arguments are only formatted a second time, directly into \p out,
+ * if the result does not fit.
+ *
+ * \note This uses the `*printf()` family of functions in the system's C
+ *       library. The format string may not be understood the same way by every
+ *       platform.
+ *
+ * \note The value of `errno` and `GetLastError()` (on Win32) are always
+ *       preserved.
+ *
+ * \param[out] out String to append to. It is left unmodified if an error
+ *                 occurs.
+ * \param fmt Format string
+ * \param ap Format arguments as `va_list`
+ *
+ * \return Nothing if successful. Otherwise, the error.
+ */
+oc::result<void> format_v_to_safe(std::string &out, const char *fmt,
+                                  va_list ap)
 {
     static_assert(INT_MAX <= SIZE_MAX, "INT_MAX > SIZE_MAX");
 
     ErrorRestorer restorer;
+    char stack_buf[512];
     int ret;
     va_list copy;
-    std::string buf;
 
     va_copy(copy, ap);
-    ret = vsnprintf(nullptr, 0, fmt, copy);
+    ret = vsnprintf(stack_buf, sizeof(stack_buf), fmt, copy);
     va_end(copy);
 
     if (ret < 0) {
         return ec_from_errno();
-    } else if (static_cast<size_t>(ret) == SIZE_MAX) {
+    }
+
+    auto size = static_cast<size_t>(ret);
+
+    if (size < sizeof(stack_buf)) {
+        out.append(stack_buf, size);
+        return oc::success();
+    } else if (size >= SIZE_MAX - out.size()) {
         return std::make_error_code(std::errc::value_too_large);
     }
 
     // C++11 guarantees that the memory is contiguous, but does not guarantee
     // that the internal buffer is NULL-terminated, so we'll make room for '\0'
     // and then get rid of it.
-    buf.resize(static_cast<size_t>(ret) + 1);
+    auto old_size = out.size();
+    out.resize(old_size + size + 1);
 
     va_copy(copy, ap);
-    ret = vsnprintf(buf.data(), buf.size(), fmt, copy);
+    ret = vsnprintf(out.data() + old_size, size + 1, fmt, copy);
     va_end(copy);
 
     if (ret < 0) {
+        out.resize(old_size);
         return ec_from_errno();
     }
 
-    buf.resize(static_cast<size_t>(ret));
+    out.resize(old_size + static_cast<size_t>(ret));
 
-    return std::move(buf);
+    return oc::success();
 }
 
 /*!
- * \brief Format a string using a `va_list`
+ * \brief Append a formatted string to an existing string using a `va_list`
  *
  * \note This uses the `*printf()` family of functions in the system's C
  *       library. The format string may not be understood the same way by every
@@ -207,22 +328,20 @@ oc::result<std::string> format_v_safe(const char *fmt, va_list ap)
  * \note The value of `errno` and `GetLastError()` (on Win32) are preserved if
  *       this function does not fail.
  *
+ * \param[out] out String to append to
  * \param fmt Format string
  * \param ap Format arguments as `va_list`
  *
- * \return Resulting formatted string.
  * \throws std::exception If an error occurs while formatting the string.
  */
-std::string format_v(const char *fmt, va_list ap)
+void format_v_to(std::string &out, const char *fmt, va_list ap)
 {
-    auto result = format_v_safe(fmt, ap);
-    if (!result) {
+    if (!format_v_to_safe(out, fmt, ap)) {
         // TODO: This should use exceptions to report errors, but we currently
         // don't support them due to the substantial size increase of the
         // compiled binaries.
         std::terminate();
     }
-    return std::move(result.value());
 }
 
 /*!
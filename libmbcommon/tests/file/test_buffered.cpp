@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "mbcommon/file/buffered.h"
+#include "mbcommon/file_error.h"
+
+#include "mock_test_file.h"
+
+using namespace mb;
+using namespace testing;
+
+struct FileBufferedTest : Test
+{
+    TestFileCounters _counters;
+    NiceMock<MockTestFile> _file{&_counters};
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_file.open());
+        _counters = {};
+    }
+};
+
+TEST_F(FileBufferedTest, OpenFailsIfUnderlyingFileIsClosed)
+{
+    TestFile file;
+
+    BufferedFile bfile;
+    auto ret = bfile.open(&file, 16);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST_F(FileBufferedTest, OpenFailsIfBufferSizeIsZero)
+{
+    BufferedFile bfile;
+    auto ret = bfile.open(&_file, 0);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileBufferedTest, CloseDoesNotCloseUnderlyingFile)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+    ASSERT_TRUE(bfile.close());
+    ASSERT_TRUE(_file.is_open());
+    ASSERT_EQ(_counters.n_close, 0u);
+}
+
+TEST_F(FileBufferedTest, SmallReadsAreCoalesced)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    for (size_t i = 0; i < 16; ++i) {
+        auto n = bfile.read(&c, 1);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), 1u);
+        ASSERT_EQ(c, static_cast<char>('a' + i % 26));
+    }
+    ASSERT_EQ(_counters.n_read, 1u);
+
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(c, 'a' + 16);
+    ASSERT_EQ(_counters.n_read, 2u);
+}
+
+TEST_F(FileBufferedTest, LargeReadsBypassBuffer)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char buf[32];
+    EXPECT_CALL(_file, on_read(buf, sizeof(buf)))
+            .Times(1);
+
+    auto n = bfile.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+}
+
+TEST_F(FileBufferedTest, ReadReturnsBufferedDataFirst)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char buf[32];
+    ASSERT_TRUE(bfile.read(buf, 4));
+
+    auto n = bfile.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 12u);
+    ASSERT_EQ(buf[0], 'e');
+}
+
+TEST_F(FileBufferedTest, SeekWithinReadBuffer)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+    _counters = {};
+
+    auto pos = bfile.seek(10, SEEK_SET);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 10u);
+
+    pos = bfile.seek(-5, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 5u);
+
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(c, 'f');
+
+    ASSERT_EQ(_counters.n_seek, 0u);
+    ASSERT_EQ(_counters.n_read, 0u);
+}
+
+TEST_F(FileBufferedTest, SeekOutsideReadBufferInvalidates)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+
+    auto pos = bfile.seek(10, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 11u);
+
+    pos = bfile.seek(20, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 31u);
+    ASSERT_EQ(_file._position, 31u);
+
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(c, 'a' + 31 % 26);
+}
+
+TEST_F(FileBufferedTest, SeekEndInvalidates)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+
+    auto pos = bfile.seek(-1, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), INITIAL_BUF_SIZE - 1);
+
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(c, 'a' + (INITIAL_BUF_SIZE - 1) % 26);
+}
+
+TEST_F(FileBufferedTest, FailedSeekKeepsPosition)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+
+    auto pos = bfile.seek(-2, SEEK_CUR);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::ArgumentOutOfRange);
+
+    pos = bfile.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 1u);
+}
+
+TEST_F(FileBufferedTest, SmallWritesAreCoalesced)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    for (size_t i = 0; i < 16; ++i) {
+        auto n = bfile.write("x", 1);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), 1u);
+    }
+    ASSERT_EQ(_counters.n_write, 0u);
+
+    auto pos = bfile.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 16u);
+
+    ASSERT_TRUE(bfile.write("x", 1));
+    ASSERT_EQ(_counters.n_write, 1u);
+    ASSERT_EQ(_file._position, 16u);
+
+    ASSERT_TRUE(bfile.flush());
+    ASSERT_EQ(_counters.n_write, 2u);
+    ASSERT_EQ(_file._position, 17u);
+    ASSERT_EQ(_file._buf[16], 'x');
+}
+
+TEST_F(FileBufferedTest, LargeWritesBypassBuffer)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    ASSERT_TRUE(bfile.write("x", 1));
+
+    char buf[32] = {};
+    {
+        InSequence seq;
+
+        EXPECT_CALL(_file, on_write(_, 1))
+                .Times(1);
+        EXPECT_CALL(_file, on_write(buf, sizeof(buf)))
+                .Times(1);
+    }
+
+    auto n = bfile.write(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+}
+
+TEST_F(FileBufferedTest, CloseFlushesWrites)
+{
+    {
+        BufferedFile bfile(&_file, 16);
+        ASSERT_TRUE(bfile.is_open());
+        ASSERT_TRUE(bfile.write("xyz", 3));
+        ASSERT_EQ(_counters.n_write, 0u);
+    }
+
+    ASSERT_EQ(_counters.n_write, 1u);
+    ASSERT_EQ(memcmp(_file._buf.data(), "xyz", 3), 0);
+}
+
+TEST_F(FileBufferedTest, WriteAfterReadGivesBackReadAhead)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(_file._position, 16u);
+
+    ASSERT_TRUE(bfile.write("x", 1));
+    ASSERT_EQ(_file._position, 1u);
+    ASSERT_TRUE(bfile.flush());
+    ASSERT_EQ(_file._position, 2u);
+    ASSERT_EQ(_file._buf[1], 'x');
+}
+
+TEST_F(FileBufferedTest, ReadAfterWriteFlushes)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    ASSERT_TRUE(bfile.write("xy", 2));
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(c, 'c');
+    ASSERT_EQ(_file._buf[0], 'x');
+    ASSERT_EQ(_file._buf[1], 'y');
+}
+
+TEST_F(FileBufferedTest, WriteFailureIsFatal)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    ASSERT_TRUE(bfile.write("x", 1));
+
+    EXPECT_CALL(_file, on_write(_, _))
+            .WillOnce(Return(std::make_error_code(std::errc::io_error)));
+
+    auto ret = bfile.flush();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::io_error);
+
+    ASSERT_FALSE(bfile.write("x", 1));
+}
+
+TEST_F(FileBufferedTest, TruncateFlushesWrites)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    ASSERT_TRUE(bfile.write("xyz", 3));
+    ASSERT_TRUE(bfile.truncate(2));
+    ASSERT_EQ(_file._buf.size(), 2u);
+    ASSERT_EQ(_file._buf[1], 'y');
+}
+
+TEST_F(FileBufferedTest, PositionalReadSeesPendingWrites)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    ASSERT_TRUE(bfile.write("xyz", 3));
+
+    char buf[3];
+    auto n = bfile.read_at(0, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+    ASSERT_EQ(memcmp(buf, "xyz", 3), 0);
+
+    auto pos = bfile.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 3u);
+}
+
+TEST_F(FileBufferedTest, PositionalWriteInvalidatesReadBuffer)
+{
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+
+    ASSERT_TRUE(bfile.write_at(1, "x", 1));
+
+    ASSERT_TRUE(bfile.read(&c, 1));
+    ASSERT_EQ(c, 'x');
+}
+
+TEST_F(FileBufferedTest, UnseekableFileReadOnly)
+{
+    ON_CALL(_file, on_seek(_, _))
+            .WillByDefault(Return(FileError::UnsupportedSeek));
+
+    BufferedFile bfile(&_file, 16);
+    ASSERT_TRUE(bfile.is_open());
+
+    char c;
+    ASSERT_TRUE(bfile.read(&c, 1));
+
+    auto pos = bfile.seek(0, SEEK_CUR);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::UnsupportedSeek);
+
+    auto n = bfile.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedSeek);
+}
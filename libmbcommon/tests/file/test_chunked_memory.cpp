@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file/chunked_memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+TEST(FileChunkedMemoryTest, OpenFailsIfChunkSizeIsZero)
+{
+    ChunkedMemoryFile file;
+    auto ret = file.open(0);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST(FileChunkedMemoryTest, WriteAcrossChunks)
+{
+    ChunkedMemoryFile file(4);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcdefghij", 10));
+    ASSERT_EQ(file.size(), 10u);
+
+    auto chunks = file.chunks();
+    ASSERT_EQ(chunks.size(), 3u);
+    ASSERT_EQ(chunks[0].size, 4u);
+    ASSERT_EQ(chunks[1].size, 4u);
+    ASSERT_EQ(chunks[2].size, 2u);
+    ASSERT_EQ(memcmp(chunks[1].data, "efgh", 4), 0);
+
+    auto data = file.flatten();
+    ASSERT_EQ(data, std::vector<unsigned char>(
+            reinterpret_cast<const unsigned char *>("abcdefghij"),
+            reinterpret_cast<const unsigned char *>("abcdefghij") + 10));
+
+    ASSERT_TRUE(file.seek(3, SEEK_SET));
+
+    char buf[6];
+    ASSERT_TRUE(file_read_exact(file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "defghi", 6), 0);
+}
+
+TEST(FileChunkedMemoryTest, WriteAfterSeekPastEndZeroFills)
+{
+    ChunkedMemoryFile file(4);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(6, SEEK_SET));
+    ASSERT_TRUE(file_write_exact(file, "x", 1));
+
+    auto data = file.flatten();
+    ASSERT_EQ(data, (std::vector<unsigned char>{0, 0, 0, 0, 0, 0, 'x'}));
+}
+
+TEST(FileChunkedMemoryTest, TruncateDoesNotExposeOldData)
+{
+    ChunkedMemoryFile file(4);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcdefghij", 10));
+    ASSERT_TRUE(file.truncate(5));
+    ASSERT_EQ(file.size(), 5u);
+    ASSERT_EQ(file.chunks().size(), 2u);
+
+    ASSERT_TRUE(file.truncate(10));
+    auto data = file.flatten();
+    ASSERT_EQ(data, (std::vector<unsigned char>{
+            'a', 'b', 'c', 'd', 'e', 0, 0, 0, 0, 0}));
+}
+
+TEST(FileChunkedMemoryTest, PositionalIo)
+{
+    ChunkedMemoryFile file(4);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(2, "abcdef", 6);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+
+    char buf[8];
+    n = file.read_at(1, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 7u);
+    ASSERT_EQ(memcmp(buf, "\0abcdef", 7), 0);
+}
+
+TEST(FileChunkedMemoryTest, DataRetainedUntilReopened)
+{
+    ChunkedMemoryFile file(4);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcdef", 6));
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(file.size(), 6u);
+
+    ASSERT_TRUE(file.open(4));
+    ASSERT_EQ(file.size(), 0u);
+}
+
+TEST(FileChunkedMemoryTest, ViewAtStopsAtChunkBoundary)
+{
+    ChunkedMemoryFile file(4);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_write_exact(file, "abcdefghij", 10));
+
+    auto view = file.view_at(2, 8);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().size, 2u);
+    ASSERT_EQ(memcmp(view.value().data, "cd", 2), 0);
+
+    view = file.view_at(8, 8);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().size, 2u);
+    ASSERT_EQ(memcmp(view.value().data, "ij", 2), 0);
+
+    view = file.view_at(10, 1);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().size, 0u);
+}
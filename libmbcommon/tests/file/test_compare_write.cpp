@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstdlib>
+
+#include "mbcommon/file/compare_write.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+struct FileCompareWriteTest : testing::Test
+{
+    std::vector<unsigned char> _target;
+    std::vector<unsigned char> _data;
+
+    void SetUp() override
+    {
+        for (size_t i = 0; i < 40; ++i) {
+            _target.push_back(static_cast<unsigned char>(i));
+        }
+        _data = _target;
+    }
+
+    void write_data(File &file, size_t block_size, uint64_t start = 0)
+    {
+        ASSERT_TRUE(file.seek(static_cast<int64_t>(start), SEEK_SET));
+
+        CompareWriteFile cwfile(&file, block_size);
+        ASSERT_TRUE(cwfile.is_open());
+
+        // Small writes so that blocks are made up of multiple writes
+        for (size_t i = start; i < _data.size(); i += 3) {
+            size_t n = std::min<size_t>(3, _data.size() - i);
+            ASSERT_TRUE(file_write_exact(cwfile, _data.data() + i, n));
+        }
+
+        ASSERT_TRUE(cwfile.close());
+
+        _blocks_compared = cwfile.blocks_compared();
+        _blocks_written = cwfile.blocks_written();
+    }
+
+    uint64_t _blocks_compared = 0;
+    uint64_t _blocks_written = 0;
+};
+
+TEST_F(FileCompareWriteTest, OpenFailsIfUnderlyingFileIsClosed)
+{
+    MemoryFile file;
+
+    CompareWriteFile cwfile;
+    auto ret = cwfile.open(&file, 16);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST_F(FileCompareWriteTest, OpenFailsIfBlockSizeIsZero)
+{
+    MemoryFile file(_target.data(), _target.size());
+
+    CompareWriteFile cwfile;
+    auto ret = cwfile.open(&file, 0);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileCompareWriteTest, IdenticalDataIsNotWritten)
+{
+    MemoryFile file(_target.data(), _target.size());
+    file.set_stats_enabled(true);
+
+    write_data(file, 16);
+
+    ASSERT_EQ(_blocks_compared, 3u);
+    ASSERT_EQ(_blocks_written, 0u);
+    ASSERT_EQ(file.stats()->bytes_written, 0u);
+}
+
+TEST_F(FileCompareWriteTest, OnlyChangedBlocksAreWritten)
+{
+    _data[20] = 0xff;
+    _data[39] = 0xff;
+
+    MemoryFile file(_target.data(), _target.size());
+    file.set_stats_enabled(true);
+
+    write_data(file, 16);
+
+    ASSERT_EQ(_target, _data);
+    ASSERT_EQ(_blocks_compared, 3u);
+    ASSERT_EQ(_blocks_written, 2u);
+    ASSERT_EQ(file.stats()->bytes_written, 16u + 8u);
+}
+
+TEST_F(FileCompareWriteTest, BlocksAreAlignedToUnderlyingFile)
+{
+    _data[35] = 0xff;
+
+    MemoryFile file(_target.data(), _target.size());
+    file.set_stats_enabled(true);
+
+    write_data(file, 16, 10);
+
+    // Blocks are [10, 16), [16, 32), and [32, 40)
+    ASSERT_EQ(_target, _data);
+    ASSERT_EQ(_blocks_compared, 3u);
+    ASSERT_EQ(_blocks_written, 1u);
+    ASSERT_EQ(file.stats()->bytes_written, 8u);
+}
+
+TEST_F(FileCompareWriteTest, DataPastEndIsWritten)
+{
+    void *buf = nullptr;
+    size_t size = 0;
+
+    {
+        MemoryFile file;
+        ASSERT_TRUE(file.open(&buf, &size));
+
+        write_data(file, 16);
+    }
+
+    ASSERT_EQ(size, _data.size());
+    ASSERT_EQ(memcmp(buf, _data.data(), size), 0);
+    ASSERT_EQ(_blocks_written, 3u);
+
+    free(buf);
+}
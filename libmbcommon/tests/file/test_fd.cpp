@@ -47,6 +47,18 @@ struct MockFdFileFuncs : public FdFileFuncs
     MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
     MOCK_METHOD3(fn_read, ssize_t(int fd, void *buf, size_t count));
     MOCK_METHOD3(fn_write, ssize_t(int fd, const void *buf, size_t count));
+#ifndef _WIN32
+    MOCK_METHOD4(fn_pread64, ssize_t(int fd, void *buf, size_t count,
+                                     off64_t offset));
+    MOCK_METHOD4(fn_pwrite64, ssize_t(int fd, const void *buf, size_t count,
+                                      off64_t offset));
+
+    // sys/uio.h
+    MOCK_METHOD3(fn_readv, ssize_t(int fd, const struct iovec *iov,
+                                   int iovcnt));
+    MOCK_METHOD3(fn_writev, ssize_t(int fd, const struct iovec *iov,
+                                    int iovcnt));
+#endif
 
     struct stat _sb_regfile{};
 
@@ -74,6 +86,18 @@ struct MockFdFileFuncs : public FdFileFuncs
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
         ON_CALL(*this, fn_write(testing::_, testing::_, testing::_))
                 .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#ifndef _WIN32
+        ON_CALL(*this, fn_pread64(testing::_, testing::_, testing::_,
+                                  testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_pwrite64(testing::_, testing::_, testing::_,
+                                   testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_readv(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_writev(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+#endif
     }
 
     void report_as_regular_file()
@@ -259,6 +283,18 @@ TEST_F(FileFdTest, OpenFile)
     ASSERT_TRUE(file.open(0, false));
 }
 
+TEST_F(FileFdTest, NativeFd)
+{
+    _funcs.report_as_regular_file();
+
+    TestableFdFile file(&_funcs, 3, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto fd = file.native_fd();
+    ASSERT_TRUE(fd);
+    ASSERT_EQ(fd.value(), 3);
+}
+
 TEST_F(FileFdTest, CloseUnownedFile)
 {
     _funcs.report_as_regular_file();
@@ -555,3 +591,173 @@ TEST_F(FileFdTest, TruncateFailed)
     ASSERT_FALSE(result);
     ASSERT_EQ(result.error(), std::errc::io_error);
 }
+
+#ifndef _WIN32
+TEST_F(FileFdTest, ReadAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    // Ensure that pread is used instead of seek + read
+    EXPECT_CALL(_funcs, fn_pread64(0, testing::_, 1, 100))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_read(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read_at(100, &c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileFdTest, ReadAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read_at(100, &c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+TEST_F(FileFdTest, ReadAtOutOfRange)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pread64(testing::_, testing::_, testing::_,
+                                   testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char c;
+    auto n = file.read_at(static_cast<uint64_t>(INT64_MAX) + 1, &c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileFdTest, WriteAtSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(0, testing::_, 1, 100))
+            .Times(1)
+            .WillOnce(testing::ReturnArg<2>());
+    EXPECT_CALL(_funcs, fn_lseek64(testing::_, testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_write(testing::_, testing::_, testing::_))
+            .Times(0);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(100, "x", 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+}
+
+TEST_F(FileFdTest, WriteAtFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_pwrite64(testing::_, testing::_, testing::_,
+                                    testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(100, "x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+TEST_F(FileFdTest, ReadvSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_readv(0, testing::_, 2))
+            .Times(1)
+            .WillOnce(testing::Return(6));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[2];
+    char b[4];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+}
+
+TEST_F(FileFdTest, ReadvFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_readv(testing::_, testing::_, testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[2];
+    FileIoVec iov[] = { { a, sizeof(a) } };
+
+    auto n = file.readv(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+TEST_F(FileFdTest, WritevSuccess)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_writev(0, testing::_, 2))
+            .Times(1)
+            .WillOnce(testing::Return(6));
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[] = "ab";
+    char b[] = "cdef";
+    FileIoVec iov[] = { { a, 2 }, { b, 4 } };
+
+    auto n = file.writev(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+}
+
+TEST_F(FileFdTest, WritevFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_writev(testing::_, testing::_, testing::_))
+            .Times(1);
+
+    TestableFdFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+
+    char a[] = "ab";
+    FileIoVec iov[] = { { a, 2 } };
+
+    auto n = file.writev(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+#endif
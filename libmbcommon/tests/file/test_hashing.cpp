@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "mbcommon/file/hashing.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+// Digests of "abc"
+static constexpr char SHA1_ABC[] =
+        "a9993e364706816aba3e25717850c26c9cd0d89d";
+static constexpr char SHA256_ABC[] =
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad";
+static constexpr char SHA512_ABC[] =
+        "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea20a9eeee64b55d39a"
+        "2192992a274fc1a836ba3c23a3feebbd454d4423643ce80e2a9ac94fa54ca49f";
+
+static std::string digest_hex(HashingFile &file, HashAlgorithm algorithm)
+{
+    auto digest = file.digest(algorithm);
+    if (!digest) {
+        return {};
+    }
+
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string result;
+
+    for (unsigned char c : digest.value()) {
+        result += digits[c >> 4];
+        result += digits[c & 0xf];
+    }
+
+    return result;
+}
+
+TEST(FileHashingTest, OpenFailsIfUnderlyingFileIsClosed)
+{
+    MemoryFile file;
+
+    HashingFile hfile;
+    auto ret = hfile.open(&file, HashAlgorithm::Sha1);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST(FileHashingTest, HashWrittenData)
+{
+    void *buf = nullptr;
+    size_t buf_size = 0;
+    MemoryFile file(&buf, &buf_size);
+    ASSERT_TRUE(file.is_open());
+
+    HashingFile hfile(&file, HashAlgorithm::Sha1 | HashAlgorithm::Sha256
+            | HashAlgorithm::Sha512);
+    ASSERT_TRUE(hfile.is_open());
+
+    ASSERT_TRUE(file_write_exact(hfile, "a", 1));
+    ASSERT_TRUE(file_write_exact(hfile, "bc", 2));
+
+    ASSERT_EQ(digest_hex(hfile, HashAlgorithm::Sha1), SHA1_ABC);
+    ASSERT_EQ(digest_hex(hfile, HashAlgorithm::Sha256), SHA256_ABC);
+    ASSERT_EQ(digest_hex(hfile, HashAlgorithm::Sha512), SHA512_ABC);
+
+    ASSERT_TRUE(hfile.close());
+    ASSERT_EQ(buf_size, 3u);
+
+    free(buf);
+}
+
+TEST(FileHashingTest, HashReadData)
+{
+    char data[] = "abc";
+    MemoryFile file(data, 3);
+    ASSERT_TRUE(file.is_open());
+
+    HashingFile hfile(&file, HashAlgorithm::Sha256);
+    ASSERT_TRUE(hfile.is_open());
+
+    char buf[2];
+    ASSERT_TRUE(file_read_exact(hfile, buf, 2));
+
+    // Digest can be queried in the middle of the stream
+    ASSERT_NE(digest_hex(hfile, HashAlgorithm::Sha256), SHA256_ABC);
+
+    ASSERT_TRUE(file_read_exact(hfile, buf, 1));
+    ASSERT_EQ(digest_hex(hfile, HashAlgorithm::Sha256), SHA256_ABC);
+
+    // Rewinding to the end of the hashed stream is allowed
+    ASSERT_TRUE(hfile.seek(1, SEEK_SET));
+    ASSERT_TRUE(hfile.seek(0, SEEK_END));
+    auto n = hfile.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+    ASSERT_EQ(digest_hex(hfile, HashAlgorithm::Sha256), SHA256_ABC);
+}
+
+TEST(FileHashingTest, UnselectedAlgorithm)
+{
+    char data[] = "abc";
+    MemoryFile file(data, 3);
+    ASSERT_TRUE(file.is_open());
+
+    HashingFile hfile(&file, HashAlgorithm::Sha1);
+    ASSERT_TRUE(hfile.is_open());
+
+    auto digest = hfile.digest(HashAlgorithm::Sha512);
+    ASSERT_FALSE(digest);
+    ASSERT_EQ(digest.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST(FileHashingTest, NonSequentialAccessInvalidatesDigest)
+{
+    char data[] = "abc";
+    MemoryFile file(data, 3);
+    ASSERT_TRUE(file.is_open());
+
+    HashingFile hfile(&file, HashAlgorithm::Sha1);
+    ASSERT_TRUE(hfile.is_open());
+
+    char buf[1];
+    ASSERT_TRUE(hfile.seek(1, SEEK_SET));
+    ASSERT_TRUE(file_read_exact(hfile, buf, 1));
+
+    auto digest = hfile.digest(HashAlgorithm::Sha1);
+    ASSERT_FALSE(digest);
+    ASSERT_EQ(digest.error(), FileError::InvalidState);
+}
+
+TEST(FileHashingTest, ReadAtDoesNotAffectDigest)
+{
+    char data[] = "abc";
+    MemoryFile file(data, 3);
+    ASSERT_TRUE(file.is_open());
+
+    HashingFile hfile(&file, HashAlgorithm::Sha1);
+    ASSERT_TRUE(hfile.is_open());
+
+    char buf[3];
+    ASSERT_TRUE(hfile.read_at(1, buf, 2));
+    ASSERT_TRUE(file_read_exact(hfile, buf, 3));
+    ASSERT_EQ(digest_hex(hfile, HashAlgorithm::Sha1), SHA1_ABC);
+}
@@ -239,6 +239,70 @@ TEST(FileStaticMemoryTest, CheckTruncateUnsupported)
     ASSERT_EQ(result.error(), FileError::UnsupportedTruncate);
 }
 
+TEST(FileStaticMemoryTest, ReadAtInBounds)
+{
+    char in[] = "abcdef";
+    constexpr size_t in_size = 6;
+    char out[4];
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.read_at(4, out, sizeof(out));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(out, "ef", 2), 0);
+
+    // File position should be unchanged
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
+
+TEST(FileStaticMemoryTest, ReadAtOutOfBounds)
+{
+    char in[] = "x";
+    constexpr size_t in_size = 1;
+    char out[1];
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.read_at(10, out, sizeof(out));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST(FileStaticMemoryTest, ReadAtEmptyFile)
+{
+    char out[1];
+
+    MemoryFile file(static_cast<void *>(nullptr), 0);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.read_at(0, out, sizeof(out));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST(FileStaticMemoryTest, WriteAtInBounds)
+{
+    char in[] = "abc";
+    constexpr size_t in_size = 3;
+
+    MemoryFile file(in, in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(1, "yz", 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(in, "ayz", 3), 0);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
+
 TEST(FileDynamicMemoryTest, OpenFile)
 {
     void *in = nullptr;
@@ -522,3 +586,48 @@ TEST(FileDynamicMemoryTest, TruncateFile)
 
     free(in);
 }
+
+TEST(FileDynamicMemoryTest, WriteAtOutOfBounds)
+{
+    void *in = strdup("x");
+    size_t in_size = 1;
+
+    MemoryFile file(&in, &in_size);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write_at(4, "y", 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+    ASSERT_EQ(in_size, 5u);
+    ASSERT_EQ(memcmp(in, "x\0\0\0y", 5), 0);
+
+    // File position should be unchanged
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+
+    free(in);
+}
+
+TEST(FileStaticMemoryTest, ViewAtShouldPointIntoBuffer)
+{
+    char buf[] = "abcdef";
+
+    MemoryFile file(buf, 6);
+    ASSERT_TRUE(file.is_open());
+
+    auto view = file.view_at(2, 10);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().data, buf + 2);
+    ASSERT_EQ(view.value().size, 4u);
+
+    // Past EOF
+    view = file.view_at(6, 1);
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view.value().size, 0u);
+
+    // File position should be unchanged
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
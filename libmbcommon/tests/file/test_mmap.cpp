@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "mbcommon/file.h"
+#include "mbcommon/file/mmap.h"
+
+using namespace mb;
+using namespace mb::detail;
+
+struct MockMmapFileFuncs : public MmapFileFuncs
+{
+    // fcntl.h
+    MOCK_METHOD3(fn_open, int(const char *path, int flags, mode_t mode));
+
+    // sys/mman.h
+    MOCK_METHOD6(fn_mmap, void *(void *addr, size_t length, int prot,
+                                 int flags, int fd, off_t offset));
+    MOCK_METHOD2(fn_munmap, int(void *addr, size_t length));
+
+    // sys/stat.h
+    MOCK_METHOD2(fn_fstat, int(int fildes, struct stat *buf));
+
+    // unistd.h
+    MOCK_METHOD1(fn_close, int(int fd));
+    MOCK_METHOD3(fn_lseek64, off64_t(int fd, off64_t offset, int whence));
+
+    char _contents[27] = "abcdefghijklmnopqrstuvwxyz";
+    struct stat _sb_regfile{};
+
+    MockMmapFileFuncs()
+    {
+        _sb_regfile.st_mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO;
+        _sb_regfile.st_size = 26;
+
+        // Fail everything by default
+        ON_CALL(*this, fn_open(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                               testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, MAP_FAILED));
+        ON_CALL(*this, fn_munmap(testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_fstat(testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_close(testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+        ON_CALL(*this, fn_lseek64(testing::_, testing::_, testing::_))
+                .WillByDefault(testing::SetErrnoAndReturn(EIO, -1));
+    }
+
+    void report_as_regular_file()
+    {
+        ON_CALL(*this, fn_fstat(testing::_, testing::_))
+                .WillByDefault(testing::DoAll(
+                        testing::SetArgPointee<1>(_sb_regfile),
+                        testing::Return(0)));
+    }
+
+    void map_with_success()
+    {
+        ON_CALL(*this, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                               testing::_, testing::_))
+                .WillByDefault(testing::Return(_contents));
+        ON_CALL(*this, fn_munmap(testing::_, testing::_))
+                .WillByDefault(testing::Return(0));
+    }
+};
+
+class TestableMmapFile : public MmapFile
+{
+public:
+    TestableMmapFile(MmapFileFuncs *funcs)
+        : MmapFile(funcs)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, int fd, bool owned)
+        : MmapFile(funcs, fd, owned)
+    {
+    }
+
+    TestableMmapFile(MmapFileFuncs *funcs, const std::string &filename)
+        : MmapFile(funcs, filename)
+    {
+    }
+
+    ~TestableMmapFile()
+    {
+    }
+};
+
+struct FileMmapTest : testing::Test
+{
+    testing::NiceMock<MockMmapFileFuncs> _funcs;
+};
+
+TEST_F(FileMmapTest, OpenFilenameSuccess)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_open(testing::_, O_RDONLY | O_CLOEXEC, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+    EXPECT_CALL(_funcs, fn_mmap(nullptr, 26u, PROT_READ, MAP_PRIVATE, 0, 0))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open("x"));
+    ASSERT_EQ(file.data(), reinterpret_cast<unsigned char *>(_funcs._contents));
+    ASSERT_EQ(file.size(), 26u);
+}
+
+TEST_F(FileMmapTest, OpenFilenameFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_open(testing::_, testing::_, testing::_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open("x");
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, OpenDirectory)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    EXPECT_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                     testing::Return(0)));
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open(0, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::is_a_directory);
+}
+
+TEST_F(FileMmapTest, OpenBlockDevice)
+{
+    struct stat sb{};
+    sb.st_mode = S_IFBLK | S_IRWXU | S_IRWXG | S_IRWXO;
+
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                     testing::Return(0)));
+    EXPECT_CALL(_funcs, fn_lseek64(0, 0, SEEK_END))
+            .Times(1)
+            .WillOnce(testing::Return(10));
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, 10u, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(1);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open(0, false));
+    ASSERT_EQ(file.size(), 10u);
+}
+
+TEST_F(FileMmapTest, OpenEmptyFile)
+{
+    struct stat sb = _funcs._sb_regfile;
+    sb.st_size = 0;
+
+    EXPECT_CALL(_funcs, fn_fstat(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::DoAll(testing::SetArgPointee<1>(sb),
+                                     testing::Return(0)));
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(_funcs, fn_munmap(testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    ASSERT_TRUE(file.open(0, false));
+    ASSERT_EQ(file.data(), nullptr);
+    ASSERT_EQ(file.size(), 0u);
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, OpenMmapFailure)
+{
+    _funcs.report_as_regular_file();
+
+    EXPECT_CALL(_funcs, fn_mmap(testing::_, testing::_, testing::_, testing::_,
+                                testing::_, testing::_))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_munmap(testing::_, testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs);
+    auto result = file.open(0, false);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::io_error);
+}
+
+TEST_F(FileMmapTest, CloseUnownedFile)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    // Ensure that the mapping is removed, but the fd is not closed
+    EXPECT_CALL(_funcs, fn_munmap(_funcs._contents, 26u))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(testing::_))
+            .Times(0);
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+    ASSERT_EQ(file.data(), nullptr);
+    ASSERT_EQ(file.size(), 0u);
+}
+
+TEST_F(FileMmapTest, CloseOwnedFile)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    EXPECT_CALL(_funcs, fn_munmap(_funcs._contents, 26u))
+            .Times(1);
+    EXPECT_CALL(_funcs, fn_close(testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+
+    TestableMmapFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+    ASSERT_TRUE(file.close());
+}
+
+TEST_F(FileMmapTest, CloseFailure)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    // The fd should still be closed if the unmap fails
+    EXPECT_CALL(_funcs, fn_munmap(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::SetErrnoAndReturn(EINVAL, -1));
+    EXPECT_CALL(_funcs, fn_close(testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(0));
+
+    TestableMmapFile file(&_funcs, 0, true);
+    ASSERT_TRUE(file.is_open());
+    auto result = file.close();
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), std::errc::invalid_argument);
+}
+
+TEST_F(FileMmapTest, ReadSuccess)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_EQ(memcmp(buf, "abcd", 4), 0);
+
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_EQ(memcmp(buf, "efgh", 4), 0);
+}
+
+TEST_F(FileMmapTest, ReadEof)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto pos = file.seek(-2, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 24u);
+
+    char buf[4];
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(buf, "yz", 2), 0);
+
+    n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, ReadOutOfBounds)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(100, SEEK_SET));
+
+    char c;
+    auto n = file.read(&c, 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FileMmapTest, WriteUnsupported)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto n = file.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedWrite);
+}
+
+TEST_F(FileMmapTest, TruncateUnsupported)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    auto result = file.truncate(10);
+    ASSERT_FALSE(result);
+    ASSERT_EQ(result.error(), FileError::UnsupportedTruncate);
+}
+
+TEST_F(FileMmapTest, SeekNormal)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    // SEEK_SET
+    auto pos = file.seek(10, SEEK_SET);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 10u);
+
+    // Positive SEEK_CUR
+    pos = file.seek(10, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 20u);
+
+    // Negative SEEK_CUR
+    pos = file.seek(-8, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 12u);
+
+    // Negative SEEK_END
+    pos = file.seek(-18, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 8u);
+}
+
+TEST_F(FileMmapTest, SeekInvalid)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    // Negative SEEK_SET
+    auto pos = file.seek(-10, SEEK_SET);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::ArgumentOutOfRange);
+
+    // Negative out of range SEEK_CUR
+    pos = file.seek(-10, SEEK_CUR);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::ArgumentOutOfRange);
+
+    // Negative out of range SEEK_END
+    pos = file.seek(-30, SEEK_END);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FileMmapTest, ReadAtSuccess)
+{
+    _funcs.report_as_regular_file();
+    _funcs.map_with_success();
+
+    TestableMmapFile file(&_funcs, 0, false);
+    ASSERT_TRUE(file.is_open());
+
+    char buf[4];
+    auto n = file.read_at(24, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(buf, "yz", 2), 0);
+
+    n = file.read_at(100, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    // File position should be unchanged
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 0u);
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/prefetch.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+#include "mock_test_file.h"
+
+using namespace mb;
+using namespace testing;
+
+struct FilePrefetchTest : Test
+{
+    std::vector<unsigned char> _data;
+    MemoryFile _file;
+
+    void SetUp() override
+    {
+        _data.resize(10000);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i * 7);
+        }
+
+        ASSERT_TRUE(_file.open(_data.data(), _data.size()));
+    }
+};
+
+TEST_F(FilePrefetchTest, OpenFailsIfUnderlyingFileIsClosed)
+{
+    MemoryFile file;
+
+    PrefetchFile pfile;
+    auto ret = pfile.open(&file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST_F(FilePrefetchTest, OpenFailsIfBufferSizeIsZero)
+{
+    PrefetchFile pfile;
+    auto ret = pfile.open(&_file, 4, 0);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FilePrefetchTest, ReadEntireFile)
+{
+    PrefetchFile pfile(&_file, 3, 64);
+    ASSERT_TRUE(pfile.is_open());
+
+    std::vector<unsigned char> out(_data.size() + 1);
+    auto n = file_read_retry(pfile, out.data(), out.size());
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), _data.size());
+    out.resize(n.value());
+    ASSERT_EQ(out, _data);
+
+    // Further reads report EOF
+    n = pfile.read(out.data(), 1);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+}
+
+TEST_F(FilePrefetchTest, ReadBufferSizedFile)
+{
+    MemoryFile file(_data.data(), 128);
+    ASSERT_TRUE(file.is_open());
+
+    PrefetchFile pfile(&file, 2, 64);
+    ASSERT_TRUE(pfile.is_open());
+
+    unsigned char buf[256];
+    auto n = file_read_retry(pfile, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 128u);
+}
+
+TEST_F(FilePrefetchTest, SeekDiscardsPrefetchedData)
+{
+    PrefetchFile pfile(&_file, 4, 16);
+    ASSERT_TRUE(pfile.is_open());
+
+    unsigned char c;
+    ASSERT_TRUE(file_read_exact(pfile, &c, 1));
+    ASSERT_EQ(c, _data[0]);
+
+    auto pos = pfile.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 1u);
+
+    pos = pfile.seek(100, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 101u);
+    ASSERT_TRUE(file_read_exact(pfile, &c, 1));
+    ASSERT_EQ(c, _data[101]);
+
+    pos = pfile.seek(-2, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 100u);
+    ASSERT_TRUE(file_read_exact(pfile, &c, 1));
+    ASSERT_EQ(c, _data[100]);
+
+    pos = pfile.seek(-1, SEEK_END);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), _data.size() - 1);
+    ASSERT_TRUE(file_read_exact(pfile, &c, 1));
+    ASSERT_EQ(c, _data.back());
+
+    pos = pfile.seek(5, SEEK_SET);
+    ASSERT_TRUE(pos);
+    ASSERT_TRUE(file_read_exact(pfile, &c, 1));
+    ASSERT_EQ(c, _data[5]);
+}
+
+TEST_F(FilePrefetchTest, SeekBeforeBeginningFails)
+{
+    PrefetchFile pfile(&_file, 4, 16);
+    ASSERT_TRUE(pfile.is_open());
+
+    auto pos = pfile.seek(-1, SEEK_CUR);
+    ASSERT_FALSE(pos);
+    ASSERT_EQ(pos.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(FilePrefetchTest, WriteIsUnsupported)
+{
+    PrefetchFile pfile(&_file);
+    ASSERT_TRUE(pfile.is_open());
+
+    auto n = pfile.write("x", 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedWrite);
+}
+
+TEST_F(FilePrefetchTest, CloseWhileWorkerIsBlocked)
+{
+    PrefetchFile pfile(&_file, 1, 16);
+    ASSERT_TRUE(pfile.is_open());
+
+    // The worker fills the only buffer and then waits for the consumer
+    unsigned char c;
+    ASSERT_TRUE(file_read_exact(pfile, &c, 1));
+    ASSERT_TRUE(pfile.close());
+}
+
+TEST_F(FilePrefetchTest, ReadErrorIsReported)
+{
+    NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    EXPECT_CALL(file, on_read(_, _))
+            .WillOnce(Return(std::make_error_code(std::errc::io_error)));
+
+    PrefetchFile pfile(&file, 2, 16);
+    ASSERT_TRUE(pfile.is_open());
+
+    unsigned char c;
+    auto n = pfile.read(&c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+    ASSERT_TRUE(pfile.is_fatal());
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/file/uring.h"
+#include "mbcommon/file_error.h"
+#include "mbcommon/file_util.h"
+
+using namespace mb;
+
+struct FileUringTest : testing::Test
+{
+    std::unique_ptr<FILE, decltype(fclose) *> _fp{nullptr, &fclose};
+    std::vector<unsigned char> _data;
+
+    void SetUp() override
+    {
+        _fp.reset(tmpfile());
+        ASSERT_TRUE(_fp);
+
+        // Not a multiple of the buffer size
+        _data.resize(UringFile::BUFFER_SIZE * 3 + UringFile::BUFFER_SIZE / 2
+                     + 123);
+        for (size_t i = 0; i < _data.size(); ++i) {
+            _data[i] = static_cast<unsigned char>(i * 7 + i / 251);
+        }
+    }
+
+    int dup_fd()
+    {
+        return dup(fileno(_fp.get()));
+    }
+
+    // Write in chunks that straddle the buffer boundaries
+    void write_data(File &file)
+    {
+        for (size_t pos = 0; pos < _data.size();) {
+            size_t n = std::min<size_t>(10000, _data.size() - pos);
+            ASSERT_TRUE(file_write_exact(file, _data.data() + pos, n));
+            pos += n;
+        }
+    }
+};
+
+TEST_F(FileUringTest, WriteThenReadBack)
+{
+    UringFile file(dup_fd(), true);
+    ASSERT_TRUE(file.is_open());
+
+    write_data(file);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), _data.size());
+
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+
+    std::vector<unsigned char> result;
+    unsigned char buf[7777];
+
+    while (true) {
+        auto n = file.read(buf, sizeof(buf));
+        ASSERT_TRUE(n);
+        if (n.value() == 0) {
+            break;
+        }
+        result.insert(result.end(), buf, buf + n.value());
+    }
+
+    ASSERT_EQ(result, _data);
+
+    // Stays at EOF
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 0u);
+
+    ASSERT_TRUE(file.close());
+
+    struct stat sb;
+    ASSERT_EQ(fstat(fileno(_fp.get()), &sb), 0);
+    ASSERT_EQ(static_cast<uint64_t>(sb.st_size), _data.size());
+}
+
+TEST_F(FileUringTest, DescriptorOffsetSyncedAfterDrain)
+{
+    UringFile file(dup_fd(), true);
+    ASSERT_TRUE(file.is_open());
+
+    write_data(file);
+
+    ASSERT_TRUE(file.truncate(_data.size()));
+
+    ASSERT_EQ(lseek(fileno(_fp.get()), 0, SEEK_CUR),
+              static_cast<off_t>(_data.size()));
+}
+
+TEST_F(FileUringTest, PositionalIoSeesQueuedWrites)
+{
+    UringFile file(dup_fd(), true);
+    ASSERT_TRUE(file.is_open());
+
+    write_data(file);
+
+    unsigned char buf[100];
+    auto n = file.read_at(_data.size() - sizeof(buf), buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+    ASSERT_TRUE(std::equal(buf, buf + sizeof(buf),
+                           _data.end() - sizeof(buf)));
+
+    // Overwrite queued read-ahead data
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+    ASSERT_TRUE(file_read_exact(file, buf, 10));
+    n = file.write_at(10, "abcd", 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+    ASSERT_TRUE(file_read_exact(file, buf, 4));
+    ASSERT_EQ(memcmp(buf, "abcd", 4), 0);
+}
+
+TEST_F(FileUringTest, DirectIoWriteThenReadBack)
+{
+    UringFile file(dup_fd(), true);
+    ASSERT_TRUE(file.is_open());
+
+    // Not every file system supports O_DIRECT
+    bool direct = file.enable_direct_io();
+    ASSERT_EQ(file.uses_direct_io(), direct);
+    if (!file.uses_uring()) {
+        ASSERT_FALSE(direct);
+    }
+
+    write_data(file);
+
+    // The final partial buffer is written through the page cache
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+    ASSERT_FALSE(file.uses_direct_io());
+
+    std::vector<unsigned char> result(_data.size());
+    ASSERT_TRUE(file_read_exact(file, result.data(), result.size()));
+    ASSERT_EQ(result, _data);
+
+    ASSERT_TRUE(file.close());
+
+    struct stat sb;
+    ASSERT_EQ(fstat(fileno(_fp.get()), &sb), 0);
+    ASSERT_EQ(static_cast<uint64_t>(sb.st_size), _data.size());
+}
+
+TEST_F(FileUringTest, NativeFdUnsupportedWhileQueueing)
+{
+    UringFile file(dup_fd(), true);
+    ASSERT_TRUE(file.is_open());
+
+    if (file.uses_uring()) {
+        auto fd = file.native_fd();
+        ASSERT_FALSE(fd);
+        ASSERT_EQ(fd.error(), FileError::UnsupportedNativeFd);
+    }
+}
+
+TEST_F(FileUringTest, FallbackForPipes)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    UringFile in_file(fds[0], true);
+    ASSERT_TRUE(in_file.is_open());
+    ASSERT_FALSE(in_file.uses_uring());
+
+    UringFile out_file(fds[1], true);
+    ASSERT_TRUE(out_file.is_open());
+    ASSERT_FALSE(out_file.uses_uring());
+    ASSERT_TRUE(out_file.native_fd());
+
+    ASSERT_TRUE(file_write_exact(out_file, "hello", 5));
+    ASSERT_TRUE(out_file.close());
+
+    char buf[5];
+    ASSERT_TRUE(file_read_exact(in_file, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "hello", 5), 0);
+}
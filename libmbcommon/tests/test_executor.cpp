@@ -0,0 +1,272 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/executor.h"
+
+using namespace mb;
+
+TEST(ExecutorTest, ParallelForVisitsEachIndexOnce)
+{
+    Executor executor(4);
+    std::vector<std::atomic_int> counts(1000);
+
+    parallel_for(counts.size(), [&](size_t i) {
+        ++counts[i];
+    }, 0, executor);
+
+    for (auto const &count : counts) {
+        ASSERT_EQ(count, 1);
+    }
+}
+
+TEST(ExecutorTest, ParallelForWithNoIndexes)
+{
+    Executor executor(2);
+    bool called = false;
+
+    parallel_for(0, [&](size_t) {
+        called = true;
+    }, 0, executor);
+
+    ASSERT_FALSE(called);
+}
+
+TEST(ExecutorTest, NestedParallelForDoesNotDeadlock)
+{
+    Executor executor(2);
+    std::atomic_int total{0};
+
+    parallel_for(8, [&](size_t) {
+        parallel_for(8, [&](size_t) {
+            ++total;
+        }, 0, executor);
+    }, 0, executor);
+
+    ASSERT_EQ(total, 64);
+}
+
+TEST(ExecutorTest, ParallelForUntilStopsAfterFailure)
+{
+    using namespace std::chrono_literals;
+
+    Executor executor(2);
+    std::atomic_int calls{0};
+
+    bool ret = parallel_for_until(1000, [&](size_t i) {
+        ++calls;
+        if (i == 0) {
+            return false;
+        }
+        std::this_thread::sleep_for(1ms);
+        return true;
+    }, 0, executor);
+
+    ASSERT_FALSE(ret);
+    ASSERT_LT(calls, 1000);
+}
+
+TEST(ExecutorTest, TryParallelForReturnsFirstError)
+{
+    Executor executor(1);
+    int calls = 0;
+
+    auto ret = try_parallel_for(10, [&](size_t i) -> oc::result<void> {
+        ++calls;
+        if (i >= 5) {
+            return std::make_error_code(
+                    i == 5 ? std::errc::invalid_argument : std::errc::io_error);
+        }
+        return oc::success();
+    }, 0, executor);
+
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), std::errc::invalid_argument);
+    ASSERT_EQ(calls, 6);
+}
+
+TEST(ExecutorTest, ConcurrencyLimitIsRespected)
+{
+    using namespace std::chrono_literals;
+
+    Executor executor(4);
+    executor.set_concurrency(2);
+    ASSERT_EQ(executor.concurrency(), 2u);
+
+    std::atomic_int running{0};
+    std::atomic_int max_running{0};
+
+    parallel_for(16, [&](size_t) {
+        int n = ++running;
+        int prev = max_running;
+        while (n > prev && !max_running.compare_exchange_weak(prev, n)) {
+        }
+        std::this_thread::sleep_for(1ms);
+        --running;
+    }, 0, executor);
+
+    ASSERT_GE(max_running, 1);
+    ASSERT_LE(max_running, 2);
+
+    executor.set_concurrency(0);
+    ASSERT_EQ(executor.concurrency(), 1u);
+    executor.set_concurrency(100);
+    ASSERT_EQ(executor.concurrency(), 4u);
+}
+
+TEST(ExecutorTest, GroupWaitsForAllTasks)
+{
+    Executor executor(3);
+    std::atomic_int done{0};
+
+    {
+        TaskGroup group(executor);
+
+        for (int i = 0; i < 100; ++i) {
+            group.run([&] {
+                ++done;
+            });
+        }
+
+        group.wait();
+        ASSERT_EQ(done, 100);
+
+        // Destructor waits too
+        for (int i = 0; i < 100; ++i) {
+            group.run([&] {
+                ++done;
+            });
+        }
+    }
+
+    ASSERT_EQ(done, 200);
+}
+
+TEST(ExecutorTest, WaitOnlyRunsTasksOfOwnGroup)
+{
+    Executor executor(1);
+    TaskGroup blocker(executor);
+    TaskGroup other(executor);
+    TaskGroup mine(executor);
+    std::atomic_bool started{false};
+    std::atomic_bool release{false};
+    std::atomic_bool other_ran{false};
+    std::atomic_bool mine_ran{false};
+
+    // Keep the only worker busy so that queued tasks can only be run by
+    // waiting threads
+    blocker.run([&] {
+        started = true;
+        while (!release) {
+            std::this_thread::yield();
+        }
+    });
+
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    other.run([&] {
+        other_ran = true;
+    });
+    mine.run([&] {
+        mine_ran = true;
+    });
+
+    mine.wait();
+
+    // Don't return before the blocker is released
+    EXPECT_TRUE(mine_ran);
+    EXPECT_FALSE(other_ran);
+
+    release = true;
+    other.wait();
+    blocker.wait();
+
+    ASSERT_TRUE(other_ran);
+}
+
+TEST(ExecutorTest, CancelledGroupSkipsPendingTasks)
+{
+    Executor executor(1);
+    TaskGroup group(executor);
+    std::atomic_bool release{false};
+    std::atomic_int ran{0};
+
+    // Keep the only worker busy, if it started the task before the group was
+    // cancelled
+    group.run([&] {
+        while (!release) {
+            std::this_thread::yield();
+        }
+        ++ran;
+    });
+
+    group.cancel();
+
+    for (int i = 0; i < 10; ++i) {
+        group.run([&] {
+            ++ran;
+        });
+    }
+
+    ASSERT_TRUE(group.is_cancelled());
+    release = true;
+    group.wait();
+
+    // The first task may or may not have started before the group was
+    // cancelled, but none of the later tasks run
+    ASSERT_LE(ran, 1);
+}
+
+TEST(ExecutorTest, ThreadSetupRunsBeforeTasks)
+{
+    static thread_local bool set_up = false;
+
+    Executor executor(2);
+    auto caller = std::this_thread::get_id();
+    std::atomic_int missing{0};
+
+    auto check = [&] {
+        if (std::this_thread::get_id() != caller && !set_up) {
+            ++missing;
+        }
+    };
+
+    // Start the workers before the setup function is set
+    parallel_for(100, [&](size_t) {}, 0, executor);
+
+    executor.set_thread_setup([] {
+        set_up = true;
+    });
+
+    TaskGroup group(executor);
+    for (int i = 0; i < 100; ++i) {
+        group.run(check);
+    }
+    group.wait();
+
+    ASSERT_EQ(missing, 0);
+}
@@ -20,6 +20,7 @@
 #include <gmock/gmock.h>
 
 #include <cinttypes>
+#include <vector>
 
 #include "mbcommon/file.h"
 #include "mbcommon/string.h"
@@ -480,3 +481,310 @@ TEST(FileTest, TruncateReturnFailure)
     ASSERT_FALSE(file.is_fatal());
     ASSERT_EQ(file.state(), FileState::Opened);
 }
+
+TEST(FileTest, ReadAtFallback)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // Save position, seek to offset, read, and restore position
+    {
+        testing::InSequence seq;
+
+        EXPECT_CALL(file, on_seek(0, SEEK_CUR))
+                .Times(1);
+        EXPECT_CALL(file, on_seek(100, SEEK_SET))
+                .Times(1);
+        EXPECT_CALL(file, on_read(testing::_, 10))
+                .Times(1);
+        EXPECT_CALL(file, on_seek(5, SEEK_SET))
+                .Times(1);
+    }
+
+    // Open file
+    ASSERT_TRUE(file.open());
+    file._position = 5;
+
+    // Read from file
+    char buf[10];
+    auto n = file.read_at(100, buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(buf));
+    ASSERT_EQ(memcmp(buf, file._buf.data() + 100, sizeof(buf)), 0);
+    ASSERT_EQ(file._position, 5u);
+}
+
+TEST(FileTest, ReadAtInWrongState)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_seek(testing::_, testing::_))
+            .Times(0);
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(0);
+
+    // Read from file
+    char c;
+    auto n = file.read_at(0, &c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::InvalidState);
+    ASSERT_EQ(file.state(), FileState::New);
+}
+
+TEST(FileTest, ReadAtSeekFailure)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_seek(testing::_, testing::_))
+            .Times(1)
+            .WillOnce(testing::Return(FileError::UnsupportedSeek));
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(0);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // Read from file
+    char c;
+    auto n = file.read_at(0, &c, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::UnsupportedSeek);
+}
+
+TEST(FileTest, WriteAtFallback)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    {
+        testing::InSequence seq;
+
+        EXPECT_CALL(file, on_seek(0, SEEK_CUR))
+                .Times(1);
+        EXPECT_CALL(file, on_seek(100, SEEK_SET))
+                .Times(1);
+        EXPECT_CALL(file, on_write(testing::_, 5))
+                .Times(1);
+        EXPECT_CALL(file, on_seek(0, SEEK_SET))
+                .Times(1);
+    }
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    // Write to file
+    auto n = file.write_at(100, "Hello", 5);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 5u);
+    ASSERT_EQ(memcmp(file._buf.data() + 100, "Hello", 5), 0);
+    ASSERT_EQ(file._position, 0u);
+}
+
+TEST(FileTest, ReadvFallback)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char a[3];
+    char b[5];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(a) + sizeof(b));
+    ASSERT_EQ(memcmp(a, file._buf.data(), sizeof(a)), 0);
+    ASSERT_EQ(memcmp(b, file._buf.data() + sizeof(a), sizeof(b)), 0);
+}
+
+TEST(FileTest, ReadvFallbackShortRead)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // Second buffer should not be read after first short read
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(1);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+    ASSERT_TRUE(file.seek(-2, SEEK_END));
+
+    char a[3];
+    char b[5];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+}
+
+TEST(FileTest, ReadvFallbackPartialFailure)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(2)
+            .WillOnce(testing::Return(3u))
+            .WillOnce(testing::Return(std::error_code{}));
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char a[3];
+    char b[5];
+    FileIoVec iov[] = { { a, sizeof(a) }, { b, sizeof(b) } };
+
+    // Data that was already read should be reported instead of the error
+    auto n = file.readv(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+}
+
+TEST(FileTest, WritevFallback)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(2);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char a[] = "Hello, ";
+    char b[] = "world!";
+    FileIoVec iov[] = { { a, strlen(a) }, { b, strlen(b) } };
+
+    auto n = file.writev(iov, 2);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 13u);
+    ASSERT_EQ(memcmp(file._buf.data(), "Hello, world!", 13), 0);
+}
+
+TEST(FileTest, WritevInWrongState)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    EXPECT_CALL(file, on_write(testing::_, testing::_))
+            .Times(0);
+
+    char a[] = "x";
+    FileIoVec iov[] = { { a, 1 } };
+
+    auto n = file.writev(iov, 1);
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), FileError::InvalidState);
+    ASSERT_EQ(file.state(), FileState::New);
+}
+
+TEST(FileTest, NativeFdUnsupportedByDefault)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    auto fd = file.native_fd();
+    ASSERT_FALSE(fd);
+    ASSERT_EQ(fd.error(), FileError::UnsupportedNativeFd);
+}
+
+TEST(FileTest, StatsDisabledByDefault)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    ASSERT_EQ(file.stats(), nullptr);
+}
+
+TEST(FileTest, StatsCountOperations)
+{
+    testing::NiceMock<MockTestFile> file;
+    file.set_stats_enabled(true);
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char buf[10] = {};
+    ASSERT_TRUE(file.write(buf, 3));
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+    auto n = file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_TRUE(file.truncate(100));
+    ASSERT_FALSE(file.seek(-1, SEEK_SET));
+
+    auto stats = file.stats();
+    ASSERT_NE(stats, nullptr);
+    ASSERT_EQ(stats->n_read, 1u);
+    ASSERT_EQ(stats->bytes_read, n.value());
+    ASSERT_EQ(stats->n_write, 1u);
+    ASSERT_EQ(stats->bytes_written, 3u);
+    ASSERT_EQ(stats->n_seek, 2u);
+    ASSERT_EQ(stats->n_truncate, 1u);
+    ASSERT_EQ(stats->n_error, 1u);
+
+    file.reset_stats();
+    ASSERT_EQ(file.stats()->n_read, 0u);
+
+    file.set_stats_enabled(false);
+    ASSERT_EQ(file.stats(), nullptr);
+}
+
+static std::vector<FileOpInfo> g_trace_ops;
+
+static void trace_hook(File &file, const FileOpInfo &info)
+{
+    (void) file;
+    g_trace_ops.push_back(info);
+}
+
+TEST(FileTest, TraceHookIsInvoked)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    g_trace_ops.clear();
+    File::set_trace_hook(&trace_hook);
+    ASSERT_EQ(File::trace_hook(), &trace_hook);
+
+    char buf[10] = {};
+    ASSERT_TRUE(file.write(buf, sizeof(buf)));
+    ASSERT_FALSE(file.seek(-1, SEEK_SET));
+
+    File::set_trace_hook(nullptr);
+
+    ASSERT_TRUE(file.write(buf, sizeof(buf)));
+
+    ASSERT_EQ(g_trace_ops.size(), 2u);
+    ASSERT_EQ(g_trace_ops[0].op, FileOp::Write);
+    ASSERT_EQ(g_trace_ops[0].bytes, 10u);
+    ASSERT_FALSE(g_trace_ops[0].error);
+    ASSERT_EQ(g_trace_ops[1].op, FileOp::Seek);
+    ASSERT_EQ(g_trace_ops[1].error, FileError::ArgumentOutOfRange);
+}
+
+TEST(FileTest, TraceHookSeekReportsNoBytes)
+{
+    testing::NiceMock<MockTestFile> file;
+
+    // Open file
+    ASSERT_TRUE(file.open());
+
+    char buf[10] = {};
+    ASSERT_TRUE(file.write(buf, sizeof(buf)));
+
+    g_trace_ops.clear();
+    File::set_trace_hook(&trace_hook);
+
+    auto pos = file.seek(5, SEEK_SET);
+
+    File::set_trace_hook(nullptr);
+
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 5u);
+    ASSERT_EQ(g_trace_ops.size(), 1u);
+    ASSERT_EQ(g_trace_ops[0].op, FileOp::Seek);
+    ASSERT_EQ(g_trace_ops[0].bytes, 0u);
+}
@@ -47,6 +47,8 @@ TEST(FileErrorTest, CheckErrorCodesComparableToErrorConditions)
                   FileErrorC::Unsupported);
     TEST_EQUALITY(make_error_code(FileError::UnsupportedTruncate),
                   FileErrorC::Unsupported);
+    TEST_EQUALITY(make_error_code(FileError::UnsupportedNativeFd),
+                  FileErrorC::Unsupported);
 
     TEST_EQUALITY(make_error_code(FileError::IntegerOverflow),
                   FileErrorC::InternalError);
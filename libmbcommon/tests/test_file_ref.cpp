@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "mbcommon/file/chunked_memory.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file_ref.h"
+
+#include "file/mock_test_file.h"
+
+using namespace mb;
+
+static void open_test_file(ChunkedMemoryFile &file)
+{
+    ASSERT_TRUE(file.open(4));
+    ASSERT_TRUE(file.write("abcdef", 6));
+    ASSERT_TRUE(file.seek(0, SEEK_SET));
+}
+
+TEST(FileRefTest, ReadFromFinalType)
+{
+    ChunkedMemoryFile file;
+    ASSERT_NO_FATAL_FAILURE(open_test_file(file));
+
+    char buf[6];
+    ASSERT_TRUE(file_read_exact(FileRef(file), buf, 4));
+    ASSERT_EQ(memcmp(buf, "abcd", 4), 0);
+
+    auto n = file_read_retry(FileRef(file), buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 2u);
+    ASSERT_EQ(memcmp(buf, "ef", 2), 0);
+
+    auto ret = file_read_exact(FileRef(file), buf, 1);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnexpectedEof);
+}
+
+TEST(FileRefTest, DiscardFromFinalType)
+{
+    ChunkedMemoryFile file;
+    ASSERT_NO_FATAL_FAILURE(open_test_file(file));
+
+    auto n = file_read_discard(FileRef(file), 10);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 6u);
+}
+
+TEST(FileRefTest, ClosedFileIsRejected)
+{
+    ChunkedMemoryFile file;
+
+    char buf[1];
+    auto ret = FileRef(file).read(buf, sizeof(buf));
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::InvalidState);
+}
+
+TEST(FileRefTest, InstrumentationIsNotBypassed)
+{
+    ChunkedMemoryFile file;
+    ASSERT_NO_FATAL_FAILURE(open_test_file(file));
+    file.set_stats_enabled(true);
+
+    char buf[3];
+    ASSERT_TRUE(file_read_exact(FileRef(file), buf, sizeof(buf)));
+    ASSERT_TRUE(FileRef(file).write("x", 1));
+
+    ASSERT_EQ(file.stats()->n_read, 1u);
+    ASSERT_EQ(file.stats()->bytes_read, 3u);
+    ASSERT_EQ(file.stats()->n_write, 1u);
+}
+
+TEST(FileRefTest, NonFinalTypeForwardsToFile)
+{
+    char data[] = "abcdef";
+    MemoryFile file(data, 6);
+    ASSERT_TRUE(file.is_open());
+    file.set_stats_enabled(true);
+
+    char buf[6];
+    ASSERT_TRUE(file_read_exact(FileRef(file), buf, sizeof(buf)));
+    ASSERT_EQ(file.stats()->n_read, 1u);
+}
+
+TEST(FileRefTest, NonFinalTypeUsesVirtualDispatch)
+{
+    testing::NiceMock<MockTestFile> file;
+    ASSERT_TRUE(file.open());
+
+    EXPECT_CALL(file, on_read(testing::_, testing::_))
+            .Times(1);
+
+    char buf[1];
+    ASSERT_TRUE(FileRef<File>(file).read(buf, sizeof(buf)));
+}
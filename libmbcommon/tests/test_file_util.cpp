@@ -21,10 +21,14 @@
 
 #include <algorithm>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <cinttypes>
+#include <cstdio>
+#include <cstring>
 
+#include "mbcommon/file/fd.h"
 #include "mbcommon/file/memory.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
@@ -221,6 +225,26 @@ TEST_F(FileUtilTest, ReadExactPartialFail)
     ASSERT_EQ(ret.error(), std::error_code{});
 }
 
+TEST_F(FileUtilTest, ReadExactAtShouldNotMoveFilePosition)
+{
+    MemoryFile file(const_cast<char *>("abcdefgh"), 8);
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file.seek(1, SEEK_SET));
+
+    char buf[4];
+    ASSERT_TRUE(file_read_exact_at(file, 3, buf, sizeof(buf)));
+    ASSERT_EQ(memcmp(buf, "defg", 4), 0);
+
+    auto pos = file.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 1u);
+
+    auto ret = file_read_exact_at(file, 6, buf, sizeof(buf));
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnexpectedEof);
+}
+
 TEST_F(FileUtilTest, WriteExactNormal)
 {
     EXPECT_CALL(_file, on_write(testing::_, testing::_))
@@ -391,6 +415,362 @@ TEST_F(FileSearchTest, FindNormal)
     ASSERT_TRUE(file_search(file, {}, {}, 0, "a", 1, {}, _cb));
 }
 
+static std::vector<uint64_t> naive_search(const std::vector<unsigned char> &data,
+                                          const std::vector<unsigned char> &pattern)
+{
+    std::vector<uint64_t> offsets;
+
+    for (size_t i = 0; i + pattern.size() <= data.size();) {
+        if (std::equal(pattern.begin(), pattern.end(),
+                       data.begin() + static_cast<std::ptrdiff_t>(i))) {
+            offsets.push_back(i);
+            i += pattern.size();
+        } else {
+            ++i;
+        }
+    }
+
+    return offsets;
+}
+
+TEST(FileSearchPatternTest, MatchesNaiveSearch)
+{
+    // Small alphabet with mostly zeros to get many partial matches
+    std::vector<unsigned char> data(10000);
+    uint32_t state = 1;
+    for (auto &c : data) {
+        state = state * 1103515245u + 12345u;
+        auto r = (state >> 16) % 8;
+        c = r < 5 ? 0x00 : static_cast<unsigned char>(r);
+    }
+
+    const size_t pattern_sizes[] = { 1, 2, 3, 4, 8, 15, 16, 17, 32, 33, 40 };
+
+    for (size_t pattern_size : pattern_sizes) {
+        // Use a pattern that exists in the data
+        std::vector<unsigned char> pattern(
+                data.begin() + 5000, data.begin() + 5000
+                + static_cast<std::ptrdiff_t>(pattern_size));
+
+        auto expected = naive_search(data, pattern);
+        ASSERT_FALSE(expected.empty());
+
+        const size_t bsizes[] = { pattern_size, pattern_size + 1, 100, 0 };
+
+        for (size_t bsize : bsizes) {
+            std::vector<uint64_t> actual;
+
+            MemoryFile file(data.data(), data.size());
+            ASSERT_TRUE(file.is_open());
+
+            auto ret = file_search(file, {}, {}, bsize, pattern.data(),
+                                   pattern.size(), {},
+                                   [&](File &, uint64_t offset)
+                                   -> oc::result<FileSearchAction> {
+                actual.push_back(offset);
+                return FileSearchAction::Continue;
+            });
+            ASSERT_TRUE(ret);
+            ASSERT_EQ(actual, expected)
+                    << "pattern_size=" << pattern_size << " bsize=" << bsize;
+        }
+    }
+}
+
+TEST(FileSearchPatternTest, FindAtBufferEdges)
+{
+    std::vector<unsigned char> data(64, 'x');
+    data[0] = data[1] = 'a';
+    data[62] = data[63] = 'a';
+
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    std::vector<uint64_t> offsets;
+    ASSERT_TRUE(file_search(file, {}, {}, 0, "aa", 2, {},
+                            [&](File &, uint64_t offset)
+                            -> oc::result<FileSearchAction> {
+        offsets.push_back(offset);
+        return FileSearchAction::Continue;
+    }));
+    ASSERT_EQ(offsets, (std::vector<uint64_t>{0, 62}));
+}
+
+static std::vector<uint64_t> search_offsets(bool parallel, File &file,
+                                            std::optional<uint64_t> start,
+                                            std::optional<uint64_t> end,
+                                            size_t bsize,
+                                            const std::string &pattern,
+                                            std::optional<uint64_t> max_matches)
+{
+    std::vector<uint64_t> offsets;
+    auto cb = [&](File &, uint64_t offset) -> oc::result<FileSearchAction> {
+        offsets.push_back(offset);
+        return FileSearchAction::Continue;
+    };
+
+    oc::result<void> ret = oc::success();
+    if (parallel) {
+        ret = file_search_parallel(file, start, end, bsize, pattern.data(),
+                                   pattern.size(), max_matches, cb, 4);
+    } else {
+        ret = file_search(file, start, end, bsize, pattern.data(),
+                          pattern.size(), max_matches, cb);
+    }
+    EXPECT_TRUE(ret);
+
+    return offsets;
+}
+
+TEST(FileSearchParallelTest, MatchesSerialSearch)
+{
+    // Repetitive data, so that matches often cross chunk boundaries and
+    // overlap the first match of the next chunk
+    std::string data;
+    uint32_t state = 1;
+    for (int i = 0; i < 5000; ++i) {
+        state = state * 1103515245u + 12345u;
+        auto r = (state >> 16) % 16;
+        data += r < 10 ? "ab" : r < 14 ? "a" : "b";
+    }
+
+    std::unique_ptr<FILE, decltype(fclose) *> fp{tmpfile(), &fclose};
+    ASSERT_TRUE(fp);
+    FdFile fd_file;
+    ASSERT_TRUE(fd_file.open(fileno(fp.get()), false));
+    ASSERT_TRUE(file_write_exact(fd_file, data.data(), data.size()));
+
+    MemoryFile mem_file(data.data(), data.size());
+    ASSERT_TRUE(mem_file.is_open());
+
+    const char *patterns[] = { "a", "ab", "aba", "abab", "ababab", "bab" };
+    const size_t chunk_sizes[] = { 6, 7, 64, 1000, 0 };
+
+    // FdFile is read with read_at() and MemoryFile is viewed directly
+    for (File *file : { static_cast<File *>(&fd_file),
+                        static_cast<File *>(&mem_file) }) {
+        for (std::string pattern : patterns) {
+            for (size_t chunk_size : chunk_sizes) {
+                auto expected = search_offsets(
+                        false, *file, {}, {}, 0, pattern, {});
+                ASSERT_FALSE(expected.empty());
+
+                auto actual = search_offsets(
+                        true, *file, {}, {}, chunk_size, pattern, {});
+                ASSERT_EQ(actual, expected)
+                        << "pattern=" << pattern
+                        << " chunk_size=" << chunk_size;
+
+                // Bounds and match limits
+                expected = search_offsets(
+                        false, *file, 101, 7003, 0, pattern, 500);
+                actual = search_offsets(
+                        true, *file, 101, 7003, chunk_size, pattern, 500);
+                ASSERT_EQ(actual, expected)
+                        << "pattern=" << pattern
+                        << " chunk_size=" << chunk_size;
+            }
+        }
+    }
+}
+
+TEST(FileSearchParallelTest, CheckEdgeCases)
+{
+    std::string data(100, 'a');
+
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    auto noop = [](File &, uint64_t) -> oc::result<FileSearchAction> {
+        return FileSearchAction::Continue;
+    };
+
+    auto ret = file_search_parallel(file, 20, 10, 0, "a", 1, {}, noop);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+
+    ret = file_search_parallel(file, {}, {}, 2, "aaa", 3, {}, noop);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+
+    // Range smaller than the pattern
+    ASSERT_EQ(search_offsets(true, file, 98, {}, 0, "aaa", {}),
+              std::vector<uint64_t>());
+    ASSERT_EQ(search_offsets(true, file, 200, {}, 0, "a", {}),
+              std::vector<uint64_t>());
+
+    // Stop from the callback
+    std::vector<uint64_t> offsets;
+    ASSERT_TRUE(file_search_parallel(file, {}, {}, 5, "aa", 2, {},
+                                     [&](File &, uint64_t offset)
+                                     -> oc::result<FileSearchAction> {
+        offsets.push_back(offset);
+        return offsets.size() == 3
+                ? FileSearchAction::Stop : FileSearchAction::Continue;
+    }));
+    ASSERT_EQ(offsets, (std::vector<uint64_t>{0, 2, 4}));
+}
+
+TEST(MemorySearchTest, MatchesNaiveSearch)
+{
+    std::vector<unsigned char> data(10000);
+    uint32_t state = 1;
+    for (auto &c : data) {
+        state = state * 1103515245u + 12345u;
+        auto r = (state >> 16) % 8;
+        c = r < 5 ? 0x00 : static_cast<unsigned char>(r);
+    }
+
+    const size_t pattern_sizes[] = { 1, 2, 3, 16, 17, 32, 33, 40 };
+
+    for (size_t pattern_size : pattern_sizes) {
+        std::vector<unsigned char> pattern(
+                data.begin() + 5000, data.begin() + 5000
+                + static_cast<std::ptrdiff_t>(pattern_size));
+
+        auto expected = naive_search(data, pattern);
+        ASSERT_FALSE(expected.empty());
+
+        auto offset = memory_search(data.data(), data.size(),
+                                    pattern.data(), pattern.size());
+        ASSERT_TRUE(offset) << "pattern_size=" << pattern_size;
+        ASSERT_EQ(*offset, expected[0]) << "pattern_size=" << pattern_size;
+    }
+}
+
+TEST(MemorySearchTest, NoMatch)
+{
+    const char data[] = "abcdefghijklmnopqrstuvwxyz";
+
+    ASSERT_FALSE(memory_search(data, sizeof(data) - 1, "abd", 3));
+    ASSERT_FALSE(memory_search(data, 2, "abc", 3));
+    ASSERT_FALSE(memory_search(data, sizeof(data) - 1, "", 0));
+    ASSERT_EQ(memory_search(data, sizeof(data) - 1, "xyz", 3), 23u);
+}
+
+TEST(FileSearchMultiTest, CheckInvalidBoundariesFail)
+{
+    MemoryFile file(const_cast<char *>("abc"), 3);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = { { "a", 1 } };
+
+    auto ret = file_search_multi(file, 20, 10, 0, patterns, 1, {},
+                                 [](File &, size_t, uint64_t)
+                                 -> oc::result<FileSearchAction> {
+        return FileSearchAction::Continue;
+    });
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST(FileSearchMultiTest, FindOverlappingPatterns)
+{
+    MemoryFile file(const_cast<char *>("xabcabcbc"), 9);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = {
+        { "abc", 3 },
+        { "bc", 2 },
+        { "", 0 },
+        { "cab", 3 },
+    };
+
+    std::vector<std::pair<size_t, uint64_t>> results;
+
+    // Use a tiny buffer to cross buffer boundaries
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 2, patterns, 4, {},
+                                  [&](File &, size_t index, uint64_t offset)
+                                  -> oc::result<FileSearchAction> {
+        results.emplace_back(index, offset);
+        return FileSearchAction::Continue;
+    }));
+
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        { 0, 1 }, { 1, 2 },
+        { 3, 3 },
+        { 0, 4 }, { 1, 5 },
+        { 1, 7 },
+    };
+    ASSERT_EQ(results, expected);
+}
+
+TEST(FileSearchMultiTest, RespectBoundsAndMaxMatches)
+{
+    MemoryFile file(const_cast<char *>("aaaaaaaaaa"), 10);
+    ASSERT_TRUE(file.is_open());
+
+    FileSearchPattern patterns[] = { { "aa", 2 }, { "a", 1 } };
+    std::vector<std::pair<size_t, uint64_t>> results;
+
+    auto cb = [&](File &, size_t index, uint64_t offset)
+            -> oc::result<FileSearchAction> {
+        results.emplace_back(index, offset);
+        return FileSearchAction::Continue;
+    };
+
+    ASSERT_TRUE(file_search_multi(file, 3, 6, 0, patterns, 2, {}, cb));
+    std::vector<std::pair<size_t, uint64_t>> expected{
+        { 1, 3 }, { 0, 3 }, { 1, 4 }, { 1, 5 }
+    };
+    ASSERT_EQ(results, expected);
+
+    results.clear();
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 0, patterns, 2, 3, cb));
+    ASSERT_EQ(results.size(), 3u);
+}
+
+TEST(FileSearchMultiTest, MatchesSinglePatternSearch)
+{
+    std::vector<unsigned char> data(10000);
+    uint32_t state = 7;
+    for (auto &c : data) {
+        state = state * 1103515245u + 12345u;
+        c = static_cast<unsigned char>((state >> 16) % 4);
+    }
+
+    std::vector<std::vector<unsigned char>> pattern_data;
+    std::vector<FileSearchPattern> patterns;
+    const size_t offsets[] = { 10, 20, 20, 500, 9000 };
+    const size_t sizes[] = { 1, 3, 5, 8, 40 };
+    for (size_t i = 0; i < 5; ++i) {
+        auto begin = data.begin() + static_cast<std::ptrdiff_t>(offsets[i]);
+        pattern_data.emplace_back(
+                begin, begin + static_cast<std::ptrdiff_t>(sizes[i]));
+    }
+    for (auto const &p : pattern_data) {
+        patterns.push_back({ p.data(), p.size() });
+    }
+
+    std::vector<std::vector<uint64_t>> actual(patterns.size());
+
+    MemoryFile file(data.data(), data.size());
+    ASSERT_TRUE(file.is_open());
+
+    ASSERT_TRUE(file_search_multi(file, {}, {}, 100, patterns.data(),
+                                  patterns.size(), {},
+                                  [&](File &, size_t index, uint64_t offset)
+                                  -> oc::result<FileSearchAction> {
+        actual[index].push_back(offset);
+        return FileSearchAction::Continue;
+    }));
+
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        std::vector<uint64_t> expected;
+
+        ASSERT_TRUE(file_search(file, {}, {}, 0, patterns[i].data,
+                                patterns[i].size, {},
+                                [&](File &, uint64_t offset)
+                                -> oc::result<FileSearchAction> {
+            expected.push_back(offset);
+            return FileSearchAction::Continue;
+        }));
+
+        ASSERT_FALSE(expected.empty());
+        ASSERT_EQ(actual[i], expected) << "pattern " << i;
+    }
+}
+
 TEST(FileMoveTest, DegenerateCasesShouldSucceed)
 {
     char buf[] = "abcdef";
@@ -497,4 +877,257 @@ TEST(FileMoveTest, LargeBackwardsCopyShouldSucceed)
     }
 }
 
+static std::vector<unsigned char> file_move_test_data(size_t size)
+{
+    std::vector<unsigned char> data(size);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 7 + i / 251);
+    }
+    return data;
+}
+
+TEST(FileMoveTest, LargeUnalignedOverlappingCopyShouldSucceed)
+{
+    constexpr size_t size = 3 * 1024 * 1024 + 123;
+
+    for (auto [src, dest] : { std::pair<uint64_t, uint64_t>{4097, 1},
+                              std::pair<uint64_t, uint64_t>{1, 4097} }) {
+        auto buf = file_move_test_data(size + 8192);
+        auto expected = buf;
+        memmove(expected.data() + dest, expected.data() + src, size);
+
+        MemoryFile file(buf.data(), buf.size());
+        ASSERT_TRUE(file.is_open());
+
+        auto n = file_move(file, src, dest, size);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), size);
+        ASSERT_EQ(buf, expected);
+    }
+}
+
+#ifdef __linux__
+struct FileMoveFdTest : testing::Test
+{
+    std::unique_ptr<FILE, decltype(fclose) *> _fp{nullptr, &fclose};
+    FdFile _file;
+
+    void SetUp() override
+    {
+        _fp.reset(tmpfile());
+        ASSERT_TRUE(_fp);
+        ASSERT_TRUE(_file.open(fileno(_fp.get()), false));
+    }
+
+    void write_data(const std::vector<unsigned char> &data)
+    {
+        ASSERT_TRUE(file_write_exact(_file, data.data(), data.size()));
+    }
+
+    std::vector<unsigned char> read_data()
+    {
+        auto size = _file.seek(0, SEEK_END);
+        EXPECT_TRUE(size);
+        EXPECT_TRUE(_file.seek(0, SEEK_SET));
+
+        std::vector<unsigned char> data(static_cast<size_t>(size.value()));
+        EXPECT_TRUE(file_read_exact(_file, data.data(), data.size()));
+        return data;
+    }
+};
+
+TEST_F(FileMoveFdTest, NonOverlappingCopyShouldSucceed)
+{
+    auto data = file_move_test_data(100000);
+    ASSERT_NO_FATAL_FAILURE(write_data(data));
+
+    auto n = file_move(_file, 10, 60000, 30000);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 30000u);
+
+    memmove(data.data() + 60000, data.data() + 10, 30000);
+    ASSERT_EQ(read_data(), data);
+}
+
+TEST_F(FileMoveFdTest, OutOfBoundsCopyShouldCopyPartially)
+{
+    auto data = file_move_test_data(100);
+    ASSERT_NO_FATAL_FAILURE(write_data(data));
+
+    auto n = file_move(_file, 80, 0, 50);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 20u);
+
+    memmove(data.data(), data.data() + 80, 20);
+    ASSERT_EQ(read_data(), data);
+}
+
+TEST_F(FileMoveFdTest, ShiftTailForwardsShouldGrowFile)
+{
+    // Block-aligned for fallocate() and unaligned for the fallback
+    for (uint64_t dest : { 4096u * 3, 4096u * 2 + 100 }) {
+        ASSERT_TRUE(_file.truncate(0));
+        ASSERT_TRUE(_file.seek(0, SEEK_SET));
+
+        auto data = file_move_test_data(4096 * 4);
+        ASSERT_NO_FATAL_FAILURE(write_data(data));
+
+        auto n = file_move(_file, 4096, dest, 4096 * 3,
+                           FileMoveFlag::ShiftTail);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), 4096u * 3);
+
+        auto result = read_data();
+        ASSERT_EQ(result.size(), dest + 4096 * 3);
+        ASSERT_TRUE(std::equal(data.begin(), data.begin() + 4096,
+                               result.begin()));
+        ASSERT_TRUE(std::equal(data.begin() + 4096, data.end(),
+                               result.begin() + static_cast<ptrdiff_t>(dest)));
+    }
+}
+
+TEST_F(FileMoveFdTest, ShiftTailBackwardsShouldShrinkFile)
+{
+    for (uint64_t src : { 4096u * 2, 4096u + 100 }) {
+        ASSERT_TRUE(_file.truncate(0));
+        ASSERT_TRUE(_file.seek(0, SEEK_SET));
+
+        auto data = file_move_test_data(4096 * 4);
+        ASSERT_NO_FATAL_FAILURE(write_data(data));
+
+        auto size = data.size() - src;
+
+        auto n = file_move(_file, src, 0, size, FileMoveFlag::ShiftTail);
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), size);
+
+        auto result = read_data();
+        ASSERT_EQ(result.size(), size);
+        ASSERT_TRUE(std::equal(data.begin() + static_cast<ptrdiff_t>(src),
+                               data.end(), result.begin()));
+    }
+}
+#endif
+
+TEST(FileCopyTest, CopySizeShouldSucceed)
+{
+    char in_buf[] = "abcdef";
+    char out_buf[] = "xxxxxx";
+
+    MemoryFile in(in_buf, sizeof(in_buf) - 1);
+    ASSERT_TRUE(in.is_open());
+    MemoryFile out(out_buf, sizeof(out_buf) - 1);
+    ASSERT_TRUE(out.is_open());
+
+    ASSERT_TRUE(in.seek(1, SEEK_SET));
+
+    auto n = file_copy(in, out, 3);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+    ASSERT_STREQ(out_buf, "bcdxxx");
+
+    auto pos = in.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 4u);
+    pos = out.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 3u);
+}
+
+TEST(FileCopyTest, CopyToEofShouldSucceed)
+{
+    std::vector<unsigned char> in_buf(3 * 1024 * 1024 + 1);
+    for (size_t i = 0; i < in_buf.size(); ++i) {
+        in_buf[i] = static_cast<unsigned char>(i);
+    }
+
+    void *out_data = nullptr;
+    size_t out_size = 0;
+
+    {
+        MemoryFile in(in_buf.data(), in_buf.size());
+        ASSERT_TRUE(in.is_open());
+        MemoryFile out(&out_data, &out_size);
+        ASSERT_TRUE(out.is_open());
+
+        auto n = file_copy(in, out, {});
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), in_buf.size());
+    }
+
+    ASSERT_EQ(out_size, in_buf.size());
+    ASSERT_EQ(memcmp(out_data, in_buf.data(), out_size), 0);
+    free(out_data);
+}
+
+TEST(FileCopyTest, CopyPastEofShouldCopyPartially)
+{
+    char in_buf[] = "abc";
+    char out_buf[] = "xxxxxx";
+
+    MemoryFile in(in_buf, sizeof(in_buf) - 1);
+    ASSERT_TRUE(in.is_open());
+    MemoryFile out(out_buf, sizeof(out_buf) - 1);
+    ASSERT_TRUE(out.is_open());
+
+    auto n = file_copy(in, out, 5);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 3u);
+    ASSERT_STREQ(out_buf, "abcxxx");
+}
+
+TEST(FileCopyTest, ReadFailureShouldFail)
+{
+    testing::NiceMock<MockTestFile> in;
+    ASSERT_TRUE(in.open());
+
+    char out_buf[1];
+    MemoryFile out(out_buf, sizeof(out_buf));
+    ASSERT_TRUE(out.is_open());
+
+    EXPECT_CALL(in, on_read(testing::_, testing::_))
+            .WillOnce(testing::Return(std::make_error_code(std::errc::io_error)));
+
+    auto n = file_copy(in, out, {});
+    ASSERT_FALSE(n);
+    ASSERT_EQ(n.error(), std::errc::io_error);
+}
+
+#ifdef __linux__
+TEST(FileCopyTest, KernelCopyBetweenFdsShouldSucceed)
+{
+    std::unique_ptr<FILE, decltype(fclose) *> fp_in(tmpfile(), &fclose);
+    ASSERT_TRUE(fp_in);
+    std::unique_ptr<FILE, decltype(fclose) *> fp_out(tmpfile(), &fclose);
+    ASSERT_TRUE(fp_out);
+
+    FdFile in(fileno(fp_in.get()), false);
+    ASSERT_TRUE(in.is_open());
+    FdFile out(fileno(fp_out.get()), false);
+    ASSERT_TRUE(out.is_open());
+
+    ASSERT_TRUE(file_write_exact(in, "abcdef", 6));
+    ASSERT_TRUE(in.seek(1, SEEK_SET));
+
+    auto n = file_copy(in, out, 4);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 4u);
+
+    auto pos = in.seek(0, SEEK_CUR);
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 5u);
+
+    n = file_copy(in, out, {});
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 1u);
+
+    char buf[6];
+    ASSERT_TRUE(out.seek(0, SEEK_SET));
+    auto n_read = file_read_retry(out, buf, sizeof(buf));
+    ASSERT_TRUE(n_read);
+    ASSERT_EQ(n_read.value(), 5u);
+    ASSERT_EQ(memcmp(buf, "bcdef", 5), 0);
+}
+#endif
+
 // TODO: Add more tests after integrating gmock
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbcommon/finally.h"
+#include "mbcommon/resource_budget.h"
+
+using namespace mb;
+
+static constexpr size_t MiB = 1024 * 1024;
+
+TEST(ResourceBudgetTest, LeaseFallsBackToMinimum)
+{
+    auto &budget = ResourceBudget::global();
+    auto old_size = budget.max_buffer_size();
+    auto restore = finally([&] {
+        budget.set_max_buffer_size(old_size);
+    });
+
+    budget.set_max_buffer_size(10 * MiB);
+
+    BufferLease a(8 * MiB, 1 * MiB);
+    ASSERT_EQ(a.size(), 8 * MiB);
+
+    // Only 2 MiB are left
+    BufferLease b(8 * MiB, 1 * MiB);
+    ASSERT_EQ(b.size(), 2 * MiB);
+
+    // The minimum is always granted
+    BufferLease c(8 * MiB, 1 * MiB);
+    ASSERT_EQ(c.size(), 1 * MiB);
+
+    // The minimum is capped at the preferred size
+    BufferLease d(64, 1 * MiB);
+    ASSERT_EQ(d.size(), 64u);
+}
+
+TEST(ResourceBudgetTest, LeaseIsReturnedOnDestruction)
+{
+    auto &budget = ResourceBudget::global();
+    auto old_size = budget.max_buffer_size();
+    auto restore = finally([&] {
+        budget.set_max_buffer_size(old_size);
+    });
+
+    budget.set_max_buffer_size(4 * MiB);
+
+    {
+        BufferLease a(4 * MiB, 0);
+        ASSERT_EQ(a.size(), 4 * MiB);
+
+        BufferLease b(std::move(a));
+        ASSERT_EQ(a.size(), 0u);
+        ASSERT_EQ(b.size(), 4 * MiB);
+
+        BufferLease c(4 * MiB, 0);
+        ASSERT_EQ(c.size(), 0u);
+    }
+
+    BufferLease d(4 * MiB, 0);
+    ASSERT_EQ(d.size(), 4 * MiB);
+}
+
+TEST(ResourceBudgetTest, BufferCountIsClamped)
+{
+    auto &budget = ResourceBudget::global();
+    auto old_size = budget.max_buffer_size();
+    auto restore = finally([&] {
+        budget.set_max_buffer_size(old_size);
+    });
+
+    budget.set_max_buffer_size(6 * MiB);
+
+    ASSERT_EQ(budget.buffer_count(1 * MiB, 4), 4u);
+    ASSERT_EQ(budget.buffer_count(2 * MiB, 4), 3u);
+    ASSERT_EQ(budget.buffer_count(8 * MiB, 4), 1u);
+    ASSERT_EQ(budget.buffer_count(8 * MiB, 4, 2), 2u);
+    ASSERT_EQ(budget.buffer_count(0, 4), 4u);
+}
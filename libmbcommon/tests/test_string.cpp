@@ -46,6 +46,28 @@ TEST(StringTest, FormatSizeT)
     ASSERT_EQ(format("%" MB_PRIzX, unsigned_val), "FFFFFFFF");
 }
 
+TEST(StringTest, FormatLongString)
+{
+    std::string arg(4096, 'x');
+
+    ASSERT_EQ(format("<%s>", arg.c_str()), "<" + arg + ">");
+}
+
+TEST(StringTest, FormatToAppends)
+{
+    std::string buf = "prefix:";
+
+    format_to(buf, "%d,%s", 42, "short");
+    ASSERT_EQ(buf, "prefix:42,short");
+
+    std::string arg(1000, 'y');
+    format_to(buf, "[%s]", arg.c_str());
+    ASSERT_EQ(buf, "prefix:42,short[" + arg + "]");
+
+    format_to(buf, "%s", "");
+    ASSERT_EQ(buf, "prefix:42,short[" + arg + "]");
+}
+
 TEST(StringTest, CheckStartsWithNormal)
 {
     // Check equal strings
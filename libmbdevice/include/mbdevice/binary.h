@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbdevice/device.h"
+
+namespace mb::device
+{
+
+class DeviceDatabase;
+class DeviceView;
+
+class MB_EXPORT StringListView
+{
+public:
+    size_t size() const;
+    bool empty() const;
+
+    std::string_view operator[](size_t index) const;
+
+    std::vector<std::string> to_vector() const;
+
+private:
+    StringListView(const unsigned char *data, uint32_t offset, uint32_t count);
+
+    const unsigned char *m_data;
+    uint32_t m_offset;
+    uint32_t m_count;
+
+    friend class DeviceView;
+};
+
+class MB_EXPORT DeviceView
+{
+public:
+    std::string_view id() const;
+    StringListView codenames() const;
+    std::string_view name() const;
+    std::string_view architecture() const;
+    DeviceFlags flags() const;
+
+    StringListView block_dev_base_dirs() const;
+    StringListView system_block_devs() const;
+    StringListView cache_block_devs() const;
+    StringListView data_block_devs() const;
+    StringListView boot_block_devs() const;
+    StringListView recovery_block_devs() const;
+    StringListView extra_block_devs() const;
+
+    bool tw_supported() const;
+    TwFlags tw_flags() const;
+    TwPixelFormat tw_pixel_format() const;
+    TwForcePixelFormat tw_force_pixel_format() const;
+    int tw_overscan_percent() const;
+    int tw_default_x_offset() const;
+    int tw_default_y_offset() const;
+    std::string_view tw_brightness_path() const;
+    std::string_view tw_secondary_brightness_path() const;
+    int tw_max_brightness() const;
+    int tw_default_brightness() const;
+    std::string_view tw_battery_path() const;
+    std::string_view tw_cpu_temp_path() const;
+    std::string_view tw_input_blacklist() const;
+    std::string_view tw_input_whitelist() const;
+    StringListView tw_graphics_backends() const;
+    std::string_view tw_theme() const;
+
+    Device to_device() const;
+
+private:
+    DeviceView(const unsigned char *data, uint32_t offset);
+
+    uint32_t field(size_t offset) const;
+    std::string_view string_field(size_t offset) const;
+    StringListView list_field(size_t offset) const;
+
+    const unsigned char *m_data;
+    uint32_t m_offset;
+
+    friend class DeviceDatabase;
+};
+
+class MB_EXPORT DeviceDatabase
+{
+public:
+    DeviceDatabase();
+    ~DeviceDatabase();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DeviceDatabase)
+
+    DeviceDatabase(DeviceDatabase &&other) noexcept;
+    DeviceDatabase & operator=(DeviceDatabase &&rhs) noexcept;
+
+    static bool is_database(std::string_view data);
+
+    bool load(std::string data);
+
+    size_t size() const;
+    DeviceView operator[](size_t index) const;
+
+    std::optional<DeviceView> find_by_codename(std::string_view codename) const;
+    std::optional<DeviceView> find_by_id(std::string_view id) const;
+
+private:
+    std::string m_data;
+    uint32_t m_device_count;
+    uint32_t m_devices_offset;
+    uint32_t m_index_count;
+    uint32_t m_index_offset;
+};
+
+MB_EXPORT bool device_list_to_binary(const std::vector<Device> &devices,
+                                     std::string &data);
+
+}
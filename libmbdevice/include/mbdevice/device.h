@@ -40,40 +40,40 @@ public:
     MB_DEFAULT_COPY_CONSTRUCT_AND_ASSIGN(Device)
     MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(Device)
 
-    std::string id() const;
+    const std::string & id() const;
     void set_id(std::string id);
 
-    std::vector<std::string> codenames() const;
+    const std::vector<std::string> & codenames() const;
     void set_codenames(std::vector<std::string> codenames);
 
-    std::string name() const;
+    const std::string & name() const;
     void set_name(std::string name);
 
-    std::string architecture() const;
+    const std::string & architecture() const;
     void set_architecture(std::string architecture);
 
     DeviceFlags flags() const;
     void set_flags(DeviceFlags flags);
 
-    std::vector<std::string> block_dev_base_dirs() const;
+    const std::vector<std::string> & block_dev_base_dirs() const;
     void set_block_dev_base_dirs(std::vector<std::string> base_dirs);
 
-    std::vector<std::string> system_block_devs() const;
+    const std::vector<std::string> & system_block_devs() const;
     void set_system_block_devs(std::vector<std::string> block_devs);
 
-    std::vector<std::string> cache_block_devs() const;
+    const std::vector<std::string> & cache_block_devs() const;
     void set_cache_block_devs(std::vector<std::string> block_devs);
 
-    std::vector<std::string> data_block_devs() const;
+    const std::vector<std::string> & data_block_devs() const;
     void set_data_block_devs(std::vector<std::string> block_devs);
 
-    std::vector<std::string> boot_block_devs() const;
+    const std::vector<std::string> & boot_block_devs() const;
     void set_boot_block_devs(std::vector<std::string> block_devs);
 
-    std::vector<std::string> recovery_block_devs() const;
+    const std::vector<std::string> & recovery_block_devs() const;
     void set_recovery_block_devs(std::vector<std::string> block_devs);
 
-    std::vector<std::string> extra_block_devs() const;
+    const std::vector<std::string> & extra_block_devs() const;
     void set_extra_block_devs(std::vector<std::string> block_devs);
 
     bool tw_supported() const;
@@ -97,10 +97,10 @@ public:
     int tw_default_y_offset() const;
     void set_tw_default_y_offset(int offset);
 
-    std::string tw_brightness_path() const;
+    const std::string & tw_brightness_path() const;
     void set_tw_brightness_path(std::string path);
 
-    std::string tw_secondary_brightness_path() const;
+    const std::string & tw_secondary_brightness_path() const;
     void set_tw_secondary_brightness_path(std::string path);
 
     int tw_max_brightness() const;
@@ -109,22 +109,22 @@ public:
     int tw_default_brightness() const;
     void set_tw_default_brightness(int value);
 
-    std::string tw_battery_path() const;
+    const std::string & tw_battery_path() const;
     void set_tw_battery_path(std::string path);
 
-    std::string tw_cpu_temp_path() const;
+    const std::string & tw_cpu_temp_path() const;
     void set_tw_cpu_temp_path(std::string path);
 
-    std::string tw_input_blacklist() const;
+    const std::string & tw_input_blacklist() const;
     void set_tw_input_blacklist(std::string blacklist);
 
-    std::string tw_input_whitelist() const;
+    const std::string & tw_input_whitelist() const;
     void set_tw_input_whitelist(std::string whitelist);
 
-    std::vector<std::string> tw_graphics_backends() const;
+    const std::vector<std::string> & tw_graphics_backends() const;
     void set_tw_graphics_backends(std::vector<std::string> backends);
 
-    std::string tw_theme() const;
+    const std::string & tw_theme() const;
     void set_tw_theme(std::string theme);
 
     ValidateFlags validate() const;
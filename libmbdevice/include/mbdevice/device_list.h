@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mbdevice/device.h"
+
+namespace mb::device
+{
+
+class MB_EXPORT DeviceList
+{
+public:
+    DeviceList();
+    explicit DeviceList(std::vector<Device> devices);
+    ~DeviceList();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DeviceList)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(DeviceList)
+
+    const std::vector<Device> & devices() const;
+
+    const Device * find_by_codename(std::string_view codename) const;
+
+private:
+    std::vector<Device> m_devices;
+    // Keys point to the codename strings in m_devices
+    std::unordered_map<std::string_view, size_t> m_codenames;
+};
+
+}
@@ -0,0 +1,873 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/binary.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+#include <cstddef>
+#include <cstring>
+
+#include "mbcommon/endian.h"
+
+// Binary device database format
+//
+// All integers are little endian uint32_t values. Every section is a plain
+// array, so a device can be read directly from the buffer without parsing or
+// allocating anything.
+//
+//   Header
+//   Device records      (RawDevice[device_count])
+//   Codename index      (RawIndexEntry[index_count], sorted by codename)
+//   String list entries (RawString[list_count])
+//   String data         (NUL-terminated strings, deduplicated)
+//
+// String references are offsets into the string data and string list
+// references are indexes into the string list entries.
+
+namespace mb::device
+{
+
+static constexpr char DATABASE_MAGIC[8] = {
+    'M', 'B', 'D', 'E', 'V', 'D', 'B', '\0'
+};
+static constexpr uint32_t DATABASE_VERSION = 1;
+
+namespace
+{
+
+struct RawString
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct RawList
+{
+    uint32_t offset;
+    uint32_t count;
+};
+
+struct RawHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t device_count;
+    uint32_t devices_offset;
+    uint32_t index_count;
+    uint32_t index_offset;
+    uint32_t list_count;
+    uint32_t lists_offset;
+    uint32_t strings_size;
+    uint32_t strings_offset;
+    uint32_t reserved;
+};
+
+struct RawDevice
+{
+    RawString id;
+    RawList codenames;
+    RawString name;
+    RawString architecture;
+    uint32_t flags;
+
+    RawList base_dirs;
+    RawList system_devs;
+    RawList cache_devs;
+    RawList data_devs;
+    RawList boot_devs;
+    RawList recovery_devs;
+    RawList extra_devs;
+
+    uint32_t tw_supported;
+    uint32_t tw_flags;
+    uint32_t tw_pixel_format;
+    uint32_t tw_force_pixel_format;
+    uint32_t tw_overscan_percent;
+    uint32_t tw_default_x_offset;
+    uint32_t tw_default_y_offset;
+    RawString tw_brightness_path;
+    RawString tw_secondary_brightness_path;
+    uint32_t tw_max_brightness;
+    uint32_t tw_default_brightness;
+    RawString tw_battery_path;
+    RawString tw_cpu_temp_path;
+    RawString tw_input_blacklist;
+    RawString tw_input_whitelist;
+    RawList tw_graphics_backends;
+    RawString tw_theme;
+};
+
+struct RawIndexEntry
+{
+    RawString codename;
+    uint32_t device;
+};
+
+}
+
+// The structs are only used for their layout. They are never read or written
+// directly, so there must not be any padding.
+static_assert(sizeof(RawHeader) == 48);
+static_assert(sizeof(RawDevice) % sizeof(uint32_t) == 0);
+static_assert(sizeof(RawIndexEntry) == 12);
+
+static constexpr size_t STRING_LIST_ENTRY_SIZE = sizeof(RawString);
+
+static inline uint32_t read_u32(const unsigned char *data, size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, data + offset, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static inline void write_u32(std::string &data, size_t offset, uint32_t value)
+{
+    value = mb_htole32(value);
+    memcpy(data.data() + offset, &value, sizeof(value));
+}
+
+static inline std::string_view read_string(const unsigned char *data,
+                                           size_t offset)
+{
+    uint32_t strings_offset = read_u32(data, offsetof(RawHeader, strings_offset));
+
+    return {
+        reinterpret_cast<const char *>(data) + strings_offset
+                + read_u32(data, offset + offsetof(RawString, offset)),
+        read_u32(data, offset + offsetof(RawString, size))
+    };
+}
+
+StringListView::StringListView(const unsigned char *data, uint32_t offset,
+                               uint32_t count)
+    : m_data(data)
+    , m_offset(offset)
+    , m_count(count)
+{
+}
+
+/*!
+ * \brief Get the number of strings in the list
+ */
+size_t StringListView::size() const
+{
+    return m_count;
+}
+
+/*!
+ * \brief Check whether the list is empty
+ */
+bool StringListView::empty() const
+{
+    return m_count == 0;
+}
+
+/*!
+ * \brief Get a string from the list
+ *
+ * \pre \p index is less than size()
+ *
+ * \param index Index of string
+ *
+ * \return View of the string in the database buffer
+ */
+std::string_view StringListView::operator[](size_t index) const
+{
+    uint32_t lists_offset = read_u32(m_data, offsetof(RawHeader, lists_offset));
+
+    return read_string(m_data, lists_offset
+            + (m_offset + index) * STRING_LIST_ENTRY_SIZE);
+}
+
+/*!
+ * \brief Copy the strings in the list
+ *
+ * \return List of strings
+ */
+std::vector<std::string> StringListView::to_vector() const
+{
+    std::vector<std::string> result;
+    result.reserve(m_count);
+
+    for (size_t i = 0; i < m_count; ++i) {
+        result.emplace_back((*this)[i]);
+    }
+
+    return result;
+}
+
+DeviceView::DeviceView(const unsigned char *data, uint32_t offset)
+    : m_data(data)
+    , m_offset(offset)
+{
+}
+
+uint32_t DeviceView::field(size_t offset) const
+{
+    return read_u32(m_data, m_offset + offset);
+}
+
+std::string_view DeviceView::string_field(size_t offset) const
+{
+    return read_string(m_data, m_offset + offset);
+}
+
+StringListView DeviceView::list_field(size_t offset) const
+{
+    return {
+        m_data,
+        field(offset + offsetof(RawList, offset)),
+        field(offset + offsetof(RawList, count))
+    };
+}
+
+#define STRING_FIELD(NAME, FIELD) \
+    std::string_view DeviceView::NAME() const \
+    { \
+        return string_field(offsetof(RawDevice, FIELD)); \
+    }
+
+#define LIST_FIELD(NAME, FIELD) \
+    StringListView DeviceView::NAME() const \
+    { \
+        return list_field(offsetof(RawDevice, FIELD)); \
+    }
+
+#define INT_FIELD(NAME, FIELD) \
+    int DeviceView::NAME() const \
+    { \
+        return static_cast<int32_t>(field(offsetof(RawDevice, FIELD))); \
+    }
+
+STRING_FIELD(id, id)
+LIST_FIELD(codenames, codenames)
+STRING_FIELD(name, name)
+STRING_FIELD(architecture, architecture)
+
+DeviceFlags DeviceView::flags() const
+{
+    return static_cast<DeviceFlag>(field(offsetof(RawDevice, flags)));
+}
+
+LIST_FIELD(block_dev_base_dirs, base_dirs)
+LIST_FIELD(system_block_devs, system_devs)
+LIST_FIELD(cache_block_devs, cache_devs)
+LIST_FIELD(data_block_devs, data_devs)
+LIST_FIELD(boot_block_devs, boot_devs)
+LIST_FIELD(recovery_block_devs, recovery_devs)
+LIST_FIELD(extra_block_devs, extra_devs)
+
+bool DeviceView::tw_supported() const
+{
+    return field(offsetof(RawDevice, tw_supported)) != 0;
+}
+
+TwFlags DeviceView::tw_flags() const
+{
+    return static_cast<TwFlag>(field(offsetof(RawDevice, tw_flags)));
+}
+
+TwPixelFormat DeviceView::tw_pixel_format() const
+{
+    return static_cast<TwPixelFormat>(
+            field(offsetof(RawDevice, tw_pixel_format)));
+}
+
+TwForcePixelFormat DeviceView::tw_force_pixel_format() const
+{
+    return static_cast<TwForcePixelFormat>(
+            field(offsetof(RawDevice, tw_force_pixel_format)));
+}
+
+INT_FIELD(tw_overscan_percent, tw_overscan_percent)
+INT_FIELD(tw_default_x_offset, tw_default_x_offset)
+INT_FIELD(tw_default_y_offset, tw_default_y_offset)
+STRING_FIELD(tw_brightness_path, tw_brightness_path)
+STRING_FIELD(tw_secondary_brightness_path, tw_secondary_brightness_path)
+INT_FIELD(tw_max_brightness, tw_max_brightness)
+INT_FIELD(tw_default_brightness, tw_default_brightness)
+STRING_FIELD(tw_battery_path, tw_battery_path)
+STRING_FIELD(tw_cpu_temp_path, tw_cpu_temp_path)
+STRING_FIELD(tw_input_blacklist, tw_input_blacklist)
+STRING_FIELD(tw_input_whitelist, tw_input_whitelist)
+LIST_FIELD(tw_graphics_backends, tw_graphics_backends)
+STRING_FIELD(tw_theme, tw_theme)
+
+#undef STRING_FIELD
+#undef LIST_FIELD
+#undef INT_FIELD
+
+/*!
+ * \brief Copy the device definition into a Device instance
+ *
+ * \return Device with all fields copied from the database
+ */
+Device DeviceView::to_device() const
+{
+    Device device;
+
+    device.set_id(std::string(id()));
+    device.set_codenames(codenames().to_vector());
+    device.set_name(std::string(name()));
+    device.set_architecture(std::string(architecture()));
+    device.set_flags(flags());
+
+    device.set_block_dev_base_dirs(block_dev_base_dirs().to_vector());
+    device.set_system_block_devs(system_block_devs().to_vector());
+    device.set_cache_block_devs(cache_block_devs().to_vector());
+    device.set_data_block_devs(data_block_devs().to_vector());
+    device.set_boot_block_devs(boot_block_devs().to_vector());
+    device.set_recovery_block_devs(recovery_block_devs().to_vector());
+    device.set_extra_block_devs(extra_block_devs().to_vector());
+
+    device.set_tw_supported(tw_supported());
+    device.set_tw_flags(tw_flags());
+    device.set_tw_pixel_format(tw_pixel_format());
+    device.set_tw_force_pixel_format(tw_force_pixel_format());
+    device.set_tw_overscan_percent(tw_overscan_percent());
+    device.set_tw_default_x_offset(tw_default_x_offset());
+    device.set_tw_default_y_offset(tw_default_y_offset());
+    device.set_tw_brightness_path(std::string(tw_brightness_path()));
+    device.set_tw_secondary_brightness_path(
+            std::string(tw_secondary_brightness_path()));
+    device.set_tw_max_brightness(tw_max_brightness());
+    device.set_tw_default_brightness(tw_default_brightness());
+    device.set_tw_battery_path(std::string(tw_battery_path()));
+    device.set_tw_cpu_temp_path(std::string(tw_cpu_temp_path()));
+    device.set_tw_input_blacklist(std::string(tw_input_blacklist()));
+    device.set_tw_input_whitelist(std::string(tw_input_whitelist()));
+    device.set_tw_graphics_backends(tw_graphics_backends().to_vector());
+    device.set_tw_theme(std::string(tw_theme()));
+
+    return device;
+}
+
+DeviceDatabase::DeviceDatabase()
+    : m_data()
+    , m_device_count(0)
+    , m_devices_offset(0)
+    , m_index_count(0)
+    , m_index_offset(0)
+{
+}
+
+DeviceDatabase::~DeviceDatabase() = default;
+
+DeviceDatabase::DeviceDatabase(DeviceDatabase &&other) noexcept
+    : DeviceDatabase()
+{
+    *this = std::move(other);
+}
+
+DeviceDatabase & DeviceDatabase::operator=(DeviceDatabase &&rhs) noexcept
+{
+    if (this != &rhs) {
+        m_data = std::move(rhs.m_data);
+        m_device_count = rhs.m_device_count;
+        m_devices_offset = rhs.m_devices_offset;
+        m_index_count = rhs.m_index_count;
+        m_index_offset = rhs.m_index_offset;
+
+        rhs.m_data.clear();
+        rhs.m_device_count = 0;
+        rhs.m_index_count = 0;
+    }
+
+    return *this;
+}
+
+/*!
+ * \brief Check whether data looks like a binary device database
+ *
+ * Only the magic bytes are checked. Use load() to validate the data.
+ *
+ * \param data Data to check
+ *
+ * \return Whether \p data starts with the database magic
+ */
+bool DeviceDatabase::is_database(std::string_view data)
+{
+    return data.size() >= sizeof(DATABASE_MAGIC)
+            && memcmp(data.data(), DATABASE_MAGIC, sizeof(DATABASE_MAGIC)) == 0;
+}
+
+/*!
+ * \brief Load a binary device database
+ *
+ * Every offset in the database is validated here so that the accessors in
+ * DeviceView and StringListView can read the buffer without any bounds
+ * checks. The buffer is owned by the DeviceDatabase instance, so any views
+ * become invalid when the database is moved, reloaded, or destroyed.
+ *
+ * \param data Contents of a file generated by devicesgen or by
+ *             device_list_to_binary()
+ *
+ * \return Whether the database was successfully loaded. If false is returned,
+ *         the database will be empty.
+ */
+bool DeviceDatabase::load(std::string data)
+{
+    *this = DeviceDatabase();
+
+    if (data.size() < sizeof(RawHeader) || !is_database(data)
+            || data.size() > std::numeric_limits<uint32_t>::max()) {
+        return false;
+    }
+
+    auto const *buf = reinterpret_cast<const unsigned char *>(data.data());
+    auto const size = static_cast<uint64_t>(data.size());
+
+    auto header = [&](size_t offset) {
+        return read_u32(buf, offset);
+    };
+
+    if (header(offsetof(RawHeader, version)) != DATABASE_VERSION) {
+        return false;
+    }
+
+    uint32_t device_count = header(offsetof(RawHeader, device_count));
+    uint32_t devices_offset = header(offsetof(RawHeader, devices_offset));
+    uint32_t index_count = header(offsetof(RawHeader, index_count));
+    uint32_t index_offset = header(offsetof(RawHeader, index_offset));
+    uint32_t list_count = header(offsetof(RawHeader, list_count));
+    uint32_t lists_offset = header(offsetof(RawHeader, lists_offset));
+    uint32_t strings_size = header(offsetof(RawHeader, strings_size));
+    uint32_t strings_offset = header(offsetof(RawHeader, strings_offset));
+
+    auto section_ok = [&](uint64_t offset, uint64_t count, uint64_t entry_size) {
+        return offset >= sizeof(RawHeader) && offset + count * entry_size <= size;
+    };
+
+    if (!section_ok(devices_offset, device_count, sizeof(RawDevice))
+            || !section_ok(index_offset, index_count, sizeof(RawIndexEntry))
+            || !section_ok(lists_offset, list_count, STRING_LIST_ENTRY_SIZE)
+            || !section_ok(strings_offset, strings_size, 1)) {
+        return false;
+    }
+
+    auto string_ok = [&](size_t offset) {
+        uint64_t str_offset = read_u32(buf, offset + offsetof(RawString, offset));
+        uint64_t str_size = read_u32(buf, offset + offsetof(RawString, size));
+
+        // The terminating NUL byte must be inside the string data too
+        return str_offset + str_size < strings_size
+                && buf[strings_offset + str_offset + str_size] == '\0';
+    };
+
+    auto list_ok = [&](size_t offset) {
+        uint64_t list_offset = read_u32(buf, offset + offsetof(RawList, offset));
+        uint64_t list_size = read_u32(buf, offset + offsetof(RawList, count));
+
+        return list_offset + list_size <= list_count;
+    };
+
+    for (uint32_t i = 0; i < list_count; ++i) {
+        if (!string_ok(lists_offset + i * STRING_LIST_ENTRY_SIZE)) {
+            return false;
+        }
+    }
+
+    static constexpr size_t string_fields[] = {
+        offsetof(RawDevice, id),
+        offsetof(RawDevice, name),
+        offsetof(RawDevice, architecture),
+        offsetof(RawDevice, tw_brightness_path),
+        offsetof(RawDevice, tw_secondary_brightness_path),
+        offsetof(RawDevice, tw_battery_path),
+        offsetof(RawDevice, tw_cpu_temp_path),
+        offsetof(RawDevice, tw_input_blacklist),
+        offsetof(RawDevice, tw_input_whitelist),
+        offsetof(RawDevice, tw_theme),
+    };
+    static constexpr size_t list_fields[] = {
+        offsetof(RawDevice, codenames),
+        offsetof(RawDevice, base_dirs),
+        offsetof(RawDevice, system_devs),
+        offsetof(RawDevice, cache_devs),
+        offsetof(RawDevice, data_devs),
+        offsetof(RawDevice, boot_devs),
+        offsetof(RawDevice, recovery_devs),
+        offsetof(RawDevice, extra_devs),
+        offsetof(RawDevice, tw_graphics_backends),
+    };
+
+    for (uint32_t i = 0; i < device_count; ++i) {
+        size_t record = devices_offset + i * sizeof(RawDevice);
+
+        for (auto const offset : string_fields) {
+            if (!string_ok(record + offset)) {
+                return false;
+            }
+        }
+        for (auto const offset : list_fields) {
+            if (!list_ok(record + offset)) {
+                return false;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < index_count; ++i) {
+        size_t entry = index_offset + i * sizeof(RawIndexEntry);
+
+        if (!string_ok(entry + offsetof(RawIndexEntry, codename))
+                || read_u32(buf, entry + offsetof(RawIndexEntry, device))
+                        >= device_count) {
+            return false;
+        }
+    }
+
+    // The index must be sorted for find_by_codename() to work
+    for (uint32_t i = 1; i < index_count; ++i) {
+        size_t entry = index_offset + i * sizeof(RawIndexEntry);
+
+        if (read_string(buf, entry)
+                < read_string(buf, entry - sizeof(RawIndexEntry))) {
+            return false;
+        }
+    }
+
+    m_data = std::move(data);
+    m_device_count = device_count;
+    m_devices_offset = devices_offset;
+    m_index_count = index_count;
+    m_index_offset = index_offset;
+
+    return true;
+}
+
+/*!
+ * \brief Get the number of devices in the database
+ */
+size_t DeviceDatabase::size() const
+{
+    return m_device_count;
+}
+
+/*!
+ * \brief Get a device from the database
+ *
+ * \pre \p index is less than size()
+ *
+ * \param index Index of device
+ *
+ * \return View of the device. The view is only valid for as long as the
+ *         database is not modified.
+ */
+DeviceView DeviceDatabase::operator[](size_t index) const
+{
+    return {
+        reinterpret_cast<const unsigned char *>(m_data.data()),
+        static_cast<uint32_t>(m_devices_offset + index * sizeof(RawDevice))
+    };
+}
+
+/*!
+ * \brief Find a device by codename
+ *
+ * This does a binary search of the codename index. If multiple devices share
+ * a codename, the one that appears first in the database is returned.
+ *
+ * \param codename Device codename
+ *
+ * \return Device view or nothing if no device has the codename
+ */
+std::optional<DeviceView>
+DeviceDatabase::find_by_codename(std::string_view codename) const
+{
+    auto const *data = reinterpret_cast<const unsigned char *>(m_data.data());
+
+    uint32_t lo = 0;
+    uint32_t hi = m_index_count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (read_string(data, m_index_offset + mid * sizeof(RawIndexEntry))
+                < codename) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == m_index_count) {
+        return std::nullopt;
+    }
+
+    size_t entry = m_index_offset + lo * sizeof(RawIndexEntry);
+
+    if (read_string(data, entry) != codename) {
+        return std::nullopt;
+    }
+
+    return (*this)[read_u32(data, entry + offsetof(RawIndexEntry, device))];
+}
+
+/*!
+ * \brief Find a device by ID
+ *
+ * \param id Device ID
+ *
+ * \return Device view or nothing if no device has the ID
+ */
+std::optional<DeviceView> DeviceDatabase::find_by_id(std::string_view id) const
+{
+    for (size_t i = 0; i < m_device_count; ++i) {
+        auto device = (*this)[i];
+
+        if (device.id() == id) {
+            return device;
+        }
+    }
+
+    return std::nullopt;
+}
+
+namespace
+{
+
+class DatabaseWriter
+{
+public:
+    bool write(const std::vector<Device> &devices, std::string &data)
+    {
+        // Empty strings all point to the NUL byte at offset 0
+        add_string({});
+
+        for (auto const &device : devices) {
+            add_device(device);
+        }
+
+        std::stable_sort(m_index.begin(), m_index.end(),
+                         [](const IndexEntry &a, const IndexEntry &b) {
+            return a.codename < b.codename;
+        });
+
+        uint64_t devices_offset = sizeof(RawHeader);
+        uint64_t index_offset = devices_offset + m_devices.size();
+        uint64_t lists_offset = index_offset
+                + m_index.size() * sizeof(RawIndexEntry);
+        uint64_t strings_offset = lists_offset
+                + m_lists.size() * STRING_LIST_ENTRY_SIZE;
+        uint64_t total_size = strings_offset + m_strings.size();
+
+        if (total_size > std::numeric_limits<uint32_t>::max()) {
+            return false;
+        }
+
+        std::string out;
+        out.resize(static_cast<size_t>(strings_offset));
+
+        memcpy(out.data(), DATABASE_MAGIC, sizeof(DATABASE_MAGIC));
+        write_u32(out, offsetof(RawHeader, version), DATABASE_VERSION);
+        write_u32(out, offsetof(RawHeader, device_count),
+                  static_cast<uint32_t>(devices.size()));
+        write_u32(out, offsetof(RawHeader, devices_offset),
+                  static_cast<uint32_t>(devices_offset));
+        write_u32(out, offsetof(RawHeader, index_count),
+                  static_cast<uint32_t>(m_index.size()));
+        write_u32(out, offsetof(RawHeader, index_offset),
+                  static_cast<uint32_t>(index_offset));
+        write_u32(out, offsetof(RawHeader, list_count),
+                  static_cast<uint32_t>(m_lists.size()));
+        write_u32(out, offsetof(RawHeader, lists_offset),
+                  static_cast<uint32_t>(lists_offset));
+        write_u32(out, offsetof(RawHeader, strings_size),
+                  static_cast<uint32_t>(m_strings.size()));
+        write_u32(out, offsetof(RawHeader, strings_offset),
+                  static_cast<uint32_t>(strings_offset));
+
+        memcpy(out.data() + devices_offset, m_devices.data(),
+               m_devices.size());
+
+        for (size_t i = 0; i < m_index.size(); ++i) {
+            size_t entry = index_offset + i * sizeof(RawIndexEntry);
+            auto const &item = m_index[i];
+
+            write_string_ref(out, entry + offsetof(RawIndexEntry, codename),
+                             item.codename);
+            write_u32(out, entry + offsetof(RawIndexEntry, device),
+                      item.device);
+        }
+
+        for (size_t i = 0; i < m_lists.size(); ++i) {
+            write_string_ref(out, lists_offset + i * STRING_LIST_ENTRY_SIZE,
+                             m_lists[i]);
+        }
+
+        out += m_strings;
+
+        data.swap(out);
+        return true;
+    }
+
+private:
+    struct IndexEntry
+    {
+        std::string codename;
+        uint32_t device;
+    };
+
+    uint32_t add_string(const std::string &str)
+    {
+        auto it = m_string_offsets.find(str);
+        if (it != m_string_offsets.end()) {
+            return it->second;
+        }
+
+        auto offset = static_cast<uint32_t>(m_strings.size());
+        m_strings += str;
+        m_strings += '\0';
+        m_string_offsets.emplace(str, offset);
+
+        return offset;
+    }
+
+    void write_string_ref(std::string &out, size_t offset,
+                          const std::string &str)
+    {
+        write_u32(out, offset + offsetof(RawString, offset),
+                  m_string_offsets[str]);
+        write_u32(out, offset + offsetof(RawString, size),
+                  static_cast<uint32_t>(str.size()));
+    }
+
+    void set_u32(size_t record, size_t offset, uint32_t value)
+    {
+        write_u32(m_devices, record + offset, value);
+    }
+
+    void set_string(size_t record, size_t offset, const std::string &str)
+    {
+        uint32_t str_offset = add_string(str);
+
+        set_u32(record, offset + offsetof(RawString, offset), str_offset);
+        set_u32(record, offset + offsetof(RawString, size),
+                static_cast<uint32_t>(str.size()));
+    }
+
+    void set_list(size_t record, size_t offset,
+                  const std::vector<std::string> &list)
+    {
+        set_u32(record, offset + offsetof(RawList, offset),
+                static_cast<uint32_t>(m_lists.size()));
+        set_u32(record, offset + offsetof(RawList, count),
+                static_cast<uint32_t>(list.size()));
+
+        for (auto const &item : list) {
+            add_string(item);
+            m_lists.push_back(item);
+        }
+    }
+
+    void add_device(const Device &device)
+    {
+        size_t record = m_devices.size();
+        auto index = static_cast<uint32_t>(record / sizeof(RawDevice));
+
+        m_devices.resize(record + sizeof(RawDevice));
+
+        set_string(record, offsetof(RawDevice, id), device.id());
+        set_list(record, offsetof(RawDevice, codenames), device.codenames());
+        set_string(record, offsetof(RawDevice, name), device.name());
+        set_string(record, offsetof(RawDevice, architecture),
+                   device.architecture());
+        set_u32(record, offsetof(RawDevice, flags), device.flags());
+
+        set_list(record, offsetof(RawDevice, base_dirs),
+                 device.block_dev_base_dirs());
+        set_list(record, offsetof(RawDevice, system_devs),
+                 device.system_block_devs());
+        set_list(record, offsetof(RawDevice, cache_devs),
+                 device.cache_block_devs());
+        set_list(record, offsetof(RawDevice, data_devs),
+                 device.data_block_devs());
+        set_list(record, offsetof(RawDevice, boot_devs),
+                 device.boot_block_devs());
+        set_list(record, offsetof(RawDevice, recovery_devs),
+                 device.recovery_block_devs());
+        set_list(record, offsetof(RawDevice, extra_devs),
+                 device.extra_block_devs());
+
+        set_u32(record, offsetof(RawDevice, tw_supported),
+                device.tw_supported());
+        set_u32(record, offsetof(RawDevice, tw_flags), device.tw_flags());
+        set_u32(record, offsetof(RawDevice, tw_pixel_format),
+                static_cast<uint32_t>(device.tw_pixel_format()));
+        set_u32(record, offsetof(RawDevice, tw_force_pixel_format),
+                static_cast<uint32_t>(device.tw_force_pixel_format()));
+        set_u32(record, offsetof(RawDevice, tw_overscan_percent),
+                static_cast<uint32_t>(device.tw_overscan_percent()));
+        set_u32(record, offsetof(RawDevice, tw_default_x_offset),
+                static_cast<uint32_t>(device.tw_default_x_offset()));
+        set_u32(record, offsetof(RawDevice, tw_default_y_offset),
+                static_cast<uint32_t>(device.tw_default_y_offset()));
+        set_string(record, offsetof(RawDevice, tw_brightness_path),
+                   device.tw_brightness_path());
+        set_string(record, offsetof(RawDevice, tw_secondary_brightness_path),
+                   device.tw_secondary_brightness_path());
+        set_u32(record, offsetof(RawDevice, tw_max_brightness),
+                static_cast<uint32_t>(device.tw_max_brightness()));
+        set_u32(record, offsetof(RawDevice, tw_default_brightness),
+                static_cast<uint32_t>(device.tw_default_brightness()));
+        set_string(record, offsetof(RawDevice, tw_battery_path),
+                   device.tw_battery_path());
+        set_string(record, offsetof(RawDevice, tw_cpu_temp_path),
+                   device.tw_cpu_temp_path());
+        set_string(record, offsetof(RawDevice, tw_input_blacklist),
+                   device.tw_input_blacklist());
+        set_string(record, offsetof(RawDevice, tw_input_whitelist),
+                   device.tw_input_whitelist());
+        set_list(record, offsetof(RawDevice, tw_graphics_backends),
+                 device.tw_graphics_backends());
+        set_string(record, offsetof(RawDevice, tw_theme), device.tw_theme());
+
+        for (auto const &codename : device.codenames()) {
+            m_index.push_back({codename, index});
+        }
+    }
+
+    std::string m_devices;
+    std::vector<IndexEntry> m_index;
+    std::vector<std::string> m_lists;
+    std::string m_strings;
+    std::unordered_map<std::string, uint32_t> m_string_offsets;
+};
+
+}
+
+/*!
+ * \brief Serialize a list of devices to the binary device database format
+ *
+ * \param[in] devices List of devices
+ * \param[out] data Output buffer
+ *
+ * \return Whether the devices were successfully serialized. This only fails
+ *         if the database would be larger than 4 GiB.
+ */
+bool device_list_to_binary(const std::vector<Device> &devices,
+                           std::string &data)
+{
+    return DatabaseWriter().write(devices, data);
+}
+
+}
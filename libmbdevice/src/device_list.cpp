@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbdevice/device_list.h"
+
+
+namespace mb::device
+{
+
+DeviceList::DeviceList() = default;
+
+/*!
+ * \brief Construct a device list with a codename index
+ *
+ * If multiple devices share a codename, find_by_codename() returns the one
+ * that appears first in \p devices.
+ *
+ * \param devices List of devices
+ */
+DeviceList::DeviceList(std::vector<Device> devices)
+    : m_devices(std::move(devices))
+{
+    for (size_t i = 0; i < m_devices.size(); ++i) {
+        for (auto const &codename : m_devices[i].codenames()) {
+            m_codenames.emplace(codename, i);
+        }
+    }
+}
+
+DeviceList::~DeviceList() = default;
+
+/*!
+ * \brief Get the list of devices
+ *
+ * \return List of devices in their original order
+ */
+const std::vector<Device> & DeviceList::devices() const
+{
+    return m_devices;
+}
+
+/*!
+ * \brief Find a device by codename
+ *
+ * \param codename Device codename
+ *
+ * \return Pointer to device or nullptr if no device has the codename. The
+ *         pointer is valid for as long as the list exists.
+ */
+const Device * DeviceList::find_by_codename(std::string_view codename) const
+{
+    auto it = m_codenames.find(codename);
+    if (it == m_codenames.end()) {
+        return nullptr;
+    }
+
+    return &m_devices[it->second];
+}
+
+}
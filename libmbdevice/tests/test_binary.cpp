@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/binary.h"
+#include "mbdevice/device.h"
+
+using namespace mb::device;
+
+static Device create_complete_device()
+{
+    Device device;
+
+    device.set_id("test");
+    device.set_codenames({"test1", "test2", "test3", "test4"});
+    device.set_name("Test Device");
+    device.set_architecture("arm64-v8a");
+    device.set_flags(DeviceFlag::HasCombinedBootAndRecovery);
+    device.set_block_dev_base_dirs({"/dev/block/bootdevice/by-name"});
+    device.set_system_block_devs({
+        "/dev/block/bootdevice/by-name/system",
+        "/dev/block/sda1",
+    });
+    device.set_cache_block_devs({
+        "/dev/block/bootdevice/by-name/cache",
+        "/dev/block/sda2",
+    });
+    device.set_data_block_devs({
+        "/dev/block/bootdevice/by-name/userdata",
+        "/dev/block/sda3",
+    });
+    device.set_boot_block_devs({
+        "/dev/block/bootdevice/by-name/boot",
+        "/dev/block/sda4",
+    });
+    device.set_recovery_block_devs({
+        "/dev/block/bootdevice/by-name/recovery",
+        "/dev/block/sda5",
+    });
+    device.set_extra_block_devs({
+        "/dev/block/bootdevice/by-name/modem",
+        "/dev/block/sda6",
+    });
+    device.set_tw_supported(true);
+    device.set_tw_flags(TwFlag::TouchscreenSwapXY | TwFlag::RoundScreen);
+    device.set_tw_pixel_format(TwPixelFormat::Rgba8888);
+    device.set_tw_force_pixel_format(TwForcePixelFormat::Rgb565);
+    device.set_tw_overscan_percent(10);
+    device.set_tw_default_x_offset(-20);
+    device.set_tw_default_y_offset(30);
+    device.set_tw_brightness_path("/sys/class/backlight");
+    device.set_tw_secondary_brightness_path("/sys/class/lcd-backlight");
+    device.set_tw_max_brightness(255);
+    device.set_tw_default_brightness(100);
+    device.set_tw_battery_path("/sys/class/battery");
+    device.set_tw_cpu_temp_path("/sys/class/cputemp");
+    device.set_tw_input_blacklist("foo");
+    device.set_tw_input_whitelist("bar");
+    device.set_tw_graphics_backends({"overlay_msm_old", "fbdev"});
+    device.set_tw_theme("portrait_hdpi");
+
+    return device;
+}
+
+static Device create_device(const char *id, std::vector<std::string> codenames)
+{
+    Device device;
+    device.set_id(id);
+    device.set_codenames(std::move(codenames));
+    return device;
+}
+
+TEST(BinaryTest, RoundTripCompleteDevice)
+{
+    Device device = create_complete_device();
+    std::string data;
+    DeviceDatabase db;
+
+    ASSERT_TRUE(device_list_to_binary({device}, data));
+    ASSERT_TRUE(DeviceDatabase::is_database(data));
+    ASSERT_TRUE(db.load(std::move(data)));
+    ASSERT_EQ(db.size(), 1u);
+
+    auto view = db[0];
+    ASSERT_EQ(view.id(), "test");
+    ASSERT_EQ(view.codenames().size(), 4u);
+    ASSERT_EQ(view.codenames()[2], "test3");
+    ASSERT_EQ(view.name(), "Test Device");
+    ASSERT_EQ(view.flags(), DeviceFlags(DeviceFlag::HasCombinedBootAndRecovery));
+    ASSERT_EQ(view.system_block_devs()[1], "/dev/block/sda1");
+    ASSERT_EQ(view.tw_default_x_offset(), -20);
+    ASSERT_EQ(view.tw_graphics_backends()[1], "fbdev");
+
+    ASSERT_EQ(view.to_device(), device);
+}
+
+TEST(BinaryTest, RoundTripDefaultDevice)
+{
+    Device device;
+    std::string data;
+    DeviceDatabase db;
+
+    ASSERT_TRUE(device_list_to_binary({device}, data));
+    ASSERT_TRUE(db.load(std::move(data)));
+    ASSERT_EQ(db.size(), 1u);
+
+    auto view = db[0];
+    ASSERT_TRUE(view.id().empty());
+    ASSERT_TRUE(view.codenames().empty());
+    ASSERT_EQ(view.tw_max_brightness(), -1);
+
+    ASSERT_EQ(view.to_device(), device);
+}
+
+TEST(BinaryTest, FindByCodename)
+{
+    std::string data;
+    DeviceDatabase db;
+
+    ASSERT_TRUE(device_list_to_binary({
+        create_device("zzz", {"c", "a"}),
+        create_device("yyy", {"b"}),
+        create_device("xxx", {"a", "d"}),
+    }, data));
+    ASSERT_TRUE(db.load(std::move(data)));
+    ASSERT_EQ(db.size(), 3u);
+
+    // First device in the list wins for duplicate codenames
+    auto view = db.find_by_codename("a");
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view->id(), "zzz");
+
+    view = db.find_by_codename("b");
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view->id(), "yyy");
+
+    view = db.find_by_codename("d");
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view->id(), "xxx");
+
+    ASSERT_FALSE(db.find_by_codename(""));
+    ASSERT_FALSE(db.find_by_codename("0"));
+    ASSERT_FALSE(db.find_by_codename("e"));
+}
+
+TEST(BinaryTest, FindById)
+{
+    std::string data;
+    DeviceDatabase db;
+
+    ASSERT_TRUE(device_list_to_binary({
+        create_device("foo", {"a"}),
+        create_device("bar", {"b"}),
+    }, data));
+    ASSERT_TRUE(db.load(std::move(data)));
+
+    auto view = db.find_by_id("bar");
+    ASSERT_TRUE(view);
+    ASSERT_EQ(view->codenames()[0], "b");
+
+    ASSERT_FALSE(db.find_by_id("baz"));
+}
+
+TEST(BinaryTest, EmptyList)
+{
+    std::string data;
+    DeviceDatabase db;
+
+    ASSERT_TRUE(device_list_to_binary({}, data));
+    ASSERT_TRUE(db.load(std::move(data)));
+    ASSERT_EQ(db.size(), 0u);
+    ASSERT_FALSE(db.find_by_codename("a"));
+}
+
+TEST(BinaryTest, RejectInvalidData)
+{
+    std::string data;
+    DeviceDatabase db;
+
+    ASSERT_FALSE(db.load({}));
+    ASSERT_FALSE(db.load("{\"id\": \"test\"}"));
+
+    ASSERT_TRUE(device_list_to_binary({create_complete_device()}, data));
+
+    // Truncated
+    ASSERT_FALSE(db.load(data.substr(0, data.size() - 1)));
+    ASSERT_EQ(db.size(), 0u);
+
+    // Bad magic
+    {
+        std::string copy = data;
+        copy[0] = 'X';
+        ASSERT_FALSE(db.load(std::move(copy)));
+    }
+
+    // Bad version
+    {
+        std::string copy = data;
+        copy[8] = 2;
+        ASSERT_FALSE(db.load(std::move(copy)));
+    }
+
+    // String reference past the end of the string data (the device ID size
+    // is the second field of the first record)
+    {
+        std::string copy = data;
+        copy[48 + 4] = '\xff';
+        copy[48 + 5] = '\xff';
+        ASSERT_FALSE(db.load(std::move(copy)));
+    }
+
+    // Missing NUL terminator
+    {
+        std::string copy = data;
+        copy.back() = 'x';
+        ASSERT_FALSE(db.load(std::move(copy)));
+    }
+
+    ASSERT_TRUE(db.load(std::move(data)));
+    ASSERT_EQ(db.size(), 1u);
+}
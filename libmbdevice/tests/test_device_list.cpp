@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include "mbdevice/device_list.h"
+
+using namespace mb::device;
+
+static Device create_device(const char *id, std::vector<std::string> codenames)
+{
+    Device device;
+    device.set_id(id);
+    device.set_codenames(std::move(codenames));
+    return device;
+}
+
+TEST(DeviceListTest, FindByCodename)
+{
+    DeviceList list({
+        create_device("zzz", {"c", "a"}),
+        create_device("yyy", {"b"}),
+        create_device("xxx", {"a", "d"}),
+    });
+
+    ASSERT_EQ(list.devices().size(), 3u);
+    ASSERT_EQ(list.devices()[1].id(), "yyy");
+
+    // First device in the list wins for duplicate codenames
+    auto const *device = list.find_by_codename("a");
+    ASSERT_NE(device, nullptr);
+    ASSERT_EQ(device->id(), "zzz");
+
+    device = list.find_by_codename("d");
+    ASSERT_NE(device, nullptr);
+    ASSERT_EQ(device->id(), "xxx");
+
+    ASSERT_EQ(list.find_by_codename("e"), nullptr);
+}
+
+TEST(DeviceListTest, MovePreservesIndex)
+{
+    DeviceList list({
+        create_device("foo", {"a"}),
+        create_device("bar", {"b"}),
+    });
+    DeviceList moved(std::move(list));
+
+    auto const *device = moved.find_by_codename("b");
+    ASSERT_NE(device, nullptr);
+    ASSERT_EQ(device->id(), "bar");
+    ASSERT_EQ(device, &moved.devices()[1]);
+}
+
+TEST(DeviceListTest, EmptyList)
+{
+    DeviceList list;
+
+    ASSERT_TRUE(list.devices().empty());
+    ASSERT_EQ(list.find_by_codename("a"), nullptr);
+}
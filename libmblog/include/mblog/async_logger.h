@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "mblog/base_logger.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace mb::log
+{
+
+/*!
+ * \brief Logger that writes records to another logger in a background thread
+ *
+ * log() only copies the record into a bounded lock-free queue, so callers never
+ * wait for the underlying logger's I/O. The background thread takes records off
+ * the queue in batches and passes them to BaseLogger::log_batch(). If the queue
+ * is full, records are dropped and the number of dropped records is logged once
+ * there is room again.
+ *
+ * Call flush() before doing anything that may prevent the background thread
+ * from running, such as rebooting or exec'ing another program. If the process
+ * forks, the child process logs synchronously to the underlying logger.
+ */
+class MB_EXPORT AsyncLogger : public BaseLogger
+{
+public:
+    AsyncLogger(std::shared_ptr<BaseLogger> logger, size_t capacity = 4096);
+    virtual ~AsyncLogger();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(AsyncLogger)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(AsyncLogger)
+
+    virtual void log(const LogRecord &rec) override;
+
+    virtual void flush() override;
+
+    virtual bool formatted() override;
+
+private:
+    struct Cell;
+
+    bool is_forked() const;
+    bool try_pop(LogRecord &rec);
+    void run();
+
+    std::shared_ptr<BaseLogger> _logger;
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    std::atomic_size_t _enqueue_pos;
+    size_t _dequeue_pos;
+    std::atomic_size_t _written_pos;
+    std::atomic_uint64_t _dropped;
+
+    std::mutex _mutex;
+    std::condition_variable _work_cv;
+    std::condition_variable _flush_cv;
+    std::atomic_bool _sleeping;
+    bool _stop;
+
+    unsigned int _fork_generation;
+    std::thread _thread;
+};
+
+}
@@ -19,6 +19,8 @@
 
 #pragma once
 
+#include <cstddef>
+
 #include "mbcommon/common.h"
 
 #include "mblog/log_level.h"
@@ -35,6 +37,10 @@ public:
 
     virtual void log(const LogRecord &rec) = 0;
 
+    virtual void log_batch(const LogRecord *recs, size_t count);
+
+    virtual void flush();
+
     virtual bool formatted() = 0;
 };
 
@@ -27,16 +27,38 @@
 
 #include "mblog/log_level.h"
 
+// Numeric log levels for MB_LOG_MIN_LEVEL (same order as mb::log::LogLevel)
+#define MB_LOG_LEVEL_ERROR      0
+#define MB_LOG_LEVEL_WARNING    1
+#define MB_LOG_LEVEL_INFO       2
+#define MB_LOG_LEVEL_DEBUG      3
+#define MB_LOG_LEVEL_VERBOSE    4
+
+// Least severe level whose call sites are compiled in. Messages below it are
+// removed at compile time and their arguments are never evaluated.
+#ifndef MB_LOG_MIN_LEVEL
+#  define MB_LOG_MIN_LEVEL MB_LOG_LEVEL_VERBOSE
+#endif
+
+#define MB_LOG_IF_ENABLED(LEVEL, EXPR) \
+    ((MB_LOG_LEVEL_ ## LEVEL <= MB_LOG_MIN_LEVEL) \
+        ? (EXPR) : static_cast<void>(0))
+
 #define TLOGE(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(ERROR, \
+        mb::log::log(mb::log::LogLevel::Error, (TAG), __VA_ARGS__))
 #define TLOGW(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(WARNING, \
+        mb::log::log(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__))
 #define TLOGI(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(INFO, \
+        mb::log::log(mb::log::LogLevel::Info, (TAG), __VA_ARGS__))
 #define TLOGD(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(DEBUG, \
+        mb::log::log(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__))
 #define TLOGV(TAG, ...) \
-    mb::log::log(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(VERBOSE, \
+        mb::log::log(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__))
 
 #define LOGE(...) TLOGE(LOG_TAG, __VA_ARGS__)
 #define LOGW(...) TLOGW(LOG_TAG, __VA_ARGS__)
@@ -45,15 +67,20 @@
 #define LOGV(...) TLOGV(LOG_TAG, __VA_ARGS__)
 
 #define TVLOGE(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Error, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(ERROR, \
+        mb::log::log_v(mb::log::LogLevel::Error, (TAG), __VA_ARGS__))
 #define TVLOGW(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(WARNING, \
+        mb::log::log_v(mb::log::LogLevel::Warning, (TAG), __VA_ARGS__))
 #define TVLOGI(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Info, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(INFO, \
+        mb::log::log_v(mb::log::LogLevel::Info, (TAG), __VA_ARGS__))
 #define TVLOGD(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(DEBUG, \
+        mb::log::log_v(mb::log::LogLevel::Debug, (TAG), __VA_ARGS__))
 #define TVLOGV(TAG, ...) \
-    mb::log::log_v(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__)
+    MB_LOG_IF_ENABLED(VERBOSE, \
+        mb::log::log_v(mb::log::LogLevel::Verbose, (TAG), __VA_ARGS__))
 
 #define VLOGE(...) TVLOGE(LOG_TAG, __VA_ARGS__)
 #define VLOGW(...) TVLOGW(LOG_TAG, __VA_ARGS__)
@@ -73,6 +100,8 @@ MB_PRINTF(3, 4)
 MB_EXPORT void log(LogLevel prio, const char *tag, const char *fmt, ...);
 MB_EXPORT void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap);
 
+MB_EXPORT void flush();
+
 MB_EXPORT std::string format();
 MB_EXPORT void set_format(std::string fmt);
 
@@ -33,6 +33,8 @@ public:
 
     virtual void log(const LogRecord &rec) override;
 
+    virtual void log_batch(const LogRecord *recs, size_t count) override;
+
     virtual bool formatted() override;
 
 private:
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/async_logger.h"
+
+#include <chrono>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+
+#ifndef _WIN32
+#  include <pthread.h>
+#endif
+
+#include "mblog/log_record.h"
+
+namespace mb::log
+{
+
+// Maximum number of records passed to the underlying logger at once
+static constexpr size_t BATCH_SIZE = 64;
+
+// Upper bound on how long a record can sit in the queue if a wakeup is missed
+static constexpr auto IDLE_TIMEOUT = std::chrono::milliseconds(50);
+
+// Upper bound on how long flush() waits for the background thread
+static constexpr auto FLUSH_TIMEOUT = std::chrono::seconds(2);
+
+static std::atomic_uint g_fork_generation{0};
+
+static void register_fork_handler()
+{
+#ifndef _WIN32
+    static std::once_flag once;
+
+    std::call_once(once, [] {
+        pthread_atfork(nullptr, nullptr, [] {
+            g_fork_generation.fetch_add(1, std::memory_order_relaxed);
+        });
+    });
+#endif
+}
+
+struct AsyncLogger::Cell
+{
+    std::atomic_size_t seq;
+    LogRecord rec;
+};
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t result = 2;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+AsyncLogger::AsyncLogger(std::shared_ptr<BaseLogger> logger, size_t capacity)
+    : _logger(std::move(logger))
+    , _cells(new Cell[round_up_pow2(capacity)])
+    , _mask(round_up_pow2(capacity) - 1)
+    , _enqueue_pos(0)
+    , _dequeue_pos(0)
+    , _written_pos(0)
+    , _dropped(0)
+    , _sleeping(false)
+    , _stop(false)
+{
+    register_fork_handler();
+    _fork_generation = g_fork_generation.load(std::memory_order_relaxed);
+
+    for (size_t i = 0; i <= _mask; ++i) {
+        _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    _thread = std::thread(&AsyncLogger::run, this);
+}
+
+AsyncLogger::~AsyncLogger()
+{
+    if (is_forked()) {
+        // The background thread only exists in the parent process
+        _thread.detach();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _work_cv.notify_one();
+
+    _thread.join();
+}
+
+bool AsyncLogger::is_forked() const
+{
+    return _fork_generation
+            != g_fork_generation.load(std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Queue a record
+ *
+ * This is safe to call from multiple threads at the same time. A slot in the
+ * queue is claimed with a compare-and-swap of the enqueue position and the
+ * record is then copied into it, reusing the slot's string buffers.
+ */
+void AsyncLogger::log(const LogRecord &rec)
+{
+    if (is_forked()) {
+        _logger->log(rec);
+        return;
+    }
+
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+
+    while (true) {
+        cell = &_cells[pos & _mask];
+        size_t seq = cell->seq.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+        if (diff == 0) {
+            if (_enqueue_pos.compare_exchange_weak(
+                    pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Queue is full
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->rec.time = rec.time;
+    cell->rec.pid = rec.pid;
+    cell->rec.tid = rec.tid;
+    cell->rec.prio = rec.prio;
+    cell->rec.tag = rec.tag;
+    cell->rec.msg = rec.msg;
+    cell->rec.fmt_msg = rec.fmt_msg;
+
+    cell->seq.store(pos + 1, std::memory_order_release);
+
+    if (_sleeping.load(std::memory_order_acquire)) {
+        _work_cv.notify_one();
+    }
+}
+
+/*!
+ * \brief Wait until every record queued before this call has been written
+ *
+ * This gives up after a few seconds so that a stuck underlying logger cannot
+ * hang the caller (eg. when rebooting after a critical failure).
+ */
+void AsyncLogger::flush()
+{
+    if (is_forked() || std::this_thread::get_id() == _thread.get_id()) {
+        _logger->flush();
+        return;
+    }
+
+    size_t target = _enqueue_pos.load(std::memory_order_acquire);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _work_cv.notify_one();
+    _flush_cv.wait_for(lock, FLUSH_TIMEOUT, [&] {
+        return _written_pos.load(std::memory_order_acquire) >= target;
+    });
+}
+
+bool AsyncLogger::formatted()
+{
+    return _logger->formatted();
+}
+
+bool AsyncLogger::try_pop(LogRecord &rec)
+{
+    Cell &cell = _cells[_dequeue_pos & _mask];
+
+    if (cell.seq.load(std::memory_order_acquire) != _dequeue_pos + 1) {
+        return false;
+    }
+
+    // Swap instead of moving so that the cell keeps a set of allocated
+    // strings for the next record written to it
+    std::swap(rec, cell.rec);
+
+    cell.seq.store(_dequeue_pos + _mask + 1, std::memory_order_release);
+    ++_dequeue_pos;
+
+    return true;
+}
+
+void AsyncLogger::run()
+{
+    std::vector<LogRecord> batch(BATCH_SIZE + 1);
+
+    while (true) {
+        size_t n = 0;
+
+        while (n < BATCH_SIZE && try_pop(batch[n])) {
+            ++n;
+        }
+
+        if (uint64_t dropped = _dropped.exchange(
+                0, std::memory_order_relaxed)) {
+            LogRecord &rec = batch[n++];
+            char buf[64];
+
+            snprintf(buf, sizeof(buf), "Dropped %" PRIu64 " log records",
+                     dropped);
+
+            rec.time = std::chrono::system_clock::now();
+            rec.pid = 0;
+            rec.tid = 0;
+            rec.prio = LogLevel::Warning;
+            rec.tag = "mblog";
+            rec.msg = buf;
+            rec.fmt_msg = buf;
+        }
+
+        if (n > 0) {
+            _logger->log_batch(batch.data(), n);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            _written_pos.store(_dequeue_pos, std::memory_order_release);
+            _flush_cv.notify_all();
+
+            if (n > 0) {
+                continue;
+            }
+
+            if (_stop) {
+                break;
+            }
+
+            _sleeping.store(true, std::memory_order_release);
+            _work_cv.wait_for(lock, IDLE_TIMEOUT);
+            _sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    _logger->flush();
+}
+
+}
@@ -30,4 +30,26 @@ BaseLogger::~BaseLogger()
 {
 }
 
+/*!
+ * \brief Log several records at once
+ *
+ * The default implementation calls log() for each record. Loggers that can
+ * write multiple records more efficiently should override this.
+ */
+void BaseLogger::log_batch(const LogRecord *recs, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        log(recs[i]);
+    }
+}
+
+/*!
+ * \brief Wait until all records passed to the logger have been written
+ *
+ * The default implementation does nothing because log() is synchronous.
+ */
+void BaseLogger::flush()
+{
+}
+
 }
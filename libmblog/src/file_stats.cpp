@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mblog/file_stats.h"
+
+#include <cinttypes>
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbcommon/file"
+
+namespace mb::log
+{
+
+static double to_ms(std::chrono::nanoseconds duration)
+{
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+static const char * op_name(FileOp op)
+{
+    switch (op) {
+    case FileOp::Read:
+        return "read";
+    case FileOp::Write:
+        return "write";
+    case FileOp::Seek:
+        return "seek";
+    case FileOp::Truncate:
+        return "truncate";
+    case FileOp::ReadAt:
+        return "read_at";
+    case FileOp::WriteAt:
+        return "write_at";
+    case FileOp::Readv:
+        return "readv";
+    case FileOp::Writev:
+        return "writev";
+    default:
+        return "unknown";
+    }
+}
+
+/*!
+ * \brief Log the I/O counters of a File handle
+ *
+ * \param prio Log level
+ * \param tag Log tag
+ * \param name Description of the file to include in the message
+ * \param stats Counters from File::stats()
+ */
+void log_file_stats(LogLevel prio, const char *tag,
+                    const char *name, const FileStats &stats)
+{
+    log(prio, tag, "%s: %" PRIu64 " reads (%" PRIu64 " bytes, %.3f ms), "
+        "%" PRIu64 " writes (%" PRIu64 " bytes, %.3f ms), "
+        "%" PRIu64 " seeks (%.3f ms), %" PRIu64 " truncates (%.3f ms), "
+        "%" PRIu64 " errors",
+        name,
+        stats.n_read, stats.bytes_read, to_ms(stats.time_read),
+        stats.n_write, stats.bytes_written, to_ms(stats.time_write),
+        stats.n_seek, to_ms(stats.time_seek),
+        stats.n_truncate, to_ms(stats.time_truncate),
+        stats.n_error);
+}
+
+/*!
+ * \brief Trace hook that logs every file operation
+ *
+ * This can be passed to File::set_trace_hook(). Each operation is logged at
+ * the verbose level.
+ */
+void log_file_op(File &file, const FileOpInfo &info)
+{
+    if (info.error) {
+        LOGV("%p: %s failed after %.3f ms: %s",
+             static_cast<void *>(&file), op_name(info.op),
+             to_ms(info.duration), info.error.message().c_str());
+    } else {
+        LOGV("%p: %s: %" PRIu64 " bytes in %.3f ms",
+             static_cast<void *>(&file), op_name(info.op), info.bytes,
+             to_ms(info.duration));
+    }
+}
+
+}
@@ -19,14 +19,16 @@
 
 #include "mblog/logging.h"
 
+#include <algorithm>
 #include <chrono>
 #include <mutex>
-#include <optional>
 #include <string>
+#include <vector>
 
 #include <cerrno>
 #include <cinttypes>
 #include <cstdarg>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 
@@ -63,11 +65,6 @@ using Tid = pid_t;
 #endif
 
 
-static std::shared_ptr<BaseLogger> g_logger;
-static std::mutex g_mutex;
-
-static std::string g_format{"[%t][%P:%T][%l] %N: %m"};
-
 // %l - Level
 // %m - Message
 // %n - Tag
@@ -76,6 +73,100 @@ static std::string g_format{"[%t][%P:%T][%l] %N: %m"};
 // %P - Process ID
 // %T - Thread ID
 
+enum class FormatTokenType
+{
+    Literal,
+    Level,
+    Message,
+    Tag,
+    ShortTag,
+    Time,
+    ProcessId,
+    ThreadId,
+};
+
+struct FormatToken
+{
+    FormatTokenType type;
+    std::string literal;
+};
+
+//! Format string that was split into tokens by set_format()
+struct ParsedFormat
+{
+    std::string str;
+    std::vector<FormatToken> tokens;
+};
+
+static ParsedFormat _parse_format(std::string fmt)
+{
+    ParsedFormat parsed;
+    std::string literal;
+
+    auto add_token = [&](FormatTokenType type) {
+        if (!literal.empty()) {
+            parsed.tokens.push_back({FormatTokenType::Literal,
+                                     std::move(literal)});
+            literal.clear();
+        }
+        parsed.tokens.push_back({type, {}});
+    };
+
+    for (auto it = fmt.begin(); it != fmt.end(); ++it) {
+        if (*it != '%') {
+            literal += *it;
+            continue;
+        } else if (it + 1 == fmt.end()) {
+            literal += '%';
+            break;
+        }
+
+        ++it;
+
+        switch (*it) {
+        case 'l':
+            add_token(FormatTokenType::Level);
+            break;
+        case 'm':
+            add_token(FormatTokenType::Message);
+            break;
+        case 'n':
+            add_token(FormatTokenType::Tag);
+            break;
+        case 'N':
+            add_token(FormatTokenType::ShortTag);
+            break;
+        case 't':
+            add_token(FormatTokenType::Time);
+            break;
+        case 'P':
+            add_token(FormatTokenType::ProcessId);
+            break;
+        case 'T':
+            add_token(FormatTokenType::ThreadId);
+            break;
+        default:
+            literal += *it;
+            break;
+        }
+    }
+
+    if (!literal.empty()) {
+        parsed.tokens.push_back({FormatTokenType::Literal, std::move(literal)});
+    }
+
+    parsed.str = std::move(fmt);
+
+    return parsed;
+}
+
+static std::shared_ptr<BaseLogger> g_logger;
+static std::mutex g_mutex;
+
+static std::shared_ptr<const ParsedFormat> g_format =
+        std::make_shared<const ParsedFormat>(
+                _parse_format("[%t][%P:%T][%l] %N: %m"));
+
 
 static Pid _get_pid()
 {
@@ -273,21 +364,27 @@ static bool _local_time_ns(const std::chrono::system_clock::time_point &tp,
     return true;
 }
 
-static std::string _format_iso8601(const std::tm &tm, long nanoseconds,
-                                   long gmtoff)
+static void _format_iso8601(std::string &buf, const std::tm &tm,
+                            long nanoseconds, long gmtoff)
 {
     // Sample: 2017-09-17T23:27:00.000000000+00:00
-    return mb::format("%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02ld:%02ld",
-                      tm.tm_year + 1900,
-                      tm.tm_mon + 1,
-                      tm.tm_mday,
-                      tm.tm_hour,
-                      tm.tm_min,
-                      tm.tm_sec,
-                      nanoseconds,
-                      gmtoff >= 0 ? '+' : '-',
-                      std::abs(gmtoff) / 3600,
-                      std::abs(gmtoff / 60) % 60);
+    char time_buf[128];
+    int n = snprintf(time_buf, sizeof(time_buf),
+                     "%04d-%02d-%02dT%02d:%02d:%02d.%09ld%c%02ld:%02ld",
+                     tm.tm_year + 1900,
+                     tm.tm_mon + 1,
+                     tm.tm_mday,
+                     tm.tm_hour,
+                     tm.tm_min,
+                     tm.tm_sec,
+                     nanoseconds,
+                     gmtoff >= 0 ? '+' : '-',
+                     std::abs(gmtoff) / 3600,
+                     std::abs(gmtoff / 60) % 60);
+    if (n > 0) {
+        buf.append(time_buf, std::min(static_cast<size_t>(n),
+                                      sizeof(time_buf) - 1));
+    }
 }
 
 static char _format_prio(LogLevel prio)
@@ -308,95 +405,132 @@ static char _format_prio(LogLevel prio)
     }
 }
 
-static std::string _format_short_tag(std::string_view tag)
+static void _format_short_tag(std::string &buf, std::string_view tag)
 {
     // Keep first letter in each component
-    auto pieces = split_sv(tag, '/');
-    if (!pieces.empty()) {
-        for (auto it = pieces.begin(); it != pieces.end() - 1; ++it) {
-            if (!it->empty() && isalnum(it->front())) {
-                *it = it->substr(0, 1);
-            }
+    while (true) {
+        auto pos = tag.find('/');
+        if (pos == std::string_view::npos) {
+            buf += tag;
+            break;
+        }
+
+        auto piece = tag.substr(0, pos);
+        if (!piece.empty() && isalnum(piece.front())) {
+            buf += piece.front();
+        } else {
+            buf += piece;
         }
+        buf += '/';
+
+        tag.remove_prefix(pos + 1);
     }
-    return join(pieces, '/');
 }
 
-static std::string _format_rec(const LogRecord &rec)
+static void _format_uint(std::string &buf, uint64_t n)
 {
-    std::string buf;
-    std::optional<std::string> time_buf;
-
-    for (auto it = g_format.begin(); it != g_format.end(); ++it) {
-        if (*it == '%') {
-            if (it + 1 == g_format.end()) {
-                buf += '%';
-                break;
-            }
+    char num_buf[24];
+    int len = snprintf(num_buf, sizeof(num_buf), "%" PRIu64, n);
+    if (len > 0) {
+        buf.append(num_buf, static_cast<size_t>(len));
+    }
+}
 
-            ++it;
+/*!
+ * \brief Format a message into a reusable buffer
+ */
+static void _format_msg(std::string &buf, const char *fmt, va_list ap)
+{
+    va_list copy;
 
-            switch (*it) {
-            case 'l':
-                buf += _format_prio(rec.prio);
-                break;
+    buf.resize(std::max<size_t>(buf.capacity(), 255));
 
-            case 'm':
-                buf += rec.msg;
-                break;
+    va_copy(copy, ap);
+    int n = vsnprintf(buf.data(), buf.size() + 1, fmt, copy);
+    va_end(copy);
 
-            case 'n':
-                buf += rec.tag;
-                break;
+    if (n < 0) {
+        buf.clear();
+        return;
+    }
 
-            case 'N':
-                buf += _format_short_tag(rec.tag);
-                break;
+    auto size = static_cast<size_t>(n);
 
-            case 't':
-                if (!time_buf) {
-                    std::tm tm;
-                    long nanos;
-                    long gmtoff;
+    if (size > buf.size()) {
+        buf.resize(size);
 
-                    if (!_local_time_ns(rec.time, tm, nanos, gmtoff)) {
-                        tm = _tm_epoch();
-                        nanos = 0;
-                        gmtoff = 0;
-                    }
+        va_copy(copy, ap);
+        vsnprintf(buf.data(), buf.size() + 1, fmt, copy);
+        va_end(copy);
+    } else {
+        buf.resize(size);
+    }
+}
 
-                    time_buf = _format_iso8601(tm, nanos, gmtoff);
+static void _format_rec(std::string &buf, const ParsedFormat &format,
+                        const LogRecord &rec)
+{
+    bool have_time = false;
+    std::tm tm;
+    long nanos;
+    long gmtoff;
+
+    buf.clear();
+
+    for (auto const &token : format.tokens) {
+        switch (token.type) {
+        case FormatTokenType::Literal:
+            buf += token.literal;
+            break;
+
+        case FormatTokenType::Level:
+            buf += _format_prio(rec.prio);
+            break;
+
+        case FormatTokenType::Message:
+            buf += rec.msg;
+            break;
+
+        case FormatTokenType::Tag:
+            buf += rec.tag;
+            break;
+
+        case FormatTokenType::ShortTag:
+            _format_short_tag(buf, rec.tag);
+            break;
+
+        case FormatTokenType::Time:
+            if (!have_time) {
+                if (!_local_time_ns(rec.time, tm, nanos, gmtoff)) {
+                    tm = _tm_epoch();
+                    nanos = 0;
+                    gmtoff = 0;
                 }
-                buf += *time_buf;
-                break;
-
-            case 'P':
-                buf += mb::format("%" PRIu64, rec.pid);
-                break;
+                have_time = true;
+            }
+            _format_iso8601(buf, tm, nanos, gmtoff);
+            break;
 
-            case 'T':
-                buf += mb::format("%" PRIu64, rec.tid);
-                break;
+        case FormatTokenType::ProcessId:
+            _format_uint(buf, rec.pid);
+            break;
 
-            default:
-                buf += *it;
-                break;
-            }
-        } else {
-            buf += *it;
+        case FormatTokenType::ThreadId:
+            _format_uint(buf, rec.tid);
+            break;
         }
     }
-
-    return buf;
 }
 
 std::shared_ptr<BaseLogger> logger()
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     return g_logger;
 }
 
 void set_logger(std::shared_ptr<BaseLogger> logger)
 {
+    std::lock_guard<std::mutex> guard(g_mutex);
     g_logger = std::move(logger);
 }
 
@@ -413,35 +547,62 @@ void log(LogLevel prio, const char *tag, const char *fmt, ...)
 void log_v(LogLevel prio, const char *tag, const char *fmt, va_list ap)
 {
     ErrorRestorer restorer;
-    LogRecord rec;
-    std::lock_guard<std::mutex> guard(g_mutex);
+
+    // Reused by every log call on this thread so that formatting does not
+    // allocate once the buffers are large enough
+    thread_local LogRecord rec;
+
+    std::shared_ptr<BaseLogger> logger;
+    std::shared_ptr<const ParsedFormat> format;
+
+    {
+        std::lock_guard<std::mutex> guard(g_mutex);
+
+        if (!g_logger) {
+            g_logger = std::make_shared<StdioLogger>(stdout);
+        }
+
+        logger = g_logger;
+        format = g_format;
+    }
 
     rec.time = std::chrono::system_clock::now();
     rec.pid = static_cast<uint64_t>(_get_pid());
     rec.tid = static_cast<uint64_t>(_get_tid());
     rec.prio = prio;
     rec.tag = tag;
-    rec.msg = format_v(fmt, ap);
+    _format_msg(rec.msg, fmt, ap);
 
-    if (!g_logger) {
-        g_logger = std::make_shared<StdioLogger>(stdout);
+    if (logger->formatted()) {
+        _format_rec(rec.fmt_msg, *format, rec);
+    } else {
+        rec.fmt_msg.clear();
     }
 
-    if (g_logger->formatted()) {
-        rec.fmt_msg = _format_rec(rec);
-    }
+    logger->log(rec);
+}
 
-    g_logger->log(rec);
+void flush()
+{
+    if (auto l = logger()) {
+        l->flush();
+    }
 }
 
 std::string format()
 {
-    return g_format;
+    std::lock_guard<std::mutex> guard(g_mutex);
+    return g_format->str;
 }
 
 void set_format(std::string fmt)
 {
-    g_format = std::move(fmt);
+    // Parse once here instead of for every record
+    auto ptr = std::make_shared<const ParsedFormat>(
+            _parse_format(std::move(fmt)));
+
+    std::lock_guard<std::mutex> guard(g_mutex);
+    g_format = std::move(ptr);
 }
 
 }
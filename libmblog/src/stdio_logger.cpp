@@ -19,9 +19,57 @@
 
 #include "mblog/stdio_logger.h"
 
+#include <algorithm>
+#include <array>
+#include <string>
+
+#ifndef _WIN32
+#  include <climits>
+#  include <cerrno>
+
+#  include <sys/uio.h>
+#  include <unistd.h>
+#endif
+
 namespace mb::log
 {
 
+#ifndef _WIN32
+// Number of records written per writev() call. Each record uses two iovecs.
+static constexpr size_t BATCH_RECORDS = std::min<size_t>(IOV_MAX / 2, 64);
+
+/*!
+ * \brief Write all of the iovecs, handling short writes
+ */
+static bool write_all(int fd, iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        auto remain = static_cast<size_t>(n);
+
+        while (count > 0 && remain >= iov->iov_len) {
+            remain -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+
+        if (count > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + remain;
+            iov->iov_len -= remain;
+        }
+    }
+
+    return true;
+}
+#endif
+
 StdioLogger::StdioLogger(std::FILE *stream)
     : _stream(stream)
 {
@@ -37,6 +85,43 @@ void StdioLogger::log(const LogRecord &rec)
     fflush(_stream);
 }
 
+void StdioLogger::log_batch(const LogRecord *recs, size_t count)
+{
+    if (!_stream) {
+        return;
+    }
+
+#ifdef _WIN32
+    for (size_t i = 0; i < count; ++i) {
+        fprintf(_stream, "%s\n", recs[i].fmt_msg.c_str());
+    }
+    fflush(_stream);
+#else
+    // Anything written with log() has already been flushed, but make sure
+    // that no other buffered output is reordered after the batch
+    fflush(_stream);
+
+    int fd = fileno(_stream);
+    std::array<iovec, BATCH_RECORDS * 2> iov;
+
+    for (size_t i = 0; i < count; i += BATCH_RECORDS) {
+        size_t n = std::min(count - i, BATCH_RECORDS);
+
+        for (size_t j = 0; j < n; ++j) {
+            const std::string &msg = recs[i + j].fmt_msg;
+            iov[j * 2].iov_base = const_cast<char *>(msg.data());
+            iov[j * 2].iov_len = msg.size();
+            iov[j * 2 + 1].iov_base = const_cast<char *>("\n");
+            iov[j * 2 + 1].iov_len = 1;
+        }
+
+        if (!write_all(fd, iov.data(), static_cast<int>(n * 2))) {
+            return;
+        }
+    }
+#endif
+}
+
 bool StdioLogger::formatted()
 {
     return true;
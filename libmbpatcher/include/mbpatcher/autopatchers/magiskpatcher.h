@@ -44,7 +44,7 @@ public:
     std::vector<std::string> new_files() const override;
     std::vector<std::string> existing_files() const override;
 
-    bool patch_files(const std::string &directory) override;
+    bool patch_files(AutoPatcher::Files &files) override;
 };
 
 }
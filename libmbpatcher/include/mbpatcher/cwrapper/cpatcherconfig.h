@@ -37,6 +37,17 @@ MB_EXPORT char * mbpatcher_config_temp_directory(const CPatcherConfig *pc);
 MB_EXPORT void mbpatcher_config_set_data_directory(CPatcherConfig *pc, char *path);
 MB_EXPORT void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path);
 
+MB_EXPORT char * mbpatcher_config_cache_directory(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_cache_directory(CPatcherConfig *pc, char *path);
+
+MB_EXPORT unsigned int mbpatcher_config_compression_threads(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_compression_threads(CPatcherConfig *pc,
+                                                        unsigned int threads);
+
+MB_EXPORT bool mbpatcher_config_store_incompressible(const CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_set_store_incompressible(CPatcherConfig *pc,
+                                                         bool enabled);
+
 MB_EXPORT char ** mbpatcher_config_patchers(const CPatcherConfig *pc);
 MB_EXPORT char ** mbpatcher_config_autopatchers(const CPatcherConfig *pc);
 
@@ -48,4 +59,13 @@ MB_EXPORT CAutoPatcher * mbpatcher_config_create_autopatcher(CPatcherConfig *pc,
 MB_EXPORT void mbpatcher_config_destroy_patcher(CPatcherConfig *pc, CPatcher *patcher);
 MB_EXPORT void mbpatcher_config_destroy_autopatcher(CPatcherConfig *pc, CAutoPatcher *patcher);
 
+MB_EXPORT CPatchJobQueue * mbpatcher_config_create_patch_job_queue(CPatcherConfig *pc);
+MB_EXPORT void mbpatcher_config_destroy_patch_job_queue(CPatcherConfig *pc,
+                                                        CPatchJobQueue *queue);
+
+MB_EXPORT CPatchTask * mbpatcher_config_create_patch_task(CPatcherConfig *pc,
+                                                          CPatcher *patcher);
+MB_EXPORT void mbpatcher_config_destroy_patch_task(CPatcherConfig *pc,
+                                                   CPatchTask *task);
+
 MB_END_C_DECLS
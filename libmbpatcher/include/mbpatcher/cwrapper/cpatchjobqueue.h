@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mbcommon/common.h"
+#include "mbpatcher/cwrapper/cpatcherinterface.h"
+#include "mbpatcher/cwrapper/ctypes.h"
+
+MB_BEGIN_C_DECLS
+
+typedef void (*JobFinishedCallback) (size_t, bool, void *);
+
+MB_EXPORT size_t mbpatcher_jobqueue_add_job(CPatchJobQueue *queue,
+                                            const CFileInfo *info,
+                                            const char *patcher_id);
+MB_EXPORT size_t mbpatcher_jobqueue_jobs(const CPatchJobQueue *queue);
+
+MB_EXPORT unsigned int mbpatcher_jobqueue_max_threads(const CPatchJobQueue *queue);
+MB_EXPORT void mbpatcher_jobqueue_set_max_threads(CPatchJobQueue *queue,
+                                                  unsigned int threads);
+
+MB_EXPORT unsigned int mbpatcher_jobqueue_max_io_jobs(const CPatchJobQueue *queue);
+MB_EXPORT void mbpatcher_jobqueue_set_max_io_jobs(CPatchJobQueue *queue,
+                                                  unsigned int jobs);
+
+MB_EXPORT bool mbpatcher_jobqueue_run(CPatchJobQueue *queue,
+                                      ProgressUpdatedCallback progress_cb,
+                                      FilesUpdatedCallback files_cb,
+                                      DetailsUpdatedCallback details_cb,
+                                      JobFinishedCallback finished_cb,
+                                      void *userdata);
+MB_EXPORT void mbpatcher_jobqueue_cancel(CPatchJobQueue *queue);
+
+MB_EXPORT bool mbpatcher_jobqueue_job_succeeded(const CPatchJobQueue *queue,
+                                                size_t index);
+MB_EXPORT /* enum ErrorCode */ int mbpatcher_jobqueue_job_error(const CPatchJobQueue *queue,
+                                                                size_t index);
+
+MB_END_C_DECLS
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mbcommon/common.h"
+#include "mbpatcher/cwrapper/ctypes.h"
+
+MB_BEGIN_C_DECLS
+
+#define MBPATCHER_PROGRESS_BYTES        (1u << 0)
+#define MBPATCHER_PROGRESS_FILES        (1u << 1)
+#define MBPATCHER_PROGRESS_DETAILS      (1u << 2)
+
+typedef struct
+{
+    unsigned int changed;
+    uint64_t bytes;
+    uint64_t max_bytes;
+    uint64_t files;
+    uint64_t max_files;
+} CPatchProgress;
+
+MB_EXPORT bool mbpatcher_patchtask_start(CPatchTask *task);
+MB_EXPORT void mbpatcher_patchtask_cancel(CPatchTask *task);
+MB_EXPORT bool mbpatcher_patchtask_wait(CPatchTask *task);
+
+MB_EXPORT int mbpatcher_patchtask_fd(const CPatchTask *task);
+MB_EXPORT void mbpatcher_patchtask_progress(CPatchTask *task,
+                                            CPatchProgress *progress,
+                                            char **details);
+
+MB_EXPORT bool mbpatcher_patchtask_is_finished(const CPatchTask *task);
+MB_EXPORT bool mbpatcher_patchtask_succeeded(const CPatchTask *task);
+MB_EXPORT /* enum ErrorCode */ int mbpatcher_patchtask_error(const CPatchTask *task);
+
+MB_END_C_DECLS
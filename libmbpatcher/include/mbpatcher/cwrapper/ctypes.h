@@ -34,4 +34,10 @@ typedef struct CPatcher CPatcher;
 struct CAutoPatcher;
 typedef struct CAutoPatcher CAutoPatcher;
 
+struct CPatchJobQueue;
+typedef struct CPatchJobQueue CPatchJobQueue;
+
+struct CPatchTask;
+typedef struct CPatchTask CPatchTask;
+
 MB_END_C_DECLS
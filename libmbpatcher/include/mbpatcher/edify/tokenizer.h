@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <deque>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -47,10 +48,31 @@ MB_EXPORT std::error_code make_error_code(EdifyError e);
 
 MB_EXPORT const std::error_category & edify_error_category();
 
+/*!
+ * \brief Owner of strings referenced by tokens that were not created by the
+ *        tokenizer
+ *
+ * Tokens only hold views. Tokens returned by EdifyTokenizer::tokenize()
+ * reference the tokenized buffer and tokens created from new strings reference
+ * strings stored in an arena. Stored strings are never moved, so the views
+ * remain valid for the lifetime of the arena.
+ */
+class EdifyStringArena
+{
+public:
+    std::string_view store(std::string str)
+    {
+        return m_strings.emplace_back(std::move(str));
+    }
+
+private:
+    std::deque<std::string> m_strings;
+};
+
 class EdifyTokenIf
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "if";
     }
@@ -59,7 +81,7 @@ public:
 class EdifyTokenThen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "then";
     }
@@ -68,7 +90,7 @@ public:
 class EdifyTokenElse
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "else";
     }
@@ -77,7 +99,7 @@ public:
 class EdifyTokenEndif
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "endif";
     }
@@ -86,7 +108,7 @@ public:
 class EdifyTokenAnd
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "&&";
     }
@@ -95,7 +117,7 @@ public:
 class EdifyTokenOr
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "||";
     }
@@ -104,7 +126,7 @@ public:
 class EdifyTokenEquals
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "==";
     }
@@ -113,7 +135,7 @@ public:
 class EdifyTokenNotEquals
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "!=";
     }
@@ -122,7 +144,7 @@ public:
 class EdifyTokenNot
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "!";
     }
@@ -131,7 +153,7 @@ public:
 class EdifyTokenLeftParen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "(";
     }
@@ -140,7 +162,7 @@ public:
 class EdifyTokenRightParen
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ")";
     }
@@ -149,7 +171,7 @@ public:
 class EdifyTokenSemicolon
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ";";
     }
@@ -158,7 +180,7 @@ public:
 class EdifyTokenComma
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return ",";
     }
@@ -167,7 +189,7 @@ public:
 class EdifyTokenConcat
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "+";
     }
@@ -176,7 +198,7 @@ public:
 class EdifyTokenNewline
 {
 public:
-    std::string generate() const
+    std::string_view generate() const
     {
         return "\n";
     }
@@ -185,7 +207,7 @@ public:
 class EdifyTokenWhitespace
 {
 public:
-    EdifyTokenWhitespace(std::string str) : m_str(std::move(str))
+    EdifyTokenWhitespace(std::string_view str) : m_str(str)
     {
         assert(!m_str.empty());
 
@@ -194,49 +216,55 @@ public:
         }
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
         return m_str;
     }
 
 private:
-    std::string m_str;
+    std::string_view m_str;
 };
 
 class EdifyTokenComment
 {
 public:
-    EdifyTokenComment(std::string str) : m_str(std::move(str))
+    //! \param str Comment, including the leading '#'
+    EdifyTokenComment(std::string_view str) : m_str(str)
     {
+        assert(!m_str.empty() && m_str.front() == '#');
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
-        return '#' + m_str;
+        return m_str;
     }
 
 private:
-    std::string m_str;
+    std::string_view m_str;
 };
 
 class EdifyTokenString
 {
 public:
-    static oc::result<EdifyTokenString> from_raw(std::string str, bool quoted);
-    static oc::result<EdifyTokenString> from_string(std::string str, bool make_quoted);
+    static oc::result<EdifyTokenString> from_raw(std::string_view str,
+                                                 bool quoted);
+    static oc::result<EdifyTokenString> from_string(std::string str,
+                                                    bool make_quoted,
+                                                    EdifyStringArena &arena);
 
-    std::string generate() const;
+    std::string_view generate() const;
 
     oc::result<std::string> unescaped_string() const;
 
-    std::string raw_string() const;
+    std::string_view raw_string() const;
 
     bool quoted() const;
 
     static bool is_valid_unquoted(char c);
 
 protected:
-    std::string m_str;
+    // Entire token, including the quotes if quoted
+    std::string_view m_str;
     bool m_quoted;
 
     EdifyTokenString() = default;
@@ -252,9 +280,9 @@ public:
     {
     }
 
-    std::string generate() const
+    std::string_view generate() const
     {
-        return std::string(1, m_char);
+        return {&m_char, 1};
     }
 
 private:
@@ -283,6 +311,12 @@ using EdifyToken = std::variant<
     EdifyTokenUnknown
 >;
 
+/*!
+ * \brief Edify tokenizer
+ *
+ * \note The tokens returned by tokenize() reference the input string, which
+ *       must outlive them.
+ */
 class EdifyTokenizer
 {
 public:
@@ -291,6 +325,8 @@ public:
     static std::string untokenize(std::vector<EdifyToken>::const_iterator begin,
                                   std::vector<EdifyToken>::const_iterator end);
 
+    static std::string_view generate(const EdifyToken &token);
+
     static void dump(const std::vector<EdifyToken> &tokens);
 
 private:
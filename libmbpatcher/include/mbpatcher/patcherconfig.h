@@ -20,6 +20,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "mbcommon/common.h"
@@ -33,6 +34,9 @@ namespace mb::patcher
 
 class Patcher;
 class AutoPatcher;
+class PatchJobQueue;
+class PatchTask;
+class PayloadCache;
 
 class MB_EXPORT PatcherConfig
 {
@@ -48,6 +52,15 @@ public:
     void set_data_directory(std::string path);
     void set_temp_directory(std::string path);
 
+    std::string cache_directory() const;
+    void set_cache_directory(std::string path);
+
+    unsigned int compression_threads() const;
+    void set_compression_threads(unsigned int threads);
+
+    bool store_incompressible() const;
+    void set_store_incompressible(bool enabled);
+
     std::vector<std::string> patchers() const;
     std::vector<std::string> auto_patchers() const;
 
@@ -58,6 +71,16 @@ public:
     void destroy_patcher(Patcher *patcher);
     void destroy_auto_patcher(AutoPatcher *patcher);
 
+    PatchJobQueue * create_patch_job_queue();
+    void destroy_patch_job_queue(PatchJobQueue *queue);
+
+    PatchTask * create_patch_task(Patcher *patcher);
+    void destroy_patch_task(PatchTask *task);
+
+    /*! \cond INTERNAL */
+    PayloadCache & payload_cache();
+    /*! \endcond */
+
     MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatcherConfig)
     MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatcherConfig)
 
@@ -65,13 +88,27 @@ private:
     // Directories
     std::string m_data_dir;
     std::string m_temp_dir;
+    std::string m_cache_dir;
+
+    // Compression
+    unsigned int m_compression_threads = 0;
+    bool m_store_incompressible = true;
 
     // Errors
     ErrorCode m_error;
 
-    // Created patchers
+    // Compressed payload files shared by all patchers
+    std::unique_ptr<PayloadCache> m_payload_cache;
+
+    // Created patchers. Patchers running in a PatchJobQueue create and
+    // destroy autopatchers concurrently, so the lists are guarded by m_mutex.
+    std::mutex m_mutex;
     std::vector<std::unique_ptr<Patcher>> m_patchers;
     std::vector<std::unique_ptr<AutoPatcher>> m_auto_patchers;
+    std::vector<std::unique_ptr<PatchJobQueue>> m_job_queues;
+    // Declared after m_patchers so that running tasks are waited for before
+    // their patchers are destroyed
+    std::vector<std::unique_ptr<PatchTask>> m_patch_tasks;
 };
 
 }
@@ -20,6 +20,9 @@
 #pragma once
 
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "mbcommon/common.h"
 
@@ -103,6 +106,9 @@ public:
 class AutoPatcher
 {
 public:
+    //! Contents of files to patch, keyed by their path in the zip file
+    using Files = std::unordered_map<std::string, std::string>;
+
     virtual ~AutoPatcher() {}
 
     /*!
@@ -133,11 +139,14 @@ public:
     virtual std::vector<std::string> existing_files() const = 0;
 
     /*!
-     * \brief Start patching the file
+     * \brief Start patching the files
+     *
+     * The files are patched in place. Files listed in existing_files() that
+     * do not exist in the zip file are not present in \p files.
      *
-     * \param directory Directory containing the files to be patched
+     * \param files Contents of the files to be patched
      */
-    virtual bool patch_files(const std::string &directory) = 0;
+    virtual bool patch_files(Files &files) = 0;
 };
 
 }
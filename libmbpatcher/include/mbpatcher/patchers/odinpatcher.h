@@ -26,12 +26,14 @@
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/progressreporter.h"
 
 #ifdef __ANDROID__
 #  include "mbcommon/file/fd.h"
 #else
 #  include "mbcommon/file/standard.h"
 #endif
+#include "mbcommon/file/prefetch.h"
 
 
 namespace mb::patcher
@@ -65,7 +67,6 @@ private:
     PatcherConfig &m_pc;
     const FileInfo *m_info;
 
-    uint64_t m_old_bytes;
     uint64_t m_bytes;
     uint64_t m_max_bytes;
 
@@ -73,19 +74,19 @@ private:
 
     ErrorCode m_error;
 
-    unsigned char m_la_buf[10240];
+    unsigned char m_la_buf[256 * 1024];
 #ifdef __ANDROID__
     FdFile m_la_file;
     int m_fd;
 #else
     StandardFile m_la_file;
 #endif
+    PrefetchFile m_la_prefetch;
 
     std::unordered_set<std::string> m_added_files;
 
     // Callbacks
-    const ProgressUpdatedCallback *m_progress_cb;
-    const DetailsUpdatedCallback *m_details_cb;
+    ProgressReporter m_progress;
 
     // Patching
     archive *m_a_input;
@@ -94,6 +95,9 @@ private:
     bool patch_tar();
 
     bool process_file(archive *a, archive_entry *entry, bool sparse);
+    bool convert_to_sparse(archive *a, const char *name,
+                           const std::vector<unsigned char> &sample,
+                           File &output);
     bool process_contents(archive *a, unsigned int depth,
                           const char *raw_entry_path);
     bool open_input_archive();
@@ -23,6 +23,7 @@
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/progressreporter.h"
 
 
 namespace mb::patcher
@@ -72,21 +73,21 @@ private:
     ErrorCode m_error;
 
     // Callbacks
-    const ProgressUpdatedCallback *m_progress_cb;
-    const FilesUpdatedCallback *m_files_cb;
-    const DetailsUpdatedCallback *m_details_cb;
+    ProgressReporter m_progress;
 
     // Patching
     ZipCtx *m_z_input = nullptr;
     ZipCtx *m_z_output = nullptr;
     std::vector<AutoPatcher *> m_auto_patchers;
 
+    bool patch_with_cache();
     bool patch_zip();
+    bool restamp(const std::string &source);
+    bool add_target_files();
 
-    bool pass1(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &exclude);
-    bool pass2(const std::string &temporary_dir,
-               const std::unordered_set<std::string> &files);
+    bool pass1(const std::unordered_set<std::string> &exclude,
+               AutoPatcher::Files &files);
+    bool pass2(AutoPatcher::Files &files);
     bool open_input_archive();
     void close_input_archive();
     bool open_output_archive();
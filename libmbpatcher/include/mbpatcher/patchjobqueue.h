@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/fileinfo.h"
+#include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/progressreporter.h"
+
+
+namespace mb::patcher
+{
+
+class PatcherConfig;
+
+class MB_EXPORT PatchJobQueue
+{
+public:
+    using ProgressUpdatedCallback = Patcher::ProgressUpdatedCallback;
+    using FilesUpdatedCallback = Patcher::FilesUpdatedCallback;
+    using DetailsUpdatedCallback = Patcher::DetailsUpdatedCallback;
+    using JobFinishedCallback = std::function<void(std::size_t, bool)>;
+
+    explicit PatchJobQueue(PatcherConfig &pc);
+    ~PatchJobQueue();
+
+    std::size_t add_job(const FileInfo &info, std::string patcher_id);
+    std::size_t jobs() const;
+
+    unsigned int max_threads() const;
+    void set_max_threads(unsigned int threads);
+
+    unsigned int max_io_jobs() const;
+    void set_max_io_jobs(unsigned int jobs);
+
+    bool run(const ProgressUpdatedCallback &progress_cb,
+             const FilesUpdatedCallback &files_cb,
+             const DetailsUpdatedCallback &details_cb,
+             const JobFinishedCallback &finished_cb = nullptr);
+    void cancel();
+
+    bool job_succeeded(std::size_t index) const;
+    ErrorCode job_error(std::size_t index) const;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatchJobQueue)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatchJobQueue)
+
+private:
+    enum class State
+    {
+        Pending,
+        Running,
+        Succeeded,
+        Failed,
+    };
+
+    struct Job
+    {
+        FileInfo info;
+        std::string patcher_id;
+        bool io_heavy;
+        Patcher *patcher = nullptr;
+        State state = State::Pending;
+        ErrorCode error = ErrorCode::NoError;
+        uint64_t bytes = 0;
+        uint64_t max_bytes = 0;
+        uint64_t files = 0;
+        uint64_t max_files = 0;
+    };
+
+    void worker(const JobFinishedCallback &finished_cb);
+    Job * next_job();
+
+    PatcherConfig &m_pc;
+
+    unsigned int m_max_threads = 0;
+    unsigned int m_max_io_jobs = 2;
+
+    // Job list and scheduling state. Only the state and progress fields of a
+    // Job are modified while the queue is running.
+    std::vector<Job> m_jobs;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::size_t m_running_io_jobs = 0;
+    std::atomic_bool m_cancelled;
+
+    // Aggregate progress of all jobs
+    uint64_t m_bytes = 0;
+    uint64_t m_max_bytes = 0;
+    uint64_t m_files = 0;
+    uint64_t m_max_files = 0;
+
+    // Serializes calls to the user's callbacks
+    std::mutex m_cb_mutex;
+    // Coalesces the progress updates. Only used with m_cb_mutex locked.
+    ProgressReporter m_progress;
+};
+
+}
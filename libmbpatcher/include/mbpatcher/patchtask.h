@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/executor.h"
+
+#include "mbpatcher/errors.h"
+#include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/progressreporter.h"
+
+
+namespace mb::patcher
+{
+
+class MB_EXPORT PatchTask
+{
+public:
+    using ProgressUpdatedCallback = Patcher::ProgressUpdatedCallback;
+    using FilesUpdatedCallback = Patcher::FilesUpdatedCallback;
+    using DetailsUpdatedCallback = Patcher::DetailsUpdatedCallback;
+
+    explicit PatchTask(Patcher &patcher);
+    ~PatchTask();
+
+    bool start();
+    void cancel();
+    bool wait();
+
+    int fd() const;
+    ProgressUpdate progress();
+
+    bool is_finished() const;
+    bool succeeded() const;
+    ErrorCode error() const;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PatchTask)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PatchTask)
+
+private:
+    /*! \cond INTERNAL */
+    void run();
+    void signal();
+
+    Patcher &m_patcher;
+
+    // Pollable file descriptor that becomes readable when there is progress
+    // to collect or the task finished
+    int m_fd;
+
+    std::atomic_bool m_started;
+    std::atomic_bool m_cancelled;
+    std::atomic_bool m_finished;
+    bool m_succeeded = false;
+    ErrorCode m_error = ErrorCode::NoError;
+
+    // Latest coalesced progress. The changed field accumulates until the next
+    // call to progress().
+    mutable std::mutex m_mutex;
+    ProgressUpdate m_update;
+
+    ProgressUpdatedCallback m_progress_cb;
+    FilesUpdatedCallback m_files_cb;
+    DetailsUpdatedCallback m_details_cb;
+    ProgressReporter m_reporter;
+
+    // Declared last so that it waits for the patcher before anything else is
+    // destroyed
+    TaskGroup m_group;
+    /*! \endcond */
+};
+
+}
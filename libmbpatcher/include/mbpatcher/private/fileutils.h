@@ -42,6 +42,13 @@ public:
     static ErrorCode write_from_string(const std::string &path,
                                        const std::string &contents);
 
+    static bool file_exists(const std::string &path);
+
+    static bool delete_file(const std::string &path);
+
+    static ErrorCode clone_file(const std::string &source,
+                                const std::string &target);
+
     static std::string system_temporary_dir();
 
     static std::string create_temporary_dir(const std::string &directory);
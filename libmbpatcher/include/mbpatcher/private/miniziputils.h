@@ -27,6 +27,7 @@
 #include "mz_zip.h"
 
 #include "mbpatcher/errors.h"
+#include "mbpatcher/private/payloadcache.h"
 
 
 namespace mb::patcher
@@ -49,27 +50,36 @@ public:
         uint64_t total_size;
     };
 
+    struct Entry
+    {
+        std::string name;
+        // Offset of the local header
+        uint64_t offset;
+        uint64_t compressed_size;
+        uint64_t uncompressed_size;
+        uint16_t compression_method;
+    };
+
     static void * ctx_get_zip_handle(ZipCtx *ctx);
 
     static ZipCtx * open_zip_file(std::string path, ZipOpenMode mode);
 
     static int close_zip_file(ZipCtx *ctx);
 
-    static ErrorCode archive_stats(const std::string &path,
+    static const std::vector<Entry> * entries(ZipCtx *ctx);
+
+    static ErrorCode archive_stats(ZipCtx *ctx,
                                    ArchiveStats &stats,
                                    const std::vector<std::string> &ignore);
 
-    static bool copy_file_raw(void *source_handle,
-                              void *target_handle,
+    static bool copy_file_raw(ZipCtx *source,
+                              ZipCtx *target,
                               const std::string &name,
                               const std::function<void(uint64_t bytes)> &cb);
 
     static bool read_to_memory(void *handle, std::string &output,
                                const std::function<void(uint64_t bytes)> &cb);
 
-    static bool extract_file(void *handle,
-                             const std::string &directory);
-
     static ErrorCode add_file_from_data(void *handle,
                                         const std::string &name,
                                         const std::string &data);
@@ -77,6 +87,11 @@ public:
     static ErrorCode add_file_from_path(void *handle,
                                         const std::string &name,
                                         const std::string &path);
+
+    static ErrorCode add_deflated_file(void *handle,
+                                       const std::string &name,
+                                       const std::string &path,
+                                       const DeflatedPayload &payload);
 };
 
 }
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/common.h"
+#include "mbcommon/executor.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \brief Block-parallel raw deflate compressor
+ *
+ * The input is split into independent 1 MiB blocks that are compressed by
+ * tasks on the global Executor. Each block is primed with the last 32 KiB of the
+ * previous block and ends with a sync flush, so that the compressed blocks can
+ * be concatenated (like pigz does) into a single valid raw deflate stream.
+ * The compressed data is passed to the output callback in order on a separate
+ * writer thread, so the caller of write() only ever blocks when too many
+ * blocks are in flight.
+ */
+class ParallelDeflater
+{
+public:
+    using OutputCallback = std::function<bool(const void *buf, size_t size)>;
+
+    static constexpr size_t BLOCK_SIZE = 1024 * 1024;
+    static constexpr size_t DICT_SIZE = 32 * 1024;
+
+    ParallelDeflater(unsigned int threads, int level, OutputCallback cb);
+    ~ParallelDeflater();
+
+    bool write(const void *buf, size_t size);
+    bool finish();
+
+    uint32_t crc() const;
+    uint64_t uncompressed_size() const;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelDeflater)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelDeflater)
+
+private:
+    struct Block
+    {
+        std::vector<unsigned char> dict;
+        std::vector<unsigned char> input;
+        std::vector<unsigned char> output;
+        uint32_t crc;
+        bool last;
+        bool ok;
+        // Destroyed first, so destroying a block waits for its task
+        TaskGroup group;
+    };
+
+    bool submit(bool last);
+    void writer();
+
+    static bool compress(Block &block, int level);
+
+    int m_level;
+    OutputCallback m_cb;
+
+    std::thread m_writer_thread;
+    std::mutex m_mutex;
+    // Signals the writer thread that a block was submitted
+    std::condition_variable m_submit_cv;
+    // Signals the producer that a block was written
+    std::condition_variable m_space_cv;
+    // Blocks that have been submitted, but not yet written, in stream order
+    std::deque<std::shared_ptr<Block>> m_blocks;
+    // Number of blocks that have been submitted, but not yet written
+    size_t m_pending;
+    size_t m_max_blocks;
+    bool m_stop;
+    bool m_failed;
+
+    // Only accessed by the producer
+    std::vector<unsigned char> m_input;
+    std::vector<unsigned char> m_dict;
+
+    // Only accessed by the writer thread until all blocks are written
+    uint32_t m_crc;
+    uint64_t m_size;
+};
+
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+
+#include "mbdevice/device.h"
+
+#include "mbpatcher/errors.h"
+
+
+namespace mb::patcher
+{
+
+class PatchCache
+{
+public:
+    explicit PatchCache(std::string directory);
+
+    ErrorCode open(const std::string &input_path,
+                   const std::string &patcher_id,
+                   const device::Device &device);
+
+    std::optional<std::string> find(const std::string &rom_id) const;
+    std::optional<std::string> find_restampable() const;
+
+    ErrorCode store(const std::string &output_path, const std::string &rom_id);
+
+private:
+    std::string entry_path(const std::string &rom_id) const;
+    std::string latest_path() const;
+
+    std::string m_directory;
+    std::string m_entry_dir;
+};
+
+}
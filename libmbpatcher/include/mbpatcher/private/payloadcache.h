@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <cstdint>
+
+#include "mbpatcher/errors.h"
+
+
+namespace mb::patcher
+{
+
+struct DeflatedPayload
+{
+    //! Raw deflate stream
+    std::string data;
+    uint32_t crc;
+    uint64_t uncompressed_size;
+};
+
+class PayloadCache
+{
+public:
+    ErrorCode get(const std::string &path, int level, unsigned int threads,
+                  std::shared_ptr<const DeflatedPayload> &payload);
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<std::string,
+                       std::shared_ptr<const DeflatedPayload>> m_entries;
+};
+
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstdint>
+
+#include "mbcommon/flags.h"
+
+
+namespace mb::patcher
+{
+
+enum class RewriteFlag : uint8_t
+{
+    // Only match the first token of a line
+    LineStart   = 1 << 0,
+    // Only match if followed by whitespace or the end of the input
+    WordEnd     = 1 << 1,
+};
+MB_DECLARE_FLAGS(RewriteFlags, RewriteFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(RewriteFlags)
+
+class TextRewriter
+{
+public:
+    TextRewriter();
+
+    void add(std::string_view from, std::string_view to,
+             RewriteFlags flags = {});
+
+    bool rewrite(std::string &contents) const;
+
+private:
+    struct Rule
+    {
+        std::string from;
+        std::string to;
+        RewriteFlags flags;
+    };
+
+    struct Node
+    {
+        uint32_t next[256];
+        int32_t rule;
+    };
+
+    bool accepts(const Rule &rule, std::string_view input, size_t begin) const;
+
+    std::vector<Rule> m_rules;
+    std::vector<Node> m_nodes;
+    bool m_first[256];
+};
+
+}
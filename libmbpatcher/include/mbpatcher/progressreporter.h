@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+#include "mbpatcher/patcherinterface.h"
+
+
+namespace mb::patcher
+{
+
+struct ProgressUpdate
+{
+    enum Fields : unsigned int
+    {
+        Bytes   = 1 << 0,
+        Files   = 1 << 1,
+        Details = 1 << 2,
+    };
+
+    //! Fields that changed since the last update
+    unsigned int changed = 0;
+    uint64_t bytes = 0;
+    uint64_t max_bytes = 0;
+    uint64_t files = 0;
+    uint64_t max_files = 0;
+    std::string details;
+};
+
+class MB_EXPORT ProgressReporter
+{
+public:
+    using ProgressUpdatedCallback = Patcher::ProgressUpdatedCallback;
+    using FilesUpdatedCallback = Patcher::FilesUpdatedCallback;
+    using DetailsUpdatedCallback = Patcher::DetailsUpdatedCallback;
+
+    static constexpr unsigned int DEFAULT_MAX_RATE = 10;
+
+    explicit ProgressReporter(unsigned int max_rate = DEFAULT_MAX_RATE);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProgressReporter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProgressReporter)
+
+    void start(const ProgressUpdatedCallback *progress_cb,
+               const FilesUpdatedCallback *files_cb,
+               const DetailsUpdatedCallback *details_cb);
+    void finish();
+
+    void update_bytes(uint64_t bytes, uint64_t max_bytes);
+    void update_files(uint64_t files, uint64_t max_files);
+    void update_details(std::string details);
+
+    void flush();
+
+private:
+    /*! \cond INTERNAL */
+    using Clock = std::chrono::steady_clock;
+
+    bool is_due(uint64_t value, uint64_t max_value,
+                const std::atomic_uint &last_percent) const;
+    void emit(bool wait);
+    void dispatch(const ProgressUpdate &update);
+
+    const Clock::duration m_interval;
+
+    const ProgressUpdatedCallback *m_progress_cb;
+    const FilesUpdatedCallback *m_files_cb;
+    const DetailsUpdatedCallback *m_details_cb;
+
+    // Written by the producers without locking
+    std::atomic_uint64_t m_bytes;
+    std::atomic_uint64_t m_max_bytes;
+    std::atomic_uint64_t m_files;
+    std::atomic_uint64_t m_max_files;
+    std::atomic_uint m_changed;
+
+    // State of the last emitted update
+    std::atomic<Clock::rep> m_next_emit;
+    std::atomic_uint m_bytes_percent;
+    std::atomic_uint m_files_percent;
+
+    std::mutex m_details_mutex;
+    std::string m_details;
+
+    // Serializes calls to the callbacks
+    std::mutex m_emit_mutex;
+    /*! \endcond */
+};
+
+}
@@ -24,7 +24,7 @@
 #include "mbcommon/string.h"
 
 #include "mbpatcher/autopatchers/standardpatcher.h"
-#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/textrewriter.h"
 
 
 namespace mb::patcher
@@ -64,42 +64,19 @@ std::vector<std::string> MagiskPatcher::existing_files() const
     return { StandardPatcher::UpdaterScript, AddonDScript, UtilFunctions };
 }
 
-static void replace_all(std::string &source, std::string_view from,
-                        std::string_view to)
+static TextRewriter create_rewriter()
 {
-    if (from.empty()) {
-        return;
-    }
-
-    std::size_t pos = 0;
-    while ((pos = source.find(from, pos)) != std::string::npos) {
-        source.replace(pos, from.size(), to);
-        pos += to.size();
-    }
-}
-
-static bool patch_file(const std::string &path, bool is_updater)
-{
-    std::string contents;
-
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
-    }
-
-    if (is_updater && !starts_with(contents, "#MAGISK")) {
-        return true;
-    }
+    TextRewriter r;
 
-    replace_all(contents, "mount /data", "/update-binary-tool mount /data");
-    replace_all(contents, "mount /cache", "/update-binary-tool mount /cache");
-    replace_all(contents, "mount -o ro /system", "/update-binary-tool mount /system");
+    r.add("mount /data", "/update-binary-tool mount /data");
+    r.add("mount /cache", "/update-binary-tool mount /cache");
+    r.add("mount -o ro /system", "/update-binary-tool mount /system");
 
     // Not a dual boot bug, but the installer uses a Java program to determine
     // if a boot image is signed and that program fails to run properly on
     // certain devices. /system/bin/dalvikvm would always exit with status 0,
     // but nothing would be executed.
-    replace_all(contents, "BOOTSIGNED=true", "BOOTSIGNED=false");
+    r.add("BOOTSIGNED=true", "BOOTSIGNED=false");
 
     // Also not a dual boot bug, but on AOSP-style custom ROMs, Magisk installs
     // an addon.d script to repatch the boot image during the installation.
@@ -107,20 +84,35 @@ static bool patch_file(const std::string &path, bool is_updater)
     // flashed, the script forks a background process and waits 5 seconds before
     // continuing. This race condition leads to a corrupted boot image on
     // devices with slow internal storage like the Galaxy S4.
-    replace_all(contents, "sleep 5", "sleep 10");
+    r.add("sleep 5", "sleep 10");
 
-    FileUtils::write_from_string(path, contents);
+    return r;
+}
 
-    return true;
+static void patch_file(AutoPatcher::Files &files, const std::string &path,
+                       bool is_updater)
+{
+    auto it = files.find(path);
+    if (it == files.end()) {
+        return;
+    }
+
+    auto &contents = it->second;
+
+    if (is_updater && !starts_with(contents, "#MAGISK")) {
+        return;
+    }
+
+    static const TextRewriter rewriter = create_rewriter();
+    rewriter.rewrite(contents);
 }
 
-bool MagiskPatcher::patch_files(const std::string &directory)
+bool MagiskPatcher::patch_files(AutoPatcher::Files &files)
 {
-    patch_file(directory + "/" + StandardPatcher::UpdaterScript, true);
-    patch_file(directory + "/" + AddonDScript, false);
-    patch_file(directory + "/" + UtilFunctions, false);
+    patch_file(files, StandardPatcher::UpdaterScript, true);
+    patch_file(files, AddonDScript, false);
+    patch_file(files, UtilFunctions, false);
 
-    // Don't fail if an error occurs
     return true;
 }
 
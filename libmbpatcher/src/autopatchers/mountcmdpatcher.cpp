@@ -19,11 +19,7 @@
 
 #include "mbpatcher/autopatchers/mountcmdpatcher.h"
 
-#include <cstring>
-
-#include "mbcommon/string.h"
-
-#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/textrewriter.h"
 
 
 namespace mb::patcher
@@ -67,46 +63,35 @@ std::vector<std::string> MountCmdPatcher::existing_files() const
     return { FlashScript, InstallerScript };
 }
 
-static bool space_or_end(const char *ptr)
-{
-    return !*ptr || isspace(*ptr);
-}
-
-static bool patch_file(const std::string &path)
+static TextRewriter create_rewriter()
 {
-    std::string contents;
+    TextRewriter r;
 
-    ErrorCode ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return false;
+    // Use the full path for mount commands at the start of a line
+    for (auto cmd : { "mount", "umount" }) {
+        r.add(cmd, std::string("/sbin/") + cmd,
+              RewriteFlag::LineStart | RewriteFlag::WordEnd);
     }
 
-    auto lines = split(contents, '\n');
-
-    for (auto &line : lines) {
-        const char *ptr = line.data();
-
-        // Skip whitespace
-        for (; *ptr && isspace(*ptr); ++ptr);
+    return r;
+}
 
-        if ((strncmp(ptr, "mount", 5) == 0 && space_or_end(ptr + 5))
-                || (strncmp(ptr, "umount", 6) == 0 && space_or_end(ptr + 6))) {
-            line.insert(static_cast<size_t>(ptr - line.data()), "/sbin/");
-        }
+static void patch_file(AutoPatcher::Files &files, const std::string &path)
+{
+    auto it = files.find(path);
+    if (it == files.end()) {
+        return;
     }
 
-    contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
-
-    return true;
+    static const TextRewriter rewriter = create_rewriter();
+    rewriter.rewrite(it->second);
 }
 
-bool MountCmdPatcher::patch_files(const std::string &directory)
+bool MountCmdPatcher::patch_files(AutoPatcher::Files &files)
 {
-    patch_file(directory + "/" + FlashScript);
-    patch_file(directory + "/" + InstallerScript);
+    patch_file(files, FlashScript);
+    patch_file(files, InstallerScript);
 
-    // Don't fail if an error occurs
     return true;
 }
 
@@ -20,6 +20,8 @@
 #include "mbpatcher/autopatchers/standardpatcher.h"
 
 #include <optional>
+#include <string_view>
+#include <unordered_map>
 
 #include <cstring>
 
@@ -27,7 +29,6 @@
 #include "mblog/logging.h"
 
 #include "mbpatcher/edify/tokenizer.h"
-#include "mbpatcher/private/fileutils.h"
 
 #define LOG_TAG "mbpatcher/autopatchers/standardpatcher"
 
@@ -82,11 +83,11 @@ std::vector<std::string> StandardPatcher::existing_files() const
     return { UpdaterScript, SystemTransferList };
 }
 
-static bool find_items_in_string(const std::string &haystack,
+static bool find_items_in_string(std::string_view haystack,
                                  const std::vector<std::string> &needles)
 {
     for (auto const &needle : needles) {
-        if (haystack.find(needle) != std::string::npos) {
+        if (haystack.find(needle) != std::string_view::npos) {
             return true;
         }
     }
@@ -94,7 +95,9 @@ static bool find_items_in_string(const std::string &haystack,
     return false;
 }
 
-using TokenIter = std::vector<EdifyToken>::iterator;
+using TokenIter = std::vector<EdifyToken>::const_iterator;
+
+static constexpr std::size_t NO_MATCH = static_cast<std::size_t>(-1);
 
 struct FunctionBounds
 {
@@ -103,124 +106,58 @@ struct FunctionBounds
     TokenIter right_paren;
 };
 
-static std::optional<FunctionBounds>
-find_function(const TokenIter begin, const TokenIter end)
+struct BlockDevs
 {
-    FunctionBounds bounds;
-
-    for (auto it = begin; it != end; ++it) {
-        // Find string representing the function name
-        if (!std::holds_alternative<EdifyTokenString>(*it)) {
-            continue;
-        }
-
-        bounds.func_name = it;
-
-        bool found_left_paren = false;
-        bool found_right_paren = false;
-
-        // Barring any whitespace, newlines, or comments, the function name
-        // should be followed by a left parenthesis
-        for (auto it2 = it + 1; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenWhitespace>(*it2)
-                    || std::holds_alternative<EdifyTokenNewline>(*it2)
-                    || std::holds_alternative<EdifyTokenComment>(*it2)) {
-                continue;
-            } else if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
-                found_left_paren = true;
-                bounds.left_paren = it2;
-            }
-            break;
-        }
-
-        // If a left parenthesis was not found, then the string token was not
-        // a function name
-        if (!found_left_paren) {
-            continue;
-        }
-
-        // Left for matching right parenthesis
-        std::size_t depth = 0;
-
-        for (auto it2 = bounds.left_paren; it2 != end; ++it2) {
-            if (std::holds_alternative<EdifyTokenLeftParen>(*it2)) {
-                ++depth;
-            } else if (std::holds_alternative<EdifyTokenRightParen>(*it2)) {
-                --depth;
-            }
-            if (depth == 0) {
-                found_right_paren = true;
-                bounds.right_paren = it2;
-                break;
-            }
-        }
-
-        // If a right parenthesis was not found, but the function name and left
-        // parenthesis were found, then assume there's a syntax error and bail
-        // out
-        if (!found_right_paren) {
-            return {};
-        }
-
-        return bounds;
-    }
+    std::vector<std::string> system;
+    std::vector<std::string> cache;
+    std::vector<std::string> data;
+};
 
-    return {};
-}
+using FunctionHandler = bool (*)(const FunctionBounds &bounds,
+                                 const BlockDevs &devs,
+                                 std::optional<std::string> &replacement);
 
 /*!
- * \brief Replace edify function
+ * \brief Find the matching right parenthesis for every left parenthesis
  *
  * \param tokens List of edify tokens
- * \param bounds Iterator bounds of the function to replace
- * \param replacement Replacement edify function (in string form)
  *
- * \return New iterator pointing to position *after* the right parenthesis of
- *         the replaced function. Returns tokens.end() if the replacement
- *         string could not be tokenized.
+ * \return Vector where the element at the index of each left parenthesis
+ *         token is the index of its matching right parenthesis. All other
+ *         elements, including unmatched left parentheses, are NO_MATCH.
  */
-static TokenIter
-replace_function(std::vector<EdifyToken> &tokens,
-                 const FunctionBounds &bounds, const std::string &replacement)
+static std::vector<std::size_t>
+match_parens(const std::vector<EdifyToken> &tokens)
 {
-    auto ret = EdifyTokenizer::tokenize(replacement);
-    if (!ret) {
-        LOGE("Failed to tokenize replacement function string: %s: %s",
-             replacement.c_str(), ret.error().message().c_str());
-        return tokens.end();
-    }
-    auto &rtokens = ret.value();
-
-    // Remove replaced tokens
-    auto it = tokens.erase(bounds.func_name, bounds.right_paren + 1);
+    std::vector<std::size_t> matching(tokens.size(), NO_MATCH);
+    std::vector<std::size_t> stack;
 
-    // Add replacement tokens
-    it = tokens.insert(it, rtokens.begin(), rtokens.end());
-
-    // Move iterator to the end of the replaced tokens
-    it += static_cast<ptrdiff_t>(rtokens.size());
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        if (std::holds_alternative<EdifyTokenLeftParen>(tokens[i])) {
+            stack.push_back(i);
+        } else if (std::holds_alternative<EdifyTokenRightParen>(tokens[i])
+                && !stack.empty()) {
+            matching[stack.back()] = i;
+            stack.pop_back();
+        }
+    }
 
-    return it;
+    return matching;
 }
 
 /*!
  * \brief Replace edify mount() command
  *
- * \param tokens List of edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices of the system, cache, and data partitions
+ * \param[out] replacement Replacement edify function (in string form) or
+ *                         nothing if the function should be kept
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was handled successfully
  */
-static TokenIter
-replace_edify_mount(std::vector<EdifyToken> &tokens,
-                    const FunctionBounds &bounds,
-                    const std::vector<std::string> &system_devs,
-                    const std::vector<std::string> &cache_devs,
-                    const std::vector<std::string> &data_devs)
+static bool
+replace_edify_mount(const FunctionBounds &bounds, const BlockDevs &devs,
+                    std::optional<std::string> &replacement)
 {
     // For the mount() edify function, replace with the corresponding
     // update-binary-tool command
@@ -230,48 +167,43 @@ replace_edify_mount(std::vector<EdifyToken> &tokens,
         }
 
         auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        auto str = token.raw_string();
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str, devs.system);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str, devs.cache);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str, devs.data);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/system"));
+            replacement = format(MOUNT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/cache"));
+            replacement = format(MOUNT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/data"));
+            replacement = format(MOUNT_FMT, "/data");
+            return true;
         }
     }
-    return bounds.right_paren + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify unmount() command
  *
- * \param tokens List of edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices of the system, cache, and data partitions
+ * \param[out] replacement Replacement edify function (in string form) or
+ *                         nothing if the function should be kept
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was handled successfully
  */
-static TokenIter
-replace_edify_unmount(std::vector<EdifyToken> &tokens,
-                      const FunctionBounds &bounds,
-                      const std::vector<std::string> &system_devs,
-                      const std::vector<std::string> &cache_devs,
-                      const std::vector<std::string> &data_devs)
+static bool
+replace_edify_unmount(const FunctionBounds &bounds, const BlockDevs &devs,
+                      std::optional<std::string> &replacement)
 {
     // For the unmount() edify function, replace with the corresponding
     // update-binary-tool command
@@ -281,48 +213,43 @@ replace_edify_unmount(std::vector<EdifyToken> &tokens,
         }
 
         auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        auto str = token.raw_string();
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str, devs.system);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str, devs.cache);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str, devs.data);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/system"));
+            replacement = format(UNMOUNT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/cache"));
+            replacement = format(UNMOUNT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/data"));
+            replacement = format(UNMOUNT_FMT, "/data");
+            return true;
         }
     }
-    return bounds.right_paren + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify run_program() command
  *
- * \param tokens List of edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices of the system, cache, and data partitions
+ * \param[out] replacement Replacement edify function (in string form) or
+ *                         nothing if the function should be kept
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was handled successfully
  */
-static TokenIter
-replace_edify_run_program(std::vector<EdifyToken> &tokens,
-                          const FunctionBounds &bounds,
-                          const std::vector<std::string> &system_devs,
-                          const std::vector<std::string> &cache_devs,
-                          const std::vector<std::string> &data_devs)
+static bool
+replace_edify_run_program(const FunctionBounds &bounds, const BlockDevs &devs,
+                          std::optional<std::string> &replacement)
 {
     bool found_reboot = false;
     bool found_mount = false;
@@ -342,8 +269,9 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
         auto ret = token.unescaped_string();
         if (!ret) {
             LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+                 std::string(token.raw_string()).c_str(),
+                 ret.error().message().c_str());
+            return false;
         }
         auto const &unescaped = ret.value();
 
@@ -364,76 +292,77 @@ replace_edify_run_program(std::vector<EdifyToken> &tokens,
         }
 
         if (unescaped.find("/system") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), system_devs)) {
+                || find_items_in_string(unescaped, devs.system)) {
             is_system = true;
         }
         if (unescaped.find("/cache") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), cache_devs)) {
+                || find_items_in_string(unescaped, devs.cache)) {
             is_cache = true;
         }
         if (unescaped.find("/data") != std::string::npos
                 || unescaped.find("/userdata") != std::string::npos
-                || find_items_in_string(unescaped.c_str(), data_devs)) {
+                || find_items_in_string(unescaped, devs.data)) {
             is_data = true;
         }
     }
 
     if (found_reboot) {
-        return replace_function(tokens, bounds,
-                                "(ui_print(\"Removed reboot command\") == 0)");
+        replacement = "(ui_print(\"Removed reboot command\") == 0)";
+        return true;
     } else if (found_umount) {
         if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/system"));
+            replacement = format(UNMOUNT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/cache"));
+            replacement = format(UNMOUNT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(UNMOUNT_FMT, "/data"));
+            replacement = format(UNMOUNT_FMT, "/data");
+            return true;
         }
     } else if (found_mount) {
         if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/system"));
+            replacement = format(MOUNT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/cache"));
+            replacement = format(MOUNT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(MOUNT_FMT, "/data"));
+            replacement = format(MOUNT_FMT, "/data");
+            return true;
         }
     } else if (found_format_sh) {
-        return replace_function(tokens, bounds,
-                                format(FORMAT_FMT, "/system"));
+        replacement = format(FORMAT_FMT, "/system");
+        return true;
     } else if (found_mke2fs) {
         if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/system"));
+            replacement = format(FORMAT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/cache"));
+            replacement = format(FORMAT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/data"));
+            replacement = format(FORMAT_FMT, "/data");
+            return true;
         }
     }
 
-    return bounds.right_paren + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify delete_recursive() command
  *
- * \param tokens List of edify tokens
  * \param bounds Iterator bounds of the function to replace
+ * \param[out] replacement Replacement edify function (in string form) or
+ *                         nothing if the function should be kept
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was handled successfully
  */
-static TokenIter
-replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
-                               const FunctionBounds &bounds)
+static bool
+replace_edify_delete_recursive(const FunctionBounds &bounds,
+                               const BlockDevs &,
+                               std::optional<std::string> &replacement)
 {
     for (auto it = bounds.left_paren + 1; it != bounds.right_paren; ++it) {
         if (!std::holds_alternative<EdifyTokenString>(*it)) {
@@ -444,40 +373,36 @@ replace_edify_delete_recursive(std::vector<EdifyToken> &tokens,
         auto ret = token.unescaped_string();
         if (!ret) {
             LOGE("Failed to unescape string token: %s: %s",
-                 token.raw_string().c_str(), ret.error().message().c_str());
-            return tokens.end();
+                 std::string(token.raw_string()).c_str(),
+                 ret.error().message().c_str());
+            return false;
         }
         auto const &unescaped = ret.value();
 
         if (unescaped == "/system" || unescaped == "/system/") {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/system"));
+            replacement = format(FORMAT_FMT, "/system");
+            return true;
         } else if (unescaped == "/cache" || unescaped == "/cache/") {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/cache"));
+            replacement = format(FORMAT_FMT, "/cache");
+            return true;
         }
     }
-    return bounds.right_paren + 1;
+    return true;
 }
 
 /*!
  * \brief Replace edify format() command
  *
- * \param tokens List of edify tokens
  * \param bounds Iterator bounds of the function to replace
- * \param system_devs List of system partition block devices
- * \param cache_devs List of cache partition block devices
- * \param data_devs List of data partition block devices
+ * \param devs Block devices of the system, cache, and data partitions
+ * \param[out] replacement Replacement edify function (in string form) or
+ *                         nothing if the function should be kept
  *
- * \return Iterator pointing to position immediately after the right parenthesis
- *         or tokens.end() if an error occurs.
+ * \return Whether the function was handled successfully
  */
-static TokenIter
-replace_edify_format(std::vector<EdifyToken> &tokens,
-                     const FunctionBounds &bounds,
-                     const std::vector<std::string> &system_devs,
-                     const std::vector<std::string> &cache_devs,
-                     const std::vector<std::string> &data_devs)
+static bool
+replace_edify_format(const FunctionBounds &bounds, const BlockDevs &devs,
+                     std::optional<std::string> &replacement)
 {
     // For the format() edify function, replace with the corresponding
     // update-binary-tool command
@@ -487,54 +412,47 @@ replace_edify_format(std::vector<EdifyToken> &tokens,
         }
 
         auto const &token = std::get<EdifyTokenString>(*it);
-        const std::string str = token.raw_string();
+        auto str = token.raw_string();
 
         bool is_system = str.find("/system") != std::string::npos
-                || find_items_in_string(str.c_str(), system_devs);
+                || find_items_in_string(str, devs.system);
         bool is_cache = str.find("/cache") != std::string::npos
-                || find_items_in_string(str.c_str(), cache_devs);
+                || find_items_in_string(str, devs.cache);
         bool is_data = str.find("/data") != std::string::npos
                 || str.find("/userdata") != std::string::npos
-                || find_items_in_string(str.c_str(), data_devs);
+                || find_items_in_string(str, devs.data);
 
         if (is_system) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/system"));
+            replacement = format(FORMAT_FMT, "/system");
+            return true;
         } else if (is_cache) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/cache"));
+            replacement = format(FORMAT_FMT, "/cache");
+            return true;
         } else if (is_data) {
-            return replace_function(tokens, bounds,
-                                    format(FORMAT_FMT, "/data"));
+            replacement = format(FORMAT_FMT, "/data");
+            return true;
         }
     }
-    return bounds.right_paren + 1;
+    return true;
 }
 
-bool StandardPatcher::patch_files(const std::string &directory)
+bool StandardPatcher::patch_files(AutoPatcher::Files &files)
 {
-    if (!patch_updater(directory)) {
+    if (auto it = files.find(UpdaterScript);
+            it != files.end() && !patch_updater(it->second)) {
         return false;
     }
 
-    if (!patch_transfer_list(directory)) {
+    if (auto it = files.find(SystemTransferList);
+            it != files.end() && !patch_transfer_list(it->second)) {
         return false;
     }
 
     return true;
 }
 
-bool StandardPatcher::patch_updater(const std::string &directory)
+bool StandardPatcher::patch_updater(std::string &contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += UpdaterScript;
-
-    FileUtils::read_to_string(path, &contents);
-
     if (starts_with(contents, "#!")) {
         // Ignore any script with a shebang line
         return true;
@@ -552,83 +470,127 @@ bool StandardPatcher::patch_updater(const std::string &directory)
     EdifyTokenizer::dump(tokens);
 #endif
 
+    static const std::unordered_map<std::string_view, FunctionHandler>
+            handlers{
+        { "mount", replace_edify_mount },
+        { "unmount", replace_edify_unmount },
+        { "run_program", replace_edify_run_program },
+        { "delete_recursive", replace_edify_delete_recursive },
+        { "format", replace_edify_format },
+    };
+
     auto &&device = m_info.device();
-    auto system_devs = device.system_block_devs();
-    auto cache_devs = device.cache_block_devs();
-    auto data_devs = device.data_block_devs();
+    BlockDevs devs{
+        device.system_block_devs(),
+        device.cache_block_devs(),
+        device.data_block_devs(),
+    };
+
+    // Matching parentheses are found up front so that the script can be
+    // patched in a single pass without modifying the token list
+    auto matching = match_parens(tokens);
 
-    TokenIter begin = tokens.begin();
-    TokenIter end;
+    std::string output;
+    output.reserve(contents.size());
 
-    while (true) {
-        end = tokens.end();
+    std::size_t i = 0;
 
+    while (i < tokens.size()) {
         // Need to find:
         // 1. String containing function name
         // 2. Left parenthesis for the function
         // 3. Right parenthesis for the function
-        auto bounds = find_function(begin, end);
-        if (!bounds) {
-            break;
+        if (!std::holds_alternative<EdifyTokenString>(tokens[i])) {
+            output += EdifyTokenizer::generate(tokens[i]);
+            ++i;
+            continue;
         }
 
-        // Tokens (types are checked by findFunction())
-        auto const &t_func_name = std::get<EdifyTokenString>(*bounds->func_name);
-        auto unescaped = t_func_name.unescaped_string();
-        if (!unescaped) {
-            LOGE("Failed to unescape string token: %s: %s",
-                 t_func_name.raw_string().c_str(),
-                 unescaped.error().message().c_str());
-            return false;
+        // Barring any whitespace, newlines, or comments, the function name
+        // should be followed by a left parenthesis
+        std::size_t left = i + 1;
+        while (left < tokens.size()
+                && (std::holds_alternative<EdifyTokenWhitespace>(tokens[left])
+                || std::holds_alternative<EdifyTokenNewline>(tokens[left])
+                || std::holds_alternative<EdifyTokenComment>(tokens[left]))) {
+            ++left;
         }
 
-        if (unescaped.value() == "mount") {
-            begin = replace_edify_mount(tokens, *bounds,
-                                        system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "unmount") {
-            begin = replace_edify_unmount(tokens, *bounds,
-                                          system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "run_program") {
-            begin = replace_edify_run_program(tokens, *bounds,
-                                              system_devs, cache_devs, data_devs);
-        } else if (unescaped.value() == "delete_recursive") {
-            begin = replace_edify_delete_recursive(tokens, *bounds);
-        } else if (unescaped.value() == "format") {
-            begin = replace_edify_format(tokens, *bounds,
-                                         system_devs, cache_devs, data_devs);
+        // If a left parenthesis was not found, then the string token was not
+        // a function name
+        if (left == tokens.size()
+                || !std::holds_alternative<EdifyTokenLeftParen>(tokens[left])) {
+            output += EdifyTokenizer::generate(tokens[i]);
+            ++i;
+            continue;
+        }
+
+        // If a right parenthesis was not found, but the function name and left
+        // parenthesis were found, then assume there's a syntax error and leave
+        // the rest of the script alone
+        if (matching[left] == NO_MATCH) {
+            output += EdifyTokenizer::untokenize(tokens.begin()
+                    + static_cast<ptrdiff_t>(i), tokens.end());
+            break;
+        }
+
+        std::size_t right = matching[left];
+
+        auto const &t_func_name = std::get<EdifyTokenString>(tokens[i]);
+        std::string unescaped_name;
+        std::string_view name;
+
+        if (t_func_name.quoted()) {
+            auto unescaped = t_func_name.unescaped_string();
+            if (!unescaped) {
+                LOGE("Failed to unescape string token: %s: %s",
+                     std::string(t_func_name.raw_string()).c_str(),
+                     unescaped.error().message().c_str());
+                return false;
+            }
+            unescaped_name = std::move(unescaped.value());
+            name = unescaped_name;
         } else {
+            name = t_func_name.raw_string();
+        }
+
+        auto handler = handlers.find(name);
+        if (handler == handlers.end()) {
             // Only skip function name so that we catch nested function calls
-            begin = bounds->func_name + 1;
+            output += EdifyTokenizer::generate(tokens[i]);
+            ++i;
+            continue;
         }
 
-        if (begin == tokens.end()) {
+        auto begin = tokens.begin();
+        FunctionBounds bounds{
+            begin + static_cast<ptrdiff_t>(i),
+            begin + static_cast<ptrdiff_t>(left),
+            begin + static_cast<ptrdiff_t>(right),
+        };
+        std::optional<std::string> replacement;
+
+        if (!handler->second(bounds, devs, replacement)) {
             return false;
         }
-    }
 
-#if DUMP_DEBUG
-    EdifyTokenizer::dump(tokens);
-#endif
+        if (replacement) {
+            output += *replacement;
+        } else {
+            output += EdifyTokenizer::untokenize(bounds.func_name,
+                                                 bounds.right_paren + 1);
+        }
 
-    FileUtils::write_from_string(path, EdifyTokenizer::untokenize(tokens));
+        i = right + 1;
+    }
+
+    contents = std::move(output);
 
     return true;
 }
 
-bool StandardPatcher::patch_transfer_list(const std::string &directory)
+bool StandardPatcher::patch_transfer_list(std::string &contents)
 {
-    std::string contents;
-    std::string path;
-
-    path += directory;
-    path += "/";
-    path += SystemTransferList;
-
-    auto ret = FileUtils::read_to_string(path, &contents);
-    if (ret != ErrorCode::NoError) {
-        return ret == ErrorCode::FileOpenError;
-    }
-
     auto lines = split_sv(contents, '\n');
 
     for (auto it = lines.begin(); it != lines.end();) {
@@ -640,7 +602,6 @@ bool StandardPatcher::patch_transfer_list(const std::string &directory)
     }
 
     contents = join(lines, "\n");
-    FileUtils::write_from_string(path, contents);
 
     return true;
 }
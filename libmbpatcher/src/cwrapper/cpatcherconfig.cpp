@@ -25,6 +25,8 @@
 #include "mbcommon/capi/util.h"
 
 #include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchjobqueue.h"
+#include "mbpatcher/patchtask.h"
 
 
 #define CAST(x) \
@@ -155,6 +157,95 @@ void mbpatcher_config_set_temp_directory(CPatcherConfig *pc, char *path)
     config->set_temp_directory(path);
 }
 
+/*!
+ * \brief Get the patch result cache directory
+ *
+ * \note The returned string is dynamically allocated. It should be free()'d
+ *       when it is no longer needed.
+ *
+ * \param pc CPatcherConfig object
+ * \return Cache directory
+ *
+ * \sa PatcherConfig::cache_directory()
+ */
+char * mbpatcher_config_cache_directory(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return mb::capi_str_to_cstr(config->cache_directory());
+}
+
+/*!
+ * \brief Set the patch result cache directory
+ *
+ * \param pc CPatcherConfig object
+ * \param path Path to cache directory or an empty string to disable the cache
+ *
+ * \sa PatcherConfig::set_cache_directory()
+ */
+void mbpatcher_config_set_cache_directory(CPatcherConfig *pc, char *path)
+{
+    CAST(pc);
+    config->set_cache_directory(path);
+}
+
+/*!
+ * \brief Get the number of threads used for compressing output files
+ *
+ * \param pc CPatcherConfig object
+ * \return Number of compression threads
+ *
+ * \sa PatcherConfig::compression_threads()
+ */
+unsigned int mbpatcher_config_compression_threads(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->compression_threads();
+}
+
+/*!
+ * \brief Set the number of threads used for compressing output files
+ *
+ * \param pc CPatcherConfig object
+ * \param threads Number of compression threads (0 for the default)
+ *
+ * \sa PatcherConfig::set_compression_threads()
+ */
+void mbpatcher_config_set_compression_threads(CPatcherConfig *pc,
+                                              unsigned int threads)
+{
+    CAST(pc);
+    config->set_compression_threads(threads);
+}
+
+/*!
+ * \brief Check whether incompressible files are stored without compression
+ *
+ * \param pc CPatcherConfig object
+ * \return Whether files that don't compress well are stored as-is
+ *
+ * \sa PatcherConfig::store_incompressible()
+ */
+bool mbpatcher_config_store_incompressible(const CPatcherConfig *pc)
+{
+    CCAST(pc);
+    return config->store_incompressible();
+}
+
+/*!
+ * \brief Set whether incompressible files are stored without compression
+ *
+ * \param pc CPatcherConfig object
+ * \param enabled Whether to store incompressible files as-is
+ *
+ * \sa PatcherConfig::set_store_incompressible()
+ */
+void mbpatcher_config_set_store_incompressible(CPatcherConfig *pc,
+                                               bool enabled)
+{
+    CAST(pc);
+    config->set_store_incompressible(enabled);
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
@@ -257,4 +348,68 @@ void mbpatcher_config_destroy_autopatcher(CPatcherConfig *pc,
     config->destroy_auto_patcher(ap);
 }
 
+/*!
+ * \brief Create new PatchJobQueue
+ *
+ * \param pc CPatcherConfig object
+ * \return New PatchJobQueue
+ *
+ * \sa PatcherConfig::create_patch_job_queue()
+ */
+CPatchJobQueue * mbpatcher_config_create_patch_job_queue(CPatcherConfig *pc)
+{
+    CAST(pc);
+    auto *queue = config->create_patch_job_queue();
+    return reinterpret_cast<CPatchJobQueue *>(queue);
+}
+
+/*!
+ * \brief Destroys a PatchJobQueue and frees its memory
+ *
+ * \param pc CPatcherConfig object
+ * \param queue CPatchJobQueue to destroy
+ *
+ * \sa PatcherConfig::destroy_patch_job_queue()
+ */
+void mbpatcher_config_destroy_patch_job_queue(CPatcherConfig *pc,
+                                              CPatchJobQueue *queue)
+{
+    CAST(pc);
+    auto *q = reinterpret_cast<mb::patcher::PatchJobQueue *>(queue);
+    config->destroy_patch_job_queue(q);
+}
+
+/*!
+ * \brief Create new PatchTask
+ *
+ * \param pc CPatcherConfig object
+ * \param patcher CPatcher to run in the background
+ * \return New PatchTask
+ *
+ * \sa PatcherConfig::create_patch_task()
+ */
+CPatchTask * mbpatcher_config_create_patch_task(CPatcherConfig *pc,
+                                                CPatcher *patcher)
+{
+    CAST(pc);
+    auto *p = reinterpret_cast<mb::patcher::Patcher *>(patcher);
+    auto *task = config->create_patch_task(p);
+    return reinterpret_cast<CPatchTask *>(task);
+}
+
+/*!
+ * \brief Destroys a PatchTask and frees its memory
+ *
+ * \param pc CPatcherConfig object
+ * \param task CPatchTask to destroy
+ *
+ * \sa PatcherConfig::destroy_patch_task()
+ */
+void mbpatcher_config_destroy_patch_task(CPatcherConfig *pc, CPatchTask *task)
+{
+    CAST(pc);
+    auto *t = reinterpret_cast<mb::patcher::PatchTask *>(task);
+    config->destroy_patch_task(t);
+}
+
 }
@@ -24,6 +24,7 @@
 #include "mbcommon/capi/util.h"
 
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/private/fileutils.h"
 
 
 #define CASTP(x) \
@@ -233,6 +234,9 @@ char ** mbpatcher_autopatcher_existing_files(const CAutoPatcher *patcher)
 /*!
  * \brief Start patching the file
  *
+ * The files listed by mbpatcher_autopatcher_existing_files() are read from
+ * \p directory, patched in memory, and written back.
+ *
  * \param patcher CAutoPatcher object
  * \param directory Directory containing the files to be patched
  * \return true on success, otherwise false (and error set appropriately)
@@ -242,8 +246,33 @@ char ** mbpatcher_autopatcher_existing_files(const CAutoPatcher *patcher)
 bool mbpatcher_autopatcher_patch_files(CAutoPatcher *patcher,
                                        const char *directory)
 {
+    using namespace mb::patcher;
+
     CASTAP(patcher);
-    return ap->patch_files(directory);
+
+    AutoPatcher::Files files;
+
+    for (auto const &file : ap->existing_files()) {
+        std::string contents;
+
+        if (FileUtils::read_to_string(std::string(directory) + "/" + file,
+                                      &contents) == ErrorCode::NoError) {
+            files.emplace(file, std::move(contents));
+        }
+    }
+
+    if (!ap->patch_files(files)) {
+        return false;
+    }
+
+    for (auto const &[file, contents] : files) {
+        if (FileUtils::write_from_string(std::string(directory) + "/" + file,
+                                         contents) != ErrorCode::NoError) {
+            return false;
+        }
+    }
+
+    return true;
 }
 
 }
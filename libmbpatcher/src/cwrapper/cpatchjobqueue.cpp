@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/cwrapper/cpatchjobqueue.h"
+
+#include <cassert>
+
+#include "mbpatcher/patchjobqueue.h"
+
+
+#define CAST(x) \
+    assert(x != nullptr); \
+    auto *q = reinterpret_cast<mb::patcher::PatchJobQueue *>(x);
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *q = reinterpret_cast<const mb::patcher::PatchJobQueue *>(x);
+
+
+/*!
+ * \file cpatchjobqueue.h
+ * \brief C Wrapper for PatchJobQueue
+ *
+ * Please see the documentation for PatchJobQueue from the C++ API for more
+ * details. The C functions directly correspond to the PatchJobQueue member
+ * functions.
+ *
+ * \sa PatchJobQueue
+ */
+
+extern "C"
+{
+
+/*!
+ * \brief Add a job to the queue
+ *
+ * \param queue CPatchJobQueue object
+ * \param info CFileInfo describing the file to patch (copied)
+ * \param patcher_id ID of the patcher to use
+ * \return Index of the job
+ *
+ * \sa PatchJobQueue::add_job()
+ */
+size_t mbpatcher_jobqueue_add_job(CPatchJobQueue *queue,
+                                  const CFileInfo *info,
+                                  const char *patcher_id)
+{
+    CAST(queue);
+    auto const *fi = reinterpret_cast<const mb::patcher::FileInfo *>(info);
+    return q->add_job(*fi, patcher_id);
+}
+
+/*!
+ * \brief Get the number of jobs in the queue
+ *
+ * \param queue CPatchJobQueue object
+ * \return Number of jobs
+ *
+ * \sa PatchJobQueue::jobs()
+ */
+size_t mbpatcher_jobqueue_jobs(const CPatchJobQueue *queue)
+{
+    CCAST(queue);
+    return q->jobs();
+}
+
+/*!
+ * \brief Get the maximum number of jobs that run concurrently
+ *
+ * \param queue CPatchJobQueue object
+ * \return Maximum number of threads
+ *
+ * \sa PatchJobQueue::max_threads()
+ */
+unsigned int mbpatcher_jobqueue_max_threads(const CPatchJobQueue *queue)
+{
+    CCAST(queue);
+    return q->max_threads();
+}
+
+/*!
+ * \brief Set the maximum number of jobs that run concurrently
+ *
+ * \param queue CPatchJobQueue object
+ * \param threads Maximum number of threads or 0 to restore the default
+ *
+ * \sa PatchJobQueue::set_max_threads()
+ */
+void mbpatcher_jobqueue_set_max_threads(CPatchJobQueue *queue,
+                                        unsigned int threads)
+{
+    CAST(queue);
+    q->set_max_threads(threads);
+}
+
+/*!
+ * \brief Get the maximum number of disk-heavy jobs that run concurrently
+ *
+ * \param queue CPatchJobQueue object
+ * \return Maximum number of disk-heavy jobs
+ *
+ * \sa PatchJobQueue::max_io_jobs()
+ */
+unsigned int mbpatcher_jobqueue_max_io_jobs(const CPatchJobQueue *queue)
+{
+    CCAST(queue);
+    return q->max_io_jobs();
+}
+
+/*!
+ * \brief Set the maximum number of disk-heavy jobs that run concurrently
+ *
+ * \param queue CPatchJobQueue object
+ * \param jobs Maximum number of disk-heavy jobs or 0 for no limit
+ *
+ * \sa PatchJobQueue::set_max_io_jobs()
+ */
+void mbpatcher_jobqueue_set_max_io_jobs(CPatchJobQueue *queue,
+                                        unsigned int jobs)
+{
+    CAST(queue);
+    q->set_max_io_jobs(jobs);
+}
+
+/*!
+ * \brief Run all jobs in the queue
+ *
+ * \param queue CPatchJobQueue object
+ * \param progress_cb Callback for receiving the total progress of all jobs
+ * \param files_cb Callback for receiving the total files count of all jobs
+ * \param details_cb Callback for receiving detailed progress text
+ * \param finished_cb Callback for receiving the result of each job
+ * \param userdata Pointer to pass to callback functions
+ * \return true if all jobs succeeded, otherwise false
+ *
+ * \sa PatchJobQueue::run()
+ */
+bool mbpatcher_jobqueue_run(CPatchJobQueue *queue,
+                            ProgressUpdatedCallback progress_cb,
+                            FilesUpdatedCallback files_cb,
+                            DetailsUpdatedCallback details_cb,
+                            JobFinishedCallback finished_cb,
+                            void *userdata)
+{
+    CAST(queue);
+
+    return q->run(
+        [&](uint64_t bytes, uint64_t max_bytes) {
+            if (progress_cb) {
+                progress_cb(bytes, max_bytes, userdata);
+            }
+        },
+        [&](uint64_t files, uint64_t max_files) {
+            if (files_cb) {
+                files_cb(files, max_files, userdata);
+            }
+        },
+        [&](const std::string &text) {
+            if (details_cb) {
+                details_cb(text.c_str(), userdata);
+            }
+        },
+        [&](std::size_t index, bool ret) {
+            if (finished_cb) {
+                finished_cb(index, ret, userdata);
+            }
+        }
+    );
+}
+
+/*!
+ * \brief Cancel the running jobs and skip the pending ones
+ *
+ * \param queue CPatchJobQueue object
+ *
+ * \sa PatchJobQueue::cancel()
+ */
+void mbpatcher_jobqueue_cancel(CPatchJobQueue *queue)
+{
+    CAST(queue);
+    q->cancel();
+}
+
+/*!
+ * \brief Check whether a job succeeded during the last run
+ *
+ * \param queue CPatchJobQueue object
+ * \param index Index of the job
+ * \return Whether the job succeeded
+ *
+ * \sa PatchJobQueue::job_succeeded()
+ */
+bool mbpatcher_jobqueue_job_succeeded(const CPatchJobQueue *queue,
+                                      size_t index)
+{
+    CCAST(queue);
+    return q->job_succeeded(index);
+}
+
+/*!
+ * \brief Get the error of a job that failed during the last run
+ *
+ * \param queue CPatchJobQueue object
+ * \param index Index of the job
+ * \return ErrorCode
+ *
+ * \sa PatchJobQueue::job_error()
+ */
+/* enum ErrorCode */ int mbpatcher_jobqueue_job_error(const CPatchJobQueue *queue,
+                                                      size_t index)
+{
+    CCAST(queue);
+    return static_cast<int>(q->job_error(index));
+}
+
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/cwrapper/cpatchtask.h"
+
+#include <cassert>
+
+#include "mbcommon/capi/util.h"
+
+#include "mbpatcher/patchtask.h"
+
+
+#define CAST(x) \
+    assert(x != nullptr); \
+    auto *t = reinterpret_cast<mb::patcher::PatchTask *>(x);
+#define CCAST(x) \
+    assert(x != nullptr); \
+    auto const *t = reinterpret_cast<const mb::patcher::PatchTask *>(x);
+
+
+/*!
+ * \file cpatchtask.h
+ * \brief C Wrapper for PatchTask
+ *
+ * Please see the documentation for PatchTask from the C++ API for more
+ * details. The C functions directly correspond to the PatchTask member
+ * functions.
+ *
+ * \sa PatchTask
+ */
+
+static_assert(MBPATCHER_PROGRESS_BYTES == mb::patcher::ProgressUpdate::Bytes,
+              "MBPATCHER_PROGRESS_BYTES does not match");
+static_assert(MBPATCHER_PROGRESS_FILES == mb::patcher::ProgressUpdate::Files,
+              "MBPATCHER_PROGRESS_FILES does not match");
+static_assert(MBPATCHER_PROGRESS_DETAILS
+                      == mb::patcher::ProgressUpdate::Details,
+              "MBPATCHER_PROGRESS_DETAILS does not match");
+
+extern "C"
+{
+
+/*!
+ * \brief Start patching in the background
+ *
+ * \param task CPatchTask object
+ * \return true if the task was started, otherwise false
+ *
+ * \sa PatchTask::start()
+ */
+bool mbpatcher_patchtask_start(CPatchTask *task)
+{
+    CAST(task);
+    return t->start();
+}
+
+/*!
+ * \brief Cancel patching
+ *
+ * \param task CPatchTask object
+ *
+ * \sa PatchTask::cancel()
+ */
+void mbpatcher_patchtask_cancel(CPatchTask *task)
+{
+    CAST(task);
+    t->cancel();
+}
+
+/*!
+ * \brief Block until the task has finished
+ *
+ * \param task CPatchTask object
+ * \return true if patching succeeded, otherwise false
+ *
+ * \sa PatchTask::wait()
+ */
+bool mbpatcher_patchtask_wait(CPatchTask *task)
+{
+    CAST(task);
+    return t->wait();
+}
+
+/*!
+ * \brief Get the file descriptor that signals progress and completion
+ *
+ * \note The file descriptor is owned by the task and must not be closed or
+ *       read from.
+ *
+ * \param task CPatchTask object
+ * \return File descriptor or -1 if the platform does not support it
+ *
+ * \sa PatchTask::fd()
+ */
+int mbpatcher_patchtask_fd(const CPatchTask *task)
+{
+    CCAST(task);
+    return t->fd();
+}
+
+/*!
+ * \brief Get a snapshot of the latest progress
+ *
+ * \note The string returned in \p details is dynamically allocated. It should
+ *       be free()'d when it is no longer needed.
+ *
+ * \param[in] task CPatchTask object
+ * \param[out] progress Pointer to store the progress values
+ * \param[out] details Pointer to store the details text if it changed since
+ *                     the previous call or NULL if it did not. May be NULL if
+ *                     the details text is not needed.
+ *
+ * \sa PatchTask::progress()
+ */
+void mbpatcher_patchtask_progress(CPatchTask *task, CPatchProgress *progress,
+                                  char **details)
+{
+    CAST(task);
+    assert(progress != nullptr);
+
+    auto update = t->progress();
+
+    progress->changed = update.changed;
+    progress->bytes = update.bytes;
+    progress->max_bytes = update.max_bytes;
+    progress->files = update.files;
+    progress->max_files = update.max_files;
+
+    if (details) {
+        if (update.changed & mb::patcher::ProgressUpdate::Details) {
+            *details = mb::capi_str_to_cstr(update.details);
+        } else {
+            *details = nullptr;
+        }
+    }
+}
+
+/*!
+ * \brief Check whether the task has finished
+ *
+ * \param task CPatchTask object
+ * \return true if the task has finished, otherwise false
+ *
+ * \sa PatchTask::is_finished()
+ */
+bool mbpatcher_patchtask_is_finished(const CPatchTask *task)
+{
+    CCAST(task);
+    return t->is_finished();
+}
+
+/*!
+ * \brief Check whether patching succeeded
+ *
+ * \param task CPatchTask object
+ * \return true if the task has finished successfully, otherwise false
+ *
+ * \sa PatchTask::succeeded()
+ */
+bool mbpatcher_patchtask_succeeded(const CPatchTask *task)
+{
+    CCAST(task);
+    return t->succeeded();
+}
+
+/*!
+ * \brief Get the error if patching failed
+ *
+ * \param task CPatchTask object
+ * \return ErrorCode
+ *
+ * \sa PatchTask::error()
+ */
+/* enum ErrorCode */ int mbpatcher_patchtask_error(const CPatchTask *task)
+{
+    CCAST(task);
+    return static_cast<int>(t->error());
+}
+
+}
@@ -77,8 +77,15 @@ std::string EdifyErrorCategory::message(int ev) const
     }
 }
 
+/*!
+ * \brief Create string token from a view of the raw token text
+ *
+ * \param str Raw token text, including the quotes if \p quoted is true. The
+ *            token references this string.
+ * \param quoted Whether the string is quoted
+ */
 oc::result<EdifyTokenString>
-EdifyTokenString::from_raw(std::string str, bool quoted)
+EdifyTokenString::from_raw(std::string_view str, bool quoted)
 {
     if (quoted && (str.size() < 2 || str.front() != '"' || str.back() != '"')) {
         return EdifyError::ValueNotQuoted;
@@ -86,17 +93,21 @@ EdifyTokenString::from_raw(std::string str, bool quoted)
 
     EdifyTokenString token;
     token.m_quoted = quoted;
-    if (quoted) {
-        token.m_str = str.substr(1, str.size() - 2);
-    } else {
-        token.m_str = std::move(str);
-    }
+    token.m_str = str;
 
     return std::move(token);
 }
 
+/*!
+ * \brief Create string token from an unescaped string
+ *
+ * \param str Unescaped string
+ * \param make_quoted Whether to create a quoted string token
+ * \param arena Arena for storing the raw token text
+ */
 oc::result<EdifyTokenString>
-EdifyTokenString::from_string(std::string str, bool make_quoted)
+EdifyTokenString::from_string(std::string str, bool make_quoted,
+                              EdifyStringArena &arena)
 {
     if (!make_quoted) {
         for (char c : str) {
@@ -109,40 +120,42 @@ EdifyTokenString::from_string(std::string str, bool make_quoted)
     EdifyTokenString token;
     token.m_quoted = make_quoted;
     if (make_quoted) {
-        token.m_str = escape(str);
+        std::string buf;
+        buf += '"';
+        buf += escape(str);
+        buf += '"';
+        token.m_str = arena.store(std::move(buf));
     } else {
-        token.m_str = std::move(str);
+        token.m_str = arena.store(std::move(str));
     }
 
     return std::move(token);
 }
 
-std::string EdifyTokenString::generate() const
+std::string_view EdifyTokenString::generate() const
 {
-    std::string buf;
-    buf.reserve(2 + m_str.size());
-    if (m_quoted) {
-        buf += '"';
-    }
-    buf += m_str;
-    if (m_quoted) {
-        buf += '"';
-    }
-    return buf;
+    return m_str;
 }
 
 oc::result<std::string> EdifyTokenString::unescaped_string() const
 {
     if (m_quoted) {
-        return unescape(m_str);
+        return unescape(raw_string());
     } else {
-        return m_str;
+        return std::string(m_str);
     }
 }
 
-std::string EdifyTokenString::raw_string() const
+/*!
+ * \brief Get the raw string without the quotes
+ */
+std::string_view EdifyTokenString::raw_string() const
 {
-    return m_str;
+    if (m_quoted) {
+        return m_str.substr(1, m_str.size() - 2);
+    } else {
+        return m_str;
+    }
 }
 
 bool EdifyTokenString::quoted() const
@@ -270,9 +283,9 @@ oc::result<std::string> EdifyTokenString::unescape(std::string_view str)
     return std::move(output);
 }
 
-static std::string generate_token(const EdifyToken &token)
+std::string_view EdifyTokenizer::generate(const EdifyToken &token)
 {
-    return std::visit([](auto &&t) {
+    return std::visit([](auto &&t) -> std::string_view {
         return t.generate();
     }, token);
 }
@@ -328,58 +341,46 @@ oc::result<EdifyToken> EdifyTokenizer::next_token(std::string_view str,
         consumed = 1;
         return EdifyTokenNewline();
     } else if (char c = str.front(); c != '\n' && std::isspace(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
-        for (auto it = str.begin() + 1;
-                it != str.end() && *it != '\n' && std::isspace(*it); ++it) {
-            buf += *it;
-            consumed += 1;
+        while (consumed < str.size() && str[consumed] != '\n'
+                && std::isspace(str[consumed])) {
+            ++consumed;
         }
-        return EdifyTokenWhitespace(std::move(buf));
+        return EdifyTokenWhitespace(str.substr(0, consumed));
     } else if (str.front() == '#') {
-        std::string buf;
-        // Omit '#' character
         consumed = 1;
-        for (auto it = str.begin() + 1; it != str.end() && *it != '\n'; ++it) {
-            buf += *it;
-            consumed += 1;
+        while (consumed < str.size() && str[consumed] != '\n') {
+            ++consumed;
         }
-        return EdifyTokenComment(std::move(buf));
+        return EdifyTokenComment(str.substr(0, consumed));
     } else if (char c = str.front(); EdifyTokenString::is_valid_unquoted(c)) {
-        std::string buf;
-        buf += c;
         consumed = 1;
-        for (auto it = str.begin() + 1;
-                it != str.end() && EdifyTokenString::is_valid_unquoted(*it);
-                ++it) {
-            buf += *it;
-            consumed += 1;
+        while (consumed < str.size()
+                && EdifyTokenString::is_valid_unquoted(str[consumed])) {
+            ++consumed;
         }
-        OUTCOME_TRY(r, EdifyTokenString::from_raw(std::move(buf), false));
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(str.substr(0, consumed),
+                                                  false));
         return std::move(r);
     } else if (char c = str.front(); c == '"') {
-        std::string buf;
-        buf += c;
         consumed = 1;
         bool escaped = false;
         bool terminated = false;
-        for (auto it = str.begin() + 1; it != str.end(); ++it) {
-            if (*it == '\\' || escaped) {
+        for (; consumed < str.size(); ++consumed) {
+            char c2 = str[consumed];
+            if (c2 == '\\' || escaped) {
                 escaped = !escaped;
-            } else if (!escaped && *it == '"') {
-                buf += *it;
+            } else if (!escaped && c2 == '"') {
                 consumed += 1;
                 terminated = true;
                 break;
             }
-            buf += *it;
-            consumed += 1;
         }
         if (!terminated) {
             return EdifyError::UnterminatedQuote;
         }
-        OUTCOME_TRY(r,  EdifyTokenString::from_raw(std::move(buf), true));
+        OUTCOME_TRY(r, EdifyTokenString::from_raw(str.substr(0, consumed),
+                                                  true));
         return std::move(r);
     } else {
         consumed = 1;
@@ -391,6 +392,8 @@ oc::result<std::vector<EdifyToken>>
 EdifyTokenizer::tokenize(std::string_view str)
 {
     std::vector<EdifyToken> temp;
+    // Rough estimate to avoid most reallocations
+    temp.reserve(str.size() / 4);
 
     while (true) {
         if (str.empty()) {
@@ -415,9 +418,15 @@ std::string EdifyTokenizer::untokenize(const std::vector<EdifyToken> &tokens)
 std::string EdifyTokenizer::untokenize(std::vector<EdifyToken>::const_iterator begin,
                                        std::vector<EdifyToken>::const_iterator end)
 {
+    size_t size = 0;
+    for (auto it = begin; it != end; ++it) {
+        size += generate(*it).size();
+    }
+
     std::string output;
+    output.reserve(size);
     for (auto it = begin; it != end; ++it) {
-        output += generate_token(*it);
+        output += generate(*it);
     }
     return output;
 }
@@ -474,7 +483,7 @@ void EdifyTokenizer::dump(const std::vector<EdifyToken> &tokens)
         );
 
         LOGD("%" MB_PRIzu ": %-20s: %s",
-             i, token_name, generate_token(t).c_str());
+             i, token_name, std::string(generate(t)).c_str());
     }
 }
 
@@ -23,8 +23,13 @@
 
 #include <cassert>
 
+#include "mbcommon/executor.h"
+
 #include "mbpatcher/patcherinterface.h"
+#include "mbpatcher/patchjobqueue.h"
+#include "mbpatcher/patchtask.h"
 #include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/payloadcache.h"
 
 // Patchers
 #include "mbpatcher/autopatchers/magiskpatcher.h"
@@ -45,7 +50,10 @@ namespace mb::patcher
  * Blah blah documenting later ;)
  */
 
-PatcherConfig::PatcherConfig() = default;
+PatcherConfig::PatcherConfig()
+    : m_payload_cache(std::make_unique<PayloadCache>())
+{
+}
 
 PatcherConfig::~PatcherConfig() = default;
 
@@ -111,6 +119,88 @@ void PatcherConfig::set_temp_directory(std::string path)
     m_temp_dir = std::move(path);
 }
 
+/*!
+ * \brief Get the patch result cache directory
+ *
+ * \return Cache directory or an empty string if the cache is disabled
+ */
+std::string PatcherConfig::cache_directory() const
+{
+    return m_cache_dir;
+}
+
+/*!
+ * \brief Set the patch result cache directory
+ *
+ * If set, patched zip files are stored in this directory. Patching the same
+ * input file for the same device again reuses the stored output instead of
+ * redoing all of the work. If only the ROM ID differs, the stored output is
+ * re-stamped with the new ROM ID. The cache is disabled by default.
+ *
+ * \note Since the input file needs to be hashed to look up the cache, this
+ *       adds an extra read of the input file to every patching operation.
+ *
+ * \param path Path to cache directory or an empty string to disable the cache
+ */
+void PatcherConfig::set_cache_directory(std::string path)
+{
+    m_cache_dir = std::move(path);
+}
+
+/*!
+ * \brief Get the number of threads used for compressing output files
+ *
+ * The default is the concurrency of the global Executor, which the
+ * compression runs on.
+ *
+ * \return Number of compression threads
+ */
+unsigned int PatcherConfig::compression_threads() const
+{
+    if (m_compression_threads == 0) {
+        return Executor::global().concurrency();
+    } else {
+        return m_compression_threads;
+    }
+}
+
+/*!
+ * \brief Set the number of threads used for compressing output files
+ *
+ * \note Setting this to 1 disables parallel compression. Setting this to 0
+ *       restores the default.
+ *
+ * \param threads Number of compression threads
+ */
+void PatcherConfig::set_compression_threads(unsigned int threads)
+{
+    m_compression_threads = threads;
+}
+
+/*!
+ * \brief Check whether incompressible files are stored without compression
+ *
+ * \return Whether files that don't compress well are stored as-is
+ */
+bool PatcherConfig::store_incompressible() const
+{
+    return m_store_incompressible;
+}
+
+/*!
+ * \brief Set whether incompressible files are stored without compression
+ *
+ * If enabled (the default), a sample from the beginning of each large file
+ * (eg. a sparse image in an Odin firmware) is test compressed and the file is
+ * stored instead of deflated if compression does not reduce its size by much.
+ *
+ * \param enabled Whether to store incompressible files as-is
+ */
+void PatcherConfig::set_store_incompressible(bool enabled)
+{
+    m_store_incompressible = enabled;
+}
+
 /*!
  * \brief Get list of Patcher IDs
  *
@@ -162,6 +252,7 @@ Patcher * PatcherConfig::create_patcher(const std::string &id)
         return nullptr;
     }
 
+    std::lock_guard<std::mutex> lock(m_mutex);
     auto *ptr = p.get();
     m_patchers.push_back(std::move(p));
     return ptr;
@@ -192,6 +283,7 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
         return nullptr;
     }
 
+    std::lock_guard<std::mutex> lock(m_mutex);
     auto *ptr = ap.get();
     m_auto_patchers.push_back(std::move(ap));
     return ptr;
@@ -204,6 +296,7 @@ AutoPatcher * PatcherConfig::create_auto_patcher(const std::string &id,
  */
 void PatcherConfig::destroy_patcher(Patcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     auto it = std::find_if(
         m_patchers.begin(),
         m_patchers.end(),
@@ -222,6 +315,7 @@ void PatcherConfig::destroy_patcher(Patcher *patcher)
  */
 void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
 {
+    std::lock_guard<std::mutex> lock(m_mutex);
     auto it = std::find_if(
         m_auto_patchers.begin(),
         m_auto_patchers.end(),
@@ -233,4 +327,101 @@ void PatcherConfig::destroy_auto_patcher(AutoPatcher *patcher)
     m_auto_patchers.erase(it);
 }
 
+/*!
+ * \brief Create new PatchJobQueue
+ *
+ * \return New PatchJobQueue
+ */
+PatchJobQueue * PatcherConfig::create_patch_job_queue()
+{
+    auto queue = std::make_unique<PatchJobQueue>(*this);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto *ptr = queue.get();
+    m_job_queues.push_back(std::move(queue));
+    return ptr;
+}
+
+/*!
+ * \brief Destroys a PatchJobQueue and frees its memory
+ *
+ * \note The queue must not be running.
+ *
+ * \param queue PatchJobQueue to destroy
+ */
+void PatcherConfig::destroy_patch_job_queue(PatchJobQueue *queue)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find_if(
+        m_job_queues.begin(),
+        m_job_queues.end(),
+        [&](const std::unique_ptr<PatchJobQueue> &item) {
+            return item.get() == queue;
+        }
+    );
+    assert(it != m_job_queues.end());
+    m_job_queues.erase(it);
+}
+
+/*!
+ * \brief Create new PatchTask
+ *
+ * \param patcher Patcher to run in the background. It must not be destroyed
+ *                before the task.
+ *
+ * \return New PatchTask
+ */
+PatchTask * PatcherConfig::create_patch_task(Patcher *patcher)
+{
+    assert(patcher != nullptr);
+
+    auto task = std::make_unique<PatchTask>(*patcher);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto *ptr = task.get();
+    m_patch_tasks.push_back(std::move(task));
+    return ptr;
+}
+
+/*!
+ * \brief Destroys a PatchTask and frees its memory
+ *
+ * \note If the task is running, this waits for it to finish.
+ *
+ * \param task PatchTask to destroy
+ */
+void PatcherConfig::destroy_patch_task(PatchTask *task)
+{
+    std::unique_ptr<PatchTask> ptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = std::find_if(
+            m_patch_tasks.begin(),
+            m_patch_tasks.end(),
+            [&](const std::unique_ptr<PatchTask> &item) {
+                return item.get() == task;
+            }
+        );
+        assert(it != m_patch_tasks.end());
+        ptr = std::move(*it);
+        m_patch_tasks.erase(it);
+    }
+
+    // Wait for the task without holding the lock. The patcher creates and
+    // destroys autopatchers while it runs.
+    ptr.reset();
+}
+
+/*!
+ * \brief Get the cache of compressed payload files
+ *
+ * The cache lives as long as the PatcherConfig, so it is shared by all
+ * patchers created from it.
+ */
+PayloadCache & PatcherConfig::payload_cache()
+{
+    return *m_payload_cache;
+}
+
 }
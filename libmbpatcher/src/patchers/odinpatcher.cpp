@@ -21,8 +21,11 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <optional>
 #include <thread>
 #include <unordered_set>
+#include <vector>
 
 #include <cassert>
 #include <cinttypes>
@@ -32,6 +35,11 @@
 #  include <cerrno>
 #endif
 
+#include <zlib.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/locale.h"
 #include "mbcommon/string.h"
@@ -39,11 +47,14 @@
 #include "mbdevice/json.h"
 
 #include "mblog/logging.h"
+#include "mbpio/delete.h"
+#include "mbsparse/sparse_writer.h"
 
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patchers/zippatcher.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/paralleldeflate.h"
 
 // minizip
 #include "mz_zip.h"
@@ -56,11 +67,18 @@ namespace mb::patcher
 
 const std::string OdinPatcher::Id("OdinPatcher");
 
+// Amount of data at the beginning of each file used to estimate whether the
+// file is compressible
+static constexpr size_t COMPRESSIBILITY_SAMPLE_SIZE = 4 * 1024 * 1024;
+// Minimum size reduction (in percent) of the sample for a file to be deflated
+static constexpr size_t MIN_COMPRESSION_GAIN = 10;
+// Magic number at the beginning of Android sparse images
+static constexpr uint32_t SPARSE_HEADER_MAGIC = 0xed26ff3a;
+
 
 OdinPatcher::OdinPatcher(PatcherConfig &pc)
     : m_pc(pc)
     , m_info(nullptr)
-    , m_old_bytes(0)
     , m_bytes(0)
     , m_max_bytes(0)
     , m_cancelled(0)
@@ -70,9 +88,9 @@ OdinPatcher::OdinPatcher(PatcherConfig &pc)
 #ifdef __ANDROID__
     , m_fd(-1)
 #endif
+    , m_la_prefetch()
     , m_added_files()
-    , m_progress_cb()
-    , m_details_cb()
+    , m_progress()
     , m_a_input(nullptr)
     , m_z_output(nullptr)
 {
@@ -110,17 +128,14 @@ bool OdinPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
 
     assert(m_info != nullptr);
 
-    m_progress_cb = &progress_cb;
-    m_details_cb = &details_cb;
+    m_progress.start(&progress_cb, nullptr, &details_cb);
 
-    m_old_bytes = 0;
     m_bytes = 0;
     m_max_bytes = 0;
 
     bool ret = patch_tar();
 
-    m_progress_cb = nullptr;
-    m_details_cb = nullptr;
+    m_progress.finish();
 
     if (m_a_input != nullptr) {
         close_input_archive();
@@ -137,6 +152,21 @@ bool OdinPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
     return ret;
 }
 
+using Clock = std::chrono::steady_clock;
+
+/*!
+ * \brief Log how long a step of the patching process took
+ *
+ * The message format ("Timing: <step>: <ms> ms") is parsed by
+ * examples/patcher_bench.cpp.
+ */
+static void log_timing(const char *step, Clock::time_point start)
+{
+    auto ms = std::chrono::duration<double, std::milli>(
+            Clock::now() - start).count();
+    LOGD("Timing: %s: %.3f ms", step, ms);
+}
+
 struct CopySpec
 {
     std::string source;
@@ -172,7 +202,7 @@ bool OdinPatcher::patch_tar()
     if (m_cancelled) return false;
 
     // Get file size and seek back to original location
-    auto current_pos = m_la_file.seek(0, SEEK_CUR);
+    auto current_pos = m_la_prefetch.seek(0, SEEK_CUR);
     if (!current_pos) {
         LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
              current_pos.error().message().c_str());
@@ -180,7 +210,7 @@ bool OdinPatcher::patch_tar()
         return false;
     }
 
-    auto seek_ret = m_la_file.seek(0, SEEK_END);
+    auto seek_ret = m_la_prefetch.seek(0, SEEK_END);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
              seek_ret.error().message().c_str());
@@ -189,8 +219,8 @@ bool OdinPatcher::patch_tar()
     }
     m_max_bytes = seek_ret.value();
 
-    seek_ret = m_la_file.seek(static_cast<int64_t>(current_pos.value()),
-                              SEEK_SET);
+    seek_ret = m_la_prefetch.seek(static_cast<int64_t>(current_pos.value()),
+                                  SEEK_SET);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", m_info->input_path().c_str(),
              seek_ret.error().message().c_str());
@@ -200,10 +230,14 @@ bool OdinPatcher::patch_tar()
 
     if (m_cancelled) return false;
 
+    auto start = Clock::now();
+
     if (!process_contents(m_a_input, 0, nullptr)) {
         return false;
     }
 
+    log_timing("process_contents", start);
+
     std::string arch_dir(m_pc.data_directory());
     arch_dir += "/binaries/android/";
     arch_dir += m_info->device().architecture();
@@ -256,6 +290,8 @@ bool OdinPatcher::patch_tar()
 
     ErrorCode result;
 
+    start = Clock::now();
+
     for (const CopySpec &spec : to_copy) {
         if (m_cancelled) return false;
 
@@ -269,6 +305,8 @@ bool OdinPatcher::patch_tar()
         }
     }
 
+    log_timing("to_copy", start);
+
     if (m_cancelled) return false;
 
     update_details("multiboot/info.prop");
@@ -303,6 +341,137 @@ bool OdinPatcher::patch_tar()
     return true;
 }
 
+/*!
+ * \brief Check if a sample of a file compresses well enough to be worth
+ *        deflating
+ *
+ * The sample is compressed at the fastest compression level, so this slightly
+ * underestimates the gain of the real compression pass.
+ */
+static bool is_compressible(const std::vector<unsigned char> &sample)
+{
+    if (sample.empty()) {
+        return true;
+    }
+
+    z_stream strm = {};
+
+    if (deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return true;
+    }
+
+    std::vector<unsigned char> output(
+            deflateBound(&strm, static_cast<uLong>(sample.size())));
+
+    strm.next_in = const_cast<unsigned char *>(sample.data());
+    strm.avail_in = static_cast<uInt>(sample.size());
+    strm.next_out = output.data();
+    strm.avail_out = static_cast<uInt>(output.size());
+
+    int ret = deflate(&strm, Z_FINISH);
+    size_t compressed_size = strm.total_out;
+    deflateEnd(&strm);
+
+    if (ret != Z_STREAM_END) {
+        return true;
+    }
+
+    return compressed_size * 100
+            <= sample.size() * (100 - MIN_COMPRESSION_GAIN);
+}
+
+static bool is_sparse_image(const std::vector<unsigned char> &sample)
+{
+    uint32_t magic;
+
+    if (sample.size() < sizeof(magic)) {
+        return false;
+    }
+
+    memcpy(&magic, sample.data(), sizeof(magic));
+    return mb_le32toh(magic) == SPARSE_HEADER_MAGIC;
+}
+
+/*!
+ * \brief Convert the raw image being read from an archive to a sparse image
+ *
+ * Blocks of zeros are stored as "don't care" chunks, so only the allocated
+ * blocks of the image are compressed and flashed.
+ *
+ * \param a Archive positioned at the data of the image
+ * \param name Name of the image
+ * \param sample Data of the image that was already read from \p a
+ * \param output Seekable file for the sparse image. On success, it is
+ *               positioned at the beginning of the sparse image.
+ */
+bool OdinPatcher::convert_to_sparse(archive *a, const char *name,
+                                    const std::vector<unsigned char> &sample,
+                                    File &output)
+{
+    sparse::SparseWriter writer;
+
+    if (auto r = writer.open(&output,
+                             sparse::SparseWriterFlag::DontCareZeroBlocks);
+            !r) {
+        LOGE("%s: Failed to open sparse writer: %s",
+             name, r.error().message().c_str());
+        m_error = ErrorCode::FileOpenError;
+        return false;
+    }
+
+    if (!sample.empty()) {
+        if (auto r = file_write_exact(writer, sample.data(), sample.size());
+                !r) {
+            LOGE("%s: Failed to write sparse image: %s",
+                 name, r.error().message().c_str());
+            m_error = ErrorCode::FileWriteError;
+            return false;
+        }
+    }
+
+    la_ssize_t n_read;
+    std::vector<char> buf(ParallelDeflater::BLOCK_SIZE);
+
+    while ((n_read = archive_read_data(a, buf.data(), buf.size())) > 0) {
+        if (m_cancelled) return false;
+
+        if (auto r = file_write_exact(writer, buf.data(),
+                                      static_cast<size_t>(n_read)); !r) {
+            LOGE("%s: Failed to write sparse image: %s",
+                 name, r.error().message().c_str());
+            m_error = ErrorCode::FileWriteError;
+            return false;
+        }
+    }
+
+    if (n_read != 0) {
+        LOGE("libarchive: Failed to read %s: %s",
+             name, archive_error_string(a));
+        m_error = ErrorCode::ArchiveReadDataError;
+        return false;
+    }
+
+    if (auto r = writer.close(); !r) {
+        LOGE("%s: Failed to finish sparse image: %s",
+             name, r.error().message().c_str());
+        m_error = ErrorCode::FileWriteError;
+        return false;
+    }
+
+    LOGD("%s: Converted to sparse image with %" PRIu32 " chunks",
+         name, writer.total_chunks());
+
+    if (auto r = output.seek(0, SEEK_SET); !r) {
+        LOGE("%s: Failed to seek sparse image: %s",
+             name, r.error().message().c_str());
+        m_error = ErrorCode::FileSeekError;
+        return false;
+    }
+
+    return true;
+}
+
 bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
 {
     const char *name = archive_entry_pathname(entry);
@@ -315,33 +484,178 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
         zip_name += ".sparse";
     }
 
+    // Read the beginning of the file to decide whether it should be stored
+    // instead of deflated. Deflating data that is already compressed only
+    // costs time when patching and when inflating it again during flashing.
+    // For sparse images, this is also used to check the sparse header.
+    std::vector<unsigned char> sample;
+    bool store = false;
+
+    if (m_pc.store_incompressible() || sparse) {
+        sample.resize(COMPRESSIBILITY_SAMPLE_SIZE);
+        size_t sample_size = 0;
+        la_ssize_t n = 0;
+
+        while (sample_size < sample.size()
+                && (n = archive_read_data(a, sample.data() + sample_size,
+                                          sample.size() - sample_size)) > 0) {
+            sample_size += static_cast<size_t>(n);
+        }
+
+        if (n < 0) {
+            LOGE("libarchive: Failed to read %s: %s",
+                 name, archive_error_string(a));
+            m_error = ErrorCode::ArchiveReadDataError;
+            return false;
+        }
+
+        sample.resize(sample_size);
+    }
+
+    // Some tarballs contain raw ext4 images where a sparse image is expected.
+    // They are converted so that the empty blocks are neither compressed nor
+    // flashed. The sparse image needs to be seekable while it is written, so
+    // it is staged in a temporary file.
+    StandardFile converted;
+    std::string temp_dir;
+
+    auto remove_temp_dir = finally([&] {
+        (void) converted.close();
+        if (!temp_dir.empty()) {
+            (void) io::delete_recursively(temp_dir);
+        }
+    });
+
+    if (sparse && !is_sparse_image(sample)) {
+        LOGD("Converting raw image to sparse image: %s", name);
+
+        temp_dir = FileUtils::create_temporary_dir(m_pc.temp_directory());
+        if (temp_dir.empty()) {
+            LOGE("Failed to create temporary directory");
+            m_error = ErrorCode::FileOpenError;
+            return false;
+        }
+
+        auto temp_path = temp_dir + "/image.sparse";
+
+        if (auto r = FileUtils::open_file(converted, temp_path,
+                                          FileOpenMode::ReadWriteTrunc); !r) {
+            LOGE("%s: Failed to open for writing: %s",
+                 temp_path.c_str(), r.error().message().c_str());
+            m_error = ErrorCode::FileOpenError;
+            return false;
+        }
+
+        if (!convert_to_sparse(a, name, sample, converted)) {
+            return false;
+        }
+
+        // The compressibility is checked on the converted data
+        sample.resize(m_pc.store_incompressible()
+                ? COMPRESSIBILITY_SAMPLE_SIZE : 0);
+
+        auto n = file_read_retry(converted, sample.data(), sample.size());
+        if (!n) {
+            LOGE("%s: Failed to read sparse image: %s",
+                 temp_path.c_str(), n.error().message().c_str());
+            m_error = ErrorCode::FileReadError;
+            return false;
+        }
+
+        sample.resize(n.value());
+    }
+
+    if (m_pc.store_incompressible()) {
+        store = !is_compressible(sample);
+
+        if (store) {
+            LOGD("Storing incompressible file: %s", name);
+        }
+    }
+
+    // Reads the rest of the file after the sample
+    auto read_data = [&](void *buf, size_t size) -> la_ssize_t {
+        if (!converted.is_open()) {
+            return archive_read_data(a, buf, size);
+        }
+
+        auto n = converted.read(buf, size);
+        if (!n) {
+            LOGE("%s: Failed to read sparse image: %s",
+                 name, n.error().message().c_str());
+            return -1;
+        }
+        return static_cast<la_ssize_t>(n.value());
+    };
+
     mz_zip_file file_info = {};
-    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.compression_method = store
+            ? MZ_COMPRESS_METHOD_STORE : MZ_COMPRESS_METHOD_DEFLATE;
     file_info.filename = zip_name.c_str();
     file_info.filename_size = static_cast<uint16_t>(zip_name.size());
 
     void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+    unsigned int threads = store ? 1 : m_pc.compression_threads();
 
-    // Open file in output zip
-    int mz_ret = mz_zip_entry_write_open(handle, &file_info,
-                                         MZ_COMPRESS_LEVEL_DEFAULT, nullptr);
+    // Open file in output zip. With parallel compression, the entry is opened
+    // in raw mode and the deflate stream is produced by ParallelDeflater.
+    int mz_ret = mz_zip_entry_write_open(
+            handle, &file_info, threads > 1 ? 0 : MZ_COMPRESS_LEVEL_DEFAULT,
+            nullptr);
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to open new file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteHeaderError;
         return false;
     }
 
+    auto write_entry = [&](const void *buf, size_t size) {
+        auto data = static_cast<const char *>(buf);
+
+        // minizip no longer supports buffers larger than UINT16_MAX
+        while (size > 0) {
+            auto n = static_cast<uint32_t>(
+                    std::min<size_t>(size, UINT16_MAX));
+
+            int n_written = mz_zip_entry_write(handle, data, n);
+            if (n_written < 0 || static_cast<uint32_t>(n_written) != n) {
+                LOGE("minizip: Failed to write %s in output zip",
+                     zip_name.c_str());
+                return false;
+            }
+
+            data += n;
+            size -= n;
+        }
+
+        return true;
+    };
+
+    std::optional<ParallelDeflater> deflater;
+    if (threads > 1) {
+        deflater.emplace(threads, Z_DEFAULT_COMPRESSION, write_entry);
+    }
+
+    // The deflater's writer thread must be stopped before the entry is closed
+    auto close_entry = finally([&] {
+        deflater.reset();
+        mz_zip_entry_close(handle);
+    });
+
+    if (!sample.empty() && (deflater
+            ? !deflater->write(sample.data(), sample.size())
+            : !write_entry(sample.data(), sample.size()))) {
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
     la_ssize_t n_read;
     char buf[10240];
-    while ((n_read = archive_read_data(a, buf, sizeof(buf))) > 0) {
+    while ((n_read = read_data(buf, sizeof(buf))) > 0) {
         if (m_cancelled) return false;
 
-        int n_written = mz_zip_entry_write(
-                handle, buf, static_cast<uint32_t>(n_read));
-        if (static_cast<la_ssize_t>(n_written) != n_read) {
-            LOGE("minizip: Failed to write %s in output zip", zip_name.c_str());
+        if (deflater ? !deflater->write(buf, static_cast<size_t>(n_read))
+                : !write_entry(buf, static_cast<size_t>(n_read))) {
             m_error = ErrorCode::ArchiveWriteDataError;
-            mz_zip_entry_close(handle);
             return false;
         }
     }
@@ -350,12 +664,23 @@ bool OdinPatcher::process_file(archive *a, archive_entry *entry, bool sparse)
         LOGE("libarchive: Failed to read %s: %s",
              name, archive_error_string(a));
         m_error = ErrorCode::ArchiveReadDataError;
-        mz_zip_entry_close(handle);
         return false;
     }
 
+    if (deflater && !deflater->finish()) {
+        m_error = ErrorCode::ArchiveWriteDataError;
+        return false;
+    }
+
+    close_entry.dismiss();
+
     // Close file in output zip
-    mz_ret = mz_zip_entry_close(handle);
+    if (deflater) {
+        mz_ret = mz_zip_entry_close_raw(handle, deflater->uncompressed_size(),
+                                        deflater->crc());
+    } else {
+        mz_ret = mz_zip_entry_close(handle);
+    }
     if (mz_ret != MZ_OK) {
         LOGE("minizip: Failed to close file in output zip: %d", mz_ret);
         m_error = ErrorCode::ArchiveWriteDataError;
@@ -601,30 +926,12 @@ bool OdinPatcher::close_output_archive()
 
 void OdinPatcher::update_progress(uint64_t bytes, uint64_t max_bytes)
 {
-    if (m_progress_cb && *m_progress_cb) {
-        bool should_call = true;
-        if (max_bytes > 0) {
-            // Rate limit... call back only if percentage exceeds 0.01%
-            double old_ratio = static_cast<double>(m_old_bytes)
-                    / static_cast<double>(max_bytes);
-            double new_ratio = static_cast<double>(bytes)
-                    / static_cast<double>(max_bytes);
-            if (new_ratio - old_ratio < 0.0001) {
-                should_call = false;
-            }
-        }
-        if (should_call) {
-            (*m_progress_cb)(bytes, max_bytes);
-            m_old_bytes = bytes;
-        }
-    }
+    m_progress.update_bytes(bytes, max_bytes);
 }
 
 void OdinPatcher::update_details(const std::string &msg)
 {
-    if (m_details_cb && *m_details_cb) {
-        (*m_details_cb)(msg);
-    }
+    m_progress.update_details(msg);
 }
 
 la_ssize_t OdinPatcher::la_nested_read_cb(archive *a, void *userdata,
@@ -646,7 +953,7 @@ la_ssize_t OdinPatcher::la_read_cb(archive *a, void *userdata,
     auto *p = static_cast<OdinPatcher *>(userdata);
     *buffer = p->m_la_buf;
 
-    auto bytes_read = p->m_la_file.read(p->m_la_buf, sizeof(p->m_la_buf));
+    auto bytes_read = p->m_la_prefetch.read(p->m_la_buf, sizeof(p->m_la_buf));
     if (!bytes_read) {
         LOGE("%s: Failed to read: %s", p->m_info->input_path().c_str(),
              bytes_read.error().message().c_str());
@@ -665,7 +972,7 @@ la_int64_t OdinPatcher::la_skip_cb(archive *a, void *userdata,
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
 
-    auto seek_ret = p->m_la_file.seek(request, SEEK_CUR);
+    auto seek_ret = p->m_la_prefetch.seek(request, SEEK_CUR);
     if (!seek_ret) {
         LOGE("%s: Failed to seek: %s", p->m_info->input_path().c_str(),
              seek_ret.error().message().c_str());
@@ -711,6 +1018,17 @@ int OdinPatcher::la_open_cb(archive *a, void *userdata)
         return -1;
     }
 
+    // Read the input file on a separate thread so that reading overlaps with
+    // decompressing and parsing the archive
+    ret = p->m_la_prefetch.open(&p->m_la_file);
+    if (!ret) {
+        LOGE("%s: Failed to start prefetching: %s",
+             p->m_info->input_path().c_str(), ret.error().message().c_str());
+        p->m_error = ErrorCode::FileOpenError;
+        (void) p->m_la_file.close();
+        return -1;
+    }
+
     return 0;
 }
 
@@ -719,7 +1037,12 @@ int OdinPatcher::la_close_cb(archive *a, void *userdata)
     (void) a;
     auto *p = static_cast<OdinPatcher *>(userdata);
 
-    auto ret = p->m_la_file.close();
+    auto ret = p->m_la_prefetch.close();
+    if (ret) {
+        ret = p->m_la_file.close();
+    } else {
+        (void) p->m_la_file.close();
+    }
     if (!ret) {
         LOGE("%s: Failed to close: %s", p->m_info->input_path().c_str(),
              ret.error().message().c_str());
@@ -22,6 +22,8 @@
 #include <cassert>
 #include <cstring>
 
+#include <zlib.h>
+
 #include "mbdevice/device.h"
 #include "mbdevice/json.h"
 
@@ -30,6 +32,7 @@
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/patchers/zippatcher.h"
 #include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/payloadcache.h"
 
 #define LOG_TAG "mbpatcher/patchers/ramdiskupdater"
 
@@ -155,8 +158,15 @@ bool RamdiskUpdater::create_zip()
     for (const CopySpec &spec : toCopy) {
         if (m_cancelled) return false;
 
-        result = MinizipUtils::add_file_from_path(
-                handle, spec.target, spec.source);
+        // These are the same files that ZipPatcher adds, so they are only
+        // compressed once no matter how many zips are created
+        std::shared_ptr<const DeflatedPayload> payload;
+        result = m_pc.payload_cache().get(spec.source, Z_DEFAULT_COMPRESSION,
+                                          m_pc.compression_threads(), payload);
+        if (result == ErrorCode::NoError) {
+            result = MinizipUtils::add_deflated_file(
+                    handle, spec.target, spec.source, *payload);
+        }
         if (result != ErrorCode::NoError) {
             m_error = result;
             return false;
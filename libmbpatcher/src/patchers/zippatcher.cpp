@@ -20,16 +20,18 @@
 #include "mbpatcher/patchers/zippatcher.h"
 
 #include <algorithm>
+#include <chrono>
 #include <unordered_set>
 
 #include <cassert>
 #include <cstring>
 
+#include <zlib.h>
+
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
-#include "mbpio/delete.h"
 
 #include "mbpatcher/autopatchers/magiskpatcher.h"
 #include "mbpatcher/autopatchers/mountcmdpatcher.h"
@@ -37,6 +39,8 @@
 #include "mbpatcher/patcherconfig.h"
 #include "mbpatcher/private/fileutils.h"
 #include "mbpatcher/private/miniziputils.h"
+#include "mbpatcher/private/patchcache.h"
+#include "mbpatcher/private/payloadcache.h"
 
 // minizip
 #include "mz_zip.h"
@@ -49,6 +53,24 @@ namespace mb::patcher
 
 const std::string ZipPatcher::Id("ZipPatcher");
 
+static constexpr char INFO_PROP_PATH[] = "multiboot/info.prop";
+static constexpr char DEVICE_JSON_PATH[] = "multiboot/device.json";
+
+using Clock = std::chrono::steady_clock;
+
+/*!
+ * \brief Log how long a step of the patching process took
+ *
+ * The message format ("Timing: <step>: <ms> ms") is parsed by
+ * examples/patcher_bench.cpp.
+ */
+static void log_timing(const char *step, Clock::time_point start)
+{
+    auto ms = std::chrono::duration<double, std::milli>(
+            Clock::now() - start).count();
+    LOGD("Timing: %s: %.3f ms", step, ms);
+}
+
 
 ZipPatcher::ZipPatcher(PatcherConfig &pc)
     : m_pc(pc)
@@ -59,9 +81,7 @@ ZipPatcher::ZipPatcher(PatcherConfig &pc)
     , m_max_files(0)
     , m_cancelled(false)
     , m_error()
-    , m_progress_cb(nullptr)
-    , m_files_cb(nullptr)
-    , m_details_cb(nullptr)
+    , m_progress()
     , m_z_input(nullptr)
     , m_z_output(nullptr)
 {
@@ -97,20 +117,16 @@ bool ZipPatcher::patch_file(const ProgressUpdatedCallback &progress_cb,
 
     assert(m_info != nullptr);
 
-    m_progress_cb = &progress_cb;
-    m_files_cb = &files_cb;
-    m_details_cb = &details_cb;
+    m_progress.start(&progress_cb, &files_cb, &details_cb);
 
     m_bytes = 0;
     m_max_bytes = 0;
     m_files = 0;
     m_max_files = 0;
 
-    bool ret = patch_zip();
+    bool ret = patch_with_cache();
 
-    m_progress_cb = nullptr;
-    m_files_cb = nullptr;
-    m_details_cb = nullptr;
+    m_progress.finish();
 
     for (auto *p : m_auto_patchers) {
         m_pc.destroy_auto_patcher(p);
@@ -170,13 +186,22 @@ bool ZipPatcher::patch_zip()
 
     if (m_cancelled) return false;
 
+    if (!open_input_archive()) {
+        return false;
+    }
+
+    auto start = Clock::now();
+
+    // The central directory read here is reused by the first pass
     MinizipUtils::ArchiveStats stats;
-    auto result = MinizipUtils::archive_stats(m_info->input_path(), stats, {});
+    auto result = MinizipUtils::archive_stats(m_z_input, stats, {});
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
     }
 
+    log_timing("archive_stats", start);
+
     m_max_bytes = stats.total_size;
 
     if (m_cancelled) return false;
@@ -222,29 +247,30 @@ bool ZipPatcher::patch_zip()
     m_max_files = stats.files + to_copy.size() + 2;
     update_files(m_files, m_max_files);
 
-    if (!open_input_archive()) {
-        return false;
-    }
+    // Files for the autopatchers are kept in memory
+    AutoPatcher::Files files;
 
-    // Create temporary dir for extracted files for autopatchers
-    std::string temp_dir =
-            FileUtils::create_temporary_dir(m_pc.temp_directory());
+    start = Clock::now();
 
-    if (!pass1(temp_dir, exclude_from_pass1)) {
-        (void) io::delete_recursively(temp_dir);
+    if (!pass1(exclude_from_pass1, files)) {
         return false;
     }
 
+    log_timing("pass1", start);
+
     if (m_cancelled) return false;
 
     // On the second pass, run the autopatchers on the rest of the files
 
-    if (!pass2(temp_dir, exclude_from_pass1)) {
-        (void) io::delete_recursively(temp_dir);
+    start = Clock::now();
+
+    if (!pass2(files)) {
         return false;
     }
 
-    (void) io::delete_recursively(temp_dir);
+    log_timing("pass2", start);
+
+    start = Clock::now();
 
     for (const CopySpec &spec : to_copy) {
         if (m_cancelled) return false;
@@ -252,22 +278,44 @@ bool ZipPatcher::patch_zip()
         update_files(++m_files, m_max_files);
         update_details(spec.target);
 
-        result = MinizipUtils::add_file_from_path(
-                handle, spec.target, spec.source);
+        // These files are the same for every zip patched for a device, so
+        // they are only compressed once
+        std::shared_ptr<const DeflatedPayload> payload;
+        result = m_pc.payload_cache().get(spec.source, Z_DEFAULT_COMPRESSION,
+                                          m_pc.compression_threads(), payload);
+        if (result == ErrorCode::NoError) {
+            result = MinizipUtils::add_deflated_file(
+                    handle, spec.target, spec.source, *payload);
+        }
         if (result != ErrorCode::NoError) {
             m_error = result;
             return false;
         }
     }
 
+    log_timing("to_copy", start);
+
     if (m_cancelled) return false;
 
+    return add_target_files();
+}
+
+/*!
+ * \brief Add the files that depend on the ROM ID and device
+ *
+ * This adds `multiboot/info.prop` and `multiboot/device.json` to the output
+ * zip. These are the only files that differ between the outputs for different
+ * ROM IDs.
+ */
+bool ZipPatcher::add_target_files()
+{
+    void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
     update_files(++m_files, m_max_files);
-    update_details("multiboot/info.prop");
+    update_details(INFO_PROP_PATH);
 
-    result = MinizipUtils::add_file_from_data(
-            handle, "multiboot/info.prop",
-            create_info_prop(m_info->rom_id()));
+    auto result = MinizipUtils::add_file_from_data(
+            handle, INFO_PROP_PATH, create_info_prop(m_info->rom_id()));
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
@@ -276,7 +324,7 @@ bool ZipPatcher::patch_zip()
     if (m_cancelled) return false;
 
     update_files(++m_files, m_max_files);
-    update_details("multiboot/device.json");
+    update_details(DEVICE_JSON_PATH);
 
     std::string json;
     if (!device::device_to_json(m_info->device(), json)) {
@@ -284,8 +332,7 @@ bool ZipPatcher::patch_zip()
         return false;
     }
 
-    result = MinizipUtils::add_file_from_data(
-            handle, "multiboot/device.json", json);
+    result = MinizipUtils::add_file_from_data(handle, DEVICE_JSON_PATH, json);
     if (result != ErrorCode::NoError) {
         m_error = result;
         return false;
@@ -296,21 +343,199 @@ bool ZipPatcher::patch_zip()
     return true;
 }
 
+/*!
+ * \brief Patch the file, reusing a previously patched file if possible
+ *
+ * If the cache is enabled and has an entry for the same input file, device,
+ * and ROM ID, the cached file is linked to the output path. If there is only
+ * an entry for a different ROM ID, it is re-stamped with restamp(). Otherwise,
+ * the file is patched normally and the result is added to the cache.
+ */
+bool ZipPatcher::patch_with_cache()
+{
+    auto cache_dir = m_pc.cache_directory();
+    if (cache_dir.empty()) {
+        return patch_zip();
+    }
+
+    PatchCache cache(std::move(cache_dir));
+
+    update_details("Looking up patch cache");
+
+    if (cache.open(m_info->input_path(), Id, m_info->device())
+            != ErrorCode::NoError) {
+        LOGW("Failed to look up patch cache; patching without it");
+        return patch_zip();
+    }
+
+    if (m_cancelled) return false;
+
+    // The output may be a hard link to a cache entry from a previous run, so
+    // it must not be truncated in place
+    if (FileUtils::file_exists(m_info->output_path())
+            && !FileUtils::delete_file(m_info->output_path())) {
+        m_error = ErrorCode::FileOpenError;
+        return false;
+    }
+
+    if (auto path = cache.find(m_info->rom_id())) {
+        LOGD("Using cached output: %s", path->c_str());
+
+        update_files(1, 1);
+        update_details(m_info->output_path());
+
+        auto result = FileUtils::clone_file(*path, m_info->output_path());
+        if (result != ErrorCode::NoError) {
+            m_error = result;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool ret;
+
+    if (auto path = cache.find_restampable()) {
+        LOGD("Re-stamping cached output: %s", path->c_str());
+        ret = restamp(*path);
+    } else {
+        ret = patch_zip();
+    }
+
+    // The archives must be closed before the output can be added to the cache
+    if (m_z_input != nullptr) {
+        close_input_archive();
+    }
+    if (m_z_output != nullptr) {
+        close_output_archive();
+    }
+
+    if (ret && !m_cancelled && cache.store(m_info->output_path(),
+                                           m_info->rom_id())
+            != ErrorCode::NoError) {
+        LOGW("Failed to add output to patch cache");
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Create the output from a file patched for a different ROM ID
+ *
+ * Everything except for the files written by add_target_files() is copied
+ * from \p source without recompressing it.
+ *
+ * \param source Previously patched file
+ */
+bool ZipPatcher::restamp(const std::string &source)
+{
+    using namespace std::placeholders;
+
+    m_z_input = MinizipUtils::open_zip_file(source, ZipOpenMode::Read);
+    if (!m_z_input) {
+        LOGE("minizip: Failed to open for reading: %s", source.c_str());
+        m_error = ErrorCode::ArchiveReadOpenError;
+        return false;
+    }
+
+    if (!open_output_archive()) {
+        return false;
+    }
+
+    MinizipUtils::ArchiveStats stats;
+    auto result = MinizipUtils::archive_stats(
+            m_z_input, stats, { INFO_PROP_PATH, DEVICE_JSON_PATH });
+    if (result != ErrorCode::NoError) {
+        m_error = result;
+        return false;
+    }
+
+    m_max_bytes = stats.total_size;
+    // +2 for info.prop and device.json
+    m_max_files = stats.files + 2;
+    update_files(m_files, m_max_files);
+
+    void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
+
+    auto const *entries = MinizipUtils::entries(m_z_input);
+    if (!entries) {
+        m_error = ErrorCode::ArchiveReadHeaderError;
+        return false;
+    }
+
+    auto entry = entries->begin();
+
+    int ret = mz_zip_goto_first_entry(h_in);
+    if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
+        m_error = ErrorCode::ArchiveReadHeaderError;
+        return false;
+    }
+
+    if (ret != MZ_END_OF_LIST) {
+        do {
+            if (m_cancelled) return false;
+
+            if (entry == entries->end()) {
+                m_error = ErrorCode::ArchiveReadHeaderError;
+                return false;
+            }
+
+            auto const &cur_file = entry->name;
+            uint64_t uncompressed_size = entry->uncompressed_size;
+            ++entry;
+
+            if (cur_file == INFO_PROP_PATH || cur_file == DEVICE_JSON_PATH) {
+                continue;
+            }
+
+            update_files(++m_files, m_max_files);
+            update_details(cur_file);
+
+            if (!MinizipUtils::copy_file_raw(m_z_input, m_z_output, cur_file,
+                    std::bind(&ZipPatcher::la_progress_cb, this, _1))) {
+                LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
+                m_error = ErrorCode::ArchiveWriteDataError;
+                return false;
+            }
+
+            m_bytes += uncompressed_size;
+        } while ((ret = mz_zip_goto_next_entry(h_in)) == MZ_OK);
+
+        if (ret != MZ_END_OF_LIST) {
+            m_error = ErrorCode::ArchiveReadHeaderError;
+            return false;
+        }
+    }
+
+    if (m_cancelled) return false;
+
+    return add_target_files();
+}
+
 /*!
  * \brief First pass of patching operation
  *
  * This performs the following operations:
  *
- * - Files needed by an AutoPatcher are extracted to the temporary directory.
+ * - Files needed by an AutoPatcher are read into \p files.
  * - Otherwise, the file is copied directly to the output zip.
  */
-bool ZipPatcher::pass1(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &exclude)
+bool ZipPatcher::pass1(const std::unordered_set<std::string> &exclude,
+                       AutoPatcher::Files &files)
 {
     using namespace std::placeholders;
 
     void *h_in = MinizipUtils::ctx_get_zip_handle(m_z_input);
-    void *h_out = MinizipUtils::ctx_get_zip_handle(m_z_output);
+
+    auto const *entries = MinizipUtils::entries(m_z_input);
+    if (!entries) {
+        m_error = ErrorCode::ArchiveReadHeaderError;
+        return false;
+    }
+
+    // minizip still has to be positioned at each entry to read or copy it,
+    // but the names and sizes come from the cached central directory
+    auto entry = entries->begin();
 
     int ret = mz_zip_goto_first_entry(h_in);
     if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
@@ -322,22 +547,22 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
         do {
             if (m_cancelled) return false;
 
-            mz_zip_file *file_info;
-
-            ret = mz_zip_entry_get_info(h_in, &file_info);
-            if (ret != MZ_OK) {
+            if (entry == entries->end()) {
                 m_error = ErrorCode::ArchiveReadHeaderError;
                 return false;
             }
 
-            std::string cur_file{file_info->filename, file_info->filename_size};
+            std::string cur_file = entry->name;
+            uint64_t uncompressed_size = entry->uncompressed_size;
+            ++entry;
 
             update_files(++m_files, m_max_files);
             update_details(cur_file);
 
             // Skip files that should be patched and added in pass 2
             if (exclude.find(cur_file) != exclude.end()) {
-                if (!MinizipUtils::extract_file(h_in, temporary_dir)) {
+                if (!MinizipUtils::read_to_memory(
+                        h_in, files[cur_file], nullptr)) {
                     m_error = ErrorCode::ArchiveReadDataError;
                     return false;
                 }
@@ -349,14 +574,14 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
                 cur_file = "META-INF/com/google/android/update-binary.orig";
             }
 
-            if (!MinizipUtils::copy_file_raw(h_in, h_out, cur_file,
+            if (!MinizipUtils::copy_file_raw(m_z_input, m_z_output, cur_file,
                     std::bind(&ZipPatcher::la_progress_cb, this, _1))) {
                 LOGW("minizip: Failed to copy raw data: %s", cur_file.c_str());
                 m_error = ErrorCode::ArchiveWriteDataError;
                 return false;
             }
 
-            m_bytes += file_info->uncompressed_size;
+            m_bytes += uncompressed_size;
         } while ((ret = mz_zip_goto_next_entry(h_in)) == MZ_OK);
 
         if (ret != MZ_END_OF_LIST) {
@@ -375,17 +600,17 @@ bool ZipPatcher::pass1(const std::string &temporary_dir,
  *
  * This performs the following operations:
  *
- * - Patch files in the temporary directory using the AutoPatchers and add the
- *   resulting files to the output zip
+ * - Patch the files read during the first pass using the AutoPatchers and add
+ *   the resulting files to the output zip. This does not read the input zip
+ *   again.
  */
-bool ZipPatcher::pass2(const std::string &temporary_dir,
-                       const std::unordered_set<std::string> &files)
+bool ZipPatcher::pass2(AutoPatcher::Files &files)
 {
     void *handle = MinizipUtils::ctx_get_zip_handle(m_z_output);
 
     for (auto *ap : m_auto_patchers) {
         if (m_cancelled) return false;
-        if (!ap->patch_files(temporary_dir)) {
+        if (!ap->patch_files(files)) {
             m_error = ap->error();
             return false;
         }
@@ -393,26 +618,21 @@ bool ZipPatcher::pass2(const std::string &temporary_dir,
 
     // TODO Headers are being discarded
 
-    for (auto const &file : files) {
+    for (auto const &[file, contents] : files) {
         if (m_cancelled) return false;
 
         ErrorCode ret;
 
         if (file == "META-INF/com/google/android/update-binary") {
-            ret = MinizipUtils::add_file_from_path(
+            ret = MinizipUtils::add_file_from_data(
                     handle,
                     "META-INF/com/google/android/update-binary.orig",
-                    temporary_dir + "/" + file);
+                    contents);
         } else {
-            ret = MinizipUtils::add_file_from_path(
-                    handle,
-                    file,
-                    temporary_dir + "/" + file);
+            ret = MinizipUtils::add_file_from_data(handle, file, contents);
         }
 
-        if (ret == ErrorCode::FileOpenError) {
-            LOGW("File does not exist in temporary directory: %s", file.c_str());
-        } else if (ret != ErrorCode::NoError) {
+        if (ret != ErrorCode::NoError) {
             m_error = ret;
             return false;
         }
@@ -483,23 +703,17 @@ void ZipPatcher::close_output_archive()
 
 void ZipPatcher::update_progress(uint64_t bytes, uint64_t max_bytes)
 {
-    if (m_progress_cb && *m_progress_cb) {
-        (*m_progress_cb)(bytes, max_bytes);
-    }
+    m_progress.update_bytes(bytes, max_bytes);
 }
 
 void ZipPatcher::update_files(uint64_t files, uint64_t max_files)
 {
-    if (m_files_cb && *m_files_cb) {
-        (*m_files_cb)(files, max_files);
-    }
+    m_progress.update_files(files, max_files);
 }
 
 void ZipPatcher::update_details(const std::string &msg)
 {
-    if (m_details_cb && *m_details_cb) {
-        (*m_details_cb)(msg);
-    }
+    m_progress.update_details(msg);
 }
 
 void ZipPatcher::la_progress_cb(uint64_t bytes)
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/patchjobqueue.h"
+
+#include <algorithm>
+
+#include <cassert>
+
+#include "mbcommon/executor.h"
+
+#include "mbpatcher/patcherconfig.h"
+#include "mbpatcher/patchers/ramdiskupdater.h"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class PatchJobQueue
+ * \brief Patches many files on a shared pool of threads
+ *
+ * Jobs are run on at most max_threads() threads. Jobs that read and write
+ * entire archives (everything except RamdiskUpdater jobs) are limited to
+ * max_io_jobs() at a time so that their I/O does not thrash the disk. The
+ * remaining threads pick up the lightweight jobs in the meantime.
+ *
+ * The progress of all jobs is summed up and reported through the same
+ * callbacks that Patcher::patch_file() uses. The updates are coalesced by a
+ * ProgressReporter, so running more jobs does not increase the callback rate.
+ * The callbacks are never called concurrently.
+ *
+ * Use PatcherConfig::create_patch_job_queue() to create a queue.
+ */
+
+PatchJobQueue::PatchJobQueue(PatcherConfig &pc)
+    : m_pc(pc)
+    , m_cancelled(false)
+{
+}
+
+PatchJobQueue::~PatchJobQueue() = default;
+
+/*!
+ * \brief Add a job to the queue
+ *
+ * \note Jobs cannot be added while the queue is running.
+ *
+ * \param info FileInfo describing the file to patch
+ * \param patcher_id ID of the Patcher to use
+ *
+ * \return Index of the job
+ */
+std::size_t PatchJobQueue::add_job(const FileInfo &info,
+                                   std::string patcher_id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Job job;
+    job.info = info;
+    job.io_heavy = patcher_id != RamdiskUpdater::Id;
+    job.patcher_id = std::move(patcher_id);
+
+    m_jobs.push_back(std::move(job));
+    return m_jobs.size() - 1;
+}
+
+/*!
+ * \brief Get the number of jobs in the queue
+ */
+std::size_t PatchJobQueue::jobs() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size();
+}
+
+/*!
+ * \brief Get the maximum number of jobs that run concurrently
+ *
+ * The default is the concurrency of the global Executor, which the jobs run
+ * on.
+ *
+ * \return Maximum number of threads
+ */
+unsigned int PatchJobQueue::max_threads() const
+{
+    if (m_max_threads == 0) {
+        return Executor::global().concurrency();
+    } else {
+        return m_max_threads;
+    }
+}
+
+/*!
+ * \brief Set the maximum number of jobs that run concurrently
+ *
+ * \param threads Maximum number of threads or 0 to restore the default
+ */
+void PatchJobQueue::set_max_threads(unsigned int threads)
+{
+    m_max_threads = threads;
+}
+
+/*!
+ * \brief Get the maximum number of disk-heavy jobs that run concurrently
+ *
+ * \return Maximum number of disk-heavy jobs (default: 2)
+ */
+unsigned int PatchJobQueue::max_io_jobs() const
+{
+    return m_max_io_jobs;
+}
+
+/*!
+ * \brief Set the maximum number of disk-heavy jobs that run concurrently
+ *
+ * \param jobs Maximum number of disk-heavy jobs or 0 for no limit
+ */
+void PatchJobQueue::set_max_io_jobs(unsigned int jobs)
+{
+    m_max_io_jobs = jobs;
+}
+
+/*!
+ * \brief Run all jobs in the queue
+ *
+ * This function blocks until all of the jobs have finished or the queue has
+ * been cancelled. The callback parameters can be passed nullptr if they are
+ * not needed.
+ *
+ * \param progress_cb Callback for receiving the total progress of all jobs
+ * \param files_cb Callback for receiving the total files count of all jobs
+ * \param details_cb Callback for receiving detailed progress text
+ * \param finished_cb Callback for receiving the index and result of each job
+ *                    when it finishes
+ *
+ * \return Whether all of the jobs succeeded
+ */
+bool PatchJobQueue::run(const ProgressUpdatedCallback &progress_cb,
+                        const FilesUpdatedCallback &files_cb,
+                        const DetailsUpdatedCallback &details_cb,
+                        const JobFinishedCallback &finished_cb)
+{
+    m_cancelled = false;
+    m_running_io_jobs = 0;
+    m_bytes = 0;
+    m_max_bytes = 0;
+    m_files = 0;
+    m_max_files = 0;
+
+    // Patchers are created up front so that the job list does not change
+    // while the workers are running
+    for (std::size_t i = 0; i < m_jobs.size(); ++i) {
+        auto &job = m_jobs[i];
+
+        job.state = State::Pending;
+        job.error = ErrorCode::NoError;
+        job.bytes = 0;
+        job.max_bytes = 0;
+        job.files = 0;
+        job.max_files = 0;
+
+        job.patcher = m_pc.create_patcher(job.patcher_id);
+        if (!job.patcher) {
+            job.state = State::Failed;
+            job.error = ErrorCode::PatcherCreateError;
+
+            if (finished_cb) {
+                finished_cb(i, false);
+            }
+            continue;
+        }
+
+        job.patcher->set_file_info(&job.info);
+    }
+
+    m_progress.start(&progress_cb, &files_cb, &details_cb);
+
+    auto threads = std::min<std::size_t>(max_threads(), m_jobs.size());
+
+    TaskGroup group;
+
+    for (std::size_t i = 0; i < threads; ++i) {
+        group.run([&] {
+            worker(finished_cb);
+        });
+    }
+
+    group.wait();
+
+    {
+        std::lock_guard<std::mutex> cb_lock(m_cb_mutex);
+        m_progress.finish();
+    }
+
+    bool ret = true;
+
+    for (auto &job : m_jobs) {
+        if (job.patcher) {
+            m_pc.destroy_patcher(job.patcher);
+            job.patcher = nullptr;
+        }
+        if (job.state != State::Succeeded) {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+/*!
+ * \brief Cancel the running jobs and skip the pending ones
+ *
+ * This method is only useful if run() is being called on another thread.
+ */
+void PatchJobQueue::cancel()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_cancelled = true;
+
+    for (auto &job : m_jobs) {
+        if (job.state == State::Running) {
+            job.patcher->cancel_patching();
+        } else if (job.state == State::Pending) {
+            job.state = State::Failed;
+            job.error = ErrorCode::PatchingCancelled;
+        }
+    }
+
+    m_cv.notify_all();
+}
+
+/*!
+ * \brief Check whether a job succeeded during the last run()
+ *
+ * \param index Index of the job
+ */
+bool PatchJobQueue::job_succeeded(std::size_t index) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(index < m_jobs.size());
+    return m_jobs[index].state == State::Succeeded;
+}
+
+/*!
+ * \brief Get the error of a job that failed during the last run()
+ *
+ * \param index Index of the job
+ *
+ * \return ErrorCode of the job. The value is invalid if the job did not fail.
+ */
+ErrorCode PatchJobQueue::job_error(std::size_t index) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(index < m_jobs.size());
+    return m_jobs[index].error;
+}
+
+void PatchJobQueue::worker(const JobFinishedCallback &finished_cb)
+{
+    while (Job *job = next_job()) {
+        auto index = static_cast<std::size_t>(job - m_jobs.data());
+
+        bool ret = job->patcher->patch_file(
+            [&](uint64_t bytes, uint64_t max_bytes) {
+                // The patcher resets its cancellation flag when it starts, so
+                // make sure a cancellation that raced with it is not lost
+                if (m_cancelled) {
+                    job->patcher->cancel_patching();
+                }
+
+                std::lock_guard<std::mutex> cb_lock(m_cb_mutex);
+                uint64_t total;
+                uint64_t max_total;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_bytes = m_bytes - job->bytes + bytes;
+                    m_max_bytes = m_max_bytes - job->max_bytes + max_bytes;
+                    job->bytes = bytes;
+                    job->max_bytes = max_bytes;
+                    total = m_bytes;
+                    max_total = m_max_bytes;
+                }
+                m_progress.update_bytes(total, max_total);
+            },
+            [&](uint64_t files, uint64_t max_files) {
+                std::lock_guard<std::mutex> cb_lock(m_cb_mutex);
+                uint64_t total;
+                uint64_t max_total;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_files = m_files - job->files + files;
+                    m_max_files = m_max_files - job->max_files + max_files;
+                    job->files = files;
+                    job->max_files = max_files;
+                    total = m_files;
+                    max_total = m_max_files;
+                }
+                m_progress.update_files(total, max_total);
+            },
+            [&](const std::string &text) {
+                std::lock_guard<std::mutex> cb_lock(m_cb_mutex);
+                m_progress.update_details(text);
+            }
+        );
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            job->state = ret ? State::Succeeded : State::Failed;
+            job->error = ret ? ErrorCode::NoError : job->patcher->error();
+
+            if (job->io_heavy) {
+                --m_running_io_jobs;
+            }
+        }
+
+        // Another disk-heavy job may be able to start now
+        m_cv.notify_all();
+
+        if (finished_cb) {
+            std::lock_guard<std::mutex> cb_lock(m_cb_mutex);
+            finished_cb(index, ret);
+        }
+    }
+}
+
+/*!
+ * \brief Wait for the next job that is allowed to run
+ *
+ * \return Job that was marked as running or nullptr if there are no more jobs
+ *         to run
+ */
+PatchJobQueue::Job * PatchJobQueue::next_job()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true) {
+        if (m_cancelled) {
+            return nullptr;
+        }
+
+        bool have_pending = false;
+
+        for (auto &job : m_jobs) {
+            if (job.state != State::Pending) {
+                continue;
+            }
+
+            have_pending = true;
+
+            if (job.io_heavy && m_max_io_jobs != 0
+                    && m_running_io_jobs >= m_max_io_jobs) {
+                continue;
+            }
+
+            job.state = State::Running;
+            if (job.io_heavy) {
+                ++m_running_io_jobs;
+            }
+            return &job;
+        }
+
+        if (!have_pending) {
+            return nullptr;
+        }
+
+        m_cv.wait(lock);
+    }
+}
+
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/patchtask.h"
+
+#ifdef __linux__
+#  include <sys/eventfd.h>
+#  include <unistd.h>
+#endif
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class PatchTask
+ * \brief Runs Patcher::patch_file() in the background
+ *
+ * The patcher runs on the global Executor instead of on the caller's thread.
+ * Instead of calling the progress callbacks, the task keeps a snapshot of the
+ * latest progress, which is coalesced by a ProgressReporter, and signals fd()
+ * whenever the snapshot changes or the task finishes. Clients poll the file
+ * descriptor for readability and then call progress() and is_finished().
+ *
+ * On Linux, fd() is an eventfd. On other platforms, there is no file
+ * descriptor to poll and clients have to call progress() periodically or use
+ * wait().
+ *
+ * The Patcher must not be used for anything else until the task has finished.
+ *
+ * Use PatcherConfig::create_patch_task() to create a task.
+ */
+
+/*!
+ * \brief Construct task for a patcher
+ *
+ * The task does not start until start() is called.
+ *
+ * \param patcher Patcher with the FileInfo to patch already set
+ */
+PatchTask::PatchTask(Patcher &patcher)
+    : m_patcher(patcher)
+#ifdef __linux__
+    , m_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+#else
+    , m_fd(-1)
+#endif
+    , m_started(false)
+    , m_cancelled(false)
+    , m_finished(false)
+{
+    m_progress_cb = [this](uint64_t bytes, uint64_t max_bytes) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_update.bytes = bytes;
+            m_update.max_bytes = max_bytes;
+            m_update.changed |= ProgressUpdate::Bytes;
+        }
+        signal();
+    };
+    m_files_cb = [this](uint64_t files, uint64_t max_files) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_update.files = files;
+            m_update.max_files = max_files;
+            m_update.changed |= ProgressUpdate::Files;
+        }
+        signal();
+    };
+    m_details_cb = [this](const std::string &text) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_update.details = text;
+            m_update.changed |= ProgressUpdate::Details;
+        }
+        signal();
+    };
+}
+
+/*!
+ * \brief Wait for the task to finish and release the file descriptor
+ *
+ * Call cancel() first to avoid waiting for the whole patching process.
+ */
+PatchTask::~PatchTask()
+{
+    m_group.wait();
+
+#ifdef __linux__
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+#endif
+}
+
+/*!
+ * \brief Start patching in the background
+ *
+ * \return Whether the task was started. This fails if the task was already
+ *         started or if the eventfd could not be created.
+ */
+bool PatchTask::start()
+{
+#ifdef __linux__
+    if (m_fd < 0) {
+        return false;
+    }
+#endif
+
+    if (m_started.exchange(true)) {
+        return false;
+    }
+
+    m_reporter.start(&m_progress_cb, &m_files_cb, &m_details_cb);
+
+    m_group.run([this] {
+        run();
+    });
+
+    return true;
+}
+
+/*!
+ * \brief Cancel patching
+ *
+ * The task still signals fd() when it finishes. error() returns
+ * ErrorCode::PatchingCancelled if the patcher was stopped early.
+ */
+void PatchTask::cancel()
+{
+    m_cancelled = true;
+    m_patcher.cancel_patching();
+}
+
+/*!
+ * \brief Block until the task has finished
+ *
+ * \return Whether patching succeeded. Returns false if the task was never
+ *         started.
+ */
+bool PatchTask::wait()
+{
+    if (!m_started) {
+        return false;
+    }
+
+    m_group.wait();
+
+    return succeeded();
+}
+
+/*!
+ * \brief Get the file descriptor that signals progress and completion
+ *
+ * The file descriptor becomes readable when there is new progress or the task
+ * has finished. It is reset by progress(), so clients should not read from it
+ * themselves. It is owned by the task and must not be closed.
+ *
+ * \return File descriptor or -1 if the platform does not support it
+ */
+int PatchTask::fd() const
+{
+    return m_fd;
+}
+
+/*!
+ * \brief Get a snapshot of the latest progress
+ *
+ * The values of all fields are always the latest ones that were reported.
+ * ProgressUpdate::changed contains the fields that changed since the previous
+ * call to this function.
+ *
+ * \return Progress snapshot
+ */
+ProgressUpdate PatchTask::progress()
+{
+#ifdef __linux__
+    uint64_t value;
+    // Ignore EAGAIN. The snapshot is returned even if nothing changed.
+    (void) read(m_fd, &value, sizeof(value));
+#endif
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    ProgressUpdate update = m_update;
+    m_update.changed = 0;
+
+    return update;
+}
+
+/*!
+ * \brief Check whether the task has finished
+ *
+ * The final progress is available from progress() once this returns true.
+ */
+bool PatchTask::is_finished() const
+{
+    return m_finished;
+}
+
+/*!
+ * \brief Check whether patching succeeded
+ *
+ * \return Whether the task has finished successfully
+ */
+bool PatchTask::succeeded() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_succeeded;
+}
+
+/*!
+ * \brief Get the error if patching failed
+ *
+ * \return ErrorCode of the patcher. The value is invalid if the task has not
+ *         finished or did not fail.
+ */
+ErrorCode PatchTask::error() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+void PatchTask::run()
+{
+    bool ret = false;
+    ErrorCode error = ErrorCode::PatchingCancelled;
+
+    if (!m_cancelled) {
+        ret = m_patcher.patch_file(
+            [&](uint64_t bytes, uint64_t max_bytes) {
+                // The patcher resets its cancellation flag when it starts, so
+                // make sure a cancellation that raced with it is not lost
+                if (m_cancelled) {
+                    m_patcher.cancel_patching();
+                }
+
+                m_reporter.update_bytes(bytes, max_bytes);
+            },
+            [&](uint64_t files, uint64_t max_files) {
+                m_reporter.update_files(files, max_files);
+            },
+            [&](const std::string &text) {
+                m_reporter.update_details(text);
+            }
+        );
+
+        error = ret ? ErrorCode::NoError : m_patcher.error();
+    }
+
+    m_reporter.finish();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_succeeded = ret;
+        m_error = error;
+    }
+
+    m_finished = true;
+    signal();
+}
+
+void PatchTask::signal()
+{
+#ifdef __linux__
+    uint64_t value = 1;
+    // The counter only overflows after 2^64 - 2 updates without a read
+    (void) write(m_fd, &value, sizeof(value));
+#endif
+}
+
+}
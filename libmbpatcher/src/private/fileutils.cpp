@@ -25,6 +25,7 @@
 #include <cstring>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/locale.h"
 
 #include "mblog/logging.h"
@@ -32,11 +33,21 @@
 #ifdef _WIN32
 #  include <windows.h>
 #else
+#  include <fcntl.h>
 #  include <sys/stat.h>
+#  include <unistd.h>
+#  ifdef __linux__
+#    include <sys/ioctl.h>
+#  endif
 #endif
 
 #define LOG_TAG "mbpatcher/private/fileutils"
 
+// Older kernel headers do not have the generic clone ioctl
+#if defined(__linux__) && !defined(FICLONE)
+#  define FICLONE _IOW(0x94, 9, int)
+#endif
+
 
 namespace mb::patcher
 {
@@ -130,6 +141,194 @@ ErrorCode FileUtils::write_from_string(const std::string &path,
     return ErrorCode::NoError;
 }
 
+/*!
+ * \brief Check whether a path exists
+ *
+ * \param path Path to check
+ *
+ * \return Whether the path exists
+ */
+bool FileUtils::file_exists(const std::string &path)
+{
+#ifdef _WIN32
+    auto w_path = utf8_to_wcs(path);
+    return w_path
+            && GetFileAttributesW(w_path.value().c_str())
+                    != INVALID_FILE_ATTRIBUTES;
+#else
+    struct stat sb;
+    return stat(path.c_str(), &sb) == 0;
+#endif
+}
+
+/*!
+ * \brief Delete a file
+ *
+ * \param path Path to file
+ *
+ * \return Whether the file was deleted
+ */
+bool FileUtils::delete_file(const std::string &path)
+{
+#ifdef _WIN32
+    auto w_path = utf8_to_wcs(path);
+    if (!w_path) {
+        LOGE("%s: Failed to convert from UTF8 to WCS: %s",
+             path.c_str(), w_path.error().message().c_str());
+        return false;
+    }
+
+    if (!DeleteFileW(w_path.value().c_str())) {
+        LOGE("%s: Failed to delete file: %s",
+             path.c_str(), ec_from_win32().message().c_str());
+        return false;
+    }
+#else
+    if (unlink(path.c_str()) < 0) {
+        LOGE("%s: Failed to delete file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+#ifndef _WIN32
+static ErrorCode copy_file_contents(const std::string &source,
+                                    const std::string &target)
+{
+    StandardFile fin;
+    StandardFile fout;
+
+    auto ret = FileUtils::open_file(fin, source, FileOpenMode::ReadOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             source.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    ret = FileUtils::open_file(fout, target, FileOpenMode::WriteOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for writing: %s",
+             target.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    auto copied = file_copy(fin, fout, {});
+    if (!copied) {
+        LOGE("%s: Failed to copy to %s: %s", source.c_str(), target.c_str(),
+             copied.error().message().c_str());
+        return ErrorCode::FileWriteError;
+    }
+
+    ret = fout.close();
+    if (!ret) {
+        LOGE("%s: Failed to close file: %s",
+             target.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileCloseError;
+    }
+
+    return ErrorCode::NoError;
+}
+#endif
+
+/*!
+ * \brief Make \p target a copy of \p source as cheaply as possible
+ *
+ * The data is shared with a reflink if the filesystem supports it. Otherwise,
+ * a hard link is created and if that fails too (eg. because the files are on
+ * different filesystems), the data is copied. The copy is created next to
+ * \p target and then renamed over it, so \p target is never left partially
+ * written.
+ *
+ * \note If a hard link is created, then modifying one of the files in place
+ *       modifies the other as well.
+ *
+ * \param source Source path
+ * \param target Target path
+ *
+ * \return ErrorCode::NoError if successful or the error code if not
+ */
+ErrorCode FileUtils::clone_file(const std::string &source,
+                                const std::string &target)
+{
+    std::string temp = target + ".tmp";
+
+#ifdef _WIN32
+    auto w_source = utf8_to_wcs(source);
+    auto w_target = utf8_to_wcs(target);
+    auto w_temp = utf8_to_wcs(temp);
+    if (!w_source || !w_target || !w_temp) {
+        LOGE("%s: Failed to convert from UTF8 to WCS", target.c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    DeleteFileW(w_temp.value().c_str());
+
+    if (!CreateHardLinkW(w_temp.value().c_str(), w_source.value().c_str(),
+                         nullptr)
+            && !CopyFileW(w_source.value().c_str(), w_temp.value().c_str(),
+                          FALSE)) {
+        LOGE("%s: Failed to copy to %s: %s", source.c_str(), temp.c_str(),
+             ec_from_win32().message().c_str());
+        return ErrorCode::FileWriteError;
+    }
+
+    if (!MoveFileExW(w_temp.value().c_str(), w_target.value().c_str(),
+                     MOVEFILE_REPLACE_EXISTING)) {
+        LOGE("%s: Failed to rename to %s: %s", temp.c_str(), target.c_str(),
+             ec_from_win32().message().c_str());
+        DeleteFileW(w_temp.value().c_str());
+        return ErrorCode::FileWriteError;
+    }
+#else
+    unlink(temp.c_str());
+
+    bool done = false;
+
+#ifdef __linux__
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source >= 0) {
+        int fd_temp = open(temp.c_str(),
+                           O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_temp >= 0) {
+            done = ioctl(fd_temp, FICLONE, fd_source) == 0;
+            close(fd_temp);
+
+            if (!done) {
+                unlink(temp.c_str());
+            }
+        }
+        close(fd_source);
+    }
+#endif
+
+    if (!done) {
+        done = link(source.c_str(), temp.c_str()) == 0;
+    }
+
+    if (!done) {
+        auto ret = copy_file_contents(source, temp);
+        if (ret != ErrorCode::NoError) {
+            unlink(temp.c_str());
+            return ret;
+        }
+    }
+
+    if (rename(temp.c_str(), target.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s", temp.c_str(), target.c_str(),
+             strerror(errno));
+        unlink(temp.c_str());
+        return ErrorCode::FileWriteError;
+    }
+
+    // rename() does nothing if both paths are links to the same file
+    unlink(temp.c_str());
+#endif
+
+    return ErrorCode::NoError;
+}
+
 #ifdef _WIN32
 static bool directory_exists(const wchar_t *path)
 {
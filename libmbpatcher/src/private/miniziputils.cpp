@@ -20,9 +20,11 @@
 #include "mbpatcher/private/miniziputils.h"
 
 #include <algorithm>
+#include <optional>
 
 #include <cassert>
 #include <cerrno>
+#include <cinttypes>
 #include <cstdint>
 #include <cstring>
 
@@ -30,16 +32,15 @@
 #include <time.h>
 #endif
 
+#include "mbcommon/endian.h"
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/locale.h"
 
 #include "mblog/logging.h"
 
-#include "mbpio/directory.h"
-#include "mbpio/path.h"
-
 #include "mz_os.h"
 #include "mz_strm_buf.h"
 #if defined(_WIN32)
@@ -58,6 +59,13 @@
 
 #define LOG_TAG "mbpatcher/private/miniziputils"
 
+// Size of the buffer used for copying raw entry data
+static constexpr size_t RAW_COPY_BUF_SIZE = 1024 * 1024;
+
+// Local file header signature and fixed size
+static constexpr uint32_t LOCAL_HEADER_MAGIC = 0x04034b50;
+static constexpr size_t LOCAL_HEADER_SIZE = 30;
+
 
 namespace mb::patcher
 {
@@ -67,6 +75,16 @@ struct ZipCtx
     void *stream;
     void *buf_stream;
     void *handle;
+
+    std::string path;
+    // Separate file handle for positional reads of raw entry data. This is
+    // opened on demand and never shares its file position with minizip's
+    // buffered stream.
+    StandardFile raw_file;
+    std::vector<unsigned char> raw_buf;
+
+    // Cached central directory
+    std::optional<std::vector<MinizipUtils::Entry>> entries;
 };
 
 void * MinizipUtils::ctx_get_zip_handle(ZipCtx *ctx)
@@ -140,6 +158,8 @@ ZipCtx * MinizipUtils::open_zip_file(std::string path, ZipOpenMode mode)
         return nullptr;
     }
 
+    ctx->path = std::move(path);
+
     close_stream.dismiss();
     destroy_buf_stream.dismiss();
     destroy_stream.dismiss();
@@ -158,28 +178,31 @@ int MinizipUtils::close_zip_file(ZipCtx *ctx)
     return ret;
 }
 
-ErrorCode MinizipUtils::archive_stats(const std::string &path,
-                                      MinizipUtils::ArchiveStats &stats,
-                                      const std::vector<std::string> &ignore)
+/*!
+ * \brief Get the central directory entries of a zip opened for reading
+ *
+ * The central directory is walked only once and the result is cached in
+ * \p ctx, so this can be called for stats, progress totals, and while copying
+ * without rescanning the archive.
+ *
+ * \note This moves the current entry of the zip handle.
+ *
+ * \return Pointer to the list of entries (owned by \p ctx) or nullptr if the
+ *         central directory could not be read
+ */
+const std::vector<MinizipUtils::Entry> * MinizipUtils::entries(ZipCtx *ctx)
 {
-    ZipCtx *ctx = open_zip_file(path, ZipOpenMode::Read);
-    if (!ctx) {
-        LOGE("minizip: Failed to open for reading: %s", path.c_str());
-        return ErrorCode::ArchiveReadOpenError;
+    if (ctx->entries) {
+        return &*ctx->entries;
     }
 
-    auto close_ctx = finally([&] {
-        close_zip_file(ctx);
-    });
-
-    uint64_t count = 0;
-    uint64_t total_size = 0;
+    std::vector<Entry> entries;
     mz_zip_file *file_info;
 
     int ret = mz_zip_goto_first_entry(ctx->handle);
     if (ret != MZ_OK && ret != MZ_END_OF_LIST) {
         LOGE("minizip: Failed to move to first file: %d", ret);
-        return ErrorCode::ArchiveReadHeaderError;
+        return nullptr;
     }
 
     if (ret != MZ_END_OF_LIST) {
@@ -187,19 +210,44 @@ ErrorCode MinizipUtils::archive_stats(const std::string &path,
             ret = mz_zip_entry_get_info(ctx->handle, &file_info);
             if (ret != MZ_OK) {
                 LOGE("minizip: Failed to get inner file metadata: %d", ret);
-                return ErrorCode::ArchiveReadHeaderError;
+                return nullptr;
             }
 
-            std::string filename{file_info->filename, file_info->filename_size};
-            if (std::find(ignore.begin(), ignore.end(), filename) == ignore.end()) {
-                ++count;
-                total_size += file_info->uncompressed_size;
-            }
+            entries.push_back({
+                {file_info->filename, file_info->filename_size},
+                file_info->disk_offset,
+                file_info->compressed_size,
+                file_info->uncompressed_size,
+                file_info->compression_method,
+            });
         } while ((ret = mz_zip_goto_next_entry(ctx->handle)) == MZ_OK);
 
         if (ret != MZ_END_OF_LIST) {
             LOGE("minizip: Finished before EOF: %d", ret);
-            return ErrorCode::ArchiveReadHeaderError;
+            return nullptr;
+        }
+    }
+
+    ctx->entries = std::move(entries);
+    return &*ctx->entries;
+}
+
+ErrorCode MinizipUtils::archive_stats(ZipCtx *ctx,
+                                      MinizipUtils::ArchiveStats &stats,
+                                      const std::vector<std::string> &ignore)
+{
+    auto const *list = entries(ctx);
+    if (!list) {
+        return ErrorCode::ArchiveReadHeaderError;
+    }
+
+    uint64_t count = 0;
+    uint64_t total_size = 0;
+
+    for (auto const &entry : *list) {
+        if (std::find(ignore.begin(), ignore.end(), entry.name) == ignore.end()) {
+            ++count;
+            total_size += entry.uncompressed_size;
         }
     }
 
@@ -209,54 +257,138 @@ ErrorCode MinizipUtils::archive_stats(const std::string &path,
     return ErrorCode::NoError;
 }
 
-bool MinizipUtils::copy_file_raw(void *source_handle,
-                                 void *target_handle,
+/*!
+ * \brief Find the compressed data of the current entry in the input zip
+ *
+ * The local header offset comes from the central directory record. Only the
+ * fixed part of the local header is read to determine where the data begins
+ * since the local filename and extra field lengths may differ from those in
+ * the central directory.
+ */
+static bool find_raw_data(ZipCtx *ctx, const mz_zip_file *file_info,
+                          uint64_t &offset_out)
+{
+    if (!ctx->raw_file.is_open()) {
+        auto open_ret = FileUtils::open_file(ctx->raw_file, ctx->path,
+                                             FileOpenMode::ReadOnly);
+        if (!open_ret) {
+            LOGE("%s: Failed to open for reading: %s",
+                 ctx->path.c_str(), open_ret.error().message().c_str());
+            return false;
+        }
+    }
+
+    unsigned char header[LOCAL_HEADER_SIZE];
+
+    auto read_ret = file_read_exact_at(ctx->raw_file, file_info->disk_offset,
+                                       header, sizeof(header));
+    if (!read_ret) {
+        LOGE("%s: Failed to read local header at %" PRIu64 ": %s",
+             ctx->path.c_str(), file_info->disk_offset,
+             read_ret.error().message().c_str());
+        return false;
+    }
+
+    uint32_t magic;
+    uint16_t filename_size;
+    uint16_t extrafield_size;
+
+    memcpy(&magic, header, sizeof(magic));
+    memcpy(&filename_size, header + 26, sizeof(filename_size));
+    memcpy(&extrafield_size, header + 28, sizeof(extrafield_size));
+
+    if (mb_le32toh(magic) != LOCAL_HEADER_MAGIC) {
+        LOGE("%s: Invalid local header at %" PRIu64,
+             ctx->path.c_str(), file_info->disk_offset);
+        return false;
+    }
+
+    offset_out = file_info->disk_offset + LOCAL_HEADER_SIZE
+            + mb_le16toh(filename_size) + mb_le16toh(extrafield_size);
+    return true;
+}
+
+/*!
+ * \brief Copy the current entry of the input zip to the output zip as-is
+ *
+ * The compressed data range is located using the input's central directory
+ * and read with large positional reads from a separate file handle instead of
+ * going through minizip's raw entry reader, which is limited to UINT16_MAX
+ * bytes per call. The data is then passed to the output zip's raw entry
+ * writer so that minizip still writes the local header and the matching
+ * central directory record.
+ */
+bool MinizipUtils::copy_file_raw(ZipCtx *source,
+                                 ZipCtx *target,
                                  const std::string &name,
                                  const std::function<void(uint64_t bytes)> &cb)
 {
     mz_zip_file *file_info;
 
-    int ret = mz_zip_entry_get_info(source_handle, &file_info);
+    int ret = mz_zip_entry_get_info(source->handle, &file_info);
     if (ret != MZ_OK) {
         LOGE("minizip: Failed to get inner file metadata: %d", ret);
         return false;
     }
 
-    // Open raw file in input zip
-    ret = mz_zip_entry_read_open(source_handle, 1, nullptr);
-    if (ret != MZ_OK) {
-        LOGE("minizip: Failed to open inner file: %d", ret);
+    uint64_t offset;
+    if (!find_raw_data(source, file_info, offset)) {
         return false;
     }
 
-    auto close_inner_read = finally([&] {
-        mz_zip_entry_close(source_handle);
-    });
-
     mz_zip_file target_file_info = *file_info;
     target_file_info.filename = name.c_str();
     target_file_info.filename_size = static_cast<uint16_t>(name.size());
 
     // Open raw file in output zip
-    ret = mz_zip_entry_write_open(target_handle, &target_file_info, 0, nullptr);
+    ret = mz_zip_entry_write_open(target->handle, &target_file_info, 0,
+                                  nullptr);
     if (ret != MZ_OK) {
         LOGE("minizip: Failed to open inner file: %d", ret);
         return false;
     }
 
     auto close_inner_write = finally([&] {
-        mz_zip_entry_close(target_handle);
+        mz_zip_entry_close(target->handle);
     });
 
-    uint64_t bytes = 0;
+    source->raw_buf.resize(RAW_COPY_BUF_SIZE);
 
-    // minizip no longer supports buffers larger than UINT16_MAX
-    char buf[UINT16_MAX];
-    int n_read;
+    uint64_t remaining = file_info->compressed_size;
+    uint64_t bytes = 0;
     double ratio;
 
-    while ((n_read = mz_zip_entry_read(source_handle, buf, sizeof(buf))) > 0) {
-        bytes += static_cast<uint64_t>(n_read);
+    while (remaining > 0) {
+        auto to_read = static_cast<size_t>(
+                std::min<uint64_t>(remaining, source->raw_buf.size()));
+
+        auto read_ret = file_read_exact_at(source->raw_file, offset + bytes,
+                                           source->raw_buf.data(), to_read);
+        if (!read_ret) {
+            LOGE("%s: Failed to read inner file: %s",
+                 source->path.c_str(), read_ret.error().message().c_str());
+            return false;
+        }
+
+        // minizip no longer supports buffers larger than UINT16_MAX
+        for (size_t pos = 0; pos < to_read;) {
+            auto chunk = static_cast<int32_t>(
+                    std::min<size_t>(to_read - pos, UINT16_MAX));
+
+            int n_written = mz_zip_entry_write(
+                    target->handle, source->raw_buf.data() + pos,
+                    static_cast<uint32_t>(chunk));
+            if (n_written != chunk) {
+                LOGE("minizip: Failed to write data to inner file");
+                return false;
+            }
+
+            pos += static_cast<size_t>(chunk);
+        }
+
+        bytes += to_read;
+        remaining -= to_read;
+
         if (cb) {
             // Scale this to the uncompressed size for the purposes of a
             // progress bar
@@ -265,30 +397,11 @@ bool MinizipUtils::copy_file_raw(void *source_handle,
             cb(static_cast<uint64_t>(
                     ratio * static_cast<double>(file_info->uncompressed_size)));
         }
-
-        int n_written = mz_zip_entry_write(
-                target_handle, buf, static_cast<uint32_t>(n_read));
-        if (n_written != n_read) {
-            LOGE("minizip: Failed to write data to inner file");
-            return false;
-        }
-    }
-    if (n_read != 0) {
-        LOGE("minizip: Failed to read inner file");
-        return false;
-    }
-
-    close_inner_read.dismiss();
-
-    ret = mz_zip_entry_close(source_handle);
-    if (ret != MZ_OK) {
-        LOGE("minizip: Failed to close inner file: %d", ret);
-        return false;
     }
 
     close_inner_write.dismiss();
 
-    ret = mz_zip_entry_close_raw(target_handle, file_info->uncompressed_size,
+    ret = mz_zip_entry_close_raw(target->handle, file_info->uncompressed_size,
                                  file_info->crc);
     if (ret != MZ_OK) {
         LOGE("minizip: Failed to close inner file: %d", ret);
@@ -349,84 +462,6 @@ bool MinizipUtils::read_to_memory(void *handle, std::string &output,
     return true;
 }
 
-bool MinizipUtils::extract_file(void *handle, const std::string &directory)
-{
-    mz_zip_file *file_info;
-
-    int ret = mz_zip_entry_get_info(handle, &file_info);
-    if (ret != MZ_OK) {
-        LOGE("minizip: Failed to get inner file metadata: %d", ret);
-        return false;
-    }
-
-    std::string full_path(directory);
-#ifdef _WIN32
-    full_path += "\\";
-#else
-    full_path += "/";
-#endif
-    full_path += std::string{file_info->filename, file_info->filename_size};
-
-    std::string parent_path = io::dir_name(full_path);
-    if (auto r = io::create_directories(parent_path); !r) {
-        LOGW("%s: Failed to create directory: %s",
-             parent_path.c_str(), r.error().message().c_str());
-    }
-
-    StandardFile file;
-
-    auto open_ret = FileUtils::open_file(file, full_path,
-                                         FileOpenMode::WriteOnly);
-    if (!open_ret) {
-        LOGE("%s: Failed to open for writing: %s",
-             full_path.c_str(), open_ret.error().message().c_str());
-        return false;
-    }
-
-    ret = mz_zip_entry_read_open(handle, 0, nullptr);
-    if (ret != MZ_OK) {
-        LOGE("minizip: Failed to open inner file: %d", ret);
-        return false;
-    }
-
-    auto close_inner_read = finally([&] {
-        mz_zip_entry_close(handle);
-    });
-
-    int n;
-    char buf[UINT16_MAX];
-
-    while ((n = mz_zip_entry_read(handle, buf, sizeof(buf))) > 0) {
-        auto bytes_written = file.write(buf, static_cast<size_t>(n));
-        if (!bytes_written) {
-            LOGE("%s: Failed to write file: %s",
-                 full_path.c_str(), bytes_written.error().message().c_str());
-            return false;
-        }
-    }
-    if (n != 0) {
-        LOGE("minizip: Failed to read inner file");
-        return false;
-    }
-
-    close_inner_read.dismiss();
-
-    ret = mz_zip_entry_close(handle);
-    if (ret != MZ_OK) {
-        LOGE("minizip: Failed to close inner file: %d", ret);
-        return false;
-    }
-
-    auto close_ret = file.close();
-    if (!close_ret) {
-        LOGE("%s: Failed to close file: %s",
-             full_path.c_str(), close_ret.error().message().c_str());
-        return false;
-    }
-
-    return n == 0;
-}
-
 ErrorCode MinizipUtils::add_file_from_data(void *handle,
                                            const std::string &name,
                                            const std::string &data)
@@ -537,4 +572,67 @@ ErrorCode MinizipUtils::add_file_from_path(void *handle,
     return ErrorCode::NoError;
 }
 
+/*!
+ * \brief Add a file that has already been compressed
+ *
+ * The entry is written in raw mode, so \p payload is copied as is. The
+ * modification time is taken from \p path.
+ */
+ErrorCode MinizipUtils::add_deflated_file(void *handle,
+                                          const std::string &name,
+                                          const std::string &path,
+                                          const DeflatedPayload &payload)
+{
+    mz_zip_file file_info = {};
+    file_info.compression_method = MZ_COMPRESS_METHOD_DEFLATE;
+    file_info.filename = name.c_str();
+    file_info.filename_size = static_cast<uint16_t>(name.size());
+
+    int ret = mz_os_get_file_date(path.c_str(), &file_info.modified_date,
+                                  &file_info.accessed_date,
+                                  &file_info.creation_date);
+    if (ret != MZ_OK) {
+        LOGE("%s: Failed to get modification time: %d", path.c_str(), ret);
+        return ErrorCode::FileOpenError;
+    }
+
+    // Open raw file in output zip
+    ret = mz_zip_entry_write_open(handle, &file_info, 0, nullptr);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to open inner file: %d", ret);
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    auto close_inner_write = finally([&] {
+        mz_zip_entry_close(handle);
+    });
+
+    // minizip no longer supports buffers larger than UINT16_MAX
+    for (size_t pos = 0; pos < payload.data.size();) {
+        auto chunk = static_cast<int32_t>(
+                std::min<size_t>(payload.data.size() - pos, UINT16_MAX));
+
+        int n_written = mz_zip_entry_write(
+                handle, payload.data.data() + pos,
+                static_cast<uint32_t>(chunk));
+        if (n_written != chunk) {
+            LOGE("minizip: Failed to write inner file data");
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        pos += static_cast<size_t>(chunk);
+    }
+
+    close_inner_write.dismiss();
+
+    ret = mz_zip_entry_close_raw(handle, payload.uncompressed_size,
+                                 payload.crc);
+    if (ret != MZ_OK) {
+        LOGE("minizip: Failed to close inner file: %d", ret);
+        return ErrorCode::ArchiveWriteDataError;
+    }
+
+    return ErrorCode::NoError;
+}
+
 }
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/paralleldeflate.h"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "mbcommon/resource_budget.h"
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbpatcher/private/paralleldeflate"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \brief Construct a parallel deflater
+ *
+ * \param threads Number of blocks to compress concurrently. Twice as many
+ *                blocks are kept in memory, unless they do not fit in the
+ *                ResourceBudget.
+ * \param level zlib compression level
+ * \param cb Callback for writing the compressed data
+ */
+ParallelDeflater::ParallelDeflater(unsigned int threads, int level,
+                                   OutputCallback cb)
+    : m_level(level)
+    , m_cb(std::move(cb))
+    , m_pending(0)
+    , m_max_blocks(ResourceBudget::global().buffer_count(
+            2 * BLOCK_SIZE, std::max(threads, 1u) * 2))
+    , m_stop(false)
+    , m_failed(false)
+    , m_crc(static_cast<uint32_t>(crc32(0, nullptr, 0)))
+    , m_size(0)
+{
+    m_input.reserve(BLOCK_SIZE);
+
+    m_writer_thread = std::thread(&ParallelDeflater::writer, this);
+}
+
+ParallelDeflater::~ParallelDeflater()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_submit_cv.notify_all();
+
+    // Destroying the remaining blocks waits for their tasks
+    m_writer_thread.join();
+}
+
+/*!
+ * \brief Compress data
+ *
+ * \return Whether all previously completed blocks were compressed and written
+ *         successfully
+ */
+bool ParallelDeflater::write(const void *buf, size_t size)
+{
+    auto data = static_cast<const unsigned char *>(buf);
+
+    while (size > 0) {
+        size_t n = std::min(size, BLOCK_SIZE - m_input.size());
+        m_input.insert(m_input.end(), data, data + n);
+        data += n;
+        size -= n;
+
+        if (m_input.size() == BLOCK_SIZE && !submit(false)) {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_failed;
+}
+
+/*!
+ * \brief Compress remaining data and terminate the deflate stream
+ *
+ * This waits for all blocks to be compressed and written.
+ *
+ * \return Whether the entire stream was compressed and written successfully
+ */
+bool ParallelDeflater::finish()
+{
+    if (!submit(true)) {
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space_cv.wait(lock, [&] { return m_failed || m_pending == 0; });
+    return !m_failed;
+}
+
+/*!
+ * \brief CRC32 of the uncompressed data passed to write()
+ *
+ * \note This is only valid after finish() returns successfully.
+ */
+uint32_t ParallelDeflater::crc() const
+{
+    return m_crc;
+}
+
+/*!
+ * \brief Size of the uncompressed data passed to write()
+ *
+ * \note This is only valid after finish() returns successfully.
+ */
+uint64_t ParallelDeflater::uncompressed_size() const
+{
+    return m_size;
+}
+
+bool ParallelDeflater::submit(bool last)
+{
+    auto block = std::make_shared<Block>();
+    block->dict = std::move(m_dict);
+    block->input = std::move(m_input);
+    block->crc = 0;
+    block->last = last;
+    block->ok = false;
+
+    // The next block is primed with the end of this block
+    size_t dict_size = std::min(block->input.size(), DICT_SIZE);
+    m_dict.assign(block->input.end() - static_cast<ptrdiff_t>(dict_size),
+                  block->input.end());
+
+    m_input.clear();
+    m_input.reserve(BLOCK_SIZE);
+
+    {
+        // Bound memory usage by waiting for the writer to catch up
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_space_cv.wait(lock, [&] {
+            return m_failed || m_pending < m_max_blocks;
+        });
+        if (m_failed) {
+            return false;
+        }
+
+        ++m_pending;
+    }
+
+    // The task must be submitted before the writer can wait for it
+    Block *ptr = block.get();
+    int level = m_level;
+
+    ptr->group.run([ptr, level] {
+        ptr->ok = compress(*ptr, level);
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_blocks.push_back(std::move(block));
+    }
+    m_submit_cv.notify_all();
+
+    return true;
+}
+
+void ParallelDeflater::writer()
+{
+    while (true) {
+        std::shared_ptr<Block> block;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_submit_cv.wait(lock, [&] {
+                return m_stop || !m_blocks.empty();
+            });
+            if (m_stop) {
+                return;
+            }
+            block = std::move(m_blocks.front());
+            m_blocks.pop_front();
+        }
+
+        // Compresses the block on this thread if no worker has picked it up
+        block->group.wait();
+
+        bool ok = block->ok;
+        if (!ok) {
+            LOGE("Failed to compress block");
+        } else {
+            m_crc = static_cast<uint32_t>(crc32_combine(
+                    m_crc, block->crc,
+                    static_cast<z_off_t>(block->input.size())));
+            m_size += block->input.size();
+
+            ok = m_cb(block->output.data(), block->output.size());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!ok) {
+                m_failed = true;
+            }
+            --m_pending;
+        }
+        m_space_cv.notify_all();
+    }
+}
+
+bool ParallelDeflater::compress(Block &block, int level)
+{
+    block.crc = static_cast<uint32_t>(crc32(
+            crc32(0, nullptr, 0), block.input.data(),
+            static_cast<uInt>(block.input.size())));
+
+    z_stream strm = {};
+
+    if (deflateInit2(&strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY)
+            != Z_OK) {
+        return false;
+    }
+
+    if (!block.dict.empty() && deflateSetDictionary(
+            &strm, block.dict.data(), static_cast<uInt>(block.dict.size()))
+            != Z_OK) {
+        deflateEnd(&strm);
+        return false;
+    }
+
+    // Leave room for the sync flush marker and the final block
+    block.output.resize(deflateBound(&strm, static_cast<uLong>(
+            block.input.size())) + 16);
+
+    strm.next_in = block.input.data();
+    strm.avail_in = static_cast<uInt>(block.input.size());
+    strm.next_out = block.output.data();
+    strm.avail_out = static_cast<uInt>(block.output.size());
+
+    // Non-final blocks end on a byte boundary so that they can be concatenated
+    int ret = deflate(&strm, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = block.last ? ret == Z_STREAM_END
+            : ret == Z_OK && strm.avail_in == 0 && strm.avail_out > 0;
+
+    block.output.resize(block.output.size() - strm.avail_out);
+    deflateEnd(&strm);
+
+    return ok;
+}
+
+}
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/patchcache.h"
+
+#include <vector>
+
+#include "mbcommon/file/hashing.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/version.h"
+#include "mbdevice/json.h"
+#include "mblog/logging.h"
+#include "mbpio/directory.h"
+
+#include "mbpatcher/private/fileutils.h"
+
+#define LOG_TAG "mbpatcher/private/patchcache"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class PatchCache
+ * \brief Cache of previously patched files
+ *
+ * Entries are keyed on the SHA-256 digest of the input file, the device
+ * definition, the patcher ID, and the libmbpatcher version. Each key has its
+ * own directory with one output file per ROM ID:
+ *
+ *     <cache>/<key>/<hex-encoded ROM ID>.zip
+ *     <cache>/<key>/latest.zip
+ *
+ * `latest.zip` is the most recently stored output for the key. A patcher can
+ * turn it into the output for another ROM ID by replacing the few files that
+ * depend on the ROM ID instead of patching the input again.
+ */
+
+static std::string to_hex(const void *data, size_t size)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+
+    auto const *ptr = static_cast<const unsigned char *>(data);
+    std::string result;
+    result.reserve(size * 2);
+
+    for (size_t i = 0; i < size; ++i) {
+        result += digits[(ptr[i] >> 4) & 0xf];
+        result += digits[ptr[i] & 0xf];
+    }
+
+    return result;
+}
+
+static oc::result<std::string> hash_file(File &file)
+{
+    HashingFile hasher;
+    OUTCOME_TRYV(hasher.open(&file, HashAlgorithm::Sha256));
+
+    std::vector<unsigned char> buf(1024 * 1024);
+
+    while (true) {
+        OUTCOME_TRY(n, hasher.read(buf.data(), buf.size()));
+        if (n == 0) {
+            break;
+        }
+    }
+
+    OUTCOME_TRY(digest, hasher.digest(HashAlgorithm::Sha256));
+    OUTCOME_TRYV(hasher.close());
+
+    return to_hex(digest.data(), digest.size());
+}
+
+PatchCache::PatchCache(std::string directory)
+    : m_directory(std::move(directory))
+{
+}
+
+/*!
+ * \brief Compute the cache key for a file
+ *
+ * \note This reads the entire input file.
+ *
+ * \param input_path Path to the file to patch
+ * \param patcher_id ID of the patcher
+ * \param device Target device
+ *
+ * \return ErrorCode::NoError if successful or the error code if not
+ */
+ErrorCode PatchCache::open(const std::string &input_path,
+                           const std::string &patcher_id,
+                           const device::Device &device)
+{
+    m_entry_dir.clear();
+
+    StandardFile file;
+
+    auto ret = FileUtils::open_file(file, input_path, FileOpenMode::ReadOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             input_path.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    auto input_hash = hash_file(file);
+    if (!input_hash) {
+        LOGE("%s: Failed to hash file: %s",
+             input_path.c_str(), input_hash.error().message().c_str());
+        return ErrorCode::FileReadError;
+    }
+
+    std::string json;
+    if (!device::device_to_json(device, json)) {
+        return ErrorCode::MemoryAllocationError;
+    }
+
+    std::string material;
+    material += input_hash.value();
+    material += '\n';
+    material += patcher_id;
+    material += '\n';
+    material += git_version();
+    material += '\n';
+    material += json;
+
+    MemoryFile material_file(material.data(), material.size());
+
+    auto key = hash_file(material_file);
+    if (!key) {
+        LOGE("Failed to compute cache key: %s",
+             key.error().message().c_str());
+        return ErrorCode::FileReadError;
+    }
+
+    m_entry_dir = m_directory;
+    m_entry_dir += '/';
+    m_entry_dir += key.value();
+
+    return ErrorCode::NoError;
+}
+
+/*!
+ * \brief Find the cached output for a ROM ID
+ *
+ * \return Path to the cached output or nothing if there is no entry
+ */
+std::optional<std::string> PatchCache::find(const std::string &rom_id) const
+{
+    if (m_entry_dir.empty()) {
+        return {};
+    }
+
+    auto path = entry_path(rom_id);
+    if (!FileUtils::file_exists(path)) {
+        return {};
+    }
+
+    return path;
+}
+
+/*!
+ * \brief Find a cached output for any ROM ID
+ *
+ * \return Path to the most recently stored output or nothing if there is no
+ *         entry
+ */
+std::optional<std::string> PatchCache::find_restampable() const
+{
+    if (m_entry_dir.empty()) {
+        return {};
+    }
+
+    auto path = latest_path();
+    if (!FileUtils::file_exists(path)) {
+        return {};
+    }
+
+    return path;
+}
+
+/*!
+ * \brief Add a patched file to the cache
+ *
+ * \param output_path Path to the patched file
+ * \param rom_id ROM ID that the file was patched for
+ *
+ * \return ErrorCode::NoError if successful or the error code if not
+ */
+ErrorCode PatchCache::store(const std::string &output_path,
+                            const std::string &rom_id)
+{
+    if (m_entry_dir.empty()) {
+        return ErrorCode::NoError;
+    }
+
+    if (auto r = io::create_directories(m_entry_dir); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             m_entry_dir.c_str(), r.error().message().c_str());
+        return ErrorCode::FileWriteError;
+    }
+
+    auto ret = FileUtils::clone_file(output_path, entry_path(rom_id));
+    if (ret != ErrorCode::NoError) {
+        return ret;
+    }
+
+    return FileUtils::clone_file(output_path, latest_path());
+}
+
+std::string PatchCache::entry_path(const std::string &rom_id) const
+{
+    // ROM IDs can contain characters that are not valid in filenames
+    std::string path(m_entry_dir);
+    path += '/';
+    path += to_hex(rom_id.data(), rom_id.size());
+    path += ".zip";
+    return path;
+}
+
+std::string PatchCache::latest_path() const
+{
+    return m_entry_dir + "/latest.zip";
+}
+
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/private/payloadcache.h"
+
+#include <vector>
+
+#include "mbcommon/file/hashing.h"
+#include "mbcommon/file/standard.h"
+#include "mblog/logging.h"
+
+#include "mbpatcher/private/fileutils.h"
+#include "mbpatcher/private/paralleldeflate.h"
+
+#define LOG_TAG "mbpatcher/private/payloadcache"
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class PayloadCache
+ * \brief In-memory cache of compressed payload files
+ *
+ * Every patched zip contains the same mbtool binaries and scripts for the
+ * device's architecture. Instead of deflating them again for every zip, the
+ * compressed data is kept in memory, keyed on the SHA-256 digest of the file
+ * contents and the compression level, and written to the output zip as a raw
+ * entry.
+ *
+ * If two patchers miss the cache for the same file at the same time, both
+ * compress it and the last one wins.
+ */
+
+static std::string digest_key(const std::vector<unsigned char> &digest,
+                              int level)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+
+    std::string key;
+    key.reserve(digest.size() * 2 + 4);
+
+    for (auto b : digest) {
+        key += digits[(b >> 4) & 0xf];
+        key += digits[b & 0xf];
+    }
+
+    key += ':';
+    key += std::to_string(level);
+
+    return key;
+}
+
+/*!
+ * \brief Get the compressed contents of a file
+ *
+ * \param[in] path Path to file
+ * \param[in] level zlib compression level
+ * \param[in] threads Number of threads to compress with on a cache miss
+ * \param[out] payload Compressed contents
+ *
+ * \return ErrorCode::NoError if successful or the error code if not
+ */
+ErrorCode PayloadCache::get(const std::string &path, int level,
+                            unsigned int threads,
+                            std::shared_ptr<const DeflatedPayload> &payload)
+{
+    StandardFile file;
+
+    auto ret = FileUtils::open_file(file, path, FileOpenMode::ReadOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), ret.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    // The file is hashed while it is read into memory
+    HashingFile hasher;
+
+    if (auto r = hasher.open(&file, HashAlgorithm::Sha256); !r) {
+        LOGE("%s: Failed to open for hashing: %s",
+             path.c_str(), r.error().message().c_str());
+        return ErrorCode::FileOpenError;
+    }
+
+    std::string contents;
+    char buf[65536];
+
+    while (true) {
+        auto n = hasher.read(buf, sizeof(buf));
+        if (!n) {
+            LOGE("%s: Failed to read data: %s",
+                 path.c_str(), n.error().message().c_str());
+            return ErrorCode::FileReadError;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        contents.append(buf, n.value());
+    }
+
+    auto digest = hasher.digest(HashAlgorithm::Sha256);
+    if (!digest) {
+        LOGE("%s: Failed to hash file: %s",
+             path.c_str(), digest.error().message().c_str());
+        return ErrorCode::FileReadError;
+    }
+
+    auto key = digest_key(digest.value(), level);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (auto it = m_entries.find(key); it != m_entries.end()) {
+            payload = it->second;
+            return ErrorCode::NoError;
+        }
+    }
+
+    auto result = std::make_shared<DeflatedPayload>();
+
+    {
+        ParallelDeflater deflater(threads, level,
+                                  [&](const void *buf, size_t size) {
+            result->data.append(static_cast<const char *>(buf), size);
+            return true;
+        });
+
+        if (!deflater.write(contents.data(), contents.size())
+                || !deflater.finish()) {
+            LOGE("%s: Failed to compress data", path.c_str());
+            return ErrorCode::ArchiveWriteDataError;
+        }
+
+        result->crc = deflater.crc();
+        result->uncompressed_size = deflater.uncompressed_size();
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_entries[key] = result;
+    payload = std::move(result);
+
+    return ErrorCode::NoError;
+}
+
+}
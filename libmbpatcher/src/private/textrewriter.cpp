@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "mbpatcher/private/textrewriter.h"
+
+#include <utility>
+
+#include <cassert>
+
+
+namespace mb::patcher
+{
+
+/*!
+ * \class TextRewriter
+ * \brief Literal search and replace of several strings in a single pass
+ *
+ * The search strings are compiled into a trie with a dense transition table.
+ * rewrite() scans the input once. At each position whose byte can start a
+ * match, the trie is walked to find the longest accepted search string, which
+ * is then replaced. Matching continues after the replaced text, so matches
+ * never overlap and replacements are never rescanned.
+ *
+ * For search strings that do not contain one another, the result is the same
+ * as calling a replace-all function for each string in turn.
+ */
+
+static bool is_line_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool is_space(char c)
+{
+    return is_line_space(c) || c == '\n';
+}
+
+TextRewriter::TextRewriter()
+    : m_first()
+{
+    m_nodes.push_back({{}, -1});
+}
+
+/*!
+ * \brief Add a search string and its replacement
+ *
+ * If \p from was already added, its replacement and flags are replaced.
+ *
+ * \param from Non-empty string to search for
+ * \param to Replacement string
+ * \param flags Conditions for a match to be accepted
+ */
+void TextRewriter::add(std::string_view from, std::string_view to,
+                       RewriteFlags flags)
+{
+    assert(!from.empty());
+
+    uint32_t node = 0;
+
+    for (auto c : from) {
+        auto index = static_cast<unsigned char>(c);
+
+        if (m_nodes[node].next[index] == 0) {
+            m_nodes[node].next[index] = static_cast<uint32_t>(m_nodes.size());
+            m_nodes.push_back({{}, -1});
+        }
+
+        node = m_nodes[node].next[index];
+    }
+
+    m_first[static_cast<unsigned char>(from.front())] = true;
+
+    if (m_nodes[node].rule >= 0) {
+        auto &rule = m_rules[static_cast<size_t>(m_nodes[node].rule)];
+        rule.to = to;
+        rule.flags = flags;
+    } else {
+        m_nodes[node].rule = static_cast<int32_t>(m_rules.size());
+        m_rules.push_back({std::string(from), std::string(to), flags});
+    }
+}
+
+bool TextRewriter::accepts(const Rule &rule, std::string_view input,
+                           size_t begin) const
+{
+    if (rule.flags & RewriteFlag::LineStart) {
+        size_t pos = begin;
+        for (; pos > 0 && is_line_space(input[pos - 1]); --pos);
+
+        if (pos > 0 && input[pos - 1] != '\n') {
+            return false;
+        }
+    }
+
+    if (rule.flags & RewriteFlag::WordEnd) {
+        size_t end = begin + rule.from.size();
+
+        if (end < input.size() && !is_space(input[end])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Replace all matches in \p contents
+ *
+ * The output is assembled in a buffer of the exact final size, which then
+ * replaces \p contents.
+ *
+ * \return Whether anything was replaced
+ */
+bool TextRewriter::rewrite(std::string &contents) const
+{
+    std::string_view input(contents);
+    std::vector<std::pair<size_t, size_t>> matches;
+    size_t out_size = input.size();
+
+    for (size_t pos = 0; pos < input.size();) {
+        if (!m_first[static_cast<unsigned char>(input[pos])]) {
+            ++pos;
+            continue;
+        }
+
+        int32_t best = -1;
+        uint32_t node = 0;
+
+        for (size_t i = pos; i < input.size(); ++i) {
+            node = m_nodes[node].next[static_cast<unsigned char>(input[i])];
+            if (node == 0) {
+                break;
+            }
+
+            auto rule = m_nodes[node].rule;
+            if (rule >= 0 && accepts(m_rules[static_cast<size_t>(rule)],
+                                     input, pos)) {
+                best = rule;
+            }
+        }
+
+        if (best < 0) {
+            ++pos;
+            continue;
+        }
+
+        auto &rule = m_rules[static_cast<size_t>(best)];
+        matches.emplace_back(pos, static_cast<size_t>(best));
+        out_size = out_size - rule.from.size() + rule.to.size();
+        pos += rule.from.size();
+    }
+
+    if (matches.empty()) {
+        return false;
+    }
+
+    std::string output;
+    output.reserve(out_size);
+
+    size_t pos = 0;
+
+    for (auto const &[begin, index] : matches) {
+        auto &rule = m_rules[index];
+        output.append(input.substr(pos, begin - pos));
+        output.append(rule.to);
+        pos = begin + rule.from.size();
+    }
+
+    output.append(input.substr(pos));
+
+    contents.swap(output);
+    return true;
+}
+
+}
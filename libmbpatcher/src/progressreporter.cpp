@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbpatcher/progressreporter.h"
+
+#include <climits>
+
+
+namespace mb::patcher
+{
+
+/*! \cond INTERNAL */
+// Percentage used for progress values with an unknown maximum
+static constexpr unsigned int UNKNOWN_PERCENT = UINT_MAX;
+/*! \endcond */
+
+static unsigned int percent(uint64_t value, uint64_t max_value)
+{
+    if (max_value == 0) {
+        return UNKNOWN_PERCENT;
+    }
+
+    return static_cast<unsigned int>(static_cast<double>(value) * 100.0
+            / static_cast<double>(max_value));
+}
+
+/*!
+ * \class ProgressReporter
+ * \brief Coalesces progress updates before passing them to the callbacks
+ *
+ * Patchers report progress far more often than a UI can display it (eg. for
+ * every block that is read from an archive). ProgressReporter keeps the latest
+ * bytes, files, and details values and only calls the callbacks at most
+ * `max_rate` times per second or when the byte or file percentage changes.
+ * Progress is reported in whole percent, so updates triggered by percentage
+ * changes are limited to 100 per field.
+ *
+ * The update functions may be called from multiple threads. In the common
+ * case where no update is due, they only store the new values in atomic
+ * variables. The callbacks are never called concurrently.
+ */
+
+/*!
+ * \brief Construct reporter without callbacks
+ *
+ * \param max_rate Maximum number of time-based updates per second. If 0, every
+ *                 change is reported.
+ */
+ProgressReporter::ProgressReporter(unsigned int max_rate)
+    : m_interval(max_rate == 0 ? Clock::duration::zero()
+            : std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::seconds(1)) / max_rate)
+    , m_progress_cb(nullptr)
+    , m_files_cb(nullptr)
+    , m_details_cb(nullptr)
+    , m_bytes(0)
+    , m_max_bytes(0)
+    , m_files(0)
+    , m_max_files(0)
+    , m_changed(0)
+    , m_next_emit(0)
+    , m_bytes_percent(UNKNOWN_PERCENT)
+    , m_files_percent(UNKNOWN_PERCENT)
+{
+}
+
+/*!
+ * \brief Start reporting to the specified callbacks
+ *
+ * The previous progress is discarded. The first update after this function is
+ * called is passed through immediately.
+ *
+ * \param progress_cb Callback for bytes updates (may be nullptr)
+ * \param files_cb Callback for files updates (may be nullptr)
+ * \param details_cb Callback for details updates (may be nullptr)
+ */
+void ProgressReporter::start(const ProgressUpdatedCallback *progress_cb,
+                             const FilesUpdatedCallback *files_cb,
+                             const DetailsUpdatedCallback *details_cb)
+{
+    std::lock_guard<std::mutex> lock(m_emit_mutex);
+
+    m_progress_cb = progress_cb;
+    m_files_cb = files_cb;
+    m_details_cb = details_cb;
+
+    m_bytes = 0;
+    m_max_bytes = 0;
+    m_files = 0;
+    m_max_files = 0;
+    m_changed = 0;
+    m_next_emit = 0;
+    m_bytes_percent = UNKNOWN_PERCENT;
+    m_files_percent = UNKNOWN_PERCENT;
+
+    std::lock_guard<std::mutex> details_lock(m_details_mutex);
+    m_details.clear();
+}
+
+/*!
+ * \brief Report pending updates and stop using the callbacks
+ */
+void ProgressReporter::finish()
+{
+    flush();
+
+    std::lock_guard<std::mutex> lock(m_emit_mutex);
+
+    m_progress_cb = nullptr;
+    m_files_cb = nullptr;
+    m_details_cb = nullptr;
+}
+
+/*!
+ * \brief Update number of bytes processed
+ */
+void ProgressReporter::update_bytes(uint64_t bytes, uint64_t max_bytes)
+{
+    m_bytes.store(bytes, std::memory_order_relaxed);
+    m_max_bytes.store(max_bytes, std::memory_order_relaxed);
+    m_changed.fetch_or(ProgressUpdate::Bytes, std::memory_order_release);
+
+    if (is_due(bytes, max_bytes, m_bytes_percent)) {
+        emit(false);
+    }
+}
+
+/*!
+ * \brief Update number of files processed
+ */
+void ProgressReporter::update_files(uint64_t files, uint64_t max_files)
+{
+    m_files.store(files, std::memory_order_relaxed);
+    m_max_files.store(max_files, std::memory_order_relaxed);
+    m_changed.fetch_or(ProgressUpdate::Files, std::memory_order_release);
+
+    if (is_due(files, max_files, m_files_percent)) {
+        emit(false);
+    }
+}
+
+/*!
+ * \brief Update details text
+ *
+ * Details updates are only reported at the rate limit, so intermediate texts
+ * may never be seen by the callback.
+ */
+void ProgressReporter::update_details(std::string details)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_details_mutex);
+        m_details = std::move(details);
+    }
+
+    m_changed.fetch_or(ProgressUpdate::Details, std::memory_order_release);
+
+    if (Clock::now().time_since_epoch().count()
+            >= m_next_emit.load(std::memory_order_relaxed)) {
+        emit(false);
+    }
+}
+
+/*!
+ * \brief Report pending updates now
+ *
+ * If another thread is reporting updates, this function waits for it.
+ */
+void ProgressReporter::flush()
+{
+    emit(true);
+}
+
+bool ProgressReporter::is_due(uint64_t value, uint64_t max_value,
+                              const std::atomic_uint &last_percent) const
+{
+    return percent(value, max_value)
+                    != last_percent.load(std::memory_order_relaxed)
+            || Clock::now().time_since_epoch().count()
+                    >= m_next_emit.load(std::memory_order_relaxed);
+}
+
+void ProgressReporter::emit(bool wait)
+{
+    std::unique_lock<std::mutex> lock(m_emit_mutex, std::defer_lock);
+
+    if (wait) {
+        lock.lock();
+    } else if (!lock.try_lock()) {
+        // Another thread is reporting. The update is picked up by the next
+        // report.
+        return;
+    }
+
+    ProgressUpdate update;
+    update.changed = m_changed.exchange(0, std::memory_order_acquire);
+
+    if (update.changed == 0) {
+        return;
+    }
+
+    m_next_emit.store((Clock::now() + m_interval).time_since_epoch().count(),
+                      std::memory_order_relaxed);
+
+    if (update.changed & ProgressUpdate::Bytes) {
+        update.bytes = m_bytes.load(std::memory_order_relaxed);
+        update.max_bytes = m_max_bytes.load(std::memory_order_relaxed);
+        m_bytes_percent.store(percent(update.bytes, update.max_bytes),
+                              std::memory_order_relaxed);
+    }
+    if (update.changed & ProgressUpdate::Files) {
+        update.files = m_files.load(std::memory_order_relaxed);
+        update.max_files = m_max_files.load(std::memory_order_relaxed);
+        m_files_percent.store(percent(update.files, update.max_files),
+                              std::memory_order_relaxed);
+    }
+    if (update.changed & ProgressUpdate::Details) {
+        std::lock_guard<std::mutex> details_lock(m_details_mutex);
+        update.details = m_details;
+    }
+
+    dispatch(update);
+}
+
+void ProgressReporter::dispatch(const ProgressUpdate &update)
+{
+    if ((update.changed & ProgressUpdate::Bytes)
+            && m_progress_cb && *m_progress_cb) {
+        (*m_progress_cb)(update.bytes, update.max_bytes);
+    }
+    if ((update.changed & ProgressUpdate::Files)
+            && m_files_cb && *m_files_cb) {
+        (*m_files_cb)(update.files, update.max_files);
+    }
+    if ((update.changed & ProgressUpdate::Details)
+            && m_details_cb && *m_details_cb) {
+        (*m_details_cb)(update.details);
+    }
+}
+
+}
@@ -22,11 +22,21 @@
 #include <string>
 
 #include "mbcommon/common.h"
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::io
 {
 
-MB_EXPORT oc::result<void> delete_recursively(const std::string &path);
+enum class DeleteFlag : uint8_t
+{
+    // Delete top-level subtrees concurrently
+    Parallel        = 1 << 0,
+};
+MB_DECLARE_FLAGS(DeleteFlags, DeleteFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DeleteFlags)
+
+MB_EXPORT oc::result<void> delete_recursively(const std::string &path,
+                                              DeleteFlags flags = {});
 
 }
@@ -24,9 +24,12 @@
 #include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
 
+#include "mbpio/delete.h"
+
 namespace mb::io::win32
 {
 
-MB_EXPORT oc::result<void> delete_recursively(const std::string &path);
+MB_EXPORT oc::result<void> delete_recursively(const std::string &path,
+                                              DeleteFlags flags);
 
 }
@@ -28,12 +28,24 @@
 namespace mb::io
 {
 
-oc::result<void> delete_recursively(const std::string &path)
+/*!
+ * \brief Recursively delete a path
+ *
+ * Symlinks and reparse points are deleted, not followed. If
+ * \ref DeleteFlag::Parallel is set and \p path is a directory, its top-level
+ * entries are deleted by tasks on the global Executor.
+ *
+ * \param path Path to delete
+ * \param flags Delete flags
+ *
+ * \return Nothing if successful. Otherwise, the first error that occurred.
+ */
+oc::result<void> delete_recursively(const std::string &path, DeleteFlags flags)
 {
 #ifdef _WIN32
-    return win32::delete_recursively(path);
+    return win32::delete_recursively(path, flags);
 #else
-    return posix::delete_recursively(path);
+    return posix::delete_recursively(path, flags);
 #endif
 }
 
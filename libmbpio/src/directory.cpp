@@ -28,33 +28,89 @@
 #  include <windows.h>
 #else
 #  include <cerrno>
+#  include <fcntl.h>
 #  include <sys/stat.h>
+#  include <unistd.h>
 #endif
 
 namespace mb::io
 {
 
-oc::result<void> create_directories(const std::string &path)
+#ifndef _WIN32
+// Create the missing components of the path one at a time. Each component is
+// created and opened relative to the previous one, so the lookup of the
+// leading components is not repeated for every level.
+static oc::result<void> create_directories_at(const std::string &path)
 {
-#ifdef _WIN32
-    constexpr char delim[] = "/\\";
-    constexpr char pathsep[] = "\\";
+#ifdef O_PATH
+    constexpr int dir_flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
 #else
-    constexpr char delim[] = "/";
-    constexpr char pathsep[] = "/";
+    constexpr int dir_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
 #endif
     char *p;
     char *save_ptr;
-    std::string temp;
     std::string copy = path;
-#ifdef _WIN32
-    std::wstring w_temp;
+
+    int dfd = open(path[0] == '/' ? "/" : ".", dir_flags);
+    if (dfd < 0) {
+        return ec_from_errno();
+    }
+
+    p = strtok_r(copy.data(), "/", &save_ptr);
+    while (p != nullptr) {
+        char *next = strtok_r(nullptr, "/", &save_ptr);
+
+        if (mkdirat(dfd, p, 0755) < 0 && errno != EEXIST) {
+            auto ec = ec_from_errno();
+            close(dfd);
+            return ec;
+        }
+
+        // The last component is not opened, so an existing file in its place
+        // is not an error
+        if (next) {
+            int fd = openat(dfd, p, dir_flags);
+            auto ec = ec_from_errno();
+            close(dfd);
+            if (fd < 0) {
+                return ec;
+            }
+            dfd = fd;
+        }
+
+        p = next;
+    }
+
+    close(dfd);
+
+    return oc::success();
+}
 #endif
 
+oc::result<void> create_directories(const std::string &path)
+{
     if (path.empty()) {
         return std::errc::invalid_argument;
     }
 
+#ifdef _WIN32
+    constexpr char delim[] = "/\\";
+    constexpr char pathsep[] = "\\";
+    char *p;
+    char *save_ptr;
+    std::string temp;
+    std::string copy = path;
+
+    // Usually, only the last component is missing
+    OUTCOME_TRY(w_path, mb::utf8_to_wcs(path));
+
+    if (CreateDirectoryW(w_path.c_str(), nullptr)
+            || GetLastError() == ERROR_ALREADY_EXISTS) {
+        return oc::success();
+    } else if (GetLastError() != ERROR_PATH_NOT_FOUND) {
+        return ec_from_win32();
+    }
+
     // Add leading separator if needed
     if (strchr(delim, path[0])) {
         temp += path[0];
@@ -65,26 +121,27 @@ oc::result<void> create_directories(const std::string &path)
         temp += p;
         temp += pathsep;
 
-#ifdef _WIN32
         OUTCOME_TRY(w_temp, mb::utf8_to_wcs(temp));
 
-        DWORD dw_attrib = GetFileAttributesW(w_temp.c_str());
-        bool exists = (dw_attrib != INVALID_FILE_ATTRIBUTES)
-                && (dw_attrib & FILE_ATTRIBUTE_DIRECTORY);
-        if (!exists && !CreateDirectoryW(w_temp.c_str(), nullptr)
+        if (!CreateDirectoryW(w_temp.c_str(), nullptr)
                 && GetLastError() != ERROR_ALREADY_EXISTS) {
             return ec_from_win32();
         }
-#else
-        if (mkdir(temp.c_str(), 0755) < 0 && errno != EEXIST) {
-            return ec_from_errno();
-        }
-#endif
 
         p = strtok_r(nullptr, delim, &save_ptr);
     }
 
     return oc::success();
+#else
+    // Usually, only the last component is missing
+    if (mkdir(path.c_str(), 0755) == 0 || errno == EEXIST) {
+        return oc::success();
+    } else if (errno != ENOENT) {
+        return ec_from_errno();
+    }
+
+    return create_directories_at(path);
+#endif
 }
 
 }
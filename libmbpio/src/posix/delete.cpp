@@ -19,26 +19,169 @@
 
 #include "mbpio/posix/delete.h"
 
-#include <ftw.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
 
 namespace mb::io::posix
 {
 
-static int _delete_cb(const char *fpath, const struct stat *sb,
-                      int typeflag, FTW *ftwbuf)
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+namespace
 {
-    (void) sb;
-    (void) typeflag;
-    (void) ftwbuf;
 
-    return remove(fpath);
+struct DeleteEntry
+{
+    std::string name;
+    bool is_dir;
+};
+
 }
 
-oc::result<void> delete_recursively(const std::string &path)
+static oc::result<std::vector<DeleteEntry>> list_entries(int dfd)
 {
-    if (nftw(path.c_str(), _delete_cb, 64, FTW_DEPTH | FTW_PHYS) < 0) {
+    int fd = dup(dfd);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    ScopedDIR dp(fdopendir(fd), closedir);
+    if (!dp) {
+        auto ec = ec_from_errno();
+        close(fd);
+        return ec;
+    }
+
+    std::vector<DeleteEntry> entries;
+
+    errno = 0;
+    while (struct dirent *ent = readdir(dp.get())) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        bool is_dir = ent->d_type == DT_DIR;
+
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(dfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                return ec_from_errno();
+            }
+            is_dir = S_ISDIR(sb.st_mode);
+        }
+
+        entries.push_back({ent->d_name, is_dir});
+    }
+
+    if (errno != 0) {
+        return ec_from_errno();
+    }
+
+    return entries;
+}
+
+// Delete an entry of the directory referred to by dfd. Subdirectories are
+// opened relative to their parent, so each path component is only resolved
+// once no matter how deep the tree is.
+static oc::result<void> delete_entry(int dfd, const DeleteEntry &entry)
+{
+    if (entry.is_dir) {
+        int fd = openat(dfd, entry.name.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+
+        auto close_fd = finally([&] {
+            close(fd);
+        });
+
+        OUTCOME_TRY(entries, list_entries(fd));
+
+        for (auto const &child : entries) {
+            OUTCOME_TRYV(delete_entry(fd, child));
+        }
+    }
+
+    if (unlinkat(dfd, entry.name.c_str(), entry.is_dir ? AT_REMOVEDIR : 0) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+static oc::result<void> delete_entries(int dfd,
+                                       std::vector<DeleteEntry> &entries,
+                                       DeleteFlags flags)
+{
+    unsigned int threads = 1;
+    if (flags & DeleteFlag::Parallel) {
+        auto dirs = std::count_if(entries.begin(), entries.end(),
+                                  [](const DeleteEntry &e) {
+            return e.is_dir;
+        });
+
+        threads = std::clamp(Executor::global().concurrency(), 1u,
+                             std::max(static_cast<unsigned int>(dirs), 1u));
+    }
+
+    if (threads > 1) {
+        // Start with the directories so that the large subtrees are picked up
+        // first and the remaining files fill in the gaps
+        std::stable_partition(entries.begin(), entries.end(),
+                              [](const DeleteEntry &e) {
+            return e.is_dir;
+        });
+    }
+
+    return try_parallel_for(entries.size(), [&](size_t i) {
+        return delete_entry(dfd, entries[i]);
+    }, threads);
+}
+
+oc::result<void> delete_recursively(const std::string &path, DeleteFlags flags)
+{
+    struct stat sb;
+    if (lstat(path.c_str(), &sb) < 0) {
+        return ec_from_errno();
+    }
+
+    if (!S_ISDIR(sb.st_mode)) {
+        if (unlink(path.c_str()) < 0) {
+            return ec_from_errno();
+        }
+        return oc::success();
+    }
+
+    int dfd = open(path.c_str(),
+                   O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (dfd < 0) {
+        return ec_from_errno();
+    }
+
+    {
+        auto close_dfd = finally([&] {
+            close(dfd);
+        });
+
+        OUTCOME_TRY(entries, list_entries(dfd));
+        OUTCOME_TRYV(delete_entries(dfd, entries, flags));
+    }
+
+    if (rmdir(path.c_str()) < 0) {
         return ec_from_errno();
     }
 
@@ -21,80 +21,210 @@
 
 #include <windows.h>
 
+#include <algorithm>
 #include <memory>
 #include <type_traits>
+#include <vector>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
 #include "mbcommon/locale.h"
 
 namespace mb::io::win32
 {
 
-using ScopedFindHandle = std::unique_ptr<std::remove_pointer_t<HANDLE>, decltype(FindClose) *>;
+using ScopedHandle = std::unique_ptr<std::remove_pointer_t<HANDLE>, decltype(CloseHandle) *>;
 
-static oc::result<void> _win32_recursive_delete(const std::wstring &path)
+namespace
 {
-    std::wstring mask(path);
-    mask += L"\\*";
-
-    WIN32_FIND_DATAW find_data;
-
-    // First, delete the contents of the directory, recursively for subdirectories
-    HANDLE _search_handle = FindFirstFileExW(
-        mask.c_str(),           // lpFileName
-        FindExInfoBasic,        // fInfoLevelId
-        &find_data,             // lpFindFileData
-        FindExSearchNameMatch,  // fSearchOp
-        nullptr,                // lpSearchFilter
-        0                       // dwAdditionalFlags
+
+struct DeleteEntry
+{
+    std::wstring name;
+    bool is_dir;
+};
+
+}
+
+// Directory entries are read in batches of this size
+static constexpr size_t DIR_INFO_BUF_SIZE = 64 * 1024;
+
+// Open a file or directory for deletion. Reparse points (symlinks and
+// junctions) are opened themselves instead of their targets.
+static oc::result<ScopedHandle> open_for_delete(const std::wstring &path,
+                                                bool is_dir)
+{
+    HANDLE handle = CreateFileW(
+        path.c_str(),                               // lpFileName
+        DELETE | (is_dir ? FILE_LIST_DIRECTORY : 0), // dwDesiredAccess
+        FILE_SHARE_READ | FILE_SHARE_WRITE
+                | FILE_SHARE_DELETE,                // dwShareMode
+        nullptr,                                    // lpSecurityAttributes
+        OPEN_EXISTING,                              // dwCreationDisposition
+        FILE_FLAG_BACKUP_SEMANTICS
+                | FILE_FLAG_OPEN_REPARSE_POINT,     // dwFlagsAndAttributes
+        nullptr                                     // hTemplateFile
     );
-    if (_search_handle == INVALID_HANDLE_VALUE) {
-        if (auto error = GetLastError(); error != ERROR_FILE_NOT_FOUND) {
-            return ec_from_win32(error);
+    if (handle == INVALID_HANDLE_VALUE) {
+        return ec_from_win32();
+    }
+
+    return ScopedHandle(handle, &CloseHandle);
+}
+
+// Mark an open file or directory for deletion. If the system supports it, the
+// POSIX semantics are used so that the name is removed immediately, even if
+// another process (eg. an antivirus scanner) still has the file open. This
+// allows the parent directory to be removed right away.
+static oc::result<void> delete_by_handle(HANDLE handle)
+{
+#ifdef FILE_DISPOSITION_FLAG_POSIX_SEMANTICS
+    FILE_DISPOSITION_INFO_EX info_ex = {};
+    info_ex.Flags = FILE_DISPOSITION_FLAG_DELETE
+            | FILE_DISPOSITION_FLAG_POSIX_SEMANTICS
+            | FILE_DISPOSITION_FLAG_IGNORE_READONLY_ATTRIBUTE;
+
+    if (SetFileInformationByHandle(handle, FileDispositionInfoEx,
+                                   &info_ex, sizeof(info_ex))) {
+        return oc::success();
+    } else if (auto error = GetLastError();
+            error != ERROR_INVALID_PARAMETER
+            && error != ERROR_INVALID_FUNCTION
+            && error != ERROR_NOT_SUPPORTED) {
+        return ec_from_win32(error);
+    }
+#endif
+
+    FILE_DISPOSITION_INFO info = {};
+    info.DeleteFile = TRUE;
+
+    if (!SetFileInformationByHandle(handle, FileDispositionInfo,
+                                    &info, sizeof(info))) {
+        return ec_from_win32();
+    }
+
+    return oc::success();
+}
+
+// List a directory through its handle. Each call returns as many entries as
+// fit in the buffer instead of one entry per FindNextFileW() call.
+static oc::result<std::vector<DeleteEntry>> list_entries(HANDLE handle)
+{
+    std::vector<DeleteEntry> entries;
+    auto buf = std::make_unique<unsigned char[]>(DIR_INFO_BUF_SIZE);
+    auto info_class = FileIdBothDirectoryRestartInfo;
+
+    while (true) {
+        if (!GetFileInformationByHandleEx(handle, info_class, buf.get(),
+                                          DIR_INFO_BUF_SIZE)) {
+            if (auto error = GetLastError(); error != ERROR_NO_MORE_FILES) {
+                return ec_from_win32(error);
+            }
+            break;
         }
-    } else {
-        ScopedFindHandle search_handle(_search_handle, &FindClose);
-
-        while (true) {
-            if (wcscmp(find_data.cFileName, L".") != 0
-                    && wcscmp(find_data.cFileName, L"..") != 0) {
-                bool is_directory = (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-                        || (find_data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT);
-                std::wstring child_path(path);
-                child_path += L'\\';
-                child_path += find_data.cFileName;
-
-                if (is_directory) {
-                    OUTCOME_TRYV(_win32_recursive_delete(child_path));
-                } else {
-                    if (!DeleteFileW(child_path.c_str())) {
-                        return ec_from_win32();
-                    }
-                }
+
+        info_class = FileIdBothDirectoryInfo;
+
+        for (unsigned char *ptr = buf.get(); ;) {
+            auto info = reinterpret_cast<FILE_ID_BOTH_DIR_INFO *>(ptr);
+            std::wstring name(info->FileName,
+                              info->FileNameLength / sizeof(WCHAR));
+
+            if (name != L"." && name != L"..") {
+                // Reparse points are deleted without descending into them
+                bool is_dir = (info->FileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                        && !(info->FileAttributes
+                                & FILE_ATTRIBUTE_REPARSE_POINT);
+
+                entries.push_back({std::move(name), is_dir});
             }
 
-            // Advance to the next file in the directory
-            if (!FindNextFileW(search_handle.get(), &find_data)) {
-                if (auto error = GetLastError(); error != ERROR_NO_MORE_FILES) {
-                    return ec_from_win32(error);
-                }
+            if (info->NextEntryOffset == 0) {
                 break;
             }
+            ptr += info->NextEntryOffset;
         }
     }
 
-    if (!RemoveDirectoryW(path.c_str())) {
-        return ec_from_win32();
+    return entries;
+}
+
+static oc::result<void> delete_tree(const std::wstring &path, bool is_dir)
+{
+    OUTCOME_TRY(handle, open_for_delete(path, is_dir));
+
+    if (is_dir) {
+        OUTCOME_TRY(entries, list_entries(handle.get()));
+
+        for (auto const &entry : entries) {
+            std::wstring child_path(path);
+            child_path += L'\\';
+            child_path += entry.name;
+
+            OUTCOME_TRYV(delete_tree(child_path, entry.is_dir));
+        }
     }
 
-    return oc::success();
+    return delete_by_handle(handle.get());
 }
 
-oc::result<void> delete_recursively(const std::string &path)
+static oc::result<void> delete_entries(const std::wstring &path,
+                                       std::vector<DeleteEntry> &entries,
+                                       DeleteFlags flags)
+{
+    auto delete_entry = [&](const DeleteEntry &entry) {
+        std::wstring child_path(path);
+        child_path += L'\\';
+        child_path += entry.name;
+
+        return delete_tree(child_path, entry.is_dir);
+    };
+
+    unsigned int threads = 1;
+    if (flags & DeleteFlag::Parallel) {
+        auto dirs = std::count_if(entries.begin(), entries.end(),
+                                  [](const DeleteEntry &e) {
+            return e.is_dir;
+        });
+
+        threads = std::clamp(Executor::global().concurrency(), 1u,
+                             std::max(static_cast<unsigned int>(dirs), 1u));
+    }
+
+    if (threads > 1) {
+        // Start with the directories so that the large subtrees are picked up
+        // first and the remaining files fill in the gaps
+        std::stable_partition(entries.begin(), entries.end(),
+                              [](const DeleteEntry &e) {
+            return e.is_dir;
+        });
+    }
+
+    return try_parallel_for(entries.size(), [&](size_t i) {
+        return delete_entry(entries[i]);
+    }, threads);
+}
+
+oc::result<void> delete_recursively(const std::string &path, DeleteFlags flags)
 {
     OUTCOME_TRY(w_path, mb::utf8_to_wcs(path));
 
-    return _win32_recursive_delete(w_path);
+    DWORD attrs = GetFileAttributesW(w_path.c_str());
+    if (attrs == INVALID_FILE_ATTRIBUTES) {
+        return ec_from_win32();
+    }
+
+    bool is_dir = (attrs & FILE_ATTRIBUTE_DIRECTORY)
+            && !(attrs & FILE_ATTRIBUTE_REPARSE_POINT);
+
+    OUTCOME_TRY(handle, open_for_delete(w_path, is_dir));
+
+    if (is_dir) {
+        OUTCOME_TRY(entries, list_entries(handle.get()));
+        OUTCOME_TRYV(delete_entries(w_path, entries, flags));
+    }
+
+    return delete_by_handle(handle.get());
 }
 
 }
@@ -23,8 +23,12 @@
 
 #include <memory>
 
+#include <cstddef>
+
 #include <openssl/evp.h>
 
+#include "mbcommon/file.h"
+
 #include "mbsign/error.h"
 
 namespace mb::sign
@@ -52,5 +56,17 @@ MB_EXPORT Result<void>
 sign_data(BIO &bio_data_in, BIO &bio_sig_out, EVP_PKEY &pkey);
 MB_EXPORT Result<void>
 verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey);
+MB_EXPORT Result<void>
+sign_data(File &data_in, File &sig_out, EVP_PKEY &pkey);
+MB_EXPORT Result<void>
+verify_data(File &data_in, File &sig_in, EVP_PKEY &pkey);
+
+MB_EXPORT Result<size_t>
+verify_data_with_keys(BIO &bio_data_in, BIO &bio_sig_in,
+                      EVP_PKEY * const *pkeys, size_t count);
+MB_EXPORT Result<size_t>
+verify_buffer_with_keys(const void *data, size_t data_size,
+                        const void *sig, size_t sig_size,
+                        EVP_PKEY * const *pkeys, size_t count);
 
 }
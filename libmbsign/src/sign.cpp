@@ -19,8 +19,10 @@
 
 #include "mbsign/sign.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <cstring>
 
@@ -34,6 +36,7 @@
 #ifdef OPENSSL_IS_BORINGSSL
 #include <openssl/mem.h>
 #endif
+#include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/pkcs12.h>
 
@@ -41,6 +44,8 @@
 #  pragma GCC diagnostic pop
 #endif
 
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 
 constexpr char MAGIC[]                      = "!MBSIGN!";
@@ -65,6 +70,8 @@ template <typename T>
 using ScopedMallocable = std::unique_ptr<T, decltype(free) *>;
 
 using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
+using ScopedEVP_PKEY_CTX =
+        std::unique_ptr<EVP_PKEY_CTX, decltype(EVP_PKEY_CTX_free) *>;
 using ScopedPKCS12 = std::unique_ptr<PKCS12, decltype(PKCS12_free) *>;
 
 /*!
@@ -505,4 +512,448 @@ verify_data(BIO &bio_data_in, BIO &bio_sig_in, EVP_PKEY &pkey)
     }
 }
 
+static Result<const EVP_MD *> check_sig_header(const SigHeader &hdr)
+{
+    if (memcmp(hdr.magic, MAGIC, MAGIC_SIZE) != 0) {
+        return ErrorInfo{Error::InvalidSignatureMagic, false};
+    }
+
+    if (hdr.version == VERSION_1_SHA512_DGST) {
+        return EVP_sha512();
+    } else {
+        return ErrorInfo{Error::InvalidSignatureVersion, false};
+    }
+}
+
+static int max_sig_size(EVP_PKEY * const *pkeys, size_t count)
+{
+    int size = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        size = std::max(size, EVP_PKEY_size(pkeys[i]));
+    }
+
+    return size;
+}
+
+static Result<size_t>
+verify_digest_with_keys(const EVP_MD *md_type, const unsigned char *digest,
+                        size_t digest_size, const unsigned char *sig,
+                        size_t sig_size, EVP_PKEY * const *pkeys, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        ScopedEVP_PKEY_CTX pctx(EVP_PKEY_CTX_new(pkeys[i], nullptr),
+                                EVP_PKEY_CTX_free);
+        if (!pctx) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+
+        if (EVP_PKEY_verify_init(pctx.get()) <= 0
+                || EVP_PKEY_CTX_set_signature_md(pctx.get(), md_type) <= 0) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+
+        // Same signature length that verify_data() would have read
+        size_t key_sig_size = std::min(
+                sig_size, static_cast<size_t>(EVP_PKEY_size(pkeys[i])));
+
+        int n = EVP_PKEY_verify(pctx.get(), sig, key_sig_size,
+                                digest, digest_size);
+        if (n == 1) {
+            return i;
+        } else if (n != 0) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+
+        // Don't leave errors from the mismatched keys in the queue
+        ERR_clear_error();
+    }
+
+    return ErrorInfo{Error::BadSignature, false};
+}
+
+/*!
+ * \brief Verify signature of data from stream against several keys
+ *
+ * This is equivalent to calling verify_data() for each key in turn, except
+ * that the data is only read and hashed once. The signature file does not
+ * record which key created it, so the digest is checked against each key
+ * until one matches.
+ *
+ * \param bio_data_in Input stream for data
+ * \param bio_sig_in Input stream for signature
+ * \param pkeys Array of public keys
+ * \param count Number of public keys in \p pkeys
+ *
+ * \return Index of the key that the signature is valid for. If the signature
+ *         is not valid for any key, the error code will be set to
+ *         Error::BadSignature.
+ */
+Result<size_t>
+verify_data_with_keys(BIO &bio_data_in, BIO &bio_sig_in,
+                      EVP_PKEY * const *pkeys, size_t count)
+{
+    EVP_MD_CTX *mctx = nullptr;
+
+#ifdef OPENSSL_IS_BORINGSSL
+    EVP_MD_CTX ctx;
+    EVP_MD_CTX_init(&ctx);
+
+    auto free_ctx = finally([&ctx] {
+        EVP_MD_CTX_cleanup(&ctx);
+    });
+
+    mctx = &ctx;
+#else
+    ScopedBIO bio_md(BIO_new(BIO_f_md()), BIO_free);
+    if (!bio_md) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (!BIO_get_md_ctx(bio_md.get(), &mctx)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+#endif
+
+    // Read header from signature file
+    SigHeader hdr;
+    if (BIO_read(&bio_sig_in, &hdr, static_cast<int>(sizeof(hdr)))
+            != static_cast<int>(sizeof(hdr))) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    OUTCOME_TRY(md_type, check_sig_header(hdr));
+
+    if (!EVP_DigestInit_ex(mctx, md_type, nullptr)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    // Read as much of the signature as the largest key needs
+    int max_siglen = max_sig_size(pkeys, count);
+    if (max_siglen <= 0) {
+        return ErrorInfo{Error::BadSignature, false};
+    }
+
+    ScopedMallocable<unsigned char> sigbuf(static_cast<unsigned char *>(
+            OPENSSL_malloc(static_cast<size_t>(max_siglen))),
+            openssl_free_wrapper);
+    if (!sigbuf) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+    int siglen = BIO_read(&bio_sig_in, sigbuf.get(), max_siglen);
+    if (siglen <= 0) {
+        return ErrorInfo{Error::IoError, true};
+    }
+
+    constexpr size_t buf_size = 8192;
+    ScopedMallocable<unsigned char> buf(
+            static_cast<unsigned char *>(OPENSSL_malloc(buf_size)),
+            openssl_free_wrapper);
+    if (!buf) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+#ifdef OPENSSL_IS_BORINGSSL
+    BIO *bio_input = &bio_data_in;
+#else
+    BIO *bio_input = BIO_push(bio_md.get(), &bio_data_in);
+#endif
+
+    while (true) {
+        int n = BIO_read(bio_input, buf.get(), buf_size);
+        if (n < 0) {
+            return ErrorInfo{Error::IoError, true};
+        }
+        if (n == 0) {
+            break;
+        }
+#ifdef OPENSSL_IS_BORINGSSL
+        if (!EVP_DigestUpdate(mctx, buf.get(), static_cast<size_t>(n))) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+#endif
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size;
+
+    if (!EVP_DigestFinal_ex(mctx, digest, &digest_size)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    return verify_digest_with_keys(md_type, digest, digest_size, sigbuf.get(),
+                                   static_cast<size_t>(siglen), pkeys, count);
+}
+
+/*!
+ * \brief Verify signature of in-memory data against several keys
+ *
+ * This behaves like verify_data_with_keys(), but the data and signature are
+ * passed as buffers (eg. from mmap()). The whole buffer is hashed in a single
+ * pass without copying it through a BIO.
+ *
+ * \param data Data buffer
+ * \param data_size Size of \p data
+ * \param sig Signature buffer (contents of the signature file)
+ * \param sig_size Size of \p sig
+ * \param pkeys Array of public keys
+ * \param count Number of public keys in \p pkeys
+ *
+ * \return Index of the key that the signature is valid for. If the signature
+ *         is not valid for any key, the error code will be set to
+ *         Error::BadSignature.
+ */
+Result<size_t>
+verify_buffer_with_keys(const void *data, size_t data_size,
+                        const void *sig, size_t sig_size,
+                        EVP_PKEY * const *pkeys, size_t count)
+{
+    SigHeader hdr;
+    if (sig_size < sizeof(hdr)) {
+        return ErrorInfo{Error::IoError, false};
+    }
+    memcpy(&hdr, sig, sizeof(hdr));
+
+    OUTCOME_TRY(md_type, check_sig_header(hdr));
+
+    if (sig_size == sizeof(hdr)) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size;
+
+    if (!EVP_Digest(data, data_size, digest, &digest_size, md_type, nullptr)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    return verify_digest_with_keys(
+            md_type, digest, digest_size,
+            static_cast<const unsigned char *>(sig) + sizeof(hdr),
+            sig_size - sizeof(hdr), pkeys, count);
+}
+
+/*!
+ * \brief Size of the blocks passed to the digest when signing or verifying a
+ *        File
+ *
+ * Files are digested in large blocks to keep the per-call overhead of the
+ * File API and OpenSSL negligible. If the File exposes its contents directly
+ * (eg. MmapFile), up to this many bytes are digested per view without
+ * copying.
+ */
+constexpr size_t FILE_DIGEST_BLOCK_SIZE = 4 * 1024 * 1024;
+
+namespace
+{
+
+// Obtains an EVP_MD_CTX the same way as the BIO-based functions so that the
+// File-based functions support the same OpenSSL and BoringSSL versions
+class DigestContext
+{
+public:
+    DigestContext()
+#ifndef OPENSSL_IS_BORINGSSL
+        : m_bio(BIO_new(BIO_f_md()), BIO_free)
+#endif
+    {
+#ifdef OPENSSL_IS_BORINGSSL
+        EVP_MD_CTX_init(&m_ctx);
+        m_mctx = &m_ctx;
+#else
+        if (m_bio && !BIO_get_md_ctx(m_bio.get(), &m_mctx)) {
+            m_mctx = nullptr;
+        }
+#endif
+    }
+
+    ~DigestContext()
+    {
+#ifdef OPENSSL_IS_BORINGSSL
+        EVP_MD_CTX_cleanup(&m_ctx);
+#endif
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DigestContext)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DigestContext)
+
+    EVP_MD_CTX * get() const
+    {
+        return m_mctx;
+    }
+
+private:
+#ifdef OPENSSL_IS_BORINGSSL
+    EVP_MD_CTX m_ctx;
+#else
+    ScopedBIO m_bio;
+#endif
+    EVP_MD_CTX *m_mctx = nullptr;
+};
+
+}
+
+template<typename Update>
+static Result<void> digest_file(File &file, EVP_MD_CTX *mctx, Update &&update)
+{
+    // Digest the contents in place if they're resident in memory
+    if (auto pos = file.seek(0, SEEK_CUR)) {
+        uint64_t offset = pos.value();
+
+        auto view = file.view_at(offset, FILE_DIGEST_BLOCK_SIZE);
+        if (view) {
+            while (view.value().size > 0) {
+                if (!update(mctx, view.value().data, view.value().size)) {
+                    return ErrorInfo{Error::OpensslError, true};
+                }
+
+                offset += view.value().size;
+
+                view = file.view_at(offset, FILE_DIGEST_BLOCK_SIZE);
+                if (!view) {
+                    return ErrorInfo{Error::IoError, false};
+                }
+            }
+
+            if (!file.seek(static_cast<int64_t>(offset), SEEK_SET)) {
+                return ErrorInfo{Error::IoError, false};
+            }
+
+            return oc::success();
+        } else if (view.error() != FileError::UnsupportedView) {
+            return ErrorInfo{Error::IoError, false};
+        }
+    }
+
+    std::vector<unsigned char> buf(FILE_DIGEST_BLOCK_SIZE);
+
+    while (true) {
+        auto n = file_read_retry(file, buf.data(), buf.size());
+        if (!n) {
+            return ErrorInfo{Error::IoError, false};
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        if (!update(mctx, buf.data(), n.value())) {
+            return ErrorInfo{Error::OpensslError, true};
+        }
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Sign data from a File
+ *
+ * This produces the same signature format as the BIO-based sign_data(), but
+ * digests the input in large blocks and without copying if the File supports
+ * direct access to its contents (eg. MmapFile).
+ *
+ * \param data_in Input file for data
+ * \param sig_out Output file for signature
+ * \param pkey Private key
+ *
+ * \return Whether the signing operation was successful
+ */
+Result<void> sign_data(File &data_in, File &sig_out, EVP_PKEY &pkey)
+{
+    constexpr unsigned int version = VERSION_LATEST;
+    const EVP_MD *md_type = nullptr;
+
+    if (version == VERSION_1_SHA512_DGST) {
+        md_type = EVP_sha512();
+    } else {
+        return ErrorInfo{Error::InvalidSignatureVersion, false};
+    }
+
+    DigestContext ctx;
+    if (!ctx.get()) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (!EVP_DigestSignInit(ctx.get(), nullptr, md_type, nullptr, &pkey)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    OUTCOME_TRYV(digest_file(data_in, ctx.get(),
+                             [](EVP_MD_CTX *c, const void *d, size_t n) {
+        return EVP_DigestSignUpdate(c, d, n);
+    }));
+
+    size_t len = 0;
+    if (!EVP_DigestSignFinal(ctx.get(), nullptr, &len)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    std::vector<unsigned char> sig(len);
+    if (!EVP_DigestSignFinal(ctx.get(), sig.data(), &len)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    // Write header
+    SigHeader hdr = {};
+    memcpy(hdr.magic, MAGIC, MAGIC_SIZE);
+    hdr.version = version;
+
+    if (!file_write_exact(sig_out, &hdr, sizeof(hdr))
+            || !file_write_exact(sig_out, sig.data(), len)) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Verify signature of data from a File
+ *
+ * \param data_in Input file for data
+ * \param sig_in Input file for signature
+ * \param pkey Public key
+ *
+ * \return Whether the verification operation completed successfully. If the
+ *         signature is invalid, the error code will be set to
+ *         Error::BadSignature.
+ */
+Result<void> verify_data(File &data_in, File &sig_in, EVP_PKEY &pkey)
+{
+    // Read header from signature file
+    SigHeader hdr;
+    if (!file_read_exact(sig_in, &hdr, sizeof(hdr))) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    OUTCOME_TRY(md_type, check_sig_header(hdr));
+
+    std::vector<unsigned char> sig(static_cast<size_t>(
+            std::max(EVP_PKEY_size(&pkey), 0)));
+    auto sig_size = file_read_retry(sig_in, sig.data(), sig.size());
+    if (!sig_size || sig_size.value() == 0) {
+        return ErrorInfo{Error::IoError, false};
+    }
+
+    DigestContext ctx;
+    if (!ctx.get()) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    if (!EVP_DigestVerifyInit(ctx.get(), nullptr, md_type, nullptr, &pkey)) {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+
+    OUTCOME_TRYV(digest_file(data_in, ctx.get(),
+                             [](EVP_MD_CTX *c, const void *d, size_t n) {
+        return EVP_DigestVerifyUpdate(c, d, n);
+    }));
+
+    int n = EVP_DigestVerifyFinal(ctx.get(), sig.data(), sig_size.value());
+    if (n == 1) {
+        return oc::success();
+    } else if (n == 0) {
+        return ErrorInfo{Error::BadSignature, false};
+    } else {
+        return ErrorInfo{Error::OpensslError, true};
+    }
+}
+
 }
@@ -20,11 +20,18 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/rsa.h>
 
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
 #include "mbsign/sign.h"
 
 using ScopedBIGNUM = std::unique_ptr<BIGNUM, decltype(BN_free) *>;
@@ -173,3 +180,184 @@ TEST(SignTest, TestLoadValidPemKeysWithInvalidPassphrase)
     auto private_key_read = load_private_key(*bio, KeyFormat::Pem, "gnitset");
     ASSERT_FALSE(private_key_read);
 }
+
+TEST(SignTest, TestVerifyDataWithKeys)
+{
+    ScopedEVP_PKEY private_key1(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key1(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY private_key2(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key2(nullptr, EVP_PKEY_free);
+
+    generate_keys(private_key1, public_key1);
+    generate_keys(private_key2, public_key2);
+
+    static constexpr char data[] = "The quick brown fox jumps over the lazy dog";
+
+    ScopedBIO bio_data(BIO_new_mem_buf(data, sizeof(data) - 1), BIO_free);
+    ASSERT_TRUE(!!bio_data);
+    ScopedBIO bio_sig(BIO_new(BIO_s_mem()), BIO_free);
+    ASSERT_TRUE(!!bio_sig);
+
+    ASSERT_TRUE(sign_data(*bio_data, *bio_sig, *private_key1));
+
+    char *sig_ptr;
+    long sig_size = BIO_get_mem_data(bio_sig.get(), &sig_ptr);
+    std::string sig(sig_ptr, static_cast<size_t>(sig_size));
+
+    auto verify = [&](std::vector<EVP_PKEY *> keys, const std::string &s) {
+        ScopedBIO bio_data_in(BIO_new_mem_buf(data, sizeof(data) - 1),
+                              BIO_free);
+        ScopedBIO bio_sig_in(BIO_new_mem_buf(s.data(),
+                                             static_cast<int>(s.size())),
+                             BIO_free);
+        return verify_data_with_keys(*bio_data_in, *bio_sig_in,
+                                     keys.data(), keys.size());
+    };
+
+    auto ret = verify({public_key2.get(), public_key1.get()}, sig);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(ret.value(), 1u);
+
+    ret = verify({public_key1.get()}, sig);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(ret.value(), 0u);
+
+    ret = verify({public_key2.get()}, sig);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, Error::BadSignature);
+
+    // Corrupt the signature
+    std::string bad_sig = sig;
+    bad_sig.back() ^= 0x01;
+
+    ret = verify({public_key2.get(), public_key1.get()}, bad_sig);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, Error::BadSignature);
+}
+
+TEST(SignTest, TestVerifyBufferWithKeys)
+{
+    ScopedEVP_PKEY private_key1(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key1(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY private_key2(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key2(nullptr, EVP_PKEY_free);
+
+    generate_keys(private_key1, public_key1);
+    generate_keys(private_key2, public_key2);
+
+    static constexpr char data[] = "The quick brown fox jumps over the lazy dog";
+
+    ScopedBIO bio_data(BIO_new_mem_buf(data, sizeof(data) - 1), BIO_free);
+    ASSERT_TRUE(!!bio_data);
+    ScopedBIO bio_sig(BIO_new(BIO_s_mem()), BIO_free);
+    ASSERT_TRUE(!!bio_sig);
+
+    ASSERT_TRUE(sign_data(*bio_data, *bio_sig, *private_key2));
+
+    char *sig_ptr;
+    long sig_size = BIO_get_mem_data(bio_sig.get(), &sig_ptr);
+    std::string sig(sig_ptr, static_cast<size_t>(sig_size));
+
+    std::vector<EVP_PKEY *> keys{public_key1.get(), public_key2.get()};
+
+    auto ret = verify_buffer_with_keys(data, sizeof(data) - 1,
+                                       sig.data(), sig.size(),
+                                       keys.data(), keys.size());
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(ret.value(), 1u);
+
+    // Modified data
+    ret = verify_buffer_with_keys(data, sizeof(data) - 2,
+                                  sig.data(), sig.size(),
+                                  keys.data(), keys.size());
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, Error::BadSignature);
+
+    // Truncated signature
+    ret = verify_buffer_with_keys(data, sizeof(data) - 1, sig.data(), 10,
+                                  keys.data(), keys.size());
+    ASSERT_FALSE(ret);
+
+    // Bad magic
+    std::string bad_sig = sig;
+    bad_sig[0] = 'X';
+
+    ret = verify_buffer_with_keys(data, sizeof(data) - 1,
+                                  bad_sig.data(), bad_sig.size(),
+                                  keys.data(), keys.size());
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error().ec, Error::InvalidSignatureMagic);
+}
+
+TEST(SignTest, TestSignAndVerifyFile)
+{
+    ScopedEVP_PKEY private_key(nullptr, EVP_PKEY_free);
+    ScopedEVP_PKEY public_key(nullptr, EVP_PKEY_free);
+
+    generate_keys(private_key, public_key);
+
+    // Larger than one digest block to exercise the block loop
+    std::string data(5 * 1024 * 1024 + 123, '\0');
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>(i * 31);
+    }
+
+    void *sig_buf = nullptr;
+    size_t sig_size = 0;
+    auto free_sig_buf = mb::finally([&] {
+        free(sig_buf);
+    });
+
+    // Sign from a File that supports direct access
+    {
+        mb::MemoryFile data_file(data.data(), data.size());
+        mb::MemoryFile sig_file(&sig_buf, &sig_size);
+        ASSERT_TRUE(data_file.is_open());
+        ASSERT_TRUE(sig_file.is_open());
+
+        ASSERT_TRUE(sign_data(data_file, sig_file, *private_key));
+    }
+
+    // Verify from a File that has to be read
+    std::string path = testing::TempDir() + "mbsign_test_data";
+    {
+        mb::StandardFile file(path, mb::FileOpenMode::WriteOnly);
+        ASSERT_TRUE(file.is_open());
+        ASSERT_TRUE(mb::file_write_exact(file, data.data(), data.size()));
+    }
+    auto remove_path = mb::finally([&] {
+        remove(path.c_str());
+    });
+
+    {
+        mb::StandardFile data_file(path, mb::FileOpenMode::ReadOnly);
+        mb::MemoryFile sig_file(sig_buf, sig_size);
+        ASSERT_TRUE(data_file.is_open());
+        ASSERT_TRUE(sig_file.is_open());
+
+        ASSERT_TRUE(verify_data(data_file, sig_file, *public_key));
+    }
+
+    // The signature must be compatible with the BIO-based functions
+    {
+        ScopedBIO bio_data(BIO_new_mem_buf(data.data(),
+                                           static_cast<int>(data.size())),
+                           BIO_free);
+        ScopedBIO bio_sig(BIO_new_mem_buf(sig_buf,
+                                          static_cast<int>(sig_size)),
+                          BIO_free);
+
+        ASSERT_TRUE(verify_data(*bio_data, *bio_sig, *public_key));
+    }
+
+    // Modified data
+    data[data.size() / 2] ^= 0x01;
+    {
+        mb::MemoryFile data_file(data.data(), data.size());
+        mb::MemoryFile sig_file(sig_buf, sig_size);
+
+        auto ret = verify_data(data_file, sig_file, *public_key);
+        ASSERT_FALSE(ret);
+        ASSERT_EQ(ret.error().ec, Error::BadSignature);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "mbcommon/executor.h"
+
+namespace mb::sparse::detail
+{
+
+/*! \cond INTERNAL */
+
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size);
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2);
+uint32_t crc32_fill(uint32_t crc, const unsigned char (&pattern)[4],
+                    uint64_t size);
+
+/*!
+ * \brief Computes CRC32 checksums of buffers on the global Executor
+ *
+ * Buffers are obtained with acquire(), filled by the caller, and passed to
+ * submit(). A buffer is recycled once its checksum has been computed. If only
+ * one job is requested, checksums are computed synchronously in submit().
+ */
+class Crc32Pool
+{
+public:
+    Crc32Pool(unsigned int jobs, size_t buf_size);
+
+    std::vector<unsigned char> acquire();
+    void submit(std::vector<unsigned char> buf, size_t size, uint32_t &out);
+    void wait();
+
+private:
+    struct Task
+    {
+        std::vector<unsigned char> buf;
+        size_t size;
+        uint32_t *out;
+        // Destroyed first, so destroying a task waits for it
+        TaskGroup group;
+    };
+
+    size_t m_buf_size;
+    size_t m_max_tasks;
+
+    // Submitted checksums, oldest first
+    std::deque<std::unique_ptr<Task>> m_tasks;
+    std::vector<std::vector<unsigned char>> m_free;
+};
+
+/*! \endcond */
+
+}
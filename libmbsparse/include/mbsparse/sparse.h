@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include <optional>
 #include <vector>
 
 #include "mbcommon/file.h"
@@ -29,6 +30,23 @@
 namespace mb::sparse
 {
 
+enum class SparseChunkType : uint8_t
+{
+    Raw,
+    Fill,
+    DontCare,
+};
+
+struct SparseChunk
+{
+    SparseChunkType type;
+    // Byte range in the output file
+    uint64_t begin;
+    uint64_t end;
+    // [Fill only] 32-bit little-endian value repeated through the chunk
+    uint32_t fill_val;
+};
+
 class MB_EXPORT SparseFile : public File
 {
 public:
@@ -43,9 +61,23 @@ public:
 
     // File open
     oc::result<void> open(File *file);
+    oc::result<void> open(File *file, File *index_file);
 
     // File size
     uint64_t size();
+    uint32_t block_size();
+
+    // Chunk access
+    oc::result<std::optional<SparseChunk>> chunk();
+    oc::result<uint64_t> skip_chunk();
+
+    // Chunk index
+    oc::result<void> build_index();
+    oc::result<void> save_index(File &file);
+
+    // Checksum verification
+    oc::result<void> verify_crc32(unsigned int jobs = 0,
+                                  size_t *failed_chunk = nullptr);
 
 protected:
     oc::result<void> on_open() override;
@@ -75,12 +107,17 @@ private:
     process_chunk(const detail::ChunkHeader &chdr, uint64_t tgt_offset);
 
     oc::result<void> move_to_chunk(uint64_t offset);
+    oc::result<void> seek_src(uint64_t offset);
+
+    oc::result<void> load_index(File &file);
 
     File *m_file;
+    File *m_index_file;
     detail::Seekability m_seekability;
 
-    // Expected CRC32 checksum. We currently do *not* validate this. It would
-    // only work if the entire file was read sequentially anyway.
+    // Expected CRC32 checksum from the last CRC32 chunk. This is only checked
+    // by verify_crc32() since it would otherwise require reading the entire
+    // file sequentially.
     uint32_t m_expected_crc32;
     // Relative offset in input file
     uint64_t m_cur_src_offset;
@@ -42,6 +42,11 @@ enum class SparseFileError
     InvalidFillChunk            = 34,
     InvalidSkipChunk            = 35,
     InvalidCrc32Chunk           = 36,
+    Crc32Mismatch               = 37,
+
+    // Chunk index errors
+    InvalidChunkIndex           = 50,
+    ChunkIndexMismatch          = 51,
 
     InternalError               = 40,
 };
@@ -86,7 +86,11 @@ struct ChunkInfo
     /*! \brief [CHUNK_TYPE_RAW only] End of raw bytes in input file */
     uint64_t raw_end;
 
-    /*! \brief [CHUNK_TYPE_FILL only] Filler value for the chunk */
+    /*!
+     * \brief [CHUNK_TYPE_FILL] Filler value for the chunk
+     *
+     * [CHUNK_TYPE_CRC32] Expected checksum of all data preceding the chunk
+     */
     uint32_t fill_val;
 };
 
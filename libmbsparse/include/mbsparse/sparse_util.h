@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include "mbcommon/file.h"
+#include "mbcommon/flags.h"
+
+#include "mbsparse/sparse.h"
+
+namespace mb::sparse
+{
+
+enum class SparseCopyFlag : uint8_t
+{
+    // The output is already zeroed (eg. a newly created file), so zero fill
+    // chunks can be skipped
+    OutputIsZeroed  = 1 << 0,
+    // Compare the data against the existing output data and only write the
+    // blocks that differ
+    SkipUnchanged   = 1 << 1,
+};
+MB_DECLARE_FLAGS(SparseCopyFlags, SparseCopyFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(SparseCopyFlags)
+
+using SparseCopyProgressCallback =
+        std::function<void(uint64_t bytes, uint64_t total)>;
+
+MB_EXPORT oc::result<uint64_t>
+sparse_copy(SparseFile &input, File &output, SparseCopyFlags flags = {},
+            const SparseCopyProgressCallback &progress_cb = nullptr);
+
+MB_EXPORT oc::result<uint64_t>
+sparse_diff(SparseFile &input, File &target, File &delta,
+            const SparseCopyProgressCallback &progress_cb = nullptr);
+
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "mbcommon/file.h"
+#include "mbcommon/flags.h"
+
+namespace mb::sparse
+{
+
+enum class SparseWriterFlag : uint8_t
+{
+    DontCareZeroBlocks  = 1 << 0,
+    WriteCrc32          = 1 << 1,
+};
+MB_DECLARE_FLAGS(SparseWriterFlags, SparseWriterFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(SparseWriterFlags)
+
+class MB_EXPORT SparseWriter : public File
+{
+public:
+    static constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+
+    SparseWriter();
+    SparseWriter(File *file, SparseWriterFlags flags = {},
+                 uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    virtual ~SparseWriter();
+
+    SparseWriter(SparseWriter &&other) noexcept;
+    SparseWriter & operator=(SparseWriter &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(SparseWriter)
+
+    // File open
+    oc::result<void> open(File *file, SparseWriterFlags flags = {},
+                          uint32_t block_size = DEFAULT_BLOCK_SIZE);
+
+    // Unknown data
+    oc::result<void> skip_blocks(uint32_t blocks);
+
+    // Statistics
+    uint32_t total_blocks() const;
+    uint32_t total_chunks() const;
+
+protected:
+    oc::result<void> on_open() override;
+    oc::result<void> on_close() override;
+    oc::result<size_t> on_write(const void *buf, size_t size) override;
+
+private:
+    /*! \cond INTERNAL */
+    void clear();
+
+    oc::result<void> wwrite(const void *buf, size_t size);
+
+    oc::result<void> process_block(const unsigned char *data);
+    oc::result<void> flush_chunk();
+    oc::result<void> write_chunk_header(uint16_t type, uint32_t blocks,
+                                        uint32_t data_size);
+    oc::result<void> write_sparse_header();
+
+    File *m_file;
+    SparseWriterFlags m_flags;
+    uint32_t m_block_size;
+
+    // Position of the sparse header in the output file
+    uint64_t m_header_offset;
+
+    uint32_t m_crc32;
+    uint32_t m_total_blocks;
+    uint32_t m_total_chunks;
+
+    // Partially filled block
+    std::vector<unsigned char> m_block;
+    size_t m_block_used;
+
+    // Pending chunk that will be extended for as long as the following blocks
+    // are of the same type
+    uint16_t m_chunk_type;
+    uint32_t m_chunk_blocks;
+    unsigned char m_chunk_fill[4];
+    std::vector<unsigned char> m_chunk_data;
+    /*! \endcond */
+};
+
+}
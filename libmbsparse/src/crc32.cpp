@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/crc32_p.h"
+
+#include <algorithm>
+#include <array>
+
+#include <cstring>
+
+#if defined(__ARM_FEATURE_CRC32)
+#  include <arm_acle.h>
+#endif
+
+#include "mbcommon/resource_budget.h"
+
+namespace mb::sparse::detail
+{
+
+/*! \cond INTERNAL */
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+// Tables for the slicing-by-8 algorithm
+static constexpr Crc32Tables make_crc32_tables()
+{
+    Crc32Tables tables{};
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int j = 0; j < 8; ++j) {
+            c = (c & 1) ? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+        }
+        tables[0][i] = c;
+    }
+
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t t = 1; t < tables.size(); ++t) {
+            uint32_t prev = tables[t - 1][i];
+            tables[t][i] = tables[0][prev & 0xff] ^ (prev >> 8);
+        }
+    }
+
+    return tables;
+}
+
+static constexpr Crc32Tables CRC32_TABLES = make_crc32_tables();
+
+/*! \endcond */
+
+/*!
+ * \brief Update CRC32 (IEEE 802.3) checksum
+ *
+ * Uses the ARMv8 CRC32 instructions if they are enabled at compile time and the
+ * slicing-by-8 algorithm otherwise.
+ *
+ * \param crc Checksum of the preceding data (0 for the beginning of the data)
+ * \param data Data
+ * \param size Size of data
+ *
+ * \return Checksum of the preceding data and \p data
+ */
+uint32_t crc32_update(uint32_t crc, const void *data, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(data);
+
+    crc = ~crc;
+
+#if defined(__ARM_FEATURE_CRC32)
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, ptr, sizeof(word));
+        crc = __crc32d(crc, word);
+        ptr += sizeof(word);
+    }
+#else
+    for (; size >= 8; size -= 8) {
+        uint32_t lo = crc ^ (static_cast<uint32_t>(ptr[0])
+                | static_cast<uint32_t>(ptr[1]) << 8
+                | static_cast<uint32_t>(ptr[2]) << 16
+                | static_cast<uint32_t>(ptr[3]) << 24);
+
+        crc = CRC32_TABLES[7][lo & 0xff]
+                ^ CRC32_TABLES[6][(lo >> 8) & 0xff]
+                ^ CRC32_TABLES[5][(lo >> 16) & 0xff]
+                ^ CRC32_TABLES[4][lo >> 24]
+                ^ CRC32_TABLES[3][ptr[4]]
+                ^ CRC32_TABLES[2][ptr[5]]
+                ^ CRC32_TABLES[1][ptr[6]]
+                ^ CRC32_TABLES[0][ptr[7]];
+        ptr += 8;
+    }
+#endif
+
+    for (; size > 0; --size) {
+        crc = CRC32_TABLES[0][(crc ^ *ptr++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, ++mat) {
+        if (vec & 1) {
+            sum ^= *mat;
+        }
+    }
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; ++n) {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+/*!
+ * \brief Combine the checksums of two consecutive pieces of data
+ *
+ * \param crc1 Checksum of the first piece
+ * \param crc2 Checksum of the second piece
+ * \param size2 Size of the second piece
+ *
+ * \return Checksum of both pieces concatenated
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t size2)
+{
+    if (size2 == 0) {
+        return crc1;
+    }
+
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    // Operator for one zero bit
+    odd[0] = 0xedb88320u;
+    uint32_t row = 1;
+    for (int n = 1; n < 32; ++n) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    // Operators for two and four zero bits
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    // Apply size2 zero bytes to crc1
+    do {
+        gf2_matrix_square(even, odd);
+        if (size2 & 1) {
+            crc1 = gf2_matrix_times(even, crc1);
+        }
+        size2 >>= 1;
+
+        if (size2 == 0) {
+            break;
+        }
+
+        gf2_matrix_square(odd, even);
+        if (size2 & 1) {
+            crc1 = gf2_matrix_times(odd, crc1);
+        }
+        size2 >>= 1;
+    } while (size2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+/*!
+ * \brief Update CRC32 checksum with a repeating 4-byte pattern
+ *
+ * This takes O(log(size)) time, so huge fill chunks are cheap to account for.
+ *
+ * \param crc Checksum of the preceding data
+ * \param pattern Pattern bytes
+ * \param size Number of bytes of the repeated pattern
+ *
+ * \return Checksum of the preceding data and the pattern
+ */
+uint32_t crc32_fill(uint32_t crc, const unsigned char (&pattern)[4],
+                    uint64_t size)
+{
+    uint64_t count = size / sizeof(pattern);
+    uint32_t unit_crc = crc32_update(0, pattern, sizeof(pattern));
+    uint64_t unit_size = sizeof(pattern);
+    uint32_t fill_crc = 0;
+
+    // Repeating the same pattern is commutative, so build the checksum of
+    // `count` repetitions from powers of two
+    while (count > 0) {
+        if (count & 1) {
+            fill_crc = crc32_combine(fill_crc, unit_crc, unit_size);
+        }
+        count >>= 1;
+
+        if (count > 0) {
+            unit_crc = crc32_combine(unit_crc, unit_crc, unit_size);
+            unit_size *= 2;
+        }
+    }
+
+    crc = crc32_combine(crc, fill_crc, size - size % sizeof(pattern));
+
+    return crc32_update(crc, pattern, static_cast<size_t>(size % sizeof(pattern)));
+}
+
+Crc32Pool::Crc32Pool(unsigned int jobs, size_t buf_size)
+    : m_buf_size(buf_size)
+    , m_max_tasks(jobs > 1 ? ResourceBudget::global().buffer_count(
+            buf_size, jobs * 2) : 0)
+{
+}
+
+/*!
+ * \brief Get a buffer to fill
+ *
+ * If all buffers are in use, waits for the oldest checksum to be computed.
+ */
+std::vector<unsigned char> Crc32Pool::acquire()
+{
+    if (!m_free.empty()) {
+        auto buf = std::move(m_free.back());
+        m_free.pop_back();
+        return buf;
+    } else if (m_tasks.size() < std::max<size_t>(m_max_tasks, 1)) {
+        return std::vector<unsigned char>(m_buf_size);
+    }
+
+    auto task = std::move(m_tasks.front());
+    m_tasks.pop_front();
+
+    task->group.wait();
+
+    return std::move(task->buf);
+}
+
+/*!
+ * \brief Compute the checksum of the first \p size bytes of \p buf
+ *
+ * The result is written to \p out, which must remain valid until wait()
+ * returns.
+ */
+void Crc32Pool::submit(std::vector<unsigned char> buf, size_t size,
+                       uint32_t &out)
+{
+    if (m_max_tasks == 0) {
+        out = crc32_update(0, buf.data(), size);
+        m_free.push_back(std::move(buf));
+        return;
+    }
+
+    auto &task = *m_tasks.emplace_back(std::make_unique<Task>());
+    task.buf = std::move(buf);
+    task.size = size;
+    task.out = &out;
+
+    task.group.run([&task] {
+        *task.out = crc32_update(0, task.buf.data(), task.size);
+    });
+}
+
+/*!
+ * \brief Wait for all submitted checksums to be computed
+ */
+void Crc32Pool::wait()
+{
+    for (auto &task : m_tasks) {
+        task->group.wait();
+        m_free.push_back(std::move(task->buf));
+    }
+
+    m_tasks.clear();
+}
+
+}
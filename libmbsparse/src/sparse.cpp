@@ -22,6 +22,7 @@
 
 // For std::min()
 #include <algorithm>
+#include <deque>
 #include <iterator>
 #include <vector>
 
@@ -32,9 +33,11 @@
 
 #include "mbcommon/algorithm.h"
 #include "mbcommon/endian.h"
+#include "mbcommon/executor.h"
 #include "mbcommon/file_util.h"
 #include "mbcommon/string.h"
 
+#include "mbsparse/crc32_p.h"
 #include "mbsparse/sparse_error.h"
 
 // Enable debug logging of headers, offsets, etc.?
@@ -85,6 +88,41 @@ static void fix_chunk_header_byte_order(ChunkHeader &header)
     header.total_sz = mb_le32toh(header.total_sz);
 }
 
+/*! \cond INTERNAL */
+
+constexpr unsigned char CHUNK_INDEX_MAGIC[] = {
+    'M', 'B', 'S', 'P', 'I', 'D', 'X', '1'
+};
+constexpr size_t CHUNK_INDEX_HEADER_SIZE = sizeof(CHUNK_INDEX_MAGIC) + 28 + 4;
+constexpr size_t CHUNK_INDEX_ENTRY_SIZE = 2 + 2 + 4 + 6 * 8;
+// Number of index entries to read at a time
+constexpr size_t CHUNK_INDEX_BATCH_SIZE = 1024;
+
+// Amount of raw data checksummed by a single CRC32 task
+constexpr size_t MAX_CRC32_SEGMENT_SIZE = 1024 * 1024;
+
+/*! \endcond */
+
+static void append_le(std::vector<unsigned char> &buf, uint64_t value,
+                      size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        buf.push_back(static_cast<unsigned char>(value >> (i * 8)));
+    }
+}
+
+static uint64_t consume_le(const unsigned char *&ptr, size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < size; ++i) {
+        value |= static_cast<uint64_t>(ptr[i]) << (i * 8);
+    }
+
+    ptr += size;
+    return value;
+}
+
 #if SPARSE_DEBUG
 static void dump_sparse_header(const SparseHeader &header)
 {
@@ -186,6 +224,7 @@ SparseFile::~SparseFile()
 SparseFile::SparseFile(SparseFile &&other) noexcept
     : File(std::move(other))
     , m_file(other.m_file)
+    , m_index_file(other.m_index_file)
     , m_seekability(other.m_seekability)
     , m_expected_crc32(other.m_expected_crc32)
     , m_cur_src_offset(other.m_cur_src_offset)
@@ -205,6 +244,7 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
     File::operator=(std::move(rhs));
 
     m_file = rhs.m_file;
+    m_index_file = rhs.m_index_file;
     m_seekability = rhs.m_seekability;
     m_expected_crc32 = rhs.m_expected_crc32;
     m_cur_src_offset = rhs.m_cur_src_offset;
@@ -234,9 +274,39 @@ SparseFile & SparseFile::operator=(SparseFile &&rhs) noexcept
  *         code.
  */
 oc::result<void> SparseFile::open(File *file)
+{
+    return open(file, nullptr);
+}
+
+/*!
+ * \brief Open sparse file from File handle with a saved chunk index.
+ *
+ * This behaves like open(File *), except that the chunk headers are loaded
+ * from an index previously written by save_index() instead of being read from
+ * the sparse file. This avoids walking every chunk header of large sparse
+ * files when seeking.
+ *
+ * The index is checked against the sparse header and for internal consistency,
+ * but it is up to the caller to make sure that it was generated from the same
+ * sparse file.
+ *
+ * \note Neither \p file nor \p index_file are owned by the SparseFile.
+ *       \p index_file is only used while opening the file and may be closed
+ *       afterwards.
+ *
+ * \param file File to open
+ * \param index_file Chunk index to load or nullptr to read the chunk headers
+ *                   on demand. The index is only supported if \p file supports
+ *                   random seeking.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseFile::open(File *file, File *index_file)
 {
     if (state() == FileState::New) {
         m_file = file;
+        m_index_file = index_file;
     }
 
     return File::open();
@@ -253,6 +323,292 @@ uint64_t SparseFile::size()
     return m_file_size;
 }
 
+/*!
+ * \brief Get the block size of the sparse file
+ *
+ * \return Block size from the sparse header. The return value is undefined if
+ *         the sparse file is not opened.
+ */
+uint32_t SparseFile::block_size()
+{
+    return m_shdr.blk_sz;
+}
+
+/*!
+ * \brief Get the chunk at the current file position
+ *
+ * This allows callers to handle chunks without data specially. For example,
+ * a "don't care" chunk can be skipped with skip_chunk() instead of reading its
+ * zeros with read(). The file position may be anywhere inside the chunk.
+ *
+ * \return The chunk containing the current position, std::nullopt if the end of
+ *         the file has been reached, or the error code if the chunk header
+ *         could not be read.
+ */
+oc::result<std::optional<SparseChunk>> SparseFile::chunk()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk == m_chunks.end()) {
+        return std::nullopt;
+    }
+
+    SparseChunk chunk{};
+    chunk.begin = m_chunk->begin;
+    chunk.end = m_chunk->end;
+
+    switch (m_chunk->type) {
+    case CHUNK_TYPE_RAW:
+        chunk.type = SparseChunkType::Raw;
+        break;
+    case CHUNK_TYPE_FILL:
+        chunk.type = SparseChunkType::Fill;
+        chunk.fill_val = mb_le32toh(m_chunk->fill_val);
+        break;
+    case CHUNK_TYPE_DONT_CARE:
+        chunk.type = SparseChunkType::DontCare;
+        break;
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %" PRIu16, m_chunk->type);
+    }
+
+    return chunk;
+}
+
+/*!
+ * \brief Move the file position to the end of the current chunk
+ *
+ * Unlike seek(), this works with underlying files that do not support random
+ * seeking. Skipping a chunk never reads its data. If the chunk is a raw chunk,
+ * the data is skipped when the next chunk header is read.
+ *
+ * \return New file position or the error code if the chunk header could not be
+ *         read. If the end of the file has been reached, the position is not
+ *         changed.
+ */
+oc::result<uint64_t> SparseFile::skip_chunk()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    }
+
+    OUTCOME_TRYV(move_to_chunk(m_cur_tgt_offset));
+
+    if (m_chunk != m_chunks.end()) {
+        m_cur_tgt_offset = m_chunk->end;
+    }
+
+    return m_cur_tgt_offset;
+}
+
+/*!
+ * \brief Read all remaining chunk headers
+ *
+ * By default, chunk headers are only read when a read or seek reaches them.
+ * This function reads all of them at once so that later seeks only need to do
+ * a binary search over the chunk index.
+ *
+ * \note The underlying file must support random seeking.
+ *
+ * \return Nothing if all chunk headers were read. Otherwise, the error code.
+ */
+oc::result<void> SparseFile::build_index()
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (m_seekability != Seekability::CanSeek) {
+        return FileError::UnsupportedSeek;
+    }
+
+    // No chunk contains the end of the file, so this reads every chunk header
+    return move_to_chunk(m_file_size);
+}
+
+/*!
+ * \brief Write the chunk index to a file
+ *
+ * The index can be passed to open(File *, File *) to reopen the sparse file
+ * without reading its chunk headers. If the index is not complete,
+ * build_index() is called first.
+ *
+ * \param file File to write the index to
+ *
+ * \return Nothing if the index was successfully written. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseFile::save_index(File &file)
+{
+    OUTCOME_TRYV(build_index());
+
+    std::vector<unsigned char> buf;
+    buf.reserve(CHUNK_INDEX_HEADER_SIZE
+            + m_chunks.size() * CHUNK_INDEX_ENTRY_SIZE);
+
+    buf.insert(buf.end(), std::begin(CHUNK_INDEX_MAGIC),
+               std::end(CHUNK_INDEX_MAGIC));
+    append_le(buf, m_shdr.magic, 4);
+    append_le(buf, m_shdr.major_version, 2);
+    append_le(buf, m_shdr.minor_version, 2);
+    append_le(buf, m_shdr.file_hdr_sz, 2);
+    append_le(buf, m_shdr.chunk_hdr_sz, 2);
+    append_le(buf, m_shdr.blk_sz, 4);
+    append_le(buf, m_shdr.total_blks, 4);
+    append_le(buf, m_shdr.total_chunks, 4);
+    append_le(buf, m_shdr.image_checksum, 4);
+    append_le(buf, m_chunks.size(), 4);
+
+    for (auto const &ci : m_chunks) {
+        append_le(buf, ci.type, 2);
+        append_le(buf, 0, 2);
+        append_le(buf, ci.fill_val, 4);
+        append_le(buf, ci.begin, 8);
+        append_le(buf, ci.end, 8);
+        append_le(buf, ci.src_begin, 8);
+        append_le(buf, ci.src_end, 8);
+        append_le(buf, ci.raw_begin, 8);
+        append_le(buf, ci.raw_end, 8);
+    }
+
+    return file_write_exact(file, buf.data(), buf.size());
+}
+
+/*!
+ * \brief Verify the CRC32 checksums stored in the sparse file
+ *
+ * Every CRC32 chunk is checked against the data preceding it and, if it is
+ * nonzero, the image checksum in the sparse header is checked against the
+ * complete data. "Don't care" chunks count as zeros. Raw data is checksummed on
+ * \p jobs threads and the partial checksums are combined afterwards, so the
+ * input file is still read sequentially.
+ *
+ * This does not change the position of the sparse file.
+ *
+ * \note The underlying file must support random seeking.
+ *
+ * \param jobs Number of tasks to use for checksumming raw data. If 0, the
+ *             concurrency of the global Executor is used.
+ * \param[out] failed_chunk If not null and a checksum does not match, set to
+ *                         the index of the CRC32 chunk that failed or to the
+ *                         total number of chunks if the header checksum failed
+ *
+ * \return
+ *   * Nothing if all checksums match
+ *   * SparseFileError::Crc32Mismatch if a checksum does not match
+ *   * Otherwise, a specific error code
+ */
+oc::result<void> SparseFile::verify_crc32(unsigned int jobs,
+                                          size_t *failed_chunk)
+{
+    OUTCOME_TRYV(build_index());
+
+    if (jobs == 0) {
+        jobs = Executor::global().concurrency();
+    }
+
+    struct Segment
+    {
+        uint32_t crc;
+        uint64_t size;
+    };
+
+    struct Checkpoint
+    {
+        size_t chunk;
+        size_t segments;
+        uint32_t expected;
+    };
+
+    // Addresses of the segments must be stable while the pool is running
+    std::deque<Segment> segments;
+    std::vector<Checkpoint> checkpoints;
+
+    {
+        Crc32Pool pool(jobs, MAX_CRC32_SEGMENT_SIZE);
+
+        for (size_t i = 0; i < m_chunks.size(); ++i) {
+            auto const &ci = m_chunks[i];
+
+            switch (ci.type) {
+            case CHUNK_TYPE_RAW: {
+                OUTCOME_TRYV(seek_src(ci.raw_begin));
+
+                for (uint64_t remain = ci.raw_end - ci.raw_begin;
+                        remain > 0;) {
+                    auto n = static_cast<size_t>(std::min<uint64_t>(
+                            remain, MAX_CRC32_SEGMENT_SIZE));
+                    auto buf = pool.acquire();
+
+                    OUTCOME_TRYV(wread(buf.data(), n));
+
+                    auto &segment = segments.emplace_back();
+                    segment.size = n;
+                    pool.submit(std::move(buf), n, segment.crc);
+
+                    remain -= n;
+                }
+                break;
+            }
+            case CHUNK_TYPE_FILL:
+            case CHUNK_TYPE_DONT_CARE: {
+                unsigned char pattern[4] = {};
+                if (ci.type == CHUNK_TYPE_FILL) {
+                    uint32_t fill_val = mb_htole32(ci.fill_val);
+                    memcpy(pattern, &fill_val, sizeof(pattern));
+                }
+
+                auto size = ci.end - ci.begin;
+                segments.push_back({crc32_fill(0, pattern, size), size});
+                break;
+            }
+            case CHUNK_TYPE_CRC32:
+                checkpoints.push_back({i, segments.size(), ci.fill_val});
+                break;
+            default:
+                MB_UNREACHABLE("Invalid chunk type: %" PRIu16, ci.type);
+            }
+        }
+
+        pool.wait();
+    }
+
+    uint32_t crc = 0;
+    auto checkpoint = checkpoints.begin();
+
+    for (size_t i = 0; i <= segments.size(); ++i) {
+        for (; checkpoint != checkpoints.end() && checkpoint->segments == i;
+                ++checkpoint) {
+            if (crc != checkpoint->expected) {
+                DEBUG("CRC32 chunk %" MB_PRIzu ": expected 0x%08" PRIx32
+                      ", but have 0x%08" PRIx32,
+                      checkpoint->chunk, checkpoint->expected, crc);
+                if (failed_chunk) {
+                    *failed_chunk = checkpoint->chunk;
+                }
+                return SparseFileError::Crc32Mismatch;
+            }
+        }
+
+        if (i < segments.size()) {
+            crc = crc32_combine(crc, segments[i].crc, segments[i].size);
+        }
+    }
+
+    if (m_shdr.image_checksum != 0 && crc != m_shdr.image_checksum) {
+        DEBUG("Image checksum: expected 0x%08" PRIx32 ", but have 0x%08" PRIx32,
+              m_shdr.image_checksum, crc);
+        if (failed_chunk) {
+            *failed_chunk = m_chunks.size();
+        }
+        return SparseFileError::Crc32Mismatch;
+    }
+
+    return oc::success();
+}
+
 /*!
  * \brief Open sparse file for reading
  *
@@ -324,7 +680,21 @@ oc::result<void> SparseFile::on_open()
         return seek_ret.as_failure();
     }
 
-    return process_sparse_header(&first_byte, n);
+    OUTCOME_TRYV(process_sparse_header(&first_byte, n));
+
+    if (m_index_file) {
+        File *index_file = m_index_file;
+        m_index_file = nullptr;
+
+        if (m_seekability != Seekability::CanSeek) {
+            DEBUG("Chunk index requires a seekable file");
+            return FileError::UnsupportedSeek;
+        }
+
+        OUTCOME_TRYV(load_index(*index_file));
+    }
+
+    return oc::success();
 }
 
 /*!
@@ -399,17 +769,7 @@ oc::result<size_t> SparseFile::on_read(void *buf, size_t size)
             uint64_t raw_src_offset = m_chunk->raw_begin + diff;
             if (raw_src_offset != m_cur_src_offset) {
                 assert(m_seekability == Seekability::CanSeek);
-
-                int64_t seek_offset;
-                if (raw_src_offset < m_cur_src_offset) {
-                    seek_offset = -static_cast<int64_t>(
-                            m_cur_src_offset - raw_src_offset);
-                } else {
-                    seek_offset = static_cast<int64_t>(
-                            raw_src_offset - m_cur_src_offset);
-                }
-
-                OUTCOME_TRYV(wseek(seek_offset));
+                OUTCOME_TRYV(seek_src(raw_src_offset));
             }
 
             OUTCOME_TRYV(wread(buf, static_cast<size_t>(to_read)));
@@ -463,6 +823,7 @@ oc::result<size_t> SparseFile::on_read(void *buf, size_t size)
  * \a lseek() in `\<stdio.h\>`.
  *
  * \note Seeking will only work if the underlying file handle supports seeking.
+ *       Querying the current position with `seek(0, SEEK_CUR)` always works.
  *
  * \param offset Offset to seek
  * \param whence \a SEEK_SET, \a SEEK_CUR, or \a SEEK_END
@@ -474,6 +835,11 @@ oc::result<uint64_t> SparseFile::on_seek(int64_t offset, int whence)
 {
     OPER("seek(%" PRId64 ", %d)", offset, whence);
 
+    // Querying the position never needs the underlying file to seek
+    if (offset == 0 && whence == SEEK_CUR) {
+        return m_cur_tgt_offset;
+    }
+
     if (m_seekability != Seekability::CanSeek) {
         DEBUG("Underlying file does not support seeking");
         return FileError::UnsupportedSeek;
@@ -521,6 +887,7 @@ oc::result<uint64_t> SparseFile::on_seek(int64_t offset, int whence)
 void SparseFile::clear()
 {
     m_file = nullptr;
+    m_index_file = nullptr;
     m_expected_crc32 = 0;
     m_cur_src_offset = 0;
     m_cur_tgt_offset = 0;
@@ -550,6 +917,24 @@ oc::result<void> SparseFile::wseek(int64_t offset)
     return oc::success();
 }
 
+/*!
+ * \brief Seek to an absolute offset in the input file
+ *
+ * \pre The input file must support random seeking
+ *
+ * \param offset Offset relative to the beginning of the sparse data
+ *
+ * \return Nothing if the seek was successful. Otherwise, the error code.
+ */
+oc::result<void> SparseFile::seek_src(uint64_t offset)
+{
+    if (offset < m_cur_src_offset) {
+        return wseek(-static_cast<int64_t>(m_cur_src_offset - offset));
+    } else {
+        return wseek(static_cast<int64_t>(offset - m_cur_src_offset));
+    }
+}
+
 /*!
  * \brief Skip a certain amount of bytes
  *
@@ -685,7 +1070,7 @@ SparseFile::process_raw_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidRawChunk;
     }
 
-    ChunkInfo ci;
+    ChunkInfo ci{};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
@@ -728,7 +1113,7 @@ SparseFile::process_fill_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
 
     uint64_t src_end = m_cur_src_offset;
 
-    ChunkInfo ci;
+    ChunkInfo ci{};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
@@ -762,7 +1147,7 @@ SparseFile::process_skip_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidSkipChunk;
     }
 
-    ChunkInfo ci;
+    ChunkInfo ci{};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
@@ -802,17 +1187,22 @@ SparseFile::process_crc32_chunk(const ChunkHeader &chdr, uint64_t tgt_offset)
         return SparseFileError::InvalidCrc32Chunk;
     }
 
+    uint64_t src_begin = m_cur_src_offset - m_shdr.chunk_hdr_sz;
+
     OUTCOME_TRYV(wread(&crc32, sizeof(crc32)));
 
+    uint64_t src_end = m_cur_src_offset;
+
     m_expected_crc32 = mb_le32toh(crc32);
 
-    ChunkInfo ci;
+    ChunkInfo ci{};
 
     ci.type = chdr.chunk_type;
     ci.begin = tgt_offset;
     ci.end = tgt_offset;
-    ci.src_begin = tgt_offset - m_shdr.chunk_hdr_sz;
-    ci.src_end = tgt_offset + data_size;
+    ci.src_begin = src_begin;
+    ci.src_end = src_end;
+    ci.fill_val = m_expected_crc32;
 
     return std::move(ci);
 }
@@ -999,4 +1389,141 @@ oc::result<void> SparseFile::move_to_chunk(uint64_t offset)
     return oc::success();
 }
 
+/*!
+ * \brief Load chunk index written by save_index()
+ *
+ * \param file File to read the index from
+ *
+ * \return Nothing if the index is valid and matches the sparse header.
+ *         Otherwise, the error code.
+ */
+oc::result<void> SparseFile::load_index(File &file)
+{
+    unsigned char header[CHUNK_INDEX_HEADER_SIZE];
+
+    auto ret = file_read_exact(file, header, sizeof(header));
+    if (!ret) {
+        if (ret.error() == FileError::UnexpectedEof) {
+            return SparseFileError::InvalidChunkIndex;
+        }
+        return ret.as_failure();
+    }
+
+    if (memcmp(header, CHUNK_INDEX_MAGIC, sizeof(CHUNK_INDEX_MAGIC)) != 0) {
+        DEBUG("Invalid chunk index magic");
+        return SparseFileError::InvalidChunkIndex;
+    }
+
+    const unsigned char *ptr = header + sizeof(CHUNK_INDEX_MAGIC);
+    SparseHeader shdr;
+
+    shdr.magic = static_cast<uint32_t>(consume_le(ptr, 4));
+    shdr.major_version = static_cast<uint16_t>(consume_le(ptr, 2));
+    shdr.minor_version = static_cast<uint16_t>(consume_le(ptr, 2));
+    shdr.file_hdr_sz = static_cast<uint16_t>(consume_le(ptr, 2));
+    shdr.chunk_hdr_sz = static_cast<uint16_t>(consume_le(ptr, 2));
+    shdr.blk_sz = static_cast<uint32_t>(consume_le(ptr, 4));
+    shdr.total_blks = static_cast<uint32_t>(consume_le(ptr, 4));
+    shdr.total_chunks = static_cast<uint32_t>(consume_le(ptr, 4));
+    shdr.image_checksum = static_cast<uint32_t>(consume_le(ptr, 4));
+    auto count = static_cast<uint32_t>(consume_le(ptr, 4));
+
+    if (shdr.magic != m_shdr.magic
+            || shdr.major_version != m_shdr.major_version
+            || shdr.minor_version != m_shdr.minor_version
+            || shdr.file_hdr_sz != m_shdr.file_hdr_sz
+            || shdr.chunk_hdr_sz != m_shdr.chunk_hdr_sz
+            || shdr.blk_sz != m_shdr.blk_sz
+            || shdr.total_blks != m_shdr.total_blks
+            || shdr.total_chunks != m_shdr.total_chunks
+            || shdr.image_checksum != m_shdr.image_checksum
+            || count != m_shdr.total_chunks) {
+        DEBUG("Chunk index does not match sparse header");
+        return SparseFileError::ChunkIndexMismatch;
+    }
+
+    std::vector<ChunkInfo> chunks;
+    chunks.reserve(count);
+
+    std::vector<unsigned char> buf;
+    uint64_t src_offset = m_shdr.file_hdr_sz;
+    uint64_t tgt_offset = 0;
+
+    while (chunks.size() < count) {
+        size_t n = std::min<size_t>(count - chunks.size(),
+                                    CHUNK_INDEX_BATCH_SIZE);
+        buf.resize(n * CHUNK_INDEX_ENTRY_SIZE);
+
+        ret = file_read_exact(file, buf.data(), buf.size());
+        if (!ret) {
+            if (ret.error() == FileError::UnexpectedEof) {
+                return SparseFileError::InvalidChunkIndex;
+            }
+            return ret.as_failure();
+        }
+
+        ptr = buf.data();
+
+        for (size_t i = 0; i < n; ++i) {
+            ChunkInfo ci{};
+
+            ci.type = static_cast<uint16_t>(consume_le(ptr, 2));
+            consume_le(ptr, 2);
+            ci.fill_val = static_cast<uint32_t>(consume_le(ptr, 4));
+            ci.begin = consume_le(ptr, 8);
+            ci.end = consume_le(ptr, 8);
+            ci.src_begin = consume_le(ptr, 8);
+            ci.src_end = consume_le(ptr, 8);
+            ci.raw_begin = consume_le(ptr, 8);
+            ci.raw_end = consume_le(ptr, 8);
+
+            // Chunks must be contiguous in both the source and output files
+            if (ci.begin != tgt_offset || ci.end < ci.begin
+                    || ci.end > m_file_size
+                    || ci.src_begin != src_offset
+                    || ci.src_end < ci.src_begin + m_shdr.chunk_hdr_sz) {
+                DEBUG("Chunk #%" MB_PRIzu " in index has invalid bounds",
+                      chunks.size());
+                return SparseFileError::InvalidChunkIndex;
+            }
+
+            switch (ci.type) {
+            case CHUNK_TYPE_RAW:
+                if (ci.raw_begin != ci.src_begin + m_shdr.chunk_hdr_sz
+                        || ci.raw_end != ci.src_end
+                        || ci.raw_end - ci.raw_begin != ci.end - ci.begin) {
+                    return SparseFileError::InvalidChunkIndex;
+                }
+                break;
+            case CHUNK_TYPE_FILL:
+            case CHUNK_TYPE_DONT_CARE:
+                break;
+            case CHUNK_TYPE_CRC32:
+                if (ci.end != ci.begin) {
+                    return SparseFileError::InvalidChunkIndex;
+                }
+                break;
+            default:
+                DEBUG("Unknown chunk type in index: %u", ci.type);
+                return SparseFileError::InvalidChunkIndex;
+            }
+
+            src_offset = ci.src_end;
+            tgt_offset = ci.end;
+
+            chunks.push_back(ci);
+        }
+    }
+
+    if (!chunks.empty() && chunks.back().end != m_file_size) {
+        DEBUG("Last chunk in index does not end at the file size");
+        return SparseFileError::ChunkIndexMismatch;
+    }
+
+    m_chunks = std::move(chunks);
+    m_chunk = m_chunks.end();
+
+    return oc::success();
+}
+
 }
@@ -61,6 +61,12 @@ std::string SparseFileErrorCategory::message(int ev) const
         return "invalid 'skip' chunk";
     case SparseFileError::InvalidCrc32Chunk:
         return "invalid 'crc32' chunk";
+    case SparseFileError::Crc32Mismatch:
+        return "CRC32 checksum does not match data";
+    case SparseFileError::InvalidChunkIndex:
+        return "invalid chunk index";
+    case SparseFileError::ChunkIndexMismatch:
+        return "chunk index does not match sparse file";
     case SparseFileError::InternalError:
         return "(internal error)";
     default:
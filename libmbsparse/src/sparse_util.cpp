@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_util.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <cstring>
+
+#ifdef __linux__
+#  include <fcntl.h>
+#  include <linux/falloc.h>
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#  include <sys/stat.h>
+#endif
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+
+#include "mbsparse/sparse_writer.h"
+
+namespace mb::sparse
+{
+
+/*! \cond INTERNAL */
+
+constexpr size_t COPY_BUFFER_SIZE = 256 * 1024;
+
+/*! \endcond */
+
+/*!
+ * \brief Zero a range of the output without writing the zeros
+ *
+ * Block devices are zeroed with BLKZEROOUT and regular files have a hole
+ * punched in them.
+ *
+ * \return Whether the range was zeroed
+ */
+static bool zero_range(File &output, uint64_t offset, uint64_t size)
+{
+#if defined(__linux__) && (!defined(__ANDROID__) || __ANDROID_API__ >= 21)
+    auto fd = output.native_fd();
+    if (!fd) {
+        return false;
+    }
+
+    struct stat sb;
+    if (fstat(fd.value(), &sb) < 0) {
+        return false;
+    }
+
+    if (S_ISBLK(sb.st_mode)) {
+        uint64_t range[2] = { offset, size };
+        return ioctl(fd.value(), BLKZEROOUT, &range) == 0;
+    } else if (S_ISREG(sb.st_mode)) {
+        if (offset > INT64_MAX || size > INT64_MAX - offset) {
+            return false;
+        }
+
+        return fallocate64(fd.value(),
+                           FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                           static_cast<off64_t>(offset),
+                           static_cast<off64_t>(size)) == 0;
+    }
+
+    return false;
+#else
+    (void) output;
+    (void) offset;
+    (void) size;
+    return false;
+#endif
+}
+
+/*!
+ * \brief Move the output position forward without writing
+ *
+ * \return Whether the output supports seeking or the error code if seeking
+ *         failed for another reason
+ */
+static oc::result<bool> skip_output(File &output, uint64_t size)
+{
+    if (size > INT64_MAX) {
+        return false;
+    }
+
+    auto ret = output.seek(static_cast<int64_t>(size), SEEK_CUR);
+    if (!ret) {
+        if (ret.error() == FileErrorC::Unsupported) {
+            return false;
+        }
+        return ret.as_failure();
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write data, optionally skipping blocks that are already present
+ *
+ * If \p cmp_buf is not null, the existing data at the current output position
+ * is read and only the blocks that differ from \p data are written. Unchanged
+ * blocks are skipped by seeking. Data past the end of the existing output always
+ * counts as changed.
+ *
+ * \param output File to write to
+ * \param data Data to write
+ * \param size Size of \p data
+ * \param block_size Granularity of the comparison
+ * \param cmp_buf Scratch buffer that is at least \p size bytes or null to
+ *                write all of the data
+ */
+static oc::result<void> write_data(File &output, const unsigned char *data,
+                                   size_t size, uint32_t block_size,
+                                   std::vector<unsigned char> *cmp_buf)
+{
+    if (!cmp_buf) {
+        return file_write_exact(output, data, size);
+    }
+
+    OUTCOME_TRY(offset, output.seek(0, SEEK_CUR));
+
+    size_t existing = 0;
+    while (existing < size) {
+        OUTCOME_TRY(n, output.read_at(offset + existing,
+                                      cmp_buf->data() + existing,
+                                      size - existing));
+        if (n == 0) {
+            break;
+        }
+        existing += n;
+    }
+
+    // Write runs of changed blocks and skip runs of unchanged blocks
+    size_t pos = 0;
+    while (pos < size) {
+        size_t n = std::min<size_t>(block_size, size - pos);
+        bool same = pos + n <= existing
+                && memcmp(data + pos, cmp_buf->data() + pos, n) == 0;
+        size_t end = pos + n;
+
+        while (end < size) {
+            size_t m = std::min<size_t>(block_size, size - end);
+            bool next_same = end + m <= existing
+                    && memcmp(data + end, cmp_buf->data() + end, m) == 0;
+            if (next_same != same) {
+                break;
+            }
+            end += m;
+        }
+
+        if (same) {
+            OUTCOME_TRYV(output.seek(static_cast<int64_t>(end - pos),
+                                     SEEK_CUR));
+        } else {
+            OUTCOME_TRYV(file_write_exact(output, data + pos, end - pos));
+        }
+
+        pos = end;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write a repeating 32-bit pattern
+ *
+ * \param output File to write to
+ * \param pattern Pattern bytes, already rotated for the starting offset
+ * \param size Number of bytes to write
+ * \param block_size Granularity of the comparison for write_data()
+ * \param buf Scratch buffer whose size is a multiple of 4
+ * \param cmp_buf Scratch buffer for write_data()
+ */
+static oc::result<void> write_pattern(File &output,
+                                      const unsigned char (&pattern)[4],
+                                      uint64_t size, uint32_t block_size,
+                                      std::vector<unsigned char> &buf,
+                                      std::vector<unsigned char> *cmp_buf)
+{
+    for (size_t i = 0; i < buf.size(); i += sizeof(pattern)) {
+        memcpy(buf.data() + i, pattern, sizeof(pattern));
+    }
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, buf.size()));
+        OUTCOME_TRYV(write_data(output, buf.data(), n, block_size, cmp_buf));
+        size -= n;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Copy a sparse file without writing chunks that have no data
+ *
+ * Data is copied from the current position of \p input to the current position
+ * of \p output until the end of \p input is reached.
+ *
+ * * Raw chunks are copied as-is.
+ * * "Don't care" chunks are skipped if \p output supports seeking.
+ * * Zero fill chunks are skipped if \ref SparseCopyFlag::OutputIsZeroed is
+ *   set. Otherwise, on Linux, block devices are zeroed with `BLKZEROOUT` and
+ *   regular files have holes punched in them.
+ * * Other fill chunks, and any of the above if the fast paths are unavailable,
+ *   are written out in large pattern writes.
+ *
+ * If \ref SparseCopyFlag::SkipUnchanged is set, the existing data in \p output
+ * is read before writing raw and non-zero fill data and only the blocks that
+ * differ from the sparse file are written. This requires \p output to support
+ * reading and seeking. Reads are usually much cheaper than writes on flash
+ * storage, so this speeds up reflashing an image that mostly did not change.
+ *
+ * If the last chunk is skipped, a single zero byte is written at the end so
+ * that a regular file ends up with the full size.
+ *
+ * \param input Sparse file to copy from
+ * \param output File to copy to
+ * \param flags Copy flags
+ * \param progress_cb Optional callback invoked with the current position and
+ *                    the size of the sparse file after each chunk piece
+ *
+ * \return Number of bytes of the sparse file that were processed. Otherwise,
+ *         the error code.
+ */
+oc::result<uint64_t> sparse_copy(SparseFile &input, File &output,
+                                 SparseCopyFlags flags,
+                                 const SparseCopyProgressCallback &progress_cb)
+{
+    std::vector<unsigned char> buf(COPY_BUFFER_SIZE);
+    std::vector<unsigned char> cmp_buf;
+    uint64_t total = input.size();
+    uint64_t copied = 0;
+    bool tail_skipped = false;
+
+    uint32_t block_size = input.block_size();
+
+    if (flags & SparseCopyFlag::SkipUnchanged) {
+        cmp_buf.resize(buf.size());
+    }
+    auto cmp_buf_ptr = cmp_buf.empty() ? nullptr : &cmp_buf;
+
+    OUTCOME_TRY(pos, input.seek(0, SEEK_CUR));
+
+    while (true) {
+        OUTCOME_TRY(chunk, input.chunk());
+        if (!chunk) {
+            break;
+        }
+
+        uint64_t size = chunk->end - pos;
+        bool skipped = false;
+
+        switch (chunk->type) {
+        case SparseChunkType::Raw: {
+            uint64_t remaining = size;
+
+            while (remaining > 0) {
+                auto n = static_cast<size_t>(
+                        std::min<uint64_t>(remaining, buf.size()));
+                OUTCOME_TRYV(file_read_exact(input, buf.data(), n));
+                OUTCOME_TRYV(write_data(output, buf.data(), n, block_size,
+                                        cmp_buf_ptr));
+                remaining -= n;
+
+                if (progress_cb) {
+                    progress_cb(chunk->end - remaining, total);
+                }
+            }
+
+            break;
+        }
+        case SparseChunkType::Fill:
+        case SparseChunkType::DontCare: {
+            bool is_zero = chunk->type == SparseChunkType::DontCare
+                    || chunk->fill_val == 0;
+
+            if (chunk->type == SparseChunkType::DontCare
+                    || (is_zero && (flags & SparseCopyFlag::OutputIsZeroed))) {
+                OUTCOME_TRY(s, skip_output(output, size));
+                skipped = s;
+            } else if (is_zero) {
+                auto out_pos = output.seek(0, SEEK_CUR);
+                if (out_pos && zero_range(output, out_pos.value(), size)) {
+                    OUTCOME_TRY(s, skip_output(output, size));
+                    skipped = s;
+                }
+            }
+
+            if (!skipped) {
+                uint32_t fill_val = mb_htole32(chunk->fill_val);
+                auto fill_bytes = reinterpret_cast<const unsigned char *>(
+                        &fill_val);
+                auto shift = (pos - chunk->begin) % sizeof(fill_val);
+                unsigned char pattern[4];
+
+                for (size_t i = 0; i < sizeof(pattern); ++i) {
+                    pattern[i] = fill_bytes[(i + shift) % sizeof(fill_val)];
+                }
+
+                OUTCOME_TRYV(write_pattern(output, pattern, size, block_size,
+                                           buf, cmp_buf_ptr));
+            }
+
+            OUTCOME_TRYV(input.skip_chunk());
+
+            if (progress_cb) {
+                progress_cb(chunk->end, total);
+            }
+
+            break;
+        }
+        }
+
+        tail_skipped = skipped;
+        copied += size;
+        pos = chunk->end;
+    }
+
+    if (tail_skipped) {
+        // Write the last byte so that regular files are extended
+        static constexpr unsigned char zero = 0;
+
+        OUTCOME_TRYV(output.seek(-1, SEEK_CUR));
+        OUTCOME_TRYV(file_write_exact(output, &zero, 1));
+    }
+
+    return copied;
+}
+
+/*!
+ * \brief Create a delta between a sparse file and existing data
+ *
+ * The sparse file is compared block by block against \p target from the
+ * current positions of \p input and \p target until the end of \p input is
+ * reached. A new sparse image containing only the blocks that differ is
+ * written to \p delta. Unchanged blocks are stored as "don't care" chunks,
+ * which sparse_copy() skips, so the delta can be applied to \p target later
+ * with sparse_copy(). The last block is always included so that applying the
+ * delta never has to extend the target.
+ *
+ * \param input Sparse file with the new data
+ * \param target Existing data, such as a block device or an older image
+ * \param delta File to write the delta sparse image to
+ * \param progress_cb Optional callback invoked with the current position and
+ *                    the size of the sparse file after each buffer
+ *
+ * \return Number of bytes that differ. Otherwise, the error code.
+ */
+oc::result<uint64_t> sparse_diff(SparseFile &input, File &target, File &delta,
+                                 const SparseCopyProgressCallback &progress_cb)
+{
+    uint32_t block_size = input.block_size();
+    uint64_t total = input.size();
+    uint64_t changed = 0;
+
+    OUTCOME_TRY(pos, input.seek(0, SEEK_CUR));
+
+    if (pos % block_size != 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    std::vector<unsigned char> buf(
+            std::max<size_t>(COPY_BUFFER_SIZE / block_size, 1) * block_size);
+    std::vector<unsigned char> cmp_buf(buf.size());
+
+    SparseWriter writer;
+    OUTCOME_TRYV(writer.open(&delta, {}, block_size));
+
+    uint32_t skipped = 0;
+
+    while (pos < total) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(total - pos,
+                                                        buf.size()));
+        OUTCOME_TRYV(file_read_exact(input, buf.data(), n));
+        OUTCOME_TRY(existing, file_read_retry(target, cmp_buf.data(), n));
+
+        for (size_t i = 0; i < n; i += block_size) {
+            bool last = pos + i + block_size >= total;
+
+            if (!last && i + block_size <= existing
+                    && memcmp(buf.data() + i, cmp_buf.data() + i,
+                              block_size) == 0) {
+                ++skipped;
+                continue;
+            }
+
+            OUTCOME_TRYV(writer.skip_blocks(skipped));
+            skipped = 0;
+
+            OUTCOME_TRYV(file_write_exact(writer, buf.data() + i,
+                                          block_size));
+            changed += block_size;
+        }
+
+        pos += n;
+
+        if (progress_cb) {
+            progress_cb(pos, total);
+        }
+    }
+
+    OUTCOME_TRYV(writer.skip_blocks(skipped));
+    OUTCOME_TRYV(writer.close());
+
+    return changed;
+}
+
+}
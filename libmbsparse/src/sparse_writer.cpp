@@ -0,0 +1,492 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbsparse/sparse_writer.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+#include "mbsparse/crc32_p.h"
+#include "mbsparse/sparse_p.h"
+
+namespace mb::sparse
+{
+using namespace mb::detail;
+using namespace detail;
+
+/*! \cond INTERNAL */
+
+// Largest amount of raw data buffered for a single raw chunk
+constexpr size_t MAX_RAW_CHUNK_SIZE = 1024 * 1024;
+
+/*! \endcond */
+
+/*!
+ * \class SparseWriter
+ *
+ * \brief Write raw data as an Android sparse file image.
+ *
+ * Data written to this File is split into blocks. Runs of blocks where every
+ * 32-bit word is the same are stored as fill chunks (or, with
+ * SparseWriterFlag::DontCareZeroBlocks, zero blocks are stored as "don't care"
+ * chunks) and everything else is stored as raw chunks. The output file must
+ * support seeking because the sparse header is rewritten when the file is
+ * closed.
+ *
+ * If the amount of data written is not a multiple of the block size, the last
+ * block is padded with zeros.
+ */
+
+/*!
+ * \brief Construct unbound SparseWriter.
+ *
+ * The File handle will not be bound to any file. One of the open functions will
+ * need to be called to open a file.
+ */
+SparseWriter::SparseWriter()
+    : File()
+{
+    clear();
+}
+
+/*!
+ * \brief Open sparse file for writing to File handle.
+ *
+ * Construct the file handle and open the file. Use is_open() to check if the
+ * file was successfully opened.
+ *
+ * \sa open(File *, SparseWriterFlags, uint32_t)
+ *
+ * \param file File to write to
+ * \param flags Writer flags
+ * \param block_size Sparse block size
+ */
+SparseWriter::SparseWriter(File *file, SparseWriterFlags flags,
+                           uint32_t block_size)
+    : SparseWriter()
+{
+    (void) open(file, flags, block_size);
+}
+
+SparseWriter::~SparseWriter()
+{
+    (void) close();
+}
+
+SparseWriter::SparseWriter(SparseWriter &&other) noexcept
+    : File(std::move(other))
+    , m_file(other.m_file)
+    , m_flags(other.m_flags)
+    , m_block_size(other.m_block_size)
+    , m_header_offset(other.m_header_offset)
+    , m_crc32(other.m_crc32)
+    , m_total_blocks(other.m_total_blocks)
+    , m_total_chunks(other.m_total_chunks)
+    , m_block(std::move(other.m_block))
+    , m_block_used(other.m_block_used)
+    , m_chunk_type(other.m_chunk_type)
+    , m_chunk_blocks(other.m_chunk_blocks)
+    , m_chunk_data(std::move(other.m_chunk_data))
+{
+    memcpy(m_chunk_fill, other.m_chunk_fill, sizeof(m_chunk_fill));
+
+    other.clear();
+}
+
+SparseWriter & SparseWriter::operator=(SparseWriter &&rhs) noexcept
+{
+    File::operator=(std::move(rhs));
+
+    m_file = rhs.m_file;
+    m_flags = rhs.m_flags;
+    m_block_size = rhs.m_block_size;
+    m_header_offset = rhs.m_header_offset;
+    m_crc32 = rhs.m_crc32;
+    m_total_blocks = rhs.m_total_blocks;
+    m_total_chunks = rhs.m_total_chunks;
+    m_block = std::move(rhs.m_block);
+    m_block_used = rhs.m_block_used;
+    m_chunk_type = rhs.m_chunk_type;
+    m_chunk_blocks = rhs.m_chunk_blocks;
+    memcpy(m_chunk_fill, rhs.m_chunk_fill, sizeof(m_chunk_fill));
+    m_chunk_data = std::move(rhs.m_chunk_data);
+
+    rhs.clear();
+
+    return *this;
+}
+
+/*!
+ * \brief Open sparse file for writing to File handle.
+ *
+ * \note The SparseWriter will *not* take ownership of \p file. The caller must
+ *       ensure that it is properly closed and destroyed when it is no longer
+ *       needed.
+ *
+ * \param file File to write to. It must support seeking.
+ * \param flags Writer flags
+ * \param block_size Sparse block size. Must be a non-zero multiple of 4.
+ *
+ * \return Nothing if the file is successfully opened. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::open(File *file, SparseWriterFlags flags,
+                                    uint32_t block_size)
+{
+    if (state() == FileState::New) {
+        m_file = file;
+        m_flags = flags;
+        m_block_size = block_size;
+    }
+
+    return File::open();
+}
+
+/*!
+ * \brief Get number of blocks written so far
+ *
+ * \return Number of complete blocks, including those in the pending chunk
+ */
+uint32_t SparseWriter::total_blocks() const
+{
+    return m_total_blocks;
+}
+
+/*!
+ * \brief Get number of chunks written so far
+ *
+ * \return Number of chunks written to the output file. After the file is
+ *         closed, this is the value stored in the sparse header.
+ */
+uint32_t SparseWriter::total_chunks() const
+{
+    return m_total_chunks;
+}
+
+oc::result<void> SparseWriter::on_open()
+{
+    if (!m_file->is_open()) {
+        return FileError::InvalidState;
+    } else if (m_block_size == 0 || m_block_size % sizeof(uint32_t) != 0) {
+        return FileError::ArgumentOutOfRange;
+    }
+
+    OUTCOME_TRY(offset, m_file->seek(0, SEEK_CUR));
+    m_header_offset = offset;
+    m_total_blocks = 0;
+    m_total_chunks = 0;
+
+    m_block.resize(m_block_size);
+    m_chunk_data.reserve(MAX_RAW_CHUNK_SIZE);
+
+    // Reserve space for the header. It is rewritten once the number of chunks
+    // is known.
+    return write_sparse_header();
+}
+
+/*!
+ * \brief Close sparse file
+ *
+ * The partial last block, if any, is padded with zeros and the pending chunk,
+ * the optional CRC32 chunk, and the final sparse header are written.
+ *
+ * \note If the sparse file is open, then no matter what value is returned, the
+ *       sparse file will be closed.
+ *
+ * \return Nothing if all remaining data was successfully written. Otherwise,
+ *         the error code.
+ */
+oc::result<void> SparseWriter::on_close()
+{
+    auto reset = finally([&] {
+        // Keep the statistics available after closing
+        auto total_blocks = m_total_blocks;
+        auto total_chunks = m_total_chunks;
+
+        clear();
+
+        m_total_blocks = total_blocks;
+        m_total_chunks = total_chunks;
+    });
+
+    if (is_fatal()) {
+        return oc::success();
+    }
+
+    if (m_block_used > 0) {
+        std::fill(m_block.begin() + static_cast<ptrdiff_t>(m_block_used),
+                  m_block.end(), 0);
+        OUTCOME_TRYV(process_block(m_block.data()));
+        m_block_used = 0;
+    }
+
+    OUTCOME_TRYV(flush_chunk());
+
+    if (m_flags & SparseWriterFlag::WriteCrc32) {
+        OUTCOME_TRYV(write_chunk_header(CHUNK_TYPE_CRC32, 0, sizeof(uint32_t)));
+
+        uint32_t crc32 = mb_htole32(m_crc32);
+        OUTCOME_TRYV(wwrite(&crc32, sizeof(crc32)));
+    }
+
+    OUTCOME_TRY(end, m_file->seek(0, SEEK_CUR));
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(m_header_offset),
+                              SEEK_SET));
+    OUTCOME_TRYV(write_sparse_header());
+    OUTCOME_TRYV(m_file->seek(static_cast<int64_t>(end), SEEK_SET));
+
+    return oc::success();
+}
+
+/*!
+ * \brief Add "don't care" blocks
+ *
+ * The blocks are stored as a "don't care" chunk without any data. This is
+ * useful for images that only contain some of the blocks, like deltas. For the
+ * CRC32 checksum, the blocks count as zeros.
+ *
+ * \pre All data written so far must be a multiple of the block size
+ *
+ * \param blocks Number of blocks to skip
+ *
+ * \return Nothing if the blocks were successfully added. Otherwise, the error
+ *         code.
+ */
+oc::result<void> SparseWriter::skip_blocks(uint32_t blocks)
+{
+    if (!is_open()) {
+        return FileError::InvalidState;
+    } else if (m_block_used != 0) {
+        return FileError::InvalidState;
+    } else if (blocks > UINT32_MAX - m_total_blocks) {
+        set_fatal();
+        return FileError::IntegerOverflow;
+    }
+
+    if (blocks == 0) {
+        return oc::success();
+    }
+
+    if (m_flags & SparseWriterFlag::WriteCrc32) {
+        static constexpr unsigned char zero[4] = {};
+        m_crc32 = crc32_fill(m_crc32, zero,
+                             static_cast<uint64_t>(blocks) * m_block_size);
+    }
+
+    if (m_chunk_blocks == 0 || m_chunk_type != CHUNK_TYPE_DONT_CARE) {
+        OUTCOME_TRYV(flush_chunk());
+        m_chunk_type = CHUNK_TYPE_DONT_CARE;
+    }
+
+    m_chunk_blocks += blocks;
+    m_total_blocks += blocks;
+
+    return oc::success();
+}
+
+oc::result<size_t> SparseWriter::on_write(const void *buf, size_t size)
+{
+    auto ptr = static_cast<const unsigned char *>(buf);
+    size_t remaining = size;
+
+    while (remaining > 0) {
+        if (m_block_used == 0 && remaining >= m_block_size) {
+            // Process whole blocks without copying them
+            OUTCOME_TRYV(process_block(ptr));
+            ptr += m_block_size;
+            remaining -= m_block_size;
+            continue;
+        }
+
+        size_t n = std::min<size_t>(remaining, m_block_size - m_block_used);
+        memcpy(m_block.data() + m_block_used, ptr, n);
+        m_block_used += n;
+        ptr += n;
+        remaining -= n;
+
+        if (m_block_used == m_block_size) {
+            OUTCOME_TRYV(process_block(m_block.data()));
+            m_block_used = 0;
+        }
+    }
+
+    return size;
+}
+
+void SparseWriter::clear()
+{
+    m_file = nullptr;
+    m_flags = {};
+    m_block_size = DEFAULT_BLOCK_SIZE;
+    m_header_offset = 0;
+    m_crc32 = 0;
+    m_total_blocks = 0;
+    m_total_chunks = 0;
+    m_block.clear();
+    m_block_used = 0;
+    m_chunk_type = 0;
+    m_chunk_blocks = 0;
+    memset(m_chunk_fill, 0, sizeof(m_chunk_fill));
+    m_chunk_data.clear();
+}
+
+oc::result<void> SparseWriter::wwrite(const void *buf, size_t size)
+{
+    auto ret = file_write_exact(*m_file, buf, size);
+    if (!ret) {
+        set_fatal();
+    }
+    return ret;
+}
+
+/*!
+ * \brief Classify a block and append it to the pending chunk
+ *
+ * A block is uniform if every 32-bit word matches the first one, which is
+ * checked by comparing the block against itself shifted by one word. memcmp()
+ * is vectorized by every libc we target, so this is much faster than a
+ * word-by-word loop.
+ */
+oc::result<void> SparseWriter::process_block(const unsigned char *data)
+{
+    if (m_total_blocks == UINT32_MAX) {
+        set_fatal();
+        return FileError::IntegerOverflow;
+    }
+
+    if (m_flags & SparseWriterFlag::WriteCrc32) {
+        m_crc32 = crc32_update(m_crc32, data, m_block_size);
+    }
+
+    bool uniform = memcmp(data, data + sizeof(uint32_t),
+                          m_block_size - sizeof(uint32_t)) == 0;
+    uint16_t type = CHUNK_TYPE_RAW;
+
+    if (uniform) {
+        static constexpr unsigned char zero[4] = {};
+
+        if ((m_flags & SparseWriterFlag::DontCareZeroBlocks)
+                && memcmp(data, zero, sizeof(zero)) == 0) {
+            type = CHUNK_TYPE_DONT_CARE;
+        } else {
+            type = CHUNK_TYPE_FILL;
+        }
+    }
+
+    bool extend = m_chunk_blocks > 0 && type == m_chunk_type;
+    if (extend && type == CHUNK_TYPE_FILL) {
+        extend = memcmp(m_chunk_fill, data, sizeof(m_chunk_fill)) == 0;
+    } else if (extend && type == CHUNK_TYPE_RAW) {
+        extend = m_chunk_data.size() + m_block_size <= MAX_RAW_CHUNK_SIZE;
+    }
+
+    if (!extend) {
+        OUTCOME_TRYV(flush_chunk());
+
+        m_chunk_type = type;
+        memcpy(m_chunk_fill, data, sizeof(m_chunk_fill));
+    }
+
+    if (type == CHUNK_TYPE_RAW) {
+        m_chunk_data.insert(m_chunk_data.end(), data, data + m_block_size);
+    }
+
+    ++m_chunk_blocks;
+    ++m_total_blocks;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Write the pending chunk, if any
+ */
+oc::result<void> SparseWriter::flush_chunk()
+{
+    if (m_chunk_blocks == 0) {
+        return oc::success();
+    }
+
+    switch (m_chunk_type) {
+    case CHUNK_TYPE_RAW: {
+        OUTCOME_TRYV(write_chunk_header(
+                m_chunk_type, m_chunk_blocks,
+                static_cast<uint32_t>(m_chunk_data.size())));
+        OUTCOME_TRYV(wwrite(m_chunk_data.data(), m_chunk_data.size()));
+        m_chunk_data.clear();
+        break;
+    }
+    case CHUNK_TYPE_FILL: {
+        OUTCOME_TRYV(write_chunk_header(m_chunk_type, m_chunk_blocks,
+                                        sizeof(m_chunk_fill)));
+        OUTCOME_TRYV(wwrite(m_chunk_fill, sizeof(m_chunk_fill)));
+        break;
+    }
+    case CHUNK_TYPE_DONT_CARE: {
+        OUTCOME_TRYV(write_chunk_header(m_chunk_type, m_chunk_blocks, 0));
+        break;
+    }
+    default:
+        MB_UNREACHABLE("Invalid chunk type: %u", m_chunk_type);
+    }
+
+    m_chunk_blocks = 0;
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::write_chunk_header(uint16_t type,
+                                                  uint32_t blocks,
+                                                  uint32_t data_size)
+{
+    ChunkHeader chdr = {};
+    chdr.chunk_type = mb_htole16(type);
+    chdr.chunk_sz = mb_htole32(blocks);
+    chdr.total_sz = mb_htole32(
+            static_cast<uint32_t>(sizeof(ChunkHeader)) + data_size);
+
+    OUTCOME_TRYV(wwrite(&chdr, sizeof(chdr)));
+
+    ++m_total_chunks;
+
+    return oc::success();
+}
+
+oc::result<void> SparseWriter::write_sparse_header()
+{
+    SparseHeader shdr = {};
+    shdr.magic = mb_htole32(SPARSE_HEADER_MAGIC);
+    shdr.major_version = mb_htole16(SPARSE_HEADER_MAJOR_VER);
+    shdr.minor_version = 0;
+    shdr.file_hdr_sz = mb_htole16(static_cast<uint16_t>(sizeof(SparseHeader)));
+    shdr.chunk_hdr_sz = mb_htole16(static_cast<uint16_t>(sizeof(ChunkHeader)));
+    shdr.blk_sz = mb_htole32(m_block_size);
+    shdr.total_blks = mb_htole32(m_total_blocks);
+    shdr.total_chunks = mb_htole32(m_total_chunks);
+    shdr.image_checksum = mb_htole32(
+            (m_flags & SparseWriterFlag::WriteCrc32) ? m_crc32 : 0);
+
+    return wwrite(&shdr, sizeof(shdr));
+}
+
+}
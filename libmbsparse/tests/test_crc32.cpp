@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+
+#include "mbsparse/crc32_p.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_error.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+using namespace mb::sparse::detail;
+
+TEST(Crc32Test, CheckKnownValue)
+{
+    ASSERT_EQ(crc32_update(0, "123456789", 9), 0xcbf43926u);
+    ASSERT_EQ(crc32_update(crc32_update(0, "1234", 4), "56789", 5),
+              0xcbf43926u);
+    ASSERT_EQ(crc32_update(0, nullptr, 0), 0u);
+}
+
+TEST(Crc32Test, CombineMatchesConcatenation)
+{
+    std::vector<unsigned char> data(10000);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<unsigned char>(i * 31 + 7);
+    }
+
+    uint32_t expected = crc32_update(0, data.data(), data.size());
+
+    for (size_t split : {0u, 1u, 3u, 4096u, 9999u, 10000u}) {
+        uint32_t crc1 = crc32_update(0, data.data(), split);
+        uint32_t crc2 = crc32_update(0, data.data() + split,
+                                     data.size() - split);
+        ASSERT_EQ(crc32_combine(crc1, crc2, data.size() - split), expected);
+    }
+}
+
+TEST(Crc32Test, FillMatchesRepeatedPattern)
+{
+    const unsigned char pattern[4] = {0xde, 0xad, 0xbe, 0xef};
+
+    for (size_t size : {0u, 1u, 4u, 7u, 4096u, 12345u}) {
+        std::vector<unsigned char> data(size);
+        for (size_t i = 0; i < size; ++i) {
+            data[i] = pattern[i % sizeof(pattern)];
+        }
+
+        uint32_t prefix = crc32_update(0, "prefix", 6);
+
+        ASSERT_EQ(crc32_fill(prefix, pattern, size),
+                  crc32_update(prefix, data.data(), data.size()));
+    }
+}
+
+TEST(Crc32Test, PoolComputesAllBuffers)
+{
+    Crc32Pool pool(4, 1024);
+    std::vector<uint32_t> results(32);
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        auto buf = pool.acquire();
+        ASSERT_EQ(buf.size(), 1024u);
+        std::fill(buf.begin(), buf.end(), static_cast<unsigned char>(i));
+        pool.submit(std::move(buf), i + 1, results[i]);
+    }
+
+    pool.wait();
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        std::vector<unsigned char> expected(i + 1,
+                                            static_cast<unsigned char>(i));
+        ASSERT_EQ(results[i], crc32_update(0, expected.data(),
+                                           expected.size()));
+    }
+}
+
+struct SparseVerifyTest : testing::Test
+{
+    void *_sparse_data = nullptr;
+    size_t _sparse_size = 0;
+
+    virtual ~SparseVerifyTest()
+    {
+        free(_sparse_data);
+    }
+
+    void SetUp() override
+    {
+        // Raw block, zero blocks, fill block, raw block
+        std::vector<unsigned char> data;
+        for (int i = 0; i < 64; ++i) {
+            data.push_back(static_cast<unsigned char>(i));
+        }
+        data.resize(data.size() + 128, 0);
+        for (int i = 0; i < 64 / 4; ++i) {
+            data.insert(data.end(), {0x01, 0x02, 0x03, 0x04});
+        }
+        for (int i = 0; i < 64; ++i) {
+            data.push_back(static_cast<unsigned char>(255 - i));
+        }
+
+        MemoryFile file;
+        ASSERT_TRUE(file.open(&_sparse_data, &_sparse_size));
+
+        SparseWriter writer;
+        ASSERT_TRUE(writer.open(&file, SparseWriterFlag::DontCareZeroBlocks
+                | SparseWriterFlag::WriteCrc32, 64));
+        ASSERT_TRUE(writer.write(data.data(), data.size()));
+        ASSERT_TRUE(writer.close());
+    }
+};
+
+TEST_F(SparseVerifyTest, VerifyValidChecksums)
+{
+    for (unsigned int jobs : {1u, 4u}) {
+        MemoryFile file(_sparse_data, _sparse_size);
+        SparseFile sparse_file;
+        ASSERT_TRUE(sparse_file.open(&file));
+
+        ASSERT_TRUE(sparse_file.verify_crc32(jobs));
+
+        // Position is unchanged and data is still readable
+        unsigned char buf[64];
+        ASSERT_TRUE(sparse_file.read(buf, sizeof(buf)));
+        ASSERT_EQ(buf[63], 63);
+    }
+}
+
+TEST_F(SparseVerifyTest, VerifyCorruptedRawChunkFails)
+{
+    // Corrupt the last byte of the last raw chunk, which precedes the CRC32
+    // chunk (12-byte chunk header + 4-byte checksum)
+    static_cast<unsigned char *>(_sparse_data)[_sparse_size - 17] ^= 0xff;
+
+    MemoryFile file(_sparse_data, _sparse_size);
+    SparseFile sparse_file;
+    ASSERT_TRUE(sparse_file.open(&file));
+
+    size_t failed_chunk = 0;
+    auto ret = sparse_file.verify_crc32(2, &failed_chunk);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::Crc32Mismatch);
+    ASSERT_EQ(failed_chunk, 4u);
+}
@@ -23,6 +23,7 @@
 
 #include "mbcommon/endian.h"
 #include "mbcommon/file/memory.h"
+#include "mbcommon/finally.h"
 
 #include "mbsparse/sparse_error.h"
 
@@ -669,6 +670,70 @@ TEST_F(SparseTest, ReadValidDataWithSeekableFile)
     ASSERT_TRUE(_file.close());
 }
 
+TEST_F(SparseTest, ReadValidDataWithSavedIndex)
+{
+    char buf[1024];
+    build_valid_data(true);
+
+    void *index_data = nullptr;
+    size_t index_size = 0;
+    auto free_index = finally([&] {
+        free(index_data);
+    });
+
+    MemoryFile index_file;
+    ASSERT_TRUE(index_file.open(&index_data, &index_size));
+
+    // Save index
+    ASSERT_TRUE(_file.open(&_source_file));
+    ASSERT_TRUE(_file.save_index(index_file));
+    ASSERT_TRUE(_file.close());
+
+    // Reopen with the index
+    ASSERT_TRUE(index_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_file.open(&_source_file, &index_file));
+
+    // Random reads should work without walking the chunk headers
+    ASSERT_TRUE(_file.seek(33, SEEK_SET));
+    auto n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), 15u);
+    ASSERT_EQ(memcmp(buf, expected_valid_data + 33, 15), 0);
+
+    ASSERT_TRUE(_file.seek(0, SEEK_SET));
+    n = _file.read(buf, sizeof(buf));
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), sizeof(expected_valid_data));
+    ASSERT_EQ(memcmp(buf, expected_valid_data, sizeof(expected_valid_data)), 0);
+
+    ASSERT_TRUE(_file.close());
+
+    // Corrupt the start offset of the last chunk in the index
+    ASSERT_GT(index_size, 48u);
+    static_cast<unsigned char *>(index_data)[index_size - 48] ^= 0xff;
+
+    ASSERT_TRUE(index_file.seek(0, SEEK_SET));
+    ASSERT_TRUE(_source_file.seek(0, SEEK_SET));
+    auto ret = _file.open(&_source_file, &index_file);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), SparseFileError::InvalidChunkIndex);
+}
+
+TEST_F(SparseTest, BuildIndexWithUnseekableFileFails)
+{
+    build_valid_data(false);
+
+    _source_file.set_seekability(Seekability::CanSkip);
+    ASSERT_TRUE(_file.open(&_source_file));
+
+    auto ret = _file.build_index();
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::UnsupportedSeek);
+
+    ASSERT_TRUE(_file.close());
+}
+
 TEST_F(SparseTest, ReadValidDataWithSkippableFile)
 {
     char buf[1024];
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/finally.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_util.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+
+struct SparseCopyTest : testing::Test
+{
+    void *_sparse_data = nullptr;
+    size_t _sparse_size = 0;
+    void *_output_data = nullptr;
+    size_t _output_size = 0;
+
+    std::vector<unsigned char> _expected;
+
+    virtual ~SparseCopyTest()
+    {
+        free(_sparse_data);
+        free(_output_data);
+    }
+
+    void SetUp() override
+    {
+        // Raw block, zero blocks, fill block, raw block, zero block
+        for (int i = 0; i < 64; ++i) {
+            _expected.push_back(static_cast<unsigned char>(i));
+        }
+        _expected.resize(_expected.size() + 128, 0);
+        for (int i = 0; i < 64 / 4; ++i) {
+            _expected.insert(_expected.end(), {0x01, 0x02, 0x03, 0x04});
+        }
+        for (int i = 0; i < 64; ++i) {
+            _expected.push_back(static_cast<unsigned char>(255 - i));
+        }
+        _expected.resize(_expected.size() + 64, 0);
+
+        MemoryFile file;
+        ASSERT_TRUE(file.open(&_sparse_data, &_sparse_size));
+
+        SparseWriter writer;
+        ASSERT_TRUE(writer.open(&file, SparseWriterFlag::DontCareZeroBlocks,
+                                64));
+        ASSERT_TRUE(writer.write(_expected.data(), _expected.size()));
+        ASSERT_TRUE(writer.close());
+    }
+};
+
+TEST_F(SparseCopyTest, ChunksWithoutDataAreNotWritten)
+{
+    MemoryFile input_file(_sparse_data, _sparse_size);
+    SparseFile sparse_file;
+    ASSERT_TRUE(sparse_file.open(&input_file));
+
+    MemoryFile output_file;
+    ASSERT_TRUE(output_file.open(&_output_data, &_output_size));
+    output_file.set_stats_enabled(true);
+
+    std::vector<uint64_t> progress;
+
+    auto n = sparse_copy(sparse_file, output_file, {},
+                         [&](uint64_t bytes, uint64_t total) {
+        ASSERT_EQ(total, _expected.size());
+        progress.push_back(bytes);
+    });
+    ASSERT_TRUE(n);
+    ASSERT_EQ(n.value(), _expected.size());
+
+    ASSERT_EQ(_output_size, _expected.size());
+    ASSERT_EQ(memcmp(_output_data, _expected.data(), _expected.size()), 0);
+
+    // Only the raw blocks, the fill block, and the trailing byte are written
+    ASSERT_EQ(output_file.stats()->bytes_written, 3u * 64u + 1u);
+
+    ASSERT_FALSE(progress.empty());
+    ASSERT_EQ(progress.back(), _expected.size());
+}
+
+TEST_F(SparseCopyTest, ChunkApiReportsChunkBoundaries)
+{
+    MemoryFile input_file(_sparse_data, _sparse_size);
+    SparseFile sparse_file;
+    ASSERT_TRUE(sparse_file.open(&input_file));
+
+    auto chunk = sparse_file.chunk();
+    ASSERT_TRUE(chunk);
+    ASSERT_TRUE(chunk.value());
+    ASSERT_EQ(chunk.value()->type, SparseChunkType::Raw);
+    ASSERT_EQ(chunk.value()->begin, 0u);
+    ASSERT_EQ(chunk.value()->end, 64u);
+
+    auto pos = sparse_file.skip_chunk();
+    ASSERT_TRUE(pos);
+    ASSERT_EQ(pos.value(), 64u);
+
+    chunk = sparse_file.chunk();
+    ASSERT_TRUE(chunk);
+    ASSERT_TRUE(chunk.value());
+    ASSERT_EQ(chunk.value()->type, SparseChunkType::DontCare);
+    ASSERT_EQ(chunk.value()->end, 192u);
+
+    ASSERT_TRUE(sparse_file.skip_chunk());
+
+    chunk = sparse_file.chunk();
+    ASSERT_TRUE(chunk);
+    ASSERT_TRUE(chunk.value());
+    ASSERT_EQ(chunk.value()->type, SparseChunkType::Fill);
+    ASSERT_EQ(chunk.value()->fill_val, 0x04030201u);
+}
+
+TEST_F(SparseCopyTest, SkipUnchangedOnlyWritesChangedBlocks)
+{
+    auto existing = _expected;
+    existing[10] ^= 0xff;
+    existing[200] ^= 0xff;
+
+    MemoryFile input_file(_sparse_data, _sparse_size);
+    SparseFile sparse_file;
+    ASSERT_TRUE(sparse_file.open(&input_file));
+
+    MemoryFile output_file(existing.data(), existing.size());
+    output_file.set_stats_enabled(true);
+
+    auto n = sparse_copy(sparse_file, output_file,
+                         SparseCopyFlag::SkipUnchanged);
+    ASSERT_TRUE(n);
+    ASSERT_EQ(existing, _expected);
+
+    // Only the first raw block, the fill block, and the trailing byte are
+    // written
+    ASSERT_EQ(output_file.stats()->bytes_written, 2u * 64u + 1u);
+}
+
+TEST_F(SparseCopyTest, DiffCanBeApplied)
+{
+    auto existing = _expected;
+    existing[70] = 0x42;
+    existing[200] ^= 0xff;
+
+    void *delta_data = nullptr;
+    size_t delta_size = 0;
+    auto free_delta = finally([&] {
+        free(delta_data);
+    });
+
+    {
+        MemoryFile input_file(_sparse_data, _sparse_size);
+        SparseFile sparse_file;
+        ASSERT_TRUE(sparse_file.open(&input_file));
+
+        MemoryFile target_file(existing.data(), existing.size());
+
+        MemoryFile delta_file;
+        ASSERT_TRUE(delta_file.open(&delta_data, &delta_size));
+
+        auto n = sparse_diff(sparse_file, target_file, delta_file);
+        ASSERT_TRUE(n);
+        // Two changed blocks and the last block
+        ASSERT_EQ(n.value(), 3u * 64u);
+    }
+
+    MemoryFile delta_file(delta_data, delta_size);
+    SparseFile delta_sparse;
+    ASSERT_TRUE(delta_sparse.open(&delta_file));
+    ASSERT_EQ(delta_sparse.size(), _expected.size());
+
+    MemoryFile target_file(existing.data(), existing.size());
+    target_file.set_stats_enabled(true);
+
+    ASSERT_TRUE(sparse_copy(delta_sparse, target_file));
+    ASSERT_EQ(existing, _expected);
+    ASSERT_EQ(target_file.stats()->bytes_written, 3u * 64u);
+}
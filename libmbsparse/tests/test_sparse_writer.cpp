@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <cstring>
+
+#include "mbcommon/file/memory.h"
+#include "mbcommon/finally.h"
+
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_error.h"
+#include "mbsparse/sparse_writer.h"
+
+using namespace mb;
+using namespace mb::sparse;
+
+struct SparseWriterTest : testing::Test
+{
+    void *_data = nullptr;
+    size_t _size = 0;
+    MemoryFile _output_file;
+
+    virtual ~SparseWriterTest()
+    {
+        free(_data);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_TRUE(_output_file.open(&_data, &_size));
+    }
+
+    void write_sparse(const std::vector<unsigned char> &data,
+                      SparseWriterFlags flags, uint32_t &chunks_out)
+    {
+        SparseWriter writer;
+        ASSERT_TRUE(writer.open(&_output_file, flags, 64));
+
+        // Write in odd-sized pieces to exercise partial blocks
+        size_t pos = 0;
+        while (pos < data.size()) {
+            size_t n = std::min<size_t>(data.size() - pos, 37);
+            ASSERT_TRUE(writer.write(data.data() + pos, n));
+            pos += n;
+        }
+
+        ASSERT_TRUE(writer.close());
+        chunks_out = writer.total_chunks();
+    }
+
+    void read_sparse(std::vector<unsigned char> &data_out)
+    {
+        MemoryFile input_file(_data, _size);
+        SparseFile sparse_file;
+        ASSERT_TRUE(sparse_file.open(&input_file));
+
+        data_out.resize(static_cast<size_t>(sparse_file.size()));
+        auto n = sparse_file.read(data_out.data(), data_out.size());
+        ASSERT_TRUE(n);
+        ASSERT_EQ(n.value(), data_out.size());
+
+        ASSERT_TRUE(sparse_file.close());
+    }
+
+    static std::vector<unsigned char> build_data()
+    {
+        std::vector<unsigned char> data;
+
+        // 2 zero blocks
+        data.insert(data.end(), 128, 0);
+
+        // 3 fill blocks
+        for (int i = 0; i < 3 * 64 / 4; ++i) {
+            data.insert(data.end(), {0x78, 0x56, 0x34, 0x12});
+        }
+
+        // 1 raw block and a partial raw block
+        for (int i = 0; i < 64 + 10; ++i) {
+            data.push_back(static_cast<unsigned char>(i));
+        }
+
+        return data;
+    }
+};
+
+TEST_F(SparseWriterTest, CheckInvalidBlockSizeFails)
+{
+    SparseWriter writer;
+    auto ret = writer.open(&_output_file, {}, 6);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(ret.error(), FileError::ArgumentOutOfRange);
+}
+
+TEST_F(SparseWriterTest, RoundTripShouldCoalesceChunks)
+{
+    auto data = build_data();
+    uint32_t chunks;
+
+    write_sparse(data, {}, chunks);
+
+    // Zero fill, 0x12345678 fill, raw
+    ASSERT_EQ(chunks, 3u);
+
+    std::vector<unsigned char> result;
+    read_sparse(result);
+
+    // Last block is padded with zeros
+    auto expected = data;
+    expected.resize(7 * 64, 0);
+    ASSERT_EQ(result, expected);
+}
+
+TEST_F(SparseWriterTest, RoundTripWithDontCareAndCrc32)
+{
+    auto data = build_data();
+    uint32_t chunks;
+
+    write_sparse(data, SparseWriterFlag::DontCareZeroBlocks
+            | SparseWriterFlag::WriteCrc32, chunks);
+
+    // Don't care, fill, raw, CRC32
+    ASSERT_EQ(chunks, 4u);
+
+    std::vector<unsigned char> result;
+    read_sparse(result);
+
+    auto expected = data;
+    expected.resize(7 * 64, 0);
+    ASSERT_EQ(result, expected);
+}
@@ -20,11 +20,14 @@
 #pragma once
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/flags.h"
+
 namespace mb::util
 {
 
@@ -46,7 +49,22 @@ enum class CompressionType : uint8_t
     Lz4,
     Gzip,
     Xz,
+    Zstd,
+};
+
+enum class TarExtractFlag : uint8_t
+{
+    // Write regular files directly with preallocation and large writes and
+    // apply their metadata in a final pass
+    BulkWrite       = 1 << 0,
 };
+MB_DECLARE_FLAGS(TarExtractFlags, TarExtractFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(TarExtractFlags)
+
+//! Suffix of the manifest written by libarchive_tar_create_segments()
+constexpr char ARCHIVE_SEGMENTS_SUFFIX[] = ".segments";
+//! Suffix of the index written next to each archive by libarchive_tar_create()
+constexpr char ARCHIVE_INDEX_SUFFIX[] = ".index";
 
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry);
 bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
@@ -57,12 +75,61 @@ bool libarchive_tar_extract(const std::string &filename,
                             const std::string &target,
                             const std::vector<std::string> &patterns,
                             CompressionType compression,
-                            bool is_split);
+                            bool is_split,
+                            TarExtractFlags flags = {});
+bool libarchive_tar_extract_paths(const std::string &filename,
+                                  const std::string &target,
+                                  const std::vector<std::string> &paths,
+                                  CompressionType compression,
+                                  bool is_split,
+                                  TarExtractFlags flags = {});
+bool libarchive_tar_verify(const std::string &filename,
+                           CompressionType compression,
+                           bool is_split);
 bool libarchive_tar_create(const std::string &filename,
                            const std::string &base_dir,
                            const std::vector<std::string> &paths,
                            CompressionType compression,
-                           uint64_t split_archive_size);
+                           uint64_t split_archive_size,
+                           unsigned int threads = 1,
+                           int level = -1);
+bool libarchive_tar_create_segments(const std::string &filename,
+                                    const std::string &base_dir,
+                                    const std::vector<std::string> &paths,
+                                    CompressionType compression,
+                                    uint64_t split_archive_size,
+                                    unsigned int segments,
+                                    int level = -1);
+bool libarchive_tar_extract_segments(const std::string &filename,
+                                     const std::string &target,
+                                     CompressionType compression,
+                                     unsigned int jobs = 0,
+                                     TarExtractFlags flags = {},
+                                     const std::vector<std::string> &paths = {});
+bool libarchive_tar_verify_segments(const std::string &filename,
+                                    CompressionType compression,
+                                    unsigned int jobs = 0);
+
+/*!
+ * \brief Index of the members of a zip archive
+ *
+ * The central directory is read once in open(). Afterwards, members can be
+ * looked up and extracted any number of times without scanning the archive.
+ */
+class ArchiveIndex
+{
+public:
+    bool open(const std::string &filename);
+
+    bool contains(const std::string &path) const;
+    bool exists(std::vector<ExistsInfo> &files) const;
+    bool extract(const std::vector<ExtractInfo> &files) const;
+
+private:
+    std::string _filename;
+    // Offset of each member's local file header
+    std::unordered_map<std::string, uint64_t> _offsets;
+};
 
 bool extract_archive(const std::string &filename, const std::string &target);
 bool extract_files(const std::string &filename, const std::string &target,
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "mbcommon/common.h"
+
+/*
+ * ATRACE-compatible markers for Android's system-wide tracing (Perfetto and
+ * systrace). Events are written to the kernel's trace_marker file, so they
+ * show up on the thread that emitted them next to the rest of the system.
+ *
+ * Nothing is written unless tracing is on. If the library is built without
+ * MB_ENABLE_ATRACE, the functions are empty inline stubs.
+ */
+
+namespace mb::util
+{
+
+#ifdef MB_ENABLE_ATRACE
+bool atrace_enabled();
+void atrace_begin(const char *name);
+void atrace_end();
+void atrace_counter(const char *name, int64_t value);
+#else
+inline bool atrace_enabled()
+{
+    return false;
+}
+
+inline void atrace_begin(const char *name)
+{
+    (void) name;
+}
+
+inline void atrace_end()
+{
+}
+
+inline void atrace_counter(const char *name, int64_t value)
+{
+    (void) name;
+    (void) value;
+}
+#endif
+
+/*!
+ * \brief Trace a section for the lifetime of the object
+ *
+ * The section is only ended if tracing was on when it began, so that no
+ * unmatched end events are written.
+ */
+class ATraceSection
+{
+public:
+    explicit ATraceSection(const char *name)
+        : _active(atrace_enabled())
+    {
+        if (_active) {
+            atrace_begin(name);
+        }
+    }
+
+    ~ATraceSection()
+    {
+        if (_active) {
+            atrace_end();
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ATraceSection)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ATraceSection)
+
+private:
+    bool _active;
+};
+
+}
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "mbcommon/outcome.h"
 
@@ -28,4 +29,7 @@ namespace mb::util
 
 oc::result<std::string> blkid_get_fs_type(const std::string &path);
 
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths);
+
 }
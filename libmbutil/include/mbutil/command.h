@@ -92,5 +92,10 @@ int run_command(const std::string &path,
                 const std::optional<std::vector<std::string>> &envp,
                 const std::string &chroot_dir,
                 const CmdLineCb &cb);
+int run_command_raw(const std::string &path,
+                    const std::vector<std::string> &argv,
+                    const std::optional<std::vector<std::string>> &envp,
+                    const std::string &chroot_dir,
+                    const CmdRawCb &cb);
 
 }
@@ -35,6 +35,10 @@ enum class CopyFlag : uint8_t
     CopyXattrs      = 1 << 1,
     ExcludeTopLevel = 1 << 2,
     FollowSymlinks  = 1 << 3,
+    // Copy regular files concurrently (copy_dir() only)
+    Parallel        = 1 << 4,
+    // Don't rewrite regular files that already have the same contents
+    SkipUnchanged   = 1 << 5,
 };
 MB_DECLARE_FLAGS(CopyFlags, CopyFlag)
 MB_DECLARE_OPERATORS_FOR_FLAGS(CopyFlags)
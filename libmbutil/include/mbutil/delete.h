@@ -20,7 +20,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 #include "mbutil/result/file_op_result.h"
@@ -28,6 +30,18 @@
 namespace mb::util
 {
 
-FileOpResult<void> delete_recursive(const std::string &path);
+enum class DeleteFlag : uint8_t
+{
+    // Delete top-level subtrees concurrently
+    Parallel        = 1 << 0,
+};
+MB_DECLARE_FLAGS(DeleteFlags, DeleteFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DeleteFlags)
+
+FileOpResult<void> delete_recursive(const std::string &path,
+                                    DeleteFlags flags = {});
+FileOpResult<void> delete_contents(const std::string &path,
+                                   const std::vector<std::string> &exclusions,
+                                   DeleteFlags flags = {});
 
 }
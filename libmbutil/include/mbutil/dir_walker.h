@@ -0,0 +1,141 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/flags.h"
+
+#include "mbutil/fts.h"
+
+namespace mb::util
+{
+
+enum class DirWalkerFlag : uint8_t
+{
+    // If tree contains a mountpoint, traverse its contents
+    CrossMountPointBoundaries   = 1 << 0,
+    // Call on_reached_special_file() instead of separate functions
+    GroupSpecialFiles           = 1 << 1,
+};
+MB_DECLARE_FLAGS(DirWalkerFlags, DirWalkerFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(DirWalkerFlags)
+
+struct DirWalkerEntry
+{
+    // Path of the entry, including the input path as a prefix
+    std::string path;
+    // Offset of the file name in path. For the root, this is 0.
+    size_t name_offset;
+    // Directory containing the entry. For the root, this is AT_FDCWD.
+    int parent_fd;
+    // Depth of the entry. The root is at level 0.
+    int level;
+    // DT_* type of the entry
+    unsigned char type;
+
+    // Name to pass to *at() functions along with parent_fd
+    const char * name() const
+    {
+        return path.c_str() + name_offset;
+    }
+};
+
+class DirWalker
+{
+public:
+    using Action = FtsWrapper::Action;
+    using Actions = FtsWrapper::Actions;
+
+    DirWalker(std::string path, DirWalkerFlags flags);
+    virtual ~DirWalker();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(DirWalker)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(DirWalker)
+
+    bool run();
+    std::string error();
+
+    virtual bool on_pre_execute();
+    virtual bool on_post_execute(bool success);
+    virtual Actions on_changed_path();
+    virtual Actions on_reached_directory_pre();
+    virtual Actions on_reached_directory_post();
+    virtual Actions on_reached_file();
+    virtual Actions on_reached_symlink();
+    virtual Actions on_reached_special_file();
+
+    // Special files
+    virtual Actions on_reached_block_device();
+    virtual Actions on_reached_character_device();
+    virtual Actions on_reached_fifo();
+    virtual Actions on_reached_socket();
+
+protected:
+    const struct stat * curr_stat();
+
+    // Input path
+    std::string _path;
+    // Input flags
+    DirWalkerFlags _flags;
+    // Current entry
+    DirWalkerEntry *_curr;
+    // Error message (valid only if run() returned false)
+    std::string _error_msg;
+
+private:
+    /*! \cond INTERNAL */
+    struct Level
+    {
+        int fd;
+        // Length of the directory's path and offset of its name
+        size_t path_len;
+        size_t name_offset;
+        // NUL-terminated names of the children
+        std::string names;
+        // Offset into names and DT_* type of each child
+        std::vector<std::pair<size_t, unsigned char>> children;
+        size_t next;
+        struct stat sb;
+    };
+
+    bool walk();
+    Actions visit(bool post);
+    bool descend();
+    bool read_children(Level &level);
+    void close_levels();
+
+    DirWalkerEntry _entry;
+    struct stat _sb;
+    bool _sb_valid;
+
+    dev_t _root_dev;
+    std::vector<Level> _levels;
+    size_t _depth;
+    std::vector<char> _dirent_buf;
+
+    bool _ran;
+    /*! \endcond */
+};
+
+}
@@ -48,6 +48,11 @@ namespace mb
 
 #define PROP_MSG_SETPROP 1
 #define PROP_MSG_SETPROP2 0x00020001
+// mbtool extension: sets up to PROP_SETPROPS_MAX properties in one message.
+// The message is a count followed by that many name and value string pairs.
+// The reply is one result code per property.
+#define PROP_MSG_SETPROPS_MB 0x4d420001
+#define PROP_SETPROPS_MAX 1024
 
 #define PROP_SUCCESS 0
 #define PROP_ERROR_READ_CMD 0x0004
@@ -124,6 +129,17 @@ int __system_property_update(prop_info *pi, const char *value, unsigned int len)
 */
 uint32_t __system_property_serial(const prop_info* pi);
 
+/* Set multiple system properties using a single connection to the property
+** service. The result code for each property is stored in results. If the
+** property service does not support batched sets, the properties are set one
+** at a time.
+**
+** Returns 0 if all properties were set, -1 otherwise.
+*/
+int __system_property_set_many(const char* const* keys,
+                               const char* const* values, size_t n,
+                               int* results);
+
 /* Initialize the system properties area in read only mode.
  * Should be done by all processes that need to read system
  * properties.
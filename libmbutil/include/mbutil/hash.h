@@ -21,6 +21,7 @@
 
 #include <array>
 #include <string>
+#include <vector>
 
 #include <openssl/sha.h>
 
@@ -31,6 +32,10 @@ namespace mb::util
 
 using Sha512Digest = std::array<unsigned char, SHA512_DIGEST_LENGTH>;
 
+oc::result<Sha512Digest> sha512_hash(int fd);
 oc::result<Sha512Digest> sha512_hash(const std::string &path);
+std::vector<oc::result<Sha512Digest>>
+sha512_hash_files(const std::vector<std::string> &paths,
+                  unsigned int jobs = 0);
 
 }
@@ -19,17 +19,107 @@
 
 #pragma once
 
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include "mbcommon/common.h"
+#include "mbcommon/flags.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
 {
 
+enum class LoopDeviceFlag : uint8_t
+{
+    ReadOnly    = 1 << 0,
+    //! Bypass the page cache of the backing file if the kernel supports it
+    DirectIo    = 1 << 1,
+    //! Detach automatically when the last reference is closed
+    AutoClear   = 1 << 2,
+};
+MB_DECLARE_FLAGS(LoopDeviceFlags, LoopDeviceFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(LoopDeviceFlags)
+
 oc::result<std::string> loopdev_find_unused();
 oc::result<void> loopdev_set_up_device(const std::string &loopdev,
                                        const std::string &file,
                                        uint64_t offset, bool ro);
+oc::result<void> loopdev_set_up_device(const std::string &loopdev,
+                                       const std::string &file,
+                                       uint64_t offset, LoopDeviceFlags flags,
+                                       uint32_t block_size = 0);
 oc::result<void> loopdev_remove_device(const std::string &loopdev);
+oc::result<bool> loopdev_supports_discard(const std::string &loopdev);
+oc::result<std::string> loopdev_find_by_file(const std::string &file);
+
+class LoopDevicePool;
+
+/*!
+ * \brief Loop device attached by a LoopDevicePool
+ *
+ * The loop device node is kept open for the lifetime of the object. Since
+ * devices from a pool are always attached with LoopDeviceFlag::AutoClear, the
+ * kernel detaches the device once this object is destroyed and the filesystem
+ * mounted from it (if any) is unmounted.
+ */
+class LoopDevice
+{
+public:
+    LoopDevice() noexcept;
+    ~LoopDevice();
+
+    LoopDevice(LoopDevice &&other) noexcept;
+    LoopDevice & operator=(LoopDevice &&rhs) noexcept;
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(LoopDevice)
+
+    const std::string & path() const;
+    bool is_attached() const;
+
+    oc::result<void> detach();
+
+private:
+    friend class LoopDevicePool;
+
+    LoopDevice(LoopDevicePool *pool, std::string path, int fd) noexcept;
+
+    LoopDevicePool *_pool;
+    std::string _path;
+    int _fd;
+};
+
+/*!
+ * \brief Pool of loop devices that are found ahead of time
+ *
+ * Finding an unused loop device may require an ioctl for every existing loop
+ * device. reserve() does this once up front so that attach() only needs to
+ * configure a device. The pool must outlive the LoopDevice objects it returns.
+ */
+class LoopDevicePool
+{
+public:
+    LoopDevicePool();
+    ~LoopDevicePool();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(LoopDevicePool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(LoopDevicePool)
+
+    oc::result<void> reserve(size_t count);
+
+    oc::result<LoopDevice> attach(const std::string &file, uint64_t offset,
+                                  LoopDeviceFlags flags,
+                                  uint32_t block_size = 0);
+
+private:
+    friend class LoopDevice;
+
+    oc::result<std::string> take();
+    void put(std::string path);
+
+    std::mutex _mutex;
+    std::vector<std::string> _free;
+    int _next_scan;
+};
 
 }
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+/*
+ * Throughput metrics for long running operations. Work is attributed to the
+ * innermost MetricsStage of the calling thread (and all of its parents), so
+ * the functions that do I/O only need to report what they did.
+ */
+
+namespace mb::util
+{
+
+struct StageMetrics;
+
+/*!
+ * \brief Statistics of a finished stage
+ */
+struct StageSummary
+{
+    std::string name;
+    double seconds;
+    // Files (or other items) processed and their total size
+    uint64_t files;
+    uint64_t bytes;
+    // Bytes read from and written to storage and the time spent doing so
+    uint64_t bytes_read;
+    double read_seconds;
+    uint64_t bytes_written;
+    double write_seconds;
+};
+
+/*!
+ * \brief Collect metrics for the lifetime of the object
+ *
+ * The stage becomes the current stage of the calling thread. A nested stage's
+ * name is prefixed with its parent's name. While system tracing is on, the
+ * stage is also traced as an ATRACE section of that name.
+ */
+class MetricsStage
+{
+public:
+    explicit MetricsStage(std::string name);
+    MetricsStage(std::string name, std::shared_ptr<StageMetrics> parent);
+    ~MetricsStage();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MetricsStage)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MetricsStage)
+
+    static std::shared_ptr<StageMetrics> current();
+
+private:
+    std::shared_ptr<StageMetrics> _metrics;
+    StageMetrics *_prev;
+    bool _traced;
+};
+
+/*!
+ * \brief Attribute work on the calling thread to another thread's stage
+ *
+ * This is used by worker threads to report to the stage that spawned them.
+ */
+class MetricsBinding
+{
+public:
+    explicit MetricsBinding(std::shared_ptr<StageMetrics> metrics);
+    ~MetricsBinding();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MetricsBinding)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MetricsBinding)
+
+private:
+    std::shared_ptr<StageMetrics> _metrics;
+    StageMetrics *_prev;
+};
+
+/*!
+ * \brief Periodically log the progress of all running stages
+ */
+class MetricsReporter
+{
+public:
+    explicit MetricsReporter(std::chrono::seconds interval);
+    ~MetricsReporter();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MetricsReporter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MetricsReporter)
+
+private:
+    std::chrono::seconds _interval;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+    std::thread _thread;
+
+    void run();
+};
+
+/*!
+ * \brief Set the number of bytes that the current stage is expected to read
+ *
+ * This is used to estimate the remaining time in the progress reports.
+ */
+void metrics_set_expected_read_bytes(uint64_t bytes);
+
+void metrics_add_files(uint64_t files, uint64_t bytes);
+void metrics_add_read(uint64_t bytes, std::chrono::steady_clock::duration time);
+void metrics_add_write(uint64_t bytes,
+                       std::chrono::steady_clock::duration time);
+
+std::vector<StageSummary> metrics_finished_stages();
+
+}
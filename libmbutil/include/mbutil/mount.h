@@ -21,7 +21,13 @@
 
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
+#include <sys/types.h>
+
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
@@ -62,6 +68,38 @@ struct MountEntry
     std::optional<int> passno;
 };
 
+/*!
+ * \brief Snapshot of the mount table
+ *
+ * The table is parsed once and then only re-parsed by refresh() when the
+ * kernel reports that the mount table has changed. Lookups by mount point and
+ * by source are indexed.
+ */
+class MountTable
+{
+public:
+    MountTable();
+    ~MountTable();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(MountTable)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(MountTable)
+
+    oc::result<void> refresh();
+    void invalidate();
+
+    const std::vector<MountEntry> & entries() const;
+    const MountEntry * find_by_target(std::string_view target) const;
+    const MountEntry * find_by_source(std::string_view source) const;
+
+private:
+    int _fd;
+    ino_t _ns;
+    bool _loaded;
+    std::vector<MountEntry> _entries;
+    std::unordered_map<std::string_view, size_t> _by_target;
+    std::unordered_map<std::string_view, size_t> _by_source;
+};
+
 oc::result<std::vector<MountEntry>> get_mount_entries();
 
 oc::result<void> is_mounted(const std::string &mountpoint);
@@ -19,12 +19,16 @@
 
 #pragma once
 
+#include <array>
 #include <functional>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "mbcommon/common.h"
 #include "mbcommon/integer.h"
 
 
@@ -62,6 +66,8 @@ inline IntType property_get_num(const std::string &key, IntType default_value)
 }
 
 bool property_set(const std::string &key, const std::string &value);
+std::vector<bool> property_set_many(
+        const std::vector<std::pair<std::string, std::string>> &props);
 bool property_set_direct(const std::string &key, const std::string &value);
 
 bool property_iter(const std::function<PropertyIterCb> &fn);
@@ -96,8 +102,73 @@ inline IntType property_file_get_num(const std::string &path,
 bool property_file_iter(const std::string &path, std::string_view filter,
                         const std::function<PropertyIterCb> &fn);
 
+size_t property_file_get_many(const std::string &path,
+                              const std::string_view *keys,
+                              std::optional<std::string> *values, size_t n);
+
+template<size_t N>
+inline std::array<std::optional<std::string>, N>
+property_file_get_many(const std::string &path,
+                       const std::string_view (&keys)[N])
+{
+    std::array<std::optional<std::string>, N> values;
+    property_file_get_many(path, keys, values.data(), N);
+    return values;
+}
+
 std::optional<PropertiesMap> property_file_get_all(const std::string &path);
 
 bool property_file_write_all(const std::string &path, const PropertiesMap &map);
 
+struct PropertyLookup
+{
+    std::string_view key;
+    std::optional<std::string_view> value;
+};
+
+/*!
+ * \brief Memory mapped, read-only view of a properties file
+ *
+ * Keys and values are views into the mapping and are only valid while the
+ * view is open. Nothing is copied or allocated during lookups. Unlike
+ * property_file_iter(), `import` lines are not followed.
+ */
+class PropertyFileView
+{
+public:
+    PropertyFileView();
+    ~PropertyFileView();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(PropertyFileView)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(PropertyFileView)
+
+    bool open(const std::string &path);
+    void close();
+    bool is_open() const;
+
+    bool iter(std::string_view filter,
+              const std::function<PropertyIterCb> &fn) const;
+
+    std::optional<std::string_view> get(std::string_view key) const;
+    size_t lookup(PropertyLookup *items, size_t n) const;
+
+    template<size_t N>
+    size_t lookup(PropertyLookup (&items)[N]) const
+    {
+        return lookup(items, N);
+    }
+
+    void build_index();
+
+private:
+    std::string_view data() const;
+
+    void *_map;
+    size_t _size;
+    bool _is_open;
+    // Properties sorted by key (only valid if _indexed is true)
+    std::vector<std::pair<std::string_view, std::string_view>> _index;
+    bool _indexed;
+};
+
 }
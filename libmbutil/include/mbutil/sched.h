@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include "mbcommon/outcome.h"
+
+namespace mb::util
+{
+
+enum class SchedPolicy
+{
+    //! Any CPU, normal CPU and I/O priority
+    Default,
+    //! Prefer the fastest CPUs, normal CPU and I/O priority
+    Performance,
+    //! Any CPU, low CPU priority and idle I/O priority
+    Background,
+};
+
+std::optional<SchedPolicy> sched_policy_from_string(std::string_view str);
+
+oc::result<std::vector<int>> performance_cpus();
+
+oc::result<void> set_thread_sched_policy(SchedPolicy policy);
+oc::result<void> set_sched_policy(SchedPolicy policy);
+
+}
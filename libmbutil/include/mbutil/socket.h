@@ -24,6 +24,7 @@
 
 #include <cinttypes>
 
+#include "mbcommon/common.h"
 #include "mbcommon/outcome.h"
 
 namespace mb::util
@@ -52,4 +53,57 @@ oc::result<void> socket_write_string_array(int fd, const std::vector<std::string
 oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds);
 oc::result<void> socket_send_fds(int fd, const std::vector<int> &fds);
 
+/*!
+ * \brief Length-prefixed message framing over a stream socket
+ *
+ * The wire format is identical to socket_read_bytes() and socket_write_bytes()
+ * (a native-endian int32 length followed by the payload), but received frames
+ * are read into a single buffer that is reused for the lifetime of the object.
+ * The socket is read opportunistically, so the length prefix and the payload
+ * of a small frame normally arrive in one read() call and any bytes belonging
+ * to the next frame are kept for the next call to receive(). Because of this,
+ * the file descriptor must not be read from directly while a FramedSocket is
+ * in use.
+ *
+ * Outgoing frames are written with a single writev() call for the length
+ * prefix and the payload.
+ */
+class FramedSocket
+{
+public:
+    struct Frame
+    {
+        const unsigned char *data;
+        size_t size;
+    };
+
+    /*! Payloads at least this large are sent with MSG_ZEROCOPY if enabled */
+    static constexpr size_t ZERO_COPY_THRESHOLD = 64 * 1024;
+
+    explicit FramedSocket(int fd);
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FramedSocket)
+    MB_DEFAULT_MOVE_CONSTRUCT_AND_ASSIGN(FramedSocket)
+
+    int fd() const;
+
+    //! Number of bytes read ahead that have not been returned by receive()
+    size_t buffered() const;
+
+    oc::result<void> enable_zero_copy();
+
+    oc::result<Frame> receive();
+    oc::result<void> send(const void *data, size_t size);
+
+private:
+    oc::result<void> send_zero_copy(const void *data, size_t size);
+
+    int _fd;
+    bool _zero_copy;
+    //! Receive buffer. Bytes in [_begin, _end) have not been consumed yet.
+    std::vector<unsigned char> _buf;
+    size_t _begin;
+    size_t _end;
+};
+
 }
@@ -21,16 +21,40 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <cerrno>
+#include <cinttypes>
+#include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <zlib.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
 #include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/resource_budget.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/atrace.h"
 #include "mbutil/directory.h"
+#include "mbutil/metrics.h"
 #include "mbutil/path.h"
+#include "mbutil/properties.h"
+#include "mbutil/string.h"
 
 #define LOG_TAG "mbutil/archive"
 
@@ -49,12 +73,17 @@
 #define LIBARCHIVE_DISK_READER_FLAGS \
     ARCHIVE_READDISK_MAC_COPYFILE
 
+// Size of the input for each independently compressed gzip member
+#define PARALLEL_GZIP_BLOCK_SIZE (1024 * 1024)
+
 namespace mb::util
 {
 
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
 using ScopedLinkResolver = std::unique_ptr<archive_entry_linkresolver,
         decltype(archive_entry_linkresolver_free) *>;
+using ScopedEVP_MD_CTX = std::unique_ptr<EVP_MD_CTX,
+        decltype(EVP_MD_CTX_free) *>;
 
 int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
 {
@@ -81,13 +110,19 @@ int libarchive_copy_data(archive *in, archive *out, archive_entry *entry)
     return ARCHIVE_OK;
 }
 
-/*!
- * \brief Copy sparse file on disk to an archive
- *
- * \see tar/write.c from libarchive's source code
- */
-bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
-                                          archive_entry *entry)
+static void hash_zeros(EVP_MD_CTX *md, uint64_t size)
+{
+    static const char zeros[64 * 1024] = {};
+
+    while (size > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(size, sizeof(zeros)));
+        EVP_DigestUpdate(md, zeros, n);
+        size -= n;
+    }
+}
+
+static bool copy_data_disk_to_archive(archive *in, archive *out,
+                                      archive_entry *entry, EVP_MD_CTX *md)
 {
     size_t bytes_read;
     ssize_t bytes_written;
@@ -97,8 +132,15 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
     const void *buf;
     int ret;
 
-    while ((ret = archive_read_data_block(
-            in, &buf, &bytes_read, &offset)) == ARCHIVE_OK) {
+    while (true) {
+        auto read_start = std::chrono::steady_clock::now();
+        ret = archive_read_data_block(in, &buf, &bytes_read, &offset);
+        if (ret != ARCHIVE_OK) {
+            break;
+        }
+        metrics_add_read(bytes_read,
+                         std::chrono::steady_clock::now() - read_start);
+
         if (offset > progress) {
             int64_t sparse = offset - progress;
             size_t ns;
@@ -122,6 +164,10 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
                     return false;
                 }
 
+                if (md) {
+                    EVP_DigestUpdate(md, null_buf, ns);
+                }
+
                 progress += bytes_written;
                 sparse -= bytes_written;
             }
@@ -139,6 +185,10 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
             return false;
         }
 
+        if (md) {
+            EVP_DigestUpdate(md, buf, bytes_read);
+        }
+
         progress += bytes_written;
     }
 
@@ -147,9 +197,26 @@ bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
         return false;
     }
 
+    // A trailing hole is padded with zeros by the archive writer
+    if (md && progress < archive_entry_size(entry)) {
+        hash_zeros(md, static_cast<uint64_t>(
+                archive_entry_size(entry) - progress));
+    }
+
     return true;
 }
 
+/*!
+ * \brief Copy sparse file on disk to an archive
+ *
+ * \see tar/write.c from libarchive's source code
+ */
+bool libarchive_copy_data_disk_to_archive(archive *in, archive *out,
+                                          archive_entry *entry)
+{
+    return copy_data_disk_to_archive(in, out, entry, nullptr);
+}
+
 int libarchive_copy_header_and_data(archive *in, archive *out,
                                     archive_entry *entry)
 {
@@ -260,11 +327,14 @@ struct SplitReaderCtx : SplitCtx
                 }
             }
 
+            auto read_start = std::chrono::steady_clock::now();
             auto n = ctx->file.read(ctx->buf.data(), ctx->buf.size());
             if (!n) {
                 set_archive_error(a, n.error());
                 return -1;
             }
+            metrics_add_read(n.value(),
+                             std::chrono::steady_clock::now() - read_start);
 
             if (n.value() == 0 && ctx->is_split()) {
                 ctx->move_to_next();
@@ -276,18 +346,197 @@ struct SplitReaderCtx : SplitCtx
         }
     }
 
+    /*!
+     * \brief Start reading at \p offset of the (concatenated) archive
+     */
+    oc::result<void> seek_to(uint64_t offset)
+    {
+        while (is_split()) {
+            std::string filename(path);
+            filename += format(".%d", split_num);
+
+            struct stat sb;
+            if (stat(filename.c_str(), &sb) < 0) {
+                return ec_from_errno();
+            } else if (static_cast<uint64_t>(sb.st_size) > offset) {
+                break;
+            }
+
+            offset -= static_cast<uint64_t>(sb.st_size);
+            move_to_next();
+        }
+
+        OUTCOME_TRYV(open_if_needed(FileOpenMode::ReadOnly));
+        OUTCOME_TRYV(file.seek(static_cast<int64_t>(offset), SEEK_SET));
+
+        return oc::success();
+    }
+
     int archive_open(archive *a)
     {
         return archive_read_open(a, this, nullptr, &la_read_cb, &la_close_cb);
     }
 };
 
+/*!
+ * \brief Block-parallel gzip compressor
+ *
+ * The input is split into fixed-size blocks and each block is compressed into
+ * an independent gzip member by a task on the global Executor, like pigz's
+ * --independent mode. Concatenated gzip members are a valid gzip stream.
+ * Compressed blocks are passed to the writer function in order on the calling
+ * thread.
+ */
+class ParallelGzipCompressor
+{
+public:
+    using Writer = std::function<oc::result<void>(const void *, size_t)>;
+
+    ParallelGzipCompressor(unsigned int threads, int level, Writer writer)
+        : _max_pending(ResourceBudget::global().buffer_count(
+                2 * PARALLEL_GZIP_BLOCK_SIZE, std::max(threads, 1u) * 2))
+        , _level(level)
+        , _writer(std::move(writer))
+    {
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ParallelGzipCompressor)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ParallelGzipCompressor)
+
+    oc::result<void> write(const void *data, size_t size)
+    {
+        auto ptr = static_cast<const char *>(data);
+
+        while (size > 0) {
+            if (!_current) {
+                _current = std::make_unique<Block>();
+                _current->input.reserve(PARALLEL_GZIP_BLOCK_SIZE);
+            }
+
+            auto n = std::min(size, PARALLEL_GZIP_BLOCK_SIZE
+                    - _current->input.size());
+            _current->input.append(ptr, n);
+            ptr += n;
+            size -= n;
+
+            if (_current->input.size() == PARALLEL_GZIP_BLOCK_SIZE) {
+                OUTCOME_TRYV(submit_current());
+            }
+        }
+
+        return oc::success();
+    }
+
+    /*!
+     * \brief Compress and write the remaining data
+     */
+    oc::result<void> finish()
+    {
+        if (_current && !_current->input.empty()) {
+            OUTCOME_TRYV(submit_current());
+        }
+
+        while (!_pending.empty()) {
+            OUTCOME_TRYV(write_oldest());
+        }
+
+        return oc::success();
+    }
+
+private:
+    struct Block
+    {
+        std::string input;
+        std::string output;
+        bool failed = false;
+        // Destroyed first, so destroying a block waits for its task
+        TaskGroup group;
+    };
+
+    size_t _max_pending;
+    int _level;
+    Writer _writer;
+    // Blocks not yet written, in output order
+    std::deque<std::unique_ptr<Block>> _pending;
+    std::unique_ptr<Block> _current;
+
+    oc::result<void> submit_current()
+    {
+        while (_pending.size() >= _max_pending) {
+            OUTCOME_TRYV(write_oldest());
+        }
+
+        Block *block = _current.get();
+        int level = _level;
+
+        block->group.run([block, level] {
+            block->failed = !compress(*block, level);
+        });
+
+        _pending.push_back(std::move(_current));
+
+        return oc::success();
+    }
+
+    oc::result<void> write_oldest()
+    {
+        auto block = std::move(_pending.front());
+        _pending.pop_front();
+
+        // Runs the compression on this thread if no worker has picked it up
+        block->group.wait();
+
+        if (block->failed) {
+            return std::errc::io_error;
+        }
+
+        return _writer(block->output.data(), block->output.size());
+    }
+
+    static bool compress(Block &block, int level)
+    {
+        z_stream zs = {};
+
+        // 16 + MAX_WBITS for a gzip header and trailer
+        if (deflateInit2(&zs, level < 0 ? Z_DEFAULT_COMPRESSION : level,
+                         Z_DEFLATED, 16 + MAX_WBITS, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            return false;
+        }
+
+        auto end_stream = finally([&] {
+            deflateEnd(&zs);
+        });
+
+        block.output.resize(deflateBound(
+                &zs, static_cast<uLong>(block.input.size())));
+
+        zs.next_in = reinterpret_cast<Bytef *>(block.input.data());
+        zs.avail_in = static_cast<uInt>(block.input.size());
+        zs.next_out = reinterpret_cast<Bytef *>(block.output.data());
+        zs.avail_out = static_cast<uInt>(block.output.size());
+
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+            return false;
+        }
+
+        block.output.resize(zs.total_out);
+
+        // Free the input now that it is no longer needed
+        std::string().swap(block.input);
+
+        return true;
+    }
+};
+
 struct SplitWriterCtx : SplitCtx
 {
     // Bytes written for current file
     uint64_t bytes_written;
     // Max size of split files
     uint64_t max_size;
+    // Compressor for the output, if compression is not done by libarchive
+    std::unique_ptr<ParallelGzipCompressor> gzip;
 
     SplitWriterCtx(std::string path, uint64_t max_size)
         : SplitCtx(std::move(path), max_size > 0)
@@ -296,165 +545,907 @@ struct SplitWriterCtx : SplitCtx
     {
     }
 
-    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
-                                  size_t size)
+    void enable_parallel_gzip(unsigned int threads, int level)
     {
-        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+        gzip = std::make_unique<ParallelGzipCompressor>(
+                threads, level, [this](const void *data, size_t size) {
+            return write_raw(data, size);
+        });
+    }
 
+    oc::result<void> write_raw(const void *data, size_t size)
+    {
         const char *ptr = static_cast<const char *>(data);
         size_t remain = size;
 
         while (remain > 0) {
-            if (auto r = ctx->open_if_needed(FileOpenMode::WriteOnly); !r) {
-                set_archive_error(a, r.error());
-                return -1;
-            }
+            OUTCOME_TRYV(open_if_needed(FileOpenMode::WriteOnly));
 
             auto to_write = static_cast<size_t>(std::min<uint64_t>(
                     remain,
-                    ctx->is_split()
-                    ? (ctx->max_size - ctx->bytes_written)
+                    is_split()
+                    ? (max_size - bytes_written)
                     : remain));
 
-            auto n = ctx->file.write(ptr, to_write);
-            if (!n) {
-                set_archive_error(a, n.error());
-                return -1;
-            }
+            auto write_start = std::chrono::steady_clock::now();
+            OUTCOME_TRY(n, file.write(ptr, to_write));
+            metrics_add_write(n,
+                              std::chrono::steady_clock::now() - write_start);
 
-            ctx->bytes_written += n.value();
-            ptr += n.value();
-            remain -= n.value();
+            bytes_written += n;
+            ptr += n;
+            remain -= n;
 
-            if (ctx->is_split() && ctx->bytes_written == ctx->max_size) {
-                ctx->bytes_written = 0;
-                ctx->move_to_next();
+            if (is_split() && bytes_written == max_size) {
+                bytes_written = 0;
+                move_to_next();
             }
         }
 
+        return oc::success();
+    }
+
+    static la_ssize_t la_write_cb(archive *a, void *userdata, const void *data,
+                                  size_t size)
+    {
+        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+
+        auto ret = ctx->gzip
+                ? ctx->gzip->write(data, size)
+                : ctx->write_raw(data, size);
+        if (!ret) {
+            set_archive_error(a, ret.error());
+            return -1;
+        }
+
         return static_cast<la_ssize_t>(size);
     }
 
+    static int la_writer_close_cb(archive *a, void *userdata)
+    {
+        auto *ctx = static_cast<SplitWriterCtx *>(userdata);
+        int ret = ARCHIVE_OK;
+
+        if (ctx->gzip) {
+            if (auto r = ctx->gzip->finish(); !r) {
+                set_archive_error(a, r.error());
+                ret = ARCHIVE_FATAL;
+            }
+        }
+
+        return std::min(ret, la_close_cb(a, userdata));
+    }
+
     int archive_open(archive *a)
     {
-        return archive_write_open(a, this, nullptr, &la_write_cb, &la_close_cb);
+        return archive_write_open(a, this, nullptr, &la_write_cb,
+                                  &la_writer_close_cb);
     }
 };
 
-/*
- * The following libarchive functions are based on code from bsdtar. The main
- * difference is that they will not try to extract/add as many files as possible
- * from/to the archive. They'll immediately fail after the first error or
- * warning because an incomplete archive is useless for backups and restores.
- */
+// Size of the buffer used to coalesce data blocks in bulk extraction mode
+#define BULK_WRITE_BUFFER_SIZE (1024 * 1024)
 
-bool libarchive_tar_extract(const std::string &filename,
-                            const std::string &target,
-                            const std::vector<std::string> &patterns,
-                            CompressionType compression,
-                            bool is_split)
+struct DeferredMetadata
 {
-    if (target.empty()) {
-        LOGE("%s: Invalid target path for extraction", target.c_str());
-        return false;
-    }
+    std::string path;
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    timespec times[2];
+    std::vector<std::pair<std::string, std::string>> xattrs;
+};
 
-    ScopedArchive matcher(archive_match_new(), archive_match_free);
-    if (!matcher) {
-        LOGE("%s: Out of memory when creating matcher", __FUNCTION__);
-        return false;
-    }
-    ScopedArchive in(archive_read_new(), archive_read_free);
-    if (!in) {
-        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
-        return false;
-    }
-    ScopedArchive out(archive_write_disk_new(), archive_write_free);
-    if (!out) {
-        LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
-        return false;
+/*!
+ * \brief Open a file for writing below a directory without following symlinks
+ *
+ * Every component of \p path is opened with `O_NOFOLLOW`, so neither the file
+ * nor any of its parents can be redirected outside of \p dfd by a symlink.
+ * Missing parent directories are created with mode 0700, matching what
+ * archive_write_disk does for intermediate directories.
+ */
+static int open_below(int dfd, std::string_view path)
+{
+    auto components = split_sv(path, "/");
+    components.erase(std::remove(components.begin(), components.end(),
+                                 std::string_view()), components.end());
+
+    if (components.empty()) {
+        errno = EINVAL;
+        return -1;
     }
 
-    // Set up matcher parameters
-    for (const std::string &pattern : patterns) {
-        if (archive_match_include_pattern(
-                matcher.get(), pattern.c_str()) != ARCHIVE_OK) {
-            LOGE("Invalid pattern: %s", pattern.c_str());
-            return false;
+    int cur_fd = dfd;
+    auto close_cur = finally([&] {
+        if (cur_fd != dfd) {
+            close(cur_fd);
+        }
+    });
+
+    std::string name;
+
+    for (size_t i = 0; i < components.size(); ++i) {
+        if (components[i] == "." || components[i] == "..") {
+            errno = EINVAL;
+            return -1;
+        }
+
+        name = components[i];
+
+        int fd;
+        if (i == components.size() - 1) {
+            fd = openat(cur_fd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC
+                        | O_NOFOLLOW | O_CLOEXEC, 0600);
+        } else {
+            fd = openat(cur_fd, name.c_str(),
+                        O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0 && errno == ENOENT) {
+                if (mkdirat(cur_fd, name.c_str(), 0700) < 0
+                        && errno != EEXIST) {
+                    return -1;
+                }
+                fd = openat(cur_fd, name.c_str(),
+                            O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            }
+        }
+        if (fd < 0) {
+            return -1;
+        }
+
+        if (cur_fd != dfd) {
+            close(cur_fd);
         }
+        cur_fd = fd;
     }
 
-    // Set up archive reader parameters
-    //archive_read_support_format_gnutar(in.get());
-    archive_read_support_format_tar(in.get());
+    int fd = cur_fd;
+    cur_fd = dfd;
+    return fd;
+}
 
-    switch (compression) {
-    case CompressionType::None:
-        break;
-    case CompressionType::Lz4:
-        archive_read_support_filter_lz4(in.get());
-        break;
-    case CompressionType::Gzip:
-        archive_read_support_filter_gzip(in.get());
-        break;
-    case CompressionType::Xz:
-        archive_read_support_filter_xz(in.get());
-        break;
-    default:
-        LOGE("Invalid compression type");
+/*!
+ * \brief Write the data of a regular file entry directly to disk
+ *
+ * The file is preallocated from the entry size and the archive's data blocks
+ * are coalesced into \p buf before being written. The file's ownership,
+ * permissions, xattrs (including SELinux labels), and timestamps are not
+ * applied here, but appended to \p deferred.
+ */
+static bool bulk_extract_file(archive *in, archive_entry *entry, int dfd,
+                              std::string_view path, std::vector<char> &buf,
+                              std::vector<DeferredMetadata> &deferred)
+{
+    const char *target_path = archive_entry_pathname(entry);
+
+    int fd = open_below(dfd, path);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             target_path, strerror(errno));
         return false;
     }
 
-    // Set up disk writer parameters
-    archive_write_disk_set_standard_lookup(out.get());
-    archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
+    auto close_fd = finally([&] {
+        close(fd);
+    });
 
-    SplitReaderCtx ctx(filename, is_split);
-    if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
-        LOGE("%s: Failed to open file: %s",
-             filename.c_str(), archive_error_string(in.get()));
-        return false;
+    auto size = archive_entry_size(entry);
+
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+    // Holes in sparse files should not be allocated
+    if (size > 0 && archive_entry_sparse_count(entry) == 0) {
+        // Not all filesystems support this, so failures are not fatal
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size);
     }
+#endif
 
-    archive_entry *entry;
+    const void *block;
+    size_t block_size;
+    int64_t offset;
+    int64_t buf_offset = 0;
+    size_t buf_used = 0;
     int ret;
-    std::string target_path;
 
-    while (true) {
-        ret = archive_read_next_header(in.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            LOGW("%s: Retrying header read", filename.c_str());
-            continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 filename.c_str(), archive_error_string(in.get()));
-            return false;
+    auto flush = [&] {
+        auto write_start = std::chrono::steady_clock::now();
+        size_t n = 0;
+        while (n < buf_used) {
+            ssize_t written = pwrite(fd, buf.data() + n, buf_used - n,
+                                     buf_offset + static_cast<int64_t>(n));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOGE("%s: Failed to write data: %s",
+                     target_path, strerror(errno));
+                return false;
+            }
+            n += static_cast<size_t>(written);
         }
+        metrics_add_write(buf_used,
+                          std::chrono::steady_clock::now() - write_start);
+        buf_offset += static_cast<int64_t>(buf_used);
+        buf_used = 0;
+        return true;
+    };
 
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", filename.c_str());
-            return false;
+    while ((ret = archive_read_data_block(
+            in, &block, &block_size, &offset)) == ARCHIVE_OK) {
+        auto data = static_cast<const char *>(block);
+
+        // Flush on holes
+        if (offset != buf_offset + static_cast<int64_t>(buf_used)) {
+            if (!flush()) {
+                return false;
+            }
+            buf_offset = offset;
         }
 
-        LOGV("%s", path);
+        while (block_size > 0) {
+            size_t n = std::min(block_size, buf.size() - buf_used);
+            memcpy(buf.data() + buf_used, data, n);
+            buf_used += n;
+            data += n;
+            block_size -= n;
 
-        // Build path
-        target_path = target;
-        if (target_path.back() != '/' && *path != '/') {
+            if (buf_used == buf.size() && !flush()) {
+                return false;
+            }
+        }
+    }
+
+    if (ret != ARCHIVE_EOF) {
+        LOGE("%s: Data copy ended without reaching EOF: %s",
+             target_path, archive_error_string(in));
+        return false;
+    } else if (!flush()) {
+        return false;
+    }
+
+    // Make sure trailing holes are accounted for and drop any preallocated
+    // space past the end of the file
+    if (ftruncate(fd, size) < 0) {
+        LOGE("%s: Failed to truncate: %s", target_path, strerror(errno));
+        return false;
+    }
+
+    close_fd.dismiss();
+    if (close(fd) < 0) {
+        LOGE("%s: Failed to close: %s", target_path, strerror(errno));
+        return false;
+    }
+
+    auto &metadata = deferred.emplace_back();
+    metadata.path = target_path;
+    metadata.uid = static_cast<uid_t>(archive_entry_uid(entry));
+    metadata.gid = static_cast<gid_t>(archive_entry_gid(entry));
+    metadata.mode = archive_entry_perm(entry);
+
+    if (archive_entry_atime_is_set(entry)) {
+        metadata.times[0].tv_sec = archive_entry_atime(entry);
+        metadata.times[0].tv_nsec = archive_entry_atime_nsec(entry);
+    } else {
+        metadata.times[0].tv_sec = 0;
+        metadata.times[0].tv_nsec = UTIME_OMIT;
+    }
+    if (archive_entry_mtime_is_set(entry)) {
+        metadata.times[1].tv_sec = archive_entry_mtime(entry);
+        metadata.times[1].tv_nsec = archive_entry_mtime_nsec(entry);
+    } else {
+        metadata.times[1].tv_sec = 0;
+        metadata.times[1].tv_nsec = UTIME_OMIT;
+    }
+
+    const char *name;
+    const void *value;
+    size_t value_size;
+
+    archive_entry_xattr_reset(entry);
+    while (archive_entry_xattr_next(
+            entry, &name, &value, &value_size) == ARCHIVE_OK) {
+        metadata.xattrs.emplace_back(
+                name, std::string(static_cast<const char *>(value),
+                                  value_size));
+    }
+
+    return true;
+}
+
+static bool apply_deferred_metadata(const DeferredMetadata &metadata)
+{
+    int fd = open(metadata.path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", metadata.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    // Ownership must be set first because it clears the setuid/setgid bits
+    if (fchown(fd, metadata.uid, metadata.gid) < 0) {
+        LOGE("%s: Failed to set ownership: %s",
+             metadata.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    for (auto const &[name, value] : metadata.xattrs) {
+        if (fsetxattr(fd, name.c_str(), value.data(), value.size(), 0) < 0) {
+            LOGE("%s: Failed to set xattr %s: %s",
+                 metadata.path.c_str(), name.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    if (fchmod(fd, metadata.mode) < 0) {
+        LOGE("%s: Failed to set permissions: %s",
+             metadata.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (futimens(fd, metadata.times) < 0) {
+        LOGE("%s: Failed to set timestamps: %s",
+             metadata.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * The following libarchive functions are based on code from bsdtar. The main
+ * difference is that they will not try to extract/add as many files as possible
+ * from/to the archive. They'll immediately fail after the first error or
+ * warning because an incomplete archive is useless for backups and restores.
+ */
+
+constexpr char TAR_INDEX_MAGIC[] = "mbutil-tar-index 1";
+
+/*!
+ * \brief Entry in the index written next to an archive by tar_create()
+ */
+struct TarIndexEntry
+{
+    // Offset of the entry's headers in the uncompressed tar stream
+    uint64_t offset;
+    // One of "fdlhbcp" (h is a hard link)
+    char type;
+    mode_t mode;
+    uint64_t size;
+    // Hex SHA-256 digest of the contents of regular files
+    std::string sha256;
+    std::string path;
+    // Hard link target
+    std::string link;
+};
+
+static char entry_type(archive_entry *entry)
+{
+    if (archive_entry_hardlink(entry)) {
+        return 'h';
+    }
+
+    switch (archive_entry_filetype(entry)) {
+    case AE_IFREG:
+        return 'f';
+    case AE_IFDIR:
+        return 'd';
+    case AE_IFLNK:
+        return 'l';
+    case AE_IFBLK:
+        return 'b';
+    case AE_IFCHR:
+        return 'c';
+    case AE_IFIFO:
+        return 'p';
+    default:
+        return '?';
+    }
+}
+
+static std::string encode_index_path(std::string_view path)
+{
+    std::string result;
+
+    for (char c : path) {
+        auto uc = static_cast<unsigned char>(c);
+        if (uc <= 0x20 || uc == 0x7f || c == '%') {
+            result += format("%%%02x", uc);
+        } else {
+            result += c;
+        }
+    }
+
+    return result;
+}
+
+static bool decode_index_path(std::string_view str, std::string &path)
+{
+    path.clear();
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] != '%') {
+            path += str[i];
+            continue;
+        } else if (i + 2 >= str.size()) {
+            return false;
+        }
+
+        unsigned char c;
+        if (!str_to_num(std::string(str.substr(i + 1, 2)).c_str(), 16, c)) {
+            return false;
+        }
+
+        path += static_cast<char>(c);
+        i += 2;
+    }
+
+    return !path.empty();
+}
+
+static std::string finish_digest(EVP_MD_CTX *md)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int size;
+
+    EVP_DigestFinal_ex(md, digest, &size);
+
+    return hex_string(digest, size);
+}
+
+/*!
+ * \brief Writes the index of an archive as it is being created
+ *
+ * The index is written to a temporary file and only moved into place once the
+ * archive is complete.
+ */
+class TarIndexWriter
+{
+public:
+    TarIndexWriter() : _fp(nullptr, fclose)
+    {
+    }
+
+    ~TarIndexWriter()
+    {
+        if (_fp) {
+            _fp.reset();
+            unlink(_temp_path.c_str());
+        }
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TarIndexWriter)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TarIndexWriter)
+
+    bool open(const std::string &filename)
+    {
+        _path = filename;
+        _path += ARCHIVE_INDEX_SUFFIX;
+        _temp_path = _path;
+        _temp_path += ".tmp";
+
+        _fp.reset(fopen(_temp_path.c_str(), "we"));
+        if (!_fp) {
+            LOGE("%s: Failed to open for writing: %s",
+                 _temp_path.c_str(), strerror(errno));
+            return false;
+        }
+
+        return write_line(format("%s\n", TAR_INDEX_MAGIC));
+    }
+
+    bool add(archive_entry *entry, uint64_t offset, const std::string &sha256)
+    {
+        char type = entry_type(entry);
+
+        std::string line = format(
+                "%" PRIu64 " %c %o %" PRId64 " %s %s", offset, type,
+                static_cast<unsigned int>(archive_entry_perm(entry)),
+                archive_entry_size(entry),
+                sha256.empty() ? "-" : sha256.c_str(),
+                encode_index_path(archive_entry_pathname(entry)).c_str());
+        if (type == 'h') {
+            line += ' ';
+            line += encode_index_path(archive_entry_hardlink(entry));
+        }
+        line += '\n';
+
+        return write_line(line);
+    }
+
+    bool commit()
+    {
+        if (fclose(_fp.release()) == EOF) {
+            LOGE("%s: Failed to close: %s",
+                 _temp_path.c_str(), strerror(errno));
+            unlink(_temp_path.c_str());
+            return false;
+        }
+
+        if (rename(_temp_path.c_str(), _path.c_str()) < 0) {
+            LOGE("%s: Failed to rename to %s: %s", _temp_path.c_str(),
+                 _path.c_str(), strerror(errno));
+            unlink(_temp_path.c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+private:
+    std::string _path;
+    std::string _temp_path;
+    std::unique_ptr<FILE, decltype(fclose) *> _fp;
+
+    bool write_line(const std::string &line)
+    {
+        if (fputs(line.c_str(), _fp.get()) == EOF) {
+            LOGE("%s: Failed to write: %s",
+                 _temp_path.c_str(), strerror(errno));
+            return false;
+        }
+        return true;
+    }
+};
+
+/*!
+ * \brief Read the index of an archive created by tar_create()
+ */
+static bool tar_index_read(const std::string &filename,
+                           std::vector<TarIndexEntry> &entries)
+{
+    std::string path(filename);
+    path += ARCHIVE_INDEX_SUFFIX;
+
+    std::unique_ptr<FILE, decltype(fclose) *> fp(
+            fopen(path.c_str(), "re"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open archive index: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char *buf = nullptr;
+    size_t buf_size = 0;
+    ssize_t n;
+    bool first = true;
+
+    auto free_buf = finally([&] {
+        free(buf);
+    });
+
+    entries.clear();
+
+    while ((n = getline(&buf, &buf_size, fp.get())) >= 0) {
+        std::string_view line(buf, static_cast<size_t>(n));
+        if (!line.empty() && line.back() == '\n') {
+            line.remove_suffix(1);
+        }
+
+        if (first) {
+            if (line != TAR_INDEX_MAGIC) {
+                LOGE("%s: Invalid or unsupported archive index", path.c_str());
+                return false;
+            }
+            first = false;
+            continue;
+        }
+
+        auto fields = split_sv(line, " ");
+        TarIndexEntry entry;
+        unsigned int mode;
+
+        if (fields.size() < 6 || fields[1].size() != 1
+                || !str_to_num(std::string(fields[0]).c_str(), 10,
+                               entry.offset)
+                || !str_to_num(std::string(fields[2]).c_str(), 8, mode)
+                || !str_to_num(std::string(fields[3]).c_str(), 10,
+                               entry.size)
+                || !decode_index_path(fields[5], entry.path)
+                || fields.size() != (fields[1][0] == 'h' ? 7u : 6u)
+                || (fields.size() == 7
+                        && !decode_index_path(fields[6], entry.link))) {
+            LOGE("%s: Malformed archive index entry: %s",
+                 path.c_str(), std::string(line).c_str());
+            return false;
+        }
+
+        entry.type = fields[1][0];
+        entry.mode = static_cast<mode_t>(mode);
+        if (fields[4] != "-") {
+            entry.sha256 = fields[4];
+        }
+
+        entries.push_back(std::move(entry));
+    }
+
+    if (ferror(fp.get())) {
+        LOGE("%s: Failed to read: %s", path.c_str(), strerror(errno));
+        return false;
+    } else if (first) {
+        LOGE("%s: Archive index is empty", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Normalize a path passed to libarchive_tar_extract_paths()
+ */
+static std::string normalize_member_path(std::string_view path)
+{
+    while (!path.empty() && path.front() == '/') {
+        path.remove_prefix(1);
+    }
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    return std::string(path);
+}
+
+static bool is_path_or_child(std::string_view path, std::string_view parent)
+{
+    return starts_with(path, parent) && (path.size() == parent.size()
+            || path[parent.size()] == '/');
+}
+
+/*!
+ * \brief Find the archive members to extract for a set of paths
+ *
+ * A path selects the member with that path and, if it is a directory,
+ * everything below it. Hard links also select their targets.
+ *
+ * \param[in] entries Archive index
+ * \param[in] paths Normalized paths
+ * \param[out] offsets Sorted offsets of the selected members
+ * \param[in,out] matched Set to true for each path that selected something
+ */
+static void select_members(const std::vector<TarIndexEntry> &entries,
+                           const std::vector<std::string> &paths,
+                           std::vector<uint64_t> &offsets,
+                           std::vector<bool> &matched)
+{
+    std::vector<std::string> links;
+
+    offsets.clear();
+
+    for (auto const &entry : entries) {
+        bool selected = false;
+
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (paths[i].empty() || is_path_or_child(entry.path, paths[i])) {
+                matched[i] = true;
+                selected = true;
+            }
+        }
+
+        if (selected) {
+            offsets.push_back(entry.offset);
+            if (entry.type == 'h') {
+                links.push_back(entry.link);
+            }
+        }
+    }
+
+    for (auto const &entry : entries) {
+        if (std::find(links.begin(), links.end(), entry.path) != links.end()) {
+            offsets.push_back(entry.offset);
+        }
+    }
+
+    std::sort(offsets.begin(), offsets.end());
+    offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+}
+
+static bool set_up_read_filter(archive *in, CompressionType compression)
+{
+    switch (compression) {
+    case CompressionType::None:
+        break;
+    case CompressionType::Lz4:
+        archive_read_support_filter_lz4(in);
+        break;
+    case CompressionType::Gzip:
+        archive_read_support_filter_gzip(in);
+        break;
+    case CompressionType::Xz:
+        archive_read_support_filter_xz(in);
+        break;
+    case CompressionType::Zstd:
+        archive_read_support_filter_zstd(in);
+        break;
+    default:
+        LOGE("Invalid compression type");
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Extract an archive
+ *
+ * \param selection If not null, only the members at these offsets (sorted) are
+ *                  extracted. Uncompressed archives are read starting at the
+ *                  first selected member and reading stops after the last one.
+ */
+static bool tar_extract(const std::string &filename,
+                        const std::string &target,
+                        const std::vector<std::string> &patterns,
+                        CompressionType compression,
+                        bool is_split,
+                        TarExtractFlags flags,
+                        const std::vector<uint64_t> *selection)
+{
+    ATraceSection section("tar_extract");
+
+    if (target.empty()) {
+        LOGE("%s: Invalid target path for extraction", target.c_str());
+        return false;
+    }
+
+    ScopedArchive matcher(archive_match_new(), archive_match_free);
+    if (!matcher) {
+        LOGE("%s: Out of memory when creating matcher", __FUNCTION__);
+        return false;
+    }
+    ScopedArchive in(archive_read_new(), archive_read_free);
+    if (!in) {
+        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
+        return false;
+    }
+    ScopedArchive out(nullptr, archive_write_free);
+    {
+        // archive_write_disk_new() briefly sets the umask to 0 to query it,
+        // which could leak into concurrent extractions
+        static std::mutex disk_writer_mutex;
+        std::lock_guard<std::mutex> lock(disk_writer_mutex);
+        out.reset(archive_write_disk_new());
+    }
+    if (!out) {
+        LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
+        return false;
+    }
+
+    // Set up matcher parameters
+    for (const std::string &pattern : patterns) {
+        if (archive_match_include_pattern(
+                matcher.get(), pattern.c_str()) != ARCHIVE_OK) {
+            LOGE("Invalid pattern: %s", pattern.c_str());
+            return false;
+        }
+    }
+
+    // Set up archive reader parameters
+    //archive_read_support_format_gnutar(in.get());
+    archive_read_support_format_tar(in.get());
+
+    if (!set_up_read_filter(in.get(), compression)) {
+        return false;
+    }
+
+    // Set up disk writer parameters
+    archive_write_disk_set_standard_lookup(out.get());
+    archive_write_disk_set_options(out.get(), LIBARCHIVE_DISK_WRITER_FLAGS);
+
+    int target_fd = -1;
+    auto close_target_fd = finally([&] {
+        if (target_fd >= 0) {
+            close(target_fd);
+        }
+    });
+
+    std::vector<char> bulk_buf;
+    std::vector<DeferredMetadata> deferred;
+
+    if (flags & TarExtractFlag::BulkWrite) {
+        target_fd = open(target.c_str(),
+                         O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (target_fd < 0) {
+            LOGE("%s: Failed to open directory: %s",
+                 target.c_str(), strerror(errno));
+            return false;
+        }
+        bulk_buf.resize(BULK_WRITE_BUFFER_SIZE);
+    }
+
+    SplitReaderCtx ctx(filename, is_split);
+
+    // Uncompressed archives can be read from the middle
+    uint64_t base_offset = 0;
+    if (selection && !selection->empty()
+            && compression == CompressionType::None) {
+        base_offset = selection->front();
+        if (auto r = ctx.seek_to(base_offset); !r) {
+            LOGE("%s: Failed to seek to %" PRIu64 ": %s", filename.c_str(),
+                 base_offset, r.error().message().c_str());
+            return false;
+        }
+    }
+
+    if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
+        LOGE("%s: Failed to open file: %s",
+             filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    archive_entry *entry;
+    int ret;
+    std::string target_path;
+    std::string target_link;
+
+    while (true) {
+        ret = archive_read_next_header(in.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            LOGW("%s: Retrying header read", filename.c_str());
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 filename.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        if (selection) {
+            auto offset = base_offset + static_cast<uint64_t>(
+                    archive_read_header_position(in.get()));
+            if (selection->empty() || offset > selection->back()) {
+                break;
+            } else if (!std::binary_search(selection->begin(),
+                                           selection->end(), offset)) {
+                continue;
+            }
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("%s: Header has null or empty filename", filename.c_str());
+            return false;
+        }
+
+        LOGV("%s", path);
+
+        // Build path
+        target_path = target;
+        if (target_path.back() != '/' && *path != '/') {
             target_path += '/';
         }
         target_path += path;
 
         archive_entry_set_pathname(entry, target_path.c_str());
 
+        // Hard link targets are relative to the archive root too
+        if (const char *link = archive_entry_hardlink(entry)) {
+            target_link = target;
+            if (target_link.back() != '/' && *link != '/') {
+                target_link += '/';
+            }
+            target_link += link;
+
+            archive_entry_set_hardlink(entry, target_link.c_str());
+        }
+
         // Check pattern matches
         if (archive_match_excluded(matcher.get(), entry)) {
             continue;
         }
 
+        metrics_add_files(1, static_cast<uint64_t>(archive_entry_size(entry)));
+
+        // Write regular files ourselves in bulk mode. Hard links and all other
+        // file types still go through the disk writer.
+        if (target_fd >= 0 && archive_entry_filetype(entry) == AE_IFREG
+                && !archive_entry_hardlink(entry)) {
+            auto rel_path = std::string_view(target_path).substr(target.size());
+            if (!bulk_extract_file(in.get(), entry, target_fd, rel_path,
+                                   bulk_buf, deferred)) {
+                return false;
+            }
+            continue;
+        }
+
         // Extract file
         ret = archive_read_extract2(in.get(), entry, out.get());
         if (ret != ARCHIVE_OK) {
@@ -469,35 +1460,147 @@ bool libarchive_tar_extract(const std::string &filename,
         return false;
     }
 
+    for (auto const &metadata : deferred) {
+        if (!apply_deferred_metadata(metadata)) {
+            return false;
+        }
+    }
+
     // Check that all patterns were matched
     const char *pattern;
     while ((ret = archive_match_path_unmatched_inclusions_next(
             matcher.get(), &pattern)) == ARCHIVE_OK) {
         LOGE("%s: Pattern not matched: %s", filename.c_str(), pattern);
     }
-    if (ret != ARCHIVE_EOF) {
-        LOGE("%s: %s", filename.c_str(), archive_error_string(matcher.get()));
+    if (ret != ARCHIVE_EOF) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(matcher.get()));
+        return false;
+    }
+
+    return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
+}
+
+bool libarchive_tar_extract(const std::string &filename,
+                            const std::string &target,
+                            const std::vector<std::string> &patterns,
+                            CompressionType compression,
+                            bool is_split,
+                            TarExtractFlags flags)
+{
+    return tar_extract(filename, target, patterns, compression, is_split,
+                       flags, nullptr);
+}
+
+/*!
+ * \brief Extract some paths from an archive using its index
+ *
+ * Only the members with the given paths (or below them, for directories) are
+ * extracted. Uncompressed archives are read starting at the first selected
+ * member. The archive is never read past the last selected member.
+ *
+ * \param filename Archive path
+ * \param target Target directory
+ * \param paths Paths relative to the root of the archive
+ * \param compression Compression type
+ * \param is_split Whether the archive is split
+ * \param flags Extraction flags
+ *
+ * \return Whether extraction was successful. If one of \p paths is not in the
+ *         archive, nothing is extracted and false is returned.
+ */
+bool libarchive_tar_extract_paths(const std::string &filename,
+                                  const std::string &target,
+                                  const std::vector<std::string> &paths,
+                                  CompressionType compression,
+                                  bool is_split,
+                                  TarExtractFlags flags)
+{
+    std::vector<TarIndexEntry> entries;
+    if (!tar_index_read(filename, entries)) {
+        return false;
+    }
+
+    std::vector<std::string> normalized;
+    for (auto const &path : paths) {
+        normalized.push_back(normalize_member_path(path));
+    }
+
+    std::vector<uint64_t> offsets;
+    std::vector<bool> matched(normalized.size());
+    select_members(entries, normalized, offsets, matched);
+
+    bool missing = false;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (!matched[i]) {
+            LOGE("%s: Not found in archive: %s",
+                 filename.c_str(), paths[i].c_str());
+            missing = true;
+        }
+    }
+    if (missing) {
         return false;
     }
 
-    return archive_match_path_unmatched_inclusions(matcher.get()) == 0;
+    return tar_extract(filename, target, {}, compression, is_split, flags,
+                       &offsets);
 }
 
-static bool write_file(archive *in, archive *out, archive_entry *entry)
+static bool write_file(archive *in, archive *out, archive_entry *entry,
+                       TarIndexWriter &index)
 {
     int ret;
 
+    // Pad the previous entry now so that the offset points at this entry's
+    // headers
+    ret = archive_write_finish_entry(out);
+    if (ret != ARCHIVE_OK) {
+        LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
+        return false;
+    }
+
+    auto offset = static_cast<uint64_t>(archive_filter_bytes(out, 0));
+
     ret = archive_write_header(out, entry);
     if (ret != ARCHIVE_OK) {
         LOGE("%s: %s", archive_entry_pathname(entry), archive_error_string(out));
         return false;
     }
 
-    if (archive_entry_size(entry) > 0) {
-        return libarchive_copy_data_disk_to_archive(in, out, entry);
+    metrics_add_files(1, static_cast<uint64_t>(archive_entry_size(entry)));
+
+    std::string sha256;
+
+    if (archive_entry_filetype(entry) == AE_IFREG
+            && !archive_entry_hardlink(entry)) {
+        ScopedEVP_MD_CTX md(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+        if (!md || !EVP_DigestInit_ex(md.get(), EVP_sha256(), nullptr)) {
+            LOGE("%s: Failed to initialize hash",
+                 archive_entry_pathname(entry));
+            return false;
+        }
+
+        if (archive_entry_size(entry) > 0 && !copy_data_disk_to_archive(
+                in, out, entry, md.get())) {
+            return false;
+        }
+
+        sha256 = finish_digest(md.get());
+    } else if (archive_entry_size(entry) > 0
+            && !libarchive_copy_data_disk_to_archive(in, out, entry)) {
+        return false;
     }
 
-    return true;
+    return index.add(entry, offset, sha256);
+}
+
+static void set_filter_option(archive *a, const char *module, const char *key,
+                              const std::string &value)
+{
+    if (archive_write_set_filter_option(
+            a, module, key, value.c_str()) != ARCHIVE_OK) {
+        LOGW("Failed to set %s%s%s=%s: %s", module ? module : "",
+             module ? ":" : "", key, value.c_str(), archive_error_string(a));
+    }
 }
 
 static int metadata_filter(archive *a, void *data, archive_entry *entry)
@@ -511,26 +1614,14 @@ static int metadata_filter(archive *a, void *data, archive_entry *entry)
     return 1;
 }
 
-/*!
- * \brief Create pax archive with all metadata
- *
- * \param filename Target archive path
- * \param base_dir Base directory for \a paths
- * \param paths List of paths to add to the archive
- *
- * \return Whether the archive creation was successful
- */
-bool libarchive_tar_create(const std::string &filename,
-                           const std::string &base_dir,
-                           const std::vector<std::string> &paths,
-                           CompressionType compression,
-                           uint64_t split_archive_size)
+static bool tar_create(const std::string &filename,
+                       const std::string &base_dir,
+                       const std::function<const std::string *()> &next_path,
+                       CompressionType compression,
+                       uint64_t split_archive_size,
+                       unsigned int threads,
+                       int level)
 {
-    if (base_dir.empty() && paths.empty()) {
-        LOGE("%s: No base directory or paths specified", filename.c_str());
-        return false;
-    }
-
     ScopedArchive in(archive_read_disk_new(), archive_read_free);
     if (!in) {
         LOGE("%s: Out of memory when creating disk reader", __FUNCTION__);
@@ -568,6 +1659,11 @@ bool libarchive_tar_create(const std::string &filename,
     //archive_write_set_format_gnutar(out.get());
     archive_write_set_format_pax_restricted(out.get());
     archive_write_set_bytes_per_block(out.get(), 10240);
+    // Don't pad the compressed stream to the block size. zstd decoders treat
+    // trailing zeros as a corrupt frame.
+    if (compression != CompressionType::None) {
+        archive_write_set_bytes_in_last_block(out.get(), 1);
+    }
 
     switch (compression) {
     case CompressionType::None:
@@ -576,35 +1672,67 @@ bool libarchive_tar_create(const std::string &filename,
         archive_write_add_filter_lz4(out.get());
         break;
     case CompressionType::Gzip:
-        archive_write_add_filter_gzip(out.get());
+        // With multiple threads, the output is compressed by SplitWriterCtx
+        if (threads == 1) {
+            archive_write_add_filter_gzip(out.get());
+        }
         break;
     case CompressionType::Xz:
         archive_write_add_filter_xz(out.get());
+        if (threads > 1) {
+            set_filter_option(out.get(), "xz", "threads",
+                              std::to_string(threads));
+        }
+        break;
+    case CompressionType::Zstd:
+        archive_write_add_filter_zstd(out.get());
+        if (threads > 1) {
+            set_filter_option(out.get(), "zstd", "threads",
+                              std::to_string(threads));
+        }
+        // Find matches across files up to 128 MiB apart. This is the largest
+        // window that decoders accept without raising their memory limit.
+        set_filter_option(out.get(), "zstd", "long", "27");
         break;
     default:
         LOGE("Invalid compression type");
         return false;
     }
 
+    if (level >= 0 && !(compression == CompressionType::Gzip && threads > 1)) {
+        set_filter_option(out.get(), nullptr, "compression-level",
+                          std::to_string(level));
+    }
+
     // Set up link resolver parameters
     archive_entry_linkresolver_set_strategy(resolver.get(),
                                             archive_format(out.get()));
 
     // Open output file
     SplitWriterCtx ctx(filename, split_archive_size);
+    if (compression == CompressionType::Gzip && threads > 1) {
+        ctx.enable_parallel_gzip(threads, level);
+    }
     if (ctx.archive_open(out.get()) != ARCHIVE_OK) {
         LOGE("%s: Failed to open file: %s",
              filename.c_str(), archive_error_string(out.get()));
         return false;
     }
 
+    TarIndexWriter index;
+    if (!index.open(filename)) {
+        return false;
+    }
+
     archive_entry *entry = nullptr;
     archive_entry *sparse_entry = nullptr;
     int ret;
     std::string full_path;
 
     // Add hierarchies
-    for (const std::string &path : paths) {
+    while (const std::string *next = next_path()) {
+        const std::string &path = *next;
+
         if (path.empty()) {
             LOGE("%s: Cannot add empty path to the archive", filename.c_str());
             return false;
@@ -678,7 +1806,7 @@ bool libarchive_tar_create(const std::string &filename,
             archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
 
             if (entry) {
-                if (!write_file(in.get(), out.get(), entry)) {
+                if (!write_file(in.get(), out.get(), entry, index)) {
                     archive_entry_free(entry);
                     return false;
                 }
@@ -686,7 +1814,7 @@ bool libarchive_tar_create(const std::string &filename,
                 entry = nullptr;
             }
             if (sparse_entry) {
-                if (!write_file(in.get(), out.get(), sparse_entry)) {
+                if (!write_file(in.get(), out.get(), sparse_entry, index)) {
                     archive_entry_free(sparse_entry);
                     return false;
                 }
@@ -730,7 +1858,7 @@ bool libarchive_tar_create(const std::string &filename,
             return false;
         }
 
-        if (!write_file(in.get(), out.get(), entry)) {
+        if (!write_file(in.get(), out.get(), entry, index)) {
             archive_entry_free(entry);
             return false;
         }
@@ -740,14 +1868,501 @@ bool libarchive_tar_create(const std::string &filename,
         archive_entry_linkify(resolver.get(), &entry, &sparse_entry);
     }
 
-    if (archive_write_close(out.get()) != ARCHIVE_OK) {
-        LOGE("%s: %s", filename.c_str(), archive_error_string(out.get()));
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(out.get()));
+        return false;
+    }
+
+    return index.commit();
+}
+
+/*!
+ * \brief Create pax archive with all metadata
+ *
+ * If \p threads is greater than 1, xz and zstd compression use their
+ * libraries' multithreaded encoders and gzip compression is done in
+ * independently compressed blocks on a pool of threads. lz4 compression is
+ * always single threaded. zstd compression always enables long distance
+ * matching.
+ *
+ * An index listing the offset, metadata, and SHA-256 digest of every member is
+ * written to `<filename>` + \ref ARCHIVE_INDEX_SUFFIX. It is used by
+ * libarchive_tar_extract_paths() and libarchive_tar_verify().
+ *
+ * \param filename Target archive path
+ * \param base_dir Base directory for \a paths
+ * \param paths List of paths to add to the archive
+ * \param compression Compression type
+ * \param split_archive_size Max size for each split file (0 to disable)
+ * \param threads Number of blocks compressed concurrently (0 for the
+ *                concurrency of the global Executor)
+ * \param level Compression level (-1 for the default)
+ *
+ * \return Whether the archive creation was successful
+ */
+bool libarchive_tar_create(const std::string &filename,
+                           const std::string &base_dir,
+                           const std::vector<std::string> &paths,
+                           CompressionType compression,
+                           uint64_t split_archive_size,
+                           unsigned int threads,
+                           int level)
+{
+    ATraceSection section("tar_create");
+
+    if (threads == 0) {
+        threads = Executor::global().concurrency();
+    }
+
+    if (base_dir.empty() && paths.empty()) {
+        LOGE("%s: No base directory or paths specified", filename.c_str());
+        return false;
+    }
+
+    auto it = paths.begin();
+
+    return tar_create(filename, base_dir, [&]() -> const std::string * {
+        return it == paths.end() ? nullptr : &*it++;
+    }, compression, split_archive_size, threads, level);
+}
+
+static std::string segment_path(const std::string &filename, unsigned int n)
+{
+    std::string path(filename);
+    path += ".seg";
+    path += std::to_string(n);
+    return path;
+}
+
+/*!
+ * \brief Create segmented pax archive with all metadata
+ *
+ * The paths are distributed among \p segments workers, each of which writes
+ * an independently compressed, self-contained archive to
+ * `<filename>.seg<N>` (split into `<filename>.seg<N>.<M>` if
+ * \p split_archive_size is nonzero). A manifest listing the segments is
+ * written to `<filename>` + \ref ARCHIVE_SEGMENTS_SUFFIX once all segments
+ * are complete. Since each path in \p paths is stored in exactly one segment,
+ * the segments can be extracted concurrently with
+ * libarchive_tar_extract_segments().
+ *
+ * Hard links are only preserved within a segment. Files linked across
+ * different entries in \p paths may be stored as separate copies.
+ *
+ * \param filename Target archive path prefix
+ * \param base_dir Base directory for \a paths
+ * \param paths List of paths to add to the archive
+ * \param compression Compression type
+ * \param split_archive_size Max size for each split file in a segment (0 to
+ *                           disable)
+ * \param segments Number of segments to create (0 for the concurrency of the
+ *                 global Executor)
+ * \param level Compression level (-1 for the default)
+ *
+ * \return Whether the archive creation was successful
+ */
+bool libarchive_tar_create_segments(const std::string &filename,
+                                    const std::string &base_dir,
+                                    const std::vector<std::string> &paths,
+                                    CompressionType compression,
+                                    uint64_t split_archive_size,
+                                    unsigned int segments,
+                                    int level)
+{
+    ATraceSection section("tar_create_segments");
+
+    if (segments == 0) {
+        segments = Executor::global().concurrency();
+    }
+    segments = std::clamp(segments, 1u, std::max(
+            static_cast<unsigned int>(paths.size()), 1u));
+
+    if (base_dir.empty() && paths.empty()) {
+        LOGE("%s: No base directory or paths specified", filename.c_str());
+        return false;
+    }
+
+    std::mutex mutex;
+    auto it = paths.begin();
+    std::atomic_bool failed{false};
+
+    auto next_path = [&]() -> const std::string * {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failed || it == paths.end()) {
+            return nullptr;
+        }
+        return &*it++;
+    };
+
+    auto stage = MetricsStage::current();
+
+    auto worker = [&](unsigned int n) {
+        MetricsBinding binding(stage);
+
+        if (!tar_create(segment_path(filename, n), base_dir, next_path,
+                        compression, split_archive_size, 1, level)) {
+            failed = true;
+        }
+    };
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < segments; ++i) {
+        group.run([&, i] {
+            worker(i);
+        });
+    }
+    worker(0);
+    group.wait();
+
+    if (failed) {
+        return false;
+    }
+
+    std::string manifest(filename);
+    manifest += ARCHIVE_SEGMENTS_SUFFIX;
+
+    if (!property_file_write_all(manifest, {
+        { "version", "1" },
+        { "segments", std::to_string(segments) },
+        { "split", split_archive_size > 0 ? "true" : "false" },
+    })) {
+        LOGE("%s: Failed to write segment manifest", manifest.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool read_segments_manifest(const std::string &filename,
+                                   unsigned int &segments, bool &is_split)
+{
+    std::string manifest(filename);
+    manifest += ARCHIVE_SEGMENTS_SUFFIX;
+
+    auto version = property_file_get_num<unsigned int>(manifest, "version", 0);
+    segments = property_file_get_num<unsigned int>(manifest, "segments", 0);
+    is_split = property_file_get_bool(manifest, "split", false);
+
+    if (version != 1 || segments == 0) {
+        LOGE("%s: Invalid or unsupported segment manifest", manifest.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Extract segmented archive created by libarchive_tar_create_segments()
+ *
+ * \param filename Archive path prefix (without \ref ARCHIVE_SEGMENTS_SUFFIX)
+ * \param target Target directory
+ * \param compression Compression type
+ * \param jobs Maximum number of segments to extract concurrently (0 for the
+ *             concurrency of the global Executor)
+ * \param flags Extraction flags passed to libarchive_tar_extract()
+ * \param paths If not empty, only extract these paths, like
+ *              libarchive_tar_extract_paths(). Segments that don't contain any
+ *              of the paths are not read at all.
+ *
+ * \return Whether all segments were successfully extracted
+ */
+bool libarchive_tar_extract_segments(const std::string &filename,
+                                     const std::string &target,
+                                     CompressionType compression,
+                                     unsigned int jobs,
+                                     TarExtractFlags flags,
+                                     const std::vector<std::string> &paths)
+{
+    ATraceSection section("tar_extract_segments");
+
+    unsigned int segments;
+    bool is_split;
+
+    if (!read_segments_manifest(filename, segments, is_split)) {
+        return false;
+    }
+
+    // Find the members to extract from each segment
+    std::vector<std::vector<uint64_t>> selections;
+
+    if (!paths.empty()) {
+        std::vector<std::string> normalized;
+        for (auto const &path : paths) {
+            normalized.push_back(normalize_member_path(path));
+        }
+
+        std::vector<bool> matched(normalized.size());
+        std::vector<TarIndexEntry> entries;
+
+        selections.resize(segments);
+
+        for (unsigned int n = 0; n < segments; ++n) {
+            if (!tar_index_read(segment_path(filename, n), entries)) {
+                return false;
+            }
+            select_members(entries, normalized, selections[n], matched);
+        }
+
+        bool missing = false;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (!matched[i]) {
+                LOGE("%s: Not found in archive: %s",
+                     filename.c_str(), paths[i].c_str());
+                missing = true;
+            }
+        }
+        if (missing) {
+            return false;
+        }
+    }
+
+    if (jobs == 0) {
+        jobs = Executor::global().concurrency();
+    }
+    jobs = std::clamp(jobs, 1u, segments);
+
+    std::atomic<unsigned int> next{0};
+    std::atomic_bool failed{false};
+
+    auto stage = MetricsStage::current();
+
+    auto worker = [&] {
+        MetricsBinding binding(stage);
+
+        unsigned int n;
+        while (!failed && (n = next++) < segments) {
+            auto selection = selections.empty() ? nullptr : &selections[n];
+            if (selection && selection->empty()) {
+                continue;
+            }
+            if (!tar_extract(segment_path(filename, n), target, {},
+                             compression, is_split, flags, selection)) {
+                failed = true;
+            }
+        }
+    };
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < jobs; ++i) {
+        group.run(worker);
+    }
+    worker();
+    group.wait();
+
+    return !failed;
+}
+
+/*!
+ * \brief Check an archive against its index
+ *
+ * Every member is decompressed and compared with the index, but nothing is
+ * written to disk. The digests of regular files are checked.
+ *
+ * \param filename Archive path
+ * \param compression Compression type
+ * \param is_split Whether the archive is split
+ *
+ * \return Whether the archive matches its index
+ */
+bool libarchive_tar_verify(const std::string &filename,
+                           CompressionType compression,
+                           bool is_split)
+{
+    ATraceSection section("tar_verify");
+
+    std::vector<TarIndexEntry> entries;
+    if (!tar_index_read(filename, entries)) {
+        return false;
+    }
+
+    ScopedArchive in(archive_read_new(), archive_read_free);
+    if (!in) {
+        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
+        return false;
+    }
+    ScopedEVP_MD_CTX md(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (!md) {
+        LOGE("%s: Out of memory when creating hash context", __FUNCTION__);
+        return false;
+    }
+
+    archive_read_support_format_tar(in.get());
+
+    if (!set_up_read_filter(in.get(), compression)) {
+        return false;
+    }
+
+    SplitReaderCtx ctx(filename, is_split);
+    if (ctx.archive_open(in.get()) != ARCHIVE_OK) {
+        LOGE("%s: Failed to open file: %s",
+             filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    archive_entry *entry;
+    int ret;
+    size_t next = 0;
+    size_t failures = 0;
+
+    while (true) {
+        ret = archive_read_next_header(in.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            LOGW("%s: Retrying header read", filename.c_str());
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header: %s",
+                 filename.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        auto offset = static_cast<uint64_t>(
+                archive_read_header_position(in.get()));
+
+        if (next == entries.size()) {
+            LOGE("%s: %s: Not in index", filename.c_str(), path);
+            ++failures;
+            continue;
+        }
+
+        auto const &expected = entries[next++];
+
+        // Offsets are needed for selective extraction, so the index is
+        // useless if they are wrong
+        if (expected.path != path || expected.offset != offset) {
+            LOGE("%s: Expected %s at offset %" PRIu64 ", but found %s at"
+                 " offset %" PRIu64, filename.c_str(), expected.path.c_str(),
+                 expected.offset, path, offset);
+            return false;
+        }
+
+        if (expected.type != entry_type(entry)
+                || expected.mode != archive_entry_perm(entry)
+                || expected.size != static_cast<uint64_t>(
+                        archive_entry_size(entry))) {
+            LOGE("%s: %s: Metadata does not match index",
+                 filename.c_str(), path);
+            ++failures;
+            continue;
+        }
+
+        metrics_add_files(1, expected.size);
+
+        if (expected.sha256.empty()) {
+            continue;
+        }
+
+        EVP_DigestInit_ex(md.get(), EVP_sha256(), nullptr);
+
+        const void *buf;
+        size_t size;
+        la_int64_t data_offset;
+        uint64_t progress = 0;
+
+        while ((ret = archive_read_data_block(
+                in.get(), &buf, &size, &data_offset)) == ARCHIVE_OK) {
+            if (static_cast<uint64_t>(data_offset) > progress) {
+                hash_zeros(md.get(),
+                           static_cast<uint64_t>(data_offset) - progress);
+            }
+            EVP_DigestUpdate(md.get(), buf, size);
+            progress = static_cast<uint64_t>(data_offset) + size;
+        }
+
+        if (ret != ARCHIVE_EOF) {
+            LOGE("%s: %s: Failed to read data: %s", filename.c_str(), path,
+                 archive_error_string(in.get()));
+            return false;
+        }
+
+        if (progress < expected.size) {
+            hash_zeros(md.get(), expected.size - progress);
+        }
+
+        if (finish_digest(md.get()) != expected.sha256) {
+            LOGE("%s: %s: Contents do not match index", filename.c_str(), path);
+            ++failures;
+        }
+    }
+
+    if (archive_read_close(in.get()) != ARCHIVE_OK) {
+        LOGE("%s: %s", filename.c_str(), archive_error_string(in.get()));
+        return false;
+    }
+
+    if (next < entries.size()) {
+        LOGE("%s: %zu indexed entries are missing from the archive",
+             filename.c_str(), entries.size() - next);
+        ++failures;
+    }
+
+    if (failures > 0) {
+        LOGE("%s: Found %zu problems", filename.c_str(), failures);
         return false;
     }
 
+    LOGV("%s: Verified %zu entries", filename.c_str(), entries.size());
     return true;
 }
 
+/*!
+ * \brief Check a segmented archive against the segments' indexes
+ *
+ * \param filename Archive path prefix (without \ref ARCHIVE_SEGMENTS_SUFFIX)
+ * \param compression Compression type
+ * \param jobs Maximum number of segments to verify concurrently (0 for the
+ *             concurrency of the global Executor)
+ *
+ * \return Whether every segment matches its index
+ */
+bool libarchive_tar_verify_segments(const std::string &filename,
+                                    CompressionType compression,
+                                    unsigned int jobs)
+{
+    ATraceSection section("tar_verify_segments");
+
+    unsigned int segments;
+    bool is_split;
+
+    if (!read_segments_manifest(filename, segments, is_split)) {
+        return false;
+    }
+
+    if (jobs == 0) {
+        jobs = Executor::global().concurrency();
+    }
+    jobs = std::clamp(jobs, 1u, segments);
+
+    std::atomic<unsigned int> next{0};
+    std::atomic_bool failed{false};
+
+    auto stage = MetricsStage::current();
+
+    // Keep going after a failure so that every bad segment is reported
+    auto worker = [&] {
+        MetricsBinding binding(stage);
+
+        unsigned int n;
+        while ((n = next++) < segments) {
+            if (!libarchive_tar_verify(segment_path(filename, n), compression,
+                                       is_split)) {
+                failed = true;
+            }
+        }
+    };
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < jobs; ++i) {
+        group.run(worker);
+    }
+    worker();
+    group.wait();
+
+    return !failed;
+}
+
 static bool set_up_input(archive *in, const std::string &filename)
 {
     // Add more as needed
@@ -779,70 +2394,334 @@ static void set_up_output(archive *out)
                                    ARCHIVE_EXTRACT_XATTR);
 }
 
-bool extract_archive(const std::string &filename, const std::string &target)
+/*
+ * Zip central directory index
+ */
+
+// Maximum size of the end of central directory record, including the comment
+#define ZIP_EOCD_MAX_SIZE (22 + 65535)
+
+#define ZIP_EOCD_SIG            0x06054b50u
+#define ZIP64_EOCD_LOCATOR_SIG  0x07064b50u
+#define ZIP64_EOCD_SIG          0x06064b50u
+#define ZIP_CDFH_SIG            0x02014b50u
+
+#define ZIP64_EXTRA_ID          0x0001u
+
+static uint16_t read_le16(const unsigned char *p)
 {
-    ScopedArchive in(archive_read_new(), archive_read_free);
-    ScopedArchive out(archive_write_disk_new(), archive_write_free);
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
 
-    if (!in || !out) {
-        LOGE("Out of memory");
+static uint32_t read_le32(const unsigned char *p)
+{
+    return static_cast<uint32_t>(p[0])
+            | static_cast<uint32_t>(p[1]) << 8
+            | static_cast<uint32_t>(p[2]) << 16
+            | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static uint64_t read_le64(const unsigned char *p)
+{
+    return static_cast<uint64_t>(read_le32(p))
+            | static_cast<uint64_t>(read_le32(p + 4)) << 32;
+}
+
+/*!
+ * \brief Read the zip central directory
+ *
+ * This only parses the end of central directory record (and its zip64
+ * counterpart) and the central directory itself. None of the members' data is
+ * read.
+ *
+ * \param filename Path to zip file
+ *
+ * \return Whether the central directory was successfully read
+ */
+bool ArchiveIndex::open(const std::string &filename)
+{
+    _filename.clear();
+    _offsets.clear();
+
+    StandardFile file;
+
+    if (auto r = file.open(filename, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open archive: %s",
+             filename.c_str(), r.error().message().c_str());
         return false;
     }
 
-    archive_entry *entry;
-    int ret;
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size) {
+        LOGE("%s: Failed to seek archive: %s",
+             filename.c_str(), file_size.error().message().c_str());
+        return false;
+    }
 
-    auto cwd = get_cwd();
-    if (!cwd) {
-        LOGE("Failed to get working directory: %s",
-             cwd.error().message().c_str());
+    // Find the end of central directory record
+    size_t tail_size = static_cast<size_t>(
+            std::min<uint64_t>(file_size.value(), ZIP_EOCD_MAX_SIZE));
+    uint64_t tail_offset = file_size.value() - tail_size;
+    std::vector<unsigned char> tail(tail_size);
+
+    if (auto r = file_read_exact_at(file, tail_offset, tail.data(), tail_size);
+            !r) {
+        LOGE("%s: Failed to read end of archive: %s",
+             filename.c_str(), r.error().message().c_str());
         return false;
     }
 
-    if (!set_up_input(in.get(), filename)) {
+    size_t eocd_pos = 0;
+    bool found = false;
+
+    for (size_t i = tail_size >= 22 ? tail_size - 22 + 1 : 0; i-- > 0;) {
+        if (read_le32(tail.data() + i) == ZIP_EOCD_SIG
+                && i + 22u + read_le16(tail.data() + i + 20) <= tail_size) {
+            eocd_pos = i;
+            found = true;
+            break;
+        }
+    }
+
+    if (!found) {
+        LOGE("%s: End of central directory record not found",
+             filename.c_str());
         return false;
     }
 
-    set_up_output(out.get());
+    const unsigned char *eocd = tail.data() + eocd_pos;
+    uint64_t entries = read_le16(eocd + 10);
+    uint64_t cd_size = read_le32(eocd + 12);
+    uint64_t cd_offset = read_le32(eocd + 16);
 
-    if (auto r = mkdir_recursive(target, S_IRWXU | S_IRWXG | S_IRWXO); !r) {
-        LOGE("%s: Failed to create directory: %s",
-             target.c_str(), r.error().message().c_str());
+    // Look for the zip64 end of central directory record if needed
+    if ((entries == 0xffffu || cd_size == 0xffffffffu
+            || cd_offset == 0xffffffffu) && eocd_pos >= 20
+            && read_le32(eocd - 20) == ZIP64_EOCD_LOCATOR_SIG) {
+        unsigned char eocd64[56];
+
+        if (auto r = file_read_exact_at(file, read_le64(eocd - 20 + 8),
+                                        eocd64, sizeof(eocd64)); !r) {
+            LOGE("%s: Failed to read zip64 end of central directory: %s",
+                 filename.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (read_le32(eocd64) != ZIP64_EOCD_SIG) {
+            LOGE("%s: Invalid zip64 end of central directory record",
+                 filename.c_str());
+            return false;
+        }
+
+        entries = read_le64(eocd64 + 32);
+        cd_size = read_le64(eocd64 + 40);
+        cd_offset = read_le64(eocd64 + 48);
+    }
+
+    if (cd_offset > file_size.value()
+            || cd_size > file_size.value() - cd_offset) {
+        LOGE("%s: Central directory is out of bounds", filename.c_str());
         return false;
     }
 
-    if (chdir(target.c_str()) < 0) {
-        LOGE("%s: Failed to change to target directory: %s",
-             target.c_str(), strerror(errno));
+    std::vector<unsigned char> cd(static_cast<size_t>(cd_size));
+
+    if (auto r = file_read_exact_at(file, cd_offset, cd.data(), cd.size());
+            !r) {
+        LOGE("%s: Failed to read central directory: %s",
+             filename.c_str(), r.error().message().c_str());
         return false;
     }
 
-    auto chdir_back = finally([&] {
-        chdir(cwd.value().c_str());
-    });
+    size_t pos = 0;
 
-    while ((ret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
-        if (libarchive_copy_header_and_data(in.get(), out.get(), entry) != ARCHIVE_OK) {
+    for (uint64_t n = 0; n < entries; ++n) {
+        if (cd.size() - pos < 46 || read_le32(cd.data() + pos) != ZIP_CDFH_SIG) {
+            LOGE("%s: Invalid central directory file header",
+                 filename.c_str());
+            return false;
+        }
+
+        const unsigned char *header = cd.data() + pos;
+        uint32_t usize = read_le32(header + 24);
+        uint32_t csize = read_le32(header + 20);
+        uint16_t name_len = read_le16(header + 28);
+        uint16_t extra_len = read_le16(header + 30);
+        uint16_t comment_len = read_le16(header + 32);
+        uint64_t offset = read_le32(header + 42);
+
+        if (cd.size() - pos - 46 < size_t(name_len) + extra_len + comment_len) {
+            LOGE("%s: Truncated central directory file header",
+                 filename.c_str());
             return false;
         }
+
+        const unsigned char *name = header + 46;
+        const unsigned char *extra = name + name_len;
+
+        // The zip64 extra field only contains the fields that overflowed, in
+        // this order
+        if (offset == 0xffffffffu) {
+            for (size_t i = 0; i + 4 <= extra_len;) {
+                uint16_t id = read_le16(extra + i);
+                uint16_t size = read_le16(extra + i + 2);
+                i += 4;
+
+                if (id == ZIP64_EXTRA_ID) {
+                    size_t field = i;
+                    if (usize == 0xffffffffu) {
+                        field += 8;
+                    }
+                    if (csize == 0xffffffffu) {
+                        field += 8;
+                    }
+                    if (field + 8 <= i + size && field + 8 <= extra_len) {
+                        offset = read_le64(extra + field);
+                    }
+                    break;
+                }
+
+                i += size;
+            }
+        }
+
+        _offsets.insert_or_assign(
+                std::string(reinterpret_cast<const char *>(name), name_len),
+                offset);
+
+        pos += 46 + size_t(name_len) + extra_len + comment_len;
     }
 
-    if (ret != ARCHIVE_EOF) {
-        LOGE("Archive extraction ended without reaching EOF: %s",
-             archive_error_string(in.get()));
+    _filename = filename;
+
+    return true;
+}
+
+/*!
+ * \brief Check whether the index contains a member
+ */
+bool ArchiveIndex::contains(const std::string &path) const
+{
+    return _offsets.find(path) != _offsets.end();
+}
+
+/*!
+ * \brief Check which members exist in the archive
+ *
+ * \param[in,out] files Members to look up. ExistsInfo::exists is set for each
+ *                      entry.
+ *
+ * \return Whether the index is open
+ */
+bool ArchiveIndex::exists(std::vector<ExistsInfo> &files) const
+{
+    if (_filename.empty()) {
         return false;
     }
 
+    for (ExistsInfo &info : files) {
+        info.exists = contains(info.path);
+    }
+
     return true;
 }
 
-bool extract_files(const std::string &filename, const std::string &target,
-                   const std::vector<std::string> &files)
+/*!
+ * \brief Extract members of the archive
+ *
+ * Each member is read by seeking directly to its local file header, so the
+ * other members are neither decompressed nor skipped over.
+ *
+ * \param files List of members to extract and their target paths
+ *
+ * \return Whether all of the members were successfully extracted
+ */
+bool ArchiveIndex::extract(const std::vector<ExtractInfo> &files) const
 {
-    if (files.empty()) {
+    if (files.empty() || _filename.empty()) {
+        return false;
+    }
+
+    int fd = ::open(_filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open archive: %s",
+             _filename.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    ScopedArchive out(archive_write_disk_new(), archive_write_free);
+    if (!out) {
+        LOGE("Out of memory");
         return false;
     }
 
+    set_up_output(out.get());
+
+    for (const ExtractInfo &info : files) {
+        auto it = _offsets.find(info.from);
+        if (it == _offsets.end()) {
+            LOGE("%s: File not found in archive: %s",
+                 _filename.c_str(), info.from.c_str());
+            return false;
+        }
+
+        if (lseek64(fd, static_cast<off64_t>(it->second), SEEK_SET) < 0) {
+            LOGE("%s: Failed to seek archive: %s",
+                 _filename.c_str(), strerror(errno));
+            return false;
+        }
+
+        // The streaming zip reader only reads forward from the local file
+        // header at the current position
+        ScopedArchive in(archive_read_new(), archive_read_free);
+        if (!in) {
+            LOGE("Out of memory");
+            return false;
+        }
+
+        archive_read_support_format_zip_streamable(in.get());
+
+        if (archive_read_open_fd(in.get(), fd, 10240) != ARCHIVE_OK) {
+            LOGE("%s: Failed to open archive: %s",
+                 _filename.c_str(), archive_error_string(in.get()));
+            return false;
+        }
+
+        archive_entry *entry;
+
+        if (archive_read_next_header(in.get(), &entry) != ARCHIVE_OK) {
+            LOGE("%s: Failed to read header for %s: %s",
+                 _filename.c_str(), info.from.c_str(),
+                 archive_error_string(in.get()));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || info.from != path) {
+            LOGE("%s: Local header does not match %s",
+                 _filename.c_str(), info.from.c_str());
+            return false;
+        }
+
+        archive_entry_set_pathname(entry, info.to.c_str());
+
+        if (libarchive_copy_header_and_data(
+                in.get(), out.get(), entry) != ARCHIVE_OK) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool extract_archive(const std::string &filename, const std::string &target)
+{
+    ATraceSection section("extract_archive");
+
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
 
@@ -853,7 +2732,6 @@ bool extract_files(const std::string &filename, const std::string &target,
 
     archive_entry *entry;
     int ret;
-    unsigned int count = 0;
 
     auto cwd = get_cwd();
     if (!cwd) {
@@ -885,13 +2763,8 @@ bool extract_files(const std::string &filename, const std::string &target,
     });
 
     while ((ret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
-        if (std::find(files.begin(), files.end(),
-                archive_entry_pathname(entry)) != files.end()) {
-            ++count;
-
-            if (libarchive_copy_header_and_data(in.get(), out.get(), entry) != ARCHIVE_OK) {
-                return false;
-            }
+        if (libarchive_copy_header_and_data(in.get(), out.get(), entry) != ARCHIVE_OK) {
+            return false;
         }
     }
 
@@ -901,67 +2774,38 @@ bool extract_files(const std::string &filename, const std::string &target,
         return false;
     }
 
-    if (count != files.size()) {
-        LOGE("Not all specified files were extracted");
-        return false;
-    }
-
     return true;
 }
 
-bool extract_files2(const std::string &filename,
-                    const std::vector<ExtractInfo> &files)
+bool extract_files(const std::string &filename, const std::string &target,
+                   const std::vector<std::string> &files)
 {
     if (files.empty()) {
         return false;
     }
 
-    ScopedArchive in(archive_read_new(), archive_read_free);
-    ScopedArchive out(archive_write_disk_new(), archive_write_free);
-
-    if (!in || !out) {
-        LOGE("Out of memory");
-        return false;
-    }
-
-    archive_entry *entry;
-    int ret;
-    unsigned int count = 0;
-
-    if (!set_up_input(in.get(), filename)) {
+    if (auto r = mkdir_recursive(target, S_IRWXU | S_IRWXG | S_IRWXO); !r) {
+        LOGE("%s: Failed to create directory: %s",
+             target.c_str(), r.error().message().c_str());
         return false;
     }
 
-    set_up_output(out.get());
-
-    while ((ret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
-        for (const ExtractInfo &info : files) {
-            if (info.from == archive_entry_pathname(entry)) {
-                ++count;
-
-                archive_entry_set_pathname(entry, info.to.c_str());
-
-                if (libarchive_copy_header_and_data(in.get(), out.get(), entry) != ARCHIVE_OK) {
-                    return false;
-                }
-
-                archive_entry_set_pathname(entry, info.from.c_str());
-            }
-        }
-    }
+    std::vector<ExtractInfo> info;
+    info.reserve(files.size());
 
-    if (ret != ARCHIVE_EOF) {
-        LOGE("Archive extraction ended without reaching EOF: %s",
-             archive_error_string(in.get()));
-        return false;
+    for (const std::string &file : files) {
+        info.push_back({file, target + "/" + file});
     }
 
-    if (count != files.size()) {
-        LOGE("Not all specified files were extracted");
-        return false;
-    }
+    ArchiveIndex index;
+    return index.open(filename) && index.extract(info);
+}
 
-    return true;
+bool extract_files2(const std::string &filename,
+                    const std::vector<ExtractInfo> &files)
+{
+    ArchiveIndex index;
+    return index.open(filename) && index.extract(files);
 }
 
 bool archive_exists(const std::string &filename,
@@ -971,39 +2815,8 @@ bool archive_exists(const std::string &filename,
         return false;
     }
 
-    ScopedArchive in(archive_read_new(), archive_read_free);
-
-    if (!in) {
-        LOGE("Out of memory");
-        return false;
-    }
-
-    archive_entry *entry;
-    int ret;
-
-    for (ExistsInfo &info : files) {
-        info.exists = false;
-    }
-
-    if (!set_up_input(in.get(), filename)) {
-        return false;
-    }
-
-    while ((ret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
-        for (ExistsInfo &info : files) {
-            if (info.path == archive_entry_pathname(entry)) {
-                info.exists = true;
-            }
-        }
-    }
-
-    if (ret != ARCHIVE_EOF) {
-        LOGE("Archive extraction ended without reaching EOF: %s",
-             archive_error_string(in.get()));
-        return false;
-    }
-
-    return true;
+    ArchiveIndex index;
+    return index.open(filename) && index.exists(files);
 }
 
 }
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/atrace.h"
+
+#ifdef MB_ENABLE_ATRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+#include <cinttypes>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace mb::util
+{
+
+// tracefs is mounted at /sys/kernel/tracing on newer kernels and only under
+// debugfs on older ones
+static const char * const TRACEFS_DIRS[] = {
+    "/sys/kernel/tracing",
+    "/sys/kernel/debug/tracing",
+};
+
+// How often to check whether tracing was turned on or off. Checking on every
+// event would cost a read() even when tracing is off.
+static constexpr std::chrono::milliseconds CHECK_INTERVAL(250);
+
+// Longest event that is written. Longer names are truncated.
+static constexpr size_t MAX_EVENT_SIZE = 256;
+
+static std::mutex g_mutex;
+static int g_marker_fd = -1;
+static int g_tracing_on_fd = -1;
+static std::atomic_bool g_enabled{false};
+static std::atomic<std::chrono::steady_clock::rep> g_next_check{0};
+
+// Must be called with g_mutex locked
+static void open_tracefs()
+{
+    for (auto const &dir : TRACEFS_DIRS) {
+        char path[64];
+
+        snprintf(path, sizeof(path), "%s/trace_marker", dir);
+        int marker_fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (marker_fd < 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/tracing_on", dir);
+        int tracing_on_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (tracing_on_fd < 0) {
+            close(marker_fd);
+            continue;
+        }
+
+        g_marker_fd = marker_fd;
+        g_tracing_on_fd = tracing_on_fd;
+        return;
+    }
+}
+
+static void check_tracing_on(std::chrono::steady_clock::rep now)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+
+    // Another thread may have checked already
+    if (now < g_next_check) {
+        return;
+    }
+    g_next_check = now + std::chrono::duration_cast<
+            std::chrono::steady_clock::duration>(CHECK_INTERVAL).count();
+
+    // Keep trying since tracefs may not be mounted yet during early boot
+    if (g_marker_fd < 0) {
+        open_tracefs();
+        if (g_marker_fd < 0) {
+            return;
+        }
+    }
+
+    char c;
+    g_enabled = pread(g_tracing_on_fd, &c, 1, 0) == 1 && c == '1';
+}
+
+static void write_event(const char *buf, int n)
+{
+    if (n < 0) {
+        return;
+    }
+
+    auto size = std::min(static_cast<size_t>(n), MAX_EVENT_SIZE - 1);
+
+    // Each write is one event, so partial writes are not retried
+    ssize_t ret = write(g_marker_fd, buf, size);
+    (void) ret;
+}
+
+/*!
+ * \brief Check whether trace events are currently recorded
+ *
+ * This is cheap enough to call on every event. The tracing state is rechecked
+ * at most every 250ms.
+ */
+bool atrace_enabled()
+{
+    auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+
+    if (now >= g_next_check.load(std::memory_order_relaxed)) {
+        check_tracing_on(now);
+    }
+
+    return g_enabled.load(std::memory_order_relaxed);
+}
+
+/*!
+ * \brief Begin a section on the calling thread
+ *
+ * Sections must be ended with atrace_end() on the same thread. ATraceSection
+ * should be used instead where possible.
+ */
+void atrace_begin(const char *name)
+{
+    if (!atrace_enabled()) {
+        return;
+    }
+
+    char buf[MAX_EVENT_SIZE];
+    write_event(buf, snprintf(buf, sizeof(buf), "B|%d|%s", getpid(), name));
+}
+
+/*!
+ * \brief End the innermost section of the calling thread
+ */
+void atrace_end()
+{
+    if (!atrace_enabled()) {
+        return;
+    }
+
+    char buf[MAX_EVENT_SIZE];
+    write_event(buf, snprintf(buf, sizeof(buf), "E|%d", getpid()));
+}
+
+/*!
+ * \brief Set the value of a counter track
+ */
+void atrace_counter(const char *name, int64_t value)
+{
+    if (!atrace_enabled()) {
+        return;
+    }
+
+    char buf[MAX_EVENT_SIZE];
+    write_event(buf, snprintf(buf, sizeof(buf), "C|%d|%s|%" PRId64,
+                              getpid(), name, value));
+}
+
+}
+
+#endif
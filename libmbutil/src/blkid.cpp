@@ -19,15 +19,21 @@
 
 #include "mbutil/blkid.h"
 
-#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
 #include "mbcommon/finally.h"
 
 // NOTE: We don't use libblkid from util-linux because we don't need most of its
@@ -36,6 +42,16 @@
 namespace mb::util
 {
 
+// The btrfs magic at 64 KiB + 0x40 is the furthest one from the start of the
+// device. Round up to a multiple of the largest logical block size so the read
+// can be done with O_DIRECT.
+constexpr size_t PROBE_ALIGNMENT = 4096;
+constexpr size_t PROBE_SIZE = 64 * 1024 + PROBE_ALIGNMENT;
+
+// Probing is bound by I/O latency, not CPU, so this is not tied to the number
+// of cores
+constexpr unsigned int MAX_PROBE_THREADS = 8;
+
 static inline bool check_magic(const void *data, size_t data_size,
                                const void *magic, size_t magic_size,
                                size_t offset)
@@ -109,12 +125,13 @@ static ProbeFunc g_probe_funcs[] = {
     { "vfat",     &is_vfat },
 };
 
-static oc::result<size_t> read_all(int fd, void *buf, size_t size)
+static oc::result<size_t> pread_all(int fd, void *buf, size_t size)
 {
     size_t total = 0;
 
     while (total < size) {
-        ssize_t n = read(fd, static_cast<char *>(buf) + total, size - total);
+        ssize_t n = pread64(fd, static_cast<char *>(buf) + total,
+                            size - total, static_cast<off64_t>(total));
         if (n == 0) {
             break;
         } else if (n < 0) {
@@ -131,11 +148,36 @@ static oc::result<size_t> read_all(int fd, void *buf, size_t size)
     return total;
 }
 
-oc::result<std::string> blkid_get_fs_type(const std::string &path)
+static const char * probe_data(const void *data, size_t size)
 {
-    std::vector<unsigned char> buf(1024 * 1024);
+    for (auto const &pf : g_probe_funcs) {
+        if (pf.func(data, size)) {
+            return pf.name;
+        }
+    }
+
+    return "";
+}
 
-    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+/*!
+ * \brief Read the superblock region of a file and detect its filesystem
+ *
+ * The read bypasses the page cache with O_DIRECT if the file supports it, so
+ * \p buf must be aligned to and at least \a PROBE_SIZE bytes long.
+ *
+ * \param path Path to block device or image
+ * \param buf Read buffer
+ * \param[out] rdev If not null, set to the device number if \p path is a block
+ *                  device or 0 otherwise
+ */
+static oc::result<std::string> probe_path(const std::string &path, void *buf,
+                                          dev_t *rdev)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        // The filesystem containing path does not support O_DIRECT
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
     if (fd < 0) {
         return ec_from_errno();
     }
@@ -144,15 +186,130 @@ oc::result<std::string> blkid_get_fs_type(const std::string &path)
         close(fd);
     });
 
-    OUTCOME_TRY(n, read_all(fd, buf.data(), buf.size()));
+    if (rdev) {
+        struct stat sb;
 
-    for (auto const &pf : g_probe_funcs) {
-        if (pf.func(buf.data(), n)) {
-            return pf.name;
+        if (fstat(fd, &sb) < 0) {
+            return ec_from_errno();
         }
+
+        *rdev = S_ISBLK(sb.st_mode) ? sb.st_rdev : 0;
     }
 
-    return "";
+    auto n = pread_all(fd, buf, PROBE_SIZE);
+    if (!n && n.error() == std::errc::invalid_argument) {
+        // Some drivers reject unaligned or direct I/O even though open()
+        // accepted O_DIRECT
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+            return ec_from_errno();
+        }
+
+        n = pread_all(fd, buf, PROBE_SIZE);
+    }
+    OUTCOME_TRYV(n);
+
+    return probe_data(buf, n.value());
+}
+
+static void * alloc_probe_buf()
+{
+    void *buf;
+
+    if (posix_memalign(&buf, PROBE_ALIGNMENT, PROBE_SIZE) != 0) {
+        return nullptr;
+    }
+
+    return buf;
+}
+
+oc::result<std::string> blkid_get_fs_type(const std::string &path)
+{
+    void *buf = alloc_probe_buf();
+    if (!buf) {
+        return std::errc::not_enough_memory;
+    }
+
+    auto free_buf = finally([&]{
+        free(buf);
+    });
+
+    return probe_path(path, buf, nullptr);
+}
+
+/*!
+ * \brief Detect the filesystems of multiple block devices concurrently
+ *
+ * The devices are probed by a small pool of threads so that slow devices do not
+ * hold up the rest. Successful results for block devices are cached by device
+ * number for the lifetime of the process, so probing the same devices again
+ * (eg. when retrying until an external SD card appears) does not issue any
+ * further I/O. Use blkid_get_fs_type() to bypass the cache.
+ *
+ * \param paths Paths to block devices or images
+ *
+ * \return A result for each path in the same order as \p paths. Each result
+ *         is the same as what blkid_get_fs_type() would return for the path.
+ */
+std::vector<oc::result<std::string>>
+blkid_get_fs_types(const std::vector<std::string> &paths)
+{
+    static std::mutex cache_mutex;
+    static std::unordered_map<dev_t, std::string> cache;
+
+    std::vector<oc::result<std::string>> results(
+            paths.size(), std::errc::operation_canceled);
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        void *buf = alloc_probe_buf();
+
+        auto free_buf = finally([&]{
+            free(buf);
+        });
+
+        while (true) {
+            size_t i = next++;
+            if (i >= paths.size()) {
+                break;
+            }
+
+            if (!buf) {
+                results[i] = std::errc::not_enough_memory;
+                continue;
+            }
+
+            struct stat sb;
+            if (stat(paths[i].c_str(), &sb) == 0 && S_ISBLK(sb.st_mode)) {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+
+                if (auto it = cache.find(sb.st_rdev); it != cache.end()) {
+                    results[i] = it->second;
+                    continue;
+                }
+            }
+
+            dev_t rdev;
+            results[i] = probe_path(paths[i], buf, &rdev);
+
+            if (results[i] && rdev != 0) {
+                std::lock_guard<std::mutex> lock(cache_mutex);
+                cache.insert_or_assign(rdev, results[i].value());
+            }
+        }
+    };
+
+    auto threads = std::clamp(
+            static_cast<unsigned int>(paths.size()), 1u, MAX_PROBE_THREADS);
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < threads; ++i) {
+        group.run(worker);
+    }
+    worker();
+    group.wait();
+
+    return results;
 }
 
 }
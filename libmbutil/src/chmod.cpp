@@ -26,18 +26,18 @@
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/string.h"
-#include "mbutil/fts.h"
+#include "mbutil/dir_walker.h"
 
 
 namespace mb::util
 {
 
-class RecursiveChmod : public FtsWrapper {
+class RecursiveChmod : public DirWalker {
 public:
     std::error_code ec;
 
     RecursiveChmod(std::string path, mode_t perms)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles)
         , _perms(perms)
     {
     }
@@ -73,7 +73,7 @@ private:
 
     bool chmod_path()
     {
-        if (::chmod(_curr->fts_accpath, _perms) < 0) {
+        if (fchmodat(_curr->parent_fd, _curr->name(), _perms, 0) < 0) {
             ec = ec_from_errno();
             return false;
         }
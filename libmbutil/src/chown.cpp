@@ -22,13 +22,14 @@
 #include <cerrno>
 #include <cstdlib>
 
+#include <fcntl.h>
 #include <grp.h>
 #include <pwd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbutil/dir_walker.h"
 
 
 namespace mb::util
@@ -54,13 +55,13 @@ static oc::result<void> chown_internal(const std::string &path,
     return oc::success();
 }
 
-class RecursiveChown : public FtsWrapper {
+class RecursiveChown : public DirWalker {
 public:
     std::error_code ec;
 
     RecursiveChown(std::string path, uid_t uid, gid_t gid,
                    bool follow_symlinks)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles)
         , _uid(uid)
         , _gid(gid)
         , _follow_symlinks(follow_symlinks)
@@ -94,9 +95,9 @@ private:
 
     bool chown_path()
     {
-        if (auto r = chown_internal(
-                _curr->fts_accpath, _uid, _gid, _follow_symlinks); !r) {
-            ec = r.error();
+        if (fchownat(_curr->parent_fd, _curr->name(), _uid, _gid,
+                     _follow_symlinks ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+            ec = ec_from_errno();
             return false;
         }
         return true;
@@ -28,6 +28,9 @@
 
 #include <fcntl.h>
 #include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -87,6 +90,142 @@ static inline void log_command(const std::string &path,
     }
 }
 
+// Only needs to be large enough for the exec*() path search
+static constexpr size_t SPAWN_STACK_SIZE = 64 * 1024;
+
+struct SpawnArgs
+{
+    const char *path;
+    char * const *argv;
+    char * const *envp;
+    const char *chroot_dir;
+    int stdout_fd;
+    int stderr_fd;
+    int close_fds[2];
+    const sigset_t *old_mask;
+
+    // Written by the child if it fails before exec
+    const char *failed_step;
+    int error;
+};
+
+/*!
+ * \brief Child side of spawn_process()
+ *
+ * This runs in the parent's address space while the parent is suspended, so it
+ * must only call async-signal-safe functions and must not allocate memory or
+ * log anything. Errors are reported back through \a args.
+ */
+static int spawn_child_main(void *userdata)
+{
+    auto *args = static_cast<SpawnArgs *>(userdata);
+
+    auto fail = [args](const char *step) {
+        args->failed_step = step;
+        args->error = errno;
+        _exit(127);
+    };
+
+    // The parent's signal handlers must not run in the child since they would
+    // operate on the parent's memory
+    for (int sig = 1; sig < NSIG; ++sig) {
+        struct sigaction sa;
+
+        if (sigaction(sig, nullptr, &sa) == 0 && sa.sa_handler != SIG_IGN
+                && sa.sa_handler != SIG_DFL) {
+            sa = {};
+            sa.sa_handler = SIG_DFL;
+            sigaction(sig, &sa, nullptr);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, args->old_mask, nullptr);
+
+    for (int fd : args->close_fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // Chroot if needed
+    if (args->chroot_dir) {
+        if (chdir(args->chroot_dir) < 0) {
+            fail("chdir");
+        }
+        if (chroot(args->chroot_dir) < 0) {
+            fail("chroot");
+        }
+    }
+
+    // Reassign stdout/stderr fds
+    if (args->stdout_fd >= 0) {
+        if (dup2(args->stdout_fd, STDOUT_FILENO) < 0) {
+            fail("redirect stdout");
+        }
+        close(args->stdout_fd);
+    }
+    if (args->stderr_fd >= 0) {
+        if (dup2(args->stderr_fd, STDERR_FILENO) < 0) {
+            fail("redirect stderr");
+        }
+        close(args->stderr_fd);
+    }
+
+    if (args->envp) {
+        execvpe(args->path, args->argv, args->envp);
+    } else {
+        execvp(args->path, args->argv);
+    }
+
+    fail("exec");
+    return 127;
+}
+
+/*!
+ * \brief Start a process without copying the caller's address space
+ *
+ * fork() has to duplicate the page tables of the whole process, which is
+ * expensive for a large process like mbtool. Instead, the child is created
+ * with clone(CLONE_VM | CLONE_VFORK), which is what posix_spawn() does
+ * internally. posix_spawn() itself is not used because it is not available
+ * on older Android versions and cannot chroot.
+ *
+ * \return The child's pid or -1 if the process could not be created. If the
+ *         child fails before exec, the pid is still returned and the failure
+ *         is stored in \a args.
+ */
+static pid_t spawn_process(SpawnArgs &args)
+{
+    void *stack = mmap(nullptr, SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) {
+        return -1;
+    }
+
+    // Block all signals so no handler runs in the child before it has reset
+    // the dispositions
+    sigset_t all_signals;
+    sigset_t old_mask;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+
+    args.old_mask = &old_mask;
+    args.failed_step = nullptr;
+    args.error = 0;
+
+    // The stack grows down on all supported architectures
+    pid_t pid = clone(&spawn_child_main,
+                      static_cast<char *>(stack) + SPAWN_STACK_SIZE,
+                      CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+    int saved_errno = errno;
+
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    munmap(stack, SPAWN_STACK_SIZE);
+
+    errno = saved_errno;
+    return pid;
+}
+
 struct CommandCtxPriv
 {
     pid_t pid;
@@ -138,11 +277,7 @@ bool command_start(CommandCtx &ctx)
         }
     }
 
-    ctx._priv->pid = fork();
-    if (ctx._priv->pid < 0) {
-        LOGE("Failed to fork: %s", strerror(errno));
-        goto error;
-    } else if (ctx._priv->pid == 0) {
+    {
         std::vector<const char *> c_argv;
         for (auto const &arg : ctx.argv) {
             c_argv.push_back(arg.c_str());
@@ -157,62 +292,34 @@ bool command_start(CommandCtx &ctx)
             c_envp.push_back(nullptr);
         }
 
-        // Close read end of the pipes
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[0]);
-            safely_close(ctx._priv->stderr_pipe[0]);
-        }
-
-        // Chroot if needed
-        if (!ctx.chroot_dir.empty()) {
-            if (chdir(ctx.chroot_dir.c_str()) < 0) {
-                LOGE("%s: Failed to chdir: %s",
-                     ctx.chroot_dir.c_str(), strerror(errno));
-                goto child_error;
-            }
-            if (chroot(ctx.chroot_dir.c_str()) < 0) {
-                LOGE("%s: Failed to chroot: %s",
-                     ctx.chroot_dir.c_str(), strerror(errno));
-                goto child_error;
-            }
-        }
-
-        // Reassign stdout/stderr fds
-        if (ctx.redirect_stdio) {
-            if (dup2(ctx._priv->stdout_pipe[1], STDOUT_FILENO) < 0) {
-                LOGE("Failed to redirect stdout: %s", strerror(errno));
-                goto child_error;
-            }
-            if (dup2(ctx._priv->stderr_pipe[1], STDERR_FILENO) < 0) {
-                LOGE("Failed to redirect stderr: %s", strerror(errno));
-                goto child_error;
-            }
-
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[1]);
-        }
-
-        if (ctx.envp) {
-            execvpe(ctx.path.c_str(),
-                    const_cast<char * const *>(c_argv.data()),
-                    const_cast<char * const *>(c_envp.data()));
-        } else {
-            execvp(ctx.path.c_str(),
-                   const_cast<char * const *>(c_argv.data()));
+        SpawnArgs args{};
+        args.path = ctx.path.c_str();
+        args.argv = const_cast<char * const *>(c_argv.data());
+        args.envp = ctx.envp
+                ? const_cast<char * const *>(c_envp.data()) : nullptr;
+        args.chroot_dir = ctx.chroot_dir.empty()
+                ? nullptr : ctx.chroot_dir.c_str();
+        args.stdout_fd = ctx._priv->stdout_pipe[1];
+        args.stderr_fd = ctx._priv->stderr_pipe[1];
+        // Close read end of the pipes in the child
+        args.close_fds[0] = ctx._priv->stdout_pipe[0];
+        args.close_fds[1] = ctx._priv->stderr_pipe[0];
+
+        ctx._priv->pid = spawn_process(args);
+        if (ctx._priv->pid < 0) {
+            LOGE("Failed to spawn process: %s", strerror(errno));
+            goto error;
         }
 
-        LOGE("%s: Failed to exec: %s", ctx.path.c_str(), strerror(errno));
-
-    child_error:
-        if (ctx.redirect_stdio) {
-            safely_close(ctx._priv->stdout_pipe[0]);
-            safely_close(ctx._priv->stdout_pipe[1]);
-            safely_close(ctx._priv->stderr_pipe[0]);
-            safely_close(ctx._priv->stderr_pipe[1]);
+        // Like before, a failure in the child is only reported through the
+        // exit status (127) from command_wait()
+        if (args.failed_step) {
+            LOGE("%s: Failed to %s: %s",
+                 args.chroot_dir && strcmp(args.failed_step, "exec") != 0
+                         ? args.chroot_dir : args.path,
+                 args.failed_step, strerror(args.error));
         }
 
-        _exit(127);
-    } else {
         // Close write ends of the pipes
         if (ctx.redirect_stdio) {
             safely_close(ctx._priv->stdout_pipe[1]);
@@ -396,11 +503,12 @@ bool command_line_reader(CommandCtx &ctx, const CmdLineCb &cb)
     });
 }
 
-int run_command(const std::string &path,
-                const std::vector<std::string> &argv,
-                const std::optional<std::vector<std::string>> &envp,
-                const std::string &chroot_dir,
-                const CmdLineCb &cb)
+template<typename Cb, typename Reader>
+static int run_command_with_reader(const std::string &path,
+                                   const std::vector<std::string> &argv,
+                                   const std::optional<std::vector<std::string>> &envp,
+                                   const std::string &chroot_dir,
+                                   const Cb &cb, Reader reader)
 {
     CommandCtx ctx;
     ctx.path = path;
@@ -420,9 +528,35 @@ int run_command(const std::string &path,
         return -1;
     }
 
-    command_line_reader(ctx, cb);
+    reader(ctx, cb);
 
     return command_wait(ctx);
 }
 
+int run_command(const std::string &path,
+                const std::vector<std::string> &argv,
+                const std::optional<std::vector<std::string>> &envp,
+                const std::string &chroot_dir,
+                const CmdLineCb &cb)
+{
+    return run_command_with_reader(path, argv, envp, chroot_dir, cb,
+                                   &command_line_reader);
+}
+
+/*!
+ * \brief Run command and pass its output to \p cb as it is read
+ *
+ * Unlike run_command(), the output is not split into lines. Each call to \p cb
+ * receives the data returned by one read of the stdout or stderr pipe.
+ */
+int run_command_raw(const std::string &path,
+                    const std::vector<std::string> &argv,
+                    const std::optional<std::vector<std::string>> &envp,
+                    const std::string &chroot_dir,
+                    const CmdRawCb &cb)
+{
+    return run_command_with_reader(path, argv, envp, chroot_dir, cb,
+                                   &command_raw_reader);
+}
+
 }
@@ -19,20 +19,35 @@
 
 #include "mbutil/copy.h"
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <vector>
+
 #include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <fcntl.h>
 #include <fts.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/xattr.h>
 #include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/atrace.h"
 #include "mbutil/fts.h"
+#include "mbutil/metrics.h"
 #include "mbutil/path.h"
 #include "mbutil/string.h"
 
@@ -41,33 +56,70 @@
 // WARNING: Everything operates on paths, so it's subject to race conditions
 // Directory copy operations will not cross mountpoint boundaries
 
+// Older kernel headers do not have the generic clone ioctl
+#ifndef FICLONE
+#  define FICLONE _IOW(0x94, 9, int)
+#endif
+
 namespace mb::util
 {
 
-oc::result<void> copy_data_fd(int fd_source, int fd_target)
+/*!
+ * \brief Try to share the data blocks of \p fd_source with \p fd_target
+ *
+ * This only works if both are regular files on the same filesystem that
+ * supports reflinks (eg. btrfs or xfs). Since a clone replaces the entire
+ * target, this is only attempted if both file positions are at the beginning
+ * and the target is empty. The positions are moved to the end of the files
+ * afterwards, as if the data was copied.
+ *
+ * \return Whether the data was cloned
+ */
+static bool clone_data_fd(int fd_source, int fd_target)
 {
-    char buf[10240];
-    ssize_t nread;
-
-    while ((nread = read(fd_source, buf, sizeof(buf))) > 0) {
-        char *out_ptr = buf;
-        ssize_t nwritten;
+    struct stat sb_source;
+    struct stat sb_target;
 
-        do {
-            if ((nwritten = write(fd_target, out_ptr,
-                                  static_cast<size_t>(nread))) < 0) {
-                return ec_from_errno();
-            }
+    if (fstat(fd_source, &sb_source) < 0 || fstat(fd_target, &sb_target) < 0
+            || !S_ISREG(sb_source.st_mode) || !S_ISREG(sb_target.st_mode)
+            || sb_source.st_dev != sb_target.st_dev
+            || sb_target.st_size != 0
+            || lseek64(fd_source, 0, SEEK_CUR) != 0
+            || lseek64(fd_target, 0, SEEK_CUR) != 0) {
+        return false;
+    }
 
-            nread -= nwritten;
-            out_ptr += nwritten;
-        } while (nread > 0);
+    // A failed clone leaves the target untouched
+    if (ioctl(fd_target, FICLONE, fd_source) < 0) {
+        return false;
     }
 
-    if (nread < 0) {
-        return ec_from_errno();
+    return lseek64(fd_source, 0, SEEK_END) >= 0
+            && lseek64(fd_target, 0, SEEK_END) >= 0;
+}
+
+/*!
+ * \brief Copy data from the current position of \p fd_source to the current
+ *        position of \p fd_target
+ *
+ * If possible, the data is cloned with a reflink. Otherwise, it is copied in
+ * the kernel with `copy_file_range()`, `sendfile()`, or `splice()`, falling
+ * back to a read/write loop. See mb::file_copy().
+ */
+oc::result<void> copy_data_fd(int fd_source, int fd_target)
+{
+    if (clone_data_fd(fd_source, fd_target)) {
+        return oc::success();
     }
 
+    FdFile source;
+    OUTCOME_TRYV(source.open(fd_source, false));
+
+    FdFile target;
+    OUTCOME_TRYV(target.open(fd_target, false));
+
+    OUTCOME_TRYV(file_copy(source, target, {}));
+
     return oc::success();
 }
 
@@ -93,11 +145,21 @@ static FileOpResult<void> copy_data(const std::string &source,
         close(fd_target);
     });
 
+    auto start = std::chrono::steady_clock::now();
+
     if (auto r = copy_data_fd(fd_source, fd_target); !r) {
         // TODO: OR SOURCE?
         return FileOpErrorInfo{target, r.error()};
     }
 
+    // The data is usually copied in the kernel, so the reads and writes cannot
+    // be timed separately. Count it all as writes.
+    if (auto size = lseek64(fd_target, 0, SEEK_CUR); size >= 0) {
+        metrics_add_files(1, static_cast<uint64_t>(size));
+        metrics_add_write(static_cast<uint64_t>(size),
+                          std::chrono::steady_clock::now() - start);
+    }
+
     close_target_fd.dismiss();
 
     if (close(fd_target) < 0) {
@@ -107,6 +169,81 @@ static FileOpResult<void> copy_data(const std::string &source,
     return oc::success();
 }
 
+static bool read_fully(int fd, void *buf, size_t size)
+{
+    auto ptr = static_cast<char *>(buf);
+
+    while (size > 0) {
+        auto n = read(fd, ptr, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Check if \p target is a regular file with the same contents as \p source
+ *
+ * Timestamps are not compared because images built by Android's build system
+ * and files extracted by updaters all have the same fixed timestamp.
+ */
+static bool same_contents(const std::string &source, const std::string &target)
+{
+    struct stat sb_source;
+    struct stat sb_target;
+
+    if (lstat(source.c_str(), &sb_source) < 0
+            || lstat(target.c_str(), &sb_target) < 0
+            || !S_ISREG(sb_source.st_mode) || !S_ISREG(sb_target.st_mode)
+            || sb_source.st_size != sb_target.st_size) {
+        return false;
+    }
+
+    int fd_source = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_source < 0) {
+        return false;
+    }
+
+    auto close_source_fd = finally([&] {
+        close(fd_source);
+    });
+
+    int fd_target = open(target.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_target < 0) {
+        return false;
+    }
+
+    auto close_target_fd = finally([&] {
+        close(fd_target);
+    });
+
+    constexpr size_t chunk_size = 256 * 1024;
+    std::vector<char> buf_source(chunk_size);
+    std::vector<char> buf_target(chunk_size);
+    auto remain = static_cast<uint64_t>(sb_source.st_size);
+
+    while (remain > 0) {
+        auto n = static_cast<size_t>(std::min<uint64_t>(remain, chunk_size));
+
+        if (!read_fully(fd_source, buf_source.data(), n)
+                || !read_fully(fd_target, buf_target.data(), n)
+                || memcmp(buf_source.data(), buf_target.data(), n) != 0) {
+            return false;
+        }
+
+        remain -= n;
+    }
+
+    return true;
+}
+
 FileOpResult<void> copy_xattrs(const std::string &source,
                                const std::string &target)
 {
@@ -212,6 +349,20 @@ FileOpResult<void> copy_contents(const std::string &source,
     return oc::success();
 }
 
+static FileOpResult<void> copy_attributes(const std::string &source,
+                                          const std::string &target,
+                                          CopyFlags flags)
+{
+    if (flags & CopyFlag::CopyAttributes) {
+        OUTCOME_TRYV(copy_stat(source, target));
+    }
+    if (flags & CopyFlag::CopyXattrs) {
+        OUTCOME_TRYV(copy_xattrs(source, target));
+    }
+
+    return oc::success();
+}
+
 FileOpResult<void> copy_file(const std::string &source,
                              const std::string &target, CopyFlags flags)
 {
@@ -221,6 +372,10 @@ FileOpResult<void> copy_file(const std::string &source,
         umask(old_umask);
     });
 
+    if ((flags & CopyFlag::SkipUnchanged) && same_contents(source, target)) {
+        return copy_attributes(source, target, flags);
+    }
+
     if (unlink(target.c_str()) < 0 && errno != ENOENT) {
         return FileOpErrorInfo{target, ec_from_errno()};
     }
@@ -281,15 +436,117 @@ FileOpResult<void> copy_file(const std::string &source,
                 target, std::make_error_code(std::errc::invalid_argument)};
     }
 
-    if (flags & CopyFlag::CopyAttributes) {
-        OUTCOME_TRYV(copy_stat(source, target));
+    return copy_attributes(source, target, flags);
+}
+
+/*!
+ * \brief Copy regular files on the global Executor
+ *
+ * Each submitted file adds one task. A task copies the largest file that has
+ * not been started yet, so that the copy does not end with a single thread
+ * copying a huge file.
+ */
+class FileCopyPool
+{
+public:
+    FileCopyPool(CopyFlags flags)
+        : _flags(flags)
+        , _stage(MetricsStage::current())
+    {
     }
-    if (flags & CopyFlag::CopyXattrs) {
-        OUTCOME_TRYV(copy_xattrs(source, target));
+
+    ~FileCopyPool()
+    {
+        (void) finish();
     }
 
-    return oc::success();
-}
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(FileCopyPool)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(FileCopyPool)
+
+    void submit(std::string source, std::string target, uint64_t size)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push({std::move(source), std::move(target), size});
+        }
+
+        _group.run([this] {
+            run_largest();
+        });
+    }
+
+    /*!
+     * \brief Wait for all jobs to complete
+     *
+     * \return The first error that occurred, if any
+     */
+    FileOpResult<void> finish()
+    {
+        _group.wait();
+
+        if (_error) {
+            return std::move(*_error);
+        }
+
+        return oc::success();
+    }
+
+private:
+    struct Job
+    {
+        std::string source;
+        std::string target;
+        uint64_t size;
+
+        bool operator<(const Job &other) const
+        {
+            return size < other.size;
+        }
+    };
+
+    CopyFlags _flags;
+    std::shared_ptr<StageMetrics> _stage;
+
+    std::mutex _mutex;
+    std::priority_queue<Job> _jobs;
+    std::optional<FileOpErrorInfo> _error;
+
+    // Declared last so that the destructor waits for the tasks before the
+    // other members are destroyed
+    TaskGroup _group;
+
+    FileOpResult<void> copy(const Job &job)
+    {
+        if (!(_flags & CopyFlag::SkipUnchanged)
+                || !same_contents(job.source, job.target)) {
+            if (unlink(job.target.c_str()) < 0 && errno != ENOENT) {
+                return FileOpErrorInfo{job.target, ec_from_errno()};
+            }
+
+            OUTCOME_TRYV(copy_data(job.source, job.target));
+        }
+
+        return copy_attributes(job.source, job.target, _flags);
+    }
+
+    void run_largest()
+    {
+        MetricsBinding binding(_stage);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        Job job = _jobs.top();
+        _jobs.pop();
+
+        lock.unlock();
+        auto ret = copy(job);
+        lock.lock();
+
+        if (!ret && !_error) {
+            _error = std::move(ret.error());
+        }
+    }
+};
 
 
 class RecursiveCopier : public FtsWrapper
@@ -302,6 +559,38 @@ public:
         , _copyflags(copyflags)
         , _target(std::move(target))
     {
+        if (_copyflags & CopyFlag::Parallel) {
+            _pool.emplace(_copyflags);
+        }
+    }
+
+    /*!
+     * \brief Wait for the file copies and then set the directory attributes
+     *
+     * Directory attributes are only set after all of the files in them have
+     * been copied, as they would be when copying sequentially.
+     *
+     * \return Whether all copies succeeded
+     */
+    bool finish()
+    {
+        bool ret = true;
+
+        if (_pool) {
+            if (auto r = _pool->finish(); !r) {
+                error = r.error();
+                ret = false;
+            }
+        }
+
+        // The directories are in post-order, so children come first
+        for (auto const &[source, target] : _deferred_dirs) {
+            if (!cp_attrs(source, target) || !cp_xattrs(source, target)) {
+                ret = false;
+            }
+        }
+
+        return ret;
     }
 
     bool on_pre_execute() override
@@ -410,6 +699,11 @@ public:
 
     Actions on_reached_directory_post() override
     {
+        if (_pool) {
+            _deferred_dirs.emplace_back(_curr->fts_accpath, _curtgtpath);
+            return Action::Ok;
+        }
+
         if (!cp_attrs()) {
             return Action::Fail;
         }
@@ -423,6 +717,18 @@ public:
 
     Actions on_reached_file() override
     {
+        if (_pool) {
+            // The worker replaces the existing file if needed
+            _pool->submit(_curr->fts_accpath, _curtgtpath,
+                          static_cast<uint64_t>(_curr->fts_statp->st_size));
+            return Action::Ok;
+        }
+
+        if ((_copyflags & CopyFlag::SkipUnchanged)
+                && same_contents(_curr->fts_accpath, _curtgtpath)) {
+            return cp_attrs() && cp_xattrs() ? Action::Ok : Action::Fail;
+        }
+
         if (!remove_existing_file()) {
             return Action::Fail;
         }
@@ -553,6 +859,8 @@ private:
     std::string _target;
     struct stat sb_target;
     std::string _curtgtpath;
+    std::optional<FileCopyPool> _pool;
+    std::vector<std::pair<std::string, std::string>> _deferred_dirs;
 
     bool remove_existing_file()
     {
@@ -565,9 +873,14 @@ private:
     }
 
     bool cp_attrs()
+    {
+        return cp_attrs(_curr->fts_accpath, _curtgtpath);
+    }
+
+    bool cp_attrs(const std::string &source, const std::string &target)
     {
         if (_copyflags & CopyFlag::CopyAttributes) {
-            if (auto r = copy_stat(_curr->fts_accpath, _curtgtpath); !r) {
+            if (auto r = copy_stat(source, target); !r) {
                 error = r.error();
                 return false;
             }
@@ -576,9 +889,14 @@ private:
     }
 
     bool cp_xattrs()
+    {
+        return cp_xattrs(_curr->fts_accpath, _curtgtpath);
+    }
+
+    bool cp_xattrs(const std::string &source, const std::string &target)
     {
         if (_copyflags & CopyFlag::CopyXattrs) {
-            if (auto r = copy_xattrs(_curr->fts_accpath, _curtgtpath); !r) {
+            if (auto r = copy_xattrs(source, target); !r) {
                 error = r.error();
                 return false;
             }
@@ -588,10 +906,26 @@ private:
 };
 
 
-// Copy as much as possible
+/*!
+ * \brief Recursively copy a directory
+ *
+ * As much as possible is copied. If any errors occur, the last one is returned.
+ * Mountpoint boundaries are not crossed and hard links are copied as separate
+ * files.
+ *
+ * If \ref CopyFlag::Parallel is set, regular files are copied by tasks on the
+ * global Executor while the tree is being traversed. The attributes and xattrs
+ * of directories are set once all files are copied.
+ *
+ * If \ref CopyFlag::SkipUnchanged is set, existing regular files in the target
+ * that have the same contents as the source are left in place and only their
+ * attributes and xattrs are updated.
+ */
 FileOpResult<void> copy_dir(const std::string &source,
                             const std::string &target, CopyFlags flags)
 {
+    ATraceSection section("copy_dir");
+
     mode_t old_umask = umask(0);
 
     auto restore_umask = finally([&] {
@@ -600,7 +934,13 @@ FileOpResult<void> copy_dir(const std::string &source,
 
     RecursiveCopier copier(source, target, flags);
 
-    if (!copier.run()) {
+    // Always wait for the file copies, even if the traversal failed
+    bool ret = copier.run();
+    if (!copier.finish()) {
+        ret = false;
+    }
+
+    if (!ret) {
         return std::move(copier.error);
     }
 
@@ -19,24 +19,35 @@
 
 #include "mbutil/delete.h"
 
+#include <algorithm>
+#include <memory>
+
 #include <cerrno>
 #include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
-#include "mbutil/fts.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
+#include "mbutil/atrace.h"
+#include "mbutil/dir_walker.h"
+#include "mbutil/metrics.h"
 
 
 namespace mb::util
 {
 
-class RecursiveDeleter : public FtsWrapper {
+class RecursiveDeleter : public DirWalker {
 public:
     std::string error_path;
     std::error_code error;
 
     RecursiveDeleter(std::string path)
-        : FtsWrapper(std::move(path), FtsFlag::GroupSpecialFiles)
+        : DirWalker(std::move(path), DirWalkerFlag::GroupSpecialFiles)
     {
     }
 
@@ -70,23 +81,151 @@ public:
 private:
     bool delete_path()
     {
-        if (remove(_curr->fts_accpath) < 0) {
-            error_path = _curr->fts_path;
+        if (unlinkat(_curr->parent_fd, _curr->name(),
+                     _curr->type == DT_DIR ? AT_REMOVEDIR : 0) < 0) {
+            error_path = _curr->path;
             error = ec_from_errno();
             return false;
         }
+        if (_curr->type != DT_DIR) {
+            metrics_add_files(1, 0);
+        }
         return true;
     }
 };
 
-FileOpResult<void> delete_recursive(const std::string &path)
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+namespace
+{
+
+struct DeleteEntry
+{
+    std::string name;
+    bool is_dir;
+};
+
+}
+
+static FileOpResult<std::vector<DeleteEntry>>
+list_entries(int dfd, const std::string &path,
+             const std::vector<std::string> &exclusions)
+{
+    int fd = dup(dfd);
+    if (fd < 0) {
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    ScopedDIR dp(fdopendir(fd), closedir);
+    if (!dp) {
+        auto ec = ec_from_errno();
+        close(fd);
+        return FileOpErrorInfo{path, ec};
+    }
+
+    std::vector<DeleteEntry> entries;
+
+    errno = 0;
+    while (struct dirent *ent = readdir(dp.get())) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0
+                || std::find(exclusions.begin(), exclusions.end(),
+                             ent->d_name) != exclusions.end()) {
+            continue;
+        }
+
+        bool is_dir = ent->d_type == DT_DIR;
+
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(dfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                return FileOpErrorInfo{path + "/" + ent->d_name,
+                                       ec_from_errno()};
+            }
+            is_dir = S_ISDIR(sb.st_mode);
+        }
+
+        entries.push_back({ent->d_name, is_dir});
+    }
+
+    if (errno != 0) {
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    return entries;
+}
+
+static FileOpResult<void> delete_entry(int dfd, dev_t dev,
+                                       const std::string &path,
+                                       const DeleteEntry &entry)
+{
+    std::string entry_path(path);
+    entry_path += '/';
+    entry_path += entry.name;
+
+    if (entry.is_dir) {
+        // A separate walk would descend into a mountpoint that the
+        // non-parallel walk skips, so only try to remove the mountpoint
+        // itself
+        struct stat sb;
+        if (fstatat(dfd, entry.name.c_str(), &sb, AT_SYMLINK_NOFOLLOW) == 0
+                && sb.st_dev != dev) {
+            if (unlinkat(dfd, entry.name.c_str(), AT_REMOVEDIR) < 0) {
+                return FileOpErrorInfo{std::move(entry_path), ec_from_errno()};
+            }
+            return oc::success();
+        }
+
+
+        RecursiveDeleter deleter(std::move(entry_path));
+        if (!deleter.run()) {
+            return FileOpErrorInfo{std::move(deleter.error_path),
+                                   deleter.error};
+        }
+    } else if (unlinkat(dfd, entry.name.c_str(), 0) < 0) {
+        if (errno != ENOENT) {
+            return FileOpErrorInfo{std::move(entry_path), ec_from_errno()};
+        }
+    } else {
+        metrics_add_files(1, 0);
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Recursively delete a path
+ *
+ * If the path does not exist, this function succeeds. Symlinks are not
+ * followed.
+ *
+ * \param path Path to delete
+ * \param flags If \ref DeleteFlag::Parallel is set and \p path is a
+ *              directory, see delete_contents()
+ *
+ * \return Nothing if successful. Otherwise, the error information.
+ */
+FileOpResult<void> delete_recursive(const std::string &path,
+                                    DeleteFlags flags)
 {
+    ATraceSection section("delete_recursive");
+
     struct stat sb;
     if (stat(path.c_str(), &sb) < 0 && errno == ENOENT) {
         // Don't fail if directory does not exist
         return oc::success();
     }
 
+    if ((flags & DeleteFlag::Parallel) && lstat(path.c_str(), &sb) == 0
+            && S_ISDIR(sb.st_mode)) {
+        OUTCOME_TRYV(delete_contents(path, {}, flags));
+
+        if (rmdir(path.c_str()) < 0) {
+            return FileOpErrorInfo{path, ec_from_errno()};
+        }
+
+        return oc::success();
+    }
+
     RecursiveDeleter deleter(path);
     if (!deleter.run()) {
         return FileOpErrorInfo{std::move(deleter.error_path), deleter.error};
@@ -95,4 +234,75 @@ FileOpResult<void> delete_recursive(const std::string &path)
     return oc::success();
 }
 
+/*!
+ * \brief Recursively delete the contents of a directory
+ *
+ * The directory itself is kept. If the directory does not exist, this
+ * function succeeds.
+ *
+ * If \ref DeleteFlag::Parallel is set, the top-level entries are partitioned
+ * across tasks on the global Executor and each subtree is deleted
+ * independently. Once a task fails, no further entries are started and the
+ * first error is returned.
+ *
+ * \param path Directory to empty
+ * \param exclusions Names of top-level entries to keep
+ * \param flags Delete flags
+ *
+ * \return Nothing if successful. Otherwise, the error information.
+ */
+FileOpResult<void> delete_contents(const std::string &path,
+                                   const std::vector<std::string> &exclusions,
+                                   DeleteFlags flags)
+{
+    ATraceSection section("delete_contents");
+
+    int dfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        if (errno == ENOENT) {
+            return oc::success();
+        }
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    auto close_dfd = finally([&] {
+        close(dfd);
+    });
+
+    struct stat sb;
+    if (fstat(dfd, &sb) < 0) {
+        return FileOpErrorInfo{path, ec_from_errno()};
+    }
+
+    OUTCOME_TRY(entries, list_entries(dfd, path, exclusions));
+
+    unsigned int threads = 1;
+    if (flags & DeleteFlag::Parallel) {
+        auto dirs = std::count_if(entries.begin(), entries.end(),
+                                  [](const DeleteEntry &e) {
+            return e.is_dir;
+        });
+
+        threads = std::clamp(Executor::global().concurrency(), 1u,
+                             std::max(static_cast<unsigned int>(dirs), 1u));
+    }
+
+    if (threads > 1) {
+        // Start with the directories so that the large subtrees are picked up
+        // first and the remaining files fill in the gaps
+        std::stable_partition(entries.begin(), entries.end(),
+                              [](const DeleteEntry &e) {
+            return e.is_dir;
+        });
+    }
+
+    auto stage = MetricsStage::current();
+
+    return try_parallel_for(entries.size(), [&](size_t i) {
+        MetricsBinding binding(stage);
+
+        return delete_entry(dfd, sb.st_dev, path, entries[i]);
+    }, threads);
+}
+
 }
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "mbutil/dir_walker.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/string.h"
+
+/*!
+ * \file mbutil/dir_walker.h
+ * \brief Directory tree walker based on file descriptors
+ */
+
+namespace mb::util
+{
+
+/*! \cond INTERNAL */
+
+// getdents64() buffer. Large directories are read in fewer system calls.
+constexpr size_t DIRENT_BUFFER_SIZE = 64 * 1024;
+
+struct LinuxDirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/*! \endcond */
+
+/*!
+ * \class DirWalker
+ *
+ * \brief Walk a directory tree with the same callbacks as FtsWrapper
+ *
+ * Unlike fts(3), this does not allocate an entry for each file or stat every
+ * file. Directories are opened relative to their parents and read with
+ * getdents64(), and the d_type values are used to determine the type of each
+ * entry. Callbacks that need the stat information must call curr_stat(), which
+ * calls fstatat() on demand. Callbacks should operate on the entry with *at()
+ * functions and `_curr->parent_fd` and `_curr->name()` to avoid path lookups.
+ *
+ * The traversal order and actions are the same as with FtsWrapper, except that
+ * symlinks are never followed. Like with fts(3), all entries of a directory are
+ * read before any of them is visited, so callbacks may delete entries.
+ *
+ * Mountpoints inside the tree are visited, but their contents are not, unless
+ * \ref DirWalkerFlag::CrossMountPointBoundaries is set.
+ */
+
+DirWalker::DirWalker(std::string path, DirWalkerFlags flags)
+    : _path(std::move(path))
+    , _flags(flags)
+    , _curr(&_entry)
+    , _entry()
+    , _sb()
+    , _sb_valid(false)
+    , _root_dev(0)
+    , _depth(0)
+    , _ran(false)
+{
+}
+
+DirWalker::~DirWalker()
+{
+    close_levels();
+}
+
+bool DirWalker::run()
+{
+    if (_ran) {
+        _error_msg = "Already ran";
+        return false;
+    }
+    _ran = true;
+
+    // Pre-execute hook
+    if (!on_pre_execute()) {
+        return false;
+    }
+
+    bool ret = walk();
+
+    if (!on_post_execute(ret)) {
+        return false;
+    }
+
+    return ret;
+}
+
+std::string DirWalker::error()
+{
+    return _error_msg;
+}
+
+/*!
+ * \brief Get the stat information of the current entry
+ *
+ * The entry is not followed if it is a symlink.
+ *
+ * \return Pointer to the stat information, which is valid until the next
+ *         callback, or nullptr with errno set if fstatat() fails
+ */
+const struct stat * DirWalker::curr_stat()
+{
+    if (!_sb_valid) {
+        if (fstatat(_entry.parent_fd, _entry.name(), &_sb,
+                    AT_SYMLINK_NOFOLLOW) < 0) {
+            return nullptr;
+        }
+        _sb_valid = true;
+    }
+
+    return &_sb;
+}
+
+bool DirWalker::walk()
+{
+    bool ret = true;
+
+    _entry.path = _path;
+    _entry.name_offset = 0;
+    _entry.parent_fd = AT_FDCWD;
+    _entry.level = 0;
+
+    if (lstat(_path.c_str(), &_sb) < 0) {
+        _error_msg = format("%s: Failed to stat: %s",
+                            _path.c_str(), strerror(errno));
+        return false;
+    }
+    _sb_valid = true;
+    _root_dev = _sb.st_dev;
+    _entry.type = static_cast<unsigned char>(IFTODT(_sb.st_mode));
+
+    _dirent_buf.resize(DIRENT_BUFFER_SIZE);
+
+    Actions result = visit(false);
+    if (result & Action::Fail) {
+        ret = false;
+    }
+    if (result & Action::Stop) {
+        return ret;
+    }
+    if (!(result & Action::Skip) && _entry.type == DT_DIR && !descend()) {
+        ret = false;
+    }
+
+    while (_depth > 0) {
+        Level &level = _levels[_depth - 1];
+
+        if (level.next == level.children.size()) {
+            // All children were visited, so revisit the directory
+            close(level.fd);
+            level.fd = -1;
+            --_depth;
+
+            _entry.path.resize(level.path_len);
+            _entry.name_offset = level.name_offset;
+            _entry.parent_fd = _depth > 0 ? _levels[_depth - 1].fd : AT_FDCWD;
+            _entry.level = static_cast<int>(_depth);
+            _entry.type = DT_DIR;
+            _sb = level.sb;
+            _sb_valid = true;
+
+            result = visit(true);
+            if (result & Action::Fail) {
+                ret = false;
+            }
+            if (result & Action::Stop) {
+                break;
+            }
+            continue;
+        }
+
+        auto [offset, type] = level.children[level.next++];
+
+        _entry.path.resize(level.path_len);
+        if (_entry.path.back() != '/') {
+            _entry.path += '/';
+        }
+        _entry.name_offset = _entry.path.size();
+        _entry.path += level.names.c_str() + offset;
+        _entry.parent_fd = level.fd;
+        _entry.level = static_cast<int>(_depth);
+        _entry.type = type;
+        _sb_valid = false;
+
+        if (_entry.type == DT_UNKNOWN) {
+            // Not all filesystems report the type
+            auto sb = curr_stat();
+            if (!sb) {
+                _error_msg = format("%s: Failed to stat: %s",
+                                    _entry.path.c_str(), strerror(errno));
+                ret = false;
+                continue;
+            }
+            _entry.type = static_cast<unsigned char>(IFTODT(sb->st_mode));
+        }
+
+        result = visit(false);
+        if (result & Action::Fail) {
+            ret = false;
+        }
+        if (result & Action::Stop) {
+            break;
+        }
+        if (!(result & Action::Skip) && _entry.type == DT_DIR && !descend()) {
+            ret = false;
+        }
+    }
+
+    close_levels();
+
+    return ret;
+}
+
+/*!
+ * \brief Call the callbacks for the current entry
+ *
+ * \param post Whether the directory is revisited after its children
+ */
+DirWalker::Actions DirWalker::visit(bool post)
+{
+    // Current path hook
+    _error_msg = "Handler returned failure";
+    Actions changed = on_changed_path();
+    if (changed & (Action::Next | Action::Skip | Action::Stop)) {
+        return changed;
+    }
+
+    // Call other hooks
+    _error_msg = "Handler returned failure";
+    Actions result;
+
+    switch (_entry.type) {
+    case DT_DIR:
+        result = post ? on_reached_directory_post()
+                : on_reached_directory_pre();
+        break;
+    case DT_REG:
+        result = on_reached_file();
+        break;
+    case DT_LNK:
+        result = on_reached_symlink();
+        break;
+    case DT_BLK:
+    case DT_CHR:
+    case DT_FIFO:
+    case DT_SOCK:
+        if (_flags & DirWalkerFlag::GroupSpecialFiles) {
+            result = on_reached_special_file();
+        } else if (_entry.type == DT_BLK) {
+            result = on_reached_block_device();
+        } else if (_entry.type == DT_CHR) {
+            result = on_reached_character_device();
+        } else if (_entry.type == DT_FIFO) {
+            result = on_reached_fifo();
+        } else {
+            result = on_reached_socket();
+        }
+        break;
+    default:
+        result = Action::Skip;
+        break;
+    }
+
+    if (changed & Action::Fail) {
+        result |= Action::Fail;
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Open the current directory and read its children
+ *
+ * If an error occurs, the directory is still revisited afterwards with the
+ * children that could be read.
+ *
+ * \return Whether the directory was successfully read
+ */
+bool DirWalker::descend()
+{
+    int fd = openat(_entry.parent_fd, _entry.name(),
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        _error_msg = format("%s: Failed to open directory: %s",
+                            _entry.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (_depth == _levels.size()) {
+        _levels.emplace_back();
+    }
+
+    // Level objects are reused to keep their buffers' allocations
+    Level &level = _levels[_depth++];
+    level.fd = fd;
+    level.path_len = _entry.path.size();
+    level.name_offset = _entry.name_offset;
+    level.names.clear();
+    level.children.clear();
+    level.next = 0;
+
+    if (fstat(fd, &level.sb) < 0) {
+        _error_msg = format("%s: Failed to stat: %s",
+                            _entry.path.c_str(), strerror(errno));
+        level.sb = {};
+        return false;
+    }
+
+    if (!(_flags & DirWalkerFlag::CrossMountPointBoundaries)
+            && level.sb.st_dev != _root_dev) {
+        // Don't traverse the contents of mountpoints
+        return true;
+    }
+
+    return read_children(level);
+}
+
+bool DirWalker::read_children(Level &level)
+{
+    while (true) {
+        auto n = syscall(SYS_getdents64, level.fd, _dirent_buf.data(),
+                         _dirent_buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _error_msg = format("%s: Failed to read directory: %s",
+                                _entry.path.c_str(), strerror(errno));
+            return false;
+        } else if (n == 0) {
+            break;
+        }
+
+        for (long pos = 0; pos < n;) {
+            auto d = reinterpret_cast<const LinuxDirent64 *>(
+                    _dirent_buf.data() + pos);
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == '\0'
+                    || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            level.children.emplace_back(level.names.size(), d->d_type);
+            level.names.append(name, strlen(name) + 1);
+        }
+    }
+
+    return true;
+}
+
+void DirWalker::close_levels()
+{
+    for (; _depth > 0; --_depth) {
+        close(_levels[_depth - 1].fd);
+        _levels[_depth - 1].fd = -1;
+    }
+}
+
+bool DirWalker::on_pre_execute()
+{
+    return true;
+}
+
+bool DirWalker::on_post_execute(bool success)
+{
+    (void) success;
+    return true;
+}
+
+DirWalker::Actions DirWalker::on_changed_path()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_directory_pre()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_directory_post()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_file()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_symlink()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_special_file()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_block_device()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_character_device()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_fifo()
+{
+    return Action::Ok;
+}
+
+DirWalker::Actions DirWalker::on_reached_socket()
+{
+    return Action::Ok;
+}
+
+}
@@ -41,7 +41,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <new>
+#include <string>
 
 #include <linux/xattr.h>
 #include <netinet/in.h>
@@ -1463,6 +1465,99 @@ int __system_property_set(const char* key, const char* value) {
   }
 }
 
+static void set_many_individually(const char* const* keys,
+                                  const char* const* values, size_t n,
+                                  int* results) {
+  for (size_t i = 0; i < n; ++i) {
+    results[i] = __system_property_set(keys[i], values[i]) == 0
+        ? PROP_SUCCESS : PROP_ERROR_SET_FAILED;
+  }
+}
+
+static bool set_many_batch(const char* const* keys, const char* const* values,
+                           size_t n, int* results) {
+  PropertyServiceConnection connection;
+  if (!connection.IsValid()) {
+    errno = connection.GetLastError();
+    LOGW("Unable to set %zu properties: connection failed; errno=%d (%s)",
+         n, errno, strerror(errno));
+    return false;
+  }
+
+  std::string buf;
+  auto append_uint32 = [&](uint32_t value) {
+    buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  };
+
+  append_uint32(PROP_MSG_SETPROPS_MB);
+  append_uint32(static_cast<uint32_t>(n));
+  for (size_t i = 0; i < n; ++i) {
+    const char* value = values[i] ? values[i] : "";
+    append_uint32(static_cast<uint32_t>(strlen(keys[i])));
+    buf += keys[i];
+    append_uint32(static_cast<uint32_t>(strlen(value)));
+    buf += value;
+  }
+
+  for (size_t offset = 0; offset < buf.size();) {
+    ssize_t num_bytes = TEMP_FAILURE_RETRY(
+        send(connection.socket(), buf.data() + offset, buf.size() - offset, 0));
+    if (num_bytes < 0) {
+      LOGW("Unable to set %zu properties: write failed; errno=%d (%s)",
+           n, errno, strerror(errno));
+      return false;
+    }
+    offset += static_cast<size_t>(num_bytes);
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    if (!connection.RecvInt32(&results[i])) {
+      errno = connection.GetLastError();
+      LOGW("Unable to set %zu properties: recv failed; errno=%d (%s)",
+           n, errno, strerror(errno));
+      return false;
+    }
+
+    // A per-property result is never PROP_ERROR_INVALID_CMD, so the property
+    // service does not support batched sets
+    if (i == 0 && results[i] == PROP_ERROR_INVALID_CMD) {
+      LOGV("Property service does not support batched sets");
+      set_many_individually(keys, values, n, results);
+      return true;
+    }
+  }
+
+  return true;
+}
+
+int __system_property_set_many(const char* const* keys,
+                               const char* const* values, size_t n,
+                               int* results) {
+  if (g_propservice_protocol_version == 0) {
+    detect_protocol_version();
+  }
+
+  if (g_propservice_protocol_version == kProtocolVersion1) {
+    set_many_individually(keys, values, n, results);
+  } else {
+    for (size_t i = 0; i < n; i += PROP_SETPROPS_MAX) {
+      size_t count = std::min<size_t>(n - i, PROP_SETPROPS_MAX);
+      if (!set_many_batch(keys + i, values + i, count, results + i)) {
+        std::fill(results + i, results + n, PROP_ERROR_SET_FAILED);
+        return -1;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n; ++i) {
+    if (results[i] != PROP_SUCCESS) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
 int __system_property_update(prop_info* pi, const char* value, unsigned int len) {
   if (len >= PROP_VALUE_MAX) {
     return -1;
@@ -1531,6 +1626,12 @@ int __system_property_add(const char* name, unsigned int namelen, const char* va
 
 // Wait for non-locked serial, and retrieve it with acquire semantics.
 uint32_t __system_property_serial(const prop_info* pi) {
+#if MB_ENABLE_COMPAT_PROPERTIES
+  if (__predict_false(compat_mode)) {
+    return __system_property_serial_compat(pi);
+  }
+#endif
+
   uint32_t serial = load_const_atomic(&pi->serial, memory_order_acquire);
   while (SERIAL_DIRTY(serial)) {
     __futex_wait(const_cast<_Atomic(uint_least32_t)*>(&pi->serial), serial, nullptr);
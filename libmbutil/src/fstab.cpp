@@ -20,6 +20,9 @@
 #include "mbutil/fstab.h"
 
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 
 #include <cctype>
 #include <cerrno>
@@ -29,6 +32,7 @@
 #include <cstring>
 
 #include <sys/mount.h>
+#include <sys/stat.h>
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
@@ -105,11 +109,121 @@ std::string FstabErrorInfo::message() const
 
 struct MountFlag
 {
-    const char *name;
+    std::string_view name;
     unsigned long flag;
 };
 
-static struct MountFlag g_mount_flags[] =
+/*!
+ * \brief Compile-time perfect hash table for option names
+ *
+ * Options are matched by prefix (eg. "encryptable=" matches
+ * "encryptable=footer") and the first matching entry in table order wins. To
+ * keep those semantics, lookup() hashes the option's prefix for every distinct
+ * name length in the table instead of comparing against every name. The hash
+ * seed is chosen at compile time so that no two names share a bucket.
+ */
+template<size_t N>
+class OptionTable
+{
+public:
+    constexpr OptionTable(const MountFlag (&flags)[N])
+        : _flags(flags), _buckets(), _lengths(), _num_lengths(0), _seed(0)
+    {
+        for (size_t i = 0; i < N; ++i) {
+            bool found = false;
+            for (size_t j = 0; j < _num_lengths; ++j) {
+                if (_lengths[j] == flags[i].name.size()) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                _lengths[_num_lengths++] = flags[i].name.size();
+            }
+        }
+
+        // Find a seed without collisions. The loop is bounded by the
+        // compiler's constexpr step limit, so a table that cannot be hashed
+        // fails to compile instead of silently degrading.
+        for (;; ++_seed) {
+            for (auto &b : _buckets) {
+                b = 0;
+            }
+
+            bool collision = false;
+
+            for (size_t i = 0; i < N && !collision; ++i) {
+                auto &b = _buckets[bucket(_flags[i].name)];
+                if (b != 0) {
+                    collision = true;
+                } else {
+                    b = static_cast<uint8_t>(i + 1);
+                }
+            }
+
+            if (!collision) {
+                break;
+            }
+        }
+    }
+
+    //! Index of the first entry whose name is a prefix of \p option or -1
+    constexpr int lookup(std::string_view option) const
+    {
+        int result = -1;
+
+        for (size_t i = 0; i < _num_lengths; ++i) {
+            if (_lengths[i] > option.size()) {
+                continue;
+            }
+
+            auto prefix = option.substr(0, _lengths[i]);
+            auto b = _buckets[bucket(prefix)];
+
+            if (b != 0 && _flags[b - 1].name == prefix
+                    && (result < 0 || b - 1 < result)) {
+                result = b - 1;
+            }
+        }
+
+        return result;
+    }
+
+    constexpr const MountFlag & operator[](size_t i) const
+    {
+        return _flags[i];
+    }
+
+private:
+    static constexpr size_t NUM_BUCKETS = [] {
+        size_t n = 1;
+        while (n < N * 8) {
+            n <<= 1;
+        }
+        return n;
+    }();
+
+    static_assert(N < UINT8_MAX, "Too many entries");
+
+    constexpr size_t bucket(std::string_view str) const
+    {
+        // FNV-1a
+        uint32_t hash = 2166136261u ^ _seed;
+        for (char c : str) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 16777619u;
+        }
+        return hash & (NUM_BUCKETS - 1);
+    }
+
+    const MountFlag *_flags;
+    uint8_t _buckets[NUM_BUCKETS];
+    size_t _lengths[N];
+    size_t _num_lengths;
+    uint32_t _seed;
+};
+
+static constexpr MountFlag g_mount_flags_list[] =
 {
     { "active",         MS_ACTIVE },
     { "bind",           MS_BIND },
@@ -137,10 +251,9 @@ static struct MountFlag g_mount_flags[] =
     // Flags that should be ignored
     { "rw",             0 },
     { "defaults",       0 },
-    { nullptr,          0 }
 };
 
-static struct MountFlag g_fs_mgr_flags[] =
+static constexpr MountFlag g_fs_mgr_flags_list[] =
 {
     { "wait",               MF_WAIT },
     { "check",              MF_CHECK },
@@ -169,26 +282,28 @@ static struct MountFlag g_fs_mgr_flags[] =
     { "eraseblk=",          MF_ERASEBLKSIZE },
     { "logicalblk=",        MF_LOGICALBLKSIZE },
     { "defaults",           0 },
-    { nullptr,              0 },
 };
 
+static constexpr OptionTable g_mount_flags(g_mount_flags_list);
+static constexpr OptionTable g_fs_mgr_flags(g_fs_mgr_flags_list);
+
+static_assert(g_mount_flags.lookup("ro") == 13);
+static_assert(g_mount_flags.lookup("nodiratime") == 7);
+static_assert(g_fs_mgr_flags.lookup("verifyatboot") == 13);
+static_assert(g_fs_mgr_flags.lookup("encryptable=footer") == 2);
+static_assert(g_fs_mgr_flags.lookup("foo") == -1);
+
+template<size_t N>
 static std::pair<unsigned long, std::vector<std::string>>
-parse_options(const MountFlag *flags_map, std::string_view options)
+parse_options(const OptionTable<N> &flags_map, std::string_view options)
 {
     unsigned long flags = 0;
     std::vector<std::string> remaining;
 
     for (auto const &option : split_sv(options, ',')) {
-        const MountFlag *it;
-
-        for (it = flags_map; it->name; ++it) {
-            if (starts_with(option, it->name)) {
-                flags |= it->flag;
-                break;
-            }
-        }
-
-        if (!it->name) {
+        if (auto i = flags_map.lookup(option); i >= 0) {
+            flags |= flags_map[static_cast<size_t>(i)].flag;
+        } else {
             remaining.emplace_back(option);
         }
     }
@@ -208,6 +323,62 @@ parse_fs_mgr_options(std::string_view options)
     return parse_options(g_fs_mgr_flags, options);
 }
 
+/*!
+ * \brief Cache of parsed fstab files
+ *
+ * The same fstab file is typically read several times while booting. Entries
+ * are keyed by path and are only used if the file's identity (device, inode,
+ * size, and modification and change times) is unchanged.
+ */
+template<typename Recs>
+class FstabCache
+{
+public:
+    std::optional<Recs> find(const std::string &path, const struct stat &sb)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (auto it = _entries.find(path); it != _entries.end()
+                && same_file(it->second.sb, sb)) {
+            return it->second.recs;
+        }
+
+        return std::nullopt;
+    }
+
+    void insert(const std::string &path, const struct stat &sb,
+                const Recs &recs)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _entries.insert_or_assign(path, Entry{sb, recs});
+    }
+
+private:
+    struct Entry
+    {
+        struct stat sb;
+        Recs recs;
+    };
+
+    static bool same_file(const struct stat &a, const struct stat &b)
+    {
+        return a.st_dev == b.st_dev
+                && a.st_ino == b.st_ino
+                && a.st_size == b.st_size
+                && a.st_mtim.tv_sec == b.st_mtim.tv_sec
+                && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec
+                && a.st_ctim.tv_sec == b.st_ctim.tv_sec
+                && a.st_ctim.tv_nsec == b.st_ctim.tv_nsec;
+    }
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, Entry> _entries;
+};
+
+static FstabCache<FstabRecs> g_fstab_cache;
+static FstabCache<TwrpFstabRecs> g_twrp_fstab_cache;
+
 // Much simplified version of fs_mgr's fstab parsing code
 FstabResult<FstabRecs> read_fstab(const std::string &path)
 {
@@ -216,6 +387,15 @@ FstabResult<FstabRecs> read_fstab(const std::string &path)
         return FstabErrorInfo{{}, ec_from_errno()};
     }
 
+    struct stat sb;
+    if (fstat(fileno(fp.get()), &sb) < 0) {
+        return FstabErrorInfo{{}, ec_from_errno()};
+    }
+
+    if (auto cached = g_fstab_cache.find(path, sb)) {
+        return std::move(*cached);
+    }
+
     char *line = nullptr;
     size_t len = 0; // allocated memory size
     ssize_t bytes_read; // number of bytes read
@@ -284,6 +464,8 @@ FstabResult<FstabRecs> read_fstab(const std::string &path)
         return FstabErrorInfo{{}, ec_from_errno()};
     }
 
+    g_fstab_cache.insert(path, sb, fstab);
+
     return std::move(fstab);
 }
 
@@ -294,6 +476,15 @@ FstabResult<TwrpFstabRecs> read_twrp_fstab(const std::string &path)
         return FstabErrorInfo{{}, ec_from_errno()};
     }
 
+    struct stat sb;
+    if (fstat(fileno(fp.get()), &sb) < 0) {
+        return FstabErrorInfo{{}, ec_from_errno()};
+    }
+
+    if (auto cached = g_twrp_fstab_cache.find(path, sb)) {
+        return std::move(*cached);
+    }
+
     char *line = nullptr;
     size_t len = 0; // allocated memory size
     ssize_t bytes_read; // number of bytes read
@@ -372,6 +563,8 @@ FstabResult<TwrpFstabRecs> read_twrp_fstab(const std::string &path)
         return FstabErrorInfo{{}, ec_from_errno()};
     }
 
+    g_twrp_fstab_cache.insert(path, sb, fstab);
+
     return std::move(fstab);
 }
 
@@ -19,51 +19,65 @@
 
 #include "mbutil/hash.h"
 
-#include <memory>
+#include <algorithm>
+#include <atomic>
 
-#include <cstdio>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
 
 
 namespace mb::util
 {
 
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+// Large enough that the syscall overhead is negligible compared to hashing
+static constexpr size_t HASH_BUFFER_SIZE = 1024 * 1024;
 
 /*!
- * \brief Compute SHA512 hash of a file
+ * \brief Compute SHA512 hash of a file descriptor
  *
- * \param path Path to file
+ * The file is read from the current position until EOF.
+ *
+ * \note The file is intentionally not mmap'd. The files being hashed may be
+ *       writable by other processes and truncating a mapped file would cause
+ *       SIGBUS instead of an error.
+ *
+ * \param fd File descriptor
  *
  * \return The digest on success or the error code on failure
  */
-oc::result<Sha512Digest> sha512_hash(const std::string &path)
+oc::result<Sha512Digest> sha512_hash(int fd)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
-    if (!fp) {
-        return ec_from_errno();
-    }
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 21
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
-    std::array<unsigned char, 10240> buf;
-    size_t n;
+    std::vector<unsigned char> buf(HASH_BUFFER_SIZE);
 
     SHA512_CTX ctx;
     if (!SHA512_Init(&ctx)) {
         return std::errc::io_error;
     }
 
-    while ((n = fread(buf.data(), 1, buf.size(), fp.get())) > 0) {
-        if (!SHA512_Update(&ctx, buf.data(), n)) {
-            return std::errc::io_error;
-        }
-        if (n < buf.size()) {
+    while (true) {
+        ssize_t n = read(fd, buf.data(), buf.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
             break;
         }
-    }
 
-    if (ferror(fp.get())) {
-        return ec_from_errno();
+        if (!SHA512_Update(&ctx, buf.data(), static_cast<size_t>(n))) {
+            return std::errc::io_error;
+        }
     }
 
     Sha512Digest digest;
@@ -75,4 +89,66 @@ oc::result<Sha512Digest> sha512_hash(const std::string &path)
     return std::move(digest);
 }
 
+/*!
+ * \brief Compute SHA512 hash of a file
+ *
+ * \param path Path to file
+ *
+ * \return The digest on success or the error code on failure
+ */
+oc::result<Sha512Digest> sha512_hash(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    return sha512_hash(fd);
+}
+
+/*!
+ * \brief Compute SHA512 hashes of multiple files in parallel
+ *
+ * \param paths Paths to files
+ * \param jobs Number of tasks to use. If 0, the concurrency limit of the
+ *             global Executor is used.
+ *
+ * \return The digest or error code for each file, in the same order as
+ *         \p paths
+ */
+std::vector<oc::result<Sha512Digest>>
+sha512_hash_files(const std::vector<std::string> &paths, unsigned int jobs)
+{
+    std::vector<oc::result<Sha512Digest>> results(
+            paths.size(), std::errc::operation_canceled);
+
+    if (jobs == 0) {
+        jobs = Executor::global().concurrency();
+    }
+    jobs = std::clamp(jobs, 1u, std::max(
+            static_cast<unsigned int>(paths.size()), 1u));
+
+    std::atomic<size_t> next{0};
+
+    auto worker = [&] {
+        size_t i;
+        while ((i = next++) < paths.size()) {
+            results[i] = sha512_hash(paths[i]);
+        }
+    };
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < jobs; ++i) {
+        group.run(worker);
+    }
+    worker();
+    group.wait();
+
+    return results;
+}
+
 }
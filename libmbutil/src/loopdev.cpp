@@ -19,6 +19,8 @@
 
 #include "mbutil/loopdev.h"
 
+#include <algorithm>
+#include <memory>
 #include <vector>
 
 #include <cerrno>
@@ -26,6 +28,7 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
 #include <fcntl.h>
 
 #include <sys/ioctl.h>
@@ -37,7 +40,9 @@
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
+#include "mbutil/file.h"
 #include "mbutil/string.h"
 
 
@@ -49,10 +54,36 @@
 
 #define MAX_LOOPDEVS    1024
 
+// These may not be defined in older kernel headers. LOOP_SET_DIRECT_IO was
+// added in Linux 4.4, LOOP_SET_BLOCK_SIZE in 4.14, and LOOP_CONFIGURE in 5.8.
+#ifndef LOOP_SET_DIRECT_IO
+#  define LOOP_SET_DIRECT_IO    0x4C08
+#endif
+#ifndef LOOP_SET_BLOCK_SIZE
+#  define LOOP_SET_BLOCK_SIZE   0x4C09
+#endif
+#ifndef LOOP_CONFIGURE
+#  define LOOP_CONFIGURE        0x4C0A
+#endif
+
 
 namespace mb::util
 {
 
+// lo_flags values (LO_FLAGS_* is an enum, so it can't be checked with #ifdef)
+constexpr uint32_t LOOP_FLAG_READ_ONLY = 1;
+constexpr uint32_t LOOP_FLAG_AUTOCLEAR = 4;
+constexpr uint32_t LOOP_FLAG_DIRECT_IO = 16;
+
+// Same layout as struct loop_config from <linux/loop.h>
+struct LoopConfig
+{
+    uint32_t fd;
+    uint32_t block_size;
+    loop_info64 info;
+    uint64_t reserved[8];
+};
+
 /*!
  * \brief Find empty loopdev by using the new ioctl for /dev/block/loop-control
  *
@@ -90,20 +121,22 @@ static oc::result<int> find_loopdev_by_loop_control()
 /*!
  * \brief Find empty loopdev by dumb scan through /dev/block/loop*
  *
+ * \param start First loopdev number to check
+ *
  * \return Loopdev number or the error code if:
  *         - /dev/block/loop# failed to stat where errno != ENOENT
  *         - /dev/block/loop# is not a loop device
  *         - /dev/block/loop# could not be opened
  *         - LOOP_GET_STATUS64 ioctl failed where errno != ENXIO
  */
-static oc::result<int> find_loopdev_by_scanning()
+static oc::result<int> find_loopdev_by_scanning(int start = 1)
 {
     int fd;
     char loopdev[64];
 
     // Avoid /dev/block/loop0 since some installers (ahem, SuperSU) are
     // hardcoded to use it
-    for (int n = 1; n < MAX_LOOPDEVS; ++n) {
+    for (int n = std::max(start, 1); n < MAX_LOOPDEVS; ++n) {
         loop_info64 loopinfo;
         struct stat sb;
 
@@ -168,10 +201,97 @@ oc::result<std::string> loopdev_find_unused()
     return format(LOOP_FMT, n.value());
 }
 
+/*!
+ * \brief Associate a loop device with a file
+ *
+ * LOOP_CONFIGURE is used to set up the device with a single ioctl if the kernel
+ * supports it. Otherwise, this falls back to LOOP_SET_FD and
+ * LOOP_SET_STATUS64, followed by LOOP_SET_BLOCK_SIZE and LOOP_SET_DIRECT_IO as
+ * needed. Direct I/O is only a hint: if the backing file or kernel does not
+ * support it, the device is still set up with buffered I/O.
+ */
+static oc::result<void> configure_loopdev(int lfd, int ffd,
+                                          const std::string &file,
+                                          uint64_t offset,
+                                          LoopDeviceFlags flags,
+                                          uint32_t block_size)
+{
+    LoopConfig config = {};
+
+    config.fd = static_cast<uint32_t>(ffd);
+    config.block_size = block_size;
+    strlcpy(reinterpret_cast<char *>(config.info.lo_file_name), file.c_str(),
+            LO_NAME_SIZE);
+    config.info.lo_offset = offset;
+
+    if (flags & LoopDeviceFlag::ReadOnly) {
+        config.info.lo_flags |= LOOP_FLAG_READ_ONLY;
+    }
+    if (flags & LoopDeviceFlag::AutoClear) {
+        config.info.lo_flags |= LOOP_FLAG_AUTOCLEAR;
+    }
+    if (flags & LoopDeviceFlag::DirectIo) {
+        config.info.lo_flags |= LOOP_FLAG_DIRECT_IO;
+    }
+
+    if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+        return oc::success();
+    } else if (errno == EINVAL && (flags & LoopDeviceFlag::DirectIo)) {
+        // Newer kernels reject direct I/O if the backing file does not
+        // support it instead of silently using buffered I/O
+        config.info.lo_flags &= ~LOOP_FLAG_DIRECT_IO;
+
+        if (ioctl(lfd, LOOP_CONFIGURE, &config) == 0) {
+            return oc::success();
+        }
+    }
+
+    if (errno != EINVAL && errno != ENOTTY) {
+        return ec_from_errno();
+    }
+
+    // Kernel does not support LOOP_CONFIGURE
+
+    if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) {
+        return ec_from_errno();
+    }
+
+    // Only LO_FLAGS_AUTOCLEAR can be set this way. The device is read-only if
+    // the backing file was opened read-only.
+    config.info.lo_flags &= LOOP_FLAG_AUTOCLEAR;
+
+    if (ioctl(lfd, LOOP_SET_STATUS64, &config.info) < 0
+            || (block_size != 0
+                    && ioctl(lfd, LOOP_SET_BLOCK_SIZE,
+                             static_cast<unsigned long>(block_size)) < 0)) {
+        int saved_errno = errno;
+        ioctl(lfd, LOOP_CLR_FD, 0);
+        return ec_from_errno(saved_errno);
+    }
+
+    if (flags & LoopDeviceFlag::DirectIo) {
+        (void) ioctl(lfd, LOOP_SET_DIRECT_IO, 1UL);
+    }
+
+    return oc::success();
+}
+
 oc::result<void> loopdev_set_up_device(const std::string &loopdev,
                                        const std::string &file,
                                        uint64_t offset, bool ro)
 {
+    return loopdev_set_up_device(loopdev, file, offset,
+                                 ro ? LoopDeviceFlag::ReadOnly
+                                    : LoopDeviceFlags());
+}
+
+oc::result<void> loopdev_set_up_device(const std::string &loopdev,
+                                       const std::string &file,
+                                       uint64_t offset, LoopDeviceFlags flags,
+                                       uint32_t block_size)
+{
+    bool ro = flags & LoopDeviceFlag::ReadOnly;
+
     int ffd = open(file.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
     if (ffd < 0) {
         return ec_from_errno();
@@ -190,41 +310,291 @@ oc::result<void> loopdev_set_up_device(const std::string &loopdev,
         close(lfd);
     });
 
-    loop_info64 loopinfo = {};
-
-    strlcpy(reinterpret_cast<char *>(loopinfo.lo_file_name), file.c_str(),
-            LO_NAME_SIZE);
-    loopinfo.lo_offset = offset;
+    return configure_loopdev(lfd, ffd, file, offset, flags, block_size);
+}
 
-    if (ioctl(lfd, LOOP_SET_FD, ffd) < 0) {
+oc::result<void> loopdev_remove_device(const std::string &loopdev)
+{
+    int lfd = open(loopdev.c_str(), O_RDONLY | O_CLOEXEC);
+    if (lfd < 0) {
         return ec_from_errno();
     }
 
-    if (ioctl(lfd, LOOP_SET_STATUS64, &loopinfo) < 0) {
-        int saved_errno = errno;
-        ioctl(lfd, LOOP_CLR_FD, 0);
-        return ec_from_errno(saved_errno);
+    auto close_fd = finally([&] {
+        close(lfd);
+    });
+
+    // ENXIO means that the device is not attached, which can happen if it was
+    // set up with LoopDeviceFlag::AutoClear
+    if (ioctl(lfd, LOOP_CLR_FD, 0) < 0 && errno != ENXIO) {
+        return ec_from_errno();
     }
 
     return oc::success();
 }
 
-oc::result<void> loopdev_remove_device(const std::string &loopdev)
+/*!
+ * \brief Check whether a loop device passes discards to its backing file
+ *
+ * The loop driver punches holes in the backing file for discarded ranges, but
+ * only advertises discard support if the backing filesystem can deallocate
+ * blocks (eg. not on FAT-formatted external SD cards).
+ *
+ * \param loopdev Loop device path
+ *
+ * \return Whether discards are supported or the error
+ */
+oc::result<bool> loopdev_supports_discard(const std::string &loopdev)
 {
-    int lfd = open(loopdev.c_str(), O_RDONLY | O_CLOEXEC);
-    if (lfd < 0) {
+    struct stat sb;
+    if (stat(loopdev.c_str(), &sb) < 0) {
         return ec_from_errno();
+    } else if (!S_ISBLK(sb.st_mode)) {
+        return std::errc::invalid_argument;
     }
 
-    auto close_fd = finally([&] {
-        close(lfd);
-    });
+    OUTCOME_TRY(line, file_first_line(format(
+            "/sys/dev/block/%u:%u/queue/discard_max_bytes",
+            major(sb.st_rdev), minor(sb.st_rdev))));
+
+    uint64_t max_bytes;
+    if (!str_to_num(line.c_str(), 10, max_bytes)) {
+        return std::errc::invalid_argument;
+    }
+
+    return max_bytes > 0;
+}
 
-    if (ioctl(lfd, LOOP_CLR_FD, 0) < 0) {
+/*!
+ * \brief Find a loop device that is attached to a file
+ *
+ * \param file Path to backing file
+ *
+ * \return Path of the loop device, an empty string if the file is not attached
+ *         to a loop device, or the error
+ */
+oc::result<std::string> loopdev_find_by_file(const std::string &file)
+{
+    std::unique_ptr<char, decltype(free) *> resolved(
+            realpath(file.c_str(), nullptr), free);
+    if (!resolved) {
         return ec_from_errno();
     }
 
+    std::unique_ptr<DIR, decltype(closedir) *> dir(
+            opendir("/sys/block"), closedir);
+    if (!dir) {
+        return ec_from_errno();
+    }
+
+    while (auto ent = readdir(dir.get())) {
+        if (!starts_with(ent->d_name, "loop")) {
+            continue;
+        }
+
+        // Only attached devices have the backing_file attribute
+        auto backing_file = file_first_line(format(
+                "/sys/block/%s/loop/backing_file", ent->d_name));
+        if (backing_file && backing_file.value() == resolved.get()) {
+            return format("/dev/block/%s", ent->d_name);
+        }
+    }
+
+    return std::string();
+}
+
+/*!
+ * \brief Find a free loop device numbered \p start or higher
+ */
+static oc::result<int> find_free_loopdev(int start)
+{
+    // LOOP_CTL_GET_FREE always returns the lowest free device, which may be
+    // one that was already reserved, but not yet attached
+    if (auto n = find_loopdev_by_loop_control(); n && n.value() >= start) {
+        return n;
+    }
+
+    return find_loopdev_by_scanning(start);
+}
+
+LoopDevice::LoopDevice() noexcept
+    : _pool(nullptr)
+    , _fd(-1)
+{
+}
+
+LoopDevice::LoopDevice(LoopDevicePool *pool, std::string path, int fd) noexcept
+    : _pool(pool)
+    , _path(std::move(path))
+    , _fd(fd)
+{
+}
+
+LoopDevice::~LoopDevice()
+{
+    (void) detach();
+}
+
+LoopDevice::LoopDevice(LoopDevice &&other) noexcept
+    : _pool(other._pool)
+    , _path(std::move(other._path))
+    , _fd(other._fd)
+{
+    other._pool = nullptr;
+    other._path.clear();
+    other._fd = -1;
+}
+
+LoopDevice & LoopDevice::operator=(LoopDevice &&rhs) noexcept
+{
+    if (this != &rhs) {
+        (void) detach();
+
+        std::swap(_pool, rhs._pool);
+        std::swap(_path, rhs._path);
+        std::swap(_fd, rhs._fd);
+    }
+
+    return *this;
+}
+
+const std::string & LoopDevice::path() const
+{
+    return _path;
+}
+
+bool LoopDevice::is_attached() const
+{
+    return _fd >= 0;
+}
+
+/*!
+ * \brief Detach the loop device and return it to the pool
+ *
+ * If a filesystem is still mounted from the device, the kernel will detach it
+ * once the filesystem is unmounted.
+ */
+oc::result<void> LoopDevice::detach()
+{
+    if (_fd < 0) {
+        return oc::success();
+    }
+
+    oc::result<void> ret = oc::success();
+
+    // Older kernels return EBUSY instead of deferring the detach if the device
+    // is in use. LO_FLAGS_AUTOCLEAR takes care of that case.
+    if (ioctl(_fd, LOOP_CLR_FD, 0) < 0 && errno != ENXIO && errno != EBUSY) {
+        ret = ec_from_errno();
+    }
+
+    close(_fd);
+    _fd = -1;
+
+    if (_pool) {
+        _pool->put(std::move(_path));
+        _pool = nullptr;
+    }
+    _path.clear();
+
+    return ret;
+}
+
+LoopDevicePool::LoopDevicePool()
+    : _next_scan(1)
+{
+}
+
+LoopDevicePool::~LoopDevicePool() = default;
+
+/*!
+ * \brief Find \p count unused loop devices ahead of time
+ *
+ * Reserved devices are not locked in any way. If another process attaches one
+ * of them first, attach() will skip it.
+ */
+oc::result<void> LoopDevicePool::reserve(size_t count)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    while (_free.size() < count) {
+        OUTCOME_TRY(n, find_free_loopdev(_next_scan));
+        _next_scan = n + 1;
+        _free.push_back(format(LOOP_FMT, n));
+    }
+
     return oc::success();
 }
 
+/*!
+ * \brief Attach a file to a loop device from the pool
+ *
+ * LoopDeviceFlag::AutoClear is always set so that the device is never leaked
+ * if the LoopDevice is destroyed while a filesystem is mounted from it. If the
+ * pool is empty, another unused loop device is found.
+ */
+oc::result<LoopDevice> LoopDevicePool::attach(const std::string &file,
+                                              uint64_t offset,
+                                              LoopDeviceFlags flags,
+                                              uint32_t block_size)
+{
+    bool ro = flags & LoopDeviceFlag::ReadOnly;
+    flags |= LoopDeviceFlag::AutoClear;
+
+    int ffd = open(file.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+    if (ffd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_ffd = finally([&] {
+        close(ffd);
+    });
+
+    while (true) {
+        OUTCOME_TRY(path, take());
+
+        int lfd = open(path.c_str(), (ro ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+        if (lfd < 0) {
+            return ec_from_errno();
+        }
+
+        auto r = configure_loopdev(lfd, ffd, file, offset, flags, block_size);
+        if (!r) {
+            close(lfd);
+
+            if (r.error() == std::errc::device_or_resource_busy) {
+                // Someone else attached it since it was reserved
+                continue;
+            }
+
+            put(std::move(path));
+            return r.as_failure();
+        }
+
+        return LoopDevice(this, std::move(path), lfd);
+    }
+}
+
+oc::result<std::string> LoopDevicePool::take()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_free.empty()) {
+        std::string path = std::move(_free.front());
+        _free.erase(_free.begin());
+        return path;
+    }
+
+    OUTCOME_TRY(n, find_free_loopdev(_next_scan));
+    _next_scan = n + 1;
+
+    return format(LOOP_FMT, n);
+}
+
+void LoopDevicePool::put(std::string path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(std::move(path));
+}
+
 }
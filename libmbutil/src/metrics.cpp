@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/metrics.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include <cinttypes>
+
+#include "mbcommon/string.h"
+
+#include "mblog/logging.h"
+
+#include "mbutil/atrace.h"
+
+#define LOG_TAG "mbutil/metrics"
+
+using namespace std::chrono;
+
+namespace mb::util
+{
+
+struct StageMetrics : std::enable_shared_from_this<StageMetrics>
+{
+    std::string name;
+    std::shared_ptr<StageMetrics> parent;
+    steady_clock::time_point start;
+
+    std::atomic<uint64_t> files{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<int64_t> read_ns{0};
+    std::atomic<int64_t> write_ns{0};
+    std::atomic<uint64_t> expected_read_bytes{0};
+};
+
+static thread_local StageMetrics *g_current = nullptr;
+
+static std::mutex g_stages_mutex;
+static std::vector<std::weak_ptr<StageMetrics>> g_active_stages;
+static std::vector<StageSummary> g_finished_stages;
+
+static constexpr double MIB = 1024.0 * 1024.0;
+
+static double to_seconds(int64_t ns)
+{
+    return static_cast<double>(ns) / 1e9;
+}
+
+static double rate(uint64_t bytes, double seconds)
+{
+    return seconds > 0 ? static_cast<double>(bytes) / MIB / seconds : 0.0;
+}
+
+static StageSummary summarize(const StageMetrics &m)
+{
+    StageSummary s;
+    s.name = m.name;
+    s.seconds = duration<double>(steady_clock::now() - m.start).count();
+    s.files = m.files;
+    s.bytes = m.bytes;
+    s.bytes_read = m.bytes_read;
+    s.read_seconds = to_seconds(m.read_ns);
+    s.bytes_written = m.bytes_written;
+    s.write_seconds = to_seconds(m.write_ns);
+    return s;
+}
+
+static void log_summary(const char *prefix, const StageSummary &s,
+                        uint64_t expected_read_bytes)
+{
+    // The time spent outside of the reported reads and writes is spent
+    // (de)compressing, hashing, or otherwise processing the data
+    double cpu_seconds = std::max(
+            s.seconds - s.read_seconds - s.write_seconds, 0.0);
+
+    std::string eta;
+    if (expected_read_bytes > s.bytes_read && s.bytes_read > 0) {
+        double remaining = static_cast<double>(
+                expected_read_bytes - s.bytes_read)
+                / static_cast<double>(s.bytes_read) * s.seconds;
+        eta = format(", ETA %.0fs", remaining);
+    }
+
+    LOGI("%s%s: %.1fs, %" PRIu64 " files, %.1f MiB (%.1f MiB/s);"
+         " read %.1f MiB (%.1f MiB/s), write %.1f MiB (%.1f MiB/s),"
+         " cpu %.1fs%s",
+         prefix, s.name.c_str(), s.seconds, s.files,
+         static_cast<double>(s.bytes) / MIB, rate(s.bytes, s.seconds),
+         static_cast<double>(s.bytes_read) / MIB,
+         rate(s.bytes_read, s.read_seconds),
+         static_cast<double>(s.bytes_written) / MIB,
+         rate(s.bytes_written, s.write_seconds),
+         cpu_seconds, eta.c_str());
+}
+
+MetricsStage::MetricsStage(std::string name)
+    : MetricsStage(std::move(name),
+                   g_current ? g_current->shared_from_this() : nullptr)
+{
+}
+
+MetricsStage::MetricsStage(std::string name,
+                           std::shared_ptr<StageMetrics> parent)
+    : _metrics(std::make_shared<StageMetrics>())
+    , _prev(g_current)
+{
+    if (parent) {
+        _metrics->name = parent->name;
+        _metrics->name += '/';
+    }
+    _metrics->name += name;
+    _metrics->parent = std::move(parent);
+    _metrics->start = steady_clock::now();
+
+    {
+        std::lock_guard<std::mutex> lock(g_stages_mutex);
+        g_active_stages.push_back(_metrics);
+    }
+
+    g_current = _metrics.get();
+
+    _traced = atrace_enabled();
+    if (_traced) {
+        atrace_begin(_metrics->name.c_str());
+    }
+}
+
+MetricsStage::~MetricsStage()
+{
+    if (_traced) {
+        atrace_end();
+    }
+
+    g_current = _prev;
+
+    auto summary = summarize(*_metrics);
+    log_summary("Finished ", summary, 0);
+
+    std::lock_guard<std::mutex> lock(g_stages_mutex);
+
+    g_active_stages.erase(std::remove_if(
+            g_active_stages.begin(), g_active_stages.end(),
+            [&](const std::weak_ptr<StageMetrics> &p) {
+        auto s = p.lock();
+        return !s || s == _metrics;
+    }), g_active_stages.end());
+
+    g_finished_stages.push_back(std::move(summary));
+}
+
+std::shared_ptr<StageMetrics> MetricsStage::current()
+{
+    return g_current ? g_current->shared_from_this() : nullptr;
+}
+
+MetricsBinding::MetricsBinding(std::shared_ptr<StageMetrics> metrics)
+    : _metrics(std::move(metrics))
+    , _prev(g_current)
+{
+    g_current = _metrics.get();
+}
+
+MetricsBinding::~MetricsBinding()
+{
+    g_current = _prev;
+}
+
+MetricsReporter::MetricsReporter(seconds interval)
+    : _interval(interval)
+    , _stop(false)
+    , _thread(&MetricsReporter::run, this)
+{
+}
+
+MetricsReporter::~MetricsReporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+void MetricsReporter::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (!_cv.wait_for(lock, _interval, [this] { return _stop; })) {
+        std::vector<std::shared_ptr<StageMetrics>> stages;
+
+        {
+            std::lock_guard<std::mutex> stages_lock(g_stages_mutex);
+            for (auto const &p : g_active_stages) {
+                if (auto s = p.lock()) {
+                    stages.push_back(std::move(s));
+                }
+            }
+        }
+
+        bool traced = atrace_enabled();
+
+        for (auto const &s : stages) {
+            auto summary = summarize(*s);
+            log_summary("Progress of ", summary, s->expected_read_bytes);
+
+            if (traced) {
+                atrace_counter((s->name + " bytes read").c_str(),
+                               static_cast<int64_t>(summary.bytes_read));
+                atrace_counter((s->name + " bytes written").c_str(),
+                               static_cast<int64_t>(summary.bytes_written));
+            }
+        }
+    }
+}
+
+void metrics_set_expected_read_bytes(uint64_t bytes)
+{
+    if (g_current) {
+        g_current->expected_read_bytes = bytes;
+    }
+}
+
+void metrics_add_files(uint64_t files, uint64_t bytes)
+{
+    for (auto m = g_current; m; m = m->parent.get()) {
+        m->files += files;
+        m->bytes += bytes;
+    }
+}
+
+void metrics_add_read(uint64_t bytes, steady_clock::duration time)
+{
+    auto ns = duration_cast<nanoseconds>(time).count();
+
+    for (auto m = g_current; m; m = m->parent.get()) {
+        m->bytes_read += bytes;
+        m->read_ns += ns;
+    }
+}
+
+void metrics_add_write(uint64_t bytes, steady_clock::duration time)
+{
+    auto ns = duration_cast<nanoseconds>(time).count();
+
+    for (auto m = g_current; m; m = m->parent.get()) {
+        m->bytes_written += bytes;
+        m->write_ns += ns;
+    }
+}
+
+std::vector<StageSummary> metrics_finished_stages()
+{
+    std::lock_guard<std::mutex> lock(g_stages_mutex);
+    return g_finished_stages;
+}
+
+}
@@ -21,6 +21,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <cerrno>
@@ -28,6 +29,8 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
@@ -53,6 +56,7 @@ static constexpr int MAX_UNMOUNT_TRIES = 5;
 
 static constexpr char PROC_MOUNTS[] = "/proc/mounts";
 static constexpr char PROC_MOUNTINFO[] = "/proc/self/mountinfo";
+static constexpr char PROC_MOUNT_NS[] = "/proc/self/ns/mnt";
 static constexpr std::string_view DELETED_SUFFIX = " (deleted)";
 
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
@@ -156,7 +160,180 @@ split_options(std::string_view options)
     return {join(vfs_list, ','), join(fs_list, ',')};
 }
 
-oc::result<std::vector<MountEntry>> get_mount_entries()
+static bool parse_mountinfo_line(char *line, MountEntry &entry)
+{
+    unsigned int id;
+    unsigned int parent;
+    unsigned int dev_maj, dev_min;
+    int root_begin, root_end;
+    int target_begin, target_end;
+    int vfs_opts_begin, vfs_opts_end;
+    int type_begin, type_end;
+    int source_begin, source_end;
+    int fs_opts_begin, fs_opts_end;
+    int count;
+
+    count = std::sscanf(line,
+                        "%u "      // [1] ID
+                        "%u "      // [2] Parent
+                        "%u:%u "   // [3] Device major:minor
+                        "%n%*s%n " // [4] Bind mount root
+                        "%n%*s%n " // [5] Mount point
+                        "%n%*s%n", // [6] VFS options
+                        &id,
+                        &parent,
+                        &dev_maj, &dev_min,
+                        &root_begin, &root_end,
+                        &target_begin, &target_end,
+                        &vfs_opts_begin, &vfs_opts_end);
+    if (count != 4) {
+        return false;
+    }
+
+    // [7] Skip over optional fields
+    char *dash = strstr(line + target_end, " - ");
+    if (!dash) {
+        return false;
+    }
+
+    count = sscanf(dash, " - "
+                         "%n%*s%n " // [8] FS type
+                         "%n%*s%n " // [9] Source device
+                         "%n%*s%n", // [10] FS options
+                         &type_begin, &type_end,
+                         &source_begin, &source_end,
+                         &fs_opts_begin, &fs_opts_end);
+    if (count != 0) {
+        return false;
+    }
+
+    // NULL terminate entries
+    line[root_end] = '\0';
+    line[target_end] = '\0';
+    line[vfs_opts_end] = '\0';
+    dash[type_end] = '\0';
+    dash[source_end] = '\0';
+    dash[fs_opts_end] = '\0';
+
+    entry.id = id;
+    entry.parent = parent;
+    entry.dev = makedev(dev_maj, dev_min);
+    entry.root = unescape_octals(line + root_begin);
+    entry.target = unescape_octals(line + target_begin);
+    entry.vfs_options = unescape_octals(line + vfs_opts_begin);
+    entry.type = unescape_octals(dash + type_begin);
+    entry.source = unescape_octals(dash + source_begin);
+    entry.fs_options = unescape_octals(dash + fs_opts_begin);
+
+    strip_deleted_suffix(entry.target);
+    remove_duplicate_options(entry.vfs_options, entry.fs_options);
+
+    return true;
+}
+
+static bool parse_mounts_line(char *line, MountEntry &entry)
+{
+    int source_begin, source_end;
+    int target_begin, target_end;
+    int type_begin, type_end;
+    int opts_begin, opts_end;
+    int freq;
+    int passno;
+    int count;
+
+    count = std::sscanf(line,
+                        "%n%*s%n " // [1] Source device
+                        "%n%*s%n " // [2] Mount point
+                        "%n%*s%n " // [3] FS type
+                        "%n%*s%n " // [4] Options
+                        "%d "      // [5] Dump frequency in days
+                        "%d",      // [6] Parallel fsck pass number
+                        &source_begin, &source_end,
+                        &target_begin, &target_end,
+                        &type_begin, &type_end,
+                        &opts_begin, &opts_end,
+                        &freq,
+                        &passno);
+    if (count != 2) {
+        return false;
+    }
+
+    // NULL terminate entries
+    line[source_end] = '\0';
+    line[target_end] = '\0';
+    line[type_end] = '\0';
+    line[opts_end] = '\0';
+
+    entry.source = unescape_octals(line + source_begin);
+    entry.target = unescape_octals(line + target_begin);
+    entry.type = unescape_octals(line + type_begin);
+    std::tie(entry.vfs_options, entry.fs_options) =
+            split_options(unescape_octals(line + opts_begin));
+    entry.freq = freq;
+    entry.passno = passno;
+
+    strip_deleted_suffix(entry.target);
+
+    return true;
+}
+
+/*!
+ * \brief Read the entire contents of a (proc) file from the beginning
+ */
+static oc::result<std::string> read_fd_contents(int fd)
+{
+    std::string data;
+    size_t size = 0;
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        return ec_from_errno();
+    }
+
+    while (true) {
+        if (data.size() - size < 4096) {
+            data.resize(std::max<size_t>(data.size() * 2, 16384));
+        }
+
+        ssize_t n = read(fd, data.data() + size, data.size() - size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        } else if (n == 0) {
+            break;
+        }
+
+        size += static_cast<size_t>(n);
+    }
+
+    data.resize(size);
+    return std::move(data);
+}
+
+static oc::result<std::vector<MountEntry>> parse_mountinfo(std::string data)
+{
+    std::vector<MountEntry> entries;
+
+    for (size_t pos = 0; pos < data.size();) {
+        size_t end = data.find('\n', pos);
+        if (end == std::string::npos) {
+            end = data.size();
+        }
+        data[end] = '\0';
+
+        if (end > pos && !parse_mountinfo_line(&data[pos],
+                                              entries.emplace_back())) {
+            return std::errc::invalid_argument;
+        }
+
+        pos = end + 1;
+    }
+
+    return std::move(entries);
+}
+
+static oc::result<std::vector<MountEntry>> read_proc_mounts()
 {
     std::vector<MountEntry> entries;
 
@@ -167,163 +344,221 @@ oc::result<std::vector<MountEntry>> get_mount_entries()
         free(line);
     });
 
-    {
-        ScopedFILE fp(fopen(PROC_MOUNTINFO, "re"), fclose);
-        if (fp) {
-            while (getline(&line, &len, fp.get()) != -1) {
-                MountEntry &entry = entries.emplace_back();
-
-                unsigned int id;
-                unsigned int parent;
-                unsigned int dev_maj, dev_min;
-                int root_begin, root_end;
-                int target_begin, target_end;
-                int vfs_opts_begin, vfs_opts_end;
-                int type_begin, type_end;
-                int source_begin, source_end;
-                int fs_opts_begin, fs_opts_end;
-                int count;
-
-                count = std::sscanf(line,
-                                    "%u "      // [1] ID
-                                    "%u "      // [2] Parent
-                                    "%u:%u "   // [3] Device major:minor
-                                    "%n%*s%n " // [4] Bind mount root
-                                    "%n%*s%n " // [5] Mount point
-                                    "%n%*s%n", // [6] VFS options
-                                    &id,
-                                    &parent,
-                                    &dev_maj, &dev_min,
-                                    &root_begin, &root_end,
-                                    &target_begin, &target_end,
-                                    &vfs_opts_begin, &vfs_opts_end);
-                if (count != 4) {
-                    return std::errc::invalid_argument;
-                }
+    ScopedFILE fp(fopen(PROC_MOUNTS, "re"), fclose);
+    if (!fp) {
+        return ec_from_errno();
+    }
 
-                // [7] Skip over optional fields
-                char *dash = strstr(line + target_end, " - ");
-                if (!dash) {
-                    return std::errc::invalid_argument;
-                }
+    while (getline(&line, &len, fp.get()) != -1) {
+        if (!parse_mounts_line(line, entries.emplace_back())) {
+            return std::errc::invalid_argument;
+        }
+    }
 
-                count = sscanf(dash, " - "
-                                     "%n%*s%n " // [8] FS type
-                                     "%n%*s%n " // [9] Source device
-                                     "%n%*s%n", // [10] FS options
-                                     &type_begin, &type_end,
-                                     &source_begin, &source_end,
-                                     &fs_opts_begin, &fs_opts_end);
-                if (count != 0) {
-                    return std::errc::invalid_argument;
-                }
+    if (ferror(fp.get())) {
+        return ec_from_errno();
+    }
 
-                // NULL terminate entries
-                line[root_end] = '\0';
-                line[target_end] = '\0';
-                line[vfs_opts_end] = '\0';
-                dash[type_end] = '\0';
-                dash[source_end] = '\0';
-                dash[fs_opts_end] = '\0';
-
-                entry.id = id;
-                entry.parent = parent;
-                entry.dev = makedev(dev_maj, dev_min);
-                entry.root = unescape_octals(line + root_begin);
-                entry.target = unescape_octals(line + target_begin);
-                entry.vfs_options = unescape_octals(line + vfs_opts_begin);
-                entry.type = unescape_octals(dash + type_begin);
-                entry.source = unescape_octals(dash + source_begin);
-                entry.fs_options = unescape_octals(dash + fs_opts_begin);
-
-                strip_deleted_suffix(entry.target);
-                remove_duplicate_options(entry.vfs_options, entry.fs_options);
-            }
+    return std::move(entries);
+}
 
-            if (ferror(fp.get())) {
-                return ec_from_errno();
-            }
+static ino_t get_mount_namespace()
+{
+    struct stat sb;
 
-            return std::move(entries);
-        }
+    if (stat(PROC_MOUNT_NS, &sb) < 0) {
+        return 0;
     }
 
-    {
-        ScopedFILE fp(fopen(PROC_MOUNTS, "re"), fclose);
-        if (fp) {
-            while (getline(&line, &len, fp.get()) != -1) {
-                MountEntry &entry = entries.emplace_back();
-
-                int source_begin, source_end;
-                int target_begin, target_end;
-                int type_begin, type_end;
-                int opts_begin, opts_end;
-                int freq;
-                int passno;
-                int count;
-
-                count = std::sscanf(line,
-                                    "%n%*s%n " // [1] Source device
-                                    "%n%*s%n " // [2] Mount point
-                                    "%n%*s%n " // [3] FS type
-                                    "%n%*s%n " // [4] Options
-                                    "%d "      // [5] Dump frequency in days
-                                    "%d",      // [6] Parallel fsck pass number
-                                    &source_begin, &source_end,
-                                    &target_begin, &target_end,
-                                    &type_begin, &type_end,
-                                    &opts_begin, &opts_end,
-                                    &freq,
-                                    &passno);
-                if (count != 2) {
-                    return std::errc::invalid_argument;
-                }
+    return sb.st_ino;
+}
 
-                // NULL terminate entries
-                line[source_end] = '\0';
-                line[target_end] = '\0';
-                line[type_end] = '\0';
-                line[opts_end] = '\0';
-
-                entry.source = unescape_octals(line + source_begin);
-                entry.target = unescape_octals(line + target_begin);
-                entry.type = unescape_octals(line + type_begin);
-                std::tie(entry.vfs_options, entry.fs_options) =
-                        split_options(unescape_octals(line + opts_begin));
-                entry.freq = freq;
-                entry.passno = passno;
-
-                strip_deleted_suffix(entry.target);
-            }
+MountTable::MountTable()
+    : _fd(-1)
+    , _ns(0)
+    , _loaded(false)
+{
+}
 
-            if (ferror(fp.get())) {
-                return ec_from_errno();
-            }
+MountTable::~MountTable()
+{
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+/*!
+ * \brief Update the snapshot if the mount table has changed
+ *
+ * The kernel signals POLLPRI on an open /proc/self/mountinfo fd whenever a
+ * filesystem is mounted or unmounted in the mount namespace, so this only
+ * re-parses the table when needed. If mountinfo is not available,
+ * /proc/mounts is parsed every time.
+ */
+oc::result<void> MountTable::refresh()
+{
+    ino_t ns = get_mount_namespace();
 
-            return std::move(entries);
+    if (_fd >= 0 && ns != _ns) {
+        // The process switched to a different mount namespace
+        close(_fd);
+        _fd = -1;
+        _loaded = false;
+    }
+
+    if (_fd < 0) {
+        _fd = open(PROC_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+        _ns = ns;
+        _loaded = false;
+    }
+
+    if (_loaded && _fd >= 0) {
+        pollfd pfd = {};
+        pfd.fd = _fd;
+        pfd.events = POLLPRI;
+
+        int n;
+        do {
+            n = poll(&pfd, 1, 0);
+        } while (n < 0 && errno == EINTR);
+
+        if (n == 0) {
+            return oc::success();
         }
     }
 
-    // fopen failed
-    return ec_from_errno();
+    _loaded = false;
+    _by_target.clear();
+    _by_source.clear();
+    _entries.clear();
+
+    if (_fd >= 0) {
+        OUTCOME_TRY(data, read_fd_contents(_fd));
+        OUTCOME_TRY(entries, parse_mountinfo(std::move(data)));
+        _entries = std::move(entries);
+    } else {
+        OUTCOME_TRY(entries, read_proc_mounts());
+        _entries = std::move(entries);
+    }
+
+    // Later entries are mounted on top of earlier ones, so they win
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        _by_target.insert_or_assign(_entries[i].target, i);
+        _by_source.insert_or_assign(_entries[i].source, i);
+    }
+
+    _loaded = true;
+
+    return oc::success();
+}
+
+/*!
+ * \brief Force the next refresh() to re-parse the mount table
+ */
+void MountTable::invalidate()
+{
+    _loaded = false;
+}
+
+const std::vector<MountEntry> & MountTable::entries() const
+{
+    return _entries;
+}
+
+/*!
+ * \brief Find the top-most mount at \p target
+ *
+ * \return Pointer to entry, which is valid until the next refresh(), or nullptr
+ *         if \p target is not a mount point
+ */
+const MountEntry * MountTable::find_by_target(std::string_view target) const
+{
+    auto it = _by_target.find(target);
+    return it == _by_target.end() ? nullptr : &_entries[it->second];
+}
+
+/*!
+ * \brief Find the most recent mount of \p source
+ *
+ * \return Pointer to entry, which is valid until the next refresh(), or nullptr
+ *         if \p source is not mounted
+ */
+const MountEntry * MountTable::find_by_source(std::string_view source) const
+{
+    auto it = _by_source.find(source);
+    return it == _by_source.end() ? nullptr : &_entries[it->second];
+}
+
+static std::mutex g_mount_table_lock;
+
+/*!
+ * \brief Get the process-wide mount table snapshot
+ *
+ * \pre g_mount_table_lock must be held
+ */
+static oc::result<MountTable *> shared_mount_table()
+{
+    static MountTable table;
+
+    OUTCOME_TRYV(table.refresh());
+
+    return &table;
+}
+
+oc::result<std::vector<MountEntry>> get_mount_entries()
+{
+    std::lock_guard<std::mutex> lock(g_mount_table_lock);
+
+    OUTCOME_TRY(table, shared_mount_table());
+
+    return table->entries();
 }
 
 oc::result<void> is_mounted(const std::string &mountpoint)
 {
-    OUTCOME_TRY(entries, get_mount_entries());
+    std::lock_guard<std::mutex> lock(g_mount_table_lock);
 
-    for (auto const &entry : entries) {
-        if (entry.target == mountpoint) {
-            return oc::success();
-        }
+    OUTCOME_TRY(table, shared_mount_table());
+
+    if (table->find_by_target(mountpoint)) {
+        return oc::success();
     }
 
     return MountError::PathNotMounted;
 }
 
+/*!
+ * \brief Unmount \p target and clear the loop device if \p source is one
+ */
+static oc::result<void> umount_source(const std::string &target,
+                                      const std::string &source)
+{
+    oc::result<void> ret = oc::success();
+    if (::umount(target.c_str()) < 0) {
+        ret = ec_from_errno();
+    }
+
+    if (!source.empty()) {
+        struct stat sb;
+
+        if (stat(source.c_str(), &sb) == 0
+                && S_ISBLK(sb.st_mode) && major(sb.st_rdev) == 7) {
+            // If the source path is a loop block device, then disassociate it
+            // from the image
+            LOGD("Clearing loop device %s", source.c_str());
+            if (auto r = loopdev_remove_device(source); !r) {
+                LOGW("Failed to clear loop device: %s",
+                     r.error().message().c_str());
+            }
+        }
+    }
+
+    return ret;
+}
+
 oc::result<void> unmount_all(const std::string &dir)
 {
-    std::vector<std::string> to_unmount;
+    std::vector<std::pair<std::string, std::string>> to_unmount;
     int failed = 0;
     std::error_code ec;
 
@@ -334,20 +569,22 @@ oc::result<void> unmount_all(const std::string &dir)
 
         OUTCOME_TRY(entries, get_mount_entries());
 
-        for (auto const &entry : entries) {
+        for (auto &entry : entries) {
             // TODO: Use path_compare() instead of dumb string prefix matching
             if (starts_with(entry.target, dir)) {
-                to_unmount.push_back(std::move(entry.target));
+                to_unmount.emplace_back(std::move(entry.target),
+                                        std::move(entry.source));
             }
         }
 
-        // Unmount in reverse order
+        // Unmount in reverse order. The sources from the snapshot are used so
+        // that the mount table is not parsed again for every mount point.
         for (auto it = to_unmount.rbegin(); it != to_unmount.rend(); ++it) {
-            LOGD("Attempting to unmount %s", it->c_str());
+            LOGD("Attempting to unmount %s", it->first.c_str());
 
-            if (auto ret = umount(*it); !ret) {
+            if (auto ret = umount_source(it->first, it->second); !ret) {
                 LOGW("%s: Failed to unmount: %s",
-                     it->c_str(), ret.error().message().c_str());
+                     it->first.c_str(), ret.error().message().c_str());
                 ++failed;
                 ec = ret.error();
             }
@@ -415,8 +652,14 @@ oc::result<void> mount(const std::string &source, const std::string &target,
 
     if (need_loopdev) {
         OUTCOME_TRY(loopdev, loopdev_find_unused());
-        OUTCOME_TRYV(loopdev_set_up_device(loopdev, source, 0,
-                                           mount_flags & MS_RDONLY));
+        LoopDeviceFlags loop_flags = LoopDeviceFlag::DirectIo;
+        if (mount_flags & MS_RDONLY) {
+            loop_flags |= LoopDeviceFlag::ReadOnly;
+        }
+
+        // The filesystem has its own page cache, so avoid caching the image's
+        // contents a second time
+        OUTCOME_TRYV(loopdev_set_up_device(loopdev, source, 0, loop_flags));
 
         if (::mount(loopdev.c_str(), target.c_str(), fstype_real.c_str(),
                     mount_flags, data.c_str()) < 0) {
@@ -440,7 +683,7 @@ oc::result<void> mount(const std::string &source, const std::string &target,
  * This function takes the same arguments as umount(2), but returns nothing on
  * success and the error on failure.
  *
- * This function will search /proc/mounts for the mountpoint (using an exact
+ * This function will search the mount table for the mountpoint (using an exact
  * string compare). If the source path of the mountpoint is a block device and
  * the block device is a loop device, then it will be disassociated from the
  * previously attached file. Note that the return value of
@@ -454,40 +697,21 @@ oc::result<void> mount(const std::string &source, const std::string &target,
 oc::result<void> umount(const std::string &target)
 {
     std::string source;
-    std::string mnt_dir;
 
-    if (auto entries = get_mount_entries()) {
-        for (auto const &entry : entries.value()) {
-            if (entry.target == target) {
-                source = entry.source;
-            }
-        }
-    } else {
-        LOGW("Failed to get mount entries: %s",
-             entries.error().message().c_str());
-    }
-
-    oc::result<void> ret = oc::success();
-    if (::umount(target.c_str()) < 0) {
-        ret = ec_from_errno();
-    }
-
-    if (!source.empty()) {
-        struct stat sb;
+    {
+        std::lock_guard<std::mutex> lock(g_mount_table_lock);
 
-        if (stat(source.c_str(), &sb) == 0
-                && S_ISBLK(sb.st_mode) && major(sb.st_rdev) == 7) {
-            // If the source path is a loop block device, then disassociate it
-            // from the image
-            LOGD("Clearing loop device %s", source.c_str());
-            if (auto r = loopdev_remove_device(source); !r) {
-                LOGW("Failed to clear loop device: %s",
-                     ret.error().message().c_str());
+        if (auto table = shared_mount_table()) {
+            if (auto entry = table.value()->find_by_target(target)) {
+                source = entry->source;
             }
+        } else {
+            LOGW("Failed to get mount entries: %s",
+                 table.error().message().c_str());
         }
     }
 
-    return ret;
+    return umount_source(target, source);
 }
 
 oc::result<uint64_t> mount_get_total_size(const std::string &path)
@@ -28,7 +28,10 @@
 #include <cstdio>
 #include <cstring>
 
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "mbcommon/common.h"
 #include "mbcommon/finally.h"
@@ -103,24 +106,65 @@ static PropertyIterAction read_property_cb(const prop_info *pi,
     return ctx.result;
 }
 
+/*!
+ * \brief Cached property lookup
+ *
+ * \p pi is nullptr if the property did not exist when it was looked up. In that
+ * case, \p serial is the property area serial at the time of the lookup.
+ * Otherwise, it is the serial of the property value in \p value.
+ */
+struct CachedProperty
+{
+    const prop_info *pi;
+    uint32_t serial;
+    std::string value;
+};
+
+// Each thread has its own cache, so lookups never need a lock. Reads of the
+// property area itself are lock-free via the per-property serials.
+static thread_local std::unordered_map<std::string, CachedProperty>
+        property_cache;
+
 std::optional<std::string> property_get(const std::string &key)
 {
     initialize_properties();
 
-    const prop_info *pi = __system_property_find(key.c_str());
-    if (!pi) {
-        return std::nullopt;
+    auto it = property_cache.find(key);
+    if (it != property_cache.end()) {
+        auto const &entry = it->second;
+
+        if (entry.pi) {
+            if (__system_property_serial(entry.pi) == entry.serial) {
+                return entry.value;
+            }
+        } else if (__system_property_area_serial() == entry.serial) {
+            return std::nullopt;
+        }
+    } else {
+        it = property_cache.emplace(key, CachedProperty{}).first;
     }
 
-    std::string result;
+    auto &entry = it->second;
 
-    read_property_cb(pi, [&](std::string_view key_, std::string_view value) {
-        (void) key_;
-        result = value;
-        return PropertyIterAction::Stop;
-    });
+    if (!entry.pi) {
+        // Read the area serial first so that a property added after the
+        // lookup invalidates the entry
+        entry.serial = __system_property_area_serial();
+        entry.pi = __system_property_find(key.c_str());
+        if (!entry.pi) {
+            return std::nullopt;
+        }
+    }
 
-    return std::move(result);
+    __system_property_read_callback(
+            entry.pi, [](void *cookie, const char *, const char *value,
+                         uint32_t serial) {
+        auto *entry_ = static_cast<CachedProperty *>(cookie);
+        entry_->serial = serial;
+        entry_->value = value;
+    }, &entry);
+
+    return entry.value;
 }
 
 std::string property_get_string(const std::string &key,
@@ -151,6 +195,43 @@ bool property_set(const std::string &key, const std::string &value)
     return __system_property_set(key.c_str(), value.c_str()) == 0;
 }
 
+/*!
+ * \brief Set multiple properties with a single property service request
+ *
+ * \param props List of key/value pairs
+ *
+ * \return Whether each property was set, in the same order as \p props
+ */
+std::vector<bool> property_set_many(
+        const std::vector<std::pair<std::string, std::string>> &props)
+{
+    initialize_properties();
+
+    std::vector<const char *> keys;
+    std::vector<const char *> values;
+    std::vector<int> results(props.size());
+
+    keys.reserve(props.size());
+    values.reserve(props.size());
+
+    for (auto const &[key, value] : props) {
+        keys.push_back(key.c_str());
+        values.push_back(value.c_str());
+    }
+
+    (void) __system_property_set_many(keys.data(), values.data(), props.size(),
+                                      results.data());
+
+    std::vector<bool> ret;
+    ret.reserve(results.size());
+
+    for (int result : results) {
+        ret.push_back(result == PROP_SUCCESS);
+    }
+
+    return ret;
+}
+
 bool property_set_direct(const std::string &key, const std::string &value)
 {
     initialize_properties();
@@ -252,92 +333,173 @@ static std::string_view trim_whitespace(std::string_view sv)
     return sv;
 }
 
-static bool property_file_iter_impl(const std::string &path,
-                                    std::string_view filter,
-                                    const std::function<PropertyIterCb> &cb,
-                                    DevInodeSet &seen_files)
+/*!
+ * \brief Map a file into memory
+ *
+ * Empty files are not mapped and result in a null \p map with a \p size of 0.
+ * errno is preserved on failure.
+ */
+static bool map_file(const std::string &path, void *&map, size_t &size,
+                     struct stat &sb)
 {
-    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
-    if (!fp) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return false;
     }
 
-    struct stat sb;
-    if (fstat(fileno(fp.get()), &sb) < 0) {
+    auto close_fd = finally([&] {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+    });
+
+    if (fstat(fd, &sb) < 0) {
         return false;
     }
 
-    // Ignore duplicate imports
-    DevInode di{sb.st_dev, sb.st_ino};
-    if (seen_files.find(di) != seen_files.end()) {
+    size = static_cast<size_t>(sb.st_size);
+
+    if (size == 0) {
+        map = nullptr;
         return true;
     }
 
-    seen_files.emplace(di);
+    map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        map = nullptr;
+        return false;
+    }
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read;
+    madvise(map, size, MADV_SEQUENTIAL);
 
-    auto free_line = finally([&] {
-        free(line);
-    });
+    return true;
+}
 
-    while ((read = getline(&line, &len, fp.get())) >= 0) {
-        std::string_view sv(line, static_cast<size_t>(read));
+/*!
+ * \brief Call \p fn for every non-empty, non-comment line in \p data
+ *
+ * Lines are trimmed of surrounding whitespace. Iteration stops early if \p fn
+ * returns false.
+ *
+ * \return Whether iteration ran to completion
+ */
+template<typename Fn>
+static bool for_each_line(std::string_view data, Fn &&fn)
+{
+    while (!data.empty()) {
+        auto newline = data.find('\n');
+        auto line = trim_whitespace(data.substr(0, newline));
 
-        sv = trim_whitespace(sv);
+        data.remove_prefix(newline == std::string_view::npos
+                ? data.size() : newline + 1);
 
         // Skip empty and comment lines
-        if (sv.empty() || sv.front() == '#') {
+        if (line.empty() || line.front() == '#') {
             continue;
         }
 
-        if (starts_with(sv, "import ")) {
-            sv.remove_prefix(7);
-            sv = trim_whitespace(sv);
+        if (!fn(line)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool split_property(std::string_view line, std::string_view &key,
+                           std::string_view &value)
+{
+    auto equals = line.find('=');
+    if (equals == std::string_view::npos) {
+        return false;
+    }
+
+    key = trim_whitespace(line.substr(0, equals));
+    value = trim_whitespace(line.substr(equals + 1));
+    return true;
+}
+
+static bool matches_filter(std::string_view key, std::string_view filter)
+{
+    if (filter.empty()) {
+        return true;
+    } else if (filter.back() == '*') {
+        return starts_with(key, filter.substr(0, filter.size() - 1));
+    } else {
+        return key == filter;
+    }
+}
+
+static bool property_file_iter_impl(const std::string &path,
+                                    std::string_view filter,
+                                    const std::function<PropertyIterCb> &cb,
+                                    DevInodeSet &seen_files, bool &stopped)
+{
+    void *map;
+    size_t size;
+    struct stat sb;
+
+    if (!map_file(path, map, size, sb)) {
+        return false;
+    }
+
+    auto unmap_map = finally([&] {
+        if (map) {
+            munmap(map, size);
+        }
+    });
+
+    // Ignore duplicate imports
+    DevInode di{sb.st_dev, sb.st_ino};
+    if (seen_files.find(di) != seen_files.end()) {
+        return true;
+    }
+
+    seen_files.emplace(di);
+
+    bool ret = true;
+
+    for_each_line({static_cast<const char *>(map), size},
+                  [&](std::string_view line) {
+        if (starts_with(line, "import ")) {
+            line.remove_prefix(7);
+            line = trim_whitespace(line);
 
             std::string_view new_filter;
 
-            if (auto space = sv.find(' '); space != std::string_view::npos) {
-                new_filter = trim_whitespace(sv.substr(space + 1));
-                sv = sv.substr(0, space);
+            if (auto space = line.find(' '); space != std::string_view::npos) {
+                new_filter = trim_whitespace(line.substr(space + 1));
+                line = line.substr(0, space);
             }
 
-            if (!property_file_iter_impl(std::string(sv), new_filter, cb,
-                                         seen_files) && errno != ENOENT) {
+            if (!property_file_iter_impl(std::string(line), new_filter, cb,
+                                         seen_files, stopped)
+                    && errno != ENOENT) {
                 // Missing files are OK
                 // (follows the AOSP implementation behavior)
+                ret = false;
                 return false;
             }
-        } else {
-            auto equals = sv.find('=');
-            if (equals == std::string_view::npos) {
-                continue;
-            }
 
-            auto key = trim_whitespace(sv.substr(0, equals));
-            auto value = trim_whitespace(sv.substr(equals + 1));
-
-            if (!filter.empty()) {
-                if (filter.back() == '*') {
-                    if (!starts_with(key, filter.substr(0, filter.size() - 1))) {
-                        continue;
-                    }
-                } else {
-                    if (key != filter) {
-                        continue;
-                    }
-                }
-            }
+            return !stopped;
+        }
 
-            if (cb(key, value) == PropertyIterAction::Stop) {
-                return true;
-            }
+        std::string_view key;
+        std::string_view value;
+
+        if (!split_property(line, key, value) || !matches_filter(key, filter)) {
+            return true;
         }
-    }
 
-    return !ferror(fp.get());
+        if (cb(key, value) == PropertyIterAction::Stop) {
+            stopped = true;
+            return false;
+        }
+
+        return true;
+    });
+
+    return ret;
 }
 
 std::optional<std::string> property_file_get(const std::string &path,
@@ -384,7 +546,54 @@ bool property_file_iter(const std::string &path, std::string_view filter,
                         const std::function<PropertyIterCb> &fn)
 {
     DevInodeSet seen_files;
-    return property_file_iter_impl(path, filter, fn, seen_files);
+    bool stopped = false;
+    return property_file_iter_impl(path, filter, fn, seen_files, stopped);
+}
+
+/*!
+ * \brief Get several properties from a properties file
+ *
+ * The file is only read until every key has been found, so `import`
+ * directives are only followed if some keys are still unresolved when they
+ * are reached. If a property is defined multiple times, the first definition
+ * is used.
+ *
+ * \param path Path to properties file
+ * \param keys Property keys
+ * \param values Output for the value of each key in \p keys. A value is
+ *               `std::nullopt` if the key was not found.
+ * \param n Number of keys
+ *
+ * \return Number of keys that were found
+ */
+size_t property_file_get_many(const std::string &path,
+                              const std::string_view *keys,
+                              std::optional<std::string> *values, size_t n)
+{
+    size_t found = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        values[i].reset();
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    property_file_iter(
+            path, {}, [&](std::string_view key, std::string_view value) {
+        for (size_t i = 0; i < n; ++i) {
+            if (!values[i] && keys[i] == key) {
+                values[i] = value;
+                ++found;
+            }
+        }
+        return found == n
+                ? PropertyIterAction::Stop
+                : PropertyIterAction::Continue;
+    });
+
+    return found;
 }
 
 std::optional<PropertiesMap> property_file_get_all(const std::string &path)
@@ -402,10 +611,231 @@ std::optional<PropertiesMap> property_file_get_all(const std::string &path)
     }
 }
 
+PropertyFileView::PropertyFileView()
+    : _map(nullptr)
+    , _size(0)
+    , _is_open(false)
+    , _indexed(false)
+{
+}
+
+PropertyFileView::~PropertyFileView()
+{
+    close();
+}
+
+/*!
+ * \brief Map a properties file into memory
+ *
+ * \param path Path to properties file
+ *
+ * \return Whether the file was successfully mapped. errno is set on failure.
+ */
+bool PropertyFileView::open(const std::string &path)
+{
+    close();
+
+    struct stat sb;
+    if (!map_file(path, _map, _size, sb)) {
+        return false;
+    }
+
+    _is_open = true;
+    return true;
+}
+
+void PropertyFileView::close()
+{
+    if (_map) {
+        munmap(_map, _size);
+    }
+
+    _map = nullptr;
+    _size = 0;
+    _is_open = false;
+    _index.clear();
+    _indexed = false;
+}
+
+bool PropertyFileView::is_open() const
+{
+    return _is_open;
+}
+
+std::string_view PropertyFileView::data() const
+{
+    return {static_cast<const char *>(_map), _size};
+}
+
+/*!
+ * \brief Iterate through properties in the file
+ *
+ * \param filter Filter in the same format as property_file_iter()
+ * \param fn Callback for each property. The key and value are views into the
+ *           mapping.
+ *
+ * \return Whether the file is open
+ */
+bool PropertyFileView::iter(std::string_view filter,
+                            const std::function<PropertyIterCb> &fn) const
+{
+    if (!_is_open) {
+        return false;
+    }
+
+    for_each_line(data(), [&](std::string_view line) {
+        std::string_view key;
+        std::string_view value;
+
+        if (!split_property(line, key, value) || !matches_filter(key, filter)) {
+            return true;
+        }
+
+        return fn(key, value) == PropertyIterAction::Continue;
+    });
+
+    return true;
+}
+
+/*!
+ * \brief Look up a single property
+ *
+ * If the property is defined multiple times, the first definition is returned.
+ */
+std::optional<std::string_view> PropertyFileView::get(std::string_view key) const
+{
+    PropertyLookup item{key, std::nullopt};
+    lookup(&item, 1);
+    return item.value;
+}
+
+/*!
+ * \brief Look up several properties at once
+ *
+ * Without an index, the file is scanned only until every key has been found.
+ * If a property is defined multiple times, the first definition is used.
+ *
+ * \param items Keys to look up. PropertyLookup::value is set for every key
+ *              that is found and reset for every key that is not.
+ * \param n Number of items
+ *
+ * \return Number of keys that were found
+ */
+size_t PropertyFileView::lookup(PropertyLookup *items, size_t n) const
+{
+    size_t found = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        items[i].value.reset();
+    }
+
+    if (!_is_open || n == 0) {
+        return 0;
+    }
+
+    if (_indexed) {
+        for (size_t i = 0; i < n; ++i) {
+            auto it = std::lower_bound(
+                    _index.begin(), _index.end(), items[i].key,
+                    [](auto const &entry, std::string_view key) {
+                return entry.first < key;
+            });
+            if (it != _index.end() && it->first == items[i].key) {
+                items[i].value = it->second;
+                ++found;
+            }
+        }
+
+        return found;
+    }
+
+    for_each_line(data(), [&](std::string_view line) {
+        std::string_view key;
+        std::string_view value;
+
+        if (!split_property(line, key, value)) {
+            return true;
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            if (!items[i].value && items[i].key == key) {
+                items[i].value = value;
+                ++found;
+            }
+        }
+
+        return found != n;
+    });
+
+    return found;
+}
+
+/*!
+ * \brief Build a sorted array of the properties for faster lookups
+ *
+ * This is worthwhile when many lookups are done on the same file. Subsequent
+ * calls to get() and lookup() use binary search instead of scanning the file.
+ */
+void PropertyFileView::build_index()
+{
+    if (!_is_open || _indexed) {
+        return;
+    }
+
+    _index.clear();
+
+    for_each_line(data(), [&](std::string_view line) {
+        std::string_view key;
+        std::string_view value;
+
+        if (split_property(line, key, value)) {
+            _index.emplace_back(key, value);
+        }
+
+        return true;
+    });
+
+    // Stable sort so that the first definition of a key comes first
+    std::stable_sort(_index.begin(), _index.end(),
+                     [](auto const &a, auto const &b) {
+        return a.first < b.first;
+    });
+
+    _indexed = true;
+}
+
+/*!
+ * \brief Write properties to a file
+ *
+ * The properties are written to a temporary file that is then renamed over
+ * \p path. Readers, which memory map the file, never observe a partially
+ * written or truncated file.
+ */
 bool property_file_write_all(const std::string &path, const PropertiesMap &map)
 {
-    ScopedFILE fp(fopen(path.c_str(), "wbe"), fclose);
+    std::string temp_path(path);
+    temp_path += ".XXXXXX";
+
+    int fd = mkostemp(temp_path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    ScopedFILE fp(fdopen(fd, "wb"), fclose);
     if (!fp) {
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    // Keep the permissions of the existing file
+    struct stat sb;
+    if (fchmod(fd, stat(path.c_str(), &sb) == 0
+            ? sb.st_mode & 07777 : 0644) < 0) {
         return false;
     }
 
@@ -418,6 +848,15 @@ bool property_file_write_all(const std::string &path, const PropertiesMap &map)
         }
     }
 
+    if (fclose(fp.release()) != 0) {
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        return false;
+    }
+
+    remove_temp.dismiss();
     return true;
 }
 
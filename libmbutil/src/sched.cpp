@@ -0,0 +1,245 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mbutil/sched.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include <cerrno>
+
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+
+#include "mbutil/file.h"
+
+#define CPU_DIR                         "/sys/devices/system/cpu"
+
+#define IOPRIO_CLASS_SHIFT              13
+#define IOPRIO_CLASS_NONE               0
+#define IOPRIO_CLASS_IDLE               3
+#define IOPRIO_WHO_PROCESS              1
+
+namespace mb::util
+{
+
+// Nice value of background threads
+static constexpr int BACKGROUND_NICE = 10;
+
+/*!
+ * \brief Parse scheduling policy name
+ *
+ * \param str "default", "performance", or "background"
+ *
+ * \return Policy or std::nullopt if \p str is not a valid policy name
+ */
+std::optional<SchedPolicy> sched_policy_from_string(std::string_view str)
+{
+    if (str == "default") {
+        return SchedPolicy::Default;
+    } else if (str == "performance") {
+        return SchedPolicy::Performance;
+    } else if (str == "background") {
+        return SchedPolicy::Background;
+    } else {
+        return std::nullopt;
+    }
+}
+
+static oc::result<std::vector<int>> find_performance_cpus()
+{
+    DIR *dir = opendir(CPU_DIR);
+    if (!dir) {
+        return ec_from_errno();
+    }
+
+    auto close_dir = finally([&] {
+        closedir(dir);
+    });
+
+    std::vector<std::pair<int, uint64_t>> cpus;
+
+    while (struct dirent *ent = readdir(dir)) {
+        int cpu;
+        uint64_t max_freq;
+
+        if (!starts_with(ent->d_name, "cpu")
+                || !str_to_num(ent->d_name + 3, 10, cpu)) {
+            continue;
+        }
+
+        // Offline CPUs and CPUs without cpufreq support are skipped
+        auto line = file_first_line(format(
+                CPU_DIR "/%s/cpufreq/cpuinfo_max_freq", ent->d_name));
+        if (!line || !str_to_num(line.value().c_str(), 10, max_freq)) {
+            continue;
+        }
+
+        cpus.emplace_back(cpu, max_freq);
+    }
+
+    if (cpus.empty()) {
+        return std::vector<int>();
+    }
+
+    auto min_freq = std::min_element(cpus.begin(), cpus.end(),
+                                     [](auto const &a, auto const &b) {
+        return a.second < b.second;
+    })->second;
+
+    // Everything except the slowest cluster. On devices with a single cluster,
+    // there is no preference.
+    std::vector<int> result;
+    for (auto const &[cpu, max_freq] : cpus) {
+        if (max_freq > min_freq) {
+            result.push_back(cpu);
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+
+    return result;
+}
+
+/*!
+ * \brief Get the CPUs that CPU-bound work should prefer
+ *
+ * These are the CPUs that do not belong to the cluster with the lowest maximum
+ * frequency in a big.LITTLE (or similar) configuration. The CPUs are detected
+ * from `/sys/devices/system/cpu/cpu*<!-- -->/cpufreq/cpuinfo_max_freq` the
+ * first time this function is called.
+ *
+ * \return List of CPU numbers, which is empty if all CPUs are equally fast.
+ *         Otherwise, the error.
+ */
+oc::result<std::vector<int>> performance_cpus()
+{
+    static std::once_flag once;
+    static oc::result<std::vector<int>> result = std::vector<int>();
+
+    std::call_once(once, [] {
+        result = find_performance_cpus();
+    });
+
+    return result;
+}
+
+static oc::result<void> set_affinity(SchedPolicy policy)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+
+    if (policy == SchedPolicy::Performance) {
+        OUTCOME_TRY(cpus, performance_cpus());
+
+        for (int cpu : cpus) {
+            CPU_SET(static_cast<size_t>(cpu), &set);
+        }
+    }
+
+    if (CPU_COUNT(&set) == 0) {
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+
+        for (long cpu = 0; cpu < std::clamp<long>(count, 1, CPU_SETSIZE);
+                ++cpu) {
+            CPU_SET(static_cast<size_t>(cpu), &set);
+        }
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Apply scheduling policy to the calling thread
+ *
+ * This sets the CPU affinity, nice value, and I/O priority of the calling
+ * thread. Threads created afterwards by the calling thread inherit them.
+ *
+ * \note Returning from the background policy to one of the other policies
+ *       requires CAP_SYS_NICE. If setting one of the parameters fails, the
+ *       others are still set.
+ *
+ * \param policy Scheduling policy
+ *
+ * \return Nothing if all scheduling parameters were set. Otherwise, the first
+ *         error.
+ */
+oc::result<void> set_thread_sched_policy(SchedPolicy policy)
+{
+    bool background = policy == SchedPolicy::Background;
+    pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    std::error_code ec;
+
+    if (auto r = set_affinity(policy); !r) {
+        ec = r.error();
+    }
+
+    if (setpriority(PRIO_PROCESS, static_cast<id_t>(tid),
+                    background ? BACKGROUND_NICE : 0) < 0 && !ec) {
+        ec = ec_from_errno();
+    }
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid,
+                (background ? IOPRIO_CLASS_IDLE : IOPRIO_CLASS_NONE)
+                        << IOPRIO_CLASS_SHIFT) < 0 && !ec) {
+        ec = ec_from_errno();
+    }
+
+    if (ec) {
+        return ec;
+    }
+
+    return oc::success();
+}
+
+/*!
+ * \brief Apply scheduling policy to the calling thread and the global executor
+ *
+ * The policy is applied to the calling thread with set_thread_sched_policy()
+ * and to each of the global Executor's threads before they run their next
+ * task.
+ *
+ * \param policy Scheduling policy
+ *
+ * \return Nothing if all scheduling parameters were set for the calling
+ *         thread. Otherwise, the first error.
+ */
+oc::result<void> set_sched_policy(SchedPolicy policy)
+{
+    Executor::global().set_thread_setup([policy] {
+        (void) set_thread_sched_policy(policy);
+    });
+
+    return set_thread_sched_policy(policy);
+}
+
+}
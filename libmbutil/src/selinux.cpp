@@ -19,12 +19,17 @@
 
 #include "mbutil/selinux.h"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <thread>
+#include <vector>
 
 #include <cerrno>
 #include <cstring>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -35,10 +40,10 @@
 #include <sepol/sepol.h>
 
 #include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
-#include "mbutil/fts.h"
 
 #define LOG_TAG "mbutil/selinux"
 
@@ -50,57 +55,231 @@ static constexpr int OPEN_ATTEMPTS = 5;
 namespace mb::util
 {
 
-class RecursiveSetContext : public FtsWrapper
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+struct RelabelEntry
+{
+    std::string name;
+    bool is_dir;
+};
+
+/*!
+ * \brief Context shared by the workers of a recursive relabel
+ */
+struct RelabelCtx
+{
+    const std::string &context;
+    bool follow_symlinks;
+    // Whether paths relative to a directory fd can be resolved through
+    // /proc/self/fd instead of from the root
+    bool have_proc_fd;
+    std::atomic_bool failed{false};
+};
+
+static bool has_context(ssize_t n, const char *buf, const std::string &context)
+{
+    // The stored value may or may not include the NULL terminator
+    auto size = static_cast<size_t>(n);
+    return n >= 0 && (size == context.size() || size == context.size() + 1)
+            && memcmp(buf, context.data(), context.size()) == 0
+            && (size == context.size() || buf[context.size()] == '\0');
+}
+
+/*!
+ * \brief Set the context of a non-directory entry relative to a directory fd
+ *
+ * The xattr syscalls have no *at() variants, so the entry is addressed
+ * through the directory's /proc/self/fd magic link when possible. This avoids
+ * resolving the full path from the root for every file.
+ */
+static oc::result<void> relabel_file(RelabelCtx &ctx, int dfd,
+                                     const std::string &dir_path,
+                                     const std::string &name)
+{
+    std::string path;
+    if (ctx.have_proc_fd) {
+        path = format("/proc/self/fd/%d/%s", dfd, name.c_str());
+    } else {
+        path = dir_path + "/" + name;
+    }
+
+    auto get = ctx.follow_symlinks ? getxattr : lgetxattr;
+    auto set = ctx.follow_symlinks ? setxattr : lsetxattr;
+
+    char buf[256];
+    if (has_context(get(path.c_str(), SELINUX_XATTR, buf, sizeof(buf)), buf,
+                    ctx.context)) {
+        return oc::success();
+    }
+
+    if (set(path.c_str(), SELINUX_XATTR, ctx.context.c_str(),
+            ctx.context.size() + 1, 0) < 0) {
+        return ec_from_errno();
+    }
+
+    return oc::success();
+}
+
+static oc::result<std::vector<RelabelEntry>> list_relabel_entries(int dfd)
 {
-public:
-    RecursiveSetContext(std::string path, std::string context,
-                        bool follow_symlinks)
-        : FtsWrapper(path, FtsFlag::GroupSpecialFiles)
-        , _context(std::move(context))
-        , _follow_symlinks(follow_symlinks)
-        , _result(oc::success())
-    {
+    int fd = dup(dfd);
+    if (fd < 0) {
+        return ec_from_errno();
+    }
+
+    ScopedDIR dp(fdopendir(fd), closedir);
+    if (!dp) {
+        auto ec = ec_from_errno();
+        close(fd);
+        return ec;
+    }
+
+    std::vector<RelabelEntry> entries;
+
+    errno = 0;
+    while (struct dirent *ent = readdir(dp.get())) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        bool is_dir = ent->d_type == DT_DIR;
+
+        if (ent->d_type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(dfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                return ec_from_errno();
+            }
+            is_dir = S_ISDIR(sb.st_mode);
+        }
+
+        entries.push_back({ent->d_name, is_dir});
     }
 
-    Actions on_reached_directory_post() override
-    {
-        return set_context() ? Action::Ok : Action::Fail;
+    if (errno != 0) {
+        return ec_from_errno();
     }
 
-    Actions on_reached_file() override
-    {
-        return set_context() ? Action::Ok : Action::Fail;
+    return entries;
+}
+
+static oc::result<void> relabel_dir(RelabelCtx &ctx, int dfd,
+                                    const std::string &path,
+                                    bool parallel = false);
+
+static oc::result<void> relabel_entry(RelabelCtx &ctx, int dfd,
+                                      const std::string &path,
+                                      const RelabelEntry &entry)
+{
+    if (!entry.is_dir) {
+        return relabel_file(ctx, dfd, path, entry.name);
     }
 
-    Actions on_reached_symlink() override
-    {
-        return set_context() ? Action::Ok : Action::Fail;
+    int fd = openat(dfd, entry.name.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return ec_from_errno();
     }
 
-    Actions on_reached_special_file() override
-    {
-        return set_context() ? Action::Ok : Action::Fail;
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    return relabel_dir(ctx, fd, path + "/" + entry.name);
+}
+
+/*!
+ * \brief Relabel the contents of a directory and then the directory itself
+ *
+ * If \p parallel is true, the entries of this directory are distributed among
+ * a pool of threads. Subdirectories are always processed by the thread that
+ * picked them up.
+ */
+static oc::result<void> relabel_dir(RelabelCtx &ctx, int dfd,
+                                    const std::string &path, bool parallel)
+{
+    OUTCOME_TRY(entries, list_relabel_entries(dfd));
+
+    unsigned int threads = 1;
+    if (parallel) {
+        auto dirs = std::count_if(entries.begin(), entries.end(),
+                                  [](const RelabelEntry &e) {
+            return e.is_dir;
+        });
+
+        threads = std::clamp(Executor::global().concurrency(), 1u,
+                             std::max(static_cast<unsigned int>(dirs), 1u));
+    }
+
+    if (threads > 1) {
+        // Start with the directories so that the large subtrees are picked up
+        // first and the remaining files fill in the gaps
+        std::stable_partition(entries.begin(), entries.end(),
+                              [](const RelabelEntry &e) {
+            return e.is_dir;
+        });
+    }
+
+    // Once a subtree fails, the remaining entries are skipped. Only the
+    // subtree that failed reports an error so that it is the one returned.
+    OUTCOME_TRYV(try_parallel_for(entries.size(),
+                                  [&](size_t i) -> oc::result<void> {
+        if (ctx.failed) {
+            return oc::success();
+        }
+
+        auto r = relabel_entry(ctx, dfd, path, entries[i]);
+        if (!r && !(ctx.failed
+                && r.error() == std::errc::operation_canceled)) {
+            ctx.failed = true;
+            return r;
+        }
+        return oc::success();
+    }, threads));
+
+    if (ctx.failed) {
+        return std::errc::operation_canceled;
     }
 
-    oc::result<void> result()
-    {
-        return _result;
+    char buf[256];
+    if (!has_context(fgetxattr(dfd, SELINUX_XATTR, buf, sizeof(buf)), buf,
+                     ctx.context)) {
+        OUTCOME_TRYV(selinux_fset_context(dfd, ctx.context));
     }
 
-private:
-    std::string _context;
-    bool _follow_symlinks;
-    oc::result<void> _result;
+    return oc::success();
+}
 
-    oc::result<void> set_context()
-    {
-        if (_follow_symlinks) {
-            return _result = selinux_set_context(_curr->fts_accpath, _context);
-        } else {
-            return _result = selinux_lset_context(_curr->fts_accpath, _context);
+/*!
+ * \brief Recursively set the SELinux context of a path
+ *
+ * Directories are traversed relative to their file descriptors and entries
+ * that already have the target context are not modified. The top-level
+ * subtrees are relabeled in parallel.
+ */
+static oc::result<void> set_context_recursive(const std::string &path,
+                                              const std::string &context,
+                                              bool follow_symlinks)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOTDIR || errno == ELOOP) {
+            // Not a directory
+            return follow_symlinks
+                    ? selinux_set_context(path, context)
+                    : selinux_lset_context(path, context);
         }
+        return ec_from_errno();
     }
-};
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    RelabelCtx ctx{context, follow_symlinks,
+                   access("/proc/self/fd", X_OK) == 0};
+
+    return relabel_dir(ctx, fd, path, true);
+}
 
 bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 {
@@ -163,12 +342,9 @@ bool selinux_read_policy(const std::string &path, policydb_t *pdb)
 // See: http://marc.info/?l=selinux&m=141882521027239&w=2
 bool selinux_write_policy(const std::string &path, policydb_t *pdb)
 {
-    using namespace std::chrono_literals;
-
     void *data;
     size_t len;
     sepol_handle_t *handle;
-    int fd;
 
     // Don't print warnings to stderr
     handle = sepol_handle_create();
@@ -187,6 +363,22 @@ bool selinux_write_policy(const std::string &path, policydb_t *pdb)
         free(data);
     });
 
+    return selinux_write_policy_data(path, data, len);
+}
+
+/*!
+ * \brief Write binary policy data to a file
+ *
+ * The data is written with a single write() call so that \p path can be the
+ * selinuxfs load file.
+ */
+bool selinux_write_policy_data(const std::string &path, const void *data,
+                               size_t len)
+{
+    using namespace std::chrono_literals;
+
+    int fd;
+
     for (int i = 0; i < OPEN_ATTEMPTS; ++i) {
         fd = open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
         if (fd < 0) {
@@ -319,35 +511,15 @@ oc::result<void> selinux_fset_context(int fd, const std::string &context)
 }
 
 oc::result<void> selinux_set_context_recursive(const std::string &path,
-                                   const std::string &context)
+                                               const std::string &context)
 {
-    RecursiveSetContext rsc(path, context, true);
-    if (!rsc.run()) {
-        auto ret = rsc.result();
-        if (ret) {
-            return ec_from_errno();
-        } else {
-            return ret.as_failure();
-        }
-    }
-
-    return rsc.result();
+    return set_context_recursive(path, context, true);
 }
 
 oc::result<void> selinux_lset_context_recursive(const std::string &path,
                                                 const std::string &context)
 {
-    RecursiveSetContext rsc(path, context, false);
-    if (!rsc.run()) {
-        auto ret = rsc.result();
-        if (ret) {
-            return ec_from_errno();
-        } else {
-            return ret.as_failure();
-        }
-    }
-
-    return rsc.result();
+    return set_context_recursive(path, context, false);
 }
 
 oc::result<bool> selinux_get_enforcing()
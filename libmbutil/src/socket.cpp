@@ -19,14 +19,21 @@
 
 #include "mbutil/socket.h"
 
+#include <algorithm>
+
 #include <cerrno>
 #include <climits>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <linux/errqueue.h>
+
 #include "mbcommon/error_code.h"
 
 namespace mb::util
@@ -89,6 +96,42 @@ oc::result<size_t> socket_write(int fd, const void *buf, size_t size)
     return bytes_written;
 }
 
+/*!
+ * \brief Write all data described by an iovec array
+ *
+ * \note The contents of \p iov are modified to account for partial writes
+ */
+static oc::result<void> write_vectored(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        auto n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else {
+                return ec_from_errno();
+            }
+        } else if (n == 0) {
+            return std::errc::io_error;
+        }
+
+        auto remain = static_cast<size_t>(n);
+
+        while (iovcnt > 0 && remain >= iov->iov_len) {
+            remain -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + remain;
+            iov->iov_len -= remain;
+        }
+    }
+
+    return oc::success();
+}
+
 oc::result<std::vector<unsigned char>> socket_read_bytes(int fd)
 {
     OUTCOME_TRY(len, socket_read_int32(fd));
@@ -112,13 +155,15 @@ oc::result<void> socket_write_bytes(int fd, const void *data, size_t len)
         return std::errc::invalid_argument;
     }
 
-    OUTCOME_TRYV(socket_write_int32(fd, static_cast<int32_t>(len)));
-    OUTCOME_TRY(n, socket_write(fd, data, len));
-    if (n != len) {
-        return std::errc::io_error;
-    }
+    auto prefix = static_cast<int32_t>(len);
 
-    return oc::success();
+    struct iovec iov[2];
+    iov[0].iov_base = &prefix;
+    iov[0].iov_len = sizeof(prefix);
+    iov[1].iov_base = const_cast<void *>(data);
+    iov[1].iov_len = len;
+
+    return write_vectored(fd, iov, 2);
 }
 
 template<typename T>
@@ -293,8 +338,16 @@ oc::result<void> socket_receive_fds(int fd, std::vector<int> &fds)
     cmsg->cmsg_level = SOL_SOCKET;
     cmsg->cmsg_type = SCM_RIGHTS;
 
-    if (recvmsg(fd, &msg, 0) < 0) {
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
         return ec_from_errno();
+    } else if (n == 0 || msg.msg_controllen < sizeof(struct cmsghdr)) {
+        // Peer disconnected or no ancillary data was sent
+        return std::errc::bad_message;
     }
 
     int *data = reinterpret_cast<int *>(CMSG_DATA(cmsg));
@@ -352,4 +405,227 @@ oc::result<void> socket_send_fds(int fd, const std::vector<int> &fds)
     return oc::success();
 }
 
+FramedSocket::FramedSocket(int fd)
+    : _fd(fd)
+    , _zero_copy(false)
+    , _begin(0)
+    , _end(0)
+{
+}
+
+int FramedSocket::fd() const
+{
+    return _fd;
+}
+
+size_t FramedSocket::buffered() const
+{
+    return _end - _begin;
+}
+
+/*!
+ * \brief Send large payloads with MSG_ZEROCOPY
+ *
+ * This only has an effect on TCP (and UDP) sockets on Linux 4.14 or newer. For
+ * other socket types, including the Unix domain sockets used by the daemon,
+ * the kernel rejects SO_ZEROCOPY and an error is returned. send() continues to
+ * work normally in that case.
+ */
+oc::result<void> FramedSocket::enable_zero_copy()
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int one = 1;
+
+    if (setsockopt(_fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        return ec_from_errno();
+    }
+
+    _zero_copy = true;
+    return oc::success();
+#else
+    return std::errc::operation_not_supported;
+#endif
+}
+
+/*!
+ * \brief Receive the next frame
+ *
+ * \return The payload of the frame. It points into the internal buffer and is
+ *         only valid until the next call to receive().
+ */
+oc::result<FramedSocket::Frame> FramedSocket::receive()
+{
+    // The length prefix is stored at this offset so that the payload is
+    // suitably aligned for in-place parsing (eg. by flatbuffers' verifier)
+    constexpr size_t header_offset =
+            alignof(std::max_align_t) - sizeof(int32_t);
+    constexpr size_t min_size = 4096;
+
+    while (true) {
+        size_t avail = _end - _begin;
+        size_t needed = sizeof(int32_t);
+        bool complete = false;
+
+        if (avail >= sizeof(int32_t)) {
+            int32_t len;
+            memcpy(&len, _buf.data() + _begin, sizeof(len));
+            if (len < 0) {
+                return std::errc::bad_message;
+            }
+
+            needed += static_cast<size_t>(len);
+            complete = avail >= needed;
+        }
+
+        // Move the partial frame to the front so the rest can be read right
+        // after it. A complete frame that was read ahead with the previous
+        // one is only moved if its payload is misaligned.
+        if (_begin != header_offset && (!complete
+                || (_begin + sizeof(int32_t)) % alignof(std::max_align_t))) {
+            if (_buf.size() < header_offset + avail) {
+                _buf.resize(header_offset + avail);
+            }
+            memmove(_buf.data() + header_offset, _buf.data() + _begin, avail);
+            _begin = header_offset;
+            _end = header_offset + avail;
+        }
+
+        if (complete) {
+            Frame frame{_buf.data() + _begin + sizeof(int32_t),
+                        needed - sizeof(int32_t)};
+            _begin += needed;
+            return frame;
+        }
+
+        size_t size = std::max(header_offset + needed, min_size);
+        if (_buf.size() < size) {
+            _buf.resize(size);
+        }
+
+        ssize_t n;
+        do {
+            n = read(_fd, _buf.data() + _end, _buf.size() - _end);
+        } while (n < 0 && errno == EINTR);
+
+        if (n < 0) {
+            return ec_from_errno();
+        } else if (n == 0) {
+            return std::errc::io_error;
+        }
+
+        _end += static_cast<size_t>(n);
+    }
+}
+
+oc::result<void> FramedSocket::send(const void *data, size_t size)
+{
+    if (size > INT32_MAX) {
+        return std::errc::invalid_argument;
+    }
+
+    if (_zero_copy && size >= ZERO_COPY_THRESHOLD) {
+        return send_zero_copy(data, size);
+    }
+
+    auto prefix = static_cast<int32_t>(size);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &prefix;
+    iov[0].iov_len = sizeof(prefix);
+    iov[1].iov_base = const_cast<void *>(data);
+    iov[1].iov_len = size;
+
+    return write_vectored(_fd, iov, 2);
+}
+
+/*!
+ * \brief Send payload without copying it into the kernel
+ *
+ * The kernel keeps referencing the payload's pages until the transfer
+ * completes, so this waits for the completion notification on the socket's
+ * error queue before returning. Only the payload is sent this way; the length
+ * prefix is small enough that copying it is cheaper.
+ */
+oc::result<void> FramedSocket::send_zero_copy(const void *data, size_t size)
+{
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    auto prefix = static_cast<int32_t>(size);
+
+    OUTCOME_TRY(n, socket_write(_fd, &prefix, sizeof(prefix)));
+    if (n != sizeof(prefix)) {
+        return std::errc::io_error;
+    }
+
+    size_t sent = 0;
+    uint32_t calls = 0;
+
+    while (sent < size) {
+        auto ret = ::send(_fd, static_cast<const char *>(data) + sent,
+                          size - sent, MSG_ZEROCOPY);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == ENOBUFS && calls == 0) {
+                // Not enough locked memory; fall back to a regular copy
+                OUTCOME_TRY(n, socket_write(_fd, data, size));
+                if (n != size) {
+                    return std::errc::io_error;
+                }
+                return oc::success();
+            } else {
+                return ec_from_errno();
+            }
+        }
+
+        sent += static_cast<size_t>(ret);
+        ++calls;
+    }
+
+    // Each successful send() is assigned a sequential ID starting from 0 and
+    // notifications report inclusive, possibly coalesced, ranges of IDs
+    uint32_t completed = 0;
+
+    while (completed < calls) {
+        struct pollfd pfd = {};
+        pfd.fd = _fd;
+
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ec_from_errno();
+        }
+
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err))];
+
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(_fd, &msg, MSG_ERRQUEUE) < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            return ec_from_errno();
+        }
+
+        for (auto *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+                cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            auto *serr = reinterpret_cast<struct sock_extended_err *>(
+                    CMSG_DATA(cmsg));
+            if (serr->ee_origin == SO_EE_ORIGIN_ZEROCOPY
+                    && serr->ee_errno == 0) {
+                completed = std::max(completed, serr->ee_data + 1);
+            }
+        }
+    }
+
+    return oc::success();
+#else
+    (void) data;
+    (void) size;
+    return std::errc::operation_not_supported;
+#endif
+}
+
 }
@@ -17,23 +17,48 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <cerrno>
 #include <cstdarg>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <archive.h>
 #include <archive_entry.h>
 
 #include <jni.h>
 
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
 #include "mbcommon/common.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file/standard.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/string.h"
 
 #include "mbbootimg/entry.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/probe_cache.h"
 #include "mbbootimg/reader.h"
 
 #include "mblog/android_logger.h"
@@ -52,6 +77,9 @@ using namespace mb::bootimg;
 
 typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
 
+// ROM listing probes the same boot images over and over
+static ProbeCache g_probe_cache;
+
 extern "C" {
 
 MB_PRINTF(3, 4)
@@ -83,15 +111,266 @@ static bool throw_exception(JNIEnv *env, const char *class_name,
     return env->ThrowNew(clazz, buf) == 0;
 }
 
-JNIEXPORT void JNICALL
+// Block size for reading archives
+#define ARCHIVE_BLOCK_SIZE              (1024 * 1024)
+
+// Maximum number of threads used for extracting zip archives
+#define EXTRACT_MAX_THREADS             4u
+
+// Interval between progress updates and cancellation checks
+#define EXTRACT_PROGRESS_INTERVAL       std::chrono::milliseconds(100)
+
+#define EXTRACT_FLAGS \
+    (ARCHIVE_EXTRACT_ACL \
+            | ARCHIVE_EXTRACT_FFLAGS \
+            | ARCHIVE_EXTRACT_PERM \
+            | ARCHIVE_EXTRACT_SECURE_NODOTDOT \
+            | ARCHIVE_EXTRACT_SECURE_SYMLINKS \
+            | ARCHIVE_EXTRACT_TIME \
+            | ARCHIVE_EXTRACT_UNLINK \
+            | ARCHIVE_EXTRACT_XATTR)
+
+struct ExtractState
+{
+    const char *filename;
+    const char *target;
+    // Absolute path to the archive, since the workers open it after changing
+    // to the target directory
+    std::string path;
+    // Whether the entries can be extracted in parallel. Each thread opens the
+    // zip file itself and claims the next unclaimed entry once it's done with
+    // the previous one. Entries that are not claimed are skipped using the
+    // central directory without being decompressed.
+    bool seekable_zip;
+
+    // For zip files, the uncompressed size of the entries. Otherwise, the
+    // number of bytes read from the (compressed) archive.
+    std::atomic<uint64_t> bytes;
+    uint64_t max_bytes;
+
+    std::atomic_size_t next_entry;
+    std::atomic_bool cancelled;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t running;
+    // First error that occurred
+    std::string error;
+};
+
+MB_PRINTF(2, 3)
+static void set_extract_error(ExtractState &state, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    auto error = format_v(fmt, ap);
+    va_end(ap);
+
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (state.error.empty()) {
+            state.error = std::move(error);
+        }
+    }
+
+    // Stop the other threads
+    state.cancelled = true;
+}
+
+static bool is_zip_file(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    char magic[4];
+
+    return read(fd, magic, sizeof(magic)) == sizeof(magic)
+            && memcmp(magic, "PK\x03\x04", sizeof(magic)) == 0;
+}
+
+static bool open_extract_input(ExtractState &state, ScopedArchive &in)
+{
+    in.reset(archive_read_new());
+    if (!in) {
+        set_extract_error(state, "Failed to allocate archive");
+        return false;
+    }
+
+    if (state.seekable_zip) {
+        archive_read_support_format_zip_seekable(in.get());
+    } else {
+        // Add more as needed
+        //archive_read_support_format_all(in.get());
+        //archive_read_support_filter_all(in.get());
+        archive_read_support_format_tar(in.get());
+        archive_read_support_format_zip(in.get());
+        archive_read_support_filter_xz(in.get());
+    }
+
+    if (archive_read_open_filename(in.get(), state.path.c_str(),
+                                   ARCHIVE_BLOCK_SIZE) != ARCHIVE_OK) {
+        set_extract_error(state, "%s: Failed to open archive: %s",
+                          state.filename, archive_error_string(in.get()));
+        return false;
+    }
+
+    return true;
+}
+
+// Sum up the sizes of the entries in a zip file and return the number of
+// entries
+static std::optional<size_t> scan_zip_entries(ExtractState &state)
+{
+    ScopedArchive in(nullptr, &archive_read_free);
+    if (!open_extract_input(state, in)) {
+        return std::nullopt;
+    }
+
+    archive_entry *entry;
+    int laret;
+    size_t count = 0;
+
+    state.max_bytes = 0;
+
+    while ((laret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
+        if (archive_entry_size_is_set(entry)) {
+            state.max_bytes += static_cast<uint64_t>(archive_entry_size(entry));
+        }
+        ++count;
+    }
+
+    if (laret != ARCHIVE_EOF) {
+        set_extract_error(state, "%s: Failed to read entry header: %s",
+                          state.filename, archive_error_string(in.get()));
+        return std::nullopt;
+    }
+
+    return count;
+}
+
+static void extract_entries(ExtractState &state)
+{
+    ScopedArchive in(nullptr, &archive_read_free);
+    if (!open_extract_input(state, in)) {
+        return;
+    }
+
+    ScopedArchive out(archive_write_disk_new(), &archive_write_free);
+    if (!out) {
+        set_extract_error(state, "Failed to allocate archive");
+        return;
+    }
+
+    archive_write_disk_set_options(out.get(), EXTRACT_FLAGS);
+
+    archive_entry *entry;
+    int laret;
+    size_t index = 0;
+    size_t claimed = state.seekable_zip ? state.next_entry++ : 0;
+
+    for (; (laret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK;
+            ++index) {
+        if (state.cancelled) {
+            return;
+        }
+
+        if (state.seekable_zip) {
+            if (index != claimed) {
+                continue;
+            }
+            claimed = state.next_entry++;
+        }
+
+        if ((laret = archive_write_header(out.get(), entry)) != ARCHIVE_OK) {
+            set_extract_error(state, "%s: Failed to write header: %s",
+                              state.target, archive_error_string(out.get()));
+            return;
+        }
+
+        const void *buff;
+        size_t size;
+        int64_t offset;
+
+        while ((laret = archive_read_data_block(
+                in.get(), &buff, &size, &offset)) == ARCHIVE_OK) {
+            if (archive_write_data_block(out.get(), buff, size, offset)
+                    != ARCHIVE_OK) {
+                set_extract_error(state, "%s: Failed to write data: %s",
+                                  state.target,
+                                  archive_error_string(out.get()));
+                return;
+            }
+
+            if (state.seekable_zip) {
+                state.bytes += size;
+            } else {
+                state.bytes = static_cast<uint64_t>(
+                        archive_filter_bytes(in.get(), -1));
+            }
+
+            if (state.cancelled) {
+                return;
+            }
+        }
+
+        if (laret != ARCHIVE_EOF) {
+            set_extract_error(state,
+                              "%s: Data copy ended without reaching EOF: %s",
+                              state.filename, archive_error_string(in.get()));
+            return;
+        }
+    }
+
+    if (laret != ARCHIVE_EOF) {
+        set_extract_error(state,
+                          "%s: Archive extraction ended without reaching EOF: %s",
+                          state.filename, archive_error_string(in.get()));
+        return;
+    }
+
+    // Apply the deferred directory permissions and timestamps
+    if (archive_write_close(out.get()) != ARCHIVE_OK) {
+        set_extract_error(state, "%s: Failed to finish extraction: %s",
+                          state.target, archive_error_string(out.get()));
+        return;
+    }
+}
+
+JNIEXPORT jboolean JNICALL
 CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
-                            jstring jtarget)
+                             jstring jtarget, jobject jlistener)
 {
     (void) clazz;
 
+    jmethodID progress_method = nullptr;
+    jmethodID cancelled_method = nullptr;
+
+    if (jlistener) {
+        jclass listener_class = env->GetObjectClass(jlistener);
+
+        progress_method = env->GetMethodID(
+                listener_class, "onProgressUpdated", "(JJ)V");
+        if (!progress_method) {
+            // Java will throw NoSuchMethodError after returning
+            return false;
+        }
+
+        cancelled_method = env->GetMethodID(
+                listener_class, "isCancelled", "()Z");
+        if (!cancelled_method) {
+            return false;
+        }
+    }
+
     const char *filename = env->GetStringUTFChars(jfilename, nullptr);
     if (!filename) {
-        return;
+        return false;
     }
 
     auto free_filename = finally([&] {
@@ -102,7 +381,7 @@ CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
 
     const char *target = env->GetStringUTFChars(jtarget, nullptr);
     if (!target) {
-        return;
+        return false;
     }
 
     auto free_target = finally([&] {
@@ -111,100 +390,128 @@ CLASS_METHOD(extractArchive)(JNIEnv *env, jclass clazz, jstring jfilename,
         }
     });
 
-    ScopedArchive in(archive_read_new(), &archive_read_free);
-    if (!in) {
-        throw_exception(env, OutOfMemoryError, "Failed to allocate archive");
-        return;
-    }
-
-    // Add more as needed
-    //archive_read_support_format_all(in.get());
-    //archive_read_support_filter_all(in.get());
-    archive_read_support_format_tar(in.get());
-    archive_read_support_format_zip(in.get());
-    archive_read_support_filter_xz(in.get());
-
-    if (archive_read_open_filename(in.get(), filename, 10240) != ARCHIVE_OK) {
+    char *path = realpath(filename, nullptr);
+    if (!path) {
         throw_exception(env, IOException,
                         "%s: Failed to open archive: %s",
-                        filename, archive_error_string(in.get()));
-        return;
+                        filename, strerror(errno));
+        return false;
     }
 
-    ScopedArchive out(archive_write_disk_new(), &archive_write_free);
-    if (!out) {
-        throw_exception(env, OutOfMemoryError, "Failed to allocate archive");
-        return;
-    }
+    ExtractState state;
+    state.filename = filename;
+    state.target = target;
+    state.path = path;
+    free(path);
+    state.seekable_zip = is_zip_file(filename);
+    state.bytes = 0;
+    state.max_bytes = 0;
+    state.next_entry = 0;
+    state.cancelled = false;
+    state.running = 0;
+
+    size_t threads = 1;
+
+    if (state.seekable_zip) {
+        auto count = scan_zip_entries(state);
+        if (!count) {
+            throw_exception(env, IOException, "%s", state.error.c_str());
+            return false;
+        }
 
-    archive_write_disk_set_options(out.get(),
-                                   ARCHIVE_EXTRACT_ACL |
-                                   ARCHIVE_EXTRACT_FFLAGS |
-                                   ARCHIVE_EXTRACT_PERM |
-                                   ARCHIVE_EXTRACT_SECURE_NODOTDOT |
-                                   ARCHIVE_EXTRACT_SECURE_SYMLINKS |
-                                   ARCHIVE_EXTRACT_TIME |
-                                   ARCHIVE_EXTRACT_UNLINK |
-                                   ARCHIVE_EXTRACT_XATTR);
+        threads = std::clamp<size_t>(
+                std::min(mb::Executor::global().concurrency(),
+                         EXTRACT_MAX_THREADS), 1, std::max<size_t>(*count, 1));
+    } else {
+        struct stat sb;
+        if (stat(filename, &sb) == 0) {
+            state.max_bytes = static_cast<uint64_t>(sb.st_size);
+        }
+    }
 
-    const char *cwd = getcwd(nullptr, 0);
+    char *cwd = getcwd(nullptr, 0);
     if (!cwd) {
         throw_exception(env, IOException,
                         "Failed to get cwd: %s", strerror(errno));
-        return;
+        return false;
     }
 
+    auto free_cwd = finally([&] {
+        free(cwd);
+    });
+
     if (chdir(target) < 0) {
         throw_exception(env, IOException,
                         "%s: Failed to change to target directory: %s",
                         target, strerror(errno));
-        return;
+        return false;
     }
 
     auto restore_cwd = finally([&] {
         chdir(cwd);
     });
 
-    archive_entry *entry;
-    int laret;
+    // Extract on the executor's worker threads so that this thread can report
+    // progress and poll for cancellation. Java methods can only be called from
+    // this thread.
+    mb::TaskGroup workers;
+    state.running = threads;
 
-    while ((laret = archive_read_next_header(in.get(), &entry)) == ARCHIVE_OK) {
-        if ((laret = archive_write_header(out.get(), entry)) != ARCHIVE_OK) {
-            throw_exception(env, IOException,
-                            "%s: Failed to write header: %s",
-                            target, archive_error_string(out.get()));
-            return;
-        }
+    for (size_t i = 0; i < threads; ++i) {
+        workers.run([&state] {
+            extract_entries(state);
 
-        const void *buff;
-        size_t size;
-        int64_t offset;
+            std::lock_guard<std::mutex> lock(state.mutex);
+            --state.running;
+            state.cv.notify_all();
+        });
+    }
 
-        while ((laret = archive_read_data_block(
-                in.get(), &buff, &size, &offset)) == ARCHIVE_OK) {
-            if (archive_write_data_block(out.get(), buff, size, offset)
-                    != ARCHIVE_OK) {
-                throw_exception(env, IOException,
-                                "%s: Failed to write data: %s",
-                                target, archive_error_string(out.get()));
-                return;
+    bool user_cancelled = false;
+
+    {
+        std::unique_lock<std::mutex> lock(state.mutex);
+
+        while (state.running > 0) {
+            state.cv.wait_for(lock, EXTRACT_PROGRESS_INTERVAL);
+
+            if (!jlistener || user_cancelled) {
+                continue;
             }
-        }
 
-        if (laret != ARCHIVE_EOF) {
-            throw_exception(env, IOException,
-                            "%s: Data copy ended without reaching EOF: %s",
-                            filename, archive_error_string(in.get()));
-            return;
+            lock.unlock();
+
+            env->CallVoidMethod(jlistener, progress_method,
+                                static_cast<jlong>(state.bytes.load()),
+                                static_cast<jlong>(state.max_bytes));
+            if (env->ExceptionCheck()
+                    || env->CallBooleanMethod(jlistener, cancelled_method)
+                    || env->ExceptionCheck()) {
+                user_cancelled = true;
+                state.cancelled = true;
+            }
+
+            lock.lock();
         }
     }
 
-    if (laret != ARCHIVE_EOF) {
-        throw_exception(env, IOException,
-                        "%s: Archive extraction ended without reaching EOF: %s",
-                        filename, archive_error_string(in.get()));
-        return;
+    workers.wait();
+
+    if (user_cancelled) {
+        // Any pending Java exception is thrown after returning
+        return false;
+    } else if (!state.error.empty()) {
+        throw_exception(env, IOException, "%s", state.error.c_str());
+        return false;
     }
+
+    if (jlistener) {
+        env->CallVoidMethod(jlistener, progress_method,
+                            static_cast<jlong>(state.max_bytes),
+                            static_cast<jlong>(state.max_bytes));
+    }
+
+    return true;
 }
 
 JNIEXPORT void JNICALL
@@ -216,10 +523,185 @@ CLASS_METHOD(mblogSetLogcat)(JNIEnv *env, jclass clazz)
     mb::log::set_logger(std::make_shared<mb::log::AndroidLogger>());
 }
 
+// Size of the views used for comparing and hashing entry data
+#define ENTRY_VIEW_SIZE                 (1024 * 1024)
+
+// Size of the views passed to libarchive when reading the ramdisk. The ROM ID
+// is normally within the first few KiB of the ramdisk.
+#define RAMDISK_VIEW_SIZE               (64 * 1024)
+
+// Maximum number of boot images whose entry digests are remembered
+#define DIGEST_CACHE_MAX_ENTRIES        64
+
+// Maximum number of boot images whose ROM IDs are remembered
+#define ROM_ID_CACHE_MAX_ENTRIES        64
+
+struct ImageIdentity
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+
+    bool operator==(const ImageIdentity &other) const
+    {
+        return dev == other.dev
+                && ino == other.ino
+                && size == other.size
+                && mtime_ns == other.mtime_ns
+                && ctime_ns == other.ctime_ns;
+    }
+};
+
+using EntryDigest = std::array<unsigned char, SHA512_DIGEST_LENGTH>;
+// SHA512 digest of each entry's data, sorted by entry type
+using EntryDigests = std::vector<std::pair<int, EntryDigest>>;
+
+// The ROM list compares every ROM's saved boot image against the same copy of
+// the boot partition, so the digests of both sides are usually already known
+static std::mutex g_digest_cache_mutex;
+static std::deque<std::pair<ImageIdentity, EntryDigests>> g_digest_cache;
+
+struct RomIdCacheEntry
+{
+    std::string path;
+    ImageIdentity id;
+    // Empty if the boot image has no ROM ID
+    std::optional<std::string> rom_id;
+};
+
+// The app looks up the ROM ID of every listed boot image each time the list
+// is shown
+static std::mutex g_rom_id_cache_mutex;
+static std::deque<RomIdCacheEntry> g_rom_id_cache;
+
+static oc::result<std::unique_ptr<File>> open_image(const char *filename)
+{
+    // Prefer a mapping so that the entry data can be viewed without copying
+    auto mmap_file = std::make_unique<MmapFile>();
+    if (mmap_file->open(filename)) {
+        return mmap_file;
+    }
+
+    auto std_file = std::make_unique<StandardFile>();
+    OUTCOME_TRYV(std_file->open(filename, FileOpenMode::ReadOnly));
+
+    return std_file;
+}
+
+static int64_t timespec_to_ns(const struct timespec &ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Get the identity of the file if data about it can be cached. Only regular
+// files qualify because writing to a block device does not update its
+// timestamps. Files changed less than a second ago do not qualify either,
+// since the timestamp granularity may hide a write that follows this call.
+static std::optional<ImageIdentity> identity_from_stat(const struct stat &sb)
+{
+    if (!S_ISREG(sb.st_mode)) {
+        return std::nullopt;
+    }
+
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) < 0
+            || timespec_to_ns(now) - timespec_to_ns(sb.st_ctim) < 1000000000) {
+        return std::nullopt;
+    }
+
+    return ImageIdentity{
+        static_cast<uint64_t>(sb.st_dev),
+        static_cast<uint64_t>(sb.st_ino),
+        static_cast<uint64_t>(sb.st_size),
+        timespec_to_ns(sb.st_mtim),
+        timespec_to_ns(sb.st_ctim),
+    };
+}
+
+static std::optional<ImageIdentity> get_image_identity(File &file)
+{
+    auto fd = file.native_fd();
+    if (!fd) {
+        return std::nullopt;
+    }
+
+    struct stat sb;
+    if (fstat(fd.value(), &sb) < 0) {
+        return std::nullopt;
+    }
+
+    return identity_from_stat(sb);
+}
+
+static std::optional<EntryDigests> lookup_digests(const ImageIdentity &id)
+{
+    std::lock_guard<std::mutex> lock(g_digest_cache_mutex);
+
+    for (auto const &item : g_digest_cache) {
+        if (item.first == id) {
+            return item.second;
+        }
+    }
+
+    return std::nullopt;
+}
+
+static void insert_digests(const ImageIdentity &id, EntryDigests digests)
+{
+    std::lock_guard<std::mutex> lock(g_digest_cache_mutex);
+
+    for (auto it = g_digest_cache.begin(); it != g_digest_cache.end(); ++it) {
+        if (it->first.dev == id.dev && it->first.ino == id.ino) {
+            g_digest_cache.erase(it);
+            break;
+        }
+    }
+
+    if (g_digest_cache.size() >= DIGEST_CACHE_MAX_ENTRIES) {
+        g_digest_cache.pop_front();
+    }
+
+    g_digest_cache.emplace_back(id, std::move(digests));
+}
+
+static std::optional<std::optional<std::string>>
+lookup_rom_id(const std::string &path, const ImageIdentity &id)
+{
+    std::lock_guard<std::mutex> lock(g_rom_id_cache_mutex);
+
+    for (auto const &item : g_rom_id_cache) {
+        if (item.path == path && item.id == id) {
+            return item.rom_id;
+        }
+    }
+
+    return std::nullopt;
+}
+
+static void insert_rom_id(const std::string &path, const ImageIdentity &id,
+                          std::optional<std::string> rom_id)
+{
+    std::lock_guard<std::mutex> lock(g_rom_id_cache_mutex);
+
+    for (auto it = g_rom_id_cache.begin(); it != g_rom_id_cache.end(); ++it) {
+        if (it->path == path) {
+            g_rom_id_cache.erase(it);
+            break;
+        }
+    }
+
+    if (g_rom_id_cache.size() >= ROM_ID_CACHE_MAX_ENTRIES) {
+        g_rom_id_cache.pop_front();
+    }
+
+    g_rom_id_cache.push_back({path, id, std::move(rom_id)});
+}
+
 struct LaBootImgCtx
 {
     Reader reader;
-    char buf[10240];
 };
 
 static la_ssize_t laBootImgReadCb(archive *a, void *userdata,
@@ -228,13 +710,14 @@ static la_ssize_t laBootImgReadCb(archive *a, void *userdata,
     (void) a;
     LaBootImgCtx *ctx = static_cast<LaBootImgCtx *>(userdata);
 
-    auto bytesRead = ctx->reader.read_data(ctx->buf, sizeof(ctx->buf));
-    if (!bytesRead) {
+    // The view stays valid until the next call, as libarchive requires
+    auto view = ctx->reader.entry_view(RAMDISK_VIEW_SIZE);
+    if (!view) {
         return -1;
     }
 
-    *buffer = ctx->buf;
-    return static_cast<la_ssize_t>(bytesRead.value());
+    *buffer = view.value().data;
+    return static_cast<la_ssize_t>(view.value().size);
 }
 
 JNIEXPORT jstring JNICALL
@@ -257,7 +740,32 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         }
     });
 
+    // Return the cached ROM ID if the boot image did not change
+    std::optional<ImageIdentity> id;
+    {
+        struct stat sb;
+        if (stat(filename, &sb) == 0) {
+            id = identity_from_stat(sb);
+        }
+    }
+    if (id) {
+        if (auto rom_id = lookup_rom_id(filename, *id)) {
+            return *rom_id ? env->NewStringUTF((*rom_id)->c_str()) : nullptr;
+        }
+    }
+
     // Open input boot image
+    auto file = open_image(filename);
+    if (!file) {
+        throw_exception(env, IOException,
+                        "%s: Failed to open boot image for reading: %s",
+                        filename, file.error().message().c_str());
+        return nullptr;
+    }
+
+    // Use the identity of the file that is actually read
+    id = get_image_identity(*file.value());
+
     auto ret = reader.enable_format_all();
     if (!ret) {
         throw_exception(env, IOException,
@@ -265,7 +773,8 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
                         ret.error().message().c_str());
         return nullptr;
     }
-    ret = reader.open_filename(filename);
+    reader.set_probe_cache(&g_probe_cache);
+    ret = reader.open(std::move(file.value()));
     if (!ret) {
         throw_exception(env, IOException,
                         "%s: Failed to open boot image for reading: %s",
@@ -312,7 +821,9 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
     archive_read_support_filter_xz(a.get());
     archive_read_support_format_cpio(a.get());
 
-    // Open ramdisk archive
+    // Open ramdisk archive. The ROM ID is read as soon as its entry is found,
+    // so only the beginning of the ramdisk is decompressed when mbtool wrote
+    // it as the first entry.
     ctx.reader = std::move(reader);
     int laret = archive_read_open(a.get(), &ctx, nullptr, &laBootImgReadCb,
                                   nullptr);
@@ -356,6 +867,10 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
                 return nullptr;
             }
 
+            if (id) {
+                insert_rom_id(filename, *id, std::string(buf));
+            }
+
             return env->NewStringUTF(buf);
         }
     }
@@ -367,9 +882,82 @@ CLASS_METHOD(getBootImageRomId)(JNIEnv *env, jclass clazz, jstring jfilename)
         return nullptr;
     }
 
+    if (id) {
+        insert_rom_id(filename, *id, std::nullopt);
+    }
+
     return nullptr;
 }
 
+// Hash every remaining entry in the reader
+static bool compute_digests(JNIEnv *env, Reader &reader, const char *filename,
+                            EntryDigests &digests)
+{
+    std::unique_ptr<EVP_MD_CTX, decltype(EVP_MD_CTX_free) *> ctx(
+            EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    if (!ctx) {
+        throw_exception(env, OutOfMemoryError,
+                        "Failed to allocate digest context");
+        return false;
+    }
+
+    Entry entry;
+
+    digests.clear();
+
+    while (true) {
+        auto ret = reader.read_entry(entry);
+        if (!ret) {
+            if (ret.error() == ReaderError::EndOfEntries) {
+                break;
+            }
+            throw_exception(env, IOException,
+                            "%s: Failed to read entry: %s",
+                            filename, ret.error().message().c_str());
+            return false;
+        }
+
+        if (!EVP_DigestInit_ex(ctx.get(), EVP_sha512(), nullptr)) {
+            throw_exception(env, IOException,
+                            "%s: Failed to initialize digest", filename);
+            return false;
+        }
+
+        while (true) {
+            auto view = reader.entry_view(ENTRY_VIEW_SIZE);
+            if (!view) {
+                throw_exception(env, IOException,
+                                "%s: Failed to read data: %s", filename,
+                                view.error().message().c_str());
+                return false;
+            } else if (view.value().size == 0) {
+                break;
+            }
+
+            if (!EVP_DigestUpdate(ctx.get(), view.value().data,
+                                  view.value().size)) {
+                throw_exception(env, IOException,
+                                "%s: Failed to update digest", filename);
+                return false;
+            }
+        }
+
+        EntryDigest digest;
+
+        if (!EVP_DigestFinal_ex(ctx.get(), digest.data(), nullptr)) {
+            throw_exception(env, IOException,
+                            "%s: Failed to finalize digest", filename);
+            return false;
+        }
+
+        digests.emplace_back(*entry.type(), digest);
+    }
+
+    std::sort(digests.begin(), digests.end());
+
+    return true;
+}
+
 JNIEXPORT jboolean JNICALL
 CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
                               jstring jfilename2)
@@ -406,6 +994,25 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
         }
     });
 
+    // Open files
+    auto file1 = open_image(filename1);
+    if (!file1) {
+        throw_exception(env, IOException,
+                        "%s: Failed to open boot image for reading: %s",
+                        filename1, file1.error().message().c_str());
+        return false;
+    }
+    auto file2 = open_image(filename2);
+    if (!file2) {
+        throw_exception(env, IOException,
+                        "%s: Failed to open boot image for reading: %s",
+                        filename2, file2.error().message().c_str());
+        return false;
+    }
+
+    auto id1 = get_image_identity(*file1.value());
+    auto id2 = get_image_identity(*file2.value());
+
     // Set up reader formats
     auto ret = reader1.enable_format_all();
     if (!ret) {
@@ -422,15 +1029,18 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
         return false;
     }
 
+    reader1.set_probe_cache(&g_probe_cache);
+    reader2.set_probe_cache(&g_probe_cache);
+
     // Open boot images
-    ret = reader1.open_filename(filename1);
+    ret = reader1.open(file1.value().get());
     if (!ret) {
         throw_exception(env, IOException,
                         "%s: Failed to open boot image for reading: %s",
                         filename1, ret.error().message().c_str());
         return false;
     }
-    ret = reader2.open_filename(filename2);
+    ret = reader2.open(file2.value().get());
     if (!ret) {
         throw_exception(env, IOException,
                         "%s: Failed to open boot image for reading: %s",
@@ -459,6 +1069,30 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
         return false;
     }
 
+    // If both files can be identified, compare the digests of their entries.
+    // Each image only has to be hashed the first time it's seen.
+    if (id1 && id2) {
+        auto digests1 = lookup_digests(*id1);
+        if (!digests1) {
+            digests1.emplace();
+            if (!compute_digests(env, reader1, filename1, *digests1)) {
+                return false;
+            }
+            insert_digests(*id1, *digests1);
+        }
+
+        auto digests2 = lookup_digests(*id2);
+        if (!digests2) {
+            digests2.emplace();
+            if (!compute_digests(env, reader2, filename2, *digests2)) {
+                return false;
+            }
+            insert_digests(*id2, *digests2);
+        }
+
+        return *digests1 == *digests2;
+    }
+
     // Count entries in first boot image
     {
         while (true) {
@@ -509,34 +1143,55 @@ CLASS_METHOD(bootImagesEqual)(JNIEnv *env, jclass clazz, jstring jfilename1,
                 return false;
             }
 
-            // Compare data
-            char buf1[10240];
-            char buf2[10240];
+            // Compare data. The views from each image can have different
+            // sizes, so compare the overlapping parts.
+            FileView view1{};
+            FileView view2{};
 
             while (true) {
-                auto n1 = reader1.read_data(buf1, sizeof(buf1));
-                if (!n1) {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to read data: %s", filename1,
-                                    n1.error().message().c_str());
-                    return false;
-                } else if (n1.value() == 0) {
-                    break;
+                if (view1.size == 0) {
+                    auto view = reader1.entry_view(ENTRY_VIEW_SIZE);
+                    if (!view) {
+                        throw_exception(env, IOException,
+                                        "%s: Failed to read data: %s",
+                                        filename1,
+                                        view.error().message().c_str());
+                        return false;
+                    }
+                    view1 = view.value();
                 }
 
-                auto n2 = reader2.read_data(buf2, n1.value());
-                if (!n2) {
-                    throw_exception(env, IOException,
-                                    "%s: Failed to read data: %s", filename2,
-                                    n2.error().message().c_str());
-                    return false;
+                if (view2.size == 0) {
+                    auto view = reader2.entry_view(ENTRY_VIEW_SIZE);
+                    if (!view) {
+                        throw_exception(env, IOException,
+                                        "%s: Failed to read data: %s",
+                                        filename2,
+                                        view.error().message().c_str());
+                        return false;
+                    }
+                    view2 = view.value();
                 }
 
-                if (n1.value() != n2.value()
-                        || memcmp(buf1, buf2, n1.value()) != 0) {
+                if (view1.size == 0 || view2.size == 0) {
+                    if (view1.size != view2.size) {
+                        // Data has different sizes
+                        return false;
+                    }
+                    break;
+                }
+
+                size_t n = std::min(view1.size, view2.size);
+
+                if (memcmp(view1.data, view2.data, n) != 0) {
                     // Data is not equivalent
                     return false;
                 }
+
+                view1.data = static_cast<const unsigned char *>(view1.data) + n;
+                view1.size -= n;
+                view2.data = static_cast<const unsigned char *>(view2.data) + n;
+                view2.size -= n;
             }
         }
     }
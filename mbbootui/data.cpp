@@ -65,6 +65,7 @@ pthread_mutex_t DataManager::m_valuesLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
 #else
 pthread_mutex_t DataManager::m_valuesLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 #endif
+std::atomic_uint DataManager::mVersion(0);
 
 int DataManager::ResetDefaults()
 {
@@ -72,6 +73,7 @@ int DataManager::ResetDefaults()
     mPersist.Clear();
     mData.Clear();
     mConst.Clear();
+    ++mVersion;
     pthread_mutex_unlock(&m_valuesLock);
 
     SetDefaultValues();
@@ -94,6 +96,7 @@ int DataManager::LoadValues(const std::string& filename)
     // Read in the file, if possible
     pthread_mutex_lock(&m_valuesLock);
     mPersist.LoadValues();
+    ++mVersion;
 
     if (!(tw_device.tw_flags() & mb::device::TwFlag::NoScreenTimeout)) {
         blankTimer.setTime(mPersist.GetIntValue(VAR_TW_SCREEN_TIMEOUT_SECS));
@@ -263,6 +266,7 @@ int DataManager::SetValue(const std::string& varName, const std::string& value,
             mData.SetValue(varName, value);
         }
     }
+    ++mVersion;
 
     pthread_mutex_unlock(&m_valuesLock);
 
@@ -487,9 +491,24 @@ void DataManager::SetDefaultValues()
     // Set default autoboot timeout to 5 seconds
     mPersist.SetValue(VAR_TW_AUTOBOOT_TIMEOUT, 5);
 
+    ++mVersion;
     pthread_mutex_unlock(&m_valuesLock);
 }
 
+unsigned int DataManager::GetVersion()
+{
+    return mVersion.load();
+}
+
+bool DataManager::IsDynamicValue(const std::string& varName)
+{
+    // These are computed by GetMagicValue() or read from the system
+    return varName == VAR_TW_TIME
+            || varName == VAR_TW_CPU_TEMP
+            || varName == VAR_TW_BATTERY
+            || (varName.length() > 9 && varName.compare(0, 9, "property.") == 0);
+}
+
 // Magic Values
 int DataManager::GetMagicValue(const std::string& varName, std::string& value)
 {
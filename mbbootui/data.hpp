@@ -19,6 +19,7 @@
 #ifndef _DATAMANAGER_HPP_HEADER
 #define _DATAMANAGER_HPP_HEADER
 
+#include <atomic>
 #include <string>
 #include <pthread.h>
 #include "infomanager.hpp"
@@ -48,6 +49,11 @@ public:
     static int SetProgress(const float Fraction);
     static int ShowProgress(const float Portion, const float Seconds);
 
+    // Returns a counter that changes whenever any value is set or loaded
+    static unsigned int GetVersion();
+    // Whether the value can change without being set (eg. the time)
+    static bool IsDynamicValue(const std::string& varName);
+
     static void DumpValues();
     static void update_tz_environment_variables();
     static void Vibrate(const std::string& varName);
@@ -70,6 +76,7 @@ protected:
 
 private:
     static pthread_mutex_t m_valuesLock;
+    static std::atomic_uint mVersion;
 };
 
 #endif // _DATAMANAGER_HPP_HEADER
@@ -111,3 +111,12 @@ int GUIAnimation::Update()
     }
     return 0;
 }
+
+bool GUIAnimation::GetDamage(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return true;
+}
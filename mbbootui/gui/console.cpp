@@ -307,6 +307,15 @@ int GUIConsole::Update()
     return 0;
 }
 
+bool GUIConsole::GetDamage(int& x, int& y, int& w, int& h)
+{
+    if (mSlideout) {
+        // Showing or hiding the console changes the area that is drawn
+        return false;
+    }
+    return GUIScrollList::GetDamage(x, y, w, h);
+}
+
 // IsInRegion - Checks if the request is handled by this object
 //  Return 1 if this object handles the request, 0 if not
 int GUIConsole::IsInRegion(int x, int y)
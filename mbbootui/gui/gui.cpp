@@ -18,10 +18,17 @@
 
 #include "gui/gui.h"
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 
+#include <cerrno>
+#include <cstring>
+
 #include <linux/input.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 #include "mblog/logging.h"
@@ -57,6 +64,14 @@ using namespace std::chrono;
 // Global values
 static int gGuiInitialized = 0;
 static std::atomic_int gForceRender;
+// Written to wake up the main loop when a render is requested
+static int gWakeupFd = -1;
+// Armed with the time at which the main loop needs to run next
+static int gTimerFd = -1;
+// Time between frames while something is animating. This is a whole number
+// of display refreshes close to 1/30th of a second, since the GUI objects
+// count on getting about 30 updates per second.
+static long gFrameIntervalNs = 33333333;
 blanktimer blankTimer;
 static float scale_theme_w = 1;
 static float scale_theme_h = 1;
@@ -71,7 +86,7 @@ static int gRecorder = -1;
 
 void gr_write_frame_to_file(int fd);
 
-void flip()
+void flip(const DamageRegion* damage = nullptr)
 {
     if (gRecorder != -1) {
         timespec time;
@@ -79,7 +94,11 @@ void flip()
         write(gRecorder, &time, sizeof(timespec));
         gr_write_frame_to_file(gRecorder);
     }
-    gr_flip();
+    if (damage && !damage->full) {
+        gr_flip_region(damage->x, damage->y, damage->w, damage->h);
+    } else {
+        gr_flip();
+    }
 }
 
 void rapidxml::parse_error_handler(const char *what, void *where)
@@ -118,6 +137,10 @@ public:
     // process input events. returns true if any event was received.
     bool processInput(int timeout_ms);
 
+    // get the time at which the next touch/key hold or repeat is due.
+    // returns false if no touch or key is being held.
+    bool getHoldDeadline(steady_clock::time_point& deadline) const;
+
     void handleDrag();
 
 private:
@@ -228,6 +251,30 @@ void InputHandler::processHoldAndRepeat()
     }
 }
 
+bool InputHandler::getHoldDeadline(steady_clock::time_point& deadline) const
+{
+    int delay_ms;
+
+    if (touch_status == TS_TOUCH_AND_HOLD) {
+        delay_ms = touch_hold_ms;
+    } else if (touch_status == TS_TOUCH_REPEAT) {
+        delay_ms = touch_repeat_ms;
+    } else if (key_status == KS_KEY_PRESSED) {
+        delay_ms = key_hold_ms;
+    } else if (key_status == KS_KEY_REPEAT) {
+        delay_ms = key_repeat_ms;
+    } else {
+        return false;
+    }
+
+    // touchStart comes from CLOCK_MONOTONIC, which is what steady_clock uses.
+    // processHoldAndRepeat() only fires once the delay has been exceeded, so
+    // wake up a millisecond late.
+    deadline = steady_clock::time_point(seconds(touchStart.tv_sec)
+            + nanoseconds(touchStart.tv_nsec) + milliseconds(delay_ms + 1));
+    return true;
+}
+
 void InputHandler::doTouchStart()
 {
     LOGEVENT("TOUCH_START: %d,%d", x, y);
@@ -363,11 +410,102 @@ void InputHandler::handleDrag()
     }
 }
 
+static void wakeMainLoop()
+{
+    if (gWakeupFd >= 0) {
+        uint64_t value = 1;
+        (void) write(gWakeupFd, &value, sizeof(value));
+    }
+}
+
+// Sleep until an input device or the terminal pty is readable, a render is
+// requested, or the deadline passes. Returns true if a render was requested.
+static bool waitForEvents(steady_clock::time_point deadline)
+{
+    static constexpr unsigned MAX_INPUT_FDS = 32;
+
+    struct pollfd fds[MAX_INPUT_FDS + 4];
+    unsigned n = ev_get_fds(fds, MAX_INPUT_FDS);
+    int wakeup_index = -1;
+    int timer_index = -1;
+    int display_index = -1;
+    int timeout_ms = -1;
+    int display_fd = gr_fb_event_fd();
+
+    if (g_pty_fd > 0) {
+        fds[n].fd = g_pty_fd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        ++n;
+    }
+    if (gWakeupFd >= 0) {
+        wakeup_index = static_cast<int>(n);
+        fds[n].fd = gWakeupFd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        ++n;
+    }
+    if (display_fd >= 0) {
+        display_index = static_cast<int>(n);
+        fds[n].fd = display_fd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        ++n;
+    }
+
+    auto now = steady_clock::now();
+    if (deadline <= now) {
+        timeout_ms = 0;
+    } else {
+        auto ns = duration_cast<nanoseconds>(
+                deadline.time_since_epoch()).count();
+        itimerspec spec = {};
+        spec.it_value.tv_sec = static_cast<time_t>(ns / 1000000000);
+        spec.it_value.tv_nsec = static_cast<long>(ns % 1000000000);
+
+        if (gTimerFd >= 0 && timerfd_settime(
+                gTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+            timer_index = static_cast<int>(n);
+            fds[n].fd = gTimerFd;
+            fds[n].events = POLLIN;
+            fds[n].revents = 0;
+            ++n;
+        } else {
+            // Round up so that we don't wake up before the deadline
+            timeout_ms = static_cast<int>(
+                    duration_cast<milliseconds>(deadline - now).count() + 1);
+        }
+    }
+
+    if (poll(fds, n, timeout_ms) <= 0) {
+        return false;
+    }
+
+    uint64_t value;
+
+    if (display_index >= 0 && (fds[display_index].revents & POLLIN)) {
+        // Completed page flips
+        gr_fb_handle_events();
+    }
+    if (timer_index >= 0 && (fds[timer_index].revents & POLLIN)) {
+        (void) read(gTimerFd, &value, sizeof(value));
+    }
+    if (wakeup_index >= 0 && (fds[wakeup_index].revents & POLLIN)) {
+        (void) read(gWakeupFd, &value, sizeof(value));
+        return true;
+    }
+
+    return false;
+}
+
 // Get and dispatch input events until it's time to draw the next frame
 // This special function will return immediately the first time, but then
-// always returns 1/30th of a second (or immediately if called later) from
-// the last time it was called
-static void loopTimer(int input_timeout_ms)
+// always returns gFrameIntervalNs (about 1/30th of a second, or immediately
+// if called later) from the last time it was called. While waiting, it sleeps in a single poll()
+// instead of spinning. If the screen is idle (nothing is animating), it sleeps
+// until there is input, a touch/key repeat is due, a render is requested, or
+// one second has passed.
+static void loopTimer(bool idle)
 {
     static steady_clock::time_point lastCall;
     static int initialized = 0;
@@ -379,28 +517,39 @@ static void loopTimer(int input_timeout_ms)
     }
 
     do {
-        bool got_event = input_handler.processInput(input_timeout_ms); // get inputs but don't send drag notices
+        bool got_event = input_handler.processInput(0); // get inputs but don't send drag notices
         auto curTime = steady_clock::now();
         auto diff = duration_cast<nanoseconds>(curTime - lastCall);
 
         // This is really 2 or 30 times per second
         // As long as we get events, increase the timeout so we can catch up with input
-        long timeout = got_event ? 500000000 : 33333333;
+        long timeout = got_event ? 500000000 : gFrameIntervalNs;
 
         if (diff.count() > timeout) {
-            //auto input_time = duration_cast<milliseconds>(curTime - lastCall);
-            //LOGI("loopTimer(): %" PRId64 " ms, count: %u",
-            //     input_time.count(), count);
-
             lastCall = curTime;
             input_handler.handleDrag(); // send only drag notices if needed
             return;
         }
 
-        // We need to sleep some period time microseconds
-        //unsigned int sleepTime = 33333 -(diff.tv_nsec / 1000);
-        //usleep(sleepTime); // removed so we can scan for input
-        input_timeout_ms = 0;
+        if (got_event) {
+            // There might be more events in the queue
+            continue;
+        }
+
+        steady_clock::time_point deadline = idle
+                ? curTime + seconds(1)
+                : lastCall + nanoseconds(gFrameIntervalNs + 1);
+        steady_clock::time_point hold_deadline;
+        if (input_handler.getHoldDeadline(hold_deadline)) {
+            deadline = std::min(deadline, hold_deadline);
+        }
+
+        if (waitForEvents(deadline)) {
+            // Render requested
+            lastCall = steady_clock::now();
+            input_handler.handleDrag();
+            return;
+        }
     } while (1);
 }
 
@@ -422,13 +571,14 @@ static int runPages(const char *page_name, const int stop_on_page_done)
     fd_set fdset;
     int has_data = 0;
 
-    int input_timeout_ms = 0;
+    bool idle = false;
     int idle_frames = 0;
 
     for (;;) {
-        loopTimer(input_timeout_ms);
+        loopTimer(idle);
         if (g_pty_fd > 0) {
-            // TODO: this is not nice, we should have one central select for input, pty
+            // loopTimer() wakes up when the pty is readable, but it does not
+            // consume the data
             FD_ZERO(&fdset);
             FD_SET(g_pty_fd, &fdset);
             timeout.tv_sec = 0;
@@ -449,24 +599,31 @@ static int runPages(const char *page_name, const int stop_on_page_done)
                 idle_frames = 0;
             }
             // due to possible animation objects, we need to delay activating the input timeout
-            input_timeout_ms = idle_frames > 15 ? 1000 : 0;
+            idle = idle_frames > 15;
+
+            // If the backend keeps the previous frame around, only redraw
+            // and copy the regions that changed
+            const DamageRegion* damage = nullptr;
+            if (gr_has_flip_region()) {
+                damage = &PageManager::GetDamage();
+            }
 
 #ifndef PRINT_RENDER_TIME
             if (ret > 1) {
-                PageManager::Render();
+                PageManager::Render(damage);
             }
 
             if (ret > 0) {
-                flip();
+                flip(damage);
             }
 #else
             if (ret > 1) {
                 auto start = steady_clock::now();
-                PageManager::Render();
+                PageManager::Render(damage);
                 auto end = steady_clock::now();
                 auto render_t = duration_cast<milliseconds>(end - start);
 
-                flip();
+                flip(damage);
                 auto flip_end = steady_clock::now();
                 auto flip_t = duration_cast<milliseconds>(flip_end - end);
 
@@ -474,14 +631,14 @@ static int runPages(const char *page_name, const int stop_on_page_done)
                      render_t.count(), flip_t.count(),
                      render_t.count() + flip_t.count());
             } else if (ret > 0) {
-                flip();
+                flip(damage);
             }
 #endif
         } else {
             gForceRender = 0;
             PageManager::Render();
             flip();
-            input_timeout_ms = 0;
+            idle = false;
         }
 
         blankTimer.checkForTimeout();
@@ -500,6 +657,7 @@ static int runPages(const char *page_name, const int stop_on_page_done)
 int gui_forceRender()
 {
     gForceRender = 1;
+    wakeMainLoop();
     return 0;
 }
 
@@ -508,6 +666,7 @@ int gui_changePage(std::string newPage)
     LOGI("Set page: '%s'", newPage.c_str());
     PageManager::ChangePage(newPage);
     gForceRender = 1;
+    wakeMainLoop();
     return 0;
 }
 
@@ -516,10 +675,11 @@ int gui_changeOverlay(std::string overlay)
     LOGI("Set overlay: '%s'", overlay.c_str());
     PageManager::ChangeOverlay(overlay);
     gForceRender = 1;
+    wakeMainLoop();
     return 0;
 }
 
-std::string gui_parse_text(std::string str)
+static std::string parse_text(std::string str, bool* dynamic)
 {
     // This function parses text for DataManager values encompassed by %value% in the XML
     // and string resources (%@resource_name%)
@@ -573,8 +733,13 @@ std::string gui_parse_text(std::string str)
                 // this is a string resource ("%@string_name%")
                 value = PageManager::GetResources()->FindString(var.substr(1));
                 str.insert(next, value);
-            } else if (DataManager::GetValue(var, value) == 0) {
-                str.insert(next, value);
+            } else {
+                if (dynamic && DataManager::IsDynamicValue(var)) {
+                    *dynamic = true;
+                }
+                if (DataManager::GetValue(var, value) == 0) {
+                    str.insert(next, value);
+                }
             }
         }
 
@@ -582,6 +747,40 @@ std::string gui_parse_text(std::string str)
     }
 }
 
+std::string gui_parse_text(std::string str)
+{
+    return parse_text(std::move(str), nullptr);
+}
+
+GUITextTemplate::GUITextTemplate()
+    : mHasSubstitutions(false), mDynamic(false), mValid(false), mVersion(0)
+{
+}
+
+void GUITextTemplate::SetText(std::string text)
+{
+    mText = std::move(text);
+    mHasSubstitutions = mText.find('%') != std::string::npos
+            || mText.find("{@") != std::string::npos;
+    mValid = false;
+}
+
+const std::string& GUITextTemplate::Parse()
+{
+    if (!mHasSubstitutions) {
+        return mText;
+    }
+
+    unsigned int version = DataManager::GetVersion();
+    if (!mValid || mDynamic || version != mVersion) {
+        mDynamic = false;
+        mValue = parse_text(mText, &mDynamic);
+        mVersion = version;
+        mValid = true;
+    }
+    return mValue;
+}
+
 std::string gui_lookup(const std::string& resource_name,
                        const std::string& default_value)
 {
@@ -594,6 +793,15 @@ extern "C" int gui_init()
         return -1;
     }
 
+    int refresh_rate = gr_fb_refresh_rate();
+    if (refresh_rate > 0) {
+        long period = 1000000000L / refresh_rate;
+        long refreshes = std::max((33333333L + period / 2) / period, 1L);
+        gFrameIntervalNs = refreshes * period;
+        LOGV("Drawing frames every %ld display refreshes (%d Hz)",
+             refreshes, refresh_rate);
+    }
+
     TWFunc::Set_Brightness(DataManager::GetStrValue(VAR_TW_BRIGHTNESS));
 
     // load and show splash screen
@@ -607,6 +815,16 @@ extern "C" int gui_init()
     }
 
     ev_init();
+
+    gWakeupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (gWakeupFd < 0) {
+        LOGW("Failed to create eventfd: %s", strerror(errno));
+    }
+    gTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (gTimerFd < 0) {
+        LOGW("Failed to create timerfd: %s", strerror(errno));
+    }
+
     return 0;
 }
 
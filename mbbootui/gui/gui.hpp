@@ -19,6 +19,8 @@
 #ifndef _GUI_HPP_HEADER
 #define _GUI_HPP_HEADER
 
+#include <string>
+
 #include "twmsg.h"
 
 void gui_msg(const char* text);
@@ -28,6 +30,34 @@ void gui_highlight(const char* text);
 void gui_msg(Message msg);
 
 std::string gui_parse_text(std::string inText);
+
+// Text with gui_parse_text() substitutions whose result is cached. The
+// lookups are only redone when a DataManager value changed since the
+// previous Parse() call or if the text refers to a value that can change on
+// its own, like the time or a property.
+class GUITextTemplate
+{
+public:
+    GUITextTemplate();
+
+    void SetText(std::string text);
+    const std::string& GetText() const
+    {
+        return mText;
+    }
+
+    const std::string& Parse();
+
+private:
+    std::string mText;
+    std::string mValue;
+    // Whether mText contains anything that could be substituted
+    bool mHasSubstitutions;
+    // Whether the last result included values that change on their own
+    bool mDynamic;
+    bool mValid;
+    unsigned int mVersion;
+};
 std::string gui_lookup(const std::string& resource_name, const std::string& default_value);
 
 #endif //_GUI_HPP_HEADER
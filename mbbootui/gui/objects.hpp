@@ -50,6 +50,16 @@ public:
         return 0;
     }
 
+    // GetDamage - Returns the region that changed in the last Update() that
+    //  returned >0. Only this region is redrawn and copied to the display.
+    //  Return true if the region is known, false if the whole screen must be
+    //  redrawn
+    virtual bool GetDamage(int& x __unused, int& y __unused,
+                           int& w __unused, int& h __unused)
+    {
+        return false;
+    }
+
     // GetRenderPos - Returns the current position of the object
     virtual int GetRenderPos(int& x, int& y, int& w, int& h)
     {
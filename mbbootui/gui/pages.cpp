@@ -82,12 +82,53 @@ PageSet* PageManager::mCurrentSet;
 MouseCursor *PageManager::mMouseCursor = nullptr;
 HardwareKeyboard *PageManager::mHardwareKeyboard = nullptr;
 bool PageManager::mReloadTheme = false;
+DamageRegion PageManager::mDamage;
 std::string PageManager::mStartPage = "main";
 std::vector<language_struct> Language_List;
 
 int tw_x_offset = 0;
 int tw_y_offset = 0;
 
+void DamageRegion::Clear()
+{
+    x = y = w = h = 0;
+    full = false;
+}
+
+void DamageRegion::Add(int ax, int ay, int aw, int ah)
+{
+    if (full || aw <= 0 || ah <= 0) {
+        return;
+    } else if (w <= 0 || h <= 0) {
+        x = ax;
+        y = ay;
+        w = aw;
+        h = ah;
+        return;
+    }
+
+    int x2 = std::max(x + w, ax + aw);
+    int y2 = std::max(y + h, ay + ah);
+    x = std::min(x, ax);
+    y = std::min(y, ay);
+    w = x2 - x;
+    h = y2 - y;
+}
+
+void DamageRegion::Add(const DamageRegion& other)
+{
+    if (other.full) {
+        AddFull();
+    } else {
+        Add(other.x, other.y, other.w, other.h);
+    }
+}
+
+void DamageRegion::AddFull()
+{
+    full = true;
+}
+
 // Helper routine to convert a string to a color declaration
 int ConvertStrToColor(std::string str, COLOR* color)
 {
@@ -528,11 +569,25 @@ int Page::Update()
 {
     int retCode = 0;
 
+    mDamage.Clear();
+
     for (auto iter = mRenders.begin(); iter != mRenders.end(); iter++) {
         int ret = (*iter)->Update();
         if (ret < 0) {
             LOGE("An update request has failed.");
-        } else if (ret > retCode) {
+            continue;
+        } else if (ret == 0) {
+            continue;
+        }
+
+        int x, y, w, h;
+        if ((*iter)->GetDamage(x, y, w, h)) {
+            mDamage.Add(x, y, w, h);
+        } else {
+            mDamage.AddFull();
+        }
+
+        if (ret > retCode) {
             retCode = ret;
         }
     }
@@ -1095,7 +1150,12 @@ int PageSet::Update()
 {
     int ret;
 
+    mDamage.Clear();
+
     ret = (mCurrentPage ? mCurrentPage->Update() : -1);
+    if (ret > 0) {
+        mDamage.Add(mCurrentPage->GetDamage());
+    }
     if (ret < 0 || ret > 1) {
         return ret;
     }
@@ -1104,6 +1164,8 @@ int PageSet::Update()
         ret = ((*iter) ? (*iter)->Update() : -1);
         if (ret < 0) {
             return ret;
+        } else if (ret > 0) {
+            mDamage.Add((*iter)->GetDamage());
         }
     }
     return ret;
@@ -1572,16 +1634,26 @@ int PageManager::IsCurrentPage(Page* page)
     return (mCurrentSet ? mCurrentSet->IsCurrentPage(page) : 0);
 }
 
-int PageManager::Render()
+int PageManager::Render(const DamageRegion* damage)
 {
     if (blankTimer.isScreenOff()) {
         return 0;
     }
 
+    // Every object is still rendered, but nothing outside of the damaged
+    // region is touched
+    if (damage && !damage->full) {
+        gr_set_base_clip(damage->x, damage->y, damage->w, damage->h);
+    }
+
     int res = (mCurrentSet ? mCurrentSet->Render() : -1);
     if (mMouseCursor) {
         mMouseCursor->Render();
     }
+
+    if (damage && !damage->full) {
+        gr_clear_base_clip();
+    }
     return res;
 }
 
@@ -1636,18 +1708,32 @@ void PageManager::LoadCursorData(xml_node<>* node)
 
 int PageManager::Update()
 {
+    mDamage.Clear();
+
     if (blankTimer.isScreenOff()) {
         return 0;
     }
 
     if (RunReload()) {
+        mDamage.AddFull();
         return -2;
     }
 
     int res = (mCurrentSet ? mCurrentSet->Update() : -1);
+    if (res > 0) {
+        mDamage.Add(mCurrentSet->GetDamage());
+    }
 
     if (mMouseCursor) {
         int c_res = mMouseCursor->Update();
+        if (c_res > 0) {
+            int x, y, w, h;
+            if (mMouseCursor->GetDamage(x, y, w, h)) {
+                mDamage.Add(x, y, w, h);
+            } else {
+                mDamage.AddFull();
+            }
+        }
         if (c_res > res) {
             res = c_res;
         }
@@ -1655,6 +1741,11 @@ int PageManager::Update()
     return res;
 }
 
+const DamageRegion& PageManager::GetDamage()
+{
+    return mDamage;
+}
+
 int PageManager::NotifyTouch(TOUCH_STATE state, int x, int y)
 {
     return (mCurrentSet ? mCurrentSet->NotifyTouch(state, x, y) : -1);
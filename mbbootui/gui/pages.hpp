@@ -35,6 +35,24 @@ struct COLOR {
         : red(r), green(g), blue(b), alpha(a) {}
 };
 
+// Bounding box of the regions of the screen that changed since the last frame
+struct DamageRegion
+{
+    int x;
+    int y;
+    int w;
+    int h;
+    // Whether the whole screen needs to be redrawn
+    bool full;
+
+    DamageRegion() : x(0), y(0), w(0), h(0), full(false) {}
+
+    void Clear();
+    void Add(int ax, int ay, int aw, int ah);
+    void Add(const DamageRegion& other);
+    void AddFull();
+};
+
 struct language_struct
 {
     std::string filename;
@@ -86,6 +104,12 @@ public:
                                 const std::string& value);
     virtual void SetPageFocus(int inFocus);
 
+    // Region that changed in the last Update()
+    const DamageRegion& GetDamage() const
+    {
+        return mDamage;
+    }
+
 protected:
     std::string mName;
     std::vector<GUIObject*> mObjects;
@@ -95,6 +119,7 @@ protected:
 
     ActionObject* mTouchStart;
     COLOR mBackground;
+    DamageRegion mDamage;
 
 protected:
     bool ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, int depth);
@@ -131,6 +156,12 @@ public:
     int SetKeyBoardFocus(int inFocus);
     int NotifyVarChange(const std::string& varName, const std::string& value);
 
+    // Region that changed in the last Update()
+    const DamageRegion& GetDamage() const
+    {
+        return mDamage;
+    }
+
     void AddStringResource(std::string resource_source, std::string resource_name, std::string value);
 
 protected:
@@ -143,6 +174,7 @@ protected:
     std::vector<Page*> mPages;
     Page* mCurrentPage;
     std::vector<Page*> mOverlays; // Special case for popup dialogs and the lock screen
+    DamageRegion mDamage;
 };
 
 class PageManager
@@ -172,8 +204,11 @@ public:
     static int IsCurrentPage(Page* page);
 
     // These are routing routines
-    static int Render();
+    // If damage is not null, only that region is redrawn
+    static int Render(const DamageRegion* damage = nullptr);
     static int Update();
+    // Region that changed in the last Update()
+    static const DamageRegion& GetDamage();
     static int NotifyTouch(TOUCH_STATE state, int x, int y);
     static int NotifyKey(int key, bool down);
     static int NotifyCharInput(int ch);
@@ -198,6 +233,7 @@ protected:
     static MouseCursor *mMouseCursor;
     static HardwareKeyboard *mHardwareKeyboard;
     static bool mReloadTheme;
+    static DamageRegion mDamage;
     static std::string mStartPage;
     static LoadingContext* currentLoadingContext;
 };
@@ -148,6 +148,15 @@ int GUIProgressBar::Update()
     return 2;
 }
 
+bool GUIProgressBar::GetDamage(int& x, int& y, int& w, int& h)
+{
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return true;
+}
+
 int GUIProgressBar::NotifyVarChange(const std::string& varName,
                                     const std::string& value)
 {
@@ -6,6 +6,7 @@
 #include <iostream>
 
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "mblog/logging.h"
@@ -18,6 +19,8 @@
 
 #define TMP_RESOURCE_NAME   "/tmp/extract.bin"
 
+#define MAX_IMAGE_LOADER_THREADS 4
+
 Resource::Resource(xml_node<>* node, ZipArchive* pZip __unused)
 {
     if (node && node->first_attribute("name")) {
@@ -57,26 +60,6 @@ int Resource::ExtractResource(ZipArchive* pZip,
     return ret;
 }
 
-void Resource::LoadImage(ZipArchive* pZip, const std::string& file,
-                         gr_surface* surface)
-{
-    int rc = 0;
-    if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0) {
-        rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-        unlink(TMP_RESOURCE_NAME);
-    } else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0) {
-        // JPG includes the .jpg extension in the filename so extension should be blank
-        rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-        unlink(TMP_RESOURCE_NAME);
-    } else if (!pZip) {
-        // File name in xml may have included .png so try without adding .png
-        rc = res_create_surface(file.c_str(), surface);
-    }
-    if (rc != 0) {
-        LOGI("Failed to load image from %s%s, error %d", file.c_str(), pZip ? " (zip)" : "", rc);
-    }
-}
-
 void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
 {
     if (!source) {
@@ -101,6 +84,135 @@ void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, in
     }
 }
 
+ImageLoader::ImageLoader(ZipArchive* pZip)
+    : mZip(pZip), mNextJob(0)
+{
+    pthread_mutex_init(&mLock, nullptr);
+}
+
+ImageLoader::~ImageLoader()
+{
+    // Clean up the extracted files if Run() was never called
+    for (auto const& job : mJobs) {
+        if (job.temp) {
+            unlink(job.path.c_str());
+        }
+    }
+    pthread_mutex_destroy(&mLock);
+}
+
+bool ImageLoader::Add(const std::string& file, bool retain_aspect,
+                      std::shared_ptr<void>* surface)
+{
+    auto key = std::make_pair(file, retain_aspect);
+    auto it = mJobIndex.find(key);
+    if (it != mJobIndex.end()) {
+        mJobs[it->second].destinations.push_back(surface);
+        return true;
+    }
+
+    Job job;
+    job.file = file;
+    job.temp = false;
+    job.retain_aspect = retain_aspect;
+
+    std::string tmp_path = TMP_RESOURCE_NAME "." + std::to_string(mJobs.size());
+
+    if (Resource::ExtractResource(mZip, "images", file, ".png", tmp_path) == 0) {
+        job.path = tmp_path;
+        job.temp = true;
+    } else if (Resource::ExtractResource(mZip, "images", file, "", tmp_path) == 0) {
+        // JPG includes the .jpg extension in the filename so extension should be blank
+        job.path = tmp_path;
+        job.temp = true;
+    } else if (!mZip && access(file.c_str(), R_OK) == 0) {
+        // File name in xml may have included .png so try without adding .png
+        job.path = file;
+    } else {
+        return false;
+    }
+
+    job.destinations.push_back(surface);
+    mJobIndex[key] = mJobs.size();
+    mJobs.push_back(std::move(job));
+    return true;
+}
+
+void ImageLoader::Decode(Job& job)
+{
+    gr_surface temp_surface = nullptr;
+    gr_surface surface = nullptr;
+
+    int rc = res_create_surface(job.path.c_str(), &temp_surface);
+    if (job.temp) {
+        unlink(job.path.c_str());
+        job.temp = false;
+    }
+    if (rc != 0) {
+        LOGI("Failed to load image from %s%s, error %d",
+             job.file.c_str(), mZip ? " (zip)" : "", rc);
+    }
+
+    Resource::CheckAndScaleImage(temp_surface, &surface, job.retain_aspect);
+    if (surface) {
+        job.surface = std::shared_ptr<void>(surface, res_free_surface);
+    }
+}
+
+void* ImageLoader::WorkerThread(void* cookie)
+{
+    ImageLoader* loader = static_cast<ImageLoader*>(cookie);
+
+    for (;;) {
+        pthread_mutex_lock(&loader->mLock);
+        size_t index = loader->mNextJob++;
+        pthread_mutex_unlock(&loader->mLock);
+
+        if (index >= loader->mJobs.size()) {
+            break;
+        }
+
+        loader->Decode(loader->mJobs[index]);
+    }
+
+    return nullptr;
+}
+
+void ImageLoader::Run()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t n_threads = cpus > 1 ? cpus : 1;
+    n_threads = std::min<size_t>(n_threads, MAX_IMAGE_LOADER_THREADS);
+    n_threads = std::min(n_threads, mJobs.size());
+
+    // The calling thread decodes images too
+    std::vector<pthread_t> threads;
+    for (size_t i = 1; i < n_threads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, &WorkerThread, this) != 0) {
+            LOGW("Failed to create image loader thread");
+            break;
+        }
+        threads.push_back(thread);
+    }
+
+    WorkerThread(this);
+
+    for (pthread_t thread : threads) {
+        pthread_join(thread, nullptr);
+    }
+
+    for (auto& job : mJobs) {
+        for (auto* destination : job.destinations) {
+            *destination = job.surface;
+        }
+    }
+
+    mJobs.clear();
+    mJobIndex.clear();
+    mNextJob = 0;
+}
+
 FontResource::FontResource(xml_node<>* node, ZipArchive* pZip)
     : Resource(node, pZip)
 {
@@ -192,13 +304,11 @@ FontResource::~FontResource()
     DeleteFont();
 }
 
-ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
-    : Resource(node, pZip)
+ImageResource::ImageResource(xml_node<>* node, ImageLoader* loader)
+    : Resource(node, loader->GetZip())
 {
     std::string file;
-    gr_surface temp_surface = nullptr;
 
-    mSurface = nullptr;
     if (!node) {
         LOGE("ImageResource node is NULL");
         return;
@@ -213,19 +323,15 @@ ImageResource::ImageResource(xml_node<>* node, ZipArchive* pZip)
 
     bool retain_aspect = (node->first_attribute("retainaspect") != nullptr);
     // the value does not matter, if retainaspect is present, we assume that we want to retain it
-    LoadImage(pZip, file, &temp_surface);
-    CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+    loader->Add(file, retain_aspect, &mSurface);
 }
 
 ImageResource::~ImageResource()
 {
-    if (mSurface) {
-        res_free_surface(mSurface);
-    }
 }
 
-AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
-    : Resource(node, pZip)
+AnimationResource::AnimationResource(xml_node<>* node, ImageLoader* loader)
+    : Resource(node, loader->GetZip())
 {
     std::string file;
     int fileNum = 1;
@@ -247,25 +353,28 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipArchive* pZip)
         std::ostringstream fileName;
         fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
 
-        gr_surface surface, temp_surface = nullptr;
-        LoadImage(pZip, fileName.str(), &temp_surface);
-        CheckAndScaleImage(temp_surface, &surface, retain_aspect);
-        if (surface) {
-            mSurfaces.push_back(surface);
+        mSurfaces.emplace_back();
+        if (loader->Add(fileName.str(), retain_aspect, &mSurfaces.back())) {
             fileNum++;
         } else {
+            mSurfaces.pop_back();
             break; // Done loading animation images
         }
     }
 }
 
 AnimationResource::~AnimationResource()
+{
+}
+
+void AnimationResource::DropFailedFrames()
 {
     for (auto it = mSurfaces.begin(); it != mSurfaces.end(); ++it) {
-        res_free_surface(*it);
+        if (!*it) {
+            mSurfaces.erase(it, mSurfaces.end());
+            break;
+        }
     }
-
-    mSurfaces.clear();
 }
 
 FontResource* ResourceManager::FindFont(const std::string& name) const
@@ -373,6 +482,12 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
         return;
     }
 
+    // Images and animations are only queued here and are decoded all at once
+    // after the whole list has been parsed
+    ImageLoader loader(pZip);
+    std::vector<std::pair<xml_node<>*, ImageResource*>> images;
+    std::vector<std::pair<xml_node<>*, AnimationResource*>> animations;
+
     for (xml_node<>* child = resList->first_node(); child; child = child->next_sibling()) {
         std::string type = child->name();
         if (type == "resource") {
@@ -410,21 +525,9 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
                 LOGE("Unable to locate font name for type fontoverride.");
             }
         } else if (type == "image") {
-            ImageResource* res = new ImageResource(child, pZip);
-            if (res->GetResource()) {
-                mImages.push_back(res);
-            } else {
-                error = true;
-                delete res;
-            }
+            images.emplace_back(child, new ImageResource(child, &loader));
         } else if (type == "animation") {
-            AnimationResource* res = new AnimationResource(child, pZip);
-            if (res->GetResourceCount()) {
-                mAnimations.push_back(res);
-            } else {
-                error = true;
-                delete res;
-            }
+            animations.emplace_back(child, new AnimationResource(child, &loader));
         } else if (type == "string") {
             if (xml_attribute<>* attr = child->first_attribute("name")) {
                 string_resource_struct res;
@@ -440,21 +543,47 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipArchive* pZip,
         }
 
         if (error) {
-            std::string res_name;
-            if (child->first_attribute("name")) {
-                res_name = child->first_attribute("name")->value();
-            }
-            if (res_name.empty() && child->first_attribute("filename")) {
-                res_name = child->first_attribute("filename")->value();
-            }
+            LogLoadError(child, type);
+        }
+    }
 
-            if (!res_name.empty()) {
-                LOGE("Resource (%s)-(%s) failed to load", type.c_str(), res_name.c_str());
-            } else {
-                LOGE("Resource type (%s) failed to load", type.c_str());
-            }
+    loader.Run();
+
+    for (auto const& item : images) {
+        if (item.second->GetResource()) {
+            mImages.push_back(item.second);
+        } else {
+            LogLoadError(item.first, "image");
+            delete item.second;
         }
     }
+
+    for (auto const& item : animations) {
+        item.second->DropFailedFrames();
+        if (item.second->GetResourceCount()) {
+            mAnimations.push_back(item.second);
+        } else {
+            LogLoadError(item.first, "animation");
+            delete item.second;
+        }
+    }
+}
+
+void ResourceManager::LogLoadError(xml_node<>* node, const std::string& type)
+{
+    std::string res_name;
+    if (node->first_attribute("name")) {
+        res_name = node->first_attribute("name")->value();
+    }
+    if (res_name.empty() && node->first_attribute("filename")) {
+        res_name = node->first_attribute("filename")->value();
+    }
+
+    if (!res_name.empty()) {
+        LOGE("Resource (%s)-(%s) failed to load", type.c_str(), res_name.c_str());
+    } else {
+        LOGE("Resource type (%s) failed to load", type.c_str());
+    }
 }
 
 ResourceManager::~ResourceManager()
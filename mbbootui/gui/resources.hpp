@@ -3,12 +3,23 @@
 #ifndef _RESOURCE_HEADER
 #define _RESOURCE_HEADER
 
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+
 #include "minuitwrp/minui.h"
 
 #include "gui/rapidxml.hpp"
 
 struct ZipArchive;
 
+class ImageLoader;
+
 // Base Objects
 class Resource
 {
@@ -31,10 +42,55 @@ protected:
                                const std::string& fileName,
                                const std::string& fileExtn,
                                const std::string& destFile);
-    static void LoadImage(ZipArchive* pZip,
-                          const std::string& file, gr_surface* surface);
     static void CheckAndScaleImage(gr_surface source, gr_surface* destination,
                                    int retain_aspect);
+
+    friend class ImageLoader;
+};
+
+// Decodes the images of a resource list in parallel. Images are extracted
+// from the theme zip when they are queued (minzip is not thread safe) and
+// are decoded and scaled on a few worker threads by Run(). An image that is
+// queued more than once with the same parameters is only decoded once and
+// the surface is shared.
+class ImageLoader
+{
+public:
+    explicit ImageLoader(ZipArchive* pZip);
+    ~ImageLoader();
+
+    ZipArchive* GetZip() const
+    {
+        return mZip;
+    }
+
+    // Queue an image. *surface is set by Run(). Returns false if the image
+    // does not exist.
+    bool Add(const std::string& file, bool retain_aspect,
+             std::shared_ptr<void>* surface);
+
+    // Decode and scale all queued images
+    void Run();
+
+private:
+    struct Job
+    {
+        std::string file;
+        std::string path;
+        bool temp;
+        bool retain_aspect;
+        std::vector<std::shared_ptr<void>*> destinations;
+        std::shared_ptr<void> surface;
+    };
+
+    static void* WorkerThread(void* cookie);
+    void Decode(Job& job);
+
+    ZipArchive* mZip;
+    std::vector<Job> mJobs;
+    std::map<std::pair<std::string, bool>, size_t> mJobIndex;
+    size_t mNextJob;
+    pthread_mutex_t mLock;
 };
 
 class FontResource : public Resource
@@ -79,63 +135,63 @@ private:
 class ImageResource : public Resource
 {
 public:
-    ImageResource(xml_node<>* node, ZipArchive* pZip);
+    ImageResource(xml_node<>* node, ImageLoader* loader);
     virtual ~ImageResource();
 
 public:
     gr_surface GetResource()
     {
 #if 0
-        return this ? mSurface : nullptr;
+        return this ? mSurface.get() : nullptr;
 #else
-        return mSurface;
+        return mSurface.get();
 #endif
     }
 
     int GetWidth()
     {
 #if 0
-        return gr_get_width(this ? mSurface : nullptr);
+        return gr_get_width(this ? mSurface.get() : nullptr);
 #else
-        return gr_get_width(mSurface);
+        return gr_get_width(mSurface.get());
 #endif
     }
 
     int GetHeight()
     {
 #if 0
-        return gr_get_height(this ? mSurface : nullptr);
+        return gr_get_height(this ? mSurface.get() : nullptr);
 #else
-        return gr_get_height(mSurface);
+        return gr_get_height(mSurface.get());
 #endif
     }
 
 protected:
-    gr_surface mSurface;
+    std::shared_ptr<void> mSurface;
 };
 
 class AnimationResource : public Resource
 {
 public:
-    AnimationResource(xml_node<>* node, ZipArchive* pZip);
+    AnimationResource(xml_node<>* node, ImageLoader* loader);
     virtual ~AnimationResource();
 
 public:
     gr_surface GetResource()
     {
 #if 0
-        return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(0);
+        return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(0).get();
 #else
-        return mSurfaces.empty() ? nullptr : mSurfaces.at(0);
+        return mSurfaces.empty() ? nullptr : mSurfaces.at(0).get();
 #endif
     }
 
     gr_surface GetResource(int entry)
     {
 #if 0
-        return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(entry);
+        return (!this || mSurfaces.empty()) ? nullptr : mSurfaces.at(entry).get();
 #else
-        return mSurfaces.empty() ? nullptr : mSurfaces.at(entry);
+        return mSurfaces.empty() ? nullptr : mSurfaces.at(entry).get();
 #endif
     }
 
@@ -162,8 +218,12 @@ public:
         return mSurfaces.size();
     }
 
+    // Drop the frames after the first one that failed to decode
+    void DropFailedFrames();
+
 protected:
-    std::vector<gr_surface> mSurfaces;
+    // A deque, so that the ImageLoader can fill in queued frames
+    std::deque<std::shared_ptr<void>> mSurfaces;
 };
 
 class ResourceManager
@@ -184,6 +244,8 @@ public:
     void DumpStrings() const;
 
 private:
+    static void LogLoadError(xml_node<>* node, const std::string& type);
+
     struct string_resource_struct
     {
         std::string value;
@@ -228,14 +228,22 @@ int GUIScrollList::Render()
     }
 
     int yPos = mRenderY + mHeaderH + y_offset;
+    int yTop = mRenderY + mHeaderH;
+    int yBottom = mRenderY + mRenderH;
 
     // render all visible items
     for (size_t line = 0; line < lines; line++) {
         size_t itemindex = line + firstDisplayedItem;
-        if (itemindex >= listSize) {
+        if (itemindex >= listSize || yPos >= yBottom) {
             break;
         }
 
+        // skip rows that are completely hidden behind the header
+        if (yPos + actualItemHeight <= yTop) {
+            yPos += actualItemHeight;
+            continue;
+        }
+
         RenderItem(itemindex, yPos, itemindex == selectedItem);
 
         // Add the separator
@@ -401,6 +409,17 @@ int GUIScrollList::Update()
     return 0;
 }
 
+bool GUIScrollList::GetDamage(int& x, int& y, int& w, int& h)
+{
+    // Everything, including the header and the fast scroll bar, is drawn
+    // inside the render area
+    x = mRenderX;
+    y = mRenderY;
+    w = mRenderW;
+    h = mRenderH;
+    return true;
+}
+
 size_t GUIScrollList::HitTestItem(int x __unused, int y)
 {
     // We only care about y position
@@ -324,6 +324,66 @@ public:
         }
     };
 
+    // Fixed-capacity ring buffer of lines. Once it is full, the oldest lines
+    // must be dropped before new ones can be added, so the scrollback never
+    // grows past the capacity and the line storage is reused.
+    class LineBuffer
+    {
+    public:
+        explicit LineBuffer(size_t capacity) : buf(capacity), first(0), count(0) {}
+
+        size_t size() const
+        {
+            return count;
+        }
+
+        bool full() const
+        {
+            return count == buf.size();
+        }
+
+        Line& operator[](size_t n)
+        {
+            return buf[(first + n) % buf.size()];
+        }
+
+        const Line& operator[](size_t n) const
+        {
+            return buf[(first + n) % buf.size()];
+        }
+
+        // Append an empty line. The buffer must not be full.
+        void push_back()
+        {
+            ++count;
+            (*this)[count - 1].text.clear();
+        }
+
+        // Drop the first n lines
+        void pop_front(size_t n)
+        {
+            n = std::min(n, count);
+            first = (first + n) % buf.size();
+            count -= n;
+        }
+
+        // Drop everything after the first n lines
+        void truncate(size_t n)
+        {
+            count = std::min(n, count);
+        }
+
+        void clear()
+        {
+            first = count = 0;
+        }
+
+    private:
+        std::vector<Line> buf;
+        size_t first; // index of the first line in buf
+        size_t count;
+    };
+
     // A single character cell with a Unicode code point
     struct Cell
     {
@@ -353,12 +413,13 @@ public:
         }
     };
 
-    TerminalEngine()
+    TerminalEngine() : lines(kMaxLines)
     {
         // the default size will be overwritten by the GUI window when the size is known
         width = 40;
         height = 10;
 
+        unpackedY = kNoLine;
         clear();
         updateCounter = 0;
         state = kStateGround;
@@ -513,10 +574,15 @@ public:
     {
         //y = min(height, max(y, 0));
         y = std::max(y, 0);
-        cursorY = y;
         while (lines.size() <= (size_t) y) {
-            lines.push_back(Line());
+            if (lines.full()) {
+                // scroll the oldest line out of the history
+                dropLines(1);
+                --y;
+            }
+            lines.push_back();
         }
+        cursorY = y;
         ++updateCounter;
     }
 
@@ -541,8 +607,21 @@ public:
     }
 
 private:
+    // Remove the first n lines from the history
+    void dropLines(size_t n)
+    {
+        n = std::min(n, lines.size());
+        lines.pop_front(n);
+        if (unpackedY != kNoLine) {
+            unpackedY = unpackedY >= n ? unpackedY - n : kNoLine;
+        }
+    }
+
     void packLine()
     {
+        if (unpackedY >= lines.size()) {
+            return;
+        }
         std::string& s = lines[unpackedY].text;
         s.clear();
         for (size_t i = 0; i < unpackedLine.cells.size(); ++i) {
@@ -754,14 +833,12 @@ private:
             default:
             case 0:
                 unpackedLine.eraseFrom(cursorX);
-                if (lines.size() > (size_t) cursorY + 1) {
-                    lines.erase(lines.begin() + cursorY + 1, lines.end());
-                }
+                lines.truncate(cursorY + 1);
                 break;
             case 1:
                 unpackedLine.eraseTo(cursorX);
                 if (cursorY > 0) {
-                    lines.erase(lines.begin(), lines.begin() + cursorY - 1);
+                    dropLines(cursorY - 1);
                     cursorY = 0;
                 }
                 break;
@@ -798,9 +875,13 @@ private:
     }
 
 private:
+    // maximum number of lines kept in the scrollback
+    static constexpr size_t kMaxLines = 1000;
+    static constexpr size_t kNoLine = (size_t) -1;
+
     int cursorX, cursorY; // 0-based, char based. TODO: decide how to handle scrollback
     int width, height; // window size in chars
-    std::vector<Line> lines; // the text buffer
+    LineBuffer lines; // the text buffer
     UnpackedLine unpackedLine; // current line for editing
     size_t unpackedY; // number of current line
     int updateCounter; // changes whenever terminal could require redraw
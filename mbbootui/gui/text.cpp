@@ -29,7 +29,6 @@ GUIText::GUIText(xml_node<>* node) : GUIObject(node)
     maxWidth = 0;
     scaleWidth = true;
     isHighlighted = false;
-    mText = "";
 
     if (!node) {
         return;
@@ -54,7 +53,7 @@ GUIText::GUIText(xml_node<>* node) : GUIObject(node)
 
     xml_node<>* child = FindNode(node, "text");
     if (child) {
-        mText = child->value();
+        mText.SetText(child->value());
     }
 
     child = FindNode(node, "noscaling");
@@ -75,8 +74,8 @@ GUIText::GUIText(xml_node<>* node) : GUIObject(node)
     }
 
     // Simple way to check for static state
-    mLastValue = gui_parse_text(mText);
-    if (mLastValue != mText) {
+    mLastValue = mText.Parse();
+    if (mLastValue != mText.GetText()) {
         mIsStatic = 0;
     }
 
@@ -96,7 +95,7 @@ int GUIText::Render()
         return -1;
     }
 
-    mLastValue = gui_parse_text(mText);
+    mLastValue = mText.Parse();
 
     mVarChanged = 0;
 
@@ -138,7 +137,7 @@ int GUIText::Update()
         return 0;
     }
 
-    std::string newValue = gui_parse_text(mText);
+    const std::string& newValue = mText.Parse();
     if (mLastValue == newValue) {
         return 0;
     } else {
@@ -156,7 +155,7 @@ int GUIText::GetCurrentBounds(int& w, int& h)
     }
 
     h = mFontHeight;
-    mLastValue = gui_parse_text(mText);
+    mLastValue = mText.Parse();
     w = gr_ttf_measureEx(mLastValue.c_str(), fontResource);
     return 0;
 }
@@ -181,5 +180,5 @@ int GUIText::SetMaxWidth(unsigned width)
 
 void GUIText::SetText(std::string newtext)
 {
-    mText = std::move(newtext);
+    mText.SetText(std::move(newtext));
 }
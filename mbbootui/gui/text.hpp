@@ -54,7 +54,7 @@ public:
     unsigned maxWidth;
 
 protected:
-    std::string mText;
+    GUITextTemplate mText;
     std::string mLastValue;
     COLOR mColor;
     COLOR mHighlightColor;
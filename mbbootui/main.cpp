@@ -13,6 +13,12 @@
  * along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 #include <cinttypes>
 #include <cstring>
 
@@ -23,9 +29,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <archive.h>
-#include <archive_entry.h>
-
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
@@ -51,6 +56,9 @@
 
 #include "config/config.hpp"
 
+#include "minzip/SysUtil.h"
+#include "minzip/Zip.h"
+
 #define LOG_TAG "mbbootui/main"
 
 #define APPEND_TO_LOG               1
@@ -69,12 +77,12 @@
 
 #define DEVICE_JSON_PATH            "/device.json"
 
+#define MAX_EXTRACT_THREADS         4
+
 #define BOOL_STR(x)                 ((x) ? "true" : "false")
 
 using namespace mb::device;
 
-using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
-
 static mb::patcher::PatcherConfig pc;
 
 static bool redirect_output_to_file(const char *path, mode_t mode)
@@ -126,102 +134,174 @@ static bool detect_device()
     return true;
 }
 
-static bool extract_theme(const std::string &path, const std::string &target,
-                          const std::string &theme_name)
+struct ThemeFile
 {
-    ScopedArchive in(archive_read_new(), archive_read_free);
-    if (!in) {
-        LOGE("%s: Out of memory when creating archive reader", __FUNCTION__);
+    const ZipEntry *entry;
+    std::string target_path;
+    bool device_specific;
+};
+
+static bool extract_theme_file(const ZipArchive *zip, const ThemeFile &file)
+{
+    int fd = open(file.target_path.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             file.target_path.c_str(), strerror(errno));
         return false;
     }
-    ScopedArchive out(archive_write_disk_new(), archive_write_free);
-    if (!out) {
-        LOGE("%s: Out of memory when creating disk writer", __FUNCTION__);
+
+    auto close_fd = mb::finally([&] {
+        close(fd);
+    });
+
+    long size = mzGetZipEntryUncompLen(file.entry);
+
+    // Allocate the whole file up front so that the inflated chunks do not
+    // extend the file one write at a time
+    if (size > 0 && fallocate(fd, 0, 0, size) < 0
+            && errno != EOPNOTSUPP && errno != ENOSYS) {
+        LOGW("%s: Failed to preallocate %ld bytes: %s",
+             file.target_path.c_str(), size, strerror(errno));
+    }
+
+    if (!mzExtractZipEntryToFile(zip, file.entry, fd)) {
+        LOGE("%s: Failed to extract file", file.target_path.c_str());
         return false;
     }
 
-    archive_read_support_format_zip(in.get());
+    close_fd.dismiss();
 
-    // Set up disk writer parameters. We purposely don't extract any file
-    // metadata
-    int flags = ARCHIVE_EXTRACT_SECURE_SYMLINKS
-            | ARCHIVE_EXTRACT_SECURE_NODOTDOT;
+    if (close(fd) < 0) {
+        LOGE("%s: Failed to close file: %s",
+             file.target_path.c_str(), strerror(errno));
+        return false;
+    }
 
-    archive_write_disk_set_standard_lookup(out.get());
-    archive_write_disk_set_options(out.get(), flags);
+    return true;
+}
 
-    if (archive_read_open_filename(in.get(), path.c_str(), 10240) != ARCHIVE_OK) {
-        LOGE("%s: Failed to open file: %s",
-             path.c_str(), archive_error_string(in.get()));
+/*!
+ * \brief Extract the common and device-specific theme files
+ *
+ * The zip is memory mapped and the central directory gives random access to
+ * every entry, so the files are inflated in parallel. Device-specific files
+ * override common files with the same name.
+ */
+static bool extract_theme(const std::string &path, const std::string &target,
+                          const std::string &theme_name)
+{
+    MemMapping map;
+    if (sysMapFile(path.c_str(), &map) != 0) {
+        LOGE("%s: Failed to map file", path.c_str());
         return false;
     }
 
-    archive_entry *entry;
-    int ret;
-    std::string target_path;
+    auto release_map = mb::finally([&] {
+        sysReleaseMap(&map);
+    });
+
+    ZipArchive zip;
+    if (int ret = mzOpenZipArchive(map.addr, map.length, &zip); ret != 0) {
+        LOGE("%s: Failed to open zip: %s", path.c_str(), strerror(ret));
+        return false;
+    }
+
+    auto close_zip = mb::finally([&] {
+        mzCloseZipArchive(&zip);
+    });
 
     std::string common_prefix("theme/common/");
     std::string theme_prefix("theme/");
     theme_prefix += theme_name;
     theme_prefix += '/';
 
-    while (true) {
-        ret = archive_read_next_header(in.get(), &entry);
-        if (ret == ARCHIVE_EOF) {
-            break;
-        } else if (ret == ARCHIVE_RETRY) {
-            LOGW("%s: Retrying header read", path.c_str());
+    std::vector<ThemeFile> files;
+    // Index in files for each target path. Every target is written by only
+    // one of the parallel extractions.
+    std::unordered_map<std::string, size_t> targets;
+
+    for (unsigned int i = 0; i < zip.numEntries; ++i) {
+        const ZipEntry *entry = &zip.pEntries[i];
+        std::string name(entry->fileName, entry->fileNameLen);
+        size_t prefix_size;
+        bool device_specific;
+
+        if (mb::starts_with(name, common_prefix)) {
+            prefix_size = common_prefix.size();
+            device_specific = false;
+        } else if (mb::starts_with(name, theme_prefix)) {
+            prefix_size = theme_prefix.size();
+            device_specific = true;
+        } else {
+            LOGV("Skipping: %s", name.c_str());
             continue;
-        } else if (ret != ARCHIVE_OK) {
-            LOGE("%s: Failed to read header: %s",
-                 path.c_str(), archive_error_string(in.get()));
-            return false;
         }
 
-        const char *path = archive_entry_pathname(entry);
-        if (!path || !*path) {
-            LOGE("%s: Header has null or empty filename", path);
-            return false;
+        // Directories are created as needed for the files
+        if (name.back() == '/') {
+            continue;
         }
 
-        const char *suffix;
-
-        if (mb::starts_with(path, common_prefix)) {
-            suffix = path + common_prefix.size();
-        } else if (mb::starts_with(path, theme_prefix)) {
-            suffix = path + theme_prefix.size();
-        } else {
-            LOGV("Skipping: %s", path);
+        if (S_ISLNK(static_cast<mode_t>(entry->externalFileAttributes >> 16))) {
+            LOGW("Skipping symlink: %s", name.c_str());
             continue;
         }
 
+        std::string suffix = name.substr(prefix_size);
+        if (suffix == ".." || mb::starts_with(suffix, "../")
+                || mb::ends_with(suffix, "/..")
+                || suffix.find("/../") != std::string::npos) {
+            LOGE("%s: Path escapes the theme directory", name.c_str());
+            return false;
+        }
+
         // Build path
-        target_path = target;
-        if (target_path.back() != '/' && *suffix != '/') {
+        std::string target_path = target;
+        if (target_path.back() != '/' && suffix.front() != '/') {
             target_path += '/';
         }
         target_path += suffix;
 
-        LOGV("Extracting: %s -> %s", path, target_path.c_str());
-
-        archive_entry_set_pathname(entry, target_path.c_str());
-
-        // Extract file
-        ret = archive_read_extract2(in.get(), entry, out.get());
-        if (ret != ARCHIVE_OK) {
-            LOGE("%s: %s", archive_entry_pathname(entry),
-                 archive_error_string(in.get()));
+        if (auto r = mb::util::mkdir_parent(target_path, 0755);
+                !r && r.error() != std::errc::file_exists) {
+            LOGE("%s: Failed to create parent directory: %s",
+                 target_path.c_str(), r.error().message().c_str());
             return false;
         }
-    }
 
-    if (archive_read_close(in.get()) != ARCHIVE_OK) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), archive_error_string(in.get()));
-        return false;
+        if (auto it = targets.find(target_path); it != targets.end()) {
+            auto &file = files[it->second];
+
+            // The later entry wins, except that a common file never replaces
+            // a device-specific one
+            if (!file.device_specific || device_specific) {
+                LOGV("Extracting: %s -> %s (overrides earlier entry)",
+                     name.c_str(), target_path.c_str());
+                file.entry = entry;
+                file.device_specific = device_specific;
+            } else {
+                LOGV("Skipping: %s (overridden by device theme)",
+                     name.c_str());
+            }
+            continue;
+        }
+
+        LOGV("Extracting: %s -> %s", name.c_str(), target_path.c_str());
+
+        targets.emplace(target_path, files.size());
+        files.push_back({entry, std::move(target_path), device_specific});
     }
 
-    return true;
+    std::atomic_bool failed{false};
+
+    mb::parallel_for(files.size(), [&](size_t i) {
+        if (!failed && !extract_theme_file(&zip, files[i])) {
+            failed = true;
+        }
+    }, MAX_EXTRACT_THREADS);
+
+    return !failed;
 }
 
 static void wait_forever()
@@ -52,9 +52,13 @@ struct adf_pdata
     unsigned int current_surface;
     unsigned int n_surfaces;
     adf_surface_pdata surfaces[2];
+
+    // Region passed to the previous adf_flip_region() call
+    GRRect last_damage;
 };
 
 static GRSurface* adf_flip(minui_backend *backend);
+static GRSurface* adf_flip_region(minui_backend *backend, const GRRect *r);
 static void adf_blank(minui_backend *backend, bool blank);
 
 static int adf_surface_init(adf_pdata *pdata, drm_mode_modeinfo *mode, adf_surface_pdata *surf)
@@ -241,12 +245,8 @@ static GRSurface* adf_init(minui_backend *backend)
     return ret;
 }
 
-static GRSurface* adf_flip(minui_backend *backend)
+static void adf_post(adf_pdata *pdata, adf_surface_pdata *surf)
 {
-    adf_pdata *pdata = (adf_pdata *)backend;
-    adf_surface_pdata *surf = &pdata->surfaces[pdata->current_surface];
-
-    memcpy(surf->adf_data, surf->base.data, surf->pitch * surf->base.height);
     int fence_fd = adf_interface_simple_post(pdata->intf_fd, pdata->eng_id,
             surf->base.width, surf->base.height, pdata->format, surf->fd,
             surf->offset, surf->pitch, -1);
@@ -255,6 +255,33 @@ static GRSurface* adf_flip(minui_backend *backend)
     }
 
     pdata->current_surface = (pdata->current_surface + 1) % pdata->n_surfaces;
+}
+
+static GRSurface* adf_flip(minui_backend *backend)
+{
+    adf_pdata *pdata = (adf_pdata *)backend;
+    adf_surface_pdata *surf = &pdata->surfaces[pdata->current_surface];
+
+    memcpy(surf->adf_data, surf->base.data, surf->pitch * surf->base.height);
+    adf_post(pdata, surf);
+    return &pdata->surfaces[pdata->current_surface].base;
+}
+
+static GRSurface* adf_flip_region(minui_backend *backend, const GRRect *r)
+{
+    adf_pdata *pdata = (adf_pdata *)backend;
+    adf_surface_pdata *surf = &pdata->surfaces[pdata->current_surface];
+
+    // All surfaces share the same drawing buffer. With two surfaces, this
+    // one does not have the previous frame's changes yet.
+    GRRect copy = *r;
+    if (pdata->n_surfaces > 1) {
+        copy = gr_rect_union(r, &pdata->last_damage);
+    }
+    gr_copy_rect(surf->adf_data, surf->base.data, &surf->base, &copy);
+    pdata->last_damage = *r;
+
+    adf_post(pdata, surf);
     return &pdata->surfaces[pdata->current_surface].base;
 }
 
@@ -298,5 +325,6 @@ extern "C" struct minui_backend * BACKEND_FUNCTION(adf)()
     pdata->base.flip = adf_flip;
     pdata->base.blank = adf_blank;
     pdata->base.exit = adf_exit;
+    pdata->base.flip_region = adf_flip_region;
     return &pdata->base;
 }
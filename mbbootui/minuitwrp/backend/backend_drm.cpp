@@ -15,7 +15,9 @@
  */
 
 #include <drm_fourcc.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,15 +39,29 @@
 
 #define ARRAY_SIZE(A) (sizeof(A)/sizeof(*(A)))
 
+// One buffer is scanned out, one may be queued for the next vblank and the
+// third one is drawn into, so rendering never touches a visible buffer
+#define NUM_BUFFERS 3
+
+// Give up waiting for a page flip event after this many milliseconds
+#define PAGE_FLIP_TIMEOUT_MS 100
+
 struct drm_surface
 {
     GRSurface base;
     uint32_t fb_id;
     uint32_t handle;
+    // Whether the buffer's contents are unrelated to the previous frames
+    bool stale;
 };
 
-static drm_surface *drm_surfaces[2];
-static int current_buffer;
+static drm_surface *drm_surfaces[NUM_BUFFERS];
+static int current_buffer;   // buffer being drawn into
+static int displayed_buffer; // buffer being scanned out
+static int pending_buffer;   // buffer queued with drmModePageFlip() or -1
+
+// Region passed to the previous drm_flip_region() call
+static GRRect last_damage;
 
 static drmModeCrtc *main_monitor_crtc;
 static drmModeConnector *main_monitor_connector;
@@ -81,13 +97,72 @@ static void drm_enable_crtc(int drm_fd, drmModeCrtc *crtc,
     }
 }
 
+static void drm_page_flip_handler(int fd __unused, unsigned int frame __unused,
+                                  unsigned int sec __unused,
+                                  unsigned int usec __unused,
+                                  void *data __unused)
+{
+    if (pending_buffer >= 0) {
+        displayed_buffer = pending_buffer;
+        pending_buffer = -1;
+    }
+}
+
+static void drm_handle_events(minui_backend* backend __unused)
+{
+    drmEventContext evctx;
+    memset(&evctx, 0, sizeof(evctx));
+    evctx.version = 2;
+    evctx.page_flip_handler = drm_page_flip_handler;
+
+    if (drmHandleEvent(drm_fd, &evctx) != 0) {
+        printf("drmHandleEvent failed\n");
+    }
+}
+
+// Wait for the queued page flip (if any) to complete. Only one flip can be
+// queued at a time.
+static void drm_wait_for_flip()
+{
+    while (pending_buffer >= 0) {
+        struct pollfd pfd;
+        pfd.fd = drm_fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        int ret = poll(&pfd, 1, PAGE_FLIP_TIMEOUT_MS);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret <= 0) {
+            // Don't hang if the driver never sends the event
+            printf("Timed out waiting for page flip\n");
+            drm_page_flip_handler(drm_fd, 0, 0, 0, nullptr);
+            break;
+        }
+
+        drm_handle_events(nullptr);
+    }
+}
+
+static int drm_event_fd(minui_backend* backend __unused)
+{
+    return drm_fd;
+}
+
+static int drm_refresh_rate(minui_backend* backend __unused)
+{
+    return main_monitor_crtc ? main_monitor_crtc->mode.vrefresh : 0;
+}
+
 static void drm_blank(minui_backend* backend __unused, bool blank)
 {
+    drm_wait_for_flip();
+
     if (blank) {
         drm_disable_crtc(drm_fd, main_monitor_crtc);
     } else {
         drm_enable_crtc(drm_fd, main_monitor_crtc,
-                        drm_surfaces[current_buffer]);
+                        drm_surfaces[displayed_buffer]);
     }
 }
 
@@ -224,6 +299,7 @@ static drm_surface *drm_create_surface(int width, int height)
     surface->base.row_bytes = create_dumb.pitch;
     surface->base.pixel_bytes = create_dumb.bpp / 8;
     surface->base.format = base_format;
+    surface->stale = true;
     surface->base.data = (unsigned char*)
                          mmap(nullptr,
                               surface->base.height * surface->base.row_bytes,
@@ -473,19 +549,24 @@ static GRSurface* drm_init(minui_backend* backend __unused)
 
     drmModeFreeResources(res);
 
-    drm_surfaces[0] = drm_create_surface(width, height);
-    drm_surfaces[1] = drm_create_surface(width, height);
-    if (!drm_surfaces[0] || !drm_surfaces[1]) {
-        drm_destroy_surface(drm_surfaces[0]);
-        drm_destroy_surface(drm_surfaces[1]);
-        drmModeFreeResources(res);
-        close(drm_fd);
-        return nullptr;
+    for (i = 0; i < NUM_BUFFERS; ++i) {
+        drm_surfaces[i] = drm_create_surface(width, height);
+        if (!drm_surfaces[i]) {
+            while (i-- > 0) {
+                drm_destroy_surface(drm_surfaces[i]);
+                drm_surfaces[i] = nullptr;
+            }
+            close(drm_fd);
+            return nullptr;
+        }
     }
 
     current_buffer = 0;
+    displayed_buffer = 1;
+    pending_buffer = -1;
+    last_damage = { 0, 0, width, height };
 
-    drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[1]);
+    drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[displayed_buffer]);
 
     return &(drm_surfaces[0]->base);
 }
@@ -494,21 +575,62 @@ static GRSurface* drm_flip(minui_backend* backend __unused)
 {
     int ret;
 
+    // If the previous frame is still queued, this only blocks until the
+    // next vblank
+    drm_wait_for_flip();
+
     ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
-                          drm_surfaces[current_buffer]->fb_id, 0, nullptr);
+                          drm_surfaces[current_buffer]->fb_id,
+                          DRM_MODE_PAGE_FLIP_EVENT, nullptr);
     if (ret < 0) {
         printf("drmModePageFlip failed ret=%d\n", ret);
         return nullptr;
     }
-    current_buffer = 1 - current_buffer;
+    pending_buffer = current_buffer;
+
+    // Draw the next frame into the buffer that is neither displayed nor
+    // queued
+    for (int i = 0; i < NUM_BUFFERS; ++i) {
+        if (i != displayed_buffer && i != pending_buffer) {
+            current_buffer = i;
+            break;
+        }
+    }
     return &(drm_surfaces[current_buffer]->base);
 }
 
+static GRSurface* drm_flip_region(minui_backend* backend,
+                                  const GRRect* r)
+{
+    GRSurface *queued = &(drm_surfaces[current_buffer]->base);
+    GRSurface *next = drm_flip(backend);
+    if (!next) {
+        return nullptr;
+    }
+
+    // The new drawing surface holds the frame from before the previous one,
+    // so it lacks the regions that changed in the last two frames
+    drm_surface *surface = drm_surfaces[current_buffer];
+    GRRect copy;
+    if (surface->stale) {
+        copy = { 0, 0, queued->width, queued->height };
+        surface->stale = false;
+    } else {
+        copy = gr_rect_union(r, &last_damage);
+    }
+    gr_copy_rect(next->data, queued->data, queued, &copy);
+    last_damage = *r;
+    return next;
+}
+
 static void drm_exit(minui_backend* backend __unused)
 {
+    drm_wait_for_flip();
     drm_disable_crtc(drm_fd, main_monitor_crtc);
-    drm_destroy_surface(drm_surfaces[0]);
-    drm_destroy_surface(drm_surfaces[1]);
+    for (int i = 0; i < NUM_BUFFERS; ++i) {
+        drm_destroy_surface(drm_surfaces[i]);
+        drm_surfaces[i] = nullptr;
+    }
     drmModeFreeCrtc(main_monitor_crtc);
     drmModeFreeConnector(main_monitor_connector);
     close(drm_fd);
@@ -520,6 +642,10 @@ static minui_backend drm_backend = {
     .flip = drm_flip,
     .blank = drm_blank,
     .exit = drm_exit,
+    .flip_region = drm_flip_region,
+    .event_fd = drm_event_fd,
+    .handle_events = drm_handle_events,
+    .refresh_rate = drm_refresh_rate,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(drm)() {
@@ -35,17 +35,21 @@
 #include "config/config.hpp"
 #include "minui.h"
 #include "graphics.h"
+#include "pixel_ops.h"
 #include <pixelflinger/pixelflinger.h>
 
 static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
+static GRSurface* fbdev_flip_region(minui_backend*, const GRRect*);
 
 static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = nullptr;
 static int displayed_buffer;
+// Region passed to the previous fbdev_flip_region() call
+static GRRect last_damage;
 
 static fb_var_screeninfo vi;
 static int fb_fd = -1;
@@ -56,6 +60,7 @@ static minui_backend my_backend = {
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .flip_region = fbdev_flip_region,
 };
 
 extern "C" struct minui_backend * BACKEND_FUNCTION(fbdev)()
@@ -272,6 +277,11 @@ static GRSurface* fbdev_init(minui_backend* backend)
 
     smem_len = fi.smem_len;
 
+    // Rotating the screen always needs the whole frame
+    if (tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen) {
+        backend->flip_region = nullptr;
+    }
+
     return gr_draw;
 }
 
@@ -279,15 +289,8 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
 {
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
         // In case of BGRA, do some byte swapping
-        unsigned int idx;
-        unsigned char tmp;
-        unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
-                idx += 4) {
-            tmp = ucfb_vaddr[idx];
-            ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
-            ucfb_vaddr[idx + 2] = tmp;
-        }
+        uint32_t *px = reinterpret_cast<uint32_t *>(gr_draw->data);
+        gr_px_swap_rb(px, px, gr_draw->height * gr_draw->row_bytes / 4);
     }
     if (!(tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen)) {
         if (double_buffered) {
@@ -333,6 +336,33 @@ static GRSurface* fbdev_flip(minui_backend* backend __unused)
     return gr_draw;
 }
 
+static GRSurface* fbdev_flip_region(minui_backend* backend __unused,
+                                    const GRRect* r)
+{
+    if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
+        // Only swap the pixels that were redrawn. Everything else in the
+        // in-memory surface was already swapped by a previous flip.
+        for (int y = r->y; y < r->y + r->h; ++y) {
+            uint32_t *px = reinterpret_cast<uint32_t *>(
+                    gr_draw->data + y * gr_draw->row_bytes) + r->x;
+            gr_px_swap_rb(px, px, r->w);
+        }
+    }
+
+    if (double_buffered) {
+        // The back buffer does not have the previous frame's changes yet
+        GRRect copy = gr_rect_union(r, &last_damage);
+        gr_copy_rect(gr_framebuffer[1-displayed_buffer].data, gr_draw->data,
+                     gr_draw, &copy);
+        set_displayed_framebuffer(1-displayed_buffer);
+    } else {
+        gr_copy_rect(gr_framebuffer[0].data, gr_draw->data, gr_draw, r);
+    }
+
+    last_damage = *r;
+    return gr_draw;
+}
+
 static void fbdev_exit(minui_backend* backend __unused)
 {
     close(fb_fd);
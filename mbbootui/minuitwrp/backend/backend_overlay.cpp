@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,6 +43,7 @@
 #include "config/config.hpp"
 #include "minui.h"
 #include "graphics.h"
+#include "pixel_ops.h"
 #include <pixelflinger/pixelflinger.h>
 
 #define MDP_V4_0 400
@@ -50,7 +53,11 @@ static GRSurface* overlay_init(minui_backend*);
 static GRSurface* overlay_flip(minui_backend*);
 static void overlay_blank(minui_backend*, bool);
 static void overlay_exit(minui_backend*);
+#ifdef MSM_BSP
+static GRSurface* overlay_flip_region(minui_backend*, const GRRect*);
+#endif
 
+// Format and layout of the drawing surfaces
 static GRSurface gr_framebuffer;
 static GRSurface* gr_draw = nullptr;
 
@@ -70,6 +77,7 @@ typedef struct
     int size;
     int ion_fd;
     int mem_fd;
+    bool cached;
     struct ion_handle_data handle_data;
 } memInfo;
 
@@ -77,7 +85,31 @@ typedef struct
 static int overlayL_id = MSMFB_NEW_REQUEST;
 static int overlayR_id = MSMFB_NEW_REQUEST;
 
-static memInfo mem_info;
+static memInfo mem_info = { nullptr, 0, -1, -1, false, {} };
+
+// Frames are drawn directly into the ION buffers if the CPU mapping is cached,
+// which makes blending (reading back pixels) fast. With an uncached mapping,
+// frames are drawn into gr_staging and the damaged region is copied to the ION
+// buffer that is played next.
+#define MAX_ION_BUFFERS 2
+static GRSurface gr_ion_buffers[MAX_ION_BUFFERS];
+static int num_ion_buffers = 0;
+static size_t ion_buffer_stride = 0;
+// Buffer that is drawn into next (the other one is being displayed)
+static int draw_buffer = 0;
+static GRSurface gr_staging;
+static bool use_staging = false;
+// Region passed to the previous overlay_flip_region() call
+static GRRect last_damage;
+
+// Partial update (ROI) support published by the panel driver
+static bool partial_update = false;
+static int roi_x_align = 1;
+static int roi_w_align = 1;
+static int roi_y_align = 1;
+static int roi_h_align = 1;
+static int roi_min_w = 0;
+static int roi_min_h = 0;
 
 static int map_mdp_pixel_format()
 {
@@ -100,6 +132,9 @@ static minui_backend my_backend = {
     .flip = overlay_flip,
     .blank = overlay_blank,
     .exit = overlay_exit,
+#ifdef MSM_BSP
+    .flip_region = overlay_flip_region,
+#endif
 };
 
 bool target_has_overlay(char *version)
@@ -243,7 +278,7 @@ int free_ion_mem(void)
 {
     int ret = 0;
 
-    if (mem_info.mem_buf) {
+    if (mem_info.mem_buf && mem_info.mem_buf != MAP_FAILED) {
         munmap(mem_info.mem_buf, mem_info.size);
     }
 
@@ -267,7 +302,7 @@ int free_ion_mem(void)
     return 0;
 }
 
-int alloc_ion_mem(unsigned int size)
+int alloc_ion_mem(unsigned int size, bool cached)
 {
     int result;
     struct ion_fd_data fd_data;
@@ -279,7 +314,7 @@ int alloc_ion_mem(unsigned int size)
         return -errno;
     }
 
-    ionAllocData.flags = 0;
+    ionAllocData.flags = cached ? ION_FLAG_CACHED : 0;
     ionAllocData.len = size;
     ionAllocData.align = sysconf(_SC_PAGESIZE);
 #ifdef NEW_ION_HEAP
@@ -294,6 +329,7 @@ int alloc_ion_mem(unsigned int size)
     if (result) {
         perror("ION_IOC_ALLOC Failed ");
         close(mem_info.ion_fd);
+        mem_info.ion_fd = -1;
         return result;
     }
 
@@ -308,8 +344,10 @@ int alloc_ion_mem(unsigned int size)
     mem_info.mem_buf = (unsigned char *)mmap(nullptr, size, PROT_READ |
                 PROT_WRITE, MAP_SHARED, fd_data.fd, 0);
     mem_info.mem_fd = fd_data.fd;
+    mem_info.size = size;
+    mem_info.cached = cached;
 
-    if (!mem_info.mem_buf) {
+    if (mem_info.mem_buf == MAP_FAILED) {
         perror("ERROR: mem_buf MAP_FAILED ");
         free_ion_mem();
         return -ENOMEM;
@@ -318,6 +356,75 @@ int alloc_ion_mem(unsigned int size)
     return 0;
 }
 
+// Write back the CPU cache for a range of the ION buffer before MDP reads it
+int clean_ion_cache(size_t offset, size_t size)
+{
+    if (!mem_info.cached || size == 0) {
+        return 0;
+    }
+
+    struct ion_flush_data flush_data;
+    memset(&flush_data, 0, sizeof(flush_data));
+    flush_data.handle = mem_info.handle_data.handle;
+    flush_data.fd = mem_info.mem_fd;
+    flush_data.vaddr = mem_info.mem_buf + offset;
+    flush_data.offset = offset;
+    flush_data.length = size;
+
+    struct ion_custom_data custom_data;
+    custom_data.cmd = ION_IOC_CLEAN_CACHES;
+    custom_data.arg = reinterpret_cast<unsigned long>(&flush_data);
+
+    int ret = ioctl(mem_info.ion_fd, ION_IOC_CUSTOM, &custom_data);
+    if (ret < 0) {
+        perror("ION_IOC_CLEAN_CACHES Failed ");
+    }
+    return ret;
+}
+
+// Allocate the ION buffers. Double buffering with a cached mapping is tried
+// first, then uncached double buffering, and finally the single uncached buffer
+// that older devices have always used.
+int alloc_ion_buffers(void)
+{
+    static const struct {
+        int buffers;
+        bool cached;
+    } configs[] = {
+        { 2, true },
+        { 2, false },
+        { 1, false },
+    };
+
+    ion_buffer_stride = ALIGN(frame_size, (size_t) sysconf(_SC_PAGESIZE));
+
+    for (auto const &config : configs) {
+        if (alloc_ion_mem(ion_buffer_stride * config.buffers,
+                          config.cached) < 0) {
+            continue;
+        }
+
+        // Kernels without the MSM cache maintenance ioctls cannot use cached
+        // buffers for scanout
+        if (config.cached && clean_ion_cache(0, mem_info.size) < 0) {
+            free_ion_mem();
+            continue;
+        }
+
+        num_ion_buffers = config.buffers;
+        for (int i = 0; i < num_ion_buffers; ++i) {
+            gr_ion_buffers[i] = gr_framebuffer;
+            gr_ion_buffers[i].data = mem_info.mem_buf + i * ion_buffer_stride;
+        }
+
+        printf("Using %d %s ION buffer(s)\n", num_ion_buffers,
+               config.cached ? "cached" : "uncached");
+        return 0;
+    }
+
+    return -ENOMEM;
+}
+
 bool isDisplaySplit(void)
 {
     if (vi.xres > MAX_DISPLAY_DIM) {
@@ -440,7 +547,91 @@ int allocate_overlay(int fd, GRSurface gr_fb)
     return 0;
 }
 
-int overlay_display_frame(int fd, void* data, size_t size)
+// Read the partial update capabilities from the panel info, which has one
+// "key=value" pair per line
+void read_partial_update_info(void)
+{
+    partial_update = false;
+
+    // The ROI is in panel coordinates, so it does not match the drawing
+    // surface when MDP rotates the overlay. Split displays would need one ROI
+    // per mixer.
+    if ((tw_device.tw_flags() & mb::device::TwFlag::BoardHasFlippedScreen)
+            || isDisplaySplit()) {
+        return;
+    }
+
+    FILE *fp = fopen("/sys/class/graphics/fb0/msm_fb_panel_info", "re");
+    if (!fp) {
+        return;
+    }
+
+    char line[64];
+    while (fgets(line, sizeof(line), fp)) {
+        char *value = strchr(line, '=');
+        if (!value) {
+            continue;
+        }
+        *value++ = '\0';
+
+        int n = atoi(value);
+        if (strcmp(line, "pu_en") == 0) {
+            partial_update = n > 0;
+        } else if (strcmp(line, "xstart") == 0) {
+            roi_x_align = n > 0 ? n : 1;
+        } else if (strcmp(line, "walign") == 0) {
+            roi_w_align = n > 0 ? n : 1;
+        } else if (strcmp(line, "ystart") == 0) {
+            roi_y_align = n > 0 ? n : 1;
+        } else if (strcmp(line, "halign") == 0) {
+            roi_h_align = n > 0 ? n : 1;
+        } else if (strcmp(line, "min_w") == 0) {
+            roi_min_w = n;
+        } else if (strcmp(line, "min_h") == 0) {
+            roi_min_h = n;
+        }
+    }
+
+    fclose(fp);
+
+    if (partial_update) {
+        printf("Panel supports partial updates\n");
+    }
+}
+
+// Expand a damaged region to the ROI alignment required by the panel. Returns
+// false if the whole screen must be updated.
+static bool get_commit_roi(const GRRect *r, mdp_rect *roi)
+{
+    if (!partial_update || gr_rect_empty(r)) {
+        return false;
+    }
+
+    int x1 = r->x / roi_x_align * roi_x_align;
+    int y1 = r->y / roi_y_align * roi_y_align;
+    int w = ALIGN(std::max(r->x + r->w - x1, roi_min_w), roi_w_align);
+    int h = ALIGN(std::max(r->y + r->h - y1, roi_min_h), roi_h_align);
+
+    x1 = std::max(std::min(x1, gr_framebuffer.width - w), 0);
+    y1 = std::max(std::min(y1, gr_framebuffer.height - h), 0);
+    w = std::min(w, gr_framebuffer.width - x1);
+    h = std::min(h, gr_framebuffer.height - y1);
+
+    if (w >= gr_framebuffer.width && h >= gr_framebuffer.height) {
+        return false;
+    }
+
+    roi->x = x1;
+    roi->y = y1;
+    roi->w = w;
+    roi->h = h;
+    return true;
+}
+
+// Play the ION buffer at `offset` on the overlay(s) and commit it. If `damage`
+// is not null, only that region is sent to the panel if it supports partial
+// updates.
+int overlay_display_frame(int fd, uint32_t offset, const GRRect *damage)
 {
     int ret = 0;
     struct msmfb_overlay_data ovdataL, ovdataR;
@@ -452,13 +643,11 @@ int overlay_display_frame(int fd, void* data, size_t size)
             return -EINVAL;
         }
 
-        memcpy(mem_info.mem_buf, data, size);
-
         memset(&ovdataL, 0, sizeof(struct msmfb_overlay_data));
 
         ovdataL.id = overlayL_id;
         ovdataL.data.flags = 0;
-        ovdataL.data.offset = 0;
+        ovdataL.data.offset = offset;
         ovdataL.data.memory_id = mem_info.mem_fd;
         ret = ioctl(fd, MSMFB_OVERLAY_PLAY, &ovdataL);
         if (ret < 0) {
@@ -473,13 +662,11 @@ int overlay_display_frame(int fd, void* data, size_t size)
             return -EINVAL;
         }
 
-        memcpy(mem_info.mem_buf, data, size);
-
         memset(&ovdataL, 0, sizeof(struct msmfb_overlay_data));
 
         ovdataL.id = overlayL_id;
         ovdataL.data.flags = 0;
-        ovdataL.data.offset = 0;
+        ovdataL.data.offset = offset;
         ovdataL.data.memory_id = mem_info.mem_fd;
         ret = ioctl(fd, MSMFB_OVERLAY_PLAY, &ovdataL);
         if (ret < 0) {
@@ -495,7 +682,7 @@ int overlay_display_frame(int fd, void* data, size_t size)
 
         ovdataR.id = overlayR_id;
         ovdataR.data.flags = 0;
-        ovdataR.data.offset = 0;
+        ovdataR.data.offset = offset;
         ovdataR.data.memory_id = mem_info.mem_fd;
         ret = ioctl(fd, MSMFB_OVERLAY_PLAY, &ovdataR);
         if (ret < 0) {
@@ -506,7 +693,15 @@ int overlay_display_frame(int fd, void* data, size_t size)
     memset(&ext_commit, 0, sizeof(struct mdp_display_commit));
     ext_commit.flags = MDP_DISPLAY_COMMIT_OVERLAY;
     ext_commit.wait_for_finish = 1;
+    // A zero ROI updates the whole panel
+    bool has_roi = damage && get_commit_roi(damage, &ext_commit.roi);
     ret = ioctl(fd, MSMFB_DISPLAY_COMMIT, &ext_commit);
+    if (ret < 0 && has_roi) {
+        perror("Partial update commit failed, disabling partial updates");
+        partial_update = false;
+        memset(&ext_commit.roi, 0, sizeof(ext_commit.roi));
+        ret = ioctl(fd, MSMFB_DISPLAY_COMMIT, &ext_commit);
+    }
     if (ret < 0) {
         perror("overlay_display_frame failed, overlay commit Failed\n!");
     }
@@ -514,25 +709,71 @@ int overlay_display_frame(int fd, void* data, size_t size)
     return ret;
 }
 
-static GRSurface* overlay_flip(minui_backend* backend __unused)
+// Byte offset and size of the rows covered by a region
+static void rect_rows(const GRRect *r, size_t *offset, size_t *size)
+{
+    if (gr_rect_empty(r)) {
+        *offset = 0;
+        *size = 0;
+    } else {
+        *offset = r->y * gr_framebuffer.row_bytes;
+        *size = r->h * gr_framebuffer.row_bytes;
+    }
+}
+
+static GRSurface* overlay_flip_region(minui_backend* backend __unused,
+                                      const GRRect* r)
 {
     if (tw_device.tw_pixel_format() == mb::device::TwPixelFormat::Bgra8888) {
-        // In case of BGRA, do some byte swapping
-        unsigned int idx;
-        unsigned char tmp;
-        unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-        for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
-                idx += 4) {
-            tmp = ucfb_vaddr[idx];
-            ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
-            ucfb_vaddr[idx + 2] = tmp;
+        // Only swap the pixels that were redrawn. Everything else in the
+        // drawing surface was already swapped by a previous flip.
+        for (int y = r->y; y < r->y + r->h; ++y) {
+            uint32_t *px = reinterpret_cast<uint32_t *>(
+                    gr_draw->data + y * gr_draw->row_bytes) + r->x;
+            gr_px_swap_rb(px, px, r->w);
+        }
+    }
+
+    GRSurface *buffer = &gr_ion_buffers[draw_buffer];
+    // With double buffering, the buffer does not have the previous frame's
+    // changes yet
+    GRRect changed = num_ion_buffers > 1 ? gr_rect_union(r, &last_damage) : *r;
+
+    if (use_staging) {
+        gr_copy_rect(buffer->data, gr_staging.data, &gr_framebuffer, &changed);
+    } else {
+        // The previous frame's changes were copied into this buffer right
+        // after the previous flip
+        size_t offset;
+        size_t size;
+        rect_rows(&changed, &offset, &size);
+        clean_ion_cache(draw_buffer * ion_buffer_stride + offset, size);
+    }
+
+    overlay_display_frame(fb_fd, draw_buffer * ion_buffer_stride, r);
+
+    if (num_ion_buffers > 1) {
+        int displayed = draw_buffer;
+        draw_buffer = 1 - draw_buffer;
+
+        if (!use_staging) {
+            // Bring the new drawing buffer up to date with what is displayed
+            gr_copy_rect(gr_ion_buffers[draw_buffer].data,
+                         gr_ion_buffers[displayed].data, &gr_framebuffer, r);
+            gr_draw = &gr_ion_buffers[draw_buffer];
         }
     }
-    // Copy from the in-memory surface to the framebuffer.
-    overlay_display_frame(fb_fd, gr_draw->data, frame_size);
+
+    last_damage = *r;
     return gr_draw;
 }
 
+static GRSurface* overlay_flip(minui_backend* backend)
+{
+    GRRect r = { 0, 0, gr_draw->width, gr_draw->height };
+    return overlay_flip_region(backend, &r);
+}
+
 int free_overlay(int fd)
 {
     int ret = 0;
@@ -651,41 +892,61 @@ static GRSurface* overlay_init(minui_backend* backend)
     }
 
     frame_size = fi.line_length * vi.yres;
+    fb_fd = fd;
 
-    gr_framebuffer.data = reinterpret_cast<uint8_t*>(calloc(frame_size, 1));
-    if (gr_framebuffer.data == nullptr) {
-        perror("failed to calloc framebuffer");
-        close(fd);
+    if (alloc_ion_buffers() < 0) {
+        printf("Failed to allocate ION memory for the overlay\n");
         return nullptr;
     }
 
-    gr_draw = &gr_framebuffer;
-    fb_fd = fd;
+    for (int i = 0; i < num_ion_buffers; ++i) {
+        memset(gr_ion_buffers[i].data, 0, frame_size);
+    }
+    clean_ion_cache(0, mem_info.size);
+
+    use_staging = !mem_info.cached;
+    if (use_staging) {
+        gr_staging = gr_framebuffer;
+        gr_staging.data = reinterpret_cast<uint8_t*>(calloc(frame_size, 1));
+        if (gr_staging.data == nullptr) {
+            perror("failed to calloc framebuffer");
+            return nullptr;
+        }
+        gr_draw = &gr_staging;
+    } else {
+        gr_draw = &gr_ion_buffers[0];
+    }
+
+    draw_buffer = 0;
+    last_damage = { 0, 0, 0, 0 };
 
     printf("framebuffer: %d (%d x %d)\n", fb_fd, gr_draw->width, gr_draw->height);
 
     overlay_blank(backend, true);
     overlay_blank(backend, false);
 
-    if (!alloc_ion_mem(frame_size)) {
-        allocate_overlay(fb_fd, gr_framebuffer);
+    if (allocate_overlay(fb_fd, gr_framebuffer) < 0) {
+        return nullptr;
     }
 
+    read_partial_update_info();
+
     return gr_draw;
 }
 
 static void overlay_exit(minui_backend* backend __unused)
 {
-    free_overlay(fb_fd);
-    free_ion_mem();
+    if (fb_fd >= 0) {
+        free_overlay(fb_fd);
+        close(fb_fd);
+        fb_fd = -1;
+    }
 
-    close(fb_fd);
-    fb_fd = -1;
+    free_ion_mem();
+    num_ion_buffers = 0;
 
-    if (gr_draw) {
-        free(gr_draw->data);
-        free(gr_draw);
-    }
+    free(gr_staging.data);
+    gr_staging.data = nullptr;
     gr_draw = nullptr;
 }
 #else // MSM_BSP
@@ -776,6 +776,19 @@ int ev_get(struct input_event *ev, int timeout_ms)
     return -2;
 }
 
+unsigned ev_get_fds(struct pollfd *fds, unsigned max_fds)
+{
+    unsigned n;
+
+    for (n = 0; n < ev_count && n < max_fds; n++) {
+        fds[n].fd = ev_fds[n].fd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+    }
+
+    return n;
+}
+
 int ev_wait(int timeout)
 {
     (void) timeout;
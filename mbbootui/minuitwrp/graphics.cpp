@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,6 +40,7 @@
 #include "backend/backend.h"
 #include "minui.h"
 #include "graphics.h"
+#include "pixel_ops.h"
 #include "gui/placement.h"
 
 struct GRFont
@@ -71,6 +75,49 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+static bool gr_base_clip_enabled = false;
+static GRRect gr_base_clip;
+
+// Kernels for drawing to gr_draw or nullptr if pixelflinger must be used
+static const gr_pixel_ops *gr_px_ops = nullptr;
+// Current color in the component order that pixelflinger receives
+static uint32_t gr_current_px = 0xffffffff;
+// Current pixelflinger scissor state
+static bool gr_scissor_enabled = false;
+static GRRect gr_scissor;
+
+// Intersect a rectangle with the drawing surface and the scissor rectangle.
+// Returns false if there is nothing left to draw.
+static bool gr_clip_rect(int *x, int *y, int *w, int *h)
+{
+    int x1 = std::max(*x, 0);
+    int y1 = std::max(*y, 0);
+    int x2 = std::min(*x + *w, gr_draw->width);
+    int y2 = std::min(*y + *h, gr_draw->height);
+
+    if (gr_scissor_enabled) {
+        x1 = std::max(x1, gr_scissor.x);
+        y1 = std::max(y1, gr_scissor.y);
+        x2 = std::min(x2, gr_scissor.x + gr_scissor.w);
+        y2 = std::min(y2, gr_scissor.y + gr_scissor.h);
+    }
+
+    if (x2 <= x1 || y2 <= y1) {
+        return false;
+    }
+
+    *x = x1;
+    *y = y1;
+    *w = x2 - x1;
+    *h = y2 - y1;
+    return true;
+}
+
+static inline uint32_t * gr_draw_row(int y)
+{
+    return reinterpret_cast<uint32_t *>(gr_draw->data + y * gr_draw->row_bytes);
+}
+
 #if 0 // unused
 static bool outside(int x, int y)
 {
@@ -136,15 +183,52 @@ int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, in
 void gr_clip(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
+
+    if (gr_base_clip_enabled) {
+        int x2 = std::min(x + w, gr_base_clip.x + gr_base_clip.w);
+        int y2 = std::min(y + h, gr_base_clip.y + gr_base_clip.h);
+        x = std::max(x, gr_base_clip.x);
+        y = std::max(y, gr_base_clip.y);
+        w = std::max(x2 - x, 0);
+        h = std::max(y2 - y, 0);
+    }
+
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+    gr_scissor = { x, y, w, h };
+    gr_scissor_enabled = true;
 }
 
 void gr_noclip()
 {
     GGLContext *gl = gr_context;
+
+    if (gr_base_clip_enabled) {
+        gl->scissor(gl, gr_base_clip.x, gr_base_clip.y,
+                    gr_base_clip.w, gr_base_clip.h);
+        gl->enable(gl, GGL_SCISSOR_TEST);
+        gr_scissor = gr_base_clip;
+        gr_scissor_enabled = true;
+        return;
+    }
+
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
+    gr_scissor_enabled = false;
+}
+
+void gr_set_base_clip(int x, int y, int w, int h)
+{
+    gr_base_clip_enabled = false;
+    gr_clip(x, y, w, h);
+    gr_base_clip = { x, y, w, h };
+    gr_base_clip_enabled = true;
+}
+
+void gr_clear_base_clip(void)
+{
+    gr_base_clip_enabled = false;
+    gr_noclip();
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
@@ -171,6 +255,7 @@ gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsign
     const int diameter = radius*2 + 1;
     const int radius_check = radius*radius + radius*0.8;
     const uint32_t px = (a << 24) | (b << 16) | (g << 8) | r;
+    const gr_pixel_ops *ops = gr_pixel_ops_for_format(GGL_PIXEL_FORMAT_RGBA_8888);
     uint32_t *data;
 
     surface = (GGLSurface *) malloc(sizeof(GGLSurface));
@@ -187,11 +272,21 @@ gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsign
     surface->format = GGL_PIXEL_FORMAT_RGBA_8888;
 
     for (ry = -radius; ry <= radius; ++ry) {
-        for (rx = -radius; rx <= radius; ++rx) {
-            if (rx*rx+ry*ry <= radius_check) {
-                *(data + diameter * (radius + ry) + (radius+rx)) = px;
-            }
+        // Find the widest span where rx*rx + ry*ry <= radius_check
+        int remaining = radius_check - ry*ry;
+        if (remaining < 0) {
+            continue;
+        }
+        rx = static_cast<int>(sqrt(remaining));
+        while (rx * rx > remaining) {
+            --rx;
         }
+        while ((rx + 1) * (rx + 1) <= remaining) {
+            ++rx;
+        }
+        rx = std::min(rx, radius);
+
+        ops->fill(data + diameter * (radius + ry) + (radius - rx), px, 2*rx + 1);
     }
 
     return (gr_surface) surface;
@@ -207,11 +302,13 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
         color[1] = ((g << 8) | g) + 1;
         color[2] = ((r << 8) | b) + 1;
         color[3] = ((a << 8) | a) + 1;
+        gr_current_px = (a << 24) | (r << 16) | (g << 8) | b;
     } else {
         color[0] = ((r << 8) | r) + 1;
         color[1] = ((g << 8) | g) + 1;
         color[2] = ((b << 8) | b) + 1;
         color[3] = ((a << 8) | a) + 1;
+        gr_current_px = (a << 24) | (b << 16) | (g << 8) | r;
     }
     gl->color4xv(gl, color);
 
@@ -246,6 +343,20 @@ void gr_fill(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
 
+    if (gr_px_ops) {
+        if (!gr_clip_rect(&x, &y, &w, &h)) {
+            return;
+        }
+        for (int row = y; row < y + h; ++row) {
+            if (gr_is_curr_clr_opaque) {
+                gr_px_ops->fill(gr_draw_row(row) + x, gr_current_px, w);
+            } else {
+                gr_px_ops->blend_color(gr_draw_row(row) + x, gr_current_px, w);
+            }
+        }
+        return;
+    }
+
     if (gr_is_curr_clr_opaque) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -266,6 +377,33 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy)
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    // Opaque copies and alpha blending without scaling can skip pixelflinger
+    // as long as the source rectangle is inside the source surface
+    if (gr_px_ops
+            && (surface->format == GGL_PIXEL_FORMAT_RGBX_8888
+                    || surface->format == GGL_PIXEL_FORMAT_RGBA_8888)
+            && sx >= 0 && sy >= 0
+            && sx + w <= static_cast<int>(surface->width)
+            && sy + h <= static_cast<int>(surface->height)) {
+        int x = dx, y = dy;
+        if (!gr_clip_rect(&x, &y, &w, &h)) {
+            return;
+        }
+        sx += x - dx;
+        sy += y - dy;
+
+        const uint32_t *src = reinterpret_cast<const uint32_t *>(surface->data)
+                + sy * surface->stride + sx;
+        for (int row = y; row < y + h; ++row, src += surface->stride) {
+            if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
+                gr_px_ops->copy(gr_draw_row(row) + x, src, w);
+            } else {
+                gr_px_ops->blend(gr_draw_row(row) + x, src, w);
+            }
+        }
+        return;
+    }
+
     if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888) {
         gl->disable(gl, GGL_BLEND);
     }
@@ -300,15 +438,70 @@ unsigned int gr_get_height(gr_surface surface)
     return ((GGLSurface*) surface)->height;
 }
 
-void gr_flip()
+static void gr_set_draw_surface(GRSurface *surface)
 {
-    gr_draw = gr_backend->flip(gr_backend);
+    gr_draw = surface;
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
     gr_mem_surface.data = (GGLubyte*)gr_draw->data;
     gr_context->colorBuffer(gr_context, &gr_mem_surface);
 }
 
+void gr_flip()
+{
+    if (gr_backend->flip_region) {
+        GRRect r = { 0, 0, gr_draw->width, gr_draw->height };
+        gr_set_draw_surface(gr_backend->flip_region(gr_backend, &r));
+    } else {
+        gr_set_draw_surface(gr_backend->flip(gr_backend));
+    }
+}
+
+void gr_flip_region(int x, int y, int w, int h)
+{
+    if (!gr_backend->flip_region) {
+        gr_flip();
+        return;
+    }
+
+    // Clamp to the drawing surface
+    int x2 = std::min(x + w, gr_draw->width);
+    int y2 = std::min(y + h, gr_draw->height);
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+
+    GRRect r = { x, y, std::max(x2 - x, 0), std::max(y2 - y, 0) };
+    gr_set_draw_surface(gr_backend->flip_region(gr_backend, &r));
+}
+
+bool gr_has_flip_region(void)
+{
+    return gr_backend && gr_backend->flip_region;
+}
+
+int gr_fb_event_fd(void)
+{
+    if (gr_backend && gr_backend->event_fd && gr_backend->handle_events) {
+        return gr_backend->event_fd(gr_backend);
+    }
+    return -1;
+}
+
+void gr_fb_handle_events(void)
+{
+    if (gr_backend && gr_backend->handle_events) {
+        gr_backend->handle_events(gr_backend);
+    }
+}
+
+int gr_fb_refresh_rate(void)
+{
+    if (gr_backend && gr_backend->refresh_rate) {
+        return gr_backend->refresh_rate(gr_backend);
+    }
+    return 0;
+}
+
 static void get_memory_surface(GGLSurface* ms)
 {
     ms->version = sizeof(*ms);
@@ -362,6 +555,11 @@ int gr_init(void)
 
     // Set up pixelflinger
     get_memory_surface(&gr_mem_surface);
+
+    // 16bpp surfaces are still drawn by pixelflinger
+    if (gr_draw->pixel_bytes == 4) {
+        gr_px_ops = gr_pixel_ops_for_format(gr_draw->format);
+    }
     gglInit(&gr_context);
     GGLContext *gl = gr_context;
     gl->colorBuffer(gl, &gr_mem_surface);
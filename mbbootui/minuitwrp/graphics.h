@@ -17,8 +17,62 @@
 #ifndef _GRAPHICS_H_
 #define _GRAPHICS_H_
 
+#include <string.h>
+
 #include "minui.h"
 
+struct GRRect
+{
+    int x;
+    int y;
+    int w;
+    int h;
+};
+
+static inline bool gr_rect_empty(const GRRect *r)
+{
+    return r->w <= 0 || r->h <= 0;
+}
+
+// Bounding box of two rectangles. Empty rectangles are ignored.
+static inline GRRect gr_rect_union(const GRRect *a, const GRRect *b)
+{
+    if (gr_rect_empty(a)) {
+        return *b;
+    } else if (gr_rect_empty(b)) {
+        return *a;
+    }
+
+    int x1 = a->x < b->x ? a->x : b->x;
+    int y1 = a->y < b->y ? a->y : b->y;
+    int x2 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    int y2 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+    return { x1, y1, x2 - x1, y2 - y1 };
+}
+
+// Copy a region between two buffers with the same layout
+static inline void gr_copy_rect(unsigned char *dst, const unsigned char *src,
+                                const GRSurface *layout, const GRRect *r)
+{
+    if (gr_rect_empty(r)) {
+        return;
+    }
+
+    size_t offset = r->y * layout->row_bytes + r->x * layout->pixel_bytes;
+    size_t size = r->w * layout->pixel_bytes;
+
+    if (r->x == 0 && r->w == layout->width) {
+        memcpy(dst + offset, src + offset, r->h * layout->row_bytes);
+        return;
+    }
+
+    for (int y = 0; y < r->h; ++y) {
+        memcpy(dst + offset, src + offset, size);
+        offset += layout->row_bytes;
+    }
+}
+
 // TODO: lose the function pointers.
 struct minui_backend
 {
@@ -35,6 +89,25 @@ struct minui_backend
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Like flip(), but only the given region of the drawing surface changed
+    // since the previous flip. The returned drawing surface must contain
+    // everything that was displayed so that the next frame only needs to
+    // redraw the regions that change. May be null if the backend does not
+    // support partial updates.
+    GRSurface* (*flip_region)(minui_backend*, const GRRect*);
+
+    // Returns a file descriptor that becomes readable when there are display
+    // events (eg. completed page flips) to process or -1. May be null.
+    int (*event_fd)(minui_backend*);
+
+    // Processes the pending display events. Only called when event_fd() is
+    // readable. May be null.
+    void (*handle_events)(minui_backend*);
+
+    // Returns the display refresh rate in Hz or 0 if it is unknown. May be
+    // null.
+    int (*refresh_rate)(minui_backend*);
 };
 
 #endif
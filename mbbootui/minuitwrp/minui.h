@@ -49,11 +49,26 @@ int gr_fb_width(void);
 int gr_fb_height(void);
 gr_pixel *gr_fb_data(void);
 void gr_flip(void);
+// Like gr_flip(), but only copies the given region to the display if the
+// backend supports it
+void gr_flip_region(int x, int y, int w, int h);
+// Returns true if the drawing surface keeps its contents across flips so
+// that only the changed regions of a frame need to be redrawn
+bool gr_has_flip_region(void);
+// File descriptor to poll for display events (eg. completed page flips) or -1
+int gr_fb_event_fd(void);
+// Process display events once gr_fb_event_fd() is readable
+void gr_fb_handle_events(void);
+// Display refresh rate in Hz or 0 if it is unknown
+int gr_fb_refresh_rate(void);
 void gr_fb_blank(bool blank);
 
 void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
 void gr_clip(int x, int y, int w, int h);
 void gr_noclip();
+// Restrict all drawing, including gr_clip() regions, to the given rectangle
+void gr_set_base_clip(int x, int y, int w, int h);
+void gr_clear_base_clip(void);
 void gr_fill(int x, int y, int w, int h);
 void gr_line(int x0, int y0, int x1, int y1, int width);
 gr_surface gr_render_circle(int radius, unsigned char r, unsigned char g, unsigned char b, unsigned char a);
@@ -83,10 +98,14 @@ int gr_save_screenshot(const char *dest);
 // input event structure, include <linux/input.h> for the definition.
 // see http://www.mjmwired.net/kernel/Documentation/input/ for info.
 struct input_event;
+struct pollfd;
 
 int ev_init(void);
 void ev_exit(void);
 int ev_get(struct input_event *ev, int timeout_ms);
+// Copy the input device fds into fds (up to max_fds) so that callers can wait
+// for input in their own poll() call. Returns the number of fds copied.
+unsigned ev_get_fds(struct pollfd *fds, unsigned max_fds);
 int ev_has_mouse(void);
 
 // Resources
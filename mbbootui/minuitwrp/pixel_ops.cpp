@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2018 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pixel_ops.h"
+
+#include <string.h>
+
+#include <pixelflinger/pixelflinger.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define PIXEL_OPS_NEON 1
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#  define PIXEL_OPS_SSE2 1
+#  ifdef __SSSE3__
+#    include <tmmintrin.h>
+#    define PIXEL_OPS_SSSE3 1
+#  endif
+#endif
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#  error The pixel kernels assume a little endian CPU
+#endif
+
+static inline uint32_t swap_rb(uint32_t px)
+{
+    return (px & 0xff00ff00u) | ((px & 0xffu) << 16) | ((px >> 16) & 0xffu);
+}
+
+template<bool Swap>
+static inline uint32_t to_dst(uint32_t px)
+{
+    return Swap ? swap_rb(px) : px;
+}
+
+// Blend src over dst. Two channels are processed at a time and
+// (x + 128 + ((x + 128) >> 8)) >> 8 is used for an exact, rounded division by
+// 255, which matches what the SIMD implementations compute.
+static inline uint32_t blend_px(uint32_t dst, uint32_t src)
+{
+    uint32_t a = src >> 24;
+    if (a == 0xff) {
+        return src;
+    } else if (a == 0) {
+        return dst;
+    }
+    uint32_t ia = 255 - a;
+
+    uint32_t rb = (src & 0xff00ff) * a + (dst & 0xff00ff) * ia + 0x800080;
+    rb = ((rb + ((rb >> 8) & 0xff00ff)) >> 8) & 0xff00ff;
+
+    uint32_t ga = ((src >> 8) & 0xff00ff) * a
+            + ((dst >> 8) & 0xff00ff) * ia + 0x800080;
+    ga = (ga + ((ga >> 8) & 0xff00ff)) & 0xff00ff00;
+
+    return rb | ga;
+}
+
+#if PIXEL_OPS_SSE2
+static inline __m128i swap_rb_sse2(__m128i px)
+{
+    __m128i ga = _mm_and_si128(px, _mm_set1_epi32(0xff00ff00));
+    __m128i rb = _mm_and_si128(px, _mm_set1_epi32(0x00ff00ff));
+    rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+    return _mm_or_si128(ga, rb);
+}
+
+static inline __m128i div255_sse2(__m128i x)
+{
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+// Blend 4 source pixels over 4 destination pixels
+static inline __m128i blend_sse2(__m128i dst, __m128i src)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i ff = _mm_set1_epi16(255);
+
+    // Replicate each pixel's alpha to all four 16-bit channels
+    __m128i a = _mm_srli_epi32(src, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    __m128i a_lo = _mm_unpacklo_epi32(a, a);
+    __m128i a_hi = _mm_unpackhi_epi32(a, a);
+
+    __m128i lo = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), a_lo),
+            _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero),
+                            _mm_sub_epi16(ff, a_lo)));
+    __m128i hi = _mm_add_epi16(
+            _mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), a_hi),
+            _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero),
+                            _mm_sub_epi16(ff, a_hi)));
+
+    return _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi));
+}
+#endif
+
+#if PIXEL_OPS_NEON
+static inline uint8x8_t blend_channel_neon(uint8x8_t dst, uint8x8_t src,
+                                           uint8x8_t a, uint8x8_t ia)
+{
+    uint16x8_t t = vmull_u8(src, a);
+    t = vmlal_u8(t, dst, ia);
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+#endif
+
+template<bool Swap>
+static void fill(uint32_t *dst, uint32_t color, size_t n)
+{
+    size_t i = 0;
+
+    color = to_dst<Swap>(color);
+
+#if PIXEL_OPS_NEON
+    uint32x4_t v = vdupq_n_u32(color);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, v);
+    }
+#elif PIXEL_OPS_SSE2
+    __m128i v = _mm_set1_epi32(static_cast<int>(color));
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), v);
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = color;
+    }
+}
+
+template<bool Swap>
+static void blend_color(uint32_t *dst, uint32_t color, size_t n)
+{
+    size_t i = 0;
+
+    color = to_dst<Swap>(color);
+
+    uint32_t a = color >> 24;
+    if (a == 0xff) {
+        fill<false>(dst, color, n);
+        return;
+    } else if (a == 0) {
+        return;
+    }
+
+#if PIXEL_OPS_NEON
+    uint8x8_t va = vdup_n_u8(static_cast<uint8_t>(a));
+    uint8x8_t via = vdup_n_u8(static_cast<uint8_t>(255 - a));
+    uint8x8_t vc[4];
+    for (int c = 0; c < 4; ++c) {
+        vc[c] = vdup_n_u8(static_cast<uint8_t>(color >> (c * 8)));
+    }
+    for (; i + 8 <= n; i += 8) {
+        uint8_t *p = reinterpret_cast<uint8_t *>(dst + i);
+        uint8x8x4_t d = vld4_u8(p);
+        for (int c = 0; c < 4; ++c) {
+            d.val[c] = blend_channel_neon(d.val[c], vc[c], va, via);
+        }
+        vst4_u8(p, d);
+    }
+#elif PIXEL_OPS_SSE2
+    __m128i src = _mm_set1_epi32(static_cast<int>(color));
+    for (; i + 4 <= n; i += 4) {
+        __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(p, blend_sse2(_mm_loadu_si128(p), src));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = blend_px(dst[i], color);
+    }
+}
+
+void gr_px_swap_rb(uint32_t *dst, const uint32_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if PIXEL_OPS_NEON
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t v = vld4_u8(reinterpret_cast<const uint8_t *>(src + i));
+        uint8x8_t tmp = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = tmp;
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + i), v);
+    }
+#elif PIXEL_OPS_SSE2
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         swap_rb_sse2(v));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = swap_rb(src[i]);
+    }
+}
+
+template<bool Swap>
+static void copy(uint32_t *dst, const uint32_t *src, size_t n)
+{
+    if (Swap) {
+        gr_px_swap_rb(dst, src, n);
+    } else {
+        memcpy(dst, src, n * sizeof(uint32_t));
+    }
+}
+
+template<bool Swap>
+static void blend(uint32_t *dst, const uint32_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if PIXEL_OPS_NEON
+    for (; i + 8 <= n; i += 8) {
+        uint8_t *p = reinterpret_cast<uint8_t *>(dst + i);
+        uint8x8x4_t s = vld4_u8(reinterpret_cast<const uint8_t *>(src + i));
+        if (Swap) {
+            uint8x8_t tmp = s.val[0];
+            s.val[0] = s.val[2];
+            s.val[2] = tmp;
+        }
+        uint8x8x4_t d = vld4_u8(p);
+        uint8x8_t ia = vmvn_u8(s.val[3]);
+        for (int c = 0; c < 4; ++c) {
+            d.val[c] = blend_channel_neon(d.val[c], s.val[c], s.val[3], ia);
+        }
+        vst4_u8(p, d);
+    }
+#elif PIXEL_OPS_SSE2
+    __m128i alpha_mask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    for (; i + 4 <= n; i += 4) {
+        __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        if (Swap) {
+            s = swap_rb_sse2(s);
+        }
+
+        // Images are mostly fully opaque or fully transparent
+        __m128i alpha = _mm_and_si128(s, alpha_mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask)) == 0xffff) {
+            _mm_storeu_si128(p, s);
+        } else if (_mm_movemask_epi8(_mm_cmpeq_epi32(
+                alpha, _mm_setzero_si128())) != 0xffff) {
+            _mm_storeu_si128(p, blend_sse2(_mm_loadu_si128(p), s));
+        }
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = blend_px(dst[i], to_dst<Swap>(src[i]));
+    }
+}
+
+void gr_px_gray_to_rgbx(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if PIXEL_OPS_NEON
+    uint8x8_t ff = vdup_n_u8(0xff);
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t v;
+        v.val[0] = v.val[1] = v.val[2] = vld1_u8(src + i);
+        v.val[3] = ff;
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + i), v);
+    }
+#elif PIXEL_OPS_SSE2
+    __m128i ff = _mm_set1_epi8(-1);
+    for (; i + 16 <= n; i += 16) {
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i gg_lo = _mm_unpacklo_epi8(g, g);
+        __m128i gg_hi = _mm_unpackhi_epi8(g, g);
+        __m128i ga_lo = _mm_unpacklo_epi8(g, ff);
+        __m128i ga_hi = _mm_unpackhi_epi8(g, ff);
+        __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(p, _mm_unpacklo_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128(p + 1, _mm_unpackhi_epi16(gg_lo, ga_lo));
+        _mm_storeu_si128(p + 2, _mm_unpacklo_epi16(gg_hi, ga_hi));
+        _mm_storeu_si128(p + 3, _mm_unpackhi_epi16(gg_hi, ga_hi));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        dst[i] = 0xff000000u | (src[i] << 16) | (src[i] << 8) | src[i];
+    }
+}
+
+void gr_px_rgb_to_rgbx(uint32_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+
+#if PIXEL_OPS_NEON
+    uint8x8_t ff = vdup_n_u8(0xff);
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x3_t rgb = vld3_u8(src + i * 3);
+        uint8x8x4_t v;
+        v.val[0] = rgb.val[0];
+        v.val[1] = rgb.val[1];
+        v.val[2] = rgb.val[2];
+        v.val[3] = ff;
+        vst4_u8(reinterpret_cast<uint8_t *>(dst + i), v);
+    }
+#elif PIXEL_OPS_SSSE3
+    __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                    6, 7, 8, -1, 9, 10, 11, -1);
+    __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+    // Each iteration reads 16 bytes, but only uses 12 of them
+    for (; i + 6 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(src + i * 3));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                         _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        const uint8_t *p = src + i * 3;
+        dst[i] = 0xff000000u | (p[2] << 16) | (p[1] << 8) | p[0];
+    }
+}
+
+static const gr_pixel_ops pixel_ops_rgba = {
+    .fill = fill<false>,
+    .blend_color = blend_color<false>,
+    .copy = copy<false>,
+    .blend = blend<false>,
+};
+
+static const gr_pixel_ops pixel_ops_bgra = {
+    .fill = fill<true>,
+    .blend_color = blend_color<true>,
+    .copy = copy<true>,
+    .blend = blend<true>,
+};
+
+const gr_pixel_ops * gr_pixel_ops_for_format(int format)
+{
+    switch (format) {
+    case GGL_PIXEL_FORMAT_RGBA_8888:
+    case GGL_PIXEL_FORMAT_RGBX_8888:
+        return &pixel_ops_rgba;
+    case GGL_PIXEL_FORMAT_BGRA_8888:
+        return &pixel_ops_bgra;
+    default:
+        return nullptr;
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2018 Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Pixel kernels used to bypass pixelflinger for the common 32bpp cases. Each
+// kernel has a NEON (ARM) or SSE2 (x86) implementation when the compiler
+// targets those instruction sets and a scalar implementation for everything
+// else and for the tail of each row.
+//
+// 32-bit pixels are stored as R, G, B, A bytes in memory (ie. the alpha
+// channel is in the high byte of the little endian uint32_t). Colors and
+// source pixels are always in that order. The kernels for a destination
+// surface in BGRA order swap the red and blue channels while drawing.
+
+struct gr_pixel_ops
+{
+    // dst[i] = color
+    void (*fill)(uint32_t *dst, uint32_t color, size_t n);
+    // dst[i] = color blended over dst[i] using the color's alpha
+    void (*blend_color)(uint32_t *dst, uint32_t color, size_t n);
+    // dst[i] = src[i]
+    void (*copy)(uint32_t *dst, const uint32_t *src, size_t n);
+    // dst[i] = src[i] blended over dst[i] using the source alpha
+    void (*blend)(uint32_t *dst, const uint32_t *src, size_t n);
+};
+
+// Returns the kernels for drawing to a surface with the given GGL pixel
+// format or nullptr if pixelflinger must be used for that format
+const gr_pixel_ops * gr_pixel_ops_for_format(int format);
+
+// Swap the red and blue channels (RGBA <-> BGRA). dst and src may be equal.
+void gr_px_swap_rb(uint32_t *dst, const uint32_t *src, size_t n);
+
+// Expand 8-bit grayscale pixels to RGBX
+void gr_px_gray_to_rgbx(uint32_t *dst, const uint8_t *src, size_t n);
+
+// Expand 24-bit RGB pixels to RGBX
+void gr_px_rgb_to_rgbx(uint32_t *dst, const uint8_t *src, size_t n);
@@ -38,6 +38,7 @@ extern "C" {
 #endif
 #include "config/config.hpp"
 #include "minui.h"
+#include "pixel_ops.h"
 
 #define SURFACE_DATA_ALIGNMENT 8
 
@@ -178,30 +179,17 @@ static void transform_rgb_to_draw(unsigned char* input_row,
                                   unsigned char* output_row,
                                   int channels, int width)
 {
-    int x;
-    unsigned char* ip = input_row;
-    unsigned char* op = output_row;
+    uint32_t* op = reinterpret_cast<uint32_t*>(output_row);
 
     switch (channels) {
     case 1:
         // expand gray level to RGBX
-        for (x = 0; x < width; ++x) {
-            *op++ = *ip;
-            *op++ = *ip;
-            *op++ = *ip;
-            *op++ = 0xff;
-            ip++;
-        }
+        gr_px_gray_to_rgbx(op, input_row, width);
         break;
 
     case 3:
-        // expand RGBA to RGBX
-        for (x = 0; x < width; ++x) {
-            *op++ = *ip++;
-            *op++ = *ip++;
-            *op++ = *ip++;
-            *op++ = 0xff;
-        }
+        // expand RGB to RGBX
+        gr_px_rgb_to_rgbx(op, input_row, width);
         break;
 
     case 4:
@@ -15,6 +15,14 @@
 #include <pixelflinger/pixelflinger.h>
 #include <pthread.h>
 
+// Glyphs are rasterized once into a per-font A_8 atlas and strings are drawn
+// from it glyph by glyph. Defining TW_TTF_STRING_CACHE additionally keeps a
+// separate surface for every rendered string, trading memory for a single
+// blit per string.
+#define GLYPH_ATLAS_WIDTH 512
+#define GLYPH_ATLAS_MIN_HEIGHT 64
+#define GLYPH_ATLAS_MAX_HEIGHT 2048
+
 #define STRING_CACHE_MAX_ENTRIES 400
 #define STRING_CACHE_TRUNCATE_ENTRIES 150
 
@@ -25,6 +33,14 @@ typedef struct
     char *path;
 } TrueTypeFontKey;
 
+typedef struct
+{
+    GGLSurface surface;
+    int shelf_x; // next free column in the current shelf
+    int shelf_y; // top row of the current shelf
+    int shelf_h; // height of the tallest glyph in the current shelf
+} GlyphAtlas;
+
 typedef struct
 {
     int type;
@@ -35,9 +51,12 @@ typedef struct
     int base;
     FT_Face face;
     Hashmap *glyph_cache;
+    GlyphAtlas atlas;
+#ifdef TW_TTF_STRING_CACHE
     Hashmap *string_cache;
     struct StringCacheEntry *string_cache_head;
     struct StringCacheEntry *string_cache_tail;
+#endif
     pthread_mutex_t mutex;
     TrueTypeFontKey *key;
 } TrueTypeFont;
@@ -45,9 +64,24 @@ typedef struct
 typedef struct
 {
     FT_BBox bbox;
-    FT_BitmapGlyph glyph;
+    int char_index;
+    int left;       // bitmap offset from the pen position
+    int top;        // bitmap offset from the baseline (upwards)
+    int width;      // bitmap size
+    int rows;
+    int advance;
+    int atlas_x;    // bitmap position in the atlas or -1 if it was evicted
+    int atlas_y;
 } TrueTypeCacheEntry;
 
+typedef struct
+{
+    TrueTypeCacheEntry *ent;
+    int x;          // pen position relative to the start of the string
+} GlyphPosition;
+
+#ifdef TW_TTF_STRING_CACHE
+
 typedef struct
 {
     char *text;
@@ -64,6 +98,7 @@ struct StringCacheEntry
 };
 
 typedef struct StringCacheEntry StringCacheEntry;
+#endif
 
 typedef struct
 {
@@ -148,6 +183,7 @@ int utf8_to_unicode(const char* pIn, unsigned int *pOut)
     return utf_bytes;
 }
 
+#ifdef TW_TTF_STRING_CACHE
 static bool gr_ttf_string_cache_equals(void *keyA, void *keyB)
 {
     StringCacheKey *a = (StringCacheKey *)keyA;
@@ -160,6 +196,7 @@ static int gr_ttf_string_cache_hash(void *key)
     StringCacheKey *k = (StringCacheKey *)key;
     return fnv_hash(k->text, strlen(k->text));
 }
+#endif
 
 static bool gr_ttf_font_cache_equals(void *keyA, void *keyB)
 {
@@ -232,7 +269,9 @@ void *gr_ttf_loadFont(const char *filename, int size, int dpi)
     res->base = -1;
     res->refcount = 1;
     res->glyph_cache = hashmapCreate(32, hashmapIntHash, hashmapIntEquals);
+#ifdef TW_TTF_STRING_CACHE
     res->string_cache = hashmapCreate(128, gr_ttf_string_cache_hash, gr_ttf_string_cache_equals);
+#endif
     pthread_mutex_init(&res->mutex, 0);
 
     if (!font_data.fonts) {
@@ -273,13 +312,12 @@ void *gr_ttf_scaleFont(void *font, int max_width, int measured_width)
 
 static bool gr_ttf_freeFontCache(void *key, void *value, void *context __unused)
 {
-    TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
-    FT_Done_Glyph((FT_Glyph)e->glyph);
-    free(e);
+    free(value);
     free(key);
     return true;
 }
 
+#ifdef TW_TTF_STRING_CACHE
 static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unused)
 {
     StringCacheKey *k = (StringCacheKey *)key;
@@ -291,6 +329,7 @@ static bool gr_ttf_freeStringCache(void *key, void *value, void *context __unuse
     free(e);
     return true;
 }
+#endif
 
 void gr_ttf_freeFont(void *font)
 {
@@ -310,10 +349,13 @@ void gr_ttf_freeFont(void *font)
         free(d->key);
 
         FT_Done_Face(d->face);
+#ifdef TW_TTF_STRING_CACHE
         hashmapForEach(d->string_cache, gr_ttf_freeStringCache, nullptr);
         hashmapFree(d->string_cache);
+#endif
         hashmapForEach(d->glyph_cache, gr_ttf_freeFontCache, nullptr);
         hashmapFree(d->glyph_cache);
+        free(d->atlas.surface.data);
         pthread_mutex_destroy(&d->mutex);
         free(d);
     }
@@ -321,6 +363,130 @@ void gr_ttf_freeFont(void *font)
     pthread_mutex_unlock(&font_data.mutex);
 }
 
+static bool gr_ttf_glyph_atlas_evict(void *key __unused, void *value, void *context __unused)
+{
+    TrueTypeCacheEntry *e = (TrueTypeCacheEntry *)value;
+    e->atlas_x = -1;
+    e->atlas_y = -1;
+    return true;
+}
+
+// Drop every glyph from the atlas. They will be rasterized again when they
+// are next drawn.
+static void gr_ttf_glyph_atlas_reset(TrueTypeFont *font)
+{
+    GlyphAtlas *a = &font->atlas;
+
+    hashmapForEach(font->glyph_cache, gr_ttf_glyph_atlas_evict, nullptr);
+    a->shelf_x = 0;
+    a->shelf_y = 0;
+    a->shelf_h = 0;
+}
+
+static bool gr_ttf_glyph_atlas_grow(GlyphAtlas *a, int min_height)
+{
+    int new_height = a->surface.height;
+    while (new_height < min_height) {
+        new_height *= 2;
+    }
+    if (new_height > GLYPH_ATLAS_MAX_HEIGHT) {
+        return false;
+    }
+
+    uint8_t *data = (uint8_t *) realloc(a->surface.data,
+                                        a->surface.stride * new_height);
+    if (!data) {
+        return false;
+    }
+    memset(data + a->surface.stride * a->surface.height, 0,
+           a->surface.stride * (new_height - a->surface.height));
+
+    a->surface.data = (GGLubyte *) data;
+    a->surface.height = new_height;
+    return true;
+}
+
+// Copy a rendered glyph bitmap into the next free slot of the font's atlas.
+// Glyphs are packed left to right into shelves as tall as the tallest glyph
+// in them. The atlas grows downwards until GLYPH_ATLAS_MAX_HEIGHT and is
+// emptied once it is full.
+static bool gr_ttf_glyph_atlas_store(TrueTypeFont *font, TrueTypeCacheEntry *ent, const FT_Bitmap *bitmap)
+{
+    GlyphAtlas *a = &font->atlas;
+    int w = bitmap->width;
+    int h = bitmap->rows;
+    unsigned y;
+
+    if (bitmap->pixel_mode != FT_PIXEL_MODE_GRAY) {
+        fprintf(stderr, "Unsupported pixel mode in FT_Bitmap %d\n", bitmap->pixel_mode);
+        return false;
+    }
+
+    if (w == 0 || h == 0) {
+        // Nothing to draw (eg. spaces)
+        ent->atlas_x = 0;
+        ent->atlas_y = 0;
+        return true;
+    }
+
+    if (!a->surface.data) {
+        int width = MAX(GLYPH_ATLAS_WIDTH, 4 * font->face->size->metrics.x_ppem);
+        int height = GLYPH_ATLAS_MIN_HEIGHT;
+        while (height < h && height < GLYPH_ATLAS_MAX_HEIGHT) {
+            height *= 2;
+        }
+
+        a->surface.data = (GGLubyte *) calloc(width, height);
+        if (!a->surface.data) {
+            fprintf(stderr, "Failed to allocate %dx%d glyph atlas\n", width, height);
+            return false;
+        }
+        a->surface.version = sizeof(a->surface);
+        a->surface.width = width;
+        a->surface.height = height;
+        a->surface.stride = width;
+        a->surface.format = GGL_PIXEL_FORMAT_A_8;
+    }
+
+    if (w > (int) a->surface.width || h > GLYPH_ATLAS_MAX_HEIGHT) {
+        fprintf(stderr, "Glyph idx %d (%dx%d) does not fit in the glyph atlas\n",
+                ent->char_index, w, h);
+        return false;
+    }
+
+    if (a->shelf_x + w > (int) a->surface.width) {
+        a->shelf_x = 0;
+        a->shelf_y += a->shelf_h;
+        a->shelf_h = 0;
+    }
+
+    if (a->shelf_y + h > (int) a->surface.height
+            && !gr_ttf_glyph_atlas_grow(a, a->shelf_y + h)) {
+        gr_ttf_glyph_atlas_reset(font);
+        if (h > (int) a->surface.height && !gr_ttf_glyph_atlas_grow(a, h)) {
+            fprintf(stderr, "Failed to grow glyph atlas\n");
+            return false;
+        }
+    }
+
+    uint8_t *src_itr = bitmap->buffer;
+    uint8_t *dest_itr = a->surface.data + a->shelf_y * a->surface.stride + a->shelf_x;
+
+    for (y = 0; y < bitmap->rows; ++y) {
+        memcpy(dest_itr, src_itr, bitmap->width);
+        src_itr += bitmap->pitch;
+        dest_itr += a->surface.stride;
+    }
+
+    ent->atlas_x = a->shelf_x;
+    ent->atlas_y = a->shelf_y;
+
+    // Leave a column and row of padding between glyphs
+    a->shelf_x += w + 1;
+    a->shelf_h = MAX(a->shelf_h, h + 1);
+    return true;
+}
+
 static TrueTypeCacheEntry *gr_ttf_glyph_cache_peek(TrueTypeFont *font, int char_index)
 {
     return (TrueTypeCacheEntry *)hashmapGet(font->glyph_cache, &char_index);
@@ -336,17 +502,25 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
             return nullptr;
         }
 
-        FT_BitmapGlyph glyph;
-        error = FT_Get_Glyph(font->face->glyph, (FT_Glyph*)&glyph);
-        if (error) {
-            fprintf(stderr, "Failed to copy glyph %d: %d\n", char_index, error);
-            return nullptr;
-        }
+        FT_GlyphSlot slot = font->face->glyph;
 
         res = (TrueTypeCacheEntry *)malloc(sizeof(TrueTypeCacheEntry));
         memset(res, 0, sizeof(TrueTypeCacheEntry));
-        res->glyph = glyph;
-        FT_Glyph_Get_CBox((FT_Glyph)glyph, FT_GLYPH_BBOX_PIXELS, &res->bbox);
+        res->char_index = char_index;
+        res->left = slot->bitmap_left;
+        res->top = slot->bitmap_top;
+        res->width = slot->bitmap.width;
+        res->rows = slot->bitmap.rows;
+        res->advance = slot->advance.x >> 6;
+        res->bbox.xMin = res->left;
+        res->bbox.xMax = res->left + res->width;
+        res->bbox.yMin = res->top - res->rows;
+        res->bbox.yMax = res->top;
+        res->atlas_x = -1;
+        res->atlas_y = -1;
+
+        // The bitmap is already rendered, so put it in the atlas right away
+        gr_ttf_glyph_atlas_store(font, res, &slot->bitmap);
 
         int *key = (int *)malloc(sizeof(int));
         *key = char_index;
@@ -357,31 +531,21 @@ static TrueTypeCacheEntry *gr_ttf_glyph_cache_get(TrueTypeFont *font, int char_i
     return res;
 }
 
-static int gr_ttf_copy_glyph_to_surface(GGLSurface *dest, FT_BitmapGlyph glyph, int offX, int offY, int base)
+// Make sure that the glyph is in the atlas, rasterizing it again if it was
+// evicted
+static bool gr_ttf_glyph_atlas_get(TrueTypeFont *font, TrueTypeCacheEntry *ent)
 {
-    unsigned y;
-    uint8_t *src_itr = glyph->bitmap.buffer;
-    uint8_t *dest_itr = dest->data;
-
-    if (glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY) {
-        fprintf(stderr, "Unsupported pixel mode in FT_BitmapGlyph %d\n", glyph->bitmap.pixel_mode);
-        return -1;
+    if (ent->atlas_x >= 0) {
+        return true;
     }
 
-    dest_itr += (offY + base - glyph->top)*dest->stride + (offX + glyph->left);
-
-    // FIXME: if glyph->left is negative and everything else is 0 (e.g. letter 'j' in Roboto-Regular),
-    // the result might end up being before the buffer - I'm not sure how to properly handle this.
-    if (dest_itr < dest->data) {
-        dest_itr = dest->data;
+    int error = FT_Load_Glyph(font->face, ent->char_index, FT_LOAD_RENDER);
+    if (error) {
+        fprintf(stderr, "Failed to load glyph idx %d: %d\n", ent->char_index, error);
+        return false;
     }
 
-    for (y = 0; y < glyph->bitmap.rows; ++y) {
-        memcpy(dest_itr, src_itr, glyph->bitmap.width);
-        src_itr += glyph->bitmap.pitch;
-        dest_itr += dest->stride;
-    }
-    return 0;
+    return gr_ttf_glyph_atlas_store(font, ent, &font->face->glyph->bitmap);
 }
 
 static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
@@ -435,23 +599,21 @@ static void gr_ttf_calcMaxFontHeight(TrueTypeFont *f)
     f->base += f->size / 4;
 }
 
-// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
-static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const char *text, int max_width)
+// Lay out as much of the text as fits in max_width pixels (or all of it if
+// max_width is -1). If glyphs is not null, it must have room for strlen(text)
+// entries and receives the glyphs and their pen positions. Returns the number
+// of bytes from const char *text laid out, not number of UTF8 characters!
+static int gr_ttf_layout_text(TrueTypeFont *font, const char *text, int max_width,
+                              GlyphPosition *glyphs, int *glyphs_len, int *width)
 {
     TrueTypeFont *f = font;
     TrueTypeCacheEntry *ent;
-    int bytes_rendered = 0, total_w = 0;
+    int bytes_rendered = 0, total_w = 0, len = 0;
     int utf_bytes = 0;
     unsigned int unicode = 0;
-    int i, x, diff, char_idx, prev_idx = 0;
-    int height;
+    int diff, kerning, char_idx, prev_idx = 0;
     FT_Vector delta;
-    uint8_t *data = nullptr;
     const char *text_itr = text;
-    int *char_idxs;
-    int char_idxs_len = 0;
-
-    char_idxs = (int *) malloc(strlen(text) * sizeof(int));
 
     while (*text_itr) {
         utf_bytes = utf8_to_unicode(text_itr, &unicode);
@@ -459,33 +621,59 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
         bytes_rendered += utf_bytes;
 
         char_idx = FT_Get_Char_Index(f->face, unicode);
-        char_idxs[char_idxs_len] = char_idx;
 
         ent = gr_ttf_glyph_cache_get(f, char_idx);
         if (ent) {
-            diff = ent->glyph->root.advance.x >> 16;
-
+            kerning = 0;
             if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
                 FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-                diff += delta.x >> 6;
+                kerning = delta.x >> 6;
             }
+            diff = ent->advance + kerning;
 
             if (max_width != -1 && total_w + diff > max_width) {
                 break;
             }
 
+            if (glyphs) {
+                glyphs[len].ent = ent;
+                glyphs[len].x = total_w + kerning;
+                ++len;
+            }
+
             total_w += diff;
         }
         prev_idx = char_idx;
-        ++char_idxs_len;
     }
 
+    if (glyphs_len) {
+        *glyphs_len = len;
+    }
+    if (width) {
+        *width = total_w;
+    }
+    return bytes_rendered;
+}
+
+#ifdef TW_TTF_STRING_CACHE
+// returns number of bytes from const char *text rendered to fit max_width, not number of UTF8 characters!
+static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const char *text, int max_width)
+{
+    GlyphAtlas *a = &font->atlas;
+    GlyphPosition *glyphs;
+    int glyphs_len, total_w, bytes_rendered;
+    int i, x, y, l, r, t, b, height;
+    uint8_t *data = nullptr;
+
+    glyphs = (GlyphPosition *) malloc((strlen(text) + 1) * sizeof(GlyphPosition));
+    bytes_rendered = gr_ttf_layout_text(font, text, max_width, glyphs, &glyphs_len, &total_w);
+
     if (font->max_height == -1) {
         gr_ttf_calcMaxFontHeight(font);
     }
 
     if (font->max_height == -1) {
-        free(char_idxs);
+        free(glyphs);
         return -1;
     }
 
@@ -493,8 +681,6 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
 
     data = (uint8_t *) malloc(total_w*height);
     memset(data, 0, total_w*height);
-    x = 0;
-    prev_idx = 0;
 
     surface->version = sizeof(*surface);
     surface->width = total_w;
@@ -503,23 +689,32 @@ static int gr_ttf_render_text(TrueTypeFont *font, GGLSurface *surface, const cha
     surface->data = (GGLubyte*)data;
     surface->format = GGL_PIXEL_FORMAT_A_8;
 
-    for (i = 0; i < char_idxs_len; ++i) {
-        char_idx = char_idxs[i];
-        if (FT_HAS_KERNING(f->face) && prev_idx && char_idx) {
-            FT_Get_Kerning(f->face, prev_idx, char_idx, FT_KERNING_DEFAULT, &delta);
-            x += delta.x >> 6;
+    for (i = 0; i < glyphs_len; ++i) {
+        TrueTypeCacheEntry *ent = glyphs[i].ent;
+        if (!gr_ttf_glyph_atlas_get(font, ent)) {
+            continue;
         }
 
-        ent = gr_ttf_glyph_cache_get(f, char_idx);
-        if (ent) {
-            gr_ttf_copy_glyph_to_surface(surface, ent->glyph, x, 0, font->base);
-            x += ent->glyph->root.advance.x >> 16;
+        x = glyphs[i].x + ent->left;
+        y = font->base - ent->top;
+        l = MAX(x, 0);
+        r = MIN(x + ent->width, total_w);
+        t = MAX(y, 0);
+        b = MIN(y + ent->rows, height);
+
+        for (int row = t; row < b; ++row) {
+            const uint8_t *src = a->surface.data
+                    + (ent->atlas_y + row - y) * a->surface.stride
+                    + ent->atlas_x + l - x;
+            uint8_t *dest = data + row * total_w + l;
+            for (int col = 0; col < r - l; ++col) {
+                // Glyphs may overlap, so keep the highest coverage
+                dest[col] = MAX(dest[col], src[col]);
+            }
         }
-
-        prev_idx = char_idx;
     }
 
-    free(char_idxs);
+    free(glyphs);
     return bytes_rendered;
 }
 
@@ -603,6 +798,7 @@ static StringCacheEntry *gr_ttf_string_cache_get(TrueTypeFont *font, const char
     }
     return res;
 }
+#endif
 
 int gr_ttf_measureEx(const char *s, void *font)
 {
@@ -610,9 +806,14 @@ int gr_ttf_measureEx(const char *s, void *font)
     int res = -1;
 
     pthread_mutex_lock(&f->mutex);
-    StringCacheEntry *e = gr_ttf_string_cache_get(f, s, -1);
+#ifdef TW_TTF_STRING_CACHE
+    StringCacheEntry *e = gr_ttf_string_cache_peek(f, s, -1);
     if (e) {
         res = e->surface.width;
+    } else
+#endif
+    {
+        gr_ttf_layout_text(f, s, -1, nullptr, nullptr, &res);
     }
     pthread_mutex_unlock(&f->mutex);
 
@@ -628,16 +829,17 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
     unsigned int unicode = 0;
     int char_idx, prev_idx = 0;
     FT_Vector delta;
-    StringCacheEntry *e;
 
     pthread_mutex_lock(&f->mutex);
 
-    e = gr_ttf_string_cache_peek(f, s, max_width);
+#ifdef TW_TTF_STRING_CACHE
+    StringCacheEntry *e = gr_ttf_string_cache_peek(f, s, max_width);
     if (e) {
         max_bytes = e->rendered_bytes;
         pthread_mutex_unlock(&f->mutex);
         return max_bytes;
     }
+#endif
 
     while (*s) {
         utf_bytes = utf8_to_unicode(s, &unicode);
@@ -661,13 +863,73 @@ int gr_ttf_maxExW(const char *s, void *font, int max_width)
             continue;
         }
 
-        total_w += ent->glyph->root.advance.x >> 16;
+        total_w += ent->advance;
         max_bytes += utf_bytes;
     }
     pthread_mutex_unlock(&f->mutex);
     return max_bytes;
 }
 
+static void gr_ttf_begin_texture(GGLContext *gl, GGLSurface *surface)
+{
+    gl->bindTexture(gl, surface);
+    gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+    gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    gl->enable(gl, GGL_TEXTURE_2D);
+}
+
+// Draw the laid out glyphs straight from the atlas, clipped to the
+// (x, y, x_right, y_bottom) box that the string occupies
+static void gr_ttf_draw_glyphs(GGLContext *gl, TrueTypeFont *font,
+                               const GlyphPosition *glyphs, int glyphs_len,
+                               int x, int y, int x_right, int y_bottom)
+{
+    GlyphAtlas *a = &font->atlas;
+    GGLubyte *bound_data = nullptr;
+    unsigned bound_height = 0;
+    int i, gx, gy, l, r, t, b;
+
+    for (i = 0; i < glyphs_len; ++i) {
+        TrueTypeCacheEntry *ent = glyphs[i].ent;
+        if (ent->width == 0 || ent->rows == 0) {
+            continue;
+        }
+
+        gx = x + glyphs[i].x + ent->left;
+        gy = y + font->base - ent->top;
+        l = MAX(gx, x);
+        r = MIN(gx + ent->width, x_right);
+        t = MAX(gy, y);
+        b = MIN(gy + ent->rows, y_bottom);
+        if (l >= r || t >= b) {
+            continue;
+        }
+
+        if (!gr_ttf_glyph_atlas_get(font, ent)) {
+            continue;
+        }
+
+        // Rasterizing a glyph might have reallocated the atlas
+        if (a->surface.data != bound_data || a->surface.height != bound_height) {
+            if (!bound_data) {
+                gr_ttf_begin_texture(gl, &a->surface);
+            } else {
+                gl->bindTexture(gl, &a->surface);
+            }
+            bound_data = a->surface.data;
+            bound_height = a->surface.height;
+        }
+
+        gl->texCoord2i(gl, ent->atlas_x - gx, ent->atlas_y - gy);
+        gl->recti(gl, l, t, r, b);
+    }
+
+    if (bound_data) {
+        gl->disable(gl, GGL_TEXTURE_2D);
+    }
+}
+
 int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int max_width, int max_height)
 {
     GGLContext *gl = (GGLContext *)context;
@@ -683,6 +945,7 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
 
     pthread_mutex_lock(&font->mutex);
 
+#ifdef TW_TTF_STRING_CACHE
     StringCacheEntry *e = gr_ttf_string_cache_get(font, s, max_width);
     if (!e) {
         pthread_mutex_unlock(&font->mutex);
@@ -700,15 +963,33 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
-    gl->bindTexture(gl, &e->surface);
-    gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
-    gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
-    gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
-
-    gl->enable(gl, GGL_TEXTURE_2D);
+    gr_ttf_begin_texture(gl, &e->surface);
     gl->texCoord2i(gl, -x, -y);
     gl->recti(gl, x, y, x + e->surface.width, y_bottom);
     gl->disable(gl, GGL_TEXTURE_2D);
+#else
+    if (font->max_height == -1) {
+        gr_ttf_calcMaxFontHeight(font);
+    }
+
+    int y_bottom = y + font->max_height;
+
+    if (max_height != -1 && max_height < y_bottom) {
+        y_bottom = max_height;
+        if (y_bottom <= y) {
+            pthread_mutex_unlock(&font->mutex);
+            return 0;
+        }
+    }
+
+    GlyphPosition *glyphs = (GlyphPosition *) malloc((strlen(s) + 1) * sizeof(GlyphPosition));
+    int glyphs_len, total_w;
+    int res = gr_ttf_layout_text(font, s, max_width, glyphs, &glyphs_len, &total_w);
+
+    gr_ttf_draw_glyphs(gl, font, glyphs, glyphs_len, x, y, x + total_w, y_bottom);
+
+    free(glyphs);
+#endif
 
     pthread_mutex_unlock(&font->mutex);
     return res;
@@ -730,6 +1011,7 @@ int gr_ttf_getMaxFontHeight(void *font)
     return res;
 }
 
+#ifdef TW_TTF_STRING_CACHE
 static bool gr_ttf_dump_stats_count_string_cache(void *key __unused, void *value, void *context)
 {
     int *string_cache_size = (int *) context;
@@ -737,32 +1019,42 @@ static bool gr_ttf_dump_stats_count_string_cache(void *key __unused, void *value
     *string_cache_size += e->surface.height*e->surface.width + sizeof(StringCacheEntry);
     return true;
 }
+#endif
 
 static bool gr_ttf_dump_stats_font(void *key, void *value, void *context)
 {
     TrueTypeFontKey *k = (TrueTypeFontKey *)key;
     TrueTypeFont *f = (TrueTypeFont *)value;
-    int *total_string_cache_size = (int *)context;
+    int *total_cache_size = (int *)context;
     int string_cache_size = 0;
+    int atlas_size;
 
     pthread_mutex_lock(&f->mutex);
 
-    hashmapForEach(f->string_cache, gr_ttf_dump_stats_count_string_cache, &string_cache_size);
+    atlas_size = f->atlas.surface.stride * f->atlas.surface.height;
 
     printf("  Font %s (size %d, dpi %d):\n"
            "    refcount: %d\n"
            "    max_height: %d\n"
            "    base: %d\n"
            "    glyph_cache: %zu entries\n"
-           "    string_cache: %zu entries (%.2f kB)\n",
+           "    glyph_atlas: %ux%u (%.2f kB)\n",
            k->path, k->size, k->dpi,
            f->refcount, f->max_height, f->base,
            hashmapSize(f->glyph_cache),
+           f->atlas.surface.width, f->atlas.surface.height,
+           ((double)atlas_size)/1024);
+
+#ifdef TW_TTF_STRING_CACHE
+    hashmapForEach(f->string_cache, gr_ttf_dump_stats_count_string_cache, &string_cache_size);
+
+    printf("    string_cache: %zu entries (%.2f kB)\n",
            hashmapSize(f->string_cache), ((double)string_cache_size)/1024);
+#endif
 
     pthread_mutex_unlock(&f->mutex);
 
-    *total_string_cache_size += string_cache_size;
+    *total_cache_size += atlas_size + string_cache_size;
     return true;
 }
 
@@ -774,10 +1066,10 @@ void gr_ttf_dump_stats(void)
     if (!font_data.fonts) {
         printf("no truetype fonts loaded.\n");
     } else {
-        int total_string_cache_size = 0;
+        int total_cache_size = 0;
         printf("%zu fonts loaded.\n", hashmapSize(font_data.fonts));
-        hashmapForEach(font_data.fonts, gr_ttf_dump_stats_font, &total_string_cache_size);
-        printf("  Total string cache size: %.2f kB\n", ((double)total_string_cache_size)/1024);
+        hashmapForEach(font_data.fonts, gr_ttf_dump_stats_font, &total_cache_size);
+        printf("  Total cache size: %.2f kB\n", ((double)total_cache_size)/1024);
     }
 
     pthread_mutex_unlock(&font_data.mutex);
@@ -32,6 +32,9 @@ __BEGIN_DECLS
 
 #define MAX_AUDIT_MESSAGE_LENGTH 8970
 
+/* Maximum number of messages received by audit_get_replies() */
+#define AUDIT_MAX_BATCH 16
+
 typedef enum { GET_REPLY_BLOCKING = 0, GET_REPLY_NONBLOCKING } reply_t;
 
 /* type == AUDIT_SIGNAL_INFO */
@@ -78,6 +81,27 @@ extern void audit_close(int fd);
 extern int audit_get_reply(int fd, struct audit_message* rep, reply_t block,
                            int peek);
 
+/**
+ * Receives a batch of messages with a single recvmmsg() call
+ * @param fd
+ *  The fd returned by a call to audit_open()
+ * @param reps
+ *  Array of response structs to store the responses in.
+ * @param lens
+ *  Array that receives the number of bytes received for each response.
+ * @param count
+ *  Number of elements in reps and lens.
+ * @param block
+ *  Whether or not to block until at least one message is available. Once one
+ *  message has been received, the call never blocks for the rest.
+ * @return
+ *  This function returns the number of messages received on success, else
+ *  -errno. Messages that were not sent by the kernel or are malformed have
+ *  their length set to 0.
+ */
+extern int audit_get_replies(int fd, struct audit_message* reps, size_t* lens,
+                             size_t count, reply_t block);
+
 /**
  * Sets a pid to receive audit netlink events from the kernel
  * @param fd
@@ -22,6 +22,7 @@
 namespace mb
 {
 
+bool init_version_3_stats();
 bool connection_version_3(int fd);
 
 }
\ No newline at end of file
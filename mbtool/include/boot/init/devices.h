@@ -19,7 +19,6 @@
 
 #include <algorithm>
 #include <mutex>
-#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -64,7 +63,9 @@ class DeviceHandler {
                       int minor, const std::vector<std::string>& links) const;
 
     std::string sysfs_mount_point_;
-    mutable std::optional<std::string> boot_device_;
+    // Lazily initialized because coldboot handles uevents from several threads
+    mutable std::once_flag boot_device_once_;
+    mutable std::string boot_device_;
 
     BlockDevMap block_dev_mappings_;
     mutable std::mutex block_dev_mappings_guard_;
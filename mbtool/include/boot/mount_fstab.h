@@ -24,14 +24,11 @@
 
 #include "util/roms.h"
 
-namespace android::init
-{
-    class DeviceHandler;
-}
-
 namespace mb
 {
 
+class UeventThread;
+
 enum class MountFlag : uint32_t
 {
     // Rewrite fstab file to remove mounted entries
@@ -58,7 +55,7 @@ MB_DECLARE_OPERATORS_FOR_FLAGS(MountFlags)
 
 bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
                  const device::Device &device, MountFlags flags,
-                 const android::init::DeviceHandler &handler);
+                 const UeventThread &uevent_thread);
 bool mount_rom(const std::shared_ptr<Rom> &rom);
 
 }
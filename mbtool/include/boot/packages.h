@@ -180,6 +180,14 @@ public:
 
     std::shared_ptr<Package> find_by_uid(uid_t uid) const;
     std::shared_ptr<Package> find_by_pkg(const std::string &pkg_id) const;
+
+private:
+    void build_indexes();
+
+    // Built by load_xml(). If multiple packages match, the first one in pkgs
+    // is indexed.
+    std::unordered_map<uid_t, std::shared_ptr<Package>> _by_uid;
+    std::unordered_map<std::string, std::shared_ptr<Package>> _by_pkg;
 };
 
 }
@@ -17,15 +17,25 @@
 
 #pragma once
 
+#include <chrono>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "mbcommon/common.h"
 
 class SocketConnection;
 
+namespace mb
+{
+struct prop_info;
+}
+
 class PropertyService
 {
 public:
@@ -48,18 +58,34 @@ public:
 
     bool load_properties_file(const std::string &path, std::string_view filter);
 
+    std::vector<std::pair<std::string, uint64_t>> set_counts();
+
 private:
+    struct PropertyEntry
+    {
+        mb::prop_info *pi;
+        uint64_t set_count;
+    };
+
     bool m_initialized;
     int m_setter_fd;
     int m_stopper_pipe[2];
     std::thread m_thread;
 
+    // Guards property area writes and m_props since properties can be set from
+    // both the socket thread and the main thread
+    std::mutex m_props_guard;
+    std::unordered_map<std::string, PropertyEntry> m_props;
+
+    mb::prop_info * find_cached(const std::string &name);
     uint32_t set_internal(const std::string &name, std::string_view value);
 
     int create_socket();
 
     void socket_handler_loop();
     void socket_handle_set_property();
+    void socket_handle_set_properties(SocketConnection &socket,
+                                      std::chrono::milliseconds &timeout);
     void socket_handle_set_property_impl(SocketConnection &socket,
                                          const std::string &name,
                                          std::string_view value, bool legacy);
@@ -19,9 +19,15 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <thread>
 
+#include <cstdint>
+
 #include "boot/init/devices.h"
 #include "boot/init/uevent_listener.h"
 
@@ -39,6 +45,12 @@ public:
 
     const android::init::DeviceHandler & device_handler() const;
 
+    uint64_t event_count() const;
+    bool wait_for_events(uint64_t count,
+                         std::chrono::milliseconds timeout) const;
+    bool wait_for_path(const std::string &path,
+                       std::chrono::milliseconds timeout) const;
+
 private:
     android::init::DeviceHandler m_device_handler;
     // Need deferred initialization because the constructor opens a socket
@@ -49,6 +61,13 @@ private:
     std::thread m_thread;
     bool m_is_running;
 
+    // Number of uevents handled so far. Waiters are notified after every event.
+    mutable std::mutex m_event_guard;
+    mutable std::condition_variable m_event_cv;
+    uint64_t m_event_count;
+
+    void coldboot();
+    void handle_event(const android::init::Uevent &uevent);
     void thread_func();
 };
 
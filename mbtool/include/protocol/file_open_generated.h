@@ -125,7 +125,8 @@ struct FileOpenRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_PATH = 4,
     VT_FLAGS = 6,
-    VT_PERMS = 8
+    VT_PERMS = 8,
+    VT_PASS_FD = 10
   };
   const flatbuffers::String *path() const {
     return GetPointer<const flatbuffers::String *>(VT_PATH);
@@ -136,6 +137,9 @@ struct FileOpenRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   uint32_t perms() const {
     return GetField<uint32_t>(VT_PERMS, 0);
   }
+  bool pass_fd() const {
+    return GetField<uint8_t>(VT_PASS_FD, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyOffset(verifier, VT_PATH) &&
@@ -143,6 +147,7 @@ struct FileOpenRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyOffset(verifier, VT_FLAGS) &&
            verifier.Verify(flags()) &&
            VerifyField<uint32_t>(verifier, VT_PERMS) &&
+           VerifyField<uint8_t>(verifier, VT_PASS_FD) &&
            verifier.EndTable();
   }
 };
@@ -159,6 +164,9 @@ struct FileOpenRequestBuilder {
   void add_perms(uint32_t perms) {
     fbb_.AddElement<uint32_t>(FileOpenRequest::VT_PERMS, perms, 0);
   }
+  void add_pass_fd(bool pass_fd) {
+    fbb_.AddElement<uint8_t>(FileOpenRequest::VT_PASS_FD, static_cast<uint8_t>(pass_fd), 0);
+  }
   explicit FileOpenRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -175,11 +183,13 @@ inline flatbuffers::Offset<FileOpenRequest> CreateFileOpenRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     flatbuffers::Offset<flatbuffers::String> path = 0,
     flatbuffers::Offset<flatbuffers::Vector<int16_t>> flags = 0,
-    uint32_t perms = 0) {
+    uint32_t perms = 0,
+    bool pass_fd = false) {
   FileOpenRequestBuilder builder_(_fbb);
   builder_.add_perms(perms);
   builder_.add_flags(flags);
   builder_.add_path(path);
+  builder_.add_pass_fd(pass_fd);
   return builder_.Finish();
 }
 
@@ -187,12 +197,14 @@ inline flatbuffers::Offset<FileOpenRequest> CreateFileOpenRequestDirect(
     flatbuffers::FlatBufferBuilder &_fbb,
     const char *path = nullptr,
     const std::vector<int16_t> *flags = nullptr,
-    uint32_t perms = 0) {
+    uint32_t perms = 0,
+    bool pass_fd = false) {
   return mbtool::daemon::v3::CreateFileOpenRequest(
       _fbb,
       path ? _fbb.CreateString(path) : 0,
       flags ? _fbb.CreateVector<int16_t>(*flags) : 0,
-      perms);
+      perms,
+      pass_fd);
 }
 
 struct FileOpenResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
@@ -200,7 +212,8 @@ struct FileOpenResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
     VT_SUCCESS = 4,
     VT_ERROR_MSG = 6,
     VT_ID = 8,
-    VT_ERROR = 10
+    VT_ERROR = 10,
+    VT_FD_PASSED = 12
   };
   bool success() const {
     return GetField<uint8_t>(VT_SUCCESS, 0) != 0;
@@ -214,6 +227,9 @@ struct FileOpenResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const FileOpenError *error() const {
     return GetPointer<const FileOpenError *>(VT_ERROR);
   }
+  bool fd_passed() const {
+    return GetField<uint8_t>(VT_FD_PASSED, 0) != 0;
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_SUCCESS) &&
@@ -222,6 +238,7 @@ struct FileOpenResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
            VerifyField<int32_t>(verifier, VT_ID) &&
            VerifyOffset(verifier, VT_ERROR) &&
            verifier.VerifyTable(error()) &&
+           VerifyField<uint8_t>(verifier, VT_FD_PASSED) &&
            verifier.EndTable();
   }
 };
@@ -241,6 +258,9 @@ struct FileOpenResponseBuilder {
   void add_error(flatbuffers::Offset<FileOpenError> error) {
     fbb_.AddOffset(FileOpenResponse::VT_ERROR, error);
   }
+  void add_fd_passed(bool fd_passed) {
+    fbb_.AddElement<uint8_t>(FileOpenResponse::VT_FD_PASSED, static_cast<uint8_t>(fd_passed), 0);
+  }
   explicit FileOpenResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -258,11 +278,13 @@ inline flatbuffers::Offset<FileOpenResponse> CreateFileOpenResponse(
     bool success = false,
     flatbuffers::Offset<flatbuffers::String> error_msg = 0,
     int32_t id = 0,
-    flatbuffers::Offset<FileOpenError> error = 0) {
+    flatbuffers::Offset<FileOpenError> error = 0,
+    bool fd_passed = false) {
   FileOpenResponseBuilder builder_(_fbb);
   builder_.add_error(error);
   builder_.add_id(id);
   builder_.add_error_msg(error_msg);
+  builder_.add_fd_passed(fd_passed);
   builder_.add_success(success);
   return builder_.Finish();
 }
@@ -272,13 +294,15 @@ inline flatbuffers::Offset<FileOpenResponse> CreateFileOpenResponseDirect(
     bool success = false,
     const char *error_msg = nullptr,
     int32_t id = 0,
-    flatbuffers::Offset<FileOpenError> error = 0) {
+    flatbuffers::Offset<FileOpenError> error = 0,
+    bool fd_passed = false) {
   return mbtool::daemon::v3::CreateFileOpenResponse(
       _fbb,
       success,
       error_msg ? _fbb.CreateString(error_msg) : 0,
       id,
-      error);
+      error,
+      fd_passed);
 }
 
 }  // namespace v3
@@ -0,0 +1,331 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_JOB_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_JOB_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct JobSubmitResponse;
+
+struct JobCancelRequest;
+
+struct JobCancelResponse;
+
+struct JobProgressEvent;
+
+struct JobFinishedEvent;
+
+struct JobSubmitResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_ERROR_MSG = 6
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  const flatbuffers::String *error_msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_ERROR_MSG);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           VerifyOffset(verifier, VT_ERROR_MSG) &&
+           verifier.Verify(error_msg()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobSubmitResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobSubmitResponse::VT_JOB_ID, job_id, 0);
+  }
+  void add_error_msg(flatbuffers::Offset<flatbuffers::String> error_msg) {
+    fbb_.AddOffset(JobSubmitResponse::VT_ERROR_MSG, error_msg);
+  }
+  explicit JobSubmitResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobSubmitResponseBuilder &operator=(const JobSubmitResponseBuilder &);
+  flatbuffers::Offset<JobSubmitResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobSubmitResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobSubmitResponse> CreateJobSubmitResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    flatbuffers::Offset<flatbuffers::String> error_msg = 0) {
+  JobSubmitResponseBuilder builder_(_fbb);
+  builder_.add_error_msg(error_msg);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<JobSubmitResponse> CreateJobSubmitResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    const char *error_msg = nullptr) {
+  return mbtool::daemon::v3::CreateJobSubmitResponse(
+      _fbb,
+      job_id,
+      error_msg ? _fbb.CreateString(error_msg) : 0);
+}
+
+struct JobCancelRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobCancelRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobCancelRequest::VT_JOB_ID, job_id, 0);
+  }
+  explicit JobCancelRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobCancelRequestBuilder &operator=(const JobCancelRequestBuilder &);
+  flatbuffers::Offset<JobCancelRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobCancelRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobCancelRequest> CreateJobCancelRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0) {
+  JobCancelRequestBuilder builder_(_fbb);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct JobCancelResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SUCCESS = 4
+  };
+  bool success() const {
+    return GetField<uint8_t>(VT_SUCCESS, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_SUCCESS) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobCancelResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_success(bool success) {
+    fbb_.AddElement<uint8_t>(JobCancelResponse::VT_SUCCESS, static_cast<uint8_t>(success), 0);
+  }
+  explicit JobCancelResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobCancelResponseBuilder &operator=(const JobCancelResponseBuilder &);
+  flatbuffers::Offset<JobCancelResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobCancelResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobCancelResponse> CreateJobCancelResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    bool success = false) {
+  JobCancelResponseBuilder builder_(_fbb);
+  builder_.add_success(success);
+  return builder_.Finish();
+}
+
+struct JobProgressEvent FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_ELAPSED_MS = 6,
+    VT_BYTES_READ = 8,
+    VT_BYTES_WRITTEN = 10,
+    VT_READ_RATE = 12,
+    VT_WRITE_RATE = 14
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  uint64_t elapsed_ms() const {
+    return GetField<uint64_t>(VT_ELAPSED_MS, 0);
+  }
+  uint64_t bytes_read() const {
+    return GetField<uint64_t>(VT_BYTES_READ, 0);
+  }
+  uint64_t bytes_written() const {
+    return GetField<uint64_t>(VT_BYTES_WRITTEN, 0);
+  }
+  uint64_t read_rate() const {
+    return GetField<uint64_t>(VT_READ_RATE, 0);
+  }
+  uint64_t write_rate() const {
+    return GetField<uint64_t>(VT_WRITE_RATE, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           VerifyField<uint64_t>(verifier, VT_ELAPSED_MS) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_READ) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_WRITTEN) &&
+           VerifyField<uint64_t>(verifier, VT_READ_RATE) &&
+           VerifyField<uint64_t>(verifier, VT_WRITE_RATE) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobProgressEventBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobProgressEvent::VT_JOB_ID, job_id, 0);
+  }
+  void add_elapsed_ms(uint64_t elapsed_ms) {
+    fbb_.AddElement<uint64_t>(JobProgressEvent::VT_ELAPSED_MS, elapsed_ms, 0);
+  }
+  void add_bytes_read(uint64_t bytes_read) {
+    fbb_.AddElement<uint64_t>(JobProgressEvent::VT_BYTES_READ, bytes_read, 0);
+  }
+  void add_bytes_written(uint64_t bytes_written) {
+    fbb_.AddElement<uint64_t>(JobProgressEvent::VT_BYTES_WRITTEN, bytes_written, 0);
+  }
+  void add_read_rate(uint64_t read_rate) {
+    fbb_.AddElement<uint64_t>(JobProgressEvent::VT_READ_RATE, read_rate, 0);
+  }
+  void add_write_rate(uint64_t write_rate) {
+    fbb_.AddElement<uint64_t>(JobProgressEvent::VT_WRITE_RATE, write_rate, 0);
+  }
+  explicit JobProgressEventBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobProgressEventBuilder &operator=(const JobProgressEventBuilder &);
+  flatbuffers::Offset<JobProgressEvent> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobProgressEvent>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobProgressEvent> CreateJobProgressEvent(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    uint64_t elapsed_ms = 0,
+    uint64_t bytes_read = 0,
+    uint64_t bytes_written = 0,
+    uint64_t read_rate = 0,
+    uint64_t write_rate = 0) {
+  JobProgressEventBuilder builder_(_fbb);
+  builder_.add_write_rate(write_rate);
+  builder_.add_read_rate(read_rate);
+  builder_.add_bytes_written(bytes_written);
+  builder_.add_bytes_read(bytes_read);
+  builder_.add_elapsed_ms(elapsed_ms);
+  builder_.add_job_id(job_id);
+  return builder_.Finish();
+}
+
+struct JobFinishedEvent FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_JOB_ID = 4,
+    VT_CANCELLED = 6,
+    VT_RESPONSE = 8
+  };
+  uint32_t job_id() const {
+    return GetField<uint32_t>(VT_JOB_ID, 0);
+  }
+  bool cancelled() const {
+    return GetField<uint8_t>(VT_CANCELLED, 0) != 0;
+  }
+  const flatbuffers::Vector<uint8_t> *response() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_RESPONSE);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint32_t>(verifier, VT_JOB_ID) &&
+           VerifyField<uint8_t>(verifier, VT_CANCELLED) &&
+           VerifyOffset(verifier, VT_RESPONSE) &&
+           verifier.Verify(response()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobFinishedEventBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_job_id(uint32_t job_id) {
+    fbb_.AddElement<uint32_t>(JobFinishedEvent::VT_JOB_ID, job_id, 0);
+  }
+  void add_cancelled(bool cancelled) {
+    fbb_.AddElement<uint8_t>(JobFinishedEvent::VT_CANCELLED, static_cast<uint8_t>(cancelled), 0);
+  }
+  void add_response(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response) {
+    fbb_.AddOffset(JobFinishedEvent::VT_RESPONSE, response);
+  }
+  explicit JobFinishedEventBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobFinishedEventBuilder &operator=(const JobFinishedEventBuilder &);
+  flatbuffers::Offset<JobFinishedEvent> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobFinishedEvent>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobFinishedEvent> CreateJobFinishedEvent(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    bool cancelled = false,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response = 0) {
+  JobFinishedEventBuilder builder_(_fbb);
+  builder_.add_response(response);
+  builder_.add_job_id(job_id);
+  builder_.add_cancelled(cancelled);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<JobFinishedEvent> CreateJobFinishedEventDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    uint32_t job_id = 0,
+    bool cancelled = false,
+    const std::vector<uint8_t> *response = nullptr) {
+  return mbtool::daemon::v3::CreateJobFinishedEvent(
+      _fbb,
+      job_id,
+      cancelled,
+      response ? _fbb.CreateVector<uint8_t>(*response) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_JOB_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,222 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct MbRequestStats;
+
+struct MbGetStatsRequest;
+
+struct MbGetStatsResponse;
+
+struct MbRequestStats FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_NAME = 4,
+    VT_COUNT = 6,
+    VT_LATENCY_P50_US = 8,
+    VT_LATENCY_P99_US = 10,
+    VT_LATENCY_MAX_US = 12,
+    VT_BYTES_IN = 14,
+    VT_BYTES_OUT = 16
+  };
+  const flatbuffers::String *name() const {
+    return GetPointer<const flatbuffers::String *>(VT_NAME);
+  }
+  uint64_t count() const {
+    return GetField<uint64_t>(VT_COUNT, 0);
+  }
+  uint64_t latency_p50_us() const {
+    return GetField<uint64_t>(VT_LATENCY_P50_US, 0);
+  }
+  uint64_t latency_p99_us() const {
+    return GetField<uint64_t>(VT_LATENCY_P99_US, 0);
+  }
+  uint64_t latency_max_us() const {
+    return GetField<uint64_t>(VT_LATENCY_MAX_US, 0);
+  }
+  uint64_t bytes_in() const {
+    return GetField<uint64_t>(VT_BYTES_IN, 0);
+  }
+  uint64_t bytes_out() const {
+    return GetField<uint64_t>(VT_BYTES_OUT, 0);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_NAME) &&
+           verifier.Verify(name()) &&
+           VerifyField<uint64_t>(verifier, VT_COUNT) &&
+           VerifyField<uint64_t>(verifier, VT_LATENCY_P50_US) &&
+           VerifyField<uint64_t>(verifier, VT_LATENCY_P99_US) &&
+           VerifyField<uint64_t>(verifier, VT_LATENCY_MAX_US) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_IN) &&
+           VerifyField<uint64_t>(verifier, VT_BYTES_OUT) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbRequestStatsBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_name(flatbuffers::Offset<flatbuffers::String> name) {
+    fbb_.AddOffset(MbRequestStats::VT_NAME, name);
+  }
+  void add_count(uint64_t count) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_COUNT, count, 0);
+  }
+  void add_latency_p50_us(uint64_t latency_p50_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_LATENCY_P50_US, latency_p50_us, 0);
+  }
+  void add_latency_p99_us(uint64_t latency_p99_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_LATENCY_P99_US, latency_p99_us, 0);
+  }
+  void add_latency_max_us(uint64_t latency_max_us) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_LATENCY_MAX_US, latency_max_us, 0);
+  }
+  void add_bytes_in(uint64_t bytes_in) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_BYTES_IN, bytes_in, 0);
+  }
+  void add_bytes_out(uint64_t bytes_out) {
+    fbb_.AddElement<uint64_t>(MbRequestStats::VT_BYTES_OUT, bytes_out, 0);
+  }
+  explicit MbRequestStatsBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbRequestStatsBuilder &operator=(const MbRequestStatsBuilder &);
+  flatbuffers::Offset<MbRequestStats> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbRequestStats>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbRequestStats> CreateMbRequestStats(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> name = 0,
+    uint64_t count = 0,
+    uint64_t latency_p50_us = 0,
+    uint64_t latency_p99_us = 0,
+    uint64_t latency_max_us = 0,
+    uint64_t bytes_in = 0,
+    uint64_t bytes_out = 0) {
+  MbRequestStatsBuilder builder_(_fbb);
+  builder_.add_bytes_out(bytes_out);
+  builder_.add_bytes_in(bytes_in);
+  builder_.add_latency_max_us(latency_max_us);
+  builder_.add_latency_p99_us(latency_p99_us);
+  builder_.add_latency_p50_us(latency_p50_us);
+  builder_.add_count(count);
+  builder_.add_name(name);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbRequestStats> CreateMbRequestStatsDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *name = nullptr,
+    uint64_t count = 0,
+    uint64_t latency_p50_us = 0,
+    uint64_t latency_p99_us = 0,
+    uint64_t latency_max_us = 0,
+    uint64_t bytes_in = 0,
+    uint64_t bytes_out = 0) {
+  return mbtool::daemon::v3::CreateMbRequestStats(
+      _fbb,
+      name ? _fbb.CreateString(name) : 0,
+      count,
+      latency_p50_us,
+      latency_p99_us,
+      latency_max_us,
+      bytes_in,
+      bytes_out);
+}
+
+struct MbGetStatsRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetStatsRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  explicit MbGetStatsRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetStatsRequestBuilder &operator=(const MbGetStatsRequestBuilder &);
+  flatbuffers::Offset<MbGetStatsRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbGetStatsRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetStatsRequest> CreateMbGetStatsRequest(
+    flatbuffers::FlatBufferBuilder &_fbb) {
+  MbGetStatsRequestBuilder builder_(_fbb);
+  return builder_.Finish();
+}
+
+struct MbGetStatsResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_STATS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>> *stats() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>> *>(VT_STATS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_STATS) &&
+           verifier.Verify(stats()) &&
+           verifier.VerifyVectorOfTables(stats()) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbGetStatsResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_stats(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>>> stats) {
+    fbb_.AddOffset(MbGetStatsResponse::VT_STATS, stats);
+  }
+  explicit MbGetStatsResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbGetStatsResponseBuilder &operator=(const MbGetStatsResponseBuilder &);
+  flatbuffers::Offset<MbGetStatsResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbGetStatsResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbGetStatsResponse> CreateMbGetStatsResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<MbRequestStats>>> stats = 0) {
+  MbGetStatsResponseBuilder builder_(_fbb);
+  builder_.add_stats(stats);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<MbGetStatsResponse> CreateMbGetStatsResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<MbRequestStats>> *stats = nullptr) {
+  return mbtool::daemon::v3::CreateMbGetStatsResponse(
+      _fbb,
+      stats ? _fbb.CreateVector<flatbuffers::Offset<MbRequestStats>>(*stats) : 0);
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_MBGETSTATS_MBTOOL_DAEMON_V3_H_
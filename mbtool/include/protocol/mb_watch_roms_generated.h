@@ -0,0 +1,119 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_MBWATCHROMS_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_MBWATCHROMS_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct MbWatchRomsRequest;
+
+struct MbWatchRomsResponse;
+
+struct MbRomsChangedEvent;
+
+struct MbWatchRomsRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ENABLE = 4
+  };
+  bool enable() const {
+    return GetField<uint8_t>(VT_ENABLE, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<uint8_t>(verifier, VT_ENABLE) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbWatchRomsRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_enable(bool enable) {
+    fbb_.AddElement<uint8_t>(MbWatchRomsRequest::VT_ENABLE, static_cast<uint8_t>(enable), 0);
+  }
+  explicit MbWatchRomsRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbWatchRomsRequestBuilder &operator=(const MbWatchRomsRequestBuilder &);
+  flatbuffers::Offset<MbWatchRomsRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbWatchRomsRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbWatchRomsRequest> CreateMbWatchRomsRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    bool enable = false) {
+  MbWatchRomsRequestBuilder builder_(_fbb);
+  builder_.add_enable(enable);
+  return builder_.Finish();
+}
+
+struct MbWatchRomsResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbWatchRomsResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  explicit MbWatchRomsResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbWatchRomsResponseBuilder &operator=(const MbWatchRomsResponseBuilder &);
+  flatbuffers::Offset<MbWatchRomsResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbWatchRomsResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbWatchRomsResponse> CreateMbWatchRomsResponse(
+    flatbuffers::FlatBufferBuilder &_fbb) {
+  MbWatchRomsResponseBuilder builder_(_fbb);
+  return builder_.Finish();
+}
+
+struct MbRomsChangedEvent FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           verifier.EndTable();
+  }
+};
+
+struct MbRomsChangedEventBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  explicit MbRomsChangedEventBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  MbRomsChangedEventBuilder &operator=(const MbRomsChangedEventBuilder &);
+  flatbuffers::Offset<MbRomsChangedEvent> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<MbRomsChangedEvent>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<MbRomsChangedEvent> CreateMbRomsChangedEvent(
+    flatbuffers::FlatBufferBuilder &_fbb) {
+  MbRomsChangedEventBuilder builder_(_fbb);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_MBWATCHROMS_MBTOOL_DAEMON_V3_H_
@@ -0,0 +1,212 @@
+// automatically generated by the FlatBuffers compiler, do not modify
+
+
+#ifndef FLATBUFFERS_GENERATED_PATHCOPYTREE_MBTOOL_DAEMON_V3_H_
+#define FLATBUFFERS_GENERATED_PATHCOPYTREE_MBTOOL_DAEMON_V3_H_
+
+#include "flatbuffers/flatbuffers.h"
+
+namespace mbtool {
+namespace daemon {
+namespace v3 {
+
+struct PathCopyTreeError;
+
+struct PathCopyTreeRequest;
+
+struct PathCopyTreeResponse;
+
+struct PathCopyTreeError FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERRNO_VALUE = 4,
+    VT_MSG = 6,
+    VT_PATH = 8
+  };
+  int32_t errno_value() const {
+    return GetField<int32_t>(VT_ERRNO_VALUE, 0);
+  }
+  const flatbuffers::String *msg() const {
+    return GetPointer<const flatbuffers::String *>(VT_MSG);
+  }
+  const flatbuffers::String *path() const {
+    return GetPointer<const flatbuffers::String *>(VT_PATH);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyField<int32_t>(verifier, VT_ERRNO_VALUE) &&
+           VerifyOffset(verifier, VT_MSG) &&
+           verifier.Verify(msg()) &&
+           VerifyOffset(verifier, VT_PATH) &&
+           verifier.Verify(path()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyTreeErrorBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_errno_value(int32_t errno_value) {
+    fbb_.AddElement<int32_t>(PathCopyTreeError::VT_ERRNO_VALUE, errno_value, 0);
+  }
+  void add_msg(flatbuffers::Offset<flatbuffers::String> msg) {
+    fbb_.AddOffset(PathCopyTreeError::VT_MSG, msg);
+  }
+  void add_path(flatbuffers::Offset<flatbuffers::String> path) {
+    fbb_.AddOffset(PathCopyTreeError::VT_PATH, path);
+  }
+  explicit PathCopyTreeErrorBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyTreeErrorBuilder &operator=(const PathCopyTreeErrorBuilder &);
+  flatbuffers::Offset<PathCopyTreeError> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyTreeError>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyTreeError> CreatePathCopyTreeError(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    flatbuffers::Offset<flatbuffers::String> msg = 0,
+    flatbuffers::Offset<flatbuffers::String> path = 0) {
+  PathCopyTreeErrorBuilder builder_(_fbb);
+  builder_.add_path(path);
+  builder_.add_msg(msg);
+  builder_.add_errno_value(errno_value);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathCopyTreeError> CreatePathCopyTreeErrorDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    int32_t errno_value = 0,
+    const char *msg = nullptr,
+    const char *path = nullptr) {
+  return mbtool::daemon::v3::CreatePathCopyTreeError(
+      _fbb,
+      errno_value,
+      msg ? _fbb.CreateString(msg) : 0,
+      path ? _fbb.CreateString(path) : 0);
+}
+
+struct PathCopyTreeRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_SOURCE = 4,
+    VT_TARGET = 6,
+    VT_EXCLUDE_TOP_LEVEL = 8
+  };
+  const flatbuffers::String *source() const {
+    return GetPointer<const flatbuffers::String *>(VT_SOURCE);
+  }
+  const flatbuffers::String *target() const {
+    return GetPointer<const flatbuffers::String *>(VT_TARGET);
+  }
+  bool exclude_top_level() const {
+    return GetField<uint8_t>(VT_EXCLUDE_TOP_LEVEL, 0) != 0;
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_SOURCE) &&
+           verifier.Verify(source()) &&
+           VerifyOffset(verifier, VT_TARGET) &&
+           verifier.Verify(target()) &&
+           VerifyField<uint8_t>(verifier, VT_EXCLUDE_TOP_LEVEL) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyTreeRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_source(flatbuffers::Offset<flatbuffers::String> source) {
+    fbb_.AddOffset(PathCopyTreeRequest::VT_SOURCE, source);
+  }
+  void add_target(flatbuffers::Offset<flatbuffers::String> target) {
+    fbb_.AddOffset(PathCopyTreeRequest::VT_TARGET, target);
+  }
+  void add_exclude_top_level(bool exclude_top_level) {
+    fbb_.AddElement<uint8_t>(PathCopyTreeRequest::VT_EXCLUDE_TOP_LEVEL, static_cast<uint8_t>(exclude_top_level), 0);
+  }
+  explicit PathCopyTreeRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyTreeRequestBuilder &operator=(const PathCopyTreeRequestBuilder &);
+  flatbuffers::Offset<PathCopyTreeRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyTreeRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyTreeRequest> CreatePathCopyTreeRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::String> source = 0,
+    flatbuffers::Offset<flatbuffers::String> target = 0,
+    bool exclude_top_level = false) {
+  PathCopyTreeRequestBuilder builder_(_fbb);
+  builder_.add_target(target);
+  builder_.add_source(source);
+  builder_.add_exclude_top_level(exclude_top_level);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<PathCopyTreeRequest> CreatePathCopyTreeRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const char *source = nullptr,
+    const char *target = nullptr,
+    bool exclude_top_level = false) {
+  return mbtool::daemon::v3::CreatePathCopyTreeRequest(
+      _fbb,
+      source ? _fbb.CreateString(source) : 0,
+      target ? _fbb.CreateString(target) : 0,
+      exclude_top_level);
+}
+
+struct PathCopyTreeResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_ERROR = 4
+  };
+  const PathCopyTreeError *error() const {
+    return GetPointer<const PathCopyTreeError *>(VT_ERROR);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_ERROR) &&
+           verifier.VerifyTable(error()) &&
+           verifier.EndTable();
+  }
+};
+
+struct PathCopyTreeResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_error(flatbuffers::Offset<PathCopyTreeError> error) {
+    fbb_.AddOffset(PathCopyTreeResponse::VT_ERROR, error);
+  }
+  explicit PathCopyTreeResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  PathCopyTreeResponseBuilder &operator=(const PathCopyTreeResponseBuilder &);
+  flatbuffers::Offset<PathCopyTreeResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<PathCopyTreeResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<PathCopyTreeResponse> CreatePathCopyTreeResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<PathCopyTreeError> error = 0) {
+  PathCopyTreeResponseBuilder builder_(_fbb);
+  builder_.add_error(error);
+  return builder_.Finish();
+}
+
+}  // namespace v3
+}  // namespace daemon
+}  // namespace mbtool
+
+#endif  // FLATBUFFERS_GENERATED_PATHCOPYTREE_MBTOOL_DAEMON_V3_H_
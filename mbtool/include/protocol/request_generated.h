@@ -17,15 +17,19 @@
 #include "file_selinux_set_label_generated.h"
 #include "file_stat_generated.h"
 #include "file_write_generated.h"
+#include "job_generated.h"
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_stats_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
+#include "mb_watch_roms_generated.h"
 #include "mb_wipe_rom_generated.h"
 #include "path_chmod_generated.h"
 #include "path_copy_generated.h"
+#include "path_copy_tree_generated.h"
 #include "path_delete_generated.h"
 #include "path_get_directory_size_generated.h"
 #include "path_mkdir_generated.h"
@@ -42,6 +46,10 @@ namespace v3 {
 
 struct Request;
 
+struct BatchRequest;
+
+struct JobSubmitRequest;
+
 enum RequestType {
   RequestType_NONE = 0,
   RequestType_FileChmodRequest = 1,
@@ -73,11 +81,17 @@ enum RequestType {
   RequestType_CryptoDecryptRequest = 27,
   RequestType_CryptoGetPwTypeRequest = 28,
   RequestType_PathReadlinkRequest = 29,
+  RequestType_MbGetStatsRequest = 30,
+  RequestType_BatchRequest = 31,
+  RequestType_MbWatchRomsRequest = 32,
+  RequestType_JobSubmitRequest = 33,
+  RequestType_JobCancelRequest = 34,
+  RequestType_PathCopyTreeRequest = 35,
   RequestType_MIN = RequestType_NONE,
-  RequestType_MAX = RequestType_PathReadlinkRequest
+  RequestType_MAX = RequestType_PathCopyTreeRequest
 };
 
-inline const RequestType (&EnumValuesRequestType())[30] {
+inline const RequestType (&EnumValuesRequestType())[36] {
   static const RequestType values[] = {
     RequestType_NONE,
     RequestType_FileChmodRequest,
@@ -108,7 +122,13 @@ inline const RequestType (&EnumValuesRequestType())[30] {
     RequestType_PathMkdirRequest,
     RequestType_CryptoDecryptRequest,
     RequestType_CryptoGetPwTypeRequest,
-    RequestType_PathReadlinkRequest
+    RequestType_PathReadlinkRequest,
+    RequestType_MbGetStatsRequest,
+    RequestType_BatchRequest,
+    RequestType_MbWatchRomsRequest,
+    RequestType_JobSubmitRequest,
+    RequestType_JobCancelRequest,
+    RequestType_PathCopyTreeRequest
   };
   return values;
 }
@@ -145,6 +165,12 @@ inline const char * const *EnumNamesRequestType() {
     "CryptoDecryptRequest",
     "CryptoGetPwTypeRequest",
     "PathReadlinkRequest",
+    "MbGetStatsRequest",
+    "BatchRequest",
+    "MbWatchRomsRequest",
+    "JobSubmitRequest",
+    "JobCancelRequest",
+    "PathCopyTreeRequest",
     nullptr
   };
   return names;
@@ -275,13 +301,38 @@ template<> struct RequestTypeTraits<PathReadlinkRequest> {
   static const RequestType enum_value = RequestType_PathReadlinkRequest;
 };
 
+template<> struct RequestTypeTraits<MbGetStatsRequest> {
+  static const RequestType enum_value = RequestType_MbGetStatsRequest;
+};
+
+template<> struct RequestTypeTraits<BatchRequest> {
+  static const RequestType enum_value = RequestType_BatchRequest;
+};
+
+template<> struct RequestTypeTraits<MbWatchRomsRequest> {
+  static const RequestType enum_value = RequestType_MbWatchRomsRequest;
+};
+
+template<> struct RequestTypeTraits<JobSubmitRequest> {
+  static const RequestType enum_value = RequestType_JobSubmitRequest;
+};
+
+template<> struct RequestTypeTraits<JobCancelRequest> {
+  static const RequestType enum_value = RequestType_JobCancelRequest;
+};
+
+template<> struct RequestTypeTraits<PathCopyTreeRequest> {
+  static const RequestType enum_value = RequestType_PathCopyTreeRequest;
+};
+
 bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj, RequestType type);
 bool VerifyRequestTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
 struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_REQUEST_TYPE = 4,
-    VT_REQUEST = 6
+    VT_REQUEST = 6,
+    VT_ID = 8
   };
   RequestType request_type() const {
     return static_cast<RequestType>(GetField<uint8_t>(VT_REQUEST_TYPE, 0));
@@ -377,11 +428,33 @@ struct Request FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const PathReadlinkRequest *request_as_PathReadlinkRequest() const {
     return request_type() == RequestType_PathReadlinkRequest ? static_cast<const PathReadlinkRequest *>(request()) : nullptr;
   }
+  const MbGetStatsRequest *request_as_MbGetStatsRequest() const {
+    return request_type() == RequestType_MbGetStatsRequest ? static_cast<const MbGetStatsRequest *>(request()) : nullptr;
+  }
+  const BatchRequest *request_as_BatchRequest() const {
+    return request_type() == RequestType_BatchRequest ? static_cast<const BatchRequest *>(request()) : nullptr;
+  }
+  const MbWatchRomsRequest *request_as_MbWatchRomsRequest() const {
+    return request_type() == RequestType_MbWatchRomsRequest ? static_cast<const MbWatchRomsRequest *>(request()) : nullptr;
+  }
+  const JobSubmitRequest *request_as_JobSubmitRequest() const {
+    return request_type() == RequestType_JobSubmitRequest ? static_cast<const JobSubmitRequest *>(request()) : nullptr;
+  }
+  const JobCancelRequest *request_as_JobCancelRequest() const {
+    return request_type() == RequestType_JobCancelRequest ? static_cast<const JobCancelRequest *>(request()) : nullptr;
+  }
+  const PathCopyTreeRequest *request_as_PathCopyTreeRequest() const {
+    return request_type() == RequestType_PathCopyTreeRequest ? static_cast<const PathCopyTreeRequest *>(request()) : nullptr;
+  }
+  uint32_t id() const {
+    return GetField<uint32_t>(VT_ID, 0);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_REQUEST_TYPE) &&
            VerifyOffset(verifier, VT_REQUEST) &&
            VerifyRequestType(verifier, request(), request_type()) &&
+           VerifyField<uint32_t>(verifier, VT_ID) &&
            verifier.EndTable();
   }
 };
@@ -502,6 +575,30 @@ template<> inline const PathReadlinkRequest *Request::request_as<PathReadlinkReq
   return request_as_PathReadlinkRequest();
 }
 
+template<> inline const MbGetStatsRequest *Request::request_as<MbGetStatsRequest>() const {
+  return request_as_MbGetStatsRequest();
+}
+
+template<> inline const BatchRequest *Request::request_as<BatchRequest>() const {
+  return request_as_BatchRequest();
+}
+
+template<> inline const MbWatchRomsRequest *Request::request_as<MbWatchRomsRequest>() const {
+  return request_as_MbWatchRomsRequest();
+}
+
+template<> inline const JobSubmitRequest *Request::request_as<JobSubmitRequest>() const {
+  return request_as_JobSubmitRequest();
+}
+
+template<> inline const JobCancelRequest *Request::request_as<JobCancelRequest>() const {
+  return request_as_JobCancelRequest();
+}
+
+template<> inline const PathCopyTreeRequest *Request::request_as<PathCopyTreeRequest>() const {
+  return request_as_PathCopyTreeRequest();
+}
+
 struct RequestBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -511,6 +608,9 @@ struct RequestBuilder {
   void add_request(flatbuffers::Offset<void> request) {
     fbb_.AddOffset(Request::VT_REQUEST, request);
   }
+  void add_id(uint32_t id) {
+    fbb_.AddElement<uint32_t>(Request::VT_ID, id, 0);
+  }
   explicit RequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -526,13 +626,106 @@ struct RequestBuilder {
 inline flatbuffers::Offset<Request> CreateRequest(
     flatbuffers::FlatBufferBuilder &_fbb,
     RequestType request_type = RequestType_NONE,
-    flatbuffers::Offset<void> request = 0) {
+    flatbuffers::Offset<void> request = 0,
+    uint32_t id = 0) {
   RequestBuilder builder_(_fbb);
+  builder_.add_id(id);
   builder_.add_request(request);
   builder_.add_request_type(request_type);
   return builder_.Finish();
 }
 
+struct BatchRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUESTS = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<Request>> *requests() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<Request>> *>(VT_REQUESTS);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_REQUESTS) &&
+           verifier.Verify(requests()) &&
+           verifier.VerifyVectorOfTables(requests()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_requests(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Request>>> requests) {
+    fbb_.AddOffset(BatchRequest::VT_REQUESTS, requests);
+  }
+  explicit BatchRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchRequestBuilder &operator=(const BatchRequestBuilder &);
+  flatbuffers::Offset<BatchRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<Request>>> requests = 0) {
+  BatchRequestBuilder builder_(_fbb);
+  builder_.add_requests(requests);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchRequest> CreateBatchRequestDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<Request>> *requests = nullptr) {
+  return mbtool::daemon::v3::CreateBatchRequest(
+      _fbb,
+      requests ? _fbb.CreateVector<flatbuffers::Offset<Request>>(*requests) : 0);
+}
+
+struct JobSubmitRequest FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_REQUEST = 4
+  };
+  const Request *request() const {
+    return GetPointer<const Request *>(VT_REQUEST);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_REQUEST) &&
+           verifier.VerifyTable(request()) &&
+           verifier.EndTable();
+  }
+};
+
+struct JobSubmitRequestBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_request(flatbuffers::Offset<Request> request) {
+    fbb_.AddOffset(JobSubmitRequest::VT_REQUEST, request);
+  }
+  explicit JobSubmitRequestBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  JobSubmitRequestBuilder &operator=(const JobSubmitRequestBuilder &);
+  flatbuffers::Offset<JobSubmitRequest> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<JobSubmitRequest>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<JobSubmitRequest> CreateJobSubmitRequest(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<Request> request = 0) {
+  JobSubmitRequestBuilder builder_(_fbb);
+  builder_.add_request(request);
+  return builder_.Finish();
+}
+
 inline bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj, RequestType type) {
   switch (type) {
     case RequestType_NONE: {
@@ -654,6 +847,30 @@ inline bool VerifyRequestType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const PathReadlinkRequest *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case RequestType_MbGetStatsRequest: {
+      auto ptr = reinterpret_cast<const MbGetStatsRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_BatchRequest: {
+      auto ptr = reinterpret_cast<const BatchRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_MbWatchRomsRequest: {
+      auto ptr = reinterpret_cast<const MbWatchRomsRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_JobSubmitRequest: {
+      auto ptr = reinterpret_cast<const JobSubmitRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_JobCancelRequest: {
+      auto ptr = reinterpret_cast<const JobCancelRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case RequestType_PathCopyTreeRequest: {
+      auto ptr = reinterpret_cast<const PathCopyTreeRequest *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
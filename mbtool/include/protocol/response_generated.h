@@ -17,15 +17,19 @@
 #include "file_selinux_set_label_generated.h"
 #include "file_stat_generated.h"
 #include "file_write_generated.h"
+#include "job_generated.h"
 #include "mb_get_booted_rom_id_generated.h"
 #include "mb_get_installed_roms_generated.h"
 #include "mb_get_packages_count_generated.h"
+#include "mb_get_stats_generated.h"
 #include "mb_get_version_generated.h"
 #include "mb_set_kernel_generated.h"
 #include "mb_switch_rom_generated.h"
+#include "mb_watch_roms_generated.h"
 #include "mb_wipe_rom_generated.h"
 #include "path_chmod_generated.h"
 #include "path_copy_generated.h"
+#include "path_copy_tree_generated.h"
 #include "path_delete_generated.h"
 #include "path_get_directory_size_generated.h"
 #include "path_mkdir_generated.h"
@@ -46,6 +50,10 @@ struct Unsupported;
 
 struct Response;
 
+struct BatchResponseEntry;
+
+struct BatchResponse;
+
 enum ResponseType {
   ResponseType_NONE = 0,
   ResponseType_Invalid = 1,
@@ -80,11 +88,20 @@ enum ResponseType {
   ResponseType_CryptoDecryptResponse = 30,
   ResponseType_CryptoGetPwTypeResponse = 31,
   ResponseType_PathReadlinkResponse = 32,
+  ResponseType_MbGetStatsResponse = 33,
+  ResponseType_BatchResponse = 34,
+  ResponseType_MbWatchRomsResponse = 35,
+  ResponseType_MbRomsChangedEvent = 36,
+  ResponseType_JobSubmitResponse = 37,
+  ResponseType_JobCancelResponse = 38,
+  ResponseType_JobProgressEvent = 39,
+  ResponseType_JobFinishedEvent = 40,
+  ResponseType_PathCopyTreeResponse = 41,
   ResponseType_MIN = ResponseType_NONE,
-  ResponseType_MAX = ResponseType_PathReadlinkResponse
+  ResponseType_MAX = ResponseType_PathCopyTreeResponse
 };
 
-inline const ResponseType (&EnumValuesResponseType())[33] {
+inline const ResponseType (&EnumValuesResponseType())[42] {
   static const ResponseType values[] = {
     ResponseType_NONE,
     ResponseType_Invalid,
@@ -118,7 +135,16 @@ inline const ResponseType (&EnumValuesResponseType())[33] {
     ResponseType_PathMkdirResponse,
     ResponseType_CryptoDecryptResponse,
     ResponseType_CryptoGetPwTypeResponse,
-    ResponseType_PathReadlinkResponse
+    ResponseType_PathReadlinkResponse,
+    ResponseType_MbGetStatsResponse,
+    ResponseType_BatchResponse,
+    ResponseType_MbWatchRomsResponse,
+    ResponseType_MbRomsChangedEvent,
+    ResponseType_JobSubmitResponse,
+    ResponseType_JobCancelResponse,
+    ResponseType_JobProgressEvent,
+    ResponseType_JobFinishedEvent,
+    ResponseType_PathCopyTreeResponse
   };
   return values;
 }
@@ -158,6 +184,15 @@ inline const char * const *EnumNamesResponseType() {
     "CryptoDecryptResponse",
     "CryptoGetPwTypeResponse",
     "PathReadlinkResponse",
+    "MbGetStatsResponse",
+    "BatchResponse",
+    "MbWatchRomsResponse",
+    "MbRomsChangedEvent",
+    "JobSubmitResponse",
+    "JobCancelResponse",
+    "JobProgressEvent",
+    "JobFinishedEvent",
+    "PathCopyTreeResponse",
     nullptr
   };
   return names;
@@ -300,6 +335,42 @@ template<> struct ResponseTypeTraits<PathReadlinkResponse> {
   static const ResponseType enum_value = ResponseType_PathReadlinkResponse;
 };
 
+template<> struct ResponseTypeTraits<MbGetStatsResponse> {
+  static const ResponseType enum_value = ResponseType_MbGetStatsResponse;
+};
+
+template<> struct ResponseTypeTraits<BatchResponse> {
+  static const ResponseType enum_value = ResponseType_BatchResponse;
+};
+
+template<> struct ResponseTypeTraits<MbWatchRomsResponse> {
+  static const ResponseType enum_value = ResponseType_MbWatchRomsResponse;
+};
+
+template<> struct ResponseTypeTraits<MbRomsChangedEvent> {
+  static const ResponseType enum_value = ResponseType_MbRomsChangedEvent;
+};
+
+template<> struct ResponseTypeTraits<JobSubmitResponse> {
+  static const ResponseType enum_value = ResponseType_JobSubmitResponse;
+};
+
+template<> struct ResponseTypeTraits<JobCancelResponse> {
+  static const ResponseType enum_value = ResponseType_JobCancelResponse;
+};
+
+template<> struct ResponseTypeTraits<JobProgressEvent> {
+  static const ResponseType enum_value = ResponseType_JobProgressEvent;
+};
+
+template<> struct ResponseTypeTraits<JobFinishedEvent> {
+  static const ResponseType enum_value = ResponseType_JobFinishedEvent;
+};
+
+template<> struct ResponseTypeTraits<PathCopyTreeResponse> {
+  static const ResponseType enum_value = ResponseType_PathCopyTreeResponse;
+};
+
 bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj, ResponseType type);
 bool VerifyResponseTypeVector(flatbuffers::Verifier &verifier, const flatbuffers::Vector<flatbuffers::Offset<void>> *values, const flatbuffers::Vector<uint8_t> *types);
 
@@ -362,7 +433,8 @@ inline flatbuffers::Offset<Unsupported> CreateUnsupported(
 struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   enum {
     VT_RESPONSE_TYPE = 4,
-    VT_RESPONSE = 6
+    VT_RESPONSE = 6,
+    VT_ID = 8
   };
   ResponseType response_type() const {
     return static_cast<ResponseType>(GetField<uint8_t>(VT_RESPONSE_TYPE, 0));
@@ -467,11 +539,42 @@ struct Response FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
   const PathReadlinkResponse *response_as_PathReadlinkResponse() const {
     return response_type() == ResponseType_PathReadlinkResponse ? static_cast<const PathReadlinkResponse *>(response()) : nullptr;
   }
+  const MbGetStatsResponse *response_as_MbGetStatsResponse() const {
+    return response_type() == ResponseType_MbGetStatsResponse ? static_cast<const MbGetStatsResponse *>(response()) : nullptr;
+  }
+  const BatchResponse *response_as_BatchResponse() const {
+    return response_type() == ResponseType_BatchResponse ? static_cast<const BatchResponse *>(response()) : nullptr;
+  }
+  const MbWatchRomsResponse *response_as_MbWatchRomsResponse() const {
+    return response_type() == ResponseType_MbWatchRomsResponse ? static_cast<const MbWatchRomsResponse *>(response()) : nullptr;
+  }
+  const MbRomsChangedEvent *response_as_MbRomsChangedEvent() const {
+    return response_type() == ResponseType_MbRomsChangedEvent ? static_cast<const MbRomsChangedEvent *>(response()) : nullptr;
+  }
+  const JobSubmitResponse *response_as_JobSubmitResponse() const {
+    return response_type() == ResponseType_JobSubmitResponse ? static_cast<const JobSubmitResponse *>(response()) : nullptr;
+  }
+  const JobCancelResponse *response_as_JobCancelResponse() const {
+    return response_type() == ResponseType_JobCancelResponse ? static_cast<const JobCancelResponse *>(response()) : nullptr;
+  }
+  const JobProgressEvent *response_as_JobProgressEvent() const {
+    return response_type() == ResponseType_JobProgressEvent ? static_cast<const JobProgressEvent *>(response()) : nullptr;
+  }
+  const JobFinishedEvent *response_as_JobFinishedEvent() const {
+    return response_type() == ResponseType_JobFinishedEvent ? static_cast<const JobFinishedEvent *>(response()) : nullptr;
+  }
+  const PathCopyTreeResponse *response_as_PathCopyTreeResponse() const {
+    return response_type() == ResponseType_PathCopyTreeResponse ? static_cast<const PathCopyTreeResponse *>(response()) : nullptr;
+  }
+  uint32_t id() const {
+    return GetField<uint32_t>(VT_ID, 0);
+  }
   bool Verify(flatbuffers::Verifier &verifier) const {
     return VerifyTableStart(verifier) &&
            VerifyField<uint8_t>(verifier, VT_RESPONSE_TYPE) &&
            VerifyOffset(verifier, VT_RESPONSE) &&
            VerifyResponseType(verifier, response(), response_type()) &&
+           VerifyField<uint32_t>(verifier, VT_ID) &&
            verifier.EndTable();
   }
 };
@@ -604,6 +707,42 @@ template<> inline const PathReadlinkResponse *Response::response_as<PathReadlink
   return response_as_PathReadlinkResponse();
 }
 
+template<> inline const MbGetStatsResponse *Response::response_as<MbGetStatsResponse>() const {
+  return response_as_MbGetStatsResponse();
+}
+
+template<> inline const BatchResponse *Response::response_as<BatchResponse>() const {
+  return response_as_BatchResponse();
+}
+
+template<> inline const MbWatchRomsResponse *Response::response_as<MbWatchRomsResponse>() const {
+  return response_as_MbWatchRomsResponse();
+}
+
+template<> inline const MbRomsChangedEvent *Response::response_as<MbRomsChangedEvent>() const {
+  return response_as_MbRomsChangedEvent();
+}
+
+template<> inline const JobSubmitResponse *Response::response_as<JobSubmitResponse>() const {
+  return response_as_JobSubmitResponse();
+}
+
+template<> inline const JobCancelResponse *Response::response_as<JobCancelResponse>() const {
+  return response_as_JobCancelResponse();
+}
+
+template<> inline const JobProgressEvent *Response::response_as<JobProgressEvent>() const {
+  return response_as_JobProgressEvent();
+}
+
+template<> inline const JobFinishedEvent *Response::response_as<JobFinishedEvent>() const {
+  return response_as_JobFinishedEvent();
+}
+
+template<> inline const PathCopyTreeResponse *Response::response_as<PathCopyTreeResponse>() const {
+  return response_as_PathCopyTreeResponse();
+}
+
 struct ResponseBuilder {
   flatbuffers::FlatBufferBuilder &fbb_;
   flatbuffers::uoffset_t start_;
@@ -613,6 +752,9 @@ struct ResponseBuilder {
   void add_response(flatbuffers::Offset<void> response) {
     fbb_.AddOffset(Response::VT_RESPONSE, response);
   }
+  void add_id(uint32_t id) {
+    fbb_.AddElement<uint32_t>(Response::VT_ID, id, 0);
+  }
   explicit ResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
         : fbb_(_fbb) {
     start_ = fbb_.StartTable();
@@ -628,13 +770,114 @@ struct ResponseBuilder {
 inline flatbuffers::Offset<Response> CreateResponse(
     flatbuffers::FlatBufferBuilder &_fbb,
     ResponseType response_type = ResponseType_NONE,
-    flatbuffers::Offset<void> response = 0) {
+    flatbuffers::Offset<void> response = 0,
+    uint32_t id = 0) {
   ResponseBuilder builder_(_fbb);
+  builder_.add_id(id);
   builder_.add_response(response);
   builder_.add_response_type(response_type);
   return builder_.Finish();
 }
 
+struct BatchResponseEntry FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESPONSE = 4
+  };
+  const flatbuffers::Vector<uint8_t> *response() const {
+    return GetPointer<const flatbuffers::Vector<uint8_t> *>(VT_RESPONSE);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_RESPONSE) &&
+           verifier.Verify(response()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseEntryBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_response(flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response) {
+    fbb_.AddOffset(BatchResponseEntry::VT_RESPONSE, response);
+  }
+  explicit BatchResponseEntryBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseEntryBuilder &operator=(const BatchResponseEntryBuilder &);
+  flatbuffers::Offset<BatchResponseEntry> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchResponseEntry>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponseEntry> CreateBatchResponseEntry(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<uint8_t>> response = 0) {
+  BatchResponseEntryBuilder builder_(_fbb);
+  builder_.add_response(response);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchResponseEntry> CreateBatchResponseEntryDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<uint8_t> *response = nullptr) {
+  return mbtool::daemon::v3::CreateBatchResponseEntry(
+      _fbb,
+      response ? _fbb.CreateVector<uint8_t>(*response) : 0);
+}
+
+struct BatchResponse FLATBUFFERS_FINAL_CLASS : private flatbuffers::Table {
+  enum {
+    VT_RESPONSES = 4
+  };
+  const flatbuffers::Vector<flatbuffers::Offset<BatchResponseEntry>> *responses() const {
+    return GetPointer<const flatbuffers::Vector<flatbuffers::Offset<BatchResponseEntry>> *>(VT_RESPONSES);
+  }
+  bool Verify(flatbuffers::Verifier &verifier) const {
+    return VerifyTableStart(verifier) &&
+           VerifyOffset(verifier, VT_RESPONSES) &&
+           verifier.Verify(responses()) &&
+           verifier.VerifyVectorOfTables(responses()) &&
+           verifier.EndTable();
+  }
+};
+
+struct BatchResponseBuilder {
+  flatbuffers::FlatBufferBuilder &fbb_;
+  flatbuffers::uoffset_t start_;
+  void add_responses(flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchResponseEntry>>> responses) {
+    fbb_.AddOffset(BatchResponse::VT_RESPONSES, responses);
+  }
+  explicit BatchResponseBuilder(flatbuffers::FlatBufferBuilder &_fbb)
+        : fbb_(_fbb) {
+    start_ = fbb_.StartTable();
+  }
+  BatchResponseBuilder &operator=(const BatchResponseBuilder &);
+  flatbuffers::Offset<BatchResponse> Finish() {
+    const auto end = fbb_.EndTable(start_);
+    auto o = flatbuffers::Offset<BatchResponse>(end);
+    return o;
+  }
+};
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponse(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    flatbuffers::Offset<flatbuffers::Vector<flatbuffers::Offset<BatchResponseEntry>>> responses = 0) {
+  BatchResponseBuilder builder_(_fbb);
+  builder_.add_responses(responses);
+  return builder_.Finish();
+}
+
+inline flatbuffers::Offset<BatchResponse> CreateBatchResponseDirect(
+    flatbuffers::FlatBufferBuilder &_fbb,
+    const std::vector<flatbuffers::Offset<BatchResponseEntry>> *responses = nullptr) {
+  return mbtool::daemon::v3::CreateBatchResponse(
+      _fbb,
+      responses ? _fbb.CreateVector<flatbuffers::Offset<BatchResponseEntry>>(*responses) : 0);
+}
+
 inline bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj, ResponseType type) {
   switch (type) {
     case ResponseType_NONE: {
@@ -768,6 +1011,42 @@ inline bool VerifyResponseType(flatbuffers::Verifier &verifier, const void *obj,
       auto ptr = reinterpret_cast<const PathReadlinkResponse *>(obj);
       return verifier.VerifyTable(ptr);
     }
+    case ResponseType_MbGetStatsResponse: {
+      auto ptr = reinterpret_cast<const MbGetStatsResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_BatchResponse: {
+      auto ptr = reinterpret_cast<const BatchResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbWatchRomsResponse: {
+      auto ptr = reinterpret_cast<const MbWatchRomsResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_MbRomsChangedEvent: {
+      auto ptr = reinterpret_cast<const MbRomsChangedEvent *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobSubmitResponse: {
+      auto ptr = reinterpret_cast<const JobSubmitResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobCancelResponse: {
+      auto ptr = reinterpret_cast<const JobCancelResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobProgressEvent: {
+      auto ptr = reinterpret_cast<const JobProgressEvent *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_JobFinishedEvent: {
+      auto ptr = reinterpret_cast<const JobFinishedEvent *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
+    case ResponseType_PathCopyTreeResponse: {
+      auto ptr = reinterpret_cast<const PathCopyTreeResponse *>(obj);
+      return verifier.VerifyTable(ptr);
+    }
     default: return false;
   }
 }
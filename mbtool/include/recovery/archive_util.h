@@ -21,9 +21,14 @@
 
 #include <archive.h>
 
+#include "mbbootimg/ramdisk.h"
+
 namespace mb
 {
+class File;
 
 bool la_copy_data_to_fd(archive *a, int fd);
+int la_open_file(archive *a, File &file);
+void la_support_ramdisk(archive *a, bootimg::RamdiskCompression compression);
 
 }
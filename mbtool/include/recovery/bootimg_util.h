@@ -19,17 +19,13 @@
 
 #pragma once
 
-#include <string>
+#include <vector>
 
 #include "mbbootimg/reader.h"
-#include "mbbootimg/writer.h"
 
 namespace mb
 {
 
-bool bi_copy_data_to_fd(bootimg::Reader &reader, int fd);
-bool bi_copy_file_to_data(const std::string &path, bootimg::Writer &writer);
-bool bi_copy_data_to_file(bootimg::Reader &reader, const std::string &path);
-bool bi_copy_data_to_data(bootimg::Reader &reader, bootimg::Writer &writer);
+bool bi_read_data(bootimg::Reader &reader, std::vector<unsigned char> &data_out);
 
 }
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mbcommon/common.h"
+
+namespace mb
+{
+
+/*!
+ * \brief Content-addressed store for deduplicated backups
+ *
+ * Files are split into content-defined chunks that are stored once under
+ * `chunks/` by their SHA-256 digest. Each backed up directory is described by
+ * a manifest that lists the metadata of every path and the chunks of every
+ * regular file. Every manifest has a random ID and is registered under
+ * `refs/<ID>` so that gc() knows which chunks are still in use.
+ *
+ * Opening a store takes a shared lock on it, which is held until the object
+ * is destroyed. gc() only runs if it can take the lock exclusively, so it
+ * never runs alongside a backup or restore.
+ */
+class ChunkStore
+{
+public:
+    ChunkStore();
+    ~ChunkStore();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ChunkStore)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ChunkStore)
+
+    bool open(const std::string &path, bool create);
+
+    const std::string & path() const;
+
+    bool put(const void *data, size_t size, std::string &hash_out);
+    bool get(const std::string &hash, std::vector<unsigned char> &buf) const;
+
+    bool begin_ref(std::string &id_out);
+    bool commit_ref(const std::string &id, const std::string &manifest_path);
+    void abort_ref(const std::string &id);
+
+    bool gc(const std::vector<std::string> &search_dirs, bool prune);
+
+private:
+    std::string _path;
+    int _lock_fd;
+
+    std::string chunk_path(const std::string &hash) const;
+    std::string ref_path(const std::string &id) const;
+};
+
+bool chunked_backup_directory(ChunkStore &store,
+                              const std::string &manifest_path,
+                              const std::string &directory,
+                              const std::vector<std::string> &exclusions);
+bool chunked_restore_directory(const std::string &manifest_path,
+                               const std::string &directory);
+
+}
@@ -37,4 +37,13 @@ enum class CreateImageResult
 CreateImageResult create_ext4_image(const std::string &path, uint64_t size);
 bool fsck_ext4_image(const std::string &image);
 
+bool trim_ext4_image(const std::string &image, uint64_t &trimmed);
+bool shrink_ext4_image(const std::string &image, uint64_t &new_size);
+bool grow_ext4_image(const std::string &image, uint64_t size);
+
+bool backup_ext4_image_blocks(const std::string &image,
+                              const std::string &output_file);
+bool restore_ext4_image_blocks(const std::string &input_file,
+                               const std::string &image);
+
 }
@@ -22,11 +22,14 @@
 #include <memory>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_map>
 
 #include "mbcommon/common.h"
 #include "mbcommon/flags.h"
 #include "mbdevice/device.h"
+#include "mbutil/archive.h"
+#include "mbutil/loopdev.h"
 
 #include "util/legacy_property_service.h"
 #include "util/roms.h"
@@ -81,6 +84,7 @@ protected:
     virtual void on_cleanup(ProceedState ret);
 
     std::string _zip_file;
+    util::ArchiveIndex _zip_index;
     std::string _chroot;
     std::string _temp;
     int _interface;
@@ -110,7 +114,14 @@ protected:
     bool _is_aroma;
     bool _use_fuse_exfat;
 
-    std::vector<std::string> _associated_loop_devs;
+    // The pool must outlive the devices attached from it
+    util::LoopDevicePool _loop_pool;
+    std::vector<util::LoopDevice> _loop_devs;
+
+    // Images created in the background while the chroot is being set up
+    std::thread _image_thread;
+    uint64_t _system_image_size;
+    bool _temp_image_created;
 
     std::string in_chroot(const std::string &path) const;
 
@@ -132,6 +143,8 @@ private:
     bool extract_multiboot_files();
     bool set_up_busybox_wrapper();
     bool create_image(const std::string &path, uint64_t size);
+    void start_image_creation();
+    void wait_for_image_creation();
     bool system_image_copy(const std::string &source,
                            const std::string &image, bool reverse);
     bool mount_dir_or_image(const std::string &source,
@@ -141,6 +154,7 @@ private:
                             uint64_t image_size);
     static bool change_root(const std::string &path);
     bool set_up_legacy_properties();
+    void updater_commands(std::string_view data);
     bool updater_fd_reader(int stdio_fd, int command_fd);
     bool run_real_updater();
     bool run_debug_shell();
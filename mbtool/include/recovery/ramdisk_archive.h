@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include "mbcommon/common.h"
+
+#include "recovery/ramdisk_compress.h"
+
+namespace mb
+{
+class File;
+
+/*!
+ * \brief In-memory model of a cpio ramdisk
+ *
+ * The contents of every entry are stored back to back in a single arena and
+ * entries only hold the offset and size of their data. Unmodified entries
+ * (and hard links) keep referring to the data that was read from the original
+ * archive and modified entries append their new contents to the arena. This
+ * allows the ramdisk to be patched without extracting it to disk.
+ *
+ * When the ramdisk is saved, gzip, xz, and lz4 legacy compression is done on
+ * multiple threads. For lz4 legacy ramdisks, frames whose contents did not
+ * change are copied verbatim from the original ramdisk.
+ *
+ * Paths are relative to the root of the ramdisk. Leading slashes and `./`
+ * components are ignored.
+ */
+class RamdiskArchive
+{
+public:
+    RamdiskArchive();
+    ~RamdiskArchive();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(RamdiskArchive)
+
+    bool load(File &input);
+    bool save(const std::string &output_file) const;
+    bool save(std::vector<unsigned char> &output) const;
+
+    std::optional<mode_t> mode(const std::string &path) const;
+
+    bool read_file(const std::string &path, std::string &data_out) const;
+    bool read_symlink(const std::string &path, std::string &target_out) const;
+
+    bool write_file(const std::string &path, std::string_view data,
+                    mode_t perm);
+    bool copy_from_disk(const std::string &source, const std::string &path,
+                        mode_t perm);
+    bool symlink(const std::string &target, const std::string &path);
+    bool rename(const std::string &from, const std::string &to);
+    bool remove(const std::string &path);
+    bool move_to_front(const std::string &path);
+
+private:
+    using ScopedArchiveEntry =
+            std::unique_ptr<archive_entry, decltype(archive_entry_free) *>;
+
+    struct Entry
+    {
+        ScopedArchiveEntry ae;
+        size_t offset;
+        size_t size;
+    };
+
+    int _format;
+    std::vector<int> _filters;
+    bool _lz4_legacy;
+    std::vector<Lz4LegacyFrame> _lz4_frames;
+    uint32_t _xz_check;
+
+    std::vector<unsigned char> _arena;
+    std::vector<Entry> _entries;
+    std::unordered_map<std::string, size_t> _index;
+    la_int64_t _next_ino;
+
+    std::optional<size_t> find(const std::string &path) const;
+    std::optional<size_t> create(const std::string &path, mode_t type,
+                                 mode_t perm);
+    bool ensure_parent(const std::string &path);
+    bool replace_data(const std::string &path, size_t offset, size_t size,
+                      mode_t perm);
+    void set_data(Entry &entry, size_t offset, size_t size);
+
+    bool prepare_writer(archive *a, bool compress) const;
+    bool write_entries(archive *a) const;
+    bool write_archive(std::vector<unsigned char> &output,
+                       bool compress) const;
+};
+
+}
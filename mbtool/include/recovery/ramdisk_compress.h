@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <openssl/sha.h>
+
+namespace mb
+{
+class File;
+
+//! Size of the decompressed data in each frame of an lz4 legacy stream
+constexpr size_t LZ4_LEGACY_BLOCK_SIZE = 8 * 1024 * 1024;
+
+/*!
+ * \brief Frame of an lz4 legacy stream
+ *
+ * The decompressed digest is kept so that frames whose contents did not
+ * change can be copied verbatim when the ramdisk is recompressed.
+ */
+struct Lz4LegacyFrame
+{
+    //! Compressed data (without the size field)
+    std::vector<unsigned char> data;
+    //! Size of the decompressed data
+    size_t size;
+    //! SHA-256 digest of the decompressed data
+    std::array<unsigned char, SHA256_DIGEST_LENGTH> digest;
+};
+
+bool is_lz4_legacy(File &file);
+bool read_xz_check(File &file, uint32_t &check_out);
+
+bool lz4_legacy_decompress(File &input, std::vector<unsigned char> &output,
+                           std::vector<Lz4LegacyFrame> &frames_out,
+                           unsigned int threads);
+bool lz4_legacy_compress(const std::vector<unsigned char> &input,
+                         std::vector<unsigned char> &output,
+                         const std::vector<Lz4LegacyFrame> &original_frames,
+                         unsigned int threads);
+bool gzip_compress(const std::vector<unsigned char> &input,
+                   std::vector<unsigned char> &output,
+                   unsigned int threads);
+bool xz_compress(const std::vector<unsigned char> &input,
+                 std::vector<unsigned char> &output,
+                 uint32_t check, unsigned int threads);
+
+}
@@ -24,8 +24,9 @@
 
 namespace mb
 {
+class RamdiskArchive;
 
-using RamdiskPatcherFn = bool(const std::string &dir);
+using RamdiskPatcherFn = bool(RamdiskArchive &ramdisk);
 
 std::function<RamdiskPatcherFn>
 rp_write_rom_id(const std::string &rom_id);
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "mbcommon/common.h"
+
+/*
+ * Lightweight tracing of the boot process. Spans are recorded with monotonic
+ * timestamps into a fixed, preallocated ring buffer and are written out with
+ * trace_write() once there is somewhere to store them. While system tracing is
+ * on, the spans are also emitted as ATRACE sections.
+ */
+
+namespace mb
+{
+
+/*!
+ * \brief Maximum number of trace events that are kept
+ *
+ * Events are recorded into a ring buffer, so once it is full, the oldest
+ * events are overwritten.
+ */
+constexpr size_t TRACE_MAX_EVENTS = 4096;
+
+/*! Names longer than this are truncated */
+constexpr size_t TRACE_MAX_NAME = 48;
+
+void trace_begin(const char *name);
+void trace_end(const char *name);
+
+bool trace_write(const char *path);
+
+/*!
+ * \brief Record a span for the lifetime of the object
+ */
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name);
+    ~TraceSpan();
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(TraceSpan)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(TraceSpan)
+
+private:
+    char _name[TRACE_MAX_NAME];
+};
+
+}
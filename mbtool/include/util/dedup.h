@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <cstdint>
+
+namespace mb
+{
+
+// Files smaller than this are not worth the extra extent and inode bookkeeping
+constexpr uint64_t DEDUP_DEFAULT_MIN_SIZE = 64 * 1024;
+
+struct DedupOptions
+{
+    // Fall back to hard links on filesystems that cannot share extents. The
+    // linked directories must never be written to outside of mbtool.
+    bool allow_hardlinks = false;
+    // Only report what would be deduplicated
+    bool dry_run = false;
+    // Minimum size of files to consider
+    uint64_t min_size = DEDUP_DEFAULT_MIN_SIZE;
+};
+
+struct DedupStats
+{
+    // Regular files that were considered
+    uint64_t files = 0;
+    // Files that had the same size as another file and were hashed
+    uint64_t hashed = 0;
+    // Files that now share their data with another file
+    uint64_t shared = 0;
+    // Files that were replaced by hard links
+    uint64_t linked = 0;
+    // Bytes that no longer take up their own space
+    uint64_t bytes = 0;
+};
+
+bool dedup_directories(const std::vector<std::string> &dirs,
+                       const DedupOptions &options, DedupStats &stats);
+bool dedup_installed_roms(const DedupOptions &options, DedupStats &stats);
+
+bool dedup_unshare_hardlinks(const std::string &dir);
+
+int dedup_main(int argc, char *argv[]);
+
+}
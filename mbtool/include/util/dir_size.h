@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "mbcommon/outcome.h"
+
+namespace mb
+{
+
+struct FileId
+{
+    dev_t dev;
+    ino_t ino;
+
+    bool operator==(const FileId &other) const
+    {
+        return dev == other.dev && ino == other.ino;
+    }
+};
+
+struct FileIdHash
+{
+    size_t operator()(const FileId &id) const
+    {
+        return std::hash<uint64_t>()(static_cast<uint64_t>(id.dev))
+                ^ (std::hash<uint64_t>()(static_cast<uint64_t>(id.ino)) << 1);
+    }
+};
+
+/*!
+ * \brief Cache of directory sizes
+ *
+ * The size is computed per first-level subdirectory. Each subdirectory's
+ * result is remembered along with a fingerprint of the mtimes of all the
+ * directories in it. On later queries, only the directories are walked to
+ * recompute the fingerprints and only the subtrees whose fingerprint changed
+ * are rescanned. Subtrees are processed in parallel.
+ *
+ * \note Since only directory mtimes are checked, a file that changes size
+ *       without any directory being modified is not noticed until the cache
+ *       is destroyed.
+ */
+class DirectorySizeCache
+{
+public:
+    oc::result<uint64_t> get(const std::string &path,
+                             const std::vector<std::string> &exclusions);
+
+private:
+    struct Subtree
+    {
+        uint64_t fingerprint;
+        // Total size of regular files with a single link
+        uint64_t size;
+        // Sizes of regular files with multiple links
+        std::unordered_map<FileId, uint64_t, FileIdHash> links;
+    };
+
+    // Keyed by subtree path
+    std::unordered_map<std::string, Subtree> _subtrees;
+};
+
+}
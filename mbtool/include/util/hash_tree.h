@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mb
+{
+
+//! Default size of the blocks that are hashed individually
+constexpr size_t HASH_TREE_BLOCK_SIZE = 1024 * 1024;
+
+/*!
+ * \brief Two-level SHA512 hash tree of an image
+ *
+ * The image is split into fixed-size blocks that are hashed in parallel. The
+ * root is the SHA512 digest of the block size, the image size, and all of the
+ * block digests, so it identifies the image as strongly as a flat digest.
+ */
+class HashTree
+{
+public:
+    bool compute(std::string_view data,
+                 size_t block_size = HASH_TREE_BLOCK_SIZE);
+
+    std::optional<size_t> find_mismatch(std::string_view data) const;
+
+    std::string checksum() const;
+
+    size_t block_size() const;
+
+    bool load_file(const std::string &path);
+    bool save_file(const std::string &path) const;
+
+private:
+    size_t _block_size = 0;
+    uint64_t _size = 0;
+    // Concatenated SHA512 digests of the blocks
+    std::vector<unsigned char> _digests;
+};
+
+}
@@ -53,6 +53,13 @@
 #define BOOT_UI_PATH                    "/mbbootui"
 #define BOOT_UI_EXEC_PATH               BOOT_UI_PATH "/exec"
 
+// SELinux
+#define SEPOLICY_CACHE_DIR              "/raw/data/multiboot/cache/sepolicy"
+#define FILE_CONTEXTS_CACHE_DIR         "/raw/data/multiboot/cache/file_contexts"
+
+// Boot timeline written by mbtool init
+#define BOOT_TRACE_PATH                 "/raw/data/multiboot/boot_trace.json"
+
 // Installer
 #define CHROOT_SYSTEM_BIND_MOUNT        "/mb/bind.system"
 #define CHROOT_CACHE_BIND_MOUNT         "/mb/bind.cache"
@@ -68,6 +75,7 @@ namespace mb
 {
 
 bool copy_system(const std::string &source, const std::string &target);
+bool sync_system(const std::string &source, const std::string &target);
 
 bool fix_multiboot_permissions();
 
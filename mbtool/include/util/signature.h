@@ -19,6 +19,10 @@
 
 #pragma once
 
+#include <string>
+#include <utility>
+#include <vector>
+
 namespace mb
 {
 
@@ -31,6 +35,9 @@ enum class SigVerifyResult
 
 SigVerifyResult verify_signature(const char *path, const char *sig_path);
 
+std::vector<SigVerifyResult>
+verify_signatures_batch(const std::vector<std::pair<std::string, std::string>> &files);
+
 int sigverify_main(int argc, char *argv[]);
 
 }
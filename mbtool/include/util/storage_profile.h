@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#define STORAGE_PROFILE_PATH            "/data/multiboot/storage_profile.json"
+
+namespace mb
+{
+
+struct StorageBlockResult
+{
+    size_t block_size;
+    //! Sequential throughput in bytes per second
+    double read_bps;
+    double write_bps;
+};
+
+struct StorageTarget
+{
+    //! Mount point, such as "/data" or the external SD card's mount point
+    std::string path;
+    //! Block size with the best sequential throughput
+    size_t block_size = 0;
+    //! Number of concurrent random reads with the best throughput
+    unsigned int queue_depth = 0;
+    double seq_read_bps = 0;
+    double seq_write_bps = 0;
+    double rand_read_iops = 0;
+    double rand_write_iops = 0;
+    double fsync_latency_us = 0;
+    std::vector<StorageBlockResult> blocks;
+};
+
+struct StorageProfile
+{
+    std::vector<StorageTarget> targets;
+
+    bool load_file(const std::string &path);
+    bool save_file(const std::string &path) const;
+
+    const StorageTarget * find(const std::string &path) const;
+    void set(StorageTarget target);
+};
+
+size_t storage_block_size(const std::string &path, size_t fallback);
+unsigned int storage_queue_depth(const std::string &path,
+                                 unsigned int fallback);
+
+}
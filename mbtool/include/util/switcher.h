@@ -21,11 +21,20 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace mb
 {
 
+enum class ChecksumType
+{
+    //! SHA512 digest of the whole image
+    Sha512,
+    //! Root of a HashTree of the image
+    Sha512Tree,
+};
+
 enum class ChecksumsGetResult
 {
     Found,
@@ -40,12 +49,18 @@ public:
     bool save_file();
 
     ChecksumsGetResult get(const std::string &rom_id, const std::string &image,
-                           std::string &sha512_out);
+                           std::string &hash_out, ChecksumType &type_out);
     void set(const std::string &rom_id, const std::string &image,
-             const std::string &sha512);
+             const std::string &hash,
+             ChecksumType type = ChecksumType::Sha512);
 
 private:
     std::unordered_map<std::string, std::string> m_props;
+    // Keys that changed since the file was loaded or saved
+    std::unordered_set<std::string> m_dirty;
+    // Number of records in the file, including superseded ones
+    size_t m_records = 0;
+    bool m_loaded = false;
 };
 
 enum class SwitchRomResult
@@ -19,17 +19,31 @@
 
 #pragma once
 
+#include "mbcommon/flags.h"
+
 #include "util/roms.h"
 
 namespace mb
 {
 
+enum class WipeFlag : uint8_t
+{
+    // Move files to the trash and leave the deletion to reap_trash()
+    Deferred        = 1 << 0,
+};
+MB_DECLARE_FLAGS(WipeFlags, WipeFlag)
+MB_DECLARE_OPERATORS_FOR_FLAGS(WipeFlags)
+
 bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions);
-bool wipe_system(const std::shared_ptr<Rom> &rom);
-bool wipe_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_data(const std::shared_ptr<Rom> &rom);
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom);
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom);
+                    const std::vector<std::string> &exclusions,
+                    WipeFlags flags = {});
+bool wipe_system(const std::shared_ptr<Rom> &rom, WipeFlags flags = {});
+bool wipe_cache(const std::shared_ptr<Rom> &rom, WipeFlags flags = {});
+bool wipe_data(const std::shared_ptr<Rom> &rom, WipeFlags flags = {});
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom, WipeFlags flags = {});
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom, WipeFlags flags = {});
+
+void reap_trash();
+void start_trash_reaper();
 
 }
@@ -21,6 +21,9 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 
 #include <cassert>
@@ -30,8 +33,9 @@
 
 #include <fcntl.h>
 #include <getopt.h>
-#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -301,77 +305,201 @@ static int create_new_socket()
 /*
  * Socket messages are prefixed with 16-bit unsigned value (little-endian)
  * indicating the number of bytes that follow. The data should be treated as
- * a string and a null terminator must be added to the end.
+ * a string and a null terminator must be added to the end. If the async
+ * variant of installd is used, the size is preceded by a 32-bit transaction
+ * ID.
  */
 
+struct Message
+{
+    int async_id = 0;
+    std::string data;
+};
+
 /*!
- * \brief Receive a message from a socket
+ * \brief Buffered reader for messages from a non-blocking socket
+ *
+ * Everything that is available on the socket is read with as few read() calls
+ * as possible and all complete messages in the buffer can then be extracted
+ * with next(). Partial messages are kept until the rest of the data arrives.
  */
-static bool receive_message(int fd, char *buf, std::size_t size,
-                            bool is_async, int &async_id)
+class MessageReader
 {
-    if (is_async) {
-        auto ret = util::socket_read_int32(fd);
-        if (!ret) {
-            LOGE("Failed to receive async command ID: %s",
-                 ret.error().message().c_str());
-            return false;
-        }
-        async_id = ret.value();
+public:
+    MessageReader(int fd, bool is_async)
+        : _fd(fd)
+        , _is_async(is_async)
+        , _begin(0)
+        , _end(0)
+    {
     }
 
-    auto count = util::socket_read_uint16(fd);
-    if (!count) {
-        LOGE("Failed to read command size: %s",
-             count.error().message().c_str());
-        return false;
-    }
+    /*!
+     * \brief Read all available data from the socket
+     *
+     * \return False if the socket was closed or an error occurred
+     */
+    bool fill()
+    {
+        while (true) {
+            if (_begin == _end) {
+                _begin = _end = 0;
+            } else if (_end == _buf.size() && _begin > 0) {
+                memmove(_buf.data(), _buf.data() + _begin, _end - _begin);
+                _end -= _begin;
+                _begin = 0;
+            }
 
-    if (count.value() < 1 || count.value() >= size) {
-        LOGE("Invalid size %u", count.value());
-        return false;
+            if (_end == _buf.size()) {
+                _buf.resize(_buf.empty() ? READ_SIZE : _buf.size() * 2);
+            }
+
+            ssize_t n = read(_fd, _buf.data() + _end, _buf.size() - _end);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                LOGE("Failed to read from socket: %s", strerror(errno));
+                return false;
+            } else if (n == 0) {
+                LOGD("Socket was closed by peer");
+                return false;
+            }
+
+            _end += static_cast<size_t>(n);
+        }
     }
 
-    if (auto ret = util::socket_read(fd, buf, count.value());
-            !ret || ret.value() != count.value()) {
-        LOGE("Failed to read command: %s", ret.error().message().c_str());
-        return false;
+    /*!
+     * \brief Extract the next complete message from the buffer
+     *
+     * \param[out] msg Output message
+     * \param[out] error Set to true if the buffered data is not a valid message
+     *
+     * \return Whether a message was extracted
+     */
+    bool next(Message &msg, bool &error)
+    {
+        size_t avail = _end - _begin;
+        size_t header_size = (_is_async ? sizeof(int32_t) : 0)
+                + sizeof(uint16_t);
+
+        error = false;
+
+        if (avail < header_size) {
+            return false;
+        }
+
+        const char *ptr = _buf.data() + _begin;
+        int32_t async_id = 0;
+        uint16_t count;
+
+        if (_is_async) {
+            memcpy(&async_id, ptr, sizeof(async_id));
+            ptr += sizeof(async_id);
+        }
+        memcpy(&count, ptr, sizeof(count));
+        ptr += sizeof(count);
+
+        if (count < 1 || count >= COMMAND_BUF_SIZE) {
+            LOGE("Invalid size %u", count);
+            error = true;
+            return false;
+        }
+
+        if (avail < header_size + count) {
+            return false;
+        }
+
+        msg.async_id = async_id;
+        msg.data.assign(ptr, count);
+        _begin += header_size + count;
+
+        return true;
     }
 
-    buf[count.value()] = 0;
+private:
+    static constexpr size_t READ_SIZE = 4096;
 
-    return true;
-}
+    int _fd;
+    bool _is_async;
+    std::vector<char> _buf;
+    size_t _begin;
+    size_t _end;
+};
 
 /*!
- * \brief Send a message to a socket
+ * \brief Buffered writer for messages to a non-blocking socket
+ *
+ * Messages are appended to a single buffer and written out by flush(). If the
+ * socket cannot accept all of the data, the remainder stays buffered until the
+ * socket becomes writable again.
  */
-static bool send_message(int fd, const char *command,
-                         bool is_async, int async_id)
+class MessageWriter
 {
-    auto count = static_cast<uint16_t>(strlen(command));
+public:
+    MessageWriter(int fd, bool is_async)
+        : _fd(fd)
+        , _is_async(is_async)
+        , _pos(0)
+    {
+    }
 
-    if (is_async) {
-        if (auto ret = util::socket_write_int32(fd, async_id); !ret) {
-            LOGE("Failed to write async command ID: %s",
-                 ret.error().message().c_str());
-            return false;
+    void queue(const Message &msg)
+    {
+        auto count = static_cast<uint16_t>(msg.data.size());
+
+        if (_is_async) {
+            int32_t async_id = msg.async_id;
+            _buf.append(reinterpret_cast<const char *>(&async_id),
+                        sizeof(async_id));
         }
+        _buf.append(reinterpret_cast<const char *>(&count), sizeof(count));
+        _buf.append(msg.data, 0, count);
     }
 
-    if (auto ret = util::socket_write_uint16(fd, count); !ret) {
-        LOGE("Failed to write command size: %s", ret.error().message().c_str());
-        return false;
+    /*!
+     * \brief Write as much of the buffered data as the socket accepts
+     *
+     * \return False if an error occurred
+     */
+    bool flush()
+    {
+        while (_pos < _buf.size()) {
+            ssize_t n = send(_fd, _buf.data() + _pos, _buf.size() - _pos,
+                             MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return true;
+                }
+                LOGE("Failed to write to socket: %s", strerror(errno));
+                return false;
+            }
+
+            _pos += static_cast<size_t>(n);
+        }
+
+        _buf.clear();
+        _pos = 0;
+
+        return true;
     }
 
-    if (auto ret = util::socket_write(fd, command, count);
-            !ret || ret.value() != count) {
-        LOGE("Failed to write command: %s", ret.error().message().c_str());
-        return false;
+    bool pending() const
+    {
+        return _pos < _buf.size();
     }
 
-    return true;
-}
+private:
+    int _fd;
+    bool _is_async;
+    std::string _buf;
+    size_t _pos;
+};
 
 /*!
  * \brief Connect to the installd socket at INSTALLD_SOCKET_PATH
@@ -538,174 +666,561 @@ static void handle_command(const std::vector<std::string> &args)
     }
 }
 
-static bool handle_installd_event(int client_fd, int installd_fd,
-                                  bool is_async)
+/*!
+ * \brief Thread for running the command hooks
+ *
+ * The hooks (eg. unmounting shared data directories) can take a while, so they
+ * are run outside of the proxy's event loop. Completion of each hook is
+ * signaled through an eventfd, which can be watched with epoll.
+ */
+class HookWorker
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+public:
+    HookWorker()
+        : _event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+        , _stop(false)
+    {
+        if (_event_fd < 0) {
+            LOGE("Failed to create eventfd: %s", strerror(errno));
+            return;
+        }
 
-    int async_id;
+        _thread = std::thread(&HookWorker::run, this);
+    }
 
-    auto start = steady_clock::now();
+    ~HookWorker()
+    {
+        if (_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _cv.notify_one();
+            _thread.join();
+        }
 
-    auto start_installd = steady_clock::now();
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
+        if (_event_fd >= 0) {
+            close(_event_fd);
+        }
     }
-    auto stop_installd = steady_clock::now();
 
-    std::vector<std::string> args = parse_args(buf);
-    LOGD("Received async (probably) reply: %s", args_to_string(args).c_str());
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(HookWorker)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(HookWorker)
 
-    auto start_send = steady_clock::now();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
+    bool valid() const
+    {
+        return _thread.joinable();
     }
-    auto stop_send = steady_clock::now();
 
-    auto stop = steady_clock::now();
+    int event_fd() const
+    {
+        return _event_fd;
+    }
 
-    LOGD("Command stats:");
-    LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop_send - start_send).count()));
-    LOGD("- Time to receive reply from installd: %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop_installd - start_installd).count()));
-    LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
-         static_cast<uint64_t>(duration_cast<milliseconds>(
-                stop - start).count()));
-    LOGD("---");
+    void submit(std::vector<std::string> args)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(std::move(args));
+        }
+        _cv.notify_one();
+    }
 
-    return true;
+    /*!
+     * \brief Get the number of hooks that completed since the last call
+     */
+    uint64_t completed()
+    {
+        uint64_t count;
+        if (read(_event_fd, &count, sizeof(count)) != sizeof(count)) {
+            return 0;
+        }
+        return count;
+    }
+
+private:
+    void run()
+    {
+        while (true) {
+            std::vector<std::string> args;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait(lock, [&] { return _stop || !_jobs.empty(); });
+
+                if (_stop) {
+                    return;
+                }
+
+                args = std::move(_jobs.front());
+                _jobs.pop_front();
+            }
+
+            handle_command(args);
+
+            uint64_t one = 1;
+            if (write(_event_fd, &one, sizeof(one)) != sizeof(one)) {
+                LOGE("Failed to signal hook completion: %s", strerror(errno));
+            }
+        }
+    }
+
+    int _event_fd;
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::vector<std::string>> _jobs;
+    bool _stop;
+};
+
+static bool is_hooked_command(const std::string &cmd)
+{
+    for (std::size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); ++i) {
+        if (cmd == cmds[i].name) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static bool handle_android_event(int client_fd, int installd_fd,
-                                 bool can_appsync, bool is_async)
+/*!
+ * \brief Log a command from the client
+ *
+ * \return Whether the result of the command should be logged
+ */
+static bool log_android_command(const std::vector<std::string> &args)
 {
-    // Use the same buffer size as installd
-    char buf[COMMAND_BUF_SIZE];
+    if (args.empty()) {
+        LOGE("Invalid command (empty message)");
+        return true;
+    }
 
-    steady_clock::time_point start_hook, stop_hook;
+    const std::string &cmd = args[0];
+
+    if (cmd == "ping"
+            || cmd == "freecache") {
+        LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
+    } else if (cmd == "aapt"
+            || cmd == "aapt_with_common") {
+        LOGD("Received CyanogenMod-specific command: %s",
+             args_to_string(args).c_str());
+    } else if (cmd == "rmrcl"
+            || cmd == "asyncDexopt"
+            || cmd == "changeDexOwner") {
+        LOGD("Received Touchwiz-specific command: %s",
+             args_to_string(args).c_str());
+        if (cmd == "asyncDexopt") {
+            LOGD("Expecting future installd reply for 'asyncDexopt'");
+        }
+    } else if (cmd == "getsize") {
+        // Get size is so annoying we don't want it to show... EVER!
+        return false;
+    } else if (cmd == "install"
+            || cmd == "dexopt"
+            || cmd == "markbootcomplete"
+            || cmd == "movedex"
+            || cmd == "rmdex"
+            || cmd == "remove"
+            || cmd == "rename"
+            || cmd == "fixuid"
+            || cmd == "rmcache"
+            || cmd == "rmcodecache"
+            || cmd == "rmuserdata"
+            || cmd == "movefiles"
+            || cmd == "linklib"
+            || cmd == "mkuserdata"
+            || cmd == "mkuserconfig"
+            || cmd == "rmuser"
+            || cmd == "idmap"
+            || cmd == "restorecondata"
+            || cmd == "patchoat") {
+        LOGD("Received command: %s", args_to_string(args).c_str());
+    } else {
+        LOGW("Unrecognized command: %s", args_to_string(args).c_str());
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Command from the client that has not been forwarded to installd yet
+ */
+struct PendingCommand
+{
+    Message msg;
+    std::vector<std::string> args;
+    bool log_result;
+    bool needs_hook;
+    bool hook_submitted;
+    bool hook_done;
+    steady_clock::time_point start;
+    steady_clock::time_point start_hook;
+    steady_clock::time_point stop_hook;
+};
 
+/*!
+ * \brief Command that has been forwarded to installd and awaits a reply
+ */
+struct InFlightCommand
+{
     int async_id;
+    bool log_result;
+    bool hooked;
+    steady_clock::time_point start;
+    steady_clock::time_point start_installd;
+    steady_clock::duration hook_time;
+};
 
-    if (!receive_message(client_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive request from client");
-        return false;
+/*!
+ * \brief State of the connection between a client and installd
+ *
+ * Messages are read in batches from both sockets. Commands from the client are
+ * forwarded to installd in the order they were received. If a command has a
+ * hook, the hook runs on the HookWorker thread and neither that command nor
+ * any of the following commands are forwarded until the hook completes, so
+ * installd never sees a command before its hook has finished (eg. the shared
+ * data directory is unmounted before installd wipes it). Replies from installd
+ * continue to be relayed to the client while a hook is running.
+ */
+class ProxyConnection
+{
+public:
+    ProxyConnection(int client_fd, int installd_fd, bool can_appsync,
+                    bool is_async)
+        : _client_fd(client_fd)
+        , _installd_fd(installd_fd)
+        , _can_appsync(can_appsync)
+        , _is_async(is_async)
+        , _client_reader(client_fd, is_async)
+        , _client_writer(client_fd, is_async)
+        , _installd_reader(installd_fd, is_async)
+        , _installd_writer(installd_fd, is_async)
+        , _epoll_fd(-1)
+    {
     }
 
-    auto start = steady_clock::now();
+    ~ProxyConnection()
+    {
+        if (_epoll_fd >= 0) {
+            close(_epoll_fd);
+        }
+    }
 
-    std::vector<std::string> args = parse_args(buf);
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ProxyConnection)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ProxyConnection)
 
-    bool log_result = true;
+    /*!
+     * \brief Relay messages until either side closes the connection
+     */
+    void run()
+    {
+        if (!set_nonblocking(_client_fd) || !set_nonblocking(_installd_fd)) {
+            return;
+        }
 
-    if (args.empty()) {
-        LOGE("Invalid command (empty message)");
-    } else {
-        const std::string &cmd = args[0];
-
-        if (cmd == "ping"
-                || cmd == "freecache") {
-            LOGD("Received unimportant command: [%s, ...]", cmd.c_str());
-        } else if (cmd == "aapt"
-                || cmd == "aapt_with_common") {
-            LOGD("Received CyanogenMod-specific command: %s",
-                 args_to_string(args).c_str());
-        } else if (cmd == "rmrcl"
-                || cmd == "asyncDexopt"
-                || cmd == "changeDexOwner") {
-            LOGD("Received Touchwiz-specific command: %s",
-                 args_to_string(args).c_str());
-            if (cmd == "asyncDexopt") {
-                LOGD("Expecting future installd reply for 'asyncDexopt'");
+        if (_can_appsync && !_worker.valid()) {
+            LOGW("Hook thread is not running; commands won't be hooked");
+            _can_appsync = false;
+        }
+
+        _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (_epoll_fd < 0) {
+            LOGE("Failed to create epoll fd: %s", strerror(errno));
+            return;
+        }
+
+        if (!epoll_update(EPOLL_CTL_ADD, _client_fd, EPOLLIN)
+                || !epoll_update(EPOLL_CTL_ADD, _installd_fd, EPOLLIN)
+                || (_worker.valid() && !epoll_update(
+                        EPOLL_CTL_ADD, _worker.event_fd(), EPOLLIN))) {
+            return;
+        }
+
+        epoll_event events[3];
+
+        while (true) {
+            int n = epoll_wait(_epoll_fd, events, 3, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                LOGE("Failed to epoll_wait(): %s", strerror(errno));
+                return;
             }
-        } else if (cmd == "getsize") {
-            // Get size is so annoying we don't want it to show... EVER!
-            log_result = false;
-        } else if (cmd == "install"
-                || cmd == "dexopt"
-                || cmd == "markbootcomplete"
-                || cmd == "movedex"
-                || cmd == "rmdex"
-                || cmd == "remove"
-                || cmd == "rename"
-                || cmd == "fixuid"
-                || cmd == "rmcache"
-                || cmd == "rmcodecache"
-                || cmd == "rmuserdata"
-                || cmd == "movefiles"
-                || cmd == "linklib"
-                || cmd == "mkuserdata"
-                || cmd == "mkuserconfig"
-                || cmd == "rmuser"
-                || cmd == "idmap"
-                || cmd == "restorecondata"
-                || cmd == "patchoat") {
-            LOGD("Received command: %s", args_to_string(args).c_str());
-
-            if (can_appsync) {
-                start_hook = steady_clock::now();
-                handle_command(args);
-                stop_hook = steady_clock::now();
+
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                uint32_t revents = events[i].events;
+
+                if (fd == _worker.event_fd()) {
+                    if (!handle_hooks_completed()) {
+                        return;
+                    }
+                    continue;
+                }
+
+                // Read before checking for hangups so that any messages that
+                // were sent right before the socket was closed are relayed
+                if (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    if (fd == _client_fd && !handle_client_readable()) {
+                        return;
+                    } else if (fd == _installd_fd
+                            && !handle_installd_readable()) {
+                        return;
+                    }
+                }
+
+                if (revents & EPOLLOUT) {
+                    MessageWriter &writer = fd == _client_fd
+                            ? _client_writer : _installd_writer;
+                    if (!writer.flush()) {
+                        return;
+                    }
+                }
+            }
+
+            if (!update_write_interest()) {
+                return;
             }
-        } else {
-            LOGW("Unrecognized command: %s", args_to_string(args).c_str());
         }
     }
 
-    auto start_installd = steady_clock::now();
-    if (!send_message(installd_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send request to installd");
-        return false;
+private:
+    static bool set_nonblocking(int fd)
+    {
+        int flags = fcntl(fd, F_GETFL);
+        if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+            LOGE("Failed to make fd %d non-blocking: %s", fd, strerror(errno));
+            return false;
+        }
+        return true;
     }
-    if (!receive_message(
-            installd_fd, buf, sizeof(buf), is_async, async_id)) {
-        LOGE("Failed to receive reply from installd");
-        return false;
+
+    bool epoll_update(int op, int fd, uint32_t events)
+    {
+        epoll_event event = {};
+        event.events = events;
+        event.data.fd = fd;
+
+        if (epoll_ctl(_epoll_fd, op, fd, &event) < 0) {
+            LOGE("Failed to update epoll fd %d: %s", fd, strerror(errno));
+            return false;
+        }
+        return true;
     }
-    auto stop_installd = steady_clock::now();
 
-    args = parse_args(buf);
+    static uint32_t write_events(bool pending)
+    {
+        uint32_t events = EPOLLIN;
+        if (pending) {
+            events |= EPOLLOUT;
+        }
+        return events;
+    }
 
-    if (log_result) {
-        LOGD("Sending reply: %s", args_to_string(args).c_str());
+    bool update_write_interest()
+    {
+        bool client_out = _client_writer.pending();
+        bool installd_out = _installd_writer.pending();
+
+        if (client_out != _client_out && !epoll_update(
+                EPOLL_CTL_MOD, _client_fd, write_events(client_out))) {
+            return false;
+        }
+        if (installd_out != _installd_out && !epoll_update(
+                EPOLL_CTL_MOD, _installd_fd, write_events(installd_out))) {
+            return false;
+        }
+
+        _client_out = client_out;
+        _installd_out = installd_out;
+
+        return true;
     }
 
-    auto start_send = steady_clock::now();
-    if (!send_message(client_fd, buf, is_async, async_id)) {
-        LOGE("Failed to send reply to client");
-        return false;
+    bool handle_client_readable()
+    {
+        bool ok = _client_reader.fill();
+
+        Message msg;
+        bool error;
+
+        while (_client_reader.next(msg, error)) {
+            PendingCommand cmd;
+            cmd.start = steady_clock::now();
+            cmd.args = parse_args(msg.data.c_str());
+            cmd.log_result = log_android_command(cmd.args);
+            cmd.needs_hook = _can_appsync && !cmd.args.empty()
+                    && is_hooked_command(cmd.args[0]);
+            cmd.hook_submitted = false;
+            cmd.hook_done = false;
+            cmd.msg = std::move(msg);
+
+            _pending.push_back(std::move(cmd));
+        }
+
+        if (error) {
+            LOGE("Failed to receive request from client");
+            return false;
+        }
+
+        forward_pending();
+
+        if (!_installd_writer.flush()) {
+            LOGE("Failed to send request to installd");
+            return false;
+        }
+
+        return ok;
     }
-    auto stop_send = steady_clock::now();
 
-    auto stop = steady_clock::now();
+    bool handle_installd_readable()
+    {
+        bool ok = _installd_reader.fill();
+
+        Message msg;
+        bool error;
 
-    if (log_result) {
+        while (_installd_reader.next(msg, error)) {
+            relay_reply(msg);
+        }
+
+        if (error) {
+            LOGE("Failed to receive reply from installd");
+            return false;
+        }
+
+        if (!_client_writer.flush()) {
+            LOGE("Failed to send reply to client");
+            return false;
+        }
+
+        return ok;
+    }
+
+    bool handle_hooks_completed()
+    {
+        uint64_t count = _worker.completed();
+
+        for (auto &cmd : _pending) {
+            if (count == 0) {
+                break;
+            }
+            if (cmd.hook_submitted && !cmd.hook_done) {
+                cmd.hook_done = true;
+                cmd.stop_hook = steady_clock::now();
+                --count;
+            }
+        }
+
+        forward_pending();
+
+        if (!_installd_writer.flush()) {
+            LOGE("Failed to send request to installd");
+            return false;
+        }
+
+        return true;
+    }
+
+    /*!
+     * \brief Forward commands to installd up to the first unfinished hook
+     */
+    void forward_pending()
+    {
+        while (!_pending.empty()) {
+            PendingCommand &cmd = _pending.front();
+
+            if (cmd.needs_hook && !cmd.hook_done) {
+                if (!cmd.hook_submitted) {
+                    cmd.hook_submitted = true;
+                    cmd.start_hook = steady_clock::now();
+                    _worker.submit(cmd.args);
+                }
+                break;
+            }
+
+            InFlightCommand in_flight;
+            in_flight.async_id = cmd.msg.async_id;
+            in_flight.log_result = cmd.log_result;
+            in_flight.hooked = cmd.needs_hook;
+            in_flight.start = cmd.start;
+            in_flight.start_installd = steady_clock::now();
+            in_flight.hook_time = cmd.needs_hook
+                    ? cmd.stop_hook - cmd.start_hook
+                    : steady_clock::duration::zero();
+
+            _installd_writer.queue(cmd.msg);
+            _in_flight.push_back(in_flight);
+            _pending.pop_front();
+        }
+    }
+
+    void relay_reply(const Message &msg)
+    {
+        auto now = steady_clock::now();
+        std::vector<std::string> args = parse_args(msg.data.c_str());
+
+        // The async installd may reply out of order, so match the reply by
+        // its transaction ID. Otherwise, replies arrive in command order.
+        auto it = _in_flight.begin();
+        if (_is_async) {
+            it = std::find_if(_in_flight.begin(), _in_flight.end(),
+                              [&](const InFlightCommand &c) {
+                return c.async_id == msg.async_id;
+            });
+        }
+
+        _client_writer.queue(msg);
+
+        if (it == _in_flight.end()) {
+            LOGD("Received async (probably) reply: %s",
+                 args_to_string(args).c_str());
+            return;
+        }
+
+        InFlightCommand in_flight = *it;
+        _in_flight.erase(it);
+
+        if (!in_flight.log_result) {
+            return;
+        }
+
+        LOGD("Sending reply: %s", args_to_string(args).c_str());
         LOGD("Command stats:");
-        LOGD("- Time to send result back to client:  %" PRIu64 "ms",
-             static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop_send - start_send).count()));
         LOGD("- Time to complete installd command:   %" PRIu64 "ms",
              static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop_installd - start_installd).count()));
-        if (can_appsync) {
+                    now - in_flight.start_installd).count()));
+        if (in_flight.hooked) {
             LOGD("- Time to hook installd command:       %" PRIu64 "ms",
                  static_cast<uint64_t>(duration_cast<milliseconds>(
-                        stop_hook - start_hook).count()));
+                        in_flight.hook_time).count()));
         }
         LOGD("- Time to complete entire proxy logic: %" PRIu64 "ms",
              static_cast<uint64_t>(duration_cast<milliseconds>(
-                    stop - start).count()));
+                    now - in_flight.start).count()));
         LOGD("---");
     }
 
-    return true;
-}
+    int _client_fd;
+    int _installd_fd;
+    bool _can_appsync;
+    bool _is_async;
+
+    MessageReader _client_reader;
+    MessageWriter _client_writer;
+    MessageReader _installd_reader;
+    MessageWriter _installd_writer;
+
+    bool _client_out = false;
+    bool _installd_out = false;
+
+    std::deque<PendingCommand> _pending;
+    std::deque<InFlightCommand> _in_flight;
+
+    int _epoll_fd;
+    HookWorker _worker;
+};
 
 /**
  * \brief Main function for capturing and relaying the daemon commands
@@ -753,8 +1268,6 @@ static bool proxy_process(int fd, bool can_appsync)
         });
 
         // Check if we're using some variant of the CyanogenMood async installd
-        // NOTE: We'll effectively make the connection sychronous because we
-        //       always wait for a reply before receiving the next command.
         // See: https://github.com/CyanogenMod/android_frameworks_native/commit/8124b181d4b5a3a44796fdb0e3ea4e4171f102c7
         bool is_async = false;
         if (auto r = util::file_find_one_of(INSTALLD_PATH,
@@ -765,30 +1278,8 @@ static bool proxy_process(int fd, bool can_appsync)
 
         LOGD("---");
 
-        pollfd fds[2] = {};
-        fds[0].fd = client_fd;
-        fds[0].events = POLLIN;
-        fds[1].fd = installd_fd;
-        fds[1].events = POLLIN;
-
-        while (true) {
-            fds[0].revents = 0;
-            fds[1].revents = 1;
-
-            if (poll(fds, 2, -1) < 0) {
-                LOGE("Failed to poll() fds: %s", strerror(errno));
-                break;
-            }
-
-            if (fds[0].revents & POLLIN && !handle_android_event(
-                    client_fd, installd_fd, can_appsync, is_async)) {
-                break;
-            }
-            if (fds[1].revents & POLLIN && !handle_installd_event(
-                    client_fd, installd_fd, is_async)) {
-                break;
-            }
-        }
+        ProxyConnection conn(client_fd, installd_fd, can_appsync, is_async);
+        conn.run();
     }
 }
 
@@ -20,26 +20,35 @@
 #include "boot/appsyncmanager.h"
 
 #include <algorithm>
+#include <unordered_map>
 
 #include <cerrno>
+#include <cinttypes>
+#include <cstring>
 
+#include <dirent.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/chown.h"
 #include "mbutil/directory.h"
+#include "mbutil/file.h"
 #include "mbutil/fts.h"
 #include "mbutil/selinux.h"
 
 #define LOG_TAG "mbtool/boot/appsyncmanager"
 
 #define APP_SHARING_DATA_DIR            "/data/multiboot/_appsharing/data"
+#define APP_SHARING_LABEL_STATE_FILE    "/data/multiboot/_appsharing/label_state"
 
 #define USER_DATA_DIR                   "/data/data"
 
 static std::string _as_data_dir;
+static std::string _as_label_state_file;
 static std::string _user_data_dir;
 
 namespace mb
@@ -78,6 +87,7 @@ public:
 void AppSyncManager::detect_directories()
 {
     _as_data_dir = get_raw_path(APP_SHARING_DATA_DIR);
+    _as_label_state_file = get_raw_path(APP_SHARING_LABEL_STATE_FILE);
     _user_data_dir = USER_DATA_DIR;
 
     LOGD("App sharing app data directory: %s", _as_data_dir.c_str());
@@ -134,6 +144,128 @@ bool AppSyncManager::create_shared_data_directory(const std::string &pkg, uid_t
     return true;
 }
 
+struct LabelState
+{
+    uint64_t generation;
+    std::string context;
+};
+
+using LabelStates = std::unordered_map<std::string, LabelState>;
+
+static uint64_t timespec_ns(const struct timespec &ts)
+{
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000u
+            + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/*!
+ * \brief Get the generation of a shared data directory
+ *
+ * This is the newest mtime of the directory and its immediate subdirectories
+ * (files/, databases/, shared_prefs/, etc.), which changes whenever the app
+ * creates or removes files in the places where apps store their data.
+ */
+static bool get_generation(const std::string &path, uint64_t &generation)
+{
+    struct stat sb;
+
+    if (lstat(path.c_str(), &sb) < 0) {
+        return false;
+    }
+
+    generation = timespec_ns(sb.st_mtim);
+
+    DIR *dp = opendir(path.c_str());
+    if (!dp) {
+        return false;
+    }
+
+    std::string child;
+
+    while (auto ent = readdir(dp)) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+
+        child = path;
+        child += '/';
+        child += ent->d_name;
+
+        if (lstat(child.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            generation = std::max(generation, timespec_ns(sb.st_mtim));
+        }
+    }
+
+    closedir(dp);
+
+    return true;
+}
+
+// Each line is "<package> <generation> <context>"
+static LabelStates read_label_states(const std::string &path)
+{
+    LabelStates states;
+
+    auto data = util::file_read_all(path);
+    if (!data) {
+        return states;
+    }
+
+    for (auto const &line : split(data.value(), '\n')) {
+        auto fields = split(line, ' ');
+        LabelState state;
+
+        if (fields.size() != 3
+                || !str_to_num(fields[1].c_str(), 10, state.generation)) {
+            continue;
+        }
+
+        state.context = std::move(fields[2]);
+        states.emplace(std::move(fields[0]), std::move(state));
+    }
+
+    return states;
+}
+
+static bool write_label_states(const std::string &path,
+                               const LabelStates &states)
+{
+    std::string data;
+
+    for (auto const &[pkg, state] : states) {
+        data += format("%s %" PRIu64 " %s\n", pkg.c_str(), state.generation,
+                       state.context.c_str());
+    }
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    if (auto r = util::file_write_data(temp_path, data.data(), data.size());
+            !r) {
+        LOGW("%s: Failed to write file: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Ensure that the shared data has the app data SELinux context
+ *
+ * The context and generation of each package's shared data directory are
+ * recorded after it is relabeled. Packages are only relabeled again if the
+ * target context or the directory's generation changed since then, so booting
+ * without having used the apps from another ROM does not walk the whole
+ * shared data directory.
+ */
 bool AppSyncManager::fix_shared_data_permissions()
 {
     std::string context("u:object_r:app_data_file:s0");
@@ -142,15 +274,69 @@ bool AppSyncManager::fix_shared_data_permissions()
         context.swap(ret.value());
     }
 
-    if (auto ret = util::selinux_lset_context_recursive(
-            _as_data_dir, context); !ret) {
-        LOGW("%s: Failed to set context recursively to %s: %s",
+    if (auto ret = util::selinux_lset_context(_as_data_dir, context); !ret) {
+        LOGW("%s: Failed to set context to %s: %s",
              _as_data_dir.c_str(), context.c_str(),
              ret.error().message().c_str());
         return false;
     }
 
-    return true;
+    DIR *dp = opendir(_as_data_dir.c_str());
+    if (!dp) {
+        LOGW("%s: Failed to open directory: %s",
+             _as_data_dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<std::string> pkgs;
+
+    while (auto ent = readdir(dp)) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+            pkgs.emplace_back(ent->d_name);
+        }
+    }
+
+    closedir(dp);
+
+    LabelStates old_states = read_label_states(_as_label_state_file);
+    LabelStates new_states;
+    bool ret = true;
+    size_t relabeled = 0;
+
+    for (auto const &pkg : pkgs) {
+        std::string path = get_shared_data_path(pkg);
+        uint64_t generation;
+
+        if (auto it = old_states.find(pkg); it != old_states.end()
+                && it->second.context == context
+                && get_generation(path, generation)
+                && it->second.generation == generation) {
+            new_states.emplace(pkg, std::move(it->second));
+            continue;
+        }
+
+        if (auto r = util::selinux_lset_context_recursive(path, context); !r) {
+            LOGW("%s: Failed to set context recursively to %s: %s",
+                 path.c_str(), context.c_str(), r.error().message().c_str());
+            ret = false;
+            continue;
+        }
+
+        ++relabeled;
+
+        // Relabeling only changes the ctime, so the generation is unaffected
+        if (get_generation(path, generation)) {
+            new_states.emplace(pkg, LabelState{generation, context});
+        }
+    }
+
+    LOGD("Relabeled shared data of %zu/%zu packages", relabeled, pkgs.size());
+
+    if (relabeled > 0 || new_states.size() != old_states.size()) {
+        (void) write_label_states(_as_label_state_file, new_states);
+    }
+
+    return ret;
 }
 
 bool AppSyncManager::mount_shared_directory(const std::string &pkg, uid_t uid)
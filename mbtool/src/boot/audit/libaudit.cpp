@@ -262,6 +262,62 @@ int audit_get_reply(int fd, struct audit_message* rep, reply_t block, int peek)
     return rc;
 }
 
+int audit_get_replies(int fd, struct audit_message* reps, size_t* lens,
+                      size_t count, reply_t block) {
+    struct mmsghdr msgs[AUDIT_MAX_BATCH];
+    struct iovec iovs[AUDIT_MAX_BATCH];
+    struct sockaddr_nl nladdrs[AUDIT_MAX_BATCH];
+    int flags;
+    int n;
+
+    if (fd < 0) {
+        return -EBADF;
+    }
+
+    if (count > AUDIT_MAX_BATCH) {
+        count = AUDIT_MAX_BATCH;
+    }
+
+    memset(msgs, 0, sizeof(msgs));
+
+    for (size_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = &reps[i];
+        iovs[i].iov_len = sizeof(reps[i]);
+        msgs[i].msg_hdr.msg_name = &nladdrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(nladdrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* Only wait for the first message and take whatever else is queued */
+    flags = (block == GET_REPLY_NONBLOCKING) ? MSG_DONTWAIT : MSG_WAITFORONE;
+
+    n = TEMP_FAILURE_RETRY(recvmmsg(fd, msgs, (unsigned int) count, flags,
+                                    NULL));
+    if (n < 0) {
+        if (block == GET_REPLY_NONBLOCKING && errno == EAGAIN) {
+            return 0;
+        }
+        return -errno;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        size_t len = msgs[i].msg_len;
+
+        /* Drop messages that were spoof'd or that the kernel truncated */
+        if (msgs[i].msg_hdr.msg_namelen != sizeof(nladdrs[i])
+                || nladdrs[i].nl_pid
+                || !NLMSG_OK(&reps[i].nlh, len)
+                || len == sizeof(reps[i])) {
+            len = 0;
+        }
+
+        lens[i] = len;
+    }
+
+    return n;
+}
+
 void audit_close(int fd) {
     close(fd);
 }
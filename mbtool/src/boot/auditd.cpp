@@ -19,7 +19,20 @@
 
 #include "boot/auditd.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -34,10 +47,286 @@
 
 #define LOG_TAG "mbtool/boot/auditd"
 
+// Number of messages that can be queued for the logging thread
+#define RING_SIZE                       512
+// Messages longer than this are truncated when queued
+#define RING_MESSAGE_SIZE               2048
+// How often the logging thread drains the queue
+#define FLUSH_INTERVAL                  std::chrono::seconds(1)
+// How often the number of suppressed duplicate denials is logged
+#define REPEAT_REPORT_INTERVAL          std::chrono::seconds(10)
+// Maximum number of distinct denials that are tracked at a time
+#define MAX_TRACKED_DENIALS             1024
+
+using namespace std::chrono;
 
 namespace mb
 {
 
+namespace
+{
+
+struct AuditRecord
+{
+    uint16_t type;
+    uint16_t len;
+    char data[RING_MESSAGE_SIZE];
+};
+
+/*!
+ * \brief Single-producer, single-consumer queue of audit messages
+ *
+ * The netlink reader pushes messages and the logging thread pops them. Neither
+ * side ever takes a lock, so a slow log device cannot stall the reader. If the
+ * queue is full, new messages are dropped and counted instead.
+ */
+class AuditRing
+{
+public:
+    AuditRing()
+        : _head(0)
+        , _tail(0)
+        , _dropped(0)
+    {
+    }
+
+    bool push(uint16_t type, const char *data, size_t len)
+    {
+        size_t head = _head.load(std::memory_order_relaxed);
+        size_t next = (head + 1) % RING_SIZE;
+
+        if (next == _tail.load(std::memory_order_acquire)) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        AuditRecord &record = _records[head];
+        record.type = type;
+        record.len = static_cast<uint16_t>(std::min(len, sizeof(record.data)));
+        memcpy(record.data, data, record.len);
+
+        _head.store(next, std::memory_order_release);
+        return true;
+    }
+
+    const AuditRecord * front()
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+
+        if (tail == _head.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        return &_records[tail];
+    }
+
+    void pop()
+    {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        _tail.store((tail + 1) % RING_SIZE, std::memory_order_release);
+    }
+
+    size_t size() const
+    {
+        size_t head = _head.load(std::memory_order_acquire);
+        size_t tail = _tail.load(std::memory_order_acquire);
+        return (head + RING_SIZE - tail) % RING_SIZE;
+    }
+
+    uint64_t take_dropped()
+    {
+        return _dropped.exchange(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::array<AuditRecord, RING_SIZE> _records;
+    std::atomic_size_t _head;
+    std::atomic_size_t _tail;
+    std::atomic_uint64_t _dropped;
+};
+
+/*!
+ * \brief Get the value of a "key=value" field in an audit message
+ */
+std::string_view audit_field(std::string_view msg, std::string_view key)
+{
+    for (size_t pos = msg.find(key); pos != std::string_view::npos;
+            pos = msg.find(key, pos + 1)) {
+        // Make sure this is not the suffix of another key
+        if (pos != 0 && msg[pos - 1] != ' ') {
+            continue;
+        }
+
+        size_t begin = pos + key.size();
+        size_t end = msg.find(' ', begin);
+        return msg.substr(begin, end == std::string_view::npos
+                ? std::string_view::npos : end - begin);
+    }
+
+    return {};
+}
+
+/*!
+ * \brief Build the deduplication key of an SELinux denial
+ *
+ * \return "{ perms } scontext tcontext tclass" or an empty string if \p msg is
+ *         not an AVC denial
+ */
+std::string denial_key(std::string_view msg)
+{
+    if (msg.find("avc:") == std::string_view::npos
+            || msg.find("denied") == std::string_view::npos) {
+        return {};
+    }
+
+    size_t perms_begin = msg.find('{');
+    size_t perms_end = msg.find('}', perms_begin);
+    if (perms_begin == std::string_view::npos
+            || perms_end == std::string_view::npos) {
+        return {};
+    }
+
+    auto scontext = audit_field(msg, "scontext=");
+    auto tcontext = audit_field(msg, "tcontext=");
+    auto tclass = audit_field(msg, "tclass=");
+
+    std::string key(msg.substr(perms_begin, perms_end - perms_begin + 1));
+    key += ' ';
+    key += scontext;
+    key += ' ';
+    key += tcontext;
+    key += ' ';
+    key += tclass;
+
+    return key;
+}
+
+/*!
+ * \brief Consumer side of the AuditRing
+ *
+ * The first occurrence of each distinct denial is logged in full. Identical
+ * denials after that are only counted and a summary is logged periodically.
+ */
+class AuditLogger
+{
+public:
+    explicit AuditLogger(AuditRing &ring)
+        : _ring(ring)
+        , _last_report(steady_clock::now())
+        , _stop(false)
+    {
+        _thread = std::thread(&AuditLogger::run, this);
+    }
+
+    ~AuditLogger()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_one();
+        _thread.join();
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(AuditLogger)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(AuditLogger)
+
+    /*!
+     * \brief Wake up the logging thread early
+     *
+     * Called by the reader when the queue is filling up. This only notifies
+     * the condition variable and does not take the mutex.
+     */
+    void wake()
+    {
+        _cv.notify_one();
+    }
+
+private:
+    void run()
+    {
+        while (true) {
+            bool stop;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cv.wait_for(lock, FLUSH_INTERVAL);
+                stop = _stop;
+            }
+
+            flush();
+
+            if (stop) {
+                report_repeats();
+                return;
+            }
+        }
+    }
+
+    void flush()
+    {
+        while (auto record = _ring.front()) {
+            log_record(*record);
+            _ring.pop();
+        }
+
+        if (uint64_t dropped = _ring.take_dropped()) {
+            LOGW("Dropped %" PRIu64 " audit messages", dropped);
+        }
+
+        if (steady_clock::now() - _last_report >= REPEAT_REPORT_INTERVAL) {
+            report_repeats();
+        }
+    }
+
+    void log_record(const AuditRecord &record)
+    {
+        std::string_view msg(record.data, record.len);
+        std::string key = denial_key(msg);
+
+        if (!key.empty()) {
+            if (auto it = _denials.find(key); it != _denials.end()) {
+                ++it->second;
+                return;
+            }
+
+            if (_denials.size() >= MAX_TRACKED_DENIALS) {
+                report_repeats();
+                _denials.clear();
+            }
+
+            _denials.emplace(std::move(key), 0);
+        }
+
+        LOGV("type=%d %.*s", record.type,
+             static_cast<int>(msg.size()), msg.data());
+    }
+
+    void report_repeats()
+    {
+        for (auto &[key, count] : _denials) {
+            if (count > 0) {
+                LOGV("avc: denied %s (repeated %" PRIu64 " times)",
+                     key.c_str(), count);
+                count = 0;
+            }
+        }
+
+        _last_report = steady_clock::now();
+    }
+
+    AuditRing &_ring;
+    std::unordered_map<std::string, uint64_t> _denials;
+    steady_clock::time_point _last_report;
+
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+};
+
+}
+
 static bool audit_mainloop()
 {
     int fd = audit_open();
@@ -54,19 +343,41 @@ static bool audit_mainloop()
         return false;
     }
 
-    while (true) {
-        audit_message reply;
-        reply.nlh.nlmsg_type = 0;
-        reply.nlh.nlmsg_len = 0;
-        reply.data[0] = '\0';
+    // These are too large for the stack
+    auto ring = std::make_unique<AuditRing>();
+    auto replies = std::make_unique<audit_message[]>(AUDIT_MAX_BATCH);
+    size_t lens[AUDIT_MAX_BATCH];
+
+    AuditLogger logger(*ring);
 
-        if (audit_get_reply(fd, &reply, GET_REPLY_BLOCKING, 0) < 0) {
-            LOGE("Failed to get reply from audit socket: %s", strerror(errno));
+    while (true) {
+        int n = audit_get_replies(fd, replies.get(), lens, AUDIT_MAX_BATCH,
+                                  GET_REPLY_BLOCKING);
+        if (n < 0) {
+            LOGE("Failed to get reply from audit socket: %s", strerror(-n));
             return false;
         }
 
-        LOGV("type=%d %.*s",
-             reply.nlh.nlmsg_type, reply.nlh.nlmsg_len, reply.data);
+        for (int i = 0; i < n; ++i) {
+            const audit_message &reply = replies[static_cast<size_t>(i)];
+            size_t len = lens[i];
+
+            if (len == 0) {
+                continue;
+            }
+
+            // The payload is not NULL-terminated and its length does not
+            // include the netlink header
+            size_t data_len = std::min<size_t>(
+                    len - NLMSG_HDRLEN, reply.nlh.nlmsg_len - NLMSG_HDRLEN);
+            data_len = strnlen(reply.data, data_len);
+
+            ring->push(reply.nlh.nlmsg_type, reply.data, data_len);
+        }
+
+        if (ring->size() >= RING_SIZE / 2) {
+            logger.wake();
+        }
     }
 
     // unreachable
@@ -21,10 +21,14 @@
 
 #include <algorithm>
 #include <chrono>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
 #include <sched.h>
 #include <sys/mount.h>
 #include <sys/socket.h>
@@ -37,6 +41,7 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mblog/async_logger.h"
 #include "mblog/logging.h"
 #include "mblog/kmsg_logger.h"
 #include "mblog/stdio_logger.h"
@@ -51,6 +56,7 @@
 #include "util/roms.h"
 #include "util/sepolpatch.h"
 #include "util/validcerts.h"
+#include "util/wipe.h"
 
 // Needs to come last because it defines HIDDEN, which is used in packages.h
 #include <proc/readproc.h>
@@ -76,6 +82,32 @@ static bool log_to_kmsg = false;
 static bool log_to_stdio = false;
 static bool no_unshare = false;
 
+// Number of pre-forked connection workers
+static constexpr size_t WORKER_POOL_SIZE = 2;
+// Number of connections a worker serves before it exits and is replaced
+static constexpr unsigned int WORKER_MAX_CONNECTIONS = 32;
+
+// Messages sent from a worker to the daemon after serving a connection
+static constexpr char WORKER_MSG_IDLE = 'I';
+static constexpr char WORKER_MSG_RETIRE = 'R';
+
+struct Worker
+{
+    pid_t pid;
+    // Daemon's end of the control socket
+    int fd;
+    bool idle;
+};
+
+static std::vector<Worker> workers;
+
+// Credentials database. Only reloaded if packages.xml changes.
+static Packages packages_db;
+static struct stat packages_sb;
+static bool packages_loaded = false;
+// Verification result for each UID. Cleared when packages.xml is reloaded.
+static std::unordered_map<uid_t, bool> verified_uids;
+
 static ScopedFILE log_fp(nullptr, [](FILE *fp) {
     if (fp) {
         return std::fclose(fp);
@@ -83,13 +115,24 @@ static ScopedFILE log_fp(nullptr, [](FILE *fp) {
     return 0;
 });
 
-static bool verify_credentials(uid_t uid)
+static bool load_packages()
 {
-    // Rely on the OS for signature checking and simply compare strings in
-    // packages.xml. The only way that file changes is if the package is
-    // removed and reinstalled, in which case, Android will kill the client and
-    // the connection will terminate. Or, the client already has root access, in
-    // which case, there's not much we can do to prevent damage.
+    struct stat sb;
+    if (stat(PACKAGES_XML, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", PACKAGES_XML, strerror(errno));
+        return false;
+    }
+
+    // Android replaces packages.xml atomically, so the inode and timestamps
+    // change whenever the contents do
+    if (packages_loaded
+            && sb.st_dev == packages_sb.st_dev
+            && sb.st_ino == packages_sb.st_ino
+            && sb.st_size == packages_sb.st_size
+            && sb.st_mtim.tv_sec == packages_sb.st_mtim.tv_sec
+            && sb.st_mtim.tv_nsec == packages_sb.st_mtim.tv_nsec) {
+        return true;
+    }
 
     Packages pkgs;
     if (!pkgs.load_xml(PACKAGES_XML)) {
@@ -97,6 +140,23 @@ static bool verify_credentials(uid_t uid)
         return false;
     }
 
+    packages_db = std::move(pkgs);
+    packages_sb = sb;
+    packages_loaded = true;
+    verified_uids.clear();
+
+    return true;
+}
+
+static const std::unordered_set<std::string_view> & valid_cert_set()
+{
+    static const std::unordered_set<std::string_view> certs(
+            valid_certs.begin(), valid_certs.end());
+    return certs;
+}
+
+static bool check_signatures(const Packages &pkgs, uid_t uid)
+{
     std::shared_ptr<Package> pkg = pkgs.find_by_uid(uid);
     if (!pkg) {
         LOGE("Failed to find package for UID %u", uid);
@@ -106,15 +166,16 @@ static bool verify_credentials(uid_t uid)
     pkg->dump();
     LOGD("%s has %zu signatures", pkg->name.c_str(), pkg->sig_indexes.size());
 
+    auto const &certs = valid_cert_set();
+
     for (const std::string &index : pkg->sig_indexes) {
-        if (pkgs.sigs.find(index) == pkgs.sigs.end()) {
+        auto it = pkgs.sigs.find(index);
+        if (it == pkgs.sigs.end()) {
             LOGW("Signature index %s has no key", index.c_str());
             continue;
         }
 
-        const std::string &key = pkgs.sigs[index];
-        if (std::find(valid_certs.begin(), valid_certs.end(), key)
-                != valid_certs.end()) {
+        if (certs.find(it->second) != certs.end()) {
             LOGV("%s matches whitelisted signatures", pkg->name.c_str());
             return true;
         }
@@ -124,6 +185,29 @@ static bool verify_credentials(uid_t uid)
     return false;
 }
 
+static bool verify_credentials(uid_t uid)
+{
+    // Rely on the OS for signature checking and simply compare strings in
+    // packages.xml. The only way that file changes is if the package is
+    // removed and reinstalled, in which case, Android will kill the client and
+    // the connection will terminate. Or, the client already has root access, in
+    // which case, there's not much we can do to prevent damage.
+
+    if (!load_packages()) {
+        return false;
+    }
+
+    if (auto it = verified_uids.find(uid); it != verified_uids.end()) {
+        LOGV("Using cached verification result for UID %u", uid);
+        return it->second;
+    }
+
+    bool ret = check_signatures(packages_db, uid);
+    verified_uids.emplace(uid, ret);
+
+    return ret;
+}
+
 static bool client_connection(int fd)
 {
     LOGD("Accepted connection from %d", fd);
@@ -196,6 +280,172 @@ static bool client_connection(int fd)
     }
 }
 
+/*!
+ * \brief Prepare a forked process for serving connections
+ *
+ * \param propagation Mount propagation type for the new mount namespace
+ */
+static bool init_connection_process(unsigned long propagation)
+{
+    if (!no_unshare) {
+        if (unshare(CLONE_NEWNS) < 0) {
+            LOGE("unshare() failed: %s", strerror(errno));
+            return false;
+        }
+
+        if (mount("", "/", "", propagation | MS_REC, "") < 0) {
+            LOGE("Failed to set mount propagation: %s", strerror(errno));
+            return false;
+        }
+    }
+
+    // Change the process name so --replace doesn't kill existing
+    // connections
+    if (auto ret = util::set_process_title(
+            "mbtool connection initializing"); !ret) {
+        LOGE("Failed to set process title: %s",
+             ret.error().message().c_str());
+        return false;
+    }
+
+    // Restore default SIGCHLD handler
+    struct sigaction sa;
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;
+    if (sigaction(SIGCHLD, &sa, 0) < 0) {
+        LOGE("Failed to set default SIGCHLD handler: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Serve connections handed over by the daemon
+ *
+ * The worker receives client sockets over \p ctrl_fd and reports back after
+ * each connection so the daemon knows it can accept another one. After
+ * WORKER_MAX_CONNECTIONS connections, the worker exits so that state left
+ * behind by previous connections (eg. mounts in its namespace) does not
+ * accumulate.
+ */
+[[noreturn]]
+static void run_worker(int listen_fd, int ctrl_fd)
+{
+    // Only the daemon may hold the other workers' control sockets. Otherwise,
+    // they would never see EOF when the daemon exits.
+    close(listen_fd);
+    for (auto const &w : workers) {
+        close(w.fd);
+    }
+    workers.clear();
+
+    // Use slave propagation so that mounts done by the system after the
+    // worker starts (eg. adoptable storage) are still visible
+    if (!init_connection_process(MS_SLAVE)) {
+        _exit(127);
+    }
+
+    // Load the credentials database before the first connection arrives
+    (void) load_packages();
+
+    for (unsigned int n = 1; ; ++n) {
+        (void) util::set_process_title("mbtool connection worker");
+
+        std::vector<int> fds(1);
+        if (auto r = util::socket_receive_fds(ctrl_fd, fds); !r) {
+            // Daemon exited
+            _exit(EXIT_SUCCESS);
+        }
+
+        int client_fd = fds[0];
+        fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+
+        (void) client_connection(client_fd);
+        close(client_fd);
+
+        char msg = n < WORKER_MAX_CONNECTIONS
+                ? WORKER_MSG_IDLE : WORKER_MSG_RETIRE;
+        if (write(ctrl_fd, &msg, 1) != 1 || msg == WORKER_MSG_RETIRE) {
+            _exit(EXIT_SUCCESS);
+        }
+    }
+}
+
+static bool spawn_worker(int listen_fd)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        LOGE("Failed to create worker socket pair: %s", strerror(errno));
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGE("Failed to fork worker: %s", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    } else if (pid == 0) {
+        close(sv[0]);
+        run_worker(listen_fd, sv[1]);
+    }
+
+    close(sv[1]);
+    workers.push_back({pid, sv[0], true});
+
+    return true;
+}
+
+/*!
+ * \brief Serve a connection in a newly forked process
+ *
+ * This is used when all pre-forked workers are busy.
+ */
+static void fork_connection(int listen_fd, int client_fd)
+{
+    pid_t child_pid = fork();
+    if (child_pid < 0) {
+        LOGE("Failed to fork: %s", strerror(errno));
+    } else if (child_pid == 0) {
+        // Don't need the listening socket fd or the worker sockets
+        close(listen_fd);
+        for (auto const &w : workers) {
+            close(w.fd);
+        }
+
+        if (!init_connection_process(MS_PRIVATE)) {
+            _exit(127);
+        }
+
+        bool ret = client_connection(client_fd);
+        close(client_fd);
+        _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+}
+
+static void dispatch_connection(int listen_fd, int client_fd)
+{
+    for (auto &w : workers) {
+        if (!w.idle) {
+            continue;
+        }
+
+        if (auto r = util::socket_send_fds(w.fd, {client_fd}); !r) {
+            LOGW("Failed to pass connection to worker %d: %s",
+                 w.pid, r.error().message().c_str());
+            continue;
+        }
+
+        w.idle = false;
+        return;
+    }
+
+    fork_connection(listen_fd, client_fd);
+}
+
 static bool run_daemon()
 {
     int fd = socket(AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -256,63 +506,74 @@ static bool run_daemon()
         }
     }
 
+    // Must happen before forking any connection processes so they all share
+    // the same counters
+    if (!init_version_3_stats()) {
+        LOGW("Request statistics will only be collected per connection");
+    }
+
     LOGD("Socket ready, waiting for connections");
 
-    int client_fd;
-    while ((client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
-        pid_t child_pid = fork();
-        if (child_pid < 0) {
-            LOGE("Failed to fork: %s", strerror(errno));
-        } else if (child_pid == 0) {
-            if (!no_unshare) {
-                if (unshare(CLONE_NEWNS) < 0) {
-                    LOGE("unshare() failed: %s", strerror(errno));
-                    _exit(127);
-                }
+    std::vector<struct pollfd> pfds;
 
-                if (mount("", "/", "", MS_PRIVATE | MS_REC, "") < 0) {
-                    LOGE("Failed to set private mount propagation: %s",
-                         strerror(errno));
-                    _exit(127);
-                }
+    while (true) {
+        // Replace workers that have exited. If forking fails, connections are
+        // still served by dispatch_connection() forking on demand.
+        while (workers.size() < WORKER_POOL_SIZE) {
+            if (!spawn_worker(fd)) {
+                break;
+            }
+        }
+
+        pfds.clear();
+        pfds.push_back({fd, POLLIN, 0});
+        for (auto const &w : workers) {
+            pfds.push_back({w.fd, POLLIN, 0});
+        }
+
+        if (poll(pfds.data(), pfds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+            LOGE("Failed to poll sockets: %s", strerror(errno));
+            return false;
+        }
 
-            // Change the process name so --replace doesn't kill existing
-            // connections
-            if (auto ret = util::set_process_title(
-                    "mbtool connection initializing"); !ret) {
-                LOGE("Failed to set process title: %s",
-                     ret.error().message().c_str());
-                _exit(127);
+        // Process worker status first so that a worker that just finished a
+        // connection can take the next one
+        for (size_t i = pfds.size() - 1; i > 0; --i) {
+            if (!pfds[i].revents) {
+                continue;
             }
 
-            // Restore default SIGCHLD handler
-            struct sigaction sa;
-            sa.sa_handler = SIG_DFL;
-            sigemptyset(&sa.sa_mask);
-            sa.sa_flags = 0;
-            if (sigaction(SIGCHLD, &sa, 0) < 0) {
-                LOGE("Failed to set default SIGCHLD handler: %s",
-                     strerror(errno));
-                _exit(127);
+            auto &w = workers[i - 1];
+            char msg;
+            ssize_t n = (pfds[i].revents & POLLIN) ? read(w.fd, &msg, 1) : 0;
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n == 1 && msg == WORKER_MSG_IDLE) {
+                w.idle = true;
+            } else {
+                // Worker retired or died. SIGCHLD is ignored, so it does not
+                // need to be reaped.
+                close(w.fd);
+                workers.erase(workers.begin() + static_cast<ptrdiff_t>(i - 1));
             }
+        }
 
-            // Don't need the listening socket fd
-            close(fd);
+        if (pfds[0].revents & POLLIN) {
+            int client_fd = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client_fd < 0) {
+                LOGE("Failed to accept connection on socket: %s",
+                     strerror(errno));
+                return false;
+            }
 
-            bool ret = client_connection(client_fd);
+            dispatch_connection(fd, client_fd);
             close(client_fd);
-            _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
         }
-        close(client_fd);
-    }
-
-    if (client_fd < 0) {
-        LOGE("Failed to accept connection on socket: %s", strerror(errno));
-        return false;
     }
-
-    return true;
 }
 
 static bool redirect_stdio_to_dev_null()
@@ -361,7 +622,8 @@ static bool daemon_init()
     if (log_to_stdio) {
         // Default; do nothing
     } else if (log_to_kmsg) {
-        log::set_logger(std::make_shared<log::KmsgLogger>(false));
+        log::set_logger(std::make_shared<log::AsyncLogger>(
+                std::make_shared<log::KmsgLogger>(false)));
     } else {
         if (auto r = util::mkdir_parent(MULTIBOOT_LOG_DAEMON, 0775);
                 !r && r.error() != std::errc::file_exists) {
@@ -380,11 +642,15 @@ static bool daemon_init()
         fix_multiboot_permissions();
 
         // mbtool logging
-        log::set_logger(std::make_shared<log::StdioLogger>(log_fp.get()));
+        log::set_logger(std::make_shared<log::AsyncLogger>(
+                std::make_shared<log::StdioLogger>(log_fp.get())));
     }
 
     LOGD("Initialized daemon");
 
+    // Finish deleting files left over from deferred wipes
+    start_trash_reaper();
+
     return true;
 }
 
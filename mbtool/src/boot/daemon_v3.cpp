@@ -19,10 +19,23 @@
 
 #include "boot/daemon_v3.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <optional>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
+
+#include <cinttypes>
 
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -30,23 +43,28 @@
 
 #include "mbcommon/error_code.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/atrace.h"
 #include "mbutil/command.h"
 #include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
-#include "mbutil/fts.h"
+#include "mbutil/file.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/reboot.h"
+#include "mbutil/sched.h"
 #include "mbutil/selinux.h"
 #include "mbutil/socket.h"
 #include "mbutil/string.h"
 
 #include "boot/init.h"
 #include "boot/packages.h"
+#include "util/dir_size.h"
+#include "util/multiboot.h"
 #include "util/romconfig.h"
 #include "util/roms.h"
 #include "util/signature.h"
@@ -77,8 +95,165 @@ namespace fb = flatbuffers;
 static std::unordered_map<int, int> fd_map;
 static int fd_count = 0;
 
+// Latency histogram layout. Latencies (in microseconds) below
+// LATENCY_SUB_BUCKETS get their own bucket. Larger values are grouped by power
+// of two, with LATENCY_SUB_BUCKETS linear buckets per power of two, so the
+// reported percentiles are within 1/LATENCY_SUB_BUCKETS of the real value.
+static constexpr unsigned int LATENCY_SUB_BUCKET_BITS = 3;
+static constexpr size_t LATENCY_SUB_BUCKETS = 1u << LATENCY_SUB_BUCKET_BITS;
+static constexpr size_t LATENCY_BUCKETS =
+        LATENCY_SUB_BUCKETS + (64 - LATENCY_SUB_BUCKET_BITS) * LATENCY_SUB_BUCKETS;
+
+struct RequestTypeStats
+{
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<uint64_t> latency_max_us;
+    std::atomic<uint64_t> latency[LATENCY_BUCKETS];
+};
+
+struct RequestStats
+{
+    RequestTypeStats types[v3::RequestType_MAX + 1];
+};
+
+// Statistics for all connections. This lives in a shared anonymous mapping
+// created by init_version_3_stats() so that the daemon's connection processes
+// all update the same counters. The atomics must therefore be lock-free.
+static RequestStats *daemon_stats = nullptr;
+
+// Total size of the responses sent over the current connection
+static uint64_t bytes_sent = 0;
+
+// ID of the request being handled, which is echoed back in its response
+static uint32_t current_request_id = 0;
+
+// Serialized responses of the sub-requests when handling a BatchRequest.
+// v3_send_response() appends to this instead of writing to the socket if it is
+// set.
+static std::vector<std::vector<unsigned char>> *batch_responses = nullptr;
+
+static size_t latency_bucket(uint64_t us)
+{
+    if (us < LATENCY_SUB_BUCKETS) {
+        return static_cast<size_t>(us);
+    }
+
+    auto msb = static_cast<unsigned int>(63 - __builtin_clzll(us));
+    auto shift = msb - LATENCY_SUB_BUCKET_BITS;
+
+    return LATENCY_SUB_BUCKETS + shift * LATENCY_SUB_BUCKETS
+            + static_cast<size_t>((us >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+//! Largest latency that belongs to a bucket
+static uint64_t latency_bucket_max(size_t bucket)
+{
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    auto shift = (bucket - LATENCY_SUB_BUCKETS) / LATENCY_SUB_BUCKETS;
+    auto sub = (bucket - LATENCY_SUB_BUCKETS) % LATENCY_SUB_BUCKETS;
+
+    return ((static_cast<uint64_t>(LATENCY_SUB_BUCKETS + sub) + 1) << shift) - 1;
+}
+
+static uint64_t latency_percentile(const RequestTypeStats &stats,
+                                   unsigned int percent)
+{
+    uint64_t total = 0;
+    for (auto const &b : stats.latency) {
+        total += b.load(std::memory_order_relaxed);
+    }
+
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (total * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += stats.latency[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(latency_bucket_max(i),
+                            stats.latency_max_us.load(std::memory_order_relaxed));
+        }
+    }
+
+    return stats.latency_max_us.load(std::memory_order_relaxed);
+}
+
+static void record_request(RequestStats &stats, v3::RequestType type,
+                           uint64_t latency_us, uint64_t bytes_in,
+                           uint64_t bytes_out)
+{
+    auto &s = stats.types[type];
+
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.bytes_in.fetch_add(bytes_in, std::memory_order_relaxed);
+    s.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+    s.latency[latency_bucket(latency_us)].fetch_add(
+            1, std::memory_order_relaxed);
+
+    auto max = s.latency_max_us.load(std::memory_order_relaxed);
+    while (latency_us > max && !s.latency_max_us.compare_exchange_weak(
+            max, latency_us, std::memory_order_relaxed));
+}
+
+static void log_request_stats(const RequestStats &stats)
+{
+    for (int type = v3::RequestType_MIN; type <= v3::RequestType_MAX; ++type) {
+        auto const &s = stats.types[type];
+        auto count = s.count.load(std::memory_order_relaxed);
+
+        if (count == 0) {
+            continue;
+        }
+
+        LOGD("%s: count=%" PRIu64 ", p50=%" PRIu64 "us, p99=%" PRIu64
+             "us, max=%" PRIu64 "us, in=%" PRIu64 "B, out=%" PRIu64 "B",
+             v3::EnumNameRequestType(static_cast<v3::RequestType>(type)),
+             count, latency_percentile(s, 50), latency_percentile(s, 99),
+             s.latency_max_us.load(std::memory_order_relaxed),
+             s.bytes_in.load(std::memory_order_relaxed),
+             s.bytes_out.load(std::memory_order_relaxed));
+    }
+}
+
+bool init_version_3_stats()
+{
+    void *ptr = mmap(nullptr, sizeof(RequestStats), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        LOGE("Failed to map shared memory for statistics: %s",
+             strerror(errno));
+        return false;
+    }
+
+    daemon_stats = new (ptr) RequestStats();
+    return true;
+}
+
+static fb::Offset<v3::Response> v3_create_response(
+        fb::FlatBufferBuilder &builder, v3::ResponseType type,
+        fb::Offset<void> response)
+{
+    return v3::CreateResponse(builder, type, response, current_request_id);
+}
+
 static bool v3_send_response(int fd, const fb::FlatBufferBuilder &builder)
 {
+    if (batch_responses) {
+        auto data = builder.GetBufferPointer();
+        batch_responses->emplace_back(data, data + builder.GetSize());
+        return true;
+    }
+
+    bytes_sent += builder.GetSize();
+
     return util::socket_write_bytes(
             fd, builder.GetBufferPointer(), builder.GetSize()).has_value();
 }
@@ -86,7 +261,7 @@ static bool v3_send_response(int fd, const fb::FlatBufferBuilder &builder)
 static bool v3_send_response_invalid(int fd)
 {
     fb::FlatBufferBuilder builder;
-    auto response = v3::CreateResponse(builder, v3::ResponseType_Invalid,
+    auto response = v3_create_response(builder, v3::ResponseType_Invalid,
                                        v3::CreateInvalid(builder).Union());
     builder.Finish(response);
     return v3_send_response(fd, builder);
@@ -95,7 +270,7 @@ static bool v3_send_response_invalid(int fd)
 static bool v3_send_response_unsupported(int fd)
 {
     fb::FlatBufferBuilder builder;
-    auto response = v3::CreateResponse(builder, v3::ResponseType_Unsupported,
+    auto response = v3_create_response(builder, v3::ResponseType_Unsupported,
                                        v3::CreateUnsupported(builder).Union());
     builder.Finish(response);
     return v3_send_response(fd, builder);
@@ -132,7 +307,7 @@ static bool v3_file_chmod(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileChmodResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -165,7 +340,7 @@ static bool v3_file_close(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileCloseResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -217,17 +392,42 @@ static bool v3_file_open(int fd, const v3::Request *msg)
                 builder, saved_errno, strerror(saved_errno));
     }
 
+    // If requested, the file descriptor is sent right after the response so
+    // that the client can transfer data without going through FileRead and
+    // FileWrite requests. The file is still registered with an ID so that the
+    // client can close it with FileCloseRequest as usual. Note that both ends
+    // share the file offset.
+    // This is not possible in the middle of a BatchRequest.
+    bool pass_fd = ffd >= 0 && request->pass_fd() && !batch_responses;
+
     auto response = v3::CreateFileOpenResponseDirect(
             builder, ffd >= 0, ffd >= 0 ? nullptr : strerror(saved_errno), id,
-            error);
+            error, pass_fd);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileOpenResponse, response.Union()));
 
-    return v3_send_response(fd, builder);
+    if (!v3_send_response(fd, builder)) {
+        return false;
+    }
+
+    if (pass_fd) {
+        if (auto r = util::socket_send_fds(fd, {ffd}); !r) {
+            LOGE("Failed to send file descriptor: %s",
+                 r.error().message().c_str());
+            return false;
+        }
+    }
+
+    return true;
 }
 
+// Maximum number of bytes returned by a single FileReadRequest. As with
+// read(), clients must already handle short reads. This also bounds the memory
+// retained by the reused builder in v3_file_read().
+static constexpr size_t MAX_FILE_READ_SIZE = 1024 * 1024;
+
 static bool v3_file_read(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::FileReadRequest *>(msg->request());
@@ -237,19 +437,43 @@ static bool v3_file_read(int fd, const v3::Request *msg)
     }
 
     int ffd = it->second;
+    auto count = static_cast<size_t>(std::min<uint64_t>(
+            request->count(), MAX_FILE_READ_SIZE));
 
-    std::vector<unsigned char> buf(static_cast<size_t>(request->count()));
+    // Reuse the builder's buffer across requests
+    static fb::FlatBufferBuilder builder;
+    builder.Clear();
 
-    fb::FlatBufferBuilder builder;
     fb::Offset<v3::FileReadError> error;
     fb::Offset<fb::Vector<unsigned char>> data;
 
-    ssize_t ret = read(ffd, buf.data(), buf.size());
+    // Read directly into the response instead of copying from a temporary
+    // buffer
+    unsigned char *buf;
+    auto data_vec = builder.CreateUninitializedVector(count, &buf);
+
+    ssize_t ret = read(ffd, buf, count);
     int saved_errno = errno;
 
     if (ret >= 0) {
-        data = builder.CreateVector(buf.data(), static_cast<size_t>(ret));
+        auto n = static_cast<size_t>(ret);
+
+        if (n < count) {
+            // Only send the bytes that were read. The data lives inside the
+            // builder's buffer, which is reused by the new vector, so it has
+            // to be moved out first.
+            static std::vector<unsigned char> scratch;
+            scratch.assign(buf, buf + n);
+
+            builder.Clear();
+            data = builder.CreateVector(scratch);
+        } else {
+            data = data_vec;
+        }
     } else {
+        // Don't send the unused buffer
+        builder.Clear();
+
         error = v3::CreateFileReadErrorDirect(
                 builder, saved_errno, strerror(saved_errno));
     }
@@ -260,7 +484,7 @@ static bool v3_file_read(int fd, const v3::Request *msg)
             static_cast<size_t>(ret), data, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileReadResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -307,7 +531,7 @@ static bool v3_file_seek(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileSeekResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -339,7 +563,7 @@ static bool v3_file_selinux_get_label(int fd, const v3::Request *msg)
             label ? label.value().c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
@@ -371,7 +595,7 @@ static bool v3_file_selinux_set_label(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileSELinuxSetLabelResponse,
             response.Union()));
 
@@ -422,7 +646,7 @@ static bool v3_file_stat(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileStatResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -454,7 +678,7 @@ static bool v3_file_write(int fd, const v3::Request *msg)
             static_cast<size_t>(ret), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_FileWriteResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -489,7 +713,7 @@ static bool v3_path_chmod(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : strerror(saved_errno), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathChmodResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -517,12 +741,50 @@ static bool v3_path_copy(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathCopyResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static bool v3_path_copy_tree(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::PathCopyTreeRequest *>(
+            msg->request());
+    if (!request->source() || !request->target()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    // Preserve ownership, modes, timestamps, and SELinux labels (via the
+    // security.selinux xattr). Regular files are copied in parallel and their
+    // contents are copied in the kernel when possible.
+    util::CopyFlags flags = util::CopyFlag::CopyAttributes
+            | util::CopyFlag::CopyXattrs
+            | util::CopyFlag::Parallel;
+    if (request->exclude_top_level()) {
+        flags |= util::CopyFlag::ExcludeTopLevel;
+    }
+
+    fb::FlatBufferBuilder builder;
+    fb::Offset<v3::PathCopyTreeError> error;
+
+    auto ret = util::copy_dir(request->source()->str(),
+                              request->target()->str(), flags);
+    if (!ret) {
+        error = v3::CreatePathCopyTreeErrorDirect(
+                builder, ret.error().ec.value(), ret.error().message().c_str(),
+                ret.error().path.c_str());
+    }
+
+    auto response = v3::CreatePathCopyTreeResponse(builder, error);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_PathCopyTreeResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
 static bool v3_path_delete(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathDeleteRequest *>(msg->request());
@@ -571,7 +833,7 @@ static bool v3_path_delete(int fd, const v3::Request *msg)
             builder, ret, ret ? nullptr : ec.message().c_str(), error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathDeleteResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -613,7 +875,7 @@ static bool v3_path_mkdir(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathMkdirResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -641,7 +903,7 @@ static bool v3_path_readlink(int fd, const v3::Request *msg)
             builder, target ? target.value().c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathReadlinkResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -676,7 +938,7 @@ static bool v3_path_selinux_get_label(int fd, const v3::Request *msg)
             label ? label.value().c_str() : nullptr, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathSELinuxGetLabelResponse,
             response.Union()));
 
@@ -713,62 +975,13 @@ static bool v3_path_selinux_set_label(int fd, const v3::Request *msg)
             error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathSELinuxSetLabelResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-class DirectorySizeGetter : public util::FtsWrapper {
-public:
-    DirectorySizeGetter(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-        , _total(0)
-    {
-    }
-
-    Actions on_changed_path() override
-    {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
-            }
-        }
-
-        return Action::Ok;
-    }
-
-    Actions on_reached_file() override
-    {
-        dev_t dev = static_cast<dev_t>(_curr->fts_statp->st_dev);
-        ino_t ino = static_cast<ino_t>(_curr->fts_statp->st_ino);
-
-        // If this file has been visited before (hard link), then skip it
-        if (_links.find(dev) != _links.end()
-                && _links[dev].find(ino) != _links[dev].end()) {
-            return Action::Ok;
-        }
-
-        _total += static_cast<uint64_t>(_curr->fts_statp->st_size);
-        _links[dev].emplace(ino);
-
-        return Action::Ok;
-    }
-
-    uint64_t total() const {
-        return _total;
-    }
-
-private:
-    std::vector<std::string> _exclusions;
-    std::unordered_map<dev_t, std::unordered_set<ino_t>> _links;
-    uint64_t _total;
-};
-
 static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
 {
     auto request = static_cast<const v3::PathGetDirectorySizeRequest *>(
@@ -784,9 +997,13 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
         }
     }
 
-    DirectorySizeGetter dsg(request->path()->str(), std::move(exclusions));
-    bool ret = dsg.run();
-    int saved_errno = errno;
+    // Kept for the lifetime of the connection so that repeated queries only
+    // rescan the subtrees that changed
+    static DirectorySizeCache cache;
+
+    auto size = cache.get(request->path()->str(), exclusions);
+    bool ret = !!size;
+    int saved_errno = ret ? 0 : size.error().value();
 
     fb::FlatBufferBuilder builder;
     fb::Offset<v3::PathGetDirectorySizeError> error;
@@ -797,40 +1014,87 @@ static bool v3_path_get_directory_size(int fd, const v3::Request *msg)
     }
 
     auto response = v3::CreatePathGetDirectorySizeResponseDirect(
-            builder, ret, ret ? nullptr : strerror(saved_errno), dsg.total(),
-            error);
+            builder, ret, ret ? nullptr : strerror(saved_errno),
+            ret ? size.value() : 0, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_PathGetDirectorySizeResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-static void signed_exec_output_cb(int fd, std::string_view line)
+/*!
+ * \brief Coalesces signed exec output into as few responses as possible
+ *
+ * All complete lines returned by one read of the process' stdout or stderr
+ * pipe are sent in a single SignedExecOutputResponse. Partial lines are held
+ * back until they are completed, EOF is reached, or they exceed the maximum
+ * line length. The FlatBuffer builder is reused for every response.
+ */
+struct SignedExecOutput
 {
+    static constexpr size_t MAX_PARTIAL_LINE = 4096;
+
+    int fd;
     fb::FlatBufferBuilder builder;
-    auto line_id = builder.CreateString(line.data(), line.size());
+    std::string pending[2];
 
-    // Create response
-    auto response = v3::CreateSignedExecOutputResponse(builder, line_id);
+    explicit SignedExecOutput(int fd_) : fd(fd_)
+    {
+    }
 
-    // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_SignedExecOutputResponse,
-            response.Union()));
+    void on_data(std::string_view data, bool error)
+    {
+        auto &buf = pending[error];
 
-    if (!v3_send_response(fd, builder)) {
-        // Can't kill the connection from this callback (yet...)
-        LOGE("Failed to send output line: %s", strerror(errno));
+        // Reached EOF
+        if (data.empty()) {
+            if (!buf.empty()) {
+                send(buf);
+                buf.clear();
+            }
+            return;
+        }
+
+        buf.append(data);
+
+        auto pos = buf.rfind('\n');
+        size_t n = pos == std::string::npos ? 0 : pos + 1;
+        if (n == 0 && buf.size() >= MAX_PARTIAL_LINE) {
+            n = buf.size();
+        }
+
+        if (n > 0) {
+            send(std::string_view(buf).substr(0, n));
+            buf.erase(0, n);
+        }
     }
-}
+
+    void send(std::string_view lines)
+    {
+        builder.Clear();
+
+        auto line_id = builder.CreateString(lines.data(), lines.size());
+
+        // Create response
+        auto response = v3::CreateSignedExecOutputResponse(builder, line_id);
+
+        // Wrap response
+        builder.Finish(v3_create_response(
+                builder, v3::ResponseType_SignedExecOutputResponse,
+                response.Union()));
+
+        if (!v3_send_response(fd, builder)) {
+            // Can't kill the connection from this callback (yet...)
+            LOGE("Failed to send output: %s", strerror(errno));
+        }
+    }
+};
 
 static bool v3_signed_exec(int fd, const v3::Request *msg)
 {
-    using namespace std::placeholders;
-
     auto request = static_cast<const v3::SignedExecRequest *>(msg->request());
     if (!request->binary_path() || !request->signature_path()) {
         return v3_send_response_invalid(fd);
@@ -955,8 +1219,15 @@ static bool v3_signed_exec(int fd, const v3::Request *msg)
     // TODO: Update libmbutil's command.cpp so the callback can return a bool
     //       Right now, if the connection is broken, the command will continue
     //       executing.
-    status = util::run_command(target_binary, argv, {}, {},
-                               std::bind(&signed_exec_output_cb, fd, _1));
+    {
+        SignedExecOutput output(fd);
+
+        status = util::run_command_raw(
+                target_binary, argv, {}, {},
+                [&](std::string_view data, bool error) {
+            output.on_data(data, error);
+        });
+    }
     if (status >= 0 && WIFEXITED(status)) {
         result = v3::SignedExecResult_PROCESS_EXITED;
         exit_status = WEXITSTATUS(status);
@@ -985,7 +1256,7 @@ done:
             builder, result, error_msg_id, exit_status, term_sig, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_SignedExecResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1006,72 +1277,266 @@ static bool v3_mb_get_booted_rom_id(int fd, const v3::Request *msg)
     auto response = v3::CreateMbGetBootedRomIdResponse(builder, id);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetBootedRomIdResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
+//! Properties reported for each ROM by v3_mb_get_installed_roms()
+static constexpr std::string_view BUILD_PROP_KEYS[] = {
+    "ro.build.version.release",
+    "ro.build.display.id",
+};
+
+using BuildPropValues =
+        std::array<std::optional<std::string>, std::size(BUILD_PROP_KEYS)>;
+
+/*!
+ * \brief Read BUILD_PROP_KEYS from a build.prop file
+ *
+ * The values are cached by the file's identity, size, and mtime for the
+ * lifetime of the connection, so listing ROMs again does not reread unchanged
+ * files. Changes to files imported by \p path are not detected.
+ */
+static const BuildPropValues & get_build_props(const std::string &path)
 {
-    (void) msg;
+    struct Entry
+    {
+        timespec mtime;
+        off_t size;
+        BuildPropValues values;
+    };
 
-    fb::FlatBufferBuilder builder;
+    static std::unordered_map<FileId, Entry, FileIdHash> cache;
+    static const BuildPropValues empty;
+
+    struct stat sb;
+    if (stat(path.c_str(), &sb) < 0) {
+        return empty;
+    }
+
+    FileId id{sb.st_dev, sb.st_ino};
+
+    if (auto it = cache.find(id); it != cache.end()
+            && it->second.size == sb.st_size
+            && it->second.mtime.tv_sec == sb.st_mtim.tv_sec
+            && it->second.mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+        return it->second.values;
+    }
+
+    Entry entry{sb.st_mtim, sb.st_size,
+                util::property_file_get_many(path, BUILD_PROP_KEYS)};
+
+    return cache.insert_or_assign(id, std::move(entry)).first->second.values;
+}
+
+//! Changes to a watched directory that may affect the installed ROMs
+static constexpr uint32_t ROM_WATCH_MASK = IN_CREATE | IN_DELETE
+        | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE | IN_DELETE_SELF
+        | IN_MOVE_SELF;
+
+struct InstalledRom
+{
+    std::string id;
+    std::string system_path;
+    std::string cache_path;
+    std::string data_path;
+    std::optional<std::string> version;
+    std::optional<std::string> build;
+};
+
+/*!
+ * \brief Installed ROMs reported by v3_mb_get_installed_roms()
+ *
+ * The list is built on first use and kept by the connection process until
+ * inotify reports a change in one of the directories it was derived from. If
+ * inotify is not available, the list is rebuilt for every request.
+ */
+static struct
+{
+    int inotify_fd = -1;
+    bool valid = false;
+    std::vector<InstalledRom> roms;
+} rom_inventory;
+
+//! Whether the client should be sent MbRomsChangedEvent
+static bool watching_roms = false;
+
+static void rom_inventory_watch(const std::string &path)
+{
+    if (inotify_add_watch(rom_inventory.inotify_fd, path.c_str(),
+                          ROM_WATCH_MASK) < 0
+            && errno != ENOENT && errno != ENOTDIR) {
+        LOGW("%s: Failed to watch for changes: %s",
+             path.c_str(), strerror(errno));
+    }
+}
+
+static void rom_inventory_build()
+{
+    rom_inventory.roms.clear();
+    rom_inventory.valid = false;
+
+    // Start with a new inotify instance so that the watches for removed ROMs
+    // are dropped
+    if (rom_inventory.inotify_fd >= 0) {
+        close(rom_inventory.inotify_fd);
+    }
+
+    rom_inventory.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (rom_inventory.inotify_fd < 0) {
+        LOGW("Failed to initialize inotify: %s", strerror(errno));
+    } else {
+        // Watch the directories containing the ROMs before searching them so
+        // that changes made during the search are not missed
+        rom_inventory_watch(get_raw_path(MULTIBOOT_DIR));
+
+        for (auto source : { Rom::Source::System, Rom::Source::Cache,
+                             Rom::Source::Data }) {
+            if (auto path = Roms::get_mountpoint(source); !path.empty()) {
+                rom_inventory_watch(path + "/multiboot");
+            }
+        }
+
+        if (auto path = Roms::get_extsd_partition(); !path.empty()) {
+            rom_inventory_watch(path + "/multiboot");
+        }
+    }
 
     Roms roms;
     roms.add_installed();
 
-    std::vector<fb::Offset<v3::MbRom>> fb_roms;
-
     for (auto r : roms.roms) {
-        std::string system_path = r->full_system_path();
-        std::string cache_path = r->full_cache_path();
-        std::string data_path = r->full_data_path();
-
-        auto fb_id = builder.CreateString(r->id);
-        auto fb_system_path = builder.CreateString(system_path);
-        auto fb_cache_path = builder.CreateString(cache_path);
-        auto fb_data_path = builder.CreateString(data_path);
-        fb::Offset<fb::String> fb_version;
-        fb::Offset<fb::String> fb_build;
+        InstalledRom rom;
+        rom.id = r->id;
+        rom.system_path = r->full_system_path();
+        rom.cache_path = r->full_cache_path();
+        rom.data_path = r->full_data_path();
 
         std::string build_prop;
         if (r->system_is_image) {
             build_prop += "/raw/images/";
             build_prop += r->id;
         } else {
-            build_prop += system_path;
+            build_prop += rom.system_path;
         }
         build_prop += "/build.prop";
 
-        struct {
-            const char *key;
-            fb::Offset<fb::String> &offset;
-        } needed_props[] = {
-            { "ro.build.version.release", fb_version },
-            { "ro.build.display.id", fb_build },
+        if (rom_inventory.inotify_fd >= 0) {
+            // Directories containing the boot image, config, build.prop,
+            // and system image
+            rom_inventory_watch(util::dir_name(r->config_path()));
+            rom_inventory_watch(util::dir_name(build_prop));
+            if (r->system_is_image) {
+                rom_inventory_watch(util::dir_name(rom.system_path));
+            }
+        }
+
+        std::optional<std::string> *needed_props[] = {
+            &rom.version, &rom.build
         };
+        static_assert(std::size(needed_props) == std::size(BUILD_PROP_KEYS));
 
         RomConfig config;
         config.load_file(r->config_path());
         auto &props = config.cached_props;
 
-        util::property_file_iter(build_prop, {}, [&](std::string_view key,
-                                                     std::string_view value) {
-            for (auto const &item : needed_props) {
-                if (item.key == key) {
-                    props.insert_or_assign(std::string(key), std::string(value));
-                }
+        auto const &values = get_build_props(build_prop);
+
+        for (size_t i = 0; i < std::size(BUILD_PROP_KEYS); ++i) {
+            std::string key(BUILD_PROP_KEYS[i]);
+
+            if (values[i]) {
+                props.insert_or_assign(key, *values[i]);
             }
 
-            return util::PropertyIterAction::Continue;
-        });
+            if (auto it = props.find(key); it != props.end()) {
+                *needed_props[i] = it->second;
+            }
+        }
+
+        rom_inventory.roms.push_back(std::move(rom));
+    }
+
+    rom_inventory.valid = rom_inventory.inotify_fd >= 0;
+}
 
-        for (auto const &item : needed_props) {
-            if (auto it = props.find(item.key); it != props.end()) {
-                item.offset = builder.CreateString(it->second);
+/*!
+ * \brief Process pending inotify events
+ *
+ * \return Whether the inventory was valid and has been invalidated
+ */
+static bool rom_inventory_poll()
+{
+    if (rom_inventory.inotify_fd < 0) {
+        return false;
+    }
+
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+
+    // Always drain the queue so that the file descriptor does not stay
+    // readable
+    while (true) {
+        ssize_t n = read(rom_inventory.inotify_fd, buf, sizeof(buf));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno != EAGAIN) {
+                LOGW("Failed to read inotify events: %s", strerror(errno));
+                changed = true;
             }
+            break;
+        } else if (n == 0) {
+            break;
+        }
+
+        // Every event, including IN_Q_OVERFLOW and IN_IGNORED, is a change
+        changed = true;
+    }
+
+    if (changed && rom_inventory.valid) {
+        rom_inventory.valid = false;
+        return true;
+    }
+
+    return false;
+}
+
+static const std::vector<InstalledRom> & rom_inventory_get()
+{
+    rom_inventory_poll();
+
+    if (!rom_inventory.valid) {
+        rom_inventory_build();
+    }
+
+    return rom_inventory.roms;
+}
+
+static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
+{
+    (void) msg;
+
+    fb::FlatBufferBuilder builder;
+
+    std::vector<fb::Offset<v3::MbRom>> fb_roms;
+
+    for (auto const &r : rom_inventory_get()) {
+        auto fb_id = builder.CreateString(r.id);
+        auto fb_system_path = builder.CreateString(r.system_path);
+        auto fb_cache_path = builder.CreateString(r.cache_path);
+        auto fb_data_path = builder.CreateString(r.data_path);
+        fb::Offset<fb::String> fb_version;
+        fb::Offset<fb::String> fb_build;
+
+        if (r.version) {
+            fb_version = builder.CreateString(*r.version);
+        }
+        if (r.build) {
+            fb_build = builder.CreateString(*r.build);
         }
 
         v3::MbRomBuilder mrb(builder);
@@ -1091,51 +1556,89 @@ static bool v3_mb_get_installed_roms(int fd, const v3::Request *msg)
             builder, &fb_roms);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetInstalledRomsResponse,
             response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-static bool v3_mb_get_version(int fd, const v3::Request *msg)
+static bool v3_mb_watch_roms(int fd, const v3::Request *msg)
 {
-    (void) msg;
+    auto request = static_cast<const v3::MbWatchRomsRequest *>(msg->request());
+
+    watching_roms = request->enable();
+    if (watching_roms) {
+        // Ensure that the directories are being watched
+        rom_inventory_get();
+    }
 
     fb::FlatBufferBuilder builder;
 
-    // Get version
-    auto response = v3::CreateMbGetVersionResponseDirect(builder, version());
+    // Create response
+    auto response = v3::CreateMbWatchRomsResponse(builder);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
-            builder, v3::ResponseType_MbGetVersionResponse, response.Union()));
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_MbWatchRomsResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
-static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
+static bool v3_send_roms_changed_event(int fd)
 {
-    auto request = static_cast<const v3::MbSetKernelRequest *>(msg->request());
-    if (!request->rom_id() || !request->boot_blockdev()) {
-        return v3_send_response_invalid(fd);
-    }
-
     fb::FlatBufferBuilder builder;
-    fb::Offset<v3::MbSetKernelError> error;
 
-    bool ret = set_kernel(request->rom_id()->str(),
-                          request->boot_blockdev()->str());
+    // Events do not belong to a request
+    current_request_id = 0;
 
-    if (!ret) {
-        error = v3::CreateMbSetKernelError(builder);
+    auto event = v3::CreateMbRomsChangedEvent(builder);
+
+    // Wrap event
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_MbRomsChangedEvent, event.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_mb_get_version(int fd, const v3::Request *msg)
+{
+    (void) msg;
+
+    fb::FlatBufferBuilder builder;
+
+    // Get version
+    auto response = v3::CreateMbGetVersionResponseDirect(builder, version());
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_MbGetVersionResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_mb_set_kernel(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::MbSetKernelRequest *>(msg->request());
+    if (!request->rom_id() || !request->boot_blockdev()) {
+        return v3_send_response_invalid(fd);
+    }
+
+    fb::FlatBufferBuilder builder;
+    fb::Offset<v3::MbSetKernelError> error;
+
+    bool ret = set_kernel(request->rom_id()->str(),
+                          request->boot_blockdev()->str());
+
+    if (!ret) {
+        error = v3::CreateMbSetKernelError(builder);
     }
 
     // Create response
     auto response = v3::CreateMbSetKernelResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbSetKernelResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1192,7 +1695,7 @@ static bool v3_mb_switch_rom(int fd, const v3::Request *msg)
             builder, success, fb_ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbSwitchRomResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1238,15 +1741,15 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
             bool success = false;
 
             if (target == v3::MbWipeTarget_SYSTEM) {
-                success = wipe_system(rom);
+                success = wipe_system(rom, WipeFlag::Deferred);
             } else if (target == v3::MbWipeTarget_CACHE) {
-                success = wipe_cache(rom);
+                success = wipe_cache(rom, WipeFlag::Deferred);
             } else if (target == v3::MbWipeTarget_DATA) {
-                success = wipe_data(rom);
+                success = wipe_data(rom, WipeFlag::Deferred);
             } else if (target == v3::MbWipeTarget_DALVIK_CACHE) {
-                success = wipe_dalvik_cache(rom);
+                success = wipe_dalvik_cache(rom, WipeFlag::Deferred);
             } else if (target == v3::MbWipeTarget_MULTIBOOT) {
-                success = wipe_multiboot(rom);
+                success = wipe_multiboot(rom, WipeFlag::Deferred);
             } else {
                 LOGE("Unknown wipe target %d", target);
             }
@@ -1257,6 +1760,9 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
                 failed.push_back(target);
             }
         }
+
+        // Delete the files that were moved to the trash in the background
+        start_trash_reaper();
     }
 
     fb::FlatBufferBuilder builder;
@@ -1266,7 +1772,7 @@ static bool v3_mb_wipe_rom(int fd, const v3::Request *msg)
             builder, &succeeded, &failed);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbWipeRomResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1324,7 +1830,7 @@ static bool v3_mb_get_packages_count(int fd, const v3::Request *msg)
             builder, ret, system_pkgs, update_pkgs, other_pkgs, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_MbGetPackagesCountResponse,
             response.Union()));
 
@@ -1369,7 +1875,7 @@ static bool v3_reboot(int fd, const v3::Request *msg)
     auto response = v3::CreateRebootResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_RebootResponse, response.Union()));
 
     return v3_send_response(fd, builder);
@@ -1408,21 +1914,64 @@ static bool v3_shutdown(int fd, const v3::Request *msg)
     auto response = v3::CreateShutdownResponse(builder, ret, error);
 
     // Wrap response
-    builder.Finish(v3::CreateResponse(
+    builder.Finish(v3_create_response(
             builder, v3::ResponseType_ShutdownResponse, response.Union()));
 
     return v3_send_response(fd, builder);
 }
 
+static bool v3_mb_get_stats(int fd, const v3::Request *msg)
+{
+    (void) msg;
+
+    fb::FlatBufferBuilder builder;
+    std::vector<fb::Offset<v3::MbRequestStats>> fb_stats;
+
+    if (daemon_stats) {
+        for (int type = v3::RequestType_MIN; type <= v3::RequestType_MAX;
+                ++type) {
+            auto const &s = daemon_stats->types[type];
+            auto count = s.count.load(std::memory_order_relaxed);
+
+            if (count == 0) {
+                continue;
+            }
+
+            fb_stats.push_back(v3::CreateMbRequestStatsDirect(
+                    builder,
+                    v3::EnumNameRequestType(static_cast<v3::RequestType>(type)),
+                    count,
+                    latency_percentile(s, 50),
+                    latency_percentile(s, 99),
+                    s.latency_max_us.load(std::memory_order_relaxed),
+                    s.bytes_in.load(std::memory_order_relaxed),
+                    s.bytes_out.load(std::memory_order_relaxed)));
+        }
+    }
+
+    // Create response
+    auto response = v3::CreateMbGetStatsResponseDirect(builder, &fb_stats);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_MbGetStatsResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
 typedef bool (*request_handler_fn)(int, const v3::Request *);
 
+static bool v3_batch(int fd, const v3::Request *msg);
+static bool v3_job_submit(int fd, const v3::Request *msg);
+static bool v3_job_cancel(int fd, const v3::Request *msg);
+
 struct RequestMap
 {
     v3::RequestType type;
     request_handler_fn fn;
 };
 
-static RequestMap request_map[] = {
+static constexpr RequestMap request_map[] = {
     { v3::RequestType_FileChmodRequest, v3_file_chmod },
     { v3::RequestType_FileCloseRequest, v3_file_close },
     { v3::RequestType_FileOpenRequest, v3_file_open },
@@ -1434,6 +1983,7 @@ static RequestMap request_map[] = {
     { v3::RequestType_FileWriteRequest, v3_file_write },
     { v3::RequestType_PathChmodRequest, v3_path_chmod },
     { v3::RequestType_PathCopyRequest, v3_path_copy },
+    { v3::RequestType_PathCopyTreeRequest, v3_path_copy_tree },
     { v3::RequestType_PathDeleteRequest, v3_path_delete },
     { v3::RequestType_PathMkdirRequest, v3_path_mkdir },
     { v3::RequestType_PathReadlinkRequest, v3_path_readlink },
@@ -1448,11 +1998,598 @@ static RequestMap request_map[] = {
     { v3::RequestType_MbSwitchRomRequest, v3_mb_switch_rom },
     { v3::RequestType_MbWipeRomRequest, v3_mb_wipe_rom },
     { v3::RequestType_MbGetPackagesCountRequest, v3_mb_get_packages_count },
+    { v3::RequestType_MbGetStatsRequest, v3_mb_get_stats },
+    { v3::RequestType_MbWatchRomsRequest, v3_mb_watch_roms },
     { v3::RequestType_RebootRequest, v3_reboot },
     { v3::RequestType_ShutdownRequest, v3_shutdown },
+    { v3::RequestType_BatchRequest, v3_batch },
+    { v3::RequestType_JobSubmitRequest, v3_job_submit },
+    { v3::RequestType_JobCancelRequest, v3_job_cancel },
     { v3::RequestType_NONE, nullptr }
 };
 
+// Handlers indexed by request type
+static constexpr auto request_table = [] {
+    std::array<request_handler_fn, v3::RequestType_MAX + 1> table{};
+    for (auto it = request_map; it->fn; ++it) {
+        table[it->type] = it->fn;
+    }
+    return table;
+}();
+
+static request_handler_fn find_request_handler(v3::RequestType type)
+{
+    return type >= v3::RequestType_MIN && type <= v3::RequestType_MAX
+            ? request_table[type] : nullptr;
+}
+
+static bool v3_batch(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::BatchRequest *>(msg->request());
+    // Batches cannot be nested
+    if (!request->requests() || batch_responses) {
+        return v3_send_response_invalid(fd);
+    }
+
+    std::vector<std::vector<unsigned char>> responses;
+    responses.reserve(request->requests()->size());
+
+    {
+        batch_responses = &responses;
+
+        auto restore = finally([&] {
+            batch_responses = nullptr;
+            current_request_id = msg->id();
+        });
+
+        for (auto const *sub_request : *request->requests()) {
+            auto type = sub_request->request_type();
+            auto fn = find_request_handler(type);
+            bool ret;
+
+            current_request_id = sub_request->id();
+
+            if (type == v3::RequestType_SignedExecRequest) {
+                // Streams its output as multiple responses
+                ret = v3_send_response_invalid(fd);
+            } else if (fn) {
+                ret = fn(fd, sub_request);
+            } else {
+                ret = v3_send_response_unsupported(fd);
+            }
+
+            if (!ret) {
+                return false;
+            }
+        }
+    }
+
+    fb::FlatBufferBuilder builder;
+
+    std::vector<fb::Offset<v3::BatchResponseEntry>> entries;
+    entries.reserve(responses.size());
+
+    for (auto const &data : responses) {
+        entries.push_back(v3::CreateBatchResponseEntryDirect(builder, &data));
+    }
+
+    auto response = v3::CreateBatchResponseDirect(builder, &entries);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_BatchResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+// Maximum number of jobs that run at the same time. Further jobs are queued.
+static constexpr size_t JOB_MAX_RUNNING = 2;
+
+// Interval between JobProgressEvents for a running job
+static constexpr std::chrono::milliseconds JOB_PROGRESS_INTERVAL{500};
+
+struct JobType
+{
+    v3::RequestType type;
+    // Whether a running job can be cancelled. Interrupting a ROM switch or
+    // wipe could leave the ROM in an inconsistent state.
+    bool interruptible;
+};
+
+static constexpr JobType job_types[] = {
+    { v3::RequestType_MbSwitchRomRequest, false },
+    { v3::RequestType_MbWipeRomRequest, false },
+    { v3::RequestType_PathCopyRequest, true },
+    { v3::RequestType_PathCopyTreeRequest, true },
+    { v3::RequestType_PathGetDirectorySizeRequest, true },
+};
+
+/*!
+ * \brief Request that is run in a child process of the connection process
+ *
+ * The child handles the request as usual, but the response is sent back to the
+ * connection process over a pipe and is forwarded to the client in a
+ * JobFinishedEvent.
+ */
+struct Job
+{
+    uint32_t id;
+    const JobType *type;
+    //! Copy of the received frame that contains the request
+    std::vector<unsigned char> frame;
+    //! Offset of the request in frame
+    size_t offset;
+    bool cancelled = false;
+
+    // Only valid while running
+    pid_t pid = -1;
+    int pipe_fd = -1;
+    std::vector<unsigned char> response;
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point last_report;
+    uint64_t last_bytes_read = 0;
+    uint64_t last_bytes_written = 0;
+
+    const v3::Request * request() const
+    {
+        return reinterpret_cast<const v3::Request *>(frame.data() + offset);
+    }
+};
+
+//! Jobs submitted over the current connection in submission order
+static std::vector<Job> jobs;
+static uint32_t job_count = 0;
+
+//! Frame containing the request being handled
+static util::FramedSocket::Frame current_frame{};
+
+static const JobType * find_job_type(v3::RequestType type)
+{
+    for (auto const &job_type : job_types) {
+        if (job_type.type == type) {
+            return &job_type;
+        }
+    }
+    return nullptr;
+}
+
+static bool v3_job_submit(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::JobSubmitRequest *>(msg->request());
+    auto job_request = request->request();
+    if (!job_request) {
+        return v3_send_response_invalid(fd);
+    }
+
+    fb::FlatBufferBuilder builder;
+    uint32_t job_id = 0;
+    const char *error_msg = nullptr;
+
+    if (auto type = find_job_type(job_request->request_type()); !type) {
+        error_msg = "Request cannot be run as a job";
+    } else {
+        // The receive buffer is reused, so keep a copy of the whole frame. The
+        // offsets within the submitted request remain valid.
+        auto begin = current_frame.data;
+        auto ptr = reinterpret_cast<const unsigned char *>(job_request);
+
+        Job job;
+        job.id = ++job_count;
+        job.type = type;
+        job.frame.assign(begin, begin + current_frame.size);
+        job.offset = static_cast<size_t>(ptr - begin);
+
+        job_id = job.id;
+        jobs.push_back(std::move(job));
+    }
+
+    // Create response
+    auto response = v3::CreateJobSubmitResponseDirect(
+            builder, job_id, error_msg);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_JobSubmitResponse, response.Union()));
+
+    // The job is started by v3_wait_for_request()
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_job_cancel(int fd, const v3::Request *msg)
+{
+    auto request = static_cast<const v3::JobCancelRequest *>(msg->request());
+
+    fb::FlatBufferBuilder builder;
+    bool success = false;
+
+    auto it = std::find_if(jobs.begin(), jobs.end(), [&](const Job &job) {
+        return job.id == request->job_id();
+    });
+
+    if (it != jobs.end() && !it->cancelled) {
+        if (it->pid < 0) {
+            // Queued jobs are removed by jobs_update()
+            it->cancelled = true;
+            success = true;
+        } else if (it->type->interruptible) {
+            if (kill(it->pid, SIGKILL) < 0) {
+                LOGW("Failed to kill job %" PRIu32 ": %s",
+                     it->id, strerror(errno));
+            } else {
+                it->cancelled = true;
+                success = true;
+            }
+        }
+    }
+
+    // Create response
+    auto response = v3::CreateJobCancelResponse(builder, success);
+
+    // Wrap response
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_JobCancelResponse, response.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+static bool v3_send_job_finished_event(int fd, const Job &job)
+{
+    fb::FlatBufferBuilder builder;
+
+    // Events do not belong to a request
+    current_request_id = 0;
+
+    auto event = v3::CreateJobFinishedEventDirect(
+            builder, job.id, job.cancelled,
+            job.response.empty() ? nullptr : &job.response);
+
+    // Wrap event
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_JobFinishedEvent, event.Union()));
+
+    return v3_send_response(fd, builder);
+}
+
+/*!
+ * \brief Get the bytes read and written by a process from /proc/<pid>/io
+ *
+ * This includes all read()- and write()-like syscalls, whether or not they
+ * were satisfied from the page cache.
+ */
+static bool get_process_io(pid_t pid, uint64_t &bytes_read,
+                           uint64_t &bytes_written)
+{
+    auto contents = util::file_read_all(format("/proc/%d/io", pid));
+    if (!contents) {
+        return false;
+    }
+
+    bool have_read = false;
+    bool have_written = false;
+
+    for (auto const &line : split_sv(contents.value(), "\n")) {
+        if (starts_with(line, "rchar: ")) {
+            have_read = str_to_num(std::string(line.substr(7)).c_str(), 10,
+                                   bytes_read);
+        } else if (starts_with(line, "wchar: ")) {
+            have_written = str_to_num(std::string(line.substr(7)).c_str(), 10,
+                                      bytes_written);
+        }
+    }
+
+    return have_read && have_written;
+}
+
+static bool v3_send_job_progress_event(
+        int fd, Job &job, std::chrono::steady_clock::time_point now)
+{
+    uint64_t bytes_read = job.last_bytes_read;
+    uint64_t bytes_written = job.last_bytes_written;
+
+    // Report the previous values if I/O accounting is not available
+    (void) get_process_io(job.pid, bytes_read, bytes_written);
+
+    auto elapsed_ms = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                    now - job.start_time).count());
+    auto interval_us = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                    now - job.last_report).count());
+
+    auto rate = [&](uint64_t current, uint64_t previous) -> uint64_t {
+        if (interval_us == 0 || current < previous) {
+            return 0;
+        }
+        return (current - previous) * 1000000 / interval_us;
+    };
+
+    fb::FlatBufferBuilder builder;
+
+    // Events do not belong to a request
+    current_request_id = 0;
+
+    auto event = v3::CreateJobProgressEvent(
+            builder, job.id, elapsed_ms, bytes_read, bytes_written,
+            rate(bytes_read, job.last_bytes_read),
+            rate(bytes_written, job.last_bytes_written));
+
+    // Wrap event
+    builder.Finish(v3_create_response(
+            builder, v3::ResponseType_JobProgressEvent, event.Union()));
+
+    job.last_report = now;
+    job.last_bytes_read = bytes_read;
+    job.last_bytes_written = bytes_written;
+
+    return v3_send_response(fd, builder);
+}
+
+//! Runs in the child process. Returns whether the response was written.
+static bool run_job(const Job &job, int pipe_fd)
+{
+    // Jobs run while Android is in use, so they should not compete with the
+    // foreground
+    if (auto r = util::set_sched_policy(util::SchedPolicy::Background); !r) {
+        LOGW("Failed to set job scheduling policy: %s",
+             r.error().message().c_str());
+    }
+
+    const v3::Request *request = job.request();
+    request_handler_fn fn = find_request_handler(request->request_type());
+
+    std::vector<std::vector<unsigned char>> responses;
+    batch_responses = &responses;
+    current_request_id = request->id();
+
+    if (!fn || !fn(-1, request) || responses.size() != 1) {
+        return false;
+    }
+
+    auto const &response = responses.front();
+    auto ret = util::socket_write(pipe_fd, response.data(), response.size());
+    return ret && ret.value() == response.size();
+}
+
+static bool job_start(Job &job)
+{
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        LOGE("Failed to create pipe for job: %s", strerror(errno));
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGE("Failed to fork job process: %s", strerror(errno));
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return false;
+    } else if (pid == 0) {
+        close(pipe_fds[0]);
+        _exit(run_job(job, pipe_fds[1]) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(pipe_fds[1]);
+
+    job.pid = pid;
+    job.pipe_fd = pipe_fds[0];
+    job.start_time = job.last_report = std::chrono::steady_clock::now();
+
+    return true;
+}
+
+//! Reap a job whose pipe has been closed and send its JobFinishedEvent
+static bool job_finish(int fd, std::vector<Job>::iterator it)
+{
+    close(it->pipe_fd);
+
+    int status;
+    bool succeeded = false;
+
+    if (waitpid(it->pid, &status, 0) < 0) {
+        LOGE("Failed to wait for job %" PRIu32 ": %s",
+             it->id, strerror(errno));
+    } else {
+        succeeded = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    }
+
+    // Don't forward partial responses
+    if (!succeeded || it->cancelled) {
+        it->response.clear();
+    }
+
+    Job job = std::move(*it);
+    jobs.erase(it);
+
+    return v3_send_job_finished_event(fd, job);
+}
+
+static bool job_read(int fd, int pipe_fd)
+{
+    auto it = std::find_if(jobs.begin(), jobs.end(), [&](const Job &job) {
+        return job.pipe_fd == pipe_fd;
+    });
+    if (it == jobs.end()) {
+        return true;
+    }
+
+    unsigned char buf[16384];
+
+    ssize_t n = read(pipe_fd, buf, sizeof(buf));
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN) {
+            return true;
+        }
+        LOGE("Failed to read job %" PRIu32 " response: %s",
+             it->id, strerror(errno));
+        it->response.clear();
+        return job_finish(fd, it);
+    } else if (n == 0) {
+        return job_finish(fd, it);
+    }
+
+    it->response.insert(it->response.end(), buf, buf + n);
+    return true;
+}
+
+/*!
+ * \brief Remove cancelled queued jobs, start queued jobs, and report progress
+ */
+static bool jobs_update(int fd)
+{
+    size_t running = 0;
+
+    for (auto it = jobs.begin(); it != jobs.end();) {
+        if (it->pid >= 0) {
+            ++running;
+            ++it;
+        } else if (it->cancelled) {
+            Job job = std::move(*it);
+            it = jobs.erase(it);
+
+            if (!v3_send_job_finished_event(fd, job)) {
+                return false;
+            }
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto it = jobs.begin(); it != jobs.end()
+            && running < JOB_MAX_RUNNING;) {
+        if (it->pid >= 0) {
+            ++it;
+        } else if (job_start(*it)) {
+            ++running;
+            ++it;
+        } else {
+            Job job = std::move(*it);
+            it = jobs.erase(it);
+
+            if (!v3_send_job_finished_event(fd, job)) {
+                return false;
+            }
+        }
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto &job : jobs) {
+        if (job.pid >= 0 && now - job.last_report >= JOB_PROGRESS_INTERVAL
+                && !v3_send_job_progress_event(fd, job, now)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//! Milliseconds until the next progress report is due or -1 if none are
+static int jobs_poll_timeout()
+{
+    auto now = std::chrono::steady_clock::now();
+    int timeout = -1;
+
+    for (auto const &job : jobs) {
+        if (job.pid < 0) {
+            continue;
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                job.last_report + JOB_PROGRESS_INTERVAL - now).count();
+        auto ms = static_cast<int>(std::max<decltype(remaining)>(remaining, 0));
+
+        if (timeout < 0 || ms < timeout) {
+            timeout = ms;
+        }
+    }
+
+    return timeout;
+}
+
+/*!
+ * \brief Stop the jobs of a connection that is being closed
+ *
+ * Interruptible jobs are killed. The others are allowed to finish so that ROMs
+ * are not left in an inconsistent state.
+ */
+static void jobs_stop()
+{
+    for (auto &job : jobs) {
+        if (job.pid < 0) {
+            continue;
+        }
+
+        if (job.type->interruptible) {
+            kill(job.pid, SIGKILL);
+        }
+
+        // The response is no longer needed
+        close(job.pipe_fd);
+
+        while (waitpid(job.pid, nullptr, 0) < 0 && errno == EINTR);
+    }
+
+    jobs.clear();
+}
+
+/*!
+ * \brief Wait until the next request can be read
+ *
+ * While the client is watching for ROM changes or has jobs, this sends the
+ * corresponding events until the socket becomes readable. Data that has
+ * already been read is handled first.
+ *
+ * \return False if a connection error occurred
+ */
+static bool v3_wait_for_request(int fd, util::FramedSocket &socket)
+{
+    std::vector<struct pollfd> fds;
+
+    while (true) {
+        if (!jobs_update(fd)) {
+            return false;
+        }
+
+        if (socket.buffered() > 0 || (!watching_roms && jobs.empty())) {
+            return true;
+        }
+
+        fds.clear();
+        fds.push_back({ fd, POLLIN, 0 });
+        fds.push_back({ watching_roms ? rom_inventory.inotify_fd : -1,
+                        POLLIN, 0 });
+        for (auto const &job : jobs) {
+            if (job.pid >= 0) {
+                fds.push_back({ job.pipe_fd, POLLIN, 0 });
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), jobs_poll_timeout()) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("Failed to poll connection: %s", strerror(errno));
+            return false;
+        }
+
+        if ((fds[1].revents & POLLIN) && rom_inventory_poll()
+                && !v3_send_roms_changed_event(fd)) {
+            return false;
+        }
+
+        for (size_t i = 2; i < fds.size(); ++i) {
+            if (fds[i].revents && !job_read(fd, fds[i].fd)) {
+                return false;
+            }
+        }
+
+        if (fds[0].revents) {
+            return true;
+        }
+    }
+}
+
 bool connection_version_3(int fd)
 {
     std::string command;
@@ -1465,36 +2602,72 @@ bool connection_version_3(int fd)
         fd_map.clear();
     });
 
+    // Requests are received into a buffer that is reused for the whole
+    // connection. Handlers only write to fd, so the read-ahead done by
+    // FramedSocket is never observed by them.
+    util::FramedSocket socket(fd);
+
+    // Statistics for this connection, which are logged when it is closed
+    auto connection_stats = std::make_unique<RequestStats>();
+
+    auto log_stats = finally([&] {
+        log_request_stats(*connection_stats);
+    });
+
+    watching_roms = false;
+
+    auto stop_jobs = finally([&] {
+        jobs_stop();
+    });
+
     while (1) {
-        auto data = util::socket_read_bytes(fd);
+        if (!v3_wait_for_request(fd, socket)) {
+            return false;
+        }
+
+        auto data = socket.receive();
         if (!data) {
             LOGE("Failed to read request: %s",  data.error().message().c_str());
             return false;
         }
 
-        auto verifier = fb::Verifier(data.value().data(), data.value().size());
+        auto verifier = fb::Verifier(data.value().data, data.value().size);
         if (!v3::VerifyRequestBuffer(verifier)) {
             LOGE("Received invalid buffer");
             return false;
         }
 
-        const v3::Request *request = v3::GetRequest(data.value().data());
+        current_frame = data.value();
+
+        const v3::Request *request = v3::GetRequest(data.value().data);
         v3::RequestType type = request->request_type();
-        request_handler_fn fn = nullptr;
+        request_handler_fn fn = find_request_handler(type);
 
-        for (auto iter = request_map; iter->fn; ++iter) {
-            if (type == iter->type) {
-                fn = iter->fn;
-                break;
-            }
-        }
+        current_request_id = request->id();
+
+        auto start = std::chrono::steady_clock::now();
+        auto sent_before = bytes_sent;
 
         // NOTE: A false return value indicates a connection error, not a
         //       command failure!
         bool ret = true;
 
         if (fn) {
-            ret = fn(fd, request);
+            {
+                util::ATraceSection section(v3::EnumNameRequestType(type));
+                ret = fn(fd, request);
+            }
+
+            auto latency_us = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start).count());
+
+            record_request(*connection_stats, type, latency_us,
+                           data.value().size, bytes_sent - sent_before);
+            if (daemon_stats) {
+                record_request(*daemon_stats, type, latency_us,
+                               data.value().size, bytes_sent - sent_before);
+            }
         } else {
             // Invalid command; allow further commands
             ret = v3_send_response_unsupported(fd);
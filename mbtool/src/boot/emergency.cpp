@@ -153,6 +153,9 @@ bool emergency_reboot()
 
     LOGW("--- EMERGENCY REBOOT FROM MBTOOL ---");
 
+    // Make sure queued log messages reach the kernel log before it is dumped
+    log::flush();
+
     std::vector<EmergencyMount> ems;
     Device device;
     JsonError error;
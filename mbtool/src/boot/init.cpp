@@ -21,9 +21,10 @@
 
 #include <algorithm>
 #include <memory>
-#include <unordered_set>
+#include <vector>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdlib>
 #include <cstring>
 
@@ -46,15 +47,18 @@
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
 #include "mbdevice/json.h"
+#include "mblog/async_logger.h"
 #include "mblog/kmsg_logger.h"
 #include "mblog/logging.h"
 #include "mbutil/chown.h"
 #include "mbutil/cmdline.h"
 #include "mbutil/command.h"
+#include "mbutil/copy.h"
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fstab.h"
+#include "mbutil/hash.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
@@ -66,6 +70,7 @@
 #include "boot/mount_fstab.h"
 #include "boot/property_service.h"
 #include "boot/uevent_thread.h"
+#include "util/boot_trace.h"
 #include "util/multiboot.h"
 #include "util/romconfig.h"
 #include "util/sepolpatch.h"
@@ -79,6 +84,8 @@
 #error Unknown PCRE path for architecture
 #endif
 
+#define EXTRACT_BUF_SIZE        (1024 * 1024)
+
 #define LOG_TAG "mbtool/boot/init"
 
 using namespace mb::device;
@@ -414,94 +421,222 @@ static bool fix_binary_file_contexts(const char *path)
     return replace_file(path, new_path.c_str());
 }
 
-static bool is_completely_whitespace(const char *str)
+/*!
+ * \brief Remove cache entries starting with \p prefix, except for \p keep
+ */
+static void remove_stale_cache_entries(const std::string &cache_dir,
+                                       std::string_view prefix,
+                                       const std::string &keep)
 {
-    while (*str) {
-        if (!isspace(*str)) {
-            return false;
+    std::unique_ptr<DIR, decltype(closedir) *> dp(
+            opendir(cache_dir.c_str()), closedir);
+    if (!dp) {
+        return;
+    }
+
+    struct dirent *ent;
+
+    while ((ent = readdir(dp.get()))) {
+        if (starts_with(ent->d_name, prefix) && ent->d_name != keep) {
+            std::string path(cache_dir);
+            path += "/";
+            path += ent->d_name;
+
+            LOGV("%s: Removing stale cache entry", path.c_str());
+            unlink(path.c_str());
         }
-        ++str;
     }
-    return true;
 }
 
-static bool add_mbtool_services(bool enable_appsync)
+/*!
+ * \brief Patch a file_contexts file, reusing the output from a previous boot
+ *        if the inputs are unchanged
+ *
+ * The cache entry is keyed on the hashes of \p path and \p deps as well as the
+ * mbtool version. On a cache hit, the cached output replaces \p path without
+ * running \p fix.
+ *
+ * \param path Path to file_contexts file
+ * \param name Cache entry name prefix
+ * \param deps Other files that affect the output (eg. the PCRE library)
+ * \param fix Function for patching the file in place
+ *
+ * \return Whether the file was patched
+ */
+static bool fix_file_contexts_cached(const char *path, const char *name,
+                                     const std::vector<std::string> &deps,
+                                     bool (*fix)(const char *))
 {
-    ScopedFILE fp_old(fopen("/init.rc", "rbe"), fclose);
-    if (!fp_old) {
-        if (errno == ENOENT) {
-            return true;
+    std::string key;
+
+    std::vector<std::string> inputs{path};
+    inputs.insert(inputs.end(), deps.begin(), deps.end());
+
+    for (auto const &input : inputs) {
+        auto digest = util::sha512_hash(input);
+        if (!digest) {
+            LOGW("%s: Failed to compute hash: %s",
+                 input.c_str(), digest.error().message().c_str());
+            return fix(path);
+        }
+
+        key.append(reinterpret_cast<const char *>(digest.value().data()),
+                   digest.value().size());
+    }
+
+    key += git_version();
+
+    util::Sha512Digest key_digest;
+    SHA512(reinterpret_cast<const unsigned char *>(key.data()), key.size(),
+           key_digest.data());
+
+    std::string prefix(name);
+    prefix += ".";
+
+    std::string cache_name = prefix + util::hex_string(
+            key_digest.data(), key_digest.size());
+    std::string cache_path(FILE_CONTEXTS_CACHE_DIR);
+    cache_path += "/";
+    cache_path += cache_name;
+
+    std::string new_path(path);
+    new_path += ".cached";
+
+    if (access(cache_path.c_str(), R_OK) == 0) {
+        if (auto r = util::copy_file(cache_path, new_path, {}); !r) {
+            LOGW("%s", r.error().message().c_str());
+            unlink(new_path.c_str());
+        } else if (!replace_file(path, new_path.c_str())) {
+            unlink(new_path.c_str());
         } else {
-            LOGE("Failed to open /init.rc: %s", strerror(errno));
-            return false;
+            LOGV("%s: Using cached patched file: %s", path, cache_path.c_str());
+            return true;
         }
     }
 
-    ScopedFILE fp_new(fopen("/init.rc.new", "wbe"), fclose);
-    if (!fp_new) {
-        LOGE("Failed to open /init.rc.new for writing: %s",
-             strerror(errno));
+    if (!fix(path)) {
         return false;
     }
 
-    char *line = nullptr;
-    size_t len = 0;
-    ssize_t read = 0;
+    if (auto r = util::mkdir_recursive(FILE_CONTEXTS_CACHE_DIR, 0700);
+            !r && r.error() != std::errc::file_exists) {
+        LOGW("%s: Failed to create directory: %s",
+             FILE_CONTEXTS_CACHE_DIR, r.error().message().c_str());
+        return true;
+    }
 
-    auto free_line = finally([&]{
-        free(line);
+    remove_stale_cache_entries(FILE_CONTEXTS_CACHE_DIR, prefix, cache_name);
+
+    // Copy to a temporary file first so that an interrupted boot never leaves
+    // behind a truncated cache entry
+    std::string temp_path = cache_path + ".tmp";
+
+    if (auto r = util::copy_file(path, temp_path, {}); !r) {
+        LOGW("%s", r.error().message().c_str());
+        unlink(temp_path.c_str());
+    } else if (rename(temp_path.c_str(), cache_path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             cache_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+
+    return true;
+}
+
+static bool is_completely_whitespace(std::string_view str)
+{
+    return std::all_of(str.begin(), str.end(), [](char c) {
+        return isspace(static_cast<unsigned char>(c));
     });
+}
 
-    bool has_init_multiboot_rc = false;
-    bool has_disabled_installd = false;
+// Whether installd's service definition already has the "disabled" option
+static bool has_disabled_installd(std::string_view data)
+{
     bool inside_service = false;
 
-    while ((read = getline(&line, &len, fp_old.get())) >= 0) {
-        if (strstr(line, "import /init.multiboot.rc")) {
-            has_init_multiboot_rc = true;
-        }
+    while (!data.empty()) {
+        auto pos = data.find('\n');
+        auto line = data.substr(0, pos);
+        data.remove_prefix(pos == std::string_view::npos ? data.size() : pos + 1);
 
-        if (enable_appsync) {
-            if (starts_with(line, "service")) {
-                inside_service = strstr(line, "installd") != nullptr;
-            } else if (inside_service && is_completely_whitespace(line)) {
-                inside_service = false;
-            }
+        if (starts_with(line, "service")) {
+            inside_service = line.find("installd") != std::string_view::npos;
+        } else if (inside_service && is_completely_whitespace(line)) {
+            inside_service = false;
+        }
 
-            if (inside_service && strstr(line, "disabled")) {
-                has_disabled_installd = true;
-            }
+        if (inside_service && line.find("disabled") != std::string_view::npos) {
+            return true;
         }
     }
 
-    rewind(fp_old.get());
+    return false;
+}
+
+// Whether the line manually mounts /system, /cache, or /data
+static bool is_manual_mount(std::string_view line)
+{
+    if (line.find("mount") == std::string_view::npos
+            || (line.find("/system") == std::string_view::npos
+            && line.find("/cache") == std::string_view::npos
+            && line.find("/data") == std::string_view::npos)) {
+        return false;
+    }
+
+    std::vector<std::string> tokens =
+            util::tokenize(std::string(line), " \t\n");
+    return tokens.size() >= 4 && tokens[0] == "mount"
+            && (tokens[3] == "/system"
+            || tokens[3] == "/cache"
+            || tokens[3] == "/data");
+}
 
-    while ((read = getline(&line, &len, fp_old.get())) >= 0) {
-        // Load /init.multiboot.rc
-        if (!has_init_multiboot_rc && line[0] != '#') {
-            has_init_multiboot_rc = true;
-            fputs("import /init.multiboot.rc\n", fp_new.get());
+/*!
+ * \brief Apply all rc file modifications in one pass
+ *
+ * - All files: manual mounts of /system, /cache, and /data are commented out
+ * - /init.rc: /init.multiboot.rc is imported and, if appsync is enabled,
+ *   installd is disabled. mbtool's appsync will spawn it on demand.
+ */
+static std::string rewrite_rc(std::string_view data, bool is_init_rc,
+                              bool enable_appsync)
+{
+    bool need_import = is_init_rc
+            && data.find("import /init.multiboot.rc") == std::string_view::npos;
+    bool need_disable_installd = is_init_rc && enable_appsync
+            && !has_disabled_installd(data);
+
+    std::string output;
+    output.reserve(data.size() + 64);
+
+    while (!data.empty()) {
+        auto pos = data.find('\n');
+        auto line = data.substr(
+                0, pos == std::string_view::npos ? data.size() : pos + 1);
+        data.remove_prefix(line.size());
+
+        if (need_import && line[0] != '#') {
+            need_import = false;
+            output += "import /init.multiboot.rc\n";
         }
 
-        if (fwrite(line, 1, static_cast<size_t>(read), fp_new.get())
-                != static_cast<size_t>(read)) {
-            LOGE("Failed to write to /init.rc.new: %s", strerror(errno));
-            return false;
+        if (is_manual_mount(line)) {
+            output += '#';
         }
+        output += line;
 
-        // Disable installd. mbtool's appsync will spawn it on demand
-        if (enable_appsync
-                && !has_disabled_installd
-                && starts_with(line, "service")
-                && strstr(line, "installd")) {
-            fputs("    disabled\n", fp_new.get());
+        if (need_disable_installd && starts_with(line, "service")
+                && line.find("installd") != std::string_view::npos) {
+            output += "    disabled\n";
         }
     }
 
-    if (!replace_file("/init.rc", "/init.rc.new")) {
-        return false;
-    }
+    return output;
+}
 
+static bool write_init_multiboot_rc(bool enable_appsync)
+{
     // Create /init.multiboot.rc
     ScopedFILE fp_multiboot(fopen("/init.multiboot.rc", "wbe"), fclose);
     if (!fp_multiboot) {
@@ -540,112 +675,96 @@ static bool add_mbtool_services(bool enable_appsync)
     return true;
 }
 
-static bool write_fstab_hack(const char *fstab)
-{
-    ScopedFILE fp_fstab(fopen(fstab, "abe"), fclose);
-    if (!fp_fstab) {
-        LOGE("%s: Failed to open for writing: %s",
-             fstab, strerror(errno));
-        return false;
-    }
-
-    fputs(R"EOF(
-# The following is added to prevent vold in Android 7.0 from segfaulting due to
-# dereferencing a null pointer when checking if the /data fstab entry has the
-# "forcefdeorfbe" vold option. (See cryptfs_isConvertibleToFBE() in
-# system/vold/cryptfs.c.)
-
-/dev/null /data auto defaults voldmanaged=dummy:auto
-)EOF", fp_fstab.get());
-
-    return true;
-}
-
-static bool strip_manual_mounts()
+/*!
+ * \brief Rewrite the ramdisk's rc files and add mbtool's services
+ *
+ * Each rc file in the root directory is read once and only written back if
+ * rewrite_rc() changed it.
+ */
+static bool rewrite_rc_files(bool enable_appsync)
 {
-    ScopedDIR dir(opendir("/"), closedir);
-    if (!dir) {
-        return true;
-    }
+    std::vector<std::string> paths;
+    bool has_init_rc = false;
 
-    struct dirent *ent;
-    while ((ent = readdir(dir.get()))) {
-        // Look for *.rc files
-        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0
-                || !ends_with(ent->d_name, ".rc")) {
-            continue;
+    {
+        ScopedDIR dir(opendir("/"), closedir);
+        if (!dir) {
+            return true;
         }
 
-        std::string path("/");
-        path += ent->d_name;
+        struct dirent *ent;
+        while ((ent = readdir(dir.get()))) {
+            // Look for *.rc files
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0
+                    || !ends_with(ent->d_name, ".rc")
+                    || strcmp(ent->d_name, "init.multiboot.rc") == 0) {
+                continue;
+            }
 
-        ScopedFILE fp(fopen(path.c_str(), "re"), fclose);
-        if (!fp) {
-            LOGE("Failed to open %s for reading: %s",
-                 path.c_str(), strerror(errno));
-            continue;
+            paths.push_back(std::string("/") + ent->d_name);
+            has_init_rc |= paths.back() == "/init.rc";
         }
+    }
 
-        char *line = nullptr;
-        size_t len = 0;
-        ssize_t read = 0;
-
-        auto free_line = finally([&]{
-            free(line);
-        });
-
-        std::size_t count = 0;
-        std::unordered_set<std::size_t> comment_out;
-
-        // Find out which lines need to be commented out
-        while ((read = getline(&line, &len, fp.get())) >= 0) {
-            if (strstr(line, "mount")
-                    && (strstr(line, "/system")
-                    || strstr(line, "/cache")
-                    || strstr(line, "/data"))) {
-                std::vector<std::string> tokens = util::tokenize(line, " \t\n");
-                if (tokens.size() >= 4 && tokens[0] == "mount"
-                        && (tokens[3] == "/system"
-                        || tokens[3] == "/cache"
-                        || tokens[3] == "/data")) {
-                    comment_out.insert(count);
-                }
-            }
+    bool ret = true;
 
-            ++count;
+    for (auto const &path : paths) {
+        auto data = util::file_read_all(path);
+        if (!data) {
+            LOGE("%s: Failed to read file: %s",
+                 path.c_str(), data.error().message().c_str());
+            ret = ret && path != "/init.rc";
+            continue;
         }
 
-        if (comment_out.empty()) {
+        std::string output = rewrite_rc(data.value(), path == "/init.rc",
+                                        enable_appsync);
+        if (output == data.value()) {
             continue;
         }
 
-        // Go back to beginning of file for reread
-        rewind(fp.get());
-        count = 0;
-
         std::string new_path(path);
         new_path += ".new";
 
-        ScopedFILE fp_new(fopen(new_path.c_str(), "we"), fclose);
-        if (!fp_new) {
-            LOGE("Failed to open %s for writing: %s",
-                 new_path.c_str(), strerror(errno));
+        if (auto r = util::file_write_data(new_path, output.data(),
+                                           output.size()); !r) {
+            LOGE("%s: Failed to write file: %s",
+                 new_path.c_str(), r.error().message().c_str());
+            ret = ret && path != "/init.rc";
             continue;
         }
 
-        // Actually comment out the lines
-        while ((read = getline(&line, &len, fp.get())) >= 0) {
-            if (comment_out.find(count) != comment_out.end()) {
-                fputs("#", fp_new.get());
-            }
-            fputs(line, fp_new.get());
-
-            ++count;
+        if (!replace_file(path.c_str(), new_path.c_str())
+                && path == "/init.rc") {
+            ret = false;
         }
+    }
+
+    if (!ret || !has_init_rc) {
+        return ret;
+    }
+
+    return write_init_multiboot_rc(enable_appsync);
+}
 
-        replace_file(path.c_str(), new_path.c_str());
+static bool write_fstab_hack(const char *fstab)
+{
+    ScopedFILE fp_fstab(fopen(fstab, "abe"), fclose);
+    if (!fp_fstab) {
+        LOGE("%s: Failed to open for writing: %s",
+             fstab, strerror(errno));
+        return false;
     }
 
+    fputs(R"EOF(
+# The following is added to prevent vold in Android 7.0 from segfaulting due to
+# dereferencing a null pointer when checking if the /data fstab entry has the
+# "forcefdeorfbe" vold option. (See cryptfs_isConvertibleToFBE() in
+# system/vold/cryptfs.c.)
+
+/dev/null /data auto defaults voldmanaged=dummy:auto
+)EOF", fp_fstab.get());
+
     return true;
 }
 
@@ -943,6 +1062,12 @@ static bool extract_zip(const char *source, const char *target)
         return false;
     }
 
+    mz_zip_file *file_info;
+    if (mz_zip_entry_get_info(handle, &file_info) != MZ_OK) {
+        LOGE("%s: Failed to get metadata for 'exec'", source);
+        return false;
+    }
+
     if (mz_zip_entry_read_open(handle, 0, nullptr) != MZ_OK) {
         LOGE("%s: Failed to open file in zip", source);
         return false;
@@ -957,36 +1082,65 @@ static bool extract_zip(const char *source, const char *target)
 
     (void) util::mkdir_recursive(target, 0755);
 
-    FILE *fp = fopen(target_file.c_str(), "wbe");
-    if (!fp) {
+    int fd = open(target_file.c_str(),
+                  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
         LOGE("%s: Failed to open for writing: %s",
              target_file.c_str(), strerror(errno));
         return false;
     }
 
-    auto close_fp = finally([&] {
-        fclose(fp);
+    auto close_fd = finally([&] {
+        close(fd);
     });
 
-    char buf[UINT16_MAX];
+    auto size = static_cast<uint64_t>(file_info->uncompressed_size);
+
+    // Allocate the whole file up front instead of growing it with every write
+    if (size > 0 && fallocate(fd, 0, 0, static_cast<off_t>(size)) < 0
+            && errno != EOPNOTSUPP && errno != ENOSYS) {
+        LOGW("%s: Failed to preallocate %" PRIu64 " bytes: %s",
+             target_file.c_str(), size, strerror(errno));
+    }
+
+    // Large enough that the boot UI binary only takes a few iterations
+    std::vector<char> buf(EXTRACT_BUF_SIZE);
+    uint64_t total = 0;
     int bytes_read;
 
-    while ((bytes_read = mz_zip_entry_read(handle, buf, sizeof(buf))) > 0) {
-        size_t bytes_written = fwrite(buf, 1, static_cast<size_t>(bytes_read),
-                                      fp);
-        if (bytes_written == 0) {
-            LOGE("%s: Truncated write", target);
-            return false;
+    while ((bytes_read = mz_zip_entry_read(
+            handle, buf.data(), static_cast<int32_t>(buf.size()))) > 0) {
+        size_t written = 0;
+
+        while (written < static_cast<size_t>(bytes_read)) {
+            ssize_t n = write(fd, buf.data() + written,
+                              static_cast<size_t>(bytes_read) - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n <= 0) {
+                LOGE("%s: Truncated write: %s",
+                     target_file.c_str(), strerror(errno));
+                return false;
+            }
+            written += static_cast<size_t>(n);
         }
+
+        total += written;
     }
     if (bytes_read != 0) {
         LOGE("%s: Failed before reaching inner file's EOF", source);
         return false;
     }
 
-    close_fp.dismiss();
+    if (total != size) {
+        LOGE("%s: Extracted %" PRIu64 " bytes, but expected %" PRIu64,
+             target_file.c_str(), total, size);
+        return false;
+    }
+
+    close_fd.dismiss();
 
-    if (fclose(fp) < 0) {
+    if (close(fd) < 0) {
         LOGE("%s: Error when closing file: %s",
              target_file.c_str(), strerror(errno));
         return false;
@@ -1031,13 +1185,20 @@ static bool launch_boot_menu()
 
     // Verify boot UI signature
     SigVerifyResult result;
-    result = verify_signature(BOOT_UI_ZIP_PATH, BOOT_UI_ZIP_PATH ".sig");
+    {
+        TraceSpan span("verify_signature");
+        result = verify_signature(BOOT_UI_ZIP_PATH, BOOT_UI_ZIP_PATH ".sig");
+    }
     if (result != SigVerifyResult::Valid) {
         LOGE("%s: Invalid signature", BOOT_UI_ZIP_PATH);
         return false;
     }
 
-    if (!extract_zip(BOOT_UI_ZIP_PATH, BOOT_UI_PATH)) {
+    trace_begin("extract_zip");
+    bool extracted = extract_zip(BOOT_UI_ZIP_PATH, BOOT_UI_PATH);
+    trace_end("extract_zip");
+
+    if (!extracted) {
         LOGE("%s: Failed to extract zip", BOOT_UI_ZIP_PATH);
         return false;
     }
@@ -1057,7 +1218,9 @@ static bool launch_boot_menu()
     start_daemon();
 
     std::vector<std::string> argv{ BOOT_UI_EXEC_PATH, BOOT_UI_ZIP_PATH };
+    trace_begin("boot_ui");
     int ret = util::run_command(argv[0], argv, {}, {}, {});
+    trace_end("boot_ui");
     if (ret < 0) {
         LOGE("%s: Failed to execute: %s", BOOT_UI_EXEC_PATH, strerror(errno));
     } else if (WIFEXITED(ret)) {
@@ -1098,6 +1261,7 @@ static void redirect_stdio_null()
 
 static bool critical_failure()
 {
+    trace_write(BOOT_TRACE_PATH);
     return emergency_reboot();
 }
 
@@ -1132,6 +1296,8 @@ int init_main(int argc, char *argv[])
         }
     }
 
+    trace_begin("init");
+
     // Mount base directories
     mkdir("/dev", 0755);
     mkdir("/proc", 0755);
@@ -1155,7 +1321,8 @@ int init_main(int argc, char *argv[])
     redirect_stdio_null();
 
     // Log to kmsg
-    log::set_logger(std::make_shared<log::KmsgLogger>(true));
+    log::set_logger(std::make_shared<log::AsyncLogger>(
+            std::make_shared<log::KmsgLogger>(true)));
     if (klogctl(KLOG_CONSOLE_LEVEL, nullptr, 7) < 0) {
         LOGE("Failed to set loglevel: %s", strerror(errno));
     }
@@ -1173,13 +1340,19 @@ int init_main(int argc, char *argv[])
 
     // Start probing for devices so we have somewhere to write logs for
     // critical_failure()
+    trace_begin("uevent_thread_start");
     UeventThread uevent_thread;
     uevent_thread.start();
+    trace_end("uevent_thread_start");
 
     Device device;
     JsonError error;
 
-    if (!device_from_json(contents.value(), device, error)) {
+    trace_begin("device_from_json");
+    bool device_loaded = device_from_json(contents.value(), device, error);
+    trace_end("device_from_json");
+
+    if (!device_loaded) {
         LOGE("%s: Failed to load device definition", DEVICE_JSON_PATH);
         critical_failure();
         return EXIT_FAILURE;
@@ -1195,7 +1368,9 @@ int init_main(int argc, char *argv[])
     add_props_to_dbp_prop();
 
     // initialize properties
+    trace_begin("properties_setup");
     properties_setup();
+    trace_end("properties_setup");
 
     std::string fstab(find_fstab());
 
@@ -1226,8 +1401,12 @@ int init_main(int argc, char *argv[])
             | MountFlag::MountCache
             | MountFlag::MountData
             | MountFlag::MountExternalSd;
-    if (!mount_fstab(fstab.c_str(), rom, device, flags,
-                     uevent_thread.device_handler())) {
+    trace_begin("mount_fstab");
+    bool fstab_mounted =
+            mount_fstab(fstab.c_str(), rom, device, flags, uevent_thread);
+    trace_end("mount_fstab");
+
+    if (!fstab_mounted) {
         LOGE("Failed to mount fstab");
         critical_failure();
         return EXIT_FAILURE;
@@ -1235,19 +1414,28 @@ int init_main(int argc, char *argv[])
 
     LOGV("Successfully mounted fstab");
 
+    trace_begin("launch_boot_menu");
     if (!launch_boot_menu()) {
         LOGE("Failed to run boot menu");
         // Continue anyway since boot menu might not run on every device
     }
+    trace_end("launch_boot_menu");
 
     // Mount selinuxfs
     selinux_mount();
     // Load pre-boot policy
-    patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE, util::SELINUX_LOAD_FILE,
-                   SELinuxPatch::PreBoot);
+    trace_begin("patch_sepolicy_preboot");
+    patch_sepolicy_cached(util::SELINUX_DEFAULT_POLICY_FILE,
+                          util::SELINUX_LOAD_FILE, SELinuxPatch::PreBoot,
+                          SEPOLICY_CACHE_DIR);
+    trace_end("patch_sepolicy_preboot");
 
     // Mount ROM (bind mount directory or mount images, etc.)
-    if (!mount_rom(rom)) {
+    trace_begin("mount_rom");
+    bool rom_mounted = mount_rom(rom);
+    trace_end("mount_rom");
+
+    if (!rom_mounted) {
         LOGE("Failed to mount ROM directories and images");
         critical_failure();
         return EXIT_FAILURE;
@@ -1263,15 +1451,21 @@ int init_main(int argc, char *argv[])
     LOGD("Enable appsync: %d", config.indiv_app_sharing);
 
     // Make runtime ramdisk modifications
+    trace_begin("fix_file_contexts");
     if (access(FILE_CONTEXTS, R_OK) == 0) {
-        fix_file_contexts(FILE_CONTEXTS);
+        fix_file_contexts_cached(FILE_CONTEXTS, "file_contexts", {},
+                                 &fix_file_contexts);
     }
     if (access(FILE_CONTEXTS_BIN, R_OK) == 0) {
-        fix_binary_file_contexts(FILE_CONTEXTS_BIN);
+        // The compiled regexes depend on the ROM's PCRE library
+        fix_file_contexts_cached(FILE_CONTEXTS_BIN, "file_contexts.bin",
+                                 {PCRE_PATH}, &fix_binary_file_contexts);
     }
+    trace_end("fix_file_contexts");
     write_fstab_hack(fstab.c_str());
-    add_mbtool_services(config.indiv_app_sharing);
-    strip_manual_mounts();
+    trace_begin("rewrite_rc_files");
+    rewrite_rc_files(config.indiv_app_sharing);
+    trace_end("rewrite_rc_files");
 
     // Disable installd on Android 7.0+
     if (config.indiv_app_sharing) {
@@ -1287,9 +1481,14 @@ int init_main(int argc, char *argv[])
     // Patch SELinux policy
     struct stat sb;
     if (stat(util::SELINUX_DEFAULT_POLICY_FILE, &sb) == 0) {
-        if (!patch_sepolicy(util::SELINUX_DEFAULT_POLICY_FILE,
-                            util::SELINUX_DEFAULT_POLICY_FILE,
-                            SELinuxPatch::Main)) {
+        trace_begin("patch_sepolicy_main");
+        bool patched = patch_sepolicy_cached(util::SELINUX_DEFAULT_POLICY_FILE,
+                                             util::SELINUX_DEFAULT_POLICY_FILE,
+                                             SELinuxPatch::Main,
+                                             SEPOLICY_CACHE_DIR);
+        trace_end("patch_sepolicy_main");
+
+        if (!patched) {
             LOGW("%s: Failed to patch policy",
                  util::SELINUX_DEFAULT_POLICY_FILE);
             critical_failure();
@@ -1303,6 +1502,10 @@ int init_main(int argc, char *argv[])
     // Kill properties service and clean up
     properties_cleanup();
 
+    // Write the boot timeline while the data partition is still mounted
+    trace_end("init");
+    trace_write(BOOT_TRACE_PATH);
+
     // Hack to work around issue where Magisk unconditionally unmounts /system
     // https://github.com/topjohnwu/Magisk/pull/387
     if (util::file_find_one_of("/init.orig", {"MagiskPolicy v16"})) {
@@ -1328,6 +1531,7 @@ int init_main(int argc, char *argv[])
 
     // Start real init
     LOGD("Launching real init ...");
+    log::flush();
     execlp("/init", "/init", nullptr);
     LOGE("Failed to exec real init: %s", strerror(errno));
     critical_failure();
@@ -195,11 +195,11 @@ std::vector<std::string> DeviceHandler::GetBlockDeviceSymlinks(const Uevent& uev
     };
 
     // Legacy /dev/block/bootdevice support
-    if (!boot_device_) {
+    std::call_once(boot_device_once_, [&] {
         boot_device_ = GetBootDevice();
-    }
-    if (!boot_device_->empty()
-            && device.find(*boot_device_) != std::string::npos) {
+    });
+    if (!boot_device_.empty()
+            && device.find(boot_device_) != std::string::npos) {
         LOGE("Boot device is %s", device.c_str());
         link_paths.emplace_back("/dev/block/bootdevice");
     }
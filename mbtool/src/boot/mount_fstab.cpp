@@ -21,6 +21,9 @@
 
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <thread>
 
 #include <cerrno>
@@ -48,6 +51,7 @@
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fstab.h"
+#include "mbutil/loopdev.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
@@ -56,6 +60,8 @@
 
 #include "boot/init/devices.h"
 #include "boot/reboot.h"
+#include "boot/uevent_thread.h"
+#include "util/boot_trace.h"
 #include "util/multiboot.h"
 #include "util/roms.h"
 #include "util/sepolpatch.h"
@@ -76,22 +82,151 @@
 #define FSCK_WRAPPER                "/sbin/fsck-wrapper"
 #define FSCK_WRAPPER_SIG            "/sbin/fsck-wrapper.sig"
 
+// Maximum time to wait for each partition's block device to appear
+#define SYSTEM_MOUNT_TIMEOUT        std::chrono::seconds(20)
+#define CACHE_MOUNT_TIMEOUT         std::chrono::seconds(20)
+#define DATA_MOUNT_TIMEOUT          std::chrono::seconds(20)
+#define EXTSD_MOUNT_TIMEOUT         std::chrono::seconds(10)
+
 
 using namespace mb::device;
 
 namespace mb
 {
 
+enum class MountStepState
+{
+    Pending,
+    Running,
+    Succeeded,
+    Failed,
+    Skipped,
+};
+
+/*!
+ * \brief Mount operation that may run concurrently with other steps
+ */
+struct MountStep
+{
+    // Name used for logging
+    std::string name;
+    // Indexes of earlier steps that must succeed before this step can run
+    std::vector<size_t> deps;
+    // Mount function
+    std::function<bool()> func;
+};
+
+/*!
+ * \brief Run mount steps concurrently while respecting their dependencies
+ *
+ * Each step runs on its own thread as soon as all of its dependencies have
+ * succeeded. If a dependency fails or is skipped, then the step is skipped as
+ * well. Dependencies can only refer to earlier steps, so there are no cycles.
+ *
+ * \param steps List of mount steps
+ *
+ * \return State of each step in the same order as \p steps. Every state is
+ *         either MountStepState::Succeeded, MountStepState::Failed, or
+ *         MountStepState::Skipped.
+ */
+static std::vector<MountStepState>
+run_mount_steps(const std::vector<MountStep> &steps)
+{
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<MountStepState> states(steps.size(), MountStepState::Pending);
+
+    auto is_finished = [&](size_t i) {
+        return states[i] == MountStepState::Succeeded
+                || states[i] == MountStepState::Failed
+                || states[i] == MountStepState::Skipped;
+    };
+
+    auto run_step = [&](size_t i) {
+        auto const &step = steps[i];
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            cv.wait(lock, [&] {
+                return std::all_of(step.deps.begin(), step.deps.end(),
+                                   is_finished);
+            });
+
+            for (size_t dep : step.deps) {
+                if (states[dep] != MountStepState::Succeeded) {
+                    LOGW("%s: Skipping because %s did not succeed",
+                         step.name.c_str(), steps[dep].name.c_str());
+                    states[i] = MountStepState::Skipped;
+                    cv.notify_all();
+                    return;
+                }
+            }
+
+            states[i] = MountStepState::Running;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        trace_begin(step.name.c_str());
+        bool ret = step.func();
+        trace_end(step.name.c_str());
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+
+        LOGD("%s: %s after %lld ms", step.name.c_str(),
+             ret ? "Succeeded" : "Failed",
+             static_cast<long long>(duration.count()));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            states[i] = ret ? MountStepState::Succeeded
+                    : MountStepState::Failed;
+        }
+
+        cv.notify_all();
+    };
+
+    for (size_t i = 0; i < steps.size(); ++i) {
+        for (size_t dep : steps[i].deps) {
+            if (dep >= i) {
+                LOGE("%s: Invalid dependency on step %zu",
+                     steps[i].name.c_str(), dep);
+                states[i] = MountStepState::Skipped;
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(steps.size());
+
+    for (size_t i = 0; i < steps.size(); ++i) {
+        if (states[i] == MountStepState::Pending) {
+            threads.emplace_back(run_step, i);
+        }
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    return states;
+}
+
 /*!
  * \brief Try mounting each entry in a list of fstab entry until one works.
  *
+ * \param uevent_thread Uevent thread that creates the block devices
  * \param recs List of fstab entries for the given mount point
  * \param mount_point Target mount point
+ * \param timeout Maximum total time to wait for the block devices of entries
+ *                with the `wait` flag
  *
  * \return Whether some fstab entry was successfully mounted at the mount point
  */
-static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
-                                 const char *mount_point, mode_t perms)
+static bool create_dir_and_mount(const UeventThread &uevent_thread,
+                                 const std::vector<util::FstabRec> &recs,
+                                 const char *mount_point, mode_t perms,
+                                 std::chrono::milliseconds timeout)
 {
     if (recs.empty()) {
         return false;
@@ -111,6 +246,8 @@ static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
         }
     }
 
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
     // Try mounting each until we find one that works
     for (const util::FstabRec &rec : recs) {
         LOGD("Attempting to mount(%s, %s, %s, %lu, %s)",
@@ -119,9 +256,15 @@ static bool create_dir_and_mount(const std::vector<util::FstabRec> &recs,
 
         // Wait for block device if requested
         if (rec.fs_mgr_flags & util::MF_WAIT) {
-            LOGD("%s: Waiting up to 20 seconds for block device",
-                 rec.blk_device.c_str());
-            util::wait_for_path(rec.blk_device, std::chrono::seconds(20));
+            auto remaining = std::max(
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                            deadline - std::chrono::steady_clock::now()),
+                    std::chrono::milliseconds(0));
+
+            LOGD("%s: Waiting up to %lld ms for block device",
+                 rec.blk_device.c_str(),
+                 static_cast<long long>(remaining.count()));
+            uevent_thread.wait_for_path(rec.blk_device, remaining);
         }
 
         // Try mounting
@@ -278,10 +421,14 @@ static bool mount_exfat_fuse(const char *source, const char *target)
     };
 
     // Run filesystem checks
+    trace_begin("fsck.exfat");
     util::run_command(fsck_argv[0], fsck_argv, {}, {}, &dump);
+    trace_end("fsck.exfat");
 
     // Mount exfat, matching vold options as much as possible
+    trace_begin("mount.exfat");
     int ret = util::run_command(mount_argv[0], mount_argv, {}, {}, &dump);
+    trace_end("mount.exfat");
 
     if (ret >= 0) {
         LOGD("mount.exfat returned: %d", WEXITSTATUS(ret));
@@ -368,7 +515,8 @@ static bool mount_ext4(const char *source, const char *target)
     }
 }
 
-static bool try_extsd_mount(const char *block_dev, const char *mount_point)
+static bool try_extsd_mount(const char *block_dev, const char *mount_point,
+                            const oc::result<std::string> &fstype)
 {
     bool use_fuse_exfat = false;
 
@@ -390,7 +538,6 @@ static bool try_extsd_mount(const char *block_dev, const char *mount_point)
         }
     }
 
-    auto fstype = util::blkid_get_fs_type(block_dev);
     if (!fstype) {
         LOGE("%s: Failed to detect filesystem type: %s",
              block_dev, fstype.error().message().c_str());
@@ -448,12 +595,11 @@ static std::vector<std::string> split_patterns(const char *patterns)
  * This will *not* do anything if the system wasn't booted using mbtool.
  * It relies an the sysfs -> block devices map created by boot/init/devices.cpp
  */
-static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handler,
+static bool mount_extsd_fstab_entries(const UeventThread &uevent_thread,
                                       const std::vector<util::FstabRec> &extsd_recs,
-                                      const char *mount_point, mode_t perms)
+                                      const char *mount_point, mode_t perms,
+                                      std::chrono::milliseconds timeout)
 {
-    using namespace std::chrono_literals;
-
     if (extsd_recs.empty()) {
         LOGD("No external SD fstab entries to mount");
         return true;
@@ -468,15 +614,19 @@ static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handle
     }
 
     // We can't wait for a block device path to appear since we don't know the
-    // block device path. Thus, we'll match the paths a number of times with a
-    // delay between each attempt.
-    static const int max_attempts = 10;
+    // block device path. Thus, we'll match the paths again every time a new
+    // uevent is handled until the timeout expires.
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    int attempt = 0;
 
-    for (int i = 0; i < max_attempts; ++i) {
-        LOGV("[Attempt %d/%d] Finding and mounting external SD",
-             i + 1, max_attempts);
+    while (true) {
+        ++attempt;
+        LOGV("[Attempt %d] Finding and mounting external SD", attempt);
 
-        auto devices_map = handler.GetBlockDeviceMap();
+        // Read the count before the map so that no event is missed
+        auto event_count = uevent_thread.event_count();
+        auto devices_map = uevent_thread.device_handler().GetBlockDeviceMap();
+        std::vector<std::string> candidates;
 
         for (const util::FstabRec &rec : extsd_recs) {
             std::vector<std::string> patterns =
@@ -502,26 +652,80 @@ static bool mount_extsd_fstab_entries(const android::init::DeviceHandler &handle
                             continue;
                         }
 
-                        if (try_extsd_mount(info.path.c_str(), mount_point)) {
-                            return true;
-                        }
+                        candidates.push_back(info.path);
                     }
                 }
             }
         }
 
-        if (i < max_attempts - 1) {
-            LOGW("No external SD patterns were matched; waiting 1 second");
-            std::this_thread::sleep_for(1s);
+        // Probe all candidates at once so that slow devices are read in
+        // parallel. The mount attempts still happen in the original order.
+        auto fstypes = util::blkid_get_fs_types(candidates);
+
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            if (try_extsd_mount(candidates[j].c_str(), mount_point,
+                                fstypes[j])) {
+                return true;
+            }
+        }
+
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+
+        LOGW("No external SD patterns were matched; waiting for new devices");
+        if (remaining.count() <= 0
+                || !uevent_thread.wait_for_events(event_count, remaining)) {
+            break;
         }
     }
 
-    LOGE("No external SD patterns were matched after %d attempts",
-         max_attempts);
+    LOGE("No external SD patterns were matched after %d attempts", attempt);
 
     return false;
 }
 
+/*!
+ * \brief Enable online discard for a writable image mount
+ *
+ * Blocks that are freed in the filesystem are then punched out of the image
+ * file instead of staying allocated on the host filesystem.
+ */
+static void enable_image_discard(const char *target)
+{
+    auto entries = util::get_mount_entries();
+    if (!entries) {
+        LOGW("Failed to get mount entries: %s",
+             entries.error().message().c_str());
+        return;
+    }
+
+    auto it = std::find_if(entries.value().begin(), entries.value().end(),
+                           [&](const util::MountEntry &entry) {
+        return entry.target == target;
+    });
+    if (it == entries.value().end()) {
+        return;
+    }
+
+    if (auto r = util::loopdev_supports_discard(it->source); !r) {
+        LOGW("%s: Failed to check discard support: %s",
+             it->source.c_str(), r.error().message().c_str());
+        return;
+    } else if (!r.value()) {
+        LOGD("%s: Loop device does not support discard", it->source.c_str());
+        return;
+    }
+
+    unsigned long flags;
+    std::tie(flags, std::ignore) = util::parse_mount_options(it->vfs_options);
+
+    if (auto r = util::mount("", target, "", MS_REMOUNT | flags, "discard");
+            !r) {
+        LOGW("%s: Failed to enable discard: %s",
+             target, r.error().message().c_str());
+    }
+}
+
 static bool mount_target(const char *source, const char *target, bool bind,
                          bool read_only)
 {
@@ -591,6 +795,8 @@ static bool mount_target(const char *source, const char *target, bool bind,
             LOGE("%s: Failed to remount: %s", target, strerror(errno));
             return false;
         }
+    } else if (!bind && !read_only) {
+        enable_image_discard(target);
     }
 
     return true;
@@ -606,6 +812,19 @@ static bool mount_all_system_images()
 
     bool failed = false;
 
+    // Find all the loop devices up front instead of scanning once per image.
+    // The devices are detached automatically when the images are unmounted.
+    util::LoopDevicePool loop_pool;
+    auto num_images = std::count_if(roms.roms.begin(), roms.roms.end(),
+                                    [](const std::shared_ptr<Rom> &rom) {
+        return rom->system_is_image;
+    });
+
+    if (auto r = loop_pool.reserve(static_cast<size_t>(num_images)); !r) {
+        LOGW("Failed to reserve %zu loop devices: %s",
+             static_cast<size_t>(num_images), r.error().message().c_str());
+    }
+
     for (const std::shared_ptr<Rom> &rom : roms.roms) {
         if (rom->system_is_image) {
             std::string mount_point(IMAGES_MOUNT_POINT);
@@ -613,8 +832,18 @@ static bool mount_all_system_images()
             mount_point += rom->id;
             std::string system_path(rom->full_system_path());
 
-            if (!mount_target(system_path.c_str(), mount_point.c_str(),
-                              false, true)) {
+            auto loopdev = loop_pool.attach(
+                    system_path, 0, util::LoopDeviceFlag::ReadOnly
+                                  | util::LoopDeviceFlag::DirectIo);
+            if (!loopdev) {
+                LOGW("%s: Failed to attach to loop device: %s",
+                     system_path.c_str(), loopdev.error().message().c_str());
+                failed = true;
+                continue;
+            }
+
+            if (!mount_target(loopdev.value().path().c_str(),
+                              mount_point.c_str(), false, true)) {
                 LOGW("Failed to mount image for %s", rom->id.c_str());
                 failed = true;
             }
@@ -624,92 +853,110 @@ static bool mount_all_system_images()
     return !failed;
 }
 
-static bool disable_fsck(const char *fsck_binary)
+/*!
+ * \brief Attributes that a wrapped binary must have to replace its target
+ */
+struct BinaryAttrs
 {
-    SigVerifyResult result;
-    result = verify_signature(FSCK_WRAPPER, FSCK_WRAPPER_SIG);
-    if (result != SigVerifyResult::Valid) {
-        LOGE("%s: Invalid signature", FSCK_WRAPPER);
-        return false;
-    }
+    uid_t uid;
+    gid_t gid;
+    mode_t mode;
+    std::string context;
 
-    struct stat sb;
-    if (stat(fsck_binary, &sb) < 0) {
-        LOGE("%s: Failed to stat: %s", fsck_binary, strerror(errno));
-        return errno == ENOENT;
+    bool operator==(const BinaryAttrs &other) const
+    {
+        return uid == other.uid && gid == other.gid && mode == other.mode
+                && context == other.context;
     }
+};
 
-    std::string target(WRAPPED_BINARIES_DIR);
-    target += "/";
-    target += util::base_name(fsck_binary);
+struct WrappedCopy
+{
+    std::string source;
+    BinaryAttrs attrs;
+    std::string path;
+};
 
-    if (auto r = util::copy_file(FSCK_WRAPPER, target, 0); !r) {
-        LOGE("%s", r.error().message().c_str());
+static bool get_binary_attrs(const char *path, BinaryAttrs &attrs)
+{
+    struct stat sb;
+    if (stat(path, &sb) < 0) {
         return false;
     }
 
-    // Copy permissions
-    chown(target.c_str(), sb.st_uid, sb.st_gid);
-    chmod(target.c_str(), static_cast<mode_t>(sb.st_mode));
+    attrs.uid = sb.st_uid;
+    attrs.gid = sb.st_gid;
+    attrs.mode = sb.st_mode & 07777;
 
-    // Copy SELinux label
-    if (auto context = util::selinux_get_context(fsck_binary)) {
-        LOGD("%s: SELinux label is: %s", fsck_binary, context.value().c_str());
-        if (auto ret = util::selinux_set_context(target, context.value()); !ret) {
-            LOGW("%s: Failed to set SELinux label: %s",
-                 target.c_str(), ret.error().message().c_str());
-        }
+    if (auto context = util::selinux_get_context(path)) {
+        attrs.context = std::move(context.value());
     } else {
         LOGW("%s: Failed to get SELinux label: %s",
-             fsck_binary, context.error().message().c_str());
-    }
-
-    if (mount(target.c_str(), fsck_binary, "", MS_BIND | MS_RDONLY, "") < 0) {
-        LOGE("Failed to bind mount %s to %s: %s",
-             target.c_str(), fsck_binary, strerror(errno));
-        return false;
+             path, context.error().message().c_str());
+        attrs.context.clear();
     }
 
     return true;
 }
 
-static bool copy_mount_exfat()
+/*!
+ * \brief Bind mount a verified binary over \p target
+ *
+ * If \p source already has the target's ownership, mode, and SELinux label, it
+ * is mounted directly. Otherwise, it is copied to WRAPPED_BINARIES_DIR with
+ * those attributes. Targets that need the same attributes share one copy.
+ */
+static bool wrap_binary(const char *source, const char *target,
+                        std::vector<WrappedCopy> &copies)
 {
-    const char *system_mount_exfat = "/system/bin/mount.exfat";
-    const char *our_mount_exfat = "/sbin/mount.exfat";
-    const char *target = WRAPPED_BINARIES_DIR "/mount.exfat";
-
-    struct stat sb;
-    if (stat(system_mount_exfat, &sb) < 0) {
-        LOGE("%s: Failed to stat: %s", system_mount_exfat, strerror(errno));
+    BinaryAttrs target_attrs;
+    if (!get_binary_attrs(target, target_attrs)) {
+        LOGE("%s: Failed to stat: %s", target, strerror(errno));
         return errno == ENOENT;
     }
 
-    if (auto r = util::copy_file(our_mount_exfat, target, 0); !r) {
-        LOGE("%s", r.error().message().c_str());
-        return false;
-    }
+    LOGD("%s: SELinux label is: %s", target, target_attrs.context.c_str());
 
-    // Copy permissions
-    chown(target, sb.st_uid, sb.st_gid);
-    chmod(target, static_cast<mode_t>(sb.st_mode));
+    std::string path;
+    BinaryAttrs source_attrs;
 
-    // Copy SELinux label
-    if (auto context = util::selinux_get_context(system_mount_exfat)) {
-        LOGD("%s: SELinux label is: %s", system_mount_exfat,
-             context.value().c_str());
-        if (auto ret = util::selinux_set_context(target, context.value()); !ret) {
-            LOGW("%s: Failed to set SELinux label: %s",
-                 target, ret.error().message().c_str());
-        }
+    if (get_binary_attrs(source, source_attrs)
+            && source_attrs == target_attrs) {
+        path = source;
+    } else if (auto it = std::find_if(copies.begin(), copies.end(),
+                                      [&](const WrappedCopy &copy) {
+        return copy.source == source && copy.attrs == target_attrs;
+    }); it != copies.end()) {
+        path = it->path;
     } else {
-        LOGW("%s: Failed to get SELinux label: %s",
-             system_mount_exfat, context.error().message().c_str());
+        path = WRAPPED_BINARIES_DIR;
+        path += "/";
+        path += util::base_name(target);
+
+        if (auto r = util::copy_file(source, path, 0); !r) {
+            LOGE("%s", r.error().message().c_str());
+            return false;
+        }
+
+        // Copy permissions
+        chown(path.c_str(), target_attrs.uid, target_attrs.gid);
+        chmod(path.c_str(), target_attrs.mode);
+
+        // Copy SELinux label
+        if (!target_attrs.context.empty()) {
+            if (auto ret = util::selinux_set_context(
+                    path, target_attrs.context); !ret) {
+                LOGW("%s: Failed to set SELinux label: %s",
+                     path.c_str(), ret.error().message().c_str());
+            }
+        }
+
+        copies.push_back({source, target_attrs, path});
     }
 
-    if (mount(target, system_mount_exfat, "", MS_BIND | MS_RDONLY, "") < 0) {
+    if (mount(path.c_str(), target, "", MS_BIND | MS_RDONLY, "") < 0) {
         LOGE("Failed to bind mount %s to %s: %s",
-             target, system_mount_exfat, strerror(errno));
+             path.c_str(), target, strerror(errno));
         return false;
     }
 
@@ -722,22 +969,39 @@ static bool wrap_extsd_binaries()
         return false;
     }
 
+    // Verified files are remembered for the rest of the boot, so the exfat
+    // binaries are not hashed again if they are needed for mounting
+    auto results = verify_signatures_batch({
+        { FSCK_WRAPPER, FSCK_WRAPPER_SIG },
+        { "/sbin/mount.exfat", "/sbin/mount.exfat.sig" },
+    });
+
     bool ret = true;
+    std::vector<WrappedCopy> copies;
 
     // Online fsck is not possible so we'll have to prevent Vold from trying
     // to run fsck_msdos and failing.
-    if (!disable_fsck("/system/bin/fsck_msdos")) {
-        ret = false;
-    }
-    if (!disable_fsck("/system/bin/fsck_msdos_mtk")) {
-        ret = false;
-    }
-    if (!disable_fsck("/system/bin/fsck.exfat")) {
+    if (results[0] != SigVerifyResult::Valid) {
+        LOGE("%s: Invalid signature", FSCK_WRAPPER);
         ret = false;
+    } else {
+        for (auto const &fsck_binary : {
+            "/system/bin/fsck_msdos",
+            "/system/bin/fsck_msdos_mtk",
+            "/system/bin/fsck.exfat",
+        }) {
+            if (!wrap_binary(FSCK_WRAPPER, fsck_binary, copies)) {
+                ret = false;
+            }
+        }
     }
 
     // Ensure our copy of mount.exfat is used
-    if (!copy_mount_exfat()) {
+    if (results[1] != SigVerifyResult::Valid) {
+        LOGE("%s: Invalid signature", "/sbin/mount.exfat");
+        ret = false;
+    } else if (!wrap_binary("/sbin/mount.exfat", "/system/bin/mount.exfat",
+                            copies)) {
         ret = false;
     }
 
@@ -883,7 +1147,7 @@ static bool process_fstab(const char *path, const std::shared_ptr<Rom> &rom,
  */
 bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
                  const Device &device, MountFlags flags,
-                 const android::init::DeviceHandler &handler)
+                 const UeventThread &uevent_thread)
 {
     std::vector<std::string> successful;
     FstabRecs recs;
@@ -898,38 +1162,6 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         return false;
     }
 
-    bool ret = true;
-
-    // Mount system
-    if (ret && !recs.system.empty()) {
-        if (create_dir_and_mount(recs.system, SYSTEM_MOUNT_POINT, 0755)) {
-            successful.push_back(SYSTEM_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " SYSTEM_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount cache
-    if (ret && !recs.cache.empty()) {
-        if (create_dir_and_mount(recs.cache, CACHE_MOUNT_POINT, 0755)) {
-            successful.push_back(CACHE_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " CACHE_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
-    // Mount data
-    if (ret && !recs.data.empty()) {
-        if (create_dir_and_mount(recs.data, DATA_MOUNT_POINT, 0755)) {
-            successful.push_back(DATA_MOUNT_POINT);
-        } else {
-            LOGE("Failed to mount " DATA_MOUNT_POINT);
-            ret = false;
-        }
-    }
-
     // Mount external SD only if ROM is installed on the external SD. This is
     // necessary because mount_extsd_fstab_entries() blocks until an SD card is
     // found or a timeout occurs.
@@ -940,12 +1172,56 @@ bool mount_fstab(const char *path, const std::shared_ptr<Rom> &rom,
         LOGV("Skipping extsd mount because ROM is not an extsd-slot");
     }
 
-    if (ret && !recs.extsd.empty() && require_extsd) {
-        if (mount_extsd_fstab_entries(
-                handler, recs.extsd, EXTSD_MOUNT_POINT, 0755)) {
-            successful.push_back(EXTSD_MOUNT_POINT);
+    // The partitions do not depend on each other, so they are all mounted
+    // concurrently. This way, a slow external SD probe does not delay the
+    // internal partitions.
+    std::vector<MountStep> steps;
+    std::vector<const char *> mount_points;
+
+    if (!recs.system.empty()) {
+        steps.push_back({SYSTEM_MOUNT_POINT, {}, [&] {
+            return create_dir_and_mount(uevent_thread, recs.system,
+                                        SYSTEM_MOUNT_POINT, 0755,
+                                        SYSTEM_MOUNT_TIMEOUT);
+        }});
+        mount_points.push_back(SYSTEM_MOUNT_POINT);
+    }
+
+    if (!recs.cache.empty()) {
+        steps.push_back({CACHE_MOUNT_POINT, {}, [&] {
+            return create_dir_and_mount(uevent_thread, recs.cache,
+                                        CACHE_MOUNT_POINT, 0755,
+                                        CACHE_MOUNT_TIMEOUT);
+        }});
+        mount_points.push_back(CACHE_MOUNT_POINT);
+    }
+
+    if (!recs.data.empty()) {
+        steps.push_back({DATA_MOUNT_POINT, {}, [&] {
+            return create_dir_and_mount(uevent_thread, recs.data,
+                                        DATA_MOUNT_POINT, 0755,
+                                        DATA_MOUNT_TIMEOUT);
+        }});
+        mount_points.push_back(DATA_MOUNT_POINT);
+    }
+
+    if (!recs.extsd.empty() && require_extsd) {
+        steps.push_back({EXTSD_MOUNT_POINT, {}, [&] {
+            return mount_extsd_fstab_entries(uevent_thread, recs.extsd,
+                                             EXTSD_MOUNT_POINT, 0755,
+                                             EXTSD_MOUNT_TIMEOUT);
+        }});
+        mount_points.push_back(EXTSD_MOUNT_POINT);
+    }
+
+    auto states = run_mount_steps(steps);
+    bool ret = true;
+
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (states[i] == MountStepState::Succeeded) {
+            successful.push_back(mount_points[i]);
         } else {
-            LOGE("Failed to mount " EXTSD_MOUNT_POINT);
+            LOGE("Failed to mount %s", mount_points[i]);
             ret = false;
         }
     }
@@ -990,33 +1266,62 @@ bool mount_rom(const std::shared_ptr<Rom> &rom)
         return false;
     }
 
-    if (!mount_target(target_system.c_str(), "/system", !rom->system_is_image,
-                      true)) {
-        return false;
-    }
-
-    if (!mount_target(target_cache.c_str(), "/cache", !rom->cache_is_image,
-                      false)) {
-        return false;
-    }
+    // Bind mounts can happen concurrently, but image mounts are serialized
+    // because concurrent loop device allocations may race for the same free
+    // device. The /data/media bind mount waits for /data and the system images
+    // wait for the last loop device allocation.
+    std::vector<MountStep> steps;
+    std::vector<size_t> image_deps;
+
+    auto add_target_step = [&](const std::string &source, const char *target,
+                               bool is_image, bool read_only) {
+        steps.push_back({target, is_image ? image_deps : std::vector<size_t>{},
+                         [&source, target, is_image, read_only] {
+            return mount_target(source.c_str(), target, !is_image, read_only);
+        }});
+        if (is_image) {
+            image_deps = {steps.size() - 1};
+        }
+        return steps.size() - 1;
+    };
 
-    if (!mount_target(target_data.c_str(), "/data", !rom->data_is_image,
-                      false)) {
-        return false;
-    }
+    add_target_step(target_system, "/system", rom->system_is_image, true);
+    add_target_step(target_cache, "/cache", rom->cache_is_image, false);
+    size_t data_step =
+            add_target_step(target_data, "/data", rom->data_is_image, false);
 
     // Bind mount internal SD directory
-    (void) util::mkdir_recursive("/raw/data/media", 0771);
-    (void) util::mkdir_recursive("/data/media", 0771);
+    steps.push_back({"/data/media", {data_step}, [] {
+        (void) util::mkdir_recursive("/raw/data/media", 0771);
+        (void) util::mkdir_recursive("/data/media", 0771);
+
+        if (auto ret = util::mount(
+                "/raw/data/media", "/data/media", "", MS_BIND, ""); !ret) {
+            LOGE("Failed to mount /data/media: %s",
+                 ret.error().message().c_str());
+            return false;
+        }
+
+        return true;
+    }});
+
+    size_t required_steps = steps.size();
+
+    // Failures are not fatal
+    steps.push_back({IMAGES_MOUNT_POINT, image_deps, [] {
+        return mount_all_system_images();
+    }});
 
-    if (auto ret = util::mount(
-            "/raw/data/media", "/data/media", "", MS_BIND, ""); !ret) {
-        LOGE("Failed to mount /data/media: %s", ret.error().message().c_str());
+    auto states = run_mount_steps(steps);
+
+    if (!std::all_of(states.begin(), states.begin()
+                     + static_cast<std::ptrdiff_t>(required_steps),
+                     [](MountStepState state) {
+        return state == MountStepState::Succeeded;
+    })) {
         return false;
     }
 
-    mount_all_system_images();
-
     bool require_extsd = rom->system_source == Rom::Source::ExternalSd
             || rom->cache_source == Rom::Source::ExternalSd
             || rom->data_source == Rom::Source::ExternalSd;
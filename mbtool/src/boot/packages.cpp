@@ -317,6 +317,8 @@ bool Packages::load_xml(const std::string &path)
 {
     pkgs.clear();
     sigs.clear();
+    _by_uid.clear();
+    _by_pkg.clear();
 
     pugi::xml_document doc;
     pugi::xml_parse_result result = doc.load_file(path.c_str());
@@ -342,9 +344,24 @@ bool Packages::load_xml(const std::string &path)
         }
     }
 
+    build_indexes();
+
     return true;
 }
 
+void Packages::build_indexes()
+{
+    _by_uid.reserve(pkgs.size());
+    _by_pkg.reserve(pkgs.size());
+
+    for (auto const &pkg : pkgs) {
+        if (!pkg->is_shared_user) {
+            _by_uid.emplace(static_cast<uid_t>(pkg->user_id), pkg);
+        }
+        _by_pkg.emplace(pkg->name, pkg);
+    }
+}
+
 static bool parse_tag_cert(pugi::xml_node node, Packages *pkgs,
                            std::shared_ptr<Package> pkg)
 {
@@ -573,20 +590,14 @@ static bool parse_tag_packages(pugi::xml_node node, Packages *pkgs)
 
 std::shared_ptr<Package> Packages::find_by_uid(uid_t uid) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return !pkg->is_shared_user && pkg->user_id == static_cast<int>(uid);
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _by_uid.find(uid);
+    return it == _by_uid.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 std::shared_ptr<Package> Packages::find_by_pkg(const std::string &pkg_id) const
 {
-    auto it = std::find_if(pkgs.begin(), pkgs.end(),
-                           [&](const std::shared_ptr<Package> &pkg) {
-        return pkg->name == pkg_id;
-    });
-    return it == pkgs.end() ? std::shared_ptr<Package>() : *it;
+    auto it = _by_pkg.find(pkg_id);
+    return it == _by_pkg.end() ? std::shared_ptr<Package>() : it->second;
 }
 
 }
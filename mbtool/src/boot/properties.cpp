@@ -20,6 +20,8 @@
 #include "boot/properties.h"
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <cstdio>
 #include <cstdlib>
@@ -73,11 +75,22 @@ static bool set_if_possible(const std::string &key, const std::string &value,
 static bool load_prop_file(const char *path, bool force)
 {
     bool ret = true;
+    std::vector<std::pair<std::string, std::string>> props;
 
     if (!util::property_file_iter(path, {}, [&](std::string_view key,
                                                 std::string_view value) {
-        if (!set_if_possible(std::string(key), std::string(value), force)) {
+        if (force) {
+            if (!set_if_possible(std::string(key), std::string(value), force)) {
+                ret = false;
+            }
+        } else if (starts_with(key, "ro.")
+                && util::property_get(std::string(key))) {
+            fprintf(stderr, "Cannot overwrite read-only property '%.*s'"
+                    " without -f/--force\n",
+                    static_cast<int>(key.size()), key.data());
             ret = false;
+        } else {
+            props.emplace_back(key, value);
         }
 
         return util::PropertyIterAction::Continue;
@@ -86,6 +99,17 @@ static bool load_prop_file(const char *path, bool force)
         return false;
     }
 
+    // Send all of the properties to the property service at once
+    auto results = util::property_set_many(props);
+
+    for (size_t i = 0; i < props.size(); ++i) {
+        if (!results[i]) {
+            fprintf(stderr, "Failed to set property '%s'='%s'\n",
+                    props[i].first.c_str(), props[i].second.c_str());
+            ret = false;
+        }
+    }
+
     return ret;
 }
 
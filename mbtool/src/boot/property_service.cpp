@@ -17,10 +17,12 @@
 
 #include "boot/property_service.h"
 
+#include <algorithm>
 #include <chrono>
 #include <string_view>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -124,6 +126,23 @@ public:
         return std::move(str);
     }
 
+    mb::oc::result<void> send_data(const void *data, size_t size)
+    {
+        auto ptr = static_cast<const char *>(data);
+
+        while (size > 0) {
+            auto result = TEMP_FAILURE_RETRY(send(m_fd, ptr, size, 0));
+            if (result < 0) {
+                return mb::ec_from_errno();
+            }
+
+            ptr += result;
+            size -= static_cast<size_t>(result);
+        }
+
+        return mb::oc::success();
+    }
+
     mb::oc::result<void> send_uint32(uint32_t value)
     {
         auto result = TEMP_FAILURE_RETRY(
@@ -199,9 +218,34 @@ bool PropertyService::initialize()
     return m_initialized = true;
 }
 
+/*!
+ * \brief Find a property using the cached prop_info handles
+ *
+ * Properties are never removed from the property area, so the handles remain
+ * valid for the lifetime of the area.
+ */
+mb::prop_info * PropertyService::find_cached(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(m_props_guard);
+
+    if (auto it = m_props.find(name); it != m_props.end() && it->second.pi) {
+        return it->second.pi;
+    }
+
+    auto pi = const_cast<mb::prop_info *>(
+            mb::__system_property_find(name.c_str()));
+    if (pi) {
+        m_props[name].pi = pi;
+    }
+
+    return pi;
+}
+
 std::optional<std::string> PropertyService::get(const std::string &name)
 {
-    if (auto const pi = mb::__system_property_find(name.c_str())) {
+    // The value is read outside of the lock. Property reads are lock-free and
+    // are retried if the serial changes while reading.
+    if (auto const pi = find_cached(name)) {
         std::string value;
         mb::__system_property_read_callback(
                 pi, [](void *cookie, const char *, const char *v, uint32_t) {
@@ -256,8 +300,15 @@ uint32_t PropertyService::set_internal(const std::string &name,
         return PROP_ERROR_INVALID_VALUE;
     }
 
-    if (auto pi = const_cast<mb::prop_info *>(
-            mb::__system_property_find(name.c_str()))) {
+    std::lock_guard<std::mutex> lock(m_props_guard);
+
+    auto &entry = m_props[name];
+    if (!entry.pi) {
+        entry.pi = const_cast<mb::prop_info *>(
+                mb::__system_property_find(name.c_str()));
+    }
+
+    if (auto pi = entry.pi) {
         // ro.* properties are actually "write-once".
         if (mb::starts_with(name, "ro.")) {
             LOGE("['%s'='%s'] Failed to set property: Property already set",
@@ -276,6 +327,8 @@ uint32_t PropertyService::set_internal(const std::string &name,
         }
     }
 
+    ++entry.set_count;
+
     return PROP_SUCCESS;
 }
 
@@ -284,6 +337,34 @@ bool PropertyService::set(const std::string &name, std::string_view value)
     return set_internal(name, value) == PROP_SUCCESS;
 }
 
+/*!
+ * \brief Get the number of times each property was successfully set
+ *
+ * \return List of properties and their set counts, sorted by count in
+ *         descending order
+ */
+std::vector<std::pair<std::string, uint64_t>> PropertyService::set_counts()
+{
+    std::vector<std::pair<std::string, uint64_t>> result;
+
+    {
+        std::lock_guard<std::mutex> lock(m_props_guard);
+
+        for (auto const &[name, entry] : m_props) {
+            if (entry.set_count > 0) {
+                result.emplace_back(name, entry.set_count);
+            }
+        }
+    }
+
+    std::sort(result.begin(), result.end(), [](auto const &a, auto const &b) {
+        return a.second > b.second
+                || (a.second == b.second && a.first < b.first);
+    });
+
+    return result;
+}
+
 bool PropertyService::start_thread()
 {
     if (m_setter_fd >= 0) {
@@ -332,6 +413,12 @@ bool PropertyService::stop_thread()
 
     m_thread.join();
 
+    for (auto const &[name, count] : set_counts()) {
+        if (count > 1) {
+            LOGV("Property %s was set %" PRIu64 " times", name.c_str(), count);
+        }
+    }
+
     close(std::exchange(m_setter_fd, -1));
     close(std::exchange(m_stopper_pipe[0], -1));
     close(std::exchange(m_stopper_pipe[1], -1));
@@ -483,6 +570,10 @@ void PropertyService::socket_handle_set_property()
         break;
       }
 
+    case PROP_MSG_SETPROPS_MB:
+        socket_handle_set_properties(socket, timeout);
+        break;
+
     default:
         LOGE("Invalid command: %u", cmd.value());
         (void) socket.send_uint32(PROP_ERROR_INVALID_CMD);
@@ -510,13 +601,79 @@ void PropertyService::socket_handle_set_property_impl(SocketConnection &socket,
             (void) socket.send_uint32(PROP_SUCCESS);
         }
     } else {
-        uint32_t result = set(name, value);
+        uint32_t result = set_internal(name, value);
         if (!legacy) {
             (void) socket.send_uint32(result);
         }
     }
 }
 
+/*!
+ * \brief Handle a PROP_MSG_SETPROPS_MB message
+ *
+ * The properties are applied in order and one result code is sent for each
+ * property in a single reply.
+ */
+void PropertyService::socket_handle_set_properties(
+        SocketConnection &socket, std::chrono::milliseconds &timeout)
+{
+    static constexpr std::chrono::milliseconds ITEM_TIMEOUT(2000);
+
+    auto count = socket.recv_uint32(timeout);
+    if (!count) {
+        LOGE("Failed to receive property count from the socket: %s",
+             count.error().message().c_str());
+        (void) socket.send_uint32(PROP_ERROR_READ_DATA);
+        return;
+    } else if (count.value() > PROP_SETPROPS_MAX) {
+        LOGE("[PROP_MSG_SETPROPS_MB] Too many properties: %u", count.value());
+        (void) socket.send_uint32(PROP_ERROR_READ_DATA);
+        return;
+    }
+
+    std::vector<uint32_t> results;
+    results.reserve(count.value());
+
+    for (uint32_t i = 0; i < count.value(); ++i) {
+        // Each property gets its own timeout so that large batches work
+        timeout = ITEM_TIMEOUT;
+
+        auto name = socket.recv_string(timeout);
+        if (!name) {
+            LOGE("Failed to receive name from the socket: %s",
+                 name.error().message().c_str());
+            (void) socket.send_uint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+
+        auto value = socket.recv_string(timeout);
+        if (!value) {
+            LOGE("Failed to receive value from the socket: %s",
+                 value.error().message().c_str());
+            (void) socket.send_uint32(PROP_ERROR_READ_DATA);
+            return;
+        }
+
+        if (!is_legal_property_name(name.value())) {
+            LOGE("[PROP_MSG_SETPROPS_MB] Invalid property name: '%s'",
+                 name.value().c_str());
+            results.push_back(PROP_ERROR_INVALID_NAME);
+        } else if (mb::starts_with(name.value(), "ctl.")) {
+            LOGW("[PROP_MSG_SETPROPS_MB] Ignoring control message: '%s'='%s'",
+                 name.value().c_str(), value.value().c_str());
+            results.push_back(PROP_SUCCESS);
+        } else {
+            results.push_back(set_internal(name.value(), value.value()));
+        }
+    }
+
+    if (auto r = socket.send_data(results.data(),
+                                  results.size() * sizeof(uint32_t)); !r) {
+        LOGE("Failed to send results to the socket: %s",
+             r.error().message().c_str());
+    }
+}
+
 bool PropertyService::load_properties_file(const std::string &path,
                                            std::string_view filter)
 {
@@ -19,18 +19,26 @@
 
 #include "boot/uevent_thread.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <cerrno>
 #include <cstring>
 
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "mbcommon/executor.h"
 #include "mbcommon/finally.h"
 
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbtool/boot/uevent_thread"
 
+// Maximum number of threads for handling the coldboot uevents
+constexpr unsigned int COLDBOOT_MAX_THREADS = 8;
+
 namespace mb
 {
 
@@ -39,6 +47,7 @@ using namespace android::init;
 UeventThread::UeventThread()
     : m_cancel_pipe()
     , m_is_running(false)
+    , m_event_count(0)
 {
 }
 
@@ -69,10 +78,7 @@ bool UeventThread::start()
     m_uevent_listener = UeventListener();
 
     // Regenerate events for devices already detected
-    m_uevent_listener->RegenerateUevents([&](const Uevent &uevent) {
-        m_device_handler.HandleDeviceEvent(uevent);
-        return ListenerAction::kContinue;
-    });
+    coldboot();
 
     m_thread = std::thread(&UeventThread::thread_func, this);
 
@@ -115,10 +121,134 @@ const android::init::DeviceHandler & UeventThread::device_handler() const
     return m_device_handler;
 }
 
+/*!
+ * \brief Get the number of uevents that have been handled
+ *
+ * The value can be passed to wait_for_events() to wait for any event that is
+ * handled after this function is called.
+ */
+uint64_t UeventThread::event_count() const
+{
+    std::lock_guard<std::mutex> lock(m_event_guard);
+    return m_event_count;
+}
+
+/*!
+ * \brief Wait until more than \p count uevents have been handled
+ *
+ * \param count Value previously returned by event_count()
+ * \param timeout Maximum time to wait
+ *
+ * \return Whether a new event was handled before the timeout expired
+ */
+bool UeventThread::wait_for_events(uint64_t count,
+                                   std::chrono::milliseconds timeout) const
+{
+    std::unique_lock<std::mutex> lock(m_event_guard);
+
+    return m_event_cv.wait_for(lock, timeout, [&] {
+        return m_event_count > count;
+    });
+}
+
+/*!
+ * \brief Wait for a device node or symlink to be created
+ *
+ * Unlike util::wait_for_path(), this does not poll. The path is checked again
+ * only after a uevent has been handled, so the caller is woken up as soon as
+ * the device handler creates the path.
+ *
+ * \param path Path to device node or symlink (eg. a by-name path)
+ * \param timeout Maximum time to wait
+ *
+ * \return Whether the path exists
+ */
+bool UeventThread::wait_for_path(const std::string &path,
+                                 std::chrono::milliseconds timeout) const
+{
+    auto until = std::chrono::steady_clock::now() + timeout;
+    struct stat sb;
+
+    std::unique_lock<std::mutex> lock(m_event_guard);
+
+    while (true) {
+        // Events are counted after they are handled, so the path must be
+        // checked after reading the count to avoid missing an event
+        uint64_t count = m_event_count;
+
+        if (stat(path.c_str(), &sb) == 0) {
+            return true;
+        }
+
+        if (!m_event_cv.wait_until(lock, until, [&] {
+            return m_event_count > count;
+        })) {
+            return stat(path.c_str(), &sb) == 0;
+        }
+    }
+}
+
+/*!
+ * \brief Create device nodes for the devices that were detected before the
+ *        thread was started
+ *
+ * Like ueventd's coldboot, the regenerated uevents are collected first and
+ * then split between several workers. The devices are independent of each
+ * other, so their nodes and symlinks can be created concurrently.
+ */
+void UeventThread::coldboot()
+{
+    using namespace std::chrono;
+
+    auto start = steady_clock::now();
+
+    std::vector<Uevent> uevents;
+
+    m_uevent_listener->RegenerateUevents([&](const Uevent &uevent) {
+        uevents.push_back(uevent);
+        return ListenerAction::kContinue;
+    });
+
+    auto threads = std::clamp(Executor::global().concurrency(), 1u,
+                              COLDBOOT_MAX_THREADS);
+    threads = static_cast<unsigned int>(std::clamp<size_t>(
+            uevents.size(), 1, threads));
+
+    auto worker = [&](unsigned int index) {
+        for (size_t i = index; i < uevents.size(); i += threads) {
+            handle_event(uevents[i]);
+        }
+    };
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < threads; ++i) {
+        group.run([&, i] { worker(i); });
+    }
+    worker(0);
+    group.wait();
+
+    LOGV("Handled %zu coldboot uevents with %u threads in %lld ms",
+         uevents.size(), threads, static_cast<long long>(
+                 duration_cast<milliseconds>(steady_clock::now() - start)
+                         .count()));
+}
+
+void UeventThread::handle_event(const Uevent &uevent)
+{
+    m_device_handler.HandleDeviceEvent(uevent);
+
+    {
+        std::lock_guard<std::mutex> lock(m_event_guard);
+        ++m_event_count;
+    }
+
+    m_event_cv.notify_all();
+}
+
 void UeventThread::thread_func()
 {
     m_uevent_listener->Poll([&](const Uevent &uevent) {
-        m_device_handler.HandleDeviceEvent(uevent);
+        handle_event(uevent);
         return ListenerAction::kContinue;
     }, m_cancel_pipe[0]);
 }
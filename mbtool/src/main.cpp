@@ -28,6 +28,7 @@
 
 #ifdef RECOVERY
 #include "recovery/backup.h"
+#include "recovery/compact_image.h"
 #include "recovery/rom_installer.h"
 #include "recovery/update_binary.h"
 #include "recovery/update_binary_tool.h"
@@ -44,6 +45,9 @@
 #include "util/signature.h"
 #endif
 
+#include "util/bench.h"
+#include "util/dedup.h"
+
 #include "mbcommon/version.h"
 #include "mbutil/process.h"
 #include "mbutil/string.h"
@@ -62,9 +66,13 @@ static Tool g_tools[] = {
     { "mbtool", mbtool_main },
     { "mbtool_recovery", mbtool_main },
     // Tools
+    { "bench", mb::bench_main },
+    { "dedup", mb::dedup_main },
 #ifdef RECOVERY
     { "backup", mb::backup_main },
     { "restore", mb::restore_main },
+    { "backup-gc", mb::backup_gc_main },
+    { "compact-image", mb::compact_image_main },
     { "rom-installer", mb::rom_installer_main },
     { "updater", mb::update_binary_main }, // TWRP
     { "update_binary", mb::update_binary_main }, // CWM, Philz
@@ -22,6 +22,8 @@
 #include <cerrno>
 #include <cstring>
 
+#include "mbcommon/file.h"
+
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbtool/recovery/archive_util"
@@ -62,4 +64,113 @@ bool la_copy_data_to_fd(archive *a, int fd)
     return true;
 }
 
+struct LaFileCtx
+{
+    File *file;
+    char buf[BUF_SIZE];
+};
+
+static la_ssize_t la_file_read_cb(archive *a, void *userdata,
+                                  const void **buffer)
+{
+    auto ctx = static_cast<LaFileCtx *>(userdata);
+
+    while (true) {
+        auto n = ctx->file->read(ctx->buf, sizeof(ctx->buf));
+        if (!n) {
+            if (n.error() == std::errc::interrupted) {
+                continue;
+            }
+            archive_set_error(a, n.error().value(), "%s",
+                              n.error().message().c_str());
+            return -1;
+        }
+
+        *buffer = ctx->buf;
+        return static_cast<la_ssize_t>(n.value());
+    }
+}
+
+static la_int64_t la_file_seek_cb(archive *a, void *userdata,
+                                  la_int64_t offset, int whence)
+{
+    auto ctx = static_cast<LaFileCtx *>(userdata);
+
+    auto pos = ctx->file->seek(offset, whence);
+    if (!pos) {
+        archive_set_error(a, pos.error().value(), "%s",
+                          pos.error().message().c_str());
+        return ARCHIVE_FATAL;
+    }
+
+    return static_cast<la_int64_t>(pos.value());
+}
+
+static int la_file_close_cb(archive *a, void *userdata)
+{
+    (void) a;
+
+    delete static_cast<LaFileCtx *>(userdata);
+
+    return ARCHIVE_OK;
+}
+
+/*!
+ * \brief Open archive for reading from a File handle
+ *
+ * The data is read from the current file position. The File handle is not
+ * owned and must remain open until the archive is closed.
+ *
+ * \return Result of archive_read_open1()
+ */
+int la_open_file(archive *a, File &file)
+{
+    auto ctx = new LaFileCtx();
+    ctx->file = &file;
+
+    archive_read_set_read_callback(a, &la_file_read_cb);
+    archive_read_set_seek_callback(a, &la_file_seek_cb);
+    archive_read_set_close_callback(a, &la_file_close_cb);
+    archive_read_set_callback_data(a, ctx);
+
+    return archive_read_open1(a);
+}
+
+/*!
+ * \brief Enable the filters needed for a ramdisk and the cpio format
+ *
+ * If the compression is known, only the matching filter is enabled so that
+ * libarchive does not need to bid with every decompressor.
+ */
+void la_support_ramdisk(archive *a, bootimg::RamdiskCompression compression)
+{
+    using bootimg::RamdiskCompression;
+
+    switch (compression) {
+    case RamdiskCompression::None:
+        break;
+    case RamdiskCompression::Gzip:
+        archive_read_support_filter_gzip(a);
+        break;
+    case RamdiskCompression::Lz4:
+        archive_read_support_filter_lz4(a);
+        break;
+    case RamdiskCompression::Lzma:
+        archive_read_support_filter_lzma(a);
+        break;
+    case RamdiskCompression::Xz:
+        archive_read_support_filter_xz(a);
+        break;
+    case RamdiskCompression::Unknown:
+    default:
+        archive_read_support_filter_gzip(a);
+        archive_read_support_filter_lz4(a);
+        archive_read_support_filter_lzma(a);
+        archive_read_support_filter_xz(a);
+        break;
+    }
+
+    archive_read_support_format_cpio(a);
+}
+
 }
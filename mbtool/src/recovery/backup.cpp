@@ -20,20 +20,27 @@
 #include "recovery/backup.h"
 
 #include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include <dirent.h>
 #include <getopt.h>
 #include <sys/mount.h>
+#include <sys/statvfs.h>
 
 #include <archive.h>
 #include <archive_entry.h>
 
+#include "mbcommon/executor.h"
 #include "mbcommon/integer.h"
+#include "mbcommon/resource_budget.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/archive.h"
@@ -41,15 +48,22 @@
 #include "mbutil/delete.h"
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
+#include "mbutil/metrics.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
+#include "mbutil/properties.h"
+#include "mbutil/sched.h"
 #include "mbutil/selinux.h"
 #include "mbutil/string.h"
 
+#include "recovery/chunk_store.h"
 #include "recovery/installer_util.h"
 #include "recovery/image.h"
+#include "util/dedup.h"
 #include "util/multiboot.h"
 #include "util/roms.h"
+#include "util/stats_json.h"
+#include "util/storage_profile.h"
 #include "util/wipe.h"
 
 #define LOG_TAG "mbtool/recovery/backup"
@@ -79,9 +93,14 @@ constexpr char BACKUP_NAME_BOOT_IMAGE[]    = "boot.img";
 constexpr char BACKUP_NAME_CONFIG[]        = "config.json";
 constexpr char BACKUP_NAME_THUMBNAIL[]     = "thumbnail.webp";
 
+constexpr char CHUNKED_BACKUP_SUFFIX[]     = ".manifest";
+constexpr char SPARSE_IMAGE_SUFFIX[]       = ".img.sparse";
+
 // Max file size for FAT32
 constexpr uint64_t DEFAULT_ARCHIVE_SPLIT_SIZE = UINT32_MAX - 1;
 
+constexpr std::chrono::seconds METRICS_REPORT_INTERVAL{10};
+
 using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
 
 enum class Result
@@ -92,6 +111,29 @@ enum class Result
     BootImageUnpatched,
 };
 
+struct ArchiveOptions
+{
+    util::CompressionType compression = util::CompressionType::Lz4;
+    uint64_t split_archive_size = DEFAULT_ARCHIVE_SPLIT_SIZE;
+    unsigned int threads = 1;
+    int level = -1;
+    // Write one independently compressed segment per thread
+    bool segmented = false;
+    // Store deduplicated file contents here instead of creating archives
+    ChunkStore *chunk_store = nullptr;
+    // Back up the allocated blocks of image partitions instead of their files
+    bool image_blocks = false;
+};
+
+enum class ArchiveLayout
+{
+    Single,
+    Split,
+    Segmented,
+    Chunked,
+    SparseImage,
+};
+
 static struct CompressionMap
 {
     util::CompressionType type;
@@ -102,6 +144,7 @@ static struct CompressionMap
     { util::CompressionType::Lz4,  "lz4",   ".tar.lz4" },
     { util::CompressionType::Gzip, "gzip",  ".tar.gz" },
     { util::CompressionType::Xz,   "xz",    ".tar.xz" },
+    { util::CompressionType::Zstd, "zstd",  ".tar.zst" },
     { util::CompressionType::None, nullptr, nullptr }
 };
 
@@ -157,10 +200,31 @@ static std::string get_compressed_backup_name(const std::string &name,
 static std::string find_compressed_backup(const std::string &backup_dir,
                                           const std::string &name,
                                           util::CompressionType &compression,
-                                          bool &is_split)
+                                          ArchiveLayout &layout)
 {
     std::string unsplit_path;
     std::string split_path;
+    std::string manifest_path;
+
+    std::string chunked_path(backup_dir);
+    chunked_path += '/';
+    chunked_path += name;
+    chunked_path += CHUNKED_BACKUP_SUFFIX;
+
+    std::string sparse_path(backup_dir);
+    sparse_path += '/';
+    sparse_path += name;
+    sparse_path += SPARSE_IMAGE_SUFFIX;
+
+    if (access(chunked_path.c_str(), R_OK) == 0) {
+        compression = util::CompressionType::None;
+        layout = ArchiveLayout::Chunked;
+        return name + CHUNKED_BACKUP_SUFFIX;
+    } else if (access(sparse_path.c_str(), R_OK) == 0) {
+        compression = util::CompressionType::None;
+        layout = ArchiveLayout::SparseImage;
+        return name + SPARSE_IMAGE_SUFFIX;
+    }
 
     for (auto i = g_compression_map; i->name; ++i) {
         unsplit_path = backup_dir;
@@ -171,13 +235,20 @@ static std::string find_compressed_backup(const std::string &backup_dir,
         split_path = unsplit_path;
         split_path += ".0";
 
+        manifest_path = unsplit_path;
+        manifest_path += util::ARCHIVE_SEGMENTS_SUFFIX;
+
         if (access(unsplit_path.c_str(), R_OK) == 0) {
             compression = i->type;
-            is_split = false;
+            layout = ArchiveLayout::Single;
             return name + i->extension;
         } else if (access(split_path.c_str(), R_OK) == 0) {
             compression = i->type;
-            is_split = true;
+            layout = ArchiveLayout::Split;
+            return name + i->extension;
+        } else if (access(manifest_path.c_str(), R_OK) == 0) {
+            compression = i->type;
+            layout = ArchiveLayout::Segmented;
             return name + i->extension;
         }
     }
@@ -187,9 +258,13 @@ static std::string find_compressed_backup(const std::string &backup_dir,
 static bool backup_directory(const std::string &output_file,
                              const std::string &directory,
                              const std::vector<std::string> &exclusions,
-                             util::CompressionType compression,
-                             uint64_t split_archive_size)
+                             const ArchiveOptions &options)
 {
+    if (options.chunk_store) {
+        return chunked_backup_directory(*options.chunk_store, output_file,
+                                        directory, exclusions);
+    }
+
     ScopedDIR dp(opendir(directory.c_str()), closedir);
     if (!dp) {
         LOGE("%s: Failed to open directory: %s",
@@ -217,56 +292,142 @@ static bool backup_directory(const std::string &output_file,
         return false;
     }
 
+    if (options.segmented) {
+        return util::libarchive_tar_create_segments(
+                output_file, directory, contents, options.compression,
+                options.split_archive_size, options.threads, options.level);
+    }
+
     return util::libarchive_tar_create(output_file, directory, contents,
-                                       compression, split_archive_size);
+                                       options.compression,
+                                       options.split_archive_size,
+                                       options.threads, options.level);
+}
+
+/*!
+ * \brief Restore some paths of a backup on top of the existing files
+ *
+ * Only the archive members for \p paths are extracted. Files that are not in
+ * the backup are kept. Since the existing files may be written to, files that
+ * mbtool dedup hard-linked to another ROM's files are split first.
+ */
+static bool restore_paths(const std::string &input_file,
+                          const std::string &directory,
+                          const std::vector<std::string> &paths,
+                          util::CompressionType compression,
+                          ArchiveLayout layout)
+{
+    if (!dedup_unshare_hardlinks(directory)) {
+        return false;
+    }
+
+    switch (layout) {
+    case ArchiveLayout::Single:
+    case ArchiveLayout::Split:
+        return util::libarchive_tar_extract_paths(
+                input_file, directory, paths, compression,
+                layout == ArchiveLayout::Split,
+                util::TarExtractFlag::BulkWrite);
+    case ArchiveLayout::Segmented:
+        return util::libarchive_tar_extract_segments(
+                input_file, directory, compression,
+                storage_queue_depth(directory, 0),
+                util::TarExtractFlag::BulkWrite, paths);
+    default:
+        LOGE("%s: Selective restore is only supported for archive backups",
+             input_file.c_str());
+        return false;
+    }
 }
 
 static bool restore_directory(const std::string &input_file,
                               const std::string &directory,
                               const std::vector<std::string> &exclusions,
                               util::CompressionType compression,
-                              bool is_split)
+                              ArchiveLayout layout,
+                              const std::vector<std::string> &only)
 {
+    if (!only.empty()) {
+        return restore_paths(input_file, directory, only, compression, layout);
+    }
+
     if (!wipe_directory(directory, exclusions)) {
         return false;
     }
 
+    if (layout == ArchiveLayout::Chunked) {
+        return chunked_restore_directory(input_file, directory);
+    } else if (layout == ArchiveLayout::Segmented) {
+        return util::libarchive_tar_extract_segments(
+                input_file, directory, compression,
+                storage_queue_depth(directory, 0),
+                util::TarExtractFlag::BulkWrite);
+    }
+
     return util::libarchive_tar_extract(input_file, directory, {}, compression,
-                                        is_split);
+                                        layout == ArchiveLayout::Split,
+                                        util::TarExtractFlag::BulkWrite);
+}
+
+/*!
+ * \brief Get a mount point for an image that doesn't conflict with the other
+ *        images of the ROM being backed up or restored concurrently
+ */
+static std::string image_mount_dir(const std::string &image)
+{
+    std::string mount_dir(BACKUP_MNT_DIR);
+    mount_dir += '/';
+    mount_dir += util::base_name(image);
+    return mount_dir;
+}
+
+static void remove_image_mount_dir(const std::string &mount_dir)
+{
+    rmdir(mount_dir.c_str());
+    // Fails if another image is still mounted
+    rmdir(BACKUP_MNT_DIR);
 }
 
 static bool backup_image(const std::string &output_file,
                          const std::string &image,
                          const std::vector<std::string> &exclusions,
-                         util::CompressionType compression,
-                         uint64_t split_archive_size)
+                         const ArchiveOptions &options)
 {
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    std::string mount_dir = image_mount_dir(image);
+
+    if (auto r = util::mkdir_recursive(mount_dir, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_dir.c_str(), strerror(errno));
         return false;
     }
 
     fsck_ext4_image(image);
 
     if (auto ret = util::mount(
-            image, BACKUP_MNT_DIR, "ext4", MS_RDONLY, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
+            image, mount_dir, "ext4", MS_RDONLY, ""); !ret) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(), mount_dir.c_str(),
              ret.error().message().c_str());
         return false;
     }
 
-    bool ret = backup_directory(output_file, BACKUP_MNT_DIR, exclusions,
-                                compression, split_archive_size);
+    // Used space is a good enough estimate of how much will be read
+    struct statvfs sfs;
+    if (statvfs(mount_dir.c_str(), &sfs) == 0) {
+        util::metrics_set_expected_read_bytes(
+                static_cast<uint64_t>(sfs.f_blocks - sfs.f_bfree)
+                * sfs.f_frsize);
+    }
+
+    bool ret = backup_directory(output_file, mount_dir, exclusions, options);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_dir); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_dir.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
-    rmdir(BACKUP_MNT_DIR);
+    remove_image_mount_dir(mount_dir);
 
     return ret;
 }
@@ -276,7 +437,8 @@ static bool restore_image(const std::string &input_file,
                           uint64_t size,
                           const std::vector<std::string> &exclusions,
                           util::CompressionType compression,
-                          bool is_split)
+                          ArchiveLayout layout,
+                          const std::vector<std::string> &only)
 {
     if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
         LOGE("%s: Failed to create parent directory: %s",
@@ -284,6 +446,8 @@ static bool restore_image(const std::string &input_file,
         return false;
     }
 
+    bool created = false;
+
     struct stat sb;
     if (stat(image.c_str(), &sb) < 0) {
         if (errno == ENOENT) {
@@ -291,37 +455,43 @@ static bool restore_image(const std::string &input_file,
             if (result != CreateImageResult::Succeeded) {
                 return false;
             }
+            created = true;
         } else {
             LOGE("%s: Failed to stat: %s", image.c_str(), strerror(errno));
             return false;
         }
     }
 
-    if (auto r = util::mkdir_recursive(BACKUP_MNT_DIR, 0755);
+    std::string mount_dir = image_mount_dir(image);
+
+    if (auto r = util::mkdir_recursive(mount_dir, 0755);
             !r && r.error() != std::errc::file_exists) {
         LOGE("%s: Failed to create directory: %s",
-             BACKUP_MNT_DIR, strerror(errno));
+             mount_dir.c_str(), strerror(errno));
         return false;
     }
 
-    fsck_ext4_image(image);
+    // A freshly created image has nothing to check
+    if (!created) {
+        fsck_ext4_image(image);
+    }
 
-    if (auto ret = util::mount(image, BACKUP_MNT_DIR, "ext4", 0, ""); !ret) {
-        LOGE("Failed to mount %s at %s: %s", image.c_str(), BACKUP_MNT_DIR,
+    if (auto ret = util::mount(image, mount_dir, "ext4", 0, ""); !ret) {
+        LOGE("Failed to mount %s at %s: %s", image.c_str(), mount_dir.c_str(),
              ret.error().message().c_str());
         return false;
     }
 
-    bool ret = restore_directory(input_file, BACKUP_MNT_DIR, exclusions,
-                                 compression, is_split);
+    bool ret = restore_directory(input_file, mount_dir, exclusions,
+                                 compression, layout, only);
 
-    if (auto umount_ret = util::umount(BACKUP_MNT_DIR); !umount_ret) {
-        LOGE("Failed to unmount %s: %s", BACKUP_MNT_DIR,
+    if (auto umount_ret = util::umount(mount_dir); !umount_ret) {
+        LOGE("Failed to unmount %s: %s", mount_dir.c_str(),
              umount_ret.error().message().c_str());
         return false;
     }
 
-    rmdir(BACKUP_MNT_DIR);
+    remove_image_mount_dir(mount_dir);
 
     return ret;
 }
@@ -509,8 +679,7 @@ static Result restore_configs(const std::shared_ptr<Rom> &rom,
  * \param archive_name Backup archive name
  * \param is_image Whether \a path is an ext4 image
  * \param exclusions List of top-level directories to exclude from the backup
- * \param compression Compression type
- * \param split_archive_size Max size for each split file
+ * \param options Archive creation options
  *
  * \return Result::Succeeded if the directory/image was successfully backed up
  *         Result::Failed if an error occured
@@ -521,8 +690,7 @@ static Result backup_partition(const std::string &path,
                                const std::string &archive_name,
                                bool is_image,
                                const std::vector<std::string> &exclusions,
-                               util::CompressionType compression,
-                               uint64_t split_archive_size)
+                               const ArchiveOptions &options)
 {
     std::string archive(backup_dir);
     archive += '/';
@@ -533,12 +701,13 @@ static Result backup_partition(const std::string &path,
     struct stat sb;
     if (stat(path.c_str(), &sb) == 0) {
         LOGI("=== Backing up %s ===", path.c_str());
-        if (is_image) {
-            ret = backup_image(archive, path, exclusions, compression,
-                               split_archive_size);
+        if (is_image && options.image_blocks) {
+            fsck_ext4_image(path);
+            ret = backup_ext4_image_blocks(path, archive);
+        } else if (is_image) {
+            ret = backup_image(archive, path, exclusions, options);
         } else {
-            ret = backup_directory(archive, path, exclusions, compression,
-                                   split_archive_size);
+            ret = backup_directory(archive, path, exclusions, options);
         }
     } else {
         LOGW("=== %s does not exist ===", path.c_str());
@@ -558,13 +727,48 @@ static Result backup_partition(const std::string &path,
  * \param exclusions List of top-level directories to exclude from the wipe
  *                   process before restoring
  * \param compression Compression type
- * \param is_split Whether the archive is split into multiple chunks
+ * \param layout Whether the archive is split or segmented
+ * \param only If not empty, only restore these paths without wiping
  *
  * \return Result::Succeeded if the directory/image was successfully restored
  *         Result::Failed if an error occured
  *         Result::FilesMissing if \a archive_name does not exist in
  *         \a backup_dir
  */
+/*!
+ * \brief Get the total size of the files of an archive backup
+ *
+ * \return Size in bytes or 0 if it is not known (eg. for chunked backups)
+ */
+static uint64_t get_backup_size(const std::string &archive,
+                                ArchiveLayout layout)
+{
+    struct stat sb;
+
+    switch (layout) {
+    case ArchiveLayout::Single:
+    case ArchiveLayout::SparseImage:
+        return stat(archive.c_str(), &sb) == 0
+                ? static_cast<uint64_t>(sb.st_size) : 0;
+    case ArchiveLayout::Chunked:
+        return 0;
+    default:
+        break;
+    }
+
+    std::string prefix(archive);
+    prefix += layout == ArchiveLayout::Split ? "." : ".seg";
+
+    uint64_t size = 0;
+
+    for (unsigned int i = 0;
+            stat((prefix + std::to_string(i)).c_str(), &sb) == 0; ++i) {
+        size += static_cast<uint64_t>(sb.st_size);
+    }
+
+    return size;
+}
+
 static Result restore_partition(const std::string &path,
                                 const std::string &backup_dir,
                                 const std::string &archive_name,
@@ -572,26 +776,41 @@ static Result restore_partition(const std::string &path,
                                 uint64_t image_size,
                                 const std::vector<std::string> &exclusions,
                                 util::CompressionType compression,
-                                bool is_split)
+                                ArchiveLayout layout,
+                                const std::vector<std::string> &only)
 {
     std::string archive(backup_dir);
     archive += '/';
     archive += archive_name;
 
-    std::string split_archive(archive);
-    split_archive += ".0";
+    std::string first_file(archive);
+    if (layout == ArchiveLayout::Split) {
+        first_file += ".0";
+    } else if (layout == ArchiveLayout::Segmented) {
+        first_file += util::ARCHIVE_SEGMENTS_SUFFIX;
+    }
 
     bool ret = false;
 
     struct stat sb;
-    if (stat(is_split ? split_archive.c_str() : archive.c_str(), &sb) == 0) {
+    if (stat(first_file.c_str(), &sb) == 0) {
         LOGI("=== Restoring to %s ===", path.c_str());
-        if (is_image) {
+        util::metrics_set_expected_read_bytes(
+                get_backup_size(archive, layout));
+        if (layout == ArchiveLayout::SparseImage && !only.empty()) {
+            LOGE("%s: Selective restore is only supported for archive backups",
+                 archive.c_str());
+        } else if (layout == ArchiveLayout::SparseImage && !is_image) {
+            LOGE("%s: Image backups can only be restored to image ROMs",
+                 archive.c_str());
+        } else if (layout == ArchiveLayout::SparseImage) {
+            ret = restore_ext4_image_blocks(archive, path);
+        } else if (is_image) {
             ret = restore_image(archive, path, image_size, exclusions,
-                                compression, is_split);
+                                compression, layout, only);
         } else {
             ret = restore_directory(archive, path, exclusions, compression,
-                                    is_split);
+                                    layout, only);
         }
     } else {
         LOGW("=== %s does not exist ===", archive.c_str());
@@ -601,10 +820,96 @@ static Result restore_partition(const std::string &path,
     return ret ? Result::Succeeded : Result::Failed;
 }
 
+/*!
+ * \brief Backup or restore jobs for independent targets
+ *
+ * When run sequentially, the jobs stop at the first failure. When run in
+ * parallel, each job runs to completion as a task on the global executor.
+ */
+class TargetJobs
+{
+public:
+    void add(std::string name, std::function<Result()> fn)
+    {
+        _jobs.push_back({std::move(name), std::move(fn)});
+    }
+
+    bool run(bool parallel) const
+    {
+        auto parent = util::MetricsStage::current();
+
+        if (!parallel || _jobs.size() <= 1) {
+            for (auto const &job : _jobs) {
+                if (run_job(job, parent) == Result::Failed) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        std::vector<Result> results(_jobs.size(), Result::Failed);
+        TaskGroup group;
+
+        for (size_t i = 0; i < _jobs.size(); ++i) {
+            group.run([&, i] {
+                results[i] = run_job(_jobs[i], parent);
+            });
+        }
+
+        group.wait();
+
+        return std::none_of(results.begin(), results.end(),
+                            [](Result r) { return r == Result::Failed; });
+    }
+
+private:
+    struct Job
+    {
+        std::string name;
+        std::function<Result()> fn;
+    };
+
+    std::vector<Job> _jobs;
+
+    static Result run_job(const Job &job,
+                          std::shared_ptr<util::StageMetrics> parent)
+    {
+        using namespace std::chrono;
+
+        util::MetricsStage stage(job.name, std::move(parent));
+
+        auto start = steady_clock::now();
+        Result ret = job.fn();
+        auto elapsed = duration_cast<duration<double>>(
+                steady_clock::now() - start).count();
+
+        if (ret == Result::Failed) {
+            LOGE("=== [%s] Failed after %.1f seconds ===",
+                 job.name.c_str(), elapsed);
+        } else {
+            LOGI("=== [%s] Finished in %.1f seconds ===",
+                 job.name.c_str(), elapsed);
+        }
+
+        return ret;
+    }
+};
+
+static std::string get_backup_name(const std::string &name, bool is_image,
+                                   const ArchiveOptions &options)
+{
+    if (is_image && options.image_blocks) {
+        return name + SPARSE_IMAGE_SUFFIX;
+    } else if (options.chunk_store) {
+        return name + CHUNKED_BACKUP_SUFFIX;
+    } else {
+        return get_compressed_backup_name(name, options.compression);
+    }
+}
+
 static bool backup_rom(const std::shared_ptr<Rom> &rom,
                        const std::string &output_dir, BackupTargets targets,
-                       util::CompressionType compression,
-                       uint64_t split_archive_size)
+                       const ArchiveOptions &options, bool parallel)
 {
     if (!targets) {
         LOGE("No backup targets specified");
@@ -639,12 +944,16 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
     }
     LOGI("- Backup directory: %s", output_dir.c_str());
 
-    std::string output_system = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_SYSTEM, compression);
-    std::string output_cache = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_CACHE, compression);
-    std::string output_data = get_compressed_backup_name(
-            BACKUP_NAME_PREFIX_DATA, compression);
+    if (options.chunk_store) {
+        LOGI("- Chunk store: %s", options.chunk_store->path().c_str());
+    }
+
+    std::string output_system = get_backup_name(
+            BACKUP_NAME_PREFIX_SYSTEM, rom->system_is_image, options);
+    std::string output_cache = get_backup_name(
+            BACKUP_NAME_PREFIX_CACHE, rom->cache_is_image, options);
+    std::string output_data = get_backup_name(
+            BACKUP_NAME_PREFIX_DATA, rom->data_is_image, options);
 
     // Backup boot image
     if (targets & BackupTarget::Boot
@@ -658,44 +967,59 @@ static bool backup_rom(const std::shared_ptr<Rom> &rom,
         return false;
     }
 
+    // Split the compression threads between the targets that run at the
+    // same time
+    ArchiveOptions target_options = options;
+    unsigned int partitions = 0;
+    for (auto target : { BackupTarget::System, BackupTarget::Cache,
+                         BackupTarget::Data }) {
+        if (targets & target) {
+            ++partitions;
+        }
+    }
+    if (parallel && partitions > 1) {
+        unsigned int total = options.threads != 0
+                ? options.threads
+                : Executor::global().concurrency();
+        target_options.threads = std::max(total / partitions, 1u);
+    }
+
+    TargetJobs jobs;
+
     // Backup system
     if (targets & BackupTarget::System) {
-        Result ret = backup_partition(
-                system_path, output_dir, output_system,
-                rom->system_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        jobs.add("system", [&] {
+            return backup_partition(
+                    system_path, output_dir, output_system,
+                    rom->system_is_image, { "multiboot" }, target_options);
+        });
     }
 
     // Backup cache
     if (targets & BackupTarget::Cache) {
-        Result ret = backup_partition(
-                cache_path, output_dir, output_cache,
-                rom->cache_is_image, { "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        jobs.add("cache", [&] {
+            return backup_partition(
+                    cache_path, output_dir, output_cache,
+                    rom->cache_is_image, { "multiboot" }, target_options);
+        });
     }
 
     // Backup data
     if (targets & BackupTarget::Data) {
-        Result ret = backup_partition(
-                data_path, output_dir, output_data,
-                rom->data_is_image, { "media", "multiboot" }, compression,
-                split_archive_size);
-        if (ret == Result::Failed) {
-            return false;
-        }
+        jobs.add("data", [&] {
+            return backup_partition(
+                    data_path, output_dir, output_data,
+                    rom->data_is_image, { "media", "multiboot" },
+                    target_options);
+        });
     }
 
-    return true;
+    return jobs.run(parallel);
 }
 
 static bool restore_rom(const std::shared_ptr<Rom> &rom,
-                        const std::string &input_dir, BackupTargets targets)
+                        const std::string &input_dir, BackupTargets targets,
+                        bool parallel, const std::vector<std::string> &only)
 {
     if (!targets) {
         LOGE("No restore targets specified");
@@ -729,6 +1053,9 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
         LOGI("             %s", thumbnail_path.c_str());
     }
     LOGI("- Backup directory: %s", input_dir.c_str());
+    for (auto const &path : only) {
+        LOGI("- Only: %s", path.c_str());
+    }
 
     std::string multiboot_dir(MULTIBOOT_DIR);
     multiboot_dir += '/';
@@ -753,7 +1080,19 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
 
     fix_multiboot_permissions();
 
-    // Restore system
+    // Find all of the backups before restoring anything
+    struct PartitionBackup
+    {
+        std::string path;
+        util::CompressionType compression;
+        ArchiveLayout layout;
+    };
+
+    PartitionBackup system_backup;
+    PartitionBackup cache_backup;
+    PartitionBackup data_backup;
+    uint64_t system_image_size = 0;
+
     if (targets & BackupTarget::System) {
         auto image_size = util::mount_get_total_size(
                 Roms::get_system_partition());
@@ -761,66 +1100,133 @@ static bool restore_rom(const std::shared_ptr<Rom> &rom,
             LOGE("Failed to get the size of the system partition");
             return false;
         }
+        system_image_size = image_size.value();
 
-        util::CompressionType compression;
-        bool is_split;
-
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_SYSTEM, compression, is_split);
-        if (path.empty()) {
+        system_backup.path = find_compressed_backup(
+                input_dir, BACKUP_NAME_PREFIX_SYSTEM,
+                system_backup.compression, system_backup.layout);
+        if (system_backup.path.empty()) {
             LOGE("Backup of /system not found");
             return false;
         }
-
-        Result ret = restore_partition(
-                system_path, input_dir, path, rom->system_is_image,
-                image_size.value(), {}, compression, is_split);
-        if (ret == Result::Failed) {
-            return false;
-        }
     }
 
-    // Restore cache
     if (targets & BackupTarget::Cache) {
-        util::CompressionType compression;
-        bool is_split;
-
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_CACHE, compression, is_split);
-        if (path.empty()) {
+        cache_backup.path = find_compressed_backup(
+                input_dir, BACKUP_NAME_PREFIX_CACHE,
+                cache_backup.compression, cache_backup.layout);
+        if (cache_backup.path.empty()) {
             LOGE("Backup of /cache not found");
             return false;
         }
+    }
 
-        Result ret = restore_partition(
-                cache_path, input_dir, path, rom->cache_is_image,
-                DEFAULT_IMAGE_SIZE, {}, compression, is_split);
-        if (ret == Result::Failed) {
+    if (targets & BackupTarget::Data) {
+        data_backup.path = find_compressed_backup(
+                input_dir, BACKUP_NAME_PREFIX_DATA,
+                data_backup.compression, data_backup.layout);
+        if (data_backup.path.empty()) {
+            LOGE("Backup of /data not found");
             return false;
         }
     }
 
+    TargetJobs jobs;
+
+    // Restore system
+    if (targets & BackupTarget::System) {
+        jobs.add("system", [&] {
+            return restore_partition(
+                    system_path, input_dir, system_backup.path,
+                    rom->system_is_image, system_image_size, {},
+                    system_backup.compression, system_backup.layout, only);
+        });
+    }
+
+    // Restore cache
+    if (targets & BackupTarget::Cache) {
+        jobs.add("cache", [&] {
+            return restore_partition(
+                    cache_path, input_dir, cache_backup.path,
+                    rom->cache_is_image, DEFAULT_IMAGE_SIZE, {},
+                    cache_backup.compression, cache_backup.layout, only);
+        });
+    }
+
     // Restore data
     if (targets & BackupTarget::Data) {
+        jobs.add("data", [&] {
+            return restore_partition(
+                    data_path, input_dir, data_backup.path,
+                    rom->data_is_image, DEFAULT_IMAGE_SIZE, { "media" },
+                    data_backup.compression, data_backup.layout, only);
+        });
+    }
+
+    return jobs.run(parallel);
+}
+
+/*!
+ * \brief Check archives of a backup against their indexes
+ *
+ * Targets that are missing from the backup are skipped.
+ */
+static bool verify_backup(const std::string &backup_dir, BackupTargets targets)
+{
+    static constexpr std::pair<BackupTarget, const char *> partitions[] = {
+        { BackupTarget::System, BACKUP_NAME_PREFIX_SYSTEM },
+        { BackupTarget::Cache, BACKUP_NAME_PREFIX_CACHE },
+        { BackupTarget::Data, BACKUP_NAME_PREFIX_DATA },
+    };
+
+    bool ret = true;
+
+    for (auto const &[target, name] : partitions) {
+        if (!(targets & target)) {
+            continue;
+        }
+
         util::CompressionType compression;
-        bool is_split;
+        ArchiveLayout layout;
 
-        std::string path = find_compressed_backup(
-                input_dir, BACKUP_NAME_PREFIX_DATA, compression, is_split);
-        if (path.empty()) {
-            LOGE("Backup of /data not found");
-            return false;
+        std::string archive_name = find_compressed_backup(
+                backup_dir, name, compression, layout);
+        if (archive_name.empty()) {
+            LOGW("=== Backup of /%s not found ===", name);
+            continue;
         }
 
-        Result ret = restore_partition(
-                data_path, input_dir, path, rom->data_is_image,
-                DEFAULT_IMAGE_SIZE, { "media" }, compression, is_split);
-        if (ret == Result::Failed) {
-            return false;
+        std::string archive(backup_dir);
+        archive += '/';
+        archive += archive_name;
+
+        LOGI("=== Verifying %s ===", archive.c_str());
+
+        bool verified;
+
+        switch (layout) {
+        case ArchiveLayout::Single:
+        case ArchiveLayout::Split:
+            verified = util::libarchive_tar_verify(
+                    archive, compression, layout == ArchiveLayout::Split);
+            break;
+        case ArchiveLayout::Segmented:
+            verified = util::libarchive_tar_verify_segments(
+                    archive, compression);
+            break;
+        default:
+            LOGW("%s: Verification is only supported for archive backups",
+                 archive.c_str());
+            continue;
+        }
+
+        if (!verified) {
+            LOGE("=== %s is corrupted ===", archive.c_str());
+            ret = false;
         }
     }
 
-    return true;
+    return ret;
 }
 
 static bool unshare_mount_namespace()
@@ -894,6 +1300,38 @@ static bool is_non_empty_dir(const std::string &path)
     return false;
 }
 
+/*!
+ * \brief Apply the scheduling policy for backing up or restoring
+ *
+ * If no policy is specified, the work runs on the fastest CPUs in recovery and
+ * in the background once Android has booted so that it does not compete with
+ * the foreground.
+ */
+static void apply_sched_policy(std::optional<util::SchedPolicy> policy)
+{
+    if (!policy) {
+        policy = util::property_get_string("sys.boot_completed", {}) == "1"
+                ? util::SchedPolicy::Background
+                : util::SchedPolicy::Performance;
+    }
+
+    if (auto r = util::set_sched_policy(*policy); !r) {
+        LOGW("Failed to set scheduling policy: %s",
+             r.error().message().c_str());
+    }
+}
+
+static bool parse_sched_policy(const char *str,
+                               std::optional<util::SchedPolicy> &policy)
+{
+    policy = util::sched_policy_from_string(str);
+    if (!policy) {
+        fprintf(stderr, "Invalid scheduling policy: %s\n", str);
+        return false;
+    }
+    return true;
+}
+
 static void warn_selinux_context()
 {
     // We do not need to patch the SELinux policy or switch to mb_exec because
@@ -919,13 +1357,42 @@ static void backup_usage(FILE *stream)
             "                   Comma-separated list of targets to backup\n"
             "                   (Default: 'all')\n"
             "  -c, --compression <compression type>\n"
-            "                   Compression type (none, lz4, gzip, xz)\n"
+            "                   Compression type (none, lz4, gzip, xz, zstd)\n"
             "                   (Default: lz4)\n"
+            "  -l, --level <level>\n"
+            "                   Compression level (Default: compressor's default)\n"
             "  -s, --split-size <size>\n"
             "                   Split archive maximum size in bytes (0 to disable)\n"
             "                   (Default: %" PRIu64 " bytes)\n"
+            "  -j, --threads <threads>\n"
+            "                   Number of compression threads (0 for one per CPU)\n"
+            "                   (Default: 1)\n"
+            "  -p, --segmented  Write one independently compressed archive segment\n"
+            "                   per thread. Segments are created and restored in\n"
+            "                   parallel\n"
+            "  -P, --parallel   Back up system, cache, and data at the same time.\n"
+            "                   The compression threads are split between them\n"
+            "  -S, --chunk-store <directory>\n"
+            "                   Store system, cache, and data incrementally in a\n"
+            "                   deduplicating chunk store shared between backups\n"
+            "                   instead of creating archives\n"
+            "  -I, --image-blocks\n"
+            "                   Back up the allocated blocks of image-based\n"
+            "                   partitions as sparse images instead of archiving\n"
+            "                   their files. Nothing is excluded\n"
             "  -d, --backupdir <directory>\n"
             "                   Directory to store backup\n"
+            "  -V, --verify     Verify the archives in the backup directory against\n"
+            "                   their indexes instead of creating a backup\n"
+            "  -J, --stats-json <file>\n"
+            "                   Write the throughput and time of each stage to a\n"
+            "                   JSON file\n"
+            "  --sched <policy>\n"
+            "                   Scheduling policy (default, performance, background)\n"
+            "                   (Default: performance in recovery, background in\n"
+            "                   Android)\n"
+            "  --low-memory     Use fewer threads and smaller buffers (Default:\n"
+            "                   enabled on devices with 1 GiB of RAM or less)\n"
             "  -f, --force      Allow overwriting old backup with the same name\n"
             "  -h, --help       Display this help message\n"
             "\n"
@@ -949,6 +1416,21 @@ static void restore_usage(FILE *stream)
             "                   (Default: 'all')\n"
             "  -d, --backupdir <directory>\n"
             "                   Backup directory to restore from\n"
+            "  -P, --parallel   Restore system, cache, and data at the same time\n"
+            "  -o, --only <path>\n"
+            "                   Only restore this path (relative to the root of\n"
+            "                   each target) on top of the existing files. Can be\n"
+            "                   specified multiple times. Only the system, cache,\n"
+            "                   and data targets can be used\n"
+            "  -J, --stats-json <file>\n"
+            "                   Write the throughput and time of each stage to a\n"
+            "                   JSON file\n"
+            "  --sched <policy>\n"
+            "                   Scheduling policy (default, performance, background)\n"
+            "                   (Default: performance in recovery, background in\n"
+            "                   Android)\n"
+            "  --low-memory     Use fewer threads and smaller buffers (Default:\n"
+            "                   enabled on devices with 1 GiB of RAM or less)\n"
             "  -h, --help       Display this help message\n"
             "\n"
             "Valid backup targets: 'all' or some combination of the following:\n"
@@ -962,15 +1444,30 @@ int backup_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:c:d:s:fh";
+    enum options : int {
+        OPTION_SCHED            = CHAR_MAX + 1,
+        OPTION_LOW_MEMORY,
+    };
+
+    static const char *short_options = "r:t:c:l:d:s:j:pPS:IVJ:fh";
     static struct option long_options[] = {
         {"romid",       required_argument, 0, 'r'},
         {"targets",     required_argument, 0, 't'},
         {"compression", required_argument, 0, 'c'},
+        {"level",       required_argument, 0, 'l'},
         {"backupdir",   required_argument, 0, 'd'},
         {"split-size",  required_argument, 0, 's'},
+        {"threads",     required_argument, 0, 'j'},
+        {"segmented",   no_argument,       0, 'p'},
+        {"parallel",    no_argument,       0, 'P'},
+        {"chunk-store", required_argument, 0, 'S'},
+        {"image-blocks", no_argument,      0, 'I'},
+        {"verify",      no_argument,       0, 'V'},
+        {"stats-json",  required_argument, 0, 'J'},
         {"force",       no_argument,       0, 'f'},
         {"help",        no_argument,       0, 'h'},
+        {"sched",       required_argument, 0, OPTION_SCHED},
+        {"low-memory",  no_argument,       0, OPTION_LOW_MEMORY},
         {0, 0, 0, 0}
     };
 
@@ -979,9 +1476,13 @@ int backup_main(int argc, char *argv[])
     std::string romid;
     std::string targets_str("all");
     std::string backupdir;
-    util::CompressionType compression = util::CompressionType::Lz4;
-    uint64_t split_archive_size = DEFAULT_ARCHIVE_SPLIT_SIZE;
+    std::string chunk_store_dir;
+    std::string stats_json;
+    ArchiveOptions options;
+    bool parallel = false;
+    bool verify = false;
     bool force = false;
+    std::optional<util::SchedPolicy> sched_policy;
 
     while ((opt = getopt_long(argc, argv, short_options,
             long_options, &long_index)) != -1) {
@@ -993,23 +1494,61 @@ int backup_main(int argc, char *argv[])
             targets_str = optarg;
             break;
         case 'c':
-            if (!parse_compression_type(optarg, compression)) {
+            if (!parse_compression_type(optarg, options.compression)) {
                 fprintf(stderr, "Invalid compression type: %s\n", optarg);
                 return EXIT_FAILURE;
             }
             break;
+        case 'l':
+            if (!str_to_num(optarg, 10, options.level) || options.level < 0) {
+                fprintf(stderr, "Invalid compression level: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'd':
             backupdir = optarg;
             break;
         case 's':
-            if (!str_to_num(optarg, 10, split_archive_size)) {
+            if (!str_to_num(optarg, 10, options.split_archive_size)) {
                 fprintf(stderr, "Invalid split size: %s\n", optarg);
                 return EXIT_FAILURE;
             }
             break;
+        case 'j':
+            if (!str_to_num(optarg, 10, options.threads)) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'p':
+            options.segmented = true;
+            break;
+        case 'P':
+            parallel = true;
+            break;
+        case 'S':
+            chunk_store_dir = optarg;
+            break;
+        case 'I':
+            options.image_blocks = true;
+            break;
+        case 'V':
+            verify = true;
+            break;
+        case 'J':
+            stats_json = optarg;
+            break;
         case 'f':
             force = true;
             break;
+        case OPTION_SCHED:
+            if (!parse_sched_policy(optarg, sched_policy)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPTION_LOW_MEMORY:
+            ResourceBudget::global().set_low_memory(true);
+            break;
         case 'h':
             backup_usage(stdout);
             return EXIT_SUCCESS;
@@ -1025,7 +1564,7 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    if (romid.empty()) {
+    if (romid.empty() && !verify) {
         fprintf(stderr, "No ROM ID specified\n");
         return EXIT_FAILURE;
     }
@@ -1041,6 +1580,30 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    apply_sched_policy(sched_policy);
+
+    if (verify) {
+        bool ret;
+        {
+            util::MetricsStage stage("verify");
+            util::MetricsReporter reporter(METRICS_REPORT_INTERVAL);
+
+            ret = verify_backup(backupdir, targets);
+        }
+
+        if (!stats_json.empty() && !write_stats_json(stats_json)) {
+            ret = false;
+        }
+
+        if (ret) {
+            LOGI("=== Verified ===");
+            return EXIT_SUCCESS;
+        } else {
+            LOGI("=== Verification failed ===");
+            return EXIT_FAILURE;
+        }
+    }
+
     warn_selinux_context();
 
     if (!unshare_mount_namespace()) {
@@ -1073,8 +1636,28 @@ int backup_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = backup_rom(rom, backupdir, targets, compression,
-                          split_archive_size);
+    ChunkStore chunk_store;
+    if (!chunk_store_dir.empty()) {
+        if (!chunk_store.open(chunk_store_dir, true)) {
+            fprintf(stderr, "%s: Failed to open chunk store\n",
+                    chunk_store_dir.c_str());
+            return EXIT_FAILURE;
+        }
+        options.chunk_store = &chunk_store;
+    }
+
+    bool ret;
+    {
+        util::MetricsStage stage("backup");
+        util::MetricsReporter reporter(METRICS_REPORT_INTERVAL);
+
+        ret = backup_rom(rom, backupdir, targets, options, parallel);
+    }
+
+    if (!stats_json.empty() && !write_stats_json(stats_json)) {
+        ret = false;
+    }
+
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -1088,12 +1671,22 @@ int restore_main(int argc, char *argv[])
 {
     int opt;
 
-    static const char *short_options = "r:t:d:h";
+    enum options : int {
+        OPTION_SCHED            = CHAR_MAX + 1,
+        OPTION_LOW_MEMORY,
+    };
+
+    static const char *short_options = "r:t:d:Po:J:h";
     static struct option long_options[] = {
         {"romid",     required_argument, 0, 'r'},
         {"targets",   required_argument, 0, 't'},
         {"backupdir", required_argument, 0, 'd'},
+        {"parallel",  no_argument,       0, 'P'},
+        {"only",      required_argument, 0, 'o'},
+        {"stats-json", required_argument, 0, 'J'},
         {"help",      no_argument,       0, 'h'},
+        {"sched",     required_argument, 0, OPTION_SCHED},
+        {"low-memory", no_argument,      0, OPTION_LOW_MEMORY},
         {0, 0, 0, 0}
     };
 
@@ -1102,6 +1695,10 @@ int restore_main(int argc, char *argv[])
     std::string romid;
     std::string targets_str("all");
     std::string backupdir;
+    std::vector<std::string> only;
+    std::string stats_json;
+    bool parallel = false;
+    std::optional<util::SchedPolicy> sched_policy;
 
     while ((opt = getopt_long(argc, argv, short_options,
             long_options, &long_index)) != -1) {
@@ -1115,6 +1712,23 @@ int restore_main(int argc, char *argv[])
         case 'd':
             backupdir = optarg;
             break;
+        case 'P':
+            parallel = true;
+            break;
+        case 'o':
+            only.push_back(optarg);
+            break;
+        case 'J':
+            stats_json = optarg;
+            break;
+        case OPTION_SCHED:
+            if (!parse_sched_policy(optarg, sched_policy)) {
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPTION_LOW_MEMORY:
+            ResourceBudget::global().set_low_memory(true);
+            break;
         case 'h':
             restore_usage(stdout);
             return EXIT_SUCCESS;
@@ -1146,6 +1760,15 @@ int restore_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    if (!only.empty() && (targets & (BackupTarget::Boot
+            | BackupTarget::Config))) {
+        fprintf(stderr, "-o/--only can only be used with the system, cache,"
+                " and data targets\n");
+        return EXIT_FAILURE;
+    }
+
+    apply_sched_policy(sched_policy);
+
     warn_selinux_context();
 
     if (!unshare_mount_namespace()) {
@@ -1174,7 +1797,18 @@ int restore_main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    bool ret = restore_rom(rom, backupdir, targets);
+    bool ret;
+    {
+        util::MetricsStage stage("restore");
+        util::MetricsReporter reporter(METRICS_REPORT_INTERVAL);
+
+        ret = restore_rom(rom, backupdir, targets, parallel, only);
+    }
+
+    if (!stats_json.empty() && !write_stats_json(stats_json)) {
+        ret = false;
+    }
+
     if (ret) {
         LOGI("=== Finished ===");
         return EXIT_SUCCESS;
@@ -1184,4 +1818,74 @@ int restore_main(int argc, char *argv[])
     }
 }
 
+static void backup_gc_usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: backup-gc <chunk store directory> [OPTION...]\n\n"
+            "Remove chunks that are no longer used by any backup.\n\n"
+            "Options:\n"
+            "  -s, --search <directory>\n"
+            "                   Directory to search for backups that were moved\n"
+            "                   (can be specified more than once)\n"
+            "                   (default: parent of the chunk store)\n"
+            "  -p, --prune      Treat backups that can't be found as deleted\n"
+            "  -h, --help       Display this help message\n"
+            "\n"
+            "If a backup can't be found, no chunks are removed unless\n"
+            "-p/--prune is passed.\n");
+}
+
+int backup_gc_main(int argc, char *argv[])
+{
+    int opt;
+
+    std::vector<std::string> search_dirs;
+    bool prune = false;
+
+    static const char *short_options = "s:ph";
+    static struct option long_options[] = {
+        {"search", required_argument, 0, 's'},
+        {"prune",  no_argument,       0, 'p'},
+        {"help",   no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(argc, argv, short_options,
+            long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's':
+            search_dirs.emplace_back(optarg);
+            break;
+        case 'p':
+            prune = true;
+            break;
+        case 'h':
+            backup_gc_usage(stdout);
+            return EXIT_SUCCESS;
+        default:
+            backup_gc_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        backup_gc_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    ChunkStore chunk_store;
+    if (!chunk_store.open(argv[optind], false)) {
+        fprintf(stderr, "%s: Failed to open chunk store\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if (search_dirs.empty()) {
+        search_dirs.push_back(util::dir_name(chunk_store.path()));
+    }
+
+    return chunk_store.gc(search_dirs, prune) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 }
@@ -19,151 +19,39 @@
 
 #include "recovery/bootimg_util.h"
 
-#include <cerrno>
-#include <cstdio>
-#include <cstring>
-
-#include <unistd.h>
-
 #include "mblog/logging.h"
 
 #define LOG_TAG "mbtool/recovery/bootimg_util"
 
-#define BUF_SIZE    10240
-
-typedef std::unique_ptr<FILE, decltype(fclose) *> ScopedFILE;
-
 using namespace mb::bootimg;
 
 namespace mb
 {
 
-bool bi_copy_data_to_fd(Reader &reader, int fd)
-{
-    char buf[BUF_SIZE];
-
-    while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read boot image entry data: %s",
-                 n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
-
-        size_t remain = n_read.value();
-
-        while (remain > 0) {
-            ssize_t n_written = write(
-                    fd, buf + (n_read.value() - remain), remain);
-            if (n_written <= 0) {
-                LOGE("Failed to write data: %s", strerror(errno));
-                return false;
-            }
-
-            remain -= static_cast<size_t>(n_written);
-        }
-    }
-
-    return true;
-}
-
-bool bi_copy_file_to_data(const std::string &path, Writer &writer)
+/*!
+ * \brief Read the data of the current entry into memory
+ */
+bool bi_read_data(Reader &reader, std::vector<unsigned char> &data_out)
 {
-    ScopedFILE fp(fopen(path.c_str(), "rbe"), fclose);
-    if (!fp) {
-        LOGE("%s: Failed to open for reading: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    char buf[10240];
-    size_t n;
+    data_out.clear();
 
     while (true) {
-        n = fread(buf, 1, sizeof(buf), fp.get());
-
-        auto bytes_written = writer.write_data(buf, n);
-        if (!bytes_written) {
-            LOGE("Failed to write entry data: %s",
-                 bytes_written.error().message().c_str());
-            return false;
-        }
-
-        if (n < sizeof(buf)) {
-            if (ferror(fp.get())) {
-                LOGE("%s: Failed to read file: %s",
-                     path.c_str(), strerror(errno));
-            } else {
-                break;
-            }
-        }
-    }
-
-    return true;
-}
-
-bool bi_copy_data_to_file(Reader &reader, const std::string &path)
-{
-    ScopedFILE fp(fopen(path.c_str(), "wbe"), fclose);
-    if (!fp) {
-        LOGE("%s: Failed to open for writing: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    char buf[10240];
+        size_t pos = data_out.size();
+        data_out.resize(pos + 65536);
 
-    while (true) {
-        auto n = reader.read_data(buf, sizeof(buf));
+        auto n = reader.read_data(data_out.data() + pos, 65536);
         if (!n) {
             LOGE("Failed to read entry data: %s",
                  n.error().message().c_str());
             return false;
-        } else if (n.value() == 0) {
-            break;
-        }
-
-        if (fwrite(buf, 1, n.value(), fp.get()) != n.value()) {
-            LOGE("%s: Failed to write data: %s",
-                 path.c_str(), strerror(errno));
-            return false;
         }
-    }
-
-    if (fclose(fp.release()) < 0) {
-        LOGE("%s: Failed to close file: %s",
-             path.c_str(), strerror(errno));
-        return false;
-    }
-
-    return true;
-}
-
-bool bi_copy_data_to_data(Reader &reader, Writer &writer)
-{
-    char buf[10240];
 
-    while (true) {
-        auto n_read = reader.read_data(buf, sizeof(buf));
-        if (!n_read) {
-            LOGE("Failed to read boot image entry data: %s",
-                 n_read.error().message().c_str());
-            return false;
-        } else if (n_read.value() == 0) {
-            break;
-        }
+        data_out.resize(pos + n.value());
 
-        auto n_written = writer.write_data(buf, n_read.value());
-        if (!n_written) {
-            LOGE("Failed to write entry data: %s",
-                 n_written.error().message().c_str());
-            return false;
+        if (n.value() == 0) {
+            return true;
         }
     }
-
-    return true;
 }
 
 }
@@ -0,0 +1,1648 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/chunk_store.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "mbcommon/common.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/fts.h"
+#include "mbutil/metrics.h"
+#include "mbutil/path.h"
+#include "mbutil/string.h"
+
+#define LOG_TAG "mbtool/recovery/chunk_store"
+
+namespace mb
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+constexpr char MANIFEST_MAGIC[] = "mbtool-chunk-manifest 2";
+// Version 1 manifests have no ID line
+constexpr char MANIFEST_MAGIC_V1[] = "mbtool-chunk-manifest 1";
+
+// Suffix of manifests that gc() looks for when a backup was moved
+constexpr char MANIFEST_SUFFIX[] = ".manifest";
+
+// Suffix of refs of backups that have not finished yet
+constexpr char REF_PENDING_SUFFIX[] = ".pending";
+
+constexpr size_t REF_ID_SIZE = 16;
+
+// Chunk sizes for the content-defined chunking. The average is 64 KiB.
+constexpr size_t CHUNK_MIN_SIZE = 16 * 1024;
+constexpr size_t CHUNK_MAX_SIZE = 256 * 1024;
+constexpr uint64_t CHUNK_BOUNDARY_MASK = (1ull << 16) - 1;
+
+constexpr size_t FILE_BUF_SIZE = 1024 * 1024;
+
+/*!
+ * \brief Random values for the gear rolling hash
+ *
+ * These are generated with splitmix64 from a fixed seed. They must never change
+ * or new backups could no longer share chunks with old ones.
+ */
+static constexpr std::array<uint64_t, 256> make_gear_table()
+{
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x6d62746f6f6c3132;
+
+    for (auto &value : table) {
+        state += 0x9e3779b97f4a7c15;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        value = z ^ (z >> 31);
+    }
+
+    return table;
+}
+
+static constexpr auto g_gear = make_gear_table();
+
+/*!
+ * \brief Split a byte stream into content-defined chunks
+ *
+ * A chunk ends where the rolling hash satisfies the boundary mask, so an
+ * insertion or deletion only changes the chunks around it.
+ */
+class Chunker
+{
+public:
+    template<typename Fn>
+    bool feed(const unsigned char *data, size_t size, Fn &&emit)
+    {
+        size_t start = 0;
+
+        for (size_t i = 0; i < size; ++i) {
+            _hash = (_hash << 1) + g_gear[data[i]];
+            ++_pending;
+
+            if ((_pending >= CHUNK_MIN_SIZE
+                    && (_hash & CHUNK_BOUNDARY_MASK) == 0)
+                    || _pending >= CHUNK_MAX_SIZE) {
+                _buf.insert(_buf.end(), data + start, data + i + 1);
+                start = i + 1;
+
+                if (!emit(_buf.data(), _buf.size())) {
+                    return false;
+                }
+
+                _buf.clear();
+                _hash = 0;
+                _pending = 0;
+            }
+        }
+
+        _buf.insert(_buf.end(), data + start, data + size);
+
+        return true;
+    }
+
+    template<typename Fn>
+    bool finish(Fn &&emit)
+    {
+        if (_buf.empty()) {
+            return true;
+        }
+
+        bool ret = emit(_buf.data(), _buf.size());
+        _buf.clear();
+        _hash = 0;
+        _pending = 0;
+        return ret;
+    }
+
+private:
+    std::vector<unsigned char> _buf;
+    uint64_t _hash = 0;
+    size_t _pending = 0;
+};
+
+static std::string sha256_hex(const void *data, size_t size)
+{
+    std::array<unsigned char, SHA256_DIGEST_LENGTH> digest;
+    SHA256(static_cast<const unsigned char *>(data), size, digest.data());
+    return util::hex_string(digest.data(), digest.size());
+}
+
+static bool is_valid_hash(std::string_view hash)
+{
+    return hash.size() == SHA256_DIGEST_LENGTH * 2
+            && hash.find_first_not_of("0123456789abcdef") == hash.npos;
+}
+
+/*!
+ * \brief Escape a manifest field so it contains no separators or whitespace
+ */
+static std::string encode_field(std::string_view str)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string result;
+
+    if (str.empty()) {
+        return "%";
+    }
+
+    for (char ch : str) {
+        auto c = static_cast<unsigned char>(ch);
+        if (c <= 0x20 || c >= 0x7f || c == '%' || c == ',' || c == '=') {
+            result += '%';
+            result += digits[c >> 4];
+            result += digits[c & 0xf];
+        } else {
+            result += static_cast<char>(c);
+        }
+    }
+
+    return result;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else {
+        return -1;
+    }
+}
+
+static std::optional<std::string> decode_field(std::string_view str)
+{
+    std::string result;
+
+    if (str == "%") {
+        return result;
+    }
+
+    for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] != '%') {
+            result += str[i];
+            continue;
+        } else if (i + 2 >= str.size()) {
+            return std::nullopt;
+        }
+
+        int hi = hex_value(str[i + 1]);
+        int lo = hex_value(str[i + 2]);
+        if (hi < 0 || lo < 0) {
+            return std::nullopt;
+        }
+
+        result += static_cast<char>((hi << 4) | lo);
+        i += 2;
+    }
+
+    return result;
+}
+
+using Xattrs = std::vector<std::pair<std::string, std::string>>;
+
+static bool read_xattrs(const char *path, Xattrs &xattrs)
+{
+    xattrs.clear();
+
+    ssize_t size = llistxattr(path, nullptr, 0);
+    if (size < 0) {
+        if (errno == ENOTSUP) {
+            return true;
+        }
+        LOGE("%s: Failed to list xattrs: %s", path, strerror(errno));
+        return false;
+    } else if (size == 0) {
+        return true;
+    }
+
+    std::string names;
+    names.resize(static_cast<size_t>(size));
+
+    size = llistxattr(path, names.data(), names.size());
+    if (size < 0) {
+        LOGE("%s: Failed to list xattrs: %s", path, strerror(errno));
+        return false;
+    }
+    names.resize(static_cast<size_t>(size));
+
+    for (size_t pos = 0; pos < names.size();) {
+        const char *name = names.c_str() + pos;
+        pos += strlen(name) + 1;
+
+        size = lgetxattr(path, name, nullptr, 0);
+        if (size < 0) {
+            LOGE("%s: Failed to get xattr %s: %s", path, name, strerror(errno));
+            return false;
+        }
+
+        std::string value;
+        value.resize(static_cast<size_t>(size));
+
+        size = lgetxattr(path, name, value.data(), value.size());
+        if (size < 0) {
+            LOGE("%s: Failed to get xattr %s: %s", path, name, strerror(errno));
+            return false;
+        }
+        value.resize(static_cast<size_t>(size));
+
+        xattrs.emplace_back(name, std::move(value));
+    }
+
+    return true;
+}
+
+static std::string encode_xattrs(const Xattrs &xattrs)
+{
+    if (xattrs.empty()) {
+        return "-";
+    }
+
+    std::string result;
+
+    for (auto const &[name, value] : xattrs) {
+        if (!result.empty()) {
+            result += ',';
+        }
+        result += encode_field(name);
+        result += '=';
+        result += encode_field(value);
+    }
+
+    return result;
+}
+
+static bool decode_xattrs(std::string_view str, Xattrs &xattrs)
+{
+    xattrs.clear();
+
+    if (str == "-") {
+        return true;
+    }
+
+    for (auto const &item : split_sv(str, ",")) {
+        auto pos = item.find('=');
+        if (pos == item.npos) {
+            return false;
+        }
+
+        auto name = decode_field(item.substr(0, pos));
+        auto value = decode_field(item.substr(pos + 1));
+        if (!name || !value) {
+            return false;
+        }
+
+        xattrs.emplace_back(std::move(*name), std::move(*value));
+    }
+
+    return true;
+}
+
+ChunkStore::ChunkStore() : _lock_fd(-1)
+{
+}
+
+ChunkStore::~ChunkStore()
+{
+    if (_lock_fd >= 0) {
+        close(_lock_fd);
+    }
+}
+
+/*!
+ * \brief Open or create the chunk store at \p path
+ *
+ * This blocks while gc() is running on the store.
+ */
+bool ChunkStore::open(const std::string &path, bool create)
+{
+    if (create) {
+        for (auto const &dir : { path, path + "/chunks", path + "/refs",
+                                 path + "/tmp" }) {
+            if (auto r = util::mkdir_recursive(dir, 0755); !r) {
+                LOGE("%s: Failed to create directory: %s",
+                     dir.c_str(), r.error().message().c_str());
+                return false;
+            }
+        }
+    }
+
+    auto real = util::real_path(path);
+    if (!real) {
+        LOGE("%s: Failed to resolve path: %s",
+             path.c_str(), real.error().message().c_str());
+        return false;
+    }
+
+    struct stat sb;
+    std::string chunks_dir = real.value() + "/chunks";
+    if (stat(chunks_dir.c_str(), &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+        LOGE("%s: Not a chunk store", path.c_str());
+        return false;
+    }
+
+    std::string lock_path = real.value() + "/lock";
+
+    int fd = ::open(lock_path.c_str(), O_RDONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", lock_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (flock(fd, LOCK_SH) < 0) {
+        LOGE("%s: Failed to lock: %s", lock_path.c_str(), strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    if (_lock_fd >= 0) {
+        close(_lock_fd);
+    }
+    _lock_fd = fd;
+    _path = std::move(real.value());
+
+    return true;
+}
+
+const std::string & ChunkStore::path() const
+{
+    return _path;
+}
+
+std::string ChunkStore::chunk_path(const std::string &hash) const
+{
+    std::string path(_path);
+    path += "/chunks/";
+    path += std::string_view(hash).substr(0, 2);
+    path += '/';
+    path += hash;
+    return path;
+}
+
+std::string ChunkStore::ref_path(const std::string &id) const
+{
+    std::string path(_path);
+    path += "/refs/";
+    path += id;
+    return path;
+}
+
+/*!
+ * \brief Store a chunk unless a chunk with the same digest already exists
+ *
+ * New chunks are written to a temporary file and renamed into place, so
+ * concurrent backups into the same store never see partial chunks.
+ */
+bool ChunkStore::put(const void *data, size_t size, std::string &hash_out)
+{
+    std::string hash = sha256_hex(data, size);
+    std::string path = chunk_path(hash);
+
+    if (access(path.c_str(), F_OK) == 0) {
+        hash_out = std::move(hash);
+        return true;
+    }
+
+    std::string dir = util::dir_name(path);
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        LOGE("%s: Failed to create directory: %s",
+             dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::string temp_path(_path);
+    temp_path += "/tmp/chunk.XXXXXX";
+
+    int fd = mkstemp(temp_path.data());
+    if (fd < 0) {
+        LOGE("%s: Failed to create temporary file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        close(fd);
+        unlink(temp_path.c_str());
+    });
+
+    auto ptr = static_cast<const char *>(data);
+    size_t remain = size;
+    auto write_start = std::chrono::steady_clock::now();
+
+    while (remain > 0) {
+        ssize_t n = write(fd, ptr, remain);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0) {
+            LOGE("%s: Failed to write: %s", temp_path.c_str(), strerror(errno));
+            return false;
+        }
+
+        ptr += n;
+        remain -= static_cast<size_t>(n);
+    }
+
+    util::metrics_add_write(size,
+                            std::chrono::steady_clock::now() - write_start);
+
+    if (fchmod(fd, 0644) < 0) {
+        LOGE("%s: Failed to chmod: %s", temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+
+    hash_out = std::move(hash);
+    return true;
+}
+
+/*!
+ * \brief Read a chunk and verify its digest
+ */
+bool ChunkStore::get(const std::string &hash,
+                     std::vector<unsigned char> &buf) const
+{
+    std::string path = chunk_path(hash);
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open chunk: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", path.c_str(), strerror(errno));
+        return false;
+    } else if (static_cast<uint64_t>(sb.st_size) > CHUNK_MAX_SIZE) {
+        LOGE("%s: Chunk is too large", path.c_str());
+        return false;
+    }
+
+    buf.resize(static_cast<size_t>(sb.st_size));
+    size_t total = 0;
+    auto read_start = std::chrono::steady_clock::now();
+
+    while (total < buf.size()) {
+        ssize_t n = read(fd, buf.data() + total, buf.size() - total);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            LOGE("%s: Failed to read chunk: %s", path.c_str(),
+                 n < 0 ? strerror(errno) : "Unexpected EOF");
+            return false;
+        }
+        total += static_cast<size_t>(n);
+    }
+
+    util::metrics_add_read(total,
+                           std::chrono::steady_clock::now() - read_start);
+
+    if (sha256_hex(buf.data(), buf.size()) != hash) {
+        LOGE("%s: Chunk is corrupted", path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Register a backup that is about to store chunks
+ *
+ * The pending ref tells gc() that its chunks belong to a backup that was
+ * interrupted if the backup never calls commit_ref().
+ *
+ * \param[out] id_out ID of the new backup
+ */
+bool ChunkStore::begin_ref(std::string &id_out)
+{
+    std::array<unsigned char, REF_ID_SIZE> id_bytes;
+    if (RAND_bytes(id_bytes.data(), static_cast<int>(id_bytes.size())) != 1) {
+        LOGE("Failed to generate backup ID");
+        return false;
+    }
+
+    std::string id = util::hex_string(id_bytes.data(), id_bytes.size());
+    std::string path = ref_path(id) + REF_PENDING_SUFFIX;
+
+    int fd = ::open(path.c_str(),
+                    O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE("%s: Failed to create: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    close(fd);
+
+    id_out = std::move(id);
+    return true;
+}
+
+/*!
+ * \brief Register the finished manifest of a backup started by begin_ref()
+ *
+ * The ref stores the manifest path relative to the store, so the backups and
+ * the store can be moved together or reached through a different mount point.
+ * Manifests that are moved elsewhere are found again by their ID.
+ */
+bool ChunkStore::commit_ref(const std::string &id,
+                            const std::string &manifest_path)
+{
+    auto real = util::real_path(manifest_path);
+    if (!real) {
+        LOGE("%s: Failed to resolve path: %s",
+             manifest_path.c_str(), real.error().message().c_str());
+        return false;
+    }
+
+    auto rel = util::relative_path(real.value(), _path);
+    std::string contents = encode_field(rel ? rel.value() : real.value());
+    contents += '\n';
+
+    std::string path = ref_path(id);
+    std::string temp_path = path + ".tmp";
+
+    if (auto r = util::file_write_data(temp_path, contents.data(),
+                                       contents.size()); !r) {
+        LOGE("%s: Failed to write: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    abort_ref(id);
+
+    return true;
+}
+
+/*!
+ * \brief Remove the pending ref of a backup that failed
+ *
+ * The chunks that the backup stored are removed by the next gc().
+ */
+void ChunkStore::abort_ref(const std::string &id)
+{
+    std::string path = ref_path(id) + REF_PENDING_SUFFIX;
+    if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+        LOGW("%s: Failed to remove: %s", path.c_str(), strerror(errno));
+    }
+}
+
+/*!
+ * \brief One entry (one line) of a manifest
+ */
+struct ManifestEntry
+{
+    char type;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    timespec mtime;
+    std::string path;
+    Xattrs xattrs;
+    // Regular files
+    uint64_t size;
+    std::vector<std::string> chunks;
+    // Symlinks
+    std::string target;
+    // Devices
+    dev_t rdev;
+};
+
+/*!
+ * \brief Read a manifest line by line
+ */
+class ManifestReader
+{
+public:
+    ManifestReader() : _fp(nullptr, fclose)
+    {
+    }
+
+    ~ManifestReader()
+    {
+        free(_line);
+    }
+
+    MB_DISABLE_COPY_CONSTRUCT_AND_ASSIGN(ManifestReader)
+    MB_DISABLE_MOVE_CONSTRUCT_AND_ASSIGN(ManifestReader)
+
+    bool open(const std::string &path)
+    {
+        _path = path;
+        _fp.reset(fopen(path.c_str(), "re"));
+        if (!_fp) {
+            LOGE("%s: Failed to open: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        bool has_id;
+
+        if (!next_line() || _fields.size() != 2) {
+            LOGE("%s: Not a chunk manifest", path.c_str());
+            return false;
+        } else if (_fields[0] + " " + _fields[1] == MANIFEST_MAGIC) {
+            has_id = true;
+        } else if (_fields[0] + " " + _fields[1] == MANIFEST_MAGIC_V1) {
+            has_id = false;
+        } else {
+            LOGE("%s: Not a chunk manifest", path.c_str());
+            return false;
+        }
+
+        if (!next_line() || _fields.size() != 2 || _fields[0] != "store") {
+            LOGE("%s: Missing chunk store path", path.c_str());
+            return false;
+        }
+
+        auto store = decode_field(_fields[1]);
+        if (!store) {
+            LOGE("%s: Invalid chunk store path", path.c_str());
+            return false;
+        }
+
+        // Relative to the directory containing the manifest
+        if (!store->empty() && (*store)[0] == '/') {
+            _store_path = std::move(*store);
+        } else {
+            _store_path = util::dir_name(path);
+            _store_path += '/';
+            _store_path += *store;
+        }
+
+        _id.clear();
+
+        if (has_id) {
+            if (!next_line() || _fields.size() != 2 || _fields[0] != "id") {
+                LOGE("%s: Missing backup ID", path.c_str());
+                return false;
+            }
+            _id = std::move(_fields[1]);
+        }
+
+        return true;
+    }
+
+    const std::string & store_path() const
+    {
+        return _store_path;
+    }
+
+    //! Backup ID (empty for version 1 manifests)
+    const std::string & id() const
+    {
+        return _id;
+    }
+
+    /*!
+     * \return 1 if an entry was read, 0 at the end of the manifest, or -1 if
+     *         the manifest is malformed
+     */
+    int next(ManifestEntry &entry)
+    {
+        if (!next_line()) {
+            return ferror(_fp.get()) ? -1 : 0;
+        }
+
+        if (_fields.size() != 9 || _fields[0].size() != 1) {
+            return malformed();
+        }
+
+        entry.type = _fields[0][0];
+
+        unsigned int mode;
+        if (!str_to_num(_fields[1].c_str(), 8, mode)
+                || !str_to_num(_fields[2].c_str(), 10, entry.uid)
+                || !str_to_num(_fields[3].c_str(), 10, entry.gid)
+                || !str_to_num(_fields[4].c_str(), 10, entry.mtime.tv_sec)
+                || !str_to_num(_fields[5].c_str(), 10, entry.mtime.tv_nsec)) {
+            return malformed();
+        }
+        entry.mode = static_cast<mode_t>(mode);
+
+        auto path = decode_field(_fields[6]);
+        if (!path || path->empty() || (*path)[0] == '/'
+                || !decode_xattrs(_fields[7], entry.xattrs)) {
+            return malformed();
+        }
+
+        // Never write outside of the target directory
+        for (auto const &piece : split_sv(*path, "/")) {
+            if (piece == "..") {
+                return malformed();
+            }
+        }
+
+        entry.path = std::move(*path);
+
+        auto const &payload = _fields[8];
+
+        switch (entry.type) {
+        case 'f': {
+            auto pos = payload.find(':');
+            if (pos == payload.npos || !str_to_num(
+                    payload.substr(0, pos).c_str(), 10, entry.size)) {
+                return malformed();
+            }
+
+            entry.chunks.clear();
+            if (pos + 1 < payload.size()) {
+                for (auto const &hash : split_sv(
+                        std::string_view(payload).substr(pos + 1), ",")) {
+                    if (!is_valid_hash(hash)) {
+                        return malformed();
+                    }
+                    entry.chunks.emplace_back(hash);
+                }
+            }
+            break;
+        }
+        case 'l': {
+            auto target = decode_field(payload);
+            if (!target) {
+                return malformed();
+            }
+            entry.target = std::move(*target);
+            break;
+        }
+        case 'b':
+        case 'c':
+            if (!str_to_num(payload.c_str(), 10, entry.rdev)) {
+                return malformed();
+            }
+            break;
+        case 'd':
+        case 'p':
+            break;
+        default:
+            return malformed();
+        }
+
+        return 1;
+    }
+
+private:
+    std::string _path;
+    ScopedFILE _fp;
+    char *_line = nullptr;
+    size_t _line_size = 0;
+    std::vector<std::string> _fields;
+    std::string _store_path;
+    std::string _id;
+
+    bool next_line()
+    {
+        ssize_t n = getline(&_line, &_line_size, _fp.get());
+        if (n < 0) {
+            return false;
+        }
+
+        std::string_view line(_line, static_cast<size_t>(n));
+        if (!line.empty() && line.back() == '\n') {
+            line.remove_suffix(1);
+        }
+
+        _fields.clear();
+        for (auto const &field : split_sv(line, " ")) {
+            _fields.emplace_back(field);
+        }
+
+        return true;
+    }
+
+    int malformed()
+    {
+        LOGE("%s: Malformed manifest entry", _path.c_str());
+        return -1;
+    }
+};
+
+/*!
+ * \brief Find manifests by their backup ID
+ *
+ * Only version 2 manifests with the usual suffix are considered. The chunk
+ * store itself is not searched.
+ */
+class ManifestFinder : public util::FtsWrapper
+{
+public:
+    ManifestFinder(std::string path, const struct stat &store_sb,
+                   std::unordered_map<std::string, std::string> &manifests)
+        : FtsWrapper(std::move(path), {})
+        , _store_sb(store_sb)
+        , _manifests(manifests)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        auto const *sb = _curr->fts_statp;
+
+        if (_curr->fts_info == FTS_D && sb->st_dev == _store_sb.st_dev
+                && sb->st_ino == _store_sb.st_ino) {
+            return Action::Skip;
+        }
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        if (!ends_with(_curr->fts_name, MANIFEST_SUFFIX)) {
+            return Action::Ok;
+        }
+
+        auto magic = util::file_first_line(_curr->fts_accpath);
+        if (!magic || magic.value() != MANIFEST_MAGIC) {
+            return Action::Ok;
+        }
+
+        ManifestReader reader;
+        if (reader.open(_curr->fts_path)) {
+            _manifests.emplace(reader.id(), _curr->fts_path);
+        }
+
+        return Action::Ok;
+    }
+
+private:
+    const struct stat &_store_sb;
+    std::unordered_map<std::string, std::string> &_manifests;
+};
+
+static bool is_valid_ref_id(std::string_view id)
+{
+    // Refs of version 1 manifests are named after the SHA-256 digest of the
+    // manifest path
+    return (id.size() == REF_ID_SIZE * 2
+                    || id.size() == SHA256_DIGEST_LENGTH * 2)
+            && id.find_first_not_of("0123456789abcdef") == id.npos;
+}
+
+/*!
+ * \brief Check whether \p path is a manifest with the backup ID \p id
+ *
+ * Version 1 manifests have no ID and are accepted as is.
+ */
+static bool manifest_has_id(const std::string &path, const std::string &id)
+{
+    auto magic = util::file_first_line(path);
+    if (!magic) {
+        return false;
+    } else if (magic.value() == MANIFEST_MAGIC_V1) {
+        return true;
+    }
+
+    ManifestReader reader;
+    return reader.open(path) && reader.id() == id;
+}
+
+static void search_manifests(
+        const std::vector<std::string> &search_dirs,
+        const std::string &store_path,
+        std::unordered_map<std::string, std::string> &manifests)
+{
+    struct stat store_sb;
+    if (stat(store_path.c_str(), &store_sb) < 0) {
+        memset(&store_sb, 0, sizeof(store_sb));
+    }
+
+    for (auto const &dir : search_dirs) {
+        LOGI("%s: Searching for moved backups", dir.c_str());
+
+        ManifestFinder finder(dir, store_sb, manifests);
+        if (!finder.run()) {
+            LOGW("%s: Failed to search directory: %s",
+                 dir.c_str(), finder.error().c_str());
+        }
+    }
+}
+
+/*!
+ * \brief Remove chunks that are not referenced by any registered manifest
+ *
+ * Each ref points to its manifest relative to the store. If the manifest is
+ * not there, it is looked up by ID in \p search_dirs and the ref is updated.
+ * A manifest that can't be found either way may belong to a backup that was
+ * moved somewhere else, so nothing is removed unless \p prune is set, in which
+ * case those backups are treated as deleted.
+ *
+ * Pending refs are left behind by interrupted backups and are removed. Their
+ * chunks are removed too unless a finished backup uses them.
+ *
+ * \param search_dirs Directories to search for manifests that were moved
+ * \param prune Drop refs whose manifest cannot be found
+ */
+bool ChunkStore::gc(const std::vector<std::string> &search_dirs, bool prune)
+{
+    if (flock(_lock_fd, LOCK_EX | LOCK_NB) < 0) {
+        if (errno == EWOULDBLOCK) {
+            LOGE("%s: Chunk store is in use by a running backup or restore",
+                 _path.c_str());
+        } else {
+            LOGE("%s: Failed to lock: %s", _path.c_str(), strerror(errno));
+        }
+        return false;
+    }
+
+    auto unlock = finally([&] {
+        flock(_lock_fd, LOCK_SH);
+    });
+
+    std::unordered_set<std::string> used;
+    std::string refs_dir = _path + "/refs";
+
+    std::vector<std::string> refs;
+    std::vector<std::string> pending_refs;
+
+    {
+        ScopedDIR dp(opendir(refs_dir.c_str()), closedir);
+        if (!dp) {
+            LOGE("%s: Failed to open directory: %s",
+                 refs_dir.c_str(), strerror(errno));
+            return false;
+        }
+
+        dirent *ent;
+
+        while ((ent = readdir(dp.get()))) {
+            if (ent->d_name[0] == '.') {
+                continue;
+            } else if (ends_with(ent->d_name, REF_PENDING_SUFFIX)) {
+                pending_refs.emplace_back(ent->d_name);
+            } else if (is_valid_ref_id(ent->d_name)) {
+                refs.emplace_back(ent->d_name);
+            }
+        }
+    }
+
+    // Manifests found by ID. The search only runs if a manifest has moved.
+    std::optional<std::unordered_map<std::string, std::string>> found;
+    std::vector<std::string> missing;
+    std::vector<std::string> manifest_paths;
+
+    for (auto const &id : refs) {
+        std::string path = ref_path(id);
+
+        auto line = util::file_first_line(path);
+        if (!line) {
+            LOGE("%s: Failed to read: %s",
+                 path.c_str(), line.error().message().c_str());
+            return false;
+        }
+
+        auto location = decode_field(line.value());
+        if (!location) {
+            LOGE("%s: Invalid ref", path.c_str());
+            return false;
+        }
+
+        std::string manifest_path;
+        if (!location->empty() && (*location)[0] == '/') {
+            manifest_path = std::move(*location);
+        } else {
+            manifest_path = _path + "/" + *location;
+        }
+
+        if (manifest_has_id(manifest_path, id)) {
+            manifest_paths.push_back(std::move(manifest_path));
+            continue;
+        }
+
+        if (!found) {
+            found.emplace();
+            search_manifests(search_dirs, _path, *found);
+        }
+
+        if (auto it = found->find(id); it != found->end()) {
+            LOGI("Backup %s moved to %s", id.c_str(), it->second.c_str());
+            if (!commit_ref(id, it->second)) {
+                return false;
+            }
+            manifest_paths.push_back(it->second);
+        } else if (prune) {
+            LOGI("Dropping reference to deleted backup: %s",
+                 manifest_path.c_str());
+            unlink(path.c_str());
+        } else {
+            missing.push_back(std::move(manifest_path));
+        }
+    }
+
+    if (!missing.empty()) {
+        for (auto const &path : missing) {
+            LOGE("%s: Backup manifest not found", path.c_str());
+        }
+        LOGE("Not removing any chunks. If the backups were deleted, run again"
+             " with pruning enabled.");
+        return false;
+    }
+
+    for (auto const &manifest_path : manifest_paths) {
+        ManifestReader reader;
+        ManifestEntry entry;
+        int ret;
+
+        // Keep everything if a manifest can't be read
+        if (!reader.open(manifest_path)) {
+            return false;
+        }
+
+        while ((ret = reader.next(entry)) > 0) {
+            for (auto &hash : entry.chunks) {
+                used.insert(std::move(hash));
+            }
+        }
+
+        if (ret < 0) {
+            return false;
+        }
+    }
+
+    // The exclusive lock guarantees that no backup is still running
+    for (auto const &name : pending_refs) {
+        LOGI("Dropping reference to interrupted backup: %s", name.c_str());
+        std::string path = refs_dir + "/" + name;
+        unlink(path.c_str());
+    }
+
+    dirent *ent;
+
+    uint64_t removed_chunks = 0;
+    uint64_t removed_bytes = 0;
+    uint64_t kept_chunks = 0;
+
+    std::string chunks_dir = _path + "/chunks";
+
+    ScopedDIR chunks(opendir(chunks_dir.c_str()), closedir);
+    if (!chunks) {
+        LOGE("%s: Failed to open directory: %s",
+             chunks_dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    while ((ent = readdir(chunks.get()))) {
+        if (ent->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string subdir = chunks_dir + "/" + ent->d_name;
+
+        ScopedDIR dp(opendir(subdir.c_str()), closedir);
+        if (!dp) {
+            LOGE("%s: Failed to open directory: %s",
+                 subdir.c_str(), strerror(errno));
+            return false;
+        }
+
+        dirent *chunk_ent;
+
+        while ((chunk_ent = readdir(dp.get()))) {
+            if (chunk_ent->d_name[0] == '.') {
+                continue;
+            } else if (used.find(chunk_ent->d_name) != used.end()) {
+                ++kept_chunks;
+                continue;
+            }
+
+            std::string path = subdir + "/" + chunk_ent->d_name;
+
+            struct stat sb;
+            if (lstat(path.c_str(), &sb) == 0 && unlink(path.c_str()) == 0) {
+                ++removed_chunks;
+                removed_bytes += static_cast<uint64_t>(sb.st_size);
+            } else {
+                LOGW("%s: Failed to remove: %s", path.c_str(), strerror(errno));
+            }
+        }
+    }
+
+    LOGI("Removed %" PRIu64 " unused chunks (%" PRIu64 " bytes);"
+         " %" PRIu64 " chunks are in use",
+         removed_chunks, removed_bytes, kept_chunks);
+
+    return true;
+}
+
+/*!
+ * \brief Walk a directory and write its manifest, storing file contents in the
+ *        chunk store
+ */
+class ChunkedBackup : public util::FtsWrapper
+{
+public:
+    ChunkedBackup(ChunkStore &store, FILE *fp, std::string path,
+                  const std::vector<std::string> &exclusions)
+        : FtsWrapper(std::move(path), {})
+        , _store(store)
+        , _fp(fp)
+        , _exclusions(exclusions)
+        , _buf(FILE_BUF_SIZE)
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        if (_curr->fts_level == 0) {
+            return Action::Next;
+        }
+
+        if (_curr->fts_level == 1 && std::find(
+                _exclusions.begin(), _exclusions.end(), _curr->fts_name)
+                        != _exclusions.end()) {
+            return Action::Skip;
+        }
+
+        // fts_path always begins with the path passed to fts_open()
+        _relpath = _curr->fts_path + _path.size() + 1;
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        return write_entry('d', "-");
+    }
+
+    Actions on_reached_directory_post() override
+    {
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        std::string chunks;
+        uint64_t size;
+
+        if (!store_file(chunks, size)) {
+            return Action::Fail | Action::Stop;
+        }
+
+        return write_entry('f', format("%" PRIu64 ":%s", size, chunks.c_str()));
+    }
+
+    Actions on_reached_symlink() override
+    {
+        auto target = util::read_link(_curr->fts_accpath);
+        if (!target) {
+            _error_msg = format("%s: Failed to read symlink: %s",
+                                _curr->fts_path,
+                                target.error().message().c_str());
+            LOGE("%s", _error_msg.c_str());
+            return Action::Fail | Action::Stop;
+        }
+
+        return write_entry('l', encode_field(target.value()));
+    }
+
+    Actions on_reached_block_device() override
+    {
+        return write_entry('b', format("%" PRIu64, static_cast<uint64_t>(
+                _curr->fts_statp->st_rdev)));
+    }
+
+    Actions on_reached_character_device() override
+    {
+        return write_entry('c', format("%" PRIu64, static_cast<uint64_t>(
+                _curr->fts_statp->st_rdev)));
+    }
+
+    Actions on_reached_fifo() override
+    {
+        return write_entry('p', "-");
+    }
+
+    Actions on_reached_socket() override
+    {
+        LOGD("%s: Skipping socket", _curr->fts_path);
+        return Action::Ok;
+    }
+
+private:
+    ChunkStore &_store;
+    FILE *_fp;
+    const std::vector<std::string> &_exclusions;
+    std::vector<unsigned char> _buf;
+    std::string _relpath;
+    Chunker _chunker;
+
+    bool store_file(std::string &chunks, uint64_t &size)
+    {
+        int fd = open(_curr->fts_accpath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+            _error_msg = format("%s: Failed to open: %s",
+                                _curr->fts_path, strerror(errno));
+            LOGE("%s", _error_msg.c_str());
+            return false;
+        }
+
+        auto close_fd = finally([&] {
+            close(fd);
+        });
+
+        auto emit = [&](const unsigned char *data, size_t n) {
+            std::string hash;
+            if (!_store.put(data, n, hash)) {
+                return false;
+            }
+            if (!chunks.empty()) {
+                chunks += ',';
+            }
+            chunks += hash;
+            return true;
+        };
+
+        size = 0;
+
+        while (true) {
+            auto read_start = std::chrono::steady_clock::now();
+            ssize_t n = read(fd, _buf.data(), _buf.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                _error_msg = format("%s: Failed to read: %s",
+                                    _curr->fts_path, strerror(errno));
+                LOGE("%s", _error_msg.c_str());
+                return false;
+            } else if (n == 0) {
+                break;
+            }
+            util::metrics_add_read(static_cast<uint64_t>(n),
+                                   std::chrono::steady_clock::now()
+                                           - read_start);
+
+            if (!_chunker.feed(_buf.data(), static_cast<size_t>(n), emit)) {
+                _error_msg = format("%s: Failed to store chunk",
+                                    _curr->fts_path);
+                return false;
+            }
+
+            size += static_cast<uint64_t>(n);
+        }
+
+        if (!_chunker.finish(emit)) {
+            _error_msg = format("%s: Failed to store chunk", _curr->fts_path);
+            return false;
+        }
+
+        util::metrics_add_files(1, size);
+
+        return true;
+    }
+
+    Actions write_entry(char type, const std::string &payload)
+    {
+        Xattrs xattrs;
+        if (!read_xattrs(_curr->fts_accpath, xattrs)) {
+            _error_msg = format("%s: Failed to read xattrs", _curr->fts_path);
+            return Action::Fail | Action::Stop;
+        }
+
+        auto const *sb = _curr->fts_statp;
+
+        if (fprintf(_fp, "%c %o %u %u %" PRId64 " %ld %s %s %s\n",
+                    type, static_cast<unsigned int>(sb->st_mode & 07777),
+                    static_cast<unsigned int>(sb->st_uid),
+                    static_cast<unsigned int>(sb->st_gid),
+                    static_cast<int64_t>(sb->st_mtim.tv_sec),
+                    static_cast<long>(sb->st_mtim.tv_nsec),
+                    encode_field(_relpath).c_str(),
+                    encode_xattrs(xattrs).c_str(),
+                    payload.c_str()) < 0) {
+            _error_msg = format("Failed to write manifest: %s",
+                                strerror(errno));
+            LOGE("%s", _error_msg.c_str());
+            return Action::Fail | Action::Stop;
+        }
+
+        return Action::Ok;
+    }
+};
+
+/*!
+ * \brief Back up \p directory into \p store and write its manifest
+ *
+ * \param store Chunk store
+ * \param manifest_path Output manifest path
+ * \param directory Directory to back up
+ * \param exclusions Top-level paths to exclude
+ */
+bool chunked_backup_directory(ChunkStore &store,
+                              const std::string &manifest_path,
+                              const std::string &directory,
+                              const std::vector<std::string> &exclusions)
+{
+    // Register the backup before the first chunk is stored so that gc() never
+    // mistakes its chunks for unused ones
+    std::string id;
+    if (!store.begin_ref(id)) {
+        return false;
+    }
+
+    auto abort_ref = finally([&] {
+        store.abort_ref(id);
+    });
+
+    std::string temp_path = manifest_path + ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "we"), fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        unlink(temp_path.c_str());
+    });
+
+    auto backup_dir = util::real_path(util::dir_name(manifest_path));
+    if (!backup_dir) {
+        LOGE("%s: Failed to resolve path: %s", manifest_path.c_str(),
+             backup_dir.error().message().c_str());
+        return false;
+    }
+
+    // Store a relative path if possible so that the backups and store can be
+    // moved together or accessed from a different mount point
+    auto store_path = util::relative_path(store.path(), backup_dir.value());
+
+    fprintf(fp.get(), "%s\nstore %s\nid %s\n", MANIFEST_MAGIC,
+            encode_field(store_path ? store_path.value()
+                                    : store.path()).c_str(),
+            id.c_str());
+
+    ChunkedBackup backup(store, fp.get(), directory, exclusions);
+    if (!backup.run()) {
+        LOGE("%s: Failed to back up: %s",
+             directory.c_str(), backup.error().c_str());
+        return false;
+    }
+
+    if (fclose(fp.release()) == EOF) {
+        LOGE("%s: Failed to close: %s", temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), manifest_path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             manifest_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    remove_temp.dismiss();
+
+    if (!store.commit_ref(id, manifest_path)) {
+        return false;
+    }
+
+    abort_ref.dismiss();
+
+    return true;
+}
+
+static bool restore_metadata(const std::string &path,
+                             const ManifestEntry &entry)
+{
+    if (lchown(path.c_str(), entry.uid, entry.gid) < 0) {
+        LOGE("%s: Failed to chown: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // chown() clears the setuid/setgid bits, so chmod afterwards
+    if (entry.type != 'l' && chmod(path.c_str(), entry.mode) < 0) {
+        LOGE("%s: Failed to chmod: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // chown() also clears security.capability, so these come last too
+    for (auto const &[name, value] : entry.xattrs) {
+        if (lsetxattr(path.c_str(), name.c_str(), value.data(), value.size(),
+                      0) < 0) {
+            if (errno == ENOTSUP) {
+                LOGV("%s: xattrs not supported on target filesystem",
+                     path.c_str());
+                break;
+            }
+            LOGE("%s: Failed to set xattr %s: %s",
+                 path.c_str(), name.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    timespec times[2];
+    times[0] = entry.mtime;
+    times[1] = entry.mtime;
+
+    if (utimensat(AT_FDCWD, path.c_str(), times, AT_SYMLINK_NOFOLLOW) < 0) {
+        LOGE("%s: Failed to set timestamps: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool restore_file(const ChunkStore &store, const std::string &path,
+                         const ManifestEntry &entry,
+                         std::vector<unsigned char> &buf)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGE("%s: Failed to create: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    uint64_t total = 0;
+
+    for (auto const &hash : entry.chunks) {
+        if (!store.get(hash, buf)) {
+            return false;
+        }
+
+        size_t written = 0;
+        auto write_start = std::chrono::steady_clock::now();
+
+        while (written < buf.size()) {
+            ssize_t n = write(fd, buf.data() + written, buf.size() - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                LOGE("%s: Failed to write: %s", path.c_str(), strerror(errno));
+                return false;
+            }
+            written += static_cast<size_t>(n);
+        }
+
+        util::metrics_add_write(buf.size(),
+                                std::chrono::steady_clock::now() - write_start);
+        total += buf.size();
+    }
+
+    util::metrics_add_files(1, total);
+
+    if (total != entry.size) {
+        LOGE("%s: Expected %" PRIu64 " bytes, but restored %" PRIu64,
+             path.c_str(), entry.size, total);
+        return false;
+    }
+
+    close_fd.dismiss();
+
+    if (close(fd) < 0) {
+        LOGE("%s: Failed to close: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Restore a chunked backup into an (empty) directory
+ *
+ * \param manifest_path Manifest of the backup
+ * \param directory Target directory
+ */
+bool chunked_restore_directory(const std::string &manifest_path,
+                               const std::string &directory)
+{
+    ManifestReader reader;
+    if (!reader.open(manifest_path)) {
+        return false;
+    }
+
+    ChunkStore store;
+    if (!store.open(reader.store_path(), false)) {
+        return false;
+    }
+
+    // Directory metadata is restored after their contents, deepest first
+    std::vector<std::pair<std::string, ManifestEntry>> dirs;
+    std::vector<unsigned char> buf;
+    ManifestEntry entry;
+    std::string path;
+    int ret;
+
+    while ((ret = reader.next(entry)) > 0) {
+        path = directory;
+        path += '/';
+        path += entry.path;
+
+        switch (entry.type) {
+        case 'd':
+            if (mkdir(path.c_str(), 0700) < 0 && errno != EEXIST) {
+                LOGE("%s: Failed to create directory: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+            dirs.emplace_back(path, entry);
+            continue;
+        case 'f':
+            if (!restore_file(store, path, entry, buf)) {
+                return false;
+            }
+            break;
+        case 'l':
+            if (symlink(entry.target.c_str(), path.c_str()) < 0) {
+                LOGE("%s: Failed to create symlink: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+            break;
+        case 'b':
+        case 'c':
+        case 'p': {
+            mode_t type = entry.type == 'b' ? S_IFBLK
+                    : entry.type == 'c' ? S_IFCHR : S_IFIFO;
+            if (mknod(path.c_str(), type | S_IRWXU, entry.rdev) < 0) {
+                LOGE("%s: Failed to create special file: %s",
+                     path.c_str(), strerror(errno));
+                return false;
+            }
+            break;
+        }
+        }
+
+        if (!restore_metadata(path, entry)) {
+            return false;
+        }
+    }
+
+    if (ret < 0) {
+        return false;
+    }
+
+    for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+        if (!restore_metadata(it->first, it->second)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/compact_image.h"
+
+#include <string>
+#include <vector>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "mbutil/loopdev.h"
+
+#include "recovery/image.h"
+#include "util/roms.h"
+
+namespace mb
+{
+
+static uint64_t allocated_size(const std::string &path)
+{
+    struct stat sb;
+    return stat(path.c_str(), &sb) == 0
+            ? static_cast<uint64_t>(sb.st_blocks) * 512 : 0;
+}
+
+static bool compact_image(const std::string &path, bool shrink)
+{
+    // Mounting a filesystem that is already mounted through another loop
+    // device would corrupt it
+    if (auto loopdev = util::loopdev_find_by_file(path); !loopdev) {
+        fprintf(stderr, "%s: Failed to check loop devices: %s\n",
+                path.c_str(), loopdev.error().message().c_str());
+        return false;
+    } else if (!loopdev.value().empty()) {
+        fprintf(stderr, "%s: Image is in use by %s\n",
+                path.c_str(), loopdev.value().c_str());
+        return false;
+    }
+
+    uint64_t before = allocated_size(path);
+    bool ret = true;
+
+    if (!fsck_ext4_image(path)) {
+        fprintf(stderr, "%s: Failed to check filesystem\n", path.c_str());
+        return false;
+    }
+
+    uint64_t trimmed;
+    if (trim_ext4_image(path, trimmed)) {
+        printf("%s: Discarded %" PRIu64 " MiB of free space\n",
+               path.c_str(), trimmed / 1024 / 1024);
+    } else if (!shrink) {
+        // Trimming is not possible on some host filesystems, but shrinking
+        // still is
+        fprintf(stderr, "%s: Failed to trim image\n", path.c_str());
+        ret = false;
+    }
+
+    uint64_t new_size;
+    if (shrink) {
+        if (shrink_ext4_image(path, new_size)) {
+            printf("%s: Resized to %" PRIu64 " MiB\n",
+                   path.c_str(), new_size / 1024 / 1024);
+        } else {
+            fprintf(stderr, "%s: Failed to shrink image\n", path.c_str());
+            ret = false;
+        }
+    }
+
+    uint64_t after = allocated_size(path);
+    printf("%s: %" PRIu64 " MiB -> %" PRIu64 " MiB on disk\n",
+           path.c_str(), before / 1024 / 1024, after / 1024 / 1024);
+
+    return ret;
+}
+
+static void compact_image_usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: compact-image [OPTION...] [<image>...]\n\n"
+            "Options:\n"
+            "  -s, --shrink  Also shrink the filesystems to their used size\n"
+            "                plus some free space\n"
+            "  -h, --help    Display this help message\n"
+            "\n"
+            "Free blocks in the ext4 images are discarded, which turns them\n"
+            "into holes in the image files. If no images are given, the\n"
+            "images of all installed ROMs are compacted.\n\n"
+            "Shrunk system images are grown back to their full size when a\n"
+            "ROM is installed to them.\n");
+}
+
+int compact_image_main(int argc, char *argv[])
+{
+    int opt;
+    bool shrink = false;
+
+    static struct option long_options[] = {
+        {"shrink", no_argument, 0, 's'},
+        {"help",   no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    static const char short_options[] = "sh";
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(
+            argc, argv, short_options, long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 's':
+            shrink = true;
+            break;
+
+        case 'h':
+            compact_image_usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            compact_image_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<std::string> images(argv + optind, argv + argc);
+
+    if (images.empty()) {
+        Roms roms;
+        roms.add_installed();
+
+        for (auto const &rom : roms.roms) {
+            if (rom->system_is_image) {
+                images.push_back(rom->full_system_path());
+            }
+            if (rom->cache_is_image) {
+                images.push_back(rom->full_cache_path());
+            }
+            if (rom->data_is_image) {
+                images.push_back(rom->full_data_path());
+            }
+        }
+    }
+
+    bool ret = true;
+
+    for (auto const &image : images) {
+        struct stat sb;
+        if (stat(image.c_str(), &sb) < 0) {
+            // Images are only created when the ROM first needs them
+            continue;
+        }
+
+        if (!compact_image(image, shrink)) {
+            ret = false;
+        }
+    }
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
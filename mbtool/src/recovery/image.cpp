@@ -19,17 +19,38 @@
 
 #include "recovery/image.h"
 
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
 #include <cerrno>
 #include <cinttypes>
 #include <cstring>
+#include <ctime>
 
+#include <fcntl.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
+#include "mbcommon/endian.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
+#include "mbsparse/sparse.h"
+#include "mbsparse/sparse_util.h"
+#include "mbsparse/sparse_writer.h"
 #include "mblog/logging.h"
 #include "mbutil/command.h"
 #include "mbutil/directory.h"
+#include "mbutil/loopdev.h"
+#include "mbutil/metrics.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/string.h"
@@ -54,6 +75,54 @@ static int run_command_and_log(const std::vector<std::string> &args)
     });
 }
 
+/*!
+ * \brief Allocate the blocks for a new image file
+ *
+ * Storage that doesn't support fallocate() (eg. FAT-formatted external SD
+ * cards) just gets a file of the right size.
+ */
+static bool preallocate_image(const std::string &path, uint64_t size)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOGE("%s: Failed to create: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fallocate(fd, 0, 0, static_cast<off_t>(size)) < 0) {
+        if (errno != EOPNOTSUPP && errno != ENOSYS) {
+            LOGE("%s: Failed to allocate %" PRIu64 " bytes: %s",
+                 path.c_str(), size, strerror(errno));
+            return false;
+        } else if (ftruncate(fd, static_cast<off_t>(size)) < 0) {
+            LOGE("%s: Failed to truncate to %" PRIu64 " bytes: %s",
+                 path.c_str(), size, strerror(errno));
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Format a preallocated image with mke2fs
+ *
+ * The inode tables and journal are initialized lazily by the kernel when the
+ * image is first mounted instead of being zeroed here.
+ */
+static bool format_image_mke2fs(const std::string &path)
+{
+    int ret = run_command_and_log({
+        "mke2fs", "-t", "ext4", "-F", "-q",
+        "-E", "lazy_itable_init=1,lazy_journal_init=1", path
+    });
+    return ret >= 0 && WIFEXITED(ret) && WEXITSTATUS(ret) == 0;
+}
+
 CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
 {
     // Ensure we have enough space since we're creating a sparse file that may
@@ -80,6 +149,20 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
 
             LOGD("%s: Creating new %s ext4 image", path.c_str(), size_str);
 
+            util::MetricsStage stage("create-image");
+
+            if (preallocate_image(path, size)) {
+                if (format_image_mke2fs(path)) {
+                    return CreateImageResult::Succeeded;
+                }
+
+                LOGW("%s: mke2fs failed or is unavailable;"
+                     " falling back to make_ext4fs", path.c_str());
+            }
+
+            // make_ext4fs truncates the file and writes a sparse image
+            remove(path.c_str());
+
             // Create new image
             int ret = run_command_and_log({
                 "make_ext4fs", "-l", size_str, path
@@ -96,8 +179,129 @@ CreateImageResult create_ext4_image(const std::string &path, uint64_t size)
     return CreateImageResult::ImageExists;
 }
 
+// Offsets of the fields in the ext4 superblock that determine whether e2fsck
+// would do anything
+constexpr off_t EXT4_SB_OFFSET              = 1024;
+constexpr size_t EXT4_SB_SIZE               = 1024;
+constexpr size_t EXT4_SB_BLOCKS_COUNT_LO    = 0x04;
+constexpr size_t EXT4_SB_FIRST_DATA_BLOCK   = 0x14;
+constexpr size_t EXT4_SB_LOG_BLOCK_SIZE     = 0x18;
+constexpr size_t EXT4_SB_BLOCKS_PER_GROUP   = 0x20;
+constexpr size_t EXT4_SB_MNT_COUNT          = 0x34;
+constexpr size_t EXT4_SB_MAX_MNT_COUNT      = 0x36;
+constexpr size_t EXT4_SB_MAGIC              = 0x38;
+constexpr size_t EXT4_SB_STATE              = 0x3a;
+constexpr size_t EXT4_SB_LASTCHECK          = 0x40;
+constexpr size_t EXT4_SB_CHECKINTERVAL      = 0x44;
+constexpr size_t EXT4_SB_FEATURE_INCOMPAT   = 0x60;
+constexpr size_t EXT4_SB_FEATURE_RO_COMPAT  = 0x64;
+constexpr size_t EXT4_SB_LAST_ORPHAN        = 0xe8;
+constexpr size_t EXT4_SB_DESC_SIZE          = 0xfe;
+constexpr size_t EXT4_SB_BLOCKS_COUNT_HI    = 0x150;
+
+// Offsets of the fields in a block group descriptor
+constexpr size_t EXT4_BG_BLOCK_BITMAP_LO    = 0x00;
+constexpr size_t EXT4_BG_FLAGS              = 0x12;
+constexpr size_t EXT4_BG_BLOCK_BITMAP_HI    = 0x20;
+
+constexpr uint16_t EXT4_SUPER_MAGIC         = 0xef53;
+constexpr uint16_t EXT4_VALID_FS            = 0x0001;
+constexpr uint16_t EXT4_ERROR_FS            = 0x0002;
+constexpr uint16_t EXT4_ORPHAN_FS           = 0x0004;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_RECOVER = 0x0004;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_META_BG = 0x0010;
+constexpr uint32_t EXT4_FEATURE_INCOMPAT_64BIT   = 0x0080;
+constexpr uint32_t EXT4_FEATURE_RO_COMPAT_BIGALLOC = 0x0200;
+constexpr uint16_t EXT4_BG_BLOCK_UNINIT     = 0x0002;
+constexpr size_t EXT4_MIN_DESC_SIZE         = 32;
+constexpr size_t EXT4_MIN_DESC_SIZE_64BIT   = 64;
+
+// Block size to use for images that can't be parsed
+constexpr uint32_t FALLBACK_BLOCK_SIZE      = 4096;
+
+constexpr size_t IMAGE_COPY_BUFFER_SIZE     = 1024 * 1024;
+
+// Free space to leave when shrinking an image
+constexpr uint64_t SHRINK_FREE_PERCENT      = 10;
+constexpr uint64_t SHRINK_MIN_FREE_SIZE     = 64 * 1024 * 1024;
+
+template<typename T>
+static T sb_field(const unsigned char *sb, size_t offset)
+{
+    T value;
+    memcpy(&value, sb + offset, sizeof(value));
+    return value;
+}
+
+/*!
+ * \brief Check if the superblock says that the filesystem is clean
+ *
+ * This mirrors the checks e2fsck does before deciding to skip a filesystem
+ * when it's not forced: it must have been cleanly unmounted, have no recorded
+ * errors, orphans, or pending journal recovery, and must not be due for a
+ * periodic check.
+ *
+ * \return Reason for needing a check or nullptr if the filesystem is clean
+ */
+static const char * ext4_check_reason(const std::string &image)
+{
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return "failed to open image";
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    unsigned char sb[EXT4_SB_SIZE];
+    if (pread(fd, sb, sizeof(sb), EXT4_SB_OFFSET)
+            != static_cast<ssize_t>(sizeof(sb))) {
+        return "failed to read superblock";
+    }
+
+    if (mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_MAGIC)) != EXT4_SUPER_MAGIC) {
+        return "invalid superblock magic";
+    }
+
+    auto state = mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_STATE));
+    auto incompat = mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_FEATURE_INCOMPAT));
+    auto mnt_count = mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_MNT_COUNT));
+    auto max_mnt_count = static_cast<int16_t>(
+            mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_MAX_MNT_COUNT)));
+    auto last_check = mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_LASTCHECK));
+    auto check_interval =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_CHECKINTERVAL));
+
+    if (!(state & EXT4_VALID_FS)) {
+        return "not cleanly unmounted";
+    } else if (state & EXT4_ERROR_FS) {
+        return "contains errors";
+    } else if ((state & EXT4_ORPHAN_FS)
+            || sb_field<uint32_t>(sb, EXT4_SB_LAST_ORPHAN) != 0) {
+        return "has orphan inodes";
+    } else if (incompat & EXT4_FEATURE_INCOMPAT_RECOVER) {
+        return "journal needs recovery";
+    } else if (max_mnt_count > 0 && mnt_count >= max_mnt_count) {
+        return "maximum mount count reached";
+    } else if (check_interval != 0
+            && static_cast<uint64_t>(time(nullptr))
+                    >= static_cast<uint64_t>(last_check) + check_interval) {
+        return "check interval elapsed";
+    }
+
+    return nullptr;
+}
+
 bool fsck_ext4_image(const std::string &image)
 {
+    if (auto reason = ext4_check_reason(image); !reason) {
+        LOGD("%s: Filesystem is clean; skipping e2fsck", image.c_str());
+        return true;
+    } else {
+        LOGD("%s: Running e2fsck: %s", image.c_str(), reason);
+    }
+
     int ret = run_command_and_log({ "e2fsck", "-f", "-y", image });
     if (ret < 0 || (WEXITSTATUS(ret) != 0 && WEXITSTATUS(ret) != 1)) {
         LOGE("%s: Failed to e2fsck", image.c_str());
@@ -106,4 +310,699 @@ bool fsck_ext4_image(const std::string &image)
     return true;
 }
 
+static bool pread_exact(int fd, void *buf, size_t size, uint64_t offset)
+{
+    auto ptr = static_cast<unsigned char *>(buf);
+
+    while (size > 0) {
+        ssize_t n = pread64(fd, ptr, size, static_cast<off64_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+
+        ptr += n;
+        size -= static_cast<size_t>(n);
+        offset += static_cast<uint64_t>(n);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Read the block bitmaps of an ext4 image
+ *
+ * Groups whose bitmaps were never initialized are treated as fully allocated.
+ * They are usually holes in the image file anyway.
+ *
+ * \param[in] fd Image file descriptor
+ * \param[out] block_size Filesystem block size
+ * \param[out] allocated Whether each block is in use
+ *
+ * \return Whether the bitmaps were read. If false, the image is not an ext4
+ *         filesystem with a layout that can be parsed.
+ */
+static bool ext4_read_block_bitmaps(int fd, uint32_t &block_size,
+                                    std::vector<bool> &allocated)
+{
+    unsigned char sb[EXT4_SB_SIZE];
+    if (!pread_exact(fd, sb, sizeof(sb), EXT4_SB_OFFSET)
+            || mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_MAGIC))
+                    != EXT4_SUPER_MAGIC) {
+        return false;
+    }
+
+    auto incompat = mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_FEATURE_INCOMPAT));
+    auto ro_compat =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_FEATURE_RO_COMPAT));
+    auto log_block_size =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_LOG_BLOCK_SIZE));
+    auto first_data_block =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_FIRST_DATA_BLOCK));
+    auto blocks_per_group =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_BLOCKS_PER_GROUP));
+    uint64_t blocks_count =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_BLOCKS_COUNT_LO));
+    size_t desc_size = EXT4_MIN_DESC_SIZE;
+
+    if (incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+        blocks_count |= static_cast<uint64_t>(mb_le32toh(
+                sb_field<uint32_t>(sb, EXT4_SB_BLOCKS_COUNT_HI))) << 32;
+        desc_size = mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_DESC_SIZE));
+    }
+
+    // Descriptors are not contiguous with meta_bg and bitmaps track clusters
+    // with bigalloc
+    if ((incompat & EXT4_FEATURE_INCOMPAT_META_BG)
+            || (ro_compat & EXT4_FEATURE_RO_COMPAT_BIGALLOC)
+            || log_block_size > 6
+            || desc_size < EXT4_MIN_DESC_SIZE) {
+        return false;
+    }
+
+    block_size = 1024u << log_block_size;
+
+    if (blocks_per_group == 0 || blocks_per_group > block_size * 8
+            || first_data_block >= blocks_count
+            || blocks_count > UINT32_MAX) {
+        return false;
+    }
+
+    uint64_t groups = (blocks_count - first_data_block + blocks_per_group - 1)
+            / blocks_per_group;
+
+    std::vector<unsigned char> descs(static_cast<size_t>(groups) * desc_size);
+    uint64_t descs_offset =
+            (static_cast<uint64_t>(first_data_block) + 1) * block_size;
+    if (!pread_exact(fd, descs.data(), descs.size(), descs_offset)) {
+        return false;
+    }
+
+    std::vector<unsigned char> bitmap(block_size);
+
+    allocated.assign(static_cast<size_t>(blocks_count), false);
+
+    // Boot block when the block size is 1024
+    for (uint32_t i = 0; i < first_data_block; ++i) {
+        allocated[i] = true;
+    }
+
+    for (uint64_t group = 0; group < groups; ++group) {
+        const unsigned char *desc = descs.data() + group * desc_size;
+        uint64_t start = first_data_block + group * blocks_per_group;
+        uint64_t count = std::min<uint64_t>(blocks_per_group,
+                                            blocks_count - start);
+
+        auto flags = mb_le16toh(sb_field<uint16_t>(desc, EXT4_BG_FLAGS));
+        if (flags & EXT4_BG_BLOCK_UNINIT) {
+            for (uint64_t i = 0; i < count; ++i) {
+                allocated[static_cast<size_t>(start + i)] = true;
+            }
+            continue;
+        }
+
+        uint64_t bitmap_block =
+                mb_le32toh(sb_field<uint32_t>(desc, EXT4_BG_BLOCK_BITMAP_LO));
+        if (desc_size >= EXT4_MIN_DESC_SIZE_64BIT) {
+            bitmap_block |= static_cast<uint64_t>(mb_le32toh(
+                    sb_field<uint32_t>(desc, EXT4_BG_BLOCK_BITMAP_HI))) << 32;
+        }
+
+        if (bitmap_block >= blocks_count
+                || !pread_exact(fd, bitmap.data(), bitmap.size(),
+                                bitmap_block * block_size)) {
+            return false;
+        }
+
+        for (uint64_t i = 0; i < count; ++i) {
+            if (bitmap[static_cast<size_t>(i / 8)] & (1u << (i % 8))) {
+                allocated[static_cast<size_t>(start + i)] = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+struct Extent
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+/*!
+ * \brief Get the extents of a file that contain written data
+ *
+ * Holes and unwritten (fallocated) extents are omitted. If FIEMAP is not
+ * supported, the whole file is returned as one extent.
+ */
+static bool get_data_extents(int fd, uint64_t size,
+                             std::vector<Extent> &extents)
+{
+    constexpr size_t MAX_EXTENTS = 256;
+
+    std::vector<unsigned char> buf(
+            sizeof(fiemap) + MAX_EXTENTS * sizeof(fiemap_extent));
+    auto fm = reinterpret_cast<fiemap *>(buf.data());
+
+    extents.clear();
+
+    uint64_t offset = 0;
+
+    while (offset < size) {
+        memset(buf.data(), 0, buf.size());
+        fm->fm_start = offset;
+        fm->fm_length = size - offset;
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = MAX_EXTENTS;
+
+        if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0) {
+            if (errno == ENOTTY || errno == EOPNOTSUPP) {
+                extents.clear();
+                extents.push_back({0, size});
+                return true;
+            }
+            return false;
+        } else if (fm->fm_mapped_extents == 0) {
+            break;
+        }
+
+        bool last = false;
+
+        for (uint32_t i = 0; i < fm->fm_mapped_extents; ++i) {
+            auto const &fe = fm->fm_extents[i];
+
+            if (!(fe.fe_flags & FIEMAP_EXTENT_UNWRITTEN)) {
+                extents.push_back({fe.fe_logical, fe.fe_length});
+            }
+
+            offset = fe.fe_logical + fe.fe_length;
+
+            if (fe.fe_flags & FIEMAP_EXTENT_LAST) {
+                last = true;
+            }
+        }
+
+        if (last) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Back up the allocated blocks of an ext4 image as a sparse file
+ *
+ * Only blocks that are both in use by the filesystem and backed by written
+ * data in the image file are read. Everything else is recorded as "don't care"
+ * chunks, so the backup is a single sequential pass over the used data.
+ *
+ * \param image Path to ext4 image
+ * \param output_file Output sparse file
+ *
+ * \return Whether the image was successfully backed up
+ */
+bool backup_ext4_image_blocks(const std::string &image,
+                              const std::string &output_file)
+{
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", image.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat: %s", image.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto image_size = static_cast<uint64_t>(sb.st_size);
+
+    uint32_t block_size;
+    std::vector<bool> allocated;
+
+    if (!ext4_read_block_bitmaps(fd, block_size, allocated)) {
+        LOGW("%s: Could not read block bitmaps; backing up all data",
+             image.c_str());
+        block_size = FALLBACK_BLOCK_SIZE;
+        allocated.clear();
+    }
+
+    uint64_t total_blocks = (image_size + block_size - 1) / block_size;
+    if (total_blocks > UINT32_MAX) {
+        LOGE("%s: Image is too large", image.c_str());
+        return false;
+    }
+
+    std::vector<Extent> extents;
+    if (!get_data_extents(fd, image_size, extents)) {
+        LOGE("%s: Failed to get extents: %s", image.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto is_used = [&](uint64_t block) {
+        return allocated.empty()
+                || (block < allocated.size() && allocated[block]);
+    };
+
+    FdFile output;
+    if (auto r = output.open(output_file, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    sparse::SparseWriter writer;
+    if (auto r = writer.open(&output,
+                             sparse::SparseWriterFlag::DontCareZeroBlocks,
+                             block_size); !r) {
+        LOGE("%s: Failed to open sparse writer: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> buf(IMAGE_COPY_BUFFER_SIZE);
+    uint64_t cursor = 0;
+    uint64_t used_blocks = 0;
+
+    auto skip_to = [&](uint64_t block) -> bool {
+        if (block > cursor) {
+            if (auto r = writer.skip_blocks(
+                    static_cast<uint32_t>(block - cursor)); !r) {
+                LOGE("%s: Failed to write: %s", output_file.c_str(),
+                     r.error().message().c_str());
+                return false;
+            }
+            cursor = block;
+        }
+        return true;
+    };
+
+    for (auto const &extent : extents) {
+        uint64_t begin = std::max(extent.offset / block_size, cursor);
+        uint64_t end = std::min(
+                (extent.offset + extent.length + block_size - 1) / block_size,
+                total_blocks);
+
+        for (uint64_t block = begin; block < end;) {
+            if (!is_used(block)) {
+                ++block;
+                continue;
+            }
+
+            uint64_t run_end = block + 1;
+            while (run_end < end && is_used(run_end)
+                    && (run_end - block) * block_size < buf.size()) {
+                ++run_end;
+            }
+
+            if (!skip_to(block)) {
+                return false;
+            }
+
+            uint64_t offset = block * block_size;
+            auto size = static_cast<size_t>(std::min(
+                    (run_end - block) * block_size, image_size - offset));
+
+            auto read_start = std::chrono::steady_clock::now();
+
+            if (!pread_exact(fd, buf.data(), size, offset)) {
+                LOGE("%s: Failed to read: %s", image.c_str(), strerror(errno));
+                return false;
+            }
+
+            auto write_start = std::chrono::steady_clock::now();
+            util::metrics_add_read(size, write_start - read_start);
+
+            if (auto r = file_write_exact(writer, buf.data(), size); !r) {
+                LOGE("%s: Failed to write: %s", output_file.c_str(),
+                     r.error().message().c_str());
+                return false;
+            }
+
+            util::metrics_add_write(
+                    size, std::chrono::steady_clock::now() - write_start);
+
+            used_blocks += run_end - block;
+            cursor = run_end;
+            block = run_end;
+        }
+    }
+
+    if (!skip_to(total_blocks)) {
+        return false;
+    }
+
+    if (auto r = writer.close(); !r) {
+        LOGE("%s: Failed to close sparse writer: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = output.close(); !r) {
+        LOGE("%s: Failed to close: %s",
+             output_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    util::metrics_add_files(1, used_blocks * block_size);
+
+    LOGD("%s: Backed up %" PRIu64 "/%" PRIu64 " blocks of %" PRIu32 " bytes",
+         image.c_str(), used_blocks, total_blocks, block_size);
+
+    return true;
+}
+
+/*!
+ * \brief Restore an ext4 image from a sparse file
+ *
+ * The image is recreated from scratch. Unallocated and zero regions are left
+ * as holes instead of being written out.
+ *
+ * \param input_file Sparse file created by backup_ext4_image_blocks()
+ * \param image Path to ext4 image
+ *
+ * \return Whether the image was successfully restored
+ */
+bool restore_ext4_image_blocks(const std::string &input_file,
+                               const std::string &image)
+{
+    FdFile input;
+    if (auto r = input.open(input_file, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    sparse::SparseFile sparse_file;
+    if (auto r = sparse_file.open(&input); !r) {
+        LOGE("%s: Failed to open sparse file: %s",
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = util::mkdir_parent(image, S_IRWXU); !r) {
+        LOGE("%s: Failed to create parent directory: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    FdFile output;
+    if (auto r = output.open(image, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = sparse::sparse_copy(sparse_file, output,
+                                     sparse::SparseCopyFlag::OutputIsZeroed);
+            !r) {
+        LOGE("%s: Failed to restore from %s: %s", image.c_str(),
+             input_file.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = output.close(); !r) {
+        LOGE("%s: Failed to close: %s",
+             image.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Read the block size and block count from an ext4 superblock
+ */
+static bool ext4_read_geometry(const std::string &image, uint32_t &block_size,
+                               uint64_t &blocks_count)
+{
+    int fd = open(image.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", image.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    unsigned char sb[EXT4_SB_SIZE];
+    if (!pread_exact(fd, sb, sizeof(sb), EXT4_SB_OFFSET)
+            || mb_le16toh(sb_field<uint16_t>(sb, EXT4_SB_MAGIC))
+                    != EXT4_SUPER_MAGIC) {
+        LOGE("%s: Failed to read ext4 superblock", image.c_str());
+        return false;
+    }
+
+    auto incompat = mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_FEATURE_INCOMPAT));
+    auto log_block_size =
+            mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_LOG_BLOCK_SIZE));
+    if (log_block_size > 6) {
+        LOGE("%s: Invalid block size", image.c_str());
+        return false;
+    }
+
+    block_size = 1024u << log_block_size;
+    blocks_count = mb_le32toh(sb_field<uint32_t>(sb, EXT4_SB_BLOCKS_COUNT_LO));
+
+    if (incompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+        blocks_count |= static_cast<uint64_t>(mb_le32toh(
+                sb_field<uint32_t>(sb, EXT4_SB_BLOCKS_COUNT_HI))) << 32;
+    }
+
+    return true;
+}
+
+static bool e2fsck_forced(const std::string &image)
+{
+    int ret = run_command_and_log({ "e2fsck", "-f", "-y", image });
+    if (ret < 0 || !WIFEXITED(ret)
+            || (WEXITSTATUS(ret) != 0 && WEXITSTATUS(ret) != 1)) {
+        LOGE("%s: Failed to e2fsck", image.c_str());
+        return false;
+    }
+    return true;
+}
+
+static bool resize2fs(const std::string &image, const std::string &size)
+{
+    std::vector<std::string> args{ "resize2fs", image };
+    if (!size.empty()) {
+        args.push_back(size);
+    }
+
+    int ret = run_command_and_log(args);
+    if (ret < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0) {
+        LOGE("%s: Failed to resize filesystem", image.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Release the free blocks of an ext4 image back to the host filesystem
+ *
+ * The image is mounted through a loop device and FITRIM is issued on it. The
+ * loop driver turns the discards into holes in the image file. This requires
+ * a host filesystem that can punch holes (eg. not FAT).
+ *
+ * \param image Path to image. It must not be mounted.
+ * \param[out] trimmed Number of bytes that the filesystem discarded
+ *
+ * \return Whether the image was trimmed
+ */
+bool trim_ext4_image(const std::string &image, uint64_t &trimmed)
+{
+    util::MetricsStage stage("trim-image");
+
+    util::LoopDevicePool loop_pool;
+
+    auto loopdev = loop_pool.attach(image, 0, util::LoopDeviceFlag::DirectIo);
+    if (!loopdev) {
+        LOGE("%s: Failed to attach to loop device: %s",
+             image.c_str(), loopdev.error().message().c_str());
+        return false;
+    }
+
+    auto const &loopdev_path = loopdev.value().path();
+
+    if (auto r = util::loopdev_supports_discard(loopdev_path); !r) {
+        LOGE("%s: Failed to check discard support: %s",
+             loopdev_path.c_str(), r.error().message().c_str());
+        return false;
+    } else if (!r.value()) {
+        LOGE("%s: Host filesystem cannot deallocate image blocks",
+             image.c_str());
+        return false;
+    }
+
+    char mount_point[] = "/tmp/mbtool-trim.XXXXXX";
+    if (!mkdtemp(mount_point)) {
+        LOGE("Failed to create temporary directory: %s", strerror(errno));
+        return false;
+    }
+
+    auto remove_mount_point = finally([&] {
+        rmdir(mount_point);
+    });
+
+    if (auto r = util::mount(loopdev_path, mount_point, "ext4",
+                             MS_NOATIME | MS_NODEV | MS_NOSUID, ""); !r) {
+        LOGE("%s: Failed to mount at %s: %s", image.c_str(), mount_point,
+             r.error().message().c_str());
+        return false;
+    }
+
+    auto unmount = finally([&] {
+        if (auto r = util::umount(mount_point); !r) {
+            LOGW("%s: Failed to unmount: %s",
+                 mount_point, r.error().message().c_str());
+        }
+    });
+
+    int fd = open(mount_point, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open: %s", mount_point, strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct fstrim_range range = {};
+    range.len = UINT64_MAX;
+
+    if (ioctl(fd, FITRIM, &range) < 0) {
+        LOGE("%s: Failed to trim: %s", image.c_str(), strerror(errno));
+        return false;
+    }
+
+    trimmed = range.len;
+    return true;
+}
+
+/*!
+ * \brief Shrink an ext4 image to its used size plus some free space
+ *
+ * ext4 cannot shrink while mounted, so e2fsck and resize2fs are run on the
+ * image file and the file is truncated to the new filesystem size. This also
+ * helps on host filesystems where trim_ext4_image() is not supported.
+ *
+ * \param image Path to image. It must not be mounted.
+ * \param[out] new_size New size of the image
+ *
+ * \return Whether the image was checked and shrunk (or was already small
+ *         enough)
+ */
+bool shrink_ext4_image(const std::string &image, uint64_t &new_size)
+{
+    util::MetricsStage stage("shrink-image");
+
+    if (!e2fsck_forced(image)) {
+        return false;
+    }
+
+    uint64_t min_blocks = 0;
+    static constexpr char min_size_prefix[] =
+            "Estimated minimum size of the filesystem: ";
+
+    int ret = util::run_command("resize2fs", { "resize2fs", "-P", image },
+                                {}, {}, [&](std::string_view line, bool error) {
+        (void) error;
+
+        if (starts_with(line, min_size_prefix)) {
+            line.remove_prefix(sizeof(min_size_prefix) - 1);
+            if (!line.empty() && line.back() == '\n') {
+                line.remove_suffix(1);
+            }
+            (void) str_to_num(std::string(line).c_str(), 10, min_blocks);
+        }
+    });
+    if (ret < 0 || !WIFEXITED(ret) || WEXITSTATUS(ret) != 0
+            || min_blocks == 0) {
+        LOGE("%s: Failed to get minimum filesystem size", image.c_str());
+        return false;
+    }
+
+    uint32_t block_size;
+    uint64_t blocks_count;
+
+    if (!ext4_read_geometry(image, block_size, blocks_count)) {
+        return false;
+    }
+
+    // Leave room for the ROM to keep running
+    uint64_t target_blocks = min_blocks + std::max<uint64_t>(
+            min_blocks * SHRINK_FREE_PERCENT / 100,
+            SHRINK_MIN_FREE_SIZE / block_size);
+
+    if (target_blocks < blocks_count) {
+        LOGD("%s: Shrinking from %" PRIu64 " to %" PRIu64 " blocks",
+             image.c_str(), blocks_count, target_blocks);
+
+        if (!resize2fs(image, std::to_string(target_blocks))
+                || !ext4_read_geometry(image, block_size, blocks_count)) {
+            return false;
+        }
+    }
+
+    new_size = blocks_count * block_size;
+
+    if (truncate64(image.c_str(), static_cast<off64_t>(new_size)) < 0) {
+        LOGE("%s: Failed to truncate to %" PRIu64 " bytes: %s",
+             image.c_str(), new_size, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Grow an ext4 image that is smaller than \p size
+ *
+ * Images shrunk by shrink_ext4_image() are grown back before installing to
+ * them so that the updater can use the full size. The new space is sparse.
+ *
+ * \param image Path to image. Nothing is done if it does not exist.
+ * \param size Minimum size of the image
+ *
+ * \return Whether the image is now at least \p size bytes
+ */
+bool grow_ext4_image(const std::string &image, uint64_t size)
+{
+    struct stat sb;
+    if (stat(image.c_str(), &sb) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        LOGE("%s: Failed to stat: %s", image.c_str(), strerror(errno));
+        return false;
+    } else if (static_cast<uint64_t>(sb.st_size) >= size) {
+        return true;
+    }
+
+    LOGD("%s: Growing from %" PRIu64 " to %" PRIu64 " bytes", image.c_str(),
+         static_cast<uint64_t>(sb.st_size), size);
+
+    if (truncate64(image.c_str(), static_cast<off64_t>(size)) < 0) {
+        LOGE("%s: Failed to truncate to %" PRIu64 " bytes: %s",
+             image.c_str(), size, strerror(errno));
+        return false;
+    }
+
+    return e2fsck_forced(image) && resize2fs(image, {});
+}
+
 }
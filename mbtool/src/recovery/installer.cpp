@@ -22,6 +22,7 @@
 // C++
 #include <algorithm>
 #include <chrono>
+#include <thread>
 
 // C
 #include <cstring>
@@ -29,6 +30,7 @@
 // Linux/posix
 #include <dirent.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sched.h>
 #include <signal.h>
 #include <sys/mount.h>
@@ -41,6 +43,9 @@
 #include <linux/loop.h>
 
 // libmbcommon
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/hashing.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
@@ -61,8 +66,8 @@
 #include "mbutil/directory.h"
 #include "mbutil/file.h"
 #include "mbutil/fstab.h"
-#include "mbutil/hash.h"
 #include "mbutil/loopdev.h"
+#include "mbutil/metrics.h"
 #include "mbutil/mount.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
@@ -71,11 +76,11 @@
 // Local
 #include "recovery/image.h"
 #include "recovery/installer_util.h"
+#include "util/dedup.h"
 #include "util/multiboot.h"
 #include "util/signature.h"
 #include "util/romconfig.h"
 #include "util/switcher.h"
-#include "util/wipe.h"
 
 #define LOG_TAG "mbtool/recovery/installer"
 
@@ -106,7 +111,6 @@ namespace mb
 {
 
 using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
-using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
 const std::string Installer::CANCELLED = "cancelled";
 
@@ -120,6 +124,8 @@ Installer::Installer(std::string zip_file, std::string chroot_dir,
     , _interface(interface)
     , _output_fd(output_fd)
     , _flags(flags)
+    , _system_image_size(DEFAULT_IMAGE_SIZE)
+    , _temp_image_created(false)
     , _ran(false)
 {
     _passthrough = _output_fd >= 0;
@@ -129,6 +135,7 @@ Installer::Installer(std::string zip_file, std::string chroot_dir,
 
 Installer::~Installer()
 {
+    wait_for_image_creation();
 }
 
 
@@ -266,14 +273,73 @@ std::string Installer::in_chroot(const std::string &path) const
     }
 }
 
+// Mount a partition using the recovery's TWRP-style fstab. Returns false if
+// the partition is not listed or could not be mounted.
+static bool mount_from_recovery_fstab(const util::TwrpFstabRecs &fstab,
+                                      const char *mount_point, bool read_only)
+{
+    for (auto const &rec : fstab) {
+        if (rec.mount_point != mount_point || rec.blk_devices.empty()
+                || rec.fs_type.empty() || rec.fs_type == "auto") {
+            continue;
+        }
+
+        if (auto r = util::mount(rec.blk_devices[0], mount_point, rec.fs_type,
+                                 read_only ? MS_RDONLY : 0, {}); !r) {
+            LOGW("Failed to mount %s (%s) at %s: %s",
+                 rec.blk_devices[0].c_str(), rec.fs_type.c_str(), mount_point,
+                 r.error().message().c_str());
+            return false;
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
 bool Installer::create_chroot()
 {
-    // We'll just call the recovery's mount tools directly to avoid having to
-    // parse TWRP and CWM's different fstab formats
-    run_command({ "mount", "/system" });
-    run_command({ "mount", "/cache" });
-    run_command({ "mount", "/data" });
-    run_command({ "mount", "-o", "ro", "/efs" });
+    static constexpr struct {
+        const char *mount_point;
+        bool read_only;
+    } recovery_mounts[] = {
+        { "/system", false },
+        { "/cache", false },
+        { "/data", false },
+        { "/efs", true },
+    };
+
+    util::MountTable mounts;
+    if (auto r = mounts.refresh(); !r) {
+        LOGE("Failed to read mount table: %s", r.error().message().c_str());
+        return false;
+    }
+
+    // Mount the partitions directly if they are listed in the recovery's
+    // fstab. Otherwise, call the recovery's mount tool to avoid having to
+    // parse CWM's and older recoveries' different fstab formats.
+    util::TwrpFstabRecs fstab;
+    if (auto r = util::read_twrp_fstab("/etc/recovery.fstab")) {
+        fstab = std::move(r.value());
+    } else {
+        LOGW("Failed to read recovery fstab: %s",
+             r.error().message().c_str());
+    }
+
+    for (auto const &m : recovery_mounts) {
+        if (mounts.find_by_target(m.mount_point)
+                || mount_from_recovery_fstab(fstab, m.mount_point,
+                                             m.read_only)) {
+            continue;
+        }
+
+        if (m.read_only) {
+            run_command({ "mount", "-o", "ro", m.mount_point });
+        } else {
+            run_command({ "mount", m.mount_point });
+        }
+    }
 
     // Remount as writable (needed for in-app flashing)
     log_mount("", Roms::get_system_partition().c_str(), "", MS_REMOUNT, "");
@@ -281,11 +347,16 @@ bool Installer::create_chroot()
     log_mount("", Roms::get_data_partition().c_str(), "", MS_REMOUNT, "");
 
     // Make sure everything really is mounted
-    if (!log_is_mounted("/system")
-            || !log_is_mounted("/cache")
-            || !log_is_mounted("/data")) {
+    if (auto r = mounts.refresh(); !r) {
+        LOGE("Failed to read mount table: %s", r.error().message().c_str());
         return false;
     }
+    for (auto const &m : recovery_mounts) {
+        if (!m.read_only && !mounts.find_by_target(m.mount_point)) {
+            LOGE("%s: Not mounted", m.mount_point);
+            return false;
+        }
+    }
 
     // Unmount everything previously mounted in the chroot
     if (!log_unmount_all(_chroot)) {
@@ -380,17 +451,14 @@ bool Installer::create_chroot()
         return false;
     }
 
-    // We need /dev/input/* and /dev/graphics/* for AROMA
-    if (!log_copy_dir("/dev/input", in_chroot("/dev/input"),
-                      util::CopyFlag::CopyAttributes
-                    | util::CopyFlag::CopyXattrs
-                    | util::CopyFlag::ExcludeTopLevel)) {
-        return false;
-    }
-    if (!log_copy_dir("/dev/graphics", in_chroot("/dev/graphics"),
-                      util::CopyFlag::CopyAttributes
-                    | util::CopyFlag::CopyXattrs
-                    | util::CopyFlag::ExcludeTopLevel)) {
+    // We need /dev/input/* and /dev/graphics/* for AROMA. Bind mount them
+    // instead of recreating every node.
+    if (log_mkdir(in_chroot("/dev/input").c_str(), 0755) < 0
+            || log_mount("/dev/input", in_chroot("/dev/input").c_str(),
+                         "", MS_BIND, "") < 0
+            || log_mkdir(in_chroot("/dev/graphics").c_str(), 0755) < 0
+            || log_mount("/dev/graphics", in_chroot("/dev/graphics").c_str(),
+                         "", MS_BIND, "") < 0) {
         return false;
     }
 
@@ -427,6 +495,8 @@ bool Installer::destroy_chroot() const
     log_umount(in_chroot("/data").c_str());
     log_umount(in_chroot("/efs").c_str());
 
+    log_umount(in_chroot("/dev/input").c_str());
+    log_umount(in_chroot("/dev/graphics").c_str());
     log_umount(in_chroot("/dev/pts").c_str());
     log_umount(in_chroot("/dev").c_str());
     log_umount(in_chroot("/proc").c_str());
@@ -595,25 +665,30 @@ bool Installer::extract_multiboot_files()
         });
     }
 
-    if (!util::extract_files2(_zip_file, files)) {
+    if (!_zip_index.extract(files)) {
         LOGE("Failed to extract all multiboot files");
         return false;
     }
 
-    std::vector<std::string> sigcheck{
+    std::vector<std::pair<std::string, std::string>> sigcheck;
+
+    for (auto const &path : {
         _temp + "/mbtool",
         _temp + "/bb-wrapper.sh",
         _temp + "/binaries/file-contexts-tool",
         _temp + "/binaries/fsck-wrapper",
         _temp + "/binaries/mbtool",
         _temp + "/binaries/mount.exfat",
-    };
+    }) {
+        sigcheck.emplace_back(path, path + ".sig");
+    }
+
+    auto results = verify_signatures_batch(sigcheck);
 
-    for (auto const &item : sigcheck) {
-        SigVerifyResult result =
-                verify_signature(item.c_str(), (item + ".sig").c_str());
-        if (result != SigVerifyResult::Valid) {
-            LOGE("%s: Signature verification failed", item.c_str());
+    for (size_t i = 0; i < sigcheck.size(); ++i) {
+        if (results[i] != SigVerifyResult::Valid) {
+            LOGE("%s: Signature verification failed",
+                 sigcheck[i].first.c_str());
             return false;
         }
     }
@@ -673,13 +748,98 @@ bool Installer::create_image(const std::string &path, uint64_t size)
     return result == CreateImageResult::Succeeded;
 }
 
+/*!
+ * \brief Create the images needed by the mount stage on a separate thread
+ *
+ * Missing cache, data, and system images and the temporary system image are
+ * created while the chroot is being set up. The worker only logs failures.
+ * Images that couldn't be created are left for install_stage_mount_filesystems()
+ * to create as usual, which reports the error to the user.
+ */
+void Installer::start_image_creation()
+{
+    if (_flags & InstallerFlag::SkipMountingVolumes) {
+        return;
+    }
+
+    if (auto size = util::get_blockdev_size(_system_block_dev)) {
+        _system_image_size = size.value();
+    } else {
+        display_msg("Failed to get size of system partition");
+        display_msg("Image size will be 4 GiB");
+    }
+
+    std::vector<std::pair<std::string, uint64_t>> images;
+    struct stat sb;
+
+    if (_rom->cache_is_image && stat(_cache_path.c_str(), &sb) < 0) {
+        images.emplace_back(_cache_path, DEFAULT_IMAGE_SIZE);
+    }
+    if (_rom->data_is_image && stat(_data_path.c_str(), &sb) < 0) {
+        images.emplace_back(_data_path, DEFAULT_IMAGE_SIZE);
+    }
+    if (_rom->system_is_image && stat(_system_path.c_str(), &sb) < 0) {
+        images.emplace_back(_system_path, _system_image_size);
+    }
+
+    for (auto const &[path, size] : images) {
+        double mib = static_cast<double>(size) / 1024 / 1024;
+
+        display_msg("Creating image (%.1f MiB) at %s", mib, path.c_str());
+    }
+
+    // Try /data first. The external SD fallback is handled in the mount stage.
+    if (!_rom->system_is_image && (_has_block_image || _rom->id == "primary")) {
+        _temp_image_path = Roms::get_data_partition();
+        _temp_image_path += "/.system.img.tmp";
+        remove(_temp_image_path.c_str());
+
+        images.emplace_back(_temp_image_path, _system_image_size);
+    }
+
+    if (images.empty()) {
+        return;
+    }
+
+    _image_thread = std::thread([this, images = std::move(images)] {
+        util::MetricsStage stage("create-images");
+
+        for (auto const &[path, size] : images) {
+            bool ok;
+
+            if (auto r = util::mkdir_parent(path, S_IRWXU); !r) {
+                LOGE("%s: Failed to create parent directory: %s",
+                     path.c_str(), r.error().message().c_str());
+                ok = false;
+            } else {
+                ok = create_ext4_image(path, size)
+                        == CreateImageResult::Succeeded;
+            }
+
+            if (!ok) {
+                // Don't leave a partial image for the mount stage to attach
+                remove(path.c_str());
+            } else if (path == _temp_image_path) {
+                _temp_image_created = true;
+            }
+        }
+    });
+}
+
+void Installer::wait_for_image_creation()
+{
+    if (_image_thread.joinable()) {
+        _image_thread.join();
+    }
+}
+
 /*!
  * \brief Copy a /system directory to an image file
  *
  * \param source Source directory
  * \param image Target image file
  * \param reverse If non-zero, then the image file is the source and the
- *                directory is the target
+ *                directory is synced to match it
  */
 bool Installer::system_image_copy(const std::string &source,
                                   const std::string &image, bool reverse)
@@ -710,7 +870,8 @@ bool Installer::system_image_copy(const std::string &source,
     });
 
     if (reverse) {
-        if (!copy_system(temp_mnt, source)) {
+        // Only the files that the updater changed need to be written back
+        if (!sync_system(temp_mnt, source)) {
             LOGE("Failed to copy system files from %s to %s",
                  temp_mnt.c_str(), source.c_str());
             return false;
@@ -763,25 +924,20 @@ bool Installer::mount_dir_or_image(const std::string &source,
             }
         }
 
-        auto loopdev = util::loopdev_find_unused();
+        auto loopdev = _loop_pool.attach(source, 0,
+                                         util::LoopDeviceFlag::DirectIo);
         if (!loopdev) {
-            LOGE("Failed to find unused loop device: %s",
-                 loopdev.error().message().c_str());
+            LOGE("Failed to attach %s to loop device: %s",
+                 source.c_str(), loopdev.error().message().c_str());
             return false;
         }
-        if (auto ret = util::loopdev_set_up_device(
-                loopdev.value(), source, 0, false); !ret) {
-            LOGE("Failed to attach %s to %s: %s",
-                 loopdev.value().c_str(), source.c_str(),
-                 ret.error().message().c_str());
-            return false;
-        }
-        if (auto r = util::copy_file(loopdev.value(), loop_target, 0); !r) {
+        if (auto r = util::copy_file(loopdev.value().path(), loop_target, 0);
+                !r) {
             LOGE("%s", r.error().message().c_str());
             return false;
         }
 
-        _associated_loop_devs.push_back(std::move(loopdev.value()));
+        _loop_devs.push_back(std::move(loopdev.value()));
     } else {
         if (!util::mkdir_recursive(source, 0771)
                 || !util::mkdir_recursive(bind_target, 0771)
@@ -874,72 +1030,142 @@ bool Installer::set_up_legacy_properties()
     return true;
 }
 
-bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
+// Parse updater commands from complete lines. Consecutive ui_print output is
+// passed to updater_print() as one batch.
+void Installer::updater_commands(std::string_view data)
 {
-    int status;
-    pid_t pid = fork();
+    std::string batch;
 
-    if (pid < 0) {
-        LOGE("Failed to fork updater fd reader process");
-    } else if (pid == 0) {
-        // Don't need command_fd in the child process
-        close(command_fd);
+    while (!data.empty()) {
+        auto pos = data.find('\n');
+        auto line = data.substr(0, pos);
+        data.remove_prefix(pos == std::string_view::npos ? data.size() : pos + 1);
 
-        // Read program output in child process (stdout, stderr)
-        char buf[1024];
+        // Similar parsing to AOSP recovery
+        auto begin = line.find_first_not_of(' ');
+        if (begin == std::string_view::npos) {
+            continue;
+        }
+        line.remove_prefix(begin);
 
-        ScopedFILE fp(fdopen(stdio_fd, "rb"), fclose);
-        if (!fp) {
-            _exit(EXIT_FAILURE);
+        auto end = line.find(' ');
+        auto cmd = line.substr(0, end);
+        auto arg = end == std::string_view::npos
+                ? std::string_view() : line.substr(end + 1);
+
+        if (cmd == "ui_print") {
+            if (arg.empty()) {
+                batch += '\n';
+            } else {
+                batch += arg;
+            }
+            continue;
         }
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            command_output(buf);
+        if (!batch.empty()) {
+            updater_print(batch);
+            batch.clear();
         }
 
-        _exit(EXIT_SUCCESS);
-    } else {
-        // Read special command fd in parent process
+        if (cmd == "progress"
+                || cmd == "set_progress"
+                || cmd == "wipe_cache"
+                || cmd == "clear_display"
+                || cmd == "enable_reboot") {
+            // Ignore
+        } else {
+            LOGE("Unknown updater command: %.*s",
+                 static_cast<int>(cmd.size()), cmd.data());
+        }
+    }
 
-        char buf[1024];
-        char *save_ptr;
+    if (!batch.empty()) {
+        updater_print(batch);
+    }
+}
 
-        // Similar parsing to AOSP recovery
-        ScopedFILE fp(fdopen(command_fd, "rb"), fclose);
+/*!
+ * \brief Read updater output and commands until both pipes are closed
+ *
+ * Both pipes are read with poll() in the calling process. All complete lines
+ * that are available are handled at once, so the updater does not block on a
+ * full pipe while its output is being processed line by line.
+ */
+bool Installer::updater_fd_reader(int stdio_fd, int command_fd)
+{
+    static constexpr size_t READ_SIZE = 64 * 1024;
 
-        while (fgets(buf, sizeof(buf), fp.get())) {
-            char *cmd = strtok_r(buf, " \n", &save_ptr);
-            if (!cmd) {
+    pollfd fds[2] = {
+        { stdio_fd, POLLIN, 0 },
+        { command_fd, POLLIN, 0 },
+    };
+    std::string pending[2];
+    std::vector<char> buf(READ_SIZE);
+    bool ret = true;
+
+    auto handle = [&](size_t i, bool eof) {
+        auto &data = pending[i];
+
+        size_t size = data.size();
+        if (!eof) {
+            auto pos = data.rfind('\n');
+            size = pos == std::string::npos ? 0 : pos + 1;
+
+            // Don't let output without newlines accumulate indefinitely
+            if (size == 0 && i == 0 && data.size() >= READ_SIZE) {
+                size = data.size();
+            }
+        }
+        if (size == 0) {
+            return;
+        }
+
+        if (i == 0) {
+            command_output(std::string_view(data).substr(0, size));
+        } else {
+            updater_commands(std::string_view(data).substr(0, size));
+        }
+
+        data.erase(0, size);
+    };
+
+    while (fds[0].fd >= 0 || fds[1].fd >= 0) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
                 continue;
-            } else if (strcmp(cmd, "progress") == 0
-                    || strcmp(cmd, "set_progress") == 0
-                    || strcmp(cmd, "wipe_cache") == 0
-                    || strcmp(cmd, "clear_display") == 0
-                    || strcmp(cmd, "enable_reboot") == 0) {
-                // Ignore
-            } else if (strcmp(cmd, "ui_print") == 0) {
-                char *str = strtok_r(nullptr, "\n", &save_ptr);
-                if (str) {
-                    updater_print(str);
-                } else {
-                    updater_print("\n");
-                }
-            } else {
-                LOGE("Unknown updater command: %s", cmd);
             }
+            LOGE("Failed to poll updater pipes: %s", strerror(errno));
+            ret = false;
+            break;
         }
 
-        do {
-            if (waitpid(pid, &status, 0) < 0) {
-                LOGE("Failed to waitpid(): %s", strerror(errno));
-                return false;
+        for (size_t i = 0; i < 2; ++i) {
+            if (fds[i].fd < 0 || fds[i].revents == 0) {
+                continue;
             }
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
 
-        return true;
+            ssize_t n = read(fds[i].fd, buf.data(), buf.size());
+            if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0) {
+                LOGE("Failed to read updater pipe: %s", strerror(errno));
+                ret = false;
+            } else if (n > 0) {
+                pending[i].append(buf.data(), static_cast<size_t>(n));
+                handle(i, false);
+                continue;
+            }
+
+            handle(i, true);
+            fds[i].fd = -1;
+        }
     }
 
-    return false;
+    for (size_t i = 0; i < 2; ++i) {
+        handle(i, true);
+    }
+
+    return ret;
 }
 
 /*!
@@ -1090,7 +1316,7 @@ bool Installer::run_real_updater()
                 close(stdio_fds[1]);
 
                 if (!updater_fd_reader(stdio_fds[0], pipe_fds[0])) {
-                    LOGW("Updater fd reader process failed");
+                    LOGW("Failed to read updater output");
                 }
 
                 close(pipe_fds[0]);
@@ -1285,7 +1511,7 @@ Installer::ProceedState Installer::install_stage_initialize()
         { "system.img", false },
         { "system.img.sparse", false },
     };
-    if (!util::archive_exists(_zip_file, info)) {
+    if (!_zip_index.open(_zip_file) || !_zip_index.exists(info)) {
         LOGE("Failed to read zip file");
     } else {
         _has_block_image = false;
@@ -1558,6 +1784,10 @@ Installer::ProceedState Installer::install_stage_set_up_chroot()
 {
     LOGD("[Installer] Chroot set up stage");
 
+    // Creating the images doesn't depend on anything below, so let it overlap
+    // with backing up and patching the boot image
+    start_image_creation();
+
     // Save a copy of the boot image that we'll restore if the installation fails
     if (auto r = util::copy_contents(
             _boot_block_dev, _temp + "/boot.orig"); !r) {
@@ -1631,11 +1861,30 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
 {
     LOGD("[Installer] Filesystem mounting stage");
 
+    // Files that were hard-linked to another ROM's files by mbtool dedup must
+    // be split before the updater writes to them. This is done even if the
+    // volumes are mounted by the caller since the updater writes to the same
+    // directory.
+    if (!_rom->system_is_image && !dedup_unshare_hardlinks(_system_path)) {
+        display_msg("Failed to unshare files in %s", _system_path.c_str());
+        return ProceedState::Fail;
+    }
+
     if (_flags & InstallerFlag::SkipMountingVolumes) {
         LOGV("Skipping filesystem mounting stage");
         return ProceedState::Continue;
     }
 
+    // The system image (or the temporary system image) may need a loop device
+    // in addition to the cache and data images
+    size_t loop_devs = 1u + _rom->cache_is_image + _rom->data_is_image;
+    if (auto r = _loop_pool.reserve(loop_devs); !r) {
+        LOGW("Failed to reserve loop devices: %s",
+             r.error().message().c_str());
+    }
+
+    wait_for_image_creation();
+
     if (!mount_dir_or_image(_cache_path,
                             in_chroot(CHROOT_CACHE_BIND_MOUNT),
                             in_chroot(CHROOT_CACHE_LOOP_DEV),
@@ -1659,13 +1908,8 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
         return ProceedState::Fail;
     }
 
-    // Get desired system image size
-    auto system_size = util::get_blockdev_size(_system_block_dev);
-    if (!system_size) {
-        display_msg("Failed to get size of system partition");
-        display_msg("Image size will be 4 GiB");
-        system_size = DEFAULT_IMAGE_SIZE;
-    }
+    // Desired system image size was determined by start_image_creation()
+    uint64_t system_size = _system_image_size;
 
     bool system_is_image = _rom->system_is_image;
     std::string system_path = _system_path;
@@ -1675,11 +1919,15 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
         // Try /data/.system.img.tmp and if /data doesn't have enough space,
         // then try [External SD]/.system.img.tmp
 
-        _temp_image_path = Roms::get_data_partition();
-        _temp_image_path += "/.system.img.tmp";
-        remove(_temp_image_path.c_str());
+        // The image on /data is usually created in the background already
+        if (!_temp_image_created) {
+            _temp_image_path = Roms::get_data_partition();
+            _temp_image_path += "/.system.img.tmp";
+            remove(_temp_image_path.c_str());
+        }
 
-        if (!create_image(_temp_image_path, system_size.value())) {
+        if (!_temp_image_created
+                && !create_image(_temp_image_path, system_size)) {
             display_msg("Failed to create temporary image %s",
                         _temp_image_path.c_str());
 
@@ -1693,7 +1941,7 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
                 _temp_image_path += "/.system.img.tmp";
                 remove(_temp_image_path.c_str());
 
-                if (!create_image(_temp_image_path, system_size.value())) {
+                if (!create_image(_temp_image_path, system_size)) {
                     return ProceedState::Fail;
                 }
             } else {
@@ -1714,12 +1962,19 @@ Installer::ProceedState Installer::install_stage_mount_filesystems()
 
         system_is_image = true;
         system_path = _temp_image_path;
+    } else if (system_is_image) {
+        // compact-image may have shrunk the image, but the updater expects
+        // the full size
+        if (!grow_ext4_image(system_path, system_size)) {
+            display_msg("Failed to grow image %s", system_path.c_str());
+            return ProceedState::Fail;
+        }
     }
 
     if (!mount_dir_or_image(system_path,
                             in_chroot(CHROOT_SYSTEM_BIND_MOUNT),
                             in_chroot(CHROOT_SYSTEM_LOOP_DEV),
-                            system_is_image, system_size.value())) {
+                            system_is_image, system_size)) {
         return ProceedState::Fail;
     }
 
@@ -1837,12 +2092,14 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
     run_command_chroot(_chroot, { HELPER_TOOL, "unmount", "/data" });
 
     // Disassociate loop devices
-    for (const std::string &loop_dev : _associated_loop_devs) {
-        if (auto ret = util::loopdev_remove_device(loop_dev); !ret) {
+    for (util::LoopDevice &loop_dev : _loop_devs) {
+        std::string path = loop_dev.path();
+        if (auto ret = loop_dev.detach(); !ret) {
             LOGE("%s: Failed to disassociate loop device: %s",
-                 loop_dev.c_str(), ret.error().message().c_str());
+                 path.c_str(), ret.error().message().c_str());
         }
     }
+    _loop_devs.clear();
 
     if (_rom->cache_is_image && !util::umount(in_chroot("/cache"))) {
         display_msg("Failed to unmount %s", in_chroot("/cache").c_str());
@@ -1857,18 +2114,20 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
         if (!fsck_ext4_image(_system_path)) {
             display_msg("Failed to run e2fsck on image");
         }
+
+        // Release the blocks that the updater freed. This is best effort
+        // since not every host filesystem can punch holes.
+        if (uint64_t trimmed; trim_ext4_image(_system_path, trimmed)) {
+            LOGD("%s: Discarded %" PRIu64 " bytes",
+                 _system_path.c_str(), trimmed);
+        }
     } else {
         if (!(_flags & InstallerFlag::SkipMountingVolumes)
                 && (_has_block_image || _rom->id == "primary")) {
             display_msg("Copying temporary image to system");
 
-            // Format system directory
-            if (!wipe_directory(_system_path, {})) {
-                display_msg("Failed to wipe %s", _system_path.c_str());
-                return ProceedState::Fail;
-            }
-
-            // Copy image back to system directory
+            // Copy image back to system directory. This replaces everything
+            // outside of the multiboot directory, like wiping it first would.
             if (!system_image_copy(_system_path, _temp_image_path, true)) {
                 display_msg("Failed to copy %s to %s",
                             _temp_image_path.c_str(), _system_path.c_str());
@@ -1881,6 +2140,27 @@ Installer::ProceedState Installer::install_stage_unmount_filesystems()
     return on_unmounted_filesystems();
 }
 
+/*!
+ * \brief Copy a file and compute the SHA512 digest of its contents in one pass
+ */
+static oc::result<std::vector<unsigned char>>
+copy_file_with_sha512(const std::string &source, const std::string &target)
+{
+    FdFile in_file;
+    OUTCOME_TRYV(in_file.open(source, FileOpenMode::ReadOnly));
+
+    HashingFile hashing_file;
+    OUTCOME_TRYV(hashing_file.open(&in_file, HashAlgorithm::Sha512));
+
+    FdFile out_file;
+    OUTCOME_TRYV(out_file.open(target, FileOpenMode::WriteOnly));
+
+    OUTCOME_TRYV(file_copy(hashing_file, out_file, {}));
+    OUTCOME_TRYV(out_file.close());
+
+    return hashing_file.digest(HashAlgorithm::Sha512);
+}
+
 Installer::ProceedState Installer::install_stage_finish()
 {
     LOGD("[Installer] Finalization stage");
@@ -1920,21 +2200,17 @@ Installer::ProceedState Installer::install_stage_finish()
         display_msg("Failed to flash patched boot image");
         return ProceedState::Fail;
     }
-    if (auto r = util::copy_contents(temp_boot_img, path); !r) {
+
+    // Back up the boot image and compute its checksum without rereading it
+    auto digest = copy_file_with_sha512(temp_boot_img, path);
+    if (!digest) {
         LOGE("Failed to copy %s to %s: %s", temp_boot_img.c_str(), path.c_str(),
-             r.error().message().c_str());
+             digest.error().message().c_str());
         display_msg("Failed to back up boot image");
         return ProceedState::Fail;
     }
 
     // Update checksums
-    auto digest = util::sha512_hash(temp_boot_img);
-    if (!digest) {
-        LOGE("%s: Failed to compute sha512sum: %s",
-             temp_boot_img.c_str(), digest.error().message().c_str());
-        display_msg("Failed to compute sha512sum of new boot image");
-        return ProceedState::Fail;
-    }
 
     std::string hash = util::hex_string(digest.value().data(),
                                         digest.value().size());
@@ -1971,6 +2247,7 @@ void Installer::install_stage_cleanup(Installer::ProceedState ret)
 
     display_msg("Destroying chroot environment");
 
+    wait_for_image_creation();
     remove(_temp_image_path.c_str());
 
     if (ret == ProceedState::Fail && !_boot_block_dev.empty()) {
@@ -2007,38 +2284,50 @@ bool Installer::start_installation()
         install_stage_cleanup(ret);
     });
 
+    util::MetricsStage metrics("install");
+    util::MetricsReporter reporter(std::chrono::seconds(10));
+
+    auto run_stage = [this](const char *name, ProceedState (Installer::*fn)()) {
+        util::MetricsStage stage(name);
+        return (this->*fn)();
+    };
 
-    ret = install_stage_initialize();
+    ret = run_stage("initialize", &Installer::install_stage_initialize);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_create_chroot();
+    ret = run_stage("create-chroot", &Installer::install_stage_create_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_environment();
+    ret = run_stage("set-up-environment",
+                    &Installer::install_stage_set_up_environment);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_check_device();
+    ret = run_stage("check-device", &Installer::install_stage_check_device);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_get_install_type();
+    ret = run_stage("get-install-type",
+                    &Installer::install_stage_get_install_type);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_set_up_chroot();
+    ret = run_stage("set-up-chroot", &Installer::install_stage_set_up_chroot);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_mount_filesystems();
+    ret = run_stage("mount-filesystems",
+                    &Installer::install_stage_mount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ProceedState install_ret = install_stage_installation();
+    ProceedState install_ret = run_stage(
+            "installation", &Installer::install_stage_installation);
 
-    ret = install_stage_unmount_filesystems();
+    ret = run_stage("unmount-filesystems",
+                    &Installer::install_stage_unmount_filesystems);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -2046,7 +2335,7 @@ bool Installer::start_installation()
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
-    ret = install_stage_finish();
+    ret = run_stage("finish", &Installer::install_stage_finish);
     if (ret == ProceedState::Fail) return false;
     else if (ret == ProceedState::Cancel) return true;
 
@@ -0,0 +1,781 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/ramdisk_archive.h"
+
+#include <algorithm>
+
+#include <ctime>
+
+#include <lzma.h>
+
+#include "mbbootimg/ramdisk.h"
+
+#include "mbcommon/executor.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/file_util.h"
+
+#include "mblog/logging.h"
+
+#include "recovery/archive_util.h"
+#include "recovery/ramdisk_compress.h"
+
+#define LOG_TAG "mbtool/recovery/ramdisk_archive"
+
+#define READ_CHUNK_SIZE     65536
+
+typedef std::unique_ptr<archive, decltype(archive_free) *> ScopedArchive;
+
+namespace mb
+{
+
+static std::string normalize_path(std::string_view path)
+{
+    while (true) {
+        if (path.compare(0, 1, "/") == 0) {
+            path.remove_prefix(1);
+        } else if (path.compare(0, 2, "./") == 0) {
+            path.remove_prefix(2);
+        } else {
+            break;
+        }
+    }
+
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+
+    return std::string(path);
+}
+
+static unsigned int compression_threads()
+{
+    return Executor::global().concurrency();
+}
+
+RamdiskArchive::RamdiskArchive()
+    : _format(ARCHIVE_FORMAT_CPIO_SVR4_NOCRC)
+    , _lz4_legacy(false)
+    , _xz_check(LZMA_CHECK_CRC32)
+    , _next_ino(1)
+{
+}
+
+RamdiskArchive::~RamdiskArchive() = default;
+
+/*!
+ * \brief Read a ramdisk from a File handle
+ *
+ * The data is read from the current file position. The archive format and
+ * compression filters are remembered so that save() writes the ramdisk back
+ * in the same format.
+ */
+bool RamdiskArchive::load(File &input)
+{
+    ScopedArchive ain(archive_read_new(), archive_read_free);
+    if (!ain) {
+        LOGE("Failed to allocate archive reader instance");
+        return false;
+    }
+
+    auto compression = bootimg::detect_ramdisk_compression(input);
+    if (!compression) {
+        LOGE("Failed to read ramdisk: %s",
+             compression.error().message().c_str());
+        return false;
+    }
+
+    std::vector<unsigned char> decompressed;
+    MemoryFile decompressed_file;
+    File *source = &input;
+
+    _lz4_legacy = false;
+    _lz4_frames.clear();
+    _xz_check = LZMA_CHECK_CRC32;
+
+    if (compression.value() == bootimg::RamdiskCompression::Lz4
+            && is_lz4_legacy(input)) {
+        // Decompress the frames ourselves so they can be reused when saving
+        if (!lz4_legacy_decompress(input, decompressed, _lz4_frames,
+                                   compression_threads())) {
+            return false;
+        }
+
+        auto open_ret = decompressed_file.open(decompressed.data(),
+                                               decompressed.size());
+        if (!open_ret) {
+            LOGE("Failed to open decompressed ramdisk: %s",
+                 open_ret.error().message().c_str());
+            return false;
+        }
+
+        source = &decompressed_file;
+        compression = bootimg::RamdiskCompression::None;
+        _lz4_legacy = true;
+    } else if (compression.value() == bootimg::RamdiskCompression::Xz) {
+        (void) read_xz_check(input, _xz_check);
+    }
+
+    la_support_ramdisk(ain.get(), compression.value());
+
+    if (la_open_file(ain.get(), *source) != ARCHIVE_OK) {
+        LOGE("Failed to open ramdisk: %s", archive_error_string(ain.get()));
+        return false;
+    }
+
+    _arena.clear();
+    _entries.clear();
+    _index.clear();
+    _next_ino = 1;
+
+    // Hard links are resolved after all entries are read since the data may
+    // be stored with either the first or the last link
+    std::vector<std::pair<size_t, std::string>> hardlinks;
+
+    while (true) {
+        archive_entry *entry;
+
+        int ret = archive_read_next_header(ain.get(), &entry);
+        if (ret == ARCHIVE_EOF) {
+            break;
+        } else if (ret == ARCHIVE_RETRY) {
+            continue;
+        } else if (ret != ARCHIVE_OK) {
+            LOGE("Failed to read ramdisk header: %s",
+                 archive_error_string(ain.get()));
+            return false;
+        }
+
+        const char *path = archive_entry_pathname(entry);
+        if (!path || !*path) {
+            LOGE("Ramdisk header has null or empty filename");
+            return false;
+        }
+
+        // The root directory entry ("."), if any, is kept so that unchanged
+        // ramdisks are written back identically
+        auto name = normalize_path(path);
+        if (name.empty()) {
+            continue;
+        }
+
+        ScopedArchiveEntry ae(archive_entry_clone(entry), archive_entry_free);
+        if (!ae) {
+            LOGE("%s: Failed to copy entry metadata", name.c_str());
+            return false;
+        }
+
+        // The original path is only used as the lookup key after being
+        // normalized. It is left as is in the entry so unchanged entries are
+        // written back identically.
+
+        size_t offset = _arena.size();
+
+        while (true) {
+            size_t pos = _arena.size();
+            _arena.resize(pos + READ_CHUNK_SIZE);
+
+            la_ssize_t n = archive_read_data(
+                    ain.get(), _arena.data() + pos, READ_CHUNK_SIZE);
+            if (n < 0) {
+                LOGE("%s: Failed to read entry data: %s",
+                     name.c_str(), archive_error_string(ain.get()));
+                return false;
+            }
+
+            _arena.resize(pos + static_cast<size_t>(n));
+
+            if (n == 0) {
+                break;
+            }
+        }
+
+        _next_ino = std::max(_next_ino, archive_entry_ino64(ae.get()) + 1);
+
+        size_t index = _entries.size();
+
+        if (const char *link = archive_entry_hardlink(ae.get())) {
+            hardlinks.emplace_back(index, normalize_path(link));
+            archive_entry_set_hardlink(ae.get(), nullptr);
+        }
+
+        // Later entries replace earlier ones with the same path, just like
+        // when the kernel extracts the ramdisk
+        if (auto it = _index.find(name); it != _index.end()) {
+            _entries[it->second].ae.reset();
+        }
+
+        _entries.push_back({std::move(ae), 0, 0});
+        _index[name] = index;
+
+        set_data(_entries.back(), offset, _arena.size() - offset);
+    }
+
+    for (auto const &[index, target] : hardlinks) {
+        auto &link = _entries[index];
+        auto target_index = find(target);
+
+        if (!link.ae) {
+            continue;
+        } else if (!target_index) {
+            LOGW("%s: Hard link target does not exist: %s",
+                 archive_entry_pathname(link.ae.get()), target.c_str());
+            continue;
+        }
+
+        auto &orig = _entries[*target_index];
+
+        if (link.size == 0) {
+            set_data(link, orig.offset, orig.size);
+        } else if (orig.size == 0) {
+            set_data(orig, link.offset, link.size);
+        }
+    }
+
+    // Hard links are written as independent files
+    for (auto &entry : _entries) {
+        if (entry.ae && archive_entry_filetype(entry.ae.get()) == AE_IFREG) {
+            archive_entry_set_nlink(entry.ae.get(), 1);
+        }
+    }
+
+    _format = archive_format(ain.get());
+    _filters.clear();
+    for (int i = 0; i < archive_filter_count(ain.get()); ++i) {
+        int code = archive_filter_code(ain.get(), i);
+        if (code != ARCHIVE_FILTER_NONE) {
+            _filters.push_back(code);
+        }
+    }
+
+    if (archive_read_close(ain.get()) != ARCHIVE_OK) {
+        LOGE("Failed to close ramdisk: %s", archive_error_string(ain.get()));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write ramdisk to a file
+ */
+bool RamdiskArchive::save(const std::string &output_file) const
+{
+    std::vector<unsigned char> data;
+
+    if (!save(data)) {
+        return false;
+    }
+
+    StandardFile file;
+
+    auto ret = file.open(output_file, FileOpenMode::WriteOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for writing: %s",
+             output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    ret = file_write_exact(file, data.data(), data.size());
+    if (!ret) {
+        LOGE("%s: Failed to write ramdisk: %s",
+             output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    ret = file.close();
+    if (!ret) {
+        LOGE("%s: Failed to close file: %s",
+             output_file.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write ramdisk to a memory buffer
+ *
+ * \param[out] output Buffer to which the archive is written (replacing any
+ *                    existing contents)
+ */
+bool RamdiskArchive::save(std::vector<unsigned char> &output) const
+{
+    // libarchive's compressors are single threaded and its lz4 filter can only
+    // write the lz4 frame format, which the kernel does not support
+    bool builtin = _lz4_legacy || (_filters.size() == 1
+            && (_filters[0] == ARCHIVE_FILTER_GZIP
+                    || _filters[0] == ARCHIVE_FILTER_XZ));
+
+    if (!builtin) {
+        return write_archive(output, true);
+    }
+
+    std::vector<unsigned char> cpio;
+
+    if (!write_archive(cpio, false)) {
+        return false;
+    }
+
+    auto threads = compression_threads();
+
+    if (_lz4_legacy) {
+        return lz4_legacy_compress(cpio, output, _lz4_frames, threads);
+    } else if (_filters[0] == ARCHIVE_FILTER_GZIP) {
+        return gzip_compress(cpio, output, threads);
+    } else {
+        return xz_compress(cpio, output, _xz_check, threads);
+    }
+}
+
+/*!
+ * \brief Get file type and permissions of a path
+ *
+ * \return `st_mode`-style mode or nothing if the path does not exist
+ */
+std::optional<mode_t> RamdiskArchive::mode(const std::string &path) const
+{
+    if (auto index = find(path)) {
+        return archive_entry_mode(_entries[*index].ae.get());
+    }
+    return std::nullopt;
+}
+
+bool RamdiskArchive::read_file(const std::string &path,
+                               std::string &data_out) const
+{
+    auto index = find(path);
+    if (!index) {
+        LOGE("%s: File does not exist in ramdisk", path.c_str());
+        return false;
+    }
+
+    auto const &entry = _entries[*index];
+
+    if (archive_entry_filetype(entry.ae.get()) != AE_IFREG) {
+        LOGE("%s: Not a regular file", path.c_str());
+        return false;
+    }
+
+    auto data = reinterpret_cast<const char *>(_arena.data() + entry.offset);
+    data_out.assign(data, entry.size);
+
+    return true;
+}
+
+bool RamdiskArchive::read_symlink(const std::string &path,
+                                  std::string &target_out) const
+{
+    auto index = find(path);
+    if (!index) {
+        return false;
+    }
+
+    auto const &entry = _entries[*index];
+
+    if (archive_entry_filetype(entry.ae.get()) != AE_IFLNK) {
+        return false;
+    }
+
+    const char *target = archive_entry_symlink(entry.ae.get());
+    target_out = target ? target : "";
+
+    return true;
+}
+
+/*!
+ * \brief Create or replace a regular file
+ *
+ * If the file already exists, its ownership is preserved.
+ */
+bool RamdiskArchive::write_file(const std::string &path, std::string_view data,
+                                mode_t perm)
+{
+    size_t offset = _arena.size();
+    _arena.insert(_arena.end(), data.begin(), data.end());
+
+    return replace_data(path, offset, data.size(), perm);
+}
+
+/*!
+ * \brief Create or replace a regular file with the contents of a file on disk
+ *
+ * If the file already exists, its ownership is preserved.
+ */
+bool RamdiskArchive::copy_from_disk(const std::string &source,
+                                    const std::string &path, mode_t perm)
+{
+    StandardFile file;
+
+    auto ret = file.open(source, FileOpenMode::ReadOnly);
+    if (!ret) {
+        LOGE("%s: Failed to open for reading: %s",
+             source.c_str(), ret.error().message().c_str());
+        return false;
+    }
+
+    size_t offset = _arena.size();
+
+    while (true) {
+        size_t pos = _arena.size();
+        _arena.resize(pos + READ_CHUNK_SIZE);
+
+        auto n = file_read_retry(file, _arena.data() + pos, READ_CHUNK_SIZE);
+        if (!n) {
+            LOGE("%s: Failed to read file: %s",
+                 source.c_str(), n.error().message().c_str());
+            _arena.resize(offset);
+            return false;
+        }
+
+        _arena.resize(pos + n.value());
+
+        if (n.value() == 0) {
+            break;
+        }
+    }
+
+    return replace_data(path, offset, _arena.size() - offset, perm);
+}
+
+/*!
+ * \brief Create a symlink
+ *
+ * Like symlink(2), this fails if \p path already exists.
+ */
+bool RamdiskArchive::symlink(const std::string &target,
+                             const std::string &path)
+{
+    if (find(path)) {
+        LOGE("%s: File already exists in ramdisk", path.c_str());
+        return false;
+    }
+
+    auto index = create(path, AE_IFLNK, 0777);
+    if (!index) {
+        return false;
+    }
+
+    archive_entry_set_symlink(_entries[*index].ae.get(), target.c_str());
+
+    return true;
+}
+
+/*!
+ * \brief Rename a path
+ *
+ * Like rename(2), \p to is replaced if it exists. Only non-directory entries
+ * can be renamed.
+ */
+bool RamdiskArchive::rename(const std::string &from, const std::string &to)
+{
+    auto index = find(from);
+    if (!index) {
+        LOGE("%s: File does not exist in ramdisk", from.c_str());
+        return false;
+    }
+
+    if (archive_entry_filetype(_entries[*index].ae.get()) == AE_IFDIR) {
+        LOGE("%s: Renaming directories is not supported", from.c_str());
+        return false;
+    }
+
+    auto from_name = normalize_path(from);
+    auto to_name = normalize_path(to);
+
+    if (from_name == to_name) {
+        return true;
+    }
+
+    remove(to_name);
+
+    if (!ensure_parent(to_name)) {
+        return false;
+    }
+
+    _index.erase(from_name);
+    _index[to_name] = *index;
+    archive_entry_set_pathname(_entries[*index].ae.get(), to_name.c_str());
+
+    return true;
+}
+
+/*!
+ * \brief Remove a path
+ *
+ * Only the entry for \p path itself is removed. If \p path is a directory,
+ * the caller is responsible for removing its children.
+ *
+ * \return Whether \p path existed
+ */
+bool RamdiskArchive::remove(const std::string &path)
+{
+    auto it = _index.find(normalize_path(path));
+    if (it == _index.end()) {
+        return false;
+    }
+
+    _entries[it->second].ae.reset();
+    _index.erase(it);
+
+    return true;
+}
+
+/*!
+ * \brief Make an entry the first one in the archive
+ *
+ * Readers that only need this entry can then stop decompressing the ramdisk
+ * right after it. Only entries in the root directory can be moved, since
+ * directories must precede their contents.
+ *
+ * \return Whether the entry was moved
+ */
+bool RamdiskArchive::move_to_front(const std::string &path)
+{
+    auto name = normalize_path(path);
+
+    if (name.find('/') != std::string::npos) {
+        LOGE("%s: Only top-level entries can be moved to the front",
+             name.c_str());
+        return false;
+    }
+
+    auto index = find(name);
+    if (!index) {
+        LOGE("%s: Entry does not exist", name.c_str());
+        return false;
+    }
+
+    auto it = _entries.begin() + static_cast<ptrdiff_t>(*index);
+    std::rotate(_entries.begin(), it, it + 1);
+
+    for (auto &item : _index) {
+        if (item.second == *index) {
+            item.second = 0;
+        } else if (item.second < *index) {
+            ++item.second;
+        }
+    }
+
+    return true;
+}
+
+std::optional<size_t> RamdiskArchive::find(const std::string &path) const
+{
+    if (auto it = _index.find(normalize_path(path)); it != _index.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+std::optional<size_t> RamdiskArchive::create(const std::string &path,
+                                             mode_t type, mode_t perm)
+{
+    auto name = normalize_path(path);
+
+    if (!ensure_parent(name)) {
+        return std::nullopt;
+    }
+
+    ScopedArchiveEntry ae(archive_entry_new(), archive_entry_free);
+    if (!ae) {
+        LOGE("%s: Failed to allocate entry", name.c_str());
+        return std::nullopt;
+    }
+
+    archive_entry_set_pathname(ae.get(), name.c_str());
+    archive_entry_set_filetype(ae.get(), type);
+    archive_entry_set_perm(ae.get(), perm);
+    archive_entry_set_uid(ae.get(), 0);
+    archive_entry_set_gid(ae.get(), 0);
+    archive_entry_set_nlink(ae.get(), type == AE_IFDIR ? 2 : 1);
+    archive_entry_set_ino64(ae.get(), _next_ino++);
+    archive_entry_set_mtime(ae.get(), time(nullptr), 0);
+    archive_entry_set_size(ae.get(), 0);
+
+    size_t index = _entries.size();
+    _entries.push_back({std::move(ae), 0, 0});
+    _index[name] = index;
+
+    return index;
+}
+
+/*!
+ * \brief Create the parent directories of a path if they do not exist
+ */
+bool RamdiskArchive::ensure_parent(const std::string &path)
+{
+    auto pos = path.rfind('/');
+    if (pos == std::string::npos) {
+        return true;
+    }
+
+    auto parent = path.substr(0, pos);
+
+    if (auto index = find(parent)) {
+        if (archive_entry_filetype(_entries[*index].ae.get()) != AE_IFDIR) {
+            LOGE("%s: Not a directory", parent.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    return create(parent, AE_IFDIR, 0755).has_value();
+}
+
+bool RamdiskArchive::replace_data(const std::string &path, size_t offset,
+                                  size_t size, mode_t perm)
+{
+    auto index = find(path);
+
+    if (index) {
+        if (archive_entry_filetype(_entries[*index].ae.get()) != AE_IFREG) {
+            LOGE("%s: Not a regular file", path.c_str());
+            return false;
+        }
+    } else {
+        index = create(path, AE_IFREG, perm);
+        if (!index) {
+            return false;
+        }
+    }
+
+    auto &entry = _entries[*index];
+
+    archive_entry_set_perm(entry.ae.get(), perm);
+    archive_entry_set_mtime(entry.ae.get(), time(nullptr), 0);
+    set_data(entry, offset, size);
+
+    return true;
+}
+
+void RamdiskArchive::set_data(Entry &entry, size_t offset, size_t size)
+{
+    if (archive_entry_filetype(entry.ae.get()) != AE_IFREG) {
+        size = 0;
+    }
+
+    entry.offset = offset;
+    entry.size = size;
+    archive_entry_set_size(entry.ae.get(), static_cast<la_int64_t>(size));
+}
+
+bool RamdiskArchive::prepare_writer(archive *a, bool compress) const
+{
+    if (archive_write_set_format(a, _format) != ARCHIVE_OK) {
+        LOGE("Failed to set output archive format: %s",
+             archive_error_string(a));
+        return false;
+    }
+    if (compress) {
+        for (const int &filter : _filters) {
+            if (archive_write_add_filter(a, filter) != ARCHIVE_OK) {
+                LOGE("Failed to add output archive filter: %s",
+                     archive_error_string(a));
+                return false;
+            }
+        }
+    }
+
+    archive_write_set_bytes_per_block(a, 512);
+
+    return true;
+}
+
+static la_ssize_t la_vector_write_cb(archive *a, void *userdata,
+                                     const void *buffer, size_t length)
+{
+    (void) a;
+
+    auto output = static_cast<std::vector<unsigned char> *>(userdata);
+    auto data = static_cast<const unsigned char *>(buffer);
+
+    output->insert(output->end(), data, data + length);
+
+    return static_cast<la_ssize_t>(length);
+}
+
+/*!
+ * \brief Write the archive with libarchive
+ *
+ * \param[out] output Buffer to which the archive is written
+ * \param[in] compress Whether to apply the original compression filters
+ */
+bool RamdiskArchive::write_archive(std::vector<unsigned char> &output,
+                                   bool compress) const
+{
+    ScopedArchive aout(archive_write_new(), archive_write_free);
+    if (!aout) {
+        LOGE("Failed to allocate archive writer instance");
+        return false;
+    }
+
+    if (!prepare_writer(aout.get(), compress)) {
+        return false;
+    }
+
+    output.clear();
+
+    if (archive_write_open(aout.get(), &output, nullptr, &la_vector_write_cb,
+                           nullptr) != ARCHIVE_OK) {
+        LOGE("Failed to open output buffer: %s",
+             archive_error_string(aout.get()));
+        return false;
+    }
+
+    return write_entries(aout.get());
+}
+
+bool RamdiskArchive::write_entries(archive *a) const
+{
+    for (auto const &entry : _entries) {
+        if (!entry.ae) {
+            continue;
+        }
+
+        if (archive_write_header(a, entry.ae.get()) != ARCHIVE_OK) {
+            LOGE("%s: Failed to write header: %s",
+                 archive_entry_pathname(entry.ae.get()),
+                 archive_error_string(a));
+            return false;
+        }
+
+        if (entry.size > 0) {
+            la_ssize_t n = archive_write_data(
+                    a, _arena.data() + entry.offset, entry.size);
+            if (n < 0 || static_cast<size_t>(n) != entry.size) {
+                LOGE("%s: Failed to write data: %s",
+                     archive_entry_pathname(entry.ae.get()),
+                     archive_error_string(a));
+                return false;
+            }
+        }
+    }
+
+    if (archive_write_close(a) != ARCHIVE_OK) {
+        LOGE("Failed to close ramdisk: %s", archive_error_string(a));
+        return false;
+    }
+
+    return true;
+}
+
+}
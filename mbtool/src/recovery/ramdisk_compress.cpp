@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recovery/ramdisk_compress.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#include <lz4.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/file.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+
+#include "mblog/logging.h"
+
+#define LOG_TAG "mbtool/recovery/ramdisk_compress"
+
+#define READ_CHUNK_SIZE     65536
+
+namespace mb
+{
+
+static constexpr uint32_t LZ4_LEGACY_MAGIC = 0x184c2102;
+
+// Each gzip block is primed with the preceding 32 KiB so that splitting the
+// input barely affects the compression ratio
+static constexpr size_t GZIP_BLOCK_SIZE = 1024 * 1024;
+static constexpr size_t GZIP_DICT_SIZE = 32 * 1024;
+
+// lzma's default block size for the multithreaded encoder is 3x the
+// dictionary size, which would result in a single block for most ramdisks
+static constexpr uint64_t XZ_BLOCK_SIZE = 2 * 1024 * 1024;
+
+static uint32_t read_le32(const unsigned char *buf)
+{
+    uint32_t value;
+    memcpy(&value, buf, sizeof(value));
+    return mb_le32toh(value);
+}
+
+static void append_le32(std::vector<unsigned char> &buf, uint32_t value)
+{
+    value = mb_htole32(value);
+    auto ptr = reinterpret_cast<const unsigned char *>(&value);
+    buf.insert(buf.end(), ptr, ptr + sizeof(value));
+}
+
+static bool read_all(File &input, std::vector<unsigned char> &output)
+{
+    output.clear();
+
+    while (true) {
+        size_t pos = output.size();
+        output.resize(pos + READ_CHUNK_SIZE);
+
+        auto n = file_read_retry(input, output.data() + pos, READ_CHUNK_SIZE);
+        if (!n) {
+            LOGE("Failed to read compressed ramdisk: %s",
+                 n.error().message().c_str());
+            return false;
+        }
+
+        output.resize(pos + n.value());
+
+        if (n.value() == 0) {
+            return true;
+        }
+    }
+}
+
+/*!
+ * \brief Check if a ramdisk uses the lz4 legacy format used by the kernel
+ *
+ * The file is read with File::read_at(), so the file position is not changed.
+ */
+bool is_lz4_legacy(File &file)
+{
+    unsigned char buf[4];
+
+    return file_read_exact_at(file, 0, buf, sizeof(buf))
+            && read_le32(buf) == LZ4_LEGACY_MAGIC;
+}
+
+/*!
+ * \brief Read the integrity check type from an xz stream header
+ *
+ * The file is read with File::read_at(), so the file position is not changed.
+ */
+bool read_xz_check(File &file, uint32_t &check_out)
+{
+    unsigned char buf[8];
+
+    if (!file_read_exact_at(file, 0, buf, sizeof(buf))
+            || memcmp(buf, "\xfd\x37\x7a\x58\x5a\x00", 6) != 0) {
+        return false;
+    }
+
+    check_out = buf[7] & 0x0f;
+    return true;
+}
+
+/*!
+ * \brief Decompress an lz4 legacy stream
+ *
+ * The frames are decompressed in parallel. The stream is read from the
+ * current file position until EOF. Like the kernel, repeated magic numbers
+ * (concatenated streams) are skipped and a zero frame size is treated as
+ * padding at the end of the stream.
+ *
+ * \param[in] input File containing the stream
+ * \param[out] output Decompressed data
+ * \param[out] frames_out Original frames for lz4_legacy_compress()
+ * \param[in] threads Number of threads to use
+ */
+bool lz4_legacy_decompress(File &input, std::vector<unsigned char> &output,
+                           std::vector<Lz4LegacyFrame> &frames_out,
+                           unsigned int threads)
+{
+    std::vector<unsigned char> raw;
+
+    if (!read_all(input, raw)) {
+        return false;
+    }
+
+    if (raw.size() < 4 || read_le32(raw.data()) != LZ4_LEGACY_MAGIC) {
+        LOGE("Ramdisk is not an lz4 legacy stream");
+        return false;
+    }
+
+    frames_out.clear();
+
+    for (size_t pos = 4; raw.size() - pos >= 4;) {
+        uint32_t size = read_le32(raw.data() + pos);
+        pos += 4;
+
+        if (size == LZ4_LEGACY_MAGIC) {
+            continue;
+        } else if (size == 0) {
+            break;
+        } else if (size > raw.size() - pos) {
+            LOGE("lz4 frame at offset %zu is truncated", pos - 4);
+            return false;
+        }
+
+        frames_out.push_back({
+            { raw.begin() + static_cast<ptrdiff_t>(pos),
+              raw.begin() + static_cast<ptrdiff_t>(pos + size) },
+            0,
+            {},
+        });
+
+        pos += size;
+    }
+
+    // Decompress each frame to its maximum possible offset and then compact
+    // the output
+    output.resize(frames_out.size() * LZ4_LEGACY_BLOCK_SIZE);
+
+    if (!parallel_for_until(frames_out.size(), [&](size_t i) {
+        auto &frame = frames_out[i];
+        auto dest = output.data() + i * LZ4_LEGACY_BLOCK_SIZE;
+
+        int n = LZ4_decompress_safe(
+                reinterpret_cast<const char *>(frame.data.data()),
+                reinterpret_cast<char *>(dest),
+                static_cast<int>(frame.data.size()),
+                static_cast<int>(LZ4_LEGACY_BLOCK_SIZE));
+        if (n < 0) {
+            LOGE("Failed to decompress lz4 frame %zu", i);
+            return false;
+        }
+
+        frame.size = static_cast<size_t>(n);
+        SHA256(dest, frame.size, frame.digest.data());
+
+        return true;
+    }, std::max(threads, 1u))) {
+        return false;
+    }
+
+    size_t out_pos = 0;
+
+    for (size_t i = 0; i < frames_out.size(); ++i) {
+        size_t in_pos = i * LZ4_LEGACY_BLOCK_SIZE;
+        if (out_pos != in_pos) {
+            memmove(output.data() + out_pos, output.data() + in_pos,
+                    frames_out[i].size);
+        }
+        out_pos += frames_out[i].size;
+    }
+
+    output.resize(out_pos);
+
+    return true;
+}
+
+/*!
+ * \brief Compress data as an lz4 legacy stream
+ *
+ * Each 8 MiB block is compressed on a separate thread. If a block is
+ * identical to the frame at the same offset in \p original_frames, the
+ * original compressed frame is copied verbatim instead.
+ *
+ * \param[in] input Uncompressed data
+ * \param[out] output Compressed data
+ * \param[in] original_frames Frames from lz4_legacy_decompress() (may be
+ *                            empty)
+ * \param[in] threads Number of threads to use
+ */
+bool lz4_legacy_compress(const std::vector<unsigned char> &input,
+                         std::vector<unsigned char> &output,
+                         const std::vector<Lz4LegacyFrame> &original_frames,
+                         unsigned int threads)
+{
+    size_t count = (input.size() + LZ4_LEGACY_BLOCK_SIZE - 1)
+            / LZ4_LEGACY_BLOCK_SIZE;
+
+    // Find the original frames that start at the same offset as a block
+    std::vector<const Lz4LegacyFrame *> candidates(count);
+    size_t original_offset = 0;
+
+    for (auto const &frame : original_frames) {
+        if (original_offset % LZ4_LEGACY_BLOCK_SIZE == 0
+                && original_offset / LZ4_LEGACY_BLOCK_SIZE < count) {
+            candidates[original_offset / LZ4_LEGACY_BLOCK_SIZE] = &frame;
+        }
+        original_offset += frame.size;
+    }
+
+    std::vector<std::vector<unsigned char>> compressed(count);
+    std::vector<const Lz4LegacyFrame *> reused(count);
+
+    if (!parallel_for_until(count, [&](size_t i) {
+        auto src = input.data() + i * LZ4_LEGACY_BLOCK_SIZE;
+        auto size = std::min(LZ4_LEGACY_BLOCK_SIZE,
+                             input.size() - i * LZ4_LEGACY_BLOCK_SIZE);
+
+        if (auto frame = candidates[i]; frame && frame->size == size) {
+            std::array<unsigned char, SHA256_DIGEST_LENGTH> digest;
+            SHA256(src, size, digest.data());
+
+            if (digest == frame->digest) {
+                reused[i] = frame;
+                return true;
+            }
+        }
+
+        auto &out = compressed[i];
+        out.resize(static_cast<size_t>(
+                LZ4_compressBound(static_cast<int>(size))));
+
+        int n = LZ4_compress_default(
+                reinterpret_cast<const char *>(src),
+                reinterpret_cast<char *>(out.data()),
+                static_cast<int>(size), static_cast<int>(out.size()));
+        if (n <= 0) {
+            LOGE("Failed to compress lz4 frame %zu", i);
+            return false;
+        }
+
+        out.resize(static_cast<size_t>(n));
+
+        return true;
+    }, std::max(threads, 1u))) {
+        return false;
+    }
+
+    output.clear();
+    append_le32(output, LZ4_LEGACY_MAGIC);
+
+    size_t n_reused = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        auto const &data = reused[i] ? reused[i]->data : compressed[i];
+
+        append_le32(output, static_cast<uint32_t>(data.size()));
+        output.insert(output.end(), data.begin(), data.end());
+
+        if (reused[i]) {
+            ++n_reused;
+        }
+    }
+
+    LOGD("Reused %zu of %zu original lz4 frames", n_reused, count);
+
+    return true;
+}
+
+/*!
+ * \brief Compress data as a gzip stream
+ *
+ * The input is split into 1 MiB blocks that are deflated on separate threads,
+ * like pigz. Each block is primed with the last 32 KiB of the previous block
+ * and all but the last block end with a sync flush, so the output is a single
+ * regular gzip member that any gzip decoder (including the kernel's) accepts.
+ *
+ * \param[in] input Uncompressed data
+ * \param[out] output Compressed data
+ * \param[in] threads Number of threads to use
+ */
+bool gzip_compress(const std::vector<unsigned char> &input,
+                   std::vector<unsigned char> &output,
+                   unsigned int threads)
+{
+    size_t count = std::max<size_t>(
+            (input.size() + GZIP_BLOCK_SIZE - 1) / GZIP_BLOCK_SIZE, 1);
+
+    std::vector<std::vector<unsigned char>> blocks(count);
+    std::vector<uLong> crcs(count);
+
+    if (!parallel_for_until(count, [&](size_t i) {
+        size_t start = i * GZIP_BLOCK_SIZE;
+        size_t size = std::min(GZIP_BLOCK_SIZE, input.size() - start);
+        bool last = i == count - 1;
+
+        z_stream zs = {};
+
+        // Negative window bits for raw deflate data
+        if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                         8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            LOGE("Failed to initialize deflate stream");
+            return false;
+        }
+
+        auto end_stream = finally([&] {
+            deflateEnd(&zs);
+        });
+
+        if (start > 0) {
+            size_t dict_size = std::min(start, GZIP_DICT_SIZE);
+
+            if (deflateSetDictionary(&zs, input.data() + start - dict_size,
+                                     static_cast<uInt>(dict_size)) != Z_OK) {
+                LOGE("Failed to set deflate dictionary");
+                return false;
+            }
+        }
+
+        auto &out = blocks[i];
+        // Extra space for the sync flush marker
+        out.resize(deflateBound(&zs, static_cast<uLong>(size)) + 16);
+
+        zs.next_in = const_cast<Bytef *>(input.data() + start);
+        zs.avail_in = static_cast<uInt>(size);
+        zs.next_out = out.data();
+        zs.avail_out = static_cast<uInt>(out.size());
+
+        int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if (last ? ret != Z_STREAM_END
+                : ret != Z_OK || zs.avail_in != 0 || zs.avail_out == 0) {
+            LOGE("Failed to deflate block %zu: %d", i, ret);
+            return false;
+        }
+
+        out.resize(zs.total_out);
+        crcs[i] = crc32(0, input.data() + start, static_cast<uInt>(size));
+
+        return true;
+    }, std::max(threads, 1u))) {
+        return false;
+    }
+
+    // Header with no file name or timestamp and the Unix OS code
+    output.assign({
+        0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+    });
+
+    uLong crc = crcs[0];
+
+    for (size_t i = 0; i < count; ++i) {
+        output.insert(output.end(), blocks[i].begin(), blocks[i].end());
+
+        if (i > 0) {
+            size_t size = std::min(GZIP_BLOCK_SIZE,
+                                   input.size() - i * GZIP_BLOCK_SIZE);
+            crc = crc32_combine(crc, crcs[i], static_cast<z_off_t>(size));
+        }
+    }
+
+    append_le32(output, static_cast<uint32_t>(crc));
+    append_le32(output, static_cast<uint32_t>(input.size()));
+
+    return true;
+}
+
+/*!
+ * \brief Compress data as an xz stream
+ *
+ * liblzma's multithreaded encoder is used with 2 MiB blocks. The kernel's xz
+ * decoder supports multi-block streams, but not every integrity check, so
+ * \p check should be the check type of the original ramdisk.
+ *
+ * \param[in] input Uncompressed data
+ * \param[out] output Compressed data
+ * \param[in] check Integrity check type (`lzma_check`)
+ * \param[in] threads Number of threads to use
+ */
+bool xz_compress(const std::vector<unsigned char> &input,
+                 std::vector<unsigned char> &output,
+                 uint32_t check, unsigned int threads)
+{
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_mt mt = {};
+
+    mt.threads = std::max(threads, 1u);
+    mt.block_size = XZ_BLOCK_SIZE;
+    mt.preset = LZMA_PRESET_DEFAULT;
+    mt.check = static_cast<lzma_check>(check);
+
+    lzma_ret ret = lzma_stream_encoder_mt(&strm, &mt);
+    if (ret != LZMA_OK) {
+        LOGE("Failed to initialize xz encoder: %d", ret);
+        return false;
+    }
+
+    auto end_stream = finally([&] {
+        lzma_end(&strm);
+    });
+
+    output.resize(std::max<size_t>(lzma_stream_buffer_bound(input.size()),
+                                   READ_CHUNK_SIZE));
+
+    strm.next_in = input.data();
+    strm.avail_in = input.size();
+    strm.next_out = output.data();
+    strm.avail_out = output.size();
+
+    while ((ret = lzma_code(&strm, LZMA_FINISH)) == LZMA_OK) {
+        if (strm.avail_out == 0) {
+            size_t used = output.size();
+            output.resize(used * 2);
+            strm.next_out = output.data() + used;
+            strm.avail_out = output.size() - used;
+        }
+    }
+
+    if (ret != LZMA_STREAM_END) {
+        LOGE("Failed to compress xz stream: %d", ret);
+        return false;
+    }
+
+    output.resize(strm.total_out);
+
+    return true;
+}
+
+}
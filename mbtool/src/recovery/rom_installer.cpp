@@ -19,6 +19,8 @@
 
 #include "recovery/rom_installer.h"
 
+#include <cinttypes>
+
 #include <fcntl.h>
 #include <getopt.h>
 #include <sched.h>
@@ -29,10 +31,14 @@
 #include <unistd.h>
 
 #include "mbbootimg/entry.h"
+#include "mbbootimg/entry_file.h"
 #include "mbbootimg/header.h"
+#include "mbbootimg/ramdisk.h"
 #include "mbbootimg/reader.h"
+#include "mbcommon/file/fd.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
+#include "mblog/async_logger.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
 #include "mbutil/archive.h"
@@ -45,9 +51,10 @@
 #include "mbutil/string.h"
 
 #include "recovery/archive_util.h"
-#include "recovery/bootimg_util.h"
 #include "recovery/installer.h"
+#include "util/dedup.h"
 #include "util/multiboot.h"
+#include "util/stats_json.h"
 
 #define LOG_TAG "mbtool/recovery/rom_installer"
 
@@ -66,7 +73,7 @@ class RomInstaller : public Installer
 {
 public:
     RomInstaller(std::string zip_file, std::string rom_id, std::FILE *log_fp,
-                 InstallerFlags flags);
+                 InstallerFlags flags, bool dedup);
 
     virtual void display_msg(std::string_view msg) override;
     virtual void updater_print(std::string_view msg) override;
@@ -81,6 +88,7 @@ public:
 private:
     std::string _rom_id;
     std::FILE *_log_fp;
+    bool _dedup;
 
     std::string _ld_library_path;
     std::string _ld_preload;
@@ -89,13 +97,14 @@ private:
 
     static bool extract_ramdisk(const std::string &boot_image_file,
                                 const std::string &output_dir, bool nested);
-    static bool extract_ramdisk_fd(int fd, const std::string &output_dir,
-                                   bool nested);
+    static bool extract_ramdisk_file(File &file, const std::string &output_dir,
+                                     bool nested);
 };
 
 
 RomInstaller::RomInstaller(std::string zip_file, std::string rom_id,
-                           std::FILE *log_fp, InstallerFlags flags) :
+                           std::FILE *log_fp, InstallerFlags flags,
+                           bool dedup) :
     Installer(zip_file, "/chroot", "/multiboot", 3,
 #if DEBUG_ENABLE_PASSTHROUGH
               STDOUT_FILENO,
@@ -104,7 +113,8 @@ RomInstaller::RomInstaller(std::string zip_file, std::string rom_id,
 #endif
              flags),
     _rom_id(std::move(rom_id)),
-    _log_fp(log_fp)
+    _log_fp(log_fp),
+    _dedup(dedup)
 {
 }
 
@@ -275,6 +285,22 @@ Installer::ProceedState RomInstaller::on_unmounted_filesystems()
         }
     }
 
+    if (_dedup) {
+        display_msg("Deduplicating system files");
+
+        // Only extents are shared so that the ROMs stay independent. A failure
+        // here does not affect the installed ROM.
+        DedupOptions options;
+        DedupStats stats;
+
+        if (dedup_installed_roms(options, stats)) {
+            display_msg(format("- Saved %" PRIu64 " MiB in %" PRIu64 " files",
+                               stats.bytes / (1024 * 1024), stats.shared));
+        } else {
+            display_msg("Failed to deduplicate system files");
+        }
+    }
+
     return ProceedState::Continue;
 }
 
@@ -291,7 +317,6 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
 {
     Reader reader;
     Header header;
-    Entry entry;
 
     // Open input boot image
     auto ret = reader.enable_format_all();
@@ -315,41 +340,26 @@ bool RomInstaller::extract_ramdisk(const std::string &boot_image_file,
         return false;
     }
 
-    // Go to ramdisk
-    ret = reader.go_to_entry(entry, ENTRY_TYPE_RAMDISK);
+    // Decompress the ramdisk straight from the boot image
+    EntryFile ramdisk;
+
+    ret = ramdisk.open(&reader, ENTRY_TYPE_RAMDISK);
     if (!ret) {
         if (ret.error() == ReaderError::EndOfEntries) {
             LOGE("%s: Boot image is missing ramdisk", boot_image_file.c_str());
         } else {
-            LOGE("%s: Failed to find ramdisk entry: %s",
+            LOGE("%s: Failed to open ramdisk entry: %s",
                  boot_image_file.c_str(), ret.error().message().c_str());
         }
         return false;
     }
 
-    {
-        std::string tmpfile = format("%s.XXXXXX", output_dir.c_str());
-
-        int tmpfd = mkstemp(tmpfile.data());
-        if (tmpfd < 0) {
-            LOGE("Failed to create temporary file: %s", strerror(errno));
-            return false;
-        }
-
-        // We don't need the path
-        unlink(tmpfile.c_str());
-
-        auto close_fd = finally([&]{
-            close(tmpfd);
-        });
-
-        return bi_copy_data_to_fd(reader, tmpfd)
-                && extract_ramdisk_fd(tmpfd, output_dir, nested);
-    }
+    return extract_ramdisk_file(ramdisk, output_dir, nested);
 }
 
-bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
-                                      bool nested)
+bool RomInstaller::extract_ramdisk_file(File &file,
+                                        const std::string &output_dir,
+                                        bool nested)
 {
     ScopedArchive in(archive_read_new(), archive_read_free);
     ScopedArchive out(archive_write_disk_new(), archive_write_free);
@@ -362,18 +372,21 @@ bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
     }
 
     // Seek to beginning
-    if (lseek(fd, 0, SEEK_SET) < 0) {
-        LOGE("Failed to seek to beginning: %s", strerror(errno));
+    if (auto r = file.seek(0, SEEK_SET); !r) {
+        LOGE("Failed to seek to beginning: %s", r.error().message().c_str());
         return false;
     }
 
-    archive_read_support_filter_gzip(in.get());
-    archive_read_support_filter_lz4(in.get());
-    archive_read_support_filter_lzma(in.get());
-    archive_read_support_filter_xz(in.get());
-    archive_read_support_format_cpio(in.get());
+    auto compression = detect_ramdisk_compression(file);
+    if (!compression) {
+        LOGE("Failed to read ramdisk: %s",
+             compression.error().message().c_str());
+        return false;
+    }
 
-    if (archive_read_open_fd(in.get(), fd, 10240) != ARCHIVE_OK) {
+    la_support_ramdisk(in.get(), compression.value());
+
+    if (la_open_file(in.get(), file) != ARCHIVE_OK) {
         LOGE("Failed to open archive: %s", archive_error_string(in.get()));
         return false;
     }
@@ -415,8 +428,16 @@ bool RomInstaller::extract_ramdisk_fd(int fd, const std::string &output_dir,
                     close(tmpfd);
                 });
 
+                FdFile nested_file;
+                if (auto r = nested_file.open(tmpfd, false); !r) {
+                    LOGE("Failed to open temporary file: %s",
+                         r.error().message().c_str());
+                    return false;
+                }
+
                 return la_copy_data_to_fd(in.get(), tmpfd)
-                        && extract_ramdisk_fd(tmpfd, output_dir, false);
+                        && extract_ramdisk_file(nested_file, output_dir,
+                                                false);
             }
         } else {
             if (strcmp(path, "default.prop") == 0) {
@@ -465,7 +486,12 @@ static void rom_installer_usage(bool error)
             "  -r, --romid        ROM install type/ID (primary, dual, etc.)\n"
             "  -h, --help         Display this help message\n"
             "  --skip-mount       Skip filesystem mounting stage\n"
-            "  --allow-overwrite  Allow overwriting current ROM\n");
+            "  --allow-overwrite  Allow overwriting current ROM\n"
+            "  --dedup            Share identical system files with the\n"
+            "                     other ROMs after installing\n"
+            "  --stats-json <file>\n"
+            "                     Write the throughput and time of each\n"
+            "                     installation stage to a JSON file\n");
 }
 
 int rom_installer_main(int argc, char *argv[])
@@ -487,13 +513,17 @@ int rom_installer_main(int argc, char *argv[])
     std::string rom_id;
     std::string zip_file;
     InstallerFlags flags;
+    std::string stats_json;
     bool allow_overwrite = false;
+    bool dedup = false;
 
     int opt;
 
     enum options : int {
         OPTION_SKIP_MOUNT       = CHAR_MAX + 1,
         OPTION_ALLOW_OVERWRITE  = CHAR_MAX + 2,
+        OPTION_STATS_JSON       = CHAR_MAX + 3,
+        OPTION_DEDUP            = CHAR_MAX + 4,
     };
 
     static struct option long_options[] = {
@@ -501,6 +531,8 @@ int rom_installer_main(int argc, char *argv[])
         {"help",            no_argument,       0, 'h'},
         {"skip-mount",      no_argument,       0, OPTION_SKIP_MOUNT},
         {"allow-overwrite", no_argument,       0, OPTION_ALLOW_OVERWRITE},
+        {"stats-json",      required_argument, 0, OPTION_STATS_JSON},
+        {"dedup",           no_argument,       0, OPTION_DEDUP},
         {0, 0, 0, 0}
     };
 
@@ -527,6 +559,14 @@ int rom_installer_main(int argc, char *argv[])
             allow_overwrite = true;
             break;
 
+        case OPTION_STATS_JSON:
+            stats_json = optarg;
+            break;
+
+        case OPTION_DEDUP:
+            dedup = true;
+            break;
+
         default:
             rom_installer_usage(true);
             return EXIT_FAILURE;
@@ -613,11 +653,21 @@ int rom_installer_main(int argc, char *argv[])
 #endif
 
     // mbtool logging
-    log::set_logger(std::make_shared<log::StdioLogger>(fp.get()));
+    log::set_logger(std::make_shared<log::AsyncLogger>(
+            std::make_shared<log::StdioLogger>(fp.get())));
 
     // Start installing!
-    RomInstaller ri(zip_file, rom_id, fp.get(), flags);
-    return ri.start_installation() ? EXIT_SUCCESS : EXIT_FAILURE;
+    RomInstaller ri(zip_file, rom_id, fp.get(), flags, dedup);
+    bool ret = ri.start_installation();
+
+    if (!stats_json.empty() && !write_stats_json(stats_json)) {
+        ret = false;
+    }
+
+    // Write out everything before the log file is closed
+    log::flush();
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 }
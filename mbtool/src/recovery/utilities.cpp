@@ -36,7 +36,9 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mbcommon/version.h"
+#include "mbdevice/binary.h"
 #include "mbdevice/device.h"
+#include "mbdevice/device_list.h"
 #include "mbdevice/json.h"
 #include "mblog/logging.h"
 #include "mblog/stdio_logger.h"
@@ -79,6 +81,36 @@ static bool get_device(const char *path, Device &device)
         return false;
     }
 
+    // Binary device databases have a codename index, so only the matching
+    // device needs to be copied out
+    if (DeviceDatabase::is_database(contents.value())) {
+        DeviceDatabase db;
+
+        if (!db.load(std::move(contents.value()))) {
+            LOGE("%s: Failed to load device database", path);
+            return false;
+        }
+
+        for (auto const &codename : { prop_product_device, prop_build_product }) {
+            auto view = db.find_by_codename(codename);
+            if (!view) {
+                continue;
+            }
+
+            Device d = view->to_device();
+            if (d.validate()) {
+                LOGW("Skipping invalid device");
+                continue;
+            }
+
+            device = std::move(d);
+            return true;
+        }
+
+        LOGE("Unknown device: %s", prop_product_device.c_str());
+        return false;
+    }
+
     std::vector<Device> devices;
     JsonError error;
 
@@ -87,20 +119,20 @@ static bool get_device(const char *path, Device &device)
         return false;
     }
 
-    for (auto &d : devices) {
+    devices.erase(std::remove_if(devices.begin(), devices.end(),
+                                 [](const Device &d) {
         if (d.validate()) {
             LOGW("Skipping invalid device");
-            continue;
+            return true;
         }
+        return false;
+    }), devices.end());
 
-        auto const &codenames = d.codenames();
-        auto it = std::find_if(codenames.begin(), codenames.end(),
-                               [&](const std::string &item) {
-            return item == prop_product_device || item == prop_build_product;
-        });
+    DeviceList list(std::move(devices));
 
-        if (it != codenames.end()) {
-            device = std::move(d);
+    for (auto const &codename : { prop_product_device, prop_build_product }) {
+        if (auto const *d = list.find_by_codename(codename)) {
+            device = *d;
             return true;
         }
     }
@@ -0,0 +1,522 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/bench.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mblog/logging.h"
+
+#include "util/roms.h"
+#include "util/storage_profile.h"
+
+#define LOG_TAG "mbtool/util/bench"
+
+// Size of the random I/O and fsync operations
+#define SMALL_BLOCK_SIZE            4096u
+// Number of random operations per measurement
+#define RANDOM_OPS                  2048u
+// Number of fsync latency samples
+#define FSYNC_SAMPLES               32u
+// Block size or queue depth is chosen if it is within this fraction of the best
+#define PICK_THRESHOLD              0.95
+
+#define BENCH_FILE_NAME             ".mbtool_bench.tmp"
+
+namespace mb
+{
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t default_block_sizes[] = {
+    4096, 16384, 65536, 262144, 1048576
+};
+
+static const unsigned int queue_depths[] = { 1, 2, 4, 8 };
+
+static double seconds_since(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static bool drop_cache(int fd, const std::string &path)
+{
+    if (fdatasync(fd) < 0) {
+        LOGE("%s: Failed to sync file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Best effort. Some filesystems do not drop clean pages.
+    (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    return true;
+}
+
+static bool write_full(int fd, const char *buf, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, buf, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+static bool bench_sequential(int fd, const std::string &path, size_t file_size,
+                             StorageBlockResult &result)
+{
+    // Random data so that compressing filesystems do not skew the results
+    std::vector<char> buf(result.block_size);
+    std::minstd_rand rng;
+    std::generate(buf.begin(), buf.end(),
+                  [&] { return static_cast<char>(rng()); });
+
+    size_t blocks = file_size / result.block_size;
+
+    if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        LOGE("%s: Failed to truncate file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto start = Clock::now();
+
+    for (size_t i = 0; i < blocks; ++i) {
+        if (!write_full(fd, buf.data(), buf.size())) {
+            LOGE("%s: Failed to write file: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+    }
+
+    if (fdatasync(fd) < 0) {
+        LOGE("%s: Failed to sync file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    result.write_bps = static_cast<double>(blocks * buf.size())
+            / seconds_since(start);
+
+    if (!drop_cache(fd, path)) {
+        return false;
+    }
+
+    start = Clock::now();
+
+    for (size_t i = 0; i < blocks; ++i) {
+        ssize_t n = pread(fd, buf.data(), buf.size(),
+                          static_cast<off_t>(i * buf.size()));
+        if (n < 0 && errno == EINTR) {
+            --i;
+            continue;
+        } else if (n < 0) {
+            LOGE("%s: Failed to read file: %s", path.c_str(), strerror(errno));
+            return false;
+        } else if (static_cast<size_t>(n) != buf.size()) {
+            LOGE("%s: Unexpected EOF", path.c_str());
+            return false;
+        }
+    }
+
+    result.read_bps = static_cast<double>(blocks * buf.size())
+            / seconds_since(start);
+
+    return true;
+}
+
+// Run RANDOM_OPS random reads or writes of SMALL_BLOCK_SIZE bytes spread
+// across `depth` threads and return the number of operations per second
+static bool bench_random(int fd, const std::string &path, size_t file_size,
+                         unsigned int depth, bool write, Executor &executor,
+                         double &iops)
+{
+    off_t slots = static_cast<off_t>(file_size / SMALL_BLOCK_SIZE);
+    std::atomic_bool failed{false};
+
+    auto start = Clock::now();
+
+    parallel_for(depth, [&](size_t index) {
+        std::vector<char> buf(SMALL_BLOCK_SIZE,
+                              static_cast<char>(index + 1));
+        std::minstd_rand rng(static_cast<std::minstd_rand::result_type>(
+                index + 1));
+        std::uniform_int_distribution<off_t> dist(0, slots - 1);
+
+        for (size_t i = index; i < RANDOM_OPS; i += depth) {
+            off_t offset = dist(rng) * static_cast<off_t>(SMALL_BLOCK_SIZE);
+            ssize_t n = write
+                    ? pwrite(fd, buf.data(), buf.size(), offset)
+                    : pread(fd, buf.data(), buf.size(), offset);
+            if (n < 0 && errno == EINTR) {
+                i -= depth;
+                continue;
+            } else if (n != static_cast<ssize_t>(buf.size())) {
+                LOGE("%s: Failed to %s file: %s", path.c_str(),
+                     write ? "write" : "read",
+                     n < 0 ? strerror(errno) : "Short I/O");
+                failed = true;
+                return;
+            }
+        }
+    }, depth, executor);
+
+    if (failed) {
+        return false;
+    }
+
+    if (write && fdatasync(fd) < 0) {
+        LOGE("%s: Failed to sync file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    iops = RANDOM_OPS / seconds_since(start);
+    return true;
+}
+
+static bool bench_fsync(int fd, const std::string &path, double &latency_us)
+{
+    std::vector<char> buf(SMALL_BLOCK_SIZE, 'x');
+    double total = 0;
+
+    for (unsigned int i = 0; i < FSYNC_SAMPLES; ++i) {
+        if (pwrite(fd, buf.data(), buf.size(), 0)
+                != static_cast<ssize_t>(buf.size())) {
+            LOGE("%s: Failed to write file: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        auto start = Clock::now();
+
+        if (fsync(fd) < 0) {
+            LOGE("%s: Failed to sync file: %s", path.c_str(), strerror(errno));
+            return false;
+        }
+
+        total += seconds_since(start);
+    }
+
+    latency_us = total * 1000000 / FSYNC_SAMPLES;
+    return true;
+}
+
+static bool bench_target(StorageTarget &target,
+                         const std::vector<size_t> &block_sizes,
+                         size_t file_size)
+{
+    struct statvfs sfs;
+
+    if (statvfs(target.path.c_str(), &sfs) < 0) {
+        LOGE("%s: Failed to stat filesystem: %s",
+             target.path.c_str(), strerror(errno));
+        return false;
+    } else if (sfs.f_flag & ST_RDONLY) {
+        LOGE("%s: Filesystem is read-only", target.path.c_str());
+        return false;
+    } else if (static_cast<uint64_t>(sfs.f_bavail) * sfs.f_frsize
+            < 2 * static_cast<uint64_t>(file_size)) {
+        LOGE("%s: Not enough free space for a %zu byte test file",
+             target.path.c_str(), file_size);
+        return false;
+    }
+
+    std::string path = target.path;
+    path += "/";
+    path += BENCH_FILE_NAME;
+
+    int fd = open(path.c_str(),
+                  O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_file = finally([&] {
+        close(fd);
+        unlink(path.c_str());
+    });
+
+    target.blocks.clear();
+
+    for (size_t block_size : block_sizes) {
+        StorageBlockResult result{block_size, 0, 0};
+
+        LOGV("%s: Sequential I/O with %zu byte blocks",
+             target.path.c_str(), block_size);
+
+        if (!bench_sequential(fd, path, file_size, result)) {
+            return false;
+        }
+
+        target.blocks.push_back(result);
+    }
+
+    double best = 0;
+    for (auto const &b : target.blocks) {
+        best = std::max(best, b.read_bps + b.write_bps);
+    }
+    for (auto const &b : target.blocks) {
+        if (b.read_bps + b.write_bps >= best * PICK_THRESHOLD) {
+            target.block_size = b.block_size;
+            target.seq_read_bps = b.read_bps;
+            target.seq_write_bps = b.write_bps;
+            break;
+        }
+    }
+
+    // The file is a multiple of the last block size
+    file_size -= file_size % block_sizes.back();
+
+    // Threads are blocked on I/O most of the time, so the queue depth is not
+    // limited by the number of CPUs
+    Executor executor(queue_depths[std::size(queue_depths) - 1]);
+    double iops[std::size(queue_depths)];
+
+    for (size_t i = 0; i < std::size(queue_depths); ++i) {
+        LOGV("%s: Random reads with queue depth %u",
+             target.path.c_str(), queue_depths[i]);
+
+        if (!drop_cache(fd, path) || !bench_random(
+                fd, path, file_size, queue_depths[i], false, executor,
+                iops[i])) {
+            return false;
+        }
+    }
+
+    best = *std::max_element(std::begin(iops), std::end(iops));
+    for (size_t i = 0; i < std::size(queue_depths); ++i) {
+        if (iops[i] >= best * PICK_THRESHOLD) {
+            target.queue_depth = queue_depths[i];
+            target.rand_read_iops = iops[i];
+            break;
+        }
+    }
+
+    LOGV("%s: Random writes", target.path.c_str());
+
+    if (!bench_random(fd, path, file_size, target.queue_depth, true, executor,
+                      target.rand_write_iops)) {
+        return false;
+    }
+
+    LOGV("%s: fsync latency", target.path.c_str());
+
+    return bench_fsync(fd, path, target.fsync_latency_us);
+}
+
+static bool parse_size(const char *str, size_t &out)
+{
+    return str_to_num(str, 10, out) && out >= SMALL_BLOCK_SIZE;
+}
+
+static bool parse_block_sizes(const char *str, std::vector<size_t> &out)
+{
+    out.clear();
+
+    for (const char *p = str; *p;) {
+        const char *end = strchr(p, ',');
+        std::string item = end ? std::string(p, end) : std::string(p);
+        size_t size;
+
+        if (!parse_size(item.c_str(), size)) {
+            return false;
+        }
+        out.push_back(size);
+
+        if (!end) {
+            break;
+        }
+        p = end + 1;
+    }
+
+    return !out.empty();
+}
+
+static void bench_usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: bench [OPTION...]\n\n"
+            "Options:\n"
+            "  -t, --target <dir>  Directory to benchmark (can be repeated)\n"
+            "  -b, --block-sizes <sizes>\n"
+            "                      Comma-separated sequential I/O block sizes\n"
+            "  -s, --size <bytes>  Size of the test file (default: %zu)\n"
+            "  -o, --output <file> Storage profile to update\n"
+            "  -n, --no-save       Only print the results\n"
+            "  -h, --help          Display this help message\n"
+            "\n"
+            "If --target is omitted, /data, /cache, /system, and the external\n"
+            "SD card are benchmarked. Read-only targets are skipped.\n\n"
+            "The results are merged into %s, which is used to\n"
+            "pick the block sizes and I/O concurrency for copying, flashing,\n"
+            "and restoring.\n",
+            static_cast<size_t>(64 * 1024 * 1024), STORAGE_PROFILE_PATH);
+}
+
+int bench_main(int argc, char *argv[])
+{
+    int opt;
+    std::vector<std::string> targets;
+    std::vector<size_t> block_sizes(std::begin(default_block_sizes),
+                                    std::end(default_block_sizes));
+    size_t file_size = 64 * 1024 * 1024;
+    std::string output = get_raw_path(STORAGE_PROFILE_PATH);
+    bool no_save = false;
+
+    static struct option long_options[] = {
+        {"target",      required_argument, 0, 't'},
+        {"block-sizes", required_argument, 0, 'b'},
+        {"size",        required_argument, 0, 's'},
+        {"output",      required_argument, 0, 'o'},
+        {"no-save",     no_argument,       0, 'n'},
+        {"help",        no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    static const char short_options[] = "t:b:s:o:nh";
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(
+            argc, argv, short_options, long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 't':
+            targets.push_back(optarg);
+            break;
+
+        case 'b':
+            if (!parse_block_sizes(optarg, block_sizes)) {
+                fprintf(stderr, "Invalid block sizes: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 's':
+            if (!parse_size(optarg, file_size)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'o':
+            output = optarg;
+            break;
+
+        case 'n':
+            no_save = true;
+            break;
+
+        case 'h':
+            bench_usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            bench_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // There should be no other arguments
+    if (argc - optind != 0) {
+        bench_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (file_size < *std::max_element(block_sizes.begin(), block_sizes.end())) {
+        fprintf(stderr, "Test file size is smaller than the largest block\n");
+        return EXIT_FAILURE;
+    }
+
+    bool explicit_targets = !targets.empty();
+    if (!explicit_targets) {
+        targets = { "/data", "/cache", "/system" };
+        if (auto extsd = Roms::get_extsd_partition(); !extsd.empty()) {
+            targets.push_back(std::move(extsd));
+        }
+    }
+
+    StorageProfile profile;
+    struct stat sb;
+
+    if (stat(output.c_str(), &sb) == 0 && !profile.load_file(output)) {
+        LOGW("%s: Replacing invalid storage profile", output.c_str());
+        profile.targets.clear();
+    }
+
+    bool ret = true;
+
+    printf("%-24s %10s %4s %10s %10s %9s %9s %9s\n",
+           "target", "block", "qd", "seq rd/s", "seq wr/s",
+           "rnd rd/s", "rnd wr/s", "fsync us");
+
+    for (auto const &path : targets) {
+        StorageTarget target;
+        target.path = path;
+
+        if (!bench_target(target, block_sizes, file_size)) {
+            // Skipping the default targets (eg. a read-only /system) is not
+            // an error
+            if (explicit_targets) {
+                ret = false;
+            }
+            continue;
+        }
+
+        printf("%-24s %10zu %4u %8.1fM %8.1fM %9.0f %9.0f %9.0f\n",
+               target.path.c_str(), target.block_size, target.queue_depth,
+               target.seq_read_bps / (1024 * 1024),
+               target.seq_write_bps / (1024 * 1024),
+               target.rand_read_iops, target.rand_write_iops,
+               target.fsync_latency_us);
+
+        profile.set(std::move(target));
+    }
+
+    if (!no_save && !profile.save_file(output)) {
+        ret = false;
+    }
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
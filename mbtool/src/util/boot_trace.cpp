@@ -0,0 +1,241 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/boot_trace.h"
+
+#include <array>
+#include <atomic>
+#include <string>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "mbcommon/finally.h"
+#include "mblog/logging.h"
+#include "mbutil/atrace.h"
+#include "mbutil/directory.h"
+
+#define LOG_TAG "mbtool/util/boot_trace"
+
+namespace mb
+{
+
+namespace
+{
+
+struct TraceEvent
+{
+    // Index + 1 of the event that was last written to this slot. This lets
+    // trace_write() skip slots that are being written or were overwritten.
+    std::atomic<uint64_t> seq;
+    uint64_t timestamp_ns;
+    pid_t tid;
+    char phase;
+    char name[TRACE_MAX_NAME];
+};
+
+// Preallocated so that recording an event never allocates
+std::array<TraceEvent, TRACE_MAX_EVENTS> g_events;
+std::atomic<uint64_t> g_next_event{0};
+
+uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * UINT64_C(1000000000)
+            + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+pid_t current_tid()
+{
+    thread_local pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+    return tid;
+}
+
+void record(char phase, const char *name)
+{
+    uint64_t index = g_next_event.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent &event = g_events[index % TRACE_MAX_EVENTS];
+
+    event.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    event.timestamp_ns = monotonic_ns();
+    event.tid = current_tid();
+    event.phase = phase;
+    strncpy(event.name, name, sizeof(event.name) - 1);
+    event.name[sizeof(event.name) - 1] = '\0';
+
+    event.seq.store(index + 1, std::memory_order_release);
+}
+
+void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (auto p = reinterpret_cast<const unsigned char *>(str); *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', fp);
+            fputc(*p, fp);
+        } else if (*p < 0x20) {
+            fprintf(fp, "\\u%04x", *p);
+        } else {
+            fputc(*p, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+}
+
+/*!
+ * \brief Record the start of a span
+ *
+ * This is safe to call from any thread and does not allocate memory. \p name is
+ * copied into the event, so it does not need to outlive the call. The span is
+ * also written as an ATRACE section if system tracing is on.
+ */
+void trace_begin(const char *name)
+{
+    record('B', name);
+    util::atrace_begin(name);
+}
+
+/*!
+ * \brief Record the end of a span
+ *
+ * \p name must match the name passed to the corresponding trace_begin() call
+ * on the same thread.
+ */
+void trace_end(const char *name)
+{
+    record('E', name);
+    util::atrace_end();
+}
+
+/*!
+ * \brief Write the recorded events in the Chrome trace event format
+ *
+ * The output can be loaded in chrome://tracing or Perfetto. Timestamps are
+ * relative to CLOCK_MONOTONIC, which starts at kernel boot. Events that are
+ * still being recorded by other threads are skipped.
+ *
+ * \param path Output path. The file is written to a temporary file first and
+ *             then renamed into place.
+ *
+ * \return Whether the file was successfully written
+ */
+bool trace_write(const char *path)
+{
+    if (auto r = util::mkdir_parent(path, 0755);
+            !r && r.error() != std::errc::file_exists) {
+        LOGE("%s: Failed to create parent directory: %s",
+             path, r.error().message().c_str());
+        return false;
+    }
+
+    std::string temp_path(path);
+    temp_path += ".tmp";
+
+    FILE *fp = fopen(temp_path.c_str(), "we");
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        if (fp) {
+            fclose(fp);
+        }
+        unlink(temp_path.c_str());
+    });
+
+    uint64_t end = g_next_event.load(std::memory_order_acquire);
+    uint64_t begin = end > TRACE_MAX_EVENTS ? end - TRACE_MAX_EVENTS : 0;
+    pid_t pid = getpid();
+    bool first = true;
+
+    fputs("{\"traceEvents\":[", fp);
+
+    for (uint64_t i = begin; i < end; ++i) {
+        const TraceEvent &event = g_events[i % TRACE_MAX_EVENTS];
+
+        if (event.seq.load(std::memory_order_acquire) != i + 1) {
+            continue;
+        }
+
+        if (!first) {
+            fputc(',', fp);
+        }
+        first = false;
+
+        fputs("\n{\"name\":", fp);
+        write_json_string(fp, event.name);
+        fprintf(fp, ",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03" PRIu64
+                ",\"pid\":%d,\"tid\":%d}",
+                event.phase, event.timestamp_ns / 1000,
+                event.timestamp_ns % 1000, pid, event.tid);
+    }
+
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":"
+            "{\"droppedEvents\":%" PRIu64 "}}\n", begin);
+
+    bool ok = !ferror(fp);
+
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    fp = nullptr;
+
+    if (!ok) {
+        LOGE("%s: Failed to write trace: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path, strerror(errno));
+        return false;
+    }
+
+    LOGD("%s: Wrote %" PRIu64 " trace events", path, end - begin);
+
+    return true;
+}
+
+TraceSpan::TraceSpan(const char *name)
+{
+    strncpy(_name, name, sizeof(_name) - 1);
+    _name[sizeof(_name) - 1] = '\0';
+    trace_begin(_name);
+}
+
+TraceSpan::~TraceSpan()
+{
+    trace_end(_name);
+}
+
+}
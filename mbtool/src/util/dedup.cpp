@@ -0,0 +1,705 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/dedup.h"
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <unordered_set>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "mbcommon/executor.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/hashing.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/copy.h"
+#include "mbutil/dir_walker.h"
+
+#include "util/dir_size.h"
+#include "util/roms.h"
+
+#define LOG_TAG "mbtool/util/dedup"
+
+// Size of each FIDEDUPERANGE request. Filesystems may deduplicate less than
+// this per call.
+static constexpr uint64_t DEDUP_RANGE_SIZE = 16 * 1024 * 1024;
+
+static constexpr size_t DEDUP_READ_SIZE = 1024 * 1024;
+
+// Extended attributes that are shared by hard links and must match before two
+// files can be linked together
+static const char * const LINK_XATTRS[] = {
+    "security.selinux",
+    "security.capability",
+};
+
+static constexpr char DEDUP_TEMP_SUFFIX[] = ".mbdedup";
+
+namespace mb
+{
+
+struct DedupFile
+{
+    std::string path;
+    dev_t dev;
+    ino_t ino;
+    uint64_t size;
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    nlink_t nlink;
+    std::vector<unsigned char> digest;
+};
+
+class DedupWalker : public util::DirWalker
+{
+public:
+    std::vector<DedupFile> files;
+
+    DedupWalker(std::string path, uint64_t min_size)
+        : DirWalker(std::move(path), util::DirWalkerFlag::GroupSpecialFiles)
+        , _min_size(min_size)
+    {
+    }
+
+    Actions on_reached_file() override
+    {
+        auto sb = curr_stat();
+        if (!sb) {
+            _error_msg = format("%s: Failed to stat: %s",
+                                _curr->path.c_str(), strerror(errno));
+            return Action::Fail;
+        }
+
+        auto size = static_cast<uint64_t>(sb->st_size);
+
+        if (size >= _min_size) {
+            files.push_back({
+                _curr->path, sb->st_dev, sb->st_ino, size, sb->st_mode,
+                sb->st_uid, sb->st_gid, sb->st_nlink, {}
+            });
+        }
+
+        return Action::Ok;
+    }
+
+private:
+    uint64_t _min_size;
+};
+
+enum class ShareResult
+{
+    Shared,
+    Differs,
+    Unsupported,
+    Failed,
+};
+
+static bool is_unsupported_error(int error)
+{
+    return error == EOPNOTSUPP || error == ENOTTY || error == EINVAL
+            || error == EXDEV;
+}
+
+static bool hash_file(DedupFile &file)
+{
+    FdFile fd_file;
+    HashingFile hashing_file;
+
+    if (auto r = fd_file.open(file.path, FileOpenMode::ReadOnly); !r) {
+        LOGW("%s: Failed to open: %s",
+             file.path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = hashing_file.open(&fd_file, HashAlgorithm::Sha256); !r) {
+        LOGW("%s: Failed to initialize hash: %s",
+             file.path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto buf = std::make_unique<unsigned char[]>(DEDUP_READ_SIZE);
+    uint64_t total = 0;
+
+    while (true) {
+        auto n = file_read_retry(hashing_file, buf.get(), DEDUP_READ_SIZE);
+        if (!n) {
+            LOGW("%s: Failed to read: %s",
+                 file.path.c_str(), n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            break;
+        }
+        total += n.value();
+    }
+
+    // The file changed since it was walked
+    if (total != file.size) {
+        return false;
+    }
+
+    auto digest = hashing_file.digest(HashAlgorithm::Sha256);
+    if (!digest) {
+        LOGW("%s: Failed to compute hash: %s",
+             file.path.c_str(), digest.error().message().c_str());
+        return false;
+    }
+
+    file.digest = std::move(digest.value());
+    return true;
+}
+
+/*!
+ * \brief Share the extents of \p target with \p source
+ *
+ * The kernel compares the data of both files under lock before sharing it, so
+ * \p target keeps its contents if it was changed after it was hashed. Writes
+ * to either file afterwards are copy-on-write.
+ */
+static ShareResult share_extents(const DedupFile &source,
+                                 const DedupFile &target, uint64_t &shared)
+{
+#ifdef FIDEDUPERANGE
+    int source_fd = open(source.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (source_fd < 0) {
+        LOGW("%s: Failed to open: %s", source.path.c_str(), strerror(errno));
+        return ShareResult::Failed;
+    }
+
+    auto close_source_fd = finally([&] {
+        close(source_fd);
+    });
+
+    // Opening for writing does not modify the file, but is required for
+    // deduplicating into files that the caller does not own
+    int target_fd = open(target.path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (target_fd < 0) {
+        LOGW("%s: Failed to open: %s", target.path.c_str(), strerror(errno));
+        return ShareResult::Failed;
+    }
+
+    auto close_target_fd = finally([&] {
+        close(target_fd);
+    });
+
+    std::vector<unsigned char> buf(sizeof(file_dedupe_range)
+            + sizeof(file_dedupe_range_info));
+    auto *range = reinterpret_cast<file_dedupe_range *>(buf.data());
+
+    for (uint64_t offset = 0; offset < target.size;) {
+        std::fill(buf.begin(), buf.end(), 0);
+        range->src_offset = offset;
+        range->src_length = std::min(target.size - offset, DEDUP_RANGE_SIZE);
+        range->dest_count = 1;
+        range->info[0].dest_fd = target_fd;
+        range->info[0].dest_offset = offset;
+
+        if (ioctl(source_fd, FIDEDUPERANGE, range) < 0) {
+            if (is_unsupported_error(errno)) {
+                return ShareResult::Unsupported;
+            }
+            LOGW("%s: Failed to deduplicate: %s",
+                 target.path.c_str(), strerror(errno));
+            return ShareResult::Failed;
+        }
+
+        auto const &info = range->info[0];
+
+        if (info.status == FILE_DEDUPE_RANGE_DIFFERS) {
+            return ShareResult::Differs;
+        } else if (info.status < 0) {
+            if (is_unsupported_error(-info.status)) {
+                return ShareResult::Unsupported;
+            }
+            LOGW("%s: Failed to deduplicate: %s",
+                 target.path.c_str(), strerror(-info.status));
+            return ShareResult::Failed;
+        } else if (info.bytes_deduped == 0) {
+            LOGW("%s: Deduplication made no progress at offset %" PRIu64,
+                 target.path.c_str(), offset);
+            return ShareResult::Failed;
+        }
+
+        offset += info.bytes_deduped;
+        shared += info.bytes_deduped;
+    }
+
+    return ShareResult::Shared;
+#else
+    (void) source;
+    (void) target;
+    (void) shared;
+    return ShareResult::Unsupported;
+#endif
+}
+
+static bool get_xattr(const std::string &path, const char *name,
+                      std::string &value)
+{
+    value.clear();
+
+    ssize_t size = lgetxattr(path.c_str(), name, nullptr, 0);
+    if (size < 0) {
+        return errno == ENODATA || errno == ENOTSUP;
+    }
+
+    value.resize(static_cast<size_t>(size));
+
+    size = lgetxattr(path.c_str(), name, value.data(), value.size());
+    if (size < 0) {
+        return false;
+    }
+
+    value.resize(static_cast<size_t>(size));
+    return true;
+}
+
+// Hard links share the inode, so everything that the ROM can observe through
+// the inode must already be identical
+static bool can_link(const DedupFile &source, const DedupFile &target)
+{
+    if (source.mode != target.mode || source.uid != target.uid
+            || source.gid != target.gid) {
+        return false;
+    }
+
+    for (auto const &name : LINK_XATTRS) {
+        std::string source_value;
+        std::string target_value;
+
+        if (!get_xattr(source.path, name, source_value)
+                || !get_xattr(target.path, name, target_value)
+                || source_value != target_value) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Unlike FIDEDUPERANGE, linking does not verify the data, so compare it byte
+// for byte instead of trusting the hashes from earlier
+static bool same_contents(const DedupFile &source, const DedupFile &target)
+{
+    FdFile source_file;
+    FdFile target_file;
+
+    if (!source_file.open(source.path, FileOpenMode::ReadOnly)
+            || !target_file.open(target.path, FileOpenMode::ReadOnly)) {
+        return false;
+    }
+
+    auto source_buf = std::make_unique<unsigned char[]>(DEDUP_READ_SIZE);
+    auto target_buf = std::make_unique<unsigned char[]>(DEDUP_READ_SIZE);
+
+    while (true) {
+        auto n = file_read_retry(source_file, source_buf.get(),
+                                 DEDUP_READ_SIZE);
+        if (!n) {
+            return false;
+        }
+
+        auto m = file_read_retry(target_file, target_buf.get(),
+                                 DEDUP_READ_SIZE);
+        if (!m || m.value() != n.value()) {
+            return false;
+        } else if (n.value() == 0) {
+            return true;
+        } else if (memcmp(source_buf.get(), target_buf.get(),
+                          n.value()) != 0) {
+            return false;
+        }
+    }
+}
+
+static bool replace_with_link(const DedupFile &source, const DedupFile &target)
+{
+    std::string temp_path = target.path + DEDUP_TEMP_SUFFIX;
+    unlink(temp_path.c_str());
+
+    if (link(source.path.c_str(), temp_path.c_str()) < 0) {
+        LOGW("%s: Failed to link to %s: %s", temp_path.c_str(),
+             source.path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), target.path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             target.path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static bool dedup_key_less(const DedupFile &a, const DedupFile &b)
+{
+    if (a.dev != b.dev) {
+        return a.dev < b.dev;
+    } else if (a.size != b.size) {
+        return a.size < b.size;
+    } else {
+        return a.digest < b.digest;
+    }
+}
+
+/*!
+ * \brief Deduplicate identical regular files in a set of directories
+ *
+ * Files are grouped by filesystem and size, and only files that share their
+ * size with another file are hashed. Files with the same SHA-256 digest are
+ * then deduplicated against the first file of their group with
+ * FIDEDUPERANGE, which shares the extents and keeps both files independent.
+ *
+ * If the filesystem cannot share extents and \p options.allow_hardlinks is
+ * set, duplicates that also have the same mode, owner, SELinux label, and
+ * capabilities are replaced by hard links instead. Since a write through one
+ * hard link is visible through all of them, dedup_unshare_hardlinks() must be
+ * called on a directory before anything modifies its files. The installers and
+ * selective backup restores do this, and booted ROMs get their system
+ * directory mounted read-only. Nothing else may write to a linked directory:
+ * remounting /system read-write in a booted ROM or modifying it from recovery
+ * without mbtool changes the files of every ROM it is linked to.
+ *
+ * Mountpoints are not traversed.
+ *
+ * \param dirs Directories to deduplicate
+ * \param options Deduplication options
+ * \param[out] stats Deduplication statistics
+ *
+ * \return Whether all directories could be walked. Files that could not be
+ *         deduplicated are skipped with a warning.
+ */
+bool dedup_directories(const std::vector<std::string> &dirs,
+                       const DedupOptions &options, DedupStats &stats)
+{
+    std::vector<DedupFile> files;
+
+    for (auto const &dir : dirs) {
+        DedupWalker walker(dir, std::max<uint64_t>(options.min_size, 1));
+        if (!walker.run()) {
+            LOGE("%s: Failed to walk directory: %s",
+                 dir.c_str(), walker.error().c_str());
+            return false;
+        }
+
+        std::move(walker.files.begin(), walker.files.end(),
+                  std::back_inserter(files));
+    }
+
+    stats.files += files.size();
+
+    // Existing hard links (and overlapping input directories) already share
+    // their data
+    {
+        std::unordered_set<FileId, FileIdHash> seen;
+        files.erase(std::remove_if(files.begin(), files.end(),
+                [&](const DedupFile &f) {
+                    return !seen.insert({f.dev, f.ino}).second;
+                }), files.end());
+    }
+
+    // Only files with the same size as another file on the same filesystem
+    // can be duplicates
+    std::sort(files.begin(), files.end(), dedup_key_less);
+
+    std::vector<DedupFile> candidates;
+
+    for (auto it = files.begin(); it != files.end();) {
+        auto end = std::find_if(it, files.end(), [&](const DedupFile &f) {
+            return f.dev != it->dev || f.size != it->size;
+        });
+
+        if (end - it > 1) {
+            std::move(it, end, std::back_inserter(candidates));
+        }
+
+        it = end;
+    }
+
+    files.clear();
+
+    parallel_for(candidates.size(), [&](size_t i) {
+        // A file that cannot be read is left alone
+        if (!hash_file(candidates[i])) {
+            candidates[i].digest.clear();
+        }
+    });
+
+    stats.hashed += candidates.size();
+
+    std::sort(candidates.begin(), candidates.end(), dedup_key_less);
+
+    std::unordered_set<dev_t> no_extent_sharing;
+
+    for (auto it = candidates.begin(); it != candidates.end();) {
+        auto end = std::find_if(it, candidates.end(), [&](const DedupFile &f) {
+            return f.dev != it->dev || f.size != it->size
+                    || f.digest != it->digest;
+        });
+
+        auto const &source = *it;
+
+        for (auto dup = std::next(it); !source.digest.empty() && dup != end;
+                ++dup) {
+            if (options.dry_run) {
+                printf("%s -> %s\n", dup->path.c_str(), source.path.c_str());
+                ++stats.shared;
+                stats.bytes += dup->size;
+                continue;
+            }
+
+            auto result = ShareResult::Unsupported;
+            uint64_t shared = 0;
+
+            if (no_extent_sharing.find(dup->dev) == no_extent_sharing.end()) {
+                result = share_extents(source, *dup, shared);
+            }
+
+            switch (result) {
+            case ShareResult::Shared:
+                ++stats.shared;
+                stats.bytes += shared;
+                break;
+
+            case ShareResult::Differs:
+                LOGW("%s: Contents changed since it was hashed",
+                     dup->path.c_str());
+                break;
+
+            case ShareResult::Unsupported:
+                no_extent_sharing.insert(dup->dev);
+
+                if (options.allow_hardlinks && can_link(source, *dup)
+                        && same_contents(source, *dup)
+                        && replace_with_link(source, *dup)) {
+                    ++stats.linked;
+                    stats.bytes += dup->size;
+                }
+                break;
+
+            case ShareResult::Failed:
+                break;
+            }
+        }
+
+        it = end;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Deduplicate the system directories of the installed ROMs
+ *
+ * The primary ROM is skipped because its system partition is managed by the
+ * stock updater and contains the system directories of the secondary ROMs.
+ * ROMs with image-based system partitions are skipped as well.
+ *
+ * \param options Deduplication options
+ * \param[out] stats Deduplication statistics
+ *
+ * \return Whether all directories could be walked
+ */
+bool dedup_installed_roms(const DedupOptions &options, DedupStats &stats)
+{
+    Roms roms;
+    roms.add_installed();
+
+    std::vector<std::string> dirs;
+
+    for (auto const &rom : roms.roms) {
+        if (rom->id == "primary" || rom->system_is_image) {
+            continue;
+        }
+
+        std::string path = rom->full_system_path();
+        struct stat sb;
+
+        if (!path.empty() && stat(path.c_str(), &sb) == 0
+                && S_ISDIR(sb.st_mode)) {
+            dirs.push_back(std::move(path));
+        }
+    }
+
+    return dedup_directories(dirs, options, stats);
+}
+
+/*!
+ * \brief Give each hard-linked file in a directory its own inode
+ *
+ * dedup_directories() may link files within one ROM as well as across ROMs,
+ * so every path with more than one link is copied to a new inode. Writes to
+ * the directory's files then cannot affect any other path. Files that share
+ * extents instead of inodes do not need this since their writes are
+ * copy-on-write.
+ *
+ * \param dir Directory whose files will be modified
+ *
+ * \return Whether all hard-linked files were copied
+ */
+bool dedup_unshare_hardlinks(const std::string &dir)
+{
+    DedupWalker walker(dir, 0);
+    if (!walker.run()) {
+        LOGE("%s: Failed to walk directory: %s",
+             dir.c_str(), walker.error().c_str());
+        return false;
+    }
+
+    bool ret = true;
+
+    for (auto const &file : walker.files) {
+        if (file.nlink <= 1) {
+            continue;
+        }
+
+        std::string temp_path = file.path + DEDUP_TEMP_SUFFIX;
+
+        // copy_file() writes a new inode with the same attributes, xattrs,
+        // and contents
+        if (auto r = util::copy_file(file.path, temp_path,
+                                     util::CopyFlag::CopyAttributes
+                                     | util::CopyFlag::CopyXattrs); !r) {
+            LOGE("%s: Failed to copy: %s",
+                 file.path.c_str(), r.error().message().c_str());
+            unlink(temp_path.c_str());
+            ret = false;
+        } else if (rename(temp_path.c_str(), file.path.c_str()) < 0) {
+            LOGE("%s: Failed to rename to %s: %s",
+                 temp_path.c_str(), file.path.c_str(), strerror(errno));
+            unlink(temp_path.c_str());
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+
+static void dedup_usage(FILE *stream)
+{
+    fprintf(stream,
+            "Usage: dedup [OPTION...] [<dir>...]\n\n"
+            "Options:\n"
+            "  -l, --hardlinks     Use hard links if extents cannot be shared\n"
+            "  -m, --min-size <bytes>\n"
+            "                      Skip smaller files (default: %" PRIu64 ")\n"
+            "  -n, --dry-run       Only print the duplicate files\n"
+            "  -h, --help          Display this help message\n"
+            "\n"
+            "Identical files are made to share their data. If no directories\n"
+            "are given, the system directories of the installed secondary\n"
+            "ROMs are deduplicated against each other.\n\n"
+            "Extents are only shared on filesystems that support it, like\n"
+            "btrfs and XFS. Hard-linked files are split again when mbtool\n"
+            "flashes a ROM to the directory or restores a backup on top of\n"
+            "it. With --hardlinks, a linked system directory must never be\n"
+            "written to by anything else: remounting /system read-write in a\n"
+            "booted ROM modifies every ROM that shares the files.\n",
+            DEDUP_DEFAULT_MIN_SIZE);
+}
+
+int dedup_main(int argc, char *argv[])
+{
+    int opt;
+    DedupOptions options;
+
+    static struct option long_options[] = {
+        {"hardlinks", no_argument,       0, 'l'},
+        {"min-size",  required_argument, 0, 'm'},
+        {"dry-run",   no_argument,       0, 'n'},
+        {"help",      no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    static const char short_options[] = "lm:nh";
+
+    int long_index = 0;
+
+    while ((opt = getopt_long(
+            argc, argv, short_options, long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'l':
+            options.allow_hardlinks = true;
+            break;
+
+        case 'm':
+            if (!str_to_num(optarg, 10, options.min_size)) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'n':
+            options.dry_run = true;
+            break;
+
+        case 'h':
+            dedup_usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            dedup_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    DedupStats stats;
+    bool ret;
+
+    if (optind < argc) {
+        ret = dedup_directories({argv + optind, argv + argc}, options, stats);
+    } else {
+        ret = dedup_installed_roms(options, stats);
+    }
+
+    printf("%" PRIu64 " files, %" PRIu64 " hashed, %" PRIu64 " shared,"
+           " %" PRIu64 " linked, %" PRIu64 " bytes %s\n",
+           stats.files, stats.hashed, stats.shared, stats.linked, stats.bytes,
+           options.dry_run ? "could be saved" : "saved");
+
+    if (stats.linked > 0 && !options.dry_run) {
+        fprintf(stderr, "Warning: Hard-linked files are shared between ROMs."
+                        " Do not remount /system read-write in a booted ROM"
+                        " or modify it from recovery without mbtool.\n");
+    }
+
+    return ret ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
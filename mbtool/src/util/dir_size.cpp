@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/dir_size.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mbcommon/error_code.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
+#include "mbcommon/string.h"
+#include "mbutil/dir_walker.h"
+
+namespace mb
+{
+
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
+
+static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+static constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+static uint64_t fingerprint_update(uint64_t hash, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i) {
+        hash ^= value & 0xff;
+        hash *= FNV_PRIME;
+        value >>= 8;
+    }
+    return hash;
+}
+
+class SubtreeWalker : public util::DirWalker
+{
+public:
+    int error_value = 0;
+    uint64_t fingerprint = FNV_OFFSET_BASIS;
+    uint64_t size = 0;
+    std::unordered_map<FileId, uint64_t, FileIdHash> links;
+
+    SubtreeWalker(std::string path, bool count_files)
+        : DirWalker(std::move(path), util::DirWalkerFlag::GroupSpecialFiles)
+        , _count_files(count_files)
+    {
+    }
+
+    Actions on_reached_directory_pre() override
+    {
+        auto sb = curr_stat();
+        if (!sb) {
+            return stat_failed();
+        }
+
+        fingerprint = fingerprint_update(
+                fingerprint, static_cast<uint64_t>(sb->st_ino));
+        fingerprint = fingerprint_update(
+                fingerprint, static_cast<uint64_t>(sb->st_mtim.tv_sec));
+        fingerprint = fingerprint_update(
+                fingerprint, static_cast<uint64_t>(sb->st_mtim.tv_nsec));
+
+        return Action::Ok;
+    }
+
+    Actions on_reached_file() override
+    {
+        if (!_count_files) {
+            return Action::Ok;
+        }
+
+        auto sb = curr_stat();
+        if (!sb) {
+            return stat_failed();
+        }
+
+        auto file_size = static_cast<uint64_t>(sb->st_size);
+
+        if (sb->st_nlink > 1) {
+            links.emplace(FileId{sb->st_dev, sb->st_ino}, file_size);
+        } else {
+            size += file_size;
+        }
+
+        return Action::Ok;
+    }
+
+private:
+    bool _count_files;
+
+    Actions stat_failed()
+    {
+        error_value = errno;
+        _error_msg = format("%s: Failed to stat: %s",
+                            _curr->path.c_str(), strerror(error_value));
+        return Action::Fail;
+    }
+};
+
+/*!
+ * \brief Get the total size of regular files in a directory
+ *
+ * Hard links are only counted once and mountpoints are not traversed.
+ *
+ * \param path Directory path
+ * \param exclusions Names of first-level entries to exclude
+ *
+ * \return Total size in bytes or the error
+ */
+oc::result<uint64_t>
+DirectorySizeCache::get(const std::string &path,
+                        const std::vector<std::string> &exclusions)
+{
+    int dfd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        return ec_from_errno();
+    }
+
+    auto close_dfd = finally([&] {
+        close(dfd);
+    });
+
+    struct stat root_sb;
+    if (fstat(dfd, &root_sb) < 0) {
+        return ec_from_errno();
+    }
+
+    uint64_t total = 0;
+    std::unordered_map<FileId, uint64_t, FileIdHash> links;
+    std::vector<std::string> subtrees;
+
+    {
+        int fd = dup(dfd);
+        if (fd < 0) {
+            return ec_from_errno();
+        }
+
+        ScopedDIR dp(fdopendir(fd), closedir);
+        if (!dp) {
+            auto ec = ec_from_errno();
+            close(fd);
+            return ec;
+        }
+
+        while (struct dirent *ent = readdir(dp.get())) {
+            if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0
+                    || std::find(exclusions.begin(), exclusions.end(),
+                                 ent->d_name) != exclusions.end()) {
+                continue;
+            }
+
+            struct stat sb;
+            if (fstatat(dfd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+                return ec_from_errno();
+            }
+
+            if (S_ISDIR(sb.st_mode)) {
+                // Contents of mountpoints are not counted
+                if (sb.st_dev == root_sb.st_dev) {
+                    subtrees.push_back(path + "/" + ent->d_name);
+                }
+            } else if (S_ISREG(sb.st_mode)) {
+                auto file_size = static_cast<uint64_t>(sb.st_size);
+
+                if (sb.st_nlink > 1) {
+                    links.emplace(FileId{sb.st_dev, sb.st_ino}, file_size);
+                } else {
+                    total += file_size;
+                }
+            }
+        }
+    }
+
+    std::vector<Subtree> results(subtrees.size());
+    std::atomic<size_t> next{0};
+    std::atomic_bool failed{false};
+    std::mutex error_mutex;
+    std::optional<std::error_code> error;
+
+    auto walk = [&](SubtreeWalker &walker) {
+        if (walker.run()) {
+            return true;
+        }
+
+        int error_value = walker.error_value ? walker.error_value : errno;
+
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+            error = ec_from_errno(error_value ? error_value : EIO);
+        }
+        failed = true;
+
+        return false;
+    };
+
+    auto worker = [&] {
+        while (!failed) {
+            size_t i = next++;
+            if (i >= subtrees.size()) {
+                break;
+            }
+
+            auto const &subtree_path = subtrees[i];
+
+            // Only the directories need to be walked to check if the cached
+            // result is still valid
+            if (auto it = _subtrees.find(subtree_path);
+                    it != _subtrees.end()) {
+                SubtreeWalker walker(subtree_path, false);
+                if (!walk(walker)) {
+                    break;
+                }
+
+                if (walker.fingerprint == it->second.fingerprint) {
+                    results[i] = it->second;
+                    continue;
+                }
+            }
+
+            SubtreeWalker walker(subtree_path, true);
+            if (!walk(walker)) {
+                break;
+            }
+
+            results[i] = {walker.fingerprint, walker.size,
+                          std::move(walker.links)};
+        }
+    };
+
+    unsigned int threads = std::clamp(
+            Executor::global().concurrency(), 1u,
+            std::max(static_cast<unsigned int>(subtrees.size()), 1u));
+
+    TaskGroup group;
+    for (unsigned int i = 1; i < threads; ++i) {
+        group.run(worker);
+    }
+    worker();
+    group.wait();
+
+    if (error) {
+        return *error;
+    }
+
+    for (size_t i = 0; i < subtrees.size(); ++i) {
+        auto &result = results[i];
+
+        total += result.size;
+        links.insert(result.links.begin(), result.links.end());
+
+        _subtrees[subtrees[i]] = std::move(result);
+    }
+
+    for (auto const &[id, file_size] : links) {
+        total += file_size;
+    }
+
+    return total;
+}
+
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/hash_tree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <utility>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <openssl/sha.h>
+
+#include "mbcommon/endian.h"
+#include "mbcommon/executor.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file_util.h"
+#include "mbcommon/finally.h"
+#include "mbutil/atrace.h"
+#include "mbutil/string.h"
+
+namespace mb
+{
+
+// Sidecar file layout: magic, block size (le64), image size (le64), digests
+static constexpr char HASH_TREE_MAGIC[8] = { 'M', 'B', 'H', 'T', 1, 0, 0, 0 };
+static constexpr size_t HASH_TREE_HEADER_SIZE = sizeof(HASH_TREE_MAGIC) + 16;
+
+static size_t block_count(uint64_t size, size_t block_size)
+{
+    return static_cast<size_t>(size / block_size + (size % block_size != 0));
+}
+
+static void hash_block(std::string_view data, size_t block_size, size_t index,
+                       unsigned char *digest)
+{
+    auto block = data.substr(index * block_size, block_size);
+    SHA512(reinterpret_cast<const unsigned char *>(block.data()), block.size(),
+           digest);
+}
+
+static void write_header(unsigned char *buf, size_t block_size, uint64_t size)
+{
+    uint64_t block_size_le = mb_htole64(static_cast<uint64_t>(block_size));
+    uint64_t size_le = mb_htole64(size);
+
+    memcpy(buf, HASH_TREE_MAGIC, sizeof(HASH_TREE_MAGIC));
+    memcpy(buf + sizeof(HASH_TREE_MAGIC), &block_size_le, 8);
+    memcpy(buf + sizeof(HASH_TREE_MAGIC) + 8, &size_le, 8);
+}
+
+/*!
+ * \brief Hash the blocks of an image
+ *
+ * \param data Contents of image
+ * \param block_size Size of each block (except possibly the last)
+ *
+ * \return False if \p block_size is 0. Otherwise, true.
+ */
+bool HashTree::compute(std::string_view data, size_t block_size)
+{
+    util::ATraceSection section("hash_tree_compute");
+
+    if (block_size == 0) {
+        return false;
+    }
+
+    size_t count = block_count(data.size(), block_size);
+
+    _block_size = block_size;
+    _size = data.size();
+    _digests.resize(count * SHA512_DIGEST_LENGTH);
+
+    parallel_for(count, [&](size_t i) {
+        hash_block(data, block_size, i,
+                   _digests.data() + i * SHA512_DIGEST_LENGTH);
+    });
+
+    return true;
+}
+
+/*!
+ * \brief Find the first block of an image that does not match the tree
+ *
+ * The blocks are verified in parallel. Once a mismatch is found, blocks after
+ * it are no longer hashed.
+ *
+ * \param data Contents of image
+ *
+ * \return Index of the first mismatching block or std::nullopt if every block
+ *         matches. If the size of \p data differs, the index of the block
+ *         containing the end of the shorter size is returned.
+ */
+std::optional<size_t> HashTree::find_mismatch(std::string_view data) const
+{
+    util::ATraceSection section("hash_tree_verify");
+
+    if (data.size() != _size) {
+        return std::min<uint64_t>(data.size(), _size) / _block_size;
+    }
+
+    constexpr size_t none = std::numeric_limits<size_t>::max();
+    std::atomic_size_t first{none};
+
+    parallel_for(block_count(_size, _block_size), [&](size_t i) {
+        // Indexes are claimed in increasing order, so every later block can
+        // be skipped
+        if (i > first.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        unsigned char digest[SHA512_DIGEST_LENGTH];
+        hash_block(data, _block_size, i, digest);
+
+        if (memcmp(digest, _digests.data() + i * SHA512_DIGEST_LENGTH,
+                   sizeof(digest)) != 0) {
+            size_t cur = first.load(std::memory_order_relaxed);
+            while (i < cur && !first.compare_exchange_weak(cur, i)) {
+            }
+        }
+    });
+
+    if (size_t index = first.load(); index != none) {
+        return index;
+    }
+
+    return std::nullopt;
+}
+
+/*!
+ * \brief Checksum identifying the image
+ *
+ * \return "<block size>:<root SHA512 hex digest>"
+ */
+std::string HashTree::checksum() const
+{
+    std::vector<unsigned char> buf(HASH_TREE_HEADER_SIZE + _digests.size());
+    write_header(buf.data(), _block_size, _size);
+    std::copy(_digests.begin(), _digests.end(),
+              buf.begin() + HASH_TREE_HEADER_SIZE);
+
+    // The magic is not part of the root
+    unsigned char root[SHA512_DIGEST_LENGTH];
+    SHA512(buf.data() + sizeof(HASH_TREE_MAGIC),
+           buf.size() - sizeof(HASH_TREE_MAGIC), root);
+
+    std::string result = std::to_string(_block_size);
+    result += ':';
+    result += util::hex_string(root, sizeof(root));
+
+    return result;
+}
+
+/*!
+ * \brief Size of the blocks that are hashed individually
+ */
+size_t HashTree::block_size() const
+{
+    return _block_size;
+}
+
+/*!
+ * \brief Load block digests from a file
+ *
+ * \note The file is not trusted. The caller must compare checksum() against a
+ *       trusted checksum before using the tree.
+ *
+ * \param path Path to file written by save_file()
+ *
+ * \return True if the file was read and is well formed. Otherwise, false.
+ */
+bool HashTree::load_file(const std::string &path)
+{
+    FdFile file;
+    if (!file.open(path, FileOpenMode::ReadOnly)) {
+        return false;
+    }
+
+    unsigned char header[HASH_TREE_HEADER_SIZE];
+    if (!file_read_exact(file, header, sizeof(header))
+            || memcmp(header, HASH_TREE_MAGIC, sizeof(HASH_TREE_MAGIC)) != 0) {
+        return false;
+    }
+
+    uint64_t block_size;
+    uint64_t size;
+    memcpy(&block_size, header + sizeof(HASH_TREE_MAGIC), 8);
+    memcpy(&size, header + sizeof(HASH_TREE_MAGIC) + 8, 8);
+    block_size = mb_le64toh(block_size);
+    size = mb_le64toh(size);
+
+    if (block_size == 0 || block_size > std::numeric_limits<size_t>::max()
+            || size > std::numeric_limits<size_t>::max()) {
+        return false;
+    }
+
+    size_t count = block_count(size, static_cast<size_t>(block_size));
+
+    // The file must end right after the digests
+    auto file_size = file.seek(0, SEEK_END);
+    if (!file_size || file_size.value() < HASH_TREE_HEADER_SIZE
+            || (file_size.value() - HASH_TREE_HEADER_SIZE)
+                    / SHA512_DIGEST_LENGTH != count
+            || (file_size.value() - HASH_TREE_HEADER_SIZE)
+                    % SHA512_DIGEST_LENGTH != 0) {
+        return false;
+    }
+
+    std::vector<unsigned char> digests(count * SHA512_DIGEST_LENGTH);
+
+    if (!file.seek(HASH_TREE_HEADER_SIZE, SEEK_SET)
+            || !file_read_exact(file, digests.data(), digests.size())) {
+        return false;
+    }
+
+    _block_size = static_cast<size_t>(block_size);
+    _size = size;
+    _digests = std::move(digests);
+
+    return true;
+}
+
+/*!
+ * \brief Atomically write block digests to a file
+ *
+ * \param path Path to file
+ *
+ * \return True if the file was written. Otherwise, false.
+ */
+bool HashTree::save_file(const std::string &path) const
+{
+    std::string temp_path(path);
+    temp_path += ".XXXXXX";
+
+    int fd = mkostemp(temp_path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(temp_path.c_str());
+    });
+
+    if (fchmod(fd, 0600) < 0) {
+        return false;
+    }
+
+    unsigned char header[HASH_TREE_HEADER_SIZE];
+    write_header(header, _block_size, _size);
+
+    FdFile file;
+    if (!file.open(fd, false)
+            || !file_write_exact(file, header, sizeof(header))
+            || !file_write_exact(file, _digests.data(), _digests.size())) {
+        return false;
+    }
+
+    if (fsync(fd) < 0 || close(std::exchange(fd, -1)) < 0
+            || rename(temp_path.c_str(), path.c_str()) < 0) {
+        return false;
+    }
+
+    remove_temp.dismiss();
+
+    return true;
+}
+
+}
@@ -28,6 +28,7 @@
 #include "mbutil/chmod.h"
 #include "mbutil/chown.h"
 #include "mbutil/copy.h"
+#include "mbutil/delete.h"
 #include "mbutil/file.h"
 #include "mbutil/fts.h"
 #include "mbutil/selinux.h"
@@ -41,9 +42,12 @@ namespace mb
 
 class CopySystem : public util::FtsWrapper {
 public:
-    CopySystem(std::string path, std::string target)
+    CopySystem(std::string path, std::string target,
+               util::CopyFlags copy_flags)
         : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles),
-        _target(std::move(target))
+        _target(std::move(target)),
+        _copy_flags(copy_flags | util::CopyFlag::CopyAttributes
+                               | util::CopyFlag::CopyXattrs)
     {
     }
 
@@ -81,8 +85,8 @@ public:
         // _target is the correct parameter here (or pathbuf and
         // CopyFlag::ExcludeTopLevel flag)
         if (auto r = util::copy_dir(_curr->fts_accpath, _target,
-                                    util::CopyFlag::CopyAttributes
-                                  | util::CopyFlag::CopyXattrs); !r) {
+                                    _copy_flags
+                                  | util::CopyFlag::Parallel); !r) {
             _error_msg = format("Failed to copy directory: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -135,12 +139,12 @@ public:
 private:
     std::string _target;
     std::string _curtgtpath;
+    util::CopyFlags _copy_flags;
 
     bool copy_path()
     {
         if (auto r = util::copy_file(_curr->fts_accpath, _curtgtpath,
-                                     util::CopyFlag::CopyAttributes
-                                   | util::CopyFlag::CopyXattrs); !r) {
+                                     _copy_flags); !r) {
             _error_msg = format("Failed to copy file: %s",
                                 r.error().message().c_str());
             LOGW("%s", _error_msg.c_str());
@@ -158,10 +162,87 @@ private:
  */
 bool copy_system(const std::string &source, const std::string &target)
 {
-    CopySystem fts(source, target);
+    CopySystem fts(source, target, {});
     return fts.run();
 }
 
+/*!
+ * \brief Delete paths in a /system directory that aren't in another one
+ *
+ * Paths that exist in both directories, but with different file types, are
+ * deleted as well so they can be replaced.
+ */
+class RemoveExtraneous : public util::FtsWrapper {
+public:
+    RemoveExtraneous(std::string path, std::string source)
+        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles),
+        _source(std::move(source))
+    {
+    }
+
+    Actions on_changed_path() override
+    {
+        if (_curr->fts_level == 0) {
+            return Action::Ok;
+        }
+
+        // Multiboot files are never copied, so don't delete them either
+        if (_curr->fts_level == 1 && strcmp(_curr->fts_name, "multiboot") == 0) {
+            return Action::Skip;
+        }
+
+        // fts_path always begins with the path passed to fts_open()
+        _cursrcpath.clear();
+        _cursrcpath += _source;
+        _cursrcpath += _curr->fts_path + _path.size();
+
+        struct stat sb;
+        if (lstat(_cursrcpath.c_str(), &sb) == 0) {
+            if ((sb.st_mode & S_IFMT) == (_curr->fts_statp->st_mode & S_IFMT)) {
+                return Action::Ok;
+            }
+        } else if (errno != ENOENT) {
+            _error_msg = format("%s: Failed to stat: %s",
+                                _cursrcpath.c_str(), strerror(errno));
+            LOGW("%s", _error_msg.c_str());
+            return Action::Fail;
+        }
+
+        if (auto r = util::delete_recursive(_curr->fts_accpath); !r) {
+            _error_msg = format("%s: Failed to delete: %s",
+                                _curr->fts_path, r.error().message().c_str());
+            LOGW("%s", _error_msg.c_str());
+            return Action::Skip | Action::Fail;
+        }
+
+        return Action::Skip;
+    }
+
+private:
+    std::string _source;
+    std::string _cursrcpath;
+};
+
+/*!
+ * \brief Make a /system directory match another one, excluding multiboot files
+ *
+ * Unlike wiping \p target and calling copy_system(), files that already have
+ * the same contents are not rewritten.
+ *
+ * \param source Source directory
+ * \param target Target directory
+ */
+bool sync_system(const std::string &source, const std::string &target)
+{
+    RemoveExtraneous remove(target, source);
+    if (!remove.run()) {
+        return false;
+    }
+
+    CopySystem copy(source, target, util::CopyFlag::SkipUnchanged);
+    return copy.run();
+}
+
 /*!
  * \brief Fix permissions and label on /data/media/0/MultiBoot/
  *
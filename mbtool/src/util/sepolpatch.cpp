@@ -19,11 +19,15 @@
 
 #include "util/sepolpatch.h"
 
+#include <map>
 #include <memory>
+#include <tuple>
+#include <unordered_map>
 
 #include <climits>
 #include <cstdio>
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <sys/mman.h>
@@ -42,13 +46,23 @@
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
+#include "mbcommon/version.h"
 #include "mblog/logging.h"
+#include "mbutil/atrace.h"
+#include "mbutil/directory.h"
+#include "mbutil/file.h"
+#include "mbutil/hash.h"
 #include "mbutil/selinux.h"
+#include "mbutil/string.h"
 
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/util/sepolpatch"
 
+// Increment when the policy patches change so that previously cached policies
+// are no longer used
+#define SEPOLICY_PATCH_VERSION      1
+
 
 extern "C" int policydb_index_decls(sepol_handle_t *handle, policydb_t *p);
 
@@ -802,6 +816,198 @@ static void selinux_strip_no_audit(policydb_t *pdb)
 #endif
 }
 
+// Batched rule editing
+
+/*!
+ * \brief Batch of allow rules to add to the avtab
+ *
+ * Type and class names are resolved to their values only once per batch and
+ * the permissions for each (source, target, class) key are merged into a
+ * single bitmask. apply() then does one avtab lookup per key, in sorted key
+ * order, instead of one lookup per permission.
+ */
+class AllowRuleBatch
+{
+public:
+    explicit AllowRuleBatch(policydb_t *pdb);
+
+    bool add(const char *source_str, const char *target_str,
+             const char *class_str, const std::vector<std::string> &perms);
+    void add_raw(uint16_t source_type_val, uint16_t target_type_val,
+                 uint16_t class_val, uint32_t perms);
+    void grant_all_perms(uint16_t source_type_val, uint16_t target_type_val);
+
+    bool apply();
+
+private:
+    type_datum_t * type(const char *name);
+    class_datum_t * clazz(const char *name);
+
+    policydb_t *_pdb;
+
+    std::unordered_map<std::string, type_datum_t *> _types;
+    std::unordered_map<std::string, class_datum_t *> _classes;
+    // Bitmask of all permissions for each class (indexed by class value - 1)
+    std::vector<uint32_t> _class_perms;
+
+    std::map<std::tuple<uint16_t, uint16_t, uint16_t>, uint32_t> _rules;
+};
+
+AllowRuleBatch::AllowRuleBatch(policydb_t *pdb)
+    : _pdb(pdb)
+    , _class_perms(pdb->p_classes.nprim)
+{
+    for (uint32_t class_val = 1; class_val <= pdb->p_classes.nprim;
+            ++class_val) {
+        auto c = pdb->class_val_to_struct[class_val - 1];
+        if (!c) {
+            continue;
+        }
+
+        // Class-specific and common permissions
+        hashtab_t tables[] = { c->permissions.table, nullptr, nullptr };
+        if (c->comdatum) {
+            tables[1] = c->comdatum->permissions.table;
+        }
+
+        for (auto table = tables; *table; ++table) {
+            for (uint32_t bucket = 0; bucket < (*table)->size; ++bucket) {
+                for (hashtab_ptr_t cur = (*table)->htable[bucket]; cur;
+                        cur = cur->next) {
+                    auto perm = static_cast<perm_datum_t *>(cur->datum);
+                    _class_perms[class_val - 1] |= 1U << (perm->s.value - 1);
+                }
+            }
+        }
+    }
+}
+
+type_datum_t * AllowRuleBatch::type(const char *name)
+{
+    auto it = _types.find(name);
+    if (it == _types.end()) {
+        it = _types.emplace(name, find_type(_pdb, name)).first;
+    }
+    return it->second;
+}
+
+class_datum_t * AllowRuleBatch::clazz(const char *name)
+{
+    auto it = _classes.find(name);
+    if (it == _classes.end()) {
+        it = _classes.emplace(name, find_class(_pdb, name)).first;
+    }
+    return it->second;
+}
+
+/*!
+ * \brief Queue allow rules for a set of permissions
+ *
+ * \return False if the types, class, or any of the permissions do not exist
+ */
+bool AllowRuleBatch::add(const char *source_str, const char *target_str,
+                         const char *class_str,
+                         const std::vector<std::string> &perms)
+{
+    type_datum_t *source = type(source_str);
+    if (!source) {
+        LOGE("Source type %s does not exist", source_str);
+        return false;
+    }
+
+    type_datum_t *target = type(target_str);
+    if (!target) {
+        LOGE("Target type %s does not exist", target_str);
+        return false;
+    }
+
+    class_datum_t *c = clazz(class_str);
+    if (!c) {
+        LOGE("Class %s does not exist", class_str);
+        return false;
+    }
+
+    uint32_t mask = 0;
+
+    for (auto const &perm_str : perms) {
+        perm_datum_t *perm = find_perm(c, perm_str.c_str());
+        if (!perm) {
+            LOGE("Perm %s does not exist in class %s",
+                 perm_str.c_str(), class_str);
+            return false;
+        }
+
+        mask |= 1U << (perm->s.value - 1);
+    }
+
+    add_raw(static_cast<uint16_t>(source->s.value),
+            static_cast<uint16_t>(target->s.value),
+            static_cast<uint16_t>(c->s.value), mask);
+
+    return true;
+}
+
+/*!
+ * \brief Queue allow rules for a permission bitmask
+ */
+void AllowRuleBatch::add_raw(uint16_t source_type_val,
+                             uint16_t target_type_val,
+                             uint16_t class_val, uint32_t perms)
+{
+    if (perms != 0) {
+        _rules[{source_type_val, target_type_val, class_val}] |= perms;
+    }
+}
+
+/*!
+ * \brief Queue allow rules for every permission of every class
+ */
+void AllowRuleBatch::grant_all_perms(uint16_t source_type_val,
+                                     uint16_t target_type_val)
+{
+    for (size_t i = 0; i < _class_perms.size(); ++i) {
+        add_raw(source_type_val, target_type_val,
+                static_cast<uint16_t>(i + 1), _class_perms[i]);
+    }
+}
+
+/*!
+ * \brief Add all queued rules to the avtab
+ *
+ * \return Whether all rules were added. The batch is empty after this
+ *         function returns.
+ */
+bool AllowRuleBatch::apply()
+{
+    auto clear_rules = finally([&] {
+        _rules.clear();
+    });
+
+    for (auto const &[k, perms] : _rules) {
+        avtab_key_t key;
+        key.source_type = std::get<0>(k);
+        key.target_type = std::get<1>(k);
+        key.target_class = std::get<2>(k);
+        key.specified = AVTAB_ALLOWED;
+
+        avtab_datum_t *av = avtab_search(&_pdb->te_avtab, &key);
+
+        if (av) {
+            av->data |= perms;
+        } else {
+            avtab_datum_t av_new{};
+            av_new.data = perms;
+
+            if (avtab_insert(&_pdb->te_avtab, &key, &av_new) != 0) {
+                LOGE("Failed to add rule to avtab");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
 // Patching functions
 
 // Fail fast
@@ -810,19 +1016,13 @@ static void selinux_strip_no_audit(policydb_t *pdb)
         if (!(expr)) return false; \
     } while (0)
 
-static inline bool add_rules(policydb_t *pdb,
+static inline bool add_rules(AllowRuleBatch &rules,
                              const char *source,
                              const char *target,
                              const char *clazz,
                              const std::vector<std::string> &perms)
 {
-    for (auto const &perm : perms) {
-        if (!selinux_add_rule(pdb, source, target, clazz, perm.c_str())) {
-            return false;
-        }
-    }
-
-    return true;
+    return rules.add(source, target, clazz, perms);
 }
 
 [[maybe_unused]]
@@ -860,6 +1060,8 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
         return false;
     }
 
+    AllowRuleBatch rules(pdb);
+
     // For all attributes
     for (uint32_t type_val = 1; type_val <= pdb->p_types.nprim; ++type_val) {
         // Skip non-attributes
@@ -867,22 +1069,14 @@ static bool apply_pre_boot_patches(policydb_t *pdb)
             continue;
         }
 
-        auto ret = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(kernel->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
-            LOGE("Failed to grant all perms for: %s -> %s",
-                 "kernel", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
-        }
+        rules.grant_all_perms(static_cast<uint16_t>(kernel->s.value),
+                              static_cast<uint16_t>(type_val));
     }
 
     // Allow the real init to load the "secure" SELinux policy
-    ff(selinux_add_rule(pdb, "kernel", "kernel", "security", "load_policy"));
+    ff(add_rules(rules, "kernel", "kernel", "security", { "load_policy" }));
+
+    ff(rules.apply());
 
     return true;
 }
@@ -891,7 +1085,7 @@ static bool copy_avtab_rules(policydb_t *pdb,
                              const char *source_type,
                              const char *target_type)
 {
-    std::vector<std::pair<avtab_key_t, avtab_datum_t>> to_add;
+    AllowRuleBatch rules(pdb);
 
     type_datum_t *source, *target;
 
@@ -920,31 +1114,14 @@ static bool copy_avtab_rules(policydb_t *pdb,
             }
 
             if (cur->key.target_type == source->s.value) {
-                avtab_key_t copy = cur->key;
-                copy.target_type = static_cast<uint16_t>(target->s.value);
-
-                to_add.push_back(std::make_pair(std::move(copy), cur->datum));
+                rules.add_raw(cur->key.source_type,
+                              static_cast<uint16_t>(target->s.value),
+                              cur->key.target_class, cur->datum.data);
             }
         }
     }
 
-    avtab_datum_t *datum;
-    for (auto &pair : to_add) {
-        datum = avtab_search(&pdb->te_avtab, &pair.first);
-
-        if (!datum) {
-            // Create new avtab rule if the key doesn't exist
-            if (avtab_insert(&pdb->te_avtab, &pair.first, &pair.second) != 0) {
-                LOGE("Failed to add rule to avtab");
-                return false;
-            }
-        } else {
-            // Add additional perms if the key already exists
-            datum->data |= pair.second.data;
-        }
-    }
-
-    return true;
+    return rules.apply();
 }
 
 /*!
@@ -1006,22 +1183,24 @@ static bool create_mbtool_types(policydb_t *pdb)
     ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedobject"));
     ff(selinux_set_attribute(pdb, "mb_exec", "mlstrustedsubject"));
 
+    AllowRuleBatch rules(pdb);
+
     // Allow setting the current process context from init to mb_exec
-    ff(add_rules(pdb, "init", "mb_exec", "process", {
+    ff(add_rules(rules, "init", "mb_exec", "process", {
         "noatsecure", "rlimitinh", "setcurrent", "siginh", "transition",
         //"dyntransition",
     }));
 
     // Allow installd to connect to appsync's socket
-    ff(add_rules(pdb, "installd", "mb_exec", "unix_stream_socket", {
+    ff(add_rules(rules, "installd", "mb_exec", "unix_stream_socket", {
         "accept", "listen", "read", "write",
     }));
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "system_server", "mb_exec", "unix_stream_socket", {
+        ff(add_rules(rules, "system_server", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     } else {
-        ff(add_rules(pdb, "system", "mb_exec", "unix_stream_socket", {
+        ff(add_rules(rules, "system", "mb_exec", "unix_stream_socket", {
             "connectto",
         }));
     }
@@ -1034,43 +1213,43 @@ static bool create_mbtool_types(policydb_t *pdb)
         if (strcmp(name, "untrusted_app") == 0
                 || (starts_with(name, "untrusted_app_")
                         && str_to_num(name + 14, 10, dummy))) {
-            ff(add_rules(pdb, name, "mb_exec", "unix_stream_socket", {
+            ff(add_rules(rules, name, "mb_exec", "unix_stream_socket", {
                 "connectto",
             }));
         }
     }
 
     // Allow zygote to write to our stdout pipe when rebooting
-    ff(add_rules(pdb, "zygote", "init", "fifo_file", { "write" }));
+    ff(add_rules(rules, "zygote", "init", "fifo_file", { "write" }));
 
     // Allow 'am' to use fds (eg. pipes) inherited from the daemon
-    ff(add_rules(pdb, "system_server", "mb_exec", "fd", { "use" }));
-    ff(add_rules(pdb, "system_server", "mb_exec", "fifo_file", { "write" }));
+    ff(add_rules(rules, "system_server", "mb_exec", "fd", { "use" }));
+    ff(add_rules(rules, "system_server", "mb_exec", "fifo_file", { "write" }));
 
     // Allow rebooting via the android.intent.action.REBOOT intent
     if (find_type(pdb, "activity_service")) {
-        ff(add_rules(pdb, "zygote", "activity_service", "service_manager", { "find" }));
+        ff(add_rules(rules, "zygote", "activity_service", "service_manager", { "find" }));
     }
     if (find_type(pdb, "system_server")) {
-        ff(add_rules(pdb, "zygote", "system_server", "binder", { "call" }));
+        ff(add_rules(rules, "zygote", "system_server", "binder", { "call" }));
     }
 
-    ff(add_rules(pdb, "zygote", "init", "unix_stream_socket", { "read", "write" }));
-    ff(add_rules(pdb, "zygote", "servicemanager", "binder", { "call" }));
+    ff(add_rules(rules, "zygote", "init", "unix_stream_socket", { "read", "write" }));
+    ff(add_rules(rules, "zygote", "servicemanager", "binder", { "call" }));
 
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "binder", { "transfer" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "file", { "open", "read" }));
-    ff(add_rules(pdb, "servicemanager", "mb_exec", "process", { "getattr" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "dir", { "search" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "open" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "file", { "read" }));
-    ff(add_rules(pdb, "servicemanager", "zygote", "process", { "getattr" }));
+    ff(add_rules(rules, "servicemanager", "mb_exec", "binder", { "transfer" }));
+    ff(add_rules(rules, "servicemanager", "mb_exec", "dir", { "search" }));
+    ff(add_rules(rules, "servicemanager", "mb_exec", "file", { "open", "read" }));
+    ff(add_rules(rules, "servicemanager", "mb_exec", "process", { "getattr" }));
+    ff(add_rules(rules, "servicemanager", "zygote", "dir", { "search" }));
+    ff(add_rules(rules, "servicemanager", "zygote", "file", { "open" }));
+    ff(add_rules(rules, "servicemanager", "zygote", "file", { "read" }));
+    ff(add_rules(rules, "servicemanager", "zygote", "process", { "getattr" }));
 
     // For in-app flashing
-    ff(add_rules(pdb, "rootfs", "tmpfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs", "filesystem", { "associate" }));
-    ff(add_rules(pdb, "kernel", "mb_exec", "fd", { "use" }));
+    ff(add_rules(rules, "rootfs", "tmpfs", "filesystem", { "associate" }));
+    ff(add_rules(rules, "tmpfs",  "rootfs", "filesystem", { "associate" }));
+    ff(add_rules(rules, "kernel", "mb_exec", "fd", { "use" }));
 
     // Give mb_exec <insert diety here> permissions
     type_datum_t *mb_exec = find_type(pdb, "mb_exec");
@@ -1087,20 +1266,12 @@ static bool create_mbtool_types(policydb_t *pdb)
             continue;
         }
 
-        auto ret2 = selinux_raw_grant_all_perms(
-                pdb, static_cast<uint16_t>(mb_exec->s.value),
-                static_cast<uint16_t>(type_val));
-        switch (ret2) {
-        case SELinuxResult::Changed:
-        case SELinuxResult::Unchanged:
-            break;
-        case SELinuxResult::Error:
-            LOGE("Failed to grant all perms for: %s -> %s",
-                 "mb_exec", pdb->p_type_val_to_name[type_val - 1]);
-            return false;
-        }
+        rules.grant_all_perms(static_cast<uint16_t>(mb_exec->s.value),
+                              static_cast<uint16_t>(type_val));
     }
 
+    ff(rules.apply());
+
     return true;
 }
 
@@ -1114,20 +1285,24 @@ static bool apply_main_patches(policydb_t *pdb)
 
 static bool apply_cwm_recovery_patches(policydb_t *pdb)
 {
+    AllowRuleBatch rules(pdb);
+
     // Debugging rules (for CWM and Philz)
-    ff(add_rules(pdb, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "graphics_device", "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "input_device",    "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "dir",        { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "system_file",     "file",       { "relabelto" }));
-    ff(add_rules(pdb, "adbd",  "tmpfs",           "file",       { "relabelto" }));
-
-    ff(add_rules(pdb, "rootfs", "tmpfs",          "filesystem", { "associate" }));
-    ff(add_rules(pdb, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
+    ff(add_rules(rules, "adbd",  "block_device",    "blk_file",   { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "graphics_device", "chr_file",   { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "graphics_device", "dir",        { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "input_device",    "chr_file",   { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "input_device",    "dir",        { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "rootfs",          "dir",        { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "rootfs",          "file",       { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "rootfs",          "lnk_file",   { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "system_file",     "file",       { "relabelto" }));
+    ff(add_rules(rules, "adbd",  "tmpfs",           "file",       { "relabelto" }));
+
+    ff(add_rules(rules, "rootfs", "tmpfs",          "filesystem", { "associate" }));
+    ff(add_rules(rules, "tmpfs",  "rootfs",         "filesystem", { "associate" }));
+
+    ff(rules.apply());
 
     return true;
 }
@@ -1161,6 +1336,8 @@ bool patch_sepolicy(const std::string &source,
                     const std::string &target,
                     SELinuxPatch patch)
 {
+    util::ATraceSection section("patch_sepolicy");
+
     policydb_t pdb;
 
     if (policydb_init(&pdb) < 0) {
@@ -1192,6 +1369,152 @@ bool patch_sepolicy(const std::string &source,
     return true;
 }
 
+/*!
+ * \brief Get the cache file name prefix for a patch type
+ */
+static std::string sepolicy_cache_prefix(SELinuxPatch patch)
+{
+    return format("sepolicy.%d.", static_cast<int>(patch));
+}
+
+/*!
+ * \brief Get the cache file name for a source policy and patch type
+ *
+ * The name contains a hash of the source policy's digest, the patch type, the
+ * patch set version, and the mbtool version.
+ */
+static std::string sepolicy_cache_name(const util::Sha512Digest &digest,
+                                       SELinuxPatch patch)
+{
+    std::string key(reinterpret_cast<const char *>(digest.data()),
+                    digest.size());
+    key += format("|%d|%d|", static_cast<int>(patch), SEPOLICY_PATCH_VERSION);
+    key += git_version();
+
+    util::Sha512Digest key_digest;
+    SHA512(reinterpret_cast<const unsigned char *>(key.data()), key.size(),
+           key_digest.data());
+
+    return sepolicy_cache_prefix(patch)
+            + util::hex_string(key_digest.data(), key_digest.size());
+}
+
+/*!
+ * \brief Remove cached policies for a patch type, except for \p keep
+ */
+static void remove_stale_sepolicy_cache(const std::string &cache_dir,
+                                        SELinuxPatch patch,
+                                        const std::string &keep)
+{
+    std::unique_ptr<DIR, decltype(closedir) *> dp(
+            opendir(cache_dir.c_str()), closedir);
+    if (!dp) {
+        return;
+    }
+
+    auto prefix = sepolicy_cache_prefix(patch);
+    struct dirent *ent;
+
+    while ((ent = readdir(dp.get()))) {
+        if (starts_with(ent->d_name, prefix) && ent->d_name != keep) {
+            std::string path(cache_dir);
+            path += "/";
+            path += ent->d_name;
+
+            LOGV("%s: Removing stale cached policy", path.c_str());
+            unlink(path.c_str());
+        }
+    }
+}
+
+/*!
+ * \brief Patch SELinux policy and cache the patched policy
+ *
+ * If \p cache_dir contains a policy that was previously patched from the same
+ * source policy with the same patch type and version of mbtool, then it is
+ * written to \p target without parsing or patching the source policy.
+ * Otherwise, the source policy is patched as in patch_sepolicy() and the result
+ * is saved to \p cache_dir.
+ *
+ * \param source Source policy file
+ * \param target Target policy file (can be the selinuxfs load file)
+ * \param patch Patch type
+ * \param cache_dir Directory for storing patched policies
+ *
+ * \return Whether the patched policy was written to \p target
+ */
+bool patch_sepolicy_cached(const std::string &source,
+                           const std::string &target,
+                           SELinuxPatch patch,
+                           const std::string &cache_dir)
+{
+    auto digest = util::sha512_hash(source);
+    if (!digest) {
+        LOGW("%s: Failed to compute hash: %s",
+             source.c_str(), digest.error().message().c_str());
+        return patch_sepolicy(source, target, patch);
+    }
+
+    auto cache_name = sepolicy_cache_name(digest.value(), patch);
+    auto cache_path = cache_dir + "/" + cache_name;
+
+    if (auto data = util::file_read_all(cache_path)) {
+        if (util::selinux_write_policy_data(
+                target, data.value().data(), data.value().size())) {
+            LOGV("%s: Using cached patched policy", cache_path.c_str());
+            return true;
+        }
+
+        LOGW("%s: Failed to write cached policy", cache_path.c_str());
+        unlink(cache_path.c_str());
+    } else if (data.error() != std::errc::no_such_file_or_directory) {
+        LOGW("%s: Failed to read cached policy: %s",
+             cache_path.c_str(), data.error().message().c_str());
+    }
+
+    if (auto r = util::mkdir_recursive(cache_dir, 0700);
+            !r && r.error() != std::errc::file_exists) {
+        LOGW("%s: Failed to create directory: %s",
+             cache_dir.c_str(), r.error().message().c_str());
+        return patch_sepolicy(source, target, patch);
+    }
+
+    remove_stale_sepolicy_cache(cache_dir, patch, cache_name);
+
+    // Patch into a temporary file first so that an interrupted boot never
+    // leaves behind a truncated cache entry
+    auto temp_path = cache_path + ".tmp";
+
+    if (!patch_sepolicy(source, temp_path, patch)) {
+        unlink(temp_path.c_str());
+        LOGW("%s: Failed to cache patched policy", temp_path.c_str());
+        return patch_sepolicy(source, target, patch);
+    }
+
+    auto data = util::file_read_all(temp_path);
+    if (!data) {
+        LOGE("%s: Failed to read patched policy: %s",
+             temp_path.c_str(), data.error().message().c_str());
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (!util::selinux_write_policy_data(
+            target, data.value().data(), data.value().size())) {
+        LOGE("%s: Failed to write SELinux policy", target.c_str());
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), cache_path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s", temp_path.c_str(),
+             cache_path.c_str(), strerror(errno));
+        unlink(temp_path.c_str());
+    }
+
+    return true;
+}
+
 bool patch_loaded_sepolicy(SELinuxPatch patch)
 {
     ScopedFILE fp(fopen(util::SELINUX_ENFORCE_FILE, "rbe"), fclose);
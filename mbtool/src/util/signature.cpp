@@ -19,10 +19,18 @@
 
 #include "util/signature.h"
 
+#include <algorithm>
+#include <mutex>
+
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 
+#include <fcntl.h>
 #include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifdef __clang__
 #  pragma GCC diagnostic push
@@ -38,8 +46,11 @@
 #  pragma GCC diagnostic pop
 #endif
 
+#include "mbcommon/executor.h"
+#include "mbcommon/finally.h"
 #include "mblog/logging.h"
 #include "mbsign/sign.h"
+#include "mbutil/file.h"
 
 #include "util/validcerts.h"
 
@@ -106,49 +117,36 @@ static void openssl_log_errors()
     ERR_print_errors_cb(&log_callback, nullptr);
 }
 
-static SigVerifyResult verify_signature_with_key(const char *path,
-                                                 const char *sig_path,
-                                                 EVP_PKEY &public_key)
+namespace
 {
-    ScopedBIO bio_data_in(BIO_new_file(path, "rb"), BIO_free);
-    if (!bio_data_in) {
-        LOGE("%s: Failed to open input file", path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
-    }
 
-    ScopedBIO bio_sig_in(BIO_new_file(sig_path, "rb"), BIO_free);
-    if (!bio_sig_in) {
-        LOGE("%s: Failed to open signature file", sig_path);
-        openssl_log_errors();
-        return SigVerifyResult::Failure;
-    }
+struct TrustedKeys
+{
+    bool loaded = false;
+    std::vector<ScopedEVP_PKEY> keys;
+    std::vector<EVP_PKEY *> key_ptrs;
+};
 
-    auto ret = sign::verify_data(*bio_data_in, *bio_sig_in, public_key);
-    if (!ret) {
-        if (ret.error().ec == sign::Error::BadSignature) {
-            return SigVerifyResult::Invalid;
-        } else {
-            LOGE("%s: Failed to verify signature: %s", sig_path,
-                 ret.error().ec.message().c_str());
-            if (ret.error().has_openssl_error) {
-                openssl_log_errors();
-            }
-            return SigVerifyResult::Failure;
-        }
-    }
+struct VerifiedFile
+{
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    std::string signature;
+};
 
-    return SigVerifyResult::Valid;
 }
 
-SigVerifyResult verify_signature(const char *path, const char *sig_path)
+static void load_trusted_keys(TrustedKeys &tk)
 {
     for (const std::string &hex_der : valid_certs) {
         std::string der;
         if (!hex2bin(hex_der, der)) {
             LOGE("Failed to convert hex-encoded certificate to binary: %s",
                  hex_der.c_str());
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Cast to (void *) is okay since BIO_new_mem_buf() creates a read-only
@@ -159,7 +157,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             LOGE("Failed to create BIO for X509 certificate: %s",
                  hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Load DER-encoded certificate
@@ -167,7 +165,7 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
         if (!cert) {
             LOGE("Failed to load X509 certificate: %s", hex_der.c_str());
             openssl_log_errors();
-            return SigVerifyResult::Failure;
+            return;
         }
 
         // Get public key from certificate
@@ -176,20 +174,189 @@ SigVerifyResult verify_signature(const char *path, const char *sig_path)
             LOGE("Failed to load public key from X509 certificate: %s",
                  hex_der.c_str());
             openssl_log_errors();
+            return;
+        }
+
+        tk.key_ptrs.push_back(public_key.get());
+        tk.keys.push_back(std::move(public_key));
+    }
+
+    tk.loaded = true;
+}
+
+// The certificates are compiled in, so they only need to be parsed once
+static const TrustedKeys & trusted_keys()
+{
+    static TrustedKeys tk = [] {
+        TrustedKeys result;
+        load_trusted_keys(result);
+        return result;
+    }();
+
+    return tk;
+}
+
+static std::mutex g_verified_lock;
+static std::vector<VerifiedFile> g_verified;
+
+static inline bool timespec_equal(const struct timespec &a,
+                                  const struct timespec &b)
+{
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static VerifiedFile make_verified_file(const struct stat &sb,
+                                       std::string signature)
+{
+    return {
+        sb.st_dev,
+        sb.st_ino,
+        sb.st_size,
+        sb.st_mtim,
+        sb.st_ctim,
+        std::move(signature),
+    };
+}
+
+static bool is_verified(const VerifiedFile &vf)
+{
+    std::lock_guard<std::mutex> lock(g_verified_lock);
+
+    return std::any_of(g_verified.begin(), g_verified.end(),
+                       [&](const VerifiedFile &item) {
+        return item.dev == vf.dev
+                && item.ino == vf.ino
+                && item.size == vf.size
+                && timespec_equal(item.mtime, vf.mtime)
+                && timespec_equal(item.ctime, vf.ctime)
+                && item.signature == vf.signature;
+    });
+}
+
+static void add_verified(VerifiedFile vf)
+{
+    std::lock_guard<std::mutex> lock(g_verified_lock);
+
+    g_verified.push_back(std::move(vf));
+}
+
+static SigVerifyResult verify_signature_mapped(const TrustedKeys &tk,
+                                               const char *path,
+                                               const char *sig_path)
+{
+    auto signature = util::file_read_all(sig_path);
+    if (!signature) {
+        LOGE("%s: Failed to read signature file: %s", sig_path,
+             signature.error().message().c_str());
+        return SigVerifyResult::Failure;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open input file: %s", path, strerror(errno));
+        return SigVerifyResult::Failure;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat input file: %s", path, strerror(errno));
+        return SigVerifyResult::Failure;
+    }
+
+    auto vf = make_verified_file(sb, std::move(signature.value()));
+    if (is_verified(vf)) {
+        return SigVerifyResult::Valid;
+    }
+
+    auto size = static_cast<size_t>(sb.st_size);
+    void *data = nullptr;
+
+    // mmap() of an empty file fails, but an empty buffer is fine to hash
+    if (size > 0) {
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            LOGE("%s: Failed to mmap input file: %s", path, strerror(errno));
             return SigVerifyResult::Failure;
         }
+    }
 
-        SigVerifyResult result =
-                verify_signature_with_key(path, sig_path, *public_key);
-        if (result == SigVerifyResult::Invalid) {
-            // Keep trying ...
-            continue;
+    auto unmap_data = finally([&] {
+        if (data) {
+            munmap(data, size);
         }
+    });
 
-        return result;
+    auto ret = sign::verify_buffer_with_keys(
+            size > 0 ? data : "", size,
+            vf.signature.data(), vf.signature.size(),
+            tk.key_ptrs.data(), tk.key_ptrs.size());
+    if (!ret) {
+        if (ret.error().ec == sign::Error::BadSignature) {
+            return SigVerifyResult::Invalid;
+        } else {
+            LOGE("%s: Failed to verify signature: %s", sig_path,
+                 ret.error().ec.message().c_str());
+            if (ret.error().has_openssl_error) {
+                openssl_log_errors();
+            }
+            return SigVerifyResult::Failure;
+        }
+    }
+
+    add_verified(std::move(vf));
+
+    return SigVerifyResult::Valid;
+}
+
+/*!
+ * \brief Verify the signature of a file against the trusted certificates
+ *
+ * The data file is mapped and hashed once regardless of how many certificates
+ * are trusted. Files that were successfully verified are remembered for the
+ * lifetime of the process, keyed by device, inode, size, mtime, ctime, and the
+ * signature contents. Any modification to the file changes its ctime, so a
+ * cached result can't be reused for different data.
+ */
+SigVerifyResult verify_signature(const char *path, const char *sig_path)
+{
+    auto const &tk = trusted_keys();
+    if (!tk.loaded) {
+        return SigVerifyResult::Failure;
+    }
+
+    return verify_signature_mapped(tk, path, sig_path);
+}
+
+/*!
+ * \brief Verify the signatures of several files in parallel
+ *
+ * \param files List of (file path, signature path) pairs
+ *
+ * \return Result for each entry in \p files. Every entry is
+ *         SigVerifyResult::Failure unless it was explicitly verified, so a
+ *         worker that never reaches an entry can't cause it to pass.
+ */
+std::vector<SigVerifyResult>
+verify_signatures_batch(const std::vector<std::pair<std::string, std::string>> &files)
+{
+    std::vector<SigVerifyResult> results(files.size(),
+                                         SigVerifyResult::Failure);
+
+    auto const &tk = trusted_keys();
+    if (!tk.loaded || files.empty()) {
+        return results;
     }
 
-    return SigVerifyResult::Invalid;
+    parallel_for(files.size(), [&](size_t i) {
+        results[i] = verify_signature_mapped(
+                tk, files[i].first.c_str(), files[i].second.c_str());
+    });
+
+    return results;
 }
 
 static void sigverify_usage(FILE *stream)
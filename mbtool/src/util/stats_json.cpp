@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/stats_json.h"
+
+#include <memory>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/prettywriter.h>
+
+#include "mblog/logging.h"
+#include "mbutil/metrics.h"
+
+#define LOG_TAG "mbtool/util/stats_json"
+
+using namespace rapidjson;
+
+namespace mb
+{
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+/*!
+ * \brief Write the statistics of all finished metrics stages to a JSON file
+ *
+ * The file contains an array of objects, one per stage, in the order that the
+ * stages finished.
+ */
+bool write_stats_json(const std::string &path)
+{
+    ScopedFILE fp(fopen(path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[65536];
+    FileWriteStream os(fp.get(), buf, sizeof(buf));
+    PrettyWriter<FileWriteStream> writer(os);
+
+    writer.StartArray();
+
+    for (auto const &s : util::metrics_finished_stages()) {
+        writer.StartObject();
+        writer.Key("stage");
+        writer.String(s.name.c_str(), static_cast<SizeType>(s.name.size()));
+        writer.Key("seconds");
+        writer.Double(s.seconds);
+        writer.Key("files");
+        writer.Uint64(s.files);
+        writer.Key("bytes");
+        writer.Uint64(s.bytes);
+        writer.Key("bytes_read");
+        writer.Uint64(s.bytes_read);
+        writer.Key("read_seconds");
+        writer.Double(s.read_seconds);
+        writer.Key("bytes_written");
+        writer.Uint64(s.bytes_written);
+        writer.Key("write_seconds");
+        writer.Double(s.write_seconds);
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    os.Flush();
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+}
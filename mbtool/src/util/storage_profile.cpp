@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2018  Andrew Gunnerson <andrewgunnerson@gmail.com>
+ *
+ * This file is part of DualBootPatcher
+ *
+ * DualBootPatcher is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DualBootPatcher is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "util/storage_profile.h"
+
+#include <memory>
+#include <mutex>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <rapidjson/filereadstream.h>
+#include <rapidjson/filewritestream.h>
+#include <rapidjson/prettywriter.h>
+
+#include "mbcommon/string.h"
+#include "mblog/logging.h"
+#include "mbutil/directory.h"
+
+#include "util/roms.h"
+
+#define LOG_TAG "mbtool/util/storage_profile"
+
+#define KEY_VERSION                "version"
+#define KEY_TARGETS                "targets"
+#define KEY_PATH                   "path"
+#define KEY_BLOCK_SIZE             "block_size"
+#define KEY_QUEUE_DEPTH            "queue_depth"
+#define KEY_SEQ_READ_BPS           "seq_read_bps"
+#define KEY_SEQ_WRITE_BPS          "seq_write_bps"
+#define KEY_RAND_READ_IOPS         "rand_read_iops"
+#define KEY_RAND_WRITE_IOPS        "rand_write_iops"
+#define KEY_FSYNC_LATENCY_US       "fsync_latency_us"
+#define KEY_BLOCKS                 "blocks"
+#define KEY_READ_BPS               "read_bps"
+#define KEY_WRITE_BPS              "write_bps"
+
+#define PROFILE_VERSION            1
+
+using namespace rapidjson;
+
+namespace mb
+{
+
+using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
+
+/*
+ * Example JSON structure:
+ *
+ * {
+ *     "version": 1,
+ *     "targets": [
+ *         {
+ *             "path": "/data",
+ *             "block_size": 262144,
+ *             "queue_depth": 4,
+ *             "seq_read_bps": 251658240.0,
+ *             "seq_write_bps": 125829120.0,
+ *             "rand_read_iops": 8000.0,
+ *             "rand_write_iops": 3000.0,
+ *             "fsync_latency_us": 1500.0,
+ *             "blocks": [
+ *                 {
+ *                     "block_size": 4096,
+ *                     "read_bps": 41943040.0,
+ *                     "write_bps": 20971520.0
+ *                 }
+ *             ]
+ *         }
+ *     ]
+ * }
+ */
+
+static inline std::string get_string(const Value &node)
+{
+    return {node.GetString(), node.GetStringLength()};
+}
+
+static bool load_block(StorageBlockResult &block, const Value &node,
+                       const std::string &context)
+{
+    if (!node.IsObject()) {
+        LOGE("%s: Not an object", context.c_str());
+        return false;
+    }
+
+    block = {};
+
+    for (auto const &item : node.GetObject()) {
+        auto const &key = get_string(item.name);
+
+        if (key == KEY_BLOCK_SIZE) {
+            if (!item.value.IsUint64()) {
+                LOGE("%s.%s: Not an integer", context.c_str(), key.c_str());
+                return false;
+            }
+            block.block_size = static_cast<size_t>(item.value.GetUint64());
+        } else if (key == KEY_READ_BPS || key == KEY_WRITE_BPS) {
+            if (!item.value.IsNumber()) {
+                LOGE("%s.%s: Not a number", context.c_str(), key.c_str());
+                return false;
+            }
+            (key == KEY_READ_BPS ? block.read_bps : block.write_bps) =
+                    item.value.GetDouble();
+        } else {
+            LOGW("%s.%s: Skipping unknown key", context.c_str(), key.c_str());
+        }
+    }
+
+    return true;
+}
+
+static bool load_target(StorageTarget &target, const Value &node,
+                        const std::string &context)
+{
+    if (!node.IsObject()) {
+        LOGE("%s: Not an object", context.c_str());
+        return false;
+    }
+
+    for (auto const &item : node.GetObject()) {
+        auto const &key = get_string(item.name);
+        double *number = nullptr;
+
+        if (key == KEY_PATH) {
+            if (!item.value.IsString()) {
+                LOGE("%s.%s: Not a string", context.c_str(), key.c_str());
+                return false;
+            }
+            target.path = get_string(item.value);
+            continue;
+        } else if (key == KEY_BLOCK_SIZE || key == KEY_QUEUE_DEPTH) {
+            if (!item.value.IsUint()) {
+                LOGE("%s.%s: Not an integer", context.c_str(), key.c_str());
+                return false;
+            }
+            if (key == KEY_BLOCK_SIZE) {
+                target.block_size = item.value.GetUint();
+            } else {
+                target.queue_depth = item.value.GetUint();
+            }
+            continue;
+        } else if (key == KEY_BLOCKS) {
+            if (!item.value.IsArray()) {
+                LOGE("%s.%s: Not an array", context.c_str(), key.c_str());
+                return false;
+            }
+
+            size_t i = 0;
+            for (auto const &block_node : item.value.GetArray()) {
+                StorageBlockResult block;
+                if (!load_block(block, block_node, format(
+                        "%s.%s[%zu]", context.c_str(), key.c_str(), i))) {
+                    return false;
+                }
+                target.blocks.push_back(block);
+                ++i;
+            }
+            continue;
+        } else if (key == KEY_SEQ_READ_BPS) {
+            number = &target.seq_read_bps;
+        } else if (key == KEY_SEQ_WRITE_BPS) {
+            number = &target.seq_write_bps;
+        } else if (key == KEY_RAND_READ_IOPS) {
+            number = &target.rand_read_iops;
+        } else if (key == KEY_RAND_WRITE_IOPS) {
+            number = &target.rand_write_iops;
+        } else if (key == KEY_FSYNC_LATENCY_US) {
+            number = &target.fsync_latency_us;
+        } else {
+            LOGW("%s.%s: Skipping unknown key", context.c_str(), key.c_str());
+            continue;
+        }
+
+        if (!item.value.IsNumber()) {
+            LOGE("%s.%s: Not a number", context.c_str(), key.c_str());
+            return false;
+        }
+        *number = item.value.GetDouble();
+    }
+
+    if (target.path.empty()) {
+        LOGE("%s: Missing %s", context.c_str(), KEY_PATH);
+        return false;
+    }
+
+    return true;
+}
+
+static bool load_root(StorageProfile &profile, const Value &node)
+{
+    static constexpr char context[] = ".";
+
+    if (!node.IsObject()) {
+        LOGE("%s: Not an object", context);
+        return false;
+    }
+
+    for (auto const &item : node.GetObject()) {
+        auto const &key = get_string(item.name);
+
+        if (key == KEY_VERSION) {
+            if (!item.value.IsUint() || item.value.GetUint() != PROFILE_VERSION) {
+                LOGE("%s%s: Unsupported version", context, key.c_str());
+                return false;
+            }
+        } else if (key == KEY_TARGETS) {
+            if (!item.value.IsArray()) {
+                LOGE("%s%s: Not an array", context, key.c_str());
+                return false;
+            }
+
+            size_t i = 0;
+            for (auto const &target_node : item.value.GetArray()) {
+                StorageTarget target;
+                if (!load_target(target, target_node,
+                                 format(".%s[%zu]", key.c_str(), i))) {
+                    return false;
+                }
+                profile.targets.push_back(std::move(target));
+                ++i;
+            }
+        } else {
+            LOGW("%s%s: Skipping unknown key", context, key.c_str());
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Load storage profile written by `mbtool bench`
+ *
+ * \return Whether the profile was successfully loaded
+ */
+bool StorageProfile::load_file(const std::string &path)
+{
+    ScopedFILE fp(fopen(path.c_str(), "re"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for reading: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[65536];
+    FileReadStream is(fp.get(), buf, sizeof(buf));
+    Document d;
+
+    if (d.ParseStream(is).HasParseError()) {
+        LOGE("%s: Error at offset %zu: %s", path.c_str(), d.GetErrorOffset(),
+             GetParseError_En(d.GetParseError()));
+        return false;
+    }
+
+    targets.clear();
+
+    return load_root(*this, d);
+}
+
+/*!
+ * \brief Save storage profile
+ *
+ * The profile is written to a temporary file that replaces \p path once it is
+ * complete, so readers never see a partial profile.
+ *
+ * \return Whether the profile was successfully saved
+ */
+bool StorageProfile::save_file(const std::string &path) const
+{
+    if (auto r = util::mkdir_parent(path, 0755);
+            !r && r.error() != std::errc::file_exists) {
+        LOGE("%s: Failed to create parent directory: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    std::string temp_path = path + ".tmp";
+
+    ScopedFILE fp(fopen(temp_path.c_str(), "we"), &fclose);
+    if (!fp) {
+        LOGE("%s: Failed to open for writing: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    char buf[65536];
+    FileWriteStream os(fp.get(), buf, sizeof(buf));
+    PrettyWriter<FileWriteStream> writer(os);
+
+    writer.StartObject();
+    writer.Key(KEY_VERSION);
+    writer.Uint(PROFILE_VERSION);
+    writer.Key(KEY_TARGETS);
+    writer.StartArray();
+
+    for (auto const &t : targets) {
+        writer.StartObject();
+        writer.Key(KEY_PATH);
+        writer.String(t.path.c_str(), static_cast<SizeType>(t.path.size()));
+        writer.Key(KEY_BLOCK_SIZE);
+        writer.Uint64(t.block_size);
+        writer.Key(KEY_QUEUE_DEPTH);
+        writer.Uint(t.queue_depth);
+        writer.Key(KEY_SEQ_READ_BPS);
+        writer.Double(t.seq_read_bps);
+        writer.Key(KEY_SEQ_WRITE_BPS);
+        writer.Double(t.seq_write_bps);
+        writer.Key(KEY_RAND_READ_IOPS);
+        writer.Double(t.rand_read_iops);
+        writer.Key(KEY_RAND_WRITE_IOPS);
+        writer.Double(t.rand_write_iops);
+        writer.Key(KEY_FSYNC_LATENCY_US);
+        writer.Double(t.fsync_latency_us);
+        writer.Key(KEY_BLOCKS);
+        writer.StartArray();
+        for (auto const &b : t.blocks) {
+            writer.StartObject();
+            writer.Key(KEY_BLOCK_SIZE);
+            writer.Uint64(b.block_size);
+            writer.Key(KEY_READ_BPS);
+            writer.Double(b.read_bps);
+            writer.Key(KEY_WRITE_BPS);
+            writer.Double(b.write_bps);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    os.Flush();
+
+    if (fflush(fp.get()) != 0 || fsync(fileno(fp.get())) < 0) {
+        LOGE("%s: Failed to flush file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (fclose(fp.release()) != 0) {
+        LOGE("%s: Failed to close file: %s",
+             temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGE("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Find the target that \p path is stored on
+ *
+ * A target matches if \p path is its mount point or is below it, either by its
+ * name (eg. "/data") or by its raw path (eg. "/raw/data"). If several targets
+ * match, the one with the longest mount point wins. Block devices are assumed
+ * to be on the same flash chip as "/data".
+ *
+ * \return Target or nullptr if no target matches
+ */
+const StorageTarget * StorageProfile::find(const std::string &path) const
+{
+    if (starts_with(path, "/dev/block/")) {
+        return find("/data");
+    }
+
+    const StorageTarget *result = nullptr;
+    size_t result_len = 0;
+
+    for (auto const &t : targets) {
+        for (auto const &mount_point : { t.path, get_raw_path(t.path) }) {
+            if (mount_point.size() <= result_len
+                    || !starts_with(path, mount_point)
+                    || (path.size() > mount_point.size()
+                            && path[mount_point.size()] != '/'
+                            && mount_point != "/")) {
+                continue;
+            }
+
+            result = &t;
+            result_len = mount_point.size();
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * \brief Add target or replace the existing target with the same path
+ */
+void StorageProfile::set(StorageTarget target)
+{
+    for (auto &t : targets) {
+        if (t.path == target.path) {
+            t = std::move(target);
+            return;
+        }
+    }
+
+    targets.push_back(std::move(target));
+}
+
+static const StorageProfile & system_profile()
+{
+    static StorageProfile profile;
+    static std::once_flag once;
+
+    std::call_once(once, [] {
+        std::string path = get_raw_path(STORAGE_PROFILE_PATH);
+
+        struct stat sb;
+        if (stat(path.c_str(), &sb) < 0) {
+            // `mbtool bench` has not been run yet
+            return;
+        }
+
+        if (!profile.load_file(path)) {
+            LOGW("%s: Ignoring invalid storage profile", path.c_str());
+            profile.targets.clear();
+        }
+    });
+
+    return profile;
+}
+
+/*!
+ * \brief Get the preferred I/O block size for \p path
+ *
+ * \param path Path to a file or directory
+ * \param fallback Block size to use if there is no profile for \p path
+ *
+ * \return Block size from `/data/multiboot/storage_profile.json` or \p fallback
+ */
+size_t storage_block_size(const std::string &path, size_t fallback)
+{
+    auto target = system_profile().find(path);
+    return target && target->block_size != 0 ? target->block_size : fallback;
+}
+
+/*!
+ * \brief Get the preferred number of concurrent I/O operations for \p path
+ *
+ * \param path Path to a file or directory
+ * \param fallback Queue depth to use if there is no profile for \p path
+ *
+ * \return Queue depth from `/data/multiboot/storage_profile.json` or
+ *         \p fallback
+ */
+unsigned int storage_queue_depth(const std::string &path,
+                                 unsigned int fallback)
+{
+    auto target = system_profile().find(path);
+    return target && target->queue_depth != 0 ? target->queue_depth : fallback;
+}
+
+}
@@ -19,40 +19,117 @@
 
 #include "util/switcher.h"
 
-#include <array>
+#include <algorithm>
+#include <utility>
+#include <vector>
 
 #include <cerrno>
+#include <cinttypes>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
-#include <openssl/sha.h>
-
+#include "mbcommon/file/compare_write.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/hashing.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
+#include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
+#include "mbutil/atrace.h"
 #include "mbutil/chmod.h"
-#include "mbutil/chown.h"
 #include "mbutil/copy.h"
 #include "mbutil/directory.h"
-#include "mbutil/file.h"
 #include "mbutil/path.h"
 #include "mbutil/properties.h"
 #include "mbutil/string.h"
 
+#include "util/hash_tree.h"
 #include "util/multiboot.h"
 #include "util/roms.h"
+#include "util/storage_profile.h"
 
 #define LOG_TAG "mbtool/util/switcher"
 
 #define CHECKSUMS_PATH "/data/multiboot/checksums.prop"
+#define HASH_CACHE_PATH "/data/multiboot/hash_cache.prop"
+
+#define ALGO_SHA512 "sha512"
+#define ALGO_SHA512_TREE "sha512tree"
+
+// Block digests of an image with a ChecksumType::Sha512Tree checksum are
+// stored next to the image with this suffix
+#define HASH_TREE_SUFFIX ".sha512tree"
 
 namespace mb
 {
 
+// The checksums file is a log of properties in which later definitions of a
+// key override earlier ones. Updates are appended and the file is only
+// rewritten when the superseded records outnumber the live ones.
+constexpr size_t CHECKSUMS_COMPACT_SLACK = 32;
+
+/*!
+ * \brief Remove an incomplete record from the end of a log of properties
+ *
+ * If an append was interrupted, the file does not end with a newline. It is
+ * truncated to the end of the last complete line.
+ *
+ * \return True if the file is intact or was repaired. Otherwise, false.
+ */
+static bool truncate_torn_record(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return errno == ENOENT;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    struct stat sb;
+    if (fstat(fd, &sb) < 0) {
+        return false;
+    }
+
+    char buf[4096];
+    auto end = static_cast<uint64_t>(sb.st_size);
+
+    while (end > 0) {
+        auto offset = end > sizeof(buf) ? end - sizeof(buf) : 0;
+        auto size = static_cast<size_t>(end - offset);
+
+        if (pread64(fd, buf, size, static_cast<off64_t>(offset))
+                != static_cast<ssize_t>(size)) {
+            return false;
+        }
+
+        if (auto *nl = static_cast<char *>(memrchr(buf, '\n', size))) {
+            end = offset + static_cast<uint64_t>(nl - buf) + 1;
+            break;
+        }
+
+        end = offset;
+    }
+
+    if (end == static_cast<uint64_t>(sb.st_size)) {
+        return true;
+    }
+
+    LOGW("%s: Discarding incomplete record at offset %" PRIu64,
+         path.c_str(), end);
+
+    return ftruncate64(fd, static_cast<off64_t>(end)) == 0 && fsync(fd) == 0;
+}
+
 /*!
  * \brief Read checksums properties from \a /data/multiboot/checksums.prop
  *
@@ -62,8 +139,24 @@ bool ChecksumProps::load_file()
 {
     std::string checksums_path = get_raw_path(CHECKSUMS_PATH);
 
-    if (auto p = util::property_file_get_all(checksums_path)) {
-        p->swap(m_props);
+    if (!truncate_torn_record(checksums_path)) {
+        LOGW("%s: Failed to check for incomplete record: %s",
+             checksums_path.c_str(), strerror(errno));
+    }
+
+    std::unordered_map<std::string, std::string> props;
+    size_t records = 0;
+
+    if (util::property_file_iter(checksums_path, {},
+            [&](std::string_view key, std::string_view value) {
+        props.insert_or_assign(std::string(key), std::string(value));
+        ++records;
+        return util::PropertyIterAction::Continue;
+    })) {
+        m_props.swap(props);
+        m_dirty.clear();
+        m_records = records;
+        m_loaded = true;
         return true;
     } else {
         LOGE("%s: Failed to load properties", checksums_path.c_str());
@@ -71,38 +164,181 @@ bool ChecksumProps::load_file()
     }
 }
 
+/*!
+ * \brief Atomically write a properties file that is only accessible by root
+ *
+ * The properties are written to a temporary file, which is synced and then
+ * renamed over \p path. If this is interrupted, \p path keeps its old
+ * contents.
+ *
+ * \param path Path to properties file
+ * \param props Properties to write
+ *
+ * \return True if successfully written. Otherwise, false.
+ */
+static bool write_root_props(const std::string &path,
+                             const std::unordered_map<std::string,
+                                                      std::string> &props)
+{
+    std::string data;
+    for (auto const &[key, value] : props) {
+        data += key;
+        data += '=';
+        data += value;
+        data += '\n';
+    }
+
+    (void) util::mkdir_parent(path, 0755);
+
+    std::string temp_path(path);
+    temp_path += ".XXXXXX";
+
+    int fd = mkostemp(temp_path.data(), O_CLOEXEC);
+    if (fd < 0) {
+        LOGW("%s: Failed to create temporary file: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto remove_temp = finally([&] {
+        if (fd >= 0) {
+            close(fd);
+        }
+        unlink(temp_path.c_str());
+    });
+
+    if (fchown(fd, 0, 0) < 0) {
+        LOGW("%s: Failed to chown file: %s", temp_path.c_str(), strerror(errno));
+    }
+    if (fchmod(fd, 0700) < 0) {
+        LOGW("%s: Failed to chmod file: %s", temp_path.c_str(), strerror(errno));
+    }
+
+    FdFile file;
+
+    if (auto r = file.open(fd, false); !r) {
+        LOGW("%s: Failed to open file: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = file_write_exact(file, data.data(), data.size()); !r) {
+        LOGW("%s: Failed to write new properties: %s",
+             temp_path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (fsync(fd) < 0 || close(std::exchange(fd, -1)) < 0) {
+        LOGW("%s: Failed to flush file: %s", temp_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (rename(temp_path.c_str(), path.c_str()) < 0) {
+        LOGW("%s: Failed to rename to %s: %s",
+             temp_path.c_str(), path.c_str(), strerror(errno));
+        return false;
+    }
+
+    remove_temp.dismiss();
+
+    // Make the rename itself durable
+    int dir_fd = open(util::dir_name(path).c_str(),
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Append properties to a log of properties with a single write
+ *
+ * \param path Path to properties file
+ * \param data Records to append. Each one must end with a newline.
+ *
+ * \return True if successfully written. Otherwise, false.
+ */
+static bool append_root_props(const std::string &path, const std::string &data)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        LOGW("%s: Failed to open for appending: %s",
+             path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    FdFile file;
+
+    if (auto r = file.open(fd, false); !r) {
+        LOGW("%s: Failed to open file: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = file_write_exact(file, data.data(), data.size()); !r) {
+        LOGW("%s: Failed to append properties: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (fsync(fd) < 0) {
+        LOGW("%s: Failed to flush file: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
 /*!
  * \brief Write checksums properties to \a /data/multiboot/checksums.prop
  *
+ * Properties that were changed since the file was loaded are appended to it.
+ * The file is rewritten instead if it was not loaded or if it has accumulated
+ * too many superseded records.
+ *
  * \return True if successfully written. Otherwise, false.
  */
 bool ChecksumProps::save_file()
 {
     std::string checksums_path = get_raw_path(CHECKSUMS_PATH);
 
-    if (remove(checksums_path.c_str()) < 0 && errno != ENOENT) {
-        LOGW("%s: Failed to remove file: %s",
-             checksums_path.c_str(), strerror(errno));
+    if (m_loaded && m_dirty.empty()) {
+        return true;
     }
 
-    (void) util::mkdir_parent(checksums_path, 0755);
-    (void) util::create_empty_file(checksums_path);
+    if (m_loaded && m_records + m_dirty.size()
+            <= 2 * m_props.size() + CHECKSUMS_COMPACT_SLACK) {
+        std::string data;
+        for (auto const &key : m_dirty) {
+            data += key;
+            data += '=';
+            data += m_props[key];
+            data += '\n';
+        }
 
-    if (auto r = util::chown(checksums_path, 0, 0, 0); !r) {
-        LOGW("%s: Failed to chown file: %s",
-             checksums_path.c_str(), r.error().message().c_str());
-    }
-    if (chmod(checksums_path.c_str(), 0700) < 0) {
-        LOGW("%s: Failed to chmod file: %s",
-             checksums_path.c_str(), strerror(errno));
+        if (append_root_props(checksums_path, data)) {
+            m_records += m_dirty.size();
+            m_dirty.clear();
+            return true;
+        }
+
+        // Fall back to rewriting the file
     }
 
-    if (!util::property_file_write_all(checksums_path, m_props)) {
-        LOGW("%s: Failed to write new properties: %s",
-             checksums_path.c_str(), strerror(errno));
+    if (!write_root_props(checksums_path, m_props)) {
         return false;
     }
 
+    m_dirty.clear();
+    m_records = m_props.size();
+    m_loaded = true;
+
     return true;
 }
 
@@ -111,7 +347,8 @@ bool ChecksumProps::save_file()
  *
  * \param[in] rom_id ROM ID
  * \param[in] image Image filename (without directory)
- * \param[out] sha512_out SHA512 hex digest output
+ * \param[out] hash_out SHA512 hex digest or HashTree::checksum() output
+ * \param[out] type_out Type of \p hash_out
  *
  * \return ChecksumsGetResult::Found if the hash was successfully retrieved,
  *         ChecksumsGetResult::NotFound if the hash does not exist in the map,
@@ -119,7 +356,8 @@ bool ChecksumProps::save_file()
  */
 ChecksumsGetResult ChecksumProps::get(const std::string &rom_id,
                                       const std::string &image,
-                                      std::string &sha512_out)
+                                      std::string &hash_out,
+                                      ChecksumType &type_out)
 {
     std::string checksums_path = get_raw_path(CHECKSUMS_PATH);
 
@@ -137,13 +375,17 @@ ChecksumsGetResult ChecksumProps::get(const std::string &rom_id,
     if (auto pos = value.find(":"); pos != std::string::npos) {
         std::string algo = value.substr(0, pos);
         std::string hash = value.substr(pos + 1);
-        if (algo != "sha512") {
+        if (algo == ALGO_SHA512) {
+            type_out = ChecksumType::Sha512;
+        } else if (algo == ALGO_SHA512_TREE) {
+            type_out = ChecksumType::Sha512Tree;
+        } else {
             LOGE("%s: Invalid hash algorithm: %s",
                  checksums_path.c_str(), algo.c_str());
             return ChecksumsGetResult::Malformed;
         }
 
-        sha512_out = hash;
+        hash_out = hash;
         return ChecksumsGetResult::Found;
     } else {
         LOGE("%s: Invalid checksum property: %s=%s",
@@ -157,17 +399,137 @@ ChecksumsGetResult ChecksumProps::get(const std::string &rom_id,
  *
  * \param rom_id ROM ID
  * \param image Image filename (without directory)
- * \param sha512 SHA512 hex digest
+ * \param hash SHA512 hex digest or HashTree::checksum() output
+ * \param type Type of \p hash
  */
 void ChecksumProps::set(const std::string &rom_id, const std::string &image,
-                        const std::string &sha512)
+                        const std::string &hash, ChecksumType type)
 {
     std::string key(rom_id);
     key += "/";
     key += image;
 
-    m_props[key] = "sha512:";
-    m_props[key] += sha512;
+    std::string value(type == ChecksumType::Sha512Tree
+            ? ALGO_SHA512_TREE ":" : ALGO_SHA512 ":");
+    value += hash;
+
+    if (auto &old_value = m_props[key]; old_value != value) {
+        old_value = std::move(value);
+        m_dirty.insert(std::move(key));
+    }
+}
+
+/*!
+ * \brief Cache of image hashes
+ *
+ * Each entry maps an image path to its SHA512 digest along with the device,
+ * inode, size, mtime, and ctime of the file at the time it was hashed. An
+ * entry is only used if all of these still match.
+ */
+class HashCache
+{
+public:
+    void load_file();
+    bool save_file();
+
+    bool get(const std::string &path, const struct stat &sb,
+             std::string &sha512_out) const;
+    void set(const std::string &path, const struct stat &sb,
+             const std::string &sha512);
+
+private:
+    std::unordered_map<std::string, std::string> m_props;
+};
+
+static int64_t timespec_to_ns(const struct timespec &ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static std::string hash_cache_stat_key(const struct stat &sb)
+{
+    return format("%ju:%ju:%jd:%" PRId64 ":%" PRId64,
+                  static_cast<uintmax_t>(sb.st_dev),
+                  static_cast<uintmax_t>(sb.st_ino),
+                  static_cast<intmax_t>(sb.st_size),
+                  timespec_to_ns(sb.st_mtim),
+                  timespec_to_ns(sb.st_ctim));
+}
+
+/*!
+ * \brief Read hash cache from \a /data/multiboot/hash_cache.prop
+ */
+void HashCache::load_file()
+{
+    if (auto p = util::property_file_get_all(get_raw_path(HASH_CACHE_PATH))) {
+        p->swap(m_props);
+    }
+}
+
+/*!
+ * \brief Write hash cache to \a /data/multiboot/hash_cache.prop
+ *
+ * \return True if successfully written. Otherwise, false.
+ */
+bool HashCache::save_file()
+{
+    return write_root_props(get_raw_path(HASH_CACHE_PATH), m_props);
+}
+
+/*!
+ * \brief Get the cached hash of a file
+ *
+ * \note Files that were changed less than a second before \p sb was obtained
+ *       are never considered cached. The kernel's timestamp granularity may be
+ *       coarse enough that a write immediately afterwards would not change the
+ *       ctime.
+ *
+ * \param[in] path Path to file
+ * \param[in] sb Current stat information of the file
+ * \param[out] sha512_out SHA512 hex digest output
+ *
+ * \return Whether the cached hash is valid for the file
+ */
+bool HashCache::get(const std::string &path, const struct stat &sb,
+                    std::string &sha512_out) const
+{
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) < 0
+            || timespec_to_ns(now) - timespec_to_ns(sb.st_ctim)
+                    < 1000000000) {
+        return false;
+    }
+
+    auto it = m_props.find(path);
+    if (it == m_props.end()) {
+        return false;
+    }
+
+    std::string prefix = hash_cache_stat_key(sb);
+    prefix += ':';
+
+    if (!starts_with(it->second, prefix)) {
+        return false;
+    }
+
+    sha512_out = it->second.substr(prefix.size());
+    return true;
+}
+
+/*!
+ * \brief Update the cached hash of a file
+ *
+ * \param path Path to file
+ * \param sb Stat information of the file when it was hashed
+ * \param sha512 SHA512 hex digest
+ */
+void HashCache::set(const std::string &path, const struct stat &sb,
+                    const std::string &sha512)
+{
+    auto &value = m_props[path];
+    value = hash_cache_stat_key(sb);
+    value += ':';
+    value += sha512;
 }
 
 struct Flashable
@@ -175,10 +537,369 @@ struct Flashable
     std::string image;
     std::string block_dev;
     std::string expected_hash;
+    ChecksumType type = ChecksumType::Sha512;
     std::string hash;
     std::string data;
+    struct stat sb;
 };
 
+// Images are read, compared, and written in blocks of this size
+constexpr size_t IMAGE_BLOCK_SIZE = 1024 * 1024;
+
+static std::string sha512_hex(HashingFile &file)
+{
+    auto digest = file.digest(HashAlgorithm::Sha512);
+    return digest ? util::hex_string(digest.value().data(),
+                                     digest.value().size())
+                  : std::string();
+}
+
+/*!
+ * \brief Read an image into memory
+ *
+ * Unless \p hash_cache has a valid entry for the image, a
+ * ChecksumType::Sha512 checksum is computed while the image is being read. A
+ * ChecksumType::Sha512Tree checksum is only taken from the cache. Otherwise,
+ * \p hash_out is left empty for the caller to verify the data in parallel.
+ *
+ * \param[in] path Path to image
+ * \param[in] hash_cache Cache of image hashes
+ * \param[in] type Type of checksum to get
+ * \param[out] data Contents of image
+ * \param[out] sb Stat information of the image
+ * \param[out] hash_out Checksum of the image
+ *
+ * \return True if the image was read and was not modified during the read.
+ *         Otherwise, false.
+ */
+static bool read_image(const std::string &path, const HashCache &hash_cache,
+                       ChecksumType type, std::string &data, struct stat &sb,
+                       std::string &hash_out)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        LOGE("%s: Failed to open image: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    auto close_fd = finally([&] {
+        close(fd);
+    });
+
+    if (fstat(fd, &sb) < 0) {
+        LOGE("%s: Failed to stat image: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // Tree checksums are cached with their algorithm prefix to distinguish them
+    // from flat SHA512 digests
+    bool cached = hash_cache.get(path, sb, hash_out);
+    bool is_tree = starts_with(hash_out, ALGO_SHA512_TREE ":");
+
+    if (type == ChecksumType::Sha512Tree) {
+        if (cached && is_tree) {
+            hash_out.erase(0, strlen(ALGO_SHA512_TREE ":"));
+        } else {
+            hash_out.clear();
+        }
+        cached = true;
+    } else if (is_tree) {
+        cached = false;
+    }
+
+    FdFile file;
+    HashingFile hashing_file;
+    File *input = &file;
+
+    if (auto r = file.open(fd, false); !r) {
+        LOGE("%s: Failed to open image: %s",
+             path.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (!cached) {
+        if (auto r = hashing_file.open(&file, HashAlgorithm::Sha512); !r) {
+            LOGE("%s: Failed to initialize hash: %s",
+                 path.c_str(), r.error().message().c_str());
+            return false;
+        }
+        input = &hashing_file;
+    }
+
+    data.resize(static_cast<size_t>(sb.st_size));
+    size_t total = 0;
+
+    while (true) {
+        // Keep reading past the expected size to detect a growing file
+        if (total == data.size()) {
+            data.resize(total + IMAGE_BLOCK_SIZE);
+        }
+
+        auto n = file_read_retry(*input, data.data() + total,
+                                 std::min(data.size() - total,
+                                          IMAGE_BLOCK_SIZE));
+        if (!n) {
+            LOGE("%s: Failed to read image: %s",
+                 path.c_str(), n.error().message().c_str());
+            return false;
+        } else if (n.value() == 0) {
+            break;
+        }
+
+        total += n.value();
+    }
+
+    data.resize(total);
+
+    // The cached hash can only be trusted if the file did not change while it
+    // was being read
+    struct stat sb_after;
+    if (fstat(fd, &sb_after) < 0) {
+        LOGE("%s: Failed to stat image: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (hash_cache_stat_key(sb) != hash_cache_stat_key(sb_after)
+            || data.size() != static_cast<size_t>(sb.st_size)) {
+        LOGE("%s: Image was modified while reading", path.c_str());
+        return false;
+    }
+
+    if (!cached) {
+        hash_out = sha512_hex(hashing_file);
+        if (hash_out.empty()) {
+            LOGE("%s: Failed to compute hash", path.c_str());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Compute or verify the hash tree checksum of an in-memory image
+ *
+ * If \p expected is not empty and the block digests stored next to the image
+ * match it, the blocks are verified in parallel and verification stops at the
+ * first mismatching block. Otherwise, the whole tree is computed. If
+ * \p save_tree is true, the computed block digests are stored next to the
+ * image.
+ *
+ * \param[in] path Path to image
+ * \param[in] data Contents of image
+ * \param[in] expected Expected HashTree::checksum() or empty string
+ * \param[in] save_tree Whether to store the block digests
+ * \param[out] hash_out Checksum of the image or empty string if a block did
+ *                      not match
+ *
+ * \return True unless the block digests could not be stored
+ */
+static bool hash_tree_image(const std::string &path, const std::string &data,
+                            const std::string &expected, bool save_tree,
+                            std::string &hash_out)
+{
+    std::string tree_path(path);
+    tree_path += HASH_TREE_SUFFIX;
+
+    HashTree tree;
+
+    if (!expected.empty() && tree.load_file(tree_path)
+            && tree.checksum() == expected) {
+        if (auto block = tree.find_mismatch(data)) {
+            LOGE("%s: Block %zu at offset %" PRIu64 " was modified",
+                 path.c_str(), *block,
+                 static_cast<uint64_t>(*block) * tree.block_size());
+            hash_out.clear();
+        } else {
+            hash_out = expected;
+        }
+        return true;
+    }
+
+    // Keep the block size of the expected checksum so the roots are comparable
+    size_t block_size = HASH_TREE_BLOCK_SIZE;
+    if (auto pos = expected.find(':'); pos != std::string::npos) {
+        if (!str_to_num(expected.substr(0, pos).c_str(), 10, block_size)
+                || block_size == 0) {
+            block_size = HASH_TREE_BLOCK_SIZE;
+        }
+    }
+
+    tree.compute(data, block_size);
+    hash_out = tree.checksum();
+
+    if (save_tree && !tree.save_file(tree_path)) {
+        LOGE("%s: Failed to write block digests: %s",
+             tree_path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Write an in-memory image to a block device
+ *
+ * Only the blocks of the block device that differ from the image are written.
+ * If the block device already holds the image, nothing is written at all.
+ *
+ * \param block_dev Path to block device
+ * \param data Contents of image
+ *
+ * \return True if the block device holds the image. Otherwise, false.
+ */
+static bool flash_image(const std::string &block_dev, const std::string &data)
+{
+    FdFile file;
+    if (auto r = file.open(block_dev, FileOpenMode::ReadWrite); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             block_dev.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    CompareWriteFile cw_file;
+    if (auto r = cw_file.open(
+            &file, storage_block_size(block_dev, IMAGE_BLOCK_SIZE)); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             block_dev.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = file_write_exact(cw_file, data.data(), data.size()); !r) {
+        LOGE("%s: Failed to write image: %s",
+             block_dev.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    // This also syncs the block device
+    if (auto r = cw_file.close(); !r) {
+        LOGE("%s: Failed to write image: %s",
+             block_dev.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = file.close(); !r) {
+        LOGE("%s: Failed to close: %s",
+             block_dev.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    LOGD("%s: Wrote %" PRIu64 "/%" PRIu64 " blocks", block_dev.c_str(),
+         cw_file.blocks_written(), cw_file.blocks_compared());
+
+    return true;
+}
+
+/*!
+ * \brief Copy a partition to an image and hash it in the same pass
+ *
+ * If the image already has the same size as the partition and its cached hash
+ * matches the partition's hash, the image is not rewritten. The partition is
+ * then only read once for hashing.
+ *
+ * \param[in] source Path to partition block device
+ * \param[in] target Path to image
+ * \param[in,out] hash_cache Cache of image hashes
+ * \param[out] sha512_out SHA512 hex digest of the partition
+ *
+ * \return True if the image holds the partition's contents. Otherwise, false.
+ */
+static bool copy_image(const std::string &source, const std::string &target,
+                       HashCache &hash_cache, std::string &sha512_out)
+{
+    FdFile in_file;
+    if (auto r = in_file.open(source, FileOpenMode::ReadOnly); !r) {
+        LOGE("%s: Failed to open: %s",
+             source.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    auto size = in_file.seek(0, SEEK_END);
+    if (!size) {
+        LOGE("%s: Failed to get size: %s",
+             source.c_str(), size.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = in_file.seek(0, SEEK_SET); !r) {
+        LOGE("%s: Failed to seek: %s",
+             source.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    struct stat sb;
+    std::string cached_hash;
+
+    if (stat(target.c_str(), &sb) == 0 && S_ISREG(sb.st_mode)
+            && static_cast<uint64_t>(sb.st_size) == size.value()
+            && hash_cache.get(target, sb, cached_hash)) {
+        HashingFile hashing_file;
+        if (auto r = hashing_file.open(&in_file, HashAlgorithm::Sha512); !r) {
+            LOGE("%s: Failed to initialize hash: %s",
+                 source.c_str(), r.error().message().c_str());
+            return false;
+        }
+
+        if (auto r = file_read_discard(hashing_file, size.value());
+                !r || r.value() != size.value()) {
+            LOGE("%s: Failed to read: %s", source.c_str(),
+                 r ? "Unexpected EOF" : r.error().message().c_str());
+            return false;
+        }
+
+        sha512_out = sha512_hex(hashing_file);
+        if (!sha512_out.empty() && sha512_out == cached_hash) {
+            LOGD("%s: Already up to date with %s",
+                 target.c_str(), source.c_str());
+            return true;
+        }
+
+        if (auto r = in_file.seek(0, SEEK_SET); !r) {
+            LOGE("%s: Failed to seek: %s",
+                 source.c_str(), r.error().message().c_str());
+            return false;
+        }
+    }
+
+    HashingFile hashing_file;
+    if (auto r = hashing_file.open(&in_file, HashAlgorithm::Sha512); !r) {
+        LOGE("%s: Failed to initialize hash: %s",
+             source.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    FdFile out_file;
+    if (auto r = out_file.open(target, FileOpenMode::WriteOnly); !r) {
+        LOGE("%s: Failed to open for writing: %s",
+             target.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = file_copy(hashing_file, out_file, {}); !r) {
+        LOGE("%s: Failed to copy from %s: %s", target.c_str(),
+             source.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = out_file.close(); !r) {
+        LOGE("%s: Failed to close: %s",
+             target.c_str(), r.error().message().c_str());
+        return false;
+    }
+
+    sha512_out = sha512_hex(hashing_file);
+    if (sha512_out.empty()) {
+        LOGE("%s: Failed to compute hash", source.c_str());
+        return false;
+    }
+
+    if (stat(target.c_str(), &sb) == 0) {
+        hash_cache.set(target, sb, sha512_out);
+    }
+
+    return true;
+}
+
 /*!
  * \brief Perform non-recursive search for a block device
  *
@@ -301,6 +1022,8 @@ SwitchRomResult switch_rom(const std::string &id,
                            const std::vector<std::string> &blockdev_base_dirs,
                            bool force_update_checksums)
 {
+    util::ATraceSection section("switch_rom");
+
     LOGD("Attempting to switch to %s", id.c_str());
     LOGD("Force update checksums: %d", force_update_checksums);
 
@@ -344,41 +1067,83 @@ SwitchRomResult switch_rom(const std::string &id,
     ChecksumProps props;
     props.load_file();
 
+    HashCache hash_cache;
+    hash_cache.load_file();
+
     for (Flashable &f : flashables) {
+        // Get expected checksum
+        ChecksumsGetResult ret = props.get(id, util::base_name(f.image),
+                                           f.expected_hash, f.type);
+        if (ret == ChecksumsGetResult::Malformed) {
+            return SwitchRomResult::ChecksumInvalid;
+        } else if (ret == ChecksumsGetResult::NotFound) {
+            f.expected_hash.clear();
+        }
+
+        // New checksums are always hash trees
+        if (force_update_checksums) {
+            f.expected_hash.clear();
+            f.type = ChecksumType::Sha512Tree;
+        }
+
         // If memory becomes an issue, an alternative method is to create a
         // temporary directory in /data/multiboot/ that's only writable by root
         // and copy the images there.
-        if (auto r = util::file_read_all(f.image)) {
-            f.data = std::move(r.value());
-        } else {
-            LOGE("%s: Failed to read image: %s",
-                 f.image.c_str(), r.error().message().c_str());
+        //
+        // The actual checksum is computed while reading or, for hash trees, in
+        // parallel afterwards, unless the previous result can be reused because
+        // the image is unchanged.
+        if (!read_image(f.image, hash_cache, f.type, f.data, f.sb, f.hash)) {
             return SwitchRomResult::Failed;
         }
 
-        // Get actual sha512sum
-        std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-        SHA512(reinterpret_cast<const unsigned char *>(f.data.data()),
-               f.data.size(), digest.data());
-        f.hash = util::hex_string(digest.data(), digest.size());
+        if (f.type == ChecksumType::Sha512Tree && f.hash.empty()
+                && !hash_tree_image(f.image, f.data, f.expected_hash,
+                                    force_update_checksums, f.hash)) {
+            return SwitchRomResult::Failed;
+        }
 
-        if (force_update_checksums) {
-            props.set(id, util::base_name(f.image), f.hash);
+        if (f.hash.empty()) {
+            // A block of the tree did not match
+        } else if (f.type == ChecksumType::Sha512Tree) {
+            hash_cache.set(f.image, f.sb, ALGO_SHA512_TREE ":" + f.hash);
+        } else {
+            hash_cache.set(f.image, f.sb, f.hash);
         }
+    }
 
-        // Get expected sha512sum
-        ChecksumsGetResult ret = props.get(id, util::base_name(f.image),
-                                           f.expected_hash);
-        if (ret == ChecksumsGetResult::Malformed) {
-            return SwitchRomResult::ChecksumInvalid;
+    (void) hash_cache.save_file();
+
+    bool update_checksums = force_update_checksums;
+
+    for (Flashable &f : flashables) {
+        if (force_update_checksums) {
+            props.set(id, util::base_name(f.image), f.hash, f.type);
+            f.expected_hash = f.hash;
         }
 
         // Verify hashes if we have an expected hash
-        if (ret == ChecksumsGetResult::Found && f.expected_hash != f.hash) {
+        if (!f.expected_hash.empty() && f.expected_hash != f.hash) {
             LOGE("%s: Checksum (%s) does not match expected (%s)",
                  f.image.c_str(), f.hash.c_str(), f.expected_hash.c_str());
             return SwitchRomResult::ChecksumInvalid;
         }
+
+        // Upgrade verified flat checksums to hash trees, so that the next
+        // switch can verify the image in parallel
+        if (!f.expected_hash.empty() && f.type == ChecksumType::Sha512) {
+            std::string tree_hash;
+            if (hash_tree_image(f.image, f.data, {}, true, tree_hash)) {
+                props.set(id, util::base_name(f.image), tree_hash,
+                          ChecksumType::Sha512Tree);
+                hash_cache.set(f.image, f.sb, ALGO_SHA512_TREE ":" + tree_hash);
+                update_checksums = true;
+            }
+        }
+    }
+
+    if (update_checksums) {
+        (void) hash_cache.save_file();
     }
 
     // Fail if we're missing expected hashes. We do this last to make sure
@@ -393,15 +1158,12 @@ SwitchRomResult switch_rom(const std::string &id,
 
     // Now we can flash the images
     for (Flashable &f : flashables) {
-        if (auto r = util::file_write_data(
-                f.block_dev, f.data.data(), f.data.size()); !r) {
-            LOGE("%s: Failed to write image: %s",
-                 f.block_dev.c_str(), r.error().message().c_str());
+        if (!flash_image(f.block_dev, f.data)) {
             return SwitchRomResult::Failed;
         }
     }
 
-    if (force_update_checksums) {
+    if (update_checksums) {
         LOGD("Updating checksums file");
         props.save_file();
     }
@@ -451,18 +1213,16 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
         return false;
     }
 
-    auto data = util::file_read_all(boot_blockdev);
-    if (!data) {
-        LOGE("%s: Failed to read block device: %s",
-             boot_blockdev.c_str(), data.error().message().c_str());
+    HashCache hash_cache;
+    hash_cache.load_file();
+
+    // Get actual sha512sum while copying the boot partition
+    std::string hash;
+    if (!copy_image(boot_blockdev, bootimg_path, hash_cache, hash)) {
         return false;
     }
 
-    // Get actual sha512sum
-    std::array<unsigned char, SHA512_DIGEST_LENGTH> digest;
-    SHA512(reinterpret_cast<const unsigned char *>(data.value().data()),
-           data.value().size(), digest.data());
-    std::string hash = util::hex_string(digest.data(), digest.size());
+    (void) hash_cache.save_file();
 
     // Add to checksums.prop
     ChecksumProps props;
@@ -472,15 +1232,6 @@ bool set_kernel(const std::string &id, const std::string &boot_blockdev)
     // NOTE: This function isn't responsible for updating the checksums for
     //       any extra images. We don't want to mask any malicious changes.
 
-    // Cast is okay. The data is just passed to fwrite (ie. no signed
-    // extension issues)
-    if (auto r = util::file_write_data(
-            bootimg_path, data.value().data(), data.value().size()); !r) {
-        LOGE("%s: Failed to write image: %s",
-             bootimg_path.c_str(), r.error().message().c_str());
-        return false;
-    }
-
     LOGD("Updating checksums file");
     props.save_file();
 
@@ -20,92 +20,301 @@
 #include "util/wipe.h"
 
 #include <algorithm>
+#include <memory>
 
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include "mbcommon/finally.h"
 #include "mbcommon/string.h"
 #include "mblog/logging.h"
 #include "mbutil/delete.h"
-#include "mbutil/fts.h"
+#include "mbutil/directory.h"
+#include "mbutil/metrics.h"
 #include "mbutil/mount.h"
+#include "mbutil/path.h"
+#include "mbutil/process.h"
 #include "mbutil/string.h"
 
 #include "util/multiboot.h"
 
 #define LOG_TAG "mbtool/util/wipe"
 
+// Relative to the root of each partition
+#define TRASH_DIR                       "/multiboot/.trash"
+
+#define IOPRIO_CLASS_SHIFT              13
+#define IOPRIO_CLASS_IDLE               3
+#define IOPRIO_WHO_PROCESS              1
+
 namespace mb
 {
 
-class WipeDirectory : public util::FtsWrapper {
-public:
-    WipeDirectory(std::string path, std::vector<std::string> exclusions)
-        : FtsWrapper(path, util::FtsFlag::GroupSpecialFiles)
-        , _exclusions(std::move(exclusions))
-    {
-    }
+using ScopedDIR = std::unique_ptr<DIR, decltype(closedir) *>;
 
-    Actions on_changed_path() override
-    {
-        // Exclude first-level directories
-        if (_curr->fts_level == 1) {
-            if (std::find(_exclusions.begin(), _exclusions.end(), _curr->fts_name)
-                    != _exclusions.end()) {
-                return Action::Skip;
+static const char * const TRASH_PARTITIONS[] = { "/system", "/cache", "/data" };
+
+/*!
+ * \brief Create a new directory in the trash on the same partition as a path
+ *
+ * The trash directory is locked in shared mode so that reap_trash() will not
+ * delete the new directory while files are being moved into it.
+ *
+ * \param path Path that will be moved to the trash
+ * \param[out] lock_fd File descriptor holding the lock
+ *
+ * \return Path to the new directory or an empty string if \p path is not on
+ *         a known partition or the directory could not be created
+ */
+static std::string create_trash_entry(const std::string &path, int &lock_fd)
+{
+    for (auto const &partition : TRASH_PARTITIONS) {
+        std::string raw_path = get_raw_path(partition);
+        if (path != raw_path && !starts_with(path, raw_path + "/")) {
+            continue;
+        }
+
+        std::string trash_dir = raw_path + TRASH_DIR;
+        if (auto r = util::mkdir_recursive(trash_dir, 0700); !r) {
+            LOGW("%s: Failed to create directory: %s",
+                 trash_dir.c_str(), r.error().message().c_str());
+            return {};
+        }
+
+        int fd = open(trash_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            LOGW("%s: Failed to open: %s", trash_dir.c_str(), strerror(errno));
+            return {};
+        }
+
+        auto close_fd = finally([&] {
+            if (fd >= 0) {
+                close(fd);
             }
+        });
+
+        if (flock(fd, LOCK_SH) < 0) {
+            LOGW("%s: Failed to lock: %s", trash_dir.c_str(), strerror(errno));
+            return {};
+        }
+
+        std::string entry = trash_dir + "/XXXXXX";
+        if (!mkdtemp(entry.data())) {
+            LOGW("%s: Failed to create temporary directory: %s",
+                 trash_dir.c_str(), strerror(errno));
+            return {};
         }
 
-        return Action::Ok;
+        lock_fd = fd;
+        fd = -1;
+
+        return entry;
     }
 
-    Actions on_reached_directory_pre() override
-    {
-        // Do nothing. Need depth-first search, so directories are deleted
-        // in FTS_DP
-        return Action::Ok;
+    return {};
+}
+
+/*!
+ * \brief Move the contents of a directory to the trash
+ *
+ * Entries that cannot be renamed (eg. mountpoints) are left in place.
+ *
+ * \param directory Directory to empty
+ * \param exclusions List of first-level paths to keep
+ *
+ * \return True if the trash could be used. False, otherwise.
+ */
+static bool move_contents_to_trash(const std::string &directory,
+                                   const std::vector<std::string> &exclusions)
+{
+    int lock_fd;
+    std::string entry = create_trash_entry(directory, lock_fd);
+    if (entry.empty()) {
+        return false;
     }
 
-    Actions on_reached_directory_post() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
+    auto close_lock_fd = finally([&] {
+        close(lock_fd);
+    });
+
+    // The trash must not be one of the entries being moved
+    std::string prefix = directory + "/";
+    if (starts_with(entry, prefix)) {
+        auto name = entry.substr(prefix.size(),
+                                 entry.find('/', prefix.size())
+                                 - prefix.size());
+        if (std::find(exclusions.begin(), exclusions.end(), name)
+                == exclusions.end()) {
+            return false;
+        }
     }
 
-    Actions on_reached_file() override
+    std::vector<std::string> names;
+
     {
-        return delete_path() ? Action::Ok : Action::Fail;
+        ScopedDIR dp(opendir(directory.c_str()), closedir);
+        if (!dp) {
+            LOGW("%s: Failed to open directory: %s",
+                 directory.c_str(), strerror(errno));
+            return false;
+        }
+
+        while (struct dirent *ent = readdir(dp.get())) {
+            if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0
+                    && std::find(exclusions.begin(), exclusions.end(),
+                                 ent->d_name) == exclusions.end()) {
+                names.emplace_back(ent->d_name);
+            }
+        }
     }
 
-    Actions on_reached_symlink() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
+    for (auto const &name : names) {
+        std::string source = prefix + name;
+        std::string target = entry + "/" + name;
+
+        if (rename(source.c_str(), target.c_str()) < 0) {
+            LOGV("%s: Failed to move to trash: %s",
+                 source.c_str(), strerror(errno));
+        }
     }
 
-    Actions on_reached_special_file() override
-    {
-        return delete_path() ? Action::Ok : Action::Fail;
+    return true;
+}
+
+/*!
+ * \brief Move a path to the trash
+ *
+ * \param path Path to move
+ *
+ * \return True if the path was moved or does not exist. False, otherwise.
+ */
+static bool move_to_trash(const std::string &path)
+{
+    int lock_fd;
+    std::string entry = create_trash_entry(path, lock_fd);
+    if (entry.empty()) {
+        return false;
     }
 
-private:
-    std::vector<std::string> _exclusions;
+    auto close_lock_fd = finally([&] {
+        close(lock_fd);
+    });
 
-    bool delete_path()
-    {
-        if (_curr->fts_level >= 1 && remove(_curr->fts_accpath) < 0) {
-            _error_msg = format("%s: Failed to remove: %s",
-                                _curr->fts_path, strerror(errno));
-            LOGW("%s", _error_msg.c_str());
-            return false;
+    if (starts_with(entry, path + "/")) {
+        return false;
+    }
+
+    std::string target = entry + "/" + util::base_name(path);
+
+    if (rename(path.c_str(), target.c_str()) < 0 && errno != ENOENT) {
+        LOGV("%s: Failed to move to trash: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \brief Delete everything in the trash directories
+ *
+ * This waits for in-progress deferred wipes to finish moving files to the
+ * trash.
+ */
+void reap_trash()
+{
+    for (auto const &partition : TRASH_PARTITIONS) {
+        std::string trash_dir = get_raw_path(partition) + TRASH_DIR;
+
+        int fd = open(trash_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno != ENOENT) {
+                LOGW("%s: Failed to open: %s",
+                     trash_dir.c_str(), strerror(errno));
+            }
+            continue;
+        }
+
+        auto close_fd = finally([&] {
+            close(fd);
+        });
+
+        if (flock(fd, LOCK_EX) < 0) {
+            LOGW("%s: Failed to lock: %s", trash_dir.c_str(), strerror(errno));
+            continue;
+        }
+
+        if (auto r = util::delete_contents(trash_dir, {},
+                                           util::DeleteFlag::Parallel); !r) {
+            LOGW("%s: Failed to empty trash: %s",
+                 trash_dir.c_str(), r.error().message().c_str());
         }
-        return true;
     }
-};
+}
 
+/*!
+ * \brief Empty the trash in a detached low priority process
+ *
+ * The process is reparented to init, so it keeps running after the calling
+ * process (eg. a daemon connection) exits.
+ */
+void start_trash_reaper()
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOGW("Failed to fork trash reaper: %s", strerror(errno));
+        return;
+    } else if (pid > 0) {
+        // Wait for the intermediate process
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    if (fork() != 0) {
+        _exit(EXIT_SUCCESS);
+    }
+
+    (void) util::set_process_title("mbtool trash reaper");
+
+    if (setpriority(PRIO_PROCESS, 0, 19) < 0) {
+        LOGW("Failed to set priority: %s", strerror(errno));
+    }
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) < 0) {
+        LOGW("Failed to set I/O priority: %s", strerror(errno));
+    }
+
+    reap_trash();
+
+    _exit(EXIT_SUCCESS);
+}
+
+/*!
+ * \brief Delete the contents of a directory
+ *
+ * If \ref WipeFlag::Deferred is set, the contents are moved to the trash on
+ * the same partition first and only the entries that could not be moved are
+ * deleted immediately. The caller is responsible for calling reap_trash() or
+ * start_trash_reaper() afterwards.
+ *
+ * \param directory Directory to wipe
+ * \param exclusions List of first-level paths to exclude
+ * \param flags Wipe flags
+ *
+ * \return True if the directory was wiped or doesn't exist. False, otherwise.
+ */
 bool wipe_directory(const std::string &directory,
-                    const std::vector<std::string> &exclusions)
+                    const std::vector<std::string> &exclusions,
+                    WipeFlags flags)
 {
     struct stat sb;
     if (stat(directory.c_str(), &sb) < 0 && errno == ENOENT) {
@@ -113,12 +322,26 @@ bool wipe_directory(const std::string &directory,
         return true;
     }
 
+    util::MetricsStage stage("wipe");
+
     std::vector<std::string> new_exclusions{ "multiboot" };
     new_exclusions.insert(new_exclusions.end(),
                           exclusions.begin(), exclusions.end());
 
-    WipeDirectory wd(directory, std::move(new_exclusions));
-    return wd.run();
+    if ((flags & WipeFlag::Deferred)
+            && !move_contents_to_trash(directory, new_exclusions)) {
+        LOGW("%s: Cannot use trash; deleting immediately", directory.c_str());
+    }
+
+    auto ret = util::delete_contents(directory, new_exclusions,
+                                     util::DeleteFlag::Parallel);
+    if (!ret) {
+        LOGW("%s: Failed to remove: %s", ret.error().path.c_str(),
+             ret.error().ec.message().c_str());
+        return false;
+    }
+
+    return true;
 }
 
 /*!
@@ -162,11 +385,13 @@ static bool log_wipe_file(const std::string &path)
  *
  * \param mountpoint Mountpoint root to wipe
  * \param exclusions List of first-level paths to exclude
+ * \param flags Wipe flags
  *
  * \return True if the path was wiped or doesn't exist. False, otherwise
  */
 static bool log_wipe_directory(const std::string &mountpoint,
-                               const std::vector<std::string> &exclusions)
+                               const std::vector<std::string> &exclusions,
+                               WipeFlags flags)
 {
     if (exclusions.empty()) {
         LOGV("Wiping directory %s", mountpoint.c_str());
@@ -190,15 +415,20 @@ static bool log_wipe_directory(const std::string &mountpoint,
         return false;
     }
 
-    bool ret = wipe_directory(mountpoint, exclusions);
+    bool ret = wipe_directory(mountpoint, exclusions, flags);
     LOGV("-> %s", ret ? "Succeeded" : "Failed");
     return ret;
 }
 
-static bool log_delete_recursive(const std::string &path)
+static bool log_delete_recursive(const std::string &path, WipeFlags flags)
 {
     LOGV("Recursively deleting %s", path.c_str());
-    if (auto r = util::delete_recursive(path)) {
+
+    if ((flags & WipeFlag::Deferred) && !move_to_trash(path)) {
+        LOGW("%s: Cannot use trash; deleting immediately", path.c_str());
+    }
+
+    if (auto r = util::delete_recursive(path, util::DeleteFlag::Parallel)) {
         LOGV("-> Succeeded");
         return true;
     } else {
@@ -207,7 +437,7 @@ static bool log_delete_recursive(const std::string &path)
     }
 }
 
-bool wipe_system(const std::shared_ptr<Rom> &rom)
+bool wipe_system(const std::shared_ptr<Rom> &rom, WipeFlags flags)
 {
     std::string path = rom->full_system_path();
     if (path.empty()) {
@@ -224,14 +454,14 @@ bool wipe_system(const std::shared_ptr<Rom> &rom)
 
         ret = log_wipe_file(path);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, flags);
         // Try removing ROM's /system if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_cache(const std::shared_ptr<Rom> &rom, WipeFlags flags)
 {
     std::string path = rom->full_cache_path();
     if (path.empty()) {
@@ -243,14 +473,14 @@ bool wipe_cache(const std::shared_ptr<Rom> &rom)
     if (rom->cache_is_image) {
         ret = log_wipe_file(path);
     } else {
-        ret = log_wipe_directory(path, {});
+        ret = log_wipe_directory(path, {}, flags);
         // Try removing ROM's /cache if it's empty
         remove(path.c_str());
     }
     return ret;
 }
 
-bool wipe_data(const std::shared_ptr<Rom> &rom)
+bool wipe_data(const std::shared_ptr<Rom> &rom, WipeFlags flags)
 {
     std::string path = rom->full_data_path();
     if (path.empty()) {
@@ -262,7 +492,7 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
     if (rom->data_is_image) {
         ret = log_wipe_file(path);
     } else {
-        ret = log_wipe_directory(path, { "media" });
+        ret = log_wipe_directory(path, { "media" }, flags);
         // Try removing ROM's /data/media and /data if they're empty
         remove((path + "/media").c_str());
         remove(path.c_str());
@@ -270,7 +500,7 @@ bool wipe_data(const std::shared_ptr<Rom> &rom)
     return ret;
 }
 
-bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
+bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom, WipeFlags flags)
 {
     if (rom->data_is_image || rom->cache_is_image) {
         LOGE("Wiping dalvik-cache for ROMs that use data or cache images is "
@@ -297,17 +527,17 @@ bool wipe_dalvik_cache(const std::shared_ptr<Rom> &rom)
     // util::delete_recursive() returns true if the path does not
     // exist (ie. returns false only on errors), which is exactly
     // what we want
-    return log_delete_recursive(data_path)
-            && log_delete_recursive(cache_path);
+    return log_delete_recursive(data_path, flags)
+            && log_delete_recursive(cache_path, flags);
 }
 
-bool wipe_multiboot(const std::shared_ptr<Rom> &rom)
+bool wipe_multiboot(const std::shared_ptr<Rom> &rom, WipeFlags flags)
 {
     // Delete /data/media/0/MultiBoot/[ROM ID]
     std::string multiboot_path(MULTIBOOT_DIR);
     multiboot_path += '/';
     multiboot_path += rom->id;
-    return log_delete_recursive(multiboot_path);
+    return log_delete_recursive(multiboot_path, flags);
 }
 
 }
@@ -10,8 +10,8 @@
 #include "callbacks.h"
 #include "label_file.h"
 
-static int process_file(struct pcre_shim *shim,
-                        struct selabel_handle *rec, const char *filename)
+int process_file(struct pcre_shim *shim,
+                 struct selabel_handle *rec, const char *filename)
 {
     unsigned int line_num;
     int rc;
@@ -223,7 +223,7 @@ err:
     goto out;
 }
 
-static void free_specs(struct pcre_shim *shim, struct saved_data *data)
+void free_specs(struct pcre_shim *shim, struct saved_data *data)
 {
     struct spec *specs = data->spec_arr;
     unsigned int num_entries = data->nspec;
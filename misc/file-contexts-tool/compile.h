@@ -6,6 +6,13 @@
 extern "C" {
 #endif
 
+struct saved_data;
+struct selabel_handle;
+
+int process_file(struct pcre_shim *shim,
+                 struct selabel_handle *rec, const char *filename);
+void free_specs(struct pcre_shim *shim, struct saved_data *data);
+
 int compile(struct pcre_shim *shim,
             const char *source_file, const char *target_file);
 
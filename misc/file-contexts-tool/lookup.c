@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+
+#include "lookup.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callbacks.h"
+#include "matcher.h"
+
+/*
+ * Query Format
+ *
+ * Each line of the query file is "<mode> <path>", where <mode> is the octal
+ * st_mode of the file (or 0 to match any file type). For every query, one line
+ * containing the context is printed to stdout. If no spec matches the path or
+ * the spec's context is <<none>>, "<<none>>" is printed instead.
+ *
+ * Queries should be sorted by directory to benefit from the matcher's
+ * per-directory memoization, which is naturally the case when the paths come
+ * from a directory walk.
+ */
+int lookup(struct pcre_shim *shim,
+           const char *source_file, const char *query_file)
+{
+    struct fc_matcher *matcher;
+    FILE *fp;
+    char *line_buf = NULL;
+    size_t line_len = 0;
+    ssize_t n;
+    unsigned int line_num = 0;
+    int rc = 0;
+
+    if (strcmp(query_file, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(query_file, "re");
+        if (!fp) {
+            selinux_log("%s: Failed to open for reading: %s\n",
+                        query_file, strerror(errno));
+            return -1;
+        }
+    }
+
+    matcher = fc_matcher_create(shim, source_file);
+    if (!matcher) {
+        rc = -1;
+        goto out;
+    }
+
+    while ((n = getline(&line_buf, &line_len, fp)) > 0) {
+        char *path;
+        unsigned long mode;
+        const char *context;
+
+        ++line_num;
+
+        if (line_buf[n - 1] == '\n') {
+            line_buf[n - 1] = '\0';
+        }
+
+        errno = 0;
+        mode = strtoul(line_buf, &path, 8);
+        if (errno || path == line_buf || *path != ' ') {
+            selinux_log("%s: line %u has invalid mode\n",
+                        query_file, line_num);
+            rc = -1;
+            goto out;
+        }
+        ++path;
+
+        context = fc_matcher_lookup(matcher, path, (mode_t) mode);
+        if (!context && errno != ENOENT) {
+            rc = -1;
+            goto out;
+        }
+
+        if (printf("%s\n", context ? context : "<<none>>") < 0) {
+            rc = -1;
+            goto out;
+        }
+    }
+
+    if (ferror(fp)) {
+        selinux_log("%s: Failed to read: %s\n", query_file, strerror(errno));
+        rc = -1;
+    }
+
+out:
+    if (fflush(stdout) != 0) {
+        rc = -1;
+    }
+    fc_matcher_free(matcher);
+    free(line_buf);
+    if (fp != stdin) {
+        fclose(fp);
+    }
+    return rc;
+}
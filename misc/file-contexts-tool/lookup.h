@@ -0,0 +1,14 @@
+#pragma once
+
+#include "pcre_shim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int lookup(struct pcre_shim *shim,
+           const char *source_file, const char *query_file);
+
+#ifdef __cplusplus
+}
+#endif
@@ -5,6 +5,7 @@
 
 #include "compile.h"
 #include "decompile.h"
+#include "lookup.h"
 
 static void usage(FILE *stream, const char *progname)
 {
@@ -14,12 +15,17 @@ static void usage(FILE *stream, const char *progname)
     fprintf(stream,
             "Usage: %s compile [option...] <source file> <target file>\n"
             "       %s decompile [option...] <source file> <target file>\n"
+            "       %s lookup [option...] <source file> <query file>\n"
             "\n"
             "Options:\n"
             "  -p, --pcre <PCRE lib path>\n"
             "                   Path to PCRE shared library\n"
-            "  -h, --help       Display this help message\n",
-            progname, progname);
+            "  -h, --help       Display this help message\n"
+            "\n"
+            "The lookup action reads \"<octal mode> <path>\" lines from the query\n"
+            "file (or stdin if it is \"-\") and prints the matching context for\n"
+            "each path from the non-compiled source file.\n",
+            progname, progname, progname);
 }
 
 int main(int argc, char *argv[])
@@ -81,6 +87,8 @@ int main(int argc, char *argv[])
         ret = compile(&shim, source_path, target_path);
     } else if (strcmp(action, "decompile") == 0) {
         ret = decompile(&shim, source_path, target_path);
+    } else if (strcmp(action, "lookup") == 0) {
+        ret = lookup(&shim, source_path, target_path);
     } else {
         usage(stderr, argv[0]);
         ret = -1;
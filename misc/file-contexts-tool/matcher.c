@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+
+#include "matcher.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compile.h"
+#include "label_file.h"
+
+struct trie_node
+{
+    struct trie_node *child;
+    struct trie_node *sibling;
+    unsigned int *specs;            /* specs whose literal prefix ends here */
+    unsigned int nspecs;
+    unsigned int alloc_specs;
+    unsigned char c;
+};
+
+struct spec_list
+{
+    unsigned int *items;
+    size_t len;
+    size_t alloc;
+};
+
+struct fc_matcher
+{
+    struct pcre_shim *shim;
+    struct selabel_handle rec;
+    struct saved_data data;
+
+    /* Unescaped path for specs that do not need a regex, otherwise NULL */
+    char **literals;
+    struct trie_node root;
+
+    /* Trie walk memoized for the directory of the previous lookup */
+    char *dir;
+    size_t dir_len;
+    size_t dir_alloc;
+    int have_dir;
+    const struct trie_node *dir_node;
+    struct spec_list dir_candidates;
+
+    /* Scratch buffers */
+    struct spec_list candidates;
+    char *key;
+    size_t key_alloc;
+};
+
+static int spec_list_push(struct spec_list *list, unsigned int value)
+{
+    if (list->len == list->alloc) {
+        size_t new_alloc = list->alloc * 2 + 16;
+        unsigned int *items =
+                realloc(list->items, new_alloc * sizeof(*items));
+        if (!items) {
+            return -1;
+        }
+        list->items = items;
+        list->alloc = new_alloc;
+    }
+
+    list->items[list->len++] = value;
+    return 0;
+}
+
+static int spec_list_extend(struct spec_list *list,
+                            const unsigned int *values, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (spec_list_push(list, values[i]) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static const struct trie_node * trie_child(const struct trie_node *node,
+                                           unsigned char c)
+{
+    const struct trie_node *child;
+
+    for (child = node->child; child; child = child->sibling) {
+        if (child->c == c) {
+            return child;
+        }
+    }
+
+    return NULL;
+}
+
+static int trie_insert(struct trie_node *root, const char *prefix, size_t len,
+                       unsigned int spec)
+{
+    struct trie_node *node = root;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        struct trie_node *child =
+                (struct trie_node *) trie_child(node, (unsigned char) prefix[i]);
+
+        if (!child) {
+            child = calloc(1, sizeof(*child));
+            if (!child) {
+                return -1;
+            }
+            child->c = (unsigned char) prefix[i];
+            child->sibling = node->child;
+            node->child = child;
+        }
+
+        node = child;
+    }
+
+    if (node->nspecs == node->alloc_specs) {
+        unsigned int new_alloc = node->alloc_specs * 2 + 1;
+        unsigned int *specs =
+                realloc(node->specs, new_alloc * sizeof(*specs));
+        if (!specs) {
+            return -1;
+        }
+        node->specs = specs;
+        node->alloc_specs = new_alloc;
+    }
+
+    node->specs[node->nspecs++] = spec;
+    return 0;
+}
+
+static void trie_free_children(struct trie_node *node)
+{
+    struct trie_node *child = node->child;
+
+    while (child) {
+        struct trie_node *next = child->sibling;
+        trie_free_children(child);
+        free(child->specs);
+        free(child);
+        child = next;
+    }
+
+    node->child = NULL;
+}
+
+/* Check if the remainder of a regex contains a '|' outside of any group. */
+static int has_top_level_alternation(const char *c)
+{
+    int depth = 0;
+
+    for (; *c; c++) {
+        switch (*c) {
+        case '\\':
+            if (c[1]) {
+                c++;
+            }
+            break;
+        case '[':
+            c++;
+            if (*c == '^') {
+                c++;
+            }
+            if (*c == ']') {
+                c++;
+            }
+            while (*c && *c != ']') {
+                if (*c == '\\' && c[1]) {
+                    c++;
+                }
+                c++;
+            }
+            if (!*c) {
+                return 1;
+            }
+            break;
+        case '(':
+            depth++;
+            break;
+        case ')':
+            depth--;
+            break;
+        case '|':
+            if (depth <= 0) {
+                return 1;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Compute the unescaped literal text that every path matched by a regex must
+ * begin with. This is stricter than spec->prefix_len: an escape sequence that
+ * is not a literal character (eg. \d) ends the prefix, a quantifier that
+ * allows zero repetitions makes the previous character optional, and an
+ * alternation at the top level means that there is no common prefix at all.
+ * If the whole regex is literal, *exact is set to 1.
+ */
+static char * literal_prefix(const char *regex, size_t *len_out, int *exact)
+{
+    const char *c;
+    size_t len = 0;
+    char *buf;
+
+    buf = malloc(strlen(regex) + 1);
+    if (!buf) {
+        return NULL;
+    }
+
+    *exact = 0;
+
+    for (c = regex; *c; c++) {
+        switch (*c) {
+        case '?':
+        case '*':
+        case '{':
+            if (len > 0) {
+                len--;
+            }
+            goto done;
+        case '.':
+        case '^':
+        case '$':
+        case '+':
+        case '|':
+        case '[':
+        case '(':
+            goto done;
+        case '\\':
+            if (!c[1] || isalnum((unsigned char) c[1])) {
+                goto done;
+            }
+            c++;
+            /* fall through */
+        default:
+            buf[len++] = *c;
+            break;
+        }
+    }
+
+    *exact = 1;
+
+done:
+    if (!*exact && has_top_level_alternation(c)) {
+        len = 0;
+    }
+
+    buf[len] = '\0';
+    *len_out = len;
+    return buf;
+}
+
+/* Same as libselinux's find_stem_from_file() */
+static int find_stem_from_file(struct saved_data *data, const char **key)
+{
+    const char *tmp;
+    int stem_len;
+    int i;
+
+    if (!**key) {
+        return -1;
+    }
+
+    tmp = strchr(*key + 1, '/');
+    if (!tmp) {
+        return -1;
+    }
+    stem_len = tmp - *key;
+
+    for (i = 0; i < data->num_stems; i++) {
+        if (stem_len == data->stem_arr[i].len
+                && !strncmp(*key, data->stem_arr[i].buf, stem_len)) {
+            *key += stem_len;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* Remove duplicate and trailing slashes like selabel_lookup() does. */
+static const char * normalize_key(struct fc_matcher *matcher, const char *path)
+{
+    size_t len = strlen(path);
+    size_t i, n = 0;
+    char *key;
+
+    if (len + 1 > matcher->key_alloc) {
+        key = realloc(matcher->key, len + 1);
+        if (!key) {
+            return NULL;
+        }
+        matcher->key = key;
+        matcher->key_alloc = len + 1;
+    }
+
+    key = matcher->key;
+
+    for (i = 0; i < len; i++) {
+        if (path[i] == '/' && n > 0 && key[n - 1] == '/') {
+            continue;
+        }
+        key[n++] = path[i];
+    }
+
+    if (n > 1 && key[n - 1] == '/') {
+        n--;
+    }
+
+    key[n] = '\0';
+    return key;
+}
+
+/* Walk the trie along the directory part of the key and memoize the result. */
+static int walk_dir(struct fc_matcher *matcher, const char *key,
+                    size_t dir_len)
+{
+    const struct trie_node *node = &matcher->root;
+    size_t i;
+
+    if (dir_len + 1 > matcher->dir_alloc) {
+        char *dir = realloc(matcher->dir, dir_len + 1);
+        if (!dir) {
+            return -1;
+        }
+        matcher->dir = dir;
+        matcher->dir_alloc = dir_len + 1;
+    }
+
+    matcher->have_dir = 0;
+    matcher->dir_candidates.len = 0;
+
+    if (spec_list_extend(&matcher->dir_candidates,
+                         node->specs, node->nspecs) < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < dir_len && node; i++) {
+        node = trie_child(node, (unsigned char) key[i]);
+        if (node && spec_list_extend(&matcher->dir_candidates,
+                                     node->specs, node->nspecs) < 0) {
+            return -1;
+        }
+    }
+
+    memcpy(matcher->dir, key, dir_len);
+    matcher->dir[dir_len] = '\0';
+    matcher->dir_len = dir_len;
+    matcher->dir_node = node;
+    matcher->have_dir = 1;
+
+    return 0;
+}
+
+static int compare_desc(const void *a, const void *b)
+{
+    unsigned int lhs = *(const unsigned int *) a;
+    unsigned int rhs = *(const unsigned int *) b;
+
+    return (lhs < rhs) - (lhs > rhs);
+}
+
+struct fc_matcher * fc_matcher_create(struct pcre_shim *shim,
+                                      const char *source_file)
+{
+    struct fc_matcher *matcher;
+    unsigned int i;
+
+    matcher = calloc(1, sizeof(*matcher));
+    if (!matcher) {
+        selinux_log("Failed to calloc matcher: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    matcher->shim = shim;
+    matcher->rec.data = &matcher->data;
+
+    if (process_file(shim, &matcher->rec, source_file) < 0) {
+        goto err;
+    }
+
+    if (sort_specs(&matcher->data)) {
+        goto err;
+    }
+
+    if (matcher->data.nspec > 0) {
+        matcher->literals = calloc(matcher->data.nspec,
+                                   sizeof(*matcher->literals));
+        if (!matcher->literals) {
+            goto err;
+        }
+    }
+
+    for (i = 0; i < matcher->data.nspec; i++) {
+        struct spec *spec = &matcher->data.spec_arr[i];
+        size_t len;
+        int exact;
+        char *prefix;
+
+        prefix = literal_prefix(spec->regex_str, &len, &exact);
+        if (!prefix) {
+            goto err;
+        }
+
+        if (trie_insert(&matcher->root, prefix, len, i) < 0) {
+            free(prefix);
+            goto err;
+        }
+
+        if (exact) {
+            matcher->literals[i] = prefix;
+        } else {
+            free(prefix);
+            regex_jit_compile(shim, spec->regex);
+        }
+    }
+
+    return matcher;
+
+err:
+    selinux_log("%s: Failed to load file contexts\n", source_file);
+    fc_matcher_free(matcher);
+    return NULL;
+}
+
+void fc_matcher_free(struct fc_matcher *matcher)
+{
+    unsigned int i;
+
+    if (!matcher) {
+        return;
+    }
+
+    if (matcher->literals) {
+        for (i = 0; i < matcher->data.nspec; i++) {
+            free(matcher->literals[i]);
+        }
+        free(matcher->literals);
+    }
+
+    trie_free_children(&matcher->root);
+    free(matcher->root.specs);
+    free_specs(matcher->shim, &matcher->data);
+
+    free(matcher->dir);
+    free(matcher->dir_candidates.items);
+    free(matcher->candidates.items);
+    free(matcher->key);
+    free(matcher);
+}
+
+const char * fc_matcher_lookup(struct fc_matcher *matcher,
+                               const char *path, mode_t mode)
+{
+    struct spec_list *candidates = &matcher->candidates;
+    const struct trie_node *node;
+    const char *key, *buf, *slash, *c;
+    size_t dir_len, i;
+    int file_stem;
+
+    key = normalize_key(matcher, path);
+    if (!key) {
+        return NULL;
+    }
+
+    mode &= S_IFMT;
+
+    slash = strrchr(key, '/');
+    dir_len = slash ? (size_t) (slash - key) + 1 : 0;
+
+    if (!matcher->have_dir || dir_len != matcher->dir_len
+            || memcmp(key, matcher->dir, dir_len) != 0) {
+        if (walk_dir(matcher, key, dir_len) < 0) {
+            return NULL;
+        }
+    }
+
+    candidates->len = 0;
+    if (spec_list_extend(candidates, matcher->dir_candidates.items,
+                         matcher->dir_candidates.len) < 0) {
+        return NULL;
+    }
+
+    node = matcher->dir_node;
+    for (c = key + dir_len; node && *c; c++) {
+        node = trie_child(node, (unsigned char) *c);
+        if (node && spec_list_extend(candidates,
+                                     node->specs, node->nspecs) < 0) {
+            return NULL;
+        }
+    }
+
+    /* Later specs take precedence, like in selabel_lookup() */
+    qsort(candidates->items, candidates->len, sizeof(*candidates->items),
+          compare_desc);
+
+    buf = key;
+    file_stem = find_stem_from_file(&matcher->data, &buf);
+
+    for (i = 0; i < candidates->len; i++) {
+        unsigned int index = candidates->items[i];
+        struct spec *spec = &matcher->data.spec_arr[index];
+        int rc;
+
+        if ((spec->stem_id != -1 && spec->stem_id != file_stem)
+                || (mode && spec->mode && mode != spec->mode)) {
+            continue;
+        }
+
+        if (matcher->literals[index]) {
+            rc = strcmp(key, matcher->literals[index]) == 0
+                    ? REGEX_MATCH : REGEX_NO_MATCH;
+        } else {
+            rc = regex_match(matcher->shim, spec->regex,
+                             spec->stem_id == -1 ? key : buf, 0);
+        }
+
+        if (rc == REGEX_MATCH) {
+            spec->matches++;
+
+            if (strcmp(spec->lr.ctx_raw, "<<none>>") == 0) {
+                errno = ENOENT;
+                return NULL;
+            }
+
+            return spec->lr.ctx_raw;
+        } else if (rc == REGEX_ERROR) {
+            selinux_log("%s: Failed to match against %s\n",
+                        path, spec->regex_str);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+
+    errno = ENOENT;
+    return NULL;
+}
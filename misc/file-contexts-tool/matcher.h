@@ -0,0 +1,49 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include "pcre_shim.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct fc_matcher;
+
+/**
+ * Load a (non-compiled) file_contexts file and prepare it for repeated
+ * lookups.
+ *
+ * Every spec is indexed in a trie by the literal text that any matching path
+ * must begin with, so a lookup only evaluates the regexes of the specs whose
+ * prefix matches the path. Specs without any regex meta characters are
+ * compared directly and the remaining regexes are JIT compiled when the PCRE
+ * library supports it.
+ *
+ * @return Matcher that must be freed with fc_matcher_free() or NULL on error
+ */
+struct fc_matcher * fc_matcher_create(struct pcre_shim *shim,
+                                      const char *source_file);
+void fc_matcher_free(struct fc_matcher *matcher);
+
+/**
+ * Look up the context for a path.
+ *
+ * The result is identical to libselinux's selabel_lookup() for the same
+ * file_contexts file: the last matching spec (after moving exact paths to the
+ * end) wins and \p mode is compared against the spec's file type if both are
+ * specified. The candidate specs for the parent directory are memoized, so
+ * looking up paths in directory order is cheaper than random lookups.
+ *
+ * @param path Absolute path
+ * @param mode File mode (only the S_IFMT bits are used) or 0 to match any type
+ *
+ * @return Context string owned by the matcher or NULL if there is no matching
+ *         spec (errno is set to ENOENT) or an error occurred
+ */
+const char * fc_matcher_lookup(struct fc_matcher *matcher,
+                               const char *path, mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
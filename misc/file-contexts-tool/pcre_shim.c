@@ -18,6 +18,10 @@ static int load_pcre1(struct pcre1_shim *p1, void *handle)
         return -1;
     }
 
+    if (!(p1->pcre_exec = dlsym(handle, "pcre_exec"))) {
+        return -1;
+    }
+
     if (!(p1->pcre_fullinfo = dlsym(handle, "pcre_fullinfo"))) {
         return -1;
     }
@@ -59,6 +63,10 @@ static int load_pcre2(struct pcre2_shim *p2, void *handle)
         return -1;
     }
 
+    if (!(p2->pcre2_match = dlsym(handle, "pcre2_match_8"))) {
+        return -1;
+    }
+
     if (!(p2->pcre2_match_data_free =
             dlsym(handle, "pcre2_match_data_free_8"))) {
         return -1;
@@ -73,6 +81,9 @@ static int load_pcre2(struct pcre2_shim *p2, void *handle)
         return -1;
     }
 
+    // JIT is an optional feature of PCRE2. Matching still works without it.
+    p2->pcre2_jit_compile = dlsym(handle, "pcre2_jit_compile_8");
+
     if (!(p2->pcre2_get_error_message =
             dlsym(handle, "pcre2_get_error_message_8"))) {
         return -1;
@@ -35,6 +35,10 @@ typedef struct pcre_extra {
 #define PCRE_INFO_SIZE              1
 #define PCRE_INFO_STUDYSIZE         10
 #define PCRE_DOTALL                 0x00000004
+#define PCRE_PARTIAL_SOFT           0x00008000
+#define PCRE_STUDY_JIT_COMPILE      0x0001
+#define PCRE_ERROR_NOMATCH          (-1)
+#define PCRE_ERROR_PARTIAL          (-12)
 
 
 /*
@@ -45,6 +49,7 @@ typedef struct pcre2_general_context pcre2_general_context;
 typedef struct pcre2_compile_context pcre2_compile_context;
 typedef struct pcre2_code pcre2_code;
 typedef struct pcre2_match_data pcre2_match_data;
+typedef struct pcre2_match_context pcre2_match_context;
 
 // Various needed typedefs
 
@@ -56,7 +61,11 @@ typedef size_t PCRE2_SIZE;
 
 #define PCRE2_ZERO_TERMINATED       (~(PCRE2_SIZE) 0)
 #define PCRE2_DOTALL                0x00000020u
+#define PCRE2_PARTIAL_SOFT          0x00000010u
+#define PCRE2_JIT_COMPLETE          0x00000001u
 #define PCRE2_CONFIG_VERSION        11
+#define PCRE2_ERROR_NOMATCH         (-1)
+#define PCRE2_ERROR_PARTIAL         (-2)
 #define PCRE2_ERROR_NOMEMORY        (-48)
 
 
@@ -74,6 +83,16 @@ struct pcre1_shim
                     int *,
                     const unsigned char *);
 
+    int
+    (*pcre_exec)(const pcre *,
+                 const pcre_extra *,
+                 const char *,
+                 int,
+                 int,
+                 int,
+                 int *,
+                 int);
+
     int
     (*pcre_fullinfo)(const pcre *,
                      const pcre_extra *,
@@ -113,6 +132,15 @@ struct pcre2_shim
     (*pcre2_match_data_create_from_pattern)(const pcre2_code *,
                                             pcre2_general_context *);
 
+    int
+    (*pcre2_match)(const pcre2_code *,
+                   PCRE2_SPTR,
+                   PCRE2_SIZE,
+                   PCRE2_SIZE,
+                   uint32_t,
+                   pcre2_match_data *,
+                   pcre2_match_context *);
+
     void
     (*pcre2_match_data_free)(pcre2_match_data *);
 
@@ -126,6 +154,11 @@ struct pcre2_shim
     void
     (*pcre2_serialize_free)(uint8_t *);
 
+    // Optional: NULL if the library was built without JIT support
+    int
+    (*pcre2_jit_compile)(pcre2_code *,
+                         uint32_t);
+
     int
     (*pcre2_get_error_message)(int,
                                PCRE2_UCHAR *,
@@ -59,6 +59,69 @@ err:
     return -1;
 }
 
+void regex_jit_compile(struct pcre_shim *shim, struct regex_data * regex)
+{
+    if (shim->use_pcre2) {
+        if (shim->p2.pcre2_jit_compile) {
+            shim->p2.pcre2_jit_compile(regex->p2_regex, PCRE2_JIT_COMPLETE);
+        }
+    } else {
+        char const * error = NULL;
+        pcre_extra *sd = shim->p1.pcre_study(
+                regex->p1_regex, PCRE_STUDY_JIT_COMPILE, &error);
+        if (!sd) {
+            return;
+        }
+
+        if (regex->p1_extra_owned && regex->p1_sd) {
+            shim->p1.pcre_free_study(regex->p1_sd);
+        }
+        regex->p1_sd = sd;
+        regex->p1_extra_owned = 1;
+    }
+}
+
+int regex_match(struct pcre_shim *shim, struct regex_data * regex,
+                char const * subject, int partial)
+{
+    int rc;
+
+    if (shim->use_pcre2) {
+        rc = shim->p2.pcre2_match(regex->p2_regex, (PCRE2_SPTR) subject,
+                                  PCRE2_ZERO_TERMINATED, 0,
+                                  partial ? PCRE2_PARTIAL_SOFT : 0,
+                                  regex->p2_match_data, NULL);
+        if (rc > 0) {
+            return REGEX_MATCH;
+        }
+        switch (rc) {
+        case PCRE2_ERROR_PARTIAL:
+            return REGEX_MATCH_PARTIAL;
+        case PCRE2_ERROR_NOMATCH:
+            return REGEX_NO_MATCH;
+        default:
+            return REGEX_ERROR;
+        }
+    } else {
+        rc = shim->p1.pcre_exec(regex->p1_regex,
+                                regex->p1_extra_owned ? regex->p1_sd
+                                                      : &regex->p1_lsd,
+                                subject, strlen(subject), 0,
+                                partial ? PCRE_PARTIAL_SOFT : 0, NULL, 0);
+        if (rc >= 0) {
+            return REGEX_MATCH;
+        }
+        switch (rc) {
+        case PCRE_ERROR_PARTIAL:
+            return REGEX_MATCH_PARTIAL;
+        case PCRE_ERROR_NOMATCH:
+            return REGEX_NO_MATCH;
+        default:
+            return REGEX_ERROR;
+        }
+    }
+}
+
 char const * regex_version(struct pcre_shim *shim)
 {
     if (shim->use_pcre2) {
@@ -85,6 +85,30 @@ void regex_data_free(struct pcre_shim *shim, struct regex_data * regex);
 int regex_prepare_data(struct pcre_shim *shim, struct regex_data ** regex,
                        char const * pattern_string,
                        struct regex_error_data * errordata);
+/**
+ * This function enables JIT compilation for a compiled regular expression
+ * when the underlying library supports it. For PCRE, the pattern is studied
+ * again with PCRE_STUDY_JIT_COMPILE. For PCRE2, pcre2_jit_compile is called
+ * if the library exports it. Failure is not an error: the regular expression
+ * is simply matched by the interpreter.
+ *
+ * @arg regex The precompiled regular expression data.
+ */
+void regex_jit_compile(struct pcre_shim *shim, struct regex_data * regex);
+/**
+ * This function matches a string against a precompiled regular expression.
+ *
+ * @arg regex The precompiled regular expression data.
+ * @arg subject The string to match.
+ * @arg partial Boolean indicating whether a partial match is acceptable.
+ * @retval REGEX_MATCH if the subject matches the regular expression.
+ * @retval REGEX_MATCH_PARTIAL if the subject partially matches and partial
+ *                             matches were requested.
+ * @retval REGEX_NO_MATCH if the subject does not match.
+ * @retval REGEX_ERROR if an error occurred during matching.
+ */
+int regex_match(struct pcre_shim *shim, struct regex_data * regex,
+                char const * subject, int partial);
 /**
  * This function stores a precompiled regular expression to a file.
  * In the case of PCRE, it just dumps the binary representation of the
@@ -58,6 +58,7 @@
 
 // libmbcommon
 #include "mbcommon/file.h"
+#include "mbcommon/file/memory.h"
 #include "mbcommon/file/standard.h"
 
 // libmbsparse
@@ -71,6 +72,10 @@
 
 static char source_fd_path[50];
 static uint64_t sparse_size;
+// Chunk index shared by all opened handles so that each open does not have to
+// walk the chunk headers again
+static void *sparse_index_data;
+static size_t sparse_index_size;
 
 struct context
 {
@@ -114,7 +119,12 @@ static int fuse_open(const char *path, fuse_file_info *fi)
         return -extract_errno(ret.error()).value_or(EIO);
     }
 
-    ret = ctx->sparse_file.open(&ctx->source_file);
+    if (sparse_index_data) {
+        mb::MemoryFile index_file(sparse_index_data, sparse_index_size);
+        ret = ctx->sparse_file.open(&ctx->source_file, &index_file);
+    } else {
+        ret = ctx->sparse_file.open(&ctx->source_file);
+    }
     if (!ret) {
         fprintf(stderr, "%s: Failed to open sparse file: %s\n",
                 source_fd_path, ret.error().message().c_str());
@@ -213,6 +223,21 @@ static int get_sparse_file_size()
 
     sparse_size = sparse_file.size();
 
+    mb::MemoryFile index_file;
+
+    ret = index_file.open(&sparse_index_data, &sparse_index_size);
+    if (ret) {
+        ret = sparse_file.save_index(index_file);
+    }
+    if (!ret) {
+        // Not fatal. Chunk headers will just be read on demand.
+        fprintf(stderr, "%s: Failed to build chunk index: %s\n",
+                source_fd_path, ret.error().message().c_str());
+        free(sparse_index_data);
+        sparse_index_data = nullptr;
+        sparse_index_size = 0;
+    }
+
     return 0;
 }
 
@@ -18,8 +18,12 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -37,13 +41,18 @@
 // libmbcommon
 #include "mbcommon/error_code.h"
 #include "mbcommon/file/callbacks.h"
-#include "mbcommon/file/standard.h"
+#include "mbcommon/file/compare_write.h"
+#include "mbcommon/file/fd.h"
+#include "mbcommon/file/prefetch.h"
+#include "mbcommon/file/uring.h"
+#include "mbcommon/file_util.h"
 #include "mbcommon/finally.h"
 #include "mbcommon/integer.h"
 #include "mbcommon/string.h"
 
 // libmbsparse
 #include "mbsparse/sparse.h"
+#include "mbsparse/sparse_util.h"
 
 // libmbdevice
 #include "mbdevice/json.h"
@@ -78,6 +87,9 @@
 #define PROP_SYSTEM_DEV         "system"
 #define PROP_BOOT_DEV           "boot"
 
+// Maximum number of zip entries that are extracted at the same time
+#define MAX_FLASH_JOBS          3
+
 using ScopedArchive = std::unique_ptr<archive, decltype(archive_free) *>;
 using ScopedFILE = std::unique_ptr<FILE, decltype(fclose) *>;
 
@@ -98,9 +110,18 @@ static std::string sales_code;
 static std::string system_block_dev;
 static std::string boot_block_dev;
 
+// Serializes the output from the flashing threads
+static std::recursive_mutex output_mutex;
+
+// Bytes written and total bytes of each running flash job
+static std::vector<std::pair<uint64_t, uint64_t>> progress_jobs;
+static double progress_reported;
+
 MB_PRINTF(1, 2)
 static void ui_print(const char *fmt, ...)
 {
+    std::lock_guard<std::recursive_mutex> lock(output_mutex);
+
     va_list ap;
     va_list copy;
 
@@ -108,13 +129,13 @@ static void ui_print(const char *fmt, ...)
 
     dprintf(output_fd, "ui_print ");
     va_copy(copy, ap);
-    vdprintf(output_fd, fmt, ap);
+    vdprintf(output_fd, fmt, copy);
     va_end(copy);
     dprintf(output_fd, "\nui_print\n");
 
     fputs("[UI] ", stdout);
     va_copy(copy, ap);
-    vprintf(fmt, ap);
+    vprintf(fmt, copy);
     va_end(copy);
     fputc('\n', stdout);
 
@@ -123,12 +144,16 @@ static void ui_print(const char *fmt, ...)
 
 static void set_progress(double frac)
 {
+    std::lock_guard<std::recursive_mutex> lock(output_mutex);
+
     dprintf(output_fd, "set_progress %f\n", frac);
 }
 
 MB_PRINTF(1, 2)
 static void error(const char *fmt, ...)
 {
+    std::lock_guard<std::recursive_mutex> lock(output_mutex);
+
     va_list ap;
     va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
@@ -139,6 +164,8 @@ static void error(const char *fmt, ...)
 MB_PRINTF(1, 2)
 static void info(const char *fmt, ...)
 {
+    std::lock_guard<std::recursive_mutex> lock(output_mutex);
+
     va_list ap;
     va_start(ap, fmt);
     vprintf(fmt, ap);
@@ -146,6 +173,45 @@ static void info(const char *fmt, ...)
     fputc('\n', stdout);
 }
 
+// Start reporting the combined progress of a new set of flash jobs
+static void progress_reset(size_t jobs)
+{
+    std::lock_guard<std::recursive_mutex> lock(output_mutex);
+
+    progress_jobs.assign(jobs, {0, 0});
+    progress_reported = 0;
+    set_progress(0);
+}
+
+// The progress is the fraction of the total size of the jobs that has been
+// written. A job's size is only known once it has started.
+static void progress_update(size_t job, uint64_t cur_bytes, uint64_t max_bytes)
+{
+    std::lock_guard<std::recursive_mutex> lock(output_mutex);
+
+    progress_jobs[job] = {cur_bytes, max_bytes};
+
+    uint64_t total_cur = 0;
+    uint64_t total_max = 0;
+
+    for (auto const &[cur, max] : progress_jobs) {
+        total_cur += cur;
+        total_max += max;
+    }
+
+    if (total_max == 0) {
+        return;
+    }
+
+    // Rate limit: update progress only after difference exceeds 0.1%
+    double ratio = static_cast<double>(total_cur)
+            / static_cast<double>(total_max);
+    if (ratio - progress_reported >= 0.001 || ratio < progress_reported) {
+        set_progress(ratio);
+        progress_reported = ratio;
+    }
+}
+
 static bool run_command(const std::vector<std::string> &argv)
 {
     int status = mb::util::run_command(argv[0], argv, {}, {}, {});
@@ -172,9 +238,12 @@ static bool umount_system()
     return run_command({ "umount", "/system" });
 }
 
+// The zip is read through its central directory, so entries that are not
+// needed are seeked over instead of being read. Each extraction opens the zip
+// separately, which allows several entries to be extracted concurrently.
 static bool la_open_zip(archive *a, const char *filename)
 {
-    if (archive_read_support_format_zip(a) != ARCHIVE_OK) {
+    if (archive_read_support_format_zip_seekable(a) != ARCHIVE_OK) {
         error("libarchive: Failed to enable zip support: %s",
               archive_error_string(a));
         return false;
@@ -349,14 +418,22 @@ static mb::oc::result<size_t> cb_zip_read(archive *a, mb::File &file,
 }
 
 static ExtractResult extract_sparse_file(const char *zip_filename,
-                                         const char *out_filename)
+                                         const char *out_filename,
+                                         size_t job)
 {
     using namespace std::placeholders;
 
+    // The extraction is a three stage pipeline:
+    // 1. The zip entry is inflated on the prefetch thread into a bounded ring
+    //    of buffers
+    // 2. The sparse data is decoded on this thread
+    // 3. The raw data is coalesced into large aligned buffers and several
+    //    writes to the block device are kept in flight
     ScopedArchive a{archive_read_new(), &archive_read_free};
     mb::CallbackFile file;
+    mb::PrefetchFile inflated_file;
     mb::sparse::SparseFile sparse_file;
-    mb::StandardFile out_file;
+    mb::UringFile out_file;
 
     if (!a) {
         error("Out of memory");
@@ -382,7 +459,14 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
-    open_ret = sparse_file.open(&file);
+    open_ret = inflated_file.open(&file);
+    if (!open_ret) {
+        error("Failed to start reading sparse file in zip: %s",
+              open_ret.error().message().c_str());
+        return ExtractResult::Error;
+    }
+
+    open_ret = sparse_file.open(&inflated_file);
     if (!open_ret) {
         error("Failed to open sparse file: %s",
               open_ret.error().message().c_str());
@@ -396,45 +480,27 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
-    char buf[10240];
-    uint64_t cur_bytes = 0;
-    uint64_t max_bytes = sparse_file.size();
-    uint64_t old_bytes = 0;
-
-    set_progress(0);
-
-    while (true) {
-        auto n = sparse_file.read(buf, sizeof(buf));
-        if (!n) {
-            error("Failed to read sparse file %s: %s",
-                  zip_filename, n.error().message().c_str());
-            return ExtractResult::Error;
-        } else if (n.value() == 0) {
-            break;
-        }
-
-        // Rate limit: update progress only after difference exceeds 0.1%
-        double old_ratio = static_cast<double>(old_bytes) / max_bytes;
-        double new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
-            set_progress(new_ratio);
-            old_bytes = cur_bytes;
-        }
+    // Write straight to the device instead of filling up the page cache and
+    // stalling on close while it is flushed
+    if (!out_file.enable_direct_io()) {
+        info("%s: Not using direct I/O", out_filename);
+    }
 
-        char *out_ptr = buf;
+    uint64_t max_bytes = sparse_file.size();
 
-        while (n.value() > 0) {
-            auto n_written = out_file.write(buf, n.value());
-            if (!n_written) {
-                error("%s: Failed to write file: %s",
-                      out_filename, n_written.error().message().c_str());
-                return ExtractResult::Error;
-            }
+    progress_update(job, 0, max_bytes);
 
-            n.value() -= n_written.value();
-            out_ptr += n_written.value();
-            cur_bytes += n_written.value();
-        }
+    // Chunks without data are skipped or zeroed on the block device instead
+    // of being written out
+    auto copy_ret = mb::sparse::sparse_copy(
+            sparse_file, out_file, {},
+            [&](uint64_t cur_bytes, uint64_t) {
+        progress_update(job, cur_bytes, max_bytes);
+    });
+    if (!copy_ret) {
+        error("Failed to extract sparse file %s to %s: %s",
+              zip_filename, out_filename, copy_ret.error().message().c_str());
+        return ExtractResult::Error;
     }
 
     auto close_ret = out_file.close();
@@ -448,7 +514,9 @@ static ExtractResult extract_sparse_file(const char *zip_filename,
 }
 
 static ExtractResult extract_raw_file(const char *zip_filename,
-                                      const char *out_filename)
+                                      const char *out_filename,
+                                      size_t job,
+                                      bool skip_unchanged = false)
 {
     ScopedArchive a{archive_read_new(), &archive_read_free};
     char buf[10240];
@@ -456,9 +524,6 @@ static ExtractResult extract_raw_file(const char *zip_filename,
     int fd;
     uint64_t cur_bytes = 0;
     uint64_t max_bytes = 0;
-    uint64_t old_bytes = 0;
-    double old_ratio;
-    double new_ratio;
 
     if (!a) {
         error("Out of memory");
@@ -477,41 +542,59 @@ static ExtractResult extract_raw_file(const char *zip_filename,
 
     max_bytes = static_cast<uint64_t>(archive_entry_size(entry));
 
+    // When skipping unchanged blocks, the existing data must be kept for the
+    // comparison
     fd = open64(out_filename,
-                O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC | O_LARGEFILE, 0600);
+                O_CREAT | O_CLOEXEC | O_LARGEFILE
+                        | (skip_unchanged ? O_RDWR : O_TRUNC | O_WRONLY),
+                0600);
     if (fd < 0) {
         error("%s: Failed to open: %s", out_filename, strerror(errno));
         return ExtractResult::Error;
     }
 
-    auto close_fd = mb::finally([fd]{
-        close(fd);
-    });
+    // Keeps several writes to the block device in flight. The comparisons
+    // need synchronous reads, so a plain fd is used when skipping unchanged
+    // blocks.
+    mb::UringFile uring_file;
+    mb::FdFile fd_file;
+    mb::CompareWriteFile cw_file;
+    mb::File *out = &uring_file;
 
-    set_progress(0);
+    if (skip_unchanged) {
+        if (auto r = fd_file.open(fd, true); !r) {
+            error("%s: Failed to open: %s",
+                  out_filename, r.error().message().c_str());
+            return ExtractResult::Error;
+        }
+        if (auto r = cw_file.open(&fd_file); !r) {
+            error("%s: Failed to open: %s",
+                  out_filename, r.error().message().c_str());
+            return ExtractResult::Error;
+        }
+        out = &cw_file;
+    } else if (auto r = uring_file.open(fd, true); !r) {
+        error("%s: Failed to open: %s",
+              out_filename, r.error().message().c_str());
+        return ExtractResult::Error;
+    } else if (!uring_file.enable_direct_io()) {
+        info("%s: Not using direct I/O", out_filename);
+    }
+
+    progress_update(job, 0, max_bytes);
 
     while ((n = archive_read_data(a.get(), buf, sizeof(buf))) > 0) {
-        // Rate limit: update progress only after difference exceeds 0.1%
-        old_ratio = static_cast<double>(old_bytes) / max_bytes;
-        new_ratio = static_cast<double>(cur_bytes) / max_bytes;
-        if (new_ratio - old_ratio >= 0.001) {
-            set_progress(new_ratio);
-            old_bytes = cur_bytes;
+        auto write_ret = mb::file_write_exact(*out, buf,
+                                              static_cast<size_t>(n));
+        if (!write_ret) {
+            error("%s: Failed to write: %s",
+                  out_filename, write_ret.error().message().c_str());
+            return ExtractResult::Error;
         }
 
-        char *out_ptr = buf;
-        ssize_t nwritten;
+        cur_bytes += static_cast<uint64_t>(n);
 
-        do {
-            if ((nwritten = write(fd, out_ptr, static_cast<size_t>(n))) < 0) {
-                error("%s: Failed to write: %s",
-                      out_filename, strerror(errno));
-                return ExtractResult::Error;
-            }
-
-            n -= nwritten;
-            out_ptr += nwritten;
-        } while (n > 0);
+        progress_update(job, cur_bytes, max_bytes);
     }
     if (n != 0) {
         error("libarchive: %s: Failed to read %s: %s",
@@ -519,6 +602,25 @@ static ExtractResult extract_raw_file(const char *zip_filename,
         return ExtractResult::Error;
     }
 
+    // Queued or pending writes may fail when the file is closed
+    auto close_ret = out->close();
+    if (!close_ret) {
+        error("%s: Failed to close file: %s",
+              out_filename, close_ret.error().message().c_str());
+        return ExtractResult::Error;
+    }
+
+    if (skip_unchanged) {
+        if (auto r = fd_file.close(); !r) {
+            error("%s: Failed to close file: %s",
+                  out_filename, r.error().message().c_str());
+            return ExtractResult::Error;
+        }
+
+        info("%s: Wrote %" PRIu64 "/%" PRIu64 " changed blocks", out_filename,
+             cw_file.blocks_written(), cw_file.blocks_compared());
+    }
+
     return ExtractResult::Ok;
 }
 
@@ -684,7 +786,8 @@ static bool copy_dir_if_exists(const char *source_dir,
     auto ret = mb::util::copy_dir(source_dir, target_dir,
                                   mb::util::CopyFlag::CopyAttributes
                                 | mb::util::CopyFlag::CopyXattrs
-                                | mb::util::CopyFlag::ExcludeTopLevel);
+                                | mb::util::CopyFlag::ExcludeTopLevel
+                                | mb::util::CopyFlag::Parallel);
     if (!ret) {
         error("%s", ret.error().message().c_str());
     }
@@ -754,7 +857,17 @@ static bool apply_multi_csc()
     return true;
 }
 
-static bool flash_carrier_package_zip(const char *zip_path)
+// Entries are claimed in central directory order by the workers in
+// flash_carrier_package_zip(). Each worker opens the zip separately and seeks
+// over the entries that were claimed by the others.
+struct CarrierExtractState
+{
+    const char *zip_path;
+    std::atomic_size_t next_entry{0};
+    std::atomic_bool failed{false};
+};
+
+static bool extract_carrier_package_entries(CarrierExtractState &state)
 {
     ScopedArchive matcher{archive_match_new(), &archive_match_free};
     ScopedArchive in{archive_read_new(), &archive_read_free};
@@ -773,7 +886,11 @@ static bool flash_carrier_package_zip(const char *zip_path)
     }
 
     // Set up archive reader parameters
-    archive_read_support_format_zip(in.get());
+    if (archive_read_support_format_zip_seekable(in.get()) != ARCHIVE_OK) {
+        error("libarchive: Failed to enable zip support: %s",
+              archive_error_string(in.get()));
+        return false;
+    }
 
     // Set up disk writer parameters
     archive_write_disk_set_standard_lookup(out.get());
@@ -789,15 +906,17 @@ static bool flash_carrier_package_zip(const char *zip_path)
                                  | ARCHIVE_EXTRACT_MAC_METADATA
                                  | ARCHIVE_EXTRACT_SPARSE);
 
-    if (archive_read_open_filename(in.get(), zip_path, 10240)
+    if (archive_read_open_filename(in.get(), state.zip_path, 10240)
             != ARCHIVE_OK) {
         error("libarchive: %s: Failed to open file: %s",
-              zip_path, archive_error_string(in.get()));
+              state.zip_path, archive_error_string(in.get()));
         return false;
     }
 
     archive_entry *entry;
     int ret;
+    size_t index = 0;
+    size_t claimed = state.next_entry++;
 
     while (true) {
         ret = archive_read_next_header(in.get(), &entry);
@@ -807,13 +926,23 @@ static bool flash_carrier_package_zip(const char *zip_path)
             continue;
         } else if (ret != ARCHIVE_OK) {
             error("libarchive: %s: Failed to read header: %s",
-                  zip_path, archive_error_string(in.get()));
+                  state.zip_path, archive_error_string(in.get()));
+            return false;
+        }
+
+        if (state.failed) {
             return false;
         }
 
+        if (index++ != claimed) {
+            continue;
+        }
+        claimed = state.next_entry++;
+
         const char *path = archive_entry_pathname(entry);
         if (!path || !*path) {
-            error("libarchive: %s: Header has null or empty filename", path);
+            error("libarchive: %s: Header has null or empty filename",
+                  state.zip_path);
             return false;
         }
 
@@ -833,6 +962,8 @@ static bool flash_carrier_package_zip(const char *zip_path)
         }
     }
 
+    // Sets the deferred directory attributes of the entries extracted by this
+    // worker
     if (archive_write_close(out.get()) != ARCHIVE_OK) {
         error("libarchive: Failed to close disk writer: %s",
               archive_error_string(out.get()));
@@ -842,17 +973,41 @@ static bool flash_carrier_package_zip(const char *zip_path)
     return true;
 }
 
-static ExtractResult flash_carrier_package()
+static bool flash_carrier_package_zip(const char *zip_path)
 {
-    ExtractResult result;
+    CarrierExtractState state;
+    state.zip_path = zip_path;
 
-    result = extract_raw_file(CACHE_SPARSE_FILE, TEMP_CACHE_SPARSE_FILE);
-    if (result != ExtractResult::Ok) {
-        return result;
+    auto worker = [&] {
+        if (!extract_carrier_package_entries(state)) {
+            state.failed = true;
+        }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (size_t i = 1; i < MAX_FLASH_JOBS; ++i) {
+        threads.emplace_back(worker);
     }
+    worker();
 
-    result = extract_raw_file(FUSE_SPARSE_FILE, TEMP_FUSE_SPARSE_FILE);
-    if (result != ExtractResult::Ok) {
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    return !state.failed;
+}
+
+// The cache image and fuse-sparse binary are extracted along with the other
+// images by flash_zip()
+static ExtractResult flash_carrier_package(ExtractResult cache_result,
+                                           ExtractResult fuse_result)
+{
+    if (cache_result != ExtractResult::Ok) {
+        return cache_result;
+    }
+
+    if (fuse_result != ExtractResult::Ok) {
         return ExtractResult::Error;
     }
 
@@ -928,6 +1083,106 @@ static ExtractResult flash_carrier_package()
     return ExtractResult::Ok;
 }
 
+// Runs as a flash job once the system image, cache image, and fuse-sparse
+// binary have been extracted. The status messages are printed here because
+// the remaining flash jobs may still be running.
+static ExtractResult post_process_system(ExtractResult system_result,
+                                         ExtractResult cache_result,
+                                         ExtractResult fuse_result)
+{
+    if (system_result == ExtractResult::Error) {
+        return ExtractResult::Error;
+    }
+
+    // Kill RLC (remote lock control) as early as possible so the bootloader
+    // doesn't get relocked if the user decides to reboot into a partially
+    // flashed ROM
+    ui_print("Removing RLC (if present)");
+    if (!kill_rlc()) {
+        ui_print("--- WARNING WARNING WARNING ---");
+        ui_print("FAILED TO FULLY DISABLE RLC");
+        ui_print("YOUR BOOTLOADER MIGHT GET RELOCKED IF YOU REBOOT");
+        ui_print("--- WARNING WARNING WARNING ---");
+        return ExtractResult::Error;
+    }
+
+    // Flash carrier package from cache.img.ext4
+    ui_print("Flashing carrier package from cache image");
+    switch (flash_carrier_package(cache_result, fuse_result)) {
+    case ExtractResult::Error:
+        ui_print("Failed to flash carrier package");
+        return ExtractResult::Error;
+    case ExtractResult::Missing:
+        ui_print("[WARNING] Cache image not found. Won't flash carrier package");
+        break;
+    case ExtractResult::Ok:
+        ui_print("Successfully flashed carrier package");
+        break;
+    }
+
+    return ExtractResult::Ok;
+}
+
+struct FlashJob
+{
+    std::function<ExtractResult(size_t job,
+                                const std::vector<ExtractResult> &results)> run;
+    // Earlier jobs that must finish before this job starts. Their results are
+    // passed to the job.
+    std::vector<size_t> deps = {};
+};
+
+// Run the jobs on up to MAX_FLASH_JOBS threads. Jobs are started in order and
+// a job only waits for the earlier jobs it depends on, so the other jobs keep
+// running in the meantime. The results are in the same order as the jobs.
+static std::vector<ExtractResult>
+run_flash_jobs(const std::vector<FlashJob> &jobs)
+{
+    std::vector<ExtractResult> results(jobs.size(), ExtractResult::Error);
+    std::vector<bool> done(jobs.size());
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    std::atomic_size_t next_job{0};
+
+    progress_reset(jobs.size());
+
+    auto worker = [&] {
+        for (size_t i; (i = next_job++) < jobs.size();) {
+            {
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done_cv.wait(lock, [&] {
+                    return std::all_of(jobs[i].deps.begin(),
+                                       jobs[i].deps.end(),
+                                       [&](size_t dep) { return done[dep]; });
+                });
+            }
+
+            auto result = jobs[i].run(i, results);
+
+            {
+                std::lock_guard<std::mutex> lock(done_mutex);
+                results[i] = result;
+                done[i] = true;
+            }
+            done_cv.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t n_threads = std::min<size_t>(MAX_FLASH_JOBS, jobs.size());
+
+    for (size_t i = 1; i < n_threads; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    return results;
+}
+
 static bool flash_zip()
 {
     struct stat sb;
@@ -959,12 +1214,33 @@ static bool flash_zip()
         return false;
     }
 
-    ExtractResult result;
+    // Flash system.img.ext4 and boot.img while extracting the files needed for
+    // flashing the carrier package. The carrier package is applied to the new
+    // system partition while the boot image may still be flashing.
+    ui_print("Flashing system and boot images");
+    auto results = run_flash_jobs({
+        {[](size_t job, auto &) {
+            return extract_sparse_file(SYSTEM_SPARSE_FILE,
+                                       system_block_dev.c_str(), job);
+        }},
+        {[](size_t job, auto &) {
+            return extract_raw_file(CACHE_SPARSE_FILE, TEMP_CACHE_SPARSE_FILE,
+                                    job);
+        }},
+        {[](size_t job, auto &) {
+            return extract_raw_file(FUSE_SPARSE_FILE, TEMP_FUSE_SPARSE_FILE,
+                                    job);
+        }},
+        {[](size_t job, auto &) {
+            return extract_raw_file(BOOT_IMAGE_FILE, boot_block_dev.c_str(),
+                                    job, true);
+        }},
+        {[](size_t, auto &r) {
+            return post_process_system(r[0], r[1], r[2]);
+        }, {0, 1, 2}},
+    });
 
-    // Flash system.img.ext4
-    ui_print("Flashing system image");
-    result = extract_sparse_file(SYSTEM_SPARSE_FILE, system_block_dev.c_str());
-    switch (result) {
+    switch (results[0]) {
     case ExtractResult::Error:
         ui_print("Failed to flash system image");
         return false;
@@ -976,41 +1252,15 @@ static bool flash_zip()
         break;
     }
 
-    // Kill RLC (remote lock control) as early as possible so the bootloader
-    // doesn't get relocked if the user decides to reboot into a partially
-    // flashed ROM
-    ui_print("Removing RLC (if present)");
-    if (!kill_rlc()) {
-        ui_print("--- WARNING WARNING WARNING ---");
-        ui_print("FAILED TO FULLY DISABLE RLC");
-        ui_print("YOUR BOOTLOADER MIGHT GET RELOCKED IF YOU REBOOT");
-        ui_print("--- WARNING WARNING WARNING ---");
-        return false;
-    }
-
-    // Flash carrier package from cache.img.ext4
-    ui_print("Flashing carrier package from cache image");
-    result = flash_carrier_package();
-    switch (result) {
-    case ExtractResult::Error:
-        ui_print("Failed to flash carrier package");
+    if (results[3] != ExtractResult::Ok) {
+        ui_print("Failed to flash boot image");
         return false;
-    case ExtractResult::Missing:
-        ui_print("[WARNING] Cache image not found. Won't flash carrier package");
-        break;
-    case ExtractResult::Ok:
-        ui_print("Successfully flashed carrier package");
-        break;
     }
+    ui_print("Successfully flashed boot image");
 
-    // Flash boot.img
-    ui_print("Flashing boot image");
-    result = extract_raw_file(BOOT_IMAGE_FILE, boot_block_dev.c_str());
-    if (result != ExtractResult::Ok) {
-        ui_print("Failed to flash boot image");
+    if (results[4] != ExtractResult::Ok) {
         return false;
     }
-    ui_print("Successfully flashed boot image");
 
     ui_print("---");
     ui_print("Flashing completed. The bootloader");
@@ -14,15 +14,19 @@ files=(
     v3/file_selinux_set_label.fbs
     v3/file_stat.fbs
     v3/file_write.fbs
+    v3/job.fbs
     v3/mb_get_booted_rom_id.fbs
     v3/mb_get_installed_roms.fbs
     v3/mb_get_packages_count.fbs
+    v3/mb_get_stats.fbs
     v3/mb_get_version.fbs
     v3/mb_set_kernel.fbs
     v3/mb_switch_rom.fbs
+    v3/mb_watch_roms.fbs
     v3/mb_wipe_rom.fbs
     v3/path_chmod.fbs
     v3/path_copy.fbs
+    v3/path_copy_tree.fbs
     v3/path_delete.fbs
     v3/path_get_directory_size.fbs
     v3/path_mkdir.fbs
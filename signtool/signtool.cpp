@@ -17,19 +17,28 @@
  * along with DualBootPatcher.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <vector>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <getopt.h>
+
 #include <openssl/err.h>
 
+// libmbcommon
+#include "mbcommon/executor.h"
+#include "mbcommon/file/mmap.h"
+#include "mbcommon/file/standard.h"
+#include "mbcommon/integer.h"
+
 // libmbsign
 #include "mbsign/sign.h"
 
-using ScopedBIO = std::unique_ptr<BIO, decltype(BIO_free) *>;
-
 static void openssl_log_errors()
 {
     ERR_print_errors_fp(stderr);
@@ -38,24 +47,116 @@ static void openssl_log_errors()
 static void usage(FILE *stream)
 {
     fprintf(stream,
-            "Usage: signtool <PKCS12 file> <input file> <output signature file>\n\n"
+            "Usage: signtool [option...] <PKCS12 file>\n"
+            "                <input file> <output signature file>"
+            " [<input file> <output signature file>]...\n\n"
+            "Options:\n"
+            "  -j, --jobs <N>   Number of files to sign in parallel\n"
+            "                   (default: number of CPUs)\n"
+            "  -h, --help       Display this help message\n\n"
             "NOTE: This is not a general purpose tool for signing files!\n"
             "It is only meant for use with mbtool.\n");
 }
 
+static bool sign_file(const char *file_input, const char *file_output,
+                      EVP_PKEY &private_key)
+{
+    // Map the input if possible so it can be digested without copying
+    std::unique_ptr<mb::File> data_in;
+    {
+        auto mmap_file = std::make_unique<mb::MmapFile>();
+        if (mmap_file->open(file_input)) {
+            data_in = std::move(mmap_file);
+        } else {
+            auto file = std::make_unique<mb::StandardFile>();
+            if (auto r = file->open(file_input, mb::FileOpenMode::ReadOnly);
+                    !r) {
+                fprintf(stderr, "%s: Failed to open input file: %s\n",
+                        file_input, r.error().message().c_str());
+                return false;
+            }
+            data_in = std::move(file);
+        }
+    }
+
+    mb::StandardFile sig_out;
+    if (auto r = sig_out.open(file_output, mb::FileOpenMode::WriteOnly); !r) {
+        fprintf(stderr, "%s: Failed to open output file: %s\n",
+                file_output, r.error().message().c_str());
+        return false;
+    }
+
+    if (auto ret = mb::sign::sign_data(*data_in, sig_out, private_key); !ret) {
+        fprintf(stderr, "%s: Failed to sign data: %s\n",
+                file_input, ret.error().ec.message().c_str());
+        if (ret.error().has_openssl_error) {
+            openssl_log_errors();
+        }
+        return false;
+    }
+
+    if (auto r = data_in->close(); !r) {
+        fprintf(stderr, "%s: Failed to close input file: %s\n",
+                file_input, r.error().message().c_str());
+        return false;
+    }
+
+    if (auto r = sig_out.close(); !r) {
+        fprintf(stderr, "%s: Failed to close output file: %s\n",
+                file_output, r.error().message().c_str());
+        return false;
+    }
+
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
     ERR_load_crypto_strings();
     OpenSSL_add_all_algorithms();
 
-    if (argc != 4) {
+    int opt;
+
+    static const char short_options[] = "j:h";
+
+    static struct option long_options[] = {
+        {"jobs", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int long_index = 0;
+    unsigned int jobs = mb::Executor::global().concurrency();
+
+    while ((opt = getopt_long(argc, argv, short_options,
+                              long_options, &long_index)) != -1) {
+        switch (opt) {
+        case 'j':
+            if (!mb::str_to_num(optarg, 10, jobs) || jobs == 0) {
+                fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 'h':
+            usage(stdout);
+            return EXIT_SUCCESS;
+
+        default:
+            usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // PKCS12 file followed by (input, output) pairs
+    if (argc - optind < 3 || (argc - optind - 1) % 2 != 0) {
         usage(stderr);
         return EXIT_FAILURE;
     }
 
-    const char *file_pkcs12 = argv[1];
-    const char *file_input = argv[2];
-    const char *file_output = argv[3];
+    const char *file_pkcs12 = argv[optind];
+    char **files = argv + optind + 1;
+    size_t n_files = static_cast<size_t>(argc - optind - 1) / 2;
 
     const char *pass = getenv("MBSIGN_PASSPHRASE");
     if (!pass) {
@@ -70,40 +171,14 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    ScopedBIO bio_data_in(BIO_new_file(file_input, "rb"), BIO_free);
-    if (!bio_data_in) {
-        fprintf(stderr, "%s: Failed to open input file\n", file_input);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
-    ScopedBIO bio_sig_out(BIO_new_file(file_output, "wb"), BIO_free);
-    if (!bio_sig_out) {
-        fprintf(stderr, "%s: Failed to open output file\n", file_output);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
+    std::atomic_bool failed{false};
 
-    if (auto ret = mb::sign::sign_data(
-            *bio_data_in, *bio_sig_out, *private_key.value()); !ret) {
-        fprintf(stderr, "Failed to sign data: %s\n",
-                ret.error().ec.message().c_str());
-        if (ret.error().has_openssl_error) {
-            openssl_log_errors();
+    mb::parallel_for(n_files, [&](size_t i) {
+        if (!sign_file(files[i * 2], files[i * 2 + 1],
+                       *private_key.value())) {
+            failed = true;
         }
-        return EXIT_FAILURE;
-    }
-
-    if (!BIO_free(bio_data_in.release())) {
-        fprintf(stderr, "%s: Failed to close input file\n", file_input);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
-
-    if (!BIO_free(bio_sig_out.release())) {
-        fprintf(stderr, "%s: Failed to close output file\n", file_output);
-        openssl_log_errors();
-        return EXIT_FAILURE;
-    }
+    }, jobs);
 
-    return EXIT_SUCCESS;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }